@@ -0,0 +1,58 @@
+#!/bin/bash
+
+# time XYZ <-> Lab, with and without the SIMD kernels
+
+uname -a
+vips --version
+
+# sample2.v is 290x442 pixels ... replicate this many times horizontally and
+# vertically to get a highres image for the benchmark
+tile=20
+
+echo building test image ...
+echo "tile=$tile"
+vips replicate sample2.v temp.v $tile $tile
+if [ $? != 0 ]; then
+  echo "build of test image failed -- out of disc space?"
+  exit 1
+fi
+vips colourspace temp.v temp-xyz.v xyz
+vips colourspace temp.v temp-lab.v lab
+echo -n "test image is" `vipsheader -f width temp.v`
+echo " by" `vipsheader -f height temp.v` "pixels"
+
+# best of three runs of a command
+best() {
+  t1=`/usr/bin/time -f %e "$@" 2>&1`
+  if [ $? != 0 ]; then
+    echo "benchmark failed -- install problem?"
+    exit 1
+  fi
+  t2=`/usr/bin/time -f %e "$@" 2>&1`
+  t3=`/usr/bin/time -f %e "$@" 2>&1`
+
+  if [[ $t2 < $t1 ]]; then
+	  t1=$t2
+  fi
+  if [[ $t3 < $t1 ]]; then
+	  t1=$t3
+  fi
+  echo $t1
+}
+
+echo reported real-time is best of three runs
+echo operation simd nosimd
+
+for op in XYZ2Lab Lab2XYZ; do
+  if [ $op == XYZ2Lab ]; then
+    in=temp-xyz.v
+  else
+    in=temp-lab.v
+  fi
+
+  t1=`best vips --vips-concurrency=1 $op $in temp2.v`
+  t2=`best vips --vips-concurrency=1 --vips-nosimd $op $in temp2.v`
+  echo $op $t1 $t2
+done
+
+rm -f temp.v temp-xyz.v temp-lab.v temp2.v
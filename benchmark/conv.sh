@@ -0,0 +1,57 @@
+#!/bin/bash
+
+# time a large vips_conv() on wide images, with and without column strips
+
+uname -a
+vips --version
+
+# a float mask about 17 pixels across, so each output line needs a tall band
+# of input lines
+vips gaussmat temp-mask.mat 3 0.05 --precision float
+
+# sample2.v is 290x442 pixels ... replicate horizontally to get wide images
+widths="14 55 104"
+
+# best of three runs of a command
+best() {
+  t1=`/usr/bin/time -f %e "$@" 2>&1`
+  if [ $? != 0 ]; then
+    echo "benchmark failed -- install problem?"
+    exit 1
+  fi
+  t2=`/usr/bin/time -f %e "$@" 2>&1`
+  t3=`/usr/bin/time -f %e "$@" 2>&1`
+
+  if [[ $t2 < $t1 ]]; then
+	  t1=$t2
+  fi
+  if [[ $t3 < $t1 ]]; then
+	  t1=$t3
+  fi
+  echo $t1
+}
+
+echo reported real-time is best of three runs
+echo tiles are a full image width across, so each region is very wide
+echo width precision strips nostrips
+
+for across in $widths; do
+  echo building test image ...
+  vips replicate sample2.v temp.v $across 4
+  if [ $? != 0 ]; then
+    echo "build of test image failed -- out of disc space?"
+    exit 1
+  fi
+  width=`vipsheader -f width temp.v`
+
+  for precision in integer float; do
+    opts="--vips-concurrency=1 --vips-tile-width=$width --vips-tile-height=16"
+    t1=`best vips $opts conv temp.v temp2.v temp-mask.mat \
+      --precision $precision`
+    t2=`best vips $opts --vips-conv-block=0 conv temp.v temp2.v temp-mask.mat \
+      --precision $precision`
+    echo $width $precision $t1 $t2
+  done
+done
+
+rm -f temp.v temp2.v temp-mask.mat
@@ -0,0 +1,625 @@
+/* time hot operations across formats, bands, sizes and thread counts
+ *
+ * 14/10/18
+ * 	- first version
+ */
+
+/*
+
+    This file is part of VIPS.
+
+    VIPS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA
+
+ */
+
+/*
+
+    These files are distributed with VIPS - http://www.vips.ecs.soton.ac.uk
+
+ */
+
+/* Each result is printed to stdout as a line of JSON, for example:
+ *
+ * 	{"name": "reduceh", "format": "uchar", "bands": 3, "size": 2048,
+ * 	 "threads": 4, "mpix_per_sec": 312.5, "allocs": 40,
+ * 	 "peak_mem": 1572864}
+ *
+ * all on one line. Save a run, then use --compare to check a later build
+ * against it. Regressions are listed on stderr and the exit code is 1.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /*HAVE_CONFIG_H*/
+#include <vips/intl.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <locale.h>
+
+#include <vips/vips.h>
+
+static char *main_option_filter = NULL;
+static char *main_option_sizes = "512,2048";
+static char *main_option_threads = NULL;
+static int main_option_repeat = 5;
+static char *main_option_compare = NULL;
+static double main_option_threshold = 10.0;
+
+static GOptionEntry main_option[] = {
+	{ "filter", 'f', 0, G_OPTION_ARG_STRING, &main_option_filter,
+		N_( "only run benchmarks whose name contains FILTER" ),
+		"FILTER" },
+	{ "sizes", 's', 0, G_OPTION_ARG_STRING, &main_option_sizes,
+		N_( "comma-separated list of image sizes" ), "SIZES" },
+	{ "threads", 't', 0, G_OPTION_ARG_STRING, &main_option_threads,
+		N_( "comma-separated list of thread counts" ), "THREADS" },
+	{ "repeat", 'r', 0, G_OPTION_ARG_INT, &main_option_repeat,
+		N_( "time the best of N runs" ), "N" },
+	{ "compare", 'c', 0, G_OPTION_ARG_FILENAME, &main_option_compare,
+		N_( "compare against results saved in FILE" ), "FILE" },
+	{ "threshold", 'p', 0, G_OPTION_ARG_DOUBLE, &main_option_threshold,
+		N_( "report slowdowns of more than PERCENT" ), "PERCENT" },
+	{ NULL }
+};
+
+/* State for one benchmark run. in is the source image, buf and len hold
+ * an encoded version of it for the loaders.
+ */
+typedef struct _Bench {
+	VipsImage *in;
+	void *buf;
+	size_t len;
+} Bench;
+
+typedef int (*BenchFn)( Bench *bench );
+
+/* We don't want the cost of writing anywhere, so we just compute the pixels
+ * and throw them away.
+ */
+static int
+bench_sink_gen( VipsRegion *region,
+	void *seq, void *a, void *b, gboolean *stop )
+{
+	return( 0 );
+}
+
+static int
+bench_sink( VipsImage *image )
+{
+	int result;
+
+	result = vips_sink( image, NULL, bench_sink_gen, NULL, NULL, NULL );
+	g_object_unref( image );
+
+	return( result );
+}
+
+static int
+bench_reduceh( Bench *bench )
+{
+	VipsImage *t;
+
+	if( vips_reduceh( bench->in, &t, 2.5, NULL ) )
+		return( -1 );
+
+	return( bench_sink( t ) );
+}
+
+static int
+bench_reducev( Bench *bench )
+{
+	VipsImage *t;
+
+	if( vips_reducev( bench->in, &t, 2.5, NULL ) )
+		return( -1 );
+
+	return( bench_sink( t ) );
+}
+
+static int
+bench_conv( Bench *bench )
+{
+	VipsImage *mask;
+	VipsImage *t;
+
+	if( vips_gaussmat( &mask, 2.0, 0.1, NULL ) )
+		return( -1 );
+	if( vips_conv( bench->in, &t, mask, NULL ) ) {
+		g_object_unref( mask );
+		return( -1 );
+	}
+	g_object_unref( mask );
+
+	return( bench_sink( t ) );
+}
+
+static int
+bench_composite( Bench *bench )
+{
+	VipsImage *t;
+
+	if( vips_composite2( bench->in, bench->in, &t,
+		VIPS_BLEND_MODE_OVER, NULL ) )
+		return( -1 );
+
+	return( bench_sink( t ) );
+}
+
+static int
+bench_colourspace( Bench *bench )
+{
+	VipsImage *t1;
+	VipsImage *t2;
+
+	if( vips_copy( bench->in, &t1,
+		"interpretation", VIPS_INTERPRETATION_sRGB,
+		NULL ) )
+		return( -1 );
+	if( vips_colourspace( t1, &t2, VIPS_INTERPRETATION_LAB, NULL ) ) {
+		g_object_unref( t1 );
+		return( -1 );
+	}
+	g_object_unref( t1 );
+
+	return( bench_sink( t2 ) );
+}
+
+static int
+bench_jpegload_setup( Bench *bench )
+{
+	return( vips_jpegsave_buffer( bench->in,
+		&bench->buf, &bench->len, NULL ) );
+}
+
+static int
+bench_jpegload( Bench *bench )
+{
+	VipsImage *t;
+
+	if( vips_jpegload_buffer( bench->buf, bench->len, &t, NULL ) )
+		return( -1 );
+
+	return( bench_sink( t ) );
+}
+
+static int
+bench_jpegsave( Bench *bench )
+{
+	void *buf;
+	size_t len;
+
+	if( vips_jpegsave_buffer( bench->in, &buf, &len, NULL ) )
+		return( -1 );
+	g_free( buf );
+
+	return( 0 );
+}
+
+static int
+bench_pngsave( Bench *bench )
+{
+	void *buf;
+	size_t len;
+
+	if( vips_pngsave_buffer( bench->in, &buf, &len, NULL ) )
+		return( -1 );
+	g_free( buf );
+
+	return( 0 );
+}
+
+static int
+bench_tiffsave( Bench *bench )
+{
+	void *buf;
+	size_t len;
+
+	if( vips_tiffsave_buffer( bench->in, &buf, &len,
+		"tile", TRUE,
+		"compression", VIPS_FOREIGN_TIFF_COMPRESSION_LZW,
+		NULL ) )
+		return( -1 );
+	g_free( buf );
+
+	return( 0 );
+}
+
+static int
+bench_thumbnail( Bench *bench )
+{
+	VipsImage *t;
+
+	if( vips_thumbnail_buffer( bench->buf, bench->len, &t, 256, NULL ) )
+		return( -1 );
+
+	return( bench_sink( t ) );
+}
+
+/* The benchmarks, and the formats and band counts we run each one on. Lists
+ * end with -1.
+ */
+typedef struct _BenchCase {
+	const char *name;
+	BenchFn setup;
+	BenchFn fn;
+	VipsBandFormat format[4];
+	int bands[4];
+} BenchCase;
+
+static BenchCase bench_cases[] = {
+	{ "reduceh", NULL, bench_reduceh,
+		{ VIPS_FORMAT_UCHAR, VIPS_FORMAT_USHORT, VIPS_FORMAT_FLOAT, -1 },
+		{ 1, 3, 4, -1 } },
+	{ "reducev", NULL, bench_reducev,
+		{ VIPS_FORMAT_UCHAR, VIPS_FORMAT_USHORT, VIPS_FORMAT_FLOAT, -1 },
+		{ 1, 3, 4, -1 } },
+	{ "conv", NULL, bench_conv,
+		{ VIPS_FORMAT_UCHAR, VIPS_FORMAT_USHORT, VIPS_FORMAT_FLOAT, -1 },
+		{ 1, 3, -1 } },
+	{ "composite", NULL, bench_composite,
+		{ VIPS_FORMAT_UCHAR, VIPS_FORMAT_USHORT, VIPS_FORMAT_FLOAT, -1 },
+		{ 4, -1 } },
+	{ "colourspace", NULL, bench_colourspace,
+		{ VIPS_FORMAT_UCHAR, VIPS_FORMAT_FLOAT, -1 },
+		{ 3, -1 } },
+	{ "jpegload", bench_jpegload_setup, bench_jpegload,
+		{ VIPS_FORMAT_UCHAR, -1 },
+		{ 1, 3, -1 } },
+	{ "jpegsave", NULL, bench_jpegsave,
+		{ VIPS_FORMAT_UCHAR, -1 },
+		{ 1, 3, -1 } },
+	{ "pngsave", NULL, bench_pngsave,
+		{ VIPS_FORMAT_UCHAR, VIPS_FORMAT_USHORT, -1 },
+		{ 1, 3, 4, -1 } },
+	{ "tiffsave", NULL, bench_tiffsave,
+		{ VIPS_FORMAT_UCHAR, VIPS_FORMAT_USHORT, VIPS_FORMAT_FLOAT, -1 },
+		{ 1, 3, -1 } },
+	{ "thumbnail", bench_jpegload_setup, bench_thumbnail,
+		{ VIPS_FORMAT_UCHAR, -1 },
+		{ 3, -1 } }
+};
+
+/* A noisy test image in memory, so the benchmarks only time the operation.
+ * Noise stops the encoders taking shortcuts.
+ */
+static VipsImage *
+bench_image( int size, VipsBandFormat format, int bands )
+{
+	VipsImage *band[4];
+	VipsImage *t[3];
+	VipsImage *image;
+	int i;
+
+	g_assert( bands <= 4 );
+
+	for( i = 0; i < bands; i++ )
+		if( vips_gaussnoise( &band[i], size, size,
+			"mean", 128.0,
+			"sigma", 40.0,
+			NULL ) ) {
+			while( --i >= 0 )
+				g_object_unref( band[i] );
+			return( NULL );
+		}
+	i = vips_bandjoin( band, &t[0], bands, NULL );
+	while( --bands >= 0 )
+		g_object_unref( band[bands] );
+	if( i )
+		return( NULL );
+
+	/* Scale to the range of ushort.
+	 */
+	if( vips_linear1( t[0], &t[1],
+		format == VIPS_FORMAT_USHORT ? 256.0 : 1.0, 0.0, NULL ) ) {
+		g_object_unref( t[0] );
+		return( NULL );
+	}
+	g_object_unref( t[0] );
+
+	if( vips_cast( t[1], &t[2], format, NULL ) ) {
+		g_object_unref( t[1] );
+		return( NULL );
+	}
+	g_object_unref( t[1] );
+
+	image = vips_image_copy_memory( t[2] );
+	g_object_unref( t[2] );
+
+	return( image );
+}
+
+/* A result, as printed or as read back from a saved run.
+ */
+typedef struct _BenchResult {
+	char name[64];
+	char format[16];
+	int bands;
+	int size;
+	int threads;
+	double mpix_per_sec;
+	guint64 allocs;
+	size_t peak_mem;
+} BenchResult;
+
+static void
+bench_result_print( BenchResult *result )
+{
+	printf( "{\"name\": \"%s\", \"format\": \"%s\", \"bands\": %d, "
+		"\"size\": %d, \"threads\": %d, \"mpix_per_sec\": %g, "
+		"\"allocs\": %" G_GUINT64_FORMAT ", \"peak_mem\": %zd}\n",
+		result->name, result->format, result->bands,
+		result->size, result->threads, result->mpix_per_sec,
+		result->allocs, result->peak_mem );
+	fflush( stdout );
+}
+
+/* Read the results from a previous run. We only need to parse our own
+ * output, so sscanf() is enough.
+ */
+static GSList *
+bench_result_load( const char *filename )
+{
+	FILE *fp;
+	char line[1024];
+	GSList *results;
+
+	if( !(fp = fopen( filename, "r" )) ) {
+		vips_error_system( errno, "vipsbench",
+			_( "unable to open \"%s\"" ), filename );
+		return( NULL );
+	}
+
+	results = NULL;
+	while( fgets( line, sizeof( line ), fp ) ) {
+		BenchResult *result = g_new0( BenchResult, 1 );
+
+		if( sscanf( line, "{\"name\": \"%63[^\"]\", "
+			"\"format\": \"%15[^\"]\", \"bands\": %d, "
+			"\"size\": %d, \"threads\": %d, "
+			"\"mpix_per_sec\": %lg",
+			result->name, result->format, &result->bands,
+			&result->size, &result->threads,
+			&result->mpix_per_sec ) == 6 )
+			results = g_slist_prepend( results, result );
+		else
+			g_free( result );
+	}
+
+	fclose( fp );
+
+	return( g_slist_reverse( results ) );
+}
+
+static BenchResult *
+bench_result_find( GSList *results, BenchResult *result )
+{
+	GSList *p;
+
+	for( p = results; p; p = p->next ) {
+		BenchResult *old = (BenchResult *) p->data;
+
+		if( strcmp( old->name, result->name ) == 0 &&
+			strcmp( old->format, result->format ) == 0 &&
+			old->bands == result->bands &&
+			old->size == result->size &&
+			old->threads == result->threads )
+			return( old );
+	}
+
+	return( NULL );
+}
+
+/* Run one benchmark on one image with one thread count.
+ */
+static int
+bench_run( BenchCase *bcase, Bench *bench, int threads,
+	BenchResult *result )
+{
+	GTimer *timer;
+	double best;
+	size_t mem;
+	guint64 allocs;
+	int i;
+
+	vips_concurrency_set( threads );
+
+	/* Once to warm up.
+	 */
+	if( bcase->fn( bench ) )
+		return( -1 );
+
+	timer = g_timer_new();
+	best = -1;
+	mem = vips_tracked_get_mem();
+	allocs = vips_tracked_get_allocs_total();
+	vips_tracked_reset_highwater();
+
+	for( i = 0; i < main_option_repeat; i++ ) {
+		double elapsed;
+
+		g_timer_start( timer );
+		if( bcase->fn( bench ) ) {
+			g_timer_destroy( timer );
+			return( -1 );
+		}
+		elapsed = g_timer_elapsed( timer, NULL );
+
+		if( best < 0 ||
+			elapsed < best )
+			best = elapsed;
+	}
+
+	g_timer_destroy( timer );
+
+	vips_strncpy( result->name, bcase->name, 64 );
+	vips_strncpy( result->format,
+		vips_enum_nick( VIPS_TYPE_BAND_FORMAT, bench->in->BandFmt ),
+		16 );
+	result->bands = bench->in->Bands;
+	result->size = bench->in->Xsize;
+	result->threads = threads;
+	result->mpix_per_sec = (double) bench->in->Xsize * bench->in->Ysize /
+		(1000000.0 * VIPS_MAX( best, 1e-9 ));
+	result->allocs = (vips_tracked_get_allocs_total() - allocs) /
+		VIPS_MAX( 1, main_option_repeat );
+	result->peak_mem = vips_tracked_get_mem_highwater() - mem;
+
+	return( 0 );
+}
+
+/* Parse a comma-separated list of positive ints.
+ */
+static int *
+bench_parse_list( const char *str, int *n )
+{
+	char **item;
+	int *list;
+	int i;
+
+	item = g_strsplit( str, ",", -1 );
+	*n = g_strv_length( item );
+	list = g_new( int, VIPS_MAX( 1, *n ) );
+	for( i = 0; i < *n; i++ )
+		list[i] = VIPS_MAX( 1, atoi( item[i] ) );
+	g_strfreev( item );
+
+	return( list );
+}
+
+int
+main( int argc, char *argv[] )
+{
+	GOptionContext *context;
+	GOptionGroup *main_group;
+	GError *error = NULL;
+	char default_threads[256];
+	GSList *baseline;
+	int *sizes;
+	int n_sizes;
+	int *threads;
+	int n_threads;
+	int n_regressions;
+	int i, j, k, l, m;
+
+	if( VIPS_INIT( argv[0] ) )
+	        vips_error_exit( "unable to start VIPS" );
+	textdomain( GETTEXT_PACKAGE );
+	setlocale( LC_ALL, "" );
+
+        context = g_option_context_new( _( "- benchmark vips operations" ) );
+	main_group = g_option_group_new( NULL, NULL, NULL, NULL, NULL );
+	g_option_group_add_entries( main_group, main_option );
+	vips_add_option_entries( main_group );
+	g_option_group_set_translation_domain( main_group, GETTEXT_PACKAGE );
+	g_option_context_set_main_group( context, main_group );
+
+	if( !g_option_context_parse( context, &argc, &argv, &error ) ) {
+		if( error ) {
+			fprintf( stderr, "%s\n", error->message );
+			g_error_free( error );
+		}
+
+		vips_error_exit( "try \"%s --help\"", g_get_prgname() );
+	}
+
+	g_option_context_free( context );
+
+	/* Cached results would make repeat runs free.
+	 */
+	vips_cache_set_max( 0 );
+
+	baseline = NULL;
+	if( main_option_compare &&
+		!(baseline = bench_result_load( main_option_compare )) )
+		vips_error_exit( NULL );
+
+	/* Default to one thread and all threads.
+	 */
+	if( !main_option_threads ) {
+		vips_snprintf( default_threads, 256,
+			"1,%d", vips_concurrency_get() );
+		main_option_threads = default_threads;
+	}
+
+	sizes = bench_parse_list( main_option_sizes, &n_sizes );
+	threads = bench_parse_list( main_option_threads, &n_threads );
+	n_regressions = 0;
+
+	for( i = 0; i < VIPS_NUMBER( bench_cases ); i++ ) {
+		BenchCase *bcase = &bench_cases[i];
+
+		if( main_option_filter &&
+			!strstr( bcase->name, main_option_filter ) )
+			continue;
+
+		for( j = 0; bcase->format[j] != -1; j++ )
+			for( k = 0; bcase->bands[k] != -1; k++ )
+				for( l = 0; l < n_sizes; l++ ) {
+			Bench bench = { 0 };
+
+			if( !(bench.in = bench_image( sizes[l],
+				bcase->format[j], bcase->bands[k] )) ||
+				(bcase->setup &&
+				 bcase->setup( &bench )) )
+				vips_error_exit( NULL );
+
+			for( m = 0; m < n_threads; m++ ) {
+				BenchResult result;
+				BenchResult *old;
+
+				if( bench_run( bcase, &bench, threads[m],
+					&result ) )
+					vips_error_exit( NULL );
+				bench_result_print( &result );
+
+				if( baseline &&
+					(old = bench_result_find( baseline,
+						&result )) &&
+					result.mpix_per_sec <
+						old->mpix_per_sec *
+						(1.0 - main_option_threshold /
+						 100.0) ) {
+					fprintf( stderr, "%s %s %d bands "
+						"%d pixels %d threads: "
+						"%g Mpix/s, was %g\n",
+						result.name, result.format,
+						result.bands, result.size,
+						result.threads,
+						result.mpix_per_sec,
+						old->mpix_per_sec );
+					n_regressions += 1;
+				}
+			}
+
+			VIPS_UNREF( bench.in );
+			VIPS_FREE( bench.buf );
+		}
+	}
+
+	g_free( sizes );
+	g_free( threads );
+	g_slist_free_full( baseline, g_free );
+
+	if( n_regressions )
+		fprintf( stderr, "%d regressions\n", n_regressions );
+
+	vips_shutdown();
+
+	return( n_regressions ? 1 : 0 );
+}
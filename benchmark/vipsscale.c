@@ -0,0 +1,460 @@
+/* measure how vips scales with the number of threads
+ *
+ * 14/10/18
+ * 	- first version
+ */
+
+/*
+
+    This file is part of VIPS.
+
+    VIPS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA
+
+ */
+
+/*
+
+    These files are distributed with VIPS - http://www.vips.ecs.soton.ac.uk
+
+ */
+
+/* Each case is run at 1, 2, 4 ... up to --max-threads threads. For each run
+ * we print the time, the speedup and parallel efficiency relative to one
+ * thread, and the time spent waiting on the threadpool allocate lock and the
+ * operation cache locks and in vips_buffer_unref_ref() (see
+ * vips_gate_stats_set()).
+ *
+ * By default the output is a table with an efficiency bar for each run. Use
+ * --json to get one JSON object per line instead, handy for plotting.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /*HAVE_CONFIG_H*/
+#include <vips/intl.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <locale.h>
+
+#include <vips/vips.h>
+
+static char *main_option_filter = NULL;
+static int main_option_max_threads = 0;
+static int main_option_size = 4096;
+static int main_option_units = 20000;
+static int main_option_work = 2000;
+static int main_option_repeat = 3;
+static gboolean main_option_json = FALSE;
+
+static GOptionEntry main_option[] = {
+	{ "filter", 'f', 0, G_OPTION_ARG_STRING, &main_option_filter,
+		N_( "only run cases whose name contains FILTER" ), "FILTER" },
+	{ "max-threads", 't', 0, G_OPTION_ARG_INT, &main_option_max_threads,
+		N_( "scale up to N threads" ), "N" },
+	{ "size", 's', 0, G_OPTION_ARG_INT, &main_option_size,
+		N_( "image size for the pipeline cases" ), "SIZE" },
+	{ "units", 'u', 0, G_OPTION_ARG_INT, &main_option_units,
+		N_( "work units for the synthetic cases" ), "N" },
+	{ "work", 'w', 0, G_OPTION_ARG_INT, &main_option_work,
+		N_( "loop iterations per synthetic work unit" ), "N" },
+	{ "repeat", 'r', 0, G_OPTION_ARG_INT, &main_option_repeat,
+		N_( "time the best of N runs" ), "N" },
+	{ "json", 'j', 0, G_OPTION_ARG_NONE, &main_option_json,
+		N_( "print results as JSON" ), NULL },
+	{ NULL }
+};
+
+/* Shared state for the synthetic threadpool cases. next is only touched
+ * by allocate, which runs under the pool's allocate lock.
+ */
+typedef struct _Synth {
+	int next;
+	int units;
+	int work;
+} Synth;
+
+static int
+synth_allocate( VipsThreadState *state, void *a, gboolean *stop )
+{
+	Synth *synth = (Synth *) a;
+
+	if( synth->next >= synth->units ) {
+		*stop = TRUE;
+		return( 0 );
+	}
+
+	state->pos.left = synth->next++;
+	state->pos.top = 0;
+	state->pos.width = 1;
+	state->pos.height = 1;
+
+	return( 0 );
+}
+
+/* Spin for a while. Use a volatile so the compiler can't remove the loop.
+ */
+static int
+synth_work( VipsThreadState *state, void *a )
+{
+	Synth *synth = (Synth *) a;
+	volatile double x = state->pos.left;
+	int i;
+
+	for( i = 0; i < synth->work; i++ )
+		x = x * 0.999 + 1.0;
+
+	return( 0 );
+}
+
+static int
+synth_progress( void *a )
+{
+	return( 0 );
+}
+
+static int
+synth_run( int work )
+{
+	VipsImage *image;
+	Synth synth;
+	int result;
+
+	/* The threadpool needs an image to hang errors and signals off.
+	 */
+	image = vips_image_new();
+	synth.next = 0;
+	synth.units = main_option_units;
+	synth.work = work;
+
+	result = vips_threadpool_run( image,
+		vips_thread_state_new,
+		synth_allocate, synth_work, synth_progress,
+		&synth );
+
+	g_object_unref( image );
+
+	return( result );
+}
+
+/* Units with real work: this should scale well.
+ */
+static int
+case_synth( void )
+{
+	return( synth_run( main_option_work ) );
+}
+
+/* Units with no work: this is all allocate lock.
+ */
+static int
+case_synth_empty( void )
+{
+	return( synth_run( 0 ) );
+}
+
+static int
+sink_gen( VipsRegion *region, void *seq, void *a, void *b, gboolean *stop )
+{
+	return( 0 );
+}
+
+static int
+sink( VipsImage *image )
+{
+	int result;
+
+	result = vips_sink( image, NULL, sink_gen, NULL, NULL, NULL );
+	g_object_unref( image );
+
+	return( result );
+}
+
+static VipsImage *case_source = NULL;
+
+/* A cheap point pipeline: lots of buffer traffic for little work.
+ */
+static int
+case_point( void )
+{
+	VipsImage *t[3];
+	int result;
+
+	if( vips_linear1( case_source, &t[0], 1.1, 10.0, NULL ) )
+		return( -1 );
+	if( vips_invert( t[0], &t[1], NULL ) ) {
+		g_object_unref( t[0] );
+		return( -1 );
+	}
+	g_object_unref( t[0] );
+	if( vips_cast( t[1], &t[2], VIPS_FORMAT_UCHAR, NULL ) ) {
+		g_object_unref( t[1] );
+		return( -1 );
+	}
+	g_object_unref( t[1] );
+
+	result = sink( t[2] );
+
+	return( result );
+}
+
+/* A typical resize pipeline.
+ */
+static int
+case_resize( void )
+{
+	VipsImage *t[2];
+
+	if( vips_resize( case_source, &t[0], 0.4, NULL ) )
+		return( -1 );
+	if( vips_sharpen( t[0], &t[1], NULL ) ) {
+		g_object_unref( t[0] );
+		return( -1 );
+	}
+	g_object_unref( t[0] );
+
+	return( sink( t[1] ) );
+}
+
+/* Many threads building the same small operation: this is mostly cache
+ * lookup.
+ */
+static gpointer
+cache_thread( gpointer data )
+{
+	int i;
+
+	for( i = 0; i < 1000; i++ ) {
+		VipsImage *t;
+
+		if( vips_invert( case_source, &t, NULL ) )
+			return( GINT_TO_POINTER( -1 ) );
+		g_object_unref( t );
+	}
+
+	return( NULL );
+}
+
+static int
+case_cache( void )
+{
+	int n = vips_concurrency_get();
+	GThread **threads = g_new( GThread *, n );
+	int result;
+	int i;
+
+	for( i = 0; i < n; i++ )
+		threads[i] = vips_g_thread_new( "cache", cache_thread, NULL );
+
+	result = 0;
+	for( i = 0; i < n; i++ )
+		if( !threads[i] ||
+			vips_g_thread_join( threads[i] ) )
+			result = -1;
+
+	g_free( threads );
+
+	return( result );
+}
+
+typedef int (*CaseFn)( void );
+
+typedef struct _Case {
+	const char *name;
+	CaseFn fn;
+
+	/* Cases which build operations want the cache on.
+	 */
+	gboolean cache;
+} Case;
+
+static Case cases[] = {
+	{ "synth", case_synth, FALSE },
+	{ "synth-empty", case_synth_empty, FALSE },
+	{ "point", case_point, FALSE },
+	{ "resize", case_resize, FALSE },
+	{ "cache", case_cache, TRUE }
+};
+
+/* Run a case and return the best time, with the lock stats for that run in
+ * stats.
+ */
+static double
+case_time( Case *c, VipsGateStats *stats )
+{
+	GTimer *timer;
+	double best;
+	int i;
+
+	timer = g_timer_new();
+	best = -1;
+
+	for( i = 0; i < VIPS_MAX( 1, main_option_repeat ); i++ ) {
+		double elapsed;
+
+		vips_gate_stats_reset();
+
+		g_timer_start( timer );
+		if( c->fn() )
+			vips_error_exit( NULL );
+		elapsed = g_timer_elapsed( timer, NULL );
+
+		if( best < 0 ||
+			elapsed < best ) {
+			best = elapsed;
+			vips_gate_stats_snapshot( stats );
+		}
+	}
+
+	g_timer_destroy( timer );
+
+	return( best );
+}
+
+static void
+print_result( Case *c, int threads, double time, double t1,
+	VipsGateStats *stats )
+{
+	double speedup = t1 / VIPS_MAX( time, 1e-9 );
+	double efficiency = speedup / threads;
+	int i;
+
+	if( main_option_json ) {
+		printf( "{\"name\": \"%s\", \"threads\": %d, "
+			"\"seconds\": %g, \"speedup\": %g, "
+			"\"efficiency\": %g",
+			c->name, threads, time, speedup, efficiency );
+		for( i = 0; i < VIPS_GATE_STAT_LAST; i++ )
+			printf( ", \"%s_calls\": %" G_GUINT64_FORMAT
+				", \"%s_contended\": %" G_GUINT64_FORMAT
+				", \"%s_seconds\": %g",
+				stats[i].name, stats[i].calls,
+				stats[i].name, stats[i].contended,
+				stats[i].name, stats[i].time / 1000000.0 );
+		printf( "}\n" );
+	}
+	else {
+		char bar[41];
+		int n;
+
+		n = VIPS_CLIP( 0, (int) (efficiency * 40 + 0.5), 40 );
+		memset( bar, '#', n );
+		bar[n] = '\0';
+
+		printf( "%-12s %3d %9.3fs %6.2fx %5.1f%% |%-40s|",
+			c->name, threads, time, speedup,
+			efficiency * 100, bar );
+		for( i = 0; i < VIPS_GATE_STAT_LAST; i++ )
+			if( stats[i].calls )
+				printf( " %s %.1fms (%.0f%% contended)",
+					stats[i].name,
+					stats[i].time / 1000.0,
+					100.0 * stats[i].contended /
+						stats[i].calls );
+		printf( "\n" );
+	}
+
+	fflush( stdout );
+}
+
+int
+main( int argc, char *argv[] )
+{
+	GOptionContext *context;
+	GOptionGroup *main_group;
+	GError *error = NULL;
+	int i;
+
+	if( VIPS_INIT( argv[0] ) )
+	        vips_error_exit( "unable to start VIPS" );
+	textdomain( GETTEXT_PACKAGE );
+	setlocale( LC_ALL, "" );
+
+        context = g_option_context_new(
+		_( "- measure vips thread scaling" ) );
+	main_group = g_option_group_new( NULL, NULL, NULL, NULL, NULL );
+	g_option_group_add_entries( main_group, main_option );
+	vips_add_option_entries( main_group );
+	g_option_group_set_translation_domain( main_group, GETTEXT_PACKAGE );
+	g_option_context_set_main_group( context, main_group );
+
+	if( !g_option_context_parse( context, &argc, &argv, &error ) ) {
+		if( error ) {
+			fprintf( stderr, "%s\n", error->message );
+			g_error_free( error );
+		}
+
+		vips_error_exit( "try \"%s --help\"", g_get_prgname() );
+	}
+
+	g_option_context_free( context );
+
+	if( main_option_max_threads <= 0 )
+		main_option_max_threads = vips_concurrency_get();
+
+	vips_gate_stats_set( TRUE );
+
+	/* A noise source in memory, so the pipeline cases don't time a
+	 * generator.
+	 */
+	{
+		VipsImage *t[2];
+
+		if( vips_gaussnoise( &t[0],
+			main_option_size, main_option_size, NULL ) ||
+			vips_cast( t[0], &t[1], VIPS_FORMAT_UCHAR, NULL ) ||
+			!(case_source = vips_image_copy_memory( t[1] )) )
+			vips_error_exit( NULL );
+		g_object_unref( t[0] );
+		g_object_unref( t[1] );
+	}
+
+	for( i = 0; i < VIPS_NUMBER( cases ); i++ ) {
+		Case *c = &cases[i];
+		double t1;
+		int threads;
+
+		if( main_option_filter &&
+			!strstr( c->name, main_option_filter ) )
+			continue;
+
+		vips_cache_set_max( c->cache ? 1000 : 0 );
+
+		t1 = -1;
+		for( threads = 1; ; threads *= 2 ) {
+			VipsGateStats stats[VIPS_GATE_STAT_LAST];
+			double time;
+
+			threads = VIPS_MIN( threads, main_option_max_threads );
+			vips_concurrency_set( threads );
+
+			time = case_time( c, stats );
+			if( t1 < 0 )
+				t1 = time;
+			print_result( c, threads, time, t1, stats );
+
+			if( threads >= main_option_max_threads )
+				break;
+		}
+	}
+
+	VIPS_UNREF( case_source );
+
+	vips_shutdown();
+
+	return( 0 );
+}
@@ -0,0 +1,285 @@
+/* run loaders over a corpus under a time and memory budget
+ *
+ * 14/10/18
+ * 	- first version
+ */
+
+/*
+
+    This file is part of VIPS.
+
+    VIPS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA
+
+ */
+
+/*
+
+    These files are distributed with VIPS - http://www.vips.ecs.soton.ac.uk
+
+ */
+
+/* Each file on the command-line (a fuzz corpus, say) is loaded from memory
+ * and scanned, as fuzz_new_from_buffer.c does, and we measure the time and
+ * the peak tracked memory. Runs which go over the budget are stopped.
+ *
+ * At the end we print the slowest inputs for each loader, and list any
+ * which went over budget. The exit code is 1 if any input went over, so
+ * this can gate a CI job. Inputs which are rejected by the load limits
+ * (see vips_foreign_load_set_limits()) count as fast failures, which is
+ * what we want.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /*HAVE_CONFIG_H*/
+#include <vips/intl.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <locale.h>
+
+#include <vips/vips.h>
+#include <vips/internal.h>
+
+static double main_option_max_time = 1.0;
+static char *main_option_max_mem = "100m";
+static char *main_option_max_pixels = NULL;
+static int main_option_max_pages = 0;
+static char *main_option_max_bytes = NULL;
+static int main_option_worst = 5;
+static gboolean main_option_json = FALSE;
+
+static GOptionEntry main_option[] = {
+	{ "max-time", 't', 0, G_OPTION_ARG_DOUBLE, &main_option_max_time,
+		N_( "allow each input SECONDS" ), "SECONDS" },
+	{ "max-mem", 'm', 0, G_OPTION_ARG_STRING, &main_option_max_mem,
+		N_( "allow each input N bytes of memory" ), "N" },
+	{ "max-pixels", 0, 0, G_OPTION_ARG_STRING, &main_option_max_pixels,
+		N_( "set the load limit to N pixels" ), "N" },
+	{ "max-pages", 0, 0, G_OPTION_ARG_INT, &main_option_max_pages,
+		N_( "set the load limit to N pages" ), "N" },
+	{ "max-bytes", 0, 0, G_OPTION_ARG_STRING, &main_option_max_bytes,
+		N_( "set the load limit to N decompressed bytes" ), "N" },
+	{ "worst", 'w', 0, G_OPTION_ARG_INT, &main_option_worst,
+		N_( "list the N slowest inputs for each loader" ), "N" },
+	{ "json", 'j', 0, G_OPTION_ARG_NONE, &main_option_json,
+		N_( "print results as JSON" ), NULL },
+	{ NULL }
+};
+
+typedef struct _Result {
+	const char *filename;
+	const char *loader;
+	double time;
+	size_t peak_mem;
+	gboolean over;
+	gboolean failed;
+} Result;
+
+typedef struct _Budget {
+	GTimer *timer;
+	size_t max_mem;
+	size_t mem;
+	gboolean over;
+} Budget;
+
+static void
+budget_eval( VipsImage *image, VipsProgress *progress, Budget *budget )
+{
+	if( g_timer_elapsed( budget->timer, NULL ) > main_option_max_time ||
+		vips_tracked_get_mem() - budget->mem > budget->max_mem ) {
+		budget->over = TRUE;
+		vips_image_set_kill( image, TRUE );
+	}
+}
+
+static void
+run_file( const char *filename, Budget *budget, Result *result )
+{
+	char *data;
+	gsize length;
+	const char *loader;
+	VipsImage *image;
+	double d;
+
+	result->filename = filename;
+	result->loader = "none";
+	result->time = 0.0;
+	result->peak_mem = 0;
+	result->over = FALSE;
+	result->failed = TRUE;
+
+	if( !g_file_get_contents( filename, &data, &length, NULL ) )
+		return;
+
+	/* Loaders are static, so we can keep the name.
+	 */
+	if( (loader = vips_foreign_find_load_buffer( data, length )) )
+		result->loader = loader;
+	vips_error_clear();
+
+	vips_cache_drop_all();
+	vips_tracked_reset_highwater();
+	budget->mem = vips_tracked_get_mem();
+	budget->over = FALSE;
+	g_timer_start( budget->timer );
+
+	if( (image = vips_image_new_from_buffer( data, length, "", NULL )) ) {
+		vips_image_set_progress( image, TRUE );
+		g_signal_connect( image, "eval",
+			G_CALLBACK( budget_eval ), budget );
+
+		if( !vips_avg( image, &d, NULL ) )
+			result->failed = FALSE;
+
+		g_object_unref( image );
+	}
+	vips_error_clear();
+
+	result->time = g_timer_elapsed( budget->timer, NULL );
+	result->peak_mem = vips_tracked_get_mem_highwater() - budget->mem;
+	result->over = budget->over ||
+		result->time > main_option_max_time ||
+		result->peak_mem > budget->max_mem;
+
+	g_free( data );
+}
+
+static void
+print_result( Result *result )
+{
+	if( main_option_json )
+		printf( "{\"file\": \"%s\", \"loader\": \"%s\", "
+			"\"seconds\": %g, \"peak_mem\": %zd, "
+			"\"failed\": %s, \"over\": %s}\n",
+			result->filename, result->loader,
+			result->time, result->peak_mem,
+			result->failed ? "true" : "false",
+			result->over ? "true" : "false" );
+	else
+		printf( "  %8.3fs %10zd bytes %s%s%s\n",
+			result->time, result->peak_mem,
+			result->filename,
+			result->failed ? " (failed)" : "",
+			result->over ? " OVER BUDGET" : "" );
+}
+
+static int
+result_compare( const void *a, const void *b )
+{
+	const Result *ra = (const Result *) a;
+	const Result *rb = (const Result *) b;
+	int i;
+
+	if( (i = strcmp( ra->loader, rb->loader )) )
+		return( i );
+
+	return( ra->time < rb->time ? 1 : ra->time > rb->time ? -1 : 0 );
+}
+
+int
+main( int argc, char *argv[] )
+{
+	GOptionContext *context;
+	GOptionGroup *main_group;
+	GError *error = NULL;
+	Budget budget;
+	Result *results;
+	int n_results;
+	int n_over;
+	int i;
+
+	if( VIPS_INIT( argv[0] ) )
+	        vips_error_exit( "unable to start VIPS" );
+	textdomain( GETTEXT_PACKAGE );
+	setlocale( LC_ALL, "" );
+
+        context = g_option_context_new(
+		_( "FILE ... - find slow inputs for the loaders" ) );
+	main_group = g_option_group_new( NULL, NULL, NULL, NULL, NULL );
+	g_option_group_add_entries( main_group, main_option );
+	vips_add_option_entries( main_group );
+	g_option_group_set_translation_domain( main_group, GETTEXT_PACKAGE );
+	g_option_context_set_main_group( context, main_group );
+
+	if( !g_option_context_parse( context, &argc, &argv, &error ) ) {
+		if( error ) {
+			fprintf( stderr, "%s\n", error->message );
+			g_error_free( error );
+		}
+
+		vips_error_exit( "try \"%s --help\"", g_get_prgname() );
+	}
+
+	g_option_context_free( context );
+
+	/* Load limits on the command-line replace any from the environment.
+	 */
+	if( main_option_max_pixels ||
+		main_option_max_pages ||
+		main_option_max_bytes )
+		vips_foreign_load_set_limits(
+			main_option_max_pixels ?
+				vips__parse_size( main_option_max_pixels ) : 0,
+			main_option_max_pages,
+			main_option_max_bytes ?
+				vips__parse_size( main_option_max_bytes ) : 0 );
+
+	/* Each run should start from nothing.
+	 */
+	vips_cache_set_max( 0 );
+
+	budget.timer = g_timer_new();
+	budget.max_mem = vips__parse_size( main_option_max_mem );
+
+	n_results = argc - 1;
+	results = g_new( Result, VIPS_MAX( 1, n_results ) );
+	n_over = 0;
+	for( i = 0; i < n_results; i++ ) {
+		run_file( argv[i + 1], &budget, &results[i] );
+		if( results[i].over )
+			n_over += 1;
+		if( main_option_json )
+			print_result( &results[i] );
+	}
+
+	if( !main_option_json ) {
+		qsort( results, n_results, sizeof( Result ), result_compare );
+
+		for( i = 0; i < n_results; ) {
+			const char *loader = results[i].loader;
+			int j;
+
+			printf( "%s:\n", loader );
+			for( j = 0; i < n_results &&
+				strcmp( results[i].loader, loader ) == 0;
+				i++, j++ )
+				if( j < main_option_worst ||
+					results[i].over )
+					print_result( &results[i] );
+		}
+
+		printf( "%d inputs, %d over budget\n", n_results, n_over );
+	}
+
+	g_free( results );
+	g_timer_destroy( budget.timer );
+
+	vips_shutdown();
+
+	return( n_over ? 1 : 0 );
+}
@@ -6,6 +6,9 @@
  * 	- missing implementation of VImage::write()
  * 11/6/16
  * 	- added arithmetic assignment overloads, += etc. 
+ * 14/10/18
+ * 	- keep VOption pairs inline, add VOperation for prepared calls
+ * 	- VOption::set() takes the ref from images passed by value
  */
 
 /*
@@ -106,22 +109,51 @@ invert( std::vector<double> vector )
 
 VOption::~VOption()
 {
-	std::list<Pair *>::iterator i;
+	std::vector<Pair *>::iterator i;
 
-	for( i = options.begin(); i != options.end(); ++i ) 
+	clear();
+	for( i = extra_pairs.begin(); i != extra_pairs.end(); ++i )
 		delete *i;
 }
 
+VOption::Pair *
+VOption::add_pair( const char *name )
+{
+	Pair *pair;
+
+	if( n_pairs < N_INLINE )
+		pair = &inline_pairs[n_pairs];
+	else if( n_pairs - N_INLINE < (int) extra_pairs.size() )
+		pair = extra_pairs[n_pairs - N_INLINE];
+	else {
+		pair = new Pair();
+		extra_pairs.push_back( pair );
+	}
+
+	pair->name = name;
+	n_pairs += 1;
+
+	return( pair );
+}
+
+// unset all pairs, but keep the storage
+void
+VOption::clear()
+{
+	for( int i = 0; i < n_pairs; i++ )
+		get_pair( i )->clear();
+	n_pairs = 0;
+}
+
 // input bool
 VOption *
 VOption::set( const char *name, bool value )
 {
-	Pair *pair = new Pair( name );
+	Pair *pair = add_pair( name );
 
 	pair->input = true;
 	g_value_init( &pair->value, G_TYPE_BOOLEAN );
 	g_value_set_boolean( &pair->value, value );
-	options.push_back( pair );
 
 	return( this );
 }
@@ -130,12 +162,11 @@ VOption::set( const char *name, bool value )
 VOption *
 VOption::set( const char *name, int value )
 {
-	Pair *pair = new Pair( name );
+	Pair *pair = add_pair( name );
 
 	pair->input = true;
 	g_value_init( &pair->value, G_TYPE_INT );
 	g_value_set_int( &pair->value, value );
-	options.push_back( pair );
 
 	return( this );
 }
@@ -144,12 +175,11 @@ VOption::set( const char *name, int value )
 VOption *
 VOption::set( const char *name, double value )
 {
-	Pair *pair = new Pair( name );
+	Pair *pair = add_pair( name );
 
 	pair->input = true;
 	g_value_init( &pair->value, G_TYPE_DOUBLE );
 	g_value_set_double( &pair->value, value );
-	options.push_back( pair );
 
 	return( this );
 }
@@ -157,12 +187,11 @@ VOption::set( const char *name, double value )
 VOption *
 VOption::set( const char *name, const char *value )
 {
-	Pair *pair = new Pair( name );
+	Pair *pair = add_pair( name );
 
 	pair->input = true;
 	g_value_init( &pair->value, G_TYPE_STRING );
 	g_value_set_string( &pair->value, value );
-	options.push_back( pair );
 
 	return( this );
 }
@@ -171,12 +200,13 @@ VOption::set( const char *name, const char *value )
 VOption *
 VOption::set( const char *name, VImage value )
 {
-	Pair *pair = new Pair( name );
+	Pair *pair = add_pair( name );
 
 	pair->input = true;
 	g_value_init( &pair->value, VIPS_TYPE_IMAGE );
-	g_value_set_object( &pair->value, value.get_image() );
-	options.push_back( pair );
+
+	// value is our own copy, so we can take its ref
+	g_value_take_object( &pair->value, value.steal_object() );
 
 	return( this );
 }
@@ -185,7 +215,7 @@ VOption::set( const char *name, VImage value )
 VOption *
 VOption::set( const char *name, std::vector<double> value )
 {
-	Pair *pair = new Pair( name );
+	Pair *pair = add_pair( name );
 
 	double *array;
 	unsigned int i; 
@@ -200,7 +230,6 @@ VOption::set( const char *name, std::vector<double> value )
 	for( i = 0; i < value.size(); i++ )  
 		array[i] = value[i]; 
 
-	options.push_back( pair );
 
 	return( this );
 }
@@ -209,7 +238,7 @@ VOption::set( const char *name, std::vector<double> value )
 VOption *
 VOption::set( const char *name, std::vector<int> value )
 {
-	Pair *pair = new Pair( name );
+	Pair *pair = add_pair( name );
 
 	int *array;
 	unsigned int i; 
@@ -224,7 +253,6 @@ VOption::set( const char *name, std::vector<int> value )
 	for( i = 0; i < value.size(); i++ )  
 		array[i] = value[i]; 
 
-	options.push_back( pair );
 
 	return( this );
 }
@@ -233,7 +261,7 @@ VOption::set( const char *name, std::vector<int> value )
 VOption *
 VOption::set( const char *name, std::vector<VImage> value )
 {
-	Pair *pair = new Pair( name );
+	Pair *pair = add_pair( name );
 
 	VipsImage **array;
 	unsigned int i; 
@@ -252,7 +280,6 @@ VOption::set( const char *name, std::vector<VImage> value )
 		g_object_ref( vips_image );  
 	}
 
-	options.push_back( pair );
 
 	return( this );
 }
@@ -261,12 +288,11 @@ VOption::set( const char *name, std::vector<VImage> value )
 VOption *
 VOption::set( const char *name, VipsBlob *value )
 {
-	Pair *pair = new Pair( name );
+	Pair *pair = add_pair( name );
 
 	pair->input = true;
 	g_value_init( &pair->value, VIPS_TYPE_BLOB );
 	g_value_set_boxed( &pair->value, value );
-	options.push_back( pair );
 
 	return( this );
 }
@@ -275,13 +301,12 @@ VOption::set( const char *name, VipsBlob *value )
 VOption *
 VOption::set( const char *name, bool *value )
 {
-	Pair *pair = new Pair( name );
+	Pair *pair = add_pair( name );
 
 	pair->input = false;
 	pair->vbool = value;
 	g_value_init( &pair->value, G_TYPE_BOOLEAN ); 
 
-	options.push_back( pair );
 
 	return( this );
 }
@@ -290,13 +315,12 @@ VOption::set( const char *name, bool *value )
 VOption *
 VOption::set( const char *name, int *value )
 {
-	Pair *pair = new Pair( name );
+	Pair *pair = add_pair( name );
 
 	pair->input = false;
 	pair->vint = value;
 	g_value_init( &pair->value, G_TYPE_INT ); 
 
-	options.push_back( pair );
 
 	return( this );
 }
@@ -305,13 +329,12 @@ VOption::set( const char *name, int *value )
 VOption *
 VOption::set( const char *name, double *value )
 {
-	Pair *pair = new Pair( name );
+	Pair *pair = add_pair( name );
 
 	pair->input = false;
 	pair->vdouble = value;
 	g_value_init( &pair->value, G_TYPE_DOUBLE ); 
 
-	options.push_back( pair );
 
 	return( this );
 }
@@ -320,13 +343,12 @@ VOption::set( const char *name, double *value )
 VOption *
 VOption::set( const char *name, VImage *value )
 {
-	Pair *pair = new Pair( name );
+	Pair *pair = add_pair( name );
 
 	pair->input = false;
 	pair->vimage = value;
 	g_value_init( &pair->value, VIPS_TYPE_IMAGE );
 
-	options.push_back( pair );
 
 	return( this );
 }
@@ -335,13 +357,12 @@ VOption::set( const char *name, VImage *value )
 VOption *
 VOption::set( const char *name, std::vector<double> *value )
 {
-	Pair *pair = new Pair( name );
+	Pair *pair = add_pair( name );
 
 	pair->input = false;
 	pair->vvector = value;
 	g_value_init( &pair->value, VIPS_TYPE_ARRAY_DOUBLE ); 
 
-	options.push_back( pair );
 
 	return( this );
 }
@@ -350,34 +371,23 @@ VOption::set( const char *name, std::vector<double> *value )
 VOption *
 VOption::set( const char *name, VipsBlob **value )
 {
-	Pair *pair = new Pair( name );
+	Pair *pair = add_pair( name );
 
 	pair->input = false;
 	pair->vblob = value;
 	g_value_init( &pair->value, VIPS_TYPE_BLOB ); 
 
-	options.push_back( pair );
 
 	return( this );
 }
 
 // just g_object_set_property(), except we allow set enum from string
 static void 
-set_property( VipsObject *object, const char *name, const GValue *value )
+set_property( VipsObject *object, GParamSpec *pspec, const GValue *value )
 {
 	VipsObjectClass *object_class = VIPS_OBJECT_GET_CLASS( object );
 	GType type = G_VALUE_TYPE( value );
-
-	GParamSpec *pspec;
-	VipsArgumentClass *argument_class;
-	VipsArgumentInstance *argument_instance;
-
-	if( vips_object_get_argument( object, name, 
-		&pspec, &argument_class, &argument_instance ) ) {
-		g_warning( "%s", vips_error_buffer() );
-		vips_error_clear();
-		return;
-	}
+	const char *name = g_param_spec_get_name( pspec );
 
 	if( G_IS_PARAM_SPEC_ENUM( pspec ) &&
 		type == G_TYPE_STRING ) {
@@ -402,64 +412,91 @@ set_property( VipsObject *object, const char *name, const GValue *value )
 		g_object_set_property( G_OBJECT( object ), name, value );
 }
 
-// walk the options and set props on the operation 
+static GParamSpec *
+find_pspec( VipsObject *object, const char *name )
+{
+	GParamSpec *pspec;
+	VipsArgumentClass *argument_class;
+	VipsArgumentInstance *argument_instance;
+
+	if( vips_object_get_argument( object, name,
+		&pspec, &argument_class, &argument_instance ) ) {
+		g_warning( "%s", vips_error_buffer() );
+		vips_error_clear();
+		return( NULL );
+	}
+
+	return( pspec );
+}
+
+// walk the options and set props on the operation ... if this is a prepared
+// operation, look up the arg specs there
 void 
-VOption::set_operation( VipsOperation *operation )
+VOption::set_operation( VipsOperation *operation, VOperation *prepared )
 {
-	std::list<Pair *>::iterator i;
+	for( int i = 0; i < n_pairs; i++ ) {
+		Pair *pair = get_pair( i );
+
+		if( pair->input ) {
+			GParamSpec *pspec;
 
-	for( i = options.begin(); i != options.end(); ++i ) 
-		if( (*i)->input ) {
 #ifdef VIPS_DEBUG_VERBOSE
 			printf( "set_operation: " );
 			vips_object_print_name( VIPS_OBJECT( operation ) );
-			char *str_value = g_strdup_value_contents( &(*i)->value );
-			printf( ".%s = %s\n", (*i)->name, str_value );
+			char *str_value =
+				g_strdup_value_contents( &pair->value );
+			printf( ".%s = %s\n", pair->name, str_value );
 			g_free( str_value );
 #endif /*VIPS_DEBUG_VERBOSE*/
 
-			set_property( VIPS_OBJECT( operation ),
-				(*i)->name, &(*i)->value );
+			pspec = prepared ?
+				prepared->lookup( operation, pair->name ) :
+				find_pspec( VIPS_OBJECT( operation ),
+					pair->name );
+			if( pspec )
+				set_property( VIPS_OBJECT( operation ),
+					pspec, &pair->value );
 		}
+	}
 }
 
 // walk the options and fetch any requested outputs
 void 
 VOption::get_operation( VipsOperation *operation )
 {
-	std::list<Pair *>::iterator i;
+	for( int i = 0; i < n_pairs; i++ ) {
+		Pair *pair = get_pair( i );
 
-	for( i = options.begin(); i != options.end(); ++i ) 
-		if( ! (*i)->input ) {
-			const char *name = (*i)->name;
+		if( ! pair->input ) {
+			const char *name = pair->name;
 
 			g_object_get_property( G_OBJECT( operation ),
-				name, &(*i)->value );
+				name, &pair->value );
 
 #ifdef VIPS_DEBUG_VERBOSE
 			printf( "get_operation: " );
 			vips_object_print_name( VIPS_OBJECT( operation ) );
 			char *str_value = g_strdup_value_contents( 
-				&(*i)->value );
+				&pair->value );
 			printf( ".%s = %s\n", name, str_value );
 			g_free( str_value );
 #endif /*VIPS_DEBUG_VERBOSE*/
 
-			GValue *value = &(*i)->value;
+			GValue *value = &pair->value;
 			GType type = G_VALUE_TYPE( value );
 
 			if( type == VIPS_TYPE_IMAGE ) {
 				// rebox object
 				VipsImage *image = VIPS_IMAGE( 
 					g_value_get_object( value ) );  
-				*((*i)->vimage) = VImage( image ); 
+				*(pair->vimage) = VImage( image );
 			}
 			else if( type == G_TYPE_INT ) 
-				*((*i)->vint) = g_value_get_int( value ); 
+				*(pair->vint) = g_value_get_int( value );
 			else if( type == G_TYPE_BOOLEAN ) 
-				*((*i)->vbool) = g_value_get_boolean( value ); 
+				*(pair->vbool) = g_value_get_boolean( value );
 			else if( type == G_TYPE_DOUBLE ) 
-				*((*i)->vdouble) = g_value_get_double( value ); 
+				*(pair->vdouble) = g_value_get_double( value );
 			else if( type == VIPS_TYPE_ARRAY_DOUBLE ) {
 				int length;
 				double *array = 
@@ -467,16 +504,17 @@ VOption::get_operation( VipsOperation *operation )
 					&length );
 				int j;
 
-				((*i)->vvector)->resize( length ); 
+				(pair->vvector)->resize( length );
 				for( j = 0; j < length; j++ )
-					(*((*i)->vvector))[j] = array[j];
+					(*(pair->vvector))[j] = array[j];
 			}
 			else if( type == VIPS_TYPE_BLOB ) {
 				// our caller gets a reference
-				*((*i)->vblob) = 
+				*(pair->vblob) =
 					(VipsBlob *) g_value_dup_boxed( value );
 			}
 		}
+	}
 }
 
 void 
@@ -539,6 +577,104 @@ VImage::call( const char *operation_name, VOption *options )
 	call_option_string( operation_name, NULL, options ); 
 }
 
+VOperation::VOperation( const char *operation_name ) :
+	operation_name( g_strdup( operation_name ) ), reuse( 0 )
+{
+	if( !(type = vips_type_find( "VipsOperation", operation_name )) ||
+		G_TYPE_IS_ABSTRACT( type ) ) {
+		vips_error( "VipsOperation",
+			_( "class \"%s\" not found" ), operation_name );
+		g_free( this->operation_name );
+		throw( VError() );
+	}
+}
+
+VOperation::~VOperation()
+{
+	delete reuse;
+	g_free( operation_name );
+}
+
+// find the spec for an arg, caching as we go ... most operations have only a
+// few args, so a linear search is fine
+GParamSpec *
+VOperation::lookup( VipsOperation *operation, const char *name )
+{
+	std::vector<Arg>::iterator i;
+	Arg arg;
+
+	for( i = args.begin(); i != args.end(); ++i )
+		if( strcmp( i->name, name ) == 0 )
+			return( i->pspec );
+
+	if( !(arg.pspec = find_pspec( VIPS_OBJECT( operation ), name )) )
+		return( NULL );
+	arg.name = g_intern_string( name );
+	args.push_back( arg );
+
+	return( arg.pspec );
+}
+
+VOption *
+VOperation::option()
+{
+	if( !reuse )
+		reuse = new VOption();
+	else
+		reuse->clear();
+
+	return( reuse );
+}
+
+// options is deleted, unless it's our own reusable VOption, which we clear to
+// drop any refs
+void
+VOperation::release( VOption *options )
+{
+	if( options &&
+		options == reuse )
+		reuse->clear();
+	else
+		delete options;
+}
+
+void
+VOperation::call_option_string( const char *option_string,
+	VOption *options )
+{
+	VipsOperation *operation;
+
+	VIPS_DEBUG_MSG( "VOperation::call_option_string: starting for %s\n",
+		operation_name );
+
+	operation = VIPS_OPERATION( g_object_new( type, NULL ) );
+
+	if( option_string &&
+		vips_object_set_from_string( VIPS_OBJECT( operation ),
+			option_string ) ) {
+		vips_object_unref_outputs( VIPS_OBJECT( operation ) );
+		g_object_unref( operation );
+		release( options );
+		throw( VError() );
+	}
+
+	if( options )
+		options->set_operation( operation, this );
+
+	if( vips_cache_operation_buildp( &operation ) ) {
+		vips_object_unref_outputs( VIPS_OBJECT( operation ) );
+		g_object_unref( operation );
+		release( options );
+		throw( VError() );
+	}
+
+	if( options )
+		options->get_operation( operation );
+	release( options );
+
+	g_object_unref( operation );
+}
+
 VImage 
 VImage::new_from_file( const char *name, VOption *options )
 {
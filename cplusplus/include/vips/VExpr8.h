@@ -0,0 +1,309 @@
+// VIPS linear expression templates
+
+/*
+
+    This file is part of VIPS.
+
+    VIPS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA
+
+ */
+
+/*
+
+    These files are distributed with VIPS - http://www.vips.ecs.soton.ac.uk
+
+ */
+
+#ifndef VIPS_VEXPR_H
+#define VIPS_VEXPR_H
+
+#include <vector>
+
+#include <vips/vips.h>
+
+VIPS_NAMESPACE_START
+
+/* Wrap an image with expr() and arithmetic on it builds a tree of these
+ * nodes instead of an operation per operator. When the tree is converted
+ * back to a VImage it is flattened to:
+ *
+ * 	offset + weight[0] * image[0] + weight[1] * image[1] + ...
+ *
+ * and computed with a single vips_linear() or vips_sum(), so
+ *
+ * 	VImage x = (expr( a ) * 2 + b) / 3;
+ *
+ * is one operation and one pass over the pixels, not four.
+ *
+ * Only linear expressions are captured. Products of images, division by an
+ * image, comparisons and so on go through the usual VImage operators.
+ */
+
+class VLinearForm
+{
+public:
+	std::vector<VImage> images;
+	std::vector<double> weights;
+	double offset;
+
+	VLinearForm() : offset( 0.0 )
+	{
+	}
+
+	// the same image twice just adds the weights
+	void
+	add( const VImage &image, double weight )
+	{
+		VipsImage *p = const_cast<VImage &>( image ).get_image();
+
+		for( unsigned int i = 0; i < images.size(); i++ )
+			if( images[i].get_image() == p ) {
+				weights[i] += weight;
+				return;
+			}
+
+		images.push_back( image );
+		weights.push_back( weight );
+	}
+
+	VImage
+	lower() const
+	{
+		bool unit;
+
+		if( images.size() == 0 )
+			throw VError( "expression has no images" );
+
+		unit = true;
+		for( unsigned int i = 0; i < weights.size(); i++ )
+			if( weights[i] != 1.0 )
+				unit = false;
+
+		if( images.size() == 1 ) {
+			if( unit &&
+				offset == 0.0 )
+				return( images[0] );
+
+			return( const_cast<VImage &>( images[0] ).
+				linear( weights[0], offset ) );
+		}
+
+		if( unit &&
+			offset == 0.0 )
+			return( VImage::sum( images ) );
+
+		VOption *options = VImage::option();
+		if( !unit )
+			options->set( "weights", weights );
+		if( offset != 0.0 )
+			options->set( "offset", offset );
+
+		return( VImage::sum( images, options ) );
+	}
+};
+
+template <class E>
+class VExpr
+{
+public:
+	const E &
+	self() const
+	{
+		return( static_cast<const E &>( *this ) );
+	}
+
+	VImage
+	image() const
+	{
+		VLinearForm form;
+
+		self().collect( form, 1.0 );
+
+		return( form.lower() );
+	}
+
+	operator VImage() const
+	{
+		return( image() );
+	}
+};
+
+class VTerm : public VExpr<VTerm>
+{
+	VImage _image;
+
+public:
+	VTerm( const VImage &image ) : _image( image )
+	{
+	}
+
+	void
+	collect( VLinearForm &form, double scale ) const
+	{
+		form.add( _image, scale );
+	}
+};
+
+// a * e + b
+template <class E>
+class VAffine : public VExpr< VAffine<E> >
+{
+	E _e;
+	double _a;
+	double _b;
+
+public:
+	VAffine( const E &e, double a, double b ) : _e( e ), _a( a ), _b( b )
+	{
+	}
+
+	void
+	collect( VLinearForm &form, double scale ) const
+	{
+		_e.collect( form, scale * _a );
+		form.offset += scale * _b;
+	}
+};
+
+// l + sign * r
+template <class L, class R>
+class VAdd : public VExpr< VAdd<L, R> >
+{
+	L _l;
+	R _r;
+	double _sign;
+
+public:
+	VAdd( const L &l, const R &r, double sign ) :
+		_l( l ), _r( r ), _sign( sign )
+	{
+	}
+
+	void
+	collect( VLinearForm &form, double scale ) const
+	{
+		_l.collect( form, scale );
+		_r.collect( form, scale * _sign );
+	}
+};
+
+inline VTerm
+expr( const VImage &image )
+{
+	return( VTerm( image ) );
+}
+
+template <class L, class R>
+inline VAdd<L, R>
+operator+( const VExpr<L> &l, const VExpr<R> &r )
+{
+	return( VAdd<L, R>( l.self(), r.self(), 1.0 ) );
+}
+
+template <class L, class R>
+inline VAdd<L, R>
+operator-( const VExpr<L> &l, const VExpr<R> &r )
+{
+	return( VAdd<L, R>( l.self(), r.self(), -1.0 ) );
+}
+
+template <class L>
+inline VAdd<L, VTerm>
+operator+( const VExpr<L> &l, const VImage &r )
+{
+	return( VAdd<L, VTerm>( l.self(), VTerm( r ), 1.0 ) );
+}
+
+template <class L>
+inline VAdd<L, VTerm>
+operator-( const VExpr<L> &l, const VImage &r )
+{
+	return( VAdd<L, VTerm>( l.self(), VTerm( r ), -1.0 ) );
+}
+
+template <class R>
+inline VAdd<VTerm, R>
+operator+( const VImage &l, const VExpr<R> &r )
+{
+	return( VAdd<VTerm, R>( VTerm( l ), r.self(), 1.0 ) );
+}
+
+template <class R>
+inline VAdd<VTerm, R>
+operator-( const VImage &l, const VExpr<R> &r )
+{
+	return( VAdd<VTerm, R>( VTerm( l ), r.self(), -1.0 ) );
+}
+
+template <class E>
+inline VAffine<E>
+operator+( const VExpr<E> &e, double b )
+{
+	return( VAffine<E>( e.self(), 1.0, b ) );
+}
+
+template <class E>
+inline VAffine<E>
+operator+( double b, const VExpr<E> &e )
+{
+	return( VAffine<E>( e.self(), 1.0, b ) );
+}
+
+template <class E>
+inline VAffine<E>
+operator-( const VExpr<E> &e, double b )
+{
+	return( VAffine<E>( e.self(), 1.0, -b ) );
+}
+
+template <class E>
+inline VAffine<E>
+operator-( double b, const VExpr<E> &e )
+{
+	return( VAffine<E>( e.self(), -1.0, b ) );
+}
+
+template <class E>
+inline VAffine<E>
+operator-( const VExpr<E> &e )
+{
+	return( VAffine<E>( e.self(), -1.0, 0.0 ) );
+}
+
+template <class E>
+inline VAffine<E>
+operator*( const VExpr<E> &e, double a )
+{
+	return( VAffine<E>( e.self(), a, 0.0 ) );
+}
+
+template <class E>
+inline VAffine<E>
+operator*( double a, const VExpr<E> &e )
+{
+	return( VAffine<E>( e.self(), a, 0.0 ) );
+}
+
+template <class E>
+inline VAffine<E>
+operator/( const VExpr<E> &e, double a )
+{
+	return( VAffine<E>( e.self(), 1.0 / a, 0.0 ) );
+}
+
+VIPS_NAMESPACE_END
+
+#endif /*VIPS_VEXPR_H*/
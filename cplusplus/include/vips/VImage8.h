@@ -108,6 +108,15 @@ public:
 		g_object_ref( vobject );
 	}
 
+#if __cplusplus >= 201103L
+	// move constructor ... we take the ref from a, so no ref churn
+	VObject( VObject &&a ) :
+		vobject( a.vobject )
+	{
+		a.vobject = 0;
+	}
+#endif /*__cplusplus >= 201103L*/
+
 	// assignment ... we must delete the old ref
 	// old can be NULL, new must not be NULL
 	VObject &operator=( const VObject &a )
@@ -160,11 +169,22 @@ public:
 		return( vobject ); 
 	}
 
+	// give our ref to the caller and become empty
+	VipsObject *steal_object()
+	{
+		VipsObject *old_vobject = vobject;
+
+		vobject = 0;
+
+		return( old_vobject );
+	}
+
 };
 
 class VIPS_CPLUSPLUS_API VImage;
 class VIPS_CPLUSPLUS_API VInterpolate;
 class VIPS_CPLUSPLUS_API VOption;
+class VIPS_CPLUSPLUS_API VOperation;
 
 class VOption
 {
@@ -189,7 +209,7 @@ private:
 			VipsBlob **vblob;
 		}; 
 
-		Pair( const char *name ) : 
+		Pair( const char *name = 0 ) :
 			name( name ), input( false ), vimage( 0 )
 		{
 			// argh = {0} won't work wil vanilla C++
@@ -198,19 +218,51 @@ private:
 
 		~Pair()
 		{
-			g_value_unset( &value );
+			clear();
+		}
+
+		void clear()
+		{
+			if( G_IS_VALUE( &value ) )
+				g_value_unset( &value );
+			memset( &value, 0, sizeof( GValue ) );
+			name = 0;
+			input = false;
+			vimage = 0;
 		}
 	};
 
-	std::list<Pair *> options;
+	// most calls have only a few args, so we keep the first few pairs
+	// in the VOption and only go to the heap for more
+	enum { N_INLINE = 8 };
+	Pair inline_pairs[N_INLINE];
+	std::vector<Pair *> extra_pairs;
+	int n_pairs;
+
+	Pair *add_pair( const char *name );
+
+	Pair *
+	get_pair( int i )
+	{
+		return( i < N_INLINE ?
+			&inline_pairs[i] : extra_pairs[i - N_INLINE] );
+	}
+
+	// pairs hold GValues, so we can't copy
+	VOption( const VOption & );
+	VOption &operator=( const VOption & );
 
 public:
-	VOption()
+	VOption() :
+		n_pairs( 0 )
 	{
 	}
 
 	virtual ~VOption();
 
+	// drop all pairs, ready for reuse
+	void clear();
+
 	VOption *set( const char *name, bool value ); 
 	VOption *set( const char *name, int value );
 	VOption *set( const char *name, double value );
@@ -229,11 +281,53 @@ public:
 	VOption *set( const char *name, std::vector<double> *value );
 	VOption *set( const char *name, VipsBlob **blob ); 
 
-	void set_operation( VipsOperation *operation );
+	void set_operation( VipsOperation *operation,
+		VOperation *prepared = 0 );
 	void get_operation( VipsOperation *operation );
 
 };
 
+/* A prepared operation. This looks up the operation class and its argument
+ * specs once, and reuses a VOption, so calling it many times has less
+ * overhead than VImage::call(). Use one from a single thread at a time.
+ */
+class VOperation
+{
+private:
+	struct Arg {
+		const char *name;
+		GParamSpec *pspec;
+	};
+
+	char *operation_name;
+	GType type;
+	std::vector<Arg> args;
+	VOption *reuse;
+
+	VOperation( const VOperation & );
+	VOperation &operator=( const VOperation & );
+
+	void release( VOption *options );
+
+public:
+	VOperation( const char *operation_name );
+	~VOperation();
+
+	GParamSpec *lookup( VipsOperation *operation, const char *name );
+
+	// our VOption, cleared and ready for reuse
+	VOption *option();
+
+	void call_option_string( const char *option_string,
+		VOption *options = 0 );
+
+	void
+	call( VOption *options = 0 )
+	{
+		call_option_string( 0, options );
+	}
+};
+
 class VImage : VObject
 {
 public:
@@ -924,6 +1018,9 @@ public:
 	friend VIPS_CPLUSPLUS_API VImage & operator>>=( VImage &a, const double b );
 	friend VIPS_CPLUSPLUS_API VImage & operator>>=( VImage &a, const std::vector<double> b );
 
+	// VOption takes the ref from images it is given by value
+	friend class VOption;
+
 };
 
 VIPS_NAMESPACE_END
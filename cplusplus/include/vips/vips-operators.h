@@ -50,6 +50,7 @@ VImage embed( int x , int y , int width , int height , VOption *options = 0 );
 VImage gravity( VipsCompassDirection direction , int width , int height , VOption *options = 0 );
 VImage flip( VipsDirection direction , VOption *options = 0 );
 VImage insert( VImage sub , int x , int y , VOption *options = 0 );
+VImage insert_many( std::vector<VImage> sub , std::vector<int> x , std::vector<int> y , VOption *options = 0 );
 VImage join( VImage in2 , VipsDirection direction , VOption *options = 0 );
 static VImage arrayjoin( std::vector<VImage> in , VOption *options = 0 );
 VImage extract_area( int left , int top , int width , int height , VOption *options = 0 );
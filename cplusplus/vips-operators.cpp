@@ -621,6 +621,21 @@ VImage VImage::insert( VImage sub , int x , int y , VOption *options )
     return( out );
 }
 
+VImage VImage::insert_many( std::vector<VImage> sub , std::vector<int> x , std::vector<int> y , VOption *options )
+{
+    VImage out;
+
+    call( "insert_many" ,
+        (options ? options : VImage::option()) ->
+            set( "main", *this ) ->
+            set( "sub", sub ) ->
+            set( "out", &out ) ->
+            set( "x", x ) ->
+            set( "y", y ) );
+
+    return( out );
+}
+
 VImage VImage::join( VImage in2 , VipsDirection direction , VOption *options )
 {
     VImage out;
@@ -278,8 +278,8 @@ static VipsBandFormat format_largest[6][6] = {
 
 /* For two formats, find one which can represent the full range of both.
  */
-static VipsBandFormat
-vips_format_common( VipsBandFormat a, VipsBandFormat b )
+VipsBandFormat
+vips__format_common( VipsBandFormat a, VipsBandFormat b )
 {
 	if( vips_band_format_iscomplex( a ) || 
 		vips_band_format_iscomplex( b ) ) {
@@ -312,7 +312,7 @@ vips__formatalike_vec( VipsImage **in, VipsImage **out, int n )
 
 	format = in[0]->BandFmt;
 	for( i = 1; i < n; i++ )
-		format = vips_format_common( format, in[i]->BandFmt );
+		format = vips__format_common( format, in[i]->BandFmt );
 
 	for( i = 0; i < n; i++ )
 		if( in[i]->BandFmt == format ) {
@@ -540,6 +540,17 @@ vips_arithmetic_gen( VipsRegion *or,
 	return( 0 );
 }
 
+/* A line at a time for pipeline fusion.
+ */
+static void
+vips_arithmetic_point( VipsPel *out, VipsPel **in, int width, void *a )
+{
+	VipsArithmetic *arithmetic = VIPS_ARITHMETIC( a ); 
+	VipsArithmeticClass *class = VIPS_ARITHMETIC_GET_CLASS( arithmetic ); 
+
+	class->process_line( arithmetic, out, in, width );
+}
+
 static int
 vips_arithmetic_build( VipsObject *object )
 {
@@ -616,6 +627,11 @@ vips_arithmetic_build( VipsObject *object )
 		arithmetic->ready, arithmetic ) ) 
 		return( -1 );
 
+	/* vips_object_local_array() NULL-terminates for us.
+	 */
+	vips__point_attach( arithmetic->out, arithmetic->ready, 
+		vips_arithmetic_point, arithmetic );
+
 	return( 0 );
 }
 
@@ -748,6 +764,7 @@ vips_arithmetic_operation_init( void )
 	extern GType vips_divide_get_type( void ); 
 	extern GType vips_invert_get_type( void ); 
 	extern GType vips_avg_get_type( void ); 
+	extern GType vips_percentiles_get_type( void );
 	extern GType vips_min_get_type( void ); 
 	extern GType vips_max_get_type( void ); 
 	extern GType vips_deviate_get_type( void ); 
@@ -756,6 +773,8 @@ vips_arithmetic_operation_init( void )
 	extern GType vips_abs_get_type( void ); 
 	extern GType vips_sign_get_type( void ); 
 	extern GType vips_stats_get_type( void ); 
+	extern GType vips_statistics_get_type( void ); 
+	extern GType vips_tee_get_type( void ); 
 	extern GType vips_hist_find_get_type( void ); 
 	extern GType vips_hist_find_ndim_get_type( void ); 
 	extern GType vips_hist_find_indexed_get_type( void ); 
@@ -763,8 +782,10 @@ vips_arithmetic_operation_init( void )
 	extern GType vips_hough_circle_get_type( void ); 
 	extern GType vips_project_get_type( void ); 
 	extern GType vips_profile_get_type( void ); 
+	extern GType vips_integral_get_type( void ); 
 	extern GType vips_measure_get_type( void ); 
 	extern GType vips_getpoint_get_type( void ); 
+	extern GType vips_getpoints_get_type( void ); 
 	extern GType vips_round_get_type( void ); 
 	extern GType vips_relational_get_type( void ); 
 	extern GType vips_relational_const_get_type( void ); 
@@ -787,6 +808,7 @@ vips_arithmetic_operation_init( void )
 	vips_divide_get_type();
 	vips_invert_get_type();
 	vips_avg_get_type();
+	vips_percentiles_get_type();
 	vips_min_get_type();
 	vips_max_get_type();
 	vips_deviate_get_type();
@@ -795,6 +817,8 @@ vips_arithmetic_operation_init( void )
 	vips_abs_get_type();
 	vips_sign_get_type();
 	vips_stats_get_type();
+	vips_statistics_get_type();
+	vips_tee_get_type();
 	vips_hist_find_get_type(); 
 	vips_hist_find_ndim_get_type(); 
 	vips_hist_find_indexed_get_type(); 
@@ -802,8 +826,10 @@ vips_arithmetic_operation_init( void )
 	vips_hough_circle_get_type(); 
 	vips_project_get_type(); 
 	vips_profile_get_type(); 
+	vips_integral_get_type(); 
 	vips_measure_get_type();
 	vips_getpoint_get_type();
+	vips_getpoints_get_type();
 	vips_round_get_type();
 	vips_relational_get_type();
 	vips_relational_const_get_type(); 
@@ -34,6 +34,8 @@
  * 	- rewrite as a class
  * 12/9/14
  * 	- oops, fix complex avg
+ * 14/10/18
+ * 	- pairwise sums for float lines, compensated sum over lines
  */
 
 /*
@@ -80,7 +82,7 @@
 typedef struct _VipsAvg {
 	VipsStatistic parent_instance;
 
-	double sum;
+	VipsStatisticSum sum;
 	double out;
 } VipsAvg;
 
@@ -104,19 +106,18 @@ vips_avg_build( VipsObject *object )
 		vips_image_get_width( statistic->in ) * 
 		vips_image_get_height( statistic->in ) * 
 		vips_image_get_bands( statistic->in );
-	average = avg->sum / vals;
+	average = (avg->sum.sum + avg->sum.c) / vals;
 	g_object_set( object, "out", average, NULL );
 
 	return( 0 );
 }
 
-/* Start function: allocate space for a double in which we can accumulate the
- * sum for this thread.
+/* Start function: allocate space for a sum for this thread.
  */
 static void *
 vips_avg_start( VipsStatistic *statistic )
 {
-	return( (void *) g_new0( double, 1 ) );
+	return( (void *) g_new0( VipsStatisticSum, 1 ) );
 }
 
 /* Stop function. Add this little sum to the main sum.
@@ -125,9 +126,10 @@ static int
 vips_avg_stop( VipsStatistic *statistic, void *seq )
 {
 	VipsAvg *avg = (VipsAvg *) statistic;
-	double *sum = (double *) seq;
+	VipsStatisticSum *sum = (VipsStatisticSum *) seq;
 
-	avg->sum += *sum;
+	vips__statistic_sum_add( &avg->sum, sum->sum );
+	vips__statistic_sum_add( &avg->sum, sum->c );
 
 	g_free( seq );
 
@@ -154,7 +156,9 @@ vips_avg_stop( VipsStatistic *statistic, void *seq )
 	} \
 } 
 
-/* Loop over region, accumulating a sum in *tmp.
+/* Sum each line, then add to the running sum for this thread with 
+ * compensation. Float lines are summed pairwise, integer line sums are 
+ * exact.
  */
 static int
 vips_avg_scan( VipsStatistic *statistic, void *seq, 
@@ -162,12 +166,12 @@ vips_avg_scan( VipsStatistic *statistic, void *seq,
 {
 	const int sz = n * vips_image_get_bands( statistic->in );
 
-	double *sum = (double *) seq;
+	VipsStatisticSum *sum = (VipsStatisticSum *) seq;
 
 	int i;
 	double m;
 
-	m = *sum;
+	m = 0.0;
 
 	/* Now generate code for all types. 
 	 */
@@ -178,8 +182,12 @@ vips_avg_scan( VipsStatistic *statistic, void *seq,
 	case VIPS_FORMAT_SHORT:		LOOP( signed short ); break; 
 	case VIPS_FORMAT_UINT:		LOOP( unsigned int ); break;
 	case VIPS_FORMAT_INT:		LOOP( signed int ); break; 
-	case VIPS_FORMAT_FLOAT:		LOOP( float ); break; 
-	case VIPS_FORMAT_DOUBLE:	LOOP( double ); break; 
+	case VIPS_FORMAT_FLOAT:		
+		m = vips__statistic_sum_float( (float *) in, sz, 0.0 ); 
+		break; 
+	case VIPS_FORMAT_DOUBLE:	
+		m = vips__statistic_sum_double( (double *) in, sz, 0.0 ); 
+		break; 
 	case VIPS_FORMAT_COMPLEX:	CLOOP( float ); break; 
 	case VIPS_FORMAT_DPCOMPLEX:	CLOOP( double ); break; 
 
@@ -187,7 +195,7 @@ vips_avg_scan( VipsStatistic *statistic, void *seq,
 		g_assert_not_reached();
 	}
 
-	*sum = m;
+	vips__statistic_sum_add( sum, m );
 
 	return( 0 );
 }
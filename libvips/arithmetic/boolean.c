@@ -31,6 +31,9 @@
  * 	  types
  * 12/11/11
  * 	- redo as a class
+ * 14/10/18
+ * 	- use a SIMD kernel for and, or and eor on integer images, and on
+ * 	  uchar images against a constant
  */
 
 /*
@@ -73,6 +76,7 @@
 #include <stdlib.h>
 
 #include <vips/vips.h>
+#include <vips/simd.h>
 
 #include "binary.h"
 #include "unaryconst.h"
@@ -148,8 +152,24 @@ vips_boolean_buffer( VipsArithmetic *arithmetic,
 	VipsImage *im = arithmetic->ready[0];
 	const int sz = width * vips_image_get_bands( im );
 
+	VipsSimdBooleanFn simd;
 	int x;
 
+	/* and, or and eor are bitwise, so the byte kernel does any int
+	 * format.
+	 */
+	if( vips_band_format_isint( vips_image_get_format( im ) ) &&
+		(boolean->operation == VIPS_OPERATION_BOOLEAN_AND ||
+		 boolean->operation == VIPS_OPERATION_BOOLEAN_OR ||
+		 boolean->operation == VIPS_OPERATION_BOOLEAN_EOR) &&
+		(simd = (VipsSimdBooleanFn) vips_simd_get(
+			VIPS_SIMD_BOOLEAN, VIPS_FORMAT_UCHAR )) ) {
+		simd( out, in[0], in[1], NULL,
+			sz * VIPS_IMAGE_SIZEOF_ELEMENT( im ),
+			boolean->operation );
+		return;
+	}
+
 	switch( boolean->operation ) {
 	case VIPS_OPERATION_BOOLEAN_AND: 	
 		SWITCH( LOOP, FLOOP, & ); 
@@ -470,8 +490,25 @@ vips_boolean_const_buffer( VipsArithmetic *arithmetic,
 	VipsImage *im = arithmetic->ready[0];
 	int bands = im->Bands;
 
+	VipsSimdBooleanFn simd;
 	int i, x, b;
 
+	/* Constants are int, but for uchar only the bottom byte matters.
+	 */
+	if( vips_image_get_format( im ) == VIPS_FORMAT_UCHAR &&
+		uconst->uniform &&
+		(bconst->operation == VIPS_OPERATION_BOOLEAN_AND ||
+		 bconst->operation == VIPS_OPERATION_BOOLEAN_OR ||
+		 bconst->operation == VIPS_OPERATION_BOOLEAN_EOR) &&
+		(simd = (VipsSimdBooleanFn) vips_simd_get(
+			VIPS_SIMD_BOOLEAN, VIPS_FORMAT_UCHAR )) ) {
+		VipsPel c = *((int *) uconst->c_ready);
+
+		simd( out, in[0], NULL, &c, width * bands,
+			bconst->operation );
+		return;
+	}
+
 	switch( bconst->operation ) {
 	case VIPS_OPERATION_BOOLEAN_AND: 	
 		SWITCH( LOOPC, FLOOPC, & ); 
@@ -31,6 +31,10 @@
  * 	- remove liboil
  * 6/11/11
  * 	- rewrite as a class
+ * 14/10/18
+ * 	- pairwise sums for float lines, merge lines and threads with 
+ * 	  Chan's formula
+ * 	- exact line sums for 8 and 16 bit ints, two passes for 32 bit ints
  */
 
 /*
@@ -77,8 +81,7 @@
 typedef struct _VipsDeviate {
 	VipsStatistic parent_instance;
 
-	double sum;
-	double sum2;
+	VipsStatisticMoments moments;
 	double out;
 } VipsDeviate;
 
@@ -94,7 +97,6 @@ vips_deviate_build( VipsObject *object )
 	VipsDeviate *deviate = (VipsDeviate *) object;
 
 	gint64 vals;
-	double s, s2;
 
 	if( statistic->in &&
 		vips_check_noncomplex( class->nickname, statistic->in ) )
@@ -103,37 +105,27 @@ vips_deviate_build( VipsObject *object )
 	if( VIPS_OBJECT_CLASS( vips_deviate_parent_class )->build( object ) )
 		return( -1 );
 
-	/*
-	  
-		NOTE: NR suggests a two-pass algorithm to minimise roundoff. 
-		But that's too expensive for us :-( so do it the old one-pass 
-		way.
-
-	 */
-
 	/* Calculate and return deviation. Add a fabs to stop sqrt(<=0).
 	 */
 	vals = (gint64) 
 		vips_image_get_width( statistic->in ) * 
 		vips_image_get_height( statistic->in ) * 
 		vips_image_get_bands( statistic->in );
-	s = deviate->sum;
-	s2 = deviate->sum2;
 
 	g_object_set( object, 
-		"out", sqrt( VIPS_FABS( s2 - (s * s / vals) ) / (vals - 1) ),
+		"out", sqrt( VIPS_FABS( deviate->moments.m2 ) / (vals - 1) ),
 		NULL );
 
 	return( 0 );
 }
 
-/* Start function: allocate space for an array in which we can accumulate the
- * sum and sum of squares for this thread.
+/* Start function: allocate space for the moments of the pixels this thread
+ * sees.
  */
 static void *
 vips_deviate_start( VipsStatistic *statistic )
 {
-	return( (void *) g_new0( double, 2 ) );
+	return( (void *) g_new0( VipsStatisticMoments, 1 ) );
 }
 
 /* Stop function. Add this little sum to the main sum.
@@ -142,59 +134,119 @@ static int
 vips_deviate_stop( VipsStatistic *statistic, void *seq )
 {
 	VipsDeviate *deviate = (VipsDeviate *) statistic;
-	double *ss2 = (double *) seq;
+	VipsStatisticMoments *moments = (VipsStatisticMoments *) seq;
 
-	deviate->sum += ss2[0];
-	deviate->sum2 += ss2[1];
+	vips__statistic_moments_add( &deviate->moments, moments );
 
-	g_free( ss2 );
+	g_free( moments );
 
 	return( 0 );
 }
 
-#define LOOP( TYPE ) { \
+/* Small int types: sum v and v * v exactly in 64 bits. OFFSET makes signed 
+ * values non-negative, which doesn't change the variance.
+ *
+ * Then with sum = q * sz + r, 0 <= r < sz, 
+ *
+ *	m2 = sum2 - sum * sum / sz 
+ *	   = (sum2 - q * q * sz - 2 * q * r) - r * r / sz
+ *
+ * and the bracketed part is exact in integer arithmetic, so there's no 
+ * cancellation, even for constant lines.
+ */
+#define LOOP_EXACT( TYPE, OFFSET ) { \
 	TYPE *p = (TYPE *) in; \
+	guint64 sum; \
+	guint64 sum2; \
+	guint64 q, r; \
 	\
+	sum = 0; \
+	sum2 = 0; \
 	for( x = 0; x < sz; x++ ) { \
-		TYPE v = p[x]; \
+		guint64 v = (gint64) p[x] + OFFSET; \
 		\
 		sum += v; \
-		sum2 += (double) v * (double) v; \
+		sum2 += v * v; \
 	} \
+	\
+	q = sum / sz; \
+	r = sum % sz; \
+	line.mean = (double) ((gint64) sum - (gint64) OFFSET * sz) / sz; \
+	line.m2 = (double) (gint64) (sum2 - q * q * sz - 2 * q * r) - \
+		(double) r * r / sz; \
+	line.m2 = VIPS_MAX( 0.0, line.m2 ); \
 }
 
+/* 32-bit int types: v * v needs more than 64 bits, so take an exact sum for
+ * the mean, then a second pass, from cache, for the squared differences.
+ */
+#define LOOP_TWO_PASS( TYPE, ACC ) { \
+	TYPE *p = (TYPE *) in; \
+	ACC sum; \
+	double m2; \
+	\
+	sum = 0; \
+	for( x = 0; x < sz; x++ ) \
+		sum += p[x]; \
+	line.mean = (double) sum / sz; \
+	\
+	m2 = 0.0; \
+	for( x = 0; x < sz; x++ ) { \
+		double d = p[x] - line.mean; \
+		\
+		m2 += d * d; \
+	} \
+	line.m2 = m2; \
+}
+
+/* We find the moments of each line, exactly for small int types, with two
+ * passes for everything else, see above. Float lines get a pairwise sum for 
+ * the mean. Lines are then merged into the moments for this thread. 
+ */
 static int
 vips_deviate_scan( VipsStatistic *statistic, void *seq, 
 	int x, int y, void *in, int n )
 {
 	const int sz = n * vips_image_get_bands( statistic->in );
 
-	double *ss2 = (double *) seq;
+	VipsStatisticMoments *moments = (VipsStatisticMoments *) seq;
+
+	VipsStatisticMoments line;
 
-	double sum;
-	double sum2;
+	if( sz == 0 )
+		return( 0 );
 
-	sum = ss2[0];
-	sum2 = ss2[1];
+	line.n = sz;
 
 	/* Now generate code for all types. 
 	 */
 	switch( vips_image_get_format( statistic->in ) ) {
-	case VIPS_FORMAT_UCHAR:		LOOP( unsigned char ); break; 
-	case VIPS_FORMAT_CHAR:		LOOP( signed char ); break; 
-	case VIPS_FORMAT_USHORT:	LOOP( unsigned short ); break; 
-	case VIPS_FORMAT_SHORT:		LOOP( signed short ); break; 
-	case VIPS_FORMAT_UINT:		LOOP( unsigned int ); break;
-	case VIPS_FORMAT_INT:		LOOP( signed int ); break; 
-	case VIPS_FORMAT_FLOAT:		LOOP( float ); break; 
-	case VIPS_FORMAT_DOUBLE:	LOOP( double ); break; 
+	case VIPS_FORMAT_UCHAR:		LOOP_EXACT( unsigned char, 0 ); break; 
+	case VIPS_FORMAT_CHAR:		LOOP_EXACT( signed char, 128 ); break; 
+	case VIPS_FORMAT_USHORT:	LOOP_EXACT( unsigned short, 0 ); break; 
+	case VIPS_FORMAT_SHORT:		LOOP_EXACT( signed short, 32768 ); break; 
+	case VIPS_FORMAT_UINT:		LOOP_TWO_PASS( unsigned int, guint64 ); 
+					break;
+	case VIPS_FORMAT_INT:		LOOP_TWO_PASS( signed int, gint64 ); 
+					break; 
+	case VIPS_FORMAT_FLOAT:		
+		line.mean = vips__statistic_sum_float( (float *) in, 
+			sz, 0.0 ) / sz;
+		line.m2 = vips__statistic_sum2_float( (float *) in, 
+			sz, line.mean );
+		break; 
+	case VIPS_FORMAT_DOUBLE:	
+		line.mean = vips__statistic_sum_double( (double *) in, 
+			sz, 0.0 ) / sz;
+		line.m2 = vips__statistic_sum2_double( (double *) in, 
+			sz, line.mean );
+		break; 
 
 	default: 
 		g_assert_not_reached();
 	}
 
-	ss2[0] = sum;
-	ss2[1] = sum2;
+	vips__statistic_moments_add( moments, &line );
 
 	return( 0 );
 }
@@ -5,6 +5,11 @@
  * 18/9/17 kleisauke 
  * 	- missing bandor
  * 	- only flatten if there is an alpha
+ * 14/10/18
+ * 	- add "inward" mode: search in from each edge and stop at the first
+ * 	  object line
+ * 	- inward mode renders the mask to memory first for sequential 
+ * 	  sources
  */
 
 /*
@@ -55,6 +60,7 @@ typedef struct _VipsFindTrim {
 	VipsImage *in;
 	double threshold;
 	VipsArrayDouble *background;
+	gboolean inward;
 
 	int left;
 	int top;
@@ -66,6 +72,140 @@ typedef VipsOperationClass VipsFindTrimClass;
 
 G_DEFINE_TYPE( VipsFindTrim, vips_find_trim, VIPS_TYPE_OPERATION );
 
+/* In inward mode, test this many lines at once, then go a line at a time 
+ * once we've found something.
+ */
+#define VIPS_FIND_TRIM_STRIP (16)
+
+/* Is any pixel in lines @i to @i + @n - 1 in from an edge of @area set? 
+ * Search columns if @horizontal, and from the right or bottom if @reverse.
+ */
+static int
+vips_find_trim_lines( VipsImage *mask, VipsRect *area, 
+	gboolean horizontal, gboolean reverse, int i, int n, gboolean *set )
+{
+	VipsRect strip;
+	VipsImage *x;
+	double max;
+
+	strip = *area;
+	if( horizontal ) {
+		strip.left = reverse ? 
+			VIPS_RECT_RIGHT( area ) - i - n : area->left + i;
+		strip.width = n;
+	}
+	else {
+		strip.top = reverse ? 
+			VIPS_RECT_BOTTOM( area ) - i - n : area->top + i;
+		strip.height = n;
+	}
+
+	if( vips_crop( mask, &x, 
+		strip.left, strip.top, strip.width, strip.height, NULL ) )
+		return( -1 );
+	if( vips_max( x, &max, NULL ) ) {
+		g_object_unref( x );
+		return( -1 );
+	}
+	g_object_unref( x );
+
+	*set = max > 0;
+
+	return( 0 );
+}
+
+/* Search in from one edge of @area for the first line with anything set in
+ * @mask. @found is the number of lines we pass, or the size of @area if 
+ * there's nothing. 
+ */
+static int
+vips_find_trim_edge( VipsImage *mask, VipsRect *area, 
+	gboolean horizontal, gboolean reverse, int *found )
+{
+	int size = horizontal ? area->width : area->height;
+
+	int step;
+	int i;
+
+	step = VIPS_FIND_TRIM_STRIP;
+	i = 0;
+	while( i < size ) {
+		int n = VIPS_MIN( step, size - i );
+
+		gboolean set;
+
+		if( vips_find_trim_lines( mask, area, 
+			horizontal, reverse, i, n, &set ) )
+			return( -1 );
+
+		if( set ) {
+			if( n == 1 ) 
+				break;
+
+			/* Something in this strip, go back over it a line
+			 * at a time.
+			 */
+			step = 1;
+		}
+		else
+			i += n;
+	}
+
+	*found = i;
+
+	return( 0 );
+}
+
+/* Find top and bottom first, then we only need to search that band of
+ * rows for left and right.
+ */
+static int
+vips_find_trim_inward( VipsFindTrim *find_trim, VipsImage *mask )
+{
+	VipsRect area;
+	int top, bottom, left, right;
+
+	area.left = 0;
+	area.top = 0;
+	area.width = mask->Xsize;
+	area.height = mask->Ysize;
+
+	if( vips_find_trim_edge( mask, &area, FALSE, FALSE, &top ) )
+		return( -1 );
+
+	/* All background. Match the values we'd get from a full scan.
+	 */
+	if( top == mask->Ysize ) {
+		g_object_set( find_trim,
+			"left", mask->Xsize,
+			"top", mask->Ysize,
+			"width", 0,
+			"height", 0,
+			NULL ); 
+
+		return( 0 );
+	}
+
+	if( vips_find_trim_edge( mask, &area, FALSE, TRUE, &bottom ) )
+		return( -1 );
+
+	area.top = top;
+	area.height = mask->Ysize - top - bottom;
+
+	if( vips_find_trim_edge( mask, &area, TRUE, FALSE, &left ) ||
+		vips_find_trim_edge( mask, &area, TRUE, TRUE, &right ) )
+		return( -1 );
+
+	g_object_set( find_trim,
+		"left", left,
+		"top", top,
+		"width", VIPS_MAX( 0, mask->Xsize - right - left ),
+		"height", area.height,
+		NULL ); 
+
+	return( 0 );
+}
+
 static int
 vips_find_trim_build( VipsObject *object )
 {
@@ -129,6 +269,22 @@ vips_find_trim_build( VipsObject *object )
 		return( -1 ); 
 	in = t[5];
 
+	if( find_trim->inward ) {
+		/* Each edge search reads the mask again. Sequential sources 
+		 * can only be read once, top to bottom, so render the mask 
+		 * to memory in a single pass first. It's one uchar band, so
+		 * small compared to the input.
+		 */
+		if( vips_image_get_typeof( find_trim->in, 
+			VIPS_META_SEQUENTIAL ) ) {
+			if( !(t[18] = vips_image_copy_memory( in )) )
+				return( -1 );
+			in = t[18];
+		}
+
+		return( vips_find_trim_inward( find_trim, in ) );
+	}
+
 	/* t[6] == column sums, t[7] == row sums. 
 	 */
 	if( vips_project( in, &t[6], &t[7], NULL ) )
@@ -199,6 +355,13 @@ vips_find_trim_class_init( VipsFindTrimClass *class )
 		G_STRUCT_OFFSET( VipsFindTrim, background ),
 		VIPS_TYPE_ARRAY_DOUBLE );
 
+	VIPS_ARG_BOOL( class, "inward", 4, 
+		_( "Inward" ), 
+		_( "Search in from each edge, stop at the first object line" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsFindTrim, inward ),
+		FALSE );
+
 	VIPS_ARG_INT( class, "left", 5, 
 		_( "Left" ), 
 		_( "Left edge of image" ),
@@ -249,6 +412,7 @@ vips_find_trim_init( VipsFindTrim *find_trim )
  *
  * * @threshold: %gdouble, background / object threshold
  * * @background: #VipsArrayDouble, background colour
+ * * @inward: %gboolean, search in from each edge
  *
  * Search @in for the bounding box of the non-background area. 
  *
@@ -268,6 +432,13 @@ vips_find_trim_init( VipsFindTrim *find_trim )
  *
  * @threshold defaults to 10. 
  *
+ * Set @inward to search in from each edge instead, a few lines at a time, 
+ * stopping at the first line with something in. The result is the same, 
+ * but if the object is near the edges, most of the image is never 
+ * computed. Top and bottom are found first, then left and right are only 
+ * searched between them. Each edge search reads the image again, so for 
+ * sequential sources the thresholded mask is rendered to memory first.
+ *
  * See also: vips_getpoint(), vips_extract_area(), vips_smartcrop().
  *
  * Returns: 0 on success, -1 on error
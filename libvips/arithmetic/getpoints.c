@@ -0,0 +1,338 @@
+/* read many points from an image
+ *
+ * 14/10/18
+ * 	- from getpoint.c
+ */
+
+/*
+
+    This file is part of VIPS.
+
+    VIPS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA
+
+ */
+
+/*
+
+    These files are distributed with VIPS - http://www.vips.ecs.soton.ac.uk
+
+ */
+
+/*
+#define VIPS_DEBUG
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /*HAVE_CONFIG_H*/
+#include <vips/intl.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vips/vips.h>
+#include <vips/internal.h>
+
+typedef struct _VipsGetpoints {
+	VipsOperation parent_instance;
+
+	VipsImage *in;
+	VipsImage *out;
+	VipsArrayInt *points;
+	int size;
+
+	/* The input tile size, we sort points by tile.
+	 */
+	int tile_width;
+	int tile_height;
+
+} VipsGetpoints;
+
+typedef VipsOperationClass VipsGetpointsClass;
+
+G_DEFINE_TYPE( VipsGetpoints, vips_getpoints, VIPS_TYPE_OPERATION );
+
+/* Sort point indexes by tile row, then tile, then position.
+ */
+static int
+vips_getpoints_compare( const void *a, const void *b, void *user_data )
+{
+	VipsGetpoints *getpoints = (VipsGetpoints *) user_data;
+	int *xy = (int *) VIPS_AREA( getpoints->points )->data;
+	int i = *((int *) a);
+	int j = *((int *) b);
+	int xi = xy[2 * i];
+	int yi = xy[2 * i + 1];
+	int xj = xy[2 * j];
+	int yj = xy[2 * j + 1];
+
+	int d;
+
+	if( (d = yi / getpoints->tile_height - yj / getpoints->tile_height) ||
+		(d = xi / getpoints->tile_width - xj / getpoints->tile_width) ||
+		(d = yi - yj) ||
+		(d = xi - xj) )
+		return( d );
+
+	return( i - j );
+}
+
+/* The area we average for point i, clipped to the image.
+ */
+static void
+vips_getpoints_window( VipsGetpoints *getpoints, VipsImage *image,
+	int i, VipsRect *window )
+{
+	int *xy = (int *) VIPS_AREA( getpoints->points )->data;
+
+	VipsRect all;
+
+	window->left = xy[2 * i] - getpoints->size / 2;
+	window->top = xy[2 * i + 1] - getpoints->size / 2;
+	window->width = getpoints->size;
+	window->height = getpoints->size;
+
+	all.left = 0;
+	all.top = 0;
+	all.width = image->Xsize;
+	all.height = image->Ysize;
+	vips_rect_intersectrect( window, &all, window );
+}
+
+/* Average the window for point i into q. There are ne doubles per pixel.
+ */
+static void
+vips_getpoints_measure( VipsGetpoints *getpoints, VipsRegion *region,
+	int ne, int i, double *q )
+{
+	VipsRect window;
+	int x, y, k;
+
+	vips_getpoints_window( getpoints, region->im, i, &window );
+
+	for( k = 0; k < ne; k++ )
+		q[k] = 0.0;
+
+	for( y = 0; y < window.height; y++ ) {
+		double *p = (double *)
+			VIPS_REGION_ADDR( region, window.left, window.top + y );
+
+		for( x = 0; x < window.width; x++ ) {
+			for( k = 0; k < ne; k++ )
+				q[k] += p[k];
+
+			p += ne;
+		}
+	}
+
+	for( k = 0; k < ne; k++ )
+		q[k] /= window.width * window.height;
+}
+
+static int
+vips_getpoints_build( VipsObject *object )
+{
+	VipsObjectClass *class = VIPS_OBJECT_GET_CLASS( object );
+	VipsGetpoints *getpoints = (VipsGetpoints *) object;
+	VipsImage **t = (VipsImage **) vips_object_local_array( object, 2 );
+
+	int *xy;
+	int n_points;
+	int *order;
+	VipsRegion *region;
+	gboolean iscomplex;
+	int ne;
+	int i, j;
+
+	if( VIPS_OBJECT_CLASS( vips_getpoints_parent_class )->build( object ) )
+		return( -1 );
+
+	xy = vips_array_int_get( getpoints->points, &n_points );
+	if( n_points == 0 ||
+		n_points % 2 != 0 ) {
+		vips_error( class->nickname,
+			"%s", _( "points must be a list of x, y pairs" ) );
+		return( -1 );
+	}
+	n_points /= 2;
+
+	for( i = 0; i < n_points; i++ )
+		if( xy[2 * i] < 0 ||
+			xy[2 * i] >= getpoints->in->Xsize ||
+			xy[2 * i + 1] < 0 ||
+			xy[2 * i + 1] >= getpoints->in->Ysize ) {
+			vips_error( class->nickname,
+				_( "point %d is outside the image" ), i );
+			return( -1 );
+		}
+
+	/* Average in double, or double complex.
+	 */
+	if( vips_image_decode( getpoints->in, &t[0] ) )
+		return( -1 );
+	iscomplex = vips_band_format_iscomplex( t[0]->BandFmt );
+	if( vips_cast( t[0], &t[1], iscomplex ?
+		VIPS_FORMAT_DPCOMPLEX : VIPS_FORMAT_DOUBLE, NULL ) )
+		return( -1 );
+	ne = t[1]->Bands * (iscomplex ? 2 : 1);
+
+	g_object_set( object,
+		"out", vips_image_new_matrix( ne, n_points ),
+		NULL );
+
+	/* Visit the points tile by tile, so we compute each tile once.
+	 */
+	vips_get_tile_size( t[1],
+		&getpoints->tile_width, &getpoints->tile_height, &j );
+	order = VIPS_ARRAY( object, n_points, int );
+	for( i = 0; i < n_points; i++ )
+		order[i] = i;
+	g_qsort_with_data( order, n_points, sizeof( int ),
+		vips_getpoints_compare, getpoints );
+
+	region = vips_region_new( t[1] );
+
+	for( i = 0; i < n_points; i = j ) {
+		int tx = xy[2 * order[i]] / getpoints->tile_width;
+		int ty = xy[2 * order[i] + 1] / getpoints->tile_height;
+
+		VipsRect area;
+
+		/* Find the run of points in this tile, and the area their
+		 * windows cover.
+		 */
+		vips_getpoints_window( getpoints, t[1], order[i], &area );
+		for( j = i + 1; j < n_points; j++ ) {
+			VipsRect window;
+
+			if( xy[2 * order[j]] / getpoints->tile_width != tx ||
+				xy[2 * order[j] + 1] /
+					getpoints->tile_height != ty )
+				break;
+
+			vips_getpoints_window( getpoints,
+				t[1], order[j], &window );
+			vips_rect_unionrect( &area, &window, &area );
+		}
+
+		if( vips_region_prepare( region, &area ) ) {
+			g_object_unref( region );
+			return( -1 );
+		}
+
+		for( ; i < j; i++ )
+			vips_getpoints_measure( getpoints, region, ne,
+				order[i],
+				VIPS_MATRIX( getpoints->out, 0, order[i] ) );
+	}
+
+	g_object_unref( region );
+
+	return( 0 );
+}
+
+static void
+vips_getpoints_class_init( VipsGetpointsClass *class )
+{
+	GObjectClass *gobject_class = (GObjectClass *) class;
+	VipsObjectClass *object_class = (VipsObjectClass *) class;
+
+	gobject_class->set_property = vips_object_set_property;
+	gobject_class->get_property = vips_object_get_property;
+
+	object_class->nickname = "getpoints";
+	object_class->description = _( "read a set of points from an image" );
+	object_class->build = vips_getpoints_build;
+
+	VIPS_ARG_IMAGE( class, "in", 1,
+		_( "in" ),
+		_( "Input image" ),
+		VIPS_ARGUMENT_REQUIRED_INPUT,
+		G_STRUCT_OFFSET( VipsGetpoints, in ) );
+
+	VIPS_ARG_IMAGE( class, "out", 2,
+		_( "Output" ),
+		_( "Output matrix, one row per point" ),
+		VIPS_ARGUMENT_REQUIRED_OUTPUT,
+		G_STRUCT_OFFSET( VipsGetpoints, out ) );
+
+	VIPS_ARG_BOXED( class, "points", 5,
+		_( "Points" ),
+		_( "Array of x, y pairs to read" ),
+		VIPS_ARGUMENT_REQUIRED_INPUT,
+		G_STRUCT_OFFSET( VipsGetpoints, points ),
+		VIPS_TYPE_ARRAY_INT );
+
+	VIPS_ARG_INT( class, "size", 6,
+		_( "Size" ),
+		_( "Average over a square this many pixels across" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsGetpoints, size ),
+		1, 1000, 1 );
+
+}
+
+static void
+vips_getpoints_init( VipsGetpoints *getpoints )
+{
+	getpoints->size = 1;
+}
+
+/**
+ * vips_getpoints: (method)
+ * @in: image to read from
+ * @out: (out): output matrix
+ * @xy: (array length=n): x, y pairs to read
+ * @n: number of points
+ * @...: %NULL-terminated list of optional named arguments
+ *
+ * Optional arguments:
+ *
+ * * @size: average over a square this many pixels across
+ *
+ * Read @n pixels from @in. @xy holds 2 * @n ints, the x and y of each point.
+ * @out is a double matrix with one row per point, in the same order as @xy,
+ * and one column per band. Complex images have a pair of columns per band,
+ * real then imaginary.
+ *
+ * Set @size to average a @size by @size square centred on each point,
+ * clipped to the image.
+ *
+ * This is much quicker than calling vips_getpoint() many times: the points
+ * are sorted by tile, and each tile is computed only once.
+ *
+ * See also: vips_getpoint(), vips_measure().
+ *
+ * Returns: 0 on success, or -1 on error.
+ */
+int
+vips_getpoints( VipsImage *in, VipsImage **out, const int *xy, int n, ... )
+{
+	va_list ap;
+	VipsArrayInt *points;
+	int result;
+
+	points = vips_array_int_new( xy, 2 * n );
+
+	va_start( ap, n );
+	result = vips_call_split( "getpoints", ap, in, out, points );
+	va_end( ap );
+
+	vips_area_unref( VIPS_AREA( points ) );
+
+	return( result );
+}
@@ -26,6 +26,10 @@
  * 	- redo as a class
  * 28/2/16 lovell
  * 	- unroll common cases
+ * 14/10/18
+ * 	- uchar sequences spread pixels over several sets of bins
+ * 	- ushort sequences keep a coarse hist, use it to find the max and
+ * 	  skip empty blocks on merge
  */
 
 /*
@@ -66,6 +70,18 @@
 
 #include "statistic.h"
 
+/* Sequences accumulate uchar histograms into this many interleaved sets of
+ * bins. Runs of the same value (flat sky, say) would otherwise make each
+ * increment wait for the store from the one before.
+ */
+#define VIPS_HIST_FIND_NSUB (4)
+
+/* ushort sequences also count values in blocks of this many bins, so we can
+ * find the maximum and skip empty blocks when we merge. 
+ */
+#define VIPS_HIST_FIND_BLOCK_SHIFT (8)
+#define VIPS_HIST_FIND_BLOCK (1 << VIPS_HIST_FIND_BLOCK_SHIFT)
+
 /* Accumulate a histogram in one of these.
  */
 typedef struct {
@@ -74,6 +90,15 @@ typedef struct {
 	int size;		/* Number of bins for each band */
 	int mx;			/* Maximum value we have seen */
 	unsigned int **bins;	/* All the bins! */
+
+	/* Sequences only: extra sets of uchar bins, sub[0] is bins.
+	 */
+	int n_sub;
+	unsigned int **sub[VIPS_HIST_FIND_NSUB];
+
+	/* Sequences only: a coarse ushort histogram, or NULL.
+	 */
+	unsigned int **coarse;
 } Histogram;
 
 typedef struct _VipsHistFind {
@@ -97,29 +122,58 @@ typedef VipsStatisticClass VipsHistFindClass;
 
 G_DEFINE_TYPE( VipsHistFind, vips_hist_find, VIPS_TYPE_STATISTIC );
 
-/* Build a Histogram.
- */
-static Histogram *
-histogram_new( VipsHistFind *hist_find, int bands, int which, int size )
+static unsigned int **
+histogram_bins_new( VipsHistFind *hist_find, int bands, int size )
 {
-	Histogram *hist;
+	unsigned int **bins;
 	int i;
 
-	if( !(hist = VIPS_NEW( hist_find, Histogram )) ||
-		!(hist->bins = VIPS_ARRAY( hist_find, bands, unsigned int * )) )
+	if( !(bins = VIPS_ARRAY( hist_find, bands, unsigned int * )) )
 		return( NULL );
 
 	for( i = 0; i < bands; i++ ) {
-		if( !(hist->bins[i] = 
-			VIPS_ARRAY( hist_find, size, unsigned int )) )
+		if( !(bins[i] = VIPS_ARRAY( hist_find, size, unsigned int )) )
 			return( NULL );
-		memset( hist->bins[i], 0, size * sizeof( unsigned int ) );
+		memset( bins[i], 0, size * sizeof( unsigned int ) );
 	}
 
+	return( bins );
+}
+
+/* Build a Histogram. Sequence hists get the extra bins for the fast scans.
+ */
+static Histogram *
+histogram_new( VipsHistFind *hist_find, 
+	int bands, int which, int size, gboolean seq )
+{
+	Histogram *hist;
+	int i;
+
+	if( !(hist = VIPS_NEW( hist_find, Histogram )) ||
+		!(hist->bins = histogram_bins_new( hist_find, bands, size )) )
+		return( NULL );
+
 	hist->bands = bands;
 	hist->which = which;
 	hist->size = size;
 	hist->mx = 0;
+	hist->n_sub = 1;
+	hist->sub[0] = hist->bins;
+	hist->coarse = NULL;
+
+	if( seq &&
+		size == 256 ) {
+		hist->n_sub = VIPS_HIST_FIND_NSUB;
+		for( i = 1; i < hist->n_sub; i++ ) 
+			if( !(hist->sub[i] = 
+				histogram_bins_new( hist_find, bands, size )) )
+				return( NULL );
+	}
+	else if( seq ) {
+		if( !(hist->coarse = histogram_bins_new( hist_find, 
+			bands, size / VIPS_HIST_FIND_BLOCK )) )
+			return( NULL );
+	}
 
 	return( hist );
 }
@@ -190,12 +244,41 @@ vips_hist_find_start( VipsStatistic *statistic )
 				statistic->ready->Bands : 1,
 			hist_find->which, 
 			statistic->ready->BandFmt == VIPS_FORMAT_UCHAR ? 
-				256 : 65536 );
+				256 : 65536, FALSE );
 
 	return( (void *) histogram_new( hist_find, 
 		hist_find->hist->bands, 
 		hist_find->hist->which, 
-		hist_find->hist->size ) );
+		hist_find->hist->size, TRUE ) );
+}
+
+/* Find the largest value in a ushort sub-hist from the coarse hist.
+ */
+static int
+histogram_max( Histogram *hist )
+{
+	int n_blocks = hist->size / VIPS_HIST_FIND_BLOCK;
+
+	int mx;
+	int i, c, j;
+
+	mx = 0;
+	for( i = 0; i < hist->bands; i++ ) {
+		for( c = n_blocks - 1; c >= 0; c-- )
+			if( hist->coarse[i][c] )
+				break;
+		if( c < 0 )
+			continue;
+
+		for( j = (c + 1) * VIPS_HIST_FIND_BLOCK - 1; 
+			j >= c * VIPS_HIST_FIND_BLOCK; j-- )
+			if( hist->bins[i][j] )
+				break;
+
+		mx = VIPS_MAX( mx, j );
+	}
+
+	return( mx );
 }
 
 /* Join a sub-hist onto the main hist.
@@ -207,23 +290,54 @@ vips_hist_find_stop( VipsStatistic *statistic, void *seq )
 	VipsHistFind *hist_find = (VipsHistFind *) statistic;
 	Histogram *hist = hist_find->hist; 
 
-	int i, j;
+	int i, j, k;
 
 	g_assert( sub_hist->bands == hist->bands && 
 		sub_hist->size == hist->size );
 
-	/* Add on sub-data.
+	/* Add on sub-data. ushort hists can skip empty blocks.
 	 */
+	if( sub_hist->coarse ) {
+		int n_blocks = sub_hist->size / VIPS_HIST_FIND_BLOCK;
+
+		int c;
+
+		sub_hist->mx = histogram_max( sub_hist );
+
+		for( i = 0; i < hist->bands; i++ )
+			for( c = 0; c < n_blocks; c++ ) {
+				unsigned int *p;
+				unsigned int *q;
+
+				if( !sub_hist->coarse[i][c] )
+					continue;
+
+				p = sub_hist->bins[i] + 
+					c * VIPS_HIST_FIND_BLOCK;
+				q = hist->bins[i] + c * VIPS_HIST_FIND_BLOCK;
+				for( j = 0; j < VIPS_HIST_FIND_BLOCK; j++ )
+					q[j] += p[j];
+			}
+	}
+	else 
+		for( k = 0; k < sub_hist->n_sub; k++ )
+			for( i = 0; i < hist->bands; i++ ) {
+				unsigned int *p = sub_hist->sub[k][i];
+				unsigned int *q = hist->bins[i];
+
+				for( j = 0; j < hist->size; j++ )
+					q[j] += p[j];
+			}
+
 	hist->mx = VIPS_MAX( hist->mx, sub_hist->mx );
-	for( i = 0; i < hist->bands; i++ )
-		for( j = 0; j < hist->size; j++ )
-			hist->bins[i][j] += sub_hist->bins[i][j];
 
 	/* Blank out sub-hist to make sure we can't add it again.
 	 */
 	sub_hist->mx = 0;
-	for( i = 0; i < sub_hist->bands; i++ )
-		sub_hist->bins[i] = NULL;
+	for( k = 0; k < sub_hist->n_sub; k++ )
+		for( i = 0; i < sub_hist->bands; i++ )
+			sub_hist->sub[k][i] = NULL;
+	sub_hist->coarse = NULL;
 
 	return( 0 );
 }
@@ -235,48 +349,54 @@ vips_hist_find_uchar_scan( VipsStatistic *statistic,
 	void *seq, int x, int y, void *in, int n )
 {
 	Histogram *hist = (Histogram *) seq;
-	unsigned int *bins = hist->bins[0];
 	int nb = statistic->ready->Bands;
 	VipsPel *p = (VipsPel *) in;
 
-	int j;
+	int j, z;
+
+	g_assert( hist->n_sub == 4 );
 
 	/* The inner loop cannot be auto-vectorized by the compiler.
-	 * Unroll for common cases. 
+	 * Unroll for common cases, and spread neighbouring pixels over
+	 * the sets of bins so repeated values don't stall.
 	 */
 	switch( nb ) {
 	case 1:
-		for( j = 0; j < n; j++ )
-			bins[p[j]] += 1;
-		break;
-
-	case 2:
-		for( j = 0; j < n; j++ ) {
-			hist->bins[0][p[0]] += 1;
-			hist->bins[1][p[1]] += 1;
-
-			p += 2;
+	{
+		unsigned int *b0 = hist->sub[0][0];
+		unsigned int *b1 = hist->sub[1][0];
+		unsigned int *b2 = hist->sub[2][0];
+		unsigned int *b3 = hist->sub[3][0];
+
+		for( j = 0; j + 3 < n; j += 4 ) {
+			b0[p[j]] += 1;
+			b1[p[j + 1]] += 1;
+			b2[p[j + 2]] += 1;
+			b3[p[j + 3]] += 1;
 		}
+		for( ; j < n; j++ )
+			b0[p[j]] += 1;
+	}
 		break;
 
+	case 2:
 	case 3:
-		for( j = 0; j < n; j++ ) {
-			hist->bins[0][p[0]] += 1;
-			hist->bins[1][p[1]] += 1;
-			hist->bins[2][p[2]] += 1;
+	case 4:
+		/* Two pixels at a time into alternate sets of bins.
+		 */
+		for( j = 0; j + 1 < n; j += 2 ) {
+			for( z = 0; z < nb; z++ ) {
+				hist->sub[0][z][p[z]] += 1;
+				hist->sub[1][z][p[z + nb]] += 1;
+			}
 
-			p += 3;
+			p += 2 * nb;
 		}
-		break;
-
-	case 4:
-		for( j = 0; j < n; j++ ) {
-			hist->bins[0][p[0]] += 1;
-			hist->bins[1][p[1]] += 1;
-			hist->bins[2][p[2]] += 1;
-			hist->bins[3][p[3]] += 1;
+		for( ; j < n; j++ ) {
+			for( z = 0; z < nb; z++ ) 
+				hist->sub[0][z][p[z]] += 1;
 
-			p += 4;
+			p += nb;
 		}
 		break;
 
@@ -284,8 +404,6 @@ vips_hist_find_uchar_scan( VipsStatistic *statistic,
 		/* Loop when >4 bands
 		 */
 		for( j = 0; j < n; j++ ) {
-			int z;
-
 			for( z = 0; z < nb; z++ ) 
 				hist->bins[z][p[z]] += 1;
 
@@ -309,13 +427,24 @@ vips_hist_find_uchar_extract_scan( VipsStatistic *statistic,
 	Histogram *hist = (Histogram *) seq;
 	int nb = statistic->ready->Bands;
 	int max = n * nb;
-	unsigned int *bins = hist->bins[0];
+	unsigned int *b0 = hist->sub[0][0];
+	unsigned int *b1 = hist->sub[1][0];
+	unsigned int *b2 = hist->sub[2][0];
+	unsigned int *b3 = hist->sub[3][0];
 	VipsPel *p = (VipsPel *) in;
 
 	int i;
 
-	for( i = hist->which; i < max; i += nb ) 
-		bins[p[i]] += 1;
+	g_assert( hist->n_sub == 4 );
+
+	for( i = hist->which; i + 3 * nb < max; i += 4 * nb ) {
+		b0[p[i]] += 1;
+		b1[p[i + nb]] += 1;
+		b2[p[i + 2 * nb]] += 1;
+		b3[p[i + 3 * nb]] += 1;
+	}
+	for( ; i < max; i += nb ) 
+		b0[p[i]] += 1;
 
 	/* Note the maximum.
 	 */
@@ -324,38 +453,32 @@ vips_hist_find_uchar_extract_scan( VipsStatistic *statistic,
 	return( 0 );
 }
 
-/* Histogram of all bands of a ushort image.
+/* Histogram of all bands of a ushort image. We find the maximum from the
+ * coarse hist on stop.
  */
 static int
 vips_hist_find_ushort_scan( VipsStatistic *statistic, 
 	void *seq, int x, int y, void *in, int n )
 {
 	Histogram *hist = (Histogram *) seq;
-	int mx = hist->mx;
 	int nb = statistic->ready->Bands;
 	unsigned short *p = (unsigned short *) in; 
 
 	int j, z; 
 
+	g_assert( hist->coarse );
+
 	for( j = 0; j < n; j++ ) {
 		for( z = 0; z < nb; z++ ) {
 			int v = p[z];
 
-			/* Adjust maximum.
-			 */
-			if( v > mx )
-				mx = v;
-
 			hist->bins[z][v] += 1;
+			hist->coarse[z][v >> VIPS_HIST_FIND_BLOCK_SHIFT] += 1;
 		}
 
 		p += nb;
 	}
 
-	/* Note the maximum.
-	 */
-	hist->mx = mx;
-
 	return( 0 );
 }
 
@@ -366,8 +489,8 @@ vips_hist_find_ushort_extract_scan( VipsStatistic *statistic,
 	void *seq, int x, int y, void *in, int n )
 {
 	Histogram *hist = (Histogram *) seq;
-	int mx = hist->mx;
 	unsigned int *bins = hist->bins[0];
+	unsigned int *coarse = hist->coarse[0];
 	unsigned short *p = (unsigned short *) in;
 	int nb = statistic->ready->Bands;
 	int max = nb * n;
@@ -377,18 +500,10 @@ vips_hist_find_ushort_extract_scan( VipsStatistic *statistic,
 	for( i = hist->which; i < max; i += nb ) {
 		int v = p[i];
 
-		/* Adjust maximum.
-		 */
-		if( v > mx )
-			mx = v;
-
 		bins[v] += 1;
+		coarse[v >> VIPS_HIST_FIND_BLOCK_SHIFT] += 1;
 	}
 
-	/* Note the maximum.
-	 */
-	hist->mx = mx;
-
 	return( 0 );
 }
 
@@ -8,6 +8,8 @@
  * 	- small celanups
  * 17/8/13
  * 	- redo as a class
+ * 14/10/18
+ * 	- flat accumulators, sparse ones for threads if there are many bins
  */
 
 /*
@@ -50,16 +52,33 @@
 
 #include "statistic.h"
 
+/* Histograms with more than this many cells, or more cells than the image 
+ * has pixels, are accumulated sparsely by each thread.
+ */
+#define VIPS_HIST_FIND_NDIM_DENSE (1 << 20)
+
+/* Refuse to make histograms with more than this many cells.
+ */
+#define VIPS_HIST_FIND_NDIM_MAX (1 << 30)
+
 struct _VipsHistFindNDim;
 
-/* Accumulate a histogram in one of these.
+/* Accumulate a histogram in one of these. Cell (x, y, z) is at index
+ * (z * bins + y) * bins + x.
  */
 typedef struct {
 	struct _VipsHistFindNDim *ndim;
 
-	int bins;
-	int max_val;
-	unsigned int ***data;		
+	/* Either an array of counts, or a hash from cell index to count.
+	 */
+	unsigned int *data;		
+	GHashTable *sparse;
+
+	/* For sparse histograms, a run of pixels in the same cell which we
+	 * have not added to the hash yet.
+	 */
+	guint last;
+	guint run;
 } Histogram;
 
 typedef struct _VipsHistFindNDim {
@@ -69,6 +88,15 @@ typedef struct _VipsHistFindNDim {
 	 */
 	int bins;
 
+	/* Largest value on each axis, plus one, and number of cells.
+	 */
+	int max_val;
+	size_t cells;
+
+	/* Accumulate sparsely in each thread.
+	 */
+	gboolean sparse;
+
 	/* Main image histogram. Subhists accumulate to this.
 	 */
 	Histogram *hist;
@@ -83,55 +111,85 @@ typedef VipsStatisticClass VipsHistFindNDimClass;
 
 G_DEFINE_TYPE( VipsHistFindNDim, vips_hist_find_ndim, VIPS_TYPE_STATISTIC );
 
-/* Build a Histogram.
+static void
+histogram_free( Histogram *hist )
+{
+	VIPS_FREE( hist->data );
+	VIPS_FREEF( g_hash_table_destroy, hist->sparse );
+	g_free( hist );
+}
+
+/* Build a Histogram. 
  */
 static Histogram *
-histogram_new( VipsHistFindNDim *ndim )
+histogram_new( VipsHistFindNDim *ndim, gboolean sparse )
 {
-	VipsImage *in = VIPS_STATISTIC( ndim )->ready;
-	VipsObjectClass *class = VIPS_OBJECT_GET_CLASS( ndim );
-	int bins = ndim->bins;
-
-	/* How many dimensions do we need to allocate?
-	 */
-	int ilimit = in->Bands > 2 ? bins : 1;
-	int jlimit = in->Bands > 1 ? bins : 1;
-
-	int i, j;
 	Histogram *hist;
 
-	if( !(hist = VIPS_NEW( ndim, Histogram )) )
+	hist = g_new0( Histogram, 1 );
+	hist->ndim = ndim;
+
+	if( sparse )
+		hist->sparse = g_hash_table_new( g_direct_hash, 
+			g_direct_equal );
+	else if( !(hist->data = VIPS_ARRAY( NULL, 
+		ndim->cells, unsigned int )) ) {
+		histogram_free( hist );
 		return( NULL );
+	}
+	else
+		memset( hist->data, 0, ndim->cells * sizeof( unsigned int ) );
 
-	hist->ndim = ndim;
-	hist->bins = bins;
-	hist->max_val = in->BandFmt == VIPS_FORMAT_UCHAR ? 256 : 65536;
+	return( hist );
+}
+
+/* Make the main hist, and decide how threads should work. 
+ */
+static int
+vips_hist_find_ndim_main( VipsHistFindNDim *ndim )
+{
+	VipsObjectClass *class = VIPS_OBJECT_GET_CLASS( ndim );
+	VipsImage *in = VIPS_STATISTIC( ndim )->ready;
+	int bins = ndim->bins;
+
+	int i;
+
+	ndim->max_val = in->BandFmt == VIPS_FORMAT_UCHAR ? 256 : 65536;
 	if( bins < 1 || 
-		bins > hist->max_val ) {
+		bins > ndim->max_val ) {
 		vips_error( class->nickname, 
-			_( "bins out of range [1,%d]" ), hist->max_val );
-		return( NULL );
+			_( "bins out of range [1,%d]" ), ndim->max_val );
+		return( -1 );
 	}
 
-	if( !(hist->data = VIPS_ARRAY( ndim, bins, unsigned int ** )) )
-		return( NULL );
-	memset( hist->data, 0, bins * sizeof( unsigned int ** ) );
-
-	for( i = 0; i < ilimit; i++ ) {
-		if( !(hist->data[i] = 
-			VIPS_ARRAY( ndim, bins, unsigned int * )) )
-			return( NULL );
-		memset( hist->data[i], 0, bins * sizeof( unsigned int * ) );
-		for( j = 0; j < jlimit; j++ ) {
-			if( !(hist->data[i][j] = 
-				VIPS_ARRAY( ndim, bins, unsigned int )) )
-				return( NULL );
-			memset( hist->data[i][j], 
-				0, bins * sizeof( unsigned int ) );
+	ndim->cells = 1;
+	for( i = 0; i < in->Bands; i++ ) {
+		ndim->cells *= bins;
+		if( ndim->cells > VIPS_HIST_FIND_NDIM_MAX ) {
+			vips_error( class->nickname, 
+				"%s", _( "too many bins" ) );
+			return( -1 );
 		}
 	}
 
-	return( hist );
+	ndim->sparse = ndim->cells > VIPS_HIST_FIND_NDIM_DENSE ||
+		ndim->cells > VIPS_IMAGE_N_PELS( in );
+
+	if( !(ndim->hist = histogram_new( ndim, FALSE )) )
+		return( -1 );
+
+	return( 0 );
+}
+
+static void
+vips_hist_find_ndim_finalize( GObject *gobject )
+{
+	VipsHistFindNDim *ndim = (VipsHistFindNDim *) gobject;
+
+	VIPS_FREEF( histogram_free, ndim->hist );
+
+	G_OBJECT_CLASS( vips_hist_find_ndim_parent_class )->
+		finalize( gobject );
 }
 
 static int
@@ -171,7 +229,9 @@ vips_hist_find_ndim_build( VipsObject *object )
 	for( y = 0; y < ndim->out->Ysize; y++ ) {
 		for( i = 0, x = 0; x < ndim->out->Xsize; x++ ) 
 			for( z = 0; z < ndim->out->Bands; z++, i++ )
-				obuffer[i] = ndim->hist->data[z][y][x];
+				obuffer[i] = ndim->hist->data[
+					((size_t) z * ndim->bins + y) * 
+						ndim->bins + x];
 
 		if( vips_image_write_line( ndim->out, y, (VipsPel *) obuffer ) )
 			return( -1 );
@@ -187,13 +247,32 @@ vips_hist_find_ndim_start( VipsStatistic *statistic )
 
 	/* Make the main hist, if necessary.
 	 */
-	if( !ndim->hist ) 
-		ndim->hist = histogram_new( ndim );  
+	if( !ndim->hist &&
+		vips_hist_find_ndim_main( ndim ) )
+		return( NULL );
+
+	return( (void *) histogram_new( ndim, ndim->sparse ) );
+}
+
+static void
+histogram_sparse_add( Histogram *hist, guint index, guint n )
+{
+	gpointer key = GUINT_TO_POINTER( index );
+
+	n += GPOINTER_TO_UINT( g_hash_table_lookup( hist->sparse, key ) );
+	g_hash_table_insert( hist->sparse, key, GUINT_TO_POINTER( n ) );
+}
+
+static void
+histogram_sparse_merge( gpointer key, gpointer value, gpointer user_data )
+{
+	Histogram *hist = (Histogram *) user_data;
 
-	return( (void *) histogram_new( ndim ) );
+	hist->data[GPOINTER_TO_UINT( key )] += GPOINTER_TO_UINT( value );
 }
 
-/* Join a sub-hist onto the main hist.
+/* Join a sub-hist onto the main hist. We only visit the cells a sparse
+ * sub-hist used, and dense sub-hists are added as a single flat array.
  */
 static int
 vips_hist_find_ndim_stop( VipsStatistic *statistic, void *seq )
@@ -202,32 +281,54 @@ vips_hist_find_ndim_stop( VipsStatistic *statistic, void *seq )
 	VipsHistFindNDim *ndim = (VipsHistFindNDim *) statistic;
 	Histogram *hist = ndim->hist; 
 
-	int i, j, k;
+	if( sub_hist->sparse ) {
+		if( sub_hist->run )
+			histogram_sparse_add( sub_hist, 
+				sub_hist->last, sub_hist->run );
 
-	for( i = 0; i < hist->bins; i++ )
-		for( j = 0; j < hist->bins; j++ )
-			for( k = 0; k < hist->bins; k++ )
-				if( hist->data[i] && hist->data[i][j] ) {
-					hist->data[i][j][k] += 
-						sub_hist->data[i][j][k];
+		g_hash_table_foreach( sub_hist->sparse, 
+			histogram_sparse_merge, hist );
+	}
+	else {
+		unsigned int * restrict p = sub_hist->data;
+		unsigned int * restrict q = hist->data;
 
-					/* Zap sub-hist to make sure we 
-					 * can't add it again.
-					 */
-					sub_hist->data[i][j][k] = 0;
-				}
+		size_t i;
+
+		for( i = 0; i < ndim->cells; i++ )
+			q[i] += p[i];
+	}
+
+	histogram_free( sub_hist );
 
 	return( 0 );
 }
 
+/* index[0] is the fastest-varying axis.
+ */
 #define LOOP( TYPE ) { \
 	TYPE *p = (TYPE *) in; \
 	\
 	for( i = 0, j = 0; j < n; j++ ) { \
+		guint cell; \
+		\
 		for( k = 0; k < nb; k++, i++ ) \
 			index[k] = p[i] / scale; \
  		\
-		hist->data[index[2]][index[1]][index[0]] += 1; \
+		cell = (index[2] * bins + index[1]) * bins + index[0]; \
+		\
+		if( !hist->sparse ) \
+			hist->data[cell] += 1; \
+		else if( hist->run && \
+			cell == hist->last ) \
+			hist->run += 1; \
+		else { \
+			if( hist->run ) \
+				histogram_sparse_add( hist, \
+					hist->last, hist->run ); \
+			hist->last = cell; \
+			hist->run = 1; \
+		} \
 	} \
 }
 
@@ -235,12 +336,14 @@ static int
 vips_hist_find_ndim_scan( VipsStatistic *statistic, void *seq, 
 	int x, int y, void *in, int n )
 {
+	VipsHistFindNDim *ndim = (VipsHistFindNDim *) statistic;
 	Histogram *hist = (Histogram *) seq;
 	VipsImage *im = statistic->ready;
 	int nb = im->Bands;
-	double scale = (double) (hist->max_val + 1) / hist->bins;
+	guint bins = ndim->bins;
+	double scale = (double) (ndim->max_val + 1) / bins;
 	int i, j, k; 
-	int index[3];
+	guint index[3];
 
 	/* Fill these with dimensions, backwards.
 	 */
@@ -282,6 +385,7 @@ vips_hist_find_ndim_class_init( VipsHistFindNDimClass *class )
 	VipsObjectClass *object_class = (VipsObjectClass *) class;
 	VipsStatisticClass *sclass = VIPS_STATISTIC_CLASS( class );
 
+	gobject_class->finalize = vips_hist_find_ndim_finalize;
 	gobject_class->set_property = vips_object_set_property;
 	gobject_class->get_property = vips_object_get_property;
 
@@ -332,6 +436,10 @@ vips_hist_find_ndim_init( VipsHistFindNDim *ndim )
  *
  * Images are cast to uchar or ushort before histogramming.
  *
+ * If there are many bins, or more bins than pixels, each thread counts 
+ * just the bins it sees, and threads are merged into the main histogram 
+ * as they finish.
+ *
  * See also: vips_hist_find(), vips_hist_find_indexed().
  *
  * Returns: 0 on success, -1 on error
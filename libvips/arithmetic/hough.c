@@ -2,6 +2,9 @@
  *
  * 7/3/14
  * 	- from hist_find.c
+ * 14/10/18
+ * 	- add vote_slice: collect edge pixels, then vote in several threads,
+ * 	  each into a range of accumulator bands
  */
 
 /*
@@ -45,6 +48,19 @@
 
 G_DEFINE_ABSTRACT_TYPE( VipsHough, vips_hough, VIPS_TYPE_STATISTIC );
 
+static void
+vips_hough_dispose( GObject *gobject )
+{
+	VipsHough *hough = (VipsHough *) gobject;
+
+	if( hough->points ) {
+		g_array_free( hough->points, TRUE );
+		hough->points = NULL;
+	}
+
+	G_OBJECT_CLASS( vips_hough_parent_class )->dispose( gobject );
+}
+
 static VipsImage *
 vips_hough_new_accumulator( VipsHough *hough )
 {
@@ -72,12 +88,153 @@ vips_hough_new_accumulator( VipsHough *hough )
 	return( accumulator );
 }
 
+/* A thread voting into a slice of the parameter space.
+ */
+typedef struct _VipsHoughSlice {
+	VipsHough *hough;
+
+	/* Vote for bands first to first + slice->Bands of out.
+	 */
+	VipsImage *slice;
+	int first;
+
+	GThread *thread;
+} VipsHoughSlice;
+
+static void *
+vips_hough_slice_vote( void *a )
+{
+	VipsHoughSlice *slice = (VipsHoughSlice *) a;
+	VipsHough *hough = slice->hough;
+	VipsHoughClass *class = VIPS_HOUGH_GET_CLASS( hough );
+
+	class->vote_slice( hough, slice->slice, slice->first, 
+		&g_array_index( hough->points, VipsHoughPoint, 0 ), 
+		hough->points->len );
+
+	return( NULL );
+}
+
+static VipsImage *
+vips_hough_slice_new( VipsImage *out, int bands )
+{
+	VipsImage *slice;
+
+	slice = vips_image_new_memory();
+	vips_image_init_fields( slice,
+		out->Xsize, out->Ysize, bands,
+		out->BandFmt, VIPS_CODING_NONE,
+		VIPS_INTERPRETATION_MATRIX,
+		1.0, 1.0 );
+	if( vips_image_write_prepare( slice ) ) {
+		g_object_unref( slice );
+		return( NULL );
+	}
+	memset( VIPS_IMAGE_ADDR( slice, 0, 0 ), 0,
+		VIPS_IMAGE_SIZEOF_IMAGE( slice ) ); 
+
+	return( slice );
+}
+
+/* Copy a finished slice into its bands of out.
+ */
+static void
+vips_hough_slice_copy( VipsHoughSlice *slice, VipsImage *out )
+{
+	size_t ps = VIPS_IMAGE_SIZEOF_PEL( slice->slice );
+	size_t es = VIPS_IMAGE_SIZEOF_ELEMENT( out );
+
+	int x, y;
+
+	for( y = 0; y < out->Ysize; y++ ) {
+		VipsPel *p = VIPS_IMAGE_ADDR( slice->slice, 0, y );
+		VipsPel *q = VIPS_IMAGE_ADDR( out, 0, y ) + slice->first * es;
+
+		for( x = 0; x < out->Xsize; x++ ) {
+			memcpy( q, p, ps );
+
+			p += ps;
+			q += VIPS_IMAGE_SIZEOF_PEL( out );
+		}
+	}
+}
+
+/* Vote with all the edge pixels we found. Each thread gets a range of bands 
+ * and its own accumulator for just those bands, so the threads never write
+ * to the same memory and we only need one extra accumulator in total, 
+ * however many threads we run.
+ */
+static int
+vips_hough_vote_slices( VipsHough *hough )
+{
+	VipsImage *out = hough->out;
+	int n_slices = VIPS_CLIP( 1, vips_concurrency_get(), out->Bands );
+
+	VipsHoughSlice *slice;
+	int result;
+	int i;
+
+	if( hough->points->len == 0 )
+		return( 0 );
+
+	/* Just one slice: vote directly into out.
+	 */
+	if( n_slices == 1 ) {
+		VipsHoughSlice whole = { hough, out, 0, NULL };
+
+		(void) vips_hough_slice_vote( &whole );
+
+		return( 0 );
+	}
+
+	if( !(slice = VIPS_ARRAY( NULL, n_slices, VipsHoughSlice )) )
+		return( -1 );
+	memset( slice, 0, n_slices * sizeof( VipsHoughSlice ) );
+
+	result = 0;
+	for( i = 0; i < n_slices; i++ ) {
+		int first = i * out->Bands / n_slices;
+		int last = (i + 1) * out->Bands / n_slices;
+
+		slice[i].hough = hough;
+		slice[i].first = first;
+		if( !(slice[i].slice = 
+			vips_hough_slice_new( out, last - first )) ) {
+			result = -1;
+			break;
+		}
+	}
+
+	if( !result )
+		for( i = 0; i < n_slices; i++ ) 
+			if( !(slice[i].thread = vips_g_thread_new( "hough", 
+				vips_hough_slice_vote, &slice[i] )) ) {
+				result = -1;
+				break;
+			}
+
+	for( i = 0; i < n_slices; i++ ) 
+		if( slice[i].thread ) 
+			(void) vips_g_thread_join( slice[i].thread );
+
+	if( !result )
+		for( i = 0; i < n_slices; i++ ) 
+			vips_hough_slice_copy( &slice[i], out );
+
+	for( i = 0; i < n_slices; i++ ) 
+		VIPS_UNREF( slice[i].slice );
+	g_free( slice );
+
+	return( result );
+}
+
 static int
 vips_hough_build( VipsObject *object )
 {
 	VipsObjectClass *class = VIPS_OBJECT_GET_CLASS( object );
 	VipsStatistic *statistic = VIPS_STATISTIC( object ); 
 	VipsHough *hough = (VipsHough *) object;
+	VipsHoughClass *hclass = VIPS_HOUGH_GET_CLASS( hough );
 
 	VipsImage *out; 
 
@@ -94,21 +251,35 @@ vips_hough_build( VipsObject *object )
 		"out", out,
 		NULL );
 
+	if( hclass->vote_slice )
+		hough->points = g_array_new( FALSE, FALSE, 
+			sizeof( VipsHoughPoint ) );
+
 	if( VIPS_OBJECT_CLASS( vips_hough_parent_class )->build( object ) )
 		return( -1 );
 
+	if( hclass->vote_slice &&
+		vips_hough_vote_slices( hough ) )
+		return( -1 );
+
 	return( 0 );
 }
 
-/* Build a new accumulator. 
+/* Build a new accumulator, or with vote_slice, an array to collect edge 
+ * pixels in. 
  */
 static void *
 vips_hough_start( VipsStatistic *statistic )
 {
 	VipsHough *hough = (VipsHough *) statistic;
+	VipsHoughClass *class = VIPS_HOUGH_GET_CLASS( hough );
 
 	VipsImage *accumulator;
 
+	if( class->vote_slice )
+		return( (void *) g_array_new( FALSE, FALSE, 
+			sizeof( VipsHoughPoint ) ) );
+
 	if( !(accumulator = vips_hough_new_accumulator( hough )) )
 		return( NULL ); 
 
@@ -120,8 +291,22 @@ vips_hough_start( VipsStatistic *statistic )
 static int
 vips_hough_stop( VipsStatistic *statistic, void *seq )
 {
-	VipsImage *accumulator = (VipsImage *) seq;
 	VipsHough *hough = (VipsHough *) statistic;
+	VipsHoughClass *class = VIPS_HOUGH_GET_CLASS( hough );
+	VipsImage *accumulator = (VipsImage *) seq;
+
+	/* Stop functions are not run in parallel, so we can append to the
+	 * main list without a lock.
+	 */
+	if( class->vote_slice ) {
+		GArray *points = (GArray *) seq;
+
+		g_array_append_vals( hough->points, 
+			points->data, points->len );
+		g_array_free( points, TRUE );
+
+		return( 0 );
+	}
 
 	if( vips_draw_image( hough->out, accumulator, 0, 0,
 		"mode", VIPS_COMBINE_MODE_ADD,
@@ -146,6 +331,19 @@ vips_hough_scan( VipsStatistic *statistic,
 
 	int i;
 
+	if( class->vote_slice ) {
+		GArray *points = (GArray *) seq;
+
+		for( i = 0; i < n; i++ )
+			if( p[i] ) {
+				VipsHoughPoint point = { x + i, y };
+
+				g_array_append_val( points, point );
+			}
+
+		return( 0 );
+	}
+
 	for( i = 0; i < n; i++ )
 		if( p[i] )
 			class->vote( hough, accumulator, x + i, y );
@@ -169,6 +367,7 @@ vips_hough_class_init( VipsHoughClass *class )
 	VipsObjectClass *object_class = (VipsObjectClass *) class;
 	VipsStatisticClass *sclass = VIPS_STATISTIC_CLASS( class );
 
+	gobject_class->dispose = vips_hough_dispose;
 	gobject_class->set_property = vips_object_set_property;
 	gobject_class->get_property = vips_object_get_property;
 
@@ -61,6 +61,16 @@ typedef int (*VipsHoughInitAccumulator)( VipsHough *hough,
 typedef void (*VipsHoughVote)( VipsHough *hough, 
 	VipsImage *accumulator, int x, int y ); 
 
+/* An edge pixel, saved for a vote_slice.
+ */
+typedef struct _VipsHoughPoint {
+	int x;
+	int y;
+} VipsHoughPoint;
+
+typedef void (*VipsHoughVoteSlice)( VipsHough *hough, 
+	VipsImage *slice, int first, VipsHoughPoint *point, int n ); 
+
 struct _VipsHough {
 	VipsStatistic parent_instance;
 
@@ -68,6 +78,10 @@ struct _VipsHough {
 	 */
 	VipsImage *out; 
 
+	/* With vote_slice, sequences collect edge pixels here.
+	 */
+	GArray *points;
+
 };
 
 struct _VipsHoughClass {
@@ -81,6 +95,13 @@ struct _VipsHoughClass {
 	 */
 	VipsHoughVote vote; 
 
+	/* Optional. Vote for bands @first to @first + @slice->Bands of the
+	 * accumulator. If this is set, sequences just collect edge pixels, 
+	 * and after the scan several threads vote, each into a slice of 
+	 * the parameter space. 
+	 */
+	VipsHoughVoteSlice vote_slice; 
+
 };
 
 GType vips_hough_get_type( void );
@@ -4,6 +4,10 @@
  * 	- from hough_line.c
  * 2/1/18
  * 	- 20% speedup
+ * 14/10/18
+ * 	- vote in parallel over slices of radius, sequences just collect
+ * 	  edge pixels
+ * 	- add @direction
  */
 
 /*
@@ -44,6 +48,7 @@
 #include <vips/intl.h>
 
 #include <string.h>
+#include <math.h>
 
 #include <vips/vips.h>
 #include <vips/internal.h>
@@ -57,6 +62,11 @@ typedef struct _VipsHoughCircle {
 	int scale;
 	int min_radius;
 	int max_radius;
+	VipsImage *direction;
+
+	/* @direction as a float memory image.
+	 */
+	VipsImage *memory_direction;
 
 	int width;
 	int height;
@@ -108,6 +118,7 @@ vips_hough_circle_build( VipsObject *object )
 	VipsObjectClass *class = VIPS_OBJECT_GET_CLASS( object );
 	VipsStatistic *statistic = (VipsStatistic *) object;  
 	VipsHoughCircle *hough_circle = (VipsHoughCircle *) object;
+	VipsImage **t = (VipsImage **) vips_object_local_array( object, 2 );
 	int range = hough_circle->max_radius - hough_circle->min_radius;
 
 	if( range <= 0 ) {
@@ -120,6 +131,24 @@ vips_hough_circle_build( VipsObject *object )
 	hough_circle->height = statistic->in->Ysize / hough_circle->scale;
 	hough_circle->bands = 1 + range / hough_circle->scale;
 
+	/* We look up a direction for each edge pixel, so we need it in
+	 * memory.
+	 */
+	if( hough_circle->direction ) {
+		if( vips_check_mono( class->nickname, 
+				hough_circle->direction ) ||
+			vips_check_noncomplex( class->nickname, 
+				hough_circle->direction ) ||
+			vips_check_size_same( class->nickname, 
+				statistic->in, hough_circle->direction ) ||
+			vips_cast( hough_circle->direction, &t[0], 
+				VIPS_FORMAT_FLOAT, NULL ) ||
+			!(t[1] = vips_image_copy_memory( t[0] )) )
+			return( -1 );
+
+		hough_circle->memory_direction = t[1];
+	}
+
 	if( VIPS_OBJECT_CLASS( vips_hough_circle_parent_class )->
 		build( object ) )
 		return( -1 );
@@ -178,37 +207,84 @@ vips_hough_circle_vote_endpoints_noclip( VipsImage *image,
 	line[x2 * b] += 1;
 }
 
-/* Cast votes for all possible circles passing through x, y.
+/* Vote for a single centre, with clip.
  */
 static void
-vips_hough_circle_vote( VipsHough *hough, VipsImage *accumulator, int x, int y )
+vips_hough_circle_vote_centre( VipsImage *slice, int x, int y, int rb )
 {
-	VipsHoughCircle *hough_circle = (VipsHoughCircle *) hough; 
-	int min_radius = hough_circle->min_radius; 
-	int cx = x / hough_circle->scale;
-	int cy = y / hough_circle->scale;
-
-	int rb;
-
-	g_assert( hough_circle->max_radius - min_radius >= 0 ); 
-
-	for( rb = 0; rb < hough_circle->bands; rb++ ) { 
-		/* r needs to be in scaled down image space.
-		 */
-		int r = rb + min_radius / hough_circle->scale; 
-
-		VipsDrawScanline draw_scanline;
+	if( x >= 0 &&
+		x < slice->Xsize &&
+		y >= 0 &&
+		y < slice->Ysize )
+		((guint *) VIPS_IMAGE_ADDR( slice, x, y ))[rb] += 1;
+}
 
-		if( cx - r >= 0 && 
-			cx + r < accumulator->Xsize &&
-			cy - r >= 0 && 
-			cy + r < accumulator->Ysize )
-			draw_scanline = vips_hough_circle_vote_endpoints_noclip;
-		else
-			draw_scanline = vips_hough_circle_vote_endpoints_clip; 
+/* Cast votes in bands @first onwards for all possible circles passing 
+ * through each edge pixel.
+ *
+ * If we have a direction, the centre must lie along it, so we only need to
+ * vote for the centres on either side of the edge, rather than for a whole 
+ * circle of centres.
+ */
+static void
+vips_hough_circle_vote_slice( VipsHough *hough, 
+	VipsImage *slice, int first, VipsHoughPoint *point, int n )
+{
+	VipsHoughCircle *hough_circle = (VipsHoughCircle *) hough; 
+	VipsImage *direction = hough_circle->memory_direction;
+	int scale = hough_circle->scale;
 
-		vips__draw_circle_direct( accumulator, 
-			cx, cy, r, draw_scanline, &rb );
+	/* r needs to be in scaled down image space.
+	 */
+	int min_r = first + hough_circle->min_radius / scale; 
+
+	int i, rb;
+
+	g_assert( hough_circle->max_radius - 
+		hough_circle->min_radius >= 0 ); 
+
+	for( i = 0; i < n; i++ ) {
+		int cx = point[i].x / scale;
+		int cy = point[i].y / scale;
+
+		if( direction ) {
+			float angle = *((float *) VIPS_IMAGE_ADDR( direction, 
+				point[i].x, point[i].y ));
+			double dx = cos( VIPS_RAD( angle ) );
+			double dy = sin( VIPS_RAD( angle ) );
+
+			for( rb = 0; rb < slice->Bands; rb++ ) { 
+				int r = rb + min_r;
+				int ox = VIPS_RINT( r * dx );
+				int oy = VIPS_RINT( r * dy );
+
+				vips_hough_circle_vote_centre( slice, 
+					cx + ox, cy + oy, rb );
+				vips_hough_circle_vote_centre( slice, 
+					cx - ox, cy - oy, rb );
+			}
+
+			continue;
+		}
+
+		for( rb = 0; rb < slice->Bands; rb++ ) { 
+			int r = rb + min_r;
+
+			VipsDrawScanline draw_scanline;
+
+			if( cx - r >= 0 && 
+				cx + r < slice->Xsize &&
+				cy - r >= 0 && 
+				cy + r < slice->Ysize )
+				draw_scanline = 
+					vips_hough_circle_vote_endpoints_noclip;
+			else
+				draw_scanline = 
+					vips_hough_circle_vote_endpoints_clip; 
+
+			vips__draw_circle_direct( slice, 
+				cx, cy, r, draw_scanline, &rb );
+		}
 	}
 }
 
@@ -227,7 +303,7 @@ vips_hough_circle_class_init( VipsHoughClass *class )
 	object_class->build = vips_hough_circle_build;
 
 	hclass->init_accumulator = vips_hough_circle_init_accumulator;
-	hclass->vote = vips_hough_circle_vote;
+	hclass->vote_slice = vips_hough_circle_vote_slice;
 
 	VIPS_ARG_INT( class, "scale", 119, 
 		_( "Scale" ), 
@@ -250,6 +326,12 @@ vips_hough_circle_class_init( VipsHoughClass *class )
 		G_STRUCT_OFFSET( VipsHoughCircle, max_radius ),
 		1, 100000, 20 );
 
+	VIPS_ARG_IMAGE( class, "direction", 122, 
+		_( "Direction" ), 
+		_( "Edge direction in degrees" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT, 
+		G_STRUCT_OFFSET( VipsHoughCircle, direction ) );
+
 }
 
 static void
@@ -271,6 +353,7 @@ vips_hough_circle_init( VipsHoughCircle *hough_circle )
  * * @scale: scale down dimensions by this much
  * * @min_radius: smallest radius to search for
  * * @max_radius: largest radius to search for
+ * * @direction: #VipsImage, edge direction in degrees
  *
  * Find the circular Hough transform of an image. @in must be one band, with
  * non-zero pixels for image edges. @out is three-band, with the third channel 
@@ -285,6 +368,17 @@ vips_hough_circle_init( VipsHoughCircle *hough_circle )
  * @in, and reduce the number of radii tested (and hence the number of bands
  * int @out) by a factor of three as well.
  *
+ * Set @direction to a one-band image the same size as @in giving the 
+ * gradient direction at each edge pixel, in degrees, with 0 along the 
+ * positive x axis and 90 along the positive y axis, for example
+ * found from a pair of Sobel derivatives. Each edge pixel then only votes for the centres on either 
+ * side of it along that direction, rather than for a whole circle of 
+ * centres at every radius, which is much quicker for large radii.
+ * @direction is loaded into memory. 
+ *
+ * Each worker thread collects the edge pixels in part of @in,
+ * then the threads vote, each for a range of radii.
+ *
  * See also: vips_hough_line().
  *
  * Returns: 0 on success, -1 on error
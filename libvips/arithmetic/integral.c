@@ -0,0 +1,276 @@
+/* summed-area table of an image
+ *
+ * 14/10/18
+ * 	- first version
+ */
+
+/*
+
+    This file is part of VIPS.
+
+    VIPS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA
+
+ */
+
+/*
+
+    These files are distributed with VIPS - http://www.vips.ecs.soton.ac.uk
+
+ */
+
+/*
+#define DEBUG
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /*HAVE_CONFIG_H*/
+#include <vips/intl.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vips/vips.h>
+
+typedef struct _VipsIntegral {
+	VipsOperation parent_instance;
+
+	VipsImage *in;
+	VipsImage *out;
+
+	/* The last line we wrote. Each new line is this plus the running
+	 * sum along the input line.
+	 */
+	double *line;
+} VipsIntegral;
+
+typedef VipsOperationClass VipsIntegralClass;
+
+G_DEFINE_TYPE( VipsIntegral, vips_integral, VIPS_TYPE_OPERATION );
+
+/* vips_sink_disc() gives us strips top to bottom, so we can carry the
+ * previous output line from one strip to the next.
+ */
+static int
+vips_integral_write( VipsRegion *region, VipsRect *area, void *a )
+{
+	VipsIntegral *integral = (VipsIntegral *) a;
+	int bands = integral->out->Bands;
+	int width = area->width;
+
+	int x, y, b;
+
+	g_assert( area->left == 0 );
+
+	for( y = area->top; y < VIPS_RECT_BOTTOM( area ); y++ ) {
+		double *p = (double *) VIPS_REGION_ADDR( region, 0, y );
+		double *q = integral->line + bands;
+
+		for( b = 0; b < bands; b++ ) {
+			double sum;
+
+			sum = 0.0;
+			for( x = 0; x < width; x++ ) {
+				sum += p[x * bands + b];
+				q[x * bands + b] += sum;
+			}
+		}
+
+		if( vips_image_write_line( integral->out, y + 1,
+			(VipsPel *) integral->line ) )
+			return( -1 );
+	}
+
+	return( 0 );
+}
+
+static int
+vips_integral_build( VipsObject *object )
+{
+	VipsObjectClass *class = VIPS_OBJECT_GET_CLASS( object );
+	VipsIntegral *integral = (VipsIntegral *) object;
+	VipsImage **t = (VipsImage **) vips_object_local_array( object, 1 );
+
+	if( VIPS_OBJECT_CLASS( vips_integral_parent_class )->build( object ) )
+		return( -1 );
+
+	if( vips_check_uncoded( class->nickname, integral->in ) ||
+		vips_check_noncomplex( class->nickname, integral->in ) )
+		return( -1 );
+
+	if( vips_cast( integral->in, &t[0], VIPS_FORMAT_DOUBLE, NULL ) )
+		return( -1 );
+
+	g_object_set( object, "out", vips_image_new(), NULL );
+
+	/* One extra row and column of zeros at the top and left, so queries
+	 * need no special cases at the edges.
+	 */
+	if( vips_image_pipelinev( integral->out,
+		VIPS_DEMAND_STYLE_ANY, t[0], NULL ) )
+		return( -1 );
+	integral->out->Xsize = t[0]->Xsize + 1;
+	integral->out->Ysize = t[0]->Ysize + 1;
+	integral->out->Type = VIPS_INTERPRETATION_MULTIBAND;
+
+	if( !(integral->line = VIPS_ARRAY( object,
+		VIPS_IMAGE_N_ELEMENTS( integral->out ), double )) )
+		return( -1 );
+	memset( integral->line, 0,
+		VIPS_IMAGE_SIZEOF_LINE( integral->out ) );
+	if( vips_image_write_line( integral->out, 0,
+		(VipsPel *) integral->line ) )
+		return( -1 );
+
+	if( vips_sink_disc( t[0], vips_integral_write, integral ) )
+		return( -1 );
+
+	return( 0 );
+}
+
+static void
+vips_integral_class_init( VipsIntegralClass *class )
+{
+	GObjectClass *gobject_class = (GObjectClass *) class;
+	VipsObjectClass *object_class = (VipsObjectClass *) class;
+	VipsOperationClass *operation_class = VIPS_OPERATION_CLASS( class );
+
+	gobject_class->set_property = vips_object_set_property;
+	gobject_class->get_property = vips_object_get_property;
+
+	object_class->nickname = "integral";
+	object_class->description = _( "make a summed-area table" );
+	object_class->build = vips_integral_build;
+
+	operation_class->flags = VIPS_OPERATION_SEQUENTIAL;
+
+	VIPS_ARG_IMAGE( class, "in", 1,
+		_( "Input" ),
+		_( "Input image" ),
+		VIPS_ARGUMENT_REQUIRED_INPUT,
+		G_STRUCT_OFFSET( VipsIntegral, in ) );
+
+	VIPS_ARG_IMAGE( class, "out", 2,
+		_( "Output" ),
+		_( "Summed-area table" ),
+		VIPS_ARGUMENT_REQUIRED_OUTPUT,
+		G_STRUCT_OFFSET( VipsIntegral, out ) );
+}
+
+static void
+vips_integral_init( VipsIntegral *integral )
+{
+}
+
+/**
+ * vips_integral: (method)
+ * @in: input image
+ * @out: (out): output summed-area table
+ * @...: %NULL-terminated list of optional named arguments
+ *
+ * Make the summed-area table (or integral image) of @in. Pixel (x, y) of
+ * @out is the sum of all the pixels of @in above and to the left of (x, y),
+ * not including row y and column x. @out is a #VIPS_FORMAT_DOUBLE
+ * memory image one pixel wider and higher than @in, with a row and column
+ * of zeros at the top and left.
+ *
+ * The table is made in a single top-to-bottom pass over @in, so it works
+ * for sequential sources. Use vips_box_sum() to find the sum over any
+ * rectangle in constant time.
+ *
+ * Sums are exact for integer images up to 2^53.
+ *
+ * See also: vips_box_sum(), vips_project(), vips_hist_cum().
+ *
+ * Returns: 0 on success, -1 on error.
+ */
+int
+vips_integral( VipsImage *in, VipsImage **out, ... )
+{
+	va_list ap;
+	int result;
+
+	va_start( ap, out );
+	result = vips_call_split( "integral", ap, in, out );
+	va_end( ap );
+
+	return( result );
+}
+
+/**
+ * vips_box_sum:
+ * @integral: summed-area table from vips_integral()
+ * @left: left edge of box
+ * @top: top edge of box
+ * @width: width of box
+ * @height: height of box
+ * @sum: (array): return the sum for each band here
+ *
+ * Find the sum of the pixels in a box from a summed-area table made by
+ * vips_integral(). The box is clipped to the image. @sum must have room for
+ * one double per band of @integral.
+ *
+ * See also: vips_integral().
+ *
+ * Returns: 0 on success, -1 on error.
+ */
+int
+vips_box_sum( VipsImage *integral,
+	int left, int top, int width, int height, double *sum )
+{
+	VipsRect image;
+	VipsRect box;
+	double *tl, *tr, *bl, *br;
+	int b;
+
+	if( vips_check_format( "vips_box_sum",
+		integral, VIPS_FORMAT_DOUBLE ) ||
+		vips_image_wio_input( integral ) )
+		return( -1 );
+
+	/* The table has one more row and column than the image.
+	 */
+	image.left = 0;
+	image.top = 0;
+	image.width = integral->Xsize - 1;
+	image.height = integral->Ysize - 1;
+	box.left = left;
+	box.top = top;
+	box.width = width;
+	box.height = height;
+	vips_rect_intersectrect( &image, &box, &box );
+
+	if( vips_rect_isempty( &box ) ) {
+		for( b = 0; b < integral->Bands; b++ )
+			sum[b] = 0.0;
+
+		return( 0 );
+	}
+
+	tl = (double *) VIPS_IMAGE_ADDR( integral, box.left, box.top );
+	tr = (double *) VIPS_IMAGE_ADDR( integral,
+		VIPS_RECT_RIGHT( &box ), box.top );
+	bl = (double *) VIPS_IMAGE_ADDR( integral,
+		box.left, VIPS_RECT_BOTTOM( &box ) );
+	br = (double *) VIPS_IMAGE_ADDR( integral,
+		VIPS_RECT_RIGHT( &box ), VIPS_RECT_BOTTOM( &box ) );
+
+	for( b = 0; b < integral->Bands; b++ )
+		sum[b] = br[b] - bl[b] - tr[b] + tl[b];
+
+	return( 0 );
+}
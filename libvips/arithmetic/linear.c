@@ -45,6 +45,10 @@
  * 30/9/17
  * 	- squash constants with all elements equal so we use 1ary path more
  * 	  often
+ * 14/10/18
+ * 	- use a native SIMD kernel for the 1ary float path
+ * 	- uchar -> uchar goes via a LUT
+ * 	- use the native linear and clip kernels for uchar output
  */
 
 /*
@@ -88,6 +92,8 @@
 #include <math.h>
 
 #include <vips/vips.h>
+#include <vips/simd.h>
+#include <vips/internal.h>
 
 #include "unary.h"
 
@@ -109,6 +115,10 @@ typedef struct _VipsLinear {
 	double *a_ready;
 	double *b_ready;
 
+	/* For uchar -> uchar, a 256-element table for each band.
+	 */
+	VipsPel *lut;
+
 } VipsLinear;
 
 typedef VipsUnaryClass VipsLinearClass;
@@ -204,6 +214,36 @@ vips_linear_build( VipsObject *object )
 		}
 	}
 
+	/* For uchar output, work out every possible result for uchar input. 
+	 * This must match the arithmetic in LOOPuc exactly.
+	 */
+	if( linear->uchar &&
+		linear->a &&
+		linear->b ) {
+		linear->lut = VIPS_ARRAY( linear, 256 * linear->n, VipsPel );
+
+		for( i = 0; i < linear->n; i++ ) {
+			VipsPel *lut = linear->lut + i * 256;
+
+			int v;
+
+			for( v = 0; v < 256; v++ ) 
+				if( linear->a->n == 1 && 
+					linear->b->n == 1 ) {
+					float t = (float) linear->a_ready[0] * 
+						v + (float) linear->b_ready[0];
+
+					lut[v] = VIPS_FCLIP( 0, t, 255 );
+				}
+				else {
+					double t = linear->a_ready[i] * v + 
+						linear->b_ready[i];
+
+					lut[v] = VIPS_FCLIP( 0, t, 255 );
+				}
+		}
+	}
+
 	if( linear->uchar )
 		arithmetic->format = VIPS_FORMAT_UCHAR;
 
@@ -278,6 +318,48 @@ vips_linear_build( VipsObject *object )
 	} \
 }
 
+/* Elements per chunk for the native uchar path.
+ */
+#define VIPS_LINEAR_CHUNK (256)
+
+/* Non-complex input, uchar output, all bands of the constant equal, with the
+ * native linear and clip kernels, if we have them. The clip kernel floors,
+ * but that's the same as LOOP1uc's truncate once we're in 0 - 255.
+ */
+static gboolean
+vips_linear_uchar_simd( VipsLinear *linear,
+	VipsPel *out, VipsPel *in, int sz )
+{
+	VipsArithmetic *arithmetic = VIPS_ARITHMETIC( linear );
+	VipsBandFormat format =
+		vips_image_get_format( arithmetic->ready[0] );
+	int ps = vips_format_sizeof( format );
+
+	VipsSimdLinearFn linear_fn;
+	VipsSimdClipFn clip_fn;
+	float buf[VIPS_LINEAR_CHUNK];
+	int underflow, overflow;
+	int x, n;
+
+	if( !(linear_fn = (VipsSimdLinearFn)
+		vips_simd_get( VIPS_SIMD_LINEAR, format )) ||
+		!(clip_fn = (VipsSimdClipFn)
+			vips_simd_get( VIPS_SIMD_CLIP_FLOAT,
+				VIPS_FORMAT_UCHAR )) )
+		return( FALSE );
+
+	underflow = 0;
+	overflow = 0;
+	for( x = 0; x < sz; x += n ) {
+		n = VIPS_MIN( sz - x, VIPS_LINEAR_CHUNK );
+		linear_fn( buf, in + x * ps, n,
+			linear->a_ready[0], linear->b_ready[0] );
+		clip_fn( out + x, buf, n, &underflow, &overflow );
+	}
+
+	return( TRUE );
+}
+
 /* Non-complex input, uchar output.
  */
 #define LOOPNuc( IN ) { \
@@ -294,13 +376,33 @@ vips_linear_build( VipsObject *object )
 
 #define LOOPuc( IN ) { \
 	if( linear->a->n == 1 && linear->b->n == 1 ) { \
-		LOOP1uc( IN ); \
+		if( !vips_linear_uchar_simd( linear, \
+			out, in[0], width * nb ) ) \
+			LOOP1uc( IN ); \
 	} \
 	else { \
 		LOOPNuc( IN ); \
 	} \
 }
 
+/* uchar input, uchar output, via the LUT.
+ */
+#define LOOPlut { \
+	VipsPel * restrict p = (VipsPel *) in[0]; \
+	VipsPel * restrict q = (VipsPel *) out; \
+	VipsPel * restrict lut = linear->lut; \
+	\
+	if( nb == 1 ) { \
+		for( x = 0; x < width; x++ ) \
+			q[x] = lut[p[x]]; \
+	} \
+	else { \
+		for( i = 0, x = 0; x < width; x++ ) \
+			for( k = 0; k < nb; k++, i++ ) \
+				q[i] = lut[(k << 8) + p[i]]; \
+	} \
+}
+
 /* Complex input, uchar output. 
  */
 #define LOOPCMPLXNuc( IN ) { \
@@ -328,12 +430,13 @@ vips_linear_buffer( VipsArithmetic *arithmetic,
 	double * restrict b = linear->b_ready;
 	int nb = im->Bands;
 
+	VipsSimdLinearFn simd;
 	int i, x, k;
 
 	if( linear->uchar )
 		switch( vips_image_get_format( im ) ) {
 		case VIPS_FORMAT_UCHAR: 	
-			LOOPuc( unsigned char ); break;
+			LOOPlut; break;
 		case VIPS_FORMAT_CHAR: 		
 			LOOPuc( signed char ); break; 
 		case VIPS_FORMAT_USHORT: 	
@@ -356,6 +459,11 @@ vips_linear_buffer( VipsArithmetic *arithmetic,
 		default:
 			g_assert_not_reached();
 		}
+	else if( linear->a->n == 1 && 
+		linear->b->n == 1 &&
+		(simd = (VipsSimdLinearFn) vips_simd_get( VIPS_SIMD_LINEAR, 
+			vips_image_get_format( im ) )) )
+		simd( (float *) out, in[0], width * nb, a[0], b[0] );
 	else
 		switch( vips_image_get_format( im ) ) {
 		case VIPS_FORMAT_UCHAR: 	
@@ -385,6 +493,34 @@ vips_linear_buffer( VipsArithmetic *arithmetic,
 
 }
 
+/* If image is made by a float linear with a single scale and offset, get the
+ * input and the constants. vips_cast() uses this to fuse linear and clip.
+ */
+gboolean
+vips__linear_get( VipsImage *image, VipsImage **in, double *a, double *b )
+{
+	VipsLinear *linear;
+	VipsImage *linear_in;
+
+	if( !vips__point_get( image, &linear_in, (void **) &linear ) ||
+		!G_TYPE_CHECK_INSTANCE_TYPE( linear, vips_linear_get_type() ) ||
+		linear->uchar ||
+		!linear->a ||
+		!linear->b ||
+		linear->a->n != 1 ||
+		linear->b->n != 1 ||
+		vips_image_get_format( image ) != VIPS_FORMAT_FLOAT ||
+		vips_band_format_iscomplex( linear_in->BandFmt ) ||
+		linear_in->Bands != image->Bands )
+		return( FALSE );
+
+	*in = linear_in;
+	*a = linear->a_ready[0];
+	*b = linear->b_ready[0];
+
+	return( TRUE );
+}
+
 /* Save a bit of typing.
  */
 #define UC VIPS_FORMAT_UCHAR
@@ -488,6 +624,9 @@ vips_linearv( VipsImage *in, VipsImage **out,
  * complex input and double complex for double complex input. Set @uchar to
  * output uchar pixels. 
  *
+ * uchar input with @uchar set is done with a lookup table, so it's very
+ * fast.
+ *
  * If the arrays of constants have just one element, that constant is used for 
  * all image bands. If the arrays have more than one element and they have 
  * the same number of elements as there are bands in the image, then 
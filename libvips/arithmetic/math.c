@@ -25,6 +25,8 @@
  * 	- redone as a class
  * 11/8/15
  * 	- log/log10 zero-avoid
+ * 14/10/18
+ * 	- uchar images go through a table
  */
 
 /*
@@ -76,28 +78,18 @@ typedef struct _VipsMath {
 
 	VipsOperationMath math;
 
+	/* uchar images have only 256 possible values, so we make a table at
+	 * build time.
+	 */
+	gboolean table_ready;
+	float table[256];
+
 } VipsMath;
 
 typedef VipsUnaryClass VipsMathClass;
 
 G_DEFINE_TYPE( VipsMath, vips_math, VIPS_TYPE_UNARY );
 
-static int
-vips_math_build( VipsObject *object )
-{
-	VipsObjectClass *class = VIPS_OBJECT_GET_CLASS( object );
-	VipsUnary *unary = (VipsUnary *) object;
-
-	if( unary->in &&
-		vips_check_noncomplex( class->nickname, unary->in ) )
-		return( -1 );
-
-	if( VIPS_OBJECT_CLASS( vips_math_parent_class )->build( object ) )
-		return( -1 );
-
-	return( 0 );
-}
-
 #define LOOP( IN, OUT, OP ) { \
 	IN * restrict p = (IN *) in[0]; \
 	OUT * restrict q = (OUT *) out; \
@@ -147,6 +139,54 @@ vips_math_build( VipsObject *object )
 #define LOGZ( X ) ((X) == 0.0 ? 0.0 : log( X ))
 #define LOGZ10( X ) ((X) == 0.0 ? 0.0 : log10( X ))
 
+#define TABLE( OP ) { \
+	for( i = 0; i < 256; i++ ) { \
+		unsigned char v = i; \
+		\
+		math->table[i] = OP( v ); \
+	} \
+}
+
+static int
+vips_math_build( VipsObject *object )
+{
+	VipsObjectClass *class = VIPS_OBJECT_GET_CLASS( object );
+	VipsUnary *unary = (VipsUnary *) object;
+	VipsMath *math = (VipsMath *) object;
+
+	int i;
+
+	if( unary->in &&
+		vips_check_noncomplex( class->nickname, unary->in ) )
+		return( -1 );
+
+	if( unary->in &&
+		vips_image_get_format( unary->in ) == VIPS_FORMAT_UCHAR ) {
+		switch( math->math ) {
+		case VIPS_OPERATION_MATH_SIN: 	TABLE( DSIN ); break;
+		case VIPS_OPERATION_MATH_COS: 	TABLE( DCOS ); break;
+		case VIPS_OPERATION_MATH_TAN: 	TABLE( DTAN ); break;
+		case VIPS_OPERATION_MATH_ASIN: 	TABLE( ADSIN ); break;
+		case VIPS_OPERATION_MATH_ACOS: 	TABLE( ADCOS ); break;
+		case VIPS_OPERATION_MATH_ATAN: 	TABLE( ADTAN ); break;
+		case VIPS_OPERATION_MATH_LOG: 	TABLE( LOGZ ); break;
+		case VIPS_OPERATION_MATH_LOG10:	TABLE( LOGZ10 ); break;
+		case VIPS_OPERATION_MATH_EXP: 	TABLE( exp ); break;
+		case VIPS_OPERATION_MATH_EXP10:	TABLE( EXP10 ); break;
+
+		default:
+			g_assert_not_reached();
+		}
+
+		math->table_ready = TRUE;
+	}
+
+	if( VIPS_OBJECT_CLASS( vips_math_parent_class )->build( object ) )
+		return( -1 );
+
+	return( 0 );
+}
+
 static void
 vips_math_buffer( VipsArithmetic *arithmetic, 
 	VipsPel *out, VipsPel **in, int width )
@@ -157,6 +197,17 @@ vips_math_buffer( VipsArithmetic *arithmetic,
 
 	int x;
 
+	if( math->table_ready &&
+		vips_image_get_format( im ) == VIPS_FORMAT_UCHAR ) {
+		unsigned char * restrict p = (unsigned char *) in[0];
+		float * restrict q = (float *) out;
+
+		for( x = 0; x < sz; x++ )
+			q[x] = math->table[p[x]];
+
+		return;
+	}
+
 	switch( math->math ) {
 	case VIPS_OPERATION_MATH_SIN: 	SWITCH( DSIN ); break;
 	case VIPS_OPERATION_MATH_COS: 	SWITCH( DCOS ); break;
@@ -0,0 +1,637 @@
+/* find several percentiles in one pass
+ *
+ * 14/10/18
+ * 	- from avg.c and percent.c
+ */
+
+/*
+
+    This file is part of VIPS.
+
+    VIPS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA
+
+ */
+
+/*
+
+    These files are distributed with VIPS - http://www.vips.ecs.soton.ac.uk
+
+ */
+
+/*
+#define DEBUG
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /*HAVE_CONFIG_H*/
+#include <vips/intl.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <vips/vips.h>
+#include <vips/internal.h>
+
+#include "statistic.h"
+
+/* Each level of the sketch holds up to this many values before we compact
+ * it. The rank error is roughly sqrt( levels ) / VIPS_SKETCH_SIZE.
+ */
+#define VIPS_SKETCH_SIZE (4096)
+
+/* Enough for 2^48 values.
+ */
+#define VIPS_SKETCH_LEVELS (48)
+
+/* A mergeable quantile sketch for int and float images, a simple form of
+ * the KLL sketch. Level l holds a sample of the values, each standing for
+ * 2^l of them. When a level fills, we sort it and promote every other value
+ * to the next level, starting at a random offset.
+ */
+typedef struct _VipsSketch {
+	double *level[VIPS_SKETCH_LEVELS];
+	int n[VIPS_SKETCH_LEVELS];
+	int n_levels;
+	guint32 seed;
+
+	/* Exact min and max, so 0 and 100 are always right.
+	 */
+	gboolean any;
+	double min;
+	double max;
+} VipsSketch;
+
+/* Exact histograms for 8 and 16 bit images, offset for signed types.
+ */
+typedef struct _VipsPercentilesHist {
+	guint64 *bins;
+	int n_bins;
+	int offset;
+} VipsPercentilesHist;
+
+typedef struct _VipsPercentiles {
+	VipsStatistic parent_instance;
+
+	VipsArrayDouble *percent;
+	VipsArrayDouble *out;
+
+	/* The global histogram or sketch we merge thread results into.
+	 */
+	VipsPercentilesHist hist;
+	VipsSketch *sketch;
+} VipsPercentiles;
+
+typedef VipsStatisticClass VipsPercentilesClass;
+
+G_DEFINE_TYPE( VipsPercentiles, vips_percentiles, VIPS_TYPE_STATISTIC );
+
+static void
+vips_sketch_free( VipsSketch *sketch )
+{
+	int l;
+
+	for( l = 0; l < VIPS_SKETCH_LEVELS; l++ )
+		VIPS_FREE( sketch->level[l] );
+	g_free( sketch );
+}
+
+static VipsSketch *
+vips_sketch_new( void )
+{
+	VipsSketch *sketch = g_new0( VipsSketch, 1 );
+
+	sketch->seed = 1;
+
+	return( sketch );
+}
+
+static int
+vips_sketch_compare( const void *a, const void *b )
+{
+	double fa = *((double *) a);
+	double fb = *((double *) b);
+
+	return( fa < fb ? -1 : fa > fb ? 1 : 0 );
+}
+
+static void vips_sketch_compact( VipsSketch *sketch, int l );
+
+/* Add n values to level l. Levels have space for twice VIPS_SKETCH_SIZE,
+ * and are always less than VIPS_SKETCH_SIZE between calls, so we can add
+ * up to VIPS_SKETCH_SIZE values at once.
+ */
+static void
+vips_sketch_add_level( VipsSketch *sketch, int l, double *v, int n )
+{
+	g_assert( n <= VIPS_SKETCH_SIZE );
+
+	if( !sketch->level[l] ) {
+		sketch->level[l] = g_new( double, 2 * VIPS_SKETCH_SIZE );
+		sketch->n_levels = VIPS_MAX( sketch->n_levels, l + 1 );
+	}
+
+	memcpy( sketch->level[l] + sketch->n[l], v, n * sizeof( double ) );
+	sketch->n[l] += n;
+
+	if( sketch->n[l] >= VIPS_SKETCH_SIZE )
+		vips_sketch_compact( sketch, l );
+}
+
+static void
+vips_sketch_compact( VipsSketch *sketch, int l )
+{
+	double *level = sketch->level[l];
+	int n = sketch->n[l];
+
+	int i, j, offset;
+
+	/* The top level just keeps growing weight, it can't be promoted.
+	 */
+	if( l == VIPS_SKETCH_LEVELS - 1 )
+		return;
+
+	qsort( level, n, sizeof( double ), vips_sketch_compare );
+
+	/* xorshift for the offset.
+	 */
+	sketch->seed ^= sketch->seed << 13;
+	sketch->seed ^= sketch->seed >> 17;
+	sketch->seed ^= sketch->seed << 5;
+	offset = sketch->seed & 1;
+
+	/* An odd count leaves the last value behind. Pack the promoted
+	 * values down in place, then add them to the next level.
+	 */
+	for( j = 0, i = offset; i < n - (n & 1); i += 2 )
+		level[j++] = level[i];
+	if( n & 1 ) {
+		double last = level[n - 1];
+
+		sketch->n[l] = 1;
+		vips_sketch_add_level( sketch, l + 1, level, j );
+		level[0] = last;
+	}
+	else {
+		sketch->n[l] = 0;
+		vips_sketch_add_level( sketch, l + 1, level, j );
+	}
+}
+
+static void
+vips_sketch_add( VipsSketch *sketch, double v )
+{
+	if( !sketch->any ) {
+		sketch->any = TRUE;
+		sketch->min = v;
+		sketch->max = v;
+	}
+	else {
+		sketch->min = VIPS_MIN( sketch->min, v );
+		sketch->max = VIPS_MAX( sketch->max, v );
+	}
+
+	if( !sketch->level[0] ) {
+		sketch->level[0] = g_new( double, 2 * VIPS_SKETCH_SIZE );
+		sketch->n_levels = VIPS_MAX( sketch->n_levels, 1 );
+	}
+
+	sketch->level[0][sketch->n[0]++] = v;
+	if( sketch->n[0] >= VIPS_SKETCH_SIZE )
+		vips_sketch_compact( sketch, 0 );
+}
+
+/* Merge b into a.
+ */
+static void
+vips_sketch_merge( VipsSketch *a, VipsSketch *b )
+{
+	int l;
+
+	if( b->any ) {
+		if( !a->any ) {
+			a->any = TRUE;
+			a->min = b->min;
+			a->max = b->max;
+		}
+		else {
+			a->min = VIPS_MIN( a->min, b->min );
+			a->max = VIPS_MAX( a->max, b->max );
+		}
+	}
+
+	for( l = 0; l < b->n_levels; l++ )
+		if( b->n[l] > 0 )
+			vips_sketch_add_level( a, l, b->level[l], b->n[l] );
+}
+
+/* A value and its weight, for the final sort.
+ */
+typedef struct _VipsSketchItem {
+	double v;
+	double weight;
+} VipsSketchItem;
+
+static int
+vips_sketch_item_compare( const void *a, const void *b )
+{
+	return( vips_sketch_compare( &((VipsSketchItem *) a)->v,
+		&((VipsSketchItem *) b)->v ) );
+}
+
+/* Find the smallest value with at least percent[i] of the weight at or
+ * below it.
+ */
+static void
+vips_sketch_query( VipsSketch *sketch,
+	double *percent, double *out, int n_percent )
+{
+	VipsSketchItem *items;
+	int n_items;
+	double total;
+	int l, i, j;
+
+	n_items = 0;
+	for( l = 0; l < sketch->n_levels; l++ )
+		n_items += sketch->n[l];
+	items = g_new( VipsSketchItem, VIPS_MAX( n_items, 1 ) );
+
+	j = 0;
+	total = 0.0;
+	for( l = 0; l < sketch->n_levels; l++ )
+		for( i = 0; i < sketch->n[l]; i++ ) {
+			items[j].v = sketch->level[l][i];
+			items[j].weight = ldexp( 1.0, l );
+			total += items[j].weight;
+			j += 1;
+		}
+	qsort( items, n_items, sizeof( VipsSketchItem ),
+		vips_sketch_item_compare );
+
+	for( i = 0; i < n_percent; i++ ) {
+		double target = percent[i] / 100.0 * total;
+		double sum;
+
+		out[i] = 0.0;
+		sum = 0.0;
+		for( j = 0; j < n_items; j++ ) {
+			sum += items[j].weight;
+			out[i] = items[j].v;
+			if( sum >= target )
+				break;
+		}
+
+		if( percent[i] == 0.0 )
+			out[i] = sketch->min;
+		else if( percent[i] == 100.0 )
+			out[i] = sketch->max;
+	}
+
+	g_free( items );
+}
+
+static void
+vips_percentiles_dispose( GObject *gobject )
+{
+	VipsPercentiles *percentiles = (VipsPercentiles *) gobject;
+
+	VIPS_FREE( percentiles->hist.bins );
+	VIPS_FREEF( vips_sketch_free, percentiles->sketch );
+
+	G_OBJECT_CLASS( vips_percentiles_parent_class )->dispose( gobject );
+}
+
+/* Set up a histogram for a format, if it's small enough.
+ */
+static gboolean
+vips_percentiles_hist_init( VipsPercentilesHist *hist, VipsBandFormat format )
+{
+	switch( format ) {
+	case VIPS_FORMAT_UCHAR:
+		hist->n_bins = 256;
+		hist->offset = 0;
+		break;
+
+	case VIPS_FORMAT_CHAR:
+		hist->n_bins = 256;
+		hist->offset = 128;
+		break;
+
+	case VIPS_FORMAT_USHORT:
+		hist->n_bins = 65536;
+		hist->offset = 0;
+		break;
+
+	case VIPS_FORMAT_SHORT:
+		hist->n_bins = 65536;
+		hist->offset = 32768;
+		break;
+
+	default:
+		return( FALSE );
+	}
+
+	hist->bins = g_new0( guint64, hist->n_bins );
+
+	return( TRUE );
+}
+
+static int
+vips_percentiles_build( VipsObject *object )
+{
+	VipsObjectClass *class = VIPS_OBJECT_GET_CLASS( object );
+	VipsStatistic *statistic = VIPS_STATISTIC( object );
+	VipsPercentiles *percentiles = (VipsPercentiles *) object;
+
+	double *percent;
+	int n_percent;
+	double *out;
+	VipsArrayDouble *out_array;
+	int i;
+
+	if( statistic->in &&
+		vips_check_noncomplex( class->nickname, statistic->in ) )
+		return( -1 );
+
+	percent = NULL;
+	n_percent = 0;
+	if( percentiles->percent ) {
+		percent = vips_array_double_get( percentiles->percent,
+			&n_percent );
+		for( i = 0; i < n_percent; i++ )
+			if( percent[i] < 0 ||
+				percent[i] > 100 ) {
+				vips_error( class->nickname,
+					"%s", _( "percent out of range" ) );
+				return( -1 );
+			}
+	}
+
+	if( statistic->in &&
+		!vips_percentiles_hist_init( &percentiles->hist,
+			statistic->in->BandFmt ) )
+		percentiles->sketch = vips_sketch_new();
+
+	if( VIPS_OBJECT_CLASS( vips_percentiles_parent_class )->
+		build( object ) )
+		return( -1 );
+
+	out = VIPS_ARRAY( object, n_percent, double );
+
+	if( percentiles->sketch )
+		vips_sketch_query( percentiles->sketch,
+			percent, out, n_percent );
+	else {
+		VipsPercentilesHist *hist = &percentiles->hist;
+
+		guint64 total;
+
+		total = 0;
+		for( i = 0; i < hist->n_bins; i++ )
+			total += hist->bins[i];
+
+		for( i = 0; i < n_percent; i++ ) {
+			double target = percent[i] / 100.0 * total;
+
+			guint64 sum;
+			int j;
+
+			sum = 0;
+			for( j = 0; j < hist->n_bins; j++ ) {
+				sum += hist->bins[j];
+				if( sum > 0 &&
+					sum >= target )
+					break;
+			}
+
+			out[i] = VIPS_MIN( j, hist->n_bins - 1 ) -
+				hist->offset;
+		}
+	}
+
+	out_array = vips_array_double_new( out, n_percent );
+	g_object_set( object,
+		"out", out_array,
+		NULL );
+	vips_area_unref( VIPS_AREA( out_array ) );
+
+	return( 0 );
+}
+
+/* Each thread gets its own histogram or sketch.
+ */
+static void *
+vips_percentiles_start( VipsStatistic *statistic )
+{
+	VipsPercentiles *percentiles = (VipsPercentiles *) statistic;
+
+	if( percentiles->sketch )
+		return( vips_sketch_new() );
+	else {
+		VipsPercentilesHist *hist = g_new0( VipsPercentilesHist, 1 );
+
+		vips_percentiles_hist_init( hist, statistic->in->BandFmt );
+
+		return( hist );
+	}
+}
+
+/* Merge this thread's results into the main one.
+ */
+static int
+vips_percentiles_stop( VipsStatistic *statistic, void *seq )
+{
+	VipsPercentiles *percentiles = (VipsPercentiles *) statistic;
+
+	if( percentiles->sketch ) {
+		VipsSketch *sketch = (VipsSketch *) seq;
+
+		vips_sketch_merge( percentiles->sketch, sketch );
+		vips_sketch_free( sketch );
+	}
+	else {
+		VipsPercentilesHist *hist = (VipsPercentilesHist *) seq;
+
+		int i;
+
+		for( i = 0; i < hist->n_bins; i++ )
+			percentiles->hist.bins[i] += hist->bins[i];
+
+		g_free( hist->bins );
+		g_free( hist );
+	}
+
+	return( 0 );
+}
+
+#define HIST( TYPE ) { \
+	TYPE *p = (TYPE *) in; \
+	guint64 *bins = hist->bins + hist->offset; \
+	\
+	for( i = 0; i < sz; i++ ) \
+		bins[p[i]] += 1; \
+}
+
+#define SKETCH( TYPE ) { \
+	TYPE *p = (TYPE *) in; \
+	\
+	for( i = 0; i < sz; i++ ) \
+		vips_sketch_add( sketch, p[i] ); \
+}
+
+/* Skip NaN.
+ */
+#define SKETCH_FLOAT( TYPE ) { \
+	TYPE *p = (TYPE *) in; \
+	\
+	for( i = 0; i < sz; i++ ) \
+		if( !isnan( p[i] ) ) \
+			vips_sketch_add( sketch, p[i] ); \
+}
+
+static int
+vips_percentiles_scan( VipsStatistic *statistic, void *seq,
+	int x, int y, void *in, int n )
+{
+	VipsPercentiles *percentiles = (VipsPercentiles *) statistic;
+	const int sz = n * vips_image_get_bands( statistic->in );
+
+	int i;
+
+	if( percentiles->sketch ) {
+		VipsSketch *sketch = (VipsSketch *) seq;
+
+		switch( vips_image_get_format( statistic->in ) ) {
+		case VIPS_FORMAT_UINT:	SKETCH( unsigned int ); break;
+		case VIPS_FORMAT_INT:	SKETCH( signed int ); break;
+		case VIPS_FORMAT_FLOAT:	SKETCH_FLOAT( float ); break;
+		case VIPS_FORMAT_DOUBLE:SKETCH_FLOAT( double ); break;
+
+		default:
+			g_assert_not_reached();
+		}
+	}
+	else {
+		VipsPercentilesHist *hist = (VipsPercentilesHist *) seq;
+
+		switch( vips_image_get_format( statistic->in ) ) {
+		case VIPS_FORMAT_UCHAR:	HIST( unsigned char ); break;
+		case VIPS_FORMAT_CHAR:	HIST( signed char ); break;
+		case VIPS_FORMAT_USHORT:HIST( unsigned short ); break;
+		case VIPS_FORMAT_SHORT:	HIST( signed short ); break;
+
+		default:
+			g_assert_not_reached();
+		}
+	}
+
+	return( 0 );
+}
+
+static void
+vips_percentiles_class_init( VipsPercentilesClass *class )
+{
+	GObjectClass *gobject_class = (GObjectClass *) class;
+	VipsObjectClass *object_class = (VipsObjectClass *) class;
+	VipsStatisticClass *sclass = VIPS_STATISTIC_CLASS( class );
+
+	gobject_class->dispose = vips_percentiles_dispose;
+	gobject_class->set_property = vips_object_set_property;
+	gobject_class->get_property = vips_object_get_property;
+
+	object_class->nickname = "percentiles";
+	object_class->description = _( "find image percentiles" );
+	object_class->build = vips_percentiles_build;
+
+	sclass->start = vips_percentiles_start;
+	sclass->scan = vips_percentiles_scan;
+	sclass->stop = vips_percentiles_stop;
+
+	VIPS_ARG_BOXED( class, "percent", 2,
+		_( "Percent" ),
+		_( "Find these percentiles" ),
+		VIPS_ARGUMENT_REQUIRED_INPUT,
+		G_STRUCT_OFFSET( VipsPercentiles, percent ),
+		VIPS_TYPE_ARRAY_DOUBLE );
+
+	VIPS_ARG_BOXED( class, "out", 3,
+		_( "Output" ),
+		_( "Value at each percentile" ),
+		VIPS_ARGUMENT_REQUIRED_OUTPUT,
+		G_STRUCT_OFFSET( VipsPercentiles, out ),
+		VIPS_TYPE_ARRAY_DOUBLE );
+}
+
+static void
+vips_percentiles_init( VipsPercentiles *percentiles )
+{
+}
+
+/**
+ * vips_percentiles: (method)
+ * @in: input #VipsImage
+ * @percent: (array length=n): find these percentiles
+ * @out: (array length=n): write the value at each percentile here
+ * @n: number of percentiles to find
+ * @...: %NULL-terminated list of optional named arguments
+ *
+ * Find several percentiles of @in in a single pass. For each element of
+ * @percent, a value between 0 and 100, vips_percentiles() sets the matching
+ * element of @out to the smallest pixel value with at least that percentage
+ * of pixels at or below it. So 50 gives the median, and 0 and 100 give the
+ * minimum and maximum. All bands are counted together.
+ *
+ * For 8- and 16-bit images the results are exact. For other formats, each
+ * thread builds a small mergeable sketch of the pixel values, so the result
+ * has a rank error of a small fraction of a percent. NaN values are ignored.
+ *
+ * Complex images are not supported.
+ *
+ * See also: vips_percent(), vips_hist_find(), vips_stats().
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int
+vips_percentiles( VipsImage *in,
+	const double *percent, double *out, int n, ... )
+{
+	va_list ap;
+	VipsArrayDouble *percent_array;
+	VipsArrayDouble *out_array;
+	double *values;
+	int n_values;
+	int result;
+
+	percent_array = vips_array_double_new( percent, n );
+
+	va_start( ap, n );
+	result = vips_call_split( "percentiles", ap,
+		in, percent_array, &out_array );
+	va_end( ap );
+
+	vips_area_unref( VIPS_AREA( percent_array ) );
+
+	if( result )
+		return( -1 );
+
+	values = vips_array_double_get( out_array, &n_values );
+	memcpy( out, values, VIPS_MIN( n, n_values ) * sizeof( double ) );
+	vips_area_unref( VIPS_AREA( out_array ) );
+
+	return( 0 );
+}
@@ -32,6 +32,8 @@
  * 	- im1 > im2, im1 >= im2 were broken 
  * 17/9/14
  * 	- im1 > im2, im1 >= im2 were still broken, but in a more subtle way
+ * 14/10/18
+ * 	- use SIMD kernels for uchar, ushort and float
  */
 
 /*
@@ -74,6 +76,7 @@
 #include <stdlib.h>
 
 #include <vips/vips.h>
+#include <vips/simd.h>
 
 #include "binary.h"
 #include "unaryconst.h"
@@ -144,10 +147,17 @@ vips_relational_buffer( VipsArithmetic *arithmetic,
 	const int sz = width * vips_image_get_bands( im );
 
 	VipsOperationRelational op;
+	VipsSimdRelationalFn simd;
 	VipsPel *in0;
 	VipsPel *in1;
 	int x;
 
+	if( (simd = (VipsSimdRelationalFn) vips_simd_get(
+		VIPS_SIMD_RELATIONAL, vips_image_get_format( im ) )) ) {
+		simd( out, in[0], in[1], NULL, sz, relational->relational );
+		return;
+	}
+
 	in0 = in[0];
 	in1 = in[1];
 	op = relational->relational;
@@ -506,8 +516,19 @@ vips_relational_const_buffer( VipsArithmetic *arithmetic,
 	VipsImage *im = arithmetic->ready[0];
 	int bands = im->Bands;
 
+	VipsSimdRelationalFn simd;
 	int i, x, b;
 
+	/* The kernels take a single constant, the usual case.
+	 */
+	if( uconst->uniform &&
+		(simd = (VipsSimdRelationalFn) vips_simd_get(
+			VIPS_SIMD_RELATIONAL, vips_image_get_format( im ) )) ) {
+		simd( out, in[0], NULL, uconst->c_ready, width * bands,
+			rconst->relational );
+		return;
+	}
+
 	switch( rconst->relational ) {
 	case VIPS_OPERATION_RELATIONAL_EQUAL: 	
 		SWITCH( RLOOPC, CLOOPC, ==, CEQUAL ); 
@@ -6,6 +6,11 @@
  *
  * 24/8/11
  * 	- from im_avg.c
+ * 14/10/18
+ * 	- add vips__statistic_group_build() to run several statistics in one
+ * 	  scan
+ * 	- finish sequences scanned by vips_tee()
+ * 	- add pairwise and compensated summation helpers
  */
 
 /*
@@ -106,6 +111,268 @@ vips_statistic_scan_stop( void *seq, void *a, void *b )
 	return( class->stop( statistic, seq ) );
 }
 
+/* How a member of a group gets its pixels.
+ *
+ * Each member's ready image is made from a copy of the group's input, plus 
+ * perhaps a cast. If there's no cast, or the cast is a no-op, we can pass 
+ * lines of the input straight through. If the cast has a line function, we 
+ * run that into a buffer. Otherwise the member gets a region of its own.
+ */
+typedef enum {
+	VIPS_STATISTIC_LINE_DIRECT,
+	VIPS_STATISTIC_LINE_POINT,
+	VIPS_STATISTIC_LINE_REGION
+} VipsStatisticLine;
+
+struct _VipsStatisticGroup {
+	/* Every member has this as its input.
+	 */
+	VipsImage *in;
+
+	int n;
+	VipsStatistic **member;
+
+	/* How each member gets its pixels.
+	 */
+	VipsStatisticLine *line;
+	VipsPointFn *fn;
+	void **a;
+
+	/* Largest line we make with a line function.
+	 */
+	size_t sizeof_line;
+};
+
+typedef struct _VipsStatisticGroupSequence {
+	/* A sequence for each member, and a region on ready for members we
+	 * can't feed directly.
+	 */
+	void **seq;
+	VipsRegion **region;
+
+	VipsPel *buf;
+} VipsStatisticGroupSequence;
+
+static int
+vips_statistic_group_stop( void *vseq, void *a, void *b )
+{
+	VipsStatisticGroupSequence *seq = (VipsStatisticGroupSequence *) vseq;
+	VipsStatisticGroup *group = (VipsStatisticGroup *) a;
+
+	int result;
+	int i;
+
+	result = 0;
+	for( i = 0; i < group->n; i++ ) {
+		VipsStatistic *statistic = group->member[i];
+		VipsStatisticClass *class = 
+			VIPS_STATISTIC_GET_CLASS( statistic );
+
+		if( seq->seq[i] &&
+			class->stop( statistic, seq->seq[i] ) )
+			result = -1;
+		VIPS_UNREF( seq->region[i] );
+	}
+
+	VIPS_FREE( seq->buf );
+	g_free( seq->seq );
+	g_free( seq->region );
+	g_free( seq );
+
+	return( result );
+}
+
+static void *
+vips_statistic_group_start( VipsImage *in, void *a, void *b )
+{
+	VipsStatisticGroup *group = (VipsStatisticGroup *) a;
+
+	VipsStatisticGroupSequence *seq;
+	int i;
+
+	seq = g_new0( VipsStatisticGroupSequence, 1 );
+	seq->seq = g_new0( void *, group->n );
+	seq->region = g_new0( VipsRegion *, group->n );
+
+	if( group->sizeof_line > 0 &&
+		!(seq->buf = 
+			VIPS_ARRAY( NULL, group->sizeof_line, VipsPel )) ) {
+		vips_statistic_group_stop( seq, a, b );
+		return( NULL );
+	}
+
+	for( i = 0; i < group->n; i++ ) {
+		VipsStatistic *statistic = group->member[i];
+		VipsStatisticClass *class = 
+			VIPS_STATISTIC_GET_CLASS( statistic );
+
+		if( !(seq->seq[i] = class->start( statistic )) ) {
+			vips_statistic_group_stop( seq, a, b );
+			return( NULL );
+		}
+
+		if( group->line[i] == VIPS_STATISTIC_LINE_REGION &&
+			!(seq->region[i] = 
+				vips_region_new( statistic->ready )) ) {
+			vips_statistic_group_stop( seq, a, b );
+			return( NULL );
+		}
+	}
+
+	return( (void *) seq );
+}
+
+static int
+vips_statistic_group_scan( VipsRegion *region, 
+	void *vseq, void *a, void *b, gboolean *stop )
+{
+	VipsStatisticGroupSequence *seq = (VipsStatisticGroupSequence *) vseq;
+	VipsStatisticGroup *group = (VipsStatisticGroup *) a;
+	VipsRect *r = &region->valid;
+
+	gboolean all_stopped;
+	int i, y;
+
+	VIPS_DEBUG_MSG( "vips_statistic_group_scan: %d x %d @ %d x %d\n",
+		r->width, r->height, r->left, r->top );
+
+	for( i = 0; i < group->n; i++ ) 
+		if( seq->region[i] &&
+			vips_region_prepare( seq->region[i], r ) )
+			return( -1 );
+
+	for( y = r->top; y < VIPS_RECT_BOTTOM( r ); y++ ) { 
+		VipsPel *p = VIPS_REGION_ADDR( region, r->left, y ); 
+
+		for( i = 0; i < group->n; i++ ) {
+			VipsStatistic *statistic = group->member[i];
+			VipsStatisticClass *class = 
+				VIPS_STATISTIC_GET_CLASS( statistic );
+
+			VipsPel *in[2];
+			VipsPel *q;
+
+			if( statistic->stop )
+				continue;
+
+			switch( group->line[i] ) {
+			case VIPS_STATISTIC_LINE_DIRECT:
+				q = p;
+				break;
+
+			case VIPS_STATISTIC_LINE_POINT:
+				in[0] = p;
+				in[1] = NULL;
+				group->fn[i]( seq->buf, in, r->width, 
+					group->a[i] );
+				q = seq->buf;
+				break;
+
+			case VIPS_STATISTIC_LINE_REGION:
+				q = VIPS_REGION_ADDR( seq->region[i], 
+					r->left, y );
+				break;
+
+			default:
+				g_assert_not_reached();
+
+				/* Stop compiler warnings.
+				 */
+				q = NULL;
+			}
+
+			if( class->scan( statistic, 
+				seq->seq[i], r->left, y, q, r->width ) ) 
+				return( -1 );
+		}
+	}
+
+	/* Only stop when everyone has what they need.
+	 */
+	all_stopped = TRUE;
+	for( i = 0; i < group->n; i++ ) 
+		if( !group->member[i]->stop )
+			all_stopped = FALSE;
+	if( all_stopped )
+		*stop = TRUE;
+
+	return( 0 );
+}
+
+static VipsStatisticLine
+vips_statistic_group_line( VipsStatisticGroup *group, VipsImage *ready,
+	VipsPointFn *fn, void **a )
+{
+	VipsImage *in;
+
+	g_assert( ready->Xsize == group->in->Xsize &&
+		ready->Ysize == group->in->Ysize );
+
+	if( ready->BandFmt == group->in->BandFmt &&
+		ready->Bands == group->in->Bands )
+		return( VIPS_STATISTIC_LINE_DIRECT );
+
+	if( (*fn = vips__point_get( ready, &in, a )) &&
+		in->BandFmt == group->in->BandFmt &&
+		in->Bands == group->in->Bands )
+		return( VIPS_STATISTIC_LINE_POINT );
+
+	return( VIPS_STATISTIC_LINE_REGION );
+}
+
+/* Called from the build of each member in turn. We build the next member
+ * and it recurses: the last member runs the scan for everyone, then each 
+ * member's build finishes as we unwind, with the results in place.
+ */
+static int
+vips_statistic_group_next( VipsStatistic *statistic )
+{
+	VipsStatisticGroup *group = statistic->group;
+	int next = statistic->group_index + 1;
+
+	int i;
+
+	if( next < group->n ) 
+		return( vips_object_build( 
+			VIPS_OBJECT( group->member[next] ) ) );
+
+	group->sizeof_line = 0;
+	for( i = 0; i < group->n; i++ ) {
+		VipsImage *ready = group->member[i]->ready;
+
+		group->line[i] = vips_statistic_group_line( group, ready,
+			&group->fn[i], &group->a[i] );
+		if( group->line[i] == VIPS_STATISTIC_LINE_POINT )
+			group->sizeof_line = VIPS_MAX( group->sizeof_line,
+				VIPS_IMAGE_SIZEOF_LINE( ready ) );
+	}
+
+	return( vips_sink( group->in, 
+		vips_statistic_group_start, 
+		vips_statistic_group_scan, 
+		vips_statistic_group_stop, 
+		group, NULL ) );
+}
+
+/* vips_tee() has scanned the image for us, just stop the sequences.
+ */
+static int
+vips_statistic_scanned_stop( VipsStatistic *statistic )
+{
+	VipsStatisticClass *class = VIPS_STATISTIC_GET_CLASS( statistic );
+
+	int result;
+	GSList *p;
+
+	result = 0;
+	for( p = statistic->scanned; p; p = p->next )
+		if( class->stop( statistic, p->data ) )
+			result = -1;
+	VIPS_FREEF( g_slist_free, statistic->scanned );
+
+	return( result );
+}
+
 static int
 vips_statistic_build( VipsObject *object )
 {
@@ -137,7 +404,15 @@ vips_statistic_build( VipsObject *object )
 		statistic->ready = t[1];
 	}
 
-	if( vips_sink( statistic->ready, 
+	if( statistic->scanned ) {
+		if( vips_statistic_scanned_stop( statistic ) )
+			return( -1 );
+	}
+	else if( statistic->group ) {
+		if( vips_statistic_group_next( statistic ) )
+			return( -1 );
+	}
+	else if( vips_sink( statistic->ready, 
 		vips_statistic_scan_start, 
 		vips_statistic_scan, 
 		vips_statistic_scan_stop, 
@@ -175,3 +450,139 @@ static void
 vips_statistic_init( VipsStatistic *statistic )
 {
 }
+
+/* Build the @n statistics in @member with a single scan of @in. Each member
+ * must be unbuilt and have @in, which must be uncoded, as its input image. 
+ * Each member runs its own start, scan and stop functions and finishes its 
+ * own build, so results are exactly as if they had been run one by one.
+ *
+ * Members are built with vips_object_build(), not via the operation cache.
+ */
+int
+vips__statistic_group_build( VipsImage *in, VipsStatistic **member, int n )
+{
+	VipsStatisticGroup group;
+	int i;
+	int result;
+
+	g_assert( in->Coding == VIPS_CODING_NONE );
+	g_assert( n > 0 );
+
+	group.in = in;
+	group.n = n;
+	group.member = member;
+	group.line = g_new0( VipsStatisticLine, n );
+	group.fn = g_new0( VipsPointFn, n );
+	group.a = g_new0( void *, n );
+	group.sizeof_line = 0;
+
+	for( i = 0; i < n; i++ ) {
+		g_assert( member[i]->in == in );
+		g_assert( !VIPS_OBJECT( member[i] )->constructed );
+
+		member[i]->group = &group;
+		member[i]->group_index = i;
+	}
+
+	result = vips_object_build( VIPS_OBJECT( member[0] ) );
+
+	for( i = 0; i < n; i++ ) 
+		member[i]->group = NULL;
+
+	g_free( group.line );
+	g_free( group.fn );
+	g_free( group.a );
+
+	return( result );
+}
+
+/* Sum blocks up to this size with a set of independent accumulators, which
+ * the compiler can vectorise, then combine blocks pairwise. The error then
+ * grows with log(n) rather than n.
+ */
+#define VIPS_STATISTIC_BLOCK (256)
+
+#define VIPS_STATISTIC_PAIRWISE( NAME, TYPE, TERM ) \
+double \
+NAME( TYPE *p, int n, double mean ) \
+{ \
+	if( n <= VIPS_STATISTIC_BLOCK ) { \
+		double s[8] = { 0 }; \
+		double sum; \
+		int i, j; \
+		\
+		for( i = 0; i + 8 <= n; i += 8 ) \
+			for( j = 0; j < 8; j++ ) { \
+				double v = (double) p[i + j] - mean; \
+				\
+				s[j] += TERM; \
+			} \
+		\
+		sum = ((s[0] + s[1]) + (s[2] + s[3])) + \
+			((s[4] + s[5]) + (s[6] + s[7])); \
+		for( ; i < n; i++ ) { \
+			double v = (double) p[i] - mean; \
+			\
+			sum += TERM; \
+		} \
+		\
+		return( sum ); \
+	} \
+	else { \
+		int half = (n / 2) & ~7; \
+		\
+		return( NAME( p, half, mean ) + \
+			NAME( p + half, n - half, mean ) ); \
+	} \
+}
+
+/* Sum of p[i] - mean.
+ */
+VIPS_STATISTIC_PAIRWISE( vips__statistic_sum_float, float, v )
+VIPS_STATISTIC_PAIRWISE( vips__statistic_sum_double, double, v )
+
+/* Sum of (p[i] - mean) squared.
+ */
+VIPS_STATISTIC_PAIRWISE( vips__statistic_sum2_float, float, v * v )
+VIPS_STATISTIC_PAIRWISE( vips__statistic_sum2_double, double, v * v )
+
+/* Add to a running sum with Neumaier's variant of Kahan summation. The 
+ * total is sum->sum + sum->c.
+ */
+void
+vips__statistic_sum_add( VipsStatisticSum *sum, double v )
+{
+	double t = sum->sum + v;
+
+	if( VIPS_FABS( sum->sum ) >= VIPS_FABS( v ) )
+		sum->c += (sum->sum - t) + v;
+	else
+		sum->c += (v - t) + sum->sum;
+	sum->sum = t;
+}
+
+/* Merge the mean and sum of squared differences from the mean for two 
+ * sets of values with Chan's formula. This is stable, unlike subtracting 
+ * the sum squared from the sum of squares.
+ */
+void
+vips__statistic_moments_add( VipsStatisticMoments *moments, 
+	VipsStatisticMoments *b )
+{
+	gint64 n = moments->n + b->n;
+
+	double delta;
+
+	if( b->n == 0 )
+		return;
+	if( moments->n == 0 ) {
+		*moments = *b;
+		return;
+	}
+
+	delta = b->mean - moments->mean;
+	moments->m2 += b->m2 + 
+		delta * delta * ((double) moments->n * b->n / n);
+	moments->mean += delta * b->n / n;
+	moments->n = n;
+}
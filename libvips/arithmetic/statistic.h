@@ -54,6 +54,7 @@ extern "C" {
 
 typedef struct _VipsStatistic VipsStatistic;
 typedef struct _VipsStatisticClass VipsStatisticClass;
+typedef struct _VipsStatisticGroup VipsStatisticGroup;
 
 typedef void *(*VipsStatisticStartFn)( VipsStatistic *statistic ); 
 typedef int (*VipsStatisticScanFn)( VipsStatistic *statistic, 
@@ -79,6 +80,17 @@ struct _VipsStatistic {
 	 */
 	void *a; 
 	void *b;
+
+	/* If set, this statistic shares a single scan of the input with the
+	 * other members of the group, see vips__statistic_group_build().
+	 */
+	VipsStatisticGroup *group;
+	int group_index;
+
+	/* Sequences which vips_tee() has already scanned. If set, build
+	 * stops these rather than scanning the image.
+	 */
+	GSList *scanned;
 };
 
 struct _VipsStatisticClass {
@@ -95,8 +107,34 @@ struct _VipsStatisticClass {
 	const VipsBandFormat *format_table;
 };
 
+/* A compensated running sum.
+ */
+typedef struct _VipsStatisticSum {
+	double sum;
+	double c;
+} VipsStatisticSum;
+
+/* Count, mean, and sum of squared differences from the mean.
+ */
+typedef struct _VipsStatisticMoments {
+	gint64 n;
+	double mean;
+	double m2;
+} VipsStatisticMoments;
+
 GType vips_statistic_get_type( void );
 
+double vips__statistic_sum_float( float *p, int n, double mean );
+double vips__statistic_sum_double( double *p, int n, double mean );
+double vips__statistic_sum2_float( float *p, int n, double mean );
+double vips__statistic_sum2_double( double *p, int n, double mean );
+void vips__statistic_sum_add( VipsStatisticSum *sum, double v );
+void vips__statistic_moments_add( VipsStatisticMoments *moments, 
+	VipsStatisticMoments *b );
+
+int vips__statistic_group_build( VipsImage *in, 
+	VipsStatistic **member, int n );
+
 #ifdef __cplusplus
 }
 #endif /*__cplusplus*/
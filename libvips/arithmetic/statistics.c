@@ -0,0 +1,284 @@
+/* find several statistics in a single pass
+ *
+ * 14/10/18
+ * 	- first version
+ */
+
+/*
+
+    This file is part of VIPS.
+
+    VIPS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA
+
+ */
+
+/*
+
+    These files are distributed with VIPS - http://www.vips.ecs.soton.ac.uk
+
+ */
+
+/*
+#define DEBUG
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /*HAVE_CONFIG_H*/
+#include <vips/intl.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <vips/vips.h>
+#include <vips/internal.h>
+
+#include "statistic.h"
+
+typedef struct _VipsStatistics {
+	VipsOperation parent_instance;
+
+	VipsImage *in;
+	VipsStatisticsFlags which;
+
+	double avg;
+	double deviate;
+	double min;
+	double max;
+	VipsImage *hist;
+} VipsStatistics;
+
+typedef VipsOperationClass VipsStatisticsClass;
+
+G_DEFINE_TYPE( VipsStatistics, vips_statistics, VIPS_TYPE_OPERATION );
+
+/* The statistics we can find, the operation that finds each one, and the
+ * output we copy its result to.
+ */
+typedef struct _VipsStatisticsMember {
+	VipsStatisticsFlags flag;
+	const char *nickname;
+	const char *name;
+} VipsStatisticsMember;
+
+static VipsStatisticsMember vips_statistics_member[] = {
+	{ VIPS_STATISTICS_AVG, "avg", "avg" },
+	{ VIPS_STATISTICS_DEVIATE, "deviate", "deviate" },
+	{ VIPS_STATISTICS_MIN, "min", "min" },
+	{ VIPS_STATISTICS_MAX, "max", "max" },
+	{ VIPS_STATISTICS_HIST, "hist_find", "hist" }
+};
+
+/* Copy the "out" of a member to the named output.
+ */
+static void
+vips_statistics_get( VipsStatistics *statistics,
+	VipsStatistic *statistic, const char *name )
+{
+	GParamSpec *pspec;
+	GValue value = { 0 };
+
+	pspec = g_object_class_find_property(
+		G_OBJECT_GET_CLASS( statistic ), "out" );
+	g_assert( pspec );
+
+	g_value_init( &value, G_PARAM_SPEC_VALUE_TYPE( pspec ) );
+	g_object_get_property( G_OBJECT( statistic ), "out", &value );
+	g_object_set_property( G_OBJECT( statistics ), name, &value );
+	g_value_unset( &value );
+}
+
+static int
+vips_statistics_build( VipsObject *object )
+{
+	VipsStatistics *statistics = (VipsStatistics *) object;
+	VipsImage **t = (VipsImage **) vips_object_local_array( object, 1 );
+
+	VipsStatistic *member[VIPS_NUMBER( vips_statistics_member )];
+	const char *name[VIPS_NUMBER( vips_statistics_member )];
+	int n, i;
+	int result;
+
+	if( VIPS_OBJECT_CLASS( vips_statistics_parent_class )->
+		build( object ) )
+		return( -1 );
+
+	/* Decode once, then every member sees the same uncoded image.
+	 */
+	if( vips_image_decode( statistics->in, &t[0] ) )
+		return( -1 );
+
+	result = 0;
+	n = 0;
+	for( i = 0; i < VIPS_NUMBER( vips_statistics_member ); i++ ) {
+		VipsStatisticsMember *m = &vips_statistics_member[i];
+
+		VipsOperation *operation;
+
+		if( !(statistics->which & m->flag) )
+			continue;
+
+		if( !(operation = vips_operation_new( m->nickname )) ) {
+			result = -1;
+			break;
+		}
+		g_object_set( operation, "in", t[0], NULL );
+
+		member[n] = VIPS_STATISTIC( operation );
+		name[n] = m->name;
+		n += 1;
+	}
+
+	if( !result &&
+		n > 0 )
+		result = vips__statistic_group_build( t[0], member, n );
+
+	if( !result )
+		for( i = 0; i < n; i++ )
+			vips_statistics_get( statistics, member[i], name[i] );
+
+	for( i = 0; i < n; i++ ) {
+		vips_object_unref_outputs( VIPS_OBJECT( member[i] ) );
+		g_object_unref( member[i] );
+	}
+
+	return( result );
+}
+
+static void
+vips_statistics_class_init( VipsStatisticsClass *class )
+{
+	GObjectClass *gobject_class = (GObjectClass *) class;
+	VipsObjectClass *object_class = (VipsObjectClass *) class;
+	VipsOperationClass *operation_class = VIPS_OPERATION_CLASS( class );
+
+	gobject_class->set_property = vips_object_set_property;
+	gobject_class->get_property = vips_object_get_property;
+
+	object_class->nickname = "statistics";
+	object_class->description =
+		_( "find several image statistics in a single pass" );
+	object_class->build = vips_statistics_build;
+
+	operation_class->flags = VIPS_OPERATION_SEQUENTIAL;
+
+	VIPS_ARG_IMAGE( class, "in", 0,
+		_( "Input" ),
+		_( "Input image" ),
+		VIPS_ARGUMENT_REQUIRED_INPUT,
+		G_STRUCT_OFFSET( VipsStatistics, in ) );
+
+	VIPS_ARG_FLAGS( class, "which", 1,
+		_( "Which" ),
+		_( "Statistics to find" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsStatistics, which ),
+		VIPS_TYPE_STATISTICS_FLAGS, VIPS_STATISTICS_ALL );
+
+	VIPS_ARG_DOUBLE( class, "avg", 2,
+		_( "Average" ),
+		_( "Average of all pixels" ),
+		VIPS_ARGUMENT_OPTIONAL_OUTPUT,
+		G_STRUCT_OFFSET( VipsStatistics, avg ),
+		-INFINITY, INFINITY, 0.0 );
+
+	VIPS_ARG_DOUBLE( class, "deviate", 3,
+		_( "Deviate" ),
+		_( "Standard deviation of all pixels" ),
+		VIPS_ARGUMENT_OPTIONAL_OUTPUT,
+		G_STRUCT_OFFSET( VipsStatistics, deviate ),
+		-INFINITY, INFINITY, 0.0 );
+
+	VIPS_ARG_DOUBLE( class, "min", 4,
+		_( "Minimum" ),
+		_( "Minimum value" ),
+		VIPS_ARGUMENT_OPTIONAL_OUTPUT,
+		G_STRUCT_OFFSET( VipsStatistics, min ),
+		-INFINITY, INFINITY, 0.0 );
+
+	VIPS_ARG_DOUBLE( class, "max", 5,
+		_( "Maximum" ),
+		_( "Maximum value" ),
+		VIPS_ARGUMENT_OPTIONAL_OUTPUT,
+		G_STRUCT_OFFSET( VipsStatistics, max ),
+		-INFINITY, INFINITY, 0.0 );
+
+	VIPS_ARG_IMAGE( class, "hist", 6,
+		_( "Histogram" ),
+		_( "Histogram of all bands" ),
+		VIPS_ARGUMENT_OPTIONAL_OUTPUT,
+		G_STRUCT_OFFSET( VipsStatistics, hist ) );
+}
+
+static void
+vips_statistics_init( VipsStatistics *statistics )
+{
+	statistics->which = VIPS_STATISTICS_ALL;
+}
+
+/**
+ * vips_statistics: (method)
+ * @in: input #VipsImage
+ * @...: %NULL-terminated list of optional named arguments
+ *
+ * Optional arguments:
+ *
+ * * @which: #VipsStatisticsFlags, statistics to find
+ * * @avg: output average, as vips_avg()
+ * * @deviate: output standard deviation, as vips_deviate()
+ * * @min: output minimum, as vips_min()
+ * * @max: output maximum, as vips_max()
+ * * @hist: output histogram, as vips_hist_find()
+ *
+ * Find several statistics in a single pass over @in. This is much quicker
+ * than calling vips_avg(), vips_deviate() and so on one after the other,
+ * since @in is only computed and decoded once.
+ *
+ * @which selects the statistics to find, it defaults to
+ * #VIPS_STATISTICS_ALL. Each statistic is found with the same code as the
+ * operation named above, so the results are identical, and any errors are
+ * too: for example, @deviate does not work for complex images.
+ *
+ * For example:
+ *
+ * |[
+ * double avg, deviate;
+ *
+ * if (vips_statistics (in,
+ *   "which", VIPS_STATISTICS_AVG | VIPS_STATISTICS_DEVIATE,
+ *   "avg", &avg,
+ *   "deviate", &deviate,
+ *   NULL))
+ *   return -1;
+ * ]|
+ *
+ * See also: vips_stats(), vips_avg(), vips_hist_find().
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int
+vips_statistics( VipsImage *in, ... )
+{
+	va_list ap;
+	int result;
+
+	va_start( ap, in );
+	result = vips_call_split( "statistics", ap, in );
+	va_end( ap );
+
+	return( result );
+}
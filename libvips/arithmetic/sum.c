@@ -2,6 +2,8 @@
  *
  * 18/3/14
  * 	- from add.c
+ * 14/10/18
+ * 	- add @weights and @offset for a linear combination in one pass
  */
 
 /*
@@ -48,11 +50,26 @@
 
 #include "nary.h"
 
-typedef VipsNary VipsSum;
+typedef struct _VipsSum {
+	VipsNary parent_instance;
+
+	/* Optional per-image weights and an offset. If either is set we
+	 * compute a weighted sum in float.
+	 */
+	VipsArea *weights;
+	double offset;
+
+	/* One weight per input image, or NULL for a plain sum.
+	 */
+	double *w;
+} VipsSum;
+
 typedef VipsNaryClass VipsSumClass;
 
 G_DEFINE_TYPE( VipsSum, vips_sum, VIPS_TYPE_NARY );
 
+#define VIPS_SUM( obj ) ((VipsSum *) (obj))
+
 #define LOOP( IN, OUT ) { \
 	IN ** restrict p = (IN **) in; \
 	OUT * restrict q = (OUT *) out; \
@@ -67,6 +84,90 @@ G_DEFINE_TYPE( VipsSum, vips_sum, VIPS_TYPE_NARY );
 	} \
 }
 
+/* Weighted sum. Complex images have the weights applied to both parts, but
+ * the offset only to the real part.
+ */
+#define WLOOP( IN, OUT ) { \
+	IN ** restrict p = (IN **) in; \
+	OUT * restrict q = (OUT *) out; \
+	\
+	for( x = 0; x < sz; x++ ) { \
+		double sum; \
+		\
+		sum = offset; \
+		for( i = 0; i < n; i++ ) \
+			sum += w[i] * p[i][x]; \
+		q[x] = sum; \
+	} \
+}
+
+#define CWLOOP( IN ) { \
+	IN ** restrict p = (IN **) in; \
+	IN * restrict q = (IN *) out; \
+	\
+	for( x = 0; x < sz; x += 2 ) { \
+		double re; \
+		double im; \
+		\
+		re = offset; \
+		im = 0.0; \
+		for( i = 0; i < n; i++ ) { \
+			re += w[i] * p[i][x]; \
+			im += w[i] * p[i][x + 1]; \
+		} \
+		q[x] = re; \
+		q[x + 1] = im; \
+	} \
+}
+
+static void
+sum_buffer_weighted( VipsSum *sum, VipsPel *out, VipsPel **in, int width )
+{
+	VipsArithmetic *arithmetic = VIPS_ARITHMETIC( sum );
+	VipsImage *im = arithmetic->ready[0];
+	int n = arithmetic->n;
+	double *w = sum->w;
+	double offset = sum->offset;
+
+	/* Complex just doubles the size.
+	 */
+	const int sz = width * vips_image_get_bands( im ) *
+		(vips_band_format_iscomplex( vips_image_get_format( im ) ) ?
+		 	2 : 1);
+
+	int x;
+	int i;
+
+	/* Keep types here in sync with vips_sum_weighted_format_table[]
+	 * below.
+	 */
+	switch( vips_image_get_format( im ) ) {
+	case VIPS_FORMAT_UCHAR:
+		WLOOP( unsigned char, float ); break;
+	case VIPS_FORMAT_CHAR:
+		WLOOP( signed char, float ); break;
+	case VIPS_FORMAT_USHORT:
+		WLOOP( unsigned short, float ); break;
+	case VIPS_FORMAT_SHORT:
+		WLOOP( signed short, float ); break;
+	case VIPS_FORMAT_UINT:
+		WLOOP( unsigned int, float ); break;
+	case VIPS_FORMAT_INT:
+		WLOOP( signed int, float ); break;
+	case VIPS_FORMAT_FLOAT:
+		WLOOP( float, float ); break;
+	case VIPS_FORMAT_DOUBLE:
+		WLOOP( double, double ); break;
+	case VIPS_FORMAT_COMPLEX:
+		CWLOOP( float ); break;
+	case VIPS_FORMAT_DPCOMPLEX:
+		CWLOOP( double ); break;
+
+	default:
+		g_assert_not_reached();
+	}
+}
+
 static void
 sum_buffer( VipsArithmetic *arithmetic, VipsPel *out, VipsPel **in, int width )
 {
@@ -82,6 +183,11 @@ sum_buffer( VipsArithmetic *arithmetic, VipsPel *out, VipsPel **in, int width )
 	int x;
 	int i;
 
+	if( VIPS_SUM( arithmetic )->w ) {
+		sum_buffer_weighted( VIPS_SUM( arithmetic ), out, in, width );
+		return;
+	}
+
 	/* Sum all input types. Keep types here in sync with 
 	 * vips_sum_format_table[] below.
 	 */
@@ -131,18 +237,87 @@ static const VipsBandFormat vips_sum_format_table[10] = {
    UI, I,  UI, I,  UI, I, F, X, D, DX
 };
 
+/* A weighted sum is always float, or double for double input.
+ */
+static const VipsBandFormat vips_sum_weighted_format_table[10] = {
+/* UC  C   US  S   UI  I  F  X  D  DX */
+   F,  F,  F,  F,  F,  F, F, X, D, DX
+};
+
+static int
+vips_sum_build( VipsObject *object )
+{
+	VipsArithmetic *arithmetic = VIPS_ARITHMETIC( object );
+	VipsNary *nary = (VipsNary *) object;
+	VipsSum *sum = VIPS_SUM( object );
+
+	if( sum->weights ||
+		sum->offset != 0.0 ) {
+		int n = nary->in ? nary->in->n : 0;
+		int i;
+
+		if( sum->weights &&
+			sum->weights->n != 1 &&
+			sum->weights->n != n ) {
+			vips_error( "sum",
+				_( "need 1 or %d weights" ), n );
+			return( -1 );
+		}
+
+		sum->w = VIPS_ARRAY( object, VIPS_MAX( 1, n ), double );
+		if( !sum->w )
+			return( -1 );
+		for( i = 0; i < n; i++ )
+			sum->w[i] = !sum->weights ?
+				1.0 :
+				((double *) sum->weights->data)[
+					sum->weights->n == 1 ? 0 : i];
+	}
+
+	if( VIPS_OBJECT_CLASS( vips_sum_parent_class )->build( object ) )
+		return( -1 );
+
+	/* The output format depends on the input format, so we can only fix
+	 * it up now. Nothing has been computed yet.
+	 */
+	if( sum->w )
+		arithmetic->out->BandFmt = vips_sum_weighted_format_table[
+			arithmetic->ready[0]->BandFmt];
+
+	return( 0 );
+}
+
 static void
 vips_sum_class_init( VipsSumClass *class )
 {
+	GObjectClass *gobject_class = G_OBJECT_CLASS( class );
 	VipsObjectClass *object_class = (VipsObjectClass *) class;
 	VipsArithmeticClass *aclass = VIPS_ARITHMETIC_CLASS( class );
 
+	gobject_class->set_property = vips_object_set_property;
+	gobject_class->get_property = vips_object_get_property;
+
 	object_class->nickname = "sum";
 	object_class->description = _( "sum an array of images" );
+	object_class->build = vips_sum_build;
 
 	aclass->process_line = sum_buffer;
 
 	vips_arithmetic_set_format_table( aclass, vips_sum_format_table ); 
+
+	VIPS_ARG_BOXED( class, "weights", 10,
+		_( "Weights" ),
+		_( "Multiply each image by a weight" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsSum, weights ),
+		VIPS_TYPE_ARRAY_DOUBLE );
+
+	VIPS_ARG_DOUBLE( class, "offset", 11,
+		_( "Offset" ),
+		_( "Add this to the weighted sum" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsSum, offset ),
+		-VIPS_MAX_COORD, VIPS_MAX_COORD, 0.0 );
 }
 
 static void
@@ -170,8 +345,21 @@ vips_sumv( VipsImage **in, VipsImage **out, int n, va_list ap )
  * @n: number of input images
  * @...: %NULL-terminated list of optional named arguments
  *
+ * Optional arguments:
+ *
+ * * @weights: #VipsArrayDouble, multiply each image by a weight
+ * * @offset: %gdouble, add this to the weighted sum
+ *
  * This operation sums all images in @in and writes the result to @out. 
  *
+ * If you set @weights (one per image, or a single weight for all of them)
+ * or @offset, the output is instead @offset plus the sum of each image
+ * times its weight, computed in one pass with float arithmetic. The output
+ * is float, or double or complex if the inputs are. This is handy for
+ * evaluating linear expressions over many images, see vips_linear() for the
+ * one-image case.
+ *
+ *
  * If the images differ in size, the smaller images are enlarged to match the
  * largest by adding zero pixels along the bottom and right.
  *
@@ -0,0 +1,655 @@
+/* pass pixels through, feeding a statistic on the way
+ *
+ * 14/10/18
+ * 	- first version
+ * 	- track scanned pixels as runs per line, not a bitmap, and only count
+ * 	  them once the scan has worked
+ */
+
+/*
+
+    This file is part of VIPS.
+
+    VIPS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA
+
+ */
+
+/*
+
+    These files are distributed with VIPS - http://www.vips.ecs.soton.ac.uk
+
+ */
+
+/*
+#define DEBUG
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /*HAVE_CONFIG_H*/
+#include <vips/intl.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vips/vips.h>
+#include <vips/internal.h>
+
+#include "statistic.h"
+
+/* A sequence on the statistic, plus somewhere to cast lines to.
+ */
+typedef struct _VipsTeeSequence {
+	void *seq;
+	VipsPel *buf;
+
+	/* Runs of unseen pixels on a line, as (x, width) pairs.
+	 */
+	int *run;
+} VipsTeeSequence;
+
+/* The pixels on a line which have been scanned (or are being scanned), as
+ * a sorted list of disjoint [start, end) pairs. Lines which are complete
+ * drop their list.
+ */
+typedef struct _VipsTeeLine {
+	int n;
+	int *run;
+	gboolean full;
+} VipsTeeLine;
+
+typedef struct _VipsTee {
+	VipsOperation parent_instance;
+
+	VipsImage *in;
+	VipsImage *out;
+	VipsOperation *statistic;
+
+	/* The statistic scans this. If it's a cast of @in, fn makes a line
+	 * of it from a line of @in.
+	 */
+	VipsImage *ready;
+	VipsPointFn fn;
+	void *a;
+
+	GMutex *lock;
+
+	/* The pixels we've scanned, one entry per line of @in. Pixels can be
+	 * computed more than once, but must only be counted once. 
+	 */
+	VipsTeeLine *lines;
+	guint64 n_seen;
+
+	/* Sequences not in use, the number in use, and whether we've built
+	 * the statistic.
+	 */
+	GSList *idle;
+	int n_active;
+	gboolean finished;
+} VipsTee;
+
+typedef VipsOperationClass VipsTeeClass;
+
+G_DEFINE_TYPE( VipsTee, vips_tee, VIPS_TYPE_OPERATION );
+
+static void
+vips_tee_sequence_free( VipsTeeSequence *seq, VipsTee *tee )
+{
+	/* Stop anything we didn't hand over, it'll free the sequence.
+	 */
+	if( seq->seq ) {
+		VipsStatistic *statistic = VIPS_STATISTIC( tee->statistic );
+		VipsStatisticClass *class =
+			VIPS_STATISTIC_GET_CLASS( statistic );
+
+		(void) class->stop( statistic, seq->seq );
+	}
+
+	VIPS_FREE( seq->buf );
+	VIPS_FREE( seq->run );
+	g_free( seq );
+}
+
+static void
+vips_tee_dispose( GObject *gobject )
+{
+	VipsTee *tee = (VipsTee *) gobject;
+
+	GSList *p;
+	int y;
+
+	/* Some pixels went through, but not all of them, so the statistic
+	 * was never built. Make sure someone hears about it.
+	 */
+	if( tee->lines &&
+		!tee->finished &&
+		tee->n_seen > 0 )
+		g_warning( "vips_tee: only %" G_GUINT64_FORMAT " of %" 
+			G_GUINT64_FORMAT " pixels were computed, "
+			"statistic not built",
+			tee->n_seen, 
+			(guint64) tee->in->Xsize * tee->in->Ysize );
+
+	for( p = tee->idle; p; p = p->next )
+		vips_tee_sequence_free( (VipsTeeSequence *) p->data, tee );
+	VIPS_FREEF( g_slist_free, tee->idle );
+	if( tee->lines ) {
+		for( y = 0; y < tee->in->Ysize; y++ )
+			VIPS_FREE( tee->lines[y].run );
+		VIPS_FREE( tee->lines );
+	}
+	VIPS_FREEF( vips_g_mutex_free, tee->lock );
+
+	G_OBJECT_CLASS( vips_tee_parent_class )->dispose( gobject );
+}
+
+static VipsTeeSequence *
+vips_tee_sequence_new( VipsTee *tee )
+{
+	VipsStatistic *statistic = VIPS_STATISTIC( tee->statistic );
+	VipsStatisticClass *class = VIPS_STATISTIC_GET_CLASS( statistic );
+
+	VipsTeeSequence *seq;
+
+	seq = g_new0( VipsTeeSequence, 1 );
+	if( !(seq->seq = class->start( statistic )) ||
+		!(seq->run = VIPS_ARRAY( NULL, tee->in->Xsize + 2, int )) ||
+		(tee->fn &&
+		 !(seq->buf = VIPS_ARRAY( NULL,
+			VIPS_IMAGE_SIZEOF_LINE( tee->ready ), VipsPel ))) ) {
+		vips_tee_sequence_free( seq, tee );
+		return( NULL );
+	}
+
+	return( seq );
+}
+
+/* Add [@left, @right) to the seen runs on @line. 
+ */
+static void
+vips_tee_line_add( VipsTeeLine *line, int left, int right, int width )
+{
+	int *run;
+	int n;
+	int i;
+	gboolean inserted;
+
+	if( line->full ||
+		left >= right )
+		return;
+
+	run = VIPS_ARRAY( NULL, 2 * (line->n + 1), int );
+	n = 0;
+	inserted = FALSE;
+	for( i = 0; i < line->n; i++ ) {
+		int start = line->run[i * 2];
+		int end = line->run[i * 2 + 1];
+
+		if( end < left ) {
+			run[n * 2] = start;
+			run[n * 2 + 1] = end;
+			n += 1;
+		}
+		else if( start > right ) {
+			if( !inserted ) {
+				run[n * 2] = left;
+				run[n * 2 + 1] = right;
+				n += 1;
+				inserted = TRUE;
+			}
+			run[n * 2] = start;
+			run[n * 2 + 1] = end;
+			n += 1;
+		}
+		else {
+			/* Overlaps or touches, merge it in.
+			 */
+			left = VIPS_MIN( left, start );
+			right = VIPS_MAX( right, end );
+		}
+	}
+	if( !inserted ) {
+		run[n * 2] = left;
+		run[n * 2 + 1] = right;
+		n += 1;
+	}
+
+	VIPS_FREE( line->run );
+	if( n == 1 &&
+		run[0] == 0 &&
+		run[1] == width ) {
+		VIPS_FREE( run );
+		line->full = TRUE;
+		n = 0;
+	}
+	line->run = run;
+	line->n = n;
+}
+
+/* Remove [@left, @right) from the seen runs on @line.
+ */
+static void
+vips_tee_line_remove( VipsTeeLine *line, int left, int right, int width )
+{
+	int *run;
+	int n;
+	int i;
+
+	if( left >= right )
+		return;
+
+	if( line->full ) {
+		line->full = FALSE;
+		line->run = VIPS_ARRAY( NULL, 2, int );
+		line->run[0] = 0;
+		line->run[1] = width;
+		line->n = 1;
+	}
+
+	run = VIPS_ARRAY( NULL, 2 * (line->n + 1), int );
+	n = 0;
+	for( i = 0; i < line->n; i++ ) {
+		int start = line->run[i * 2];
+		int end = line->run[i * 2 + 1];
+
+		if( end <= left ||
+			start >= right ) {
+			run[n * 2] = start;
+			run[n * 2 + 1] = end;
+			n += 1;
+		}
+		else {
+			if( start < left ) {
+				run[n * 2] = start;
+				run[n * 2 + 1] = left;
+				n += 1;
+			}
+			if( end > right ) {
+				run[n * 2] = right;
+				run[n * 2 + 1] = end;
+				n += 1;
+			}
+		}
+	}
+
+	VIPS_FREE( line->run );
+	line->run = run;
+	line->n = n;
+}
+
+/* Find the unseen pixels from @left to @right on line @y, list them in @run 
+ * as (x, width) pairs, and mark them as seen so no other thread takes them. 
+ * Call with the lock held.
+ */
+static int
+vips_tee_claim( VipsTee *tee, int left, int right, int y, int *run )
+{
+	VipsTeeLine *line = &tee->lines[y];
+
+	int n;
+	int x;
+	int i;
+
+	if( line->full )
+		return( 0 );
+
+	n = 0;
+	x = left;
+	for( i = 0; i < line->n && x < right; i++ ) {
+		int start = line->run[i * 2];
+		int end = line->run[i * 2 + 1];
+
+		if( end <= x )
+			continue;
+		if( start >= right )
+			break;
+		if( start > x ) {
+			run[n * 2] = x;
+			run[n * 2 + 1] = start - x;
+			n += 1;
+		}
+		x = VIPS_MAX( x, end );
+	}
+	if( x < right ) {
+		run[n * 2] = x;
+		run[n * 2 + 1] = right - x;
+		n += 1;
+	}
+
+	for( i = 0; i < n; i++ ) {
+		vips_tee_line_add( line, 
+			run[i * 2], run[i * 2] + run[i * 2 + 1], 
+			tee->in->Xsize );
+		tee->n_seen += run[i * 2 + 1];
+	}
+
+	return( n );
+}
+
+/* A scan failed: give back the runs from @first on, so they're not counted.
+ * Call with the lock held.
+ */
+static void
+vips_tee_unclaim( VipsTee *tee, int y, int *run, int first, int n )
+{
+	int i;
+
+	for( i = first; i < n; i++ ) {
+		vips_tee_line_remove( &tee->lines[y], 
+			run[i * 2], run[i * 2] + run[i * 2 + 1], 
+			tee->in->Xsize );
+		tee->n_seen -= run[i * 2 + 1];
+	}
+}
+
+/* Every pixel has been scanned and no sequence is running: hand the
+ * sequences to the statistic and build it.
+ */
+static void
+vips_tee_finish( VipsTee *tee )
+{
+	VipsStatistic *statistic = VIPS_STATISTIC( tee->statistic );
+
+	GSList *p;
+
+	for( p = tee->idle; p; p = p->next ) {
+		VipsTeeSequence *seq = (VipsTeeSequence *) p->data;
+
+		statistic->scanned = g_slist_prepend( statistic->scanned,
+			seq->seq );
+		seq->seq = NULL;
+	}
+
+#ifdef DEBUG
+	printf( "vips_tee_finish: building %s\n",
+		VIPS_OBJECT_GET_CLASS( statistic )->nickname );
+#endif /*DEBUG*/
+
+	if( vips_object_build( VIPS_OBJECT( statistic ) ) )
+		g_warning( "vips_tee: unable to build %s",
+			VIPS_OBJECT_GET_CLASS( statistic )->nickname );
+}
+
+static int
+vips_tee_scan( VipsTee *tee, VipsRegion *ir, VipsRect *r )
+{
+	VipsStatistic *statistic = VIPS_STATISTIC( tee->statistic );
+	VipsStatisticClass *class = VIPS_STATISTIC_GET_CLASS( statistic );
+	guint64 n_pels =
+		(guint64) tee->in->Xsize * tee->in->Ysize;
+
+	VipsTeeSequence *seq;
+	gboolean finish;
+	int result;
+	int y, i;
+
+	g_mutex_lock( tee->lock );
+	if( tee->finished ) {
+		g_mutex_unlock( tee->lock );
+		return( 0 );
+	}
+	seq = NULL;
+	if( tee->idle ) {
+		seq = (VipsTeeSequence *) tee->idle->data;
+		tee->idle = g_slist_remove( tee->idle, seq );
+	}
+	tee->n_active += 1;
+	g_mutex_unlock( tee->lock );
+
+	if( !seq &&
+		!(seq = vips_tee_sequence_new( tee )) ) {
+		g_mutex_lock( tee->lock );
+		tee->n_active -= 1;
+		g_mutex_unlock( tee->lock );
+
+		return( -1 );
+	}
+
+	result = 0;
+	for( y = r->top; y < VIPS_RECT_BOTTOM( r ) && !result; y++ ) {
+		int n;
+
+		g_mutex_lock( tee->lock );
+		n = vips_tee_claim( tee,
+			r->left, VIPS_RECT_RIGHT( r ), y, seq->run );
+		g_mutex_unlock( tee->lock );
+
+		for( i = 0; i < n; i++ ) {
+			int x = seq->run[i * 2];
+			int width = seq->run[i * 2 + 1];
+			VipsPel *p = VIPS_REGION_ADDR( ir, x, y );
+
+			if( tee->fn ) {
+				VipsPel *in[2];
+
+				in[0] = p;
+				in[1] = NULL;
+				tee->fn( seq->buf, in, width, tee->a );
+				p = seq->buf;
+			}
+
+			if( class->scan( statistic, 
+				seq->seq, x, y, p, width ) ) {
+				g_mutex_lock( tee->lock );
+				vips_tee_unclaim( tee, y, seq->run, i, n );
+				g_mutex_unlock( tee->lock );
+
+				result = -1;
+				break;
+			}
+		}
+	}
+
+	g_mutex_lock( tee->lock );
+	tee->idle = g_slist_prepend( tee->idle, seq );
+	tee->n_active -= 1;
+	finish = FALSE;
+	if( !tee->finished &&
+		tee->n_seen == n_pels &&
+		tee->n_active == 0 ) {
+		tee->finished = TRUE;
+		finish = TRUE;
+	}
+	g_mutex_unlock( tee->lock );
+
+	if( finish )
+		vips_tee_finish( tee );
+
+	return( result );
+}
+
+static int
+vips_tee_gen( VipsRegion *or, void *vseq, void *a, void *b, gboolean *stop )
+{
+	VipsRegion *ir = (VipsRegion *) vseq;
+	VipsTee *tee = (VipsTee *) b;
+	VipsRect *r = &or->valid;
+
+	if( vips_region_prepare( ir, r ) ||
+		vips_region_region( or, ir, r, r->left, r->top ) ||
+		vips_tee_scan( tee, ir, r ) )
+		return( -1 );
+
+	return( 0 );
+}
+
+static int
+vips_tee_build( VipsObject *object )
+{
+	VipsObjectClass *class = VIPS_OBJECT_GET_CLASS( object );
+	VipsTee *tee = (VipsTee *) object;
+	VipsImage **t = (VipsImage **) vips_object_local_array( object, 1 );
+
+	VipsStatistic *statistic;
+	VipsStatisticClass *sclass;
+
+	if( VIPS_OBJECT_CLASS( vips_tee_parent_class )->build( object ) )
+		return( -1 );
+
+	if( vips_check_uncoded( class->nickname, tee->in ) ||
+		vips_image_pio_input( tee->in ) )
+		return( -1 );
+
+	if( !VIPS_IS_STATISTIC( tee->statistic ) ||
+		VIPS_OBJECT( tee->statistic )->constructed ) {
+		vips_error( class->nickname,
+			"%s", _( "statistic must be an unbuilt statistic" ) );
+		return( -1 );
+	}
+	statistic = VIPS_STATISTIC( tee->statistic );
+	sclass = VIPS_STATISTIC_GET_CLASS( statistic );
+
+	g_object_set( statistic, "in", tee->in, NULL );
+
+	/* If the statistic needs a cast, we must be able to run it a line at
+	 * a time, or we'd have to compute the pixels twice.
+	 */
+	tee->ready = tee->in;
+	if( sclass->format_table &&
+		sclass->format_table[tee->in->BandFmt] != tee->in->BandFmt ) {
+		VipsImage *point_in;
+
+		if( vips_cast( tee->in, &t[0],
+			sclass->format_table[tee->in->BandFmt], NULL ) )
+			return( -1 );
+		if( !(tee->fn = vips__point_get( t[0], &point_in, &tee->a )) ||
+			point_in != tee->in ) {
+			vips_error( class->nickname,
+				"%s", _( "unable to cast for statistic" ) );
+			return( -1 );
+		}
+		tee->ready = t[0];
+	}
+	statistic->ready = tee->ready;
+
+	if( !(tee->lines = VIPS_ARRAY( NULL, tee->in->Ysize, VipsTeeLine )) )
+		return( -1 );
+	memset( tee->lines, 0, tee->in->Ysize * sizeof( VipsTeeLine ) );
+
+	g_object_set( tee, "out", vips_image_new(), NULL );
+
+	if( vips_image_pipelinev( tee->out,
+		VIPS_DEMAND_STYLE_THINSTRIP, tee->in, NULL ) )
+		return( -1 );
+
+	if( vips_image_generate( tee->out,
+		vips_start_one, vips_tee_gen, vips_stop_one,
+		tee->in, tee ) )
+		return( -1 );
+
+	return( 0 );
+}
+
+static void
+vips_tee_class_init( VipsTeeClass *class )
+{
+	GObjectClass *gobject_class = G_OBJECT_CLASS( class );
+	VipsObjectClass *vobject_class = VIPS_OBJECT_CLASS( class );
+	VipsOperationClass *operation_class = VIPS_OPERATION_CLASS( class );
+
+	gobject_class->dispose = vips_tee_dispose;
+	gobject_class->set_property = vips_object_set_property;
+	gobject_class->get_property = vips_object_get_property;
+
+	vobject_class->nickname = "tee";
+	vobject_class->description =
+		_( "pass an image through, feeding a statistic" );
+	vobject_class->build = vips_tee_build;
+
+	/* We have a side-effect, so we must never be cached.
+	 */
+	operation_class->flags =
+		VIPS_OPERATION_SEQUENTIAL | VIPS_OPERATION_NOCACHE;
+
+	VIPS_ARG_IMAGE( class, "in", 1,
+		_( "Input" ),
+		_( "Input image" ),
+		VIPS_ARGUMENT_REQUIRED_INPUT,
+		G_STRUCT_OFFSET( VipsTee, in ) );
+
+	VIPS_ARG_IMAGE( class, "out", 2,
+		_( "Output" ),
+		_( "Output image" ),
+		VIPS_ARGUMENT_REQUIRED_OUTPUT,
+		G_STRUCT_OFFSET( VipsTee, out ) );
+
+	VIPS_ARG_OBJECT( class, "statistic", 3,
+		_( "Statistic" ),
+		_( "Statistic to feed" ),
+		VIPS_ARGUMENT_REQUIRED_INPUT,
+		G_STRUCT_OFFSET( VipsTee, statistic ),
+		VIPS_TYPE_OPERATION );
+}
+
+static void
+vips_tee_init( VipsTee *tee )
+{
+	tee->lock = vips_g_mutex_new();
+}
+
+/**
+ * vips_tee: (method)
+ * @in: input image
+ * @out: (out): output image
+ * @statistic: unbuilt statistic to feed
+ * @...: %NULL-terminated list of optional named arguments
+ *
+ * Copy @in to @out, feeding every pixel to @statistic as it goes through.
+ * Once every pixel of @out has been computed, @statistic is built and you
+ * can read its outputs as usual. This lets you, for example, find
+ * image statistics while saving, without computing or decoding the image a
+ * second time.
+ *
+ * @statistic must be a statistic operation such as avg, stats or
+ * hist_find which has been made with vips_operation_new() but not built.
+ * vips_tee() sets its input image for you. Pixels which
+ * are computed more than once are only counted once.
+ *
+ * For example:
+ *
+ * |[
+ * VipsOperation *stats = vips_operation_new ("stats");
+ * VipsImage *x;
+ * VipsImage *matrix;
+ *
+ * if (vips_tee (in, &x, stats, NULL) ||
+ *   vips_image_write_to_file (x, "x.jpg", NULL)) {
+ *   ...
+ * }
+ * g_object_get (stats, "out", &matrix, NULL);
+ * ]|
+ *
+ * If the statistic fails to build, you'll see a warning and its outputs will
+ * not be set. If not all of @out is computed, @statistic is never built, and
+ * you'll see a warning when @out is freed.
+ *
+ * See also: vips_stats(), vips_statistics().
+ *
+ * Returns: 0 on success, -1 on error.
+ */
+int
+vips_tee( VipsImage *in, VipsImage **out, VipsOperation *statistic, ... )
+{
+	va_list ap;
+	int result;
+
+	va_start( ap, statistic );
+	result = vips_call_split( "tee", ap, in, out, statistic );
+	va_end( ap );
+
+	return( result );
+}
@@ -2,6 +2,8 @@
  *
  * 11/11/11
  * 	- from arith_binary_const
+ * 14/10/18
+ * 	- note uniform constants
  */
 
 /*
@@ -42,6 +44,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <vips/vips.h>
 
@@ -178,10 +181,24 @@ vips_unary_const_build( VipsObject *object )
 	 * Therefore pass in the desired vector type as a param.
 	 */
 
-	if( uconst->c ) 
-		uconst->c_ready = make_pixel( (VipsObject *) uconst, 
+	if( uconst->c ) {
+		int es = vips_format_sizeof( uconst->const_format );
+
+		int i;
+
+		if( !(uconst->c_ready = make_pixel( (VipsObject *) uconst,
 			uconst->n, uconst->const_format,
-			uconst->c->n, (double *) uconst->c->data );
+			uconst->c->n, (double *) uconst->c->data )) )
+			return( -1 );
+
+		uconst->uniform = TRUE;
+		for( i = 1; i < uconst->n; i++ )
+			if( memcmp( uconst->c_ready,
+				uconst->c_ready + i * es, es ) ) {
+				uconst->uniform = FALSE;
+				break;
+			}
+	}
 
 	if( VIPS_OBJECT_CLASS( vips_unary_const_parent_class )->
 		build( object ) )
@@ -70,6 +70,11 @@ typedef struct _VipsUnaryConst {
 	int n;
 	VipsPel *c_ready;
 
+	/* Set if all n elements of c_ready are the same, so subclasses can
+	 * use a kernel which takes a single constant.
+	 */
+	gboolean uniform;
+
 } VipsUnaryConst;
 
 typedef struct _VipsUnaryConstClass {
@@ -2,6 +2,8 @@
  *
  * 9/6/15
  * 	- from sRGB2HSV.c
+ * 14/10/18
+ * 	- add an AVX2 path
  */
 
 /*
@@ -41,6 +43,7 @@
 #include <math.h>
 
 #include <vips/vips.h>
+#include <vips/simd.h>
 
 #include "pcolour.h"
 
@@ -58,8 +61,15 @@ vips_HSV2sRGB_line( VipsColour *colour, VipsPel *out, VipsPel **in, int width )
 	unsigned char *p = (unsigned char *) in[0];
 	unsigned char *q = (unsigned char *) out;
 
+	VipsSimdPelFn simd;
 	int i;
 
+	if( (simd = (VipsSimdPelFn)
+		vips_simd_get( VIPS_SIMD_HSV2SRGB, VIPS_FORMAT_UCHAR )) ) {
+		simd( q, p, width );
+		return;
+	}
+
 	for( i = 0; i < width; i++ ) {
 		float c, x, m;
 
@@ -15,6 +15,8 @@
  * 	- cleanups
  * 18/9/12
  * 	- redone as a class
+ * 14/10/18
+ * 	- add a SIMD path
  */
 
 /*
@@ -57,6 +59,7 @@
 #include <math.h>
 
 #include <vips/vips.h>
+#include <vips/simd.h>
 #include <vips/debug.h>
 
 #include "pcolour.h"
@@ -89,11 +92,24 @@ vips_Lab2XYZ_line( VipsColour *colour, VipsPel *out, VipsPel **in, int width )
 	float * restrict p = (float *) in[0];
 	float * restrict q = (float *) out;
 
+	VipsSimdLabFn simd;
 	int x;
 
 	VIPS_DEBUG_MSG( "vips_Lab2XYZ_line: X0 = %g, Y0 = %g, Z0 = %g\n",
 		Lab2XYZ->X0, Lab2XYZ->Y0, Lab2XYZ->Z0 );
 
+	if( (simd = (VipsSimdLabFn)
+		vips_simd_get( VIPS_SIMD_LAB2XYZ, VIPS_FORMAT_FLOAT )) ) {
+		double white[3];
+
+		white[0] = Lab2XYZ->X0;
+		white[1] = Lab2XYZ->Y0;
+		white[2] = Lab2XYZ->Z0;
+		simd( q, p, width, white );
+
+		return;
+	}
+
 	for( x = 0; x < width; x++ ) {
 		float L, a, b;
 		float X, Y, Z;
@@ -81,6 +81,18 @@ int vips_Y2v_8[256 + 1];
  */
 float vips_v2Y_8[256];
 
+/* 8-bit sRGB -> 16-bit linear lut.
+ */
+unsigned short vips_v2Yi_8[256];
+
+/* 16-bit linear -> 8-bit sRGB lut. Index with the top 12 bits of the linear
+ * value and interpolate with the bottom 4, see vips_col_Yi2v_8(). Entries
+ * are sRGB * 256.
+ *
+ * There's an extra element at the end to let us do a +1 for interpolation.
+ */
+int vips_Yi2v_8[4096 + 1];
+
 /* 16-bit linear -> sRGB lut. 
  *
  * There's an extra element at the end to let us do a +1 for interpolation.
@@ -161,8 +173,28 @@ calcul_tables( int range, int *Y2v, float *v2Y )
 static void *
 calcul_tables_8( void *client )
 {
+	int i;
+
 	calcul_tables( 256, vips_Y2v_8, vips_v2Y_8 ); 
 
+	for( i = 0; i < 256; i++ )
+		vips_v2Yi_8[i] = VIPS_RINT( 65535 * vips_v2Y_8[i] );
+
+	/* Knots are 16 apart in the 16-bit linear range, so the last one is
+	 * just past 1.0.
+	 */
+	for( i = 0; i < 4096 + 1; i++ ) {
+		double f = i * 16.0 / 65535.0;
+		double v;
+
+		if( f <= 0.0031308 )
+			v = 12.92 * f;
+		else
+			v = (1.0 + 0.055) * pow( f, 1.0 / 2.4 ) - 0.055;
+
+		vips_Yi2v_8[i] = VIPS_RINT( 255 * 256 * v );
+	}
+
 	return( NULL );
 }
 
@@ -211,6 +243,20 @@ vips_col_sRGB2scRGB_16( int r, int g, int b, float *R, float *G, float *B )
  */
 #define SCALE (VIPS_D65_Y0)
 
+/* Keep these in sync with the functions below.
+ */
+const double vips__scRGB2XYZ_matrix[9] = {
+	SCALE * 0.4124, SCALE * 0.3576, SCALE * 0.18056,
+	SCALE * 0.2126, SCALE * 0.7152, SCALE * 0.07220,
+	SCALE * 0.0193, SCALE * 0.1192, SCALE * 0.9505
+};
+
+const double vips__XYZ2scRGB_matrix[9] = {
+	3.2406 / SCALE, -1.5372 / SCALE, -0.4986 / SCALE,
+	-0.9689 / SCALE, 1.8758 / SCALE, 0.0415 / SCALE,
+	0.0557 / SCALE, -0.2040 / SCALE, 1.0570 / SCALE
+};
+
 /* scRGB to XYZ. 
  */
 int
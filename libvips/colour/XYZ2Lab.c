@@ -19,6 +19,10 @@
  * 	- fix a race in the table build
  * 19/9/12
  * 	- redone as a class
+ * 14/10/18
+ * 	- replace the LUT with a Halley cube root, add a SIMD path
+ * 	- keep the LUT for in-range values when there's no SIMD path, it's
+ * 	  faster than the Halley cube root on plain C
  */
 
 /*
@@ -54,9 +58,11 @@
 #include <vips/intl.h>
 
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 
 #include <vips/vips.h>
+#include <vips/simd.h>
 #include <vips/internal.h>
 
 #include "pcolour.h"
@@ -90,6 +96,39 @@ typedef VipsColourTransformClass VipsXYZ2LabClass;
 
 G_DEFINE_TYPE( VipsXYZ2Lab, vips_XYZ2Lab, VIPS_TYPE_COLOUR_TRANSFORM );
 
+/* The Lab f() function, a cube root with a linear section near zero.
+ *
+ * We find the cube root with a guess from the bits of the float, then two
+ * Halley steps, which gets within a few ulp of a float cbrt(). The SIMD 
+ * kernels do exactly the same steps. Without SIMD, the table below is 
+ * quicker and we only use this for values outside it.
+ */
+static inline double
+vips_XYZ2Lab_f( double t )
+{
+	if( t < 0.008856 )
+		return( 7.787 * t + 16.0 / 116.0 );
+	else {
+		float tf = t;
+		float g;
+		guint32 i;
+		double y, y3;
+		int n;
+
+		memcpy( &i, &tf, sizeof( float ) );
+		i = (int) ((float) ((int) i) * (1.0f / 3.0f)) + 709921077;
+		memcpy( &g, &i, sizeof( float ) );
+
+		y = g;
+		for( n = 0; n < 2; n++ ) {
+			y3 = y * y * y;
+			y = y * (y3 + 2.0 * t) / (2.0 * y3 + t);
+		}
+
+		return( y );
+	}
+}
+
 static void *
 table_init( void *client )
 {
@@ -107,47 +146,71 @@ table_init( void *client )
 	return( NULL );
 }
 
+/* f() from the table, with the Halley cube root for anything outside it. 
+ * Values above the white point are common in HDR work.
+ */
+static inline double
+vips_XYZ2Lab_f_table( double n )
+{
+	if( n >= 0 && 
+		n < QUANT_ELEMENTS - 1 ) {
+		int i = n;
+		float f = n - i;
+
+		return( cbrt_table[i] + 
+			f * (cbrt_table[i + 1] - cbrt_table[i]) );
+	}
+	else
+		return( vips_XYZ2Lab_f( n / QUANT_ELEMENTS ) );
+}
+
 /* Process a buffer of data.
  */
 static void
 vips_XYZ2Lab_line( VipsColour *colour, VipsPel *out, VipsPel **in, int width )
 {
-	static GOnce once = G_ONCE_INIT;
-
 	VipsXYZ2Lab *XYZ2Lab = (VipsXYZ2Lab *) colour;
 	float *p = (float *) in[0];
 	float *q = (float *) out;
 
+	static GOnce once = G_ONCE_INIT;
+
+	VipsSimdLabFn simd;
+	double sX, sY, sZ;
 	int x;
 
-	VIPS_ONCE( &once, table_init, NULL );
+	if( (simd = (VipsSimdLabFn)
+		vips_simd_get( VIPS_SIMD_XYZ2LAB, VIPS_FORMAT_FLOAT )) ) {
+		double white[3];
 
-	for( x = 0; x < width; x++ ) {
-		float nX, nY, nZ;
-		int i;
-		float f;
-		float cbx, cby, cbz;
-
-		nX = QUANT_ELEMENTS * p[0] / XYZ2Lab->X0;
-		nY = QUANT_ELEMENTS * p[1] / XYZ2Lab->Y0;
-		nZ = QUANT_ELEMENTS * p[2] / XYZ2Lab->Z0;
-		p += 3;
+		white[0] = XYZ2Lab->X0;
+		white[1] = XYZ2Lab->Y0;
+		white[2] = XYZ2Lab->Z0;
+		simd( q, p, width, white );
 
-		i = VIPS_FCLIP( 0, nX, QUANT_ELEMENTS - 2 );
-		f = nX - i;
-		cbx = cbrt_table[i] + f * (cbrt_table[i + 1] - cbrt_table[i]);
+		return;
+	}
 
-		i = VIPS_FCLIP( 0, nY, QUANT_ELEMENTS - 2 );
-		f = nY - i;
-		cby = cbrt_table[i] + f * (cbrt_table[i + 1] - cbrt_table[i]);
+	/* No SIMD, so the table is quickest. The Halley cube root is only 
+	 * a win when it's vectorised.
+	 */
+	VIPS_ONCE( &once, table_init, NULL );
+
+	sX = QUANT_ELEMENTS / XYZ2Lab->X0;
+	sY = QUANT_ELEMENTS / XYZ2Lab->Y0;
+	sZ = QUANT_ELEMENTS / XYZ2Lab->Z0;
 
-		i = VIPS_FCLIP( 0, nZ, QUANT_ELEMENTS - 2 );
-		f = nZ - i;
-		cbz = cbrt_table[i] + f * (cbrt_table[i + 1] - cbrt_table[i]);
+	for( x = 0; x < width; x++ ) {
+		double fx, fy, fz;
+
+		fx = vips_XYZ2Lab_f_table( p[0] * sX );
+		fy = vips_XYZ2Lab_f_table( p[1] * sY );
+		fz = vips_XYZ2Lab_f_table( p[2] * sZ );
+		p += 3;
 
-		q[0] = 116.0 * cby - 16.0;
-		q[1] = 500.0 * (cbx - cby);
-		q[2] = 200.0 * (cby - cbz);
+		q[0] = 116.0 * fy - 16.0;
+		q[1] = 500.0 * (fx - fy);
+		q[2] = 200.0 * (fy - fz);
 		q += 3;
 	}
 }
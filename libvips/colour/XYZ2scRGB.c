@@ -6,6 +6,8 @@
  * 	- remove any ICC profile
  * 25/11/14
  * 	- oh argh, revert the above
+ * 14/10/18
+ * 	- use a native SIMD kernel, if there is one
  */
 
 /*
@@ -44,6 +46,7 @@
 #include <math.h>
 
 #include <vips/vips.h>
+#include <vips/simd.h>
 
 #include "pcolour.h"
 
@@ -74,8 +77,15 @@ vips_XYZ2scRGB_line( VipsColour *colour, VipsPel *out, VipsPel **in, int width )
 	float * restrict p = (float *) in[0];
 	float * restrict q = (float *) out;
 
+	VipsSimdMatrixFn simd;
 	int i;
 
+	if( (simd = (VipsSimdMatrixFn) 
+		vips_simd_get( VIPS_SIMD_MATRIX3, VIPS_FORMAT_FLOAT )) ) {
+		simd( q, p, width, vips__XYZ2scRGB_matrix );
+		return;
+	}
+
 	for( i = 0; i < width; i++ ) {
 		float X = p[0];
 		float Y = p[1];
@@ -1,4 +1,9 @@
 /* base class for all colour operations
+ *
+ * 14/10/18
+ * 	- add "identity", skip processing and just update the header
+ * 	- add @threshold to the difference operations
+ * 	- add process_rect and pass_extra
  */
 
 /*
@@ -239,14 +244,18 @@ vips_colour_gen( VipsRegion *or,
 
 	VIPS_GATE_START( "vips_colour_gen: work" ); 
 
-	for( y = 0; y < r->height; y++ ) {
-		for( i = 0; ir[i]; i++ )
-			p[i] = VIPS_REGION_ADDR( ir[i], r->left, r->top + y );
-		p[i] = NULL;
-		q = VIPS_REGION_ADDR( or, r->left, r->top + y );
-
-		class->process_line( colour, q, p, r->width );
-	}
+	if( class->process_rect )
+		class->process_rect( colour, or, ir, r );
+	else
+		for( y = 0; y < r->height; y++ ) {
+			for( i = 0; ir[i]; i++ )
+				p[i] = VIPS_REGION_ADDR( ir[i],
+					r->left, r->top + y );
+			p[i] = NULL;
+			q = VIPS_REGION_ADDR( or, r->left, r->top + y );
+
+			class->process_line( colour, q, p, r->width );
+		}
 
 	VIPS_GATE_STOP( "vips_colour_gen: work" ); 
 
@@ -306,14 +315,46 @@ vips_colour_build( VipsObject *object )
 	 */
 	g_assert( !colour->in[colour->n] ); 
 
+	/* Pixels pass through unaltered, we only need to set the new
+	 * header fields. 
+	 */
+	if( colour->identity ) {
+		g_assert( colour->n == 1 );
+		g_assert( colour->in[0]->BandFmt == colour->format );
+
+		if( vips_copy( colour->in[0], &out, 
+			"interpretation", colour->interpretation,
+			NULL ) )
+			return( -1 );
+
+		if( colour->profile_filename ) 
+			if( vips_colour_attach_profile( out, 
+				colour->profile_filename ) ) {
+				g_object_unref( out );
+				return( -1 );
+			}
+
+		g_object_set( colour, "out", out, NULL ); 
+
+		return( 0 );
+	}
+
 	in = colour->in;
 	extra_bands = (VipsImage **) 
 		vips_object_local_array( object, colour->n );
 
 	/* If there are more than @input_bands bands, we detach and reattach
-	 * after processing.
+	 * after processing, unless the subclass has said it will pass them
+	 * through itself.
 	 */
-	if( colour->input_bands > 0 ) {
+	if( colour->input_bands > 0 &&
+		colour->pass_extra ) {
+		for( i = 0; i < colour->n; i++ )
+			if( vips_check_bands_atleast( class->nickname,
+				in[i], colour->input_bands ) )
+				return( -1 );
+	}
+	else if( colour->input_bands > 0 ) {
 		VipsImage **new_in = (VipsImage **) 
 			vips_object_local_array( object, colour->n );
 
@@ -355,6 +396,9 @@ vips_colour_build( VipsObject *object )
 	out->Type = colour->interpretation;
 	out->BandFmt = colour->format;
 	out->Bands = colour->bands;
+	if( colour->input_bands > 0 &&
+		colour->pass_extra )
+		out->Bands += in[0]->Bands - colour->input_bands;
 
 	if( colour->profile_filename ) 
 		if( vips_colour_attach_profile( out, 
@@ -601,6 +645,42 @@ vips_colour_code_init( VipsColourCode *code )
 G_DEFINE_ABSTRACT_TYPE( VipsColourDifference, vips_colour_difference, 
 	VIPS_TYPE_COLOUR );
 
+/* Make masks this many pixels at a time.
+ */
+#define VIPS_DIFFERENCE_CHUNK (256)
+
+static void
+vips_colour_difference_line( VipsColour *colour,
+	VipsPel *out, VipsPel **in, int width )
+{
+	VipsColourDifference *difference = VIPS_COLOUR_DIFFERENCE( colour );
+	VipsColourDifferenceClass *class =
+		VIPS_COLOUR_DIFFERENCE_GET_CLASS( difference );
+
+	float buf[VIPS_DIFFERENCE_CHUNK];
+	VipsPel *p[3];
+	int x, i, n;
+
+	if( colour->format == VIPS_FORMAT_FLOAT ) {
+		class->difference_line( colour, out, in, width );
+		return;
+	}
+
+	/* Threshold mode: find the differences a chunk at a time, so we
+	 * never need a float buffer for the whole line.
+	 */
+	for( x = 0; x < width; x += VIPS_DIFFERENCE_CHUNK ) {
+		n = VIPS_MIN( VIPS_DIFFERENCE_CHUNK, width - x );
+		p[0] = in[0] + x * 3 * sizeof( float );
+		p[1] = in[1] + x * 3 * sizeof( float );
+		p[2] = NULL;
+		class->difference_line( colour, (VipsPel *) buf, p, n );
+
+		for( i = 0; i < n; i++ )
+			out[x + i] = buf[i] > difference->threshold ? 255 : 0;
+	}
+}
+
 static int
 vips_colour_difference_build( VipsObject *object )
 {
@@ -675,6 +755,9 @@ vips_colour_difference_build( VipsObject *object )
 	colour->in[1] = right;
 	colour->in[2] = NULL;
 
+	if( vips_object_argument_isset( object, "threshold" ) )
+		colour->format = VIPS_FORMAT_UCHAR;
+
 	if( VIPS_OBJECT_CLASS( vips_colour_difference_parent_class )->
 		build( object ) )
 		return( -1 );
@@ -687,6 +770,7 @@ vips_colour_difference_class_init( VipsColourDifferenceClass *class )
 {
 	GObjectClass *gobject_class = G_OBJECT_CLASS( class );
 	VipsObjectClass *vobject_class = VIPS_OBJECT_CLASS( class );
+	VipsColourClass *colour_class = VIPS_COLOUR_CLASS( class );
 
 	gobject_class->set_property = vips_object_set_property;
 	gobject_class->get_property = vips_object_get_property;
@@ -695,6 +779,8 @@ vips_colour_difference_class_init( VipsColourDifferenceClass *class )
 	vobject_class->description = _( "calculate color difference" );
 	vobject_class->build = vips_colour_difference_build;
 
+	colour_class->process_line = vips_colour_difference_line;
+
 	VIPS_ARG_IMAGE( class, "left", 1, 
 		_( "Left" ), 
 		_( "Left-hand input image" ),
@@ -707,6 +793,13 @@ vips_colour_difference_class_init( VipsColourDifferenceClass *class )
 		VIPS_ARGUMENT_REQUIRED_INPUT, 
 		G_STRUCT_OFFSET( VipsColourDifference, right ) );
 
+	VIPS_ARG_DOUBLE( class, "threshold", 110,
+		_( "Threshold" ),
+		_( "Make a mask of differences above this" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsColourDifference, threshold ),
+		0.0, 10000.0, 0.0 );
+
 }
 
 static void
@@ -757,6 +850,8 @@ vips_colour_operation_init( void )
 	extern GType vips_icc_export_get_type( void ); 
 	extern GType vips_icc_transform_get_type( void ); 
 #endif
+	extern GType vips_colour_lut_get_type( void ); 
+	extern GType vips_maplut3d_get_type( void ); 
 	extern GType vips_dE76_get_type( void ); 
 	extern GType vips_dE00_get_type( void ); 
 	extern GType vips_dECMC_get_type( void ); 
@@ -791,6 +886,8 @@ vips_colour_operation_init( void )
 	vips_icc_export_get_type();
 	vips_icc_transform_get_type();
 #endif
+	vips_colour_lut_get_type(); 
+	vips_maplut3d_get_type(); 
 	vips_dE76_get_type(); 
 	vips_dE00_get_type(); 
 	vips_dECMC_get_type(); 
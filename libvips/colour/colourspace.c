@@ -19,6 +19,12 @@
  * 17/4/15
  * 	- better conversion to greyscale, see 
  * 	  https://github.com/lovell/sharp/issues/193
+ * 14/10/18
+ * 	- fuse runs of float transforms into a single pass
+ * 	- add "tolerance", use a 3D LUT if we can
+ * 	- tolerance path now uses vips_colour_lut() and vips_maplut3d()
+ * 	- find routes from a table of steps and costs, add
+ * 	  vips_colourspace_route()
  */
 
 /*
@@ -188,14 +194,6 @@ vips_GREY162RGB16( VipsImage *in, VipsImage **out, ... )
  */
 #define MAX_STEPS (10)
 
-/* A route between two colour spaces.
- */
-typedef struct _VipsColourRoute {
-	VipsInterpretation from;
-	VipsInterpretation to;
-	VipsColourTransformFn route[MAX_STEPS + 1];
-} VipsColourRoute;
-
 /* Some defines to save typing. These are the colour spaces we support
  * conversions between.
  */
@@ -213,235 +211,402 @@ typedef struct _VipsColourRoute {
 #define YXY VIPS_INTERPRETATION_YXY
 #define BW VIPS_INTERPRETATION_B_W
 
-/* All the routes we know about.
+static VipsInterpretation vips_colour_spaces[] = {
+	XYZ, LAB, LABQ, LCH, CMC, LABS, scRGB, sRGB, HSV, RGB16, GREY16,
+	YXY, BW
+};
+
+#define N_SPACES (VIPS_NUMBER( vips_colour_spaces ))
+
+/* Added to the cost of steps which lose precision, for example to 8 bits,
+ * so routes only go through these spaces if they must.
+ */
+#define LOSSY (10)
+
+/* A single conversion between two colour spaces. Fusable steps are float
+ * three-band in and out transforms, and runs of them are done as a single
+ * operation: @nickname must then be the name of the operation.
+ *
+ * The cost is roughly the time per pixel, plus LOSSY.
  */
-static VipsColourRoute vips_colour_routes[] = {
-	{ XYZ, LAB, { vips_XYZ2Lab, NULL } },
-	{ XYZ, LABQ, { vips_XYZ2Lab, vips_Lab2LabQ, NULL } },
-	{ XYZ, LCH, { vips_XYZ2Lab, vips_Lab2LCh, NULL } },
-	{ XYZ, CMC, { vips_XYZ2Lab, vips_Lab2LCh, vips_LCh2CMC, NULL } },
-	{ XYZ, LABS, { vips_XYZ2Lab, vips_Lab2LabS, NULL } },
-	{ XYZ, scRGB, { vips_XYZ2scRGB, NULL } },
-	{ XYZ, sRGB, { vips_XYZ2scRGB, vips_scRGB2sRGB, NULL } },
-	{ XYZ, HSV, { vips_XYZ2scRGB, vips_scRGB2sRGB, vips_sRGB2HSV, NULL } },
-	{ XYZ, BW, { vips_XYZ2scRGB, vips_scRGB2BW, NULL } },
-	{ XYZ, RGB16, { vips_XYZ2scRGB, vips_scRGB2RGB16, NULL } },
-	{ XYZ, GREY16, { vips_XYZ2scRGB, vips_scRGB2BW16, NULL } },
-	{ XYZ, YXY, { vips_XYZ2Yxy, NULL } },
-
-	{ LAB, XYZ, { vips_Lab2XYZ, NULL } },
-	{ LAB, LABQ, { vips_Lab2LabQ, NULL } },
-	{ LAB, LCH, { vips_Lab2LCh, NULL } },
-	{ LAB, CMC, { vips_Lab2LCh, vips_LCh2CMC, NULL } },
-	{ LAB, LABS, { vips_Lab2LabS, NULL } },
-	{ LAB, scRGB, { vips_Lab2XYZ, vips_XYZ2scRGB, NULL } },
-	{ LAB, sRGB, { vips_Lab2XYZ, vips_XYZ2scRGB, vips_scRGB2sRGB, NULL } },
-	{ LAB, HSV, { vips_Lab2XYZ, vips_XYZ2scRGB, vips_scRGB2sRGB, vips_sRGB2HSV, NULL } },
-	{ LAB, BW, { vips_Lab2XYZ, vips_XYZ2scRGB, vips_scRGB2BW, NULL } },
-	{ LAB, RGB16, { vips_Lab2XYZ, vips_XYZ2scRGB, 
-		vips_scRGB2RGB16, NULL } },
-	{ LAB, GREY16, { vips_Lab2XYZ, vips_XYZ2scRGB, 
-		vips_scRGB2BW16, NULL } },
-	{ LAB, YXY, { vips_Lab2XYZ, vips_XYZ2Yxy, NULL } },
-
-	{ LABQ, XYZ, { vips_LabQ2Lab, vips_Lab2XYZ, NULL } },
-	{ LABQ, LAB, { vips_LabQ2Lab, NULL } },
-	{ LABQ, LCH, { vips_LabQ2Lab, vips_Lab2LCh, NULL } },
-	{ LABQ, CMC, { vips_LabQ2Lab, vips_Lab2LCh, vips_LCh2CMC, NULL } },
-	{ LABQ, LABS, { vips_LabQ2LabS, NULL } },
-	{ LABQ, scRGB, { vips_LabQ2Lab, vips_Lab2XYZ, vips_XYZ2scRGB } },
-	{ LABQ, sRGB, { vips_LabQ2sRGB, NULL } },
-	{ LABQ, HSV, { vips_LabQ2sRGB, vips_sRGB2HSV, NULL } },
-	{ LABQ, BW, { vips_LabQ2Lab, vips_Lab2XYZ, vips_XYZ2scRGB, 
-		vips_scRGB2BW, NULL } },
-	{ LABQ, RGB16, { vips_LabQ2Lab, vips_Lab2XYZ, vips_XYZ2scRGB, 
-		vips_scRGB2RGB16, NULL } },
-	{ LABQ, GREY16, { vips_LabQ2Lab, vips_Lab2XYZ, vips_XYZ2scRGB, 
-		vips_scRGB2BW16, NULL } },
-	{ LABQ, YXY, { vips_LabQ2Lab, vips_Lab2XYZ, vips_XYZ2Yxy, NULL } },
-
-	{ LCH, XYZ, { vips_LCh2Lab, vips_Lab2XYZ, NULL } },
-	{ LCH, LAB, { vips_LCh2Lab, NULL } },
-	{ LCH, LABQ, { vips_LCh2Lab, vips_Lab2LabQ, NULL } },
-	{ LCH, CMC, { vips_LCh2CMC, NULL } },
-	{ LCH, LABS, { vips_LCh2Lab, vips_Lab2LabS, NULL } },
-	{ LCH, scRGB, { vips_LCh2Lab, vips_Lab2XYZ, vips_XYZ2scRGB, NULL } },
-	{ LCH, sRGB, { vips_LCh2Lab, vips_Lab2XYZ, vips_XYZ2scRGB, 
-		vips_scRGB2sRGB, NULL } },
-	{ LCH, HSV, { vips_LCh2Lab, vips_Lab2XYZ, vips_XYZ2scRGB, 
-		vips_scRGB2sRGB, vips_sRGB2HSV, NULL } },
-	{ LCH, BW, { vips_LCh2Lab, vips_Lab2XYZ, vips_XYZ2scRGB, 
-		vips_scRGB2BW, NULL } },
-	{ LCH, RGB16, { vips_LCh2Lab, vips_Lab2XYZ, vips_XYZ2scRGB, 
-		vips_scRGB2RGB16, NULL } },
-	{ LCH, GREY16, { vips_LCh2Lab, vips_Lab2XYZ, vips_XYZ2scRGB, 
-		vips_scRGB2BW16, NULL } },
-	{ LCH, YXY, { vips_LCh2Lab, vips_Lab2XYZ, vips_XYZ2Yxy, NULL } },
-
-	{ CMC, XYZ, { vips_CMC2LCh, vips_LCh2Lab, vips_Lab2XYZ, NULL } },
-	{ CMC, LAB, { vips_CMC2LCh, vips_LCh2Lab, NULL } },
-	{ CMC, LABQ, { vips_CMC2LCh, vips_LCh2Lab, vips_Lab2LabQ, NULL } },
-	{ CMC, LCH, { vips_CMC2LCh, NULL } },
-	{ CMC, LABS, { vips_CMC2LCh, vips_LCh2Lab, vips_Lab2LabS, NULL } },
-	{ CMC, scRGB, { vips_CMC2LCh, vips_LCh2Lab, vips_Lab2XYZ, 
-		vips_XYZ2scRGB, NULL } },
-	{ CMC, sRGB, { vips_CMC2LCh, vips_LCh2Lab, vips_Lab2XYZ, 
-		vips_XYZ2scRGB, vips_scRGB2sRGB, NULL } },
-	{ CMC, HSV, { vips_CMC2LCh, vips_LCh2Lab, vips_Lab2XYZ, 
-		vips_XYZ2scRGB, vips_scRGB2sRGB, vips_sRGB2HSV, NULL } },
-	{ CMC, BW, { vips_CMC2LCh, vips_LCh2Lab, vips_Lab2XYZ, 
-		vips_XYZ2scRGB, vips_scRGB2BW, NULL } },
-	{ CMC, RGB16, { vips_CMC2LCh, vips_LCh2Lab, vips_Lab2XYZ, 
-		vips_XYZ2scRGB, vips_scRGB2RGB16, NULL } },
-	{ CMC, GREY16, { vips_CMC2LCh, vips_LCh2Lab, vips_Lab2XYZ, 
-		vips_XYZ2scRGB, vips_scRGB2BW16, NULL } },
-	{ CMC, YXY, { vips_CMC2LCh, vips_LCh2Lab, vips_Lab2XYZ, 
-		vips_XYZ2Yxy, NULL } },
-
-	{ LABS, XYZ, { vips_LabS2Lab, vips_Lab2XYZ, NULL } },
-	{ LABS, LAB, { vips_LabS2Lab, NULL } },
-	{ LABS, LABQ, { vips_LabS2LabQ, NULL } },
-	{ LABS, LCH, { vips_LabS2Lab, vips_Lab2LCh, NULL } },
-	{ LABS, CMC, { vips_LabS2Lab, vips_Lab2LCh, vips_LCh2CMC, NULL } },
-	{ LABS, scRGB, { vips_LabS2Lab, vips_Lab2XYZ, vips_XYZ2scRGB, NULL } },
-	{ LABS, sRGB, { vips_LabS2Lab, vips_Lab2XYZ, vips_XYZ2scRGB, 
-		vips_scRGB2sRGB, NULL } },
-	{ LABS, HSV, { vips_LabS2Lab, vips_Lab2XYZ, vips_XYZ2scRGB, 
-		vips_scRGB2sRGB, vips_sRGB2HSV, NULL } },
-	{ LABS, BW, { vips_LabS2Lab, vips_Lab2XYZ, vips_XYZ2scRGB, 
-		vips_scRGB2BW, NULL } },
-	{ LABS, RGB16, { vips_LabS2Lab, vips_Lab2XYZ, vips_XYZ2scRGB, 
-		vips_scRGB2RGB16, NULL } },
-	{ LABS, GREY16, { vips_LabS2Lab, vips_Lab2XYZ, vips_XYZ2scRGB, 
-		vips_scRGB2BW16, NULL } },
-	{ LABS, YXY, { vips_LabS2Lab, vips_Lab2XYZ, vips_XYZ2Yxy, NULL } },
-
-	{ scRGB, XYZ, { vips_scRGB2XYZ, NULL } },
-	{ scRGB, LAB, { vips_scRGB2XYZ, vips_XYZ2Lab, NULL } },
-	{ scRGB, LABQ, { vips_scRGB2XYZ, vips_XYZ2Lab, vips_Lab2LabQ, NULL } },
-	{ scRGB, LCH, { vips_scRGB2XYZ, vips_XYZ2Lab, vips_Lab2LCh, NULL } },
-	{ scRGB, CMC, { vips_scRGB2XYZ, vips_XYZ2Lab, 
-		vips_Lab2LCh, vips_LCh2CMC, NULL } },
-	{ scRGB, sRGB, { vips_scRGB2sRGB, NULL } },
-	{ scRGB, HSV, { vips_scRGB2sRGB, vips_sRGB2HSV, NULL } },
-	{ scRGB, BW, { vips_scRGB2BW, NULL } },
-	{ scRGB, LABS, { vips_scRGB2XYZ, vips_XYZ2Lab, vips_Lab2LabS, NULL } },
-	{ scRGB, RGB16, { vips_scRGB2RGB16, NULL } },
-	{ scRGB, GREY16, { vips_scRGB2BW16, NULL } },
-	{ scRGB, YXY, { vips_scRGB2XYZ, vips_XYZ2Yxy, NULL } },
-
-	{ sRGB, XYZ, { vips_sRGB2scRGB, vips_scRGB2XYZ, NULL } },
-	{ sRGB, LAB, { vips_sRGB2scRGB, vips_scRGB2XYZ, vips_XYZ2Lab, NULL } },
-	{ sRGB, LABQ, { vips_sRGB2scRGB, vips_scRGB2XYZ, vips_XYZ2Lab, 
-		vips_Lab2LabQ, NULL } },
-	{ sRGB, LCH, { vips_sRGB2scRGB, vips_scRGB2XYZ, vips_XYZ2Lab, 
-		vips_Lab2LCh, NULL } },
-	{ sRGB, CMC, { vips_sRGB2scRGB, vips_scRGB2XYZ, vips_XYZ2Lab, 
-		vips_Lab2LCh, vips_LCh2CMC, NULL } },
-	{ sRGB, scRGB, { vips_sRGB2scRGB, NULL } },
-	{ sRGB, HSV, { vips_sRGB2HSV, NULL } },
-	{ sRGB, BW, { vips_sRGB2scRGB, vips_scRGB2BW, NULL } },
-	{ sRGB, LABS, { vips_sRGB2scRGB, vips_scRGB2XYZ, vips_XYZ2Lab, 
-		vips_Lab2LabS, NULL } },
-	{ sRGB, RGB16, { vips_sRGB2RGB16, NULL } },
-	{ sRGB, GREY16, { vips_sRGB2scRGB, vips_scRGB2BW16, NULL } },
-	{ sRGB, YXY, { vips_sRGB2scRGB, vips_scRGB2XYZ, vips_XYZ2Yxy, NULL } },
-
-	{ HSV, XYZ, { vips_HSV2sRGB, vips_sRGB2scRGB, vips_scRGB2XYZ, NULL } },
-	{ HSV, LAB, { vips_HSV2sRGB, vips_sRGB2scRGB, vips_scRGB2XYZ, 
-		vips_XYZ2Lab, NULL } },
-	{ HSV, LABQ, { vips_HSV2sRGB, vips_sRGB2scRGB, vips_scRGB2XYZ, 
-		vips_XYZ2Lab, vips_Lab2LabQ, NULL } },
-	{ HSV, LCH, { vips_HSV2sRGB, vips_sRGB2scRGB, vips_scRGB2XYZ, 
-		vips_XYZ2Lab, vips_Lab2LCh, NULL } },
-	{ HSV, CMC, { vips_HSV2sRGB, vips_sRGB2scRGB, vips_scRGB2XYZ, 
-		vips_XYZ2Lab, vips_Lab2LCh, vips_LCh2CMC, NULL } },
-	{ HSV, scRGB, { vips_HSV2sRGB, vips_sRGB2scRGB, NULL } },
-	{ HSV, sRGB, { vips_HSV2sRGB, NULL } },
-	{ HSV, BW, { vips_HSV2sRGB, vips_sRGB2scRGB, vips_scRGB2BW, NULL } },
-	{ HSV, LABS, { vips_HSV2sRGB, vips_sRGB2scRGB, vips_scRGB2XYZ, 
-		vips_XYZ2Lab, vips_Lab2LabS, NULL } },
-	{ HSV, RGB16, { vips_HSV2sRGB, vips_sRGB2RGB16, NULL } },
-	{ HSV, GREY16, { vips_HSV2sRGB, vips_sRGB2scRGB, 
-		vips_scRGB2BW16, NULL } },
-	{ HSV, YXY, { vips_HSV2sRGB, vips_sRGB2scRGB, vips_scRGB2XYZ, 
-		vips_XYZ2Yxy, NULL } },
-
-	{ RGB16, XYZ, { vips_sRGB2scRGB, vips_scRGB2XYZ, NULL } },
-	{ RGB16, LAB, { vips_sRGB2scRGB, vips_scRGB2XYZ, vips_XYZ2Lab, NULL } },
-	{ RGB16, LABQ, { vips_sRGB2scRGB, vips_scRGB2XYZ, vips_XYZ2Lab, 
-		vips_Lab2LabQ, NULL } },
-	{ RGB16, LCH, { vips_sRGB2scRGB, vips_scRGB2XYZ, vips_XYZ2Lab, 
-		vips_Lab2LCh, NULL } },
-	{ RGB16, CMC, { vips_sRGB2scRGB, vips_scRGB2XYZ, vips_XYZ2Lab, 
-		vips_Lab2LCh, vips_LCh2CMC, NULL } },
-	{ RGB16, scRGB, { vips_sRGB2scRGB, NULL } },
-	{ RGB16, sRGB, { vips_RGB162sRGB, NULL } },
-	{ RGB16, HSV, { vips_RGB162sRGB, vips_sRGB2HSV, NULL } },
-	{ RGB16, BW, { vips_sRGB2scRGB, vips_scRGB2BW, NULL } },
-	{ RGB16, LABS, { vips_sRGB2scRGB, vips_scRGB2XYZ, vips_XYZ2Lab, 
-		vips_Lab2LabS, NULL } },
-	{ RGB16, GREY16, { vips_sRGB2scRGB, vips_scRGB2BW16, NULL } },
-	{ RGB16, YXY, { vips_sRGB2scRGB, vips_scRGB2XYZ, vips_XYZ2Yxy, NULL } },
-
-	{ GREY16, XYZ, { vips_GREY162RGB16, vips_sRGB2scRGB, 
-		vips_scRGB2XYZ, NULL } },
-	{ GREY16, LAB, { vips_GREY162RGB16, vips_sRGB2scRGB, vips_scRGB2XYZ, 
-		vips_XYZ2Lab, NULL } },
-	{ GREY16, LABQ, { vips_GREY162RGB16, vips_sRGB2scRGB, vips_scRGB2XYZ, 
-		vips_XYZ2Lab, vips_Lab2LabQ, NULL } },
-	{ GREY16, LCH, { vips_GREY162RGB16, vips_sRGB2scRGB, vips_scRGB2XYZ, 
-		vips_XYZ2Lab, vips_Lab2LCh, NULL } },
-	{ GREY16, CMC, { vips_GREY162RGB16, vips_sRGB2scRGB, vips_scRGB2XYZ, 
-		vips_XYZ2Lab, vips_Lab2LCh, vips_LCh2CMC, NULL } },
-	{ GREY16, scRGB, { vips_GREY162RGB16, vips_sRGB2scRGB, NULL } },
-	{ GREY16, sRGB, { vips_GREY162RGB16, vips_RGB162sRGB, NULL } },
-	{ GREY16, HSV, { vips_GREY162RGB16, vips_RGB162sRGB, vips_sRGB2HSV, NULL } },
-	{ GREY16, BW, { vips_GREY162RGB16, vips_sRGB2scRGB, 
-		vips_scRGB2BW, NULL } },
-	{ GREY16, LABS, { vips_GREY162RGB16, vips_sRGB2scRGB, vips_scRGB2XYZ, 
-		vips_XYZ2Lab, vips_Lab2LabS, NULL } },
-	{ GREY16, RGB16, { vips_GREY162RGB16, NULL } },
-	{ GREY16, YXY, { vips_GREY162RGB16, vips_sRGB2scRGB, vips_scRGB2XYZ, 
-		vips_XYZ2Yxy, NULL } },
-
-	{ BW, XYZ, { vips_BW2sRGB, vips_sRGB2scRGB, vips_scRGB2XYZ, NULL } },
-	{ BW, LAB, { vips_BW2sRGB, vips_sRGB2scRGB, vips_scRGB2XYZ, 
-		vips_XYZ2Lab, NULL } },
-	{ BW, LABQ, { vips_BW2sRGB, vips_sRGB2scRGB, vips_scRGB2XYZ, 
-		vips_XYZ2Lab, vips_Lab2LabQ, NULL } },
-	{ BW, LCH, { vips_BW2sRGB, vips_sRGB2scRGB, vips_scRGB2XYZ, 
-		vips_XYZ2Lab, vips_Lab2LCh, NULL } },
-	{ BW, CMC, { vips_BW2sRGB, vips_sRGB2scRGB, vips_scRGB2XYZ, 
-		vips_XYZ2Lab, vips_Lab2LCh, vips_LCh2CMC, NULL } },
-	{ BW, scRGB, { vips_BW2sRGB, vips_sRGB2scRGB, NULL } },
-	{ BW, sRGB, { vips_BW2sRGB, NULL } },
-	{ BW, HSV, { vips_BW2sRGB, vips_sRGB2HSV, NULL } },
-	{ BW, LABS, { vips_BW2sRGB, vips_sRGB2scRGB, vips_scRGB2XYZ, 
-		vips_XYZ2Lab, vips_Lab2LabS, NULL } },
-	{ BW, RGB16, { vips_BW2sRGB, vips_sRGB2RGB16, NULL } },
-	{ BW, GREY16, { vips_BW2sRGB, vips_sRGB2scRGB, 
-		vips_scRGB2BW16, NULL } },
-	{ BW, YXY, { vips_BW2sRGB, vips_sRGB2scRGB, vips_scRGB2XYZ, 
-		vips_XYZ2Yxy, NULL } },
-
-	{ YXY, XYZ, { vips_Yxy2XYZ, NULL } },
-	{ YXY, LAB, { vips_Yxy2XYZ, vips_XYZ2Lab, NULL } },
-	{ YXY, LABQ, { vips_Yxy2XYZ, vips_XYZ2Lab, vips_Lab2LabQ, NULL } },
-	{ YXY, LCH, { vips_Yxy2XYZ, vips_XYZ2Lab, vips_Lab2LCh, NULL } },
-	{ YXY, CMC, { vips_Yxy2XYZ, vips_XYZ2Lab, vips_Lab2LCh, 
-		vips_LCh2CMC, NULL } },
-	{ YXY, LABS, { vips_Yxy2XYZ, vips_XYZ2Lab, vips_Lab2LabS, NULL } },
-	{ YXY, scRGB, { vips_Yxy2XYZ, vips_XYZ2scRGB, NULL } },
-	{ YXY, sRGB, { vips_Yxy2XYZ, vips_XYZ2scRGB, vips_scRGB2sRGB, NULL } },
-	{ YXY, HSV, { vips_Yxy2XYZ, vips_XYZ2scRGB, vips_scRGB2sRGB, vips_sRGB2HSV, NULL } },
-	{ YXY, BW, { vips_Yxy2XYZ, vips_XYZ2scRGB, vips_scRGB2BW, NULL } },
-	{ YXY, RGB16, { vips_Yxy2XYZ, vips_XYZ2scRGB, 
-		vips_scRGB2RGB16, NULL } },
-	{ YXY, GREY16, { vips_Yxy2XYZ, vips_XYZ2scRGB, vips_scRGB2BW16, NULL } }
+typedef struct _VipsColourStep {
+	VipsInterpretation from;
+	VipsInterpretation to;
+	VipsColourTransformFn fn;
+	const char *nickname;
+	gboolean fusable;
+	int cost;
+} VipsColourStep;
+
+/* All the steps we know about. Routes are found from these, so to add a
+ * fast path, just add a step.
+ */
+static VipsColourStep vips_colour_steps[] = {
+	{ XYZ, LAB, vips_XYZ2Lab, "XYZ2Lab", TRUE, 3 },
+	{ XYZ, scRGB, vips_XYZ2scRGB, "XYZ2scRGB", TRUE, 1 },
+	{ XYZ, YXY, vips_XYZ2Yxy, "XYZ2Yxy", TRUE, 1 },
+
+	{ LAB, XYZ, vips_Lab2XYZ, "Lab2XYZ", TRUE, 2 },
+	{ LAB, LABQ, vips_Lab2LabQ, "Lab2LabQ", FALSE, 1 + LOSSY },
+	{ LAB, LCH, vips_Lab2LCh, "Lab2LCh", TRUE, 3 },
+	{ LAB, LABS, vips_Lab2LabS, "Lab2LabS", FALSE, 1 },
+
+	{ LABQ, LAB, vips_LabQ2Lab, "LabQ2Lab", FALSE, 1 },
+	{ LABQ, LABS, vips_LabQ2LabS, "LabQ2LabS", FALSE, 1 },
+	{ LABQ, sRGB, vips_LabQ2sRGB, "LabQ2sRGB", FALSE, 2 + LOSSY },
+
+	{ LCH, LAB, vips_LCh2Lab, "LCh2Lab", TRUE, 3 },
+	{ LCH, CMC, vips_LCh2CMC, "LCh2CMC", TRUE, 4 },
+
+	{ CMC, LCH, vips_CMC2LCh, "CMC2LCh", TRUE, 4 },
+
+	{ LABS, LAB, vips_LabS2Lab, "LabS2Lab", FALSE, 1 },
+	{ LABS, LABQ, vips_LabS2LabQ, "LabS2LabQ", FALSE, 1 + LOSSY },
+
+	{ scRGB, XYZ, vips_scRGB2XYZ, "scRGB2XYZ", TRUE, 1 },
+	{ scRGB, sRGB, vips_scRGB2sRGB, "scRGB2sRGB", FALSE, 2 + LOSSY },
+	{ scRGB, BW, vips_scRGB2BW, "scRGB2BW", FALSE, 2 + LOSSY },
+	{ scRGB, RGB16, vips_scRGB2RGB16, "scRGB2RGB16", FALSE, 2 },
+	{ scRGB, GREY16, vips_scRGB2BW16, "scRGB2BW16", FALSE, 2 },
+
+	{ sRGB, scRGB, vips_sRGB2scRGB, "sRGB2scRGB", FALSE, 1 },
+	{ sRGB, HSV, vips_sRGB2HSV, "sRGB2HSV", FALSE, 2 },
+	{ sRGB, RGB16, vips_sRGB2RGB16, "sRGB2RGB16", FALSE, 1 },
+
+	{ HSV, sRGB, vips_HSV2sRGB, "HSV2sRGB", FALSE, 2 },
+
+	{ RGB16, scRGB, vips_sRGB2scRGB, "sRGB2scRGB", FALSE, 1 },
+	{ RGB16, sRGB, vips_RGB162sRGB, "RGB162sRGB", FALSE, 1 + LOSSY },
+
+	{ GREY16, RGB16, vips_GREY162RGB16, "GREY162RGB16", FALSE, 1 },
 
+	{ BW, sRGB, vips_BW2sRGB, "BW2sRGB", FALSE, 1 },
+
+	{ YXY, XYZ, vips_Yxy2XYZ, "Yxy2XYZ", TRUE, 1 }
 };
 
+/* The cheapest route between two colour spaces.
+ */
+typedef struct _VipsColourRoute {
+	int n;
+	VipsColourStep *step[MAX_STEPS];
+	int cost;
+
+	/* The step nicknames, for vips_colourspace_route().
+	 */
+	char *name;
+} VipsColourRoute;
+
+/* Indexed by from and to position in vips_colour_spaces[].
+ */
+static VipsColourRoute vips_colour_routes[N_SPACES][N_SPACES];
+
+static int
+vips_colour_space_index( VipsInterpretation interpretation )
+{
+	int i;
+
+	for( i = 0; i < N_SPACES; i++ )
+		if( vips_colour_spaces[i] == interpretation )
+			return( i );
+
+	return( -1 );
+}
+
+/* Find the cheapest route from space @from to all the others with Dijkstra's
+ * algorithm. There are only a few spaces, so we don't need a heap.
+ */
+static void
+vips_colour_routes_find( int from )
+{
+	VipsColourRoute *route = vips_colour_routes[from];
+
+	gboolean done[N_SPACES];
+	int i, j;
+
+	for( i = 0; i < N_SPACES; i++ ) {
+		route[i].n = -1;
+		done[i] = FALSE;
+	}
+	route[from].n = 0;
+	route[from].cost = 0;
+
+	for(;;) {
+		int u;
+
+		u = -1;
+		for( i = 0; i < N_SPACES; i++ )
+			if( !done[i] &&
+				route[i].n >= 0 &&
+				(u == -1 ||
+				 route[i].cost < route[u].cost) )
+				u = i;
+		if( u == -1 )
+			break;
+		done[u] = TRUE;
+
+		for( i = 0; i < VIPS_NUMBER( vips_colour_steps ); i++ ) {
+			VipsColourStep *step = &vips_colour_steps[i];
+			int v = vips_colour_space_index( step->to );
+			int cost = route[u].cost + step->cost;
+
+			if( step->from != vips_colour_spaces[u] ||
+				route[u].n >= MAX_STEPS ||
+				(route[v].n >= 0 &&
+				 cost >= route[v].cost) )
+				continue;
+
+			for( j = 0; j < route[u].n; j++ )
+				route[v].step[j] = route[u].step[j];
+			route[v].step[j] = step;
+			route[v].n = route[u].n + 1;
+			route[v].cost = cost;
+		}
+	}
+
+	for( i = 0; i < N_SPACES; i++ )
+		if( route[i].n >= 0 ) {
+			char txt[256];
+			VipsBuf buf = VIPS_BUF_STATIC( txt );
+
+			for( j = 0; j < route[i].n; j++ ) {
+				if( j > 0 )
+					vips_buf_appends( &buf, " " );
+				vips_buf_appends( &buf,
+					route[i].step[j]->nickname );
+			}
+			route[i].name = g_strdup( vips_buf_all( &buf ) );
+		}
+}
+
+static void *
+vips_colour_routes_init( void *client )
+{
+	int i;
+
+	for( i = 0; i < N_SPACES; i++ )
+		vips_colour_routes_find( i );
+
+	return( NULL );
+}
+
+/* Look up the cheapest route, or NULL if there's no route.
+ */
+static VipsColourRoute *
+vips_colour_route_get( VipsInterpretation from, VipsInterpretation to )
+{
+	static GOnce once = G_ONCE_INIT;
+
+	int i, j;
+
+	VIPS_ONCE( &once, vips_colour_routes_init, NULL );
+
+	if( (i = vips_colour_space_index( from )) < 0 ||
+		(j = vips_colour_space_index( to )) < 0 ||
+		vips_colour_routes[i][j].n < 0 )
+		return( NULL );
+
+	return( &vips_colour_routes[i][j] );
+}
+
+/* Run a set of float transforms in one pass, a chunk of pixels at a time. 
+ * There are no intermediate images, and the chunk buffers stay in cache.
+ */
+typedef struct _VipsColourFused {
+	VipsColourTransform parent_instance;
+
+	/* The steps, with their default parameters. We never build these,
+	 * we just use them to call their process_line.
+	 */
+	int n;
+	VipsColour *step[MAX_STEPS];
+
+} VipsColourFused;
+
+typedef VipsColourTransformClass VipsColourFusedClass;
+
+G_DEFINE_TYPE( VipsColourFused, vips_colour_fused, 
+	VIPS_TYPE_COLOUR_TRANSFORM );
+
+/* Pixels per chunk.
+ */
+#define VIPS_COLOUR_FUSED_CHUNK (256)
+
+static void
+vips_colour_fused_dispose( GObject *gobject )
+{
+	VipsColourFused *fused = (VipsColourFused *) gobject;
+
+	int i;
+
+	for( i = 0; i < fused->n; i++ )
+		VIPS_UNREF( fused->step[i] );
+	fused->n = 0;
+
+	G_OBJECT_CLASS( vips_colour_fused_parent_class )->dispose( gobject );
+}
+
+static void
+vips_colour_fused_line( VipsColour *colour, 
+	VipsPel *out, VipsPel **in, int width )
+{
+	VipsColourFused *fused = (VipsColourFused *) colour;
+	size_t ps = 3 * sizeof( float );
+
+	float buf[2][VIPS_COLOUR_FUSED_CHUNK * 3];
+	int x, i;
+
+	for( x = 0; x < width; x += VIPS_COLOUR_FUSED_CHUNK ) {
+		int n = VIPS_MIN( VIPS_COLOUR_FUSED_CHUNK, width - x );
+
+		VipsPel *p[2];
+		VipsPel *q;
+
+		p[0] = in[0] + x * ps;
+		p[1] = NULL;
+		for( i = 0; i < fused->n; i++ ) {
+			VipsColour *step = fused->step[i];
+
+			if( i == fused->n - 1 )
+				q = out + x * ps;
+			else
+				q = (VipsPel *) buf[i & 1];
+
+			VIPS_COLOUR_GET_CLASS( step )->
+				process_line( step, q, p, n );
+
+			p[0] = q;
+		}
+	}
+}
+
+static int
+vips_colour_fused_build( VipsObject *object )
+{
+	VipsColour *colour = VIPS_COLOUR( object );
+	VipsColourFused *fused = (VipsColourFused *) object;
+
+	g_assert( fused->n > 0 );
+
+	colour->interpretation = fused->step[fused->n - 1]->interpretation;
+
+	if( VIPS_OBJECT_CLASS( vips_colour_fused_parent_class )->
+		build( object ) )
+		return( -1 );
+
+	return( 0 );
+}
+
+static void
+vips_colour_fused_class_init( VipsColourFusedClass *class )
+{
+	GObjectClass *gobject_class = G_OBJECT_CLASS( class );
+	VipsObjectClass *object_class = (VipsObjectClass *) class;
+	VipsColourClass *colour_class = VIPS_COLOUR_CLASS( class );
+
+	gobject_class->dispose = vips_colour_fused_dispose;
+	gobject_class->set_property = vips_object_set_property;
+	gobject_class->get_property = vips_object_get_property;
+
+	object_class->nickname = "colour_fused";
+	object_class->description = 
+		_( "run several colour transforms in one pass" );
+	object_class->build = vips_colour_fused_build;
+
+	colour_class->process_line = vips_colour_fused_line;
+}
+
+static void
+vips_colour_fused_init( VipsColourFused *fused )
+{
+}
+
+/* Run the transforms named in @nickname as a single operation.
+ */
+static int
+vips_colour_fuse( VipsImage *in, VipsImage **out, 
+	const char **nickname, int n )
+{
+	VipsColourFused *fused;
+	int i;
+
+	g_assert( n <= MAX_STEPS );
+
+	fused = g_object_new( vips_colour_fused_get_type(), NULL );
+
+	for( i = 0; i < n; i++ ) {
+		VipsOperation *step;
+
+		if( !(step = vips_operation_new( nickname[i] )) ) {
+			g_object_unref( fused );
+			return( -1 );
+		}
+		fused->step[i] = VIPS_COLOUR( step );
+		fused->n += 1;
+	}
+
+	g_object_set( fused, "in", in, NULL );
+	if( vips_object_build( VIPS_OBJECT( fused ) ) ) {
+		vips_object_unref_outputs( VIPS_OBJECT( fused ) );
+		g_object_unref( fused );
+		return( -1 );
+	}
+
+	g_object_get( fused, "out", out, NULL );
+	vips_object_unref_outputs( VIPS_OBJECT( fused ) );
+	g_object_unref( fused );
+
+	return( 0 );
+}
+
+/* Run a route, fusing runs of float transforms.
+ */
+static int
+vips_colourspace_run( VipsImage *in, VipsImage **out,
+	VipsColourRoute *route )
+{
+	VipsImage *scope = vips_image_new();
+	VipsImage **pipe = (VipsImage **) 
+		vips_object_local_array( VIPS_OBJECT( scope ), MAX_STEPS );
+
+	VipsImage *x;
+	int j, k, n;
+
+	x = in;
+	for( j = 0, k = 0; k < route->n; j++ ) {
+		const char *nickname[MAX_STEPS];
+
+		for( n = 0; k + n < route->n; n++ ) {
+			if( !route->step[k + n]->fusable )
+				break;
+			nickname[n] = route->step[k + n]->nickname;
+		}
+
+		if( n > 1 ) {
+			if( vips_colour_fuse( x, &pipe[j], nickname, n ) ) {
+				g_object_unref( scope );
+				return( -1 );
+			}
+			k += n;
+		}
+		else {
+			if( route->step[k]->fn( x, &pipe[j], NULL ) ) {
+				g_object_unref( scope );
+				return( -1 );
+			}
+			k += 1;
+		}
+
+		x = pipe[j];
+	}
+
+	*out = x;
+	g_object_ref( x );
+	g_object_unref( scope );
+
+	return( 0 );
+}
+
 /* Is an image in a supported colourspace.
  */
 
@@ -468,11 +633,37 @@ vips_colourspace_issupported( const VipsImage *image )
 	if( interpretation == VIPS_INTERPRETATION_RGB )
 		interpretation = VIPS_INTERPRETATION_sRGB;
 
-	for( i = 0; i < VIPS_NUMBER( vips_colour_routes ); i++ )
-		if( vips_colour_routes[i].from == interpretation )
-			return( TRUE );
+	return( vips_colour_route_get( interpretation,
+		VIPS_INTERPRETATION_sRGB ) != NULL );
+}
+
+/**
+ * vips_colourspace_route:
+ * @from: source colour space
+ * @to: destination colour space
+ *
+ * Find the route vips_colourspace() will take between two colour spaces.
+ * Routes are the cheapest path through the set of conversions vips knows
+ * about, where steps which lose precision, such as to 8-bit sRGB, are very
+ * expensive. They are found once, when first needed.
+ *
+ * For example, #VIPS_INTERPRETATION_sRGB to #VIPS_INTERPRETATION_LAB gives
+ * "sRGB2scRGB scRGB2XYZ XYZ2Lab".
+ *
+ * See also: vips_colourspace().
+ *
+ * Returns: the names of the steps, separated by spaces, or %NULL if there is
+ * no route. Don't free this.
+ */
+const char *
+vips_colourspace_route( VipsInterpretation from, VipsInterpretation to )
+{
+	VipsColourRoute *route;
+
+	if( !(route = vips_colour_route_get( from, to )) )
+		return( NULL );
 
-	return( FALSE );
+	return( route->name );
 }
 
 
@@ -483,24 +674,63 @@ typedef struct _VipsColourspace {
 	VipsImage *out;
 	VipsInterpretation space;
 	VipsInterpretation source_space;
+	double tolerance;
 } VipsColourspace;
 
 typedef VipsOperationClass VipsColourspaceClass;
 
 G_DEFINE_TYPE( VipsColourspace, vips_colourspace, VIPS_TYPE_OPERATION );
 
+/* With a tolerance, try to map three-band 8- and 16-bit images through a 3D
+ * LUT. We only use the LUT if it's accurate enough, and any failure just means
+ * we take the exact route instead.
+ */
+static gboolean
+vips_colourspace_lut( VipsColourspace *colourspace, VipsImage *in, 
+	VipsInterpretation interpretation, VipsImage **out )
+{
+	VipsImage *lut;
+	double error;
+	VipsBandFormat format;
+
+	if( colourspace->tolerance <= 0 ||
+		in->Coding != VIPS_CODING_NONE ||
+		in->Bands != 3 ||
+		(in->BandFmt != VIPS_FORMAT_UCHAR &&
+		 in->BandFmt != VIPS_FORMAT_USHORT) )
+		return( FALSE );
+
+	if( vips_colour_lut( &lut, 
+		"source", interpretation,
+		"destination", colourspace->space,
+		"depth", in->BandFmt == VIPS_FORMAT_UCHAR ? 8 : 16,
+		"error", &error,
+		"format", &format,
+		NULL ) ) {
+		vips_error_clear();
+		return( FALSE );
+	}
+
+	if( error > colourspace->tolerance ||
+		vips_maplut3d( in, out, lut, "format", format, NULL ) ) {
+		vips_error_clear();
+		g_object_unref( lut );
+		return( FALSE );
+	}
+	g_object_unref( lut );
+
+	return( TRUE );
+}
+
 static int
 vips_colourspace_build( VipsObject *object )
 {
 	VipsColourspace *colourspace = (VipsColourspace *) object; 
 
-	int i, j;
 	VipsImage *x;
 	VipsImage **t = (VipsImage **) 
-		vips_object_local_array( object, 1 );
-	VipsImage **pipe = (VipsImage **) 
-		vips_object_local_array( object, MAX_STEPS );
-
+		vips_object_local_array( object, 2 );
+	VipsColourRoute *route;
 	VipsInterpretation interpretation;
 
 	/* Verify that all input args have been set.
@@ -539,11 +769,8 @@ vips_colourspace_build( VipsObject *object )
 		return( vips_image_write( colourspace->in, colourspace->out ) );
 	}
 
-	for( i = 0; i < VIPS_NUMBER( vips_colour_routes ); i++ )
-		if( vips_colour_routes[i].from == interpretation &&
-			vips_colour_routes[i].to == colourspace->space )
-			break;
-	if( i == VIPS_NUMBER( vips_colour_routes ) ) {
+	if( !(route = vips_colour_route_get( interpretation,
+		colourspace->space )) ) {
 		vips_error( "vips_colourspace", 
 			_( "no known route from '%s' to '%s'" ),
 			vips_enum_nick( VIPS_TYPE_INTERPRETATION, 
@@ -553,11 +780,10 @@ vips_colourspace_build( VipsObject *object )
 		return( -1 );
 	}
 
-	for( j = 0; vips_colour_routes[i].route[j]; j++ ) {
-		if( vips_colour_routes[i].route[j]( x, &pipe[j], NULL ) ) 
-			return( -1 );
-		x = pipe[j];
-	}
+	if( !vips_colourspace_lut( colourspace, x, interpretation, &t[1] ) &&
+		vips_colourspace_run( x, &t[1], route ) )
+		return( -1 );
+	x = t[1];
 
 	g_object_set( colourspace, "out", vips_image_new(), NULL ); 
 	if( vips_image_write( x, colourspace->out ) )
@@ -608,6 +834,13 @@ vips_colourspace_class_init( VipsColourspaceClass *class )
 		G_STRUCT_OFFSET( VipsColourspace, source_space ),
 		VIPS_TYPE_INTERPRETATION, VIPS_INTERPRETATION_sRGB );
 
+	VIPS_ARG_DOUBLE( class, "tolerance", 7, 
+		_( "Tolerance" ), 
+		_( "Allow approximations with at most this error" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsColourspace, tolerance ),
+		0.0, 1000000.0, 0.0 );
+
 }
 
 static void
@@ -626,6 +859,7 @@ vips_colourspace_init( VipsColourspace *colourspace )
  * Optional arguments:
  *
  * * @source_space: input colour space
+ * * @tolerance: %gdouble, allow approximations with at most this error
  *
  * This operation looks at the interpretation field of @in (or uses
  * @source_space, if set) and runs
@@ -635,8 +869,20 @@ vips_colourspace_init( VipsColourspace *colourspace )
  * vips_colourspace() with @space set to #VIPS_INTERPRETATION_LAB will
  * convert with vips_Yxy2XYZ() and vips_XYZ2Lab().
  *
- * See also: vips_colourspace_issupported(),
- * vips_image_guess_interpretation().
+ * The route is the cheapest one through the conversions vips knows about,
+ * use vips_colourspace_route() to see it. Runs of float transforms, such as
+ * vips_XYZ2Lab() then vips_Lab2LCh(), are done in a single pass with no
+ * intermediate images.
+ *
+ * Set @tolerance to allow an approximation. For three-band 8- and 16-bit
+ * images, vips_colourspace() will make a 3D LUT for the conversion with 
+ * vips_colour_lut() and use vips_maplut3d() if the largest error it finds 
+ * is less than @tolerance, in the units of the output space. This is much 
+ * faster, but the error check is only a sample, so don't set @tolerance if 
+ * you need exact results. 
+ *
+ * See also: vips_colourspace_issupported(), vips_colourspace_route(),
+ * vips_image_guess_interpretation(), vips_colour_lut().
  *
  * Returns: 0 on success, -1 on error.
  */
@@ -8,6 +8,8 @@
  * 	- gtkdoc comment
  * 25/10/12
  * 	- redone as a class
+ * 14/10/18
+ * 	- add @threshold
  */
 
 /*
@@ -107,12 +109,13 @@ static void
 vips_dE76_class_init( VipsdE76Class *class )
 {
 	VipsObjectClass *object_class = (VipsObjectClass *) class;
-	VipsColourClass *colour_class = VIPS_COLOUR_CLASS( class );
+	VipsColourDifferenceClass *difference_class =
+		VIPS_COLOUR_DIFFERENCE_CLASS( class );
 
 	object_class->nickname = "dE76";
 	object_class->description = _( "calculate dE76" );
 
-	colour_class->process_line = vips__pythagoras_line;
+	difference_class->difference_line = vips__pythagoras_line;
 }
 
 static void
@@ -130,8 +133,15 @@ vips_dE76_init( VipsdE76 *dE76 )
  * @out: (out): output image
  * @...: %NULL-terminated list of optional named arguments
  *
+ * Optional arguments:
+ *
+ * * @threshold: %gdouble, make a mask of differences above this
+ *
  * Calculate dE 76.
  *
+ * Set @threshold to get a uchar mask instead of a float image, see
+ * vips_dE00().
+ *
  * Returns: 0 on success, -1 on error
  */
 int
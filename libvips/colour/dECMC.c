@@ -3,6 +3,8 @@
  * Modified:
  * 31/10/12
  * 	- from dE76.c
+ * 14/10/18
+ * 	- add @threshold
  */
 
 /*
@@ -55,12 +57,13 @@ static void
 vips_dECMC_class_init( VipsdECMCClass *class )
 {
 	VipsObjectClass *object_class = (VipsObjectClass *) class;
-	VipsColourClass *colour_class = VIPS_COLOUR_CLASS( class );
+	VipsColourDifferenceClass *difference_class =
+		VIPS_COLOUR_DIFFERENCE_CLASS( class );
 
 	object_class->nickname = "dECMC";
 	object_class->description = _( "calculate dECMC" );
 
-	colour_class->process_line = vips__pythagoras_line;
+	difference_class->difference_line = vips__pythagoras_line;
 }
 
 static void
@@ -78,6 +81,10 @@ vips_dECMC_init( VipsdECMC *dECMC )
  * @out: (out): output image
  * @...: %NULL-terminated list of optional named arguments
  *
+ * Optional arguments:
+ *
+ * * @threshold: %gdouble, make a mask of differences above this
+ *
  * Calculate dE CMC. The input images are transformed to CMC colour space and
  * the euclidean distance between corresponding pixels calculated. 
  *
@@ -85,6 +92,9 @@ vips_dECMC_init( VipsdECMC *dECMC )
  * transform the two source images to CMC yourself, scale the channels
  * appropriately, and call this function.
  *
+ * Set @threshold to get a uchar mask instead of a float image, see
+ * vips_dE00().
+ *
  * See also: vips_colourspace()
  *
  * Returns: 0 on success, -1 on error
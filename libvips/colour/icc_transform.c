@@ -38,6 +38,10 @@
  * 	- more input profile sanity tests
  * 8/3/18
  * 	- attach fallback profile on import if we used it
+ * 14/10/18
+ * 	- share transforms through a process-wide cache keyed on profile MD5
+ * 	- skip the transform if the profiles are equivalent
+ * 	- let lcms copy alpha and do whole regions per call in icc_transform
  */
 
 /*
@@ -75,6 +79,7 @@
 #ifdef HAVE_LCMS2
 
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 #include <assert.h>
 
@@ -126,6 +131,316 @@ vips_icc_present( void )
 	return( 1 );
 }
 
+/* Transforms are slow to make, so we keep a process-wide cache of them, keyed
+ * on the profile IDs, formats and intent. We make transforms with 
+ * cmsFLAGS_NOCACHE, so many threads can use one at once, and lcms does not
+ * need the profiles once a transform has been made.
+ */
+
+/* Keep at most this many transforms, unless more are in use.
+ */
+#define VIPS_ICC_CACHE_MAX (20)
+
+typedef struct _VipsIccCacheKey {
+	cmsUInt8Number in_id[16];
+	cmsUInt8Number out_id[16];
+	cmsUInt32Number in_icc_format;
+	cmsUInt32Number out_icc_format;
+	cmsUInt32Number intent;
+} VipsIccCacheKey;
+
+typedef struct _VipsIccCacheEntry {
+	VipsIccCacheKey key;
+	cmsHTRANSFORM trans;
+
+	/* The number of VipsIcc using this transform, and when it was last
+	 * used.
+	 */
+	int ref_count;
+	int time;
+} VipsIccCacheEntry;
+
+static GMutex *vips_icc_cache_lock = NULL;
+static GHashTable *vips_icc_cache_table = NULL;
+static int vips_icc_cache_time = 0;
+
+static guint
+vips_icc_cache_hash( gconstpointer key )
+{
+	const cmsUInt8Number *p = (const cmsUInt8Number *) key;
+
+	guint hash;
+	int i;
+
+	hash = 0;
+	for( i = 0; i < sizeof( VipsIccCacheKey ); i++ )
+		hash = (hash << 5) - hash + p[i];
+
+	return( hash );
+}
+
+static gboolean
+vips_icc_cache_equal( gconstpointer a, gconstpointer b )
+{
+	return( memcmp( a, b, sizeof( VipsIccCacheKey ) ) == 0 );
+}
+
+static void *
+vips_icc_cache_init( void *data )
+{
+	vips_icc_cache_lock = vips_g_mutex_new();
+	vips_icc_cache_table = g_hash_table_new( 
+		vips_icc_cache_hash, vips_icc_cache_equal );
+
+	return( NULL );
+}
+
+/* The MD5 of a profile. Use the ID in the header if there is one, otherwise
+ * hash the profile, ignoring the header fields which change each time a 
+ * profile is made, such as the creation date.
+ */
+static int
+vips_icc_profile_id( cmsHPROFILE profile, cmsUInt8Number *id )
+{
+	static const cmsUInt8Number zero[16] = { 0 };
+
+	cmsUInt32Number length;
+	cmsUInt8Number *data;
+	GChecksum *checksum;
+	gsize digest_length;
+
+	if( !profile )
+		return( -1 );
+
+	cmsGetHeaderProfileID( profile, id );
+	if( memcmp( id, zero, 16 ) != 0 )
+		return( 0 );
+
+	if( !cmsSaveProfileToMem( profile, NULL, &length ) ||
+		length < 128 )
+		return( -1 );
+	data = g_malloc( length );
+	if( !cmsSaveProfileToMem( profile, data, &length ) ) {
+		g_free( data );
+		return( -1 );
+	}
+
+	/* Zero the creation date, flags, rendering intent and ID. 
+	 */
+	memset( data + 24, 0, 12 );
+	memset( data + 44, 0, 4 );
+	memset( data + 64, 0, 4 );
+	memset( data + 84, 0, 16 );
+
+	checksum = g_checksum_new( G_CHECKSUM_MD5 );
+	g_checksum_update( checksum, data, length );
+	digest_length = 16;
+	g_checksum_get_digest( checksum, id, &digest_length );
+	g_checksum_free( checksum );
+	g_free( data );
+
+	return( 0 );
+}
+
+static gboolean
+vips_icc_xyz_equal( cmsHPROFILE a, cmsHPROFILE b, cmsTagSignature sig )
+{
+	cmsCIEXYZ *xyz_a = (cmsCIEXYZ *) cmsReadTag( a, sig );
+	cmsCIEXYZ *xyz_b = (cmsCIEXYZ *) cmsReadTag( b, sig );
+
+	/* Tags are s15Fixed16, so steps of about 1.5e-5.
+	 */
+	return( xyz_a &&
+		xyz_b &&
+		fabs( xyz_a->X - xyz_b->X ) < 1e-4 &&
+		fabs( xyz_a->Y - xyz_b->Y ) < 1e-4 &&
+		fabs( xyz_a->Z - xyz_b->Z ) < 1e-4 );
+}
+
+static gboolean
+vips_icc_curve_equal( cmsHPROFILE a, cmsHPROFILE b, cmsTagSignature sig )
+{
+	cmsToneCurve *curve_a = (cmsToneCurve *) cmsReadTag( a, sig );
+	cmsToneCurve *curve_b = (cmsToneCurve *) cmsReadTag( b, sig );
+
+	int i;
+
+	if( !curve_a ||
+		!curve_b )
+		return( FALSE );
+
+	/* Within half a 16-bit step everywhere.
+	 */
+	for( i = 0; i <= 256; i++ ) {
+		float v = i / 256.0;
+
+		if( fabs( cmsEvalToneCurveFloat( curve_a, v ) - 
+			cmsEvalToneCurveFloat( curve_b, v ) ) > 0.5 / 65535 )
+			return( FALSE );
+	}
+
+	return( TRUE );
+}
+
+/* Are two profiles the same matrix-shaper device profile? A transform between
+ * them would do nothing. Try the profile IDs first, then compare the
+ * colorants, white point and curves, since many files embed their own copy
+ * of sRGB with a different ID.
+ */
+static gboolean
+vips_icc_profile_equivalent( cmsHPROFILE a, cmsHPROFILE b )
+{
+	cmsUInt8Number id_a[16];
+	cmsUInt8Number id_b[16];
+
+	if( !a ||
+		!b ||
+		cmsGetColorSpace( a ) != cmsGetColorSpace( b ) ||
+		!cmsIsMatrixShaper( a ) ||
+		!cmsIsMatrixShaper( b ) )
+		return( FALSE );
+
+	if( !vips_icc_profile_id( a, id_a ) &&
+		!vips_icc_profile_id( b, id_b ) &&
+		memcmp( id_a, id_b, 16 ) == 0 )
+		return( TRUE );
+
+	if( !vips_icc_xyz_equal( a, b, cmsSigMediaWhitePointTag ) )
+		return( FALSE );
+
+	switch( cmsGetColorSpace( a ) ) {
+	case cmsSigRgbData:
+		return( vips_icc_xyz_equal( a, b, cmsSigRedColorantTag ) &&
+			vips_icc_xyz_equal( a, b, cmsSigGreenColorantTag ) &&
+			vips_icc_xyz_equal( a, b, cmsSigBlueColorantTag ) &&
+			vips_icc_curve_equal( a, b, cmsSigRedTRCTag ) &&
+			vips_icc_curve_equal( a, b, cmsSigGreenTRCTag ) &&
+			vips_icc_curve_equal( a, b, cmsSigBlueTRCTag ) );
+
+	case cmsSigGrayData:
+		return( vips_icc_curve_equal( a, b, cmsSigGrayTRCTag ) );
+
+	default:
+		return( FALSE );
+	}
+}
+
+/* Drop unused transforms, oldest first, until we are under the limit. Call 
+ * with the lock held.
+ */
+static void
+vips_icc_cache_trim( void )
+{
+	while( g_hash_table_size( vips_icc_cache_table ) > 
+		VIPS_ICC_CACHE_MAX ) {
+		GHashTableIter iter;
+		VipsIccCacheEntry *entry;
+		VipsIccCacheEntry *oldest;
+
+		oldest = NULL;
+		g_hash_table_iter_init( &iter, vips_icc_cache_table );
+		while( g_hash_table_iter_next( &iter, 
+			NULL, (gpointer *) &entry ) )
+			if( entry->ref_count == 0 &&
+				(!oldest ||
+				 entry->time < oldest->time) )
+				oldest = entry;
+		if( !oldest )
+			break;
+
+		g_hash_table_remove( vips_icc_cache_table, &oldest->key );
+		cmsDeleteTransform( oldest->trans );
+		g_free( oldest );
+	}
+}
+
+/* Find or make a transform. Release it with vips_icc_cache_release().
+ */
+static VipsIccCacheEntry *
+vips_icc_cache_get( cmsHPROFILE in_profile, cmsUInt32Number in_icc_format,
+	cmsHPROFILE out_profile, cmsUInt32Number out_icc_format,
+	VipsIntent intent )
+{
+	static GOnce once = G_ONCE_INIT;
+
+	VipsIccCacheKey key;
+	VipsIccCacheEntry *entry;
+	cmsUInt32Number flags;
+	cmsHTRANSFORM trans;
+
+	VIPS_ONCE( &once, vips_icc_cache_init, NULL );
+
+	memset( &key, 0, sizeof( key ) );
+	if( vips_icc_profile_id( in_profile, key.in_id ) ||
+		vips_icc_profile_id( out_profile, key.out_id ) ) {
+		vips_error( "VipsIcc", "%s", _( "unable to hash profile" ) );
+		return( NULL );
+	}
+	key.in_icc_format = in_icc_format;
+	key.out_icc_format = out_icc_format;
+	key.intent = intent;
+
+	g_mutex_lock( vips_icc_cache_lock );
+	if( (entry = g_hash_table_lookup( vips_icc_cache_table, &key )) ) {
+		entry->ref_count += 1;
+		entry->time = vips_icc_cache_time++;
+	}
+	g_mutex_unlock( vips_icc_cache_lock );
+
+	if( entry )
+		return( entry );
+
+	/* Extra channels in the formats are alpha for lcms to copy, see
+	 * vips_icc_build().
+	 */
+	flags = cmsFLAGS_NOCACHE;
+#ifdef cmsFLAGS_COPY_ALPHA
+	if( T_EXTRA( in_icc_format ) )
+		flags |= cmsFLAGS_COPY_ALPHA;
+#endif /*cmsFLAGS_COPY_ALPHA*/
+
+	/* Make the transform outside the lock, it can take a while.
+	 */
+	if( !(trans = cmsCreateTransform( 
+		in_profile, in_icc_format,
+		out_profile, out_icc_format, 
+		intent, flags )) )
+		return( NULL );
+
+	g_mutex_lock( vips_icc_cache_lock );
+
+	/* Another thread might have made this transform while we were busy.
+	 */
+	if( (entry = g_hash_table_lookup( vips_icc_cache_table, &key )) ) 
+		cmsDeleteTransform( trans );
+	else {
+		entry = g_new( VipsIccCacheEntry, 1 );
+		entry->key = key;
+		entry->trans = trans;
+		entry->ref_count = 0;
+		g_hash_table_insert( vips_icc_cache_table, 
+			&entry->key, entry );
+	}
+
+	entry->ref_count += 1;
+	entry->time = vips_icc_cache_time++;
+	vips_icc_cache_trim();
+
+	g_mutex_unlock( vips_icc_cache_lock );
+
+	return( entry );
+}
+
+static void
+vips_icc_cache_release( VipsIccCacheEntry *entry )
+{
+	g_mutex_lock( vips_icc_cache_lock );
+	g_assert( entry->ref_count > 0 );
+	entry->ref_count -= 1;
+	vips_icc_cache_trim();
+	g_mutex_unlock( vips_icc_cache_lock );
+}
+
 #define VIPS_TYPE_ICC (vips_icc_get_type())
 #define VIPS_ICC( obj ) \
 	(G_TYPE_CHECK_INSTANCE_CAST( (obj), \
@@ -152,6 +467,10 @@ typedef struct _VipsIcc {
 	cmsHPROFILE out_profile;
 	cmsUInt32Number in_icc_format;
 	cmsUInt32Number out_icc_format;
+
+	/* Our transform, shared with other VipsIcc via the cache.
+	 */
+	VipsIccCacheEntry *entry;
 	cmsHTRANSFORM trans;
 
 } VipsIcc;
@@ -174,7 +493,8 @@ vips_icc_dispose( GObject *gobject )
 {
 	VipsIcc *icc = (VipsIcc *) gobject;
 
-	VIPS_FREEF( cmsDeleteTransform, icc->trans );
+	VIPS_FREEF( vips_icc_cache_release, icc->entry );
+	icc->trans = NULL;
 	VIPS_FREEF( cmsCloseProfile, icc->in_profile );
 	VIPS_FREEF( cmsCloseProfile, icc->out_profile );
 
@@ -333,14 +653,39 @@ vips_icc_build( VipsObject *object )
 		return( -1 );
 	}
 
-	/* Use cmsFLAGS_NOCACHE to disable the 1-pixel cache and make
-	 * calling cmsDoTransform() from multiple threads safe.
+#ifdef cmsFLAGS_COPY_ALPHA
+	/* A device to device transform that keeps the pixel format can have
+	 * lcms copy any alpha straight through, saving a detach, a cast and
+	 * a bandjoin. lcms allows up to 7 extra channels.
 	 */
-	if( !(icc->trans = cmsCreateTransform( 
-		icc->in_profile, icc->in_icc_format,
-		icc->out_profile, icc->out_icc_format, 
-		icc->intent, cmsFLAGS_NOCACHE )) )
-		return( -1 );
+	if( code->in &&
+		code->in->Coding == VIPS_CODING_NONE &&
+		icc->in_profile &&
+		icc->out_profile &&
+		!is_pcs( icc->in_profile ) &&
+		!is_pcs( icc->out_profile ) &&
+		code->in->BandFmt == colour->format &&
+		code->in->Bands > colour->input_bands &&
+		code->in->Bands - colour->input_bands <= 7 ) {
+		int n_extra = code->in->Bands - colour->input_bands;
+
+		icc->in_icc_format |= EXTRA_SH( n_extra );
+		icc->out_icc_format |= EXTRA_SH( n_extra );
+		colour->pass_extra = TRUE;
+	}
+#endif /*cmsFLAGS_COPY_ALPHA*/
+
+	/* Transforms are shared via the cache, see vips_icc_cache_get().
+	 * We don't need one if the transform does nothing.
+	 */
+	if( !colour->identity ) {
+		if( !(icc->entry = vips_icc_cache_get( 
+			icc->in_profile, icc->in_icc_format,
+			icc->out_profile, icc->out_icc_format, 
+			icc->intent )) )
+			return( -1 );
+		icc->trans = icc->entry->trans;
+	}
 
 	if( VIPS_OBJECT_CLASS( vips_icc_parent_class )->
 		build( object ) )
@@ -1083,6 +1428,19 @@ vips_icc_transform_build( VipsObject *object )
 	vips_check_intent( class->nickname, 
 		icc->out_profile, icc->intent, LCMS_USED_AS_OUTPUT );
 
+	/* If the input is already in the output format and the profiles are 
+	 * equivalent, there's nothing to do except attach the new profile.
+	 */
+	if( code->in->Coding == VIPS_CODING_NONE &&
+		code->in->BandFmt == (icc->depth == 8 ?
+			VIPS_FORMAT_UCHAR : VIPS_FORMAT_USHORT) &&
+		vips_icc_profile_equivalent( icc->in_profile, 
+			icc->out_profile ) ) {
+		g_info( "%s: profiles are equivalent, skipping transform",
+			class->nickname );
+		colour->identity = TRUE;
+	}
+
 	if( VIPS_OBJECT_CLASS( vips_icc_transform_parent_class )->
 		build( object ) )
 		return( -1 );
@@ -1101,6 +1459,24 @@ vips_icc_transform_line( VipsColour *colour,
 	cmsDoTransform( icc->trans, in[0], out, width );
 }
 
+#if LCMS_VERSION >= 2080
+/* Process a whole region in one call, lcms steps between the lines for us.
+ */
+static void
+vips_icc_transform_rect( VipsColour *colour,
+	VipsRegion *out, VipsRegion **in, VipsRect *r )
+{
+	VipsIcc *icc = (VipsIcc *) colour;
+
+	cmsDoTransformLineStride( icc->trans,
+		VIPS_REGION_ADDR( in[0], r->left, r->top ),
+		VIPS_REGION_ADDR( out, r->left, r->top ),
+		r->width, r->height,
+		VIPS_REGION_LSKIP( in[0] ), VIPS_REGION_LSKIP( out ),
+		0, 0 );
+}
+#endif /*LCMS_VERSION >= 2080*/
+
 static void
 vips_icc_transform_class_init( VipsIccImportClass *class )
 {
@@ -1117,6 +1493,9 @@ vips_icc_transform_class_init( VipsIccImportClass *class )
 	object_class->build = vips_icc_transform_build;
 
 	colour_class->process_line = vips_icc_transform_line;
+#if LCMS_VERSION >= 2080
+	colour_class->process_rect = vips_icc_transform_rect;
+#endif /*LCMS_VERSION >= 2080*/
 
 	VIPS_ARG_STRING( class, "output_profile", 110, 
 		_( "Output profile" ),
@@ -1395,6 +1774,10 @@ vips_icc_export( VipsImage *in, VipsImage **out, ... )
  * The output image has the output profile attached to the #VIPS_META_ICC_NAME
  * field. 
  *
+ * If the input and output profiles are the same matrix-shaper profile, for
+ * example two copies of sRGB, and @in is already at @depth, the pixels are
+ * passed through unaltered and only the attached profile changes. 
+ *
  * Use vips_icc_import() and vips_icc_export() to do either the first or 
  * second half of this operation in isolation.
  *
@@ -0,0 +1,724 @@
+/* build and apply 3D colour LUTs
+ *
+ * 14/10/18
+ * 	- first version
+ */
+
+/*
+
+    This file is part of VIPS.
+
+    VIPS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA
+
+ */
+
+/*
+
+    These files are distributed with VIPS - http://www.vips.ecs.soton.ac.uk
+
+ */
+
+/*
+#define DEBUG
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /*HAVE_CONFIG_H*/
+#include <vips/intl.h>
+
+#include <stdio.h>
+#include <limits.h>
+#include <math.h>
+
+#include <vips/vips.h>
+#include <vips/debug.h>
+
+#include "pcolour.h"
+
+/* The input value of grid point @i of @size points on an axis from 0 to @max.
+ * We need integer knots, since we sample the route at exact input values.
+ */
+static int
+vips_lut3d_knot( int i, int size, int max )
+{
+	return( VIPS_RINT( (double) i * max / (size - 1) ) );
+}
+
+typedef struct _VipsColourLut {
+	VipsOperation parent_instance;
+
+	VipsImage *out;
+	VipsInterpretation source;
+	VipsInterpretation destination;
+	int depth;
+	int size;
+	char *input_profile;
+	char *output_profile;
+	VipsIntent intent;
+
+	double error;
+	VipsBandFormat format;
+
+} VipsColourLut;
+
+typedef VipsOperationClass VipsColourLutClass;
+
+G_DEFINE_TYPE( VipsColourLut, vips_colour_lut, VIPS_TYPE_OPERATION );
+
+/* Make an image of input values. With @centre, make the centre of each cell,
+ * rather than the grid points.
+ */
+static VipsImage *
+vips_colour_lut_grid( VipsColourLut *lut, int max, gboolean centre )
+{
+	int n = centre ? lut->size - 1 : lut->size;
+	VipsBandFormat format = lut->depth == 8 ?
+		VIPS_FORMAT_UCHAR : VIPS_FORMAT_USHORT;
+	size_t sizeof_pel = 3 * vips_format_sizeof( format );
+
+	int *value;
+	VipsPel *buf;
+	VipsImage *grid;
+	int r, g, b, i;
+
+	value = g_new( int, n );
+	for( i = 0; i < n; i++ )
+		if( centre )
+			value[i] = (vips_lut3d_knot( i, lut->size, max ) +
+				vips_lut3d_knot( i + 1, lut->size, max )) / 2;
+		else
+			value[i] = vips_lut3d_knot( i, lut->size, max );
+
+	/* x is the b axis, y is r * n + g.
+	 */
+	buf = g_malloc( sizeof_pel * n * n * n );
+	for( i = 0, r = 0; r < n; r++ )
+		for( g = 0; g < n; g++ )
+			for( b = 0; b < n; b++, i += 3 )
+				if( format == VIPS_FORMAT_UCHAR ) {
+					buf[i] = value[r];
+					buf[i + 1] = value[g];
+					buf[i + 2] = value[b];
+				}
+				else {
+					unsigned short *q =
+						(unsigned short *) buf;
+
+					q[i] = value[r];
+					q[i + 1] = value[g];
+					q[i + 2] = value[b];
+				}
+
+	grid = vips_image_new_from_memory_copy( buf, sizeof_pel * n * n * n,
+		n, n * n, 3, format );
+	if( grid )
+		grid->Type = lut->source;
+
+	g_free( buf );
+	g_free( value );
+
+	return( grid );
+}
+
+/* Run the exact transform.
+ */
+static int
+vips_colour_lut_route( VipsColourLut *lut, VipsImage *in, VipsImage **out )
+{
+	if( lut->output_profile ) {
+		if( lut->input_profile )
+			return( vips_icc_transform( in, out,
+				lut->output_profile,
+				"input_profile", lut->input_profile,
+				"intent", lut->intent,
+				"depth", lut->depth,
+				NULL ) );
+		else
+			return( vips_icc_transform( in, out,
+				lut->output_profile,
+				"intent", lut->intent,
+				"depth", lut->depth,
+				NULL ) );
+	}
+	else
+		return( vips_colourspace( in, out, lut->destination,
+			"source_space", lut->source,
+			NULL ) );
+}
+
+static int
+vips_colour_lut_build( VipsObject *object )
+{
+	VipsObjectClass *class = VIPS_OBJECT_GET_CLASS( object );
+	VipsColourLut *lut = (VipsColourLut *) object;
+	VipsImage **t = (VipsImage **) vips_object_local_array( object, 9 );
+
+	int max;
+	double error;
+
+	if( VIPS_OBJECT_CLASS( vips_colour_lut_parent_class )->build( object ) )
+		return( -1 );
+
+	if( lut->depth != 8 &&
+		lut->depth != 16 ) {
+		vips_error( class->nickname,
+			"%s", _( "depth must be 8 or 16" ) );
+		return( -1 );
+	}
+	max = lut->depth == 8 ? UCHAR_MAX : USHRT_MAX;
+	if( lut->size - 1 > max ) {
+		vips_error( class->nickname,
+			"%s", _( "too many grid points for depth" ) );
+		return( -1 );
+	}
+
+	/* Sample the route on the grid points.
+	 */
+	if( !(t[0] = vips_colour_lut_grid( lut, max, FALSE )) ||
+		vips_colour_lut_route( lut, t[0], &t[1] ) )
+		return( -1 );
+	if( t[1]->Coding != VIPS_CODING_NONE ||
+		vips_band_format_iscomplex( t[1]->BandFmt ) ) {
+		vips_error( class->nickname,
+			"%s", _( "transform must make uncoded real pixels" ) );
+		return( -1 );
+	}
+	g_object_set( object, "format", t[1]->BandFmt, NULL );
+
+	g_object_set( object, "out", vips_image_new_memory(), NULL );
+	if( vips_cast( t[1], &t[2], VIPS_FORMAT_FLOAT, NULL ) ||
+		vips_image_write( t[2], lut->out ) )
+		return( -1 );
+
+	/* Find the error at the centre of each cell, the furthest point from
+	 * the grid. Make the approximation in the format of the exact
+	 * transform, so we include any rounding as well.
+	 */
+	if( !(t[3] = vips_colour_lut_grid( lut, max, TRUE )) ||
+		vips_colour_lut_route( lut, t[3], &t[4] ) ||
+		vips_maplut3d( t[3], &t[5], lut->out,
+			"format", lut->format,
+			NULL ) ||
+		vips_cast( t[4], &t[6], VIPS_FORMAT_FLOAT, NULL ) ||
+		vips_subtract( t[6], t[5], &t[7], NULL ) ||
+		vips_abs( t[7], &t[8], NULL ) ||
+		vips_max( t[8], &error, NULL ) )
+		return( -1 );
+	g_object_set( object, "error", error, NULL );
+
+#ifdef DEBUG
+	printf( "vips_colour_lut_build: %d points, error = %g\n",
+		lut->size, lut->error );
+#endif /*DEBUG*/
+
+	return( 0 );
+}
+
+static void
+vips_colour_lut_class_init( VipsColourLutClass *class )
+{
+	GObjectClass *gobject_class = G_OBJECT_CLASS( class );
+	VipsObjectClass *object_class = (VipsObjectClass *) class;
+
+	gobject_class->set_property = vips_object_set_property;
+	gobject_class->get_property = vips_object_get_property;
+
+	object_class->nickname = "colour_lut";
+	object_class->description = _( "make a 3D LUT for a colour transform" );
+	object_class->build = vips_colour_lut_build;
+
+	VIPS_ARG_IMAGE( class, "out", 1,
+		_( "Output" ),
+		_( "Output LUT" ),
+		VIPS_ARGUMENT_REQUIRED_OUTPUT,
+		G_STRUCT_OFFSET( VipsColourLut, out ) );
+
+	VIPS_ARG_ENUM( class, "source", 3,
+		_( "Source" ),
+		_( "Source color space" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsColourLut, source ),
+		VIPS_TYPE_INTERPRETATION, VIPS_INTERPRETATION_sRGB );
+
+	VIPS_ARG_ENUM( class, "destination", 4,
+		_( "Destination" ),
+		_( "Destination color space" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsColourLut, destination ),
+		VIPS_TYPE_INTERPRETATION, VIPS_INTERPRETATION_LAB );
+
+	VIPS_ARG_INT( class, "depth", 5,
+		_( "Depth" ),
+		_( "Input bits per sample, 8 or 16" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsColourLut, depth ),
+		8, 16, 8 );
+
+	VIPS_ARG_INT( class, "size", 6,
+		_( "Size" ),
+		_( "Grid points along each axis" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsColourLut, size ),
+		2, 129, 33 );
+
+	VIPS_ARG_STRING( class, "input_profile", 7,
+		_( "Input profile" ),
+		_( "Filename to load input profile from" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsColourLut, input_profile ),
+		NULL );
+
+	VIPS_ARG_STRING( class, "output_profile", 8,
+		_( "Output profile" ),
+		_( "Filename to load output profile from" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsColourLut, output_profile ),
+		NULL );
+
+	VIPS_ARG_ENUM( class, "intent", 9,
+		_( "Intent" ),
+		_( "Rendering intent" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsColourLut, intent ),
+		VIPS_TYPE_INTENT, VIPS_INTENT_RELATIVE );
+
+	VIPS_ARG_DOUBLE( class, "error", 10,
+		_( "Error" ),
+		_( "Largest error at the cell centres" ),
+		VIPS_ARGUMENT_OPTIONAL_OUTPUT,
+		G_STRUCT_OFFSET( VipsColourLut, error ),
+		0.0, INFINITY, 0.0 );
+
+	VIPS_ARG_ENUM( class, "format", 11,
+		_( "Format" ),
+		_( "Format of the exact transform" ),
+		VIPS_ARGUMENT_OPTIONAL_OUTPUT,
+		G_STRUCT_OFFSET( VipsColourLut, format ),
+		VIPS_TYPE_BAND_FORMAT, VIPS_FORMAT_FLOAT );
+}
+
+static void
+vips_colour_lut_init( VipsColourLut *lut )
+{
+	lut->source = VIPS_INTERPRETATION_sRGB;
+	lut->destination = VIPS_INTERPRETATION_LAB;
+	lut->depth = 8;
+	lut->size = 33;
+	lut->intent = VIPS_INTENT_RELATIVE;
+	lut->format = VIPS_FORMAT_FLOAT;
+}
+
+/**
+ * vips_colour_lut:
+ * @out: (out): output LUT
+ * @...: %NULL-terminated list of optional named arguments
+ *
+ * Optional arguments:
+ *
+ * * @source: #VipsInterpretation, source colour space
+ * * @destination: #VipsInterpretation, destination colour space
+ * * @depth: %gint, input bits per sample, 8 or 16
+ * * @size: %gint, grid points along each axis
+ * * @input_profile: input ICC profile filename
+ * * @output_profile: output ICC profile filename
+ * * @intent: #VipsIntent, rendering intent
+ * * @error: output %gdouble, largest error at the cell centres
+ * * @format: output #VipsBandFormat, format of the exact transform
+ *
+ * Sample a colour transform on a regular grid and make a 3D LUT for
+ * vips_maplut3d(). The transform is vips_colourspace() from @source to
+ * @destination, or if @output_profile is set, vips_icc_transform() with
+ * @input_profile and @intent.
+ *
+ * @depth sets the input format the LUT is for, #VIPS_FORMAT_UCHAR or
+ * #VIPS_FORMAT_USHORT. @size sets the number of grid points on each axis,
+ * it defaults to 33.
+ *
+ * @out is a float image @size pixels across and @size * @size pixels down.
+ * Pixel (b, r * @size + g) holds the transform of the grid point (r, g, b).
+ * It has as many bands as the transform makes.
+ *
+ * The LUT is checked at the centre of every cell, the points furthest from
+ * the grid, and the largest difference from the exact transform is set in
+ * @error. Use @format with vips_maplut3d() to make the same format as the
+ * exact transform.
+ *
+ * Since this is an operation, LUTs are shared through the operation cache:
+ * asking for the same LUT twice will only build it once.
+ *
+ * See also: vips_maplut3d(), vips_colourspace().
+ *
+ * Returns: 0 on success, -1 on error.
+ */
+int
+vips_colour_lut( VipsImage **out, ... )
+{
+	va_list ap;
+	int result;
+
+	va_start( ap, out );
+	result = vips_call_split( "colour_lut", ap, out );
+	va_end( ap );
+
+	return( result );
+}
+
+typedef struct _VipsMaplut3d {
+	VipsOperation parent_instance;
+
+	VipsImage *in;
+	VipsImage *out;
+	VipsImage *lut;
+	VipsBandFormat format;
+
+	/* The LUT as a float memory image.
+	 */
+	VipsImage *memory;
+
+	/* For each input value, the cell it's in and the position within the
+	 * cell.
+	 */
+	int *index;
+	float *frac;
+
+} VipsMaplut3d;
+
+typedef VipsOperationClass VipsMaplut3dClass;
+
+G_DEFINE_TYPE( VipsMaplut3d, vips_maplut3d, VIPS_TYPE_OPERATION );
+
+/* Tetrahedral interpolation. The axis order of fr, fg, fb picks one of six
+ * tetrahedra in the cell, each with c000 and c111 at the ends and two of the
+ * other corners. We set the offsets of those two corners and the weights,
+ * then every band is three multiply-adds.
+ */
+#define TETRA( IN, OUT, CONV ) { \
+	IN * restrict p = (IN *) VIPS_REGION_ADDR( ir, r->left, y ); \
+	OUT * restrict q = (OUT *) VIPS_REGION_ADDR( or, r->left, y ); \
+	\
+	for( x = 0; x < r->width; x++ ) { \
+		float fr = frac[p[0]]; \
+		float fg = frac[p[1]]; \
+		float fb = frac[p[2]]; \
+		float *c000 = lut + \
+			((index[p[0]] * size + index[p[1]]) * size + \
+			 index[p[2]]) * bands; \
+		\
+		int oa, ob; \
+		float w1, w2, w3; \
+		int k; \
+		\
+		if( fr >= fg ) { \
+			if( fg >= fb ) { \
+				oa = dr; \
+				ob = dr + dg; \
+				w1 = fr; \
+				w2 = fg; \
+				w3 = fb; \
+			} \
+			else if( fr >= fb ) { \
+				oa = dr; \
+				ob = dr + db; \
+				w1 = fr; \
+				w2 = fb; \
+				w3 = fg; \
+			} \
+			else { \
+				oa = db; \
+				ob = dr + db; \
+				w1 = fb; \
+				w2 = fr; \
+				w3 = fg; \
+			} \
+		} \
+		else { \
+			if( fr >= fb ) { \
+				oa = dg; \
+				ob = dr + dg; \
+				w1 = fg; \
+				w2 = fr; \
+				w3 = fb; \
+			} \
+			else if( fg >= fb ) { \
+				oa = dg; \
+				ob = dg + db; \
+				w1 = fg; \
+				w2 = fb; \
+				w3 = fr; \
+			} \
+			else { \
+				oa = db; \
+				ob = dg + db; \
+				w1 = fb; \
+				w2 = fg; \
+				w3 = fr; \
+			} \
+		} \
+		\
+		for( k = 0; k < bands; k++ ) { \
+			float v = c000[k] + \
+				w1 * (c000[k + oa] - c000[k]) + \
+				w2 * (c000[k + ob] - c000[k + oa]) + \
+				w3 * (c000[k + d111] - c000[k + ob]); \
+			\
+			q[k] = CONV( v ); \
+		} \
+		\
+		p += 3; \
+		q += bands; \
+	} \
+}
+
+#define CONV_FLOAT( V ) (V)
+#define CONV_UCHAR( V ) VIPS_CLIP( 0, VIPS_RINT( V ), UCHAR_MAX )
+#define CONV_USHORT( V ) VIPS_CLIP( 0, VIPS_RINT( V ), USHRT_MAX )
+
+#define TETRA_FORMAT( IN ) { \
+	switch( maplut3d->format ) { \
+	case VIPS_FORMAT_UCHAR: \
+		TETRA( IN, unsigned char, CONV_UCHAR ); \
+		break; \
+	\
+	case VIPS_FORMAT_USHORT: \
+		TETRA( IN, unsigned short, CONV_USHORT ); \
+		break; \
+	\
+	case VIPS_FORMAT_FLOAT: \
+		TETRA( IN, float, CONV_FLOAT ); \
+		break; \
+	\
+	default: \
+		g_assert_not_reached(); \
+	} \
+}
+
+static int
+vips_maplut3d_gen( VipsRegion *or, void *seq, void *a, void *b,
+	gboolean *stop )
+{
+	VipsRegion *ir = (VipsRegion *) seq;
+	VipsMaplut3d *maplut3d = (VipsMaplut3d *) b;
+	VipsRect *r = &or->valid;
+	float *lut = (float *) VIPS_IMAGE_ADDR( maplut3d->memory, 0, 0 );
+	int bands = maplut3d->memory->Bands;
+	int size = maplut3d->memory->Xsize;
+	int *index = maplut3d->index;
+	float *frac = maplut3d->frac;
+
+	/* Offsets to the corners of a cell.
+	 */
+	int db = bands;
+	int dg = bands * size;
+	int dr = bands * size * size;
+	int d111 = dr + dg + db;
+
+	int x, y;
+
+	if( vips_region_prepare( ir, r ) )
+		return( -1 );
+
+	VIPS_GATE_START( "vips_maplut3d_gen: work" );
+
+	for( y = r->top; y < VIPS_RECT_BOTTOM( r ); y++ )
+		if( maplut3d->in->BandFmt == VIPS_FORMAT_UCHAR )
+			TETRA_FORMAT( unsigned char )
+		else
+			TETRA_FORMAT( unsigned short )
+
+	VIPS_GATE_STOP( "vips_maplut3d_gen: work" );
+
+	return( 0 );
+}
+
+static int
+vips_maplut3d_build( VipsObject *object )
+{
+	VipsObjectClass *class = VIPS_OBJECT_GET_CLASS( object );
+	VipsMaplut3d *maplut3d = (VipsMaplut3d *) object;
+	VipsImage **t = (VipsImage **) vips_object_local_array( object, 1 );
+
+	int size;
+	int max;
+	int i, v;
+
+	if( VIPS_OBJECT_CLASS( vips_maplut3d_parent_class )->build( object ) )
+		return( -1 );
+
+	if( vips_check_uncoded( class->nickname, maplut3d->in ) ||
+		vips_check_bands( class->nickname, maplut3d->in, 3 ) ||
+		vips_check_u8or16( class->nickname, maplut3d->in ) ||
+		vips_check_uncoded( class->nickname, maplut3d->lut ) ||
+		vips_check_noncomplex( class->nickname, maplut3d->lut ) )
+		return( -1 );
+
+	if( maplut3d->format != VIPS_FORMAT_UCHAR &&
+		maplut3d->format != VIPS_FORMAT_USHORT &&
+		maplut3d->format != VIPS_FORMAT_FLOAT ) {
+		vips_error( class->nickname,
+			"%s", _( "format must be uchar, ushort or float" ) );
+		return( -1 );
+	}
+
+	size = maplut3d->lut->Xsize;
+	max = maplut3d->in->BandFmt == VIPS_FORMAT_UCHAR ?
+		UCHAR_MAX : USHRT_MAX;
+	if( size < 2 ||
+		maplut3d->lut->Ysize != size * size ) {
+		vips_error( class->nickname,
+			"%s", _( "LUT must be size by size * size pixels" ) );
+		return( -1 );
+	}
+	if( size - 1 > max ) {
+		vips_error( class->nickname,
+			"%s", _( "LUT too large for input format" ) );
+		return( -1 );
+	}
+
+	if( vips_cast( maplut3d->lut, &t[0], VIPS_FORMAT_FLOAT, NULL ) ||
+		!(maplut3d->memory = vips_image_copy_memory( t[0] )) )
+		return( -1 );
+
+	/* Locate every input value in the grid.
+	 */
+	if( !(maplut3d->index = VIPS_ARRAY( object, max + 1, int )) ||
+		!(maplut3d->frac = VIPS_ARRAY( object, max + 1, float )) )
+		return( -1 );
+	for( i = 0, v = 0; v <= max; v++ ) {
+		int lo, hi;
+
+		while( i < size - 2 &&
+			v >= vips_lut3d_knot( i + 1, size, max ) )
+			i += 1;
+
+		lo = vips_lut3d_knot( i, size, max );
+		hi = vips_lut3d_knot( i + 1, size, max );
+		maplut3d->index[v] = i;
+		maplut3d->frac[v] = (float) (v - lo) / (hi - lo);
+	}
+
+	g_object_set( object, "out", vips_image_new(), NULL );
+
+	if( vips_image_pipelinev( maplut3d->out,
+		VIPS_DEMAND_STYLE_THINSTRIP, maplut3d->in, NULL ) )
+		return( -1 );
+	maplut3d->out->Bands = maplut3d->memory->Bands;
+	maplut3d->out->BandFmt = maplut3d->format;
+	maplut3d->out->Type = maplut3d->lut->Type;
+
+	if( vips_image_generate( maplut3d->out,
+		vips_start_one, vips_maplut3d_gen, vips_stop_one,
+		maplut3d->in, maplut3d ) )
+		return( -1 );
+
+	return( 0 );
+}
+
+static void
+vips_maplut3d_dispose( GObject *gobject )
+{
+	VipsMaplut3d *maplut3d = (VipsMaplut3d *) gobject;
+
+	VIPS_UNREF( maplut3d->memory );
+
+	G_OBJECT_CLASS( vips_maplut3d_parent_class )->dispose( gobject );
+}
+
+static void
+vips_maplut3d_class_init( VipsMaplut3dClass *class )
+{
+	GObjectClass *gobject_class = G_OBJECT_CLASS( class );
+	VipsObjectClass *object_class = (VipsObjectClass *) class;
+	VipsOperationClass *operation_class = VIPS_OPERATION_CLASS( class );
+
+	gobject_class->dispose = vips_maplut3d_dispose;
+	gobject_class->set_property = vips_object_set_property;
+	gobject_class->get_property = vips_object_get_property;
+
+	object_class->nickname = "maplut3d";
+	object_class->description = _( "map an image through a 3D LUT" );
+	object_class->build = vips_maplut3d_build;
+
+	operation_class->flags = VIPS_OPERATION_SEQUENTIAL;
+
+	VIPS_ARG_IMAGE( class, "in", 1,
+		_( "Input" ),
+		_( "Input image" ),
+		VIPS_ARGUMENT_REQUIRED_INPUT,
+		G_STRUCT_OFFSET( VipsMaplut3d, in ) );
+
+	VIPS_ARG_IMAGE( class, "out", 2,
+		_( "Output" ),
+		_( "Output image" ),
+		VIPS_ARGUMENT_REQUIRED_OUTPUT,
+		G_STRUCT_OFFSET( VipsMaplut3d, out ) );
+
+	VIPS_ARG_IMAGE( class, "lut", 3,
+		_( "LUT" ),
+		_( "3D LUT, as made by vips_colour_lut()" ),
+		VIPS_ARGUMENT_REQUIRED_INPUT,
+		G_STRUCT_OFFSET( VipsMaplut3d, lut ) );
+
+	VIPS_ARG_ENUM( class, "format", 4,
+		_( "Format" ),
+		_( "Output format" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsMaplut3d, format ),
+		VIPS_TYPE_BAND_FORMAT, VIPS_FORMAT_FLOAT );
+}
+
+static void
+vips_maplut3d_init( VipsMaplut3d *maplut3d )
+{
+	maplut3d->format = VIPS_FORMAT_FLOAT;
+}
+
+/**
+ * vips_maplut3d: (method)
+ * @in: input image
+ * @out: (out): output image
+ * @lut: 3D LUT
+ * @...: %NULL-terminated list of optional named arguments
+ *
+ * Optional arguments:
+ *
+ * * @format: #VipsBandFormat, output format
+ *
+ * Map a three-band #VIPS_FORMAT_UCHAR or #VIPS_FORMAT_USHORT image through
+ * a 3D LUT, as made by vips_colour_lut(), with tetrahedral interpolation.
+ * @lut must be @size by @size * @size pixels, the grid points are spread
+ * evenly from 0 to the largest value of the input format.
+ *
+ * @out has as many bands as @lut and the interpretation of @lut. @format
+ * can be #VIPS_FORMAT_FLOAT, the default, or #VIPS_FORMAT_UCHAR or
+ * #VIPS_FORMAT_USHORT, in which case values are rounded and clipped.
+ *
+ * See also: vips_colour_lut(), vips_maplut().
+ *
+ * Returns: 0 on success, -1 on error.
+ */
+int
+vips_maplut3d( VipsImage *in, VipsImage **out, VipsImage *lut, ... )
+{
+	va_list ap;
+	int result;
+
+	va_start( ap, lut );
+	result = vips_call_split( "maplut3d", ap, in, out, lut );
+	va_end( ap );
+
+	return( result );
+}
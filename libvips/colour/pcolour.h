@@ -55,6 +55,8 @@ extern "C" {
 struct _VipsColour;
 typedef void (*VipsColourProcessFn)( struct _VipsColour *colour, 
 	VipsPel *out, VipsPel **in, int width );
+typedef void (*VipsColourProcessRectFn)( struct _VipsColour *colour,
+	VipsRegion *out, VipsRegion **in, VipsRect *r );
 
 typedef struct _VipsColour {
 	VipsOperation parent_instance;
@@ -70,6 +72,11 @@ typedef struct _VipsColour {
 	 */
 	int input_bands; 
 
+	/* Set this to keep extra bands attached: process_line then sees all
+	 * of them and must copy them to the output itself.
+	 */
+	gboolean pass_extra;
+
 	VipsImage *out;
 
 	/* Set fields on ->out from these.
@@ -82,6 +89,11 @@ typedef struct _VipsColour {
 	/* Attach this profile, if set.
 	 */
 	char *profile_filename;
+
+	/* Set this if the transform does nothing. We skip processing and 
+	 * just update the header.
+	 */
+	gboolean identity;
 } VipsColour;
 
 typedef struct _VipsColourClass {
@@ -91,6 +103,10 @@ typedef struct _VipsColourClass {
 	 */
 	VipsColourProcessFn process_line;
 
+	/* Optionally, process a whole region in one call.
+	 */
+	VipsColourProcessRectFn process_rect;
+
 } VipsColourClass;
 
 GType vips_colour_get_type( void );
@@ -193,11 +209,20 @@ typedef struct _VipsColourDifference {
 	 */
 	VipsInterpretation interpretation;
 
+	/* If set, make a uchar mask of differences above this.
+	 */
+	double threshold;
+
 } VipsColourDifference;
 
 typedef struct _VipsColourDifferenceClass {
 	VipsColourClass parent_class;
 
+	/* Make a float difference for each pixel. We wrap this to make
+	 * masks.
+	 */
+	VipsColourProcessFn difference_line;
+
 } VipsColourDifferenceClass;
 
 GType vips_colour_difference_get_type( void );
@@ -212,10 +237,30 @@ extern int vips_Y2v_8[256 + 1];
 extern float vips_v2Y_8[256];
 extern int vips_Y2v_16[65536 + 1];
 extern float vips_v2Y_16[65536];
+extern unsigned short vips_v2Yi_8[256];
+extern int vips_Yi2v_8[4096 + 1];
 
 void vips_col_make_tables_RGB_8( void );
 void vips_col_make_tables_RGB_16( void );
 
+/* 16-bit linear to 8-bit sRGB with vips_Yi2v_8[].
+ */
+static inline int
+vips_col_Yi2v_8( int Y )
+{
+	int i = Y >> 4;
+	int f = Y & 15;
+
+	return( (vips_Yi2v_8[i] * 16 +
+		(vips_Yi2v_8[i + 1] - vips_Yi2v_8[i]) * f + 2048) >> 12 );
+}
+
+/* The matrices in vips_col_scRGB2XYZ() and vips_col_XYZ2scRGB(), row major,
+ * for the native kernels.
+ */
+extern const double vips__scRGB2XYZ_matrix[9];
+extern const double vips__XYZ2scRGB_matrix[9];
+
 #ifdef __cplusplus
 }
 #endif /*__cplusplus*/
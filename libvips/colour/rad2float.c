@@ -8,6 +8,8 @@
  * 	- redo as a class
  * 13/12/12
  * 	- tag output as scRGB, since it'll be 0-1
+ * 15/10/18
+ * 	- add a SIMD path
  */
 
 /*
@@ -110,6 +112,7 @@
 #include <math.h>
 
 #include <vips/vips.h>
+#include <vips/simd.h>
 
 #include "pcolour.h"
 
@@ -164,6 +167,14 @@ vips_rad2float_line( VipsColour *colour, VipsPel *out, VipsPel **in, int width )
 	COLR *inp = (COLR *) in[0];
 	COLOR *outbuf = (COLOR *) out;
 
+	VipsSimdRadFn simd;
+
+	if( (simd = (VipsSimdRadFn)
+		vips_simd_get( VIPS_SIMD_RAD2FLOAT, VIPS_FORMAT_UCHAR )) ) {
+		simd( (float *) out, in[0], width );
+		return;
+	}
+
 	colr_color(outbuf[0], inp[0]);
 	while (--width > 0) {
 		outbuf++; inp++;
@@ -2,6 +2,9 @@
  *
  * 9/6/15
  * 	- from LabS2Lab.c
+ * 14/10/18
+ * 	- add an AVX2 path
+ * 	- add @hue_only
  */
 
 /*
@@ -39,10 +42,16 @@
 #include <stdio.h>
 
 #include <vips/vips.h>
+#include <vips/simd.h>
 
 #include "pcolour.h"
 
-typedef VipsColourCode VipssRGB2HSV;
+typedef struct _VipssRGB2HSV {
+	VipsColourCode parent_instance;
+
+	gboolean hue_only;
+} VipssRGB2HSV;
+
 typedef VipsColourCodeClass VipssRGB2HSVClass;
 
 G_DEFINE_TYPE( VipssRGB2HSV, vips_sRGB2HSV, VIPS_TYPE_COLOUR_CODE );
@@ -50,11 +59,21 @@ G_DEFINE_TYPE( VipssRGB2HSV, vips_sRGB2HSV, VIPS_TYPE_COLOUR_CODE );
 static void
 vips_sRGB2HSV_line( VipsColour *colour, VipsPel *out, VipsPel **in, int width )
 {
+	VipssRGB2HSV *sRGB2HSV = (VipssRGB2HSV *) colour;
+	gboolean hue_only = sRGB2HSV->hue_only;
 	unsigned char *p = (unsigned char *) in[0];
 	unsigned char *q = (unsigned char *) out;
 
+	VipsSimdPelFn simd;
 	int i;
 
+	if( (simd = (VipsSimdPelFn) vips_simd_get( hue_only ?
+		VIPS_SIMD_SRGB2HUE : VIPS_SIMD_SRGB2HSV,
+		VIPS_FORMAT_UCHAR )) ) {
+		simd( q, p, width );
+		return;
+	}
+
 	for( i = 0; i < width; i++ ) {
 		unsigned char c_max;
 		unsigned char c_min;
@@ -101,13 +120,14 @@ vips_sRGB2HSV_line( VipsColour *colour, VipsPel *out, VipsPel **in, int width )
 
 		if( c_max == 0 ) {
 			q[0] = 0;
-			q[1] = 0;
-			q[2] = 0;
+			if( !hue_only ) {
+				q[1] = 0;
+				q[2] = 0;
+			}
 		} 
 		else {
 			unsigned char delta;
 
-			q[2] = c_max;
 			delta = c_max - c_min;
 
 			if( delta == 0 ) 
@@ -116,24 +136,57 @@ vips_sRGB2HSV_line( VipsColour *colour, VipsPel *out, VipsPel **in, int width )
 				q[0] = 42.5 * (secondary_diff / (float) delta) +
 				       	wrap_around_hue;
 
-			q[1] = delta * 255.0 / (float) c_max;
+			if( !hue_only ) {
+				q[1] = delta * 255.0 / (float) c_max;
+				q[2] = c_max;
+			}
 		}
 
 		p += 3;
-		q += 3;
+		q += hue_only ? 1 : 3;
+	}
+}
+
+static int
+vips_sRGB2HSV_build( VipsObject *object )
+{
+	VipsColour *colour = VIPS_COLOUR( object );
+	VipssRGB2HSV *sRGB2HSV = (VipssRGB2HSV *) object;
+
+	if( sRGB2HSV->hue_only ) {
+		colour->interpretation = VIPS_INTERPRETATION_MULTIBAND;
+		colour->bands = 1;
 	}
+
+	if( VIPS_OBJECT_CLASS( vips_sRGB2HSV_parent_class )->
+		build( object ) )
+		return( -1 );
+
+	return( 0 );
 }
 
 static void
 vips_sRGB2HSV_class_init( VipssRGB2HSVClass *class )
 {
+	GObjectClass *gobject_class = G_OBJECT_CLASS( class );
 	VipsObjectClass *object_class = (VipsObjectClass *) class;
 	VipsColourClass *colour_class = VIPS_COLOUR_CLASS( class );
 
+	gobject_class->set_property = vips_object_set_property;
+	gobject_class->get_property = vips_object_get_property;
+
 	object_class->nickname = "sRGB2HSV";
 	object_class->description = _( "transform sRGB to HSV" );
+	object_class->build = vips_sRGB2HSV_build;
 
 	colour_class->process_line = vips_sRGB2HSV_line;
+
+	VIPS_ARG_BOOL( class, "hue_only", 110,
+		_( "Hue only" ),
+		_( "Only output the hue band" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipssRGB2HSV, hue_only ),
+		FALSE );
 }
 
 static void
@@ -158,12 +211,19 @@ vips_sRGB2HSV_init( VipssRGB2HSV *sRGB2HSV )
  * @out: (out): output image
  * @...: %NULL-terminated list of optional named arguments
  *
+ * Optional arguments:
+ *
+ * * @hue_only: %gboolean, only output the hue band
+ *
  * Convert to HSV.
  *
  * HSV is a crude polar coordinate system for RGB images. It is provided for
  * compatibility with other image processing systems. See vips_Lab2LCh() for a 
  * much better colour space.
  *
+ * Set @hue_only to make a one-band #VIPS_INTERPRETATION_MULTIBAND image of
+ * just the hue. S and V are not computed.
+ *
  * See also: vips_HSV2sRGB(), vips_Lab2LCh().
  *
  * Returns: 0 on success, -1 on error.
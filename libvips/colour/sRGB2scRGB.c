@@ -19,6 +19,8 @@
  * 	- look for RGB16 tag, not just ushort, for the 16-bit path
  * 24/11/17 lovell
  * 	- special path for 3 and 4 band images
+ * 14/10/18
+ * 	- add @format, for 16-bit linear output
  */
 
 /*
@@ -69,6 +71,7 @@ typedef struct _VipssRGB2scRGB {
 
 	VipsImage *in;
 	VipsImage *out;
+	VipsBandFormat format;
 } VipssRGB2scRGB; 
 
 typedef VipsOperationClass VipssRGB2scRGBClass;
@@ -167,13 +170,62 @@ vips_sRGB2scRGB_line_16( float * restrict q, unsigned short * restrict p,
 	}
 }
 
+/* 8-bit sRGB to 16-bit linear with a LUT.
+ */
+static void
+vips_sRGB2scRGB_line_8_ushort( unsigned short * restrict q,
+	VipsPel * restrict p, int extra_bands, int width )
+{
+	int i, j;
+
+	for( i = 0; i < width; i++ ) {
+		q[0] = vips_v2Yi_8[p[0]];
+		q[1] = vips_v2Yi_8[p[1]];
+		q[2] = vips_v2Yi_8[p[2]];
+
+		p += 3;
+		q += 3;
+
+		for( j = 0; j < extra_bands; j++ )
+			q[j] = p[j];
+		p += extra_bands;
+		q += extra_bands;
+	}
+}
+
+/* 16-bit sRGB to 16-bit linear. Alpha is scaled to 0 - 255, as for float.
+ */
+static void
+vips_sRGB2scRGB_line_16_ushort( unsigned short * restrict q,
+	unsigned short * restrict p, int extra_bands, int width )
+{
+	int i, j;
+
+	for( i = 0; i < width; i++ ) {
+		q[0] = VIPS_RINT( 65535 * vips_v2Y_16[p[0]] );
+		q[1] = VIPS_RINT( 65535 * vips_v2Y_16[p[1]] );
+		q[2] = VIPS_RINT( 65535 * vips_v2Y_16[p[2]] );
+
+		p += 3;
+		q += 3;
+
+		for( j = 0; j < extra_bands; j++ )
+			q[j] = p[j] >> 8;
+		p += extra_bands;
+		q += extra_bands;
+	}
+}
+
 static int
 vips_sRGB2scRGB_gen( VipsRegion *or, 
 	void *seq, void *a, void *b, gboolean *stop )
 {
 	VipsRegion *ir = (VipsRegion *) seq;
+	VipssRGB2scRGB *sRGB2scRGB = (VipssRGB2scRGB *) b;
 	VipsRect *r = &or->valid;
 	VipsImage *in = ir->im;
+	int extra_bands = in->Bands - 3;
+	gboolean ushort = sRGB2scRGB->format == VIPS_FORMAT_USHORT;
 
 	int y;
 
@@ -186,23 +238,38 @@ vips_sRGB2scRGB_gen( VipsRegion *or,
 		vips_col_make_tables_RGB_8();
 
 		for( y = 0; y < r->height; y++ ) {
-			VipsPel *p = VIPS_REGION_ADDR( ir, r->left, r->top + y );
-			float *q = (float *)
+			VipsPel *p =
+				VIPS_REGION_ADDR( ir, r->left, r->top + y );
+			VipsPel *q =
 				VIPS_REGION_ADDR( or, r->left, r->top + y );
 
-			vips_sRGB2scRGB_line_8( q, p, in->Bands - 3, r->width );
+			if( ushort )
+				vips_sRGB2scRGB_line_8_ushort(
+					(unsigned short *) q, p,
+					extra_bands, r->width );
+			else
+				vips_sRGB2scRGB_line_8( (float *) q, p,
+					extra_bands, r->width );
 		}
 	}
 	else {
 		vips_col_make_tables_RGB_16();
 
 		for( y = 0; y < r->height; y++ ) {
-			VipsPel *p = VIPS_REGION_ADDR( ir, r->left, r->top + y );
-			float *q = (float *)
+			VipsPel *p =
+				VIPS_REGION_ADDR( ir, r->left, r->top + y );
+			VipsPel *q =
 				VIPS_REGION_ADDR( or, r->left, r->top + y );
 
-			vips_sRGB2scRGB_line_16( q, (unsigned short *) p, 
-				in->Bands - 3, r->width );
+			if( ushort )
+				vips_sRGB2scRGB_line_16_ushort(
+					(unsigned short *) q,
+					(unsigned short *) p,
+					extra_bands, r->width );
+			else
+				vips_sRGB2scRGB_line_16( (float *) q,
+					(unsigned short *) p,
+					extra_bands, r->width );
 		}
 	}
 
@@ -231,6 +298,13 @@ vips_sRGB2scRGB_build( VipsObject *object )
 	if( vips_check_bands_atleast( class->nickname, in, 3 ) )
 		return( -1 ); 
 
+	if( sRGB2scRGB->format != VIPS_FORMAT_FLOAT &&
+		sRGB2scRGB->format != VIPS_FORMAT_USHORT ) {
+		vips_error( class->nickname,
+			"%s", _( "format must be float or ushort" ) );
+		return( -1 );
+	}
+
 	format = in->Type == VIPS_INTERPRETATION_RGB16 ?
 		VIPS_FORMAT_USHORT : VIPS_FORMAT_UCHAR;
 	if( in->BandFmt != format ) {
@@ -250,7 +324,7 @@ vips_sRGB2scRGB_build( VipsObject *object )
 		return( -1 );
 	}
 	out->Type = VIPS_INTERPRETATION_scRGB;
-	out->BandFmt = VIPS_FORMAT_FLOAT;
+	out->BandFmt = sRGB2scRGB->format;
 
 	if( vips_image_generate( out,
 		vips_start_one, vips_sRGB2scRGB_gen, vips_stop_one, 
@@ -292,11 +366,19 @@ vips_sRGB2scRGB_class_init( VipssRGB2scRGBClass *class )
 		VIPS_ARGUMENT_REQUIRED_OUTPUT, 
 		G_STRUCT_OFFSET( VipssRGB2scRGB, out ) );
 
+	VIPS_ARG_ENUM( class, "format", 110,
+		_( "Format" ),
+		_( "Format for output image" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipssRGB2scRGB, format ),
+		VIPS_TYPE_BAND_FORMAT, VIPS_FORMAT_FLOAT );
+
 }
 
 static void
 vips_sRGB2scRGB_init( VipssRGB2scRGB *sRGB2scRGB )
 {
+	sRGB2scRGB->format = VIPS_FORMAT_FLOAT;
 }
 
 /**
@@ -305,12 +387,22 @@ vips_sRGB2scRGB_init( VipssRGB2scRGB *sRGB2scRGB )
  * @out: (out): output image
  * @...: %NULL-terminated list of optional named arguments
  *
+ * Optional arguments:
+ *
+ * * @format: #VipsBandFormat, make float or ushort output
+ *
  * Convert an sRGB image to scRGB. The input image can be 8 or 16-bit.
  *
  * If the input image is tagged as #VIPS_INTERPRETATION_RGB16, any extra 
  * channels after RGB are divided by 256. Thus, scRGB alpha is 
  * always 0 - 255.99.
  *
+ * Set @format to #VIPS_FORMAT_USHORT to get linear light scaled to 0 - 65535
+ * instead of float 0 - 1. 8-bit input is then converted with a single LUT,
+ * so this is much quicker. Alpha is rounded down to 0 - 255.
+ * vips_scRGB2sRGB() understands this form, but other operations will
+ * expect float scRGB.
+ *
  * See also: vips_scRGB2XYZ(), vips_scRGB2sRGB(), vips_rad2float().
  *
  * Returns: 0 on success, -1 on error.
@@ -8,6 +8,8 @@
  * 	- cleanups
  * 20/9/12
  * 	redo as a class
+ * 14/10/18
+ * 	- use a native SIMD kernel, if there is one
  */
 
 /*
@@ -46,6 +48,7 @@
 #include <math.h>
 
 #include <vips/vips.h>
+#include <vips/simd.h>
 
 #include "pcolour.h"
 
@@ -60,8 +63,15 @@ vips_scRGB2XYZ_line( VipsColour *colour, VipsPel *out, VipsPel **in, int width )
 	float * restrict p = (float *) in[0];
 	float * restrict q = (float *) out;
 
+	VipsSimdMatrixFn simd;
 	int i;
 
+	if( (simd = (VipsSimdMatrixFn) 
+		vips_simd_get( VIPS_SIMD_MATRIX3, VIPS_FORMAT_FLOAT )) ) {
+		simd( q, p, width, vips__scRGB2XYZ_matrix );
+		return;
+	}
+
 	for( i = 0; i < width; i++ ) {
 		float R = p[0];
 		float G = p[1];
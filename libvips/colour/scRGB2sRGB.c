@@ -27,6 +27,8 @@
  * 	- cut about to make scRGB2sRGB.c
  * 12/2/15
  * 	- add 16-bit alpha handling
+ * 14/10/18
+ * 	- add a path for 16-bit linear input
  */
 
 /*
@@ -148,6 +150,60 @@ vips_scRGB2sRGB_line_16( unsigned short * restrict q, float * restrict p,
 	}
 }
 
+/* 16-bit linear from vips_sRGB2scRGB(), see there.
+ */
+static void
+vips_scRGB2sRGB_line_ushort_8( VipsPel * restrict q,
+	unsigned short * restrict p, int extra_bands, int width )
+{
+	int i, j;
+
+	for( i = 0; i < width; i++ ) {
+		q[0] = vips_col_Yi2v_8( p[0] );
+		q[1] = vips_col_Yi2v_8( p[1] );
+		q[2] = vips_col_Yi2v_8( p[2] );
+
+		p += 3;
+		q += 3;
+
+		for( j = 0; j < extra_bands; j++ )
+			q[j] = VIPS_MIN( p[j], UCHAR_MAX );
+		p += extra_bands;
+		q += extra_bands;
+	}
+}
+
+static void
+vips_scRGB2sRGB_line_ushort_16( unsigned short * restrict q,
+	unsigned short * restrict p, int extra_bands, int width )
+{
+	int i, j;
+
+	for( i = 0; i < width; i++ ) {
+		float R = p[0] / 65535.0;
+		float G = p[1] / 65535.0;
+		float B = p[2] / 65535.0;
+
+		int r, g, b;
+		int or;
+
+		vips_col_scRGB2sRGB_16( R, G, B, &r, &g, &b, &or );
+
+		p += 3;
+
+		q[0] = r;
+		q[1] = g;
+		q[2] = b;
+
+		q += 3;
+
+		for( j = 0; j < extra_bands; j++ )
+			q[j] = VIPS_MIN( p[j] * 256, USHRT_MAX );
+		p += extra_bands;
+		q += extra_bands;
+	}
+}
+
 static int
 vips_scRGB2sRGB_gen( VipsRegion *or, 
 	void *seq, void *a, void *b, gboolean *stop )
@@ -164,17 +220,29 @@ vips_scRGB2sRGB_gen( VipsRegion *or,
 
 	VIPS_GATE_START( "vips_scRGB2sRGB_gen: work" ); 
 
-	for( y = 0; y < r->height; y++ ) {
-		float *p = (float *) 
-			VIPS_REGION_ADDR( ir, r->left, r->top + y );
-		VipsPel *q = (VipsPel *) 
-			VIPS_REGION_ADDR( or, r->left, r->top + y );
+	if( in->BandFmt == VIPS_FORMAT_USHORT )
+		vips_col_make_tables_RGB_8();
 
-		if( scRGB2sRGB->depth == 16 ) 
-			vips_scRGB2sRGB_line_16( (unsigned short *) q, p, 
-				in->Bands - 3, r->width );
+	for( y = 0; y < r->height; y++ ) {
+		VipsPel *p = VIPS_REGION_ADDR( ir, r->left, r->top + y );
+		VipsPel *q = VIPS_REGION_ADDR( or, r->left, r->top + y );
+
+		if( in->BandFmt == VIPS_FORMAT_USHORT ) {
+			if( scRGB2sRGB->depth == 16 )
+				vips_scRGB2sRGB_line_ushort_16(
+					(unsigned short *) q,
+					(unsigned short *) p,
+					in->Bands - 3, r->width );
+			else
+				vips_scRGB2sRGB_line_ushort_8( q,
+					(unsigned short *) p,
+					in->Bands - 3, r->width );
+		}
+		else if( scRGB2sRGB->depth == 16 )
+			vips_scRGB2sRGB_line_16( (unsigned short *) q,
+				(float *) p, in->Bands - 3, r->width );
 		else
-			vips_scRGB2sRGB_line_8( q, p, 
+			vips_scRGB2sRGB_line_8( q, (float *) p,
 				in->Bands - 3, r->width );
 	}
 
@@ -220,9 +288,14 @@ vips_scRGB2sRGB_build( VipsObject *object )
 		return( -1 );
 	}
 
-	if( vips_cast_float( in, &t[0], NULL ) )
-		return( -1 );
-	in = t[0];
+	/* ushort is 16-bit linear from vips_sRGB2scRGB(), we have a path for
+	 * that.
+	 */
+	if( in->BandFmt != VIPS_FORMAT_USHORT ) {
+		if( vips_cast_float( in, &t[0], NULL ) )
+			return( -1 );
+		in = t[0];
+	}
 
 	out = vips_image_new();
 	if( vips_image_pipelinev( out, 
@@ -303,6 +376,10 @@ vips_scRGB2sRGB_init( VipsscRGB2sRGB *scRGB2sRGB )
  * If @depth is 16, any extra channels after RGB are 
  * multiplied by 256. 
  *
+ * #VIPS_FORMAT_USHORT input is taken to be linear light scaled to 0 - 65535,
+ * as made by vips_sRGB2scRGB() with @format set. 8-bit output from this is
+ * found with a small LUT, so it's much quicker than float input.
+ *
  * See also: vips_LabS2LabQ(), vips_sRGB2scRGB(), vips_rad2float().
  *
  * Returns: 0 on success, -1 on error.
@@ -2,6 +2,9 @@
  *
  * 11/12/15
  * 	- from join.c
+ * 14/10/18
+ * 	- find the inputs a request touches from the grid, start them only
+ * 	  when first needed, and release them once we've gone past them
  */
 
 /*
@@ -73,31 +76,184 @@ typedef VipsConversionClass VipsArrayjoinClass;
 
 G_DEFINE_TYPE( VipsArrayjoin, vips_arrayjoin, VIPS_TYPE_CONVERSION );
 
+/* Each thread makes regions on inputs as it reaches them, and releases them
+ * once it's gone past, so mosaics of thousands of images only have a row or
+ * two of inputs running at once.
+ */
+typedef struct _VipsArrayjoinSequence {
+	VipsArrayjoin *join;
+
+	/* A region for each input, or NULL if we've not made it yet.
+	 */
+	VipsRegion **ir;
+
+	/* The indexes of the inputs we've made regions for.
+	 */
+	int *open;
+	int n_open;
+} VipsArrayjoinSequence;
+
 static int
-vips_arrayjoin_gen( VipsRegion *or, void *seq, 
-	void *a, void *b, gboolean *stop )
+vips_arrayjoin_stop( void *vseq, void *a, void *b )
+{
+	VipsArrayjoinSequence *seq = (VipsArrayjoinSequence *) vseq;
+
+	int i;
+
+	if( seq->ir )
+		for( i = 0; i < seq->n_open; i++ )
+			VIPS_FREEF( vips__region_pool_put,
+				seq->ir[seq->open[i]] );
+
+	VIPS_FREE( seq->ir );
+	VIPS_FREE( seq->open );
+	VIPS_FREE( seq );
+
+	return( 0 );
+}
+
+static void *
+vips_arrayjoin_start( VipsImage *out, void *a, void *b )
 {
-	VipsRegion **ir = (VipsRegion **) seq;
 	VipsArrayjoin *join = (VipsArrayjoin *) b;
-	VipsRect *r = &or->valid;
 	int n = VIPS_AREA( join->in )->n;
 
+	VipsArrayjoinSequence *seq;
 	int i;
 
+	if( !(seq = VIPS_NEW( NULL, VipsArrayjoinSequence )) )
+		return( NULL );
+	seq->join = join;
+	seq->ir = VIPS_ARRAY( NULL, n, VipsRegion * );
+	seq->open = VIPS_ARRAY( NULL, n, int );
+	seq->n_open = 0;
+	if( !seq->ir ||
+		!seq->open ) {
+		vips_arrayjoin_stop( seq, NULL, NULL );
+		return( NULL );
+	}
+
+	for( i = 0; i < n; i++ )
+		seq->ir[i] = NULL;
+
+	return( seq );
+}
+
+/* The region for input i, making it if necessary.
+ */
+static VipsRegion *
+vips_arrayjoin_region( VipsArrayjoinSequence *seq, VipsImage **in, int i )
+{
+	if( !seq->ir[i] ) {
+		if( !(seq->ir[i] = vips__region_pool_get( in[i] )) )
+			return( NULL );
+		seq->open[seq->n_open++] = i;
+	}
+
+	return( seq->ir[i] );
+}
+
+/* Release the regions for inputs in grid rows above row.
+ */
+static void
+vips_arrayjoin_release( VipsArrayjoinSequence *seq, int row )
+{
+	VipsArrayjoin *join = seq->join;
+
+	int i;
+
+	for( i = 0; i < seq->n_open; ) {
+		int k = seq->open[i];
+
+		if( k / join->across < row ) {
+			VIPS_FREEF( vips__region_pool_put, seq->ir[k] );
+			seq->n_open -= 1;
+			seq->open[i] = seq->open[seq->n_open];
+		}
+		else
+			i += 1;
+	}
+}
+
+/* The grid cell holding a pixel. Each cell is a rect in join->rects, so cells
+ * include the shim to their right and below.
+ */
+static int
+vips_arrayjoin_column( VipsArrayjoin *join, int x )
+{
+	return( VIPS_MIN( x / (join->hspacing + join->shim),
+		join->across - 1 ) );
+}
+
+static int
+vips_arrayjoin_row( VipsArrayjoin *join, int y )
+{
+	return( VIPS_MIN( y / (join->vspacing + join->shim),
+		join->down - 1 ) );
+}
+
+/* The input for a cell. The last image is stretched to fill the end of the
+ * final row.
+ */
+static int
+vips_arrayjoin_index( VipsArrayjoin *join, int column, int row )
+{
+	return( VIPS_MIN( row * join->across + column,
+		VIPS_AREA( join->in )->n - 1 ) );
+}
+
+static int
+vips_arrayjoin_gen( VipsRegion *or, void *vseq,
+	void *a, void *b, gboolean *stop )
+{
+	VipsArrayjoinSequence *seq = (VipsArrayjoinSequence *) vseq;
+	VipsImage **in = (VipsImage **) a;
+	VipsArrayjoin *join = (VipsArrayjoin *) b;
+	VipsRect *r = &or->valid;
+	int c0 = vips_arrayjoin_column( join, r->left );
+	int c1 = vips_arrayjoin_column( join, VIPS_RECT_RIGHT( r ) - 1 );
+	int r0 = vips_arrayjoin_row( join, r->top );
+	int r1 = vips_arrayjoin_row( join, VIPS_RECT_BOTTOM( r ) - 1 );
+
+	VipsRegion *ir;
+	int i, x, y;
+	int last;
+
+	/* Requests usually travel down the image, so we can drop any inputs
+	 * above this one.
+	 */
+	vips_arrayjoin_release( seq, r0 );
+
 	/* Does this rect fit within one of our inputs? If it does, we
 	 * can pass just the request on.
 	 */
-	for( i = 0; i < n; i++ ) 
-		if( vips_rect_includesrect( &join->rects[i], r ) ) 
-			return( vips__insert_just_one( or, ir[i],
-				join->rects[i].left, join->rects[i].top ) ); 
+	i = vips_arrayjoin_index( join, c0, r0 );
+	if( vips_rect_includesrect( &join->rects[i], r ) ) {
+		if( !(ir = vips_arrayjoin_region( seq, in, i )) )
+			return( -1 );
+
+		return( vips__insert_just_one( or, ir,
+			join->rects[i].left, join->rects[i].top ) );
+	}
 
 	/* Output requires more than one input. Paste all touching inputs into
 	 * the output.
 	 */
-	for( i = 0; i < n; i++ ) 
-		if( vips__insert_paste_region( or, ir[i], &join->rects[i] ) )
-			return( -1 );
+	for( y = r0; y <= r1; y++ ) {
+		last = -1;
+
+		for( x = c0; x <= c1; x++ ) {
+			i = vips_arrayjoin_index( join, x, y );
+			if( i == last )
+				break;
+			last = i;
+
+			if( !(ir = vips_arrayjoin_region( seq, in, i )) ||
+				vips__insert_paste_region( or, ir,
+					&join->rects[i] ) )
+				return( -1 );
+		}
+	}
 
 	return( 0 );
 }
@@ -275,7 +431,7 @@ vips_arrayjoin_build( VipsObject *object )
 	conversion->out->Ysize = output_height;
 
 	if( vips_image_generate( conversion->out,
-		vips_start_many, vips_arrayjoin_gen, vips_stop_many, 
+		vips_arrayjoin_start, vips_arrayjoin_gen, vips_arrayjoin_stop,
 		size, join ) )
 		return( -1 );
 
@@ -424,6 +580,10 @@ vips_arrayjoinv( VipsImage **in, VipsImage **out, int n, va_list ap )
  * Smallest common format in 
  * <link linkend="libvips-arithmetic">arithmetic</link>).
  *
+ * Each input is only started when a request first touches it, and is
+ * released again once computation has moved below it, so you can join
+ * many thousands of images.
+ *
  * See also: vips_join(), vips_insert().
  *
  * Returns: 0 on success, -1 on error
@@ -213,6 +213,10 @@ vips_autorot_init( VipsAutorot *autorot )
  * vips only supports the four simple rotations, it does not support the
  * various mirror modes. 
  *
+ * Rotation by 90 or 270 degrees moves every pixel, so if you are going to
+ * shrink the image as well, shrink first and rotate the smaller image.
+ * vips_thumbnail() does this for you.
+ *
  * See also: vips_autorot_get_angle(), vips_autorot_remove_angle(), vips_rot().
  *
  * Returns: 0 on success, -1 on error
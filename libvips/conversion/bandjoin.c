@@ -26,6 +26,8 @@
  * 	- rewrite as a class
  * 7/11/15
  * 	- added bandjoin_const
+ * 14/10/18
+ * 	- bandjoin copies 1, 2, 4 and 8 byte input pels as single values
  */
 
 /*
@@ -87,6 +89,16 @@ typedef VipsBandaryClass VipsBandjoinClass;
 
 G_DEFINE_TYPE( VipsBandjoin, vips_bandjoin, VIPS_TYPE_BANDARY );
 
+/* Copy TYPE from p1 to every stride-th TYPE of q1.
+ */
+#define STRIDED_COPY( TYPE ) { \
+	TYPE * restrict tp = (TYPE *) p1; \
+	TYPE * restrict tq = (TYPE *) q1; \
+	\
+	for( x = 0; x < width; x++ ) \
+		tq[x * stride] = tp[x]; \
+}
+
 static void
 vips_bandjoin_buffer( VipsBandarySequence *seq, 
 	VipsPel *q, VipsPel **p, int width )
@@ -116,13 +128,33 @@ vips_bandjoin_buffer( VipsBandarySequence *seq,
 		q1 = q;
 		p1 = p[i];
 
-		for( x = 0; x < width; x++ ) {
-			for( z = 0; z < ips; z++ )
-				q1[z] = p1[z];
-
-			p1 += ips;
-			q1 += ops;
+		/* Joining a one-band image, eg. putting alpha back, is
+		 * common. Copy pels as single values if we can.
+		 */
+		if( (ips == 1 || ips == 2 || ips == 4 || ips == 8) &&
+			((size_t) p1 % ips) == 0 &&
+			((size_t) q1 % ips) == 0 &&
+			ops % ips == 0 ) {
+			int stride = ops / ips;
+
+			switch( ips ) {
+			case 1:	STRIDED_COPY( guint8 ); break;
+			case 2:	STRIDED_COPY( guint16 ); break;
+			case 4:	STRIDED_COPY( guint32 ); break;
+			case 8:	STRIDED_COPY( guint64 ); break;
+
+			default:
+				g_assert_not_reached();
+			}
 		}
+		else
+			for( x = 0; x < width; x++ ) {
+				for( z = 0; z < ips; z++ )
+					q1[z] = p1[z];
+
+				p1 += ips;
+				q1 += ops;
+			}
 
 		q += ips;
 	}
@@ -51,6 +51,11 @@
  * 	- add @shift option
  * 1/3/16
  * 	- better behaviour for shift of non-int types (thanks apacheark)
+ * 14/10/18
+ * 	- use native SIMD kernels for some casts to and from float
+ * 	- split out vips_cast_line() so cast can be fused with other point ops
+ * 	- fuse a preceding float linear, and a native kernel for ushort to
+ * 	  uchar shift
  */
 
 /*
@@ -95,6 +100,7 @@
 #include <math.h>
 
 #include <vips/vips.h>
+#include <vips/simd.h>
 #include <vips/internal.h>
 #include <vips/debug.h>
 
@@ -110,6 +116,21 @@ typedef struct _VipsCast {
 	int underflow;		/* Number of underflows */
 	int overflow;		/* Number of overflows */
 
+	/* The format we actually read, after decode, and the native kernels
+	 * for this pair of formats, if any.
+	 */
+	VipsBandFormat in_format;
+	VipsSimdCastFn cast_fn;
+	VipsSimdClipFn clip_fn;
+	VipsSimdShiftFn shift_fn;
+
+	/* If we've swallowed a linear before us, our input is the linear's
+	 * input and this is the kernel for the scale and offset.
+	 */
+	VipsSimdLinearFn linear_fn;
+	float a;
+	float b;
+
 } VipsCast;
 
 typedef VipsConversionClass VipsCastClass;
@@ -366,6 +387,130 @@ vips_cast_start( VipsImage *out, void *a, void *b )
 	} \
 }
 
+/* Elements per chunk for fused linear and clip.
+ */
+#define VIPS_CAST_CHUNK (256)
+
+/* Cast a line of sz elements. Clips are counted in seq.
+ */
+static void
+vips_cast_line( VipsCast *cast, 
+	VipsPel *out, VipsPel *in, int sz, VipsCastSequence *seq )
+{
+	VipsConversion *conversion = (VipsConversion *) cast;
+
+	int x;
+
+	if( cast->linear_fn ) {
+		int ips = vips_format_sizeof( cast->in_format );
+		int ops = vips_format_sizeof( cast->format );
+
+		float buf[VIPS_CAST_CHUNK];
+		int n;
+
+		/* Scale to float and clip a chunk at a time, so the float
+		 * stays in cache.
+		 */
+		for( x = 0; x < sz; x += n ) {
+			n = VIPS_MIN( sz - x, VIPS_CAST_CHUNK );
+			cast->linear_fn( buf, in + x * ips, n,
+				cast->a, cast->b );
+			cast->clip_fn( out + x * ops, buf, n,
+				&seq->underflow, &seq->overflow );
+		}
+
+		return;
+	}
+	if( cast->shift_fn ) {
+		cast->shift_fn( out, in, sz );
+		return;
+	}
+	if( cast->cast_fn ) {
+		cast->cast_fn( (float *) out, in, sz );
+		return;
+	}
+	if( cast->clip_fn ) {
+		cast->clip_fn( out, (float *) in, sz, 
+			&seq->underflow, &seq->overflow );
+		return;
+	}
+
+	switch( cast->in_format ) { 
+	case VIPS_FORMAT_UCHAR: 
+		BAND_SWITCH_INNER( unsigned char,
+			VIPS_INT_INT, 
+			VIPS_CLIP_REAL_FLOAT, 
+			VIPS_CLIP_REAL_COMPLEX );
+		break; 
+
+	case VIPS_FORMAT_CHAR: 
+		BAND_SWITCH_INNER( signed char,
+			VIPS_INT_INT, 
+			VIPS_CLIP_REAL_FLOAT, 
+			VIPS_CLIP_REAL_COMPLEX );
+		break; 
+
+	case VIPS_FORMAT_USHORT: 
+		BAND_SWITCH_INNER( unsigned short,
+			VIPS_INT_INT, 
+			VIPS_CLIP_REAL_FLOAT, 
+			VIPS_CLIP_REAL_COMPLEX );
+		break; 
+
+	case VIPS_FORMAT_SHORT: 
+		BAND_SWITCH_INNER( signed short,
+			VIPS_INT_INT, 
+			VIPS_CLIP_REAL_FLOAT, 
+			VIPS_CLIP_REAL_COMPLEX );
+		break; 
+
+	case VIPS_FORMAT_UINT: 
+		BAND_SWITCH_INNER( unsigned int,
+			VIPS_INT_INT, 
+			VIPS_CLIP_REAL_FLOAT, 
+			VIPS_CLIP_REAL_COMPLEX );
+		break; 
+
+	case VIPS_FORMAT_INT: 
+		BAND_SWITCH_INNER( signed int,
+			VIPS_INT_INT, 
+			VIPS_CLIP_REAL_FLOAT, 
+			VIPS_CLIP_REAL_COMPLEX );
+		break; 
+
+	case VIPS_FORMAT_FLOAT: 
+		BAND_SWITCH_INNER( float,
+			VIPS_CLIP_FLOAT_INT, 
+			VIPS_CLIP_REAL_FLOAT, 
+			VIPS_CLIP_REAL_COMPLEX );
+		break; 
+
+	case VIPS_FORMAT_DOUBLE: 
+		BAND_SWITCH_INNER( double,
+			VIPS_CLIP_FLOAT_INT, 
+			VIPS_CLIP_REAL_FLOAT, 
+			VIPS_CLIP_REAL_COMPLEX );
+		break; 
+
+	case VIPS_FORMAT_COMPLEX: 
+		BAND_SWITCH_INNER( float,
+			VIPS_CLIP_COMPLEX_INT, 
+			VIPS_CLIP_COMPLEX_FLOAT, 
+			VIPS_CLIP_COMPLEX_COMPLEX );
+		break; 
+
+	case VIPS_FORMAT_DPCOMPLEX: 
+		BAND_SWITCH_INNER( double,
+			VIPS_CLIP_COMPLEX_INT, 
+			VIPS_CLIP_COMPLEX_FLOAT, 
+			VIPS_CLIP_COMPLEX_COMPLEX );
+		break; 
+
+	default: 
+		g_assert_not_reached(); 
+	} 
+}
+
 static int
 vips_cast_gen( VipsRegion *or, void *vseq, void *a, void *b,
 	gboolean *stop )
@@ -373,11 +518,10 @@ vips_cast_gen( VipsRegion *or, void *vseq, void *a, void *b,
 	VipsCastSequence *seq = (VipsCastSequence *) vseq;
 	VipsRegion *ir = seq->ir;
 	VipsCast *cast = (VipsCast *) b;
-	VipsConversion *conversion = (VipsConversion *) b;
 	VipsRect *r = &or->valid;
 	int sz = VIPS_REGION_N_ELEMENTS( or );
 
-	int x, y;
+	int y;
 
 	if( vips_region_prepare( ir, r ) )
 		return( -1 );
@@ -388,80 +532,7 @@ vips_cast_gen( VipsRegion *or, void *vseq, void *a, void *b,
 		VipsPel *in = VIPS_REGION_ADDR( ir, r->left, r->top + y ); 
 		VipsPel *out = VIPS_REGION_ADDR( or, r->left, r->top + y ); 
 
-		switch( ir->im->BandFmt ) { 
-		case VIPS_FORMAT_UCHAR: 
-			BAND_SWITCH_INNER( unsigned char,
-				VIPS_INT_INT, 
-				VIPS_CLIP_REAL_FLOAT, 
-				VIPS_CLIP_REAL_COMPLEX );
-			break; 
-
-		case VIPS_FORMAT_CHAR: 
-			BAND_SWITCH_INNER( signed char,
-				VIPS_INT_INT, 
-				VIPS_CLIP_REAL_FLOAT, 
-				VIPS_CLIP_REAL_COMPLEX );
-			break; 
-
-		case VIPS_FORMAT_USHORT: 
-			BAND_SWITCH_INNER( unsigned short,
-				VIPS_INT_INT, 
-				VIPS_CLIP_REAL_FLOAT, 
-				VIPS_CLIP_REAL_COMPLEX );
-			break; 
-
-		case VIPS_FORMAT_SHORT: 
-			BAND_SWITCH_INNER( signed short,
-				VIPS_INT_INT, 
-				VIPS_CLIP_REAL_FLOAT, 
-				VIPS_CLIP_REAL_COMPLEX );
-			break; 
-
-		case VIPS_FORMAT_UINT: 
-			BAND_SWITCH_INNER( unsigned int,
-				VIPS_INT_INT, 
-				VIPS_CLIP_REAL_FLOAT, 
-				VIPS_CLIP_REAL_COMPLEX );
-			break; 
-
-		case VIPS_FORMAT_INT: 
-			BAND_SWITCH_INNER( signed int,
-				VIPS_INT_INT, 
-				VIPS_CLIP_REAL_FLOAT, 
-				VIPS_CLIP_REAL_COMPLEX );
-			break; 
-
-		case VIPS_FORMAT_FLOAT: 
-			BAND_SWITCH_INNER( float,
-				VIPS_CLIP_FLOAT_INT, 
-				VIPS_CLIP_REAL_FLOAT, 
-				VIPS_CLIP_REAL_COMPLEX );
-			break; 
-
-		case VIPS_FORMAT_DOUBLE: 
-			BAND_SWITCH_INNER( double,
-				VIPS_CLIP_FLOAT_INT, 
-				VIPS_CLIP_REAL_FLOAT, 
-				VIPS_CLIP_REAL_COMPLEX );
-			break; 
-
-		case VIPS_FORMAT_COMPLEX: 
-			BAND_SWITCH_INNER( float,
-				VIPS_CLIP_COMPLEX_INT, 
-				VIPS_CLIP_COMPLEX_FLOAT, 
-				VIPS_CLIP_COMPLEX_COMPLEX );
-			break; 
-
-		case VIPS_FORMAT_DPCOMPLEX: 
-			BAND_SWITCH_INNER( double,
-				VIPS_CLIP_COMPLEX_INT, 
-				VIPS_CLIP_COMPLEX_FLOAT, 
-				VIPS_CLIP_COMPLEX_COMPLEX );
-			break; 
-
-		default: 
-			g_assert_not_reached(); 
-		} 
+		vips_cast_line( cast, out, in, sz, seq );
 	}
 
 	VIPS_GATE_STOP( "vips_cast_gen: work" );
@@ -469,15 +540,43 @@ vips_cast_gen( VipsRegion *or, void *vseq, void *a, void *b,
 	return( 0 );
 }
 
+/* A line at a time for pipeline fusion. There's no sequence, so we count
+ * clips locally and add them in as we go.
+ */
+static void
+vips_cast_point( VipsPel *out, VipsPel **in, int width, void *a )
+{
+	VipsCast *cast = (VipsCast *) a;
+	VipsConversion *conversion = (VipsConversion *) a;
+
+	VipsCastSequence seq;
+
+	seq.ir = NULL;
+	seq.underflow = 0;
+	seq.overflow = 0;
+
+	vips_cast_line( cast, out, in[0], width * conversion->out->Bands, 
+		&seq );
+
+	if( seq.underflow )
+		g_atomic_int_add( &cast->underflow, seq.underflow );
+	if( seq.overflow )
+		g_atomic_int_add( &cast->overflow, seq.overflow );
+}
+
 static int
 vips_cast_build( VipsObject *object )
 {
 	VipsConversion *conversion = VIPS_CONVERSION( object );
 	VipsCast *cast = (VipsCast *) object;
 	VipsImage **t = (VipsImage **) 
-		vips_object_local_array( object, 2 );
+		vips_object_local_array( object, 3 );
 
 	VipsImage *in; 
+	VipsImage *source;
+	VipsImage *linear_in;
+	double a, b;
+	VipsImage *point[2];
 
 	if( VIPS_OBJECT_CLASS( vips_cast_parent_class )->build( object ) )
 		return( -1 );
@@ -513,6 +612,44 @@ vips_cast_build( VipsObject *object )
 
 	conversion->out->BandFmt = cast->format;
 
+	/* The common to-float and from-float casts have native kernels.
+	 */
+	cast->in_format = in->BandFmt;
+	cast->cast_fn = NULL;
+	cast->clip_fn = NULL;
+	cast->shift_fn = NULL;
+	cast->linear_fn = NULL;
+	if( cast->format == VIPS_FORMAT_FLOAT )
+		cast->cast_fn = (VipsSimdCastFn) 
+			vips_simd_get( VIPS_SIMD_CAST_FLOAT, in->BandFmt );
+	else if( in->BandFmt == VIPS_FORMAT_FLOAT )
+		cast->clip_fn = (VipsSimdClipFn) 
+			vips_simd_get( VIPS_SIMD_CLIP_FLOAT, cast->format );
+	else if( cast->shift &&
+		in->BandFmt == VIPS_FORMAT_USHORT &&
+		cast->format == VIPS_FORMAT_UCHAR )
+		cast->shift_fn = (VipsSimdShiftFn)
+			vips_simd_get( VIPS_SIMD_SHIFT_UCHAR, in->BandFmt );
+
+	/* A float linear followed by a clip to uchar or ushort is very
+	 * common. If linear has a kernel for its input, do the scale and
+	 * offset here and read the linear's input directly. The float image
+	 * is never made.
+	 */
+	source = in;
+	if( cast->clip_fn &&
+		cast->in->Coding == VIPS_CODING_NONE &&
+		vips__linear_get( cast->in, &linear_in, &a, &b ) &&
+		(cast->linear_fn = (VipsSimdLinearFn) vips_simd_get(
+			VIPS_SIMD_LINEAR, linear_in->BandFmt )) ) {
+		t[2] = linear_in;
+		g_object_ref( linear_in );
+		source = linear_in;
+		cast->in_format = linear_in->BandFmt;
+		cast->a = a;
+		cast->b = b;
+	}
+
 	g_signal_connect( in, "preeval", 
 		G_CALLBACK( vips_cast_preeval ), cast );
 	g_signal_connect( in, "posteval", 
@@ -520,9 +657,13 @@ vips_cast_build( VipsObject *object )
 
 	if( vips_image_generate( conversion->out,
 		vips_cast_start, vips_cast_gen, vips_cast_stop, 
-		in, cast ) )
+		source, cast ) )
 		return( -1 );
 
+	point[0] = source;
+	point[1] = NULL;
+	vips__point_attach( conversion->out, point, vips_cast_point, cast ); 
+
 	return( 0 );
 }
 
@@ -7,6 +7,11 @@
  * 30/1/18
  * 	- remove number of images limit
  * 	- allow one mode ... reused for all joins
+ * 14/10/18
+ * 	- use a native SIMD kernel for uchar RGBA with OVER, if there is one
+ * 	- native SIMD kernels also do MULTIPLY, SCREEN and DEST_IN, and ushort
+ * 	- add x and y offsets, skip inputs which don't touch a tile and stop
+ * 	  at opaque layers
  */
 
 /*
@@ -53,6 +58,7 @@
 #include <vips/vips.h>
 #include <vips/internal.h>
 #include <vips/debug.h>
+#include <vips/simd.h>
 
 #include "pconversion.h"
 
@@ -83,6 +89,11 @@ typedef struct _VipsCompositeBase {
 	 */
 	VipsArrayInt *mode;
 
+	/* Optional positions for the N - 1 images after the first.
+	 */
+	VipsArrayInt *x_offset;
+	VipsArrayInt *y_offset;
+
 	/* Compositing space. This defaults to RGB, or B_W if we only have
 	 * G and GA inputs.
 	 */
@@ -101,6 +112,18 @@ typedef struct _VipsCompositeBase {
 	 */
 	int bands;
 
+	/* For each of the n inputs, the blend mode (unused for the base),
+	 * and the area of the output it covers. Outside that area an input
+	 * is transparent.
+	 */
+	VipsBlendMode *input_mode;
+	VipsRect *subimage;
+
+	/* Set if a single input can be copied to the output unchanged where
+	 * it's opaque, or everywhere if the images are premultiplied.
+	 */
+	gboolean passthrough;
+
 	/* The maximum value for each band, set from the image interpretation.
 	 * This is used to scale each band to 0 - 1.
 	 */
@@ -112,6 +135,12 @@ typedef struct _VipsCompositeBase {
 	v4f max_band_vec;
 #endif /*HAVE_VECTOR_ARITH*/
 
+	/* A native kernel for uchar or ushort RGBA with a few modes, and
+	 * max_band as float for it.
+	 */
+	VipsSimdCompositeFn simd;
+	float max_band_float[4];
+
 } VipsCompositeBase;
 
 typedef VipsConversionClass VipsCompositeBaseClass;
@@ -136,6 +165,14 @@ vips_composite_base_dispose( GObject *gobject )
 		vips_area_unref( (VipsArea *) composite->mode );
 		composite->mode = NULL;
 	}
+	if( composite->x_offset ) {
+		vips_area_unref( (VipsArea *) composite->x_offset );
+		composite->x_offset = NULL;
+	}
+	if( composite->y_offset ) {
+		vips_area_unref( (VipsArea *) composite->y_offset );
+		composite->y_offset = NULL;
+	}
 
 	G_OBJECT_CLASS( vips_composite_base_parent_class )->dispose( gobject );
 }
@@ -153,6 +190,11 @@ typedef struct {
 	 */
 	VipsPel **p;
 
+	/* The inputs we need for this tile, and their blend modes.
+	 */
+	int *active;
+	VipsBlendMode *mode;
+
 } VipsCompositeSequence;
 
 static int
@@ -169,6 +211,8 @@ vips_composite_stop( void *vseq, void *a, void *b )
 	}
 
 	VIPS_FREE( seq->p );
+	VIPS_FREE( seq->active );
+	VIPS_FREE( seq->mode );
 
 	VIPS_FREE( seq );
 
@@ -190,6 +234,8 @@ vips_composite_start( VipsImage *out, void *a, void *b )
 	seq->composite = composite;
 	seq->ir = NULL;
 	seq->p = NULL;
+	seq->active = NULL;
+	seq->mode = NULL;
 
 	/* How many images?
 	 */
@@ -214,7 +260,9 @@ vips_composite_start( VipsImage *out, void *a, void *b )
 
 	/* Input pointers.
 	 */
-	if( !(seq->p = VIPS_ARRAY( NULL, n + 1, VipsPel * )) ) {
+	if( !(seq->p = VIPS_ARRAY( NULL, n + 1, VipsPel * )) ||
+		!(seq->active = VIPS_ARRAY( NULL, n, int )) ||
+		!(seq->mode = VIPS_ARRAY( NULL, n, VipsBlendMode )) ) {
 		vips_composite_stop( seq, NULL, NULL );
 		return( NULL );
 	}
@@ -775,11 +823,9 @@ vips_composite_base_blend3( VipsCompositeBase *composite,
  */
 template <typename T, gint64 min_T, gint64 max_T>
 static void 
-vips_combine_pixels( VipsCompositeBase *composite, VipsPel *q, VipsPel **p )
+vips_combine_pixels( VipsCompositeBase *composite,
+	int n, VipsBlendMode *mode, VipsPel *q, VipsPel **p )
 {
-	VipsBlendMode *mode = (VipsBlendMode *) composite->mode->area.data;
-	int n_mode = composite->mode->area.n;
-	int n = composite->n;
 	int bands = composite->bands;
 	T * restrict tq = (T * restrict) q;
 	T ** restrict tp = (T ** restrict) p;
@@ -797,11 +843,8 @@ vips_combine_pixels( VipsCompositeBase *composite, VipsPel *q, VipsPel **p )
 		for( int b = 0; b < bands; b++ )
 			B[b] *= aB;
 
-	for( int i = 1; i < n; i++ ) {
-		VipsBlendMode m = n_mode == 1 ? mode[0] : mode[i - 1];
-
-		vips_composite_base_blend<T>( composite, m, B, tp[i] ); 
-	}
+	for( int i = 1; i < n; i++ )
+		vips_composite_base_blend<T>( composite, mode[i], B, tp[i] );
 
 	/* Unpremultiply, if necessary.
 	 */
@@ -838,11 +881,9 @@ vips_combine_pixels( VipsCompositeBase *composite, VipsPel *q, VipsPel **p )
  */
 template <typename T, gint64 min_T, gint64 max_T>
 static void 
-vips_combine_pixels3( VipsCompositeBase *composite, VipsPel *q, VipsPel **p )
+vips_combine_pixels3( VipsCompositeBase *composite,
+	int n, VipsBlendMode *mode, VipsPel *q, VipsPel **p )
 {
-	VipsBlendMode *mode = (VipsBlendMode *) composite->mode->area.data;
-	int n_mode = composite->mode->area.n;
-	int n = composite->n;
 	T * restrict tq = (T * restrict) q;
 	T ** restrict tp = (T ** restrict) p;
 
@@ -864,11 +905,8 @@ vips_combine_pixels3( VipsCompositeBase *composite, VipsPel *q, VipsPel **p )
 		B[3] = aB;
 	}
 
-	for( int i = 1; i < n; i++ ) {
-		VipsBlendMode m = n_mode == 1 ? mode[0] : mode[i - 1];
-
-		vips_composite_base_blend3<T>( composite, m, B, tp[i] ); 
-	}
+	for( int i = 1; i < n; i++ )
+		vips_composite_base_blend3<T>( composite, mode[i], B, tp[i] );
 
 	/* Unpremultiply, if necessary.
 	 */
@@ -902,6 +940,96 @@ vips_combine_pixels3( VipsCompositeBase *composite, VipsPel *q, VipsPel **p )
 }
 #endif /*HAVE_VECTOR_ARITH*/
 
+/* Blending a transparent black pixel with one of these modes leaves the
+ * pixel below unchanged, so we can skip inputs in places where they are
+ * not present.
+ */
+static gboolean
+vips_composite_mode_transparent( VipsBlendMode mode )
+{
+	switch( mode ) {
+	case VIPS_BLEND_MODE_OVER:
+	case VIPS_BLEND_MODE_ATOP:
+	case VIPS_BLEND_MODE_DEST:
+	case VIPS_BLEND_MODE_DEST_OVER:
+	case VIPS_BLEND_MODE_DEST_OUT:
+	case VIPS_BLEND_MODE_XOR:
+		return( TRUE );
+
+	default:
+		/* The PDF modes.
+		 */
+		return( mode >= VIPS_BLEND_MODE_MULTIPLY );
+	}
+}
+
+template <typename T>
+static gboolean
+vips_composite_base_opaque_format( VipsCompositeBase *composite,
+	VipsRegion *region, VipsRect *r )
+{
+	const int bands = composite->bands;
+	const double max_alpha = composite->max_band[bands];
+
+	for( int y = 0; y < r->height; y++ ) {
+		T *p = (T *) VIPS_REGION_ADDR( region, r->left, r->top + y );
+
+		for( int x = 0; x < r->width; x++ ) {
+			if( p[bands] != max_alpha )
+				return( FALSE );
+
+			p += bands + 1;
+		}
+	}
+
+	return( TRUE );
+}
+
+/* Test for an area of an input being completely opaque. Such an area hides
+ * everything below it for OVER.
+ */
+static gboolean
+vips_composite_base_opaque( VipsCompositeBase *composite,
+	VipsRegion *region, VipsRect *r )
+{
+	switch( region->im->BandFmt ) {
+	case VIPS_FORMAT_UCHAR:
+		return( vips_composite_base_opaque_format<unsigned char>(
+			composite, region, r ) );
+
+	case VIPS_FORMAT_CHAR:
+		return( vips_composite_base_opaque_format<signed char>(
+			composite, region, r ) );
+
+	case VIPS_FORMAT_USHORT:
+		return( vips_composite_base_opaque_format<unsigned short>(
+			composite, region, r ) );
+
+	case VIPS_FORMAT_SHORT:
+		return( vips_composite_base_opaque_format<signed short>(
+			composite, region, r ) );
+
+	case VIPS_FORMAT_UINT:
+		return( vips_composite_base_opaque_format<unsigned int>(
+			composite, region, r ) );
+
+	case VIPS_FORMAT_INT:
+		return( vips_composite_base_opaque_format<signed int>(
+			composite, region, r ) );
+
+	case VIPS_FORMAT_FLOAT:
+		return( vips_composite_base_opaque_format<float>(
+			composite, region, r ) );
+
+	case VIPS_FORMAT_DOUBLE:
+		return( vips_composite_base_opaque_format<double>(
+			composite, region, r ) );
+
+	default:
+		return( FALSE );
+	}
+}
+
 static int
 vips_composite_base_gen( VipsRegion *output_region,
 	void *vseq, void *a, void *b, gboolean *stop )
@@ -911,39 +1039,97 @@ vips_composite_base_gen( VipsRegion *output_region,
 	VipsRect *r = &output_region->valid;
 	int ps = VIPS_IMAGE_SIZEOF_PEL( output_region->im );
 
-	if( vips_reorder_prepare_many( output_region->im, seq->ir, r ) )
-		return( -1 );
+	int n;
+	int top;
+
+	/* Work down from the top image, preparing only the inputs we need.
+	 * We can skip an input which does not touch this tile if its mode
+	 * leaves the pixels below unchanged, and we can stop at an input
+	 * which hides everything below it.
+	 */
+	n = 0;
+	for( int i = composite->n - 1; i >= 0; i-- ) {
+		VipsBlendMode m = composite->input_mode[i];
+		VipsRect hit;
+
+		vips_rect_intersectrect( r, &composite->subimage[i], &hit );
+		if( i > 0 &&
+			vips_rect_isempty( &hit ) &&
+			vips_composite_mode_transparent( m ) )
+			continue;
+
+		if( vips_region_prepare( seq->ir[i], r ) )
+			return( -1 );
+		seq->active[n] = i;
+		n += 1;
+
+		if( i > 0 &&
+			(m == VIPS_BLEND_MODE_SOURCE ||
+			 (m == VIPS_BLEND_MODE_OVER &&
+			  vips_rect_equalsrect( &hit, r ) &&
+			  vips_composite_base_opaque( composite,
+				seq->ir[i], r ))) )
+			break;
+	}
+
+	/* A single opaque input is just copied.
+	 */
+	top = seq->active[0];
+	if( n == 1 &&
+		composite->passthrough &&
+		(composite->premultiplied ||
+		 vips_composite_base_opaque( composite, seq->ir[top], r )) )
+		return( vips_region_region( output_region, seq->ir[top],
+			r, r->left, r->top ) );
+
+	/* Reverse into bottom-up order. The input at the bottom of the stack
+	 * is now the base, whatever its mode was.
+	 */
+	for( int i = 0; i < n / 2; i++ )
+		VIPS_SWAP( int, seq->active[i], seq->active[n - i - 1] );
+	for( int i = 1; i < n; i++ )
+		seq->mode[i] = composite->input_mode[seq->active[i]];
 
 	VIPS_GATE_START( "vips_composite_base_gen: work" );
 
 	for( int y = 0; y < r->height; y++ ) {
 		VipsPel *q;
 
-		for( int i = 0; i < composite->n; i++ )
-			seq->p[i] = VIPS_REGION_ADDR( seq->ir[i],
+		for( int i = 0; i < n; i++ )
+			seq->p[i] = VIPS_REGION_ADDR( seq->ir[seq->active[i]],
 				r->left, r->top + y );
-		seq->p[composite->n] = NULL;
+		seq->p[n] = NULL;
 		q = VIPS_REGION_ADDR( output_region, r->left, r->top + y );
 
+		if( composite->simd ) {
+			composite->simd( q, seq->p, n, r->width,
+				seq->mode + 1, n - 1,
+				composite->max_band_float, 
+				composite->premultiplied );
+			continue;
+		}
+
 		for( int x = 0; x < r->width; x++ ) {
-			switch( seq->ir[0]->im->BandFmt ) {
+			switch( output_region->im->BandFmt ) {
 			case VIPS_FORMAT_UCHAR: 	
 #ifdef HAVE_VECTOR_ARITH
 				if( composite->bands == 3 ) 
 					vips_combine_pixels3
 						<unsigned char, 0, UCHAR_MAX>
-						( composite, q, seq->p );
+						( composite, n, seq->mode,
+							q, seq->p );
 				else
 #endif 
 					vips_combine_pixels
 						<unsigned char, 0, UCHAR_MAX>
-						( composite, q, seq->p );
+						( composite, n, seq->mode,
+							q, seq->p );
 				break;
 
 			case VIPS_FORMAT_CHAR: 		
 				vips_combine_pixels
 					<signed char, SCHAR_MIN, SCHAR_MAX>
-					( composite, q, seq->p );
+					( composite, n, seq->mode, q, seq->p );
 				break; 
 
 			case VIPS_FORMAT_USHORT: 	
@@ -951,30 +1137,32 @@ vips_composite_base_gen( VipsRegion *output_region,
 				if( composite->bands == 3 ) 
 					vips_combine_pixels3
 						<unsigned short, 0, USHRT_MAX>
-						( composite, q, seq->p );
+						( composite, n, seq->mode,
+							q, seq->p );
 				else
 #endif 
 					vips_combine_pixels
 						<unsigned short, 0, USHRT_MAX>
-						( composite, q, seq->p );
+						( composite, n, seq->mode,
+							q, seq->p );
 				break; 
 
 			case VIPS_FORMAT_SHORT: 	
 				vips_combine_pixels
 					<signed short, SHRT_MIN, SHRT_MAX>
-					( composite, q, seq->p );
+					( composite, n, seq->mode, q, seq->p );
 				break; 
 
 			case VIPS_FORMAT_UINT: 		
 				vips_combine_pixels
 					<unsigned int, 0, UINT_MAX>
-					( composite, q, seq->p );
+					( composite, n, seq->mode, q, seq->p );
 				break; 
 
 			case VIPS_FORMAT_INT: 		
 				vips_combine_pixels
 					<signed int, INT_MIN, INT_MAX>
-					( composite, q, seq->p );
+					( composite, n, seq->mode, q, seq->p );
 				break; 
 
 			case VIPS_FORMAT_FLOAT:
@@ -982,18 +1170,20 @@ vips_composite_base_gen( VipsRegion *output_region,
 				if( composite->bands == 3 ) 
 					vips_combine_pixels3
 						<float, 0, USHRT_MAX>
-						( composite, q, seq->p );
+						( composite, n, seq->mode,
+							q, seq->p );
 				else
 #endif 
 					vips_combine_pixels
 						<float, 0, 0>
-						( composite, q, seq->p );
+						( composite, n, seq->mode,
+							q, seq->p );
 				break;
 
 			case VIPS_FORMAT_DOUBLE:
 				vips_combine_pixels
 					<double, 0, 0>
-					( composite, q, seq->p );
+					( composite, n, seq->mode, q, seq->p );
 				break;
 
 			default:
@@ -1001,7 +1191,7 @@ vips_composite_base_gen( VipsRegion *output_region,
 				return( -1 );
 			}
 
-			for( int i = 0; i < composite->n; i++ )
+			for( int i = 0; i < n; i++ )
 				seq->p[i] += ps;
 			q += ps;
 		}
@@ -1025,6 +1215,8 @@ vips_composite_base_build( VipsObject *object )
 	VipsImage **format;
 	VipsImage **size;
 	VipsBlendMode *mode;
+	int n_mode;
+	int skip;
 
 	if( VIPS_OBJECT_CLASS( vips_composite_base_parent_class )->
 		build( object ) )
@@ -1052,6 +1244,16 @@ vips_composite_base_build( VipsObject *object )
 			return( -1 );
 		}
 	}
+	n_mode = composite->mode->area.n;
+
+	if( (composite->x_offset &&
+		composite->x_offset->area.n != composite->n - 1) ||
+		(composite->y_offset &&
+		 composite->y_offset->area.n != composite->n - 1) ) {
+		vips_error( klass->nickname, _( "must be %d x and y offsets" ),
+			composite->n - 1 );
+		return( -1 );
+	}
 
 	in = (VipsImage **) composite->in->area.data;
 
@@ -1063,7 +1265,9 @@ vips_composite_base_build( VipsObject *object )
 
 	/* Are any of the images missing an alpha? The first missing alpha is
 	 * given a solid 255 and becomes the background image, shortening n.
+	 * in[i] is then image i + skip of the original array.
 	 */
+	skip = 0;
 	for( int i = composite->n - 1; i >= 0; i-- )
 		if( !vips_image_hasalpha( in[i] ) ) {
 			VipsImage *x;
@@ -1075,6 +1279,7 @@ vips_composite_base_build( VipsObject *object )
 
 			composite->n -= i;
 			in += i;
+			skip = i;
 
 			break;
 		}
@@ -1153,16 +1358,114 @@ vips_composite_base_build( VipsObject *object )
 			composite->max_band_vec[b] = composite->max_band[b];
 #endif /*HAVE_VECTOR_ARITH*/
 
-	/* Transform the input images to match in size and format. We may have
+	if( !(composite->input_mode =
+		VIPS_ARRAY( object, composite->n, VipsBlendMode )) ||
+		!(composite->subimage =
+			VIPS_ARRAY( object, composite->n, VipsRect )) )
+		return( -1 );
+	for( int i = 0; i < composite->n; i++ ) {
+		int j = i + skip;
+
+		composite->input_mode[i] = j == 0 ?
+			VIPS_BLEND_MODE_OVER : mode[n_mode == 1 ? 0 : j - 1];
+	}
+
+	/* Transform the input images to match in format. We may have
 	 * mixed float and double, for example.  
 	 */
 	format = (VipsImage **) vips_object_local_array( object, composite->n );
-	size = (VipsImage **) vips_object_local_array( object, composite->n );
-	if( vips__formatalike_vec( in, format, composite->n ) ||
-		vips__sizealike_vec( format, size, composite->n ) )
+	if( vips__formatalike_vec( in, format, composite->n ) )
 		return( -1 );
+	in = format;
+
+	/* With no offsets, the images are expanded to the largest common
+	 * size in the usual way. Otherwise, each is placed on a transparent
+	 * canvas the size of the first image, and we note the area it covers
+	 * so we can skip it elsewhere.
+	 */
+	size = (VipsImage **) vips_object_local_array( object, composite->n );
+	if( !composite->x_offset &&
+		!composite->y_offset ) {
+		if( vips__sizealike_vec( in, size, composite->n ) )
+			return( -1 );
+
+		for( int i = 0; i < composite->n; i++ ) {
+			composite->subimage[i].left = 0;
+			composite->subimage[i].top = 0;
+			composite->subimage[i].width = size[i]->Xsize;
+			composite->subimage[i].height = size[i]->Ysize;
+		}
+	}
+	else {
+		VipsImage *base =
+			((VipsImage **) composite->in->area.data)[0];
+		int *x = composite->x_offset ?
+			(int *) composite->x_offset->area.data : NULL;
+		int *y = composite->y_offset ?
+			(int *) composite->y_offset->area.data : NULL;
+
+		for( int i = 0; i < composite->n; i++ ) {
+			VipsRect *subimage = &composite->subimage[i];
+			int j = i + skip;
+
+			subimage->left = j > 0 && x ? x[j - 1] : 0;
+			subimage->top = j > 0 && y ? y[j - 1] : 0;
+			subimage->width = in[i]->Xsize;
+			subimage->height = in[i]->Ysize;
+
+			if( vips_embed( in[i], &size[i],
+				subimage->left, subimage->top,
+				base->Xsize, base->Ysize, (void *) NULL ) )
+				return( -1 );
+		}
+	}
 	in = size;
 
+	/* Integer pixels survive scaling to 0 - 1 and back unchanged, so
+	 * where there's only one input we can sometimes just copy it.
+	 */
+	composite->passthrough = FALSE;
+	if( in[0]->BandFmt == VIPS_FORMAT_UCHAR ||
+		in[0]->BandFmt == VIPS_FORMAT_USHORT ) {
+		double max = in[0]->BandFmt == VIPS_FORMAT_UCHAR ?
+			UCHAR_MAX : USHRT_MAX;
+
+		composite->passthrough = TRUE;
+		for( int b = 0; b <= composite->bands; b++ )
+			if( composite->max_band[b] != max )
+				composite->passthrough = FALSE;
+	}
+
+#ifdef HAVE_VECTOR_ARITH
+	/* The native kernels do a few common modes on uchar and ushort RGBA,
+	 * and they match the float vector path, not the double one.
+	 */
+	if( composite->bands == 3 &&
+		(in[0]->BandFmt == VIPS_FORMAT_UCHAR ||
+		 in[0]->BandFmt == VIPS_FORMAT_USHORT) ) {
+		VipsBlendMode *mode = 
+			(VipsBlendMode *) composite->mode->area.data;
+		gboolean all_native;
+
+		all_native = TRUE;
+		for( int i = 0; i < composite->mode->area.n; i++ )
+			if( mode[i] != VIPS_BLEND_MODE_OVER &&
+				mode[i] != VIPS_BLEND_MODE_MULTIPLY &&
+				mode[i] != VIPS_BLEND_MODE_SCREEN &&
+				mode[i] != VIPS_BLEND_MODE_DEST_IN )
+				all_native = FALSE;
+
+		if( all_native ) {
+			composite->simd = (VipsSimdCompositeFn) vips_simd_get( 
+				VIPS_SIMD_COMPOSITE, in[0]->BandFmt );
+
+			for( int b = 0; b <= 3; b++ )
+				composite->max_band_float[b] = 
+					composite->max_band[b];
+		}
+	}
+#endif /*HAVE_VECTOR_ARITH*/
+
 	if( vips_image_pipeline_array( conversion->out,
 		VIPS_DEMAND_STYLE_THINSTRIP, in ) )
 		return( -1 );
@@ -1264,6 +1567,20 @@ vips_composite_class_init( VipsCompositeClass *klass )
 		G_STRUCT_OFFSET( VipsCompositeBase, mode ),
 		VIPS_TYPE_ARRAY_INT );
 
+	VIPS_ARG_BOXED( klass, "x", 4,
+		_( "x coordinates" ),
+		_( "Array of x coordinates to join at" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsCompositeBase, x_offset ),
+		VIPS_TYPE_ARRAY_INT );
+
+	VIPS_ARG_BOXED( klass, "y", 5,
+		_( "y coordinates" ),
+		_( "Array of y coordinates to join at" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsCompositeBase, y_offset ),
+		VIPS_TYPE_ARRAY_INT );
+
 }
 
 static void
@@ -1310,6 +1627,8 @@ typedef struct _VipsComposite2 {
 	VipsImage *base;
 	VipsImage *overlay;
 	VipsBlendMode mode;
+	int x;
+	int y;
 
 } VipsComposite2;
 
@@ -1339,6 +1658,14 @@ vips_composite2_build( VipsObject *object )
 
 		mode[0] = (int) composite2->mode;
 		base->mode = vips_array_int_new( mode, 1 );
+
+		if( vips_object_argument_isset( object, "x" ) ||
+			vips_object_argument_isset( object, "y" ) ) {
+			base->x_offset =
+				vips_array_int_new( &composite2->x, 1 );
+			base->y_offset =
+				vips_array_int_new( &composite2->y, 1 );
+		}
 	}
 
 	if( VIPS_OBJECT_CLASS( vips_composite2_parent_class )->build( object ) )
@@ -1385,6 +1712,20 @@ vips_composite2_class_init( VipsCompositeClass *klass )
 		G_STRUCT_OFFSET( VipsComposite2, mode ),
 		VIPS_TYPE_BLEND_MODE, VIPS_BLEND_MODE_OVER );
 
+	VIPS_ARG_INT( klass, "x", 4,
+		_( "x" ),
+		_( "x position of overlay" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsComposite2, x ),
+		-VIPS_MAX_COORD, VIPS_MAX_COORD, 0 );
+
+	VIPS_ARG_INT( klass, "y", 5,
+		_( "y" ),
+		_( "y position of overlay" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsComposite2, y ),
+		-VIPS_MAX_COORD, VIPS_MAX_COORD, 0 );
+
 }
 
 static void
@@ -81,6 +81,8 @@
  *
  * * @compositing_space: #VipsInterpretation to composite in
  * * @premultiplied: %gboolean, images are already premultiplied
+ * * @x: #VipsArrayInt, array of (@n - 1) x coordinates
+ * * @y: #VipsArrayInt, array of (@n - 1) y coordinates
  *
  * Composite an array of images together. 
  *
@@ -108,6 +110,12 @@
  * The images do not need to match in size or format. They will be expanded to
  * the smallest common size and format in the usual way.
  *
+ * Set @x and @y to position the images after the first. The output is then
+ * the size of @in[0], and the other images are placed at those coordinates.
+ * They are transparent outside their area, and only the images which
+ * overlap each part of the output are computed for it, so small overlays on
+ * a large base are cheap.
+ *
  * Image are normally treated as unpremultiplied, so this operation can be used
  * directly on PNG images. If your images have been through vips_premultiply(),
  * set @premultiplied. 
@@ -125,6 +133,13 @@
  * @mode: composite with this blend mode
  * @...: %NULL-terminated list of optional named arguments
  *
+ * Optional arguments:
+ *
+ * * @compositing_space: #VipsInterpretation to composite in
+ * * @premultiplied: %gboolean, images are already premultiplied
+ * * @x: %gint, position of overlay
+ * * @y: %gint, position of overlay
+ *
  * Composite @overlay on top of @base with @mode. See vips_composite().
  *
  * Returns: 0 on success, -1 on error
@@ -351,6 +366,7 @@ vips_conversion_operation_init( void )
 	extern GType vips_gravity_get_type( void ); 
 	extern GType vips_flip_get_type( void ); 
 	extern GType vips_insert_get_type( void ); 
+	extern GType vips_insert_many_get_type( void ); 
 	extern GType vips_join_get_type( void ); 
 	extern GType vips_arrayjoin_get_type( void ); 
 	extern GType vips_extract_area_get_type( void ); 
@@ -401,6 +417,7 @@ vips_conversion_operation_init( void )
 	vips_gravity_get_type();
 	vips_flip_get_type();
 	vips_insert_get_type();
+	vips_insert_many_get_type();
 	vips_join_get_type();
 	vips_arrayjoin_get_type();
 	vips_extract_area_get_type();
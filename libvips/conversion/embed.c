@@ -27,6 +27,9 @@
  *	- add @background
  * 19/9/17
  * 	- break into embed and gravity
+ * 14/10/18
+ * 	- prefetch input for the tile below
+ * 	- copy, repeat and mirror map each piece straight back to the input
  */
 
 /*
@@ -69,6 +72,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <math.h>
+#include <limits.h>
 
 #include <vips/vips.h>
 #include <vips/internal.h>
@@ -112,51 +116,82 @@ typedef VipsConversionClass VipsEmbedBaseClass;
 
 G_DEFINE_ABSTRACT_TYPE( VipsEmbedBase, vips_embed_base, VIPS_TYPE_CONVERSION );
 
-/* r is the bit we are trying to paint, guaranteed to be entirely within
- * border area i. Set out to be the edge of the image we need to paint the
- * pixels in r.
+/* Map coordinate i on an axis of an input n pixels long for copy, repeat and
+ * mirror. dir is the direction the input runs in from there, 0 for a single
+ * pixel used again and again, and run is how many pixels we can go before the
+ * mapping changes.
  */
-static void
-vips_embed_base_find_edge( VipsEmbedBase *base, 
-	VipsRect *r, int i, VipsRect *out )
+static int
+vips_embed_base_map( VipsExtend extend, int i, int n, int *dir, int *run )
 {
-	/* Expand the border by 1 pixel, intersect with the image area, and we
-	 * get the edge. Usually too much though: eg. we could make the entire
-	 * right edge.
-	 */
-	*out = base->border[i];
-	vips_rect_marginadjust( out, 1 );
-	vips_rect_intersectrect( out, &base->rsub, out );
+	int m;
 
-	/* Usually too much though: eg. we could make the entire
-	 * right edge. If we're strictly up/down/left/right of the image, we
-	 * can trim.
-	 */
-	if( i == 0 || 
-		i == 2 ) {
-		VipsRect extend;
+	switch( extend ) {
+	case VIPS_EXTEND_REPEAT:
+		m = i % n;
+		if( m < 0 )
+			m += n;
+		*dir = 1;
+		*run = n - m;
+		return( m );
 
-		/* Above or below.
-		 */
-		extend = *r;
-		extend.top = 0;
-		extend.height = base->height;
-		vips_rect_intersectrect( out, &extend, out );
+	case VIPS_EXTEND_MIRROR:
+		m = i % (2 * n);
+		if( m < 0 )
+			m += 2 * n;
+		if( m < n ) {
+			*dir = 1;
+			*run = n - m;
+			return( m );
+		}
+		else {
+			*dir = -1;
+			*run = 2 * n - m;
+			return( 2 * n - 1 - m );
+		}
+
+	default:
+		g_assert( extend == VIPS_EXTEND_COPY );
+
+		if( i < 0 ) {
+			*dir = 0;
+			*run = -i;
+			return( 0 );
+		}
+		else if( i >= n ) {
+			*dir = 0;
+			*run = INT_MAX;
+			return( n - 1 );
+		}
+		else {
+			*dir = 1;
+			*run = n - i;
+			return( i );
+		}
 	}
-	if( i == 1 || 
-		i == 3 ) {
-		VipsRect extend;
+}
 
-		/* Left or right.
-		 */
-		extend = *r;
-		extend.left = 0;
-		extend.width = base->width;
-		vips_rect_intersectrect( out, &extend, out );
+/* The input pixels needed to make len pixels from s.
+ */
+static void
+vips_embed_base_source( int s, int dir, int len, int *start, int *size )
+{
+	if( dir > 0 ) {
+		*start = s;
+		*size = len;
+	}
+	else if( dir < 0 ) {
+		*start = s - len + 1;
+		*size = len;
+	}
+	else {
+		*start = s;
+		*size = 1;
 	}
 }
 
-/* Copy a single pixel sideways into a line of pixels.
+/* Copy a single pixel sideways into a line of pixels. Copy one, then keep
+ * doubling the run with memcpy().
  */
 static void
 vips_embed_base_copy_pixel( VipsEmbedBase *base, 
@@ -164,64 +199,92 @@ vips_embed_base_copy_pixel( VipsEmbedBase *base,
 {
 	const int bs = VIPS_IMAGE_SIZEOF_PEL( base->in );
 
-	int x, b;
+	int done;
+
+	if( n <= 0 )
+		return;
 
-	for( x = 0; x < n; x++ )
-		for( b = 0; b < bs; b++ )
-			*q++ = p[b];
+	memcpy( q, p, bs );
+	for( done = 1; done < n; done *= 2 )
+		memcpy( q + done * bs, q, bs * VIPS_MIN( done, n - done ) );
 }
 
-/* Paint r of region or. It's a border area, lying entirely within 
- * base->border[i]. p points to the top-left source pixel to fill with. 
- * plsk is the line stride.
+/* Paint piece of or from the input pixels in src, running in directions
+ * xdir and ydir. ovl is the part of or we've already filled from the input,
+ * if any.
  */
-static void
-vips_embed_base_paint_edge( VipsEmbedBase *base, 
-	VipsRegion *or, int i, VipsRect *r, VipsPel *p, int plsk )
+static int
+vips_embed_base_paint_piece( VipsEmbedBase *base,
+	VipsRegion *or, VipsRegion *ir, VipsRect *ovl,
+	VipsRect *piece, VipsRect *src, int xdir, int ydir )
 {
 	const int bs = VIPS_IMAGE_SIZEOF_PEL( base->in );
 
-	VipsRect todo;
-	VipsPel *q;
+	VipsRect painted;
+	VipsPel *p;
+	int plsk;
 	int y;
 
-	VIPS_GATE_START( "vips_embed_base_paint_edge: work" );
-
-	/* Pixels left to paint.
-	 */
-	todo = *r;
-
-	/* Corner pieces ... copy the single pixel to paint the top line of
-	 * todo, then use the line copier below to paint the rest of it.
+	/* If we've already painted the source pixels, we can fetch them from
+	 * or.
 	 */
-	if( i > 3 ) {
-		q = VIPS_REGION_ADDR( or, todo.left, todo.top );
-		vips_embed_base_copy_pixel( base, q, p, todo.width );
-
-		p = q;
-		todo.top += 1;
-		todo.height -= 1;
+	painted = *src;
+	painted.left += base->x;
+	painted.top += base->y;
+	if( vips_rect_includesrect( ovl, &painted ) ) {
+		p = VIPS_REGION_ADDR( or, painted.left, painted.top );
+		plsk = VIPS_REGION_LSKIP( or );
 	}
-
-	if( i == 1 || i == 3 ) {
-		/* Vertical line of pixels to copy.
+	else if( xdir > 0 &&
+		ydir > 0 )
+		/* A straight copy, as we get with repeat, can be made in
+		 * place.
 		 */
-		for( y = 0; y < todo.height; y++ ) {
-			q = VIPS_REGION_ADDR( or, todo.left, todo.top + y );
-			vips_embed_base_copy_pixel( base, q, p, todo.width );
-			p += plsk;
-		}
-	}
+		return( vips_region_prepare_to( ir, or, src,
+			piece->left, piece->top ) );
 	else {
-		/* Horizontal line of pixels to copy.
+		if( vips_region_prepare( ir, src ) )
+			return( -1 );
+		p = VIPS_REGION_ADDR( ir, src->left, src->top );
+		plsk = VIPS_REGION_LSKIP( ir );
+	}
+
+	VIPS_GATE_START( "vips_embed_base_paint_piece: work" );
+
+	for( y = 0; y < piece->height; y++ ) {
+		VipsPel *q = VIPS_REGION_ADDR( or,
+			piece->left, piece->top + y );
+
+		VipsPel *line;
+
+		/* Every line is the same, copy the first one.
 		 */
-		for( y = 0; y < todo.height; y++ ) {
-			q = VIPS_REGION_ADDR( or, todo.left, todo.top + y );
-			memcpy( q, p, bs * todo.width );
+		if( ydir == 0 &&
+			y > 0 ) {
+			memcpy( q, VIPS_REGION_ADDR( or,
+				piece->left, piece->top ), bs * piece->width );
+			continue;
 		}
+
+		if( ydir > 0 )
+			line = p + y * plsk;
+		else if( ydir < 0 )
+			line = p + (piece->height - 1 - y) * plsk;
+		else
+			line = p;
+
+		if( xdir > 0 )
+			memcpy( q, line, bs * piece->width );
+		else if( xdir < 0 )
+			vips__flip_line( q, line, piece->width, bs );
+		else
+			vips_embed_base_copy_pixel( base, q, line,
+				piece->width );
 	}
 
-	VIPS_GATE_STOP( "vips_embed_base_paint_edge: work" );
+	VIPS_GATE_STOP( "vips_embed_base_paint_piece: work" );
+
+	return( 0 );
 }
 
 static int
@@ -232,10 +295,21 @@ vips_embed_base_gen( VipsRegion *or,
 	VipsEmbedBase *base = (VipsEmbedBase *) b;
 	VipsRect *r = &or->valid;
 
-	VipsRect ovl;
+	VipsRect ovl, next;
+	VipsRect piece, src;
 	int i;
-	VipsPel *p;
-	int plsk;
+	int x, y;
+
+	/* Other threads are probably working on the rest of this row of
+	 * tiles, so hint that we'll want the input under us next.
+	 */
+	next = *r;
+	next.top += r->height;
+	vips_rect_intersectrect( &next, &base->rsub, &next );
+	next.left -= base->x;
+	next.top -= base->y;
+	if( !vips_rect_isempty( &next ) )
+		vips_region_prefetch( ir, &next );
 
 	/* Entirely within the input image? Generate the subimage and copy
 	 * pointers.
@@ -297,41 +371,44 @@ vips_embed_base_gen( VipsRegion *or,
 		break;
 
 	case VIPS_EXTEND_COPY:
-		/* Extend the borders.
+	case VIPS_EXTEND_REPEAT:
+	case VIPS_EXTEND_MIRROR:
+		/* Split r into pieces where the input maps across
+		 * in a single run, and paint each one outside the image.
 		 */
-		for( i = 0; i < 8; i++ ) {
-			VipsRect todo;
-			VipsRect edge;
-
-			vips_rect_intersectrect( r, &base->border[i], &todo );
-			if( !vips_rect_isempty( &todo ) ) {
-				vips_embed_base_find_edge( base, 
-					&todo, i, &edge );
-
-				/* Did we paint any of the input image? If we
-				 * did, we can fetch the edge pixels from
-				 * that.
-				 */
-				if( !vips_rect_isempty( &ovl ) ) {
-					p = VIPS_REGION_ADDR( or, 
-						edge.left, edge.top );
-					plsk = VIPS_REGION_LSKIP( or );
-				}
-				else {
-					/* No pixels painted ... fetch
-					 * directly from the input image.
-					 */
-					edge.left -= base->x;
-					edge.top -= base->y;
-					if( vips_region_prepare( ir, &edge ) )
-						return( -1 );
-					p = VIPS_REGION_ADDR( ir,
-						 edge.left, edge.top );
-					plsk = VIPS_REGION_LSKIP( ir );
-				}
-
-				vips_embed_base_paint_edge( base, 
-					or, i, &todo, p, plsk );
+		for( y = r->top; y < VIPS_RECT_BOTTOM( r );
+			y += piece.height ) {
+			int sy, ydir, yrun;
+
+			sy = vips_embed_base_map( base->extend,
+				y - base->y, base->in->Ysize, &ydir, &yrun );
+			piece.top = y;
+			piece.height = VIPS_MIN( yrun,
+				VIPS_RECT_BOTTOM( r ) - y );
+			vips_embed_base_source( sy, ydir, piece.height,
+				&src.top, &src.height );
+
+			for( x = r->left; x < VIPS_RECT_RIGHT( r );
+				x += piece.width ) {
+				int sx, xdir, xrun;
+
+				sx = vips_embed_base_map( base->extend,
+					x - base->x, base->in->Xsize,
+					&xdir, &xrun );
+				piece.left = x;
+				piece.width = VIPS_MIN( xrun,
+					VIPS_RECT_RIGHT( r ) - x );
+				vips_embed_base_source( sx, xdir, piece.width,
+					&src.left, &src.width );
+
+				if( vips_rect_includesrect( &base->rsub,
+					&piece ) )
+					continue;
+
+				if( vips_embed_base_paint_piece( base,
+					or, ir, &ovl, &piece, &src,
+					xdir, ydir ) )
+					return( -1 );
 			}
 		}
 
@@ -350,8 +427,6 @@ vips_embed_base_build( VipsObject *object )
 	VipsObjectClass *class = VIPS_OBJECT_GET_CLASS( object );
 	VipsConversion *conversion = VIPS_CONVERSION( object );
 	VipsEmbedBase *base = (VipsEmbedBase *) object;
-	VipsImage **t = (VipsImage **) vips_object_local_array( object, 7 );
-
 	VipsRect want;
 
 	if( VIPS_OBJECT_CLASS( vips_embed_base_parent_class )->build( object ) )
@@ -377,75 +452,12 @@ vips_embed_base_build( VipsObject *object )
 			return( -1 );
 
 	switch( base->extend ) {
-	case VIPS_EXTEND_REPEAT:
-{
-		/* Clock arithmetic: we want negative x/y to wrap around
-		 * nicely.
-		 */
-		const int nx = base->x < 0 ?
-			-base->x % base->in->Xsize : 
-			base->in->Xsize - base->x % base->in->Xsize;
-		const int ny = base->y < 0 ?
-			-base->y % base->in->Ysize : 
-			base->in->Ysize - base->y % base->in->Ysize;
-
-		if( vips_replicate( base->in, &t[0],
-			base->width / base->in->Xsize + 2, 
-			base->height / base->in->Ysize + 2, NULL ) ||
-			vips_extract_area( t[0], &t[1], 
-				nx, ny, base->width, base->height, NULL ) || 
-			vips_image_write( t[1], conversion->out ) )
-			return( -1 );
-
-}
-		break;
-
-	case VIPS_EXTEND_MIRROR:
-{
-		/* As repeat, but the tiles are twice the size because of
-		 * mirroring.
-		 */
-		const int w2 = base->in->Xsize * 2;
-		const int h2 = base->in->Ysize * 2;
-
-		const int nx = base->x < 0 ? -base->x % w2 : w2 - base->x % w2;
-		const int ny = base->y < 0 ? -base->y % h2 : h2 - base->y % h2;
-
-		if( 
-			/* Make a 2x2 mirror tile.
-			 */
-			vips_flip( base->in, &t[0], 
-				VIPS_DIRECTION_HORIZONTAL, NULL ) ||
-			vips_join( base->in, t[0], &t[1], 
-				VIPS_DIRECTION_HORIZONTAL, NULL ) ||
-			vips_flip( t[1], &t[2], 
-				VIPS_DIRECTION_VERTICAL, NULL ) ||
-			vips_join( t[1], t[2], &t[3], 
-				VIPS_DIRECTION_VERTICAL, NULL ) ||
-
-			/* Repeat, then cut out the centre.
-			 */
-			vips_replicate( t[3], &t[4], 
-				base->width / t[3]->Xsize + 2, 
-				base->height / t[3]->Ysize + 2, NULL ) ||
-			vips_extract_area( t[4], &t[5], 
-				nx, ny, base->width, base->height, NULL ) ||
-
-			/* Overwrite the centre with the in, much faster
-			 * for centre pixels.
-			 */
-			vips_insert( t[5], base->in, &t[6], 
-				base->x, base->y, NULL ) ||
-
-			vips_image_write( t[6], conversion->out ) )
-				return( -1 );
-}
-		break;
-
 	case VIPS_EXTEND_BLACK:
 	case VIPS_EXTEND_WHITE:
 	case VIPS_EXTEND_BACKGROUND:
 	case VIPS_EXTEND_COPY:
+	case VIPS_EXTEND_REPEAT:
+	case VIPS_EXTEND_MIRROR:
 		/* embed is used in many places. We don't really care about
 		 * geometry, so use ANY to avoid disturbing all pipelines. 
 		 */
@@ -471,11 +483,14 @@ vips_embed_base_build( VipsObject *object )
 		want.height = base->in->Ysize;
 		vips_rect_intersectrect( &want, &base->rout, &base->rsub );
 
-		/* FIXME ... actually, it can't. base_find_edge() will fail 
-		 * if rsub is empty. Make this more general at some point 
-		 * and remove this test.
+		/* Copy, repeat and mirror map every pixel back to the input,
+		 * but the solid modes need the image to be somewhere on the
+		 * output.
 		 */
-		if( vips_rect_isempty( &base->rsub ) ) {
+		if( vips_rect_isempty( &base->rsub ) &&
+			(base->extend == VIPS_EXTEND_BLACK ||
+			 base->extend == VIPS_EXTEND_WHITE ||
+			 base->extend == VIPS_EXTEND_BACKGROUND) ) {
 			vips_error( class->nickname, 
 				"%s", _( "bad dimensions" ) );
 			return( -1 );
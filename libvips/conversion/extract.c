@@ -37,6 +37,8 @@
  * 	- gtkdoc
  * 26/10/11
  * 	- redone as a class
+ * 14/10/18
+ * 	- extract_band copies 1, 2, 4 and 8 byte elements as single values
  */
 
 /*
@@ -336,6 +338,16 @@ typedef VipsBandaryClass VipsExtractBandClass;
 
 G_DEFINE_TYPE( VipsExtractBand, vips_extract_band, VIPS_TYPE_BANDARY );
 
+/* Copy every stride-th TYPE from p to q.
+ */
+#define STRIDED_COPY( TYPE ) { \
+	TYPE * restrict tp = (TYPE *) p; \
+	TYPE * restrict tq = (TYPE *) q; \
+	\
+	for( x = 0; x < width; x++ ) \
+		tq[x] = tp[x * stride]; \
+}
+
 static void
 vips_extract_band_buffer( VipsBandarySequence *seq,
 	VipsPel *out, VipsPel **in, int width )
@@ -353,13 +365,35 @@ vips_extract_band_buffer( VipsBandarySequence *seq,
 
 	p = in[0] + extract->band * es;
 	q = out;
-	for( x = 0; x < width; x++ ) {
-		for( z = 0; z < ops; z++ )
-			q[z] = p[z];
 
-		p += ips;
-		q += ops;
+	/* Pulling out a single band (eg. alpha from RGBA) is the common
+	 * case, do it as a strided copy of single values.
+	 */
+	if( ops == es &&
+		(es == 1 || es == 2 || es == 4 || es == 8) &&
+		((size_t) p % es) == 0 &&
+		((size_t) q % es) == 0 &&
+		ips % es == 0 ) {
+		int stride = ips / es;
+
+		switch( es ) {
+		case 1:	STRIDED_COPY( guint8 ); break;
+		case 2:	STRIDED_COPY( guint16 ); break;
+		case 4:	STRIDED_COPY( guint32 ); break;
+		case 8:	STRIDED_COPY( guint64 ); break;
+
+		default:
+			g_assert_not_reached();
+		}
 	}
+	else
+		for( x = 0; x < width; x++ ) {
+			for( z = 0; z < ops; z++ )
+				q[z] = p[z];
+
+			p += ips;
+			q += ops;
+		}
 }
 
 static int
@@ -9,6 +9,8 @@
  * 	- add max_alpha to match vips_premultiply() etc.
  * 25/5/16
  * 	- max_alpha defaults to 65535 for RGB16/GREY16
+ * 14/10/18
+ * 	- add a native RGBA path and join pipeline fusion
  */
 
 /*
@@ -51,8 +53,10 @@
 #include <string.h>
 #include <stdlib.h>
 #include <math.h>
+#include <limits.h>
 
 #include <vips/vips.h>
+#include <vips/simd.h>
 #include <vips/internal.h>
 #include <vips/debug.h>
 
@@ -75,6 +79,13 @@ typedef struct _VipsFlatten {
 	 */
 	double max_alpha;
 
+	/* The format and bands we see, after decode, and the native kernel,
+	 * if any.
+	 */
+	VipsBandFormat format;
+	int bands;
+	VipsSimdFlattenFn simd;
+
 } VipsFlatten;
 
 typedef VipsConversionClass VipsFlattenClass;
@@ -157,27 +168,24 @@ G_DEFINE_TYPE( VipsFlatten, vips_flatten, VIPS_TYPE_CONVERSION );
 	} \
 }
 
-static int
-vips_flatten_black_gen( VipsRegion *or, void *vseq, void *a, void *b,
-	gboolean *stop )
+/* Flatten a line of pixels.
+ */
+static void
+vips_flatten_line( VipsFlatten *flatten,
+	VipsPel *out, VipsPel *in, int width )
 {
-	VipsRegion *ir = (VipsRegion *) vseq;
-	VipsFlatten *flatten = (VipsFlatten *) b;
-	VipsRect *r = &or->valid;
-	int width = r->width;
-	int bands = ir->im->Bands; 
+	int bands = flatten->bands;
 	double max_alpha = flatten->max_alpha;
 
-	int x, y;
-
-	if( vips_region_prepare( ir, r ) )
-		return( -1 );
+	int x;
 
-	for( y = 0; y < r->height; y++ ) {
-		VipsPel *in = VIPS_REGION_ADDR( ir, r->left, r->top + y ); 
-		VipsPel *out = VIPS_REGION_ADDR( or, r->left, r->top + y ); 
+	if( flatten->simd ) {
+		flatten->simd( out, in, width, flatten->ink );
+		return;
+	}
 
-		switch( flatten->in->BandFmt ) { 
+	if( !flatten->ink )
+		switch( flatten->format ) {
 		case VIPS_FORMAT_UCHAR: 
 			VIPS_FLATTEN_BLACK( unsigned char ); 
 			break; 
@@ -187,7 +195,7 @@ vips_flatten_black_gen( VipsRegion *or, void *vseq, void *a, void *b,
 			break; 
 
 		case VIPS_FORMAT_USHORT: 
-			VIPS_FLATTEN_BLACK( unsigned short ); 
+			VIPS_FLATTEN_BLACK_FLOAT( unsigned short );
 			break; 
 
 		case VIPS_FORMAT_SHORT: 
@@ -215,34 +223,8 @@ vips_flatten_black_gen( VipsRegion *or, void *vseq, void *a, void *b,
 		default: 
 			g_assert_not_reached(); 
 		} 
-	}
-
-	return( 0 );
-}
-
-/* Any background.
- */
-static int
-vips_flatten_gen( VipsRegion *or, void *vseq, void *a, void *b,
-	gboolean *stop )
-{
-	VipsRegion *ir = (VipsRegion *) vseq;
-	VipsFlatten *flatten = (VipsFlatten *) b;
-	VipsRect *r = &or->valid;
-	int width = r->width;
-	int bands = ir->im->Bands; 
-	double max_alpha = flatten->max_alpha;
-
-	int x, y;
-
-	if( vips_region_prepare( ir, r ) )
-		return( -1 );
-
-	for( y = 0; y < r->height; y++ ) {
-		VipsPel *in = VIPS_REGION_ADDR( ir, r->left, r->top + y ); 
-		VipsPel *out = VIPS_REGION_ADDR( or, r->left, r->top + y ); 
-
-		switch( flatten->in->BandFmt ) { 
+	else
+		switch( flatten->format ) {
 		case VIPS_FORMAT_UCHAR: 
 			VIPS_FLATTEN( unsigned char ); 
 			break; 
@@ -252,7 +234,7 @@ vips_flatten_gen( VipsRegion *or, void *vseq, void *a, void *b,
 			break; 
 
 		case VIPS_FORMAT_USHORT: 
-			VIPS_FLATTEN( unsigned short ); 
+			VIPS_FLATTEN_FLOAT( unsigned short );
 			break; 
 
 		case VIPS_FORMAT_SHORT: 
@@ -280,11 +262,39 @@ vips_flatten_gen( VipsRegion *or, void *vseq, void *a, void *b,
 		default: 
 			g_assert_not_reached(); 
 		} 
+}
+
+static int
+vips_flatten_gen( VipsRegion *or, void *vseq, void *a, void *b,
+	gboolean *stop )
+{
+	VipsRegion *ir = (VipsRegion *) vseq;
+	VipsFlatten *flatten = (VipsFlatten *) b;
+	VipsRect *r = &or->valid;
+
+	int y;
+
+	if( vips_region_prepare( ir, r ) )
+		return( -1 );
+
+	for( y = 0; y < r->height; y++ ) {
+		VipsPel *in = VIPS_REGION_ADDR( ir, r->left, r->top + y );
+		VipsPel *out = VIPS_REGION_ADDR( or, r->left, r->top + y );
+
+		vips_flatten_line( flatten, out, in, r->width );
 	}
 
 	return( 0 );
 }
 
+/* A line at a time for pipeline fusion, so flatten can run in the same pass
+ * as the cast that usually follows it.
+ */
+static void
+vips_flatten_point( VipsPel *out, VipsPel **in, int width, void *a )
+{
+	vips_flatten_line( (VipsFlatten *) a, out, in[0], width );
+}
 
 static int
 vips_flatten_build( VipsObject *object )
@@ -295,6 +305,7 @@ vips_flatten_build( VipsObject *object )
 	VipsImage **t = (VipsImage **) vips_object_local_array( object, 1 );
 
 	VipsImage *in;
+	VipsImage *point[2];
 	int i;
 	gboolean black;
 
@@ -339,26 +350,38 @@ vips_flatten_build( VipsObject *object )
 			break;
 		}
 
-	if( black ) {
-		if( vips_image_generate( conversion->out,
-			vips_start_one, vips_flatten_black_gen, vips_stop_one, 
-			in, flatten ) )
-			return( -1 );
-	}
-	else {
-		/* Convert the background to the image's format.
-		 */
-		if( !(flatten->ink = vips__vector_to_ink( class->nickname, 
+	/* Convert the background to the image's format.
+	 */
+	if( !black &&
+		!(flatten->ink = vips__vector_to_ink( class->nickname,
 			conversion->out, 
 			VIPS_AREA( flatten->background )->data, NULL, 
 			VIPS_AREA( flatten->background )->n )) )
-			return( -1 );
+		return( -1 );
 
-		if( vips_image_generate( conversion->out,
-			vips_start_one, vips_flatten_gen, vips_stop_one, 
-			in, flatten ) )
-			return( -1 );
-	}
+	/* RGBA uchar and ushort with the full alpha range have a native
+	 * kernel.
+	 */
+	flatten->format = in->BandFmt;
+	flatten->bands = in->Bands;
+	flatten->simd = NULL;
+	if( in->Bands == 4 &&
+		((in->BandFmt == VIPS_FORMAT_UCHAR &&
+		  flatten->max_alpha == UCHAR_MAX) ||
+		 (in->BandFmt == VIPS_FORMAT_USHORT &&
+		  flatten->max_alpha == USHRT_MAX)) )
+		flatten->simd = (VipsSimdFlattenFn)
+			vips_simd_get( VIPS_SIMD_FLATTEN, in->BandFmt );
+
+	if( vips_image_generate( conversion->out,
+		vips_start_one, vips_flatten_gen, vips_stop_one,
+		in, flatten ) )
+		return( -1 );
+
+	point[0] = in;
+	point[1] = NULL;
+	vips__point_attach( conversion->out, point,
+		vips_flatten_point, flatten );
 
 	return( 0 );
 }
@@ -17,6 +17,8 @@
  * 	- gtkdoc
  * 17/10/11
  * 	- redone as a class
+ * 14/10/18
+ * 	- use a SIMD kernel and fixed-size copies for horizontal flips
  */
 
 /*
@@ -60,6 +62,7 @@
 #include <stdlib.h>
 
 #include <vips/vips.h>
+#include <vips/simd.h>
 #include <vips/internal.h>
 #include <vips/debug.h>
 
@@ -127,6 +130,90 @@ vips_flip_vertical_gen( VipsRegion *or, void *seq, void *a, void *b,
 	return( 0 );
 }
 
+/* The SIMD kernels which just move pixels are looked up by the format with the
+ * same size as a pixel. Also used by vips_rot().
+ */
+VipsBandFormat
+vips__pel_format( int ps )
+{
+	switch( ps ) {
+	case 1:
+		return( VIPS_FORMAT_UCHAR );
+
+	case 2:
+		return( VIPS_FORMAT_USHORT );
+
+	case 4:
+		return( VIPS_FORMAT_UINT );
+
+	case 8:
+		return( VIPS_FORMAT_DOUBLE );
+
+	default:
+		return( VIPS_FORMAT_NOTSET );
+	}
+}
+
+/* Copy with a constant size, so the compiler can make a single move.
+ */
+#define FLIP_LINE( N ) { \
+	p += (width - 1) * (N); \
+	for( x = 0; x < width; x++ ) { \
+		memcpy( q, p, (N) ); \
+		q += (N); \
+		p -= (N); \
+	} \
+}
+
+/* Copy width pixels from p to q, reversing their order. Also used by
+ * vips_rot() for 180 degrees.
+ */
+void
+vips__flip_line( VipsPel *q, const VipsPel *p, int width, int ps )
+{
+	VipsBandFormat format = vips__pel_format( ps );
+
+	VipsSimdFlipFn simd;
+	int x;
+
+	if( format != VIPS_FORMAT_NOTSET &&
+		(simd = (VipsSimdFlipFn) vips_simd_get( VIPS_SIMD_FLIP,
+			format )) ) {
+		simd( q, p, width );
+		return;
+	}
+
+	switch( ps ) {
+	case 1:
+		FLIP_LINE( 1 );
+		break;
+
+	case 2:
+		FLIP_LINE( 2 );
+		break;
+
+	case 3:
+		FLIP_LINE( 3 );
+		break;
+
+	case 4:
+		FLIP_LINE( 4 );
+		break;
+
+	case 6:
+		FLIP_LINE( 6 );
+		break;
+
+	case 8:
+		FLIP_LINE( 8 );
+		break;
+
+	default:
+		FLIP_LINE( ps );
+		break;
+	}
+}
+
 static int
 vips_flip_horizontal_gen( VipsRegion *or, void *seq, void *a, void *b, 
 	gboolean *stop )
@@ -134,11 +221,9 @@ vips_flip_horizontal_gen( VipsRegion *or, void *seq, void *a, void *b,
 	VipsRegion *ir = (VipsRegion *) seq;
 	VipsRect *r = &or->valid;
 	VipsRect in;
-	VipsPel *p, *q;
-	int x, y, z;
+	int y;
 
 	int le = r->left;
-	int ri = VIPS_RECT_RIGHT(r);
 	int to = r->top;
 	int bo = VIPS_RECT_BOTTOM(r);
 
@@ -146,17 +231,11 @@ vips_flip_horizontal_gen( VipsRegion *or, void *seq, void *a, void *b,
 
 	int hgt = ir->im->Xsize - r->width;
 
-	int lastx;
-
 	/* Transform to input coordinates.
 	 */
 	in = *r;
 	in.left = hgt - r->left;
 
-	/* Find x of final pixel in input area.
-	 */
-	lastx = VIPS_RECT_RIGHT( &in ) - 1;
-
 	/* Ask for input we need.
 	 */
 	if( vips_region_prepare( ir, &in ) )
@@ -164,22 +243,9 @@ vips_flip_horizontal_gen( VipsRegion *or, void *seq, void *a, void *b,
 
 	/* Loop, copying and reversing lines.
 	 */
-	for( y = to; y < bo; y++ ) {
-		p = VIPS_REGION_ADDR( ir, lastx, y );
-		q = VIPS_REGION_ADDR( or, le, y );
-
-		for( x = le; x < ri; x++ ) {
-			/* Copy the pel.
-			 */
-			for( z = 0; z < ps; z++ )
-				q[z] = p[z];
-
-			/* Skip forwards in out, back in in.
-			 */
-			q += ps;
-			p -= ps;
-		}
-	}
+	for( y = to; y < bo; y++ )
+		vips__flip_line( VIPS_REGION_ADDR( or, le, y ),
+			VIPS_REGION_ADDR( ir, in.left, y ), r->width, ps );
 
 	return( 0 );
 }
@@ -0,0 +1,709 @@
+/* VipsInsertMany
+ *
+ * 15/10/18
+ * 	- from insert.c and arrayjoin.c
+ */
+
+/*
+
+    This file is part of VIPS.
+
+    VIPS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA
+
+ */
+
+/*
+
+    These files are distributed with VIPS - http://www.vips.ecs.soton.ac.uk
+
+ */
+
+/*
+#define VIPS_DEBUG
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /*HAVE_CONFIG_H*/
+#include <vips/intl.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vips/vips.h>
+#include <vips/internal.h>
+#include <vips/debug.h>
+
+#include "pconversion.h"
+
+/* The smallest cell in the spatial index, in pixels. Cells double in size
+ * until there are not too many of them for the number of sub-images.
+ */
+#define INSERT_MANY_CELL (256)
+
+/* Sub-images touching more than this many cells go on a list we always
+ * search, rather than into the grid. This stops a few huge sub-images
+ * blowing up the size of the index.
+ */
+#define INSERT_MANY_MAX_CELLS (64)
+
+typedef struct _VipsInsertMany {
+	VipsConversion parent_instance;
+
+	/* Params.
+	 */
+	VipsImage *main;
+	VipsArrayImage *sub;
+	VipsArrayInt *x;
+	VipsArrayInt *y;
+	gboolean expand;
+	VipsArrayDouble *background;
+
+	/* The number of sub-images.
+	 */
+	int n;
+
+	/* Pixel we paint calculated from background.
+	 */
+	VipsPel *ink;
+
+	/* Inputs cast and banded up. in[0] is main, in[i + 1] is sub i. NULL
+	 * terminated.
+	 */
+	VipsImage **in;
+
+	/* Geometry.
+	 */
+	VipsRect rout;		/* Output space */
+	VipsRect rmain;		/* Position of main in output */
+	VipsRect *rsub;		/* Position of each sub in output */
+
+	/* The spatial index. A grid of cells, each with a list of the subs
+	 * which touch it in z-order, packed into one array. Cell i has
+	 * cell_index[cell_start[i]] to cell_index[cell_start[i + 1] - 1].
+	 */
+	int cell_size;
+	int cells_across;
+	int cells_down;
+	int *cell_start;
+	int *cell_index;
+
+	/* Subs too large for the grid, in z-order.
+	 */
+	int *big;
+	int n_big;
+
+} VipsInsertMany;
+
+typedef VipsConversionClass VipsInsertManyClass;
+
+G_DEFINE_TYPE( VipsInsertMany, vips_insert_many, VIPS_TYPE_CONVERSION );
+
+/* Each thread makes regions on inputs as it reaches them.
+ */
+typedef struct _VipsInsertManySequence {
+	VipsInsertMany *insert;
+
+	/* A region for each input, or NULL if we've not made it yet.
+	 */
+	VipsRegion **ir;
+
+	/* The subs touching the current request, and a stamp for each sub
+	 * so we only add it once.
+	 */
+	int *hits;
+	int n_hits;
+	unsigned int *seen;
+	unsigned int stamp;
+} VipsInsertManySequence;
+
+static int
+vips_insert_many_stop( void *vseq, void *a, void *b )
+{
+	VipsInsertManySequence *seq = (VipsInsertManySequence *) vseq;
+	VipsInsertMany *insert = seq->insert;
+
+	int i;
+
+	if( seq->ir )
+		for( i = 0; i < insert->n + 1; i++ )
+			VIPS_FREEF( vips__region_pool_put, seq->ir[i] );
+
+	VIPS_FREE( seq->ir );
+	VIPS_FREE( seq->hits );
+	VIPS_FREE( seq->seen );
+	VIPS_FREE( seq );
+
+	return( 0 );
+}
+
+static void *
+vips_insert_many_start( VipsImage *out, void *a, void *b )
+{
+	VipsInsertMany *insert = (VipsInsertMany *) b;
+	int n = insert->n;
+
+	VipsInsertManySequence *seq;
+	int i;
+
+	if( !(seq = VIPS_NEW( NULL, VipsInsertManySequence )) )
+		return( NULL );
+	seq->insert = insert;
+	seq->ir = VIPS_ARRAY( NULL, n + 1, VipsRegion * );
+	seq->hits = VIPS_ARRAY( NULL, n, int );
+	seq->n_hits = 0;
+	seq->seen = VIPS_ARRAY( NULL, n, unsigned int );
+	seq->stamp = 0;
+	if( !seq->ir ||
+		!seq->hits ||
+		!seq->seen ) {
+		vips_insert_many_stop( seq, NULL, NULL );
+		return( NULL );
+	}
+
+	for( i = 0; i < n + 1; i++ )
+		seq->ir[i] = NULL;
+	for( i = 0; i < n; i++ )
+		seq->seen[i] = 0;
+
+	return( seq );
+}
+
+/* The region for input i, making it if necessary.
+ */
+static VipsRegion *
+vips_insert_many_region( VipsInsertManySequence *seq, int i )
+{
+	if( !seq->ir[i] &&
+		!(seq->ir[i] = vips__region_pool_get( seq->insert->in[i] )) )
+		return( NULL );
+
+	return( seq->ir[i] );
+}
+
+static void
+vips_insert_many_hit( VipsInsertManySequence *seq, VipsRect *r, int i )
+{
+	VipsInsertMany *insert = seq->insert;
+
+	VipsRect ovl;
+
+	if( seq->seen[i] != seq->stamp ) {
+		seq->seen[i] = seq->stamp;
+
+		vips_rect_intersectrect( &insert->rsub[i], r, &ovl );
+		if( !vips_rect_isempty( &ovl ) ) 
+			seq->hits[seq->n_hits++] = i;
+	}
+}
+
+static int
+vips_insert_many_compare( const void *a, const void *b )
+{
+	return( *((int *) a) - *((int *) b) );
+}
+
+/* Find the subs which touch r, in z-order.
+ */
+static void
+vips_insert_many_find( VipsInsertManySequence *seq, VipsRect *r )
+{
+	VipsInsertMany *insert = seq->insert;
+	int c0 = r->left / insert->cell_size;
+	int c1 = (VIPS_RECT_RIGHT( r ) - 1) / insert->cell_size;
+	int r0 = r->top / insert->cell_size;
+	int r1 = (VIPS_RECT_BOTTOM( r ) - 1) / insert->cell_size;
+
+	int x, y, i;
+
+	/* Start a new set of stamps. On wraparound, reset the lot.
+	 */
+	seq->stamp += 1;
+	if( seq->stamp == 0 ) {
+		for( i = 0; i < insert->n; i++ )
+			seq->seen[i] = 0;
+		seq->stamp = 1;
+	}
+	seq->n_hits = 0;
+
+	for( y = r0; y <= r1; y++ )
+		for( x = c0; x <= c1; x++ ) {
+			int cell = y * insert->cells_across + x;
+
+			for( i = insert->cell_start[cell];
+				i < insert->cell_start[cell + 1]; i++ )
+				vips_insert_many_hit( seq, r,
+					insert->cell_index[i] );
+		}
+
+	for( i = 0; i < insert->n_big; i++ )
+		vips_insert_many_hit( seq, r, insert->big[i] );
+
+	/* Several cells means the hits can be out of order.
+	 */
+	if( seq->n_hits > 1 &&
+		(c0 != c1 || r0 != r1 || insert->n_big > 0) )
+		qsort( seq->hits, seq->n_hits, sizeof( int ),
+			vips_insert_many_compare );
+}
+
+static int
+vips_insert_many_gen( VipsRegion *or, void *vseq,
+	void *a, void *b, gboolean *stop )
+{
+	VipsInsertManySequence *seq = (VipsInsertManySequence *) vseq;
+	VipsInsertMany *insert = (VipsInsertMany *) b;
+	VipsRect *r = &or->valid;
+
+	VipsRegion *ir;
+	int first;
+	int i;
+
+	vips_insert_many_find( seq, r );
+
+	/* The topmost sub which covers all of r hides everything below it.
+	 */
+	for( first = seq->n_hits - 1; first >= 0; first-- )
+		if( vips_rect_includesrect(
+			&insert->rsub[seq->hits[first]], r ) )
+			break;
+
+	if( first >= 0 ) {
+		/* If it's the top one, we can pass the request on.
+		 */
+		if( first == seq->n_hits - 1 ) {
+			i = seq->hits[first];
+
+			if( !(ir = vips_insert_many_region( seq, i + 1 )) )
+				return( -1 );
+
+			return( vips__insert_just_one( or, ir,
+				insert->rsub[i].left, insert->rsub[i].top ) );
+		}
+	}
+	else {
+		/* No sub covers r, so we need main, and perhaps background.
+		 */
+		if( !(ir = vips_insert_many_region( seq, 0 )) )
+			return( -1 );
+
+		if( vips_rect_includesrect( &insert->rmain, r ) ) {
+			if( seq->n_hits == 0 )
+				return( vips__insert_just_one( or, ir,
+					insert->rmain.left,
+					insert->rmain.top ) );
+		}
+		else
+			vips_region_paint_pel( or, r, insert->ink );
+
+		if( vips__insert_paste_region( or, ir, &insert->rmain ) )
+			return( -1 );
+
+		first = 0;
+	}
+
+	for( ; first < seq->n_hits; first++ ) {
+		i = seq->hits[first];
+
+		if( !(ir = vips_insert_many_region( seq, i + 1 )) ||
+			vips__insert_paste_region( or, ir, &insert->rsub[i] ) )
+			return( -1 );
+	}
+
+	return( 0 );
+}
+
+/* Build the grid of cells over the output.
+ */
+static int
+vips_insert_many_index( VipsInsertMany *insert )
+{
+	int n = insert->n;
+
+	int i, x, y;
+	int n_cells;
+	int *fill;
+
+	/* Double the cell size until there are not many more cells than
+	 * subs.
+	 */
+	insert->cell_size = INSERT_MANY_CELL;
+	for(;;) {
+		insert->cells_across = VIPS_ROUND_UP( insert->rout.width,
+			insert->cell_size ) / insert->cell_size;
+		insert->cells_down = VIPS_ROUND_UP( insert->rout.height,
+			insert->cell_size ) / insert->cell_size;
+		n_cells = insert->cells_across * insert->cells_down;
+
+		if( n_cells <= VIPS_MAX( 1024, 16 * n ) )
+			break;
+
+		insert->cell_size *= 2;
+	}
+
+	if( !(insert->cell_start = VIPS_ARRAY( insert, n_cells + 1, int )) ||
+		!(insert->big = VIPS_ARRAY( insert, VIPS_MAX( 1, n ), int )) ||
+		!(fill = VIPS_ARRAY( NULL, n_cells, int )) )
+		return( -1 );
+
+	for( i = 0; i < n_cells + 1; i++ )
+		insert->cell_start[i] = 0;
+	insert->n_big = 0;
+
+	/* Count the subs in each cell. Subs outside the output are dropped,
+	 * and large subs go on the big list. Both passes look at subs in
+	 * order, so each cell is in z-order.
+	 */
+	for( i = 0; i < n; i++ ) {
+		VipsRect clip;
+		int c0, c1, r0, r1;
+
+		vips_rect_intersectrect( &insert->rsub[i], &insert->rout,
+			&clip );
+		if( vips_rect_isempty( &clip ) )
+			continue;
+
+		c0 = clip.left / insert->cell_size;
+		c1 = (VIPS_RECT_RIGHT( &clip ) - 1) / insert->cell_size;
+		r0 = clip.top / insert->cell_size;
+		r1 = (VIPS_RECT_BOTTOM( &clip ) - 1) / insert->cell_size;
+
+		if( (c1 - c0 + 1) * (r1 - r0 + 1) > INSERT_MANY_MAX_CELLS ) {
+			insert->big[insert->n_big++] = i;
+			continue;
+		}
+
+		for( y = r0; y <= r1; y++ )
+			for( x = c0; x <= c1; x++ )
+				insert->cell_start[y * insert->cells_across +
+					x + 1] += 1;
+	}
+
+	for( i = 0; i < n_cells; i++ ) {
+		insert->cell_start[i + 1] += insert->cell_start[i];
+		fill[i] = insert->cell_start[i];
+	}
+
+	if( !(insert->cell_index = VIPS_ARRAY( insert,
+		VIPS_MAX( 1, insert->cell_start[n_cells] ), int )) ) {
+		g_free( fill );
+		return( -1 );
+	}
+
+	for( i = 0; i < n; i++ ) {
+		VipsRect clip;
+		int c0, c1, r0, r1;
+
+		vips_rect_intersectrect( &insert->rsub[i], &insert->rout,
+			&clip );
+		if( vips_rect_isempty( &clip ) )
+			continue;
+
+		c0 = clip.left / insert->cell_size;
+		c1 = (VIPS_RECT_RIGHT( &clip ) - 1) / insert->cell_size;
+		r0 = clip.top / insert->cell_size;
+		r1 = (VIPS_RECT_BOTTOM( &clip ) - 1) / insert->cell_size;
+
+		if( (c1 - c0 + 1) * (r1 - r0 + 1) > INSERT_MANY_MAX_CELLS )
+			continue;
+
+		for( y = r0; y <= r1; y++ )
+			for( x = c0; x <= c1; x++ ) {
+				int cell = y * insert->cells_across + x;
+
+				insert->cell_index[fill[cell]++] = i;
+			}
+	}
+
+	g_free( fill );
+
+	return( 0 );
+}
+
+static int
+vips_insert_many_build( VipsObject *object )
+{
+	VipsObjectClass *class = VIPS_OBJECT_GET_CLASS( object );
+	VipsConversion *conversion = VIPS_CONVERSION( object );
+	VipsInsertMany *insert = (VipsInsertMany *) object;
+
+	VipsImage **sub;
+	VipsImage **in;
+	VipsImage **format;
+	VipsImage **band;
+	int *x;
+	int *y;
+	int i;
+
+	if( VIPS_OBJECT_CLASS( vips_insert_many_parent_class )->
+		build( object ) )
+		return( -1 );
+
+	sub = vips_array_image_get( insert->sub, &insert->n );
+	if( insert->n <= 0 ) {
+		vips_error( class->nickname, "%s", _( "no sub-images" ) );
+		return( -1 );
+	}
+	if( VIPS_AREA( insert->x )->n != insert->n ||
+		VIPS_AREA( insert->y )->n != insert->n ) {
+		vips_error( class->nickname, _( "must be %d x and y positions" ),
+			insert->n );
+		return( -1 );
+	}
+	x = (int *) VIPS_AREA( insert->x )->data;
+	y = (int *) VIPS_AREA( insert->y )->data;
+
+	/* main first, then the subs.
+	 */
+	in = VIPS_ARRAY( object, insert->n + 1, VipsImage * );
+	in[0] = insert->main;
+	for( i = 0; i < insert->n; i++ )
+		in[i + 1] = sub[i];
+
+	if( vips_check_coding_known( class->nickname, insert->main ) )
+		return( -1 );
+	for( i = 0; i < insert->n + 1; i++ )
+		if( vips_image_pio_input( in[i] ) ||
+			vips_check_coding_same( class->nickname,
+				insert->main, in[i] ) )
+			return( -1 );
+
+	/* Cast our input images up to a common format and bands.
+	 */
+	format = (VipsImage **)
+		vips_object_local_array( object, insert->n + 1 );
+	band = (VipsImage **)
+		vips_object_local_array( object, insert->n + 1 );
+	if( vips__formatalike_vec( in, format, insert->n + 1 ) ||
+		vips__bandalike_vec( class->nickname,
+			format, band, insert->n + 1, 1 ) )
+		return( -1 );
+
+	insert->in = VIPS_ARRAY( object, insert->n + 2, VipsImage * );
+	for( i = 0; i < insert->n + 1; i++ )
+		insert->in[i] = band[i];
+	insert->in[insert->n + 1] = NULL;
+
+	/* As insert, SMALLTILE keeps us small and local.
+	 */
+	if( vips_image_pipeline_array( conversion->out,
+		VIPS_DEMAND_STYLE_SMALLTILE, insert->in ) )
+		return( -1 );
+
+	/* Calculate geometry.
+	 */
+	insert->rmain.left = 0;
+	insert->rmain.top = 0;
+	insert->rmain.width = insert->in[0]->Xsize;
+	insert->rmain.height = insert->in[0]->Ysize;
+
+	insert->rsub = VIPS_ARRAY( object, insert->n, VipsRect );
+	for( i = 0; i < insert->n; i++ ) {
+		insert->rsub[i].left = x[i];
+		insert->rsub[i].top = y[i];
+		insert->rsub[i].width = insert->in[i + 1]->Xsize;
+		insert->rsub[i].height = insert->in[i + 1]->Ysize;
+	}
+
+	insert->rout = insert->rmain;
+	if( insert->expand ) {
+		/* Expand output to bounding box of everything.
+		 */
+		for( i = 0; i < insert->n; i++ )
+			vips_rect_unionrect( &insert->rout, &insert->rsub[i],
+				&insert->rout );
+
+		/* Translate origin to top LH corner of rout.
+		 */
+		insert->rmain.left -= insert->rout.left;
+		insert->rmain.top -= insert->rout.top;
+		for( i = 0; i < insert->n; i++ ) {
+			insert->rsub[i].left -= insert->rout.left;
+			insert->rsub[i].top -= insert->rout.top;
+		}
+		insert->rout.left = 0;
+		insert->rout.top = 0;
+	}
+
+	if( insert->rout.width > VIPS_MAX_COORD ||
+		insert->rout.height > VIPS_MAX_COORD ) {
+		vips_error( class->nickname, "%s", _( "output too large" ) );
+		return( -1 );
+	}
+
+	conversion->out->Xsize = insert->rout.width;
+	conversion->out->Ysize = insert->rout.height;
+
+	if( !(insert->ink = vips__vector_to_ink(
+		class->nickname, conversion->out,
+		(double *) VIPS_ARRAY_ADDR( insert->background, 0 ), NULL,
+		VIPS_AREA( insert->background )->n )) )
+		return( -1 );
+
+	if( vips_insert_many_index( insert ) )
+		return( -1 );
+
+	if( vips_image_generate( conversion->out,
+		vips_insert_many_start, vips_insert_many_gen,
+		vips_insert_many_stop,
+		insert->in, insert ) )
+		return( -1 );
+
+	return( 0 );
+}
+
+static void
+vips_insert_many_class_init( VipsInsertManyClass *class )
+{
+	GObjectClass *gobject_class = G_OBJECT_CLASS( class );
+	VipsObjectClass *vobject_class = VIPS_OBJECT_CLASS( class );
+	VipsOperationClass *operation_class = VIPS_OPERATION_CLASS( class );
+
+	VIPS_DEBUG_MSG( "vips_insert_many_class_init\n" );
+
+	gobject_class->set_property = vips_object_set_property;
+	gobject_class->get_property = vips_object_get_property;
+
+	vobject_class->nickname = "insert_many";
+	vobject_class->description =
+		_( "insert an array of images into @main" );
+	vobject_class->build = vips_insert_many_build;
+
+	operation_class->flags = VIPS_OPERATION_SEQUENTIAL;
+
+	VIPS_ARG_IMAGE( class, "main", 0,
+		_( "Main" ),
+		_( "Main input image" ),
+		VIPS_ARGUMENT_REQUIRED_INPUT,
+		G_STRUCT_OFFSET( VipsInsertMany, main ) );
+
+	VIPS_ARG_BOXED( class, "sub", 1,
+		_( "Sub-images" ),
+		_( "Array of images to insert into main image" ),
+		VIPS_ARGUMENT_REQUIRED_INPUT,
+		G_STRUCT_OFFSET( VipsInsertMany, sub ),
+		VIPS_TYPE_ARRAY_IMAGE );
+
+	VIPS_ARG_BOXED( class, "x", 3,
+		_( "X" ),
+		_( "Left edge of each sub in main" ),
+		VIPS_ARGUMENT_REQUIRED_INPUT,
+		G_STRUCT_OFFSET( VipsInsertMany, x ),
+		VIPS_TYPE_ARRAY_INT );
+
+	VIPS_ARG_BOXED( class, "y", 4,
+		_( "Y" ),
+		_( "Top edge of each sub in main" ),
+		VIPS_ARGUMENT_REQUIRED_INPUT,
+		G_STRUCT_OFFSET( VipsInsertMany, y ),
+		VIPS_TYPE_ARRAY_INT );
+
+	VIPS_ARG_BOOL( class, "expand", 5,
+		_( "Expand" ),
+		_( "Expand output to hold all of the inputs" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsInsertMany, expand ),
+		FALSE );
+
+	VIPS_ARG_BOXED( class, "background", 6,
+		_( "Background" ),
+		_( "Color for new pixels" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsInsertMany, background ),
+		VIPS_TYPE_ARRAY_DOUBLE );
+}
+
+static void
+vips_insert_many_init( VipsInsertMany *insert )
+{
+	/* Init our instance fields.
+	 */
+	insert->background = vips_array_double_newv( 1, 0.0 );
+}
+
+static int
+vips_insert_manyv( VipsImage *main, VipsImage **sub, VipsImage **out,
+	int *x, int *y, int n, va_list ap )
+{
+	VipsArrayImage *sub_array;
+	VipsArrayInt *x_array;
+	VipsArrayInt *y_array;
+	int result;
+
+	sub_array = vips_array_image_new( sub, n );
+	x_array = vips_array_int_new( x, n );
+	y_array = vips_array_int_new( y, n );
+	result = vips_call_split( "insert_many", ap,
+		main, sub_array, out, x_array, y_array );
+	vips_area_unref( VIPS_AREA( sub_array ) );
+	vips_area_unref( VIPS_AREA( x_array ) );
+	vips_area_unref( VIPS_AREA( y_array ) );
+
+	return( result );
+}
+
+/**
+ * vips_insert_many: (method)
+ * @main: big image
+ * @sub: (array length=n) (transfer none): array of small images
+ * @out: (out): output image
+ * @x: (array length=n): left position of each @sub
+ * @y: (array length=n): top position of each @sub
+ * @n: number of sub-images
+ * @...: %NULL-terminated list of optional named arguments
+ *
+ * Optional arguments:
+ *
+ * * @expand: expand output to hold all of the images
+ * * @background: colour for new pixels
+ *
+ * Insert each of @sub into @main at the matching position in @x, @y.
+ *
+ * This makes the same image as a chain of vips_insert() calls, each taking
+ * the previous result as its main image, but in a single operation. The
+ * positions are indexed with a grid over the output, so each output
+ * tile only visits the sub-images which touch it, and the pipeline does not
+ * get deeper as you add sub-images. Use it for placing many sprites or
+ * labels on a canvas.
+ *
+ * Later images in @sub appear on top of earlier ones, and all appear on top
+ * of @main.
+ *
+ * Normally @out shows the whole of @main. If @expand is #TRUE then @out is
+ * made large enough to hold all of @main and every @sub.
+ * Any areas of @out not coming from
+ * @main or @sub are set to @background (default 0).
+ *
+ * Images are cast to a common number of bands and format, as vips_insert().
+ *
+ * See also: vips_insert(), vips_arrayjoin(), vips_composite().
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int
+vips_insert_many( VipsImage *main, VipsImage **sub, VipsImage **out,
+	int *x, int *y, int n, ... )
+{
+	va_list ap;
+	int result;
+
+	va_start( ap, n );
+	result = vips_insert_manyv( main, sub, out, x, y, n, ap );
+	va_end( ap );
+
+	return( result );
+}
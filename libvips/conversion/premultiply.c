@@ -9,6 +9,8 @@
  * 	- max_alpha defaults to 65535 for RGB16/GREY16
  * 24/11/17 lovell
  * 	- match normalised alpha to output type
+ * 14/10/18
+ * 	- add a native RGBA path and join pipeline fusion
  */
 
 /*
@@ -53,6 +55,7 @@
 #include <math.h>
 
 #include <vips/vips.h>
+#include <vips/simd.h>
 #include <vips/internal.h>
 #include <vips/debug.h>
 
@@ -65,6 +68,13 @@ typedef struct _VipsPremultiply {
 
 	double max_alpha;
 
+	/* The format and bands we see, after decode, and the native kernel,
+	 * if any.
+	 */
+	VipsBandFormat format;
+	int bands;
+	VipsSimdAlphaFn simd;
+
 } VipsPremultiply;
 
 typedef VipsConversionClass VipsPremultiplyClass;
@@ -121,19 +131,71 @@ G_DEFINE_TYPE( VipsPremultiply, vips_premultiply, VIPS_TYPE_CONVERSION );
 	} \
 }
 
+/* Premultiply a line of pixels.
+ */
+static void
+vips_premultiply_line( VipsPremultiply *premultiply,
+	VipsPel *out, VipsPel *in, int width )
+{
+	int bands = premultiply->bands;
+	double max_alpha = premultiply->max_alpha;
+
+	int x, i;
+
+	if( premultiply->simd ) {
+		premultiply->simd( (float *) out, in, width, max_alpha );
+		return;
+	}
+
+	switch( premultiply->format ) {
+	case VIPS_FORMAT_UCHAR:
+		PRE( unsigned char, float );
+		break;
+
+	case VIPS_FORMAT_CHAR:
+		PRE( signed char, float );
+		break;
+
+	case VIPS_FORMAT_USHORT:
+		PRE( unsigned short, float );
+		break;
+
+	case VIPS_FORMAT_SHORT:
+		PRE( signed short, float );
+		break;
+
+	case VIPS_FORMAT_UINT:
+		PRE( unsigned int, float );
+		break;
+
+	case VIPS_FORMAT_INT:
+		PRE( signed int, float );
+		break;
+
+	case VIPS_FORMAT_FLOAT:
+		PRE( float, float );
+		break;
+
+	case VIPS_FORMAT_DOUBLE:
+		PRE( double, double );
+		break;
+
+	case VIPS_FORMAT_COMPLEX:
+	case VIPS_FORMAT_DPCOMPLEX:
+	default:
+		g_assert_not_reached();
+	}
+}
+
 static int
 vips_premultiply_gen( VipsRegion *or, void *vseq, void *a, void *b,
 	gboolean *stop )
 {
 	VipsPremultiply *premultiply = (VipsPremultiply *) b;
 	VipsRegion *ir = (VipsRegion *) vseq;
-	VipsImage *im = ir->im;
 	VipsRect *r = &or->valid;
-	int width = r->width;
-	int bands = im->Bands; 
-	double max_alpha = premultiply->max_alpha;
 
-	int x, y, i;
+	int y;
 
 	if( vips_region_prepare( ir, r ) )
 		return( -1 );
@@ -142,49 +204,19 @@ vips_premultiply_gen( VipsRegion *or, void *vseq, void *a, void *b,
 		VipsPel *in = VIPS_REGION_ADDR( ir, r->left, r->top + y ); 
 		VipsPel *out = VIPS_REGION_ADDR( or, r->left, r->top + y ); 
 
-		switch( im->BandFmt ) { 
-		case VIPS_FORMAT_UCHAR: 
-			PRE( unsigned char, float ); 
-			break; 
-
-		case VIPS_FORMAT_CHAR: 
-			PRE( signed char, float ); 
-			break; 
-
-		case VIPS_FORMAT_USHORT: 
-			PRE( unsigned short, float ); 
-			break; 
-
-		case VIPS_FORMAT_SHORT: 
-			PRE( signed short, float ); 
-			break; 
-
-		case VIPS_FORMAT_UINT: 
-			PRE( unsigned int, float ); 
-			break; 
-
-		case VIPS_FORMAT_INT: 
-			PRE( signed int, float ); 
-			break; 
-
-		case VIPS_FORMAT_FLOAT: 
-			PRE( float, float ); 
-			break; 
-
-		case VIPS_FORMAT_DOUBLE: 
-			PRE( double, double ); 
-			break; 
-
-		case VIPS_FORMAT_COMPLEX: 
-		case VIPS_FORMAT_DPCOMPLEX: 
-		default: 
-			g_assert_not_reached(); 
-		} 
+		vips_premultiply_line( premultiply, out, in, r->width );
 	}
 
 	return( 0 );
 }
 
+/* A line at a time for pipeline fusion.
+ */
+static void
+vips_premultiply_point( VipsPel *out, VipsPel **in, int width, void *a )
+{
+	vips_premultiply_line( (VipsPremultiply *) a, out, in[0], width );
+}
 
 static int
 vips_premultiply_build( VipsObject *object )
@@ -195,6 +227,7 @@ vips_premultiply_build( VipsObject *object )
 	VipsImage **t = (VipsImage **) vips_object_local_array( object, 1 );
 
 	VipsImage *in;
+	VipsImage *point[2];
 
 	if( VIPS_OBJECT_CLASS( vips_premultiply_parent_class )->
 		build( object ) )
@@ -231,11 +264,26 @@ vips_premultiply_build( VipsObject *object )
 	else
 		conversion->out->BandFmt = VIPS_FORMAT_FLOAT;
 
+	/* RGBA in the common formats has a native kernel.
+	 */
+	premultiply->format = in->BandFmt;
+	premultiply->bands = in->Bands;
+	premultiply->simd = NULL;
+	if( in->Bands == 4 &&
+		premultiply->max_alpha > 0 )
+		premultiply->simd = (VipsSimdAlphaFn)
+			vips_simd_get( VIPS_SIMD_PREMULTIPLY, in->BandFmt );
+
 	if( vips_image_generate( conversion->out,
 		vips_start_one, vips_premultiply_gen, vips_stop_one, 
 		in, premultiply ) )
 		return( -1 );
 
+	point[0] = in;
+	point[1] = NULL;
+	vips__point_attach( conversion->out, point,
+		vips_premultiply_point, premultiply );
+
 	return( 0 );
 }
 
@@ -7,6 +7,8 @@
  * 	- gtkdoc
  * 9/11/11
  * 	- redo as a class
+ * 14/10/18
+ * 	- fixed-size loops for 3 and 4 band matrices
  */
 
 /*
@@ -96,6 +98,53 @@ G_DEFINE_TYPE( VipsRecomb, vips_recomb, VIPS_TYPE_CONVERSION );
 	} \
 }
 
+/* Inner loop for a W band to H band matrix. With a fixed size the compiler
+ * can unroll the loops and keep the coefficients in registers. The sums are
+ * done in the same order as LOOP(), so the result is the same.
+ */
+#define LOOPN( IN, OUT, W, H ) { \
+	IN * restrict p = (IN *) in; \
+	OUT * restrict q = (OUT *) out; \
+	double * restrict m = VIPS_MATRIX( recomb->coeff, 0, 0 ); \
+	\
+	for( x = 0; x < or->valid.width; x++ ) { \
+		for( v = 0; v < H; v++ ) { \
+			double t; \
+			\
+			t = 0.0; \
+			\
+			for( u = 0; u < W; u++ ) \
+				t += m[v * W + u] * p[u]; \
+			\
+			q[v] = (OUT) t; \
+		} \
+		\
+		p += W; \
+		q += H; \
+	} \
+}
+
+#define LOOP33( IN, OUT ) LOOPN( IN, OUT, 3, 3 )
+#define LOOP34( IN, OUT ) LOOPN( IN, OUT, 3, 4 )
+#define LOOP43( IN, OUT ) LOOPN( IN, OUT, 4, 3 )
+#define LOOP44( IN, OUT ) LOOPN( IN, OUT, 4, 4 )
+
+#define SWITCH( LOOP ) { \
+	switch( vips_image_get_format( im ) ) { \
+	case VIPS_FORMAT_UCHAR: LOOP( unsigned char, float ); break; \
+	case VIPS_FORMAT_CHAR: 	LOOP( signed char, float ); break; \
+	case VIPS_FORMAT_USHORT:LOOP( unsigned short, float ); break; \
+	case VIPS_FORMAT_SHORT: LOOP( signed short, float ); break; \
+	case VIPS_FORMAT_UINT: 	LOOP( unsigned int, float ); break; \
+	case VIPS_FORMAT_INT: 	LOOP( signed int, float );  break; \
+	case VIPS_FORMAT_FLOAT: LOOP( float, float ); break; \
+	case VIPS_FORMAT_DOUBLE:LOOP( double, double ); break; \
+	\
+	default: \
+		g_assert_not_reached(); \
+	} \
+}
+
 static int
 vips_recomb_gen( VipsRegion *or, 
 	void *seq, void *a, void *b, gboolean *stop )
@@ -117,19 +166,16 @@ vips_recomb_gen( VipsRegion *or,
 		VipsPel *out = VIPS_REGION_ADDR( or, 
 			or->valid.left, or->valid.top + y );
 
-		switch( vips_image_get_format( im ) ) {
-		case VIPS_FORMAT_UCHAR: LOOP( unsigned char, float ); break;
-		case VIPS_FORMAT_CHAR: 	LOOP( signed char, float ); break; 
-		case VIPS_FORMAT_USHORT:LOOP( unsigned short, float ); break; 
-		case VIPS_FORMAT_SHORT: LOOP( signed short, float ); break; 
-		case VIPS_FORMAT_UINT: 	LOOP( unsigned int, float ); break; 
-		case VIPS_FORMAT_INT: 	LOOP( signed int, float );  break; 
-		case VIPS_FORMAT_FLOAT: LOOP( float, float ); break; 
-		case VIPS_FORMAT_DOUBLE:LOOP( double, double ); break; 
-
-		default:
-			g_assert_not_reached();
-		}
+		if( mwidth == 3 && mheight == 3 )
+			SWITCH( LOOP33 )
+		else if( mwidth == 3 && mheight == 4 )
+			SWITCH( LOOP34 )
+		else if( mwidth == 4 && mheight == 3 )
+			SWITCH( LOOP43 )
+		else if( mwidth == 4 && mheight == 4 )
+			SWITCH( LOOP44 )
+		else
+			SWITCH( LOOP )
 	}
 
 	return( 0 );
@@ -28,6 +28,8 @@
  * 	- rewrite as a class
  * 7/3/17
  * 	- added 90/180/270 convenience functions
+ * 14/10/18
+ * 	- transpose in cache-sized blocks, with SIMD kernels where we can
  */
 
 /*
@@ -71,6 +73,7 @@
 #include <stdlib.h>
 
 #include <vips/vips.h>
+#include <vips/simd.h>
 #include <vips/internal.h>
 #include <vips/debug.h>
 
@@ -87,18 +90,107 @@ typedef struct _VipsRot {
 	 */
 	VipsAngle angle;
 
+	/* The transpose kernel for this pixel size, or NULL.
+	 */
+	VipsSimdTransposeFn transpose;
+
 } VipsRot;
 
 typedef VipsConversionClass VipsRotClass;
 
 G_DEFINE_TYPE( VipsRot, vips_rot, VIPS_TYPE_CONVERSION );
 
+/* Transpose in blocks of this many pixels, so the lines we read and the
+ * lines we write all stay in cache.
+ */
+#define VIPS_ROT_BLOCK (32)
+
+/* Copy with a constant size, so the compiler can make a single move.
+ */
+#define TRANSPOSE( N ) { \
+	for( j = 0; j < height; j++ ) { \
+		VipsPel *q = out + j * out_lskip; \
+		const VipsPel *p = in + j * (N); \
+		\
+		for( i = 0; i < width; i++ ) { \
+			memcpy( q, p, (N) ); \
+			q += (N); \
+			p += in_lskip; \
+		} \
+	} \
+}
+
+static void
+vips_rot_transpose_block( VipsPel *out, int out_lskip,
+	const VipsPel *in, int in_lskip, int width, int height, int ps )
+{
+	int i, j;
+
+	switch( ps ) {
+	case 1:
+		TRANSPOSE( 1 );
+		break;
+
+	case 2:
+		TRANSPOSE( 2 );
+		break;
+
+	case 3:
+		TRANSPOSE( 3 );
+		break;
+
+	case 4:
+		TRANSPOSE( 4 );
+		break;
+
+	case 6:
+		TRANSPOSE( 6 );
+		break;
+
+	case 8:
+		TRANSPOSE( 8 );
+		break;
+
+	default:
+		TRANSPOSE( ps );
+		break;
+	}
+}
+
+/* Transpose width x height pixels: pixel i of output line j is pixel j of
+ * input line i. We rotate by making one of the lskips negative.
+ */
+static void
+vips_rot_transpose( VipsRot *rot, VipsPel *out, int out_lskip,
+	const VipsPel *in, int in_lskip, int width, int height )
+{
+	int ps = VIPS_IMAGE_SIZEOF_PEL( rot->in );
+
+	int i, j;
+
+	for( j = 0; j < height; j += VIPS_ROT_BLOCK )
+		for( i = 0; i < width; i += VIPS_ROT_BLOCK ) {
+			int bw = VIPS_MIN( VIPS_ROT_BLOCK, width - i );
+			int bh = VIPS_MIN( VIPS_ROT_BLOCK, height - j );
+			VipsPel *q = out + j * out_lskip + i * ps;
+			const VipsPel *p = in + i * in_lskip + j * ps;
+
+			if( rot->transpose )
+				rot->transpose( q, out_lskip,
+					p, in_lskip, bw, bh );
+			else
+				vips_rot_transpose_block( q, out_lskip,
+					p, in_lskip, bw, bh, ps );
+		}
+}
+
 static int
 vips_rot90_gen( VipsRegion *or, void *seq, void *a, void *b,
 	gboolean *stop )
 {
 	VipsRegion *ir = (VipsRegion *) seq;
 	VipsImage *in = (VipsImage *) a;
+	VipsRot *rot = (VipsRot *) b;
 
 	/* Output area.
 	 */
@@ -106,13 +198,6 @@ vips_rot90_gen( VipsRegion *or, void *seq, void *a, void *b,
 	int le = r->left;
 	int ri = VIPS_RECT_RIGHT(r);
 	int to = r->top;
-	int bo = VIPS_RECT_BOTTOM(r);
-
-	int x, y, i;
-
-	/* Pixel geometry.
-	 */
-	int ps, ls;
 
 	/* Find the area of the input image we need.
 	 */
@@ -125,32 +210,14 @@ vips_rot90_gen( VipsRegion *or, void *seq, void *a, void *b,
 	if( vips_region_prepare( ir, &need ) )
 		return( -1 );
 	
-	/* Find PEL size and line skip for ir.
-	 */
-	ps = VIPS_IMAGE_SIZEOF_PEL( in );
-	ls = VIPS_REGION_LSKIP( ir );
-
-	/* Rotate the bit we now have.
+	/* Output line j is input column j, read from the bottom up.
 	 */
-	for( y = to; y < bo; y++ ) {
-		/* Start of this output line.
-		 */
-		VipsPel *q = VIPS_REGION_ADDR( or, le, y );
-
-		/* Corresponding position in ir.
-		 */
-		VipsPel *p = VIPS_REGION_ADDR( ir, 
-			need.left + y - to, 
-			need.top + need.height - 1 );
-
-		for( x = le; x < ri; x++ ) {
-			for( i = 0; i < ps; i++ )
-				q[i] = p[i];
-
-			q += ps;
-			p -= ls;
-		}
-	}
+	vips_rot_transpose( rot,
+		VIPS_REGION_ADDR( or, le, to ), VIPS_REGION_LSKIP( or ),
+		VIPS_REGION_ADDR( ir,
+			need.left, VIPS_RECT_BOTTOM( &need ) - 1 ),
+		-VIPS_REGION_LSKIP( ir ),
+		r->width, r->height );
 
 	return( 0 );
 }
@@ -170,7 +237,7 @@ vips_rot180_gen( VipsRegion *or, void *seq, void *a, void *b,
 	int to = r->top;
 	int bo = VIPS_RECT_BOTTOM(r);
 
-	int x, y;
+	int y;
 
 	/* Pixel geometry.
 	 */
@@ -193,25 +260,12 @@ vips_rot180_gen( VipsRegion *or, void *seq, void *a, void *b,
 
 	/* Rotate the bit we now have.
 	 */
-	for( y = to; y < bo; y++ ) {
-		/* Start of this output line.
-		 */
-		VipsPel *q = VIPS_REGION_ADDR( or, le, y );
-
-		/* Corresponding position in ir.
-		 */
-		VipsPel *p = VIPS_REGION_ADDR( ir, 
-			need.left + need.width - 1, 
-			need.top + need.height - (y - to) - 1 );
-
-		/* Blap across!
-		 */
-		for( x = le; x < ri; x++ ) {
-			memcpy( q, p, ps );
-			q += ps;
-			p -= ps;
-		}
-	}
+	for( y = to; y < bo; y++ )
+		vips__flip_line( VIPS_REGION_ADDR( or, le, y ),
+			VIPS_REGION_ADDR( ir,
+				need.left,
+				need.top + need.height - (y - to) - 1 ),
+			r->width, ps );
 
 	return( 0 );
 }
@@ -222,21 +276,14 @@ vips_rot270_gen( VipsRegion *or, void *seq, void *a, void *b,
 {
 	VipsRegion *ir = (VipsRegion *) seq;
 	VipsImage *in = (VipsImage *) a;
+	VipsRot *rot = (VipsRot *) b;
 
 	/* Output area.
 	 */
 	VipsRect *r = &or->valid;
 	int le = r->left;
-	int ri = VIPS_RECT_RIGHT(r);
-	int to = r->top;
 	int bo = VIPS_RECT_BOTTOM(r);
 
-	int x, y, i;
-
-	/* Pixel geometry.
-	 */
-	int ps, ls;
-
 	/* Find the area of the input image we need.
 	 */
 	VipsRect need;
@@ -248,32 +295,13 @@ vips_rot270_gen( VipsRegion *or, void *seq, void *a, void *b,
 	if( vips_region_prepare( ir, &need ) )
 		return( -1 );
 	
-	/* Find PEL size and line skip for ir.
+	/* Output line j, counting up from the bottom, is input column j.
 	 */
-	ps = VIPS_IMAGE_SIZEOF_PEL( in );
-	ls = VIPS_REGION_LSKIP( ir );
-
-	/* Rotate the bit we now have.
-	 */
-	for( y = to; y < bo; y++ ) {
-		/* Start of this output line.
-		 */
-		VipsPel *q = VIPS_REGION_ADDR( or, le, y );
-
-		/* Corresponding position in ir.
-		 */
-		VipsPel *p = VIPS_REGION_ADDR( ir, 
-			need.left + need.width - (y - to) - 1,
-			need.top );
-
-		for( x = le; x < ri; x++ ) {
-			for( i = 0; i < ps; i++ )
-				q[i] = p[i];
-
-			q += ps;
-			p += ls;
-		}
-	}
+	vips_rot_transpose( rot,
+		VIPS_REGION_ADDR( or, le, bo - 1 ), -VIPS_REGION_LSKIP( or ),
+		VIPS_REGION_ADDR( ir, need.left, need.top ),
+		VIPS_REGION_LSKIP( ir ),
+		r->width, r->height );
 
 	return( 0 );
 }
@@ -286,6 +314,7 @@ vips_rot_build( VipsObject *object )
 
 	VipsGenerateFn generate_fn;
 	VipsDemandStyle hint;
+	VipsBandFormat format;
 
 	if( VIPS_OBJECT_CLASS( vips_rot_parent_class )->build( object ) )
 		return( -1 );
@@ -296,6 +325,11 @@ vips_rot_build( VipsObject *object )
 	if( vips_image_pio_input( rot->in ) )
 		return( -1 );
 
+	format = vips__pel_format( VIPS_IMAGE_SIZEOF_PEL( rot->in ) );
+	if( format != VIPS_FORMAT_NOTSET )
+		rot->transpose = (VipsSimdTransposeFn)
+			vips_simd_get( VIPS_SIMD_TRANSPOSE, format );
+
 	hint = rot->angle == VIPS_ANGLE_D180 ? 
 		VIPS_DEMAND_STYLE_THINSTRIP :
 		VIPS_DEMAND_STYLE_SMALLTILE; 
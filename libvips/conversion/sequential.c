@@ -23,6 +23,12 @@
  * 	- re-enable skipahead now we have the single-thread-first-tile idea
  * 6/3/17
  * 	- deprecate @trace, @access now seq is much simpler
+ * 14/10/18
+ * 	- only one thread reads from the source, and it reads ahead for
+ * 	  threads waiting on it, everyone else serves from cache without
+ * 	  the lock
+ * 	- limit read-ahead so lines other threads still need stay in the
+ * 	  linecache
  */
 
 /*
@@ -80,15 +86,40 @@ typedef struct _VipsSequential {
 	VipsAccess access;
 	gboolean trace;
 
-	/* Lock access to y_pos with this.
+	/* Lock access to y_pos, reading, wanted and error with this.
 	 */
 	GMutex *lock;
 
+	/* Signalled each time y_pos moves forward, or on error.
+	 */
+	GCond *ready;
+
 	/* The next read from our source will fetch this scanline, ie. it's 0
-	 * when we start.
+	 * when we start. Lines above this are in the cache.
 	 */
 	int y_pos;
 
+	/* Set while one thread is reading from the source. Only one thread
+	 * may read at once, since the source is sequential.
+	 */
+	gboolean reading;
+
+	/* Threads waiting for the reader set this to the bottom of the lines
+	 * they need, and the reader will fetch up to here before it stops.
+	 */
+	int wanted;
+
+	/* Every thread in generate, see VipsSequentialClient. The reader
+	 * must not get so far ahead of these that their lines fall out of
+	 * the linecache.
+	 */
+	GSList *clients;
+
+	/* The number of lines we can read past the lowest line a client 
+	 * needs. A bit less than the size of the linecache.
+	 */
+	int max_ahead;
+
 	/* If one thread gets an error, we must stop all threads, otherwise we
 	 * can stall and never wake.
 	 */
@@ -97,6 +128,14 @@ typedef struct _VipsSequential {
 
 typedef VipsConversionClass VipsSequentialClass;
 
+/* A thread in generate. serving is set once its lines are in the cache and
+ * it's copying them out.
+ */
+typedef struct _VipsSequentialClient {
+	int top;
+	gboolean serving;
+} VipsSequentialClient;
+
 G_DEFINE_TYPE( VipsSequential, vips_sequential, VIPS_TYPE_CONVERSION );
 
 static void
@@ -105,10 +144,106 @@ vips_sequential_dispose( GObject *gobject )
 	VipsSequential *sequential = (VipsSequential *) gobject;
 
 	VIPS_FREEF( vips_g_mutex_free, sequential->lock );
+	VIPS_FREEF( vips_g_cond_free, sequential->ready );
 
 	G_OBJECT_CLASS( vips_sequential_parent_class )->dispose( gobject );
 }
 
+/* The lowest line any client needs. With @serving_only, just clients
+ * copying lines out of the cache, which will finish without us.
+ */
+static int
+vips_sequential_lowest( VipsSequential *sequential, gboolean serving_only )
+{
+	int lowest;
+	GSList *p;
+
+	lowest = sequential->y_pos;
+	for( p = sequential->clients; p; p = p->next ) {
+		VipsSequentialClient *client = (VipsSequentialClient *) p->data;
+
+		if( !serving_only ||
+			client->serving )
+			lowest = VIPS_MIN( lowest, client->top );
+	}
+
+	return( lowest );
+}
+
+/* Read from y_pos down to at least @bottom, and further if other threads
+ * ask for lines while we read. We read in bands of @band lines and move
+ * y_pos after each one, so waiting threads can start as soon as their lines
+ * are there.
+ *
+ * The linecache is only max_ahead lines or so, so we must not get too far 
+ * ahead of threads which have not yet taken their lines from it, or those
+ * lines would have to be read again, out of order. We stop reading ahead
+ * for other threads at that point, and one of them will carry on once the 
+ * early threads are done. For our own lines, we wait for threads copying 
+ * out of the cache to finish.
+ *
+ * Called with the lock held and reading set, returns with the lock held.
+ */
+static int
+vips_sequential_read( VipsSequential *sequential, VipsRegion *ir,
+	int bottom, int band )
+{
+	for(;;) {
+		int lowest;
+		int target;
+		VipsRect area;
+
+		if( sequential->error )
+			return( -1 );
+
+		target = VIPS_MIN( sequential->wanted, 
+			vips_sequential_lowest( sequential, FALSE ) + 
+				sequential->max_ahead );
+		target = VIPS_MAX( bottom, target );
+		if( sequential->y_pos >= target )
+			break;
+
+		area.left = 0;
+		area.top = sequential->y_pos;
+		area.width = 1;
+		area.height = VIPS_MIN( band, target - sequential->y_pos );
+
+		lowest = vips_sequential_lowest( sequential, TRUE );
+		if( lowest < sequential->y_pos &&
+			VIPS_RECT_BOTTOM( &area ) - lowest > 
+				sequential->max_ahead ) {
+			VIPS_GATE_START( "vips_sequential_read: wait" );
+			g_cond_wait( sequential->ready, sequential->lock );
+			VIPS_GATE_STOP( "vips_sequential_read: wait" );
+
+			continue;
+		}
+
+		if( sequential->trace )
+			printf( "vips_sequential_read %p: "
+				"reading lines %d to %d\n",
+				sequential, 
+				area.top, VIPS_RECT_BOTTOM( &area ) );
+
+		/* Don't hold the lock during the read, so threads which
+		 * only need cached lines can keep working.
+		 */
+		g_mutex_unlock( sequential->lock );
+
+		if( vips_region_prepare( ir, &area ) ) {
+			g_mutex_lock( sequential->lock );
+			return( -1 );
+		}
+
+		g_mutex_lock( sequential->lock );
+
+		sequential->y_pos = VIPS_RECT_BOTTOM( &area );
+		g_cond_broadcast( sequential->ready );
+	}
+
+	return( 0 );
+}
+
 static int
 vips_sequential_generate( VipsRegion *or, 
 	void *seq, void *a, void *b, gboolean *stop )
@@ -117,65 +252,80 @@ vips_sequential_generate( VipsRegion *or,
         VipsRect *r = &or->valid;
 	VipsRegion *ir = (VipsRegion *) seq;
 
+	VipsSequentialClient client;
+	int result;
+
 	if( sequential->trace )
 		printf( "vips_sequential_generate %p: "
 			"request for line %d, height %d\n", 
 			sequential, r->top, r->height );
 
-	VIPS_GATE_START( "vips_sequential_generate: wait" );
-
 	g_mutex_lock( sequential->lock );
 
-	VIPS_GATE_STOP( "vips_sequential_generate: wait" );
+	client.top = r->top;
+	client.serving = FALSE;
+	sequential->clients = g_slist_prepend( sequential->clients, &client );
+
+	/* Loop until the lines we need are in the cache. Either we are the
+	 * reader, or we leave a note for the reader and wait.
+	 */
+	while( !sequential->error &&
+		VIPS_RECT_BOTTOM( r ) > sequential->y_pos ) {
+		if( !sequential->reading ) {
+			/* This may be a request for something some way down
+			 * the image, perhaps for extract_area. In fact we
+			 * read the skipped lines to cache, since they may be
+			 * useful.
+			 */
+			sequential->reading = TRUE;
+			if( vips_sequential_read( sequential, ir,
+				VIPS_RECT_BOTTOM( r ),
+				VIPS_MAX( r->height,
+					sequential->tile_height ) ) )
+				sequential->error = -1;
+			sequential->reading = FALSE;
+			g_cond_broadcast( sequential->ready );
+		}
+		else {
+			sequential->wanted = VIPS_MAX( sequential->wanted,
+				VIPS_RECT_BOTTOM( r ) );
+
+			VIPS_GATE_START( "vips_sequential_generate: wait" );
+			g_cond_wait( sequential->ready, sequential->lock );
+			VIPS_GATE_STOP( "vips_sequential_generate: wait" );
+		}
+	}
 
 	/* If we've seen an error, everything must stop.
 	 */
 	if( sequential->error ) {
+		sequential->clients = 
+			g_slist_remove( sequential->clients, &client );
 		g_mutex_unlock( sequential->lock );
 		return( -1 );
 	}
 
-	if( r->top > sequential->y_pos ) {
-		/* This is a request for something some way down the image. 
-		 * Probably the operation is something like extract_area and 
-		 * we should skip the initial part of the image. In fact, 
-		 * we read to cache, since it may be useful.
-		 */
-		VipsRect area;
-
-		if( sequential->trace )
-			printf( "vips_sequential_generate %p: "
-				"skipping to line %d ...\n", 
-				sequential, r->top );
+	client.serving = TRUE;
 
-		area.left = 0;
-		area.top = sequential->y_pos;
-		area.width = 1;
-		area.height = r->top - sequential->y_pos;
-		if( vips_region_prepare( ir, &area ) ) {
-			sequential->error = -1;
-			g_mutex_unlock( sequential->lock );
-			return( -1 );
-		}
-
-		sequential->y_pos = VIPS_RECT_BOTTOM( &area );
-	}
+	g_mutex_unlock( sequential->lock );
 
 	/* This is a request for old or present pixels -- serve from cache.
-	 * This may trigger further, sequential reads.
 	 */
+	result = 0;
 	if( vips_region_prepare( ir, r ) ||
-		vips_region_region( or, ir, r, r->left, r->top ) ) {
-		sequential->error = -1;
-		g_mutex_unlock( sequential->lock );
-		return( -1 );
-	}
-
-	sequential->y_pos = VIPS_MAX( sequential->y_pos, VIPS_RECT_BOTTOM( r ) );
+		vips_region_region( or, ir, r, r->left, r->top ) ) 
+		result = -1;
 
+	/* Our lines are safe in our region now, so the reader can move on.
+	 */
+	g_mutex_lock( sequential->lock );
+	sequential->clients = g_slist_remove( sequential->clients, &client );
+	if( result )
+		sequential->error = -1;
+	g_cond_broadcast( sequential->ready );
 	g_mutex_unlock( sequential->lock );
 
-	return( 0 );
+	return( result );
 }
 
 static int
@@ -185,12 +335,23 @@ vips_sequential_build( VipsObject *object )
 	VipsSequential *sequential = (VipsSequential *) object;
 
 	VipsImage *t;
+	int tile_width;
+	int tile_height;
+	int n_lines;
 
 	VIPS_DEBUG_MSG( "vips_sequential_build\n" );
 
 	if( VIPS_OBJECT_CLASS( vips_sequential_parent_class )->build( object ) )
 		return( -1 );
 
+	/* vips_linecache() keeps 3 * n_lines, see vips_line_cache_build().
+	 * Allow a band of slack for uneven sharding.
+	 */
+	vips_get_tile_size( sequential->in, 
+		&tile_width, &tile_height, &n_lines );
+	sequential->max_ahead = VIPS_MAX( 2 * n_lines, 
+		2 * sequential->tile_height );
+
 	if( vips_linecache( sequential->in, &t, 
 		"tile_height", sequential->tile_height,
 		"access", VIPS_ACCESS_SEQUENTIAL,
@@ -259,6 +420,7 @@ static void
 vips_sequential_init( VipsSequential *sequential )
 {
 	sequential->lock = vips_g_mutex_new();
+	sequential->ready = vips_g_cond_new();
 	sequential->tile_height = 1;
 	sequential->error = 0;
 	sequential->trace = FALSE;
@@ -282,6 +444,12 @@ vips_sequential_init( VipsSequential *sequential )
  * @strip_height can be used to set the size of the tiles that
  * vips_sequential() uses. The default value is 1.
  *
+ * Only one thread reads from @in at a time. Threads which need lines
+ * further down wait for it, and it reads on to cover them before it stops.
+ * Requests for lines which have already been read are served from the cache
+ * without waiting. Time spent waiting shows up in profiles, see
+ * vips_profile_set().
+ *
  * See also: vips_cache(), vips_linecache(), vips_tilecache().
  *
  * Returns: 0 on success, -1 on error.
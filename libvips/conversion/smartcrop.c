@@ -8,6 +8,9 @@
  * 	- revised attention smartcrop
  * 8/6/17
  * 	- revised again
+ * 14/10/18
+ * 	- attention works on a proxy, refines on a fine grid, and can return
+ * 	  several candidates
  */
 
 /*
@@ -64,6 +67,8 @@ typedef struct _VipsSmartcrop {
 	int width;
 	int height;
 	VipsInteresting interesting;
+	int n_candidates;
+	VipsArrayInt *candidates;
 
 } VipsSmartcrop;
 
@@ -185,9 +190,51 @@ pythagoras( VipsSmartcrop *smartcrop, VipsImage *in, VipsImage **out )
 	return( 0 );
 }
 
+/* The attention maps are made on a proxy with the short side no larger than
+ * this.
+ */
+#define VIPS_SMARTCROP_PROXY (512)
+
+/* We pick candidates on a coarse grid, then refine each one on a fine grid.
+ */
+#define VIPS_SMARTCROP_COARSE (32)
+#define VIPS_SMARTCROP_FINE (256)
+
+/* Find the highest point in an area of a one-band float memory image,
+ * skipping points set in mask, if any. FALSE if there's nothing left.
+ */
+static gboolean
+vips_smartcrop_peak( VipsImage *image, VipsRect *area, gboolean *mask,
+	int *x_pos, int *y_pos )
+{
+	gboolean found;
+	float max;
+	int x, y;
+
+	found = FALSE;
+	max = 0.0;
+	for( y = area->top; y < VIPS_RECT_BOTTOM( area ); y++ ) {
+		float *p = (float *) VIPS_IMAGE_ADDR( image, 0, y );
+
+		for( x = area->left; x < VIPS_RECT_RIGHT( area ); x++ )
+			if( (!mask ||
+				!mask[x + y * image->Xsize]) &&
+				(!found || p[x] > max) ) {
+				max = p[x];
+				*x_pos = x;
+				*y_pos = y;
+				found = TRUE;
+			}
+	}
+
+	return( found );
+}
+
+/* Find up to n_candidates crops, best first.
+ */
 static int
 vips_smartcrop_attention( VipsSmartcrop *smartcrop, 
-	VipsImage *in, int *left, int *top )
+	VipsImage *in, int *left, int *top, int *n )
 {
 	/* From smartcrop.js.
 	 */
@@ -195,14 +242,34 @@ vips_smartcrop_attention( VipsSmartcrop *smartcrop,
 	static double ones[] = {1.0, 1.0, 1.0};
 
 	VipsImage **t = (VipsImage **) 
-		vips_object_local_array( VIPS_OBJECT( smartcrop ), 24 );
+		vips_object_local_array( VIPS_OBJECT( smartcrop ), 31 );
 
+	VipsImage *proxy;
+	VipsImage *coarse;
+	VipsImage *fine;
+	double scale;
 	double hscale;
 	double vscale;
 	double sigma;
-	double max;
-	int x_pos;
-	int y_pos;
+	gboolean *mask;
+	VipsRect whole;
+	VipsRect fine_area;
+	int i;
+
+	/* Smartcrop only needs to find the general area of interest, so we
+	 * can work on a much smaller image. Callers who can shrink on load,
+	 * like vips_thumbnail(), should do so before calling us.
+	 */
+	proxy = in;
+	scale = (double) VIPS_SMARTCROP_PROXY /
+		VIPS_MIN( in->Xsize, in->Ysize );
+	if( scale < 1.0 ) {
+		if( vips_resize( in, &t[22], scale,
+			"kernel", VIPS_KERNEL_LINEAR,
+			NULL ) )
+			return( -1 );
+		proxy = t[22];
+	}
 
 	/* Simple edge detect.
 	 */
@@ -214,7 +281,8 @@ vips_smartcrop_attention( VipsSmartcrop *smartcrop,
 
 	/* Convert to XYZ and just use the first three bands.
 	 */
-	if( vips_colourspace( in, &t[0], VIPS_INTERPRETATION_XYZ, NULL ) ||
+	if( vips_colourspace( proxy, &t[0],
+			VIPS_INTERPRETATION_XYZ, NULL ) ||
 		vips_extract_band( t[0], &t[1], 0, "n", 3, NULL ) )
 		return( -1 );
 
@@ -260,34 +328,137 @@ vips_smartcrop_attention( VipsSmartcrop *smartcrop,
 		vips_ifthenelse( t[10], t[13], t[11], &t[16], NULL ) )
 		return( -1 );
 
-	/* Sum, shrink, blur and find maxpos. 
+	/* Sum, and render the map to memory, since we shrink it twice.
+	 */
+	if( vips_sum( &t[14], &t[17], 3, NULL ) ||
+		vips_cast_float( t[17], &t[23], NULL ) ||
+		!(t[24] = vips_image_copy_memory( t[23] )) )
+		return( -1 );
+
+	/* Shrink, blur and render to both grids.
 	 *
 	 * The size we shrink to gives the precision with which we can place 
 	 * the crop, the amount of blur is related to the size of the crop
 	 * area: how large an area we want to consider for the scoring
 	 * function.
 	 */
-	hscale = 32.0 / in->Xsize;
-	vscale = 32.0 / in->Ysize;
+	hscale = (double) VIPS_SMARTCROP_COARSE / in->Xsize;
+	vscale = (double) VIPS_SMARTCROP_COARSE / in->Ysize;
 	sigma = VIPS_MAX( sqrt( pow( smartcrop->width * hscale, 2 ) +
 		pow( smartcrop->height * vscale, 2 ) ) / 10, 1.0 );
-	if( vips_sum( &t[14], &t[17], 3, NULL ) ||
-		vips_resize( t[17], &t[18], hscale, 
-			"vscale", vscale, 
+	if( vips_resize( t[24], &t[18],
+			(double) VIPS_SMARTCROP_COARSE / proxy->Xsize,
+			"vscale", (double) VIPS_SMARTCROP_COARSE / proxy->Ysize,
 			"kernel", VIPS_KERNEL_LINEAR, 
 			NULL ) ||
 		vips_gaussblur( t[18], &t[19], sigma, NULL ) ||
-		vips_max( t[19], &max, "x", &x_pos, "y", &y_pos, NULL ) )
+		vips_cast_float( t[19], &t[29], NULL ) ||
+		!(t[25] = vips_image_copy_memory( t[29] )) ||
+		vips_resize( t[24], &t[26],
+			(double) VIPS_SMARTCROP_FINE / proxy->Xsize,
+			"vscale", (double) VIPS_SMARTCROP_FINE / proxy->Ysize,
+			"kernel", VIPS_KERNEL_LINEAR,
+			NULL ) ||
+		vips_gaussblur( t[26], &t[27], sigma *
+			VIPS_SMARTCROP_FINE / VIPS_SMARTCROP_COARSE, NULL ) ||
+		vips_cast_float( t[27], &t[30], NULL ) ||
+		!(t[28] = vips_image_copy_memory( t[30] )) )
 		return( -1 ); 
+	coarse = t[25];
+	fine = t[28];
 
-	/* Centre the crop over the max.
+	/* Coarse cells we have already covered by a candidate.
 	 */
-	*left = VIPS_CLIP( 0, 
-		x_pos / hscale - smartcrop->width / 2, 
-		in->Xsize - smartcrop->width );
-	*top = VIPS_CLIP( 0, 
-		y_pos / vscale - smartcrop->height / 2, 
-		in->Ysize - smartcrop->height ); 
+	if( !(mask = VIPS_ARRAY( smartcrop,
+		coarse->Xsize * coarse->Ysize, gboolean )) )
+		return( -1 );
+	memset( mask, 0, coarse->Xsize * coarse->Ysize * sizeof( gboolean ) );
+
+	whole.left = 0;
+	whole.top = 0;
+	whole.width = coarse->Xsize;
+	whole.height = coarse->Ysize;
+	fine_area.left = 0;
+	fine_area.top = 0;
+	fine_area.width = fine->Xsize;
+	fine_area.height = fine->Ysize;
+
+	*n = 0;
+	for( i = 0; i < smartcrop->n_candidates; i++ ) {
+		/* Half the crop area, in coarse cells.
+		 */
+		int cw = VIPS_MAX( 1, smartcrop->width *
+			coarse->Xsize / (2 * in->Xsize) );
+		int ch = VIPS_MAX( 1, smartcrop->height *
+			coarse->Ysize / (2 * in->Ysize) );
+		int kx = VIPS_MAX( 1, fine->Xsize / coarse->Xsize );
+		int ky = VIPS_MAX( 1, fine->Ysize / coarse->Ysize );
+
+		int x_pos, y_pos;
+		int x, y;
+		VipsRect near;
+		int crop_left, crop_top;
+		int j;
+
+		if( !vips_smartcrop_peak( coarse, &whole, mask,
+			&x_pos, &y_pos ) )
+			break;
+
+		/* Later candidates should be somewhere else.
+		 */
+		for( y = y_pos - ch + 1; y < y_pos + ch; y++ )
+			for( x = x_pos - cw + 1; x < x_pos + cw; x++ )
+				if( x >= 0 &&
+					x < coarse->Xsize &&
+					y >= 0 &&
+					y < coarse->Ysize )
+					mask[x + y * coarse->Xsize] = TRUE;
+
+		/* Refine the position on the fine grid, searching one coarse
+		 * cell either side.
+		 */
+		near.left = (x_pos - 1) * kx;
+		near.top = (y_pos - 1) * ky;
+		near.width = 3 * kx;
+		near.height = 3 * ky;
+		vips_rect_intersectrect( &near, &fine_area, &near );
+		if( !vips_smartcrop_peak( fine, &near, NULL,
+			&x_pos, &y_pos ) ) {
+			x_pos *= kx;
+			y_pos *= ky;
+		}
+
+		/* Centre the crop over the max.
+		 */
+		hscale = (double) fine->Xsize / in->Xsize;
+		vscale = (double) fine->Ysize / in->Ysize;
+		crop_left = VIPS_CLIP( 0,
+			x_pos / hscale - smartcrop->width / 2,
+			in->Xsize - smartcrop->width );
+		crop_top = VIPS_CLIP( 0,
+			y_pos / vscale - smartcrop->height / 2,
+			in->Ysize - smartcrop->height );
+
+		/* Several peaks can clip to the same crop.
+		 */
+		for( j = 0; j < *n; j++ )
+			if( left[j] == crop_left &&
+				top[j] == crop_top )
+				break;
+		if( j == *n ) {
+			left[*n] = crop_left;
+			top[*n] = crop_top;
+			*n += 1;
+		}
+	}
+
+	/* Can't happen, but be safe.
+	 */
+	if( *n == 0 ) {
+		left[0] = 0;
+		top[0] = 0;
+		*n = 1;
+	}
 
 	return( 0 ); 
 }
@@ -301,8 +472,12 @@ vips_smartcrop_build( VipsObject *object )
 	VipsImage **t = (VipsImage **) vips_object_local_array( object, 2 );
 
 	VipsImage *in;
-	int left;
-	int top;
+	int *left;
+	int *top;
+	int n;
+	int *pairs;
+	VipsArrayInt *candidates;
+	int i;
 
 	if( VIPS_OBJECT_CLASS( vips_smartcrop_parent_class )->
 		build( object ) )
@@ -327,24 +502,29 @@ vips_smartcrop_build( VipsObject *object )
 		in = t[0];
 	}
 
+	if( !(left = VIPS_ARRAY( object, smartcrop->n_candidates, int )) ||
+		!(top = VIPS_ARRAY( object, smartcrop->n_candidates, int )) )
+		return( -1 );
+	n = 1;
+
 	switch( smartcrop->interesting ) {
 	case VIPS_INTERESTING_NONE:
-		left = 0;
-		top = 0;
+		left[0] = 0;
+		top[0] = 0;
 		break;
 
 	case VIPS_INTERESTING_CENTRE:
-		left = (smartcrop->in->Xsize - smartcrop->width) / 2;
-		top = (smartcrop->in->Ysize - smartcrop->height) / 2;
+		left[0] = (smartcrop->in->Xsize - smartcrop->width) / 2;
+		top[0] = (smartcrop->in->Ysize - smartcrop->height) / 2;
 		break;
 
 	case VIPS_INTERESTING_ENTROPY:
-		if( vips_smartcrop_entropy( smartcrop, in, &left, &top ) )
+		if( vips_smartcrop_entropy( smartcrop, in, &left[0], &top[0] ) )
 			return( -1 );
 		break;
 
 	case VIPS_INTERESTING_ATTENTION:
-		if( vips_smartcrop_attention( smartcrop, in, &left, &top ) )
+		if( vips_smartcrop_attention( smartcrop, in, left, top, &n ) )
 			return( -1 );
 		break;
 
@@ -353,13 +533,24 @@ vips_smartcrop_build( VipsObject *object )
 
 		/* Stop a compiler warning.
 		 */
-		left = 0;
-		top = 0;
+		left[0] = 0;
+		top[0] = 0;
 		break;
 	}
 
+	if( !(pairs = VIPS_ARRAY( object, 2 * n, int )) )
+		return( -1 );
+	for( i = 0; i < n; i++ ) {
+		pairs[2 * i] = left[i];
+		pairs[2 * i + 1] = top[i];
+	}
+	candidates = vips_array_int_new( pairs, 2 * n );
+	g_object_set( smartcrop, "candidates", candidates, NULL );
+	vips_area_unref( VIPS_AREA( candidates ) );
+
 	if( vips_extract_area( smartcrop->in, &t[1], 
-			left, top, smartcrop->width, smartcrop->height, NULL ) ||
+			left[0], top[0],
+			smartcrop->width, smartcrop->height, NULL ) ||
 		vips_image_write( t[1], conversion->out ) )
 		return( -1 ); 
 
@@ -408,12 +599,27 @@ vips_smartcrop_class_init( VipsSmartcropClass *class )
 		G_STRUCT_OFFSET( VipsSmartcrop, interesting ),
 		VIPS_TYPE_INTERESTING, VIPS_INTERESTING_ATTENTION );
 
+	VIPS_ARG_INT( class, "n_candidates", 7,
+		_( "Number of candidates" ),
+		_( "Number of candidate crops to find" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsSmartcrop, n_candidates ),
+		1, 1000, 1 );
+
+	VIPS_ARG_BOXED( class, "candidates", 8,
+		_( "Candidates" ),
+		_( "Left and top of each candidate crop, best first" ),
+		VIPS_ARGUMENT_OPTIONAL_OUTPUT,
+		G_STRUCT_OFFSET( VipsSmartcrop, candidates ),
+		VIPS_TYPE_ARRAY_INT );
+
 }
 
 static void
 vips_smartcrop_init( VipsSmartcrop *smartcrop )
 {
 	smartcrop->interesting = VIPS_INTERESTING_ATTENTION;
+	smartcrop->n_candidates = 1;
 }
 
 /**
@@ -427,6 +633,8 @@ vips_smartcrop_init( VipsSmartcrop *smartcrop )
  * Optional arguments:
  *
  * * @interesting: #VipsInteresting to use to find interesting areas (default: #VIPS_INTERESTING_ATTENTION)
+ * * @n_candidates: %gint, number of candidate crops to find
+ * * @candidates: (out): #VipsArrayInt, left and top of each candidate crop
  *
  * Crop an image down to a specified width and height by removing boring parts. 
  *
@@ -436,6 +644,15 @@ vips_smartcrop_init( VipsSmartcrop *smartcrop )
  * You can test xoffset / yoffset on @out to find the location of the crop
  * within the input image. 
  *
+ * #VIPS_INTERESTING_ATTENTION works on a proxy image with the short side
+ * shrunk to 512 pixels. It picks the best few areas on a coarse grid, then
+ * refines the position of each on a finer grid. Set @n_candidates to
+ * return more than one of these in @candidates, as left, top pairs,
+ * best first. @out is always the first candidate.
+ *
+ * Searching is faster on a smaller image, so if you can shrink on load,
+ * do so and scale the result up, as vips_thumbnail() does.
+ *
  * See also: vips_extract_area().
  * 
  * Returns: 0 on success, -1 on error.
@@ -15,6 +15,10 @@
  * 	- add @point to force point sample mode
  * 22/1/16
  * 	- remove SEQUENTIAL hint, it confuses vips_sequential()
+ * 14/10/18
+ * 	- line mode fetches just the input rows it needs, as wide as will fit
+ * 	  in VIPS_MAX_BYTES, and gathers 1, 2, 4 and 8 byte pels as single
+ * 	  values
  */
 
 /*
@@ -70,12 +74,64 @@ typedef VipsConversionClass VipsSubsampleClass;
 
 G_DEFINE_TYPE( VipsSubsample, vips_subsample, VIPS_TYPE_CONVERSION );
 
-/* Maximum width of input we ask for.
+/* Maximum size of input line we ask for, in bytes.
  */
-#define VIPS_MAX_WIDTH (100)
+#define VIPS_MAX_BYTES (64 * 1024)
 
-/* Subsample a VipsRegion. We fetch in VIPS_MAX_WIDTH pixel-wide strips, 
- * left-to-right across the input.
+/* Copy n pels of TYPE from p to q, taking every xfac-th.
+ */
+#define GATHER( TYPE ) { \
+	TYPE *tp = (TYPE *) p; \
+	TYPE *tq = (TYPE *) q; \
+	\
+	for( z = 0; z < n; z++ ) { \
+		tq[z] = *tp; \
+		tp += xfac; \
+	} \
+}
+
+static void
+vips_subsample_gather( VipsPel *q, VipsPel *p, int n, int ps, int xfac )
+{
+	int z, k;
+
+	if( (ps == 1 || ps == 2 || ps == 4 || ps == 8) &&
+		((size_t) p % ps) == 0 &&
+		((size_t) q % ps) == 0 ) {
+		switch( ps ) {
+		case 1:
+			GATHER( guint8 );
+			break;
+
+		case 2:
+			GATHER( guint16 );
+			break;
+
+		case 4:
+			GATHER( guint32 );
+			break;
+
+		case 8:
+			GATHER( guint64 );
+			break;
+
+		default:
+			g_assert_not_reached();
+		}
+	}
+	else
+		for( z = 0; z < n; z++ ) {
+			for( k = 0; k < ps; k++ )
+				q[k] = p[k];
+
+			q += ps;
+			p += ps * xfac;
+		}
+}
+
+/* Subsample a VipsRegion. For each output line we fetch just the one input
+ * line we sample from, in pieces of at most VIPS_MAX_BYTES, left-to-right
+ * across the input.
  */
 static int
 vips_subsample_line_gen( VipsRegion *or, 
@@ -90,17 +146,16 @@ vips_subsample_line_gen( VipsRegion *or,
 	int to = r->top;
 	int bo = VIPS_RECT_BOTTOM( r );
 	int ps = VIPS_IMAGE_SIZEOF_PEL( in );
-	int owidth = VIPS_MAX_WIDTH / subsample->xfac;
+	int owidth = VIPS_MAX( 1,
+		VIPS_MAX_BYTES / ((size_t) ps * subsample->xfac) );
 
 	VipsRect s;
 	int x, y;
-	int z, k;
 
 	/* Loop down the region.
 	 */
 	for( y = to; y < bo; y++ ) {
 		VipsPel *q = VIPS_REGION_ADDR( or, le, y );
-		VipsPel *p;
 
 		/* Loop across the region, in owidth sized pieces.
 		 */
@@ -125,14 +180,10 @@ vips_subsample_line_gen( VipsRegion *or,
 
 			/* Append new pels to output.
 			 */
-			p = VIPS_REGION_ADDR( ir, s.left, s.top );
-			for( z = 0; z < ow; z++ ) {
-				for( k = 0; k < ps; k++ )
-					q[k] = p[k];
-
-				q += ps;
-				p += ps * subsample->xfac;
-			}
+			vips_subsample_gather( q,
+				VIPS_REGION_ADDR( ir, s.left, s.top ),
+				ow, ps, subsample->xfac );
+			q += ow * ps;
 		}
 	}
 
@@ -212,7 +263,7 @@ vips_subsample_build( VipsObject *object )
 		return( -1 );
 
 	/* Set demand hints. We want THINSTRIP, as we will be demanding a
-	 * large area of input for each output line.
+	 * long line of input for each output line.
 	 */
 	if( vips_image_pipelinev( conversion->out, 
 		VIPS_DEMAND_STYLE_THINSTRIP, subsample->in, NULL ) )
@@ -314,9 +365,9 @@ vips_subsample_init( VipsSubsample *subsample )
  * Subsample an image by an integer fraction. This is fast, nearest-neighbour
  * shrink.
  *
- * For small horizontal shrinks, this operation will fetch lines of pixels
- * from @in and then subsample that line. For large shrinks it will fetch
- * single pixels.
+ * For small horizontal shrinks, this operation will fetch just the lines
+ * of pixels from @in that it samples from and then subsample each line.
+ * For large shrinks it will fetch single pixels.
  *
  * If @point is set, @in will always be sampled in points. This can be faster 
  * if the previous operations in the pipeline are very slow.
@@ -35,6 +35,12 @@
  * 	- terminate on tile calc error
  * 7/3/17
  * 	- remove "access" on linecache, use the base class instead
+ * 14/10/18
+ * 	- pass prefetch hints through to the input
+ * 	- split into shards with their own lock and CLOCK reuse, wait on tiles
+ * 	  individually
+ * 	- add max_spill and spill_file: keep evicted tiles, compressed, in
+ * 	  memory or a temp file, and count hits and misses
  */
 
 /*
@@ -77,6 +83,20 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif /*HAVE_UNISTD_H*/
+#ifdef HAVE_IO_H
+#include <io.h>
+#endif /*HAVE_IO_H*/
+
+#include <glib/gstdio.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif /*HAVE_ZLIB*/
 
 #include <vips/vips.h>
 #include <vips/internal.h>
@@ -84,9 +104,19 @@
 
 #include "pconversion.h"
 
+/* Try to make an O_BINARY ... sometimes need the leading '_'.
+ */
+#ifndef O_BINARY
+#ifdef _O_BINARY
+#define O_BINARY _O_BINARY
+#else /*!_O_BINARY*/
+#define O_BINARY (0)
+#endif /*_O_BINARY*/
+#endif /*!O_BINARY*/
+
 /* A tile in cache can be in one of three states:
  *
- * DATA		- the tile holds valid pixels 
+ * DATA		- the tile holds valid pixels
  * CALC		- some thread somewhere is calculating it
  * PEND		- some thread somewhere wants it
  */
@@ -96,10 +126,52 @@ typedef enum VipsTileState {
 	VIPS_TILE_STATE_PEND
 } VipsTileState;
 
+/* The most shards we split a cache into.
+ */
+#define VIPS_TILE_SHARDS_MAX (16)
+
+/* A shard of a cache. Each shard has its own lock and its own set of tiles,
+ * so threads working on different parts of an image don't contend. Tiles
+ * which don't fit in the shard are reused, see vips_tile_reuse().
+ */
+typedef struct _VipsTileShard {
+	struct _VipsBlockCache *cache;
+
+	GMutex *lock;			/* Lock this shard */
+	GHashTable *tiles;		/* Tiles, hashed by coordinates */
+	GPtrArray *clock;		/* Tiles in sweep order for reuse */
+	int hand;			/* Next tile the sweep looks at */
+	int ntiles;			/* Current shard size */
+
+	/* Evicted tiles we've spilled, see vips_tile_spill(). NULL if the
+	 * cache doesn't spill.
+	 */
+	GHashTable *spilled;		/* Spilled tiles, hashed by position */
+	GQueue *spill_order;		/* Oldest spilled tile first */
+	size_t spill_bytes;		/* Total size of spilled tiles */
+	gint64 spill_base;		/* Our part of the spill file */
+	gint64 spill_head;		/* Next write offset in our part */
+} VipsTileShard;
+
+/* A tile that has been evicted from memory, compressed if we can, and kept
+ * in memory or in the spill file. It's an immutable copy of the pixels.
+ */
+typedef struct _VipsTileSpill {
+	VipsRect pos;			/* Hash key, as for VipsTile */
+
+	size_t size;			/* Bytes of pixels */
+	size_t length;			/* Bytes we keep */
+	gboolean compressed;		/* Set if zlib compressed */
+
+	VipsPel *data;			/* Bytes in memory */
+	gint64 offset;			/* Or at this offset in our part */
+} VipsTileSpill;
+
 /* A tile in our cache.
  */
 typedef struct _VipsTile {
 	struct _VipsBlockCache *cache;
+	VipsTileShard *shard;
 
 	VipsTileState state;
 
@@ -108,50 +180,114 @@ typedef struct _VipsTile {
 	/* We count how many threads are relying on this tile. This tile can't
 	 * be flushed if ref_count > 0.
 	 */
-	int ref_count; 
+	int ref_count;
 
 	/* Tile position. Just use left/top to calculate a hash. This is the
 	 * key for the hash table. Don't use region->valid in case the region
 	 * pointer is NULL.
 	 */
-	VipsRect pos; 
+	VipsRect pos;
+
+	/* Set on every use, cleared as the reuse sweep passes. This gives
+	 * an approximate LRU.
+	 */
+	gboolean used;
 
-	int time;			/* Time of last use for flush */
+	/* Signalled when the tile goes from CALC to DATA.
+	 */
+	GCond *ready;
 } VipsTile;
 
 typedef struct _VipsBlockCache {
 	VipsConversion parent_instance;
 
 	VipsImage *in;
-	int tile_width;	
+	int tile_width;
 	int tile_height;
 	int max_tiles;
 	VipsAccess access;
 	gboolean threaded;
 	gboolean persistent;
+	guint64 max_spill;
+	gboolean spill_file;
 
-	int time;			/* Update ticks for LRU here */
-	int ntiles;			/* Current cache size */
-	GMutex *lock;			/* Lock everything here */
-	GCond *new_tile;		/* A new tile is ready */
-	GHashTable *tiles;		/* Tiles, hashed by coordinates */
+	/* The spill file, if we are spilling to disc, and a lock for IO on
+	 * it.
+	 */
+	char *spill_filename;
+	int spill_fd;
+	GMutex *spill_lock;
+
+	/* Counters for tiles found in memory, found in the spill, and
+	 * calculated. Reported on dispose with --vips-info.
+	 */
+	int hits;
+	int spill_hits;
+	int misses;
+
+	/* Unthreaded caches hold this for the whole of each request. It
+	 * also protects changes to max_tiles.
+	 */
+	GMutex *lock;
+
+	int n_shards;
+	VipsTileShard shard[VIPS_TILE_SHARDS_MAX];
 } VipsBlockCache;
 
 typedef VipsConversionClass VipsBlockCacheClass;
 
-G_DEFINE_ABSTRACT_TYPE( VipsBlockCache, vips_block_cache, 
+G_DEFINE_ABSTRACT_TYPE( VipsBlockCache, vips_block_cache,
 	VIPS_TYPE_CONVERSION );
 
 #define VIPS_TYPE_BLOCK_CACHE (vips_block_cache_get_type())
 
+static void
+vips_tile_spill_free( VipsTileSpill *spill )
+{
+	VIPS_FREE( spill->data );
+	vips_free( spill );
+}
+
+/* Forget the oldest spilled tile in a shard.
+ */
+static void
+vips_tile_spill_drop( VipsTileShard *shard )
+{
+	VipsTileSpill *spill;
+
+	spill = (VipsTileSpill *) g_queue_pop_head( shard->spill_order );
+	shard->spill_bytes -= spill->length;
+	g_hash_table_remove( shard->spilled, &spill->pos );
+}
+
+static void
+vips_tile_spill_drop_all( VipsTileShard *shard )
+{
+	if( shard->spilled ) {
+		g_queue_clear( shard->spill_order );
+		g_hash_table_remove_all( shard->spilled );
+		shard->spill_bytes = 0;
+		shard->spill_head = 0;
+	}
+}
+
 static void
 vips_block_cache_drop_all( VipsBlockCache *cache )
 {
+	int i;
+
 	/* FIXME this is a disaster if active threads are working on tiles. We
 	 * should have something to block new requests, and only dispose once
 	 * all tiles are unreffed.
 	 */
-	g_hash_table_remove_all( cache->tiles ); 
+	for( i = 0; i < cache->n_shards; i++ ) {
+		VipsTileShard *shard = &cache->shard[i];
+
+		g_ptr_array_set_size( shard->clock, 0 );
+		shard->hand = 0;
+		g_hash_table_remove_all( shard->tiles );
+		vips_tile_spill_drop_all( shard );
+	}
 }
 
 static void
@@ -159,39 +295,87 @@ vips_block_cache_dispose( GObject *gobject )
 {
 	VipsBlockCache *cache = (VipsBlockCache *) gobject;
 
+	int i;
+
+	if( cache->hits ||
+		cache->spill_hits ||
+		cache->misses )
+		g_info( "%s: %d hits, %d spill hits, %d misses",
+			VIPS_OBJECT( cache )->nickname,
+			cache->hits, cache->spill_hits, cache->misses );
+
 	vips_block_cache_drop_all( cache );
 	VIPS_FREEF( vips_g_mutex_free, cache->lock );
-	VIPS_FREEF( vips_g_cond_free, cache->new_tile );
 
-	if( cache->tiles )
-		g_assert( g_hash_table_size( cache->tiles ) == 0 );
-	VIPS_FREEF( g_hash_table_destroy, cache->tiles );
+	for( i = 0; i < cache->n_shards; i++ ) {
+		VipsTileShard *shard = &cache->shard[i];
+
+		g_assert( g_hash_table_size( shard->tiles ) == 0 );
+		g_assert( shard->ntiles == 0 );
+
+		VIPS_FREEF( vips_g_mutex_free, shard->lock );
+		VIPS_FREEF( g_hash_table_destroy, shard->tiles );
+		if( shard->clock ) {
+			g_ptr_array_free( shard->clock, TRUE );
+			shard->clock = NULL;
+		}
+		VIPS_FREEF( g_hash_table_destroy, shard->spilled );
+		VIPS_FREEF( g_queue_free, shard->spill_order );
+	}
+	cache->n_shards = 0;
+
+	if( cache->spill_fd != -1 ) {
+		vips_tracked_close( cache->spill_fd );
+		cache->spill_fd = -1;
+	}
+	if( cache->spill_filename ) {
+		g_unlink( cache->spill_filename );
+		VIPS_FREE( cache->spill_filename );
+	}
+	VIPS_FREEF( vips_g_mutex_free, cache->spill_lock );
 
 	G_OBJECT_CLASS( vips_block_cache_parent_class )->dispose( gobject );
 }
 
+/* The shard that holds the tile at x, y. Neighbouring tiles are in
+ * different shards, so threads working across or down an image spread out.
+ */
+static VipsTileShard *
+vips_block_cache_shard( VipsBlockCache *cache, int x, int y )
+{
+	int i = x / cache->tile_width + y / cache->tile_height;
+
+	return( &cache->shard[i % cache->n_shards] );
+}
+
 static void
 vips_tile_touch( VipsTile *tile )
 {
-	g_assert( tile->cache->ntiles >= 0 );
+	g_assert( tile->shard->ntiles >= 0 );
 
-	tile->time = tile->cache->time++;
+	tile->used = TRUE;
 }
 
 static int
 vips_tile_move( VipsTile *tile, int x, int y )
 {
+	VipsTileShard *shard = tile->shard;
+
+	/* Tiles never move between shards.
+	 */
+	g_assert( vips_block_cache_shard( tile->cache, x, y ) == shard );
+
 	/* We are changing x/y and therefore the hash value. We must unlink
 	 * from the old hash position and relink at the new place.
 	 */
-	g_hash_table_steal( tile->cache->tiles, &tile->pos );
+	g_hash_table_steal( shard->tiles, &tile->pos );
 
 	tile->pos.left = x;
 	tile->pos.top = y;
 	tile->pos.width = tile->cache->tile_width;
 	tile->pos.height = tile->cache->tile_height;
 
-	g_hash_table_insert( tile->cache->tiles, &tile->pos, tile );
+	g_hash_table_insert( shard->tiles, &tile->pos, tile );
 
 	if( vips_region_buffer( tile->region, &tile->pos ) )
 		return( -1 );
@@ -203,47 +387,57 @@ vips_tile_move( VipsTile *tile, int x, int y )
 	return( 0 );
 }
 
+/* Call with the shard locked.
+ */
 static VipsTile *
-vips_tile_new( VipsBlockCache *cache, int x, int y )
+vips_tile_new( VipsTileShard *shard, int x, int y )
 {
+	VipsBlockCache *cache = shard->cache;
+
 	VipsTile *tile;
 
 	if( !(tile = VIPS_NEW( NULL, VipsTile )) )
 		return( NULL );
 
 	tile->cache = cache;
+	tile->shard = shard;
 	tile->state = VIPS_TILE_STATE_PEND;
 	tile->ref_count = 0;
 	tile->region = NULL;
-	tile->time = cache->time;
+	tile->used = FALSE;
+	tile->ready = vips_g_cond_new();
 	tile->pos.left = x;
 	tile->pos.top = y;
 	tile->pos.width = cache->tile_width;
 	tile->pos.height = cache->tile_height;
-	g_hash_table_insert( cache->tiles, &tile->pos, tile );
-	g_assert( cache->ntiles >= 0 );
-	cache->ntiles += 1;
+	g_hash_table_insert( shard->tiles, &tile->pos, tile );
+	g_assert( shard->ntiles >= 0 );
+	shard->ntiles += 1;
 
 	if( !(tile->region = vips_region_new( cache->in )) ) {
-		g_hash_table_remove( cache->tiles, &tile->pos );
+		g_hash_table_remove( shard->tiles, &tile->pos );
 		return( NULL );
 	}
 
 	vips__region_no_ownership( tile->region );
 
 	if( vips_tile_move( tile, x, y ) ) {
-		g_hash_table_remove( cache->tiles, &tile->pos );
+		g_hash_table_remove( shard->tiles, &tile->pos );
 		return( NULL );
 	}
 
+	g_ptr_array_add( shard->clock, tile );
+
 	return( tile );
 }
 
 /* Do we have a tile in the cache?
  */
 static VipsTile *
-vips_tile_search( VipsBlockCache *cache, int x, int y )
+vips_tile_search( VipsTileShard *shard, int x, int y )
 {
+	VipsBlockCache *cache = shard->cache;
+
 	VipsRect pos;
 	VipsTile *tile;
 
@@ -251,74 +445,313 @@ vips_tile_search( VipsBlockCache *cache, int x, int y )
 	pos.top = y;
 	pos.width = cache->tile_width;
 	pos.height = cache->tile_height;
-	tile = (VipsTile *) g_hash_table_lookup( cache->tiles, &pos );
+	tile = (VipsTile *) g_hash_table_lookup( shard->tiles, &pos );
 
 	return( tile );
 }
 
-typedef struct _VipsTileSearch {
-	VipsTile *tile;
+/* Make room for a new spilled tile of length bytes. Each shard has an equal
+ * part of max_spill.
+ *
+ * In memory, we just drop the oldest tiles until it fits. In the spill file,
+ * our part is a ring buffer: tiles are written at the head, and we drop the
+ * oldest tiles, which are just ahead of the head, as it overwrites them.
+ */
+static void
+vips_tile_spill_make_room( VipsTileShard *shard, size_t length )
+{
+	VipsBlockCache *cache = shard->cache;
+	guint64 limit = cache->max_spill / cache->n_shards;
+
+	VipsTileSpill *oldest;
 
-	int oldest;
-	int topmost;
-} VipsTileSearch;
+	if( !cache->spill_file ) {
+		while( shard->spill_bytes + length > limit )
+			vips_tile_spill_drop( shard );
 
-static void 
-vips_tile_search_recycle( gpointer key, gpointer value, gpointer user_data )
+		return;
+	}
+
+	if( shard->spill_head + length > limit ) {
+		/* Wrap round, and drop everything in the piece we skip.
+		 */
+		while( (oldest = (VipsTileSpill *)
+			g_queue_peek_head( shard->spill_order )) &&
+			oldest->offset >= shard->spill_head )
+			vips_tile_spill_drop( shard );
+
+		shard->spill_head = 0;
+	}
+
+	while( (oldest = (VipsTileSpill *)
+		g_queue_peek_head( shard->spill_order )) &&
+		oldest->offset < shard->spill_head + length &&
+		oldest->offset + oldest->length > shard->spill_head )
+		vips_tile_spill_drop( shard );
+}
+
+/* A DATA tile is about to be reused. Keep a copy of its pixels in the
+ * spill, if we can. Call with the shard locked.
+ */
+static void
+vips_tile_spill( VipsTile *tile )
 {
-	VipsTile *tile = (VipsTile *) value;
+	VipsTileShard *shard = tile->shard;
 	VipsBlockCache *cache = tile->cache;
-	VipsTileSearch *search = (VipsTileSearch *) user_data;
+	VipsRegion *region = tile->region;
+	size_t size = VIPS_REGION_LSKIP( region ) * region->valid.height;
+	VipsPel *p = VIPS_REGION_ADDR( region,
+		region->valid.left, region->valid.top );
+
+	VipsTileSpill *spill;
+	VipsPel *buf;
+	size_t length;
+	gboolean compressed;
+	int result;
+
+	if( tile->state != VIPS_TILE_STATE_DATA ||
+		size > cache->max_spill / cache->n_shards ||
+		g_hash_table_lookup( shard->spilled, &tile->pos ) )
+		return;
 
-	/* Only consider unreffed tiles for recycling.
+	buf = NULL;
+	length = size;
+	compressed = FALSE;
+
+#ifdef HAVE_ZLIB
+{
+	/* Level 1 is fast, and still does well on flat areas.
 	 */
-	if( !tile->ref_count ) {
-		switch( cache->access ) {
-		case VIPS_ACCESS_RANDOM:
-			if( tile->time < search->oldest ) {
-				search->oldest = tile->time;
-				search->tile = tile;
-			}
-			break;
+	uLongf zlength = compressBound( size );
+
+	if( (buf = (VipsPel *) vips_malloc( NULL, zlength )) &&
+		compress2( buf, &zlength, p, size, 1 ) == Z_OK &&
+		zlength < size ) {
+		length = zlength;
+		compressed = TRUE;
+	}
+	else
+		VIPS_FREE( buf );
+}
+#endif /*HAVE_ZLIB*/
+
+	/* In memory, we must always have our own copy.
+	 */
+	if( !compressed &&
+		!cache->spill_file ) {
+		if( !(buf = (VipsPel *) vips_malloc( NULL, size )) )
+			return;
+		memcpy( buf, p, size );
+	}
+
+	vips_tile_spill_make_room( shard, length );
+
+	if( !(spill = VIPS_NEW( NULL, VipsTileSpill )) ) {
+		VIPS_FREE( buf );
+		return;
+	}
+	spill->pos = tile->pos;
+	spill->size = size;
+	spill->length = length;
+	spill->compressed = compressed;
+	spill->data = NULL;
+	spill->offset = 0;
+
+	if( cache->spill_file ) {
+		spill->offset = shard->spill_head;
+
+		g_mutex_lock( cache->spill_lock );
+		result = vips__seek( cache->spill_fd,
+				shard->spill_base + spill->offset ) ||
+			vips__write( cache->spill_fd,
+				compressed ? buf : p, length );
+		g_mutex_unlock( cache->spill_lock );
+
+		VIPS_FREE( buf );
+
+		/* A failed spill just means we'll calculate the tile
+		 * again.
+		 */
+		if( result ) {
+			vips_error_clear();
+			vips_tile_spill_free( spill );
+			return;
+		}
+
+		shard->spill_head += length;
+	}
+	else
+		spill->data = buf;
+
+	g_hash_table_insert( shard->spilled, &spill->pos, spill );
+	g_queue_push_tail( shard->spill_order, spill );
+	shard->spill_bytes += length;
+}
 
-		case VIPS_ACCESS_SEQUENTIAL:
-		case VIPS_ACCESS_SEQUENTIAL_UNBUFFERED:
-			if( tile->pos.top < search->topmost ) {
-				search->topmost = tile->pos.top;
-				search->tile = tile;
+/* Try to fill a PEND tile from the spill. Call with the shard locked.
+ */
+static gboolean
+vips_tile_unspill( VipsTile *tile )
+{
+	VipsTileShard *shard = tile->shard;
+	VipsBlockCache *cache = tile->cache;
+	VipsRegion *region = tile->region;
+	size_t size = VIPS_REGION_LSKIP( region ) * region->valid.height;
+	VipsPel *q = VIPS_REGION_ADDR( region,
+		region->valid.left, region->valid.top );
+
+	VipsTileSpill *spill;
+	VipsPel *buf;
+	gboolean ok;
+
+	g_assert( tile->state == VIPS_TILE_STATE_PEND );
+
+	if( !shard->spilled ||
+		!(spill = (VipsTileSpill *)
+			g_hash_table_lookup( shard->spilled, &tile->pos )) ||
+		spill->size != size )
+		return( FALSE );
+
+	buf = spill->data;
+	ok = TRUE;
+
+	if( cache->spill_file ) {
+		/* Uncompressed tiles can be read straight into the region.
+		 */
+		if( !spill->compressed )
+			buf = q;
+		else if( !(buf = (VipsPel *)
+			vips_malloc( NULL, spill->length )) )
+			return( FALSE );
+
+		g_mutex_lock( cache->spill_lock );
+		ok = !vips__seek( cache->spill_fd,
+				shard->spill_base + spill->offset ) &&
+			read( cache->spill_fd, buf, spill->length ) ==
+				(ssize_t) spill->length;
+		g_mutex_unlock( cache->spill_lock );
+
+		if( !ok )
+			vips_error_clear();
+	}
+
+#ifdef HAVE_ZLIB
+	if( ok &&
+		spill->compressed ) {
+		uLongf zsize = size;
+
+		ok = uncompress( q, &zsize, buf, spill->length ) == Z_OK &&
+			zsize == size;
+	}
+#endif /*HAVE_ZLIB*/
+
+	if( ok &&
+		!spill->compressed &&
+		!cache->spill_file )
+		memcpy( q, buf, size );
+
+	if( buf != spill->data &&
+		buf != q )
+		vips_free( buf );
+
+	if( !ok )
+		return( FALSE );
+
+	VIPS_DEBUG_MSG_RED( "vips_tile_unspill: %d x %d from spill\n",
+		tile->pos.left, tile->pos.top );
+
+	tile->state = VIPS_TILE_STATE_DATA;
+
+	return( TRUE );
+}
+
+/* Pick an unreffed tile in this shard that we can reuse, or NULL if they are
+ * all in use.
+ */
+static VipsTile *
+vips_tile_reuse( VipsTileShard *shard )
+{
+	VipsBlockCache *cache = shard->cache;
+	int n = shard->clock->len;
+
+	VipsTile *tile;
+	VipsTile *best;
+	int i;
+
+	if( n == 0 )
+		return( NULL );
+
+	switch( cache->access ) {
+	case VIPS_ACCESS_RANDOM:
+		/* A CLOCK sweep: a recently used tile gets a second chance,
+		 * so two turns find any unreffed tile.
+		 */
+		for( i = 0; i < 2 * n; i++ ) {
+			tile = (VipsTile *)
+				g_ptr_array_index( shard->clock, shard->hand );
+			shard->hand = (shard->hand + 1) % n;
+
+			if( tile->ref_count )
+				continue;
+			if( tile->used ) {
+				tile->used = FALSE;
+				continue;
 			}
-			break;
 
-		default:
-			g_assert_not_reached();
+			return( tile );
 		}
+		break;
+
+	case VIPS_ACCESS_SEQUENTIAL:
+	case VIPS_ACCESS_SEQUENTIAL_UNBUFFERED:
+		/* Reuse the topmost tile.
+		 */
+		best = NULL;
+		for( i = 0; i < n; i++ ) {
+			tile = (VipsTile *)
+				g_ptr_array_index( shard->clock, i );
+
+			if( !tile->ref_count &&
+				(!best ||
+				 tile->pos.top < best->pos.top) )
+				best = tile;
+		}
+
+		return( best );
+
+	default:
+		g_assert_not_reached();
 	}
+
+	return( NULL );
 }
 
-/* Find existing tile, make a new tile, or if we have a full set of tiles, 
- * reuse one.
+/* Find existing tile, make a new tile, or if we have a full set of tiles,
+ * reuse one. Call with the shard locked.
  */
 static VipsTile *
-vips_tile_find( VipsBlockCache *cache, int x, int y )
+vips_tile_find( VipsTileShard *shard, int x, int y )
 {
+	VipsBlockCache *cache = shard->cache;
+	int max_tiles = g_atomic_int_get( &cache->max_tiles );
+
 	VipsTile *tile;
-	VipsTileSearch search;
 
 	/* In cache already?
 	 */
-	if( (tile = vips_tile_search( cache, x, y )) ) {
+	if( (tile = vips_tile_search( shard, x, y )) ) {
 		VIPS_DEBUG_MSG_RED( "vips_tile_find: "
-			"tile %d x %d in cache\n", x, y ); 
+			"tile %d x %d in cache\n", x, y );
 		return( tile );
 	}
 
-	/* VipsBlockCache not full?
+	/* Shard not full? Each shard gets an equal part of max_tiles.
 	 */
-	if( cache->max_tiles == -1 ||
-		cache->ntiles < cache->max_tiles ) {
+	if( max_tiles == -1 ||
+		shard->ntiles * cache->n_shards < max_tiles ) {
 		VIPS_DEBUG_MSG_RED( "vips_tile_find: "
-			"making new tile at %d x %d\n", x, y ); 
-		if( !(tile = vips_tile_new( cache, x, y )) )
+			"making new tile at %d x %d\n", x, y );
+		if( !(tile = vips_tile_new( shard, x, y )) )
 			return( NULL );
 
 		return( tile );
@@ -326,32 +759,29 @@ vips_tile_find( VipsBlockCache *cache, int x, int y )
 
 	/* Reuse an old one.
 	 */
-	search.oldest = cache->time;
-	search.topmost = cache->in->Ysize;
-	search.tile = NULL;
-	g_hash_table_foreach( cache->tiles, vips_tile_search_recycle, &search );
-	tile = search.tile; 
-
-	if( !tile ) {
+	if( !(tile = vips_tile_reuse( shard )) ) {
 		/* There are no tiles we can reuse -- we have to make another
 		 * for now. They will get culled down again next time around.
 		 */
-		if( !(tile = vips_tile_new( cache, x, y )) ) 
+		if( !(tile = vips_tile_new( shard, x, y )) )
 			return( NULL );
 
 		return( tile );
 	}
 
-	VIPS_DEBUG_MSG_RED( "vips_tile_find: reusing tile %d x %d\n", 
+	VIPS_DEBUG_MSG_RED( "vips_tile_find: reusing tile %d x %d\n",
 		tile->pos.left, tile->pos.top );
 
+	if( shard->spilled )
+		vips_tile_spill( tile );
+
 	if( vips_tile_move( tile, x, y ) )
 		return( NULL );
 
 	return( tile );
 }
 
-static gboolean            
+static gboolean
 vips_tile_unlocked( gpointer key, gpointer value, gpointer user_data )
 {
 	VipsTile *tile = (VipsTile *) value;
@@ -359,17 +789,157 @@ vips_tile_unlocked( gpointer key, gpointer value, gpointer user_data )
 	return( !tile->ref_count );
 }
 
+static void
+vips_tile_clock_add( gpointer key, gpointer value, gpointer user_data )
+{
+	VipsTile *tile = (VipsTile *) value;
+	VipsTileShard *shard = (VipsTileShard *) user_data;
+
+	g_ptr_array_add( shard->clock, tile );
+}
+
 static void
 vips_block_cache_minimise( VipsImage *image, VipsBlockCache *cache )
 {
-	/* We can't drop tiles that are in use.
+	int i;
+
+	for( i = 0; i < cache->n_shards; i++ ) {
+		VipsTileShard *shard = &cache->shard[i];
+
+		/* We can't drop tiles that are in use.
+		 */
+		g_mutex_lock( shard->lock );
+
+		g_ptr_array_set_size( shard->clock, 0 );
+		shard->hand = 0;
+		g_hash_table_foreach_remove( shard->tiles,
+			vips_tile_unlocked, NULL );
+		g_hash_table_foreach( shard->tiles,
+			vips_tile_clock_add, shard );
+		vips_tile_spill_drop_all( shard );
+
+		g_mutex_unlock( shard->lock );
+	}
+}
+
+/* Caches don't move pixels, so we can pass prefetch hints straight through.
+ */
+static void
+vips_block_cache_prefetch( VipsImage *image, const VipsRect *r, void *a )
+{
+	VipsImage *in = (VipsImage *) a;
+
+	vips__image_prefetch( in, r );
+}
+
+static unsigned int
+vips_rect_hash( VipsRect *pos )
+{
+	guint hash;
+
+	/* We could shift down by the tile size?
+	 *
+	 * X discrimination is more important than Y, since
+	 * most tiles will have a similar Y.
+	 */
+	hash = pos->left ^ (pos->top << 16);
+
+	return( hash );
+}
+
+static gboolean
+vips_rect_equal( VipsRect *a, VipsRect *b )
+{
+	return( a->left == b->left && a->top == b->top );
+}
+
+static void
+vips_tile_destroy( VipsTile *tile )
+{
+	VipsTileShard *shard = tile->shard;
+
+	VIPS_DEBUG_MSG_RED( "vips_tile_destroy: tile %d, %d (%p)\n",
+		tile->pos.left, tile->pos.top, tile );
+
+	shard->ntiles -= 1;
+	g_assert( shard->ntiles >= 0 );
+	tile->cache = NULL;
+	tile->shard = NULL;
+
+	VIPS_UNREF( tile->region );
+	VIPS_FREEF( vips_g_cond_free, tile->ready );
+
+	vips_free( tile );
+}
+
+/* Make the shards, and the spill, if any. Subclasses call this once they
+ * have set max_tiles.
+ */
+static int
+vips_block_cache_shards( VipsBlockCache *cache )
+{
+	int i;
+
+	g_assert( cache->n_shards == 0 );
+
+	/* Only threaded caches have more than one thread inside at once.
+	 * Every shard needs a few tiles for reuse to work well.
 	 */
-	g_mutex_lock( cache->lock );
+	if( !cache->threaded )
+		cache->n_shards = 1;
+	else if( cache->max_tiles == -1 )
+		cache->n_shards = VIPS_TILE_SHARDS_MAX;
+	else
+		cache->n_shards =
+			VIPS_CLIP( 1, cache->max_tiles / 8,
+				VIPS_TILE_SHARDS_MAX );
+
+	VIPS_DEBUG_MSG( "vips_block_cache_shards: %d shards\n",
+		cache->n_shards );
+
+	for( i = 0; i < cache->n_shards; i++ ) {
+		VipsTileShard *shard = &cache->shard[i];
+
+		shard->cache = cache;
+		shard->lock = vips_g_mutex_new();
+		shard->tiles = g_hash_table_new_full(
+			(GHashFunc) vips_rect_hash,
+			(GEqualFunc) vips_rect_equal,
+			NULL,
+			(GDestroyNotify) vips_tile_destroy );
+		shard->clock = g_ptr_array_new();
+		shard->hand = 0;
+		shard->ntiles = 0;
+
+		if( cache->max_spill > 0 ) {
+			shard->spilled = g_hash_table_new_full(
+				(GHashFunc) vips_rect_hash,
+				(GEqualFunc) vips_rect_equal,
+				NULL,
+				(GDestroyNotify) vips_tile_spill_free );
+			shard->spill_order = g_queue_new();
+			shard->spill_bytes = 0;
+			shard->spill_base =
+				i * (cache->max_spill / cache->n_shards);
+			shard->spill_head = 0;
+		}
+	}
 
-	g_hash_table_foreach_remove( cache->tiles, 
-		vips_tile_unlocked, NULL );
+	if( cache->max_spill > 0 &&
+		cache->spill_file ) {
+		if( !(cache->spill_filename = vips__temp_name( "%s.cache" )) )
+			return( -1 );
+		if( (cache->spill_fd = vips_tracked_open( cache->spill_filename,
+			O_RDWR | O_CREAT | O_TRUNC | O_BINARY, 0666 )) < 0 ) {
+			vips_error_system( errno, "tilecache",
+				_( "unable to open \"%s\"" ),
+				cache->spill_filename );
+			return( -1 );
+		}
+		cache->spill_lock = vips_g_mutex_new();
+	}
 
-	g_mutex_unlock( cache->lock );
+	return( 0 );
 }
 
 static int
@@ -389,7 +959,7 @@ vips_block_cache_build( VipsObject *object )
 		 	VIPS_IMAGE_SIZEOF_PEL( cache->in )) / (1024 * 1024.0) );
 
 	if( !cache->persistent )
-		g_signal_connect( conversion->out, "minimise", 
+		g_signal_connect( conversion->out, "minimise",
 			G_CALLBACK( vips_block_cache_minimise ), cache );
 
 	return( 0 );
@@ -447,44 +1017,20 @@ vips_block_cache_class_init( VipsBlockCacheClass *class )
 		VIPS_ARGUMENT_OPTIONAL_INPUT,
 		G_STRUCT_OFFSET( VipsBlockCache, persistent ),
 		FALSE );
-}
 
-static unsigned int
-vips_rect_hash( VipsRect *pos )
-{
-	guint hash;
-
-	/* We could shift down by the tile size?
-	 *
-	 * X discrimination is more important than Y, since
-	 * most tiles will have a similar Y. 
-	 */
-	hash = pos->left ^ (pos->top << 16);
-
-	return( hash );
-}
-
-static gboolean 
-vips_rect_equal( VipsRect *a, VipsRect *b )
-{
-	return( a->left == b->left && a->top == b->top );
-}
-
-static void
-vips_tile_destroy( VipsTile *tile )
-{
-	VipsBlockCache *cache = tile->cache;
-
-	VIPS_DEBUG_MSG_RED( "vips_tile_destroy: tile %d, %d (%p)\n", 
-		tile->pos.left, tile->pos.top, tile ); 
-
-	cache->ntiles -= 1;
-	g_assert( cache->ntiles >= 0 );
-	tile->cache = NULL;
-
-	VIPS_UNREF( tile->region );
+	VIPS_ARG_UINT64( class, "max_spill", 9,
+		_( "Max spill" ),
+		_( "Maximum number of bytes of evicted tiles to keep" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsBlockCache, max_spill ),
+		0, G_MAXUINT64, 0 );
 
-	vips_free( tile );
+	VIPS_ARG_BOOL( class, "spill_file", 10,
+		_( "Spill file" ),
+		_( "Keep evicted tiles in a temporary file" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsBlockCache, spill_file ),
+		FALSE );
 }
 
 static void
@@ -497,15 +1043,12 @@ vips_block_cache_init( VipsBlockCache *cache )
 	cache->threaded = FALSE;
 	cache->persistent = FALSE;
 
-	cache->time = 0;
-	cache->ntiles = 0;
+	cache->max_spill = 0;
+	cache->spill_file = FALSE;
+	cache->spill_fd = -1;
+
 	cache->lock = vips_g_mutex_new();
-	cache->new_tile = vips_g_cond_new();
-	cache->tiles = g_hash_table_new_full( 
-		(GHashFunc) vips_rect_hash, 
-		(GEqualFunc) vips_rect_equal,
-		NULL,
-		(GDestroyNotify) vips_tile_destroy );
+	cache->n_shards = 0;
 }
 
 typedef struct _VipsTileCache {
@@ -534,222 +1077,186 @@ vips_tile_ref( VipsTile *tile )
 }
 
 static void
-vips_tile_cache_unref( GSList *work )
+vips_tile_paste( VipsTile *tile, VipsRegion *or )
 {
-	GSList *p;
-
-	for( p = work; p; p = p->next ) 
-		vips_tile_unref( (VipsTile *) p->data ); 
+	VipsRect hit;
 
-	g_slist_free( work );
+	/* The part of the tile that we need.
+	 */
+	vips_rect_intersectrect( &or->valid, &tile->pos, &hit );
+	if( !vips_rect_isempty( &hit ) )
+		vips_region_copy( tile->region, or, &hit, hit.left, hit.top );
 }
 
-/* Make a set of work tiles.
+/* Calculate a PEND tile. Call with the shard locked. We unlock while we
+ * work, so other threads can use the shard, and hold a ref so the tile
+ * can't be reused under us.
  */
-static GSList *
-vips_tile_cache_ref( VipsBlockCache *cache, VipsRect *r )
+static int
+vips_tile_calc( VipsTile *tile, VipsRegion *in, gboolean *stop )
 {
-	const int tw = cache->tile_width;
-	const int th = cache->tile_height;
+	VipsTileShard *shard = tile->shard;
 
-	/* Find top left of tiles we need.
-	 */
-	const int xs = (r->left / tw) * tw;
-	const int ys = (r->top / th) * th;
+	int result;
 
-	GSList *work;
-	VipsTile *tile;
-	int x, y;
+	g_assert( tile->state == VIPS_TILE_STATE_PEND );
 
-	/* Ref all the tiles we will need.
-	 */
-	work = NULL;
-	for( y = ys; y < VIPS_RECT_BOTTOM( r ); y += th )
-		for( x = xs; x < VIPS_RECT_RIGHT( r ); x += tw ) {
-			if( !(tile = vips_tile_find( cache, x, y )) ) {
-				vips_tile_cache_unref( work );
-				return( NULL );
-			}
+	VIPS_DEBUG_MSG_RED( "vips_tile_calc: calc of %p\n", tile );
 
-			vips_tile_touch( tile );
+	tile->state = VIPS_TILE_STATE_CALC;
+	vips_tile_ref( tile );
 
-			vips_tile_ref( tile ); 
+	g_mutex_unlock( shard->lock );
 
-			/* We must append, since we want to keep tile ordering
-			 * for sequential sources.
-			 */
-			work = g_slist_append( work, tile );
+	result = vips_region_prepare_to( in,
+		tile->region,
+		&tile->pos,
+		tile->pos.left, tile->pos.top );
 
-			VIPS_DEBUG_MSG_RED( "vips_tile_cache_ref: "
-				"tile %d, %d (%p)\n", x, y, tile ); 
-		}
+	VIPS_GATE_START( "vips_tile_calc: wait" );
 
-	return( work );
-}
+	g_mutex_lock( shard->lock );
 
-static void
-vips_tile_paste( VipsTile *tile, VipsRegion *or )
-{
-	VipsRect hit;
+	VIPS_GATE_STOP( "vips_tile_calc: wait" );
 
-	/* The part of the tile that we need.
+	/* If there was an error calculating this tile, black it out and
+	 * terminate calculation. We have to stop so we can support things
+	 * like --fail on jpegload.
 	 */
-	vips_rect_intersectrect( &or->valid, &tile->pos, &hit );
-	if( !vips_rect_isempty( &hit ) )
-		vips_region_copy( tile->region, or, &hit, hit.left, hit.top ); 
+	if( result ) {
+		VIPS_DEBUG_MSG_RED( "vips_tile_calc: "
+			"error on tile %p\n", tile );
+
+		g_warning( _( "error in tile %d x %d" ),
+			tile->pos.left, tile->pos.top );
+
+		vips_region_black( tile->region );
+
+		*stop = TRUE;
+	}
+
+	tile->state = VIPS_TILE_STATE_DATA;
+
+	vips_tile_touch( tile );
+	vips_tile_unref( tile );
+
+	/* Wake anyone waiting for this tile.
+	 */
+	g_cond_broadcast( tile->ready );
+
+	return( result );
 }
 
 /* Also called from vips_line_cache_gen(), beware.
  */
 static int
-vips_tile_cache_gen( VipsRegion *or, 
+vips_tile_cache_gen( VipsRegion *or,
 	void *seq, void *a, void *b, gboolean *stop )
 {
 	VipsRegion *in = (VipsRegion *) seq;
 	VipsBlockCache *cache = (VipsBlockCache *) b;
 	VipsRect *r = &or->valid;
+	const int tw = cache->tile_width;
+	const int th = cache->tile_height;
+
+	/* Find top left of tiles we need.
+	 */
+	const int xs = (r->left / tw) * tw;
+	const int ys = (r->top / th) * th;
 
+	VipsTileShard *shard;
 	VipsTile *tile;
-	GSList *work;
+	GSList *wait;
 	GSList *p;
+	int x, y;
 	int result;
 
-	result = 0;
-
-	VIPS_GATE_START( "vips_tile_cache_gen: wait1" );
-
-	g_mutex_lock( cache->lock );
-
-	VIPS_GATE_STOP( "vips_tile_cache_gen: wait1" );
-
 	VIPS_DEBUG_MSG_RED( "vips_tile_cache_gen: "
 		"left = %d, top = %d, width = %d, height = %d\n",
 		r->left, r->top, r->width, r->height );
 
-	/* Ref all the tiles we will need.
+	/* Unthreaded caches only let one thread in at once.
 	 */
-	work = vips_tile_cache_ref( cache, r );
+	if( !cache->threaded ) {
+		VIPS_GATE_START( "vips_tile_cache_gen: wait1" );
 
-	while( work ) {
-		/* Search for data tiles: easy, we can just paste those in.
-		 */
-		for(;;) { 
-			for( p = work; p; p = p->next ) { 
-				tile = (VipsTile *) p->data;
+		g_mutex_lock( cache->lock );
 
-				if( tile->state == VIPS_TILE_STATE_DATA ) 
-					break;
-			}
+		VIPS_GATE_STOP( "vips_tile_cache_gen: wait1" );
+	}
 
-			if( !p )
-				break;
+	/* Paste in DATA tiles and calculate PEND tiles as we find them.
+	 * Tiles some other thread is calculating go on a wait list, and we
+	 * come back to them at the end. We work in order, since we want to
+	 * keep tile ordering for sequential sources.
+	 */
+	result = 0;
+	wait = NULL;
+	for( y = ys; !result && y < VIPS_RECT_BOTTOM( r ); y += th )
+		for( x = xs; !result && x < VIPS_RECT_RIGHT( r ); x += tw ) {
+			shard = vips_block_cache_shard( cache, x, y );
 
-			VIPS_DEBUG_MSG_RED( "vips_tile_cache_gen: "
-				"pasting %p\n", tile ); 
+			g_mutex_lock( shard->lock );
 
-			vips_tile_paste( tile, or );
+			if( !(tile = vips_tile_find( shard, x, y )) ) {
+				g_mutex_unlock( shard->lock );
+				result = -1;
+				break;
+			}
 
-			/* We're done with this tile.
-			 */
-			work = g_slist_remove( work, tile );
-			vips_tile_unref( tile ); 
-		}
+			vips_tile_touch( tile );
 
-		/* Calculate the first PEND tile we find on the work list. We
-		 * don't calculate all PEND tiles since after the first, more
-		 * DATA tiles might heve been made available by other threads
-		 * and we want to get them out of the way as soon as we can.
-		 */
-		for( p = work; p; p = p->next ) { 
-			tile = (VipsTile *) p->data;
+			if( tile->state != VIPS_TILE_STATE_PEND )
+				g_atomic_int_inc( &cache->hits );
+			else if( vips_tile_unspill( tile ) )
+				g_atomic_int_inc( &cache->spill_hits );
+			else {
+				g_atomic_int_inc( &cache->misses );
 
-			if( tile->state == VIPS_TILE_STATE_PEND ) {
-				tile->state = VIPS_TILE_STATE_CALC;
+				if( vips_tile_calc( tile, in, stop ) )
+					result = -1;
+			}
 
+			if( tile->state == VIPS_TILE_STATE_DATA ) {
 				VIPS_DEBUG_MSG_RED( "vips_tile_cache_gen: "
-					"calc of %p\n", tile ); 
-
-				/* In threaded mode, we let other threads run
-				 * while we calc this tile. In non-threaded
-				 * mode, we keep the lock and make 'em wait.
-				 */
-				if( cache->threaded ) 
-					g_mutex_unlock( cache->lock );
-
-				result = vips_region_prepare_to( in, 
-					tile->region, 
-					&tile->pos, 
-					tile->pos.left, tile->pos.top );
-
-				if( cache->threaded ) {
-					VIPS_GATE_START( "vips_tile_cache_gen: "
-						"wait2" );
-
-					g_mutex_lock( cache->lock );
-
-					VIPS_GATE_STOP( "vips_tile_cache_gen: "
-						"wait2" );
-				}
-
-				/* If there was an error calculating this
-				 * tile, black it out and terminate
-				 * calculation. We have to stop so we can
-				 * support things like --fail on jpegload.
-				 *
-				 * Don't return early, we'd deadlock. 
-				 */
-				if( result ) {
-					VIPS_DEBUG_MSG_RED( 
-						"vips_tile_cache_gen: "
-						"error on tile %p\n", tile ); 
+					"pasting %p\n", tile );
 
-					g_warning( _( "error in tile %d x %d" ),
-						tile->pos.left, tile->pos.top );
-
-					vips_region_black( tile->region );
-
-					*stop = TRUE;
-				}
-
-				tile->state = VIPS_TILE_STATE_DATA;
-
-				vips_tile_touch( tile );
-
-				/* Let everyone know there's a new DATA tile. 
-				 * They need to all check their work lists.
-				 */
-				g_cond_broadcast( cache->new_tile );
-
-				break;
+				vips_tile_paste( tile, or );
+			}
+			else {
+				vips_tile_ref( tile );
+				wait = g_slist_append( wait, tile );
 			}
+
+			g_mutex_unlock( shard->lock );
 		}
 
-		/* There are no PEND or DATA tiles, we must need a tile some
-		 * other thread is currently calculating.
-		 *
-		 * We must block until the CALC tiles we need are done.
-		 */
-		if( !p && 
-			work ) {
-			for( p = work; p; p = p->next ) { 
-				tile = (VipsTile *) p->data;
+	/* Wait for the tiles other threads are making. We hold no CALC tiles
+	 * of our own, so this can't deadlock.
+	 */
+	for( p = wait; p; p = p->next ) {
+		tile = (VipsTile *) p->data;
+		shard = tile->shard;
 
-				g_assert( tile->state == VIPS_TILE_STATE_CALC );
-			}
+		g_mutex_lock( shard->lock );
 
-			VIPS_DEBUG_MSG_RED( "vips_tile_cache_gen: waiting\n" ); 
+		VIPS_GATE_START( "vips_tile_cache_gen: wait2" );
 
-			VIPS_GATE_START( "vips_tile_cache_gen: wait3" );
+		while( tile->state == VIPS_TILE_STATE_CALC )
+			g_cond_wait( tile->ready, shard->lock );
 
-			g_cond_wait( cache->new_tile, cache->lock );
+		VIPS_GATE_STOP( "vips_tile_cache_gen: wait2" );
 
-			VIPS_GATE_STOP( "vips_tile_cache_gen: wait3" );
+		if( !result )
+			vips_tile_paste( tile, or );
+		vips_tile_unref( tile );
 
-			VIPS_DEBUG_MSG( "vips_tile_cache_gen: awake!\n" ); 
-		}
+		g_mutex_unlock( shard->lock );
 	}
+	g_slist_free( wait );
 
-	g_mutex_unlock( cache->lock );
+	if( !cache->threaded )
+		g_mutex_unlock( cache->lock );
 
 	return( result );
 }
@@ -774,10 +1281,15 @@ vips_tile_cache_build( VipsObject *object )
 		VIPS_DEMAND_STYLE_SMALLTILE, block_cache->in, NULL ) )
 		return( -1 );
 
+	if( vips_block_cache_shards( block_cache ) )
+		return( -1 );
+
 	if( vips_image_generate( conversion->out,
 		vips_start_one, vips_tile_cache_gen, vips_stop_one, 
 		block_cache->in, cache ) )
 		return( -1 );
+	vips_image_set_prefetch( conversion->out, 
+		vips_block_cache_prefetch, block_cache->in );
 
 	return( 0 );
 }
@@ -832,6 +1344,8 @@ vips_tile_cache_init( VipsTileCache *cache )
  * * @access: hint expected access pattern #VipsAccess
  * * @threaded: allow many threads
  * * @persistent: don't drop cache at end of computation
+ * * @max_spill: %guint64, keep up to this many bytes of evicted tiles
+ * * @spill_file: %gboolean, keep evicted tiles in a temporary file
  *
  * This operation behaves rather like vips_copy() between images
  * @in and @out, except that it keeps a cache of computed pixels. 
@@ -852,11 +1366,21 @@ vips_tile_cache_init( VipsTileCache *cache )
  *
  * Normally, only a single thread at once is allowed to calculate tiles. If
  * you set @threaded to %TRUE, vips_tilecache() will allow many threads to
- * calculate tiles at once, and share the cache between them.
+ * calculate tiles at once, and share the cache between them. A large
+ * threaded cache is split into independently locked shards, so threads
+ * working on different tiles rarely wait for each other. Least-recently-used
+ * reuse is then approximate, and counted per shard.
  *
  * Normally the cache is dropped when computation finishes. Set @persistent to
  * %TRUE to keep the cache between computations.
  *
+ * Set @max_spill to keep a copy of tiles as they are evicted. Up to
+ * @max_spill bytes of evicted tiles are kept, compressed if libvips was built
+ * with zlib, and a later request for one of them is served from the copy
+ * rather than being computed again. Evicted tiles are kept in memory, or in
+ * a temporary file if @spill_file is set. The default is 0, meaning evicted
+ * tiles are simply dropped.
+ *
  * See also: vips_cache(), vips_linecache().
  *
  * Returns: 0 on success, -1 on error.
@@ -899,8 +1423,8 @@ vips_line_cache_gen( VipsRegion *or,
 	 */
 	if( or->valid.height > 
 		block_cache->max_tiles * block_cache->tile_height ) {
-		block_cache->max_tiles = 
-			1 + (or->valid.height / block_cache->tile_height);
+		g_atomic_int_set( &block_cache->max_tiles,
+			1 + (or->valid.height / block_cache->tile_height) );
 		VIPS_DEBUG_MSG( "vips_line_cache_gen: bumped max_tiles to %d\n",
 			block_cache->max_tiles ); 
 	}
@@ -961,10 +1485,15 @@ vips_line_cache_build( VipsObject *object )
 		VIPS_DEMAND_STYLE_THINSTRIP, block_cache->in, NULL ) )
 		return( -1 );
 
+	if( vips_block_cache_shards( block_cache ) )
+		return( -1 );
+
 	if( vips_image_generate( conversion->out,
 		vips_start_one, vips_line_cache_gen, vips_stop_one, 
 		block_cache->in, cache ) )
 		return( -1 );
+	vips_image_set_prefetch( conversion->out, 
+		vips_block_cache_prefetch, block_cache->in );
 
 	return( 0 );
 }
@@ -998,6 +1527,8 @@ vips_line_cache_init( VipsLineCache *cache )
  * * @access: hint expected access pattern #VipsAccess
  * * @tile_height: height of tiles in cache
  * * @threaded: allow many threads
+ * * @max_spill: %guint64, keep up to this many bytes of evicted tiles
+ * * @spill_file: %gboolean, keep evicted tiles in a temporary file
  *
  * This operation behaves rather like vips_copy() between images
  * @in and @out, except that it keeps a cache of computed scanlines. 
@@ -1020,6 +1551,9 @@ vips_line_cache_init( VipsLineCache *cache )
  * you set @threaded to %TRUE, vips_linecache() will allow many threads to
  * calculate tiles at once and share the cache between them.
  *
+ * @max_spill and @spill_file keep evicted strips for reuse, see
+ * vips_tilecache().
+ *
  * See also: vips_cache(), vips_tilecache(). 
  *
  * Returns: 0 on success, -1 on error.
@@ -7,6 +7,8 @@
  * 	- max_alpha defaults to 65535 for RGB16/GREY16
  * 24/11/17 lovell
  * 	- match normalised alpha to output type
+ * 14/10/18
+ * 	- add a native RGBA path and join pipeline fusion
  */
 
 /*
@@ -51,6 +53,7 @@
 #include <math.h>
 
 #include <vips/vips.h>
+#include <vips/simd.h>
 #include <vips/internal.h>
 #include <vips/debug.h>
 
@@ -63,6 +66,13 @@ typedef struct _VipsUnpremultiply {
 
 	double max_alpha;
 
+	/* The format and bands we see, after decode, and the native kernel,
+	 * if any.
+	 */
+	VipsBandFormat format;
+	int bands;
+	VipsSimdAlphaFn simd;
+
 } VipsUnpremultiply;
 
 typedef VipsConversionClass VipsUnpremultiplyClass;
@@ -130,19 +140,71 @@ G_DEFINE_TYPE( VipsUnpremultiply, vips_unpremultiply, VIPS_TYPE_CONVERSION );
 	} \
 }
 
+/* Unpremultiply a line of pixels.
+ */
+static void
+vips_unpremultiply_line( VipsUnpremultiply *unpremultiply,
+	VipsPel *out, VipsPel *in, int width )
+{
+	int bands = unpremultiply->bands;
+	double max_alpha = unpremultiply->max_alpha;
+
+	int x, i;
+
+	if( unpremultiply->simd ) {
+		unpremultiply->simd( (float *) out, in, width, max_alpha );
+		return;
+	}
+
+	switch( unpremultiply->format ) {
+	case VIPS_FORMAT_UCHAR:
+		UNPRE( unsigned char, float );
+		break;
+
+	case VIPS_FORMAT_CHAR:
+		UNPRE( signed char, float );
+		break;
+
+	case VIPS_FORMAT_USHORT:
+		UNPRE( unsigned short, float );
+		break;
+
+	case VIPS_FORMAT_SHORT:
+		UNPRE( signed short, float );
+		break;
+
+	case VIPS_FORMAT_UINT:
+		UNPRE( unsigned int, float );
+		break;
+
+	case VIPS_FORMAT_INT:
+		UNPRE( signed int, float );
+		break;
+
+	case VIPS_FORMAT_FLOAT:
+		UNPRE( float, float );
+		break;
+
+	case VIPS_FORMAT_DOUBLE:
+		UNPRE( double, double );
+		break;
+
+	case VIPS_FORMAT_COMPLEX:
+	case VIPS_FORMAT_DPCOMPLEX:
+	default:
+		g_assert_not_reached();
+	}
+}
+
 static int
 vips_unpremultiply_gen( VipsRegion *or, void *vseq, void *a, void *b,
 	gboolean *stop )
 {
 	VipsUnpremultiply *unpremultiply = (VipsUnpremultiply *) b;
 	VipsRegion *ir = (VipsRegion *) vseq;
-	VipsImage *im = ir->im;
 	VipsRect *r = &or->valid;
-	int width = r->width;
-	int bands = im->Bands; 
-	double max_alpha = unpremultiply->max_alpha;
 
-	int x, y, i;
+	int y;
 
 	if( vips_region_prepare( ir, r ) )
 		return( -1 );
@@ -151,49 +213,19 @@ vips_unpremultiply_gen( VipsRegion *or, void *vseq, void *a, void *b,
 		VipsPel *in = VIPS_REGION_ADDR( ir, r->left, r->top + y ); 
 		VipsPel *out = VIPS_REGION_ADDR( or, r->left, r->top + y ); 
 
-		switch( im->BandFmt ) { 
-		case VIPS_FORMAT_UCHAR: 
-			UNPRE( unsigned char, float ); 
-			break; 
-
-		case VIPS_FORMAT_CHAR: 
-			UNPRE( signed char, float ); 
-			break; 
-
-		case VIPS_FORMAT_USHORT: 
-			UNPRE( unsigned short, float ); 
-			break; 
-
-		case VIPS_FORMAT_SHORT: 
-			UNPRE( signed short, float ); 
-			break; 
-
-		case VIPS_FORMAT_UINT: 
-			UNPRE( unsigned int, float ); 
-			break; 
-
-		case VIPS_FORMAT_INT: 
-			UNPRE( signed int, float ); 
-			break; 
-
-		case VIPS_FORMAT_FLOAT: 
-			UNPRE( float, float ); 
-			break; 
-
-		case VIPS_FORMAT_DOUBLE: 
-			UNPRE( double, double ); 
-			break; 
-
-		case VIPS_FORMAT_COMPLEX: 
-		case VIPS_FORMAT_DPCOMPLEX: 
-		default: 
-			g_assert_not_reached(); 
-		} 
+		vips_unpremultiply_line( unpremultiply, out, in, r->width );
 	}
 
 	return( 0 );
 }
 
+/* A line at a time for pipeline fusion.
+ */
+static void
+vips_unpremultiply_point( VipsPel *out, VipsPel **in, int width, void *a )
+{
+	vips_unpremultiply_line( (VipsUnpremultiply *) a, out, in[0], width );
+}
 
 static int
 vips_unpremultiply_build( VipsObject *object )
@@ -204,6 +236,7 @@ vips_unpremultiply_build( VipsObject *object )
 	VipsImage **t = (VipsImage **) vips_object_local_array( object, 1 );
 
 	VipsImage *in;
+	VipsImage *point[2];
 
 	if( VIPS_OBJECT_CLASS( vips_unpremultiply_parent_class )->
 		build( object ) )
@@ -240,11 +273,26 @@ vips_unpremultiply_build( VipsObject *object )
 	else
 		conversion->out->BandFmt = VIPS_FORMAT_FLOAT;
 
+	/* RGBA in the common formats has a native kernel.
+	 */
+	unpremultiply->format = in->BandFmt;
+	unpremultiply->bands = in->Bands;
+	unpremultiply->simd = NULL;
+	if( in->Bands == 4 &&
+		unpremultiply->max_alpha > 0 )
+		unpremultiply->simd = (VipsSimdAlphaFn)
+			vips_simd_get( VIPS_SIMD_UNPREMULTIPLY, in->BandFmt );
+
 	if( vips_image_generate( conversion->out,
 		vips_start_one, vips_unpremultiply_gen, vips_stop_one, 
 		in, unpremultiply ) )
 		return( -1 );
 
+	point[0] = in;
+	point[1] = NULL;
+	vips__point_attach( conversion->out, point,
+		vips_unpremultiply_point, unpremultiply );
+
 	return( 0 );
 }
 
@@ -23,6 +23,9 @@
  * 	- gtkdoc
  * 1/6/13
  * 	- redo as a class
+ * 14/10/18
+ * 	- replicate 1, 2, 4 and 8 byte pels as single values, with unrolled
+ * 	  loops for xfac 2, 3, 4 and 8
  */
 
 /*
@@ -53,13 +56,10 @@
  */
 
 /*
- * TODO:
- * Test for pixel size and use memcpy() on individual pixels once they reach
- * sizes of the order of tens of bytes. char-wise copy is quicker than 
- * memcpy() for smaller pixels.
- *
- * Also, I haven't tested it but int-wise copying may be faster still, as 
- * long as alignment permits it.
+ * Pels of 1, 2, 4 and 8 bytes are copied as a single value of that size,
+ * as long as alignment permits it, and the common xfac values have loops
+ * of a fixed size which the compiler can unroll and vectorise. Other pels
+ * are copied char-wise, which is quicker than memcpy() for small pels.
  *
  * tcv.  2006-09-01
  */
@@ -98,6 +98,115 @@ typedef VipsConversionClass VipsZoomClass;
 
 G_DEFINE_TYPE( VipsZoom, vips_zoom, VIPS_TYPE_CONVERSION );
 
+/* Replicate n pels of TYPE from p to q, each xfac times.
+ */
+#define REPLICATE( TYPE, XFAC ) { \
+	TYPE *tp = (TYPE *) p; \
+	TYPE *tq = (TYPE *) q; \
+	\
+	for( x = 0; x < n; x++ ) { \
+		TYPE v = tp[x]; \
+		\
+		for( z = 0; z < XFAC; z++ ) \
+			tq[z] = v; \
+		\
+		tq += XFAC; \
+	} \
+}
+
+/* Switch for the common zoom factors, so the inner loop has a fixed size.
+ */
+#define REPLICATE_SWITCH( TYPE ) { \
+	switch( xfac ) { \
+	case 2: \
+		REPLICATE( TYPE, 2 ); \
+		break; \
+	\
+	case 3: \
+		REPLICATE( TYPE, 3 ); \
+		break; \
+	\
+	case 4: \
+		REPLICATE( TYPE, 4 ); \
+		break; \
+	\
+	case 8: \
+		REPLICATE( TYPE, 8 ); \
+		break; \
+	\
+	default: \
+		REPLICATE( TYPE, xfac ); \
+		break; \
+	} \
+}
+
+/* Expand a line of n pels of ps bytes from p into q.
+ */
+static void
+vips_zoom_replicate( VipsPel *q, VipsPel *p, int n, int ps, int xfac )
+{
+	int x, z, i;
+
+	/* Pointers into regions are usually aligned to the pel size, but
+	 * not always, eg. for a region on an odd-sized memory image.
+	 */
+	if( (ps == 1 || ps == 2 || ps == 4 || ps == 8) &&
+		((size_t) p % ps) == 0 &&
+		((size_t) q % ps) == 0 ) {
+		switch( ps ) {
+		case 1:
+			REPLICATE_SWITCH( guint8 );
+			break;
+
+		case 2:
+			REPLICATE_SWITCH( guint16 );
+			break;
+
+		case 4:
+			REPLICATE_SWITCH( guint32 );
+			break;
+
+		case 8:
+			REPLICATE_SWITCH( guint64 );
+			break;
+
+		default:
+			g_assert_not_reached();
+		}
+	}
+	else if( ps == 3 ) {
+		/* RGB uchar is common enough to have its own loop.
+		 */
+		for( x = 0; x < n; x++ ) {
+			VipsPel p0 = p[0];
+			VipsPel p1 = p[1];
+			VipsPel p2 = p[2];
+
+			for( z = 0; z < xfac; z++ ) {
+				q[0] = p0;
+				q[1] = p1;
+				q[2] = p2;
+
+				q += 3;
+			}
+
+			p += 3;
+		}
+	}
+	else {
+		for( x = 0; x < n; x++ ) {
+			for( z = 0; z < xfac; z++ ) {
+				for( i = 0; i < ps; i++ )
+					q[i] = p[i];
+
+				q += ps;
+			}
+
+			p += ps;
+		}
+	}
+}
+
 /* Paint the part of the region containing only whole pels.
  */
 static void
@@ -115,7 +224,7 @@ vips_zoom_paint_whole( VipsRegion *or, VipsRegion *ir, VipsZoom *zoom,
 	const int itop = top / zoom->yfac;
 	const int ibottom = bottom / zoom->yfac;
 
-	int x, y, z, i;
+	int y, z;
 
 	/* We know this!
 	 */
@@ -134,19 +243,7 @@ vips_zoom_paint_whole( VipsRegion *or, VipsRegion *ir, VipsZoom *zoom,
 
 		/* Expand the first line of pels.
 		 */
-		r = q;
-		for( x = ileft; x < iright; x++ ) {
-			/* Copy each pel xfac times.
-			 */
-			for( z = 0; z < zoom->xfac; z++ ) {
-				for( i = 0; i < ps; i++ )
-					r[i] = p[i];
-
-				r += ps;
-			}
-
-			p += ps;
-		}
+		vips_zoom_replicate( q, p, iright - ileft, ps, zoom->xfac );
 
 		/* Copy the expanded line yfac-1 times.
 		 */
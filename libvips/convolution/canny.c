@@ -1,4 +1,7 @@
 /* Canny edge detector
+ * 14/10/18
+ * 	- add an all-integer path for uchar images
+ * 	- add hysteresis
  */
 
 /*
@@ -51,6 +54,9 @@ typedef struct _VipsCanny {
 
 	double sigma; 
 	VipsPrecision precision; 
+	gboolean hysteresis;
+	double low;
+	double high;
 
 	/* Need an image vector for start_many.
 	 */
@@ -368,11 +374,392 @@ vips_canny_thin( VipsImage *in, VipsImage **out )
 	return( 0 );
 }
 
+/* Sectors for the integer path.
+ */
+enum {
+	CANNY_SECTOR_HORIZONTAL,	/* Compare left and right */
+	CANNY_SECTOR_VERTICAL,		/* Compare above and below */
+	CANNY_SECTOR_DIAGONAL,		/* Top-left and bottom-right */
+	CANNY_SECTOR_ANTIDIAGONAL	/* Top-right and bottom-left */
+};
+
+/* tan(22.5) as 8-bit fixed point.
+ */
+#define CANNY_TAN22 (106)
+
+/* Per-thread state for the integer path.
+ */
+typedef struct {
+	VipsRegion *ir;
+
+	/* G and sector for the output area plus a one pixel border.
+	 */
+	short *G;
+	VipsPel *sector;
+	size_t size;
+} VipsCannySeq;
+
+static int
+vips_canny_sobel_stop( void *vseq, void *a, void *b )
+{
+	VipsCannySeq *seq = (VipsCannySeq *) vseq;
+
+	VIPS_UNREF( seq->ir );
+	VIPS_FREE( seq->G );
+	VIPS_FREE( seq->sector );
+
+	return( 0 );
+}
+
+static void *
+vips_canny_sobel_start( VipsImage *out, void *a, void *b )
+{
+	VipsImage *in = (VipsImage *) a;
+
+	VipsCannySeq *seq;
+
+	if( !(seq = VIPS_NEW( out, VipsCannySeq )) )
+		return( NULL );
+
+	seq->ir = vips_region_new( in );
+	seq->G = NULL;
+	seq->sector = NULL;
+	seq->size = 0;
+
+	if( !seq->ir ) {
+		vips_canny_sobel_stop( seq, NULL, NULL );
+		return( NULL );
+	}
+
+	return( seq );
+}
+
+/* Sobel, sector and thin in one pass. The input is uchar and has been
+ * expanded by two pixels on every edge.
+ *
+ * G is |gx| + |gy|, so at most 2040, and the sector is picked by comparing
+ * |gx| and |gy| against tan(22.5), so there's no atan2() and no
+ * floating-point anywhere. The loops have no branches, so they vectorise.
+ */
+static int
+vips_canny_sobel_generate( VipsRegion *or,
+	void *vseq, void *a, void *b, gboolean *stop )
+{
+	VipsCannySeq *seq = (VipsCannySeq *) vseq;
+	VipsRegion *ir = seq->ir;
+	VipsRect *r = &or->valid;
+	int bands = ir->im->Bands;
+	int ne = (r->width + 2) * bands;
+	size_t size = (size_t) ne * (r->height + 2);
+
+	VipsRect s;
+	int x, y;
+	int offset[4];
+
+	s = *r;
+	s.width += 4;
+	s.height += 4;
+	if( vips_region_prepare( ir, &s ) )
+		return( -1 );
+
+	if( seq->size < size ) {
+		VIPS_FREE( seq->G );
+		VIPS_FREE( seq->sector );
+		if( !(seq->G = VIPS_ARRAY( NULL, size, short )) ||
+			!(seq->sector = VIPS_ARRAY( NULL, size, VipsPel )) )
+			return( -1 );
+		seq->size = size;
+	}
+
+	VIPS_GATE_START( "vips_canny_sobel_generate: work" );
+
+	for( y = 0; y < r->height + 2; y++ ) {
+		VipsPel * restrict p0 =
+			VIPS_REGION_ADDR( ir, s.left, s.top + y );
+		VipsPel * restrict p1 =
+			VIPS_REGION_ADDR( ir, s.left, s.top + y + 1 );
+		VipsPel * restrict p2 =
+			VIPS_REGION_ADDR( ir, s.left, s.top + y + 2 );
+		short * restrict G = seq->G + y * ne;
+		VipsPel * restrict sector = seq->sector + y * ne;
+
+		for( x = 0; x < ne; x++ ) {
+			int l = x;
+			int c = x + bands;
+			int rt = x + 2 * bands;
+			int gx = (p0[rt] + 2 * p1[rt] + p2[rt]) -
+				(p0[l] + 2 * p1[l] + p2[l]);
+			int gy = (p2[l] + 2 * p2[c] + p2[rt]) -
+				(p0[l] + 2 * p0[c] + p0[rt]);
+			int ax = VIPS_ABS( gx );
+			int ay = VIPS_ABS( gy );
+
+			G[x] = ax + ay;
+			sector[x] =
+				(ay << 8) <= ax * CANNY_TAN22 ?
+					CANNY_SECTOR_HORIZONTAL :
+				(ax << 8) <= ay * CANNY_TAN22 ?
+					CANNY_SECTOR_VERTICAL :
+				(gx ^ gy) >= 0 ?
+					CANNY_SECTOR_DIAGONAL :
+					CANNY_SECTOR_ANTIDIAGONAL;
+		}
+	}
+
+	offset[CANNY_SECTOR_HORIZONTAL] = bands;
+	offset[CANNY_SECTOR_VERTICAL] = ne;
+	offset[CANNY_SECTOR_DIAGONAL] = ne + bands;
+	offset[CANNY_SECTOR_ANTIDIAGONAL] = ne - bands;
+
+	for( y = 0; y < r->height; y++ ) {
+		short * restrict G = seq->G + (y + 1) * ne + bands;
+		VipsPel * restrict sector = seq->sector + (y + 1) * ne + bands;
+		VipsPel * restrict q =
+			VIPS_REGION_ADDR( or, r->left, r->top + y );
+
+		for( x = 0; x < r->width * bands; x++ ) {
+			int o = offset[sector[x]];
+			int g = G[x];
+			int keep = g > G[x - o] && g >= G[x + o];
+
+			q[x] = keep ? (g + 4) >> 3 : 0;
+		}
+	}
+
+	VIPS_GATE_STOP( "vips_canny_sobel_generate: work" );
+
+	return( 0 );
+}
+
+/* The integer path: uchar in, uchar out.
+ */
+static int
+vips_canny_sobel( VipsImage *in, VipsImage **out )
+{
+	*out = vips_image_new();
+	if( vips_image_pipelinev( *out,
+		VIPS_DEMAND_STYLE_SMALLTILE, in, NULL ) )
+		return( -1 );
+	(*out)->Xsize -= 4;
+	(*out)->Ysize -= 4;
+
+	if( vips_image_generate( *out,
+		vips_canny_sobel_start, vips_canny_sobel_generate,
+			vips_canny_sobel_stop,
+		in, NULL ) )
+		return( -1 );
+
+	return( 0 );
+}
+
+/* Hysteresis follows edges this far outside each tile.
+ */
+#define CANNY_HYSTERESIS_MARGIN (32)
+
+/* Per-thread state for hysteresis.
+ */
+typedef struct {
+	VipsRegion *ir;
+
+	/* 0 for no edge, 1 for weak, 2 for strong, and a stack of
+	 * strong pixels still to visit.
+	 */
+	VipsPel *mark;
+	int *stack;
+	size_t size;
+} VipsCannyHysteresisSeq;
+
+static int
+vips_canny_hysteresis_stop( void *vseq, void *a, void *b )
+{
+	VipsCannyHysteresisSeq *seq = (VipsCannyHysteresisSeq *) vseq;
+
+	VIPS_UNREF( seq->ir );
+	VIPS_FREE( seq->mark );
+	VIPS_FREE( seq->stack );
+
+	return( 0 );
+}
+
+static void *
+vips_canny_hysteresis_start( VipsImage *out, void *a, void *b )
+{
+	VipsImage *in = (VipsImage *) a;
+
+	VipsCannyHysteresisSeq *seq;
+
+	if( !(seq = VIPS_NEW( out, VipsCannyHysteresisSeq )) )
+		return( NULL );
+
+	seq->ir = vips_region_new( in );
+	seq->mark = NULL;
+	seq->stack = NULL;
+	seq->size = 0;
+
+	if( !seq->ir ) {
+		vips_canny_hysteresis_stop( seq, NULL, NULL );
+		return( NULL );
+	}
+
+	return( seq );
+}
+
+#define MARK( TYPE ) { \
+	for( y = 0; y < s.height; y++ ) { \
+		TYPE *p = (TYPE *) VIPS_REGION_ADDR( ir, s.left, s.top + y ); \
+		VipsPel *m = seq->mark + y * s.width; \
+		\
+		for( x = 0; x < s.width; x++ ) { \
+			TYPE v = p[x * bands + band]; \
+			\
+			m[x] = v >= high ? 2 : v >= low ? 1 : 0; \
+		} \
+	} \
+}
+
+static int
+vips_canny_hysteresis_generate( VipsRegion *or,
+	void *vseq, void *a, void *b, gboolean *stop )
+{
+	VipsCannyHysteresisSeq *seq = (VipsCannyHysteresisSeq *) vseq;
+	VipsCanny *canny = (VipsCanny *) b;
+	VipsRegion *ir = seq->ir;
+	VipsRect *r = &or->valid;
+	int bands = ir->im->Bands;
+	int margin = CANNY_HYSTERESIS_MARGIN;
+	double low = canny->low;
+	double high = canny->high;
+
+	VipsRect s;
+	size_t size;
+	int x, y, band;
+	int sp;
+
+	s = *r;
+	s.width += 2 * margin;
+	s.height += 2 * margin;
+	if( vips_region_prepare( ir, &s ) )
+		return( -1 );
+
+	size = (size_t) s.width * s.height;
+	if( seq->size < size ) {
+		VIPS_FREE( seq->mark );
+		VIPS_FREE( seq->stack );
+		if( !(seq->mark = VIPS_ARRAY( NULL, size, VipsPel )) ||
+			!(seq->stack = VIPS_ARRAY( NULL, size, int )) )
+			return( -1 );
+		seq->size = size;
+	}
+
+	VIPS_GATE_START( "vips_canny_hysteresis_generate: work" );
+
+	for( band = 0; band < bands; band++ ) {
+		VipsPel *mark = seq->mark;
+		int *stack = seq->stack;
+
+		switch( ir->im->BandFmt ) {
+		case VIPS_FORMAT_UCHAR:
+			MARK( unsigned char );
+			break;
+
+		case VIPS_FORMAT_FLOAT:
+			MARK( float );
+			break;
+
+		case VIPS_FORMAT_DOUBLE:
+			MARK( double );
+			break;
+
+		default:
+			g_assert( FALSE );
+		}
+
+		/* Flood out from every strong pixel, promoting weak
+		 * neighbours. The edge pixels of the window are never
+		 * pushed, so we don't need to test for the boundary.
+		 */
+		sp = 0;
+		for( y = 1; y < s.height - 1; y++ )
+			for( x = 1; x < s.width - 1; x++ )
+				if( mark[y * s.width + x] == 2 )
+					stack[sp++] = y * s.width + x;
+
+		while( sp > 0 ) {
+			int i = stack[--sp];
+			int dx, dy;
+
+			for( dy = -1; dy <= 1; dy++ )
+				for( dx = -1; dx <= 1; dx++ ) {
+					int j = i + dy * s.width + dx;
+					int jx = j % s.width;
+					int jy = j / s.width;
+
+					if( mark[j] == 1 ) {
+						mark[j] = 2;
+
+						if( jx > 0 &&
+							jx < s.width - 1 &&
+							jy > 0 &&
+							jy < s.height - 1 )
+							stack[sp++] = j;
+					}
+				}
+		}
+
+		for( y = 0; y < r->height; y++ ) {
+			VipsPel *m = mark +
+				(y + margin) * s.width + margin;
+			VipsPel *q = VIPS_REGION_ADDR( or,
+				r->left, r->top + y );
+
+			for( x = 0; x < r->width; x++ )
+				q[x * bands + band] = m[x] == 2 ? 255 : 0;
+		}
+	}
+
+	VIPS_GATE_STOP( "vips_canny_hysteresis_generate: work" );
+
+	return( 0 );
+}
+
+/* Keep strong edges, and weak edges which connect to a strong edge. We only
+ * follow edges for a short way outside each tile, so this is an
+ * approximation, but it can run in parallel.
+ */
+static int
+vips_canny_hysteresis( VipsCanny *canny, VipsImage *in, VipsImage **out )
+{
+	VipsImage **t = (VipsImage **)
+		vips_object_local_array( VIPS_OBJECT( canny ), 1 );
+	int margin = CANNY_HYSTERESIS_MARGIN;
+
+	if( vips_embed( in, &t[0], margin, margin,
+		in->Xsize + 2 * margin, in->Ysize + 2 * margin,
+		NULL ) )
+		return( -1 );
+
+	*out = vips_image_new();
+	if( vips_image_pipelinev( *out,
+		VIPS_DEMAND_STYLE_SMALLTILE, t[0], NULL ) )
+		return( -1 );
+	(*out)->Xsize = in->Xsize;
+	(*out)->Ysize = in->Ysize;
+	(*out)->BandFmt = VIPS_FORMAT_UCHAR;
+
+	if( vips_image_generate( *out,
+		vips_canny_hysteresis_start, vips_canny_hysteresis_generate,
+			vips_canny_hysteresis_stop,
+		t[0], canny ) )
+		return( -1 );
+
+	return( 0 );
+}
+
 static int
 vips_canny_build( VipsObject *object )
 {
 	VipsCanny *canny = (VipsCanny *) object;
-	VipsImage **t = (VipsImage **) vips_object_local_array( object, 5 );
+	VipsImage **t = (VipsImage **) vips_object_local_array( object, 7 );
 
 	VipsImage *in;
 	VipsImage *Gx;
@@ -389,29 +776,49 @@ vips_canny_build( VipsObject *object )
 		return( -1 );
 	in = t[0];
 
-	if( vips_canny_gradient( in, &Gx, &Gy ) )
-		return( -1 ); 
-
-	/* Form (G, theta).
-	 */
-	canny->args[0] = Gx;
-	canny->args[1] = Gy;
-	canny->args[2] = NULL;
-	if( vips_canny_polar( canny->args, &t[1] ) )
-		return( -1 ); 
-	in = t[1];
-
-	/* Expand by two pixels all around, then thin in the direction of the
-	 * gradient.
+	/* uchar images with int precision can be done entirely in int.
 	 */
-	if( vips_embed( in, &t[2], 1, 1, in->Xsize + 2, in->Ysize + 2,
-		"extend", VIPS_EXTEND_COPY,
-		NULL ) )
-		return( -1 );
+	if( in->BandFmt == VIPS_FORMAT_UCHAR &&
+		canny->precision != VIPS_PRECISION_FLOAT ) {
+		if( vips_embed( in, &t[4], 2, 2,
+				in->Xsize + 4, in->Ysize + 4,
+				"extend", VIPS_EXTEND_COPY,
+				NULL ) ||
+			vips_canny_sobel( t[4], &t[5] ) )
+			return( -1 );
+		in = t[5];
+	}
+	else {
+		if( vips_canny_gradient( in, &Gx, &Gy ) )
+			return( -1 );
 
-	if( vips_canny_thin( t[2], &t[3] ) )
-		return( -1 );
-	in = t[3];
+		/* Form (G, theta).
+		 */
+		canny->args[0] = Gx;
+		canny->args[1] = Gy;
+		canny->args[2] = NULL;
+		if( vips_canny_polar( canny->args, &t[1] ) )
+			return( -1 );
+		in = t[1];
+
+		/* Expand by two pixels all around, then thin in the
+		 * direction of the gradient.
+		 */
+		if( vips_embed( in, &t[2], 1, 1, in->Xsize + 2, in->Ysize + 2,
+			"extend", VIPS_EXTEND_COPY,
+			NULL ) )
+			return( -1 );
+
+		if( vips_canny_thin( t[2], &t[3] ) )
+			return( -1 );
+		in = t[3];
+	}
+
+	if( canny->hysteresis ) {
+		if( vips_canny_hysteresis( canny, in, &t[6] ) )
+			return( -1 );
+		in = t[6];
+	}
 
 	g_object_set( object, "out", vips_image_new(), NULL ); 
 
@@ -463,6 +870,27 @@ vips_canny_class_init( VipsCannyClass *class )
 		G_STRUCT_OFFSET( VipsCanny, precision ), 
 		VIPS_TYPE_PRECISION, VIPS_PRECISION_FLOAT ); 
 
+	VIPS_ARG_BOOL( class, "hysteresis", 104,
+		_( "Hysteresis" ),
+		_( "Keep only edges connected to strong edges" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsCanny, hysteresis ),
+		FALSE );
+
+	VIPS_ARG_DOUBLE( class, "low", 105,
+		_( "Low" ),
+		_( "Weak edge threshold for hysteresis" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsCanny, low ),
+		0, 1000000, 10 );
+
+	VIPS_ARG_DOUBLE( class, "high", 106,
+		_( "High" ),
+		_( "Strong edge threshold for hysteresis" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsCanny, high ),
+		0, 1000000, 30 );
+
 }
 
 static void
@@ -470,6 +898,8 @@ vips_canny_init( VipsCanny *canny )
 {
 	canny->sigma = 1.4; 
 	canny->precision = VIPS_PRECISION_FLOAT;
+	canny->low = 10;
+	canny->high = 30;
 }
 
 /**
@@ -483,6 +913,9 @@ vips_canny_init( VipsCanny *canny )
  *
  * * @sigma: %gdouble, sigma for gaussian blur
  * * @precision: #VipsPrecision, calculation accuracy
+ * * @hysteresis: %gboolean, only keep edges connected to strong edges
+ * * @low: %gdouble, weak edge threshold
+ * * @high: %gdouble, strong edge threshold
  *
  * Find edges by Canny's method: The maximum of the derivative of the gradient
  * in the direction of the gradient. Output is float, except for uchar input,
@@ -494,10 +927,19 @@ vips_canny_init( VipsCanny *canny )
  *
  * Use @precision to set the precision of edge detection. For uchar images,
  * setting this to #VIPS_PRECISION_INTEGER will make edge detection much 
- * faster, but sacrifice some sensitivity. 
+ * faster, but sacrifice some sensitivity. This path works entirely in
+ * integer arithmetic: it finds the gradient with a 3x3 Sobel mask,
+ * G is |Gx| + |Gy| scaled to 0 - 255, and the direction is rounded to one
+ * of four sectors.
+ *
+ * Set @hysteresis to remove weak edges. Pixels with G at or above @high
+ * are edges, as are pixels at or above @low which connect to an edge.
+ * The output is then uchar, with 255 for edges and 0 elsewhere. Edges are
+ * only followed for a short distance outside each tile, so very long weak
+ * edges can be broken.
  *
- * You will probably need to process the output further to eliminate weak 
- * edges. 
+ * Without @hysteresis, you will probably need to process the output
+ * further to eliminate weak edges.
  *
  * See also: vips_sobel().
  * 
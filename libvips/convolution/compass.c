@@ -7,6 +7,8 @@
  *        the default
  * 2/11/17
  * 	- add MIN mode
+ * 14/10/18
+ * 	- do float masks in one pass with vips__convmulti()
  */
 
 /*
@@ -68,7 +70,6 @@ vips_compass_build( VipsObject *object )
 	VipsConvolution *convolution = (VipsConvolution *) object;
 	VipsCompass *compass = (VipsCompass *) object;
 	VipsImage **masks;
-	VipsImage *mask;
 	VipsImage **images;
 	int i; 
 	VipsImage **abs;
@@ -89,22 +90,45 @@ vips_compass_build( VipsObject *object )
 	combine = (VipsImage **) 
 		vips_object_local_array( object, compass->times );
 
-	mask = convolution->M;
-	for( i = 0; i < compass->times; i++ ) {
-		if( vips_conv( convolution->in, &images[i], mask, 
-			"precision", compass->precision,
-			"layers", compass->layers,
-			"cluster", compass->cluster,
-			NULL ) )
-			return( -1 ); 
-		if( vips_rot45( mask, &masks[i],
+	/* masks[0] is the original mask, then each one is rotated from the
+	 * one before.
+	 */
+	g_object_ref( convolution->M );
+	masks[0] = convolution->M;
+	for( i = 1; i < compass->times; i++ )
+		if( vips_rot45( masks[i - 1], &masks[i],
 			"angle", compass->angle,
 			NULL ) )
 			return( -1 ); 
 
-		mask = masks[i];
+	/* For float precision, we can do all the masks in one pass.
+	 */
+	if( compass->precision == VIPS_PRECISION_FLOAT ) {
+		VipsImage **t = (VipsImage **)
+			vips_object_local_array( object, 2 );
+
+		if( vips_image_decode( convolution->in, &t[0] ) )
+			return( -1 );
+
+		if( vips__convmulti_ok( t[0], masks, compass->times ) ) {
+			if( vips__convmulti( t[0], &t[1],
+					masks, compass->times,
+					compass->combine, FALSE ) ||
+				vips_image_write( t[1], convolution->out ) )
+				return( -1 );
+
+			return( 0 );
+		}
 	}
 
+	for( i = 0; i < compass->times; i++ )
+		if( vips_conv( convolution->in, &images[i], masks[i],
+			"precision", compass->precision,
+			"layers", compass->layers,
+			"cluster", compass->cluster,
+			NULL ) )
+			return( -1 );
+
 	for( i = 0; i < compass->times; i++ )
 		if( vips_abs( images[i], &abs[i], NULL ) )
 			return( -1 ); 
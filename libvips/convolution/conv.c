@@ -5,6 +5,8 @@
  * 8/5/17
  * 	- default to float ... int will often lose precision and should not be
  * 	  the default
+ * 14/10/18
+ * 	- use vips_convfft() for large masks
  */
 
 /*
@@ -92,8 +94,16 @@ vips_conv_build( VipsObject *object )
 
 	switch( conv->precision ) { 
 	case VIPS_PRECISION_FLOAT:
-		if( vips_convf( in, &t[1], convolution->M, NULL ) ||
-			vips_image_write( t[1], convolution->out ) )
+		/* Large masks are much quicker to do in the frequency domain.
+		 */
+		if( vips__convfft_worthwhile( in, convolution->M ) ) {
+			if( vips_convfft( in, &t[1], convolution->M, NULL ) )
+				return( -1 );
+		}
+		else if( vips_convf( in, &t[1], convolution->M, NULL ) )
+			return( -1 );
+
+		if( vips_image_write( t[1], convolution->out ) )
 			return( -1 ); 
 		break;
 
@@ -195,6 +205,9 @@ vips_conv_init( VipsConv *conv )
  * is always #VIPS_FORMAT_FLOAT unless @in is #VIPS_FORMAT_DOUBLE, in which case
  * @out is also #VIPS_FORMAT_DOUBLE. 
  *
+ * With #VIPS_PRECISION_FLOAT, large masks on large images are computed with
+ * vips_convfft() instead. This needs libvips to have been built with fftw.
+ *
  * If @precision is #VIPS_PRECISION_INTEGER, then 
  * elements of @mask are converted to
  * integers before convolution, using rint(),
@@ -9,6 +9,8 @@
  *      - from im_conv()
  * 5/7/16
  * 	- redone as a class
+ * 14/10/18
+ * 	- keep int column sums between vertical tiles
  */
 
 /*
@@ -349,6 +351,15 @@ typedef struct {
 	double *dsum;		
 
 	int last_stride;	/* Avoid recalcing offsets, if we can */
+
+	/* For int vertical passes, the sums for every column, kept between
+	 * calls. If the next area is directly below the last one, we can
+	 * carry on from these rather than running the mask again.
+	 */
+	int *column;
+	size_t column_size;
+	VipsRect last;
+	gboolean last_valid;
 } VipsConvasepSeq;
 
 /* Free a sequence value.
@@ -363,6 +374,7 @@ vips_convasep_stop( void *vseq, void *a, void *b )
 	VIPS_FREE( seq->end );
 	VIPS_FREE( seq->isum );
 	VIPS_FREE( seq->dsum );
+	VIPS_FREE( seq->column );
 
 	return( 0 );
 }
@@ -393,6 +405,9 @@ vips_convasep_start( VipsImage *out, void *a, void *b )
 	else
 		seq->dsum = VIPS_ARRAY( NULL, convasep->n_lines, double );
 	seq->last_stride = -1;
+	seq->column = NULL;
+	seq->column_size = 0;
+	seq->last_valid = FALSE;
 
 	if( !seq->ir || 
 		!seq->start || 
@@ -623,31 +638,41 @@ vips_convasep_generate_horizontal( VipsRegion *or,
 	return( 0 );
 }
 
+/* If we are resuming, p starts one line above the output area and we update
+ * the sums for the first line too. Otherwise, sum the first line from
+ * scratch.
+ */
 #define VCONV_INT( TYPE, CLIP ) { \
 	for( x = 0; x < sz; x++ ) { \
-		int *isum = seq->isum; \
+		int *isum = seq->column + x * n_lines; \
 		\
 		TYPE *q; \
 		TYPE *p; \
 		int sum; \
+		int y0; \
 		\
-		p = x + (TYPE *) VIPS_REGION_ADDR( ir, r->left, r->top ); \
+		p = x + (TYPE *) VIPS_REGION_ADDR( ir, r->left, s.top ); \
 		q = x + (TYPE *) VIPS_REGION_ADDR( or, r->left, r->top ); \
 		\
-		sum = 0; \
-		for( z = 0; z < n_lines; z++ ) { \
-			isum[z] = 0; \
-			for( y = seq->start[z]; y < seq->end[z]; y += istride ) \
-				isum[z] += p[y]; \
-			sum += convasep->factor[z] * isum[z]; \
+		y0 = 0; \
+		if( !resume ) { \
+			sum = 0; \
+			for( z = 0; z < n_lines; z++ ) { \
+				isum[z] = 0; \
+				for( y = seq->start[z]; y < seq->end[z]; \
+					y += istride ) \
+					isum[z] += p[y]; \
+				sum += convasep->factor[z] * isum[z]; \
+			} \
+			sum = (sum + convasep->rounding) / \
+				convasep->divisor + convasep->offset; \
+			CLIP( sum ); \
+			*q = sum; \
+			q += ostride; \
+			y0 = 1; \
 		} \
-		sum = (sum + convasep->rounding) / convasep->divisor + \
-			convasep->offset; \
-		CLIP( sum ); \
-		*q = sum; \
-		q += ostride; \
 		\
-		for( y = 1; y < r->height; y++ ) { \
+		for( y = y0; y < r->height; y++ ) { \
 			sum = 0; \
 			for( z = 0; z < n_lines; z++ ) { \
 				isum[z] += p[seq->end[z]]; \
@@ -726,15 +751,45 @@ vips_convasep_generate_vertical( VipsRegion *or,
 	int x, y, z;
 	int istride;
 	int ostride;
+	gboolean isint;
+	gboolean resume;
+
+	/* int sums are exact, so we can keep them from the area above. float
+	 * sums would drift, so we always start again to keep the result the
+	 * same as a fresh calculation.
+	 */
+	isint = vips_band_format_isint( in->BandFmt );
+	resume = isint &&
+		seq->last_valid &&
+		seq->last.left == r->left &&
+		seq->last.width == r->width &&
+		VIPS_RECT_BOTTOM( &seq->last ) == r->top;
 
 	/* Prepare the section of the input image we need. A little larger
-	 * than the section of the output image we are producing.
+	 * than the section of the output image we are producing, and one
+	 * line taller if we are resuming.
 	 */
 	s = *r;
 	s.height += convasep->width - 1;
+	if( resume ) {
+		s.top -= 1;
+		s.height += 1;
+	}
 	if( vips_region_prepare( ir, &s ) )
 		return( -1 );
 
+	if( isint &&
+		seq->column_size < (size_t) sz * n_lines ) {
+		VIPS_FREE( seq->column );
+		seq->column_size = (size_t) sz * n_lines;
+		if( !(seq->column =
+			VIPS_ARRAY( NULL, seq->column_size, int )) ) {
+			seq->column_size = 0;
+			seq->last_valid = FALSE;
+			return( -1 );
+		}
+	}
+
 	/* Stride can be different for the vertical case, keep this here for
 	 * ease of direction change.
 	 */
@@ -792,6 +847,9 @@ vips_convasep_generate_vertical( VipsRegion *or,
 		g_assert_not_reached();
 	}
 
+	seq->last = *r;
+	seq->last_valid = isint;
+
 	return( 0 );
 }
 
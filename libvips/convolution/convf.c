@@ -49,6 +49,8 @@
  * 	- redone as a class
  * 2/7/17
  * 	- remove pts for a small speedup
+ * 14/10/18
+ * 	- work in column strips for very wide regions
  */
 
 /*
@@ -192,10 +194,12 @@ vips_convf_gen( REGION *or, void *vseq, void *a, void *b, gboolean *stop )
 	int le = r->left;
 	int to = r->top;
 	int bo = VIPS_RECT_BOTTOM( r );
-	int sz = VIPS_REGION_N_ELEMENTS( or ) * 
+	int ncomp = in->Bands *
 		(vips_band_format_iscomplex( in->BandFmt ) ? 2 : 1);
+	int sz;
 
 	VipsRect s;
+	int bx, bw;
 	int x, y, z, i;
 
 	/* Prepare the section of the input image we need. A little larger
@@ -227,44 +231,52 @@ vips_convf_gen( REGION *or, void *vseq, void *a, void *b, gboolean *stop )
 
 	VIPS_GATE_START( "vips_convf_gen: work" ); 
 
-	for( y = to; y < bo; y++ ) { 
-		switch( in->BandFmt ) {
-		case VIPS_FORMAT_UCHAR: 	
-			CONV_FLOAT( unsigned char, float ); 
-			break;
-
-		case VIPS_FORMAT_CHAR:   
-			CONV_FLOAT( signed char, float ); 
-			break;
-
-		case VIPS_FORMAT_USHORT: 
-			CONV_FLOAT( unsigned short, float ); 
-			break;
-
-		case VIPS_FORMAT_SHORT:  
-			CONV_FLOAT( signed short, float ); 
-			break;
-
-		case VIPS_FORMAT_UINT:   
-			CONV_FLOAT( unsigned int, float ); 
-			break;
-
-		case VIPS_FORMAT_INT:    
-			CONV_FLOAT( signed int, float ); 
-			break;
-
-		case VIPS_FORMAT_FLOAT:  
-		case VIPS_FORMAT_COMPLEX:  
-			CONV_FLOAT( float, float ); 
-			break;
-
-		case VIPS_FORMAT_DOUBLE: 
-		case VIPS_FORMAT_DPCOMPLEX:  
-			CONV_FLOAT( double, double ); 
-			break;
-
-		default:
-			g_assert_not_reached();
+	/* Work down column strips, see vips__conv_block_width().
+	 */
+	bw = vips__conv_block_width( ir, M, r->width );
+	for( bx = r->left; bx < VIPS_RECT_RIGHT( r ); bx += bw ) {
+		le = bx;
+		sz = VIPS_MIN( bw, VIPS_RECT_RIGHT( r ) - bx ) * ncomp;
+
+		for( y = to; y < bo; y++ ) {
+			switch( in->BandFmt ) {
+			case VIPS_FORMAT_UCHAR:
+				CONV_FLOAT( unsigned char, float );
+				break;
+
+			case VIPS_FORMAT_CHAR:
+				CONV_FLOAT( signed char, float );
+				break;
+
+			case VIPS_FORMAT_USHORT:
+				CONV_FLOAT( unsigned short, float );
+				break;
+
+			case VIPS_FORMAT_SHORT:
+				CONV_FLOAT( signed short, float );
+				break;
+
+			case VIPS_FORMAT_UINT:
+				CONV_FLOAT( unsigned int, float );
+				break;
+
+			case VIPS_FORMAT_INT:
+				CONV_FLOAT( signed int, float );
+				break;
+
+			case VIPS_FORMAT_FLOAT:
+			case VIPS_FORMAT_COMPLEX:
+				CONV_FLOAT( float, float );
+				break;
+
+			case VIPS_FORMAT_DOUBLE:
+			case VIPS_FORMAT_DPCOMPLEX:
+				CONV_FLOAT( double, double );
+				break;
+
+			default:
+				g_assert_not_reached();
+			}
 		}
 	}
 
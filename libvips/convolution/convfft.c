@@ -0,0 +1,573 @@
+/* convfft
+ *
+ * 14/10/18
+ * 	- from convf.c
+ * 	- plan with the shared freqfilt plan cache and lock
+ */
+
+/*
+
+    This file is part of VIPS.
+
+    VIPS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA
+
+ */
+
+/*
+
+    These files are distributed with VIPS - http://www.vips.ecs.soton.ac.uk
+
+ */
+
+/*
+
+  Overlap-save in blocks. Each block is an N x N piece of the embedded input,
+  N a power of two. We transform it, multiply by the transform of the mask
+  (rotated and wrapped to the origin), transform back, and keep the
+  (N - mask + 1) pixels in each direction that circular convolution has not
+  wrapped into.
+
+  Plans come from the freqfilt plan cache, so they are shared with fwfft and 
+  friends, and all planning happens under the one fftw planner lock. Blocks 
+  are run by many worker threads at once, so we plan single-threaded.
+
+ */
+
+/*
+#define DEBUG
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /*HAVE_CONFIG_H*/
+#include <vips/intl.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vips/vips.h>
+
+#include "pconvolution.h"
+#include "../freqfilt/pfreqfilt.h"
+
+/* vips_conv() uses us for masks with at least this many non-zero elements,
+ * and images where the direct path would need at least this many
+ * multiply-adds.
+ */
+#define VIPS_CONVFFT_MIN_MASK (400)
+#define VIPS_CONVFFT_MIN_WORK (1e8)
+
+#ifdef HAVE_FFTW
+
+#include <fftw3.h>
+
+/* Block sizes we can use are 2^VIPS_CONVFFT_MIN_SHIFT to
+ * 2^VIPS_CONVFFT_MAX_SHIFT.
+ */
+#define VIPS_CONVFFT_MIN_SHIFT (6)
+#define VIPS_CONVFFT_MAX_SHIFT (11)
+
+typedef struct {
+	VipsConvolution parent_instance;
+
+	/* Block size, and the number of output pixels each block makes
+	 * across and down.
+	 */
+	int n;
+	int valid_width;
+	int valid_height;
+
+	/* The transform of the mask, n x (n / 2 + 1) complex. We fold the
+	 * fftw normalisation and the mask scale into this.
+	 */
+	double *mask;
+
+	VipsFftPlan *forward_plan;
+	VipsFftPlan *inverse_plan;
+	fftw_plan forward;
+	fftw_plan inverse;
+} VipsConvfft;
+
+typedef VipsConvolutionClass VipsConvfftClass;
+
+G_DEFINE_TYPE( VipsConvfft, vips_convfft, VIPS_TYPE_CONVOLUTION );
+
+static void
+vips_convfft_dispose( GObject *gobject )
+{
+	VipsConvfft *convfft = (VipsConvfft *) gobject;
+
+	VIPS_FREEF( vips__fft_plan_release, convfft->forward_plan );
+	VIPS_FREEF( vips__fft_plan_release, convfft->inverse_plan );
+	convfft->forward = NULL;
+	convfft->inverse = NULL;
+
+	G_OBJECT_CLASS( vips_convfft_parent_class )->dispose( gobject );
+}
+
+/* Get the plans for an n x n block. Executing a plan on new arrays is 
+ * threadsafe, as long as they have the same alignment. We use fftw_malloc() 
+ * for everything we pass to fftw, so @real and @complex will do for the
+ * sequence buffers too.
+ */
+static int
+vips_convfft_get_plans( VipsConvfft *convfft, 
+	double *real, fftw_complex *complex )
+{
+	const int n = convfft->n;
+
+	if( !(convfft->forward_plan = vips__fft_plan( VIPS_OBJECT( convfft ),
+		VIPS_FFT_FORWARD_R2C, n, n, 1, real, complex )) ||
+		!(convfft->inverse_plan = vips__fft_plan( 
+			VIPS_OBJECT( convfft ),
+			VIPS_FFT_BACKWARD_C2R, n, n, 1, complex, real )) )
+		return( -1 );
+
+	convfft->forward = vips__fft_plan_fftw( convfft->forward_plan );
+	convfft->inverse = vips__fft_plan_fftw( convfft->inverse_plan );
+
+	return( 0 );
+}
+
+/* Our sequence value. real is a block, complex is its transform.
+ */
+typedef struct {
+	VipsRegion *ir;
+
+	double *real;
+	fftw_complex *complex;
+} VipsConvfftSequence;
+
+static int
+vips_convfft_stop( void *vseq, void *a, void *b )
+{
+	VipsConvfftSequence *seq = (VipsConvfftSequence *) vseq;
+
+	VIPS_UNREF( seq->ir );
+	VIPS_FREEF( fftw_free, seq->real );
+	VIPS_FREEF( fftw_free, seq->complex );
+
+	return( 0 );
+}
+
+static void *
+vips_convfft_start( VipsImage *out, void *a, void *b )
+{
+	VipsImage *in = (VipsImage *) a;
+	VipsConvfft *convfft = (VipsConvfft *) b;
+	const int n = convfft->n;
+
+	VipsConvfftSequence *seq;
+
+	if( !(seq = VIPS_NEW( out, VipsConvfftSequence )) )
+		return( NULL );
+
+	seq->ir = vips_region_new( in );
+	seq->real = (double *) fftw_malloc( n * n * sizeof( double ) );
+	seq->complex = (fftw_complex *)
+		fftw_malloc( n * (n / 2 + 1) * sizeof( fftw_complex ) );
+	if( !seq->ir ||
+		!seq->real ||
+		!seq->complex ) {
+		vips_convfft_stop( seq, in, convfft );
+		return( NULL );
+	}
+
+	return( seq );
+}
+
+#define CONVFFT_IN( TYPE ) { \
+	for( y = 0; y < s->height; y++ ) { \
+		TYPE *p = (TYPE *) \
+			VIPS_REGION_ADDR( ir, s->left, s->top + y ) + b; \
+		double *q = seq->real + y * n; \
+		\
+		for( x = 0; x < s->width; x++ ) { \
+			q[x] = *p; \
+			p += bands; \
+		} \
+	} \
+}
+
+#define CONVFFT_OUT( TYPE ) { \
+	for( y = 0; y < r->height; y++ ) { \
+		TYPE *q = (TYPE *) \
+			VIPS_REGION_ADDR( or, r->left, r->top + y ) + b; \
+		double *p = seq->real + y * n; \
+		\
+		for( x = 0; x < r->width; x++ ) { \
+			*q = p[x] + offset; \
+			q += bands; \
+		} \
+	} \
+}
+
+/* Convolve one block: r is the output area, s the input area it needs.
+ */
+static void
+vips_convfft_block( VipsConvfft *convfft, VipsConvfftSequence *seq,
+	VipsRegion *or, VipsRect *r, VipsRect *s )
+{
+	VipsConvolution *convolution = (VipsConvolution *) convfft;
+	VipsRegion *ir = seq->ir;
+	const int n = convfft->n;
+	const int n_complex = n * (n / 2 + 1);
+	const int bands = ir->im->Bands;
+	const double offset = vips_image_get_offset( convolution->M );
+
+	int x, y, b, i;
+
+	for( b = 0; b < bands; b++ ) {
+		double *mask = convfft->mask;
+		double *c = (double *) seq->complex;
+
+		/* The block can be smaller than n at the image edges. The
+		 * zeros only reach outputs we don't keep.
+		 */
+		memset( seq->real, 0, n * n * sizeof( double ) );
+
+		switch( ir->im->BandFmt ) {
+		case VIPS_FORMAT_UCHAR:
+			CONVFFT_IN( unsigned char );
+			break;
+
+		case VIPS_FORMAT_CHAR:
+			CONVFFT_IN( signed char );
+			break;
+
+		case VIPS_FORMAT_USHORT:
+			CONVFFT_IN( unsigned short );
+			break;
+
+		case VIPS_FORMAT_SHORT:
+			CONVFFT_IN( signed short );
+			break;
+
+		case VIPS_FORMAT_UINT:
+			CONVFFT_IN( unsigned int );
+			break;
+
+		case VIPS_FORMAT_INT:
+			CONVFFT_IN( signed int );
+			break;
+
+		case VIPS_FORMAT_FLOAT:
+			CONVFFT_IN( float );
+			break;
+
+		case VIPS_FORMAT_DOUBLE:
+			CONVFFT_IN( double );
+			break;
+
+		default:
+			g_assert_not_reached();
+		}
+
+		fftw_execute_dft_r2c( convfft->forward,
+			seq->real, seq->complex );
+
+		for( i = 0; i < n_complex; i++ ) {
+			double re = c[0] * mask[0] - c[1] * mask[1];
+			double im = c[0] * mask[1] + c[1] * mask[0];
+
+			c[0] = re;
+			c[1] = im;
+
+			c += 2;
+			mask += 2;
+		}
+
+		fftw_execute_dft_c2r( convfft->inverse,
+			seq->complex, seq->real );
+
+		if( or->im->BandFmt == VIPS_FORMAT_DOUBLE )
+			CONVFFT_OUT( double )
+		else
+			CONVFFT_OUT( float )
+	}
+}
+
+static int
+vips_convfft_gen( VipsRegion *or,
+	void *vseq, void *a, void *b, gboolean *stop )
+{
+	VipsConvfftSequence *seq = (VipsConvfftSequence *) vseq;
+	VipsConvfft *convfft = (VipsConvfft *) b;
+	VipsConvolution *convolution = (VipsConvolution *) convfft;
+	VipsImage *M = convolution->M;
+	VipsRect *r = &or->valid;
+
+	int x, y;
+
+	VIPS_GATE_START( "vips_convfft_gen: work" );
+
+	for( y = 0; y < r->height; y += convfft->valid_height )
+		for( x = 0; x < r->width; x += convfft->valid_width ) {
+			VipsRect block;
+			VipsRect need;
+
+			block.left = r->left + x;
+			block.top = r->top + y;
+			block.width = VIPS_MIN( convfft->valid_width,
+				r->width - x );
+			block.height = VIPS_MIN( convfft->valid_height,
+				r->height - y );
+
+			need = block;
+			need.width += M->Xsize - 1;
+			need.height += M->Ysize - 1;
+			if( vips_region_prepare( seq->ir, &need ) ) {
+				VIPS_GATE_STOP( "vips_convfft_gen: work" );
+				return( -1 );
+			}
+
+			vips_convfft_block( convfft, seq, or, &block, &need );
+		}
+
+	VIPS_GATE_STOP( "vips_convfft_gen: work" );
+
+	VIPS_COUNT_PIXELS( or, "vips_convfft_gen" );
+
+	return( 0 );
+}
+
+/* Transform the mask. We want correlation, as convf does, so the mask is
+ * rotated 180 degrees and wrapped round to the origin.
+ */
+static int
+vips_convfft_mask( VipsConvfft *convfft )
+{
+	VipsConvolution *convolution = (VipsConvolution *) convfft;
+	VipsImage *M = convolution->M;
+	const int n = convfft->n;
+	const int n_complex = n * (n / 2 + 1);
+	const double scale = vips_image_get_scale( M ) * n * n;
+
+	double *real;
+	fftw_complex *complex;
+	int x, y, i;
+
+	if( !(convfft->mask = VIPS_ARRAY( convfft, 2 * n_complex, double )) )
+		return( -1 );
+
+	real = (double *) fftw_malloc( n * n * sizeof( double ) );
+	complex = (fftw_complex *)
+		fftw_malloc( n_complex * sizeof( fftw_complex ) );
+	if( !real ||
+		!complex ) {
+		if( real )
+			fftw_free( real );
+		if( complex )
+			fftw_free( complex );
+		vips_error( "convfft", "%s", _( "out of memory" ) );
+		return( -1 );
+	}
+
+	if( vips_convfft_get_plans( convfft, real, complex ) ) {
+		fftw_free( real );
+		fftw_free( complex );
+		return( -1 );
+	}
+
+	memset( real, 0, n * n * sizeof( double ) );
+	for( y = 0; y < M->Ysize; y++ )
+		for( x = 0; x < M->Xsize; x++ )
+			real[((n - y) % n) * n + (n - x) % n] =
+				*VIPS_MATRIX( M, x, y ) / scale;
+
+	fftw_execute_dft_r2c( convfft->forward, real, complex );
+
+	for( i = 0; i < n_complex; i++ ) {
+		convfft->mask[2 * i] = complex[i][0];
+		convfft->mask[2 * i + 1] = complex[i][1];
+	}
+
+	fftw_free( real );
+	fftw_free( complex );
+
+	return( 0 );
+}
+
+/* The block size we'd use for this mask, or 0 if it's too large. About four
+ * times the mask size keeps the wasted margin small.
+ */
+static int
+vips_convfft_shift( VipsImage *M )
+{
+	int size = VIPS_MAX( M->Xsize, M->Ysize );
+
+	int shift;
+
+	for( shift = VIPS_CONVFFT_MIN_SHIFT;
+		shift < VIPS_CONVFFT_MAX_SHIFT; shift++ )
+		if( (1 << shift) >= 4 * size )
+			break;
+
+	if( (1 << shift) <= size )
+		return( 0 );
+
+	return( shift );
+}
+
+static int
+vips_convfft_build( VipsObject *object )
+{
+	VipsObjectClass *class = VIPS_OBJECT_GET_CLASS( object );
+	VipsConvolution *convolution = (VipsConvolution *) object;
+	VipsConvfft *convfft = (VipsConvfft *) object;
+	VipsImage **t = (VipsImage **) vips_object_local_array( object, 4 );
+
+	VipsImage *in;
+	VipsImage *M;
+	int shift;
+
+	if( VIPS_OBJECT_CLASS( vips_convfft_parent_class )->build( object ) )
+		return( -1 );
+
+	in = convolution->in;
+	M = convolution->M;
+
+	if( vips_check_uncoded( class->nickname, in ) ||
+		vips_check_noncomplex( class->nickname, in ) )
+		return( -1 );
+
+	if( !(shift = vips_convfft_shift( M )) ) {
+		vips_error( class->nickname, "%s", _( "mask too large" ) );
+		return( -1 );
+	}
+	convfft->n = 1 << shift;
+	convfft->valid_width = convfft->n - M->Xsize + 1;
+	convfft->valid_height = convfft->n - M->Ysize + 1;
+
+	if( vips_convfft_mask( convfft ) )
+		return( -1 );
+
+	if( vips_embed( in, &t[0],
+		M->Xsize / 2, M->Ysize / 2,
+		in->Xsize + M->Xsize - 1, in->Ysize + M->Ysize - 1,
+		"extend", VIPS_EXTEND_COPY,
+		NULL ) )
+		return( -1 );
+	in = t[0];
+
+	g_object_set( convfft, "out", vips_image_new(), NULL );
+	if( vips_image_pipelinev( convolution->out,
+		VIPS_DEMAND_STYLE_SMALLTILE, in, NULL ) )
+		return( -1 );
+
+	if( in->BandFmt != VIPS_FORMAT_DOUBLE )
+		convolution->out->BandFmt = VIPS_FORMAT_FLOAT;
+	convolution->out->Xsize -= M->Xsize - 1;
+	convolution->out->Ysize -= M->Ysize - 1;
+
+	if( vips_image_generate( convolution->out,
+		vips_convfft_start, vips_convfft_gen, vips_convfft_stop,
+		in, convfft ) )
+		return( -1 );
+
+	convolution->out->Xoffset = -M->Xsize / 2;
+	convolution->out->Yoffset = -M->Ysize / 2;
+
+	return( 0 );
+}
+
+static void
+vips_convfft_class_init( VipsConvfftClass *class )
+{
+	GObjectClass *gobject_class = G_OBJECT_CLASS( class );
+	VipsObjectClass *object_class = (VipsObjectClass *) class;
+
+	gobject_class->dispose = vips_convfft_dispose;
+
+	object_class->nickname = "convfft";
+	object_class->description = _( "FFT convolution operation" );
+	object_class->build = vips_convfft_build;
+}
+
+static void
+vips_convfft_init( VipsConvfft *convfft )
+{
+}
+
+#endif /*HAVE_FFTW*/
+
+/* Should vips_conv() use vips_convfft() for this image and mask? The FFT
+ * path costs about the same per pixel for any mask, but has a fixed cost for
+ * the plans and the mask transform, so we need a large mask and a fair
+ * amount of work.
+ */
+gboolean
+vips__convfft_worthwhile( VipsImage *in, VipsImage *M )
+{
+#ifdef HAVE_FFTW
+	/* Non-zero elements, since that's what the direct path costs.
+	 */
+	int nnz;
+	int i;
+
+	if( in->Coding != VIPS_CODING_NONE ||
+		vips_band_format_iscomplex( in->BandFmt ) ||
+		!vips_convfft_shift( M ) )
+		return( FALSE );
+
+	nnz = 0;
+	for( i = 0; i < M->Xsize * M->Ysize; i++ )
+		if( VIPS_MATRIX( M, 0, 0 )[i] != 0.0 )
+			nnz += 1;
+
+	return( nnz >= VIPS_CONVFFT_MIN_MASK &&
+		(double) nnz * VIPS_IMAGE_N_PELS( in ) * in->Bands >=
+			VIPS_CONVFFT_MIN_WORK );
+#else /*!HAVE_FFTW*/
+	return( FALSE );
+#endif /*HAVE_FFTW*/
+}
+
+/**
+ * vips_convfft: (method)
+ * @in: input image
+ * @out: (out): output image
+ * @mask: convolve with this mask
+ * @...: %NULL-terminated list of optional named arguments
+ *
+ * Convolution. This is a low-level operation, see vips_conv() for something
+ * more convenient.
+ *
+ * This is the same as vips_convf(), but the work is done with Fourier
+ * transforms on blocks of the image. Each output pixel costs about the same
+ * for any size of mask, so this is much faster for large, dense masks.
+ * Results may differ from vips_convf() by small rounding errors.
+ *
+ * vips_conv() uses this automatically for large masks and images, if VIPS
+ * was built with the fftw library. If it was not, this function will fail.
+ *
+ * See also: vips_conv(), vips_convf().
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int
+vips_convfft( VipsImage *in, VipsImage **out, VipsImage *mask, ... )
+{
+	va_list ap;
+	int result;
+
+	va_start( ap, mask );
+	result = vips_call_split( "convfft", ap, in, out, mask );
+	va_end( ap );
+
+	return( result );
+}
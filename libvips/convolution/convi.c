@@ -78,6 +78,12 @@
  * 	- fix leak of vectors, thanks MHeimbuc 
  * 14/10/17
  * 	- switch to half-float for vector path
+ * 14/10/18
+ * 	- vector path uses shifts for power of two coefficients, and sums
+ * 	  mirrored rows with equal coefficients before the multiply
+ * 	- work in column strips for very wide regions
+ * 	- stop inside the row loop if the pipeline is killed, see
+ * 	  vips_thread_iskilled()
  */
 
 /*
@@ -130,11 +136,22 @@
  */
 #define MAX_PASS (20)
 
+/* One step in the vector path: a non-zero mask element, or a pair of
+ * elements in mirrored rows which have the same coefficient. We sum the
+ * pair and multiply once.
+ */
+typedef struct {
+	int x;			/* Position in mask */
+	int y;
+	int y2;			/* Row of partner element, or -1 */
+	int mant;		/* Shared coefficient */
+} Tap;
+
 /* A pass with a vector. 
  */
 typedef struct {
-	int first;		/* The index of the first mask coff we use */
-	int last;		/* The index of the last mask coff we use */
+	int first;		/* The index of the first tap we use */
+	int last;		/* The index of the last tap we use */
 
 	int r;			/* Set previous result in this var */
 
@@ -166,6 +183,11 @@ typedef struct {
 	int sexp;
 	int exp;
 
+	/* The non-zero elements of mant, in the order we compile them.
+	 */
+	int n_tap;
+	Tap *tap;
+
 	/* The set of passes we need for this mask.
 	 */
 	int n_pass;	
@@ -293,6 +315,30 @@ vips_convi_start( VipsImage *out, void *a, void *b )
 #define ASM2( OP, A, B ) vips_vector_asm2( v, (char *) OP, A, B )
 #define ASM3( OP, A, B, C ) vips_vector_asm3( v, (char *) OP, A, B, C )
 
+/* Load mask element x, y as a 16-bit value into var.
+ */
+static void
+vips_convi_compile_load( VipsConvi *convi, VipsImage *in, VipsVector *v,
+	const char *var, int x, int y )
+{
+	char source[256];
+	char off[256];
+
+	/* The source. sl0 is the first scanline in the mask.
+	 */
+	SCANLINE( source, y, 1 );
+
+	/* Load with an offset. Only for non-first-columns though.
+	 */
+	if( x == 0 )
+		ASM2( "convubw", var, source );
+	else {
+		CONST( off, in->Bands * x, 1 );
+		ASM3( "loadoffb", "valueb", source, off );
+		ASM2( "convubw", var, "valueb" );
+	}
+}
+
 /* Generate code for a section of the mask. first is the index we start
  * at, we set last to the index of the last one we use before we run 
  * out of intermediates / constants / parameters / sources or mask
@@ -303,9 +349,6 @@ vips_convi_start( VipsImage *out, void *a, void *b )
 static int
 vips_convi_compile_section( VipsConvi *convi, VipsImage *in, Pass *pass )
 {
-	VipsConvolution *convolution = (VipsConvolution *) convi;
-	VipsImage *M = convolution->M;
-
 	VipsVector *v;
 	int i;
 
@@ -322,6 +365,7 @@ vips_convi_compile_section( VipsConvi *convi, VipsImage *in, Pass *pass )
 	/* The value we fetch from the image, the accumulated sum.
 	 */
 	TEMP( "value", 2 );
+	TEMP( "value2", 2 );
 	TEMP( "valueb", 1 );
 	TEMP( "sum", 2 );
 
@@ -338,55 +382,81 @@ vips_convi_compile_section( VipsConvi *convi, VipsImage *in, Pass *pass )
 	else 
 		ASM2( "loadw", "sum", "r" );
 
-	for( i = pass->first; i < convi->n_point; i++ ) {
-		int x = i % M->Xsize;
-		int y = i / M->Xsize;
+	for( i = pass->first; i < convi->n_tap; i++ ) {
+		Tap *tap = &convi->tap[i];
+		int mant = VIPS_ABS( tap->mant );
 
-		char source[256];
-		char off[256];
 		char rnd[256];
-		char sexp[256];
+		char shift[256];
 		char coeff[256];
 
-		/* Exclude zero elements.
-		 */
-		if( !convi->mant[i] )
-			continue;
+		vips_convi_compile_load( convi, in, v, 
+			"value", tap->x, tap->y );
+		if( tap->y2 >= 0 ) {
+			vips_convi_compile_load( convi, in, v,
+				"value2", tap->x, tap->y2 );
+			ASM3( "addw", "value", "value", "value2" );
+		}
 
-		/* The source. sl0 is the first scanline in the mask.
-		 */
-		SCANLINE( source, y, 1 );
+		if( (mant & (mant - 1)) == 0 ) {
+			int k;
+
+			for( k = 0; (1 << k) < mant; k++ )
+				;
+
+			/* A power of two, so the multiply becomes a shift,
+			 * and the shift right before the add can merge into
+			 * it. This gives exactly the same result as the
+			 * mul / round / shift below.
+			 */
+			if( k >= convi->sexp ) {
+				if( k > convi->sexp ) {
+					CONST( shift, k - convi->sexp, 2 );
+					ASM3( "shlw", "value", "value", shift );
+				}
+			}
+			else {
+				CONST( rnd, 1 << (convi->sexp - 1 - k), 2 );
+				CONST( shift, convi->sexp - k, 2 );
+				if( tap->mant > 0 )
+					ASM3( "addw", "value", "value", rnd );
+				else
+					ASM3( "subw", "value", rnd, "value" );
+				ASM3( "shrsw", "value", "value", shift );
+			}
 
-		/* Load with an offset. Only for non-first-columns though.
-		 */
-		if( x == 0 ) 
-			ASM2( "convubw", "value", source );
+			/* We've not negated for k >= sexp, subtract instead.
+			 */
+			if( tap->mant < 0 &&
+				k >= convi->sexp )
+				ASM3( "subssw", "sum", "sum", "value" );
+			else
+				ASM3( "addssw", "sum", "sum", "value" );
+		}
 		else {
-			CONST( off, in->Bands * x, 1 );
-			ASM3( "loadoffb", "valueb", source, off );
-			ASM2( "convubw", "value", "valueb" );
+			/* We need a signed multiply, so the image pixel needs
+			 * to become a signed 16-bit value. We know only the
+			 * bottom 8 bits of the image and coefficient are
+			 * interesting, so we can take the bottom half of a
+			 * 16x16->32 multiply.
+			 */
+			CONST( coeff, tap->mant, 2 );
+			ASM3( "mullw", "value", "value", coeff );
+
+			/* Shift right before add to prevent overflow on large
+			 * masks.
+			 */
+			CONST( shift, convi->sexp, 2 );
+			CONST( rnd, 1 << (convi->sexp - 1), 2 );
+			ASM3( "addw", "value", "value", rnd );
+			ASM3( "shrsw", "value", "value", shift );
+
+			/* We accumulate the signed 16-bit result in sum.
+			 * Saturated add.
+			 */
+			ASM3( "addssw", "sum", "sum", "value" );
 		}
 
-		/* We need a signed multiply, so the image pixel needs to
-		 * become a signed 16-bit value. We know only the bottom 8 bits
-		 * of the image and coefficient are interesting, so we can take
-		 * the bottom half of a 16x16->32 multiply. 
-		 */
-		CONST( coeff, convi->mant[i], 2 );
-		ASM3( "mullw", "value", "value", coeff );
-
-		/* Shift right before add to prevent overflow on large masks.
-		 */
-		CONST( sexp, convi->sexp, 2 );
-		CONST( rnd, 1 << (convi->sexp - 1), 2 );
-		ASM3( "addw", "value", "value", rnd );
-		ASM3( "shrsw", "value", "value", sexp );
-
-		/* We accumulate the signed 16-bit result in sum. Saturated
-		 * add. 
-		 */
-		ASM3( "addssw", "sum", "sum", "value" );
-
 		if( vips_vector_full( v ) )
 			break;
 	}
@@ -484,7 +554,7 @@ vips_convi_compile( VipsConvi *convi, VipsImage *in )
 			return( -1 );
 		i = pass->last + 1;
 
-		if( i >= convi->n_point )
+		if( i >= convi->n_tap )
 			break;
 	}
 
@@ -505,9 +575,9 @@ vips_convi_gen_vector( VipsRegion *or,
 	VipsImage *in = (VipsImage *) a;
 	VipsRegion *ir = seq->ir;
 	VipsRect *r = &or->valid;
-	int ne = r->width * in->Bands;
 
 	VipsRect s;
+	int bx, bw;
 	int i, y;
 	VipsExecutor executor[MAX_PASS];
 	VipsExecutor clip;
@@ -526,58 +596,67 @@ vips_convi_gen_vector( VipsRegion *or,
 	if( vips_region_prepare( ir, &s ) )
 		return( -1 );
 
-	for( i = 0; i < convi->n_pass; i++ ) 
-		vips_executor_set_program( &executor[i], 
-			convi->pass[i].vector, ne );
-	vips_executor_set_program( &clip, convi->vector, ne );
-
 	VIPS_GATE_START( "vips_convi_gen_vector: work" ); 
 
-	for( y = 0; y < r->height; y ++ ) { 
-		VipsPel *q = VIPS_REGION_ADDR( or, r->left, r->top + y );
+	/* Work down column strips, see vips__conv_block_width().
+	 */
+	bw = vips__conv_block_width( ir, M, r->width );
+	for( bx = r->left; bx < VIPS_RECT_RIGHT( r ); bx += bw ) {
+		int ne = VIPS_MIN( bw, VIPS_RECT_RIGHT( r ) - bx ) * in->Bands;
+
+		for( i = 0; i < convi->n_pass; i++ )
+			vips_executor_set_program( &executor[i],
+				convi->pass[i].vector, ne );
+		vips_executor_set_program( &clip, convi->vector, ne );
+
+		for( y = 0; y < r->height; y ++ ) {
+			VipsPel *q = VIPS_REGION_ADDR( or, bx, r->top + y );
 	
 #ifdef DEBUG_PIXELS
 {
-		int h, v;
-
-		printf( "before convolve: x = %d, y = %d\n", 
-			r->left, r->top + y );
-		for( v = 0; v < M->Ysize; v++ ) {
-			for( h = 0; h < M->Xsize; h++ )
-				printf( "%3d ", *VIPS_REGION_ADDR( ir, 
-					r->left + h, r->top + y + v ) );
-			printf( "\n" );
-		}
+			int h, v;
+
+			printf( "before convolve: x = %d, y = %d\n",
+				r->left, r->top + y );
+			for( v = 0; v < M->Ysize; v++ ) {
+				for( h = 0; h < M->Xsize; h++ )
+					printf( "%3d ", *VIPS_REGION_ADDR( ir,
+						r->left + h, r->top + y + v ) );
+				printf( "\n" );
+			}
 }
 #endif /*DEBUG_PIXELS*/
 
-		/* We run our n passes to generate this scanline.
-		 */
-		for( i = 0; i < convi->n_pass; i++ ) {
-			Pass *pass = &convi->pass[i]; 
+			/* We run our n passes to generate this scanline.
+			 */
+			for( i = 0; i < convi->n_pass; i++ ) {
+				Pass *pass = &convi->pass[i];
 
-			vips_executor_set_scanline( &executor[i], 
-				ir, r->left, r->top + y );
-			vips_executor_set_array( &executor[i],
-				pass->r, seq->t1 );
-			vips_executor_set_destination( &executor[i], seq->t2 );
-			vips_executor_run( &executor[i] );
+				vips_executor_set_scanline( &executor[i],
+					ir, bx, r->top + y );
+				vips_executor_set_array( &executor[i],
+					pass->r, seq->t1 );
+				vips_executor_set_destination( &executor[i],
+					seq->t2 );
+				vips_executor_run( &executor[i] );
 
-			VIPS_SWAP( signed short *, seq->t1, seq->t2 );
-		}
+				VIPS_SWAP( signed short *, seq->t1, seq->t2 );
+			}
 
 #ifdef DEBUG_PIXELS
-		printf( "before clip: %d\n", ((signed short *) seq->t1)[0] );
+			printf( "before clip: %d\n",
+				((signed short *) seq->t1)[0] );
 #endif /*DEBUG_PIXELS*/
 
-		vips_executor_set_array( &clip, convi->r, seq->t1 );
-		vips_executor_set_destination( &clip, q ); 
-		vips_executor_run( &clip );
+			vips_executor_set_array( &clip, convi->r, seq->t1 );
+			vips_executor_set_destination( &clip, q );
+			vips_executor_run( &clip );
 
 #ifdef DEBUG_PIXELS
-		printf( "after clip: %d\n", 
-			*VIPS_REGION_ADDR( or, r->left, r->top + y ) );
+			printf( "after clip: %d\n",
+				*VIPS_REGION_ADDR( or, r->left, r->top + y ) );
 #endif /*DEBUG_PIXELS*/
+		}
 	}
 
 	VIPS_GATE_STOP( "vips_convi_gen_vector: work" ); 
@@ -690,10 +769,12 @@ vips_convi_gen( VipsRegion *or,
 	int le = r->left;
 	int to = r->top;
 	int bo = VIPS_RECT_BOTTOM( r );
-	int sz = VIPS_REGION_N_ELEMENTS( or ) * 
+	int ncomp = in->Bands *
 		(vips_band_format_iscomplex( in->BandFmt ) ? 2 : 1);
+	int sz;
 
 	VipsRect s;
+	int bx, bw;
 	int x, y, z, i;
 
 	/* Prepare the section of the input image we need. A little larger
@@ -725,44 +806,59 @@ vips_convi_gen( VipsRegion *or,
 
 	VIPS_GATE_START( "vips_convi_gen: work" ); 
 
-	for( y = to; y < bo; y++ ) { 
-		switch( in->BandFmt ) {
-		case VIPS_FORMAT_UCHAR: 	
-			CONV_INT( unsigned char, CLIP_UCHAR( sum ) ); 
-			break;
+	/* Work down column strips, see vips__conv_block_width().
+	 */
+	bw = vips__conv_block_width( ir, M, r->width );
+	for( bx = r->left; bx < VIPS_RECT_RIGHT( r ); bx += bw ) {
+		le = bx;
+		sz = VIPS_MIN( bw, VIPS_RECT_RIGHT( r ) - bx ) * ncomp;
+
+		for( y = to; y < bo; y++ ) {
+			/* Large masks can make a tile very slow.
+			 */
+			if( vips_thread_iskilled() ) {
+				VIPS_GATE_STOP( "vips_convi_gen: work" );
+				return( -1 );
+			}
 
-		case VIPS_FORMAT_CHAR:   
-			CONV_INT( signed char, CLIP_CHAR( sum ) ); 
-			break;
+			switch( in->BandFmt ) {
+			case VIPS_FORMAT_UCHAR:
+				CONV_INT( unsigned char, CLIP_UCHAR( sum ) );
+				break;
 
-		case VIPS_FORMAT_USHORT: 
-			CONV_INT( unsigned short, CLIP_USHORT( sum ) ); 
-			break;
+			case VIPS_FORMAT_CHAR:
+				CONV_INT( signed char, CLIP_CHAR( sum ) );
+				break;
 
-		case VIPS_FORMAT_SHORT:  
-			CONV_INT( signed short, CLIP_SHORT( sum ) ); 
-			break;
+			case VIPS_FORMAT_USHORT:
+				CONV_INT( unsigned short, CLIP_USHORT( sum ) );
+				break;
 
-		case VIPS_FORMAT_UINT:   
-			CONV_INT( unsigned int, CLIP_NONE( sum ) ); 
-			break;
+			case VIPS_FORMAT_SHORT:
+				CONV_INT( signed short, CLIP_SHORT( sum ) );
+				break;
 
-		case VIPS_FORMAT_INT:    
-			CONV_INT( signed int, CLIP_NONE( sum ) ); 
-			break;
+			case VIPS_FORMAT_UINT:
+				CONV_INT( unsigned int, CLIP_NONE( sum ) );
+				break;
 
-		case VIPS_FORMAT_FLOAT:  
-		case VIPS_FORMAT_COMPLEX:  
-			CONV_FLOAT( float ); 
-			break;
+			case VIPS_FORMAT_INT:
+				CONV_INT( signed int, CLIP_NONE( sum ) );
+				break;
 
-		case VIPS_FORMAT_DOUBLE: 
-		case VIPS_FORMAT_DPCOMPLEX:  
-			CONV_FLOAT( double ); 
-			break;
+			case VIPS_FORMAT_FLOAT:
+			case VIPS_FORMAT_COMPLEX:
+				CONV_FLOAT( float );
+				break;
+
+			case VIPS_FORMAT_DOUBLE:
+			case VIPS_FORMAT_DPCOMPLEX:
+				CONV_FLOAT( double );
+				break;
 
-		default:
-			g_assert_not_reached();
+			default:
+				g_assert_not_reached();
+			}
 		}
 	}
 
@@ -859,6 +955,7 @@ vips_convi_intize( VipsConvi *convi, VipsImage *M )
 	double mx;
 	double mn;
 	int shift;
+	gboolean *used;
 	int i;
 
 	n_point = M->Xsize * M->Ysize;
@@ -938,6 +1035,45 @@ vips_convi_intize( VipsConvi *convi, VipsImage *M )
 		}
 	}
 
+	/* Plan the taps. Zero elements are skipped, and where an element in
+	 * the top half has the same coefficient as the element in the
+	 * mirrored row, as in most smoothing masks, we sum the two pixels and
+	 * multiply once. The pair sum must not overflow 16 bits.
+	 */
+	if( !(convi->tap = VIPS_ARRAY( convi, n_point, Tap )) ||
+		!(used = VIPS_ARRAY( convi, n_point, gboolean )) )
+		return( -1 );
+	for( i = 0; i < n_point; i++ )
+		used[i] = FALSE;
+	convi->n_tap = 0;
+	for( i = 0; i < n_point; i++ ) {
+		int x = i % M->Xsize;
+		int y = i / M->Xsize;
+		int y2 = M->Ysize - 1 - y;
+		int j = x + y2 * M->Xsize;
+		Tap *tap;
+
+		if( !convi->mant[i] ||
+			used[i] )
+			continue;
+
+		tap = &convi->tap[convi->n_tap];
+		convi->n_tap += 1;
+		tap->x = x;
+		tap->y = y;
+		tap->y2 = -1;
+		tap->mant = convi->mant[i];
+		used[i] = TRUE;
+
+		if( y2 > y &&
+			convi->mant[j] == convi->mant[i] &&
+			2 * UCHAR_MAX * VIPS_ABS( tap->mant ) +
+				(1 << (convi->sexp - 1)) <= SHRT_MAX ) {
+			tap->y2 = y2;
+			used[j] = TRUE;
+		}
+	}
+
 #ifdef DEBUG_COMPILE
 {
 	int x, y;
@@ -963,12 +1099,17 @@ vips_convi_intize( VipsConvi *convi, VipsImage *M )
 	int int_value;
 
 	true_sum = 0.0;
+	for( i = 0; i < n_point; i++ )
+		true_sum += 128 * scaled[i];
+
 	int_sum = 0;
-	for( i = 0; i < n_point; i++ ) {
+	for( i = 0; i < convi->n_tap; i++ ) {
+		Tap *tap = &convi->tap[i];
 		int value;
 
-		true_sum += 128 * scaled[i];
-		value = 128 * convi->mant[i];
+		value = 128 * tap->mant;
+		if( tap->y2 >= 0 )
+			value *= 2;
 		value = (value + (1 << (convi->sexp - 1))) >> convi->sexp;
 		int_sum += value;
 		int_sum = VIPS_CLIP( SHRT_MIN, int_sum, SHRT_MAX ); 
@@ -0,0 +1,408 @@
+/* convolve with several masks in one pass
+ *
+ * 14/10/18
+ * 	- from convf.c
+ */
+
+/*
+
+    This file is part of VIPS.
+
+    VIPS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA
+
+ */
+
+/*
+
+    These files are distributed with VIPS - http://www.vips.ecs.soton.ac.uk
+
+ */
+
+/*
+#define DEBUG
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /*HAVE_CONFIG_H*/
+#include <vips/intl.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <vips/vips.h>
+#include <vips/internal.h>
+
+#include "pconvolution.h"
+
+/* Hung off the output image.
+ */
+typedef struct _VipsConvmulti {
+	int n;			/* Number of masks */
+	int width;		/* All masks are this size */
+	int height;
+
+	/* Positions where any mask is non-zero, and the coefficients there,
+	 * with the n masks interleaved so the inner loop runs across them.
+	 */
+	int nnz;
+	int *pos;
+	double *coeff;
+
+	double *scale;
+	double *offset;
+
+	VipsCombine combine;
+	gboolean separate;
+} VipsConvmulti;
+
+typedef struct {
+	VipsRegion *ir;
+
+	int *offsets;		/* Offsets for each position */
+	double *sum;		/* One sum per mask */
+
+	int last_bpl;		/* Avoid recalcing offsets, if we can */
+} VipsConvmultiSequence;
+
+static int
+vips_convmulti_stop( void *vseq, void *a, void *b )
+{
+	VipsConvmultiSequence *seq = (VipsConvmultiSequence *) vseq;
+
+	VIPS_UNREF( seq->ir );
+
+	return( 0 );
+}
+
+static void *
+vips_convmulti_start( VipsImage *out, void *a, void *b )
+{
+	VipsImage *in = (VipsImage *) a;
+	VipsConvmulti *convmulti = (VipsConvmulti *) b;
+
+	VipsConvmultiSequence *seq;
+
+	if( !(seq = VIPS_NEW( out, VipsConvmultiSequence )) )
+		return( NULL );
+
+	seq->ir = vips_region_new( in );
+	seq->offsets = VIPS_ARRAY( out, convmulti->nnz, int );
+	seq->sum = VIPS_ARRAY( out, convmulti->n, double );
+	seq->last_bpl = -1;
+
+	if( !seq->ir ||
+		!seq->offsets ||
+		!seq->sum ) {
+		vips_convmulti_stop( seq, in, convmulti );
+		return( NULL );
+	}
+
+	return( (void *) seq );
+}
+
+/* Each output value is exactly what vips_convf() would make. In combine
+ * mode, abs and combine in the output type, as vips_abs() and
+ * vips_bandrank() or vips_sum() would.
+ */
+#define CONVMULTI( ITYPE, OTYPE ) { \
+	ITYPE * restrict p = (ITYPE *) VIPS_REGION_ADDR( ir, le, y ); \
+	OTYPE * restrict q = (OTYPE *) VIPS_REGION_ADDR( or, le, y ); \
+	int * restrict offsets = seq->offsets; \
+	double * restrict sum = seq->sum; \
+	\
+	for( x = 0; x < sz; x++ ) { \
+		for( j = 0; j < n; j++ ) \
+			sum[j] = 0; \
+		for( i = 0; i < nnz; i++ ) { \
+			double v = p[offsets[i]]; \
+			double * restrict c = coeff + i * n; \
+			\
+			for( j = 0; j < n; j++ ) \
+				sum[j] += c[j] * v; \
+		} \
+		\
+		if( convmulti->separate ) { \
+			int pel = x / bands; \
+			int band = x % bands; \
+			OTYPE *qp = q + pel * n * bands + band; \
+			\
+			for( j = 0; j < n; j++ ) \
+				qp[j * bands] = \
+					sum[j] / scale[j] + offset[j]; \
+		} \
+		else { \
+			OTYPE result; \
+			\
+			result = (OTYPE) (sum[0] / scale[0] + offset[0]); \
+			result = VIPS_FABS( result ); \
+			for( j = 1; j < n; j++ ) { \
+				OTYPE v = (OTYPE) (sum[j] / scale[j] + \
+					offset[j]); \
+				\
+				v = VIPS_FABS( v ); \
+				switch( convmulti->combine ) { \
+				case VIPS_COMBINE_MAX: \
+					result = VIPS_MAX( result, v ); \
+					break; \
+				\
+				case VIPS_COMBINE_MIN: \
+					result = VIPS_MIN( result, v ); \
+					break; \
+				\
+				default: \
+					result += v; \
+					break; \
+				} \
+			} \
+			\
+			q[x] = result; \
+		} \
+		\
+		p += 1; \
+	} \
+}
+
+static int
+vips_convmulti_gen( VipsRegion *or,
+	void *vseq, void *a, void *b, gboolean *stop )
+{
+	VipsConvmultiSequence *seq = (VipsConvmultiSequence *) vseq;
+	VipsImage *in = (VipsImage *) a;
+	VipsConvmulti *convmulti = (VipsConvmulti *) b;
+	VipsRegion *ir = seq->ir;
+	const int n = convmulti->n;
+	const int nnz = convmulti->nnz;
+	const int bands = in->Bands;
+	double * restrict coeff = convmulti->coeff;
+	double * restrict scale = convmulti->scale;
+	double * restrict offset = convmulti->offset;
+	VipsRect *r = &or->valid;
+	int le = r->left;
+	int to = r->top;
+	int bo = VIPS_RECT_BOTTOM( r );
+	int sz = r->width * bands;
+
+	VipsRect s;
+	int x, y, z, i, j;
+
+	s = *r;
+	s.width += convmulti->width - 1;
+	s.height += convmulti->height - 1;
+	if( vips_region_prepare( ir, &s ) )
+		return( -1 );
+
+	if( seq->last_bpl != VIPS_REGION_LSKIP( ir ) ) {
+		seq->last_bpl = VIPS_REGION_LSKIP( ir );
+
+		for( i = 0; i < nnz; i++ ) {
+			z = convmulti->pos[i];
+			x = z % convmulti->width;
+			y = z / convmulti->width;
+
+			seq->offsets[i] =
+				(VIPS_REGION_ADDR( ir, x + le, y + to ) -
+				 VIPS_REGION_ADDR( ir, le, to )) /
+					VIPS_IMAGE_SIZEOF_ELEMENT( ir->im );
+		}
+	}
+
+	VIPS_GATE_START( "vips_convmulti_gen: work" );
+
+	for( y = to; y < bo; y++ ) {
+		switch( in->BandFmt ) {
+		case VIPS_FORMAT_UCHAR:
+			CONVMULTI( unsigned char, float );
+			break;
+
+		case VIPS_FORMAT_CHAR:
+			CONVMULTI( signed char, float );
+			break;
+
+		case VIPS_FORMAT_USHORT:
+			CONVMULTI( unsigned short, float );
+			break;
+
+		case VIPS_FORMAT_SHORT:
+			CONVMULTI( signed short, float );
+			break;
+
+		case VIPS_FORMAT_UINT:
+			CONVMULTI( unsigned int, float );
+			break;
+
+		case VIPS_FORMAT_INT:
+			CONVMULTI( signed int, float );
+			break;
+
+		case VIPS_FORMAT_FLOAT:
+			CONVMULTI( float, float );
+			break;
+
+		case VIPS_FORMAT_DOUBLE:
+			CONVMULTI( double, double );
+			break;
+
+		default:
+			g_assert_not_reached();
+		}
+	}
+
+	VIPS_GATE_STOP( "vips_convmulti_gen: work" );
+
+	return( 0 );
+}
+
+/* Can vips__convmulti() do this set of masks? They must all be the same
+ * size, and small enough that vips_conv() wouldn't go to the FFT path.
+ */
+gboolean
+vips__convmulti_ok( VipsImage *in, VipsImage **mask, int n )
+{
+	int i;
+
+	if( in->Coding != VIPS_CODING_NONE ||
+		vips_band_format_iscomplex( in->BandFmt ) )
+		return( FALSE );
+
+	for( i = 0; i < n; i++ )
+		if( mask[i]->Xsize != mask[0]->Xsize ||
+			mask[i]->Ysize != mask[0]->Ysize ||
+			vips__convfft_worthwhile( in, mask[i] ) )
+			return( FALSE );
+
+	return( TRUE );
+}
+
+/* Convolve @in with all @n masks, fetching each input neighbourhood just
+ * once. Each result is computed exactly as vips_convf() would. Output is
+ * float, or double for double input.
+ *
+ * If @separate is set, the output has @n times as many bands as @in, in the
+ * order vips_bandjoin() of the separate convolutions would give. Otherwise,
+ * the absolute values of the results are combined with @combine, as
+ * vips_compass() does.
+ */
+int
+vips__convmulti( VipsImage *in, VipsImage **out, VipsImage **mask, int n,
+	VipsCombine combine, gboolean separate )
+{
+	VipsConvmulti *convmulti;
+	VipsImage *t;
+	int width;
+	int height;
+	int ne;
+	int i, j;
+
+	g_assert( n > 0 );
+
+	width = mask[0]->Xsize;
+	height = mask[0]->Ysize;
+	ne = width * height;
+
+	*out = vips_image_new();
+
+	if( !(convmulti = VIPS_NEW( *out, VipsConvmulti )) ||
+		!(convmulti->pos = VIPS_ARRAY( *out, ne, int )) ||
+		!(convmulti->coeff = VIPS_ARRAY( *out, ne * n, double )) ||
+		!(convmulti->scale = VIPS_ARRAY( *out, n, double )) ||
+		!(convmulti->offset = VIPS_ARRAY( *out, n, double )) ) {
+		VIPS_UNREF( *out );
+		return( -1 );
+	}
+	convmulti->n = n;
+	convmulti->width = width;
+	convmulti->height = height;
+	convmulti->combine = combine;
+	convmulti->separate = separate;
+
+	for( j = 0; j < n; j++ ) {
+		VipsImage *M;
+
+		if( vips_check_matrix( "convmulti", mask[j], &M ) ) {
+			VIPS_UNREF( *out );
+			return( -1 );
+		}
+
+		convmulti->scale[j] = vips_image_get_scale( M );
+		convmulti->offset[j] = vips_image_get_offset( M );
+		for( i = 0; i < ne; i++ )
+			convmulti->coeff[i * n + j] =
+				((double *) VIPS_IMAGE_ADDR( M, 0, 0 ))[i];
+
+		g_object_unref( M );
+	}
+
+	/* Drop positions which are zero in every mask.
+	 */
+	convmulti->nnz = 0;
+	for( i = 0; i < ne; i++ ) {
+		for( j = 0; j < n; j++ )
+			if( convmulti->coeff[i * n + j] )
+				break;
+
+		if( j < n ) {
+			memmove( convmulti->coeff + convmulti->nnz * n,
+				convmulti->coeff + i * n,
+				n * sizeof( double ) );
+			convmulti->pos[convmulti->nnz] = i;
+			convmulti->nnz += 1;
+		}
+	}
+	if( convmulti->nnz == 0 ) {
+		for( j = 0; j < n; j++ )
+			convmulti->coeff[j] = 0;
+		convmulti->pos[0] = 0;
+		convmulti->nnz = 1;
+	}
+
+	if( vips_embed( in, &t,
+		width / 2, height / 2,
+		in->Xsize + width - 1, in->Ysize + height - 1,
+		"extend", VIPS_EXTEND_COPY,
+		NULL ) ) {
+		VIPS_UNREF( *out );
+		return( -1 );
+	}
+	vips_object_local( *out, t );
+
+	if( vips_image_pipelinev( *out,
+		VIPS_DEMAND_STYLE_SMALLTILE, t, NULL ) ) {
+		VIPS_UNREF( *out );
+		return( -1 );
+	}
+
+	if( vips_band_format_isint( t->BandFmt ) )
+		(*out)->BandFmt = VIPS_FORMAT_FLOAT;
+	if( separate )
+		(*out)->Bands *= n;
+	(*out)->Xsize -= width - 1;
+	(*out)->Ysize -= height - 1;
+
+	if( vips_image_generate( *out,
+		vips_convmulti_start, vips_convmulti_gen, vips_convmulti_stop,
+		t, convmulti ) ) {
+		VIPS_UNREF( *out );
+		return( -1 );
+	}
+
+	(*out)->Xoffset = -width / 2;
+	(*out)->Yoffset = -height / 2;
+
+	return( 0 );
+}
@@ -83,6 +83,40 @@
 G_DEFINE_ABSTRACT_TYPE( VipsConvolution, vips_convolution, 
 	VIPS_TYPE_OPERATION );
 
+/* Aim to keep the input lines a convolution works on within this many
+ * bytes, about the size of a typical L2.
+ */
+#define VIPS__CONV_BLOCK (256 * 1024)
+
+int vips__conv_block = VIPS__CONV_BLOCK;
+
+/* Very wide regions, for example from a FATSTRIP sink, mean the mask-high
+ * band of input lines a generate function sweeps along is much larger than
+ * cache. We split such regions into column strips and do each strip
+ * top-to-bottom, so the lines for a strip stay in cache from one output
+ * line to the next.
+ *
+ * Return the strip width to use for an output region @width pixels across,
+ * convolving @ir with @M. This is just @width for normal tile sizes.
+ */
+int
+vips__conv_block_width( VipsRegion *ir, VipsImage *M, int width )
+{
+	size_t psize = VIPS_IMAGE_SIZEOF_PEL( ir->im );
+	int block_width;
+
+	if( vips__conv_block <= 0 )
+		return( width );
+
+	block_width = vips__conv_block / (psize * M->Ysize) - (M->Xsize - 1);
+
+	/* Very narrow strips would just add overhead.
+	 */
+	block_width = VIPS_MAX( block_width, 64 );
+
+	return( VIPS_MIN( block_width, width ) );
+}
+
 static int
 vips_convolution_build( VipsObject *object )
 {
@@ -161,11 +195,15 @@ vips_convolution_operation_init( void )
 	extern int vips_conva_get_type( void ); 
 	extern int vips_convf_get_type( void ); 
 	extern int vips_convi_get_type( void ); 
+#ifdef HAVE_FFTW
+	extern int vips_convfft_get_type( void );
+#endif /*HAVE_FFTW*/
 	extern int vips_convsep_get_type( void ); 
 	extern int vips_convasep_get_type( void ); 
 	extern int vips_compass_get_type( void ); 
 	extern int vips_fastcor_get_type( void ); 
 	extern int vips_spcor_get_type( void ); 
+	extern int vips_find_template_get_type( void );
 	extern int vips_sharpen_get_type( void ); 
 	extern int vips_gaussblur_get_type( void ); 
 	extern int vips_sobel_get_type( void ); 
@@ -175,11 +213,15 @@ vips_convolution_operation_init( void )
 	vips_conva_get_type(); 
 	vips_convf_get_type(); 
 	vips_convi_get_type(); 
+#ifdef HAVE_FFTW
+	vips_convfft_get_type();
+#endif /*HAVE_FFTW*/
 	vips_compass_get_type(); 
 	vips_convsep_get_type(); 
 	vips_convasep_get_type(); 
 	vips_fastcor_get_type(); 
 	vips_spcor_get_type(); 
+	vips_find_template_get_type();
 	vips_sharpen_get_type(); 
 	vips_gaussblur_get_type(); 
 	vips_canny_get_type(); 
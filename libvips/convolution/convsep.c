@@ -5,6 +5,8 @@
  * 8/5/17
  *      - default to float ... int will often lose precision and should not be
  *        the default
+ * 14/10/18
+ * 	- add a single-pass fixed-point path for uchar, ushort and float
  */
 
 /*
@@ -40,8 +42,11 @@
 #include <vips/intl.h>
 
 #include <stdio.h>
+#include <limits.h>
+#include <math.h>
 
 #include <vips/vips.h>
+#include <vips/simd.h>
 
 #include "pconvolution.h"
 
@@ -51,12 +56,391 @@ typedef struct {
 	VipsPrecision precision; 
 	int layers; 
 	int cluster; 
+
+	/* The single-pass path. The horizontal mask is short for uchar, int
+	 * for ushort and float for float, and the vertical mask is always
+	 * float.
+	 */
+	int n_point;
+	void *coeff;
+	float *vcoeff;
+	float offset;
+	VipsSimdConvhFn convh;
+	VipsSimdConvvFn convv;
 } VipsConvsep;
 
 typedef VipsConvolutionClass VipsConvsepClass;
 
 G_DEFINE_TYPE( VipsConvsep, vips_convsep, VIPS_TYPE_CONVOLUTION );
 
+typedef struct {
+	VipsRegion *ir;
+
+	/* The horizontal pass for all the lines we need.
+	 */
+	float *buf;
+	size_t size;
+} VipsConvsepSeq;
+
+static int
+vips_convsep_stop( void *vseq, void *a, void *b )
+{
+	VipsConvsepSeq *seq = (VipsConvsepSeq *) vseq;
+
+	VIPS_UNREF( seq->ir );
+	VIPS_FREE( seq->buf );
+
+	return( 0 );
+}
+
+static void *
+vips_convsep_start( VipsImage *out, void *a, void *b )
+{
+	VipsImage *in = (VipsImage *) a;
+
+	VipsConvsepSeq *seq;
+
+	if( !(seq = VIPS_NEW( out, VipsConvsepSeq )) )
+		return( NULL );
+
+	seq->ir = vips_region_new( in );
+	seq->buf = NULL;
+	seq->size = 0;
+
+	if( !seq->ir ) {
+		vips_convsep_stop( seq, NULL, NULL );
+		return( NULL );
+	}
+
+	return( seq );
+}
+
+/* The C versions of the native kernels, see simd.h. They must give
+ * exactly the same results.
+ */
+#define CONVH_INT( TYPE, CTYPE ) { \
+	const TYPE * restrict p = (TYPE *) in; \
+	const CTYPE * restrict c = (CTYPE *) coeff; \
+	const int s = stride / sizeof( TYPE ); \
+	\
+	for( z = 0; z < ne; z++ ) { \
+		int sum; \
+		int i; \
+		\
+		sum = 0; \
+		for( i = 0; i < n_point; i++ ) \
+			sum += c[i] * p[z + i * s]; \
+		\
+		out[z] = sum; \
+	} \
+}
+
+#define CONV_FLOAT( OFFSET ) { \
+	const float * restrict p = (float *) in; \
+	const int s = stride / sizeof( float ); \
+	\
+	for( z = 0; z < ne; z++ ) { \
+		float sum; \
+		int i; \
+		\
+		sum = 0; \
+		for( i = 0; i < n_point; i++ ) \
+			sum += c[i] * p[z + i * s]; \
+		\
+		out[z] = sum + OFFSET; \
+	} \
+}
+
+static void
+vips_convsep_convh_uchar( float *out, const VipsPel *in,
+	int ne, int stride, const void *coeff, int n_point )
+{
+	int z;
+
+	CONVH_INT( unsigned char, short );
+}
+
+static void
+vips_convsep_convh_ushort( float *out, const VipsPel *in,
+	int ne, int stride, const void *coeff, int n_point )
+{
+	int z;
+
+	CONVH_INT( unsigned short, int );
+}
+
+static void
+vips_convsep_convh_float( float *out, const VipsPel *in,
+	int ne, int stride, const void *coeff, int n_point )
+{
+	const float *c = (float *) coeff;
+
+	int z;
+
+	CONV_FLOAT( 0 );
+}
+
+static void
+vips_convsep_convv( float *out, const float *in,
+	int ne, int stride, const float *c, int n_point, float offset )
+{
+	int z;
+
+	CONV_FLOAT( offset );
+}
+
+/* Run the horizontal pass once for every input line the output needs, then
+ * the vertical pass down the buffer. Each horizontal result is used by
+ * n_point output lines.
+ */
+static int
+vips_convsep_gen( VipsRegion *or,
+	void *vseq, void *a, void *b, gboolean *stop )
+{
+	VipsConvsepSeq *seq = (VipsConvsepSeq *) vseq;
+	VipsConvsep *convsep = (VipsConvsep *) b;
+	VipsRegion *ir = seq->ir;
+	VipsRect *r = &or->valid;
+	const int n_point = convsep->n_point;
+	const int ne = r->width * ir->im->Bands;
+	const int n_lines = r->height + n_point - 1;
+	const int stride = VIPS_IMAGE_SIZEOF_PEL( ir->im );
+	const size_t size = (size_t) n_lines * ne * sizeof( float );
+
+	VipsRect s;
+	int y;
+
+	s = *r;
+	s.width += n_point - 1;
+	s.height += n_point - 1;
+	if( vips_region_prepare( ir, &s ) )
+		return( -1 );
+
+	if( seq->size < size ) {
+		VIPS_FREE( seq->buf );
+		if( !(seq->buf = (float *) vips_malloc( NULL, size )) )
+			return( -1 );
+		seq->size = size;
+	}
+
+	VIPS_GATE_START( "vips_convsep_gen: work" );
+
+	for( y = 0; y < n_lines; y++ )
+		convsep->convh( seq->buf + y * ne,
+			VIPS_REGION_ADDR( ir, r->left, r->top + y ),
+			ne, stride, convsep->coeff, n_point );
+
+	for( y = 0; y < r->height; y++ )
+		convsep->convv(
+			(float *) VIPS_REGION_ADDR( or, r->left, r->top + y ),
+			seq->buf + y * ne,
+			ne, ne * sizeof( float ),
+			convsep->vcoeff, n_point, convsep->offset );
+
+	VIPS_GATE_STOP( "vips_convsep_gen: work" );
+
+	VIPS_COUNT_PIXELS( or, "vips_convsep_gen" );
+
+	return( 0 );
+}
+
+/* Make the masks for the single-pass path. uchar and ushort get a
+ * fixed-point horizontal mask, see vips_vector_to_fixed_point().
+ *
+ * We pick the largest shift that can't overflow (and, for uchar, that fits
+ * in 16 bits for the native kernels), and fail if the result is less than
+ * 12 bits accurate. The caller falls back to vips_conv() in that case.
+ */
+static int
+vips_convsep_fixed_point( VipsConvsep *convsep, VipsImage *in )
+{
+	VipsConvolution *convolution = (VipsConvolution *) convsep;
+	VipsImage *M = convolution->M;
+	const int n_point = M->Xsize * M->Ysize;
+	const double scale = vips_image_get_scale( M );
+	const double offset = vips_image_get_offset( M );
+
+	double *c;
+	double *h;
+	double sum;
+	double asum;
+	double amax;
+	int i;
+
+	convsep->n_point = n_point;
+	if( !(c = VIPS_ARRAY( convsep, n_point, double )) ||
+		!(h = VIPS_ARRAY( convsep, n_point, double )) ||
+		!(convsep->vcoeff = VIPS_ARRAY( convsep, n_point, float )) )
+		return( -1 );
+
+	sum = 0.0;
+	asum = 0.0;
+	amax = 0.0;
+	for( i = 0; i < n_point; i++ ) {
+		c[i] = VIPS_MATRIX( M, 0, 0 )[i] / scale;
+		sum += c[i];
+		asum += VIPS_FABS( c[i] );
+		amax = VIPS_MAX( amax, VIPS_FABS( c[i] ) );
+	}
+
+	/* The two-pass path rotates the mask by 90 degrees for the second
+	 * pass, and that reverses a column mask.
+	 */
+	for( i = 0; i < n_point; i++ )
+		h[i] = M->Ysize == 1 ? c[i] : c[n_point - 1 - i];
+
+	/* The first pass of the two-pass path adds the offset, and the second
+	 * pass then scales it by the mask sum.
+	 */
+	convsep->offset = offset * sum;
+
+	if( in->BandFmt == VIPS_FORMAT_FLOAT ) {
+		float *coeff;
+
+		if( !(coeff = VIPS_ARRAY( convsep, n_point, float )) )
+			return( -1 );
+		for( i = 0; i < n_point; i++ ) {
+			coeff[i] = h[i];
+			convsep->vcoeff[i] = c[i];
+		}
+		convsep->coeff = coeff;
+	}
+	else {
+		const double max_in = in->BandFmt == VIPS_FORMAT_UCHAR ?
+			UCHAR_MAX : USHRT_MAX;
+
+		int *icoeff;
+		int shift;
+		double error;
+		double isum;
+		int imax;
+
+		if( !(icoeff = VIPS_ARRAY( convsep, n_point, int )) )
+			return( -1 );
+
+		/* The adjustments vips_vector_to_fixed_point() makes can
+		 * still push us over, so we check again below.
+		 */
+		shift = 24;
+		if( asum > 0.0 )
+			shift = VIPS_MIN( shift,
+				floor( log2( INT_MAX / (max_in * asum) ) ) );
+		if( amax > 0.0 &&
+			in->BandFmt == VIPS_FORMAT_UCHAR )
+			shift = VIPS_MIN( shift,
+				floor( log2( (1 << 14) / amax ) ) );
+		if( shift < 1 ) {
+			g_info( "vips_convsep_fixed_point: "
+				"mask range too large" );
+			return( -1 );
+		}
+
+		vips_vector_to_fixed_point( h, icoeff, n_point, 1 << shift );
+
+		error = 0.0;
+		isum = 0.0;
+		imax = 0;
+		for( i = 0; i < n_point; i++ ) {
+			error += VIPS_FABS( h[i] -
+				(double) icoeff[i] / (1 << shift) );
+			isum += VIPS_ABS( icoeff[i] );
+			imax = VIPS_MAX( imax, VIPS_ABS( icoeff[i] ) );
+		}
+
+		if( max_in * isum > INT_MAX ||
+			(in->BandFmt == VIPS_FORMAT_UCHAR &&
+			 imax > SHRT_MAX) ||
+			error > 1.0 / 4096 ) {
+			g_info( "vips_convsep_fixed_point: too inaccurate" );
+			return( -1 );
+		}
+
+		for( i = 0; i < n_point; i++ )
+			convsep->vcoeff[i] = c[i] / (1 << shift);
+
+		if( in->BandFmt == VIPS_FORMAT_UCHAR ) {
+			short *scoeff;
+
+			if( !(scoeff = VIPS_ARRAY( convsep, n_point, short )) )
+				return( -1 );
+			for( i = 0; i < n_point; i++ )
+				scoeff[i] = icoeff[i];
+			convsep->coeff = scoeff;
+		}
+		else
+			convsep->coeff = icoeff;
+	}
+
+	return( 0 );
+}
+
+/* Convolve in a single pass.
+ */
+static int
+vips_convsep_single( VipsConvsep *convsep, VipsImage *in, VipsImage **out )
+{
+	VipsObject *object = (VipsObject *) convsep;
+	VipsConvolution *convolution = (VipsConvolution *) convsep;
+	VipsImage *M = convolution->M;
+	const int n_point = convsep->n_point;
+	VipsImage **t = (VipsImage **) vips_object_local_array( object, 1 );
+
+	switch( in->BandFmt ) {
+	case VIPS_FORMAT_UCHAR:
+		convsep->convh = vips_convsep_convh_uchar;
+		break;
+
+	case VIPS_FORMAT_USHORT:
+		convsep->convh = vips_convsep_convh_ushort;
+		break;
+
+	case VIPS_FORMAT_FLOAT:
+		convsep->convh = vips_convsep_convh_float;
+		break;
+
+	default:
+		g_assert_not_reached();
+	}
+	convsep->convv = vips_convsep_convv;
+
+	if( vips_simd_get( VIPS_SIMD_CONVH, in->BandFmt ) )
+		convsep->convh = (VipsSimdConvhFn)
+			vips_simd_get( VIPS_SIMD_CONVH, in->BandFmt );
+	if( vips_simd_get( VIPS_SIMD_CONVV, VIPS_FORMAT_FLOAT ) )
+		convsep->convv = (VipsSimdConvvFn)
+			vips_simd_get( VIPS_SIMD_CONVV, VIPS_FORMAT_FLOAT );
+
+	if( vips_embed( in, &t[0],
+		n_point / 2, n_point / 2,
+		in->Xsize + n_point - 1, in->Ysize + n_point - 1,
+		"extend", VIPS_EXTEND_COPY,
+		NULL ) )
+		return( -1 );
+	in = t[0];
+
+	*out = vips_image_new();
+	if( vips_image_pipelinev( *out,
+		VIPS_DEMAND_STYLE_SMALLTILE, in, NULL ) )
+		return( -1 );
+
+	(*out)->BandFmt = VIPS_FORMAT_FLOAT;
+	(*out)->Xsize -= n_point - 1;
+	(*out)->Ysize -= n_point - 1;
+
+	if( vips_image_generate( *out,
+		vips_convsep_start, vips_convsep_gen, vips_convsep_stop,
+		in, convsep ) )
+		return( -1 );
+
+	/* Match the offsets the two-pass path sets: the second pass uses
+	 * the rotated mask.
+	 */
+	(*out)->Xoffset = M->Ysize == 1 ? 0 : -n_point / 2;
+	(*out)->Yoffset = M->Ysize == 1 ? -n_point / 2 : 0;
+
+	return( 0 );
+}
+
 static int
 vips_convsep_build( VipsObject *object )
 {
@@ -85,6 +469,16 @@ vips_convsep_build( VipsObject *object )
 			return( -1 ); 
 		in = t[0];
 	}
+	else if( convsep->precision == VIPS_PRECISION_FLOAT &&
+		in->Coding == VIPS_CODING_NONE &&
+		(in->BandFmt == VIPS_FORMAT_UCHAR ||
+		 in->BandFmt == VIPS_FORMAT_USHORT ||
+		 in->BandFmt == VIPS_FORMAT_FLOAT) &&
+		!vips_convsep_fixed_point( convsep, in ) ) {
+		if( vips_convsep_single( convsep, in, &t[0] ) )
+			return( -1 );
+		in = t[0];
+	}
 	else { 
 		if( vips_rot( convolution->M, &t[0], VIPS_ANGLE_D90, NULL ) )
 			return( -1 ); 
@@ -179,6 +573,10 @@ vips_convsep_init( VipsConvsep *convsep )
  * rotated by 90 degrees. This is much faster for certain types of mask
  * (gaussian blur, for example) than doing a full 2D convolution.
  *
+ * With #VIPS_PRECISION_FLOAT, uchar, ushort and float images are convolved
+ * in a single pass. For uchar and ushort, the horizontal mask is converted
+ * to fixed point, as long as that is at least 12 bits accurate.
+ *
  * See also: vips_conv(), vips_gaussmat().
  *
  * Returns: 0 on success, -1 on error
@@ -0,0 +1,740 @@
+/* search an image for a template
+ *
+ * 14/10/18
+ * 	- from spcor.c
+ */
+
+/*
+
+    This file is part of VIPS.
+
+    VIPS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA
+
+ */
+
+/*
+
+    These files are distributed with VIPS - http://www.vips.ecs.soton.ac.uk
+
+ */
+
+/*
+#define DEBUG
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /*HAVE_CONFIG_H*/
+#include <vips/intl.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <vips/vips.h>
+
+/* Never make more than this many levels.
+ */
+#define VIPS_FIND_TEMPLATE_MAX_LEVELS (8)
+
+/* Stop shrinking when the smaller side of the reference would drop below
+ * this.
+ */
+#define VIPS_FIND_TEMPLATE_MIN_REF (8)
+
+/* Search this far around a peak when we move to the next level down.
+ */
+#define VIPS_FIND_TEMPLATE_RADIUS (3)
+
+/* One level of the pyramid.
+ */
+typedef struct _VipsFindTemplateLevel {
+	/* Mono float image at this scale, and the same expanded by half the
+	 * reference size, as vips_spcor() does.
+	 */
+	VipsImage *in;
+	VipsImage *embedded;
+
+	/* Mono float reference at this scale, in memory, with its mean
+	 * removed.
+	 */
+	VipsImage *ref;
+	double *ref_zm;
+	double ref_mean;
+	double ref_norm;
+} VipsFindTemplateLevel;
+
+/* A candidate match, in the coordinates of one level.
+ */
+typedef struct _VipsFindTemplatePeak {
+	int x;
+	int y;
+	double score;
+} VipsFindTemplatePeak;
+
+typedef struct _VipsFindTemplate {
+	VipsOperation parent_instance;
+
+	VipsImage *in;
+	VipsImage *ref;
+	int size;
+	int levels;
+	gboolean fft;
+
+	int x;
+	int y;
+	double score;
+	VipsArrayDouble *out_array;
+	VipsArrayInt *x_array;
+	VipsArrayInt *y_array;
+
+	int n_levels;
+	VipsFindTemplateLevel *level;
+} VipsFindTemplate;
+
+typedef VipsOperationClass VipsFindTemplateClass;
+
+G_DEFINE_TYPE( VipsFindTemplate, vips_find_template, VIPS_TYPE_OPERATION );
+
+/* Make the float mono image for each level.
+ */
+static int
+vips_find_template_pyramid( VipsFindTemplate *find_template )
+{
+	VipsObject *object = VIPS_OBJECT( find_template );
+	VipsImage **t = (VipsImage **) vips_object_local_array( object,
+		4 * VIPS_FIND_TEMPLATE_MAX_LEVELS + 4 );
+
+	VipsImage *in;
+	VipsImage *ref;
+	int max_levels;
+	int i;
+
+	in = find_template->in;
+	ref = find_template->ref;
+	if( in->Bands > 1 ) {
+		if( vips_bandmean( in, &t[0], NULL ) )
+			return( -1 );
+		in = t[0];
+	}
+	if( ref->Bands > 1 ) {
+		if( vips_bandmean( ref, &t[1], NULL ) )
+			return( -1 );
+		ref = t[1];
+	}
+	if( vips_cast( in, &t[2], VIPS_FORMAT_FLOAT, NULL ) ||
+		vips_cast( ref, &t[3], VIPS_FORMAT_FLOAT, NULL ) )
+		return( -1 );
+	in = t[2];
+	ref = t[3];
+	t += 4;
+
+	/* Shrink until the reference gets too small to be useful.
+	 */
+	max_levels = vips_object_argument_isset( object, "levels" ) ?
+		find_template->levels : VIPS_FIND_TEMPLATE_MAX_LEVELS;
+	find_template->n_levels = 1;
+	while( find_template->n_levels < max_levels &&
+		VIPS_MIN( ref->Xsize, ref->Ysize ) >>
+			find_template->n_levels >= VIPS_FIND_TEMPLATE_MIN_REF )
+		find_template->n_levels += 1;
+
+	if( !(find_template->level = VIPS_ARRAY( object,
+		find_template->n_levels, VipsFindTemplateLevel )) )
+		return( -1 );
+
+	for( i = 0; i < find_template->n_levels; i++ ) {
+		VipsFindTemplateLevel *level = &find_template->level[i];
+		int n = ref->Xsize * ref->Ysize;
+
+		float *p;
+		int j;
+		double sum;
+
+		if( !(t[0] = vips_image_copy_memory( ref )) ||
+			vips_embed( in, &t[1],
+				ref->Xsize / 2, ref->Ysize / 2,
+				in->Xsize + ref->Xsize - 1,
+				in->Ysize + ref->Ysize - 1,
+				"extend", VIPS_EXTEND_COPY,
+				NULL ) )
+			return( -1 );
+		level->in = in;
+		level->embedded = t[1];
+		level->ref = t[0];
+
+		if( !(level->ref_zm = VIPS_ARRAY( object, n, double )) )
+			return( -1 );
+		p = (float *) level->ref->data;
+		sum = 0.0;
+		for( j = 0; j < n; j++ )
+			sum += p[j];
+		level->ref_mean = sum / n;
+		sum = 0.0;
+		for( j = 0; j < n; j++ ) {
+			level->ref_zm[j] = p[j] - level->ref_mean;
+			sum += level->ref_zm[j] * level->ref_zm[j];
+		}
+		level->ref_norm = sqrt( sum );
+
+		if( i < find_template->n_levels - 1 ) {
+			if( vips_shrink( in, &t[2], 2, 2, NULL ) ||
+				vips_shrink( level->ref, &t[3], 2, 2, NULL ) )
+				return( -1 );
+			in = t[2];
+			ref = t[3];
+		}
+
+		t += 4;
+	}
+
+	return( 0 );
+}
+
+/* The correlation coefficient for the reference with its top-left at
+ * @left, @top in an embedded level image, see vips_spcor().
+ */
+static double
+vips_find_template_ncc( VipsFindTemplateLevel *level, VipsRegion *region,
+	int left, int top )
+{
+	int width = level->ref->Xsize;
+	int height = level->ref->Ysize;
+	int n = width * height;
+
+	double sum1, sum2, sum3;
+	double c2;
+	int x, y;
+
+	sum1 = 0.0;
+	sum2 = 0.0;
+	sum3 = 0.0;
+	for( y = 0; y < height; y++ ) {
+		float *p = (float *) VIPS_REGION_ADDR( region, left, top + y );
+		double *q = level->ref_zm + y * width;
+
+		for( x = 0; x < width; x++ ) {
+			double v = p[x];
+
+			sum1 += v;
+			sum2 += v * v;
+			sum3 += v * q[x];
+		}
+	}
+
+	c2 = level->ref_norm * sqrt( VIPS_MAX( 0.0, sum2 - sum1 * sum1 / n ) );
+
+	/* Constant reference or constant image: regard as uncorrelated.
+	 */
+	return( c2 == 0.0 ? 0.0 : sum3 / c2 );
+}
+
+/* The full correlation surface at the coarsest level, computed in the
+ * frequency domain.
+ *
+ * The numerator is the cross-correlation with the zero-mean
+ * reference, the denominator comes from summed-area tables.
+ */
+static int
+vips_find_template_fft( VipsFindTemplate *find_template,
+	VipsFindTemplateLevel *level, VipsImage **out )
+{
+	VipsObject *object = VIPS_OBJECT( find_template );
+	VipsImage **t = (VipsImage **) vips_object_local_array( object, 10 );
+	int width = level->in->Xsize;
+	int height = level->in->Ysize;
+	int ref_width = level->ref->Xsize;
+	int ref_height = level->ref->Ysize;
+	int n = ref_width * ref_height;
+
+	VipsImage *in;
+	int ewidth;
+	int eheight;
+	double n_pels;
+	double *s1, *s2;
+	int x, y;
+
+	if( !(t[0] = vips_image_copy_memory( level->embedded )) )
+		return( -1 );
+	in = t[0];
+	ewidth = in->Xsize;
+	eheight = in->Ysize;
+	n_pels = (double) ewidth * eheight;
+
+	if( vips_linear1( level->ref, &t[1], 1.0, -level->ref_mean, NULL ) ||
+		vips_embed( t[1], &t[2], 0, 0, ewidth, eheight, NULL ) ||
+		vips_fwfft( in, &t[3], NULL ) ||
+		vips_fwfft( t[2], &t[4], NULL ) ||
+		vips_conj( t[4], &t[5], NULL ) ||
+		vips_multiply( t[3], t[5], &t[6], NULL ) ||
+		vips_invfft( t[6], &t[7], "real", TRUE, NULL ) ||
+		!(t[8] = vips_image_copy_memory( t[7] )) )
+		return( -1 );
+
+	/* Summed-area tables for the sum and sum of squares of the image.
+	 */
+	if( !(s1 = VIPS_ARRAY( object,
+			(size_t) (ewidth + 1) * (eheight + 1), double )) ||
+		!(s2 = VIPS_ARRAY( object,
+			(size_t) (ewidth + 1) * (eheight + 1), double )) )
+		return( -1 );
+	for( x = 0; x <= ewidth; x++ ) {
+		s1[x] = 0.0;
+		s2[x] = 0.0;
+	}
+	for( y = 0; y < eheight; y++ ) {
+		float *p = (float *) VIPS_IMAGE_ADDR( in, 0, y );
+		double *a1 = s1 + (size_t) y * (ewidth + 1);
+		double *a2 = s2 + (size_t) y * (ewidth + 1);
+		double *b1 = a1 + ewidth + 1;
+		double *b2 = a2 + ewidth + 1;
+		double row1 = 0.0;
+		double row2 = 0.0;
+
+		b1[0] = 0.0;
+		b2[0] = 0.0;
+		for( x = 0; x < ewidth; x++ ) {
+			row1 += p[x];
+			row2 += (double) p[x] * p[x];
+			b1[x + 1] = a1[x + 1] + row1;
+			b2[x + 1] = a2[x + 1] + row2;
+		}
+	}
+
+#define BOX( S, X, Y ) \
+	((S)[(size_t) ((Y) + ref_height) * (ewidth + 1) + (X) + ref_width] - \
+	 (S)[(size_t) ((Y) + ref_height) * (ewidth + 1) + (X)] - \
+	 (S)[(size_t) (Y) * (ewidth + 1) + (X) + ref_width] + \
+	 (S)[(size_t) (Y) * (ewidth + 1) + (X)])
+
+	*out = vips_image_new_memory();
+	vips_image_init_fields( *out, width, height, 1,
+		VIPS_FORMAT_FLOAT, VIPS_CODING_NONE,
+		VIPS_INTERPRETATION_B_W, 1.0, 1.0 );
+	if( vips_image_write_prepare( *out ) )
+		return( -1 );
+
+	for( y = 0; y < height; y++ ) {
+		double *p = (double *) VIPS_IMAGE_ADDR( t[8], 0, y );
+		float *q = (float *) VIPS_IMAGE_ADDR( *out, 0, y );
+
+		for( x = 0; x < width; x++ ) {
+			double sum1 = BOX( s1, x, y );
+			double sum2 = BOX( s2, x, y );
+			double c2 = level->ref_norm *
+				sqrt( VIPS_MAX( 0.0, sum2 - sum1 * sum1 / n ) );
+
+			/* fwfft() normalises, invfft() does not.
+			 */
+			q[x] = c2 == 0.0 ? 0.0 : p[x] * n_pels / c2;
+		}
+	}
+
+	return( 0 );
+}
+
+static int
+vips_find_template_peak_compare( const void *a, const void *b )
+{
+	const VipsFindTemplatePeak *p1 = (const VipsFindTemplatePeak *) a;
+	const VipsFindTemplatePeak *p2 = (const VipsFindTemplatePeak *) b;
+
+	return( p1->score < p2->score ? 1 : p1->score > p2->score ? -1 : 0 );
+}
+
+/* Pick up to @n peaks from a sorted list, dropping any closer than @sep to a
+ * better one. Return the number kept.
+ */
+static int
+vips_find_template_separate( VipsFindTemplatePeak *peak, int n_peak,
+	int n, int sep )
+{
+	int n_kept;
+	int i, j;
+
+	n_kept = 0;
+	for( i = 0; i < n_peak && n_kept < n; i++ ) {
+		for( j = 0; j < n_kept; j++ )
+			if( abs( peak[i].x - peak[j].x ) < sep &&
+				abs( peak[i].y - peak[j].y ) < sep )
+				break;
+
+		if( j == n_kept )
+			peak[n_kept++] = peak[i];
+	}
+
+	return( n_kept );
+}
+
+/* Find the best correlation near a peak, moving it to the position at this
+ * level.
+ */
+static int
+vips_find_template_refine( VipsFindTemplateLevel *level,
+	VipsRegion *region, VipsFindTemplatePeak *peak )
+{
+	int width = level->in->Xsize;
+	int height = level->in->Ysize;
+	int radius = VIPS_FIND_TEMPLATE_RADIUS;
+
+	VipsRect area;
+	int left, top, right, bottom;
+	int x, y;
+
+	left = VIPS_CLIP( 0, peak->x - radius, width - 1 );
+	top = VIPS_CLIP( 0, peak->y - radius, height - 1 );
+	right = VIPS_CLIP( 0, peak->x + radius, width - 1 );
+	bottom = VIPS_CLIP( 0, peak->y + radius, height - 1 );
+
+	/* Centre x in the image is top-left x in the embedded image.
+	 */
+	area.left = left;
+	area.top = top;
+	area.width = right - left + level->ref->Xsize;
+	area.height = bottom - top + level->ref->Ysize;
+	if( vips_region_prepare( region, &area ) )
+		return( -1 );
+
+	peak->score = -2.0;
+	for( y = top; y <= bottom; y++ )
+		for( x = left; x <= right; x++ ) {
+			double score = vips_find_template_ncc( level,
+				region, x, y );
+
+			if( score > peak->score ) {
+				peak->x = x;
+				peak->y = y;
+				peak->score = score;
+			}
+		}
+
+	return( 0 );
+}
+
+static int
+vips_find_template_build( VipsObject *object )
+{
+	VipsObjectClass *class = VIPS_OBJECT_GET_CLASS( object );
+	VipsFindTemplate *find_template = (VipsFindTemplate *) object;
+	VipsImage **t = (VipsImage **) vips_object_local_array( object, 2 );
+
+	VipsFindTemplateLevel *level;
+	VipsFindTemplatePeak *peak;
+	int n_candidates;
+	int n_max;
+	int n_peak;
+	int sep;
+	VipsArrayInt *x_array;
+	VipsArrayInt *y_array;
+	VipsArrayDouble *out_array;
+	int *xs;
+	int *ys;
+	double *vs;
+	double max;
+	int *x_out;
+	int *y_out;
+	double *v_out;
+	int i, j;
+
+	if( VIPS_OBJECT_CLASS( vips_find_template_parent_class )->
+		build( object ) )
+		return( -1 );
+
+	if( vips_check_uncoded( class->nickname, find_template->in ) ||
+		vips_check_uncoded( class->nickname, find_template->ref ) ||
+		vips_check_noncomplex( class->nickname, find_template->in ) ||
+		vips_check_noncomplex( class->nickname, find_template->ref ) )
+		return( -1 );
+	if( find_template->ref->Xsize > find_template->in->Xsize ||
+		find_template->ref->Ysize > find_template->in->Ysize ) {
+		vips_error( class->nickname,
+			"%s", _( "ref must be smaller than in" ) );
+		return( -1 );
+	}
+
+	if( vips_find_template_pyramid( find_template ) )
+		return( -1 );
+
+	/* Full search at the coarsest level.
+	 */
+	level = &find_template->level[find_template->n_levels - 1];
+	if( find_template->fft ) {
+		if( vips_find_template_fft( find_template, level, &t[0] ) )
+			return( -1 );
+	}
+	else {
+		if( vips_spcor( level->in, level->ref, &t[1], NULL ) ||
+			!(t[0] = vips_image_copy_memory( t[1] )) )
+			return( -1 );
+	}
+
+	/* Keep a few extra candidates at the coarse level, since the order
+	 * can change as we refine. vips_max() will return lots of values
+	 * around each peak, so ask for plenty and thin them out.
+	 */
+	n_candidates = find_template->n_levels > 1 ?
+		2 * find_template->size : find_template->size;
+	n_max = VIPS_MIN( 32 * n_candidates, VIPS_IMAGE_N_PELS( t[0] ) );
+	if( vips_max( t[0], &max,
+		"size", n_max,
+		"x_array", &x_array,
+		"y_array", &y_array,
+		"out_array", &out_array,
+		NULL ) )
+		return( -1 );
+	xs = vips_array_int_get( x_array, &n_peak );
+	ys = vips_array_int_get( y_array, &n_peak );
+	vs = vips_array_double_get( out_array, &n_peak );
+
+	if( !(peak = VIPS_ARRAY( object,
+		VIPS_MAX( 1, n_peak ), VipsFindTemplatePeak )) ) {
+		vips_area_unref( VIPS_AREA( x_array ) );
+		vips_area_unref( VIPS_AREA( y_array ) );
+		vips_area_unref( VIPS_AREA( out_array ) );
+		return( -1 );
+	}
+	for( i = 0; i < n_peak; i++ ) {
+		peak[i].x = xs[i];
+		peak[i].y = ys[i];
+		peak[i].score = vs[i];
+	}
+	vips_area_unref( VIPS_AREA( x_array ) );
+	vips_area_unref( VIPS_AREA( y_array ) );
+	vips_area_unref( VIPS_AREA( out_array ) );
+
+	qsort( peak, n_peak, sizeof( VipsFindTemplatePeak ),
+		vips_find_template_peak_compare );
+	sep = VIPS_MAX( 1,
+		VIPS_MIN( level->ref->Xsize, level->ref->Ysize ) / 2 );
+	n_peak = vips_find_template_separate( peak, n_peak,
+		n_candidates, sep );
+
+	/* Refine each candidate on the way down.
+	 */
+	for( i = find_template->n_levels - 2; i >= 0; i-- ) {
+		VipsRegion *region;
+
+		level = &find_template->level[i];
+		if( !(region = vips_region_new( level->embedded )) )
+			return( -1 );
+
+		for( j = 0; j < n_peak; j++ ) {
+			peak[j].x *= 2;
+			peak[j].y *= 2;
+
+			if( vips_find_template_refine( level,
+				region, &peak[j] ) ) {
+				g_object_unref( region );
+				return( -1 );
+			}
+		}
+
+		g_object_unref( region );
+	}
+
+	/* Several coarse peaks can converge on the same place.
+	 */
+	qsort( peak, n_peak, sizeof( VipsFindTemplatePeak ),
+		vips_find_template_peak_compare );
+	sep = VIPS_MAX( 1, VIPS_MIN( find_template->ref->Xsize,
+		find_template->ref->Ysize ) / 2 );
+	n_peak = vips_find_template_separate( peak, n_peak,
+		find_template->size, sep );
+
+	if( !(x_out = VIPS_ARRAY( object, VIPS_MAX( 1, n_peak ), int )) ||
+		!(y_out = VIPS_ARRAY( object, VIPS_MAX( 1, n_peak ), int )) ||
+		!(v_out = VIPS_ARRAY( object, VIPS_MAX( 1, n_peak ), double )) )
+		return( -1 );
+	for( i = 0; i < n_peak; i++ ) {
+		x_out[i] = peak[i].x;
+		y_out[i] = peak[i].y;
+		v_out[i] = peak[i].score;
+	}
+
+	x_array = vips_array_int_new( x_out, n_peak );
+	y_array = vips_array_int_new( y_out, n_peak );
+	out_array = vips_array_double_new( v_out, n_peak );
+
+	g_object_set( object,
+		"x", n_peak > 0 ? x_out[0] : 0,
+		"y", n_peak > 0 ? y_out[0] : 0,
+		"score", n_peak > 0 ? v_out[0] : 0.0,
+		"x_array", x_array,
+		"y_array", y_array,
+		"out_array", out_array,
+		NULL );
+
+	vips_area_unref( VIPS_AREA( x_array ) );
+	vips_area_unref( VIPS_AREA( y_array ) );
+	vips_area_unref( VIPS_AREA( out_array ) );
+
+	return( 0 );
+}
+
+static void
+vips_find_template_class_init( VipsFindTemplateClass *class )
+{
+	GObjectClass *gobject_class = G_OBJECT_CLASS( class );
+	VipsObjectClass *object_class = (VipsObjectClass *) class;
+
+	gobject_class->set_property = vips_object_set_property;
+	gobject_class->get_property = vips_object_get_property;
+
+	object_class->nickname = "find_template";
+	object_class->description = _( "search an image for a template" );
+	object_class->build = vips_find_template_build;
+
+	VIPS_ARG_IMAGE( class, "in", 1,
+		_( "Input" ),
+		_( "Input image" ),
+		VIPS_ARGUMENT_REQUIRED_INPUT,
+		G_STRUCT_OFFSET( VipsFindTemplate, in ) );
+
+	VIPS_ARG_IMAGE( class, "ref", 2,
+		_( "Reference" ),
+		_( "Reference image to search for" ),
+		VIPS_ARGUMENT_REQUIRED_INPUT,
+		G_STRUCT_OFFSET( VipsFindTemplate, ref ) );
+
+	VIPS_ARG_INT( class, "x", 3,
+		_( "x" ),
+		_( "Horizontal position of best match" ),
+		VIPS_ARGUMENT_REQUIRED_OUTPUT,
+		G_STRUCT_OFFSET( VipsFindTemplate, x ),
+		0, VIPS_MAX_COORD, 0 );
+
+	VIPS_ARG_INT( class, "y", 4,
+		_( "y" ),
+		_( "Vertical position of best match" ),
+		VIPS_ARGUMENT_REQUIRED_OUTPUT,
+		G_STRUCT_OFFSET( VipsFindTemplate, y ),
+		0, VIPS_MAX_COORD, 0 );
+
+	VIPS_ARG_DOUBLE( class, "score", 5,
+		_( "Score" ),
+		_( "Correlation of best match" ),
+		VIPS_ARGUMENT_OPTIONAL_OUTPUT,
+		G_STRUCT_OFFSET( VipsFindTemplate, score ),
+		-1.0, 1.0, 0.0 );
+
+	VIPS_ARG_INT( class, "size", 6,
+		_( "Size" ),
+		_( "Number of matches to find" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsFindTemplate, size ),
+		1, 1000000, 1 );
+
+	VIPS_ARG_INT( class, "levels", 7,
+		_( "Levels" ),
+		_( "Maximum number of pyramid levels" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsFindTemplate, levels ),
+		1, VIPS_FIND_TEMPLATE_MAX_LEVELS,
+		VIPS_FIND_TEMPLATE_MAX_LEVELS );
+
+	VIPS_ARG_BOOL( class, "fft", 8,
+		_( "FFT" ),
+		_( "Search the coarsest level with an FFT" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsFindTemplate, fft ),
+		FALSE );
+
+	VIPS_ARG_BOXED( class, "out_array", 9,
+		_( "Output array" ),
+		_( "Array of correlation values" ),
+		VIPS_ARGUMENT_OPTIONAL_OUTPUT,
+		G_STRUCT_OFFSET( VipsFindTemplate, out_array ),
+		VIPS_TYPE_ARRAY_DOUBLE );
+
+	VIPS_ARG_BOXED( class, "x_array", 10,
+		_( "x array" ),
+		_( "Array of horizontal positions" ),
+		VIPS_ARGUMENT_OPTIONAL_OUTPUT,
+		G_STRUCT_OFFSET( VipsFindTemplate, x_array ),
+		VIPS_TYPE_ARRAY_INT );
+
+	VIPS_ARG_BOXED( class, "y_array", 11,
+		_( "y array" ),
+		_( "Array of vertical positions" ),
+		VIPS_ARGUMENT_OPTIONAL_OUTPUT,
+		G_STRUCT_OFFSET( VipsFindTemplate, y_array ),
+		VIPS_TYPE_ARRAY_INT );
+
+}
+
+static void
+vips_find_template_init( VipsFindTemplate *find_template )
+{
+	find_template->size = 1;
+	find_template->levels = VIPS_FIND_TEMPLATE_MAX_LEVELS;
+}
+
+/**
+ * vips_find_template: (method)
+ * @in: image to search
+ * @ref: reference to search for
+ * @x: (out): horizontal position of best match
+ * @y: (out): vertical position of best match
+ * @...: %NULL-terminated list of optional named arguments
+ *
+ * Optional arguments:
+ *
+ * * @size: %gint, number of matches to find
+ * * @levels: %gint, maximum number of pyramid levels
+ * * @fft: %gboolean, search the coarsest level with an FFT
+ * * @score: %gdouble, correlation coefficient of the best match
+ * * @out_array: #VipsArrayDouble, correlation coefficients of all matches
+ * * @x_array: #VipsArrayInt, horizontal positions of all matches
+ * * @y_array: #VipsArrayInt, vertical positions of all matches
+ *
+ * Search @in for @ref. Positions are for the centre of @ref, as with
+ * vips_spcor(), and scores are the same normalised correlation coefficient
+ * that vips_spcor() computes. Multi-band images are averaged to one band
+ * first.
+ *
+ * Rather than correlate at every position, vips_find_template() builds a
+ * pyramid of @in and @ref by repeated 2x2 shrinks, stopping when @ref gets
+ * too small or after @levels levels. It searches the whole of the
+ * smallest level, then refines the best candidates on each larger level,
+ * looking a few pixels either side of each peak. This is very much
+ * quicker than vips_spcor() for large references, though a match
+ * which only shows up at fine scales can be missed. Set @levels to 1 for
+ * a full search.
+ *
+ * Set @fft to compute the correlation at the smallest level in the
+ * frequency domain with vips_fwfft(). This is quicker for large
+ * references.
+ *
+ * Set @size to find the @size best matches. Matches closer together than
+ * half the size of @ref are treated as the same match. They are returned
+ * best first in @x_array, @y_array and @out_array.
+ *
+ * See also: vips_spcor(), vips_fastcor(), vips_max().
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int
+vips_find_template( VipsImage *in, VipsImage *ref, int *x, int *y, ... )
+{
+	va_list ap;
+	int result;
+
+	va_start( ap, y );
+	result = vips_call_split( "find_template", ap, in, ref, x, y );
+	va_end( ap );
+
+	return( result );
+}
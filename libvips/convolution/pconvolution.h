@@ -73,6 +73,14 @@ typedef struct _VipsConvolutionClass {
 
 GType vips_convolution_get_type( void );
 
+gboolean vips__convfft_worthwhile( VipsImage *in, VipsImage *M );
+
+int vips__conv_block_width( VipsRegion *ir, VipsImage *M, int width );
+
+gboolean vips__convmulti_ok( VipsImage *in, VipsImage **mask, int n );
+int vips__convmulti( VipsImage *in, VipsImage **out, VipsImage **mask, int n,
+	VipsCombine combine, gboolean separate );
+
 #ifdef __cplusplus
 }
 #endif /*__cplusplus*/
@@ -39,6 +39,8 @@
  * 	- swap "radius" for "sigma", allows finer control
  * 	- allow a much greater range of parameters
  * 	- move to defaults suitable for screen output
+ * 14/10/18
+ * 	- add "fast" mode: sharpen an approximate luma in a single pass
  */
 
 /*
@@ -79,6 +81,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <math.h>
 
 #include <vips/vips.h>
@@ -95,11 +98,19 @@ typedef struct _VipsSharpen {
 	double y3;
 	double m1;
 	double m2;
+	gboolean fast;
 
 	/* The lut we build.
 	 */
 	int *lut;		
 
+	/* For the fast path: a normalised 1D blur mask, and the lut in
+	 * 0 - 255 luma units, indexed by difference + 255.
+	 */
+	float *coeff;
+	int n_point;
+	int *delta;
+
 	/* We used to have a radius control.
 	 */
 	int radius;
@@ -165,6 +176,275 @@ vips_sharpen_generate( VipsRegion *or,
 	return( 0 );
 }
 
+/* The sharpening curve, in L* units.
+ */
+static double
+vips_sharpen_curve( VipsSharpen *sharpen, double v )
+{
+	double y;
+
+	if( v < -sharpen->x1 )
+		/* Left of -x1.
+		 */
+		y = (v + sharpen->x1) * sharpen->m2 +
+			-sharpen->x1 * sharpen->m1;
+	else if( v < sharpen->x1 )
+		/* Centre section.
+		 */
+		y = v * sharpen->m1;
+	else
+		/* Right of x1.
+		 */
+		y = (v - sharpen->x1) * sharpen->m2 +
+			sharpen->x1 * sharpen->m1;
+
+	if( y < -sharpen->y3 )
+		y = -sharpen->y3;
+	if( y > sharpen->y2 )
+		y = sharpen->y2;
+
+	return( y );
+}
+
+/* Per-thread state for the fast path.
+ */
+typedef struct {
+	VipsRegion *ir;
+
+	/* Luma for the input area, then the horizontally blurred luma.
+	 */
+	float *buf;
+	size_t size;
+} VipsSharpenSeq;
+
+static int
+vips_sharpen_fast_stop( void *vseq, void *a, void *b )
+{
+	VipsSharpenSeq *seq = (VipsSharpenSeq *) vseq;
+
+	VIPS_UNREF( seq->ir );
+	VIPS_FREE( seq->buf );
+
+	return( 0 );
+}
+
+static void *
+vips_sharpen_fast_start( VipsImage *out, void *a, void *b )
+{
+	VipsImage *in = (VipsImage *) a;
+
+	VipsSharpenSeq *seq;
+
+	if( !(seq = VIPS_NEW( out, VipsSharpenSeq )) )
+		return( NULL );
+
+	seq->ir = vips_region_new( in );
+	seq->buf = NULL;
+	seq->size = 0;
+
+	if( !seq->ir ) {
+		vips_sharpen_fast_stop( seq, NULL, NULL );
+		return( NULL );
+	}
+
+	return( seq );
+}
+
+/* Luma, blur, lut and write back in one pass. The input has been expanded by
+ * half the mask size on every edge.
+ */
+static int
+vips_sharpen_fast_generate( VipsRegion *or,
+	void *vseq, void *a, void *b, gboolean *stop )
+{
+	VipsSharpenSeq *seq = (VipsSharpenSeq *) vseq;
+	VipsSharpen *sharpen = (VipsSharpen *) b;
+	VipsRegion *ir = seq->ir;
+	VipsRect *r = &or->valid;
+	int bands = ir->im->Bands;
+	int colour = bands >= 3 ? 3 : 1;
+	const float * restrict coeff = sharpen->coeff;
+	int n_point = sharpen->n_point;
+	int h = n_point / 2;
+	const int *delta = sharpen->delta;
+
+	VipsRect s;
+	float * restrict luma;
+	float * restrict hblur;
+	size_t size;
+	int x, y, z, i;
+
+	s = *r;
+	s.width += n_point - 1;
+	s.height += n_point - 1;
+	if( vips_region_prepare( ir, &s ) )
+		return( -1 );
+
+	size = (size_t) s.height * (s.width + r->width);
+	if( seq->size < size ) {
+		VIPS_FREE( seq->buf );
+		if( !(seq->buf = VIPS_ARRAY( NULL, size, float )) )
+			return( -1 );
+		seq->size = size;
+	}
+	luma = seq->buf;
+	hblur = seq->buf + (size_t) s.height * s.width;
+
+	VIPS_GATE_START( "vips_sharpen_fast_generate: work" );
+
+	for( y = 0; y < s.height; y++ ) {
+		VipsPel *p = VIPS_REGION_ADDR( ir, s.left, s.top + y );
+		float *l = luma + y * s.width;
+
+		if( colour == 3 )
+			for( x = 0; x < s.width; x++ ) {
+				l[x] = 0.299f * p[0] +
+					0.587f * p[1] +
+					0.114f * p[2];
+				p += bands;
+			}
+		else
+			for( x = 0; x < s.width; x++ ) {
+				l[x] = p[0];
+				p += bands;
+			}
+	}
+
+	for( y = 0; y < s.height; y++ ) {
+		float *l = luma + y * s.width;
+		float *q = hblur + y * r->width;
+
+		for( x = 0; x < r->width; x++ ) {
+			float sum;
+
+			sum = 0.0f;
+			for( z = 0; z < n_point; z++ )
+				sum += coeff[z] * l[x + z];
+			q[x] = sum;
+		}
+	}
+
+	for( y = 0; y < r->height; y++ ) {
+		VipsPel *p = VIPS_REGION_ADDR( ir,
+			r->left + h, r->top + y + h );
+		VipsPel *q = VIPS_REGION_ADDR( or, r->left, r->top + y );
+		float *l = luma + (y + h) * s.width + h;
+
+		for( x = 0; x < r->width; x++ ) {
+			float sum;
+			int diff;
+			int d;
+
+			sum = 0.0f;
+			for( z = 0; z < n_point; z++ )
+				sum += coeff[z] * hblur[(y + z) * r->width + x];
+
+			diff = VIPS_RINT( l[x] - sum );
+			diff = VIPS_CLIP( -255, diff, 255 );
+			d = delta[diff + 255];
+
+			for( i = 0; i < colour; i++ ) {
+				int v = p[i] + d;
+
+				q[i] = VIPS_CLIP( 0, v, UCHAR_MAX );
+			}
+			for( ; i < bands; i++ )
+				q[i] = p[i];
+
+			p += bands;
+			q += bands;
+		}
+	}
+
+	VIPS_GATE_STOP( "vips_sharpen_fast_generate: work" );
+
+	return( 0 );
+}
+
+/* The fast path works on 8-bit sRGB and mono, with or without alpha.
+ */
+static gboolean
+vips_sharpen_fast_ok( VipsImage *in )
+{
+	VipsInterpretation interpretation =
+		vips_image_guess_interpretation( in );
+
+	return( in->Coding == VIPS_CODING_NONE &&
+		in->BandFmt == VIPS_FORMAT_UCHAR &&
+		in->Bands <= 4 &&
+		(interpretation == VIPS_INTERPRETATION_sRGB ||
+		 interpretation == VIPS_INTERPRETATION_B_W) );
+}
+
+/* Sharpen an approximate luma rather than L*, and write sRGB directly. This
+ * skips the whole sRGB -> LabS -> sRGB round trip.
+ */
+static int
+vips_sharpen_fast( VipsSharpen *sharpen )
+{
+	VipsObject *object = VIPS_OBJECT( sharpen );
+	VipsImage **t = (VipsImage **) vips_object_local_array( object, 3 );
+	VipsImage *in = sharpen->in;
+
+	int h;
+	int i;
+
+	/* Same mask as the LabS path.
+	 */
+	if( vips_gaussmat( &t[0], sharpen->sigma, 0.2,
+		"separable", TRUE,
+		"precision", VIPS_PRECISION_FLOAT,
+		NULL ) )
+		return( -1 );
+
+	sharpen->n_point = VIPS_IMAGE_N_PELS( t[0] );
+	if( !(sharpen->coeff = VIPS_ARRAY( object, sharpen->n_point, float )) )
+		return( -1 );
+	for( i = 0; i < sharpen->n_point; i++ )
+		sharpen->coeff[i] = VIPS_MATRIX( t[0], i, 0 )[0] /
+			vips_image_get_scale( t[0] );
+	h = sharpen->n_point / 2;
+
+	/* L* runs 0 - 100, luma 0 - 255.
+	 */
+	if( !(sharpen->delta = VIPS_ARRAY( object, 511, int )) )
+		return( -1 );
+	for( i = 0; i < 511; i++ ) {
+		double v = (i - 255) * 100.0 / 255.0;
+
+		sharpen->delta[i] =
+			VIPS_RINT( vips_sharpen_curve( sharpen, v ) * 2.55 );
+	}
+
+	if( vips_embed( in, &t[1], h, h,
+		in->Xsize + 2 * h, in->Ysize + 2 * h,
+		"extend", VIPS_EXTEND_COPY,
+		NULL ) )
+		return( -1 );
+
+	t[2] = vips_image_new();
+	if( vips_image_pipelinev( t[2],
+		VIPS_DEMAND_STYLE_FATSTRIP, t[1], NULL ) )
+		return( -1 );
+	t[2]->Xsize = in->Xsize;
+	t[2]->Ysize = in->Ysize;
+
+	if( vips_image_generate( t[2],
+		vips_sharpen_fast_start, vips_sharpen_fast_generate,
+			vips_sharpen_fast_stop,
+		t[1], sharpen ) )
+		return( -1 );
+
+	g_object_set( object, "out", vips_image_new(), NULL );
+
+	if( vips_image_write( t[2], sharpen->out ) )
+		return( -1 );
+
+	vips_reorder_margin_hint( sharpen->out, sharpen->n_point );
+
+	return( 0 );
+}
+
 static int
 vips_sharpen_build( VipsObject *object )
 {
@@ -190,6 +470,16 @@ vips_sharpen_build( VipsObject *object )
 
 	in = sharpen->in; 
 
+	if( sharpen->fast &&
+		vips_sharpen_fast_ok( in ) ) {
+		if( vips_sharpen_fast( sharpen ) )
+			return( -1 );
+
+		VIPS_GATE_STOP( "vips_sharpen_build: build" );
+
+		return( 0 );
+	}
+
 	if( vips_colourspace( in, &t[0], VIPS_INTERPRETATION_LABS, NULL ) )
 		return( -1 );
 	in = t[0];
@@ -222,27 +512,7 @@ vips_sharpen_build( VipsObject *object )
 		/* Rescale to +/- 100.
 		 */
 		double v = (i - 32767) / 327.67;
-		double y;
-
-		if( v < -sharpen->x1 ) 
-			/* Left of -x1.
-			 */
-			y = (v + sharpen->x1) * sharpen->m2 +
-				-sharpen->x1 * sharpen->m1;
-		else if( v < sharpen->x1 ) 
-			/* Centre section.
-			 */
-			y = v * sharpen->m1;
-		else 
-			/* Right of x1.
-			 */
-			y = (v - sharpen->x1) * sharpen->m2 +
-				sharpen->x1 * sharpen->m1;
-
-		if( y < -sharpen->y3 )
-			y = -sharpen->y3;
-		if( y > sharpen->y2 )
-			y = sharpen->y2;
+		double y = vips_sharpen_curve( sharpen, v );
 
 		sharpen->lut[i] = VIPS_RINT( y * 327.67 );
 	}
@@ -365,6 +635,13 @@ vips_sharpen_class_init( VipsSharpenClass *class )
 		G_STRUCT_OFFSET( VipsSharpen, m2 ),
 		0, 1000000, 3.0 );
 
+	VIPS_ARG_BOOL( class, "fast", 10,
+		_( "Fast" ),
+		_( "Sharpen an approximate luma in a single pass" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsSharpen, fast ),
+		FALSE );
+
 	/* We used to have a radius control.
 	 */
 	VIPS_ARG_INT( class, "radius", 3, 
@@ -401,6 +678,7 @@ vips_sharpen_init( VipsSharpen *sharpen )
  * * @y3: maximum amount of darkening
  * * @m1: slope for flat areas
  * * @m2: slope for jaggy areas
+ * * @fast: %gboolean, sharpen an approximate luma in a single pass
  *
  * Selectively sharpen the L channel of a LAB image. The input image is
  * transformed to #VIPS_INTERPRETATION_LABS. 
@@ -452,6 +730,13 @@ vips_sharpen_init( VipsSharpen *sharpen )
  * pixels/mm). These figures refer to the image raster, not the half-tone 
  * resolution.
  *
+ * If @fast is set and @in is an 8-bit sRGB or mono image, vips_sharpen()
+ * skips the conversion to #VIPS_INTERPRETATION_LABS. Instead, it blurs an
+ * approximate luma, and adds the lookup table output to every colour
+ * band, all in a single pass. Alpha is passed through unchanged. This is
+ * much quicker, but colours can shift slightly in strongly saturated
+ * areas. Other images use the usual path.
+ *
  * See also: vips_conv().
  * 
  * Returns: 0 on success, -1 on error.
@@ -2,6 +2,8 @@
  * 
  * 2/2/18
  * 	- from vips_sobel()
+ * 14/10/18
+ * 	- do both float masks in one pass with vips__convmulti()
  */
 
 /*
@@ -46,6 +48,8 @@
 
 #include <vips/vips.h>
 
+#include "pconvolution.h"
+
 typedef struct _VipsSobel {
 	VipsOperation parent_instance;
 
@@ -159,14 +163,28 @@ vips_sobel_build_float( VipsSobel *sobel )
 		 0.0,  0.0,  0.0,
 		-1.0, -2.0, -1.0 );
 	if( vips_rot90( t[1], &t[2], NULL ) ||
-		vips_conv( sobel->in, &t[3], t[1], NULL ) ||
-		vips_conv( sobel->in, &t[7], t[2], NULL ) )
+		vips_image_decode( sobel->in, &t[0] ) )
 		return( -1 );
 
-	if( vips_abs( t[3], &t[9], NULL ) ||
-		vips_abs( t[7], &t[10], NULL ) ||
-		vips_add( t[9], t[10], &t[11], NULL ) ||
-		vips_cast( t[11], &t[12], sobel->in->BandFmt, NULL ) )
+	/* Both masks in one pass, if we can.
+	 */
+	if( vips__convmulti_ok( t[0], &t[1], 2 ) ) {
+		if( vips__convmulti( t[0], &t[11], &t[1], 2,
+			VIPS_COMBINE_SUM, FALSE ) )
+			return( -1 );
+	}
+	else {
+		if( vips_conv( sobel->in, &t[3], t[1], NULL ) ||
+			vips_conv( sobel->in, &t[7], t[2], NULL ) )
+			return( -1 );
+
+		if( vips_abs( t[3], &t[9], NULL ) ||
+			vips_abs( t[7], &t[10], NULL ) ||
+			vips_add( t[9], t[10], &t[11], NULL ) )
+			return( -1 );
+	}
+
+	if( vips_cast( t[11], &t[12], sobel->in->BandFmt, NULL ) )
 		return( -1 ); 
 
 	g_object_set( sobel, "out", vips_image_new(), NULL ); 
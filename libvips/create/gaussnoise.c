@@ -26,6 +26,9 @@
  * 	- use g_random_double() once per image, use vips__random() for pixel
  * 	  values from (x, y) position ... makes pixels reproducible on
  * 	  recalculation
+ * 14/10/18
+ * 	- use vips__random_gauss(), a counter-based generator plus Box-Muller
+ * 	- add @seed
  */
 
 /*
@@ -77,7 +80,7 @@ typedef struct _VipsGaussnoise {
 
 	/* Per-image seed. 
 	 */
-	guint32 seed;
+	int seed;
 } VipsGaussnoise;
 
 typedef VipsCreateClass VipsGaussnoiseClass;
@@ -99,22 +102,21 @@ vips_gaussnoise_gen( VipsRegion *or, void *seq, void *a, void *b,
 
 		int x;
 
-		for( x = 0; x < sz; x++ ) {
-			guint32 seed;
-			double sum;
-			int i;
+		double z[2];
 
-			seed = gaussnoise->seed;
-			seed = vips__random_add( seed, or->valid.left + x );
-			seed = vips__random_add( seed, or->valid.top + y );
+		/* Each counter makes a pair of samples for two
+		 * horizontally adjacent pixels.
+		 */
+		for( x = 0; x < sz; x++ ) {
+			int ax = or->valid.left + x;
 
-			sum = 0.0;
-			for( i = 0; i < 12; i++ ) {
-				seed = vips__random( seed ); 
-				sum += (double) seed / UINT_MAX;
-			}
+			if( x == 0 ||
+				!(ax & 1) )
+				vips__random_gauss( gaussnoise->seed,
+					ax >> 1, or->valid.top + y,
+					&z[0], &z[1] );
 
-			q[x] = (sum - 6.0) * gaussnoise->sigma + 
+			q[x] = z[ax & 1] * gaussnoise->sigma +
 				gaussnoise->mean;
 		}
 	}
@@ -138,11 +140,6 @@ vips_gaussnoise_build( VipsObject *object )
 	vips_image_pipelinev( create->out, 
 		VIPS_DEMAND_STYLE_ANY, NULL );
 
-	/* The seed for this image. Each pixel is seeded by this plus the (x,
-	 * y) coordinate.
-	 */
-	gaussnoise->seed = UINT_MAX * g_random_double(); 
-
 	if( vips_image_generate( create->out, 
 		NULL, vips_gaussnoise_gen, NULL, gaussnoise, NULL ) )
 		return( -1 );
@@ -196,6 +193,13 @@ vips_gaussnoise_class_init( VipsGaussnoiseClass *class )
 		G_STRUCT_OFFSET( VipsGaussnoise, sigma ),
 		0, 100000, 30 );
 
+	VIPS_ARG_INT( class, "seed", 7,
+		_( "Seed" ),
+		_( "Random number seed" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsGaussnoise, seed ),
+		INT_MIN, INT_MAX, 0 );
+
 }
 
 static void
@@ -203,6 +207,11 @@ vips_gaussnoise_init( VipsGaussnoise *gaussnoise )
 {
 	gaussnoise->mean = 128.0;
 	gaussnoise->sigma = 30.0;
+
+	/* The seed for this image. Each pair of pixels is made from this
+	 * plus the (x, y) coordinate.
+	 */
+	gaussnoise->seed = g_random_int_range( INT_MIN, INT_MAX );
 }
 
 /**
@@ -216,10 +225,15 @@ vips_gaussnoise_init( VipsGaussnoise *gaussnoise )
  *
  * * @mean: mean of generated pixels
  * * @sigma: standard deviation of generated pixels
+ * * @seed: %gint, random number seed
  *
  * Make a one band float image of gaussian noise with the specified
- * distribution. The noise distribution is created by averaging 12 random 
- * numbers with the appropriate weights.
+ * distribution. The noise is made with a Box-Muller transform of a
+ * counter-based random number generator.
+ *
+ * Each pixel depends only on its position and @seed, so the output is the
+ * same however the image is computed. Set @seed to make the same noise
+ * again. By default, a random seed is picked for each call.
  *
  * See also: vips_black(), vips_xyz(), vips_text().
  *
@@ -2,6 +2,9 @@
  *
  * 02/01/14
  * 	- from sines.c
+ * 15/10/18
+ * 	- make the whole mask in memory, computing one half or one quadrant
+ * 	  and mirroring
  */
 
 /*
@@ -53,26 +56,18 @@
 
 G_DEFINE_ABSTRACT_TYPE( VipsMask, vips_mask, VIPS_TYPE_POINT );
 
+/* The mask value at (x, y), relative to the centre.
+ */
 static float
-vips_mask_point( VipsPoint *point, int x, int y )
+vips_mask_value( VipsMask *mask, int x, int y )
 {
-	VipsMask *mask = VIPS_MASK( point ); 
-	VipsMaskClass *class = VIPS_MASK_GET_CLASS( point ); 
+	VipsMaskClass *class = VIPS_MASK_GET_CLASS( mask ); 
+	VipsPoint *point = VIPS_POINT( mask );
 	int half_width = point->width / 2;
 	int half_height = point->height / 2;
 
 	double result;
 
-	/* Move centre for an optical transform mask.
-	 */
-	if( !mask->optical ) {
-		x = (x + half_width) % point->width;
-		y = (y + half_height) % point->height;
-	}
-
-	x = x - half_width;
-	y = y - half_height;
-
 	if( !mask->nodc && 
 		x == 0 &&
 		y == 0 )
@@ -97,6 +92,101 @@ vips_mask_point( VipsPoint *point, int x, int y )
 	return( result ); 
 }
 
+/* Image x (or y) to a position relative to the centre. 
+ */
+static int
+vips_mask_coordinate( VipsMask *mask, int x, int size )
+{
+	int half = size / 2;
+
+	/* Move centre for an optical transform mask.
+	 */
+	if( !mask->optical ) 
+		x = (x + half) % size;
+
+	return( x - half );
+}
+
+static float
+vips_mask_point( VipsPoint *point, int x, int y )
+{
+	VipsMask *mask = VIPS_MASK( point ); 
+
+	return( vips_mask_value( mask, 
+		vips_mask_coordinate( mask, x, point->width ),
+		vips_mask_coordinate( mask, y, point->height ) ) ); 
+}
+
+/* Masks are symmetric about the centre, so we only compute the half with
+ * y >= 0 and mirror it, or just one quadrant for radial masks. This makes
+ * the whole mask in memory, so the operation cache will hold the pixels 
+ * and repeat uses of the same mask skip generation completely.
+ */
+static int
+vips_mask_build_image( VipsPoint *point, VipsImage **out )
+{
+	VipsMask *mask = VIPS_MASK( point ); 
+	VipsMaskClass *class = VIPS_MASK_GET_CLASS( mask ); 
+	VipsPointClass *point_class = VIPS_POINT_GET_CLASS( point ); 
+	int width = point->width;
+	int height = point->height;
+	int half_width = width / 2;
+	int half_height = height / 2;
+
+	/* The table covers x in [-half_width, half_width] and y in 
+	 * [0, half_height]. Relative coordinates in the image never go 
+	 * outside this, after mirroring.
+	 */
+	int table_width = 2 * half_width + 1;
+
+	float *table;
+	int x, y;
+
+	if( !(table = VIPS_ARRAY( NULL, 
+		(size_t) table_width * (half_height + 1), float )) )
+		return( -1 );
+
+	for( y = 0; y <= half_height; y++ ) {
+		float *row = table + y * table_width + half_width;
+
+		for( x = 0; x <= half_width; x++ )
+			row[x] = vips_mask_value( mask, x, y );
+
+		for( x = -half_width; x < 0; x++ )
+			row[x] = class->radial ? 
+				row[-x] : vips_mask_value( mask, x, y );
+	}
+
+	*out = vips_image_new_memory();
+	vips_image_init_fields( *out,
+		width, height, 1,
+		VIPS_FORMAT_FLOAT, VIPS_CODING_NONE, 
+		point_class->interpretation,
+		1.0, 1.0 );
+	if( vips_image_write_prepare( *out ) ) {
+		g_free( table );
+		return( -1 );
+	}
+
+	for( y = 0; y < height; y++ ) {
+		int ry = vips_mask_coordinate( mask, y, height );
+		float *q = (float *) VIPS_IMAGE_ADDR( *out, 0, y );
+
+		/* Rows above the centre are the reflection of rows below.
+		 */
+		float *row = table + abs( ry ) * table_width + half_width;
+		int sign = ry < 0 ? -1 : 1;
+
+		for( x = 0; x < width; x++ ) 
+			q[x] = row[sign * 
+				vips_mask_coordinate( mask, x, width )];
+	}
+
+	g_free( table );
+
+	return( 0 );
+}
+
 static void
 vips_mask_class_init( VipsMaskClass *class )
 {
@@ -110,7 +200,10 @@ vips_mask_class_init( VipsMaskClass *class )
 	vobject_class->nickname = "mask";
 	vobject_class->description = _( "base class for frequency filters" );
 
+	class->radial = FALSE;
+
 	point_class->point = vips_mask_point;
+	point_class->build_image = vips_mask_build_image;
 	point_class->min = 0.0; 
 	point_class->max = 1.0; 
 	point_class->interpretation = VIPS_INTERPRETATION_FOURIER;
@@ -83,6 +83,7 @@ vips_mask_butterworth_class_init( VipsMaskButterworthClass *class )
 	vobject_class->description = _( "make a butterworth filter" );
 
 	mask_class->point = vips_mask_butterworth_point;
+	mask_class->radial = TRUE;
 
 	VIPS_ARG_DOUBLE( class, "order", 6, 
 		_( "Order" ), 
@@ -88,6 +88,7 @@ vips_mask_fractal_class_init( VipsMaskFractalClass *class )
 	vobject_class->description = _( "make fractal filter" );
 
 	mask_class->point = vips_mask_fractal_point;
+	mask_class->radial = TRUE;
 
 	VIPS_ARG_DOUBLE( class, "fractal_dimension", 8, 
 		_( "Fractal dimension" ), 
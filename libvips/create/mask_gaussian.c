@@ -81,6 +81,7 @@ vips_mask_gaussian_class_init( VipsMaskGaussianClass *class )
 	vobject_class->description = _( "make a gaussian filter" );
 
 	mask_class->point = vips_mask_gaussian_point;
+	mask_class->radial = TRUE;
 
 	VIPS_ARG_DOUBLE( class, "frequency_cutoff", 7, 
 		_( "Frequency cutoff" ), 
@@ -79,6 +79,7 @@ vips_mask_ideal_class_init( VipsMaskIdealClass *class )
 	vobject_class->description = _( "make an ideal filter" );
 
 	mask_class->point = vips_mask_ideal_point;
+	mask_class->radial = TRUE;
 
 	VIPS_ARG_DOUBLE( class, "frequency_cutoff", 6, 
 		_( "Frequency cutoff" ), 
@@ -1,6 +1,9 @@
 /* Perlin noise generator.
  *
  * 24/7/16
+ * 14/10/18
+ * 	- use vips__random_counter()
+ * 	- add @seed
  */
 
 /*
@@ -61,7 +64,7 @@ typedef struct _VipsPerlin {
 
 	/* Use this to seed this call of our rng.
 	 */
-	guint32 seed;
+	int seed;
 } VipsPerlin;
 
 typedef struct _VipsPerlinClass {
@@ -104,13 +107,10 @@ vips_perlin_create_cells( VipsPerlin *perlin,
 		for( x = 0; x < 2; x++ ) {
 			int ci = x + y * 2;
 
-			guint32 seed;
 			int cx;
 			int cy;
 			int angle;
 
-			seed = perlin->seed;
-
 			cx = cell_x + x;
 			cy = cell_y + y;
 
@@ -120,13 +120,11 @@ vips_perlin_create_cells( VipsPerlin *perlin,
 
 			if( cy >= perlin->cells_down )
 				cy = 0;
-			seed = vips__random_add( seed, cy );
-
 			if( cx >= perlin->cells_across )
 				cx = 0;
-			seed = vips__random_add( seed, cx );
 
-			angle = (seed ^ (seed >> 8) ^ (seed >> 16)) & 0xff;
+			angle = vips__random_counter( perlin->seed,
+				cx, cy ) & 0xff;
 
 			gx[ci] = vips_perlin_cos[angle];
 			gy[ci] = vips_perlin_sin[angle];
@@ -244,8 +242,6 @@ vips_perlin_build( VipsObject *object )
 		VIPS_ROUND_UP( perlin->height, perlin->cell_size ) / 
 		perlin->cell_size;
 
-	perlin->seed = g_random_double() * 0xffffffffu;
-
 	vips_image_init_fields( create->out,
 		perlin->width, perlin->height, 1,
 		perlin->uchar ? VIPS_FORMAT_UCHAR : VIPS_FORMAT_FLOAT, 
@@ -321,12 +317,20 @@ vips_perlin_class_init( VipsPerlinClass *class )
 		G_STRUCT_OFFSET( VipsPerlin, uchar ),
 		FALSE );
 
+	VIPS_ARG_INT( class, "seed", 5,
+		_( "Seed" ),
+		_( "Random number seed" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsPerlin, seed ),
+		INT_MIN, INT_MAX, 0 );
+
 }
 
 static void
 vips_perlin_init( VipsPerlin *perlin )
 {
 	perlin->cell_size = 256;
+	perlin->seed = g_random_int_range( INT_MIN, INT_MAX );
 }
 
 /**
@@ -340,6 +344,7 @@ vips_perlin_init( VipsPerlin *perlin )
  *
  * * @cell_size: %gint, size of Perlin cells
  * * @uchar: output a uchar image
+ * * @seed: %gint, random number seed
  *
  * Create a one-band float image of Perlin noise. See:
  *
@@ -353,6 +358,9 @@ vips_perlin_init( VipsPerlin *perlin )
  * Normally, output pixels are #VIPS_FORMAT_FLOAT in the range [-1, +1]. Set 
  * @uchar to output a uchar image with pixels in [0, 255]. 
  *
+ * Set @seed to make the same pattern again. By default, each call picks a
+ * random seed.
+ *
  * See also: vips_worley(), vips_fractsurf(), vips_gaussnoise().
  *
  * Returns: 0 on success, -1 on error
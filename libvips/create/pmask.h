@@ -70,6 +70,12 @@ typedef struct _VipsMaskClass {
 
 	double (*point)( VipsMask *, double, double ); 
 
+	/* point() depends only on distance from the centre, so we can
+	 * compute one quadrant and mirror it. Otherwise, masks need only be
+	 * symmetric about the centre, and we compute one half.
+	 */
+	gboolean radial;
+
 } VipsMaskClass;
 
 GType vips_mask_get_type( void );
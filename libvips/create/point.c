@@ -1,6 +1,8 @@
 /* base class for point-wise creators
  *
  * 13/6/13
+ * 15/10/18
+ * 	- add build_image
  */
 
 /*
@@ -85,16 +87,23 @@ vips_point_build( VipsObject *object )
 	if( VIPS_OBJECT_CLASS( vips_point_parent_class )->build( object ) )
 		return( -1 );
 
-	t[0] = vips_image_new();
-	vips_image_init_fields( t[0],
-		point->width, point->height, 1,
-		VIPS_FORMAT_FLOAT, VIPS_CODING_NONE, class->interpretation,
-		1.0, 1.0 );
-	vips_image_pipelinev( t[0], 
-		VIPS_DEMAND_STYLE_ANY, NULL );
-	if( vips_image_generate( t[0], 
-		NULL, vips_point_gen, NULL, point, NULL ) )
-		return( -1 );
+	if( class->build_image ) {
+		if( class->build_image( point, &t[0] ) )
+			return( -1 );
+	}
+	else {
+		t[0] = vips_image_new();
+		vips_image_init_fields( t[0],
+			point->width, point->height, 1,
+			VIPS_FORMAT_FLOAT, VIPS_CODING_NONE, 
+			class->interpretation,
+			1.0, 1.0 );
+		vips_image_pipelinev( t[0], 
+			VIPS_DEMAND_STYLE_ANY, NULL );
+		if( vips_image_generate( t[0], 
+			NULL, vips_point_gen, NULL, point, NULL ) )
+			return( -1 );
+	}
 	in = t[0];
 
 	if( point->uchar ) {
@@ -134,6 +143,7 @@ vips_point_class_init( VipsPointClass *class )
 	vobject_class->build = vips_point_build;
 
 	class->point = NULL; 
+	class->build_image = NULL; 
 	class->min = -1.0; 
 	class->max = 1.0; 
 	class->interpretation = VIPS_INTERPRETATION_MULTIBAND;
@@ -64,6 +64,12 @@ typedef struct _VipsPointClass {
 	VipsCreateClass parent_class;
 
 	float (*point)( VipsPoint *, int, int ); 
+
+	/* Optional: make the whole float image in memory in one go, rather
+	 * than calling point() for every pixel as it's needed.
+	 */
+	int (*build_image)( VipsPoint *, VipsImage ** ); 
+
 	float min;
 	float max;
 	VipsInterpretation interpretation; 
@@ -20,6 +20,10 @@
  * 	- implement auto fitting of text inside bounds
  * 12/3/18
  * 	- better fitting of fonts with overhanging edges, thanks Adrià 
+ * 14/10/18
+ * 	- keep a pool of font maps so renders can run in parallel
+ * 	- cache extents and rendered text
+ * 	- fix a lock leak on autofit failure
  */
 
 /*
@@ -82,6 +86,7 @@ typedef struct _VipsText {
 	int dpi;
 
 	FT_Bitmap bitmap;
+	PangoFontMap *fontmap;
 	PangoContext *context;
 	PangoLayout *layout;
 
@@ -91,25 +96,156 @@ typedef VipsCreateClass VipsTextClass;
 
 G_DEFINE_TYPE( VipsText, vips_text, VIPS_TYPE_CREATE );
 
-/* Just have one of these and reuse it.
- *
- * This does not unref cleanly on many platforms, so we will leak horribly
- * unless we reuse it. Sadly this means vips_text() needs to use a lock 
- * internally to single-thread text rendering.
+/* Font maps are not thread-safe, and they do not unref cleanly on many
+ * platforms, so we will leak horribly unless we reuse them. Keep a list of
+ * idle font maps: a render takes one (or makes one if they are all in use)
+ * and puts it back when it's done. We never make more font maps than
+ * the peak number of simultaneous renders, and renders never wait for each
+ * other.
+ */
+static GSList *vips_text_fontmaps = NULL;
+
+/* Cache the extents, and the rendered bitmap, of recent texts. Repeated
+ * captions, and the many trial layouts autofit makes, can then skip layout
+ * and rendering. Entries are kept in a hash on their parameters, plus a
+ * queue in order of last use, most recent first.
  */
-static PangoFontMap *vips_text_fontmap = NULL;
+#define VIPS_TEXT_CACHE_MAX (100)
+
+typedef struct _VipsTextEntry {
+	char *key;
+	GList *link;
+
+	VipsRect extents;
+
+	/* The rendered text, or NULL if we've only laid this out so far.
+	 */
+	VipsPel *buffer;
+	int pitch;
+} VipsTextEntry;
+
+static GHashTable *vips_text_cache = NULL;
+static GQueue vips_text_lru = G_QUEUE_INIT;
 
-/* ... single-thread the body of vips_text() with this.
+/* Protect the font map list and the cache with this.
  */
 static GMutex *vips_text_lock = NULL; 
 
+static PangoFontMap *
+vips_text_fontmap_get( void )
+{
+	PangoFontMap *fontmap;
+
+	g_mutex_lock( vips_text_lock );
+
+	if( vips_text_fontmaps ) {
+		fontmap = (PangoFontMap *) vips_text_fontmaps->data;
+		vips_text_fontmaps =
+			g_slist_remove( vips_text_fontmaps, fontmap );
+	}
+	else
+		fontmap = pango_ft2_font_map_new();
+
+	g_mutex_unlock( vips_text_lock );
+
+	return( fontmap );
+}
+
 static void
-vips_text_dispose( GObject *gobject )
+vips_text_fontmap_put( PangoFontMap *fontmap )
 {
-	VipsText *text = (VipsText *) gobject;
+	g_mutex_lock( vips_text_lock );
+	vips_text_fontmaps = g_slist_prepend( vips_text_fontmaps, fontmap );
+	g_mutex_unlock( vips_text_lock );
+}
+
+static void
+vips_text_entry_free( VipsTextEntry *entry )
+{
+	VIPS_FREE( entry->key );
+	VIPS_FREE( entry->buffer );
+	g_free( entry );
+}
+
+static char *
+vips_text_cache_key( VipsText *text )
+{
+	return( g_strdup_printf( "%d %d %d %d %s\n%s",
+		text->width, text->spacing, text->align, text->dpi,
+		text->font, text->text ) );
+}
 
+/* Look up the entry for key and move it to the front of the queue. Call with
+ * the lock held.
+ */
+static VipsTextEntry *
+vips_text_cache_lookup( const char *key )
+{
+	VipsTextEntry *entry;
+
+	if( !vips_text_cache ||
+		!(entry = g_hash_table_lookup( vips_text_cache, key )) )
+		return( NULL );
+
+	g_queue_unlink( &vips_text_lru, entry->link );
+	g_queue_push_head_link( &vips_text_lru, entry->link );
+
+	return( entry );
+}
+
+/* Find or make the entry for key, trimming the cache if it has grown too
+ * big. Call with the lock held.
+ */
+static VipsTextEntry *
+vips_text_cache_add( const char *key, VipsRect *extents )
+{
+	VipsTextEntry *entry;
+
+	if( (entry = vips_text_cache_lookup( key )) )
+		return( entry );
+
+	if( !vips_text_cache )
+		vips_text_cache = g_hash_table_new_full(
+			g_str_hash, g_str_equal,
+			NULL, (GDestroyNotify) vips_text_entry_free );
+
+	while( g_queue_get_length( &vips_text_lru ) >= VIPS_TEXT_CACHE_MAX ) {
+		VipsTextEntry *last =
+			(VipsTextEntry *) g_queue_pop_tail( &vips_text_lru );
+
+		g_hash_table_remove( vips_text_cache, last->key );
+	}
+
+	entry = g_new0( VipsTextEntry, 1 );
+	entry->key = g_strdup( key );
+	entry->extents = *extents;
+	g_queue_push_head( &vips_text_lru, entry );
+	entry->link = g_queue_peek_head_link( &vips_text_lru );
+	g_hash_table_insert( vips_text_cache, entry->key, entry );
+
+	return( entry );
+}
+
+/* Drop the layout and hand our font map back for another render to use.
+ */
+static void
+vips_text_release( VipsText *text )
+{
 	VIPS_UNREF( text->layout ); 
 	VIPS_UNREF( text->context ); 
+
+	if( text->fontmap ) {
+		vips_text_fontmap_put( text->fontmap );
+		text->fontmap = NULL;
+	}
+}
+
+static void
+vips_text_dispose( GObject *gobject )
+{
+	VipsText *text = (VipsText *) gobject;
+
+	vips_text_release( text );
 	VIPS_FREE( text->bitmap.buffer ); 
 
 	G_OBJECT_CLASS( vips_text_parent_class )->dispose( gobject );
@@ -159,29 +295,61 @@ text_layout_new( PangoContext *context,
 	return( layout );
 }
 
+/* Lay the text out at the current dpi.
+ */
 static int
-vips_text_get_extents( VipsText *text, VipsRect *extents )
+vips_text_layout( VipsText *text )
 {
-	PangoRectangle ink_rect;
-	PangoRectangle logical_rect;
+	VIPS_UNREF( text->layout );
+	VIPS_UNREF( text->context );
 
 	pango_ft2_font_map_set_resolution( 
-		PANGO_FT2_FONT_MAP( vips_text_fontmap ), text->dpi, text->dpi );
+		PANGO_FT2_FONT_MAP( text->fontmap ), text->dpi, text->dpi );
 	text->context = pango_font_map_create_context( 
-		PANGO_FONT_MAP( vips_text_fontmap ) );
+		PANGO_FONT_MAP( text->fontmap ) );
 
 	if( !(text->layout = text_layout_new( text->context, 
 		text->text, text->font, 
 		text->width, text->spacing, text->align )) ) 
 		return( -1 );
 
-	pango_layout_get_pixel_extents( text->layout, 
-		&ink_rect, &logical_rect );
+	return( 0 );
+}
+
+static int
+vips_text_get_extents( VipsText *text, VipsRect *extents )
+{
+	char *key = vips_text_cache_key( text );
+
+	VipsTextEntry *entry;
+	PangoRectangle ink_rect;
+	PangoRectangle logical_rect;
+
+	g_mutex_lock( vips_text_lock );
+	if( (entry = vips_text_cache_lookup( key )) )
+		*extents = entry->extents;
+	g_mutex_unlock( vips_text_lock );
+
+	if( !entry ) {
+		if( vips_text_layout( text ) ) {
+			g_free( key );
+			return( -1 );
+		}
+
+		pango_layout_get_pixel_extents( text->layout,
+			&ink_rect, &logical_rect );
+
+		extents->left = ink_rect.x;
+		extents->top = ink_rect.y;
+		extents->width = ink_rect.width;
+		extents->height = ink_rect.height;
 
-	extents->left = ink_rect.x;
-	extents->top = ink_rect.y;
-	extents->width = ink_rect.width;
-	extents->height = ink_rect.height;
+		g_mutex_lock( vips_text_lock );
+		(void) vips_text_cache_add( key, extents );
+		g_mutex_unlock( vips_text_lock );
+	}
+
+	g_free( key );
 
 #ifdef DEBUG
 	printf( "vips_text_get_extents: dpi = %d, "
@@ -313,6 +481,67 @@ vips_text_autofit( VipsText *text, VipsRect *out_extents )
 	return( 0 ); 
 }
 
+/* Render the text at the current dpi into text->bitmap, from the cache if
+ * we can. The bitmap is an 8-bit coverage mask, so it can be written
+ * straight to the output.
+ */
+static int
+vips_text_render( VipsText *text, VipsRect *extents )
+{
+	char *key = vips_text_cache_key( text );
+	size_t size;
+	VipsTextEntry *entry;
+
+	text->bitmap.width = extents->width;
+	text->bitmap.pitch = (text->bitmap.width + 3) & ~3;
+	text->bitmap.rows = extents->height;
+	text->bitmap.num_grays = 256;
+	text->bitmap.pixel_mode = ft_pixel_mode_grays;
+	size = (size_t) text->bitmap.pitch * text->bitmap.rows;
+	if( !(text->bitmap.buffer = VIPS_ARRAY( NULL, size, VipsPel )) ) {
+		g_free( key );
+		return( -1 );
+	}
+
+	g_mutex_lock( vips_text_lock );
+	if( (entry = vips_text_cache_lookup( key )) &&
+		entry->buffer &&
+		entry->pitch == text->bitmap.pitch )
+		memcpy( text->bitmap.buffer, entry->buffer, size );
+	else
+		entry = NULL;
+	g_mutex_unlock( vips_text_lock );
+
+	if( !entry ) {
+		VipsPel *buffer;
+
+		/* We may only have the extents from the cache, or the last
+		 * layout we made may be for a different dpi.
+		 */
+		if( vips_text_layout( text ) ) {
+			g_free( key );
+			return( -1 );
+		}
+
+		memset( text->bitmap.buffer, 0x00, size );
+		pango_ft2_render_layout( &text->bitmap, text->layout,
+			-extents->left, -extents->top );
+
+		buffer = g_memdup( text->bitmap.buffer, size );
+
+		g_mutex_lock( vips_text_lock );
+		entry = vips_text_cache_add( key, extents );
+		VIPS_FREE( entry->buffer );
+		entry->buffer = buffer;
+		entry->pitch = text->bitmap.pitch;
+		g_mutex_unlock( vips_text_lock );
+	}
+
+	g_free( key );
+
+	return( 0 );
+}
+
 static int
 vips_text_build( VipsObject *object )
 {
@@ -332,10 +561,7 @@ vips_text_build( VipsObject *object )
 		return( -1 );
 	}
 
-	g_mutex_lock( vips_text_lock ); 
-
-	if( !vips_text_fontmap )
-		vips_text_fontmap = pango_ft2_font_map_new();
+	text->fontmap = vips_text_fontmap_get();
 
 	/* If our caller set height and not dpi, we adjust dpi until 
 	 * we get a fit.
@@ -354,28 +580,13 @@ vips_text_build( VipsObject *object )
 	if( extents.width == 0 || 
 		extents.height == 0 ) {
 		vips_error( class->nickname, "%s", _( "no text to render" ) );
-		g_mutex_unlock( vips_text_lock ); 
 		return( -1 );
 	}
 
-	text->bitmap.width = extents.width;
-	text->bitmap.pitch = (text->bitmap.width + 3) & ~3;
-	text->bitmap.rows = extents.height;
-	if( !(text->bitmap.buffer = 
-		VIPS_ARRAY( NULL, 
-			text->bitmap.pitch * text->bitmap.rows, VipsPel )) ) {
-		g_mutex_unlock( vips_text_lock ); 
+	if( vips_text_render( text, &extents ) )
 		return( -1 );
-	}
-	text->bitmap.num_grays = 256;
-	text->bitmap.pixel_mode = ft_pixel_mode_grays;
-	memset( text->bitmap.buffer, 0x00, 
-		text->bitmap.pitch * text->bitmap.rows );
-
-	pango_ft2_render_layout( &text->bitmap, text->layout, 
-		-extents.left, -extents.top );
 
-	g_mutex_unlock( vips_text_lock ); 
+	vips_text_release( text );
 
 	vips_image_init_fields( create->out,
 		text->bitmap.width, text->bitmap.rows, 1, 
@@ -535,6 +746,10 @@ vips_text_init( VipsText *text )
  * @spacing sets the line spacing, in points. It would typicallly be something
  * like font size times 1.2.
  *
+ * Recently rendered text is cached, so repeated calls with the same text,
+ * font and layout parameters are quick. Calls from many threads can render
+ * at the same time.
+ *
  * See also: vips_xyz(), vips_text(), vips_gaussnoise().
  *
  * Returns: 0 on success, -1 on error
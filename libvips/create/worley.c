@@ -4,6 +4,9 @@
  *
  * 11/8/16
  * 	- float output
+ * 14/10/18
+ * 	- use vips__random_counter()
+ * 	- add @seed
  */
 
 /*
@@ -63,7 +66,7 @@ typedef struct _VipsWorley {
 
 	/* Use this to seed this call of our rng.
 	 */
-	guint32 seed;
+	int seed;
 } VipsWorley;
 
 typedef struct _VipsWorleyClass {
@@ -119,8 +122,8 @@ vips_worley_create_cells( VipsWorley *worley,
 		for( x = 0; x < 3; x++ ) {
 			Cell *cell = &cells[x + y * 3];
 
-			guint32 seed;
-			int value;
+			guint32 cx, cy;
+			guint64 r;
 			int j;
 
 			/* Can go <0 and >width for edges.
@@ -128,41 +131,41 @@ vips_worley_create_cells( VipsWorley *worley,
 			cell->cell_x = cell_x + x - 1;
 			cell->cell_y = cell_y + y - 1;
 
-			seed = worley->seed;
-
 			/* When we calculate the seed for this cell, we wrap
 			 * around so that our output will tesselate.
 			 */
 			if( cell->cell_x >= worley->cells_across )
-				value = 0;
+				cx = 0;
 			else if( cell->cell_x < 0 )
-				value = worley->cells_across - 1;
+				cx = worley->cells_across - 1;
 			else 
-				value = cell->cell_x;
-			seed = vips__random_add( seed, value );
+				cx = cell->cell_x;
 
 			if( cell->cell_y >= worley->cells_down )
-				value = 0;
+				cy = 0;
 			else if( cell->cell_y < 0 )
-				value = worley->cells_down - 1;
+				cy = worley->cells_down - 1;
 			else 
-				value = cell->cell_y;
-			seed = vips__random_add( seed, value );
+				cy = cell->cell_y;
 
 			/* [1, MAX_FEATURES)
 			 */
-			cell->n_features = (seed % (MAX_FEATURES - 1)) + 1;
+			r = vips__random_counter( worley->seed, cx, cy );
+			cell->n_features = (r % (MAX_FEATURES - 1)) + 1;
 
+			/* Each feature gets its own key, so a stream per
+			 * feature.
+			 */
 			for( j = 0; j < cell->n_features; j++ ) {
-				seed = vips__random( seed ); 
+				r = vips__random_counter( worley->seed + j + 1,
+					cx, cy );
+
 				cell->feature_x[j] = 
 					cell->cell_x * worley->cell_size + 
-					seed % worley->cell_size;
-
-				seed = vips__random( seed ); 
+					(r >> 32) % worley->cell_size;
 				cell->feature_y[j] = 
 					cell->cell_y * worley->cell_size + 
-					seed % worley->cell_size;
+					(r & 0xffffffffu) % worley->cell_size;
 			}
 		}
 }
@@ -277,8 +280,6 @@ vips_worley_build( VipsObject *object )
 		VIPS_ROUND_UP( worley->height, worley->cell_size ) / 
 		worley->cell_size;
 
-	worley->seed = g_random_double() * 0xffffffffu;
-
 	vips_image_init_fields( create->out,
 		worley->width, worley->height, 1,
 		VIPS_FORMAT_FLOAT, VIPS_CODING_NONE, 
@@ -328,12 +329,20 @@ vips_worley_class_init( VipsWorleyClass *class )
 		G_STRUCT_OFFSET( VipsWorley, cell_size ),
 		1, VIPS_MAX_COORD, 256 );
 
+	VIPS_ARG_INT( class, "seed", 4,
+		_( "Seed" ),
+		_( "Random number seed" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsWorley, seed ),
+		INT_MIN, INT_MAX, 0 );
+
 }
 
 static void
 vips_worley_init( VipsWorley *worley )
 {
 	worley->cell_size = 256;
+	worley->seed = g_random_int_range( INT_MIN, INT_MAX );
 }
 
 /**
@@ -346,6 +355,7 @@ vips_worley_init( VipsWorley *worley )
  * Optional arguments:
  *
  * * @cell_size: %gint, size of Worley cells
+ * * @seed: %gint, random number seed
  *
  * Create a one-band float image of Worley noise. See:
  *
@@ -356,6 +366,9 @@ vips_worley_init( VipsWorley *worley )
  *
  * If @width and @height are multiples of @cell_size, the image will tessellate.
  *
+ * Set @seed to make the same pattern again. By default, each call picks a
+ * random seed.
+ *
  * See also: vips_perlin(), vips_fractsurf(), vips_gaussnoise().
  *
  * Returns: 0 on success, -1 on error
@@ -83,11 +83,11 @@ png2vips( const char *name, IMAGE *out, gboolean header_only )
 
 #ifdef HAVE_PNG
 	if( header_only ) {
-		if( vips__png_header( filename, out ) )
+		if( vips__png_header( filename, out, 1 ) )
 			return( -1 );
 	}
 	else {
-		if( vips__png_read( filename, out, TRUE ) )
+		if( vips__png_read( filename, out, TRUE, 1 ) )
 			return( -1 );
 	}
 #else
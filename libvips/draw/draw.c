@@ -152,6 +152,7 @@ vips_draw_operation_init( void )
 	extern GType vips_draw_circle_get_type( void ); 
 	extern GType vips_draw_flood_get_type( void ); 
 	extern GType vips_draw_smudge_get_type( void ); 
+	extern GType vips_draw_batch_get_type( void );
 
 	vips_draw_rect_get_type();
 	vips_draw_image_get_type();
@@ -160,5 +161,6 @@ vips_draw_operation_init( void )
 	vips_draw_circle_get_type();
 	vips_draw_flood_get_type();
 	vips_draw_smudge_get_type();
+	vips_draw_batch_get_type();
 }
 
@@ -0,0 +1,718 @@
+/* draw many lines, rects, circles and masks in one pass
+ *
+ * 14/10/18
+ * 	- from draw_rect.c
+ */
+
+/*
+
+    This file is part of VIPS.
+
+    VIPS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA
+
+ */
+
+/*
+
+    These files are distributed with VIPS - http://www.vips.ecs.soton.ac.uk
+
+ */
+
+/*
+#define DEBUG
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /*HAVE_CONFIG_H*/
+#include <vips/intl.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vips/vips.h>
+#include <vips/internal.h>
+
+#include "pdraw.h"
+
+/* We paint this many scanlines of the image at a time. All the shapes which
+ * touch a band are drawn into it, in order, before we move on to the next
+ * one, so each band stays in cache while we paint it.
+ */
+#define VIPS_DRAW_BATCH_BAND (64)
+
+/* The fixed columns in each row of the shapes matrix. Ink follows.
+ */
+#define VIPS_DRAW_BATCH_COLUMNS (6)
+
+/* A shape, unpacked from a row of the matrix.
+ */
+typedef struct _VipsDrawBatchShape {
+	VipsDrawShape type;
+	int a, b, c, d;
+	gboolean fill;
+	VipsPel *ink;
+
+	/* The scanlines this shape touches, inclusive.
+	 */
+	int top;
+	int bottom;
+} VipsDrawBatchShape;
+
+typedef struct _VipsDrawBatch {
+	VipsDraw parent_object;
+
+	VipsImage *shapes;
+	VipsArrayImage *masks;
+
+	VipsDrawBatchShape *shape;
+	int n_shapes;
+
+	/* Each band has a list of indexes into shape, in drawing order.
+	 * band_start[i] is the start of band i in band_shape,
+	 * band_start[n_bands] is the end.
+	 */
+	int n_bands;
+	int *band_start;
+	int *band_shape;
+
+} VipsDrawBatch;
+
+typedef VipsDrawClass VipsDrawBatchClass;
+
+G_DEFINE_TYPE( VipsDrawBatch, vips_draw_batch, VIPS_TYPE_DRAW );
+
+static void
+vips_draw_batch_dispose( GObject *gobject )
+{
+	VipsDrawBatch *batch = (VipsDrawBatch *) gobject;
+
+	if( batch->shape ) {
+		int i;
+
+		/* Shapes can share ink with the shape before.
+		 */
+		for( i = 0; i < batch->n_shapes; i++ )
+			if( i == 0 ||
+				batch->shape[i].ink != batch->shape[i - 1].ink )
+				g_free( batch->shape[i].ink );
+		VIPS_FREE( batch->shape );
+	}
+	VIPS_FREE( batch->band_start );
+	VIPS_FREE( batch->band_shape );
+
+	G_OBJECT_CLASS( vips_draw_batch_parent_class )->dispose( gobject );
+}
+
+static inline void
+vips_draw_batch_pel( VipsPel *q, VipsPel *ink, int psize )
+{
+ 	int j;
+
+	/* Faster than memcopy() for n < about 20.
+	 */
+	for( j = 0; j < psize; j++ )
+		q[j] = ink[j];
+}
+
+/* Fill the part of area inside clip. clip must be inside the image.
+ */
+static void
+vips_draw_batch_fill( VipsDraw *draw, VipsPel *ink,
+	VipsRect *area, VipsRect *clip )
+{
+	VipsRect paint;
+	VipsPel *to;
+	VipsPel *q;
+	int x, y;
+
+	vips_rect_intersectrect( area, clip, &paint );
+	if( vips_rect_isempty( &paint ) )
+		return;
+
+	/* We plot the first line pointwise, then memcpy() it for the
+	 * subsequent lines, as vips_draw_rect().
+	 */
+	to = VIPS_IMAGE_ADDR( draw->image, paint.left, paint.top );
+
+	q = to;
+	for( x = 0; x < paint.width; x++ ) {
+		vips_draw_batch_pel( q, ink, draw->psize );
+		q += draw->psize;
+	}
+
+	q = to + draw->lsize;
+	for( y = 1; y < paint.height; y++ ) {
+		memcpy( q, to, paint.width * draw->psize );
+		q += draw->lsize;
+	}
+}
+
+static void
+vips_draw_batch_rect( VipsDraw *draw, VipsDrawBatchShape *shape,
+	VipsRect *clip )
+{
+	int left = shape->a;
+	int top = shape->b;
+	int width = shape->c;
+	int height = shape->d;
+
+	VipsRect area;
+
+	/* Outlines are four solid fills, as vips_draw_rect().
+	 */
+	if( !shape->fill &&
+		width > 2 &&
+		height > 2 ) {
+		area.left = left;
+		area.top = top;
+		area.width = width;
+		area.height = 1;
+		vips_draw_batch_fill( draw, shape->ink, &area, clip );
+
+		area.top = top + height - 1;
+		vips_draw_batch_fill( draw, shape->ink, &area, clip );
+
+		area.top = top;
+		area.width = 1;
+		area.height = height;
+		vips_draw_batch_fill( draw, shape->ink, &area, clip );
+
+		area.left = left + width - 1;
+		vips_draw_batch_fill( draw, shape->ink, &area, clip );
+	}
+	else {
+		area.left = left;
+		area.top = top;
+		area.width = width;
+		area.height = height;
+		vips_draw_batch_fill( draw, shape->ink, &area, clip );
+	}
+}
+
+/* Plot the pixels of a line which fall inside clip. This walks the same
+ * pixels as vips__draw_line_direct(), but jumps straight to the first pixel
+ * inside the band rather than stepping along from the start.
+ */
+static void
+vips_draw_batch_line( VipsDraw *draw, VipsDrawBatchShape *shape,
+	VipsRect *clip )
+{
+	int x1 = shape->a;
+	int y1 = shape->b;
+	int x2 = shape->c;
+	int y2 = shape->d;
+	int clip_bottom = VIPS_RECT_BOTTOM( clip ) - 1;
+
+	int dx, dy;
+	int sign;
+	gint64 k, k_start, k_end;
+	gint64 major, minor;
+	gint64 lo, hi;
+	gint64 err;
+	int x, y;
+
+	dx = x2 - x1;
+	dy = y2 - y1;
+
+	/* Swap endpoints to reduce number of cases, as
+	 * vips__draw_line_direct().
+	 */
+	if( (abs( dx ) >= abs( dy ) && dx < 0) ||
+		(abs( dx ) < abs( dy ) && dy < 0) ) {
+		VIPS_SWAP( int, x1, x2 );
+		VIPS_SWAP( int, y1, y2 );
+		dx = x2 - x1;
+		dy = y2 - y1;
+	}
+
+	if( abs( dx ) >= abs( dy ) ) {
+		/* One pixel per column, x = x1 + k and
+		 * y = y1 + sign * floor( k * |dy| / dx ).
+		 */
+		sign = dy < 0 ? -1 : 1;
+		major = dx;
+		minor = abs( dy );
+
+		/* The range of floor( k * minor / major ) in this band.
+		 */
+		if( sign > 0 ) {
+			lo = clip->top - y1;
+			hi = clip_bottom - y1;
+		}
+		else {
+			lo = y1 - clip_bottom;
+			hi = y1 - clip->top;
+		}
+		if( hi < 0 )
+			return;
+
+		if( minor == 0 ) {
+			/* Horizontal, or a single point. lo <= 0, so the
+			 * whole line is in the band.
+			 */
+			if( lo > 0 )
+				return;
+			k_start = 0;
+			k_end = major;
+		}
+		else {
+			k_start = lo <= 0 ? 0 : (lo * major + minor - 1) / minor;
+			k_end = VIPS_MIN( major,
+				((hi + 1) * major - 1) / minor );
+		}
+
+		/* Skip to k_start with the error term.
+		 */
+		err = major > 0 ? (k_start * minor) % major : 0;
+		y = y1 + sign * (major > 0 ? (k_start * minor) / major : 0);
+		for( k = k_start; k <= k_end; k++ ) {
+			x = x1 + k;
+			if( x >= 0 &&
+				x < draw->image->Xsize )
+				vips_draw_batch_pel(
+					VIPS_IMAGE_ADDR( draw->image, x, y ),
+					shape->ink, draw->psize );
+
+			err += minor;
+			if( err >= major ) {
+				err -= major;
+				y += sign;
+			}
+		}
+	}
+	else {
+		/* One pixel per row, y = y1 + k and
+		 * x = x1 + sign * floor( k * |dx| / dy ).
+		 */
+		sign = dx < 0 ? -1 : 1;
+		major = dy;
+		minor = abs( dx );
+
+		k_start = VIPS_MAX( 0, clip->top - y1 );
+		k_end = VIPS_MIN( major, clip_bottom - y1 );
+
+		err = (k_start * minor) % major;
+		x = x1 + sign * ((k_start * minor) / major);
+		for( k = k_start; k <= k_end; k++ ) {
+			y = y1 + k;
+			if( x >= 0 &&
+				x < draw->image->Xsize )
+				vips_draw_batch_pel(
+					VIPS_IMAGE_ADDR( draw->image, x, y ),
+					shape->ink, draw->psize );
+
+			err += minor;
+			if( err >= major ) {
+				err -= major;
+				x += sign;
+			}
+		}
+	}
+}
+
+/* Carry state through vips__draw_circle_direct().
+ */
+typedef struct _VipsDrawBatchCircle {
+	VipsDraw *draw;
+	VipsPel *ink;
+	VipsRect *clip;
+} VipsDrawBatchCircle;
+
+static void
+vips_draw_batch_circle_scanline( VipsImage *image,
+	int y, int x1, int x2, int quadrant, void *client )
+{
+	VipsDrawBatchCircle *circle = (VipsDrawBatchCircle *) client;
+	VipsRect area;
+
+	area.left = x1;
+	area.top = y;
+	area.width = x2 - x1 + 1;
+	area.height = 1;
+	vips_draw_batch_fill( circle->draw, circle->ink, &area, circle->clip );
+}
+
+static void
+vips_draw_batch_circle_endpoints( VipsImage *image,
+	int y, int x1, int x2, int quadrant, void *client )
+{
+	VipsDrawBatchCircle *circle = (VipsDrawBatchCircle *) client;
+	VipsDraw *draw = circle->draw;
+	VipsRect *clip = circle->clip;
+
+	if( y >= clip->top &&
+		y < VIPS_RECT_BOTTOM( clip ) ) {
+		if( x1 >= 0 &&
+			x1 < image->Xsize )
+			vips_draw_batch_pel( VIPS_IMAGE_ADDR( image, x1, y ),
+				circle->ink, draw->psize );
+		if( x2 >= 0 &&
+			x2 < image->Xsize )
+			vips_draw_batch_pel( VIPS_IMAGE_ADDR( image, x2, y ),
+				circle->ink, draw->psize );
+	}
+}
+
+static void
+vips_draw_batch_circle( VipsDraw *draw, VipsDrawBatchShape *shape,
+	VipsRect *clip )
+{
+	VipsDrawBatchCircle circle;
+
+	circle.draw = draw;
+	circle.ink = shape->ink;
+	circle.clip = clip;
+
+	vips__draw_circle_direct( draw->image, shape->a, shape->b, shape->c,
+		shape->fill ?
+			vips_draw_batch_circle_scanline :
+			vips_draw_batch_circle_endpoints,
+		&circle );
+}
+
+/* Unpack the shapes matrix, make the inks, and find the scanlines each shape
+ * touches.
+ */
+static int
+vips_draw_batch_unpack( VipsDrawBatch *batch, VipsImage *matrix )
+{
+	VipsObjectClass *class = VIPS_OBJECT_GET_CLASS( batch );
+	VipsDraw *draw = VIPS_DRAW( batch );
+	VipsImage *image = draw->image;
+	int n_ink = matrix->Xsize - VIPS_DRAW_BATCH_COLUMNS;
+
+	VipsImage **mask;
+	int n_masks;
+	int bands;
+	VipsBandFormat format;
+	int i;
+
+	mask = batch->masks ?
+		vips_array_image_get( batch->masks, &n_masks ) : NULL;
+	if( !mask )
+		n_masks = 0;
+	vips_image_decode_predict( image, &bands, &format );
+
+	batch->n_shapes = matrix->Ysize;
+	if( !(batch->shape = VIPS_ARRAY( NULL,
+		batch->n_shapes, VipsDrawBatchShape )) )
+		return( -1 );
+	memset( batch->shape, 0,
+		batch->n_shapes * sizeof( VipsDrawBatchShape ) );
+
+	for( i = 0; i < batch->n_shapes; i++ ) {
+		double *row = VIPS_MATRIX( matrix, 0, i );
+		VipsDrawBatchShape *shape = &batch->shape[i];
+
+		shape->type = row[0];
+		shape->a = row[1];
+		shape->b = row[2];
+		shape->c = row[3];
+		shape->d = row[4];
+		shape->fill = row[5] != 0.0;
+
+		/* Shapes usually come in runs of the same colour, so share
+		 * ink with the previous shape if we can.
+		 */
+		if( i > 0 &&
+			memcmp( row + VIPS_DRAW_BATCH_COLUMNS,
+				VIPS_MATRIX( matrix, 0, i - 1 ) +
+					VIPS_DRAW_BATCH_COLUMNS,
+				n_ink * sizeof( double ) ) == 0 )
+			shape->ink = batch->shape[i - 1].ink;
+		else if( !(shape->ink = vips__vector_to_pels( class->nickname,
+			bands, format, image->Coding,
+			row + VIPS_DRAW_BATCH_COLUMNS, NULL, n_ink )) )
+			return( -1 );
+
+		switch( shape->type ) {
+		case VIPS_DRAW_SHAPE_LINE:
+			shape->top = VIPS_MIN( shape->b, shape->d );
+			shape->bottom = VIPS_MAX( shape->b, shape->d );
+			break;
+
+		case VIPS_DRAW_SHAPE_RECT:
+			shape->top = shape->b;
+			shape->bottom = shape->b + shape->d - 1;
+			break;
+
+		case VIPS_DRAW_SHAPE_CIRCLE:
+			if( shape->c < 0 ) {
+				vips_error( class->nickname,
+					_( "shape %d has negative radius" ),
+					i );
+				return( -1 );
+			}
+			shape->top = shape->b - shape->c;
+			shape->bottom = shape->b + shape->c;
+			break;
+
+		case VIPS_DRAW_SHAPE_MASK:
+			if( shape->a < 0 ||
+				shape->a >= n_masks ) {
+				vips_error( class->nickname,
+					_( "shape %d has no mask" ), i );
+				return( -1 );
+			}
+			shape->top = shape->c;
+			shape->bottom = shape->c + mask[shape->a]->Ysize - 1;
+			break;
+
+		default:
+			vips_error( class->nickname,
+				_( "shape %d has unknown type" ), i );
+			return( -1 );
+		}
+
+		shape->top = VIPS_MAX( 0, shape->top );
+		shape->bottom = VIPS_MIN( image->Ysize - 1, shape->bottom );
+	}
+
+	return( 0 );
+}
+
+/* Sort shapes into bands. Shapes stay in their original order within each
+ * band, so overlaps paint as they would one at a time.
+ */
+static int
+vips_draw_batch_sort( VipsDrawBatch *batch )
+{
+	VipsDraw *draw = VIPS_DRAW( batch );
+	int n_bands;
+	int *fill;
+	int i, j;
+
+	n_bands = VIPS_ROUND_UP( draw->image->Ysize, VIPS_DRAW_BATCH_BAND ) /
+		VIPS_DRAW_BATCH_BAND;
+	batch->n_bands = n_bands;
+	if( !(batch->band_start = VIPS_ARRAY( NULL, n_bands + 1, int )) )
+		return( -1 );
+	memset( batch->band_start, 0, (n_bands + 1) * sizeof( int ) );
+
+	for( i = 0; i < batch->n_shapes; i++ ) {
+		VipsDrawBatchShape *shape = &batch->shape[i];
+
+		if( shape->top <= shape->bottom )
+			for( j = shape->top / VIPS_DRAW_BATCH_BAND;
+				j <= shape->bottom / VIPS_DRAW_BATCH_BAND; j++ )
+				batch->band_start[j + 1] += 1;
+	}
+	for( j = 0; j < n_bands; j++ )
+		batch->band_start[j + 1] += batch->band_start[j];
+
+	if( !(batch->band_shape = VIPS_ARRAY( NULL,
+		VIPS_MAX( 1, batch->band_start[n_bands] ), int )) ||
+		!(fill = VIPS_ARRAY( NULL, n_bands, int )) )
+		return( -1 );
+	memcpy( fill, batch->band_start, n_bands * sizeof( int ) );
+
+	for( i = 0; i < batch->n_shapes; i++ ) {
+		VipsDrawBatchShape *shape = &batch->shape[i];
+
+		if( shape->top <= shape->bottom )
+			for( j = shape->top / VIPS_DRAW_BATCH_BAND;
+				j <= shape->bottom / VIPS_DRAW_BATCH_BAND; j++ )
+				batch->band_shape[fill[j]++] = i;
+	}
+
+	g_free( fill );
+
+	return( 0 );
+}
+
+static int
+vips_draw_batch_build( VipsObject *object )
+{
+	VipsObjectClass *class = VIPS_OBJECT_GET_CLASS( object );
+	VipsDraw *draw = VIPS_DRAW( object );
+	VipsDrawBatch *batch = (VipsDrawBatch *) object;
+	VipsImage **t = (VipsImage **) vips_object_local_array( object, 1 );
+
+	VipsImage **mask;
+	int n_masks;
+	int i, j;
+
+	if( VIPS_OBJECT_CLASS( vips_draw_batch_parent_class )->build( object ) )
+		return( -1 );
+
+	if( vips_check_matrix( class->nickname, batch->shapes, &t[0] ) )
+		return( -1 );
+	if( t[0]->Xsize <= VIPS_DRAW_BATCH_COLUMNS ) {
+		vips_error( class->nickname,
+			"%s", _( "shapes matrix has no ink" ) );
+		return( -1 );
+	}
+
+	/* Check masks once, rather than for every shape.
+	 */
+	if( batch->masks &&
+		(mask = vips_array_image_get( batch->masks, &n_masks )) ) {
+		if( n_masks > 0 &&
+			vips_check_coding_noneorlabq( class->nickname,
+				draw->image ) )
+			return( -1 );
+
+		for( i = 0; i < n_masks; i++ )
+			if( vips_image_wio_input( mask[i] ) ||
+				vips_check_mono( class->nickname, mask[i] ) ||
+				vips_check_uncoded( class->nickname, mask[i] ) ||
+				vips_check_format( class->nickname,
+					mask[i], VIPS_FORMAT_UCHAR ) )
+				return( -1 );
+	}
+	else
+		mask = NULL;
+
+	if( vips_draw_batch_unpack( batch, t[0] ) ||
+		vips_draw_batch_sort( batch ) )
+		return( -1 );
+
+	for( j = 0; j < batch->n_bands; j++ ) {
+		VipsRect clip;
+
+		clip.left = 0;
+		clip.top = j * VIPS_DRAW_BATCH_BAND;
+		clip.width = draw->image->Xsize;
+		clip.height = VIPS_MIN( VIPS_DRAW_BATCH_BAND,
+			draw->image->Ysize - clip.top );
+
+		for( i = batch->band_start[j];
+			i < batch->band_start[j + 1]; i++ ) {
+			VipsDrawBatchShape *shape =
+				&batch->shape[batch->band_shape[i]];
+
+			switch( shape->type ) {
+			case VIPS_DRAW_SHAPE_LINE:
+				vips_draw_batch_line( draw, shape, &clip );
+				break;
+
+			case VIPS_DRAW_SHAPE_RECT:
+				vips_draw_batch_rect( draw, shape, &clip );
+				break;
+
+			case VIPS_DRAW_SHAPE_CIRCLE:
+				vips_draw_batch_circle( draw, shape, &clip );
+				break;
+
+			case VIPS_DRAW_SHAPE_MASK:
+				if( vips__draw_mask_clip( draw->image,
+					mask[shape->a], shape->ink,
+					shape->b, shape->c, &clip ) )
+					return( -1 );
+				break;
+
+			default:
+				g_assert_not_reached();
+			}
+		}
+	}
+
+	return( 0 );
+}
+
+static void
+vips_draw_batch_class_init( VipsDrawBatchClass *class )
+{
+	GObjectClass *gobject_class = G_OBJECT_CLASS( class );
+	VipsObjectClass *vobject_class = VIPS_OBJECT_CLASS( class );
+
+	gobject_class->dispose = vips_draw_batch_dispose;
+	gobject_class->set_property = vips_object_set_property;
+	gobject_class->get_property = vips_object_get_property;
+
+	vobject_class->nickname = "draw_batch";
+	vobject_class->description = _( "draw many shapes on an image" );
+	vobject_class->build = vips_draw_batch_build;
+
+	VIPS_ARG_IMAGE( class, "shapes", 5,
+		_( "Shapes" ),
+		_( "Matrix of shapes, one per row" ),
+		VIPS_ARGUMENT_REQUIRED_INPUT,
+		G_STRUCT_OFFSET( VipsDrawBatch, shapes ) );
+
+	VIPS_ARG_BOXED( class, "masks", 6,
+		_( "Masks" ),
+		_( "Masks for mask shapes" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsDrawBatch, masks ),
+		VIPS_TYPE_ARRAY_IMAGE );
+
+}
+
+static void
+vips_draw_batch_init( VipsDrawBatch *batch )
+{
+}
+
+/**
+ * VipsDrawShape:
+ * @VIPS_DRAW_SHAPE_LINE: a line
+ * @VIPS_DRAW_SHAPE_RECT: a rectangle
+ * @VIPS_DRAW_SHAPE_CIRCLE: a circle
+ * @VIPS_DRAW_SHAPE_MASK: a mask
+ *
+ * The kinds of shape vips_draw_batch() can draw.
+ *
+ * See also: vips_draw_batch().
+ */
+
+/**
+ * vips_draw_batch: (method)
+ * @image: image to draw on
+ * @shapes: matrix of shapes to draw
+ * @...: %NULL-terminated list of optional named arguments
+ *
+ * Optional arguments:
+ *
+ * * @masks: #VipsArrayImage, masks for #VIPS_DRAW_SHAPE_MASK shapes
+ *
+ * Draw many shapes on @image in one operation. This is much quicker than
+ * calling vips_draw_line(), vips_draw_rect(), vips_draw_circle() and
+ * vips_draw_mask() for each shape, since the image is only checked once, and
+ * the image is painted a band of scanlines at a time.
+ *
+ * @shapes is a matrix with one row per shape. The columns are a
+ * #VipsDrawShape, four parameters, a fill flag, and then the ink, as for
+ * vips_draw_rect():
+ *
+ * * #VIPS_DRAW_SHAPE_LINE: x1, y1, x2, y2, as vips_draw_line()
+ * * #VIPS_DRAW_SHAPE_RECT: left, top, width, height, fill, as
+ *   vips_draw_rect(). Use a 1 x 1 rect to draw a point.
+ * * #VIPS_DRAW_SHAPE_CIRCLE: cx, cy, radius, unused, fill, as
+ *   vips_draw_circle()
+ * * #VIPS_DRAW_SHAPE_MASK: index of the mask in @masks, x, y, as
+ *   vips_draw_mask()
+ *
+ * Shapes are drawn in order, so later shapes paint over earlier ones.
+ *
+ * See also: vips_draw_rect(), vips_draw_line(), vips_draw_circle().
+ *
+ * Returns: 0 on success, or -1 on error.
+ */
+int
+vips_draw_batch( VipsImage *image, VipsImage *shapes, ... )
+{
+	va_list ap;
+	int result;
+
+	va_start( ap, shapes );
+	result = vips_call_split( "draw_batch", ap, image, shapes );
+	va_end( ap );
+
+	return( result );
+}
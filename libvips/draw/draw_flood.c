@@ -30,6 +30,9 @@
  * 	- use Draw base class
  * 21/1/14
  * 	- redo as a class
+ * 14/10/18
+ * 	- search for span ends with SIMD kernels
+ * 	- track painted pixels in a bitmap when test and image differ
  */
 
 /*
@@ -69,6 +72,7 @@
 #include <string.h>
 
 #include <vips/vips.h>
+#include <vips/simd.h>
 #include <vips/internal.h>
 
 #include "drawink.h"
@@ -139,6 +143,18 @@ typedef struct _Flood {
 	 */
 	int lsize;
 
+	/* Find runs of connected or unconnected pels in @test, or NULL for
+	 * no kernel.
+	 */
+	VipsSimdSpanFn span;
+	VipsSimdSpanFn span_back;
+
+	/* When @test and @image are different, we can't use @test to see
+	 * which pixels we've painted. Keep a bitmap instead, one bit per
+	 * pixel, with each row allocated the first time we paint it.
+	 */
+	guint8 **visited;
+
 	/* Record bounding box of modified pixels.
 	 */
 	int left;
@@ -232,18 +248,84 @@ flood_connected( Flood *flood, VipsPel *p )
 	return( flood->equal ^ (j < flood->tsize) );
 }
 
-/* Is p painted? p is a pel in @image. 
+/* Count pels in @test from x, y going right which are connected (or not
+ * connected), looking at no more than n.
  */
-static gboolean
-flood_painted( Flood *flood, VipsPel *p )
+static int
+flood_span( Flood *flood, int x, int y, int n, gboolean connected )
 {
- 	int j;
+	VipsPel *p = VIPS_IMAGE_ADDR( flood->test, x, y );
 
-	for( j = 0; j < flood->psize; j++ ) 
-		if( p[j] != flood->ink[j] ) 
+	int i;
+
+	if( flood->span )
+		return( flood->span( p, n, flood->edge,
+			connected ? flood->equal : !flood->equal ) );
+
+	for( i = 0; i < n; i++ ) {
+		if( flood_connected( flood, p ) != connected )
 			break;
+		p += flood->tsize;
+	}
 
-	return( j == flood->psize );
+	return( i );
+}
+
+/* As flood_span(), but going left.
+ */
+static int
+flood_span_back( Flood *flood, int x, int y, int n, gboolean connected )
+{
+	VipsPel *p = VIPS_IMAGE_ADDR( flood->test, x, y );
+
+	int i;
+
+	if( flood->span_back )
+		return( flood->span_back( p, n, flood->edge,
+			connected ? flood->equal : !flood->equal ) );
+
+	for( i = 0; i < n; i++ ) {
+		if( flood_connected( flood, p ) != connected )
+			break;
+		p -= flood->tsize;
+	}
+
+	return( i );
+}
+
+/* Have we painted x, y? Only for separate @test and @image.
+ */
+static gboolean
+flood_visited( Flood *flood, int x, int y )
+{
+	guint8 *row = flood->visited[y];
+
+	return( row &&
+		(row[x >> 3] & (1 << (x & 7))) );
+}
+
+/* Mark x1 to x2 inclusive on line y as painted.
+ */
+static void
+flood_visit( Flood *flood, int y, int x1, int x2 )
+{
+	guint8 *row;
+	int x;
+
+	if( !(row = flood->visited[y]) )
+		row = flood->visited[y] =
+			g_malloc0( VIPS_ROUND_UP( flood->test->Xsize, 8 ) / 8 );
+
+	for( x = x1; x <= x2 && (x & 7); x++ )
+		row[x >> 3] |= 1 << (x & 7);
+	if( x2 - x + 1 >= 8 ) {
+		int n = (x2 - x + 1) / 8;
+
+		memset( row + (x >> 3), 0xff, n );
+		x += n * 8;
+	}
+	for( ; x <= x2; x++ )
+		row[x >> 3] |= 1 << (x & 7);
 }
 
 static void
@@ -297,39 +379,26 @@ flood_scanline( Flood *flood, int x, int y, int *x1, int *x2 )
 {
 	const int width = flood->test->Xsize;
 
-	VipsPel *p;
-	int i;
-
 	g_assert( flood_connected( flood, 
 		VIPS_IMAGE_ADDR( flood->test, x, y ) ) );
-	g_assert( !flood_painted( flood, 
-		VIPS_IMAGE_ADDR( flood->image, x, y ) ) );
+	g_assert( !flood->visited ||
+		!flood_visited( flood, x, y ) );
 
 	/* Search to the right for the first non-connected pixel. If the start
 	 * pixel is unpainted, we know all the intervening pixels must be
 	 * unpainted too.
 	 */
-	p = VIPS_IMAGE_ADDR( flood->test, x + 1, y );
-	for( i = x + 1; i < width; i++ ) {
-		if( !flood_connected( flood, p ) )
-			break;
-		p += flood->tsize;
-	}
-	*x2 = i - 1;
+	*x2 = x + flood_span( flood, x + 1, y, width - x - 1, TRUE );
 
 	/* Search left.
 	 */
-	p = VIPS_IMAGE_ADDR( flood->test, x - 1, y );
-	for( i = x - 1; i >= 0; i-- ) {
-		if( !flood_connected( flood, p ) )
-			break;
-		p -= flood->tsize;
-	}
-	*x1 = i + 1;
+	*x1 = x - flood_span_back( flood, x - 1, y, x, TRUE );
 
 	/* Paint the range we discovered.
 	 */
 	flood_draw_scanline( flood, y, *x1, *x2 );
+	if( flood->visited )
+		flood_visit( flood, y, *x1, *x2 );
 
 	flood->left = VIPS_MIN( flood->left, *x1 );
 	flood->right = VIPS_MAX( flood->right, *x2 );
@@ -343,17 +412,17 @@ flood_scanline( Flood *flood, int x, int y, int *x1, int *x2 )
 static void
 flood_around( Flood *flood, Scan *scan )
 {
-	VipsPel *p;
 	int x;
 
 	g_assert( scan->dir == 1 || 
 		scan->dir == -1 );
 
-	for( p = VIPS_IMAGE_ADDR( flood->test, scan->x1, scan->y ), 
-		x = scan->x1; 
-		x <= scan->x2; 
-		p += flood->tsize, x++ ) {
-		if( flood_connected( flood, p ) ) {
+	for( x = scan->x1; x <= scan->x2; x++ ) {
+		/* Skip unconnected pixels in one go.
+		 */
+		x += flood_span( flood, x, scan->y, scan->x2 - x + 1, FALSE );
+
+		if( x <= scan->x2 ) {
 			int x1a;
 			int x2a;
 
@@ -361,13 +430,9 @@ flood_around( Flood *flood, Scan *scan )
 			 * to check for painted. Otherwise we can get stuck in
 			 * connected loops.
 			 */
-			if( flood->image != flood->test ) {
-				VipsPel *mp = VIPS_IMAGE_ADDR( 
-					flood->image, x, scan->y );
-
-				if( flood_painted( flood, mp ) )
-					continue;
-			}
+			if( flood->visited &&
+				flood_visited( flood, x, scan->y ) )
+				continue;
 
 			flood_scanline( flood, x, scan->y, &x1a, &x2a );
 
@@ -388,7 +453,6 @@ flood_around( Flood *flood, Scan *scan )
 				scan->dir );
 
 			x = x2a + 1;
-			p = VIPS_IMAGE_ADDR( flood->test, x, scan->y );
 		}
 	}
 }
@@ -396,6 +460,8 @@ flood_around( Flood *flood, Scan *scan )
 static void
 flood_all( Flood *flood, int x, int y )
 {
+	VipsBandFormat format = vips__pel_format( flood->tsize );
+
 	int x1, x2;
 
 	/* Test start pixel ... nothing to do?
@@ -403,6 +469,24 @@ flood_all( Flood *flood, int x, int y )
 	if( !flood_connected( flood, VIPS_IMAGE_ADDR( flood->test, x, y ) ) ) 
 		return;
 
+	/* We compare whole pels, so we can use the SIMD kernels for any
+	 * pel size they support.
+	 */
+	if( format != VIPS_FORMAT_NOTSET ) {
+		flood->span = (VipsSimdSpanFn)
+			vips_simd_get( VIPS_SIMD_SPAN, format );
+		flood->span_back = (VipsSimdSpanFn)
+			vips_simd_get( VIPS_SIMD_SPAN_BACK, format );
+	}
+	else {
+		flood->span = NULL;
+		flood->span_back = NULL;
+	}
+
+	flood->visited = NULL;
+	if( flood->image != flood->test )
+		flood->visited = g_new0( guint8 *, flood->test->Ysize );
+
 	flood->in = buffer_build();
 	flood->out = buffer_build();
 
@@ -427,6 +511,14 @@ flood_all( Flood *flood, int x, int y )
 
 	VIPS_FREEF( buffer_free, flood->in );
 	VIPS_FREEF( buffer_free, flood->out );
+
+	if( flood->visited ) {
+		int j;
+
+		for( j = 0; j < flood->test->Ysize; j++ )
+			g_free( flood->visited[j] );
+		VIPS_FREE( flood->visited );
+	}
 }
 
 /* Base class.
@@ -704,7 +796,9 @@ vips_draw_floodv( VipsImage *image,
  *
  * Normally it will test and set pixels in @image. If @test is set, it will 
  * test pixels in @test and set pixels in @image. This lets you search an
- * image (@test) for continuous areas of pixels without modifying it. 
+ * image (@test) for continuous areas of pixels without modifying it. Only
+ * @test is used to find the edges of the area, pixels in @image which are
+ * already @ink do not stop the fill.
  *
  * @left, @top, @width, @height output the bounding box of the modified
  * pixels. 
@@ -20,6 +20,8 @@
  * 7/2/14
  * 	- redo as a class
  * 	- now it's VipsDrawMask
+ * 14/10/18
+ * 	- add vips__draw_mask_clip()
  */
 
 /*
@@ -236,11 +238,6 @@ int
 vips__draw_mask_direct( VipsImage *image, VipsImage *mask, 
 	VipsPel *ink, int x, int y )
 {
-	VipsRect image_rect;
-	VipsRect area_rect;
-	VipsRect image_clip;
-	VipsRect mask_clip;
-
 	if( vips_check_coding_noneorlabq( "draw_mask_direct", image ) ||
 		vips_image_inplace( image ) ||
 		vips_image_wio_input( mask ) ||
@@ -250,6 +247,22 @@ vips__draw_mask_direct( VipsImage *image, VipsImage *mask,
 			mask, VIPS_FORMAT_UCHAR ) )
 		return( -1 );
 
+	return( vips__draw_mask_clip( image, mask, ink, x, y, NULL ) );
+}
+
+/* Draw, only touching pixels inside @clip, or the whole image for NULL.
+ * image and mask must have been checked by the caller, see
+ * vips__draw_mask_direct().
+ */
+int
+vips__draw_mask_clip( VipsImage *image, VipsImage *mask,
+	VipsPel *ink, int x, int y, VipsRect *clip )
+{
+	VipsRect image_rect;
+	VipsRect area_rect;
+	VipsRect image_clip;
+	VipsRect mask_clip;
+
 	/* Find the area we draw on the image.
 	 */
 	area_rect.left = x;
@@ -260,6 +273,8 @@ vips__draw_mask_direct( VipsImage *image, VipsImage *mask,
 	image_rect.top = 0;
 	image_rect.width = image->Xsize;
 	image_rect.height = image->Ysize;
+	if( clip )
+		vips_rect_intersectrect( &image_rect, clip, &image_rect );
 	vips_rect_intersectrect( &area_rect, &image_rect, &image_clip );
 
 	/* And the area of the mask image we use.
@@ -32,6 +32,11 @@
  * 	  linebreaks
  * 12/8/16
  * 	- allow missing offset and scale in matrix header
+ * 14/10/18
+ * 	- csv read maps the file, indexes lines and parses strips in
+ * 	  parallel
+ * 	- parse numbers with a fast path for short decimals
+ * 	- csv write prints floats with enough digits to read back exactly
  */
 
 /*
@@ -72,8 +77,15 @@
 #include <string.h>
 #include <stdlib.h>
 #include <math.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif /*HAVE_UNISTD_H*/
+#ifdef HAVE_IO_H
+#include <io.h>
+#endif /*HAVE_IO_H*/
 
 #include <vips/vips.h>
+#include <vips/internal.h>
 
 #include "pforeign.h"
 
@@ -118,48 +130,211 @@ skip_white( FILE *fp, const char whitemap[256] )
 	return( ch );
 }
 
-static int 
-skip_to_quote( FILE *fp )
+/* Number of lines between entries in the line index.
+ */
+#define CSV_INDEX_STEP (64)
+
+/* A CSV file mapped into memory, plus an index of line starts. The index
+ * lets us parse any strip of lines, so many threads can parse at once.
+ */
+typedef struct _Csv {
+	char *filename;
+	int skip;
+	int lines;
+	gboolean fail;
+	char whitemap[256];
+	char sepmap[256];
+
+	/* The mapped file.
+	 */
+	const char *base;
+	size_t length;
+	const char *end;
+
+	/* The first line after skip.
+	 */
+	const char *first;
+
+	/* Number of columns on the first line.
+	 */
+	int columns;
+
+	/* The number of lines from first to EOF, and the offset of every
+	 * CSV_INDEX_STEP'th line.
+	 */
+	int n_lines;
+	gint64 *index;
+} Csv;
+
+static void
+csv_free( Csv *csv )
 {
-        int ch;
+	if( csv->base ) {
+		vips__munmap( csv->base, csv->length );
+		csv->base = NULL;
+	}
+	VIPS_FREE( csv->index );
+	VIPS_FREE( csv->filename );
+	g_free( csv );
+}
 
-	do {
-		ch = vips__fgetc( fp );
+static void
+csv_close_cb( VipsImage *image, Csv *csv )
+{
+	csv_free( csv );
+}
 
-		/* Ignore \" in strings.
-		 */
-		if( ch == '\\' ) 
-			ch = vips__fgetc( fp );
-		else if( ch == '"' )
-			break;
-	} while( ch != EOF && 
-		ch != '\n' );
+/* Find the next line. Files can end with EOF or with \nEOF.
+ */
+static const char *
+csv_next_line( Csv *csv, const char *p )
+{
+	const char *q;
 
-	ungetc( ch, fp );
+	if( (q = memchr( p, '\n', csv->end - p )) )
+		return( q + 1 );
+	else
+		return( csv->end );
+}
 
-	return( ch );
+/* The end of the text on this line. We allow DOS \r\n line endings.
+ */
+static const char *
+csv_line_end( Csv *csv, const char *p )
+{
+	const char *q;
+
+	if( !(q = memchr( p, '\n', csv->end - p )) )
+		q = csv->end;
+	if( q > p &&
+		q[-1] == '\r' )
+		q -= 1;
+
+	return( q );
 }
 
-static int 
-skip_to_sep( FILE *fp, const char sepmap[256] )
+/* Parse a double in the C locale from [p, end), returning a pointer to the
+ * first char we didn't use, or NULL if there's no number there.
+ *
+ * Decimals with up to 15 significant digits and a small exponent convert
+ * exactly with a single multiply or divide (Clinger's fast path). Everything
+ * else (long mantissas, big exponents, inf, nan, hex floats) goes to
+ * g_ascii_strtod().
+ */
+static const char *
+csv_parse_double( const char *p, const char *end, double *out )
 {
-        int ch;
+	static const double powers[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+		1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20,
+		1e21, 1e22
+	};
+
+	const char *start = p;
+
+	gboolean negative;
+	guint64 mantissa;
+	int n_digits;
+	int n_significant;
+	int exponent;
+	char buf[256];
+	char *tail;
+	int i;
 
-	do {
-		ch = vips__fgetc( fp );
-	} while( ch != EOF && 
-		ch != '\n' && 
-		!sepmap[ch] );
+	negative = FALSE;
+	if( p < end &&
+		(*p == '-' || *p == '+') ) {
+		negative = *p == '-';
+		p += 1;
+	}
 
-	ungetc( ch, fp );
+	mantissa = 0;
+	n_digits = 0;
+	n_significant = 0;
+	exponent = 0;
+	for( ; p < end && g_ascii_isdigit( *p ); p++ ) {
+		mantissa = mantissa * 10 + (*p - '0');
+		n_digits += 1;
+		if( mantissa )
+			n_significant += 1;
+	}
+	if( p < end &&
+		*p == '.' ) {
+		for( p++; p < end && g_ascii_isdigit( *p ); p++ ) {
+			mantissa = mantissa * 10 + (*p - '0');
+			n_digits += 1;
+			if( mantissa )
+				n_significant += 1;
+			exponent -= 1;
+		}
+	}
 
-	return( ch );
+	/* An exponent needs at least one digit, otherwise the 'e' is not
+	 * part of the number.
+	 */
+	if( n_digits > 0 &&
+		p + 1 < end &&
+		(*p == 'e' || *p == 'E') ) {
+		const char *q = p + 1;
+		gboolean exponent_negative = FALSE;
+		int e;
+
+		if( q < end &&
+			(*q == '-' || *q == '+') ) {
+			exponent_negative = *q == '-';
+			q += 1;
+		}
+
+		if( q < end &&
+			g_ascii_isdigit( *q ) ) {
+			for( e = 0; q < end && g_ascii_isdigit( *q ); q++ )
+				if( e < 100000 )
+					e = e * 10 + (*q - '0');
+			exponent += exponent_negative ? -e : e;
+			p = q;
+		}
+	}
+
+	if( n_digits > 0 &&
+		n_significant <= 15 &&
+		exponent >= -22 &&
+		exponent <= 22 &&
+		(p == end ||
+		 (!g_ascii_isalpha( *p ) && *p != '.')) ) {
+		double d;
+
+		d = mantissa;
+		if( exponent < 0 )
+			d /= powers[-exponent];
+		else
+			d *= powers[exponent];
+		*out = negative ? -d : d;
+
+		return( p );
+	}
+
+	/* Slow path: copy out the whole token and use the C library.
+	 */
+	for( i = 0; i < 255 && start + i < end; i++ ) {
+		if( start[i] == '\n' )
+			break;
+		buf[i] = start[i];
+	}
+	buf[i] = '\0';
+
+	*out = g_ascii_strtod( buf, &tail );
+	if( tail == buf ) {
+		*out = 0.0;
+		return( NULL );
+	}
+
+	return( start + (tail - buf) );
 }
 
-/* Read a single item. Syntax is:
+/* Read a single item from a line ending at lend. Syntax is:
  *
  * element : 
- * 	whitespace* item whitespace* [EOF|EOL|separator]
+ * 	whitespace* item whitespace* [EOL|separator]
  *
  * item : 
  * 	double |
@@ -168,156 +343,262 @@ skip_to_sep( FILE *fp, const char sepmap[256] )
  *
  * the anything in quotes can contain " escaped with \
  *
- * Return the char that caused failure on fail (EOF or \n).
+ * Return '\n' for end of line, -1 for a parse error with fail set, and 0 for
+ * an item read successfully.
  */
 static int
-read_double( FILE *fp, const char whitemap[256], const char sepmap[256],
-	int lineno, int colno, double *out, gboolean fail )
+csv_read_double( Csv *csv, const char **pp, const char *lend,
+	int lineno, int colno, double *out )
 {
-	int ch;
+	const char *p = *pp;
 
-	/* The fscanf() may change this ... but all other cases need a zero.
-	 */
 	*out = 0;
 
-	ch = skip_white( fp, whitemap );
-	if( ch == EOF || 
-		ch == '\n' ) 
-		return( ch );
+	while( p < lend &&
+		csv->whitemap[(unsigned char) *p] )
+		p += 1;
+	if( p >= lend ) {
+		*pp = p;
+		return( '\n' );
+	}
 
-	if( ch == '"' ) {
-		(void) vips__fgetc( fp );
-		(void) skip_to_quote( fp );
-		(void) vips__fgetc( fp );
+	if( *p == '"' ) {
+		for( p++; p < lend && *p != '"'; p++ )
+			/* Ignore \" in strings.
+			 */
+			if( *p == '\\' &&
+				p + 1 < lend )
+				p += 1;
+		if( p < lend )
+			p += 1;
 	}
-	else if( !sepmap[ch] && 
-		fscanf( fp, "%lf", out ) != 1 ) {
-		/* Only a warning, since (for example) exported spreadsheets
-		 * will often have text or date fields.
-		 */
-		g_warning( _( "error parsing number, line %d, column %d" ),
-			lineno, colno );
-		if( fail )
-			return( EOF ); 
+	else if( !csv->sepmap[(unsigned char) *p] ) {
+		const char *q;
 
-		/* Step over the bad data to the next separator.
+		/* Like fscanf(), skip any leading space.
 		 */
-		(void) skip_to_sep( fp, sepmap );
+		while( p < lend &&
+			g_ascii_isspace( *p ) &&
+			!csv->sepmap[(unsigned char) *p] )
+			p += 1;
+
+		if( !(q = csv_parse_double( p, lend, out )) ) {
+			/* Only a warning, since (for example) exported
+			 * spreadsheets will often have text or date fields.
+			 */
+			g_warning( _( "error parsing number, "
+				"line %d, column %d" ), lineno, colno );
+			if( csv->fail ) {
+				vips_error( "csv2vips",
+					_( "error parsing number, "
+						"line %d, column %d" ),
+					lineno, colno );
+				return( -1 );
+			}
+
+			/* Step over the bad data to the next separator.
+			 */
+			while( p < lend &&
+				!csv->sepmap[(unsigned char) *p] )
+				p += 1;
+		}
+		else
+			p = q;
 	}
 
-	/* Don't need to check result, we have read a field successfully.
-	 */
-	ch = skip_white( fp, whitemap );
+	while( p < lend &&
+		csv->whitemap[(unsigned char) *p] )
+		p += 1;
 
 	/* If it's a separator, we have to step over it. 
 	 */
-	if( ch != EOF && 
-		sepmap[ch] ) 
-		(void) vips__fgetc( fp );
+	if( p < lend &&
+		csv->sepmap[(unsigned char) *p] )
+		p += 1;
+
+	*pp = p;
 
 	return( 0 );
 }
 
-static int
-read_csv( FILE *fp, VipsImage *out, 
-	int skip, 
-	int lines,
-	const char *whitespace, const char *separator,
-	gboolean read_image,
-	gboolean fail )
+/* Map the file, skip the start, size the first line, and optionally build
+ * the line index.
+ */
+static Csv *
+csv_new( const char *filename,
+	int skip, int lines, const char *whitespace, const char *separator,
+	gboolean fail, gboolean build_index )
 {
-	int i;
-	char whitemap[256];
-	char sepmap[256];
+	Csv *csv;
 	const char *p;
-	fpos_t pos;
-	int columns;
-	int ch;
+	const char *lend;
+	int fd;
+	gint64 length;
+	int i;
 	double d;
-	double *buf;
-	int y;
+	int ch;
+
+	csv = g_new0( Csv, 1 );
+	csv->filename = vips_strdup( NULL, filename );
+	csv->skip = skip;
+	csv->lines = lines;
+	csv->fail = fail;
 
 	/* Make our char maps. 
 	 */
-	for( i = 0; i < 256; i++ ) {
-		whitemap[i] = 0;
-		sepmap[i] = 0;
-	}
 	for( p = whitespace; *p; p++ )
-		whitemap[(int) *p] = 1;
+		csv->whitemap[(unsigned char) *p] = 1;
 	for( p = separator; *p; p++ )
-		sepmap[(int) *p] = 1;
+		csv->sepmap[(unsigned char) *p] = 1;
+
+	if( (fd = vips__open_read( filename )) == -1 ) {
+		vips_error_system( errno, "csv2vips",
+			_( "unable to open \"%s\"" ), filename );
+		csv_free( csv );
+		return( NULL );
+	}
+	if( (length = vips_file_length( fd )) == -1 ) {
+		close( fd );
+		csv_free( csv );
+		return( NULL );
+	}
+	if( length == 0 ) {
+		close( fd );
+		csv_free( csv );
+		vips_error( "csv2vips", "%s", _( "empty line" ) );
+		return( NULL );
+	}
+	if( !(csv->base = vips__mmap( fd, 0, length, 0 )) ) {
+		close( fd );
+		csv_free( csv );
+		return( NULL );
+	}
+	close( fd );
+	csv->length = length;
+	csv->end = csv->base + length;
 
 	/* Skip first few lines.
 	 */
-	for( i = 0; i < skip; i++ )
-		if( !skip_line( fp ) ) {
+	p = csv->base;
+	for( i = 0; i < skip; i++ ) {
+		if( p >= csv->end ) {
 			vips_error( "csv2vips", 
 				"%s", _( "end of file while skipping start" ) );
-			return( -1 );
+			csv_free( csv );
+			return( NULL );
 		}
+		p = csv_next_line( csv, p );
+	}
+	csv->first = p;
 
-	/* Parse the first line to get number of columns. Only bother checking
-	 * fgetpos() the first time we use it: assume it's working after this.
+	/* Parse the first line to get number of columns.
 	 */
-	if( fgetpos( fp, &pos ) ) {
-		vips_error_system( errno, "csv2vips", 
-			"%s", _( "unable to seek" ) );
-		return( -1 );
-	}
-	for( columns = 0; 
-		(ch = read_double( fp, whitemap, sepmap, 
-			skip + 1, columns + 1, &d, fail )) == 0; 
-		columns++ )
+	lend = csv_line_end( csv, p );
+	for( csv->columns = 0;
+		(ch = csv_read_double( csv, &p, lend,
+			skip + 1, csv->columns + 1, &d )) == 0;
+		csv->columns++ )
 		;
-	(void) fsetpos( fp, &pos );
-
-	if( columns == 0 ) {
+	if( ch == -1 ) {
+		csv_free( csv );
+		return( NULL );
+	}
+	if( csv->columns == 0 ) {
 		vips_error( "csv2vips", "%s", _( "empty line" ) );
-		return( -1 );
+		csv_free( csv );
+		return( NULL );
 	}
 
-	/* If lines is -1, we have to scan the whole file to get the
-	 * number of lines out.
+	/* If lines is -1, or we are loading, we have to scan the whole file
+	 * to count lines.
 	 */
-	if( lines == -1 ) {
-		(void) fgetpos( fp, &pos );
-		for( lines = 0; skip_line( fp ); lines++ )
-			;
-		(void) fsetpos( fp, &pos );
+	if( lines == -1 ||
+		build_index ) {
+		for( csv->n_lines = 0, p = csv->first;
+			p < csv->end; csv->n_lines++ )
+			p = csv_next_line( csv, p );
+
+		if( lines == -1 )
+			csv->lines = csv->n_lines;
+	}
+
+	if( build_index ) {
+		int n_entries = csv->n_lines / CSV_INDEX_STEP + 1;
+
+		if( !(csv->index = VIPS_ARRAY( NULL, n_entries, gint64 )) ) {
+			csv_free( csv );
+			return( NULL );
+		}
+
+		for( i = 0, p = csv->first; i < csv->n_lines; i++ ) {
+			if( i % CSV_INDEX_STEP == 0 )
+				csv->index[i / CSV_INDEX_STEP] = p - csv->base;
+			p = csv_next_line( csv, p );
+		}
 	}
 
-	vips_image_pipelinev( out, VIPS_DEMAND_STYLE_THINSTRIP, NULL );
+	return( csv );
+}
+
+static void
+csv_header( Csv *csv, VipsImage *out )
+{
 	vips_image_init_fields( out,
-		columns, lines, 1, 
+		csv->columns, csv->lines, 1,
 		VIPS_FORMAT_DOUBLE, 
 		VIPS_CODING_NONE, VIPS_INTERPRETATION_B_W, 1.0, 1.0 );
+	vips_image_pipelinev( out, VIPS_DEMAND_STYLE_FATSTRIP, NULL );
+}
 
-	/* Just reading the header? We are done.
+/* Parse a strip of lines. This can run in many threads at once.
+ */
+static int
+csv_generate( VipsRegion *or,
+	void *seq, void *a, void *b, gboolean *stop )
+{
+	Csv *csv = (Csv *) a;
+	VipsRect *r = &or->valid;
+
+	const char *p;
+	int i;
+	int y;
+
+	/* Find the start of the first line we need.
 	 */
-	if( !read_image )
-		return( 0 );
+	if( r->top < csv->n_lines ) {
+		p = csv->base + csv->index[r->top / CSV_INDEX_STEP];
+		for( i = 0; i < r->top % CSV_INDEX_STEP; i++ )
+			p = csv_next_line( csv, p );
+	}
+	else
+		p = csv->end;
 
-	if( !(buf = VIPS_ARRAY( out, 
-		VIPS_IMAGE_N_ELEMENTS( out ), double )) )
-		return( -1 );
+	for( y = 0; y < r->height; y++ ) {
+		int lineno = r->top + y + csv->skip + 1;
+		double *q = (double *)
+			VIPS_REGION_ADDR( or, r->left, r->top + y );
 
-	for( y = 0; y < lines; y++ ) {
+		const char *lend;
 		int x;
 
-		for( x = 0; x < columns; x++ ) {
-			int lineno = y + skip + 1;
+		if( p >= csv->end ) {
+			vips_error( "csv2vips",
+				_( "unexpected EOF, line %d col %d" ),
+				lineno, 1 );
+			return( -1 );
+		}
+
+		lend = csv_line_end( csv, p );
+
+		for( x = 0; x < VIPS_RECT_RIGHT( r ); x++ ) {
 			int colno = x + 1;
 
-			ch = read_double( fp, whitemap, sepmap,
-				lineno, colno, &d, fail );
-			if( ch == EOF ) {
-				vips_error( "csv2vips", 
-					_( "unexpected EOF, line %d col %d" ), 
-					lineno, colno );
-				return( -1 );
-			}
-			else if( ch == '\n' ) {
+			double d;
+			int ch;
+
+			ch = csv_read_double( csv, &p, lend,
+				lineno, colno, &d );
+			if( ch == '\n' ) {
 				vips_error( "csv2vips", 
 					_( "unexpected EOL, line %d col %d" ), 
 					lineno, colno );
@@ -328,15 +609,13 @@ read_csv( FILE *fp, VipsImage *out,
 				 */
 				return( -1 );
 
-			buf[x] = d;
+			if( x >= r->left )
+				q[x - r->left] = d;
 		}
 
-		if( vips_image_write_line( out, y, (VipsPel *) buf ) )
-			return( -1 );
-
 		/* Skip over the '\n' to the next line.
 		 */
-		skip_line( fp );
+		p = csv_next_line( csv, p );
 	}
 
 	return( 0 );
@@ -347,16 +626,25 @@ vips__csv_read( const char *filename, VipsImage *out,
 	int skip, int lines, const char *whitespace, const char *separator, 
 	gboolean fail )
 {
-	FILE *fp;
+	Csv *csv;
+	VipsImage *raw;
 
-	if( !(fp = vips__file_open_read( filename, NULL, TRUE )) ) 
+	if( !(csv = csv_new( filename,
+		skip, lines, whitespace, separator, fail, TRUE )) )
 		return( -1 );
-	if( read_csv( fp, out, 
-		skip, lines, whitespace, separator, TRUE, fail ) ) {
-		fclose( fp );
+
+	/* The mapped file lives as long as the image that parses it.
+	 */
+	raw = vips_image_new();
+	vips_object_local( out, raw );
+	g_signal_connect( raw, "close",
+		G_CALLBACK( csv_close_cb ), csv );
+
+	csv_header( csv, raw );
+	if( vips_image_generate( raw,
+		NULL, csv_generate, NULL, csv, NULL ) ||
+		vips_image_write( raw, out ) )
 		return( -1 );
-	}
-	fclose( fp );
 
 	return( 0 );
 }
@@ -366,26 +654,54 @@ vips__csv_read_header( const char *filename, VipsImage *out,
 	int skip, int lines, const char *whitespace, const char *separator, 
 	gboolean fail )
 {
-	FILE *fp;
+	Csv *csv;
 
-	if( !(fp = vips__file_open_read( filename, NULL, TRUE )) ) 
-		return( -1 );
-	if( read_csv( fp, out, 
-		skip, lines, whitespace, separator, FALSE, fail ) ) {
-		fclose( fp );
+	if( !(csv = csv_new( filename,
+		skip, lines, whitespace, separator, fail, FALSE )) )
 		return( -1 );
-	}
-	fclose( fp );
+	csv_header( csv, out );
+	csv_free( csv );
 
 	return( 0 );
 }
 
 const char *vips__foreign_csv_suffs[] = { ".csv", NULL };
 
+/* Format a float in the C locale with the fewest digits, of 6 or 9, that
+ * will read back exactly.
+ */
+static const char *
+csv_format_float( char buf[G_ASCII_DTOSTR_BUF_SIZE], float f )
+{
+	g_ascii_formatd( buf, G_ASCII_DTOSTR_BUF_SIZE, "%.6g", f );
+	if( (float) g_ascii_strtod( buf, NULL ) != f )
+		g_ascii_formatd( buf, G_ASCII_DTOSTR_BUF_SIZE, "%.9g", f );
+
+	return( buf );
+}
+
+/* As above, but with 15 or 17 digits for a double.
+ */
+static const char *
+csv_format_double( char buf[G_ASCII_DTOSTR_BUF_SIZE], double d )
+{
+	g_ascii_formatd( buf, G_ASCII_DTOSTR_BUF_SIZE, "%.15g", d );
+	if( g_ascii_strtod( buf, NULL ) != d )
+		g_ascii_formatd( buf, G_ASCII_DTOSTR_BUF_SIZE, "%.17g", d );
+
+	return( buf );
+}
+
 #define PRINT_INT( TYPE ) fprintf( fp, "%d", *((TYPE*)p) );
-#define PRINT_FLOAT( TYPE ) fprintf( fp, "%g", *((TYPE*)p) );
-#define PRINT_COMPLEX( TYPE ) fprintf( fp, "(%g, %g)", \
-	((TYPE*)p)[0], ((TYPE*)p)[1] );
+#define PRINT_FLOAT( FORMAT, TYPE ) \
+	fputs( FORMAT( buf, *((TYPE*)p) ), fp );
+#define PRINT_COMPLEX( FORMAT, TYPE ) { \
+	fputs( "(", fp ); \
+	fputs( FORMAT( buf, ((TYPE*)p)[0] ), fp ); \
+	fputs( ", ", fp ); \
+	fputs( FORMAT( buf, ((TYPE*)p)[1] ), fp ); \
+	fputs( ")", fp ); \
+}
 
 static int
 vips2csv( VipsImage *in, FILE *fp, const char *sep )
@@ -395,6 +711,7 @@ vips2csv( VipsImage *in, FILE *fp, const char *sep )
 
 	int x, y; 
 	VipsPel *p;
+	char buf[G_ASCII_DTOSTR_BUF_SIZE];
 
 	p = in->data; 
 	for( y = 0; y < in->Ysize; y++ ) { 
@@ -416,13 +733,17 @@ vips2csv( VipsImage *in, FILE *fp, const char *sep )
 			case VIPS_FORMAT_INT:		
 				PRINT_INT( int ); break; 
 			case VIPS_FORMAT_FLOAT:		
-				PRINT_FLOAT( float ); break; 
+				PRINT_FLOAT( csv_format_float, float );
+				break;
 			case VIPS_FORMAT_DOUBLE:		
-				PRINT_FLOAT( double ); break; 
+				PRINT_FLOAT( csv_format_double, double );
+				break;
 			case VIPS_FORMAT_COMPLEX:	
-				PRINT_COMPLEX( float ); break; 
+				PRINT_COMPLEX( csv_format_float, float );
+				break;
 			case VIPS_FORMAT_DPCOMPLEX:	
-				PRINT_COMPLEX( double ); break; 
+				PRINT_COMPLEX( csv_format_double, double );
+				break;
 
 			default: 
 				g_assert_not_reached();
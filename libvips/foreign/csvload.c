@@ -223,6 +223,8 @@ vips_foreign_load_csv_init( VipsForeignLoadCsv *csv )
  *
  * Setting @fail to %TRUE makes the reader fail on any errors. 
  *
+ * The file is mapped into memory and lines are parsed in parallel.
+ *
  * See also: vips_image_new_from_file(), vips_bandfold().
  *
  * Returns: 0 on success, -1 on error.
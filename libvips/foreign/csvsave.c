@@ -136,6 +136,9 @@ vips_foreign_save_csv_init( VipsForeignSaveCsv *csv )
  * "(real,imaginary)" and will need extra parsing I guess. Only the first band
  * is written. 
  *
+ * Float and double pixels are written in the C locale with just enough
+ * digits to read back to exactly the same value.
+ *
  * @separator gives the string to use to separate numbers in the output. 
  * The default is "\\t" (tab).
  *
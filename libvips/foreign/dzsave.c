@@ -76,6 +76,11 @@
  * 24/11/17
  * 	- output overlap-only tiles on edges for better deepzoom spec
  * 	  compliance
+ * 14/10/18
+ * 	- encode plain JPEG tiles directly from the strip with reusable
+ * 	  per-thread compressors
+ * 	- add @skip_blanks
+ * 	- add @region_shrink
  */
 
 /*
@@ -160,6 +165,8 @@
 #include <vips/vips.h>
 #include <vips/internal.h>
 
+#include "pforeign.h"
+
 #ifdef HAVE_GSF
 
 #include <gsf/gsf.h>
@@ -447,6 +454,8 @@ struct _VipsForeignSaveDz {
 	VipsAngle angle;
 	VipsForeignDzContainer container; 
 	int compression;
+	int skip_blanks;
+	VipsRegionShrink region_shrink;
 
 	/* Tile and overlap geometry. The members above are the parameters we
 	 * accept, this next set are the derived values which are actually 
@@ -523,10 +532,21 @@ struct _VipsForeignSaveDz {
 	size_t bytes_written;
 
 	/* save->background turned into a pixel that matches the image we are
-	 * saving .. used to test for blank tiles.
+	 * saving .. used to test for blank tiles with @skip_blanks.
 	 */
 	VipsPel *ink;
 
+	/* Set if we can make JPEG tiles directly from the strip memory,
+	 * see strip_encode_jpeg(). Workers share a pool of encoders.
+	 */
+	gboolean direct_jpeg;
+	int Q;
+	gboolean optimize_coding;
+	gboolean interlace;
+	gboolean no_subsample;
+	GMutex *encoder_lock;
+	GSList *encoders;
+
 };
 
 typedef VipsForeignSaveClass VipsForeignSaveDzClass;
@@ -546,6 +566,16 @@ layer_free( Layer *layer )
 	VIPS_FREEF( layer_free, layer->below ); 
 }
 
+#ifdef HAVE_JPEG
+static void *
+encoder_free( VipsJpegEncoder *encoder, void *a, void *b )
+{
+	vips__jpeg_encoder_free( encoder );
+
+	return( NULL );
+}
+#endif /*HAVE_JPEG*/
+
 static void
 vips_foreign_save_dz_dispose( GObject *gobject )
 {
@@ -559,6 +589,12 @@ vips_foreign_save_dz_dispose( GObject *gobject )
 	VIPS_FREE( dz->tempdir );
 	VIPS_FREE( dz->root_name );
 	VIPS_FREE( dz->file_suffix );
+#ifdef HAVE_JPEG
+	vips_slist_map2( dz->encoders,
+		(VipsSListMap2Fn) encoder_free, NULL, NULL );
+	VIPS_FREEF( g_slist_free, dz->encoders );
+#endif /*HAVE_JPEG*/
+	VIPS_FREEF( vips_g_mutex_free, dz->encoder_lock );
 
 	G_OBJECT_CLASS( vips_foreign_save_dz_parent_class )->
 		dispose( gobject );
@@ -1043,20 +1079,39 @@ tile_name( Layer *layer, int x, int y )
 	return( out );
 }
 
-/* Test for tile equal to background colour. In google maps mode, we skip
+/* Test for a line of pixels within @threshold of the background colour.
+ */
+static gboolean
+line_equal( VipsPel * restrict p, int width, int bytes,
+	int threshold, VipsPel *ink )
+{
+	int x, b;
+
+	for( x = 0; x < width; x++ ) {
+		for( b = 0; b < bytes; b++ )
+			if( VIPS_ABS( p[b] - ink[b] ) > threshold )
+				return( FALSE );
+
+		p += bytes;
+	}
+
+	return( TRUE );
+}
+
+/* Test for tile equal to background colour. With @skip_blanks, we skip
  * blank background tiles. 
  *
  * Don't use exactly equality, since compression artefacts or noise can upset
  * this.
  */
 static gboolean
-tile_equal( VipsImage *image, VipsPel * restrict ink )
+tile_equal( VipsImage *image, int threshold, VipsPel * restrict ink )
 {
 	const int bytes = VIPS_IMAGE_SIZEOF_PEL( image );
 
 	VipsRect rect;
 	VipsRegion *region;
-	int x, y, b;
+	int y;
 
 	region = vips_region_new( image ); 
 
@@ -1071,19 +1126,12 @@ tile_equal( VipsImage *image, VipsPel * restrict ink )
 		return( FALSE ); 
 	}
 
-	for( y = 0; y < image->Ysize; y++ ) {
-		VipsPel * restrict p = VIPS_REGION_ADDR( region, 0, y ); 
-
-		for( x = 0; x < image->Xsize; x++ ) {
-			for( b = 0; b < bytes; b++ ) 
-				if( VIPS_ABS( p[b] - ink[b] ) > 5 ) {
-					g_object_unref( region );
-					return( FALSE ); 
-				}
-
-			p += bytes;
+	for( y = 0; y < image->Ysize; y++ )
+		if( !line_equal( VIPS_REGION_ADDR( region, 0, y ),
+			image->Xsize, bytes, threshold, ink ) ) {
+			g_object_unref( region );
+			return( FALSE );
 		}
-	}
 
 	g_object_unref( region );
 
@@ -1113,47 +1161,18 @@ estimate_zip_size( VipsForeignSaveDz *dz )
 }
 #endif /*HAVE_GSF_ZIP64*/
 
+/* Make a tile with the saver for @suffix. *buf is NULL for blank google
+ * tiles, which we don't write.
+ */
 static int
-strip_work( VipsThreadState *state, void *a )
+strip_encode_image( Strip *strip, VipsRect *pos, void **buf, size_t *len )
 {
-	Strip *strip = (Strip *) a;
 	Layer *layer = strip->layer;
 	VipsForeignSaveDz *dz = layer->dz;
 	VipsForeignSave *save = (VipsForeignSave *) dz;
-	VipsObjectClass *class = VIPS_OBJECT_GET_CLASS( dz ); 
 
 	VipsImage *x;
 	VipsImage *t;
-	void *buf;
-	size_t len;
-	GsfOutput *out; 
-	gboolean status;
-
-#ifdef DEBUG_VERBOSE
-	printf( "strip_work\n" );
-#endif /*DEBUG_VERBOSE*/
-
-	/* If we are centering we may be outside the real pixels. Skip in 
-	 * this case, and the viewer will display blank.png for us. 
-	 */
-	if( dz->centre ) {
-		VipsRect tile; 
-
-		tile.left = state->x;
-		tile.top = state->y;
-		tile.width = dz->tile_size;
-		tile.height = dz->tile_size;
-		vips_rect_intersectrect( &tile, &layer->real_pixels, &tile );
-		if( vips_rect_isempty( &tile ) ) {
-#ifdef DEBUG_VERBOSE
-			printf( "strip_work: skipping tile %d x %d\n", 
-				state->x / dz->tile_size, 
-				state->y / dz->tile_size ); 
-#endif /*DEBUG_VERBOSE*/
-
-			return( 0 ); 
-		}
-	}
 
 #ifdef DEBUG
 	vips_object_sanity( VIPS_OBJECT( strip->image ) );
@@ -1162,22 +1181,16 @@ strip_work( VipsThreadState *state, void *a )
 	/* Extract relative to the strip top-left corner.
 	 */
 	if( vips_extract_area( strip->image, &x, 
-		state->pos.left, 0, 
-		state->pos.width, state->pos.height, NULL ) ) 
+		pos->left, 0,
+		pos->width, pos->height, NULL ) )
 		return( -1 );
 
-	/* If we are writing a google map pyramid and the tile is equal to the 
-	 * background, don't save. The viewer will display blank.png for us.
+	/* If the tile is equal to the background, don't save.
 	 */
-	if( dz->layout == VIPS_FOREIGN_DZ_LAYOUT_GOOGLE &&
-		tile_equal( x, dz->ink ) ) { 
+	if( dz->skip_blanks >= 0 &&
+		tile_equal( x, dz->skip_blanks, dz->ink ) ) {
 		g_object_unref( x );
-
-#ifdef DEBUG_VERBOSE
-		printf( "strip_work: skipping blank tile %d x %d\n", 
-			state->x / dz->tile_size, 
-			state->y / dz->tile_size ); 
-#endif /*DEBUG_VERBOSE*/
+		*buf = NULL;
 
 		return( 0 ); 
 	}
@@ -1200,7 +1213,7 @@ strip_work( VipsThreadState *state, void *a )
 	 * Strip them.
 	 */
 	vips_image_set_int( x, "hide-progress", 1 );
-	if( vips_image_write_to_buffer( x, dz->suffix, &buf, &len, 
+	if( vips_image_write_to_buffer( x, dz->suffix, buf, len,
 		"strip", TRUE, 
 		NULL ) ) {
 		g_object_unref( x );
@@ -1208,6 +1221,188 @@ strip_work( VipsThreadState *state, void *a )
 	}
 	g_object_unref( x );
 
+	return( 0 );
+}
+
+#ifdef HAVE_JPEG
+static VipsJpegEncoder *
+encoder_get( VipsForeignSaveDz *dz )
+{
+	VipsJpegEncoder *encoder;
+
+	g_mutex_lock( dz->encoder_lock );
+	if( (encoder = (VipsJpegEncoder *)
+		g_slist_nth_data( dz->encoders, 0 )) )
+		dz->encoders = g_slist_remove( dz->encoders, encoder );
+	g_mutex_unlock( dz->encoder_lock );
+
+	if( !encoder )
+		encoder = vips__jpeg_encoder_new( dz->Q,
+			dz->optimize_coding, dz->interlace, dz->no_subsample );
+
+	return( encoder );
+}
+
+static void
+encoder_put( VipsForeignSaveDz *dz, VipsJpegEncoder *encoder )
+{
+	g_mutex_lock( dz->encoder_lock );
+	dz->encoders = g_slist_prepend( dz->encoders, encoder );
+	g_mutex_unlock( dz->encoder_lock );
+}
+
+/* Make a JPEG tile straight from the strip memory, with no intermediate
+ * images or operations. This makes the same file strip_encode_image() would.
+ */
+static int
+strip_encode_jpeg( Strip *strip, VipsRect *pos, void **buf, size_t *len )
+{
+	Layer *layer = strip->layer;
+	VipsForeignSaveDz *dz = layer->dz;
+	VipsImage *image = strip->image;
+	const int bytes = VIPS_IMAGE_SIZEOF_PEL( image );
+
+	int width;
+	int height;
+	VipsPel **rows;
+	VipsPel *pad;
+	VipsJpegEncoder *encoder;
+	int x, y;
+	int result;
+
+	/* Google tiles are padded up to tilesize with background.
+	 */
+	if( dz->layout == VIPS_FOREIGN_DZ_LAYOUT_GOOGLE ) {
+		width = dz->tile_size;
+		height = dz->tile_size;
+	}
+	else {
+		width = pos->width;
+		height = pos->height;
+	}
+
+	if( !(rows = VIPS_ARRAY( NULL, height, VipsPel * )) )
+		return( -1 );
+	for( y = 0; y < pos->height; y++ )
+		rows[y] = VIPS_IMAGE_ADDR( image, pos->left, y );
+
+	if( dz->skip_blanks >= 0 ) {
+		for( y = 0; y < pos->height; y++ )
+			if( !line_equal( rows[y], pos->width, bytes,
+				dz->skip_blanks, dz->ink ) )
+				break;
+		if( y == pos->height ) {
+			g_free( rows );
+			*buf = NULL;
+
+			return( 0 );
+		}
+	}
+
+	pad = NULL;
+	if( width != pos->width ||
+		height != pos->height ) {
+		if( !(pad = VIPS_ARRAY( NULL,
+			(size_t) width * height * bytes, VipsPel )) ) {
+			g_free( rows );
+			return( -1 );
+		}
+
+		for( y = 0; y < height; y++ ) {
+			VipsPel *q = pad + (size_t) y * width * bytes;
+
+			if( y < pos->height ) {
+				memcpy( q, rows[y], pos->width * bytes );
+				x = pos->width;
+			}
+			else
+				x = 0;
+
+			for( ; x < width; x++ )
+				memcpy( q + x * bytes, dz->ink, bytes );
+
+			rows[y] = q;
+		}
+	}
+
+	if( !(encoder = encoder_get( dz )) ) {
+		g_free( pad );
+		g_free( rows );
+		return( -1 );
+	}
+	result = vips__jpeg_encoder_write( encoder,
+		rows, width, height, image->Bands, buf, len );
+	encoder_put( dz, encoder );
+
+	g_free( pad );
+	g_free( rows );
+
+	return( result );
+}
+#endif /*HAVE_JPEG*/
+
+static int
+strip_work( VipsThreadState *state, void *a )
+{
+	Strip *strip = (Strip *) a;
+	Layer *layer = strip->layer;
+	VipsForeignSaveDz *dz = layer->dz;
+	VipsObjectClass *class = VIPS_OBJECT_GET_CLASS( dz );
+
+	void *buf;
+	size_t len;
+	GsfOutput *out;
+	gboolean status;
+
+#ifdef DEBUG_VERBOSE
+	printf( "strip_work\n" );
+#endif /*DEBUG_VERBOSE*/
+
+	/* If we are centering we may be outside the real pixels. Skip in
+	 * this case, and the viewer will display blank.png for us.
+	 */
+	if( dz->centre ) {
+		VipsRect tile;
+
+		tile.left = state->x;
+		tile.top = state->y;
+		tile.width = dz->tile_size;
+		tile.height = dz->tile_size;
+		vips_rect_intersectrect( &tile, &layer->real_pixels, &tile );
+		if( vips_rect_isempty( &tile ) ) {
+#ifdef DEBUG_VERBOSE
+			printf( "strip_work: skipping tile %d x %d\n",
+				state->x / dz->tile_size,
+				state->y / dz->tile_size );
+#endif /*DEBUG_VERBOSE*/
+
+			return( 0 );
+		}
+	}
+
+#ifdef HAVE_JPEG
+	if( dz->direct_jpeg ) {
+		if( strip_encode_jpeg( strip, &state->pos, &buf, &len ) )
+			return( -1 );
+	}
+	else
+#endif /*HAVE_JPEG*/
+	if( strip_encode_image( strip, &state->pos, &buf, &len ) )
+		return( -1 );
+
+	/* Blank tiles are not saved, see @skip_blanks. Google viewers will
+	 * display blank.png for us.
+	 */
+	if( !buf ) {
+#ifdef DEBUG_VERBOSE
+		printf( "strip_work: skipping blank tile %d x %d\n",
+			state->x / dz->tile_size,
+			state->y / dz->tile_size );
+#endif /*DEBUG_VERBOSE*/
+
+		return( 0 );
+	}
+
 	/* gsf doesn't like more than one write active at once.
 	 */
 	g_mutex_lock( vips__global_lock );
@@ -1404,7 +1599,8 @@ strip_shrink( Layer *layer )
 		if( vips_rect_isempty( &target ) ) 
 			break;
 
-		(void) vips_region_shrink( from, to, &target );
+		(void) vips_region_shrink_method( from, to, &target,
+			layer->dz->region_shrink );
 
 		below->write_y += target.height;
 
@@ -1602,6 +1798,89 @@ pyramid_strip( VipsRegion *region, VipsRect *area, void *a )
 	return( 0 );
 }
 
+#ifdef HAVE_JPEG
+/* jpegsave options strip_encode_jpeg() can do. Tiles are always
+ * stripped.
+ */
+static const char *dz_direct_jpeg_args[] = {
+	"Q", "optimize_coding", "interlace", "no_subsample", "strip", NULL
+};
+
+static void *
+vips_foreign_save_dz_direct_arg( VipsObject *object, GParamSpec *pspec,
+	VipsArgumentClass *argument_class,
+	VipsArgumentInstance *argument_instance,
+	void *a, void *b )
+{
+	int i;
+
+	if( !argument_instance->assigned ||
+		!(argument_class->flags & VIPS_ARGUMENT_INPUT) )
+		return( NULL );
+
+	for( i = 0; dz_direct_jpeg_args[i]; i++ )
+		if( strcmp( g_param_spec_get_name( pspec ),
+			dz_direct_jpeg_args[i] ) == 0 )
+			return( NULL );
+
+	return( pspec );
+}
+
+/* Can we skip jpegsave and write JPEG tiles directly? We need ".jpg" with
+ * only simple options, and an image jpegsave would not convert.
+ */
+static gboolean
+vips_foreign_save_dz_direct_jpeg( VipsForeignSaveDz *dz,
+	const char *option_string )
+{
+	VipsForeignSave *save = (VipsForeignSave *) dz;
+	VipsImage *ready = save->ready;
+
+	VipsOperation *operation;
+	int i;
+
+	for( i = 0; vips__jpeg_suffs[i]; i++ )
+		if( g_ascii_strcasecmp( dz->file_suffix,
+			vips__jpeg_suffs[i] ) == 0 )
+			break;
+	if( !vips__jpeg_suffs[i] )
+		return( FALSE );
+
+	if( ready->Coding != VIPS_CODING_NONE ||
+		ready->BandFmt != VIPS_FORMAT_UCHAR ||
+		!((ready->Bands == 3 &&
+			ready->Type == VIPS_INTERPRETATION_sRGB) ||
+		  (ready->Bands == 1 &&
+			ready->Type == VIPS_INTERPRETATION_B_W)) )
+		return( FALSE );
+
+	/* Parse the options with jpegsave itself, so we read them exactly as
+	 * vips_image_write_to_buffer() would.
+	 */
+	if( !(operation = vips_operation_new( "jpegsave_buffer" )) ) {
+		vips_error_clear();
+		return( FALSE );
+	}
+	if( vips_object_set_from_string( VIPS_OBJECT( operation ),
+		option_string ) ||
+		vips_argument_map( VIPS_OBJECT( operation ),
+			vips_foreign_save_dz_direct_arg, NULL, NULL ) ) {
+		vips_error_clear();
+		g_object_unref( operation );
+		return( FALSE );
+	}
+	g_object_get( operation,
+		"Q", &dz->Q,
+		"optimize_coding", &dz->optimize_coding,
+		"interlace", &dz->interlace,
+		"no_subsample", &dz->no_subsample,
+		NULL );
+	g_object_unref( operation );
+
+	return( TRUE );
+}
+#endif /*HAVE_JPEG*/
+
 static int
 vips_foreign_save_dz_build( VipsObject *object )
 {
@@ -1620,6 +1899,13 @@ vips_foreign_save_dz_build( VipsObject *object )
 			VIPS_SETSTR( dz->suffix, ".jpg" );
 	}
 
+	/* Google skips blank tiles by default, the viewer shows blank.png
+	 * instead.
+	 */
+	if( dz->layout == VIPS_FOREIGN_DZ_LAYOUT_GOOGLE &&
+		!vips_object_argument_isset( object, "skip_blanks" ) )
+		dz->skip_blanks = 5;
+
 	/* Google and zoomify default to 256 pixel tiles.
 	 */
 	if( dz->layout == VIPS_FOREIGN_DZ_LAYOUT_ZOOMIFY ||
@@ -1687,9 +1973,10 @@ vips_foreign_save_dz_build( VipsObject *object )
 	save->ready = z;
 }
 
-	/* We use ink in google mode to check for blank tiles.
+	/* We use ink to check for blank tiles, and to pad google tiles.
 	 */
-	if( dz->layout == VIPS_FOREIGN_DZ_LAYOUT_GOOGLE ) {
+	if( dz->layout == VIPS_FOREIGN_DZ_LAYOUT_GOOGLE ||
+		dz->skip_blanks >= 0 ) {
 		if( !(dz->ink = vips__vector_to_ink( 
 			class->nickname, save->ready,
 			VIPS_AREA( save->background )->data, NULL, 
@@ -1776,6 +2063,12 @@ vips_foreign_save_dz_build( VipsObject *object )
 
 	vips__filename_split8( dz->suffix, filename, option_string );
 	dz->file_suffix = g_strdup( filename ); 
+
+#ifdef HAVE_JPEG
+	dz->direct_jpeg = vips_foreign_save_dz_direct_jpeg( dz, option_string );
+	if( dz->direct_jpeg )
+		dz->encoder_lock = vips_g_mutex_new();
+#endif /*HAVE_JPEG*/
 }
 
 	/* If we will be renaming our temp dir to an existing directory or
@@ -2098,6 +2391,20 @@ vips_foreign_save_dz_class_init( VipsForeignSaveDzClass *class )
 		G_STRUCT_OFFSET( VipsForeignSaveDz, compression ),
 		-1, 9, 0 );
 
+	VIPS_ARG_INT( class, "skip_blanks", 18,
+		_( "Skip blanks" ),
+		_( "Skip tiles which are nearly equal to the background" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsForeignSaveDz, skip_blanks ),
+		-1, 65535, -1 );
+
+	VIPS_ARG_ENUM( class, "region_shrink", 19,
+		_( "Region shrink" ),
+		_( "Method to shrink regions" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsForeignSaveDz, region_shrink ),
+		VIPS_TYPE_REGION_SHRINK, VIPS_REGION_SHRINK_MEAN );
+
 	/* How annoying. We stupidly had these in earlier versions.
 	 */
 
@@ -2136,6 +2443,8 @@ vips_foreign_save_dz_init( VipsForeignSaveDz *dz )
 	dz->angle = VIPS_ANGLE_D0; 
 	dz->container = VIPS_FOREIGN_DZ_CONTAINER_FS; 
 	dz->compression = 0;
+	dz->skip_blanks = -1;
+	dz->region_shrink = VIPS_REGION_SHRINK_MEAN;
 }
 
 typedef struct _VipsForeignSaveDzFile {
@@ -2332,6 +2641,8 @@ vips_foreign_save_dz_buffer_init( VipsForeignSaveDzBuffer *buffer )
  * * @container: #VipsForeignDzContainer set container type
  * * @properties: %gboolean write a properties file
  * * @compression: %gint zip deflate compression level
+ * * @skip_blanks: %gint skip tiles which are nearly equal to the background
+ * * @region_shrink: #VipsRegionShrink how to shrink each 2x2 region
  *
  * Save an image as a set of tiles at various resolutions. By default dzsave
  * uses DeepZoom layout -- use @layout to pick other conventions.
@@ -2369,6 +2680,15 @@ vips_foreign_save_dz_buffer_init( VipsForeignSaveDzBuffer *buffer )
  * (use zlib default), 0 (store, compression disabled) to 9 (max compression).
  * If no value is given, the default is to store files without compression.
  *
+ * Tiles which are within @skip_blanks of the @background colour are not
+ * written. Set -1 to write every tile. This defaults to 5 for google
+ * layout, where the viewer displays `blank.png` in their place, and -1
+ * otherwise.
+ *
+ * Use @region_shrink to pick how each layer is made from the one above.
+ * The default is the mean, use #VIPS_REGION_SHRINK_MODE, for example, for
+ * label maps.
+ *
  * See also: vips_tiffsave().
  *
  * Returns: 0 on success, -1 on error.
@@ -2407,6 +2727,8 @@ vips_dzsave( VipsImage *in, const char *name, ... )
  * * @container: #VipsForeignDzContainer set container type
  * * @properties: %gboolean write a properties file
  * * @compression: %gint zip deflate compression level
+ * * @skip_blanks: %gint skip tiles which are nearly equal to the background
+ * * @region_shrink: #VipsRegionShrink how to shrink each 2x2 region
  *
  * As vips_dzsave(), but save to a memory buffer. 
  *
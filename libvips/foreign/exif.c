@@ -7,6 +7,9 @@
  * 	- only read orientation from ifd0
  * 1/2/18
  * 	- remove exif thumbnail if "jpeg-thumbnail-data" has been removed
+ * 14/10/18
+ * 	- read orientation, resolution and thumbnail with a direct parser,
+ * 	  make the exif-ifd* fields only on demand
  */
 
 /*
@@ -56,6 +59,309 @@
 #include <vips/internal.h>
 #include <vips/debug.h>
 
+/* A tiny TIFF IFD reader for the few tags we need at load time. We don't
+ * want to run libexif over the whole block just for these, maker notes can
+ * be very large. The full set of exif-ifd* fields is made by
+ * vips__exif_expand() on demand.
+ */
+typedef struct _VipsExifReader {
+	const VipsPel *data;		/* Start of the TIFF header */
+	size_t length;
+	gboolean big_endian;
+} VipsExifReader;
+
+/* The tags we read.
+ */
+#define VIPS_EXIF_ORIENTATION (0x112)
+#define VIPS_EXIF_X_RESOLUTION (0x11a)
+#define VIPS_EXIF_Y_RESOLUTION (0x11b)
+#define VIPS_EXIF_RESOLUTION_UNIT (0x128)
+#define VIPS_EXIF_THUMBNAIL_OFFSET (0x201)
+#define VIPS_EXIF_THUMBNAIL_LENGTH (0x202)
+
+static int
+vips_exif_reader_init( VipsExifReader *reader,
+	const void *data, size_t length )
+{
+	const VipsPel *p = (const VipsPel *) data;
+
+	/* Blocks from JPEG have the APP1 "Exif" header, others may not.
+	 */
+	if( length >= 6 &&
+		memcmp( p, "Exif\0\0", 6 ) == 0 ) {
+		p += 6;
+		length -= 6;
+	}
+
+	if( length < 8 )
+		return( -1 );
+	if( memcmp( p, "II*\0", 4 ) == 0 )
+		reader->big_endian = FALSE;
+	else if( memcmp( p, "MM\0*", 4 ) == 0 )
+		reader->big_endian = TRUE;
+	else
+		return( -1 );
+
+	reader->data = p;
+	reader->length = length;
+
+	return( 0 );
+}
+
+static int
+vips_exif_reader_u16( VipsExifReader *reader, size_t offset, guint32 *out )
+{
+	const VipsPel *p;
+
+	if( offset > reader->length - 2 )
+		return( -1 );
+
+	p = reader->data + offset;
+	*out = reader->big_endian ?
+		(p[0] << 8) | p[1] :
+		p[0] | (p[1] << 8);
+
+	return( 0 );
+}
+
+static int
+vips_exif_reader_u32( VipsExifReader *reader, size_t offset, guint32 *out )
+{
+	const VipsPel *p;
+
+	if( offset > reader->length - 4 )
+		return( -1 );
+
+	p = reader->data + offset;
+	*out = reader->big_endian ?
+		((guint32) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3] :
+		p[0] | (p[1] << 8) | (p[2] << 16) | ((guint32) p[3] << 24);
+
+	return( 0 );
+}
+
+/* Find a single-valued numeric tag in the IFD at @ifd.
+ */
+static int
+vips_exif_reader_get( VipsExifReader *reader,
+	guint32 ifd, int tag, double *out )
+{
+	guint32 n;
+	guint32 i;
+
+	if( vips_exif_reader_u16( reader, ifd, &n ) )
+		return( -1 );
+
+	for( i = 0; i < n; i++ ) {
+		size_t entry = ifd + 2 + 12 * (size_t) i;
+		guint32 entry_tag, type, count, value;
+		guint32 num, den;
+
+		if( vips_exif_reader_u16( reader, entry, &entry_tag ) ||
+			vips_exif_reader_u16( reader, entry + 2, &type ) ||
+			vips_exif_reader_u32( reader, entry + 4, &count ) )
+			return( -1 );
+		if( entry_tag != tag )
+			continue;
+		if( count != 1 )
+			return( -1 );
+
+		switch( type ) {
+		case 3:
+			/* SHORT.
+			 */
+			if( vips_exif_reader_u16( reader, entry + 8, &value ) )
+				return( -1 );
+			*out = value;
+			break;
+
+		case 4:
+			/* LONG.
+			 */
+			if( vips_exif_reader_u32( reader, entry + 8, &value ) )
+				return( -1 );
+			*out = value;
+			break;
+
+		case 5:
+		case 10:
+			/* RATIONAL and SRATIONAL, stored at an offset.
+			 */
+			if( vips_exif_reader_u32( reader, 
+					entry + 8, &value ) ||
+				vips_exif_reader_u32( reader, value, &num ) ||
+				vips_exif_reader_u32( reader, 
+					value + 4, &den ) ||
+				den == 0 )
+				return( -1 );
+			*out = type == 5 ?
+				(double) num / den :
+				(double) (gint32) num / (gint32) den;
+			break;
+
+		default:
+			return( -1 );
+		}
+
+		return( 0 );
+	}
+
+	return( -1 );
+}
+
+/* Offset of the IFD after the one at @ifd, or 0.
+ */
+static guint32
+vips_exif_reader_next( VipsExifReader *reader, guint32 ifd )
+{
+	guint32 n;
+	guint32 next;
+
+	if( vips_exif_reader_u16( reader, ifd, &n ) ||
+		vips_exif_reader_u32( reader, 
+			ifd + 2 + 12 * (size_t) n, &next ) )
+		return( 0 );
+
+	return( next );
+}
+
+/* Set the image resolution from the EXIF tags.
+ */
+static int
+vips_image_resolution_from_exif( VipsImage *image,
+	VipsExifReader *reader, guint32 ifd0 )
+{
+	double xres, yres;
+	double unit;
+
+	/* The main image xres/yres are in ifd0. ifd1 has xres/yres of the
+	 * image thumbnail, if any.
+	 *
+	 * Don't warn about missing res fields, it's very common, especially for
+	 * things like webp.
+	 */
+	if( vips_exif_reader_get( reader,
+			ifd0, VIPS_EXIF_X_RESOLUTION, &xres ) ||
+		vips_exif_reader_get( reader,
+			ifd0, VIPS_EXIF_Y_RESOLUTION, &yres ) ||
+		vips_exif_reader_get( reader,
+			ifd0, VIPS_EXIF_RESOLUTION_UNIT, &unit ) )
+		return( -1 );
+
+#ifdef DEBUG
+	printf( "vips_image_resolution_from_exif: seen exif tags "
+		"xres = %g, yres = %g, unit = %g\n", xres, yres, unit );
+#endif /*DEBUG*/
+
+	switch( (int) unit ) {
+	case 1:
+		/* No unit ... just pass the fields straight to vips.
+		 */
+		vips_image_set_string( image,
+			VIPS_META_RESOLUTION_UNIT, "none" );
+		break;
+
+	case 2:
+		/* In inches.
+		 */
+		xres /= 25.4;
+		yres /= 25.4;
+		vips_image_set_string( image,
+			VIPS_META_RESOLUTION_UNIT, "in" );
+		break;
+
+	case 3:
+		/* In cm.
+		 */
+		xres /= 10.0;
+		yres /= 10.0;
+		vips_image_set_string( image,
+			VIPS_META_RESOLUTION_UNIT, "cm" );
+		break;
+
+	default:
+		vips_warn( "exif",
+			"%s", _( "unknown EXIF resolution unit" ) );
+		return( -1 );
+	}
+
+#ifdef DEBUG
+	printf( "vips_image_resolution_from_exif: "
+		"seen exif resolution %g, %g p/mm\n", xres, yres );
+#endif /*DEBUG*/
+
+	image->Xres = xres;
+	image->Yres = yres;
+
+	return( 0 );
+}
+
+/* ifd1 points at the JPEG thumbnail, if any.
+ */
+static void
+vips_exif_get_thumbnail( VipsImage *image,
+	VipsExifReader *reader, guint32 ifd0 )
+{
+	guint32 ifd1;
+	double offset, length;
+	char *thumb_copy;
+
+	if( !(ifd1 = vips_exif_reader_next( reader, ifd0 )) ||
+		vips_exif_reader_get( reader,
+			ifd1, VIPS_EXIF_THUMBNAIL_OFFSET, &offset ) ||
+		vips_exif_reader_get( reader,
+			ifd1, VIPS_EXIF_THUMBNAIL_LENGTH, &length ) ||
+		length <= 0 ||
+		offset + length > reader->length )
+		return;
+
+	thumb_copy = g_malloc( length );
+	memcpy( thumb_copy, reader->data + (size_t) offset, length );
+
+	vips_image_set_blob( image, "jpeg-thumbnail-data",
+		(VipsCallbackFn) g_free, thumb_copy, length );
+}
+
+/* Scan the exif block on the image, if any, and set the fields we need at
+ * load time: resolution, orientation and thumbnail. The exif-ifd* string
+ * fields are made later, and only if someone asks for one.
+ */
+int
+vips__exif_parse( VipsImage *image )
+{
+	void *data;
+	size_t length;
+	VipsExifReader reader;
+	guint32 ifd0;
+	double orientation;
+
+	if( !vips_image_get_typeof( image, VIPS_META_EXIF_NAME ) )
+		return( 0 );
+	if( vips_image_get_blob( image, VIPS_META_EXIF_NAME, &data, &length ) )
+		return( -1 );
+
+	vips__exif_set_pending( image, TRUE );
+
+	/* Not a block we can read ... just leave it to libexif.
+	 */
+	if( vips_exif_reader_init( &reader, data, length ) ||
+		vips_exif_reader_u32( &reader, 4, &ifd0 ) )
+		return( 0 );
+
+	(void) vips_image_resolution_from_exif( image, &reader, ifd0 );
+	vips_exif_get_thumbnail( image, &reader, ifd0 );
+
+	/* Orientation handling. ifd0 has the Orientation tag for the main
+	 * image.
+	 */
+	if( !vips_exif_reader_get( &reader,
+		ifd0, VIPS_EXIF_ORIENTATION, &orientation ) )
+		vips_image_set_int( image, VIPS_META_ORIENTATION,
+			VIPS_CLIP( 1, (int) orientation, 8 ) );
+
+	return( 0 );
+}
+
 #ifdef HAVE_EXIF
 
 #ifdef UNTAGGED_EXIF
@@ -360,131 +666,64 @@ vips_exif_entry_get_int( ExifData *ed, int ifd, ExifTag tag, int *out )
 	return( vips_exif_get_int( ed, entry, 0, out ) );
 }
 
-/* Set the image resolution from the EXIF tags.
+/* Need to fwd ref this.
  */
 static int
-vips_image_resolution_from_exif( VipsImage *image, ExifData *ed )
+vips_exif_resolution_from_image( ExifData *ed, VipsImage *image );
+
+/* TRUE if ifd0 has a usable resolution.
+ */
+static gboolean
+vips_exif_has_resolution( ExifData *ed )
 {
 	double xres, yres;
 	int unit;
 
-	/* The main image xres/yres are in ifd0. ifd1 has xres/yres of the
-	 * image thumbnail, if any.
-	 *
-	 * Don't warn about missing res fields, it's very common, especially for
-	 * things like webp.
-	 */
-	if( vips_exif_entry_get_double( ed, 0, EXIF_TAG_X_RESOLUTION, &xres ) ||
-		vips_exif_entry_get_double( ed, 
-			0, EXIF_TAG_Y_RESOLUTION, &yres ) ||
-		vips_exif_entry_get_int( ed, 
-			0, EXIF_TAG_RESOLUTION_UNIT, &unit ) ) 
-		return( -1 );
-
-#ifdef DEBUG
-	printf( "vips_image_resolution_from_exif: seen exif tags "
-		"xres = %g, yres = %g, unit = %d\n", xres, yres, unit );
-#endif /*DEBUG*/
-
-	switch( unit ) {
-	case 1:
-		/* No unit ... just pass the fields straight to vips.
-		 */
-		vips_image_set_string( image, 
-			VIPS_META_RESOLUTION_UNIT, "none" );
-		break;
-
-	case 2:
-		/* In inches.
-		 */
-		xres /= 25.4;
-		yres /= 25.4;
-		vips_image_set_string( image, 
-			VIPS_META_RESOLUTION_UNIT, "in" );
-		break;
-
-	case 3:
-		/* In cm.
-		 */
-		xres /= 10.0;
-		yres /= 10.0;
-		vips_image_set_string( image, 
-			VIPS_META_RESOLUTION_UNIT, "cm" );
-		break;
-
-	default:
-		vips_warn( "exif", 
-			"%s", _( "unknown EXIF resolution unit" ) );
-		return( -1 );
-	}
-
-#ifdef DEBUG
-	printf( "vips_image_resolution_from_exif: "
-		"seen exif resolution %g, %g p/mm\n", xres, yres );
-#endif /*DEBUG*/
-
-	image->Xres = xres;
-	image->Yres = yres;
-
-	return( 0 );
+	return( !vips_exif_entry_get_double( ed,
+			0, EXIF_TAG_X_RESOLUTION, &xres ) &&
+		!vips_exif_entry_get_double( ed,
+			0, EXIF_TAG_Y_RESOLUTION, &yres ) &&
+		!vips_exif_entry_get_int( ed,
+			0, EXIF_TAG_RESOLUTION_UNIT, &unit ) &&
+		unit >= 1 &&
+		unit <= 3 );
 }
 
-static int
-vips_exif_get_thumbnail( VipsImage *im, ExifData *ed )
-{
-	if( ed->size > 0 ) {
-		char *thumb_copy;
-
-		thumb_copy = g_malloc( ed->size );      
-		memcpy( thumb_copy, ed->data, ed->size );
-
-		vips_image_set_blob( im, "jpeg-thumbnail-data", 
-			(VipsCallbackFn) g_free, thumb_copy, ed->size );
-	}
-
-	return( 0 );
-}
-
-/* Need to fwd ref this.
- */
-static int
-vips_exif_resolution_from_image( ExifData *ed, VipsImage *image );
-
-/* Scan the exif block on the image, if any, and make a set of vips metadata 
- * tags for what we find.
+/* Expand the exif block on the image, if any, out to a set of exif-ifd*
+ * string fields. This is slow for large blocks, so it's only done when
+ * something asks for one of these fields, see header.c.
  */
-int
-vips__exif_parse( VipsImage *image )
+void
+vips__exif_expand( VipsImage *image )
 {
+	int mark = vips__error_mark();
+
 	void *data;
 	size_t length;
 	ExifData *ed;
 	VipsExifParams params;
-	const char *str;
 
-	if( !vips_image_get_typeof( image, VIPS_META_EXIF_NAME ) )
-		return( 0 );
-	if( vips_image_get_blob( image, VIPS_META_EXIF_NAME, &data, &length ) )
-		return( -1 ); 
-	if( !(ed = vips_exif_load_data_without_fix( data, length )) )
-		return( -1 );
+	/* A bad block just means no exif-ifd* fields. Drop any messages we
+	 * made, but not anything the caller has yet to see.
+	 */
+	if( !vips_image_get_typeof( image, VIPS_META_EXIF_NAME ) ||
+		vips_image_get_blob( image,
+			VIPS_META_EXIF_NAME, &data, &length ) ||
+		!(ed = vips_exif_load_data_without_fix( data, length )) ) {
+		vips__error_pop( mark );
+		return;
+	}
 
 #ifdef DEBUG_VERBOSE
 	show_tags( ed );
 	show_values( ed );
 #endif /*DEBUG_VERBOSE*/
 
-	/* Look for resolution fields and use them to set the VIPS xres/yres 
-	 * fields.
-	 *
-	 * If the fields are missing, set them from the image, which will have
-	 * previously had them set from something like JFIF. 
+	/* If the resolution fields are missing, set them from the image,
+	 * which will have previously had them set from something like JFIF.
 	 */
-	if( vips_image_resolution_from_exif( image, ed ) &&
-		vips_exif_resolution_from_image( ed, image ) ) {
-		exif_data_free( ed );
-		return( -1 ); 
-	}
+	if( !vips_exif_has_resolution( ed ) )
+		(void) vips_exif_resolution_from_image( ed, image );
 
 	/* Make sure all required fields are there before we attach the vips
 	 * metadata.
@@ -498,23 +737,7 @@ vips__exif_parse( VipsImage *image )
 	exif_data_foreach_content( ed, 
 		(ExifDataForeachContentFunc) vips_exif_get_content, &params );
 
-	vips_exif_get_thumbnail( image, ed );
 	exif_data_free( ed );
-
-	/* Orientation handling. ifd0 has the Orientation tag for the main
-	 * image. 
-	 */
-	if( vips_image_get_typeof( image, "exif-ifd0-Orientation" ) != 0 &&
-		!vips_image_get_string( image, 
-			"exif-ifd0-Orientation", &str ) ) {
-		int orientation;
-
-		orientation = atoi( str );
-		orientation = VIPS_CLIP( 1, orientation, 8 );
-		vips_image_set_int( image, VIPS_META_ORIENTATION, orientation );
-	}
-
-	return( 0 );
 }
 
 static void
@@ -1046,6 +1269,12 @@ vips_exif_update( ExifData *ed, VipsImage *image )
 
 	VIPS_DEBUG_MSG( "vips_exif_update: \n" );
 
+	/* If the exif-ifd* fields have never been made, they can't have been
+	 * changed, so there's nothing to copy back.
+	 */
+	if( vips__exif_get_pending( image ) )
+		return;
+
 	/* Walk the image and add any exif- that's set in image metadata.
 	 */
 	vips_image_map( image, vips_exif_image_field, ed );
@@ -1155,10 +1384,9 @@ vips__exif_update( VipsImage *image )
 
 #else /*!HAVE_EXIF*/
 
-int
-vips__exif_parse( VipsImage *image )
+void
+vips__exif_expand( VipsImage *image )
 {
-	return( 0 );
 }
 
 int
@@ -33,6 +33,10 @@
  *	  extended filename syntax 
  * 15/4/17
  * 	- skip HDUs with zero dimensions, thanks benepo
+ * 15/10/18
+ * 	- each thread reads with its own cfitsio handle, if cfitsio is
+ * 	  reentrant
+ * 	- read narrow regions with a single fits_read_subset()
  */
 
 /*
@@ -119,6 +123,17 @@ typedef struct {
 
 	GMutex *lock;		/* Lock fits_*() calls with this */
 
+	/* The HDU we are reading, so we can open more handles on it.
+	 */
+	int hdu;
+
+	/* If cfitsio was built reentrant, each sequence reads with its own
+	 * handle on the file. Spare handles wait here, protected by lock. 
+	 * Otherwise, everyone shares fptr and holds lock for each read.
+	 */
+	gboolean reentrant;
+	GSList *handles;
+
 	/* Set this to -1 to read all bands, or a +ve int to read a specific
 	 * band.
 	 */
@@ -129,6 +144,21 @@ typedef struct {
 	VipsPel *buffer;
 } VipsFits;
 
+/* Per-thread read state.
+ */
+typedef struct {
+	VipsFits *fits;
+
+	/* Our own handle, or NULL for the shared one.
+	 */
+	fitsfile *fptr;
+
+	/* Narrow regions are read to here in one go, then copied out.
+	 */
+	VipsPel *buf;
+	size_t buf_size;
+} VipsFitsSequence;
+
 const char *vips__fits_suffs[] = { ".fits", ".fit", ".fts", NULL };
 
 static void
@@ -140,6 +170,17 @@ vips_fits_error( int status )
 	vips_error( "fits", "%s", buf );
 }
 
+static void
+vips_fits_close_handle( fitsfile *fptr )
+{
+	int status;
+
+	status = 0;
+
+	if( fits_close_file( fptr, &status ) ) 
+		vips_fits_error( status );
+}
+
 /* Shut down. Can be called many times.
  */
 static void
@@ -147,17 +188,11 @@ vips_fits_close( VipsFits *fits )
 {
 	VIPS_FREE( fits->filename );
 	VIPS_FREEF( vips_g_mutex_free, fits->lock );
+	VIPS_FREEF( vips_fits_close_handle, fits->fptr );
 
-	if( fits->fptr ) {
-		int status;
-
-		status = 0;
-
-		if( fits_close_file( fits->fptr, &status ) ) 
-			vips_fits_error( status );
-
-		fits->fptr = NULL;
-	}
+	g_slist_free_full( fits->handles, 
+		(GDestroyNotify) vips_fits_close_handle );
+	fits->handles = NULL;
 
 	VIPS_FREE( fits->buffer );
 }
@@ -181,6 +216,9 @@ vips_fits_new_read( const char *filename, VipsImage *out, int band_select )
 	fits->image = out;
 	fits->fptr = NULL;
 	fits->lock = NULL;
+	fits->hdu = 1;
+	fits->reentrant = fits_is_reentrant();
+	fits->handles = NULL;
 	fits->band_select = band_select;
 	fits->buffer = NULL;
 	g_signal_connect( out, "close", 
@@ -244,6 +282,8 @@ vips_fits_get_header( VipsFits *fits, VipsImage *out )
 		}
 	}
 
+	(void) fits_get_hdu_num( fits->fptr, &fits->hdu );
+
 	/* cfitsio does automatic conversion from the format stored in
 	 * the file to the equivalent type after scale/offset. We need 
 	 * to allocate a vips image of the equivalent type, not the original
@@ -382,21 +422,130 @@ vips__fits_read_header( const char *filename, VipsImage *out )
 	return( 0 );
 }
 
+/* Open another handle on the image we are reading.
+ */
+static fitsfile *
+vips_fits_open_handle( VipsFits *fits )
+{
+	fitsfile *fptr;
+	int status;
+
+	status = 0;
+	if( fits_open_diskfile( &fptr, 
+		fits->filename, READONLY, &status ) ) {
+		vips_fits_error( status );
+		return( NULL );
+	}
+
+	if( fits_movabs_hdu( fptr, fits->hdu, NULL, &status ) ) {
+		vips_fits_error( status );
+		vips_fits_close_handle( fptr );
+		return( NULL );
+	}
+
+	return( fptr );
+}
+
+static int
+fits2vips_stop( void *vseq, void *a, void *b )
+{
+	VipsFitsSequence *seq = (VipsFitsSequence *) vseq;
+	VipsFits *fits = seq->fits;
+
+	if( seq->fptr ) {
+		g_mutex_lock( fits->lock );
+		fits->handles = g_slist_prepend( fits->handles, seq->fptr );
+		g_mutex_unlock( fits->lock );
+		seq->fptr = NULL;
+	}
+
+	VIPS_FREE( seq->buf );
+	VIPS_FREE( seq );
+
+	return( 0 );
+}
+
+static void *
+fits2vips_start( VipsImage *out, void *a, void *b )
+{
+	VipsFits *fits = (VipsFits *) a;
+
+	VipsFitsSequence *seq;
+
+	if( !(seq = VIPS_NEW( NULL, VipsFitsSequence )) )
+		return( NULL );
+	seq->fits = fits;
+	seq->fptr = NULL;
+	seq->buf = NULL;
+	seq->buf_size = 0;
+
+	if( fits->reentrant ) {
+		g_mutex_lock( fits->lock );
+		if( fits->handles ) {
+			seq->fptr = (fitsfile *) fits->handles->data;
+			fits->handles = g_slist_delete_link( fits->handles, 
+				fits->handles );
+		}
+		g_mutex_unlock( fits->lock );
+
+		if( !seq->fptr &&
+			!(seq->fptr = vips_fits_open_handle( fits )) ) {
+			fits2vips_stop( seq, a, b );
+			return( NULL );
+		}
+	}
+
+	return( (void *) seq );
+}
+
+/* Read a rect of pixels to a contiguous buffer.
+ */
 static int
-vips_fits_read_subset( VipsFits *fits, 
-	long *fpixel, long *lpixel, long *inc, VipsPel *q )
+vips_fits_read_subset( VipsFitsSequence *seq, VipsRect *r, VipsPel *q )
 {
+	VipsFits *fits = seq->fits;
+
+	long fpixel[MAX_DIMENSIONS];
+	long lpixel[MAX_DIMENSIONS];
+	long inc[MAX_DIMENSIONS];
 	int status;
+	int z;
+
+	for( z = 0; z < MAX_DIMENSIONS; z++ )
+		fpixel[z] = 1;
+	fpixel[0] = r->left + 1;
+	fpixel[1] = r->top + 1;
+	fpixel[2] = fits->band_select + 1;
+
+	for( z = 0; z < MAX_DIMENSIONS; z++ )
+		lpixel[z] = 1;
+	lpixel[0] = VIPS_RECT_RIGHT( r );
+	lpixel[1] = VIPS_RECT_BOTTOM( r );
+	lpixel[2] = fits->band_select + 1;
+
+	for( z = 0; z < MAX_DIMENSIONS; z++ )
+		inc[z] = 1;
 
 	/* We must zero this or fits_read_subset() fails.
 	 */
 	status = 0;
 
+	/* With our own handle, decompress, byteswap and scale can all run
+	 * in parallel.
+	 */
+	if( !seq->fptr )
+		g_mutex_lock( fits->lock );
+
 	/* Break on ffgsv() for this call.
 	 */
-	if( fits_read_subset( fits->fptr, fits->datatype, 
-		fpixel, lpixel, inc, 
-		NULL, q, NULL, &status ) ) {
+	(void) fits_read_subset( seq->fptr ? seq->fptr : fits->fptr, 
+		fits->datatype, fpixel, lpixel, inc, 
+		NULL, q, NULL, &status );
+
+	if( !seq->fptr )
+		g_mutex_unlock( fits->lock );
+
+	if( status ) {
 		vips_fits_error( status );
 		vips_foreign_load_invalidate( fits->image );
 
@@ -408,18 +557,11 @@ vips_fits_read_subset( VipsFits *fits,
 
 static int
 fits2vips_generate( VipsRegion *out, 
-	void *seq, void *a, void *b, gboolean *stop )
+	void *vseq, void *a, void *b, gboolean *stop )
 {
-	VipsFits *fits = (VipsFits *) a;
+	VipsFitsSequence *seq = (VipsFitsSequence *) vseq;
 	VipsRect *r = &out->valid;
 
-	VipsPel *q;
-	int z;
-
-	long fpixel[MAX_DIMENSIONS];
-	long lpixel[MAX_DIMENSIONS];
-	long inc[MAX_DIMENSIONS];
-
 	VIPS_DEBUG_MSG( "fits2vips_generate: "
 		"generating left = %d, top = %d, width = %d, height = %d\n", 
 		r->left, r->top, r->width, r->height );
@@ -430,59 +572,32 @@ fits2vips_generate( VipsRegion *out,
 	if( VIPS_REGION_LSKIP( out ) == VIPS_REGION_SIZEOF_LINE( out ) ) {
 		VIPS_DEBUG_MSG( "fits2vips_generate: block read\n" );
 
-		for( z = 0; z < MAX_DIMENSIONS; z++ )
-			fpixel[z] = 1;
-		fpixel[0] = r->left + 1;
-		fpixel[1] = r->top + 1;
-		fpixel[2] = fits->band_select + 1;
-
-		for( z = 0; z < MAX_DIMENSIONS; z++ )
-			lpixel[z] = 1;
-		lpixel[0] = VIPS_RECT_RIGHT( r );
-		lpixel[1] = VIPS_RECT_BOTTOM( r );
-		lpixel[2] = fits->band_select + 1;
-
-		for( z = 0; z < MAX_DIMENSIONS; z++ )
-			inc[z] = 1;
-
-		q = VIPS_REGION_ADDR( out, r->left, r->top );
-
-		g_mutex_lock( fits->lock );
-		if( vips_fits_read_subset( fits, fpixel, lpixel, inc, q ) ) {
-			g_mutex_unlock( fits->lock );
+		if( vips_fits_read_subset( seq, r, 
+			VIPS_REGION_ADDR( out, r->left, r->top ) ) )
 			return( -1 );
-		}
-		g_mutex_unlock( fits->lock );
 	}
 	else {
-		int y;
-
-		for( y = r->top; y < VIPS_RECT_BOTTOM( r ); y ++ ) {
-			for( z = 0; z < MAX_DIMENSIONS; z++ )
-				fpixel[z] = 1;
-			fpixel[0] = r->left + 1;
-			fpixel[1] = y + 1;
-			fpixel[2] = fits->band_select + 1;
-
-			for( z = 0; z < MAX_DIMENSIONS; z++ )
-				lpixel[z] = 1;
-			lpixel[0] = VIPS_RECT_RIGHT( r );
-			lpixel[1] = y + 1;
-			lpixel[2] = fits->band_select + 1;
-
-			for( z = 0; z < MAX_DIMENSIONS; z++ )
-				inc[z] = 1;
+		size_t line_size = VIPS_REGION_SIZEOF_LINE( out );
+		size_t size = line_size * r->height;
 
-			q = VIPS_REGION_ADDR( out, r->left, y );
+		int y;
 
-			g_mutex_lock( fits->lock );
-			if( vips_fits_read_subset( fits, 
-				fpixel, lpixel, inc, q ) ) { 
-				g_mutex_unlock( fits->lock );
+		/* Rather than a read per line, read the whole rect to our 
+		 * buffer, then copy to the region.
+		 */
+		if( seq->buf_size < size ) {
+			VIPS_FREE( seq->buf );
+			if( !(seq->buf = vips_malloc( NULL, size )) )
 				return( -1 );
-			}
-			g_mutex_unlock( fits->lock );
+			seq->buf_size = size;
 		}
+
+		if( vips_fits_read_subset( seq, r, seq->buf ) )
+			return( -1 );
+
+		for( y = 0; y < r->height; y++ ) 
+			memcpy( VIPS_REGION_ADDR( out, r->left, r->top + y ),
+				seq->buf + y * line_size, line_size );
 	}
 
 	return( 0 );
@@ -501,7 +616,8 @@ fits2vips( const char *filename, VipsImage *out, int band_select )
 		return( -1 );
 	if( vips_fits_get_header( fits, out ) ||
 		vips_image_generate( out, 
-			NULL, fits2vips_generate, NULL, fits, NULL ) ) {
+			fits2vips_start, fits2vips_generate, fits2vips_stop, 
+			fits, NULL ) ) {
 		vips_fits_close( fits );
 		return( -1 );
 	}
@@ -604,6 +720,9 @@ vips_fits_new_write( VipsImage *in, const char *filename )
 	fits->image = in;
 	fits->fptr = NULL;
 	fits->lock = NULL;
+	fits->hdu = 1;
+	fits->reentrant = FALSE;
+	fits->handles = NULL;
 	fits->band_select = -1;
 	fits->buffer = NULL;
 	g_signal_connect( in, "close", 
@@ -24,6 +24,16 @@
  * 	- block _start if one start fails, see #893
  * 1/4/18
  * 	- drop incompatible ICC profiles before save
+ * 14/10/18
+ * 	- pass prefetch hints on to the real image
+ * 	- vips_foreign_find_load() reads the file header once for all loaders,
+ * 	  and caches results by filename and mtime
+ * 	- add vips_foreign_find_load_source(), vips_foreign_find_save_target()
+ * 	- note the memory a lazy load will need for the pipeline budget
+ * 	- add vips_foreign_load_set_limits(), checked after the header read
+ * 	- make the load quark in class_init, packages are now lazy
+ * 15/10/18
+ * 	- add vips_foreign_probe() and the ->header_filename() class member
  */
 
 /*
@@ -64,6 +74,9 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #include <vips/vips.h>
 #include <vips/internal.h>
@@ -418,6 +431,10 @@ vips_foreign_map( const char *base, VipsSListMap2Fn fn, void *a, void *b )
 	GSList *files;
 	void *result;
 
+	/* @base won't exist until the foreign package is registered.
+	 */
+	vips_operation_init_all();
+
 	files = NULL;
 	(void) vips_class_map_all( g_type_from_name( base ), 
 		(VipsClassMapFn) file_add_class, (void *) &files );
@@ -457,6 +474,8 @@ vips_foreign_load_summary_class( VipsObjectClass *object_class, VipsBuf *buf )
 			vips_buf_appends( buf, ", is_a" );
 		if( class->is_a_buffer )
 			vips_buf_appends( buf, ", is_a_buffer" );
+		if( class->is_a_source )
+			vips_buf_appends( buf, ", is_a_source" );
 		if( class->get_flags )
 			vips_buf_appends( buf, ", get_flags" );
 		if( class->get_flags_filename )
@@ -505,6 +524,112 @@ vips_foreign_find_load_sub( VipsForeignLoadClass *load_class,
 	return( NULL );
 }
 
+/* Read this much of a file for the is_a() sniffers to share.
+ */
+#define VIPS_FOREIGN_SNIFF_SIZE (4096)
+
+/* Remember this many sniff results.
+ */
+#define VIPS_FOREIGN_SNIFF_MAX (1000)
+
+/* A remembered sniff result. We only reuse it if the file looks unchanged.
+ */
+typedef struct _VipsForeignSniff {
+	gint64 mtime;
+	gint64 size;
+	gint64 ino;
+
+	/* The loader we picked, a class name, so it's never freed.
+	 */
+	const char *loader;
+} VipsForeignSniff;
+
+static GMutex *vips_foreign_sniff_lock = NULL;
+
+/* Index by filename.
+ */
+static GHashTable *vips_foreign_sniff_table = NULL;
+
+static void *
+vips_foreign_sniff_init_cb( void *data )
+{
+	vips_foreign_sniff_lock = vips_g_mutex_new();
+	vips_foreign_sniff_table = g_hash_table_new_full(
+		g_str_hash, g_str_equal, g_free, g_free );
+
+	return( NULL );
+}
+
+/* Fill the stamp fields of @sniff from the file, or return -1.
+ */
+static int
+vips_foreign_sniff_stat( const char *filename, VipsForeignSniff *sniff )
+{
+#ifdef OS_WIN32
+	struct _stati64 st;
+
+	if( _stati64( filename, &st ) == -1 )
+		return( -1 );
+#else /*!OS_WIN32*/
+	struct stat st;
+
+	if( stat( filename, &st ) == -1 )
+		return( -1 );
+#endif /*OS_WIN32*/
+
+	sniff->mtime = st.st_mtime;
+	sniff->size = st.st_size;
+	sniff->ino = st.st_ino;
+
+	return( 0 );
+}
+
+static const char *
+vips_foreign_sniff_lookup( const char *filename, VipsForeignSniff *stamp )
+{
+	static GOnce once = G_ONCE_INIT;
+
+	VipsForeignSniff *sniff;
+	const char *loader;
+
+	VIPS_ONCE( &once, vips_foreign_sniff_init_cb, NULL );
+
+	loader = NULL;
+
+	g_mutex_lock( vips_foreign_sniff_lock );
+	if( (sniff = g_hash_table_lookup( vips_foreign_sniff_table,
+		filename )) &&
+		sniff->mtime == stamp->mtime &&
+		sniff->size == stamp->size &&
+		sniff->ino == stamp->ino )
+		loader = sniff->loader;
+	g_mutex_unlock( vips_foreign_sniff_lock );
+
+	return( loader );
+}
+
+static void
+vips_foreign_sniff_remember( const char *filename, VipsForeignSniff *stamp )
+{
+	VipsForeignSniff *sniff;
+
+	sniff = g_new( VipsForeignSniff, 1 );
+	*sniff = *stamp;
+
+	g_mutex_lock( vips_foreign_sniff_lock );
+
+	/* Simple but effective: we just forget everything when we fill up.
+	 */
+	if( g_hash_table_size( vips_foreign_sniff_table ) >=
+		VIPS_FOREIGN_SNIFF_MAX )
+		g_hash_table_remove_all( vips_foreign_sniff_table );
+
+	g_hash_table_replace( vips_foreign_sniff_table,
+		g_strdup( filename ), sniff );
+
+	g_mutex_unlock( vips_foreign_sniff_lock );
+}
+
 /**
  * vips_foreign_find_load:
  * @filename: file to find a loader for
@@ -512,6 +637,10 @@ vips_foreign_find_load_sub( VipsForeignLoadClass *load_class,
  * Searches for an operation you could use to load @filename. Any trailing
  * options on @filename are stripped and ignored. 
  *
+ * The start of the file is read just once and shared between the
+ * loaders as they test it. The result is remembered, and reused if @filename
+ * has the same modification time, size and inode next time.
+ *
  * See also: vips_foreign_find_load_buffer(), vips_image_new_from_file().
  *
  * Returns: the name of an operation on success, %NULL on error
@@ -521,6 +650,10 @@ vips_foreign_find_load( const char *name )
 {
 	char filename[VIPS_PATH_MAX];
 	char option_string[VIPS_PATH_MAX];
+	VipsForeignSniff stamp;
+	gboolean stamped;
+	unsigned char header[VIPS_FOREIGN_SNIFF_SIZE];
+	guint64 length;
 	VipsForeignLoadClass *load_class;
 
 	vips__filename_split8( name, filename, option_string );
@@ -531,10 +664,27 @@ vips_foreign_find_load( const char *name )
 		return( NULL );
 	}
 
-	if( !(load_class = (VipsForeignLoadClass *) vips_foreign_map( 
+	stamped = !vips_foreign_sniff_stat( filename, &stamp );
+	if( stamped &&
+		(stamp.loader = vips_foreign_sniff_lookup( filename, &stamp )) )
+		return( stamp.loader );
+
+	/* Most is_a() methods sniff with vips__get_bytes(), so this saves
+	 * opening and reading the file once per loader.
+	 */
+	if( (length = vips__get_bytes( filename,
+		header, VIPS_FOREIGN_SNIFF_SIZE )) > 0 )
+		vips__get_bytes_preload( filename, header, length,
+			length < VIPS_FOREIGN_SNIFF_SIZE );
+
+	load_class = (VipsForeignLoadClass *) vips_foreign_map(
 		"VipsForeignLoad",
 		(VipsSListMap2Fn) vips_foreign_find_load_sub, 
-		(void *) filename, NULL )) ) {
+		(void *) filename, NULL );
+
+	vips__get_bytes_preload( NULL, NULL, 0, FALSE );
+
+	if( !load_class ) {
 		vips_error( "VipsForeignLoad", 
 			_( "\"%s\" is not a known file format" ), name );
 		return( NULL );
@@ -545,6 +695,11 @@ vips_foreign_find_load( const char *name )
 		VIPS_OBJECT_CLASS( load_class )->nickname );
 #endif /*DEBUG*/
 
+	if( stamped ) {
+		stamp.loader = G_OBJECT_CLASS_NAME( load_class );
+		vips_foreign_sniff_remember( filename, &stamp );
+	}
+
 	return( G_OBJECT_CLASS_NAME( load_class ) );
 }
 
@@ -619,6 +774,50 @@ vips_foreign_find_load_buffer( const void *data, size_t size )
 	return( G_OBJECT_CLASS_NAME( load_class ) );
 }
 
+/* Can this VipsForeign open this source?
+ */
+static void *
+vips_foreign_find_load_source_sub( VipsForeignLoadClass *load_class,
+	VipsSource *source )
+{
+	if( load_class->is_a_source &&
+		load_class->is_a_source( source ) )
+		return( load_class );
+
+	return( NULL );
+}
+
+/**
+ * vips_foreign_find_load_source:
+ * @source: (transfer none): source to load from
+ *
+ * Searches for an operation you could use to load a source. To see the
+ * range of source loaders supported by your vips, try something like:
+ *
+ * 	vips -l | grep load_source
+ *
+ * See also: vips_image_new_from_source().
+ *
+ * Returns: (transfer none): the name of an operation on success, %NULL on
+ * error.
+ */
+const char *
+vips_foreign_find_load_source( VipsSource *source )
+{
+	VipsForeignLoadClass *load_class;
+
+	if( !(load_class = (VipsForeignLoadClass *) vips_foreign_map(
+		"VipsForeignLoad",
+		(VipsSListMap2Fn) vips_foreign_find_load_source_sub,
+		source, NULL )) ) {
+		vips_error( "VipsForeignLoad",
+			"%s", _( "source is not in a known format" ) );
+		return( NULL );
+	}
+
+	return( G_OBJECT_CLASS_NAME( load_class ) );
+}
+
 /**
  * vips_foreign_is_a:
  * @loader: name of loader to use for test
@@ -698,6 +897,95 @@ vips_foreign_flags( const char *loader, const char *filename )
 	return( 0 );
 }
 
+/* Build the loader outside the operation cache. This reads the header and 
+ * sets up the lazy load, but decodes no pixels.
+ */
+static VipsImage *
+vips_foreign_probe_build( const char *loader, const char *filename )
+{
+	VipsObject *load;
+	VipsImage *out;
+
+	load = VIPS_OBJECT( g_object_new( g_type_from_name( loader ), NULL ) );
+	g_object_set( load, "filename", filename, NULL ); 
+	if( vips_object_build( load ) ) {
+		vips_object_unref_outputs( load );
+		g_object_unref( load );
+		return( NULL );
+	}
+
+	g_object_get( load, "out", &out, NULL );
+	vips_object_unref_outputs( load );
+	g_object_unref( load );
+
+	return( out );
+}
+
+/**
+ * vips_foreign_probe:
+ * @filename: file to probe
+ * @probe: (out): return the image basics here
+ *
+ * Read the width, height, number of bands, band format and orientation of
+ * @filename as cheaply as possible. Any trailing options on @filename are
+ * stripped and ignored. 
+ *
+ * The loader is picked with vips_foreign_find_load(), so the start of the 
+ * file is read only once. If the loader has a ->header_filename() method, 
+ * that is used to read the header directly, otherwise the loader is built 
+ * outside the operation cache. In neither case are any pixels decoded.
+ *
+ * Orientation is the EXIF-style value from #VIPS_META_ORIENTATION, or 1 if
+ * the file has none. 
+ *
+ * This is safe to call from many threads at once.
+ *
+ * See also: vips_foreign_find_load(), vips_image_new_from_file().
+ *
+ * Returns: 0 on success, -1 on error.
+ */
+int
+vips_foreign_probe( const char *name, VipsForeignProbe *probe )
+{
+	char filename[VIPS_PATH_MAX];
+	char option_string[VIPS_PATH_MAX];
+	const char *loader;
+	const VipsObjectClass *class;
+	VipsForeignLoadClass *load_class;
+	VipsImage *out;
+
+	vips__filename_split8( name, filename, option_string );
+	if( !(loader = vips_foreign_find_load( filename )) ||
+		!(class = vips_class_find( "VipsForeignLoad", loader )) )
+		return( -1 );
+	load_class = VIPS_FOREIGN_LOAD_CLASS( class );
+
+	if( load_class->header_filename ) {
+		out = vips_image_new();
+		if( load_class->header_filename( filename, out ) ) {
+			g_object_unref( out );
+			return( -1 );
+		}
+	}
+	else if( !(out = vips_foreign_probe_build( loader, filename )) )
+		return( -1 );
+
+	probe->loader = class->nickname;
+	probe->width = out->Xsize;
+	probe->height = out->Ysize;
+	probe->bands = out->Bands;
+	probe->format = out->BandFmt;
+	probe->orientation = 1;
+	if( vips_image_get_typeof( out, VIPS_META_ORIENTATION ) == 
+		G_TYPE_INT ) 
+		(void) vips_image_get_int( out, 
+			VIPS_META_ORIENTATION, &probe->orientation );
+
+	g_object_unref( out );
+
+	return( 0 );
+}
+
 static VipsObject *
 vips_foreign_load_new_from_string( const char *string )
 {
@@ -883,6 +1171,128 @@ vips_foreign_load_generate( VipsRegion *or,
         return( 0 );
 }
 
+/* Pass prefetch hints on to the real image, if we've made it.
+ */
+static void
+vips_foreign_load_prefetch( VipsImage *image, const VipsRect *r, void *a )
+{
+	VipsForeignLoad *load = (VipsForeignLoad *) a;
+	VipsImage *real;
+
+	if( (real = g_atomic_pointer_get( &load->real )) )
+		vips__image_prefetch( real, r );
+}
+
+/* Limits on what a load may produce, 0 for no limit.
+ */
+static guint64 vips__load_max_pixels = 0;
+static int vips__load_max_pages = 0;
+static guint64 vips__load_max_bytes = 0;
+
+/**
+ * vips_foreign_load_set_limits:
+ * @max_pixels: largest number of pixels a load may make, or 0 for no limit
+ * @max_pages: largest number of pages or frames a load may make, or 0
+ * @max_bytes: largest decompressed size in bytes, or 0 for no limit
+ *
+ * Set limits on the images that loaders can make. After a loader has read
+ * the header, the image size, the number of pages (see
+ * #VIPS_META_PAGE_HEIGHT) and the decompressed size in bytes are checked
+ * against these limits, and the load fails if any is over. This happens
+ * before any pixels are decoded, so a small file which declares a huge
+ * image, or an animation with a huge number of frames, will fail quickly
+ * rather than trying to allocate memory for the whole thing.
+ *
+ * Loaders which decode everything during the header read, such as
+ * csvload and matrixload, are only checked afterwards.
+ *
+ * This is useful for services which must load untrusted images. The
+ * limits are global and default to none. You can also set them with the
+ * environment variables VIPS_LOAD_MAX_PIXELS, VIPS_LOAD_MAX_PAGES and
+ * VIPS_LOAD_MAX_BYTES, or the command-line flags --vips-load-max-pixels,
+ * --vips-load-max-pages and --vips-load-max-bytes.
+ *
+ * See also: vips_foreign_load_get_limits().
+ */
+void
+vips_foreign_load_set_limits( guint64 max_pixels,
+	int max_pages, guint64 max_bytes )
+{
+	vips__load_max_pixels = max_pixels;
+	vips__load_max_pages = VIPS_MAX( 0, max_pages );
+	vips__load_max_bytes = max_bytes;
+}
+
+/**
+ * vips_foreign_load_get_limits:
+ * @max_pixels: (out) (allow-none): return the pixel limit here
+ * @max_pages: (out) (allow-none): return the page limit here
+ * @max_bytes: (out) (allow-none): return the byte limit here
+ *
+ * Get the limits set by vips_foreign_load_set_limits(). 0 means no limit.
+ */
+void
+vips_foreign_load_get_limits( guint64 *max_pixels,
+	int *max_pages, guint64 *max_bytes )
+{
+	if( max_pixels )
+		*max_pixels = vips__load_max_pixels;
+	if( max_pages )
+		*max_pages = vips__load_max_pages;
+	if( max_bytes )
+		*max_bytes = vips__load_max_bytes;
+}
+
+/* Check the header we've read against the load limits.
+ */
+static int
+vips_foreign_load_check_limits( VipsForeignLoad *load )
+{
+	VipsObjectClass *class = VIPS_OBJECT_GET_CLASS( load );
+	VipsImage *out = load->out;
+	guint64 pixels = (guint64) out->Xsize * out->Ysize;
+	guint64 bytes = VIPS_IMAGE_SIZEOF_IMAGE( out );
+
+	int page_height;
+	int pages;
+
+	page_height = 0;
+	if( vips_image_get_typeof( out, VIPS_META_PAGE_HEIGHT ) &&
+		vips_image_get_int( out, VIPS_META_PAGE_HEIGHT, &page_height ) )
+		return( -1 );
+	pages = page_height > 0 &&
+		out->Ysize % page_height == 0 ?
+			out->Ysize / page_height : 1;
+
+	if( vips__load_max_pixels &&
+		pixels > vips__load_max_pixels ) {
+		vips_error( class->nickname,
+			_( "image of %d x %d pixels is over the load limit "
+				"of %" G_GUINT64_FORMAT " pixels" ),
+			out->Xsize, out->Ysize, vips__load_max_pixels );
+		return( -1 );
+	}
+
+	if( vips__load_max_pages &&
+		pages > vips__load_max_pages ) {
+		vips_error( class->nickname,
+			_( "%d pages is over the load limit of %d pages" ),
+			pages, vips__load_max_pages );
+		return( -1 );
+	}
+
+	if( vips__load_max_bytes &&
+		bytes > vips__load_max_bytes ) {
+		vips_error( class->nickname,
+			_( "image of %" G_GUINT64_FORMAT " bytes is over the "
+				"load limit of %" G_GUINT64_FORMAT " bytes" ),
+			bytes, vips__load_max_bytes );
+		return( -1 );
+	}
+
+	return( 0 );
+}
+
 static int
 vips_foreign_load_build( VipsObject *object )
 {
@@ -945,6 +1355,11 @@ vips_foreign_load_build( VipsObject *object )
 		fclass->header( load ) ) 
 		return( -1 );
 
+	/* Before we allocate anything for the pixels.
+	 */
+	if( vips_foreign_load_check_limits( load ) )
+		return( -1 );
+
 	/* If there's no ->load() method then the header read has done
 	 * everything. Otherwise, it's just set fields and we must also
 	 * load pixels.
@@ -971,6 +1386,21 @@ vips_foreign_load_build( VipsObject *object )
 			vips_stop_one, 
 			NULL, load ) ) 
 			return( -1 );
+		vips_image_set_prefetch( load->out, 
+			vips_foreign_load_prefetch, load );
+
+		/* If the lazy load will decode to memory, tell the
+		 * pipeline memory budget. This is the same test as in
+		 * vips_foreign_load_temp().
+		 */
+		if( !(load->flags & VIPS_FOREIGN_PARTIAL) &&
+			!sequential &&
+			(load->memory ||
+			 !load->disc ||
+			 VIPS_IMAGE_SIZEOF_IMAGE( load->out ) <=
+			 	vips_get_disc_threshold()) )
+			vips__image_set_mem_hint( load->out,
+				VIPS_IMAGE_SIZEOF_IMAGE( load->out ) );
 	}
 
 	/* Tell downstream if we are reading sequentially.
@@ -1008,6 +1438,12 @@ vips_foreign_load_class_init( VipsForeignLoadClass *class )
 	gobject_class->set_property = vips_object_set_property;
 	gobject_class->get_property = vips_object_get_property;
 
+	/* Packages are registered on first use, so we can't make this in
+	 * vips_foreign_operation_init().
+	 */
+	vips__foreign_load_operation =
+		g_quark_from_static_string( "vips-foreign-load-operation" );
+
 	object_class->build = vips_foreign_load_build;
 	object_class->summary_class = vips_foreign_load_summary_class;
 	object_class->new_from_string = vips_foreign_load_new_from_string;
@@ -1651,12 +2087,14 @@ static void *
 vips_foreign_find_save_sub( VipsForeignSaveClass *save_class, 
 	const char *filename )
 {
+	VipsObjectClass *object_class = VIPS_OBJECT_CLASS( save_class );
 	VipsForeignClass *class = VIPS_FOREIGN_CLASS( save_class );
 
 	/* The suffs might be defined on an abstract base class, make sure we
-	 * don't pick that.
+	 * don't pick that. Target savers can't save to a filename.
 	 */
 	if( !G_TYPE_IS_ABSTRACT( G_TYPE_FROM_CLASS( class ) ) &&
+		!vips_ispostfix( object_class->nickname, "_target" ) &&
 		class->suffs &&
 		vips_filename_suffix_match( filename, class->suffs ) )
 		return( save_class );
@@ -1772,6 +2210,56 @@ vips_foreign_find_save_buffer( const char *name )
 	return( G_OBJECT_CLASS_NAME( save_class ) );
 }
 
+/* Can we write this target with this file type?
+ */
+static void *
+vips_foreign_find_save_target_sub( VipsForeignSaveClass *save_class,
+	const char *suffix )
+{
+	VipsObjectClass *object_class = VIPS_OBJECT_CLASS( save_class );
+	VipsForeignClass *class = VIPS_FOREIGN_CLASS( save_class );
+
+	if( class->suffs &&
+		vips_ispostfix( object_class->nickname, "_target" ) &&
+		vips_filename_suffix_match( suffix, class->suffs ) )
+		return( save_class );
+
+	return( NULL );
+}
+
+/**
+ * vips_foreign_find_save_target:
+ * @suffix: format to find a saver for
+ *
+ * Searches for an operation you could use to write to a target in @suffix
+ * format.
+ *
+ * See also: vips_image_write_to_target().
+ *
+ * Returns: the name of an operation on success, %NULL on error
+ */
+const char *
+vips_foreign_find_save_target( const char *name )
+{
+	char suffix[VIPS_PATH_MAX];
+	char option_string[VIPS_PATH_MAX];
+	VipsForeignSaveClass *save_class;
+
+	vips__filename_split8( name, suffix, option_string );
+
+	if( !(save_class = (VipsForeignSaveClass *) vips_foreign_map(
+		"VipsForeignSave",
+		(VipsSListMap2Fn) vips_foreign_find_save_target_sub,
+		(void *) suffix, NULL )) ) {
+		vips_error( "VipsForeignSave",
+			_( "\"%s\" is not a known target format" ), name );
+
+		return( NULL );
+	}
+
+	return( G_OBJECT_CLASS_NAME( save_class ) );
+}
+
 /* Called from iofuncs to init all operations in this dir. Use a plugin system
  * instead?
  */
@@ -1786,8 +2274,10 @@ vips_foreign_operation_init( void )
 	extern GType vips_foreign_save_ppm_get_type( void ); 
 	extern GType vips_foreign_load_png_get_type( void ); 
 	extern GType vips_foreign_load_png_buffer_get_type( void ); 
+	extern GType vips_foreign_load_png_source_get_type( void );
 	extern GType vips_foreign_save_png_file_get_type( void ); 
 	extern GType vips_foreign_save_png_buffer_get_type( void ); 
+	extern GType vips_foreign_save_png_target_get_type( void );
 	extern GType vips_foreign_load_csv_get_type( void ); 
 	extern GType vips_foreign_save_csv_get_type( void ); 
 	extern GType vips_foreign_load_matrix_get_type( void ); 
@@ -1800,13 +2290,18 @@ vips_foreign_operation_init( void )
 	extern GType vips_foreign_load_openslide_get_type( void ); 
 	extern GType vips_foreign_load_jpeg_file_get_type( void ); 
 	extern GType vips_foreign_load_jpeg_buffer_get_type( void ); 
+	extern GType vips_foreign_load_jpeg_source_get_type( void );
 	extern GType vips_foreign_save_jpeg_file_get_type( void ); 
 	extern GType vips_foreign_save_jpeg_buffer_get_type( void ); 
+	extern GType vips_foreign_save_jpeg_target_get_type( void );
 	extern GType vips_foreign_save_jpeg_mime_get_type( void ); 
+	extern GType vips_foreign_jpeg_transform_get_type( void );
 	extern GType vips_foreign_load_tiff_file_get_type( void ); 
 	extern GType vips_foreign_load_tiff_buffer_get_type( void ); 
+	extern GType vips_foreign_load_tiff_source_get_type( void );
 	extern GType vips_foreign_save_tiff_file_get_type( void ); 
 	extern GType vips_foreign_save_tiff_buffer_get_type( void ); 
+	extern GType vips_foreign_save_tiff_target_get_type( void );
 	extern GType vips_foreign_load_vips_get_type( void ); 
 	extern GType vips_foreign_save_vips_get_type( void ); 
 	extern GType vips_foreign_load_raw_get_type( void ); 
@@ -1822,8 +2317,10 @@ vips_foreign_operation_init( void )
 	extern GType vips_foreign_save_dz_buffer_get_type( void ); 
 	extern GType vips_foreign_load_webp_file_get_type( void ); 
 	extern GType vips_foreign_load_webp_buffer_get_type( void ); 
+	extern GType vips_foreign_load_webp_source_get_type( void );
 	extern GType vips_foreign_save_webp_file_get_type( void ); 
 	extern GType vips_foreign_save_webp_buffer_get_type( void ); 
+	extern GType vips_foreign_save_webp_target_get_type( void );
 	extern GType vips_foreign_load_pdf_get_type( void ); 
 	extern GType vips_foreign_load_pdf_file_get_type( void ); 
 	extern GType vips_foreign_load_pdf_buffer_get_type( void ); 
@@ -1833,6 +2330,9 @@ vips_foreign_operation_init( void )
 	extern GType vips_foreign_load_gif_get_type( void ); 
 	extern GType vips_foreign_load_gif_file_get_type( void ); 
 	extern GType vips_foreign_load_gif_buffer_get_type( void ); 
+	extern GType vips_foreign_save_gif_file_get_type( void );
+	extern GType vips_foreign_save_gif_buffer_get_type( void );
+	extern GType vips_foreign_save_gif_target_get_type( void );
 
 	vips_foreign_load_csv_get_type(); 
 	vips_foreign_save_csv_get_type(); 
@@ -1844,6 +2344,9 @@ vips_foreign_operation_init( void )
 	vips_foreign_save_raw_fd_get_type(); 
 	vips_foreign_load_vips_get_type(); 
 	vips_foreign_save_vips_get_type(); 
+	vips_foreign_save_gif_file_get_type();
+	vips_foreign_save_gif_buffer_get_type();
+	vips_foreign_save_gif_target_get_type();
 
 #ifdef HAVE_ANALYZE
 	vips_foreign_load_analyze_get_type(); 
@@ -1892,8 +2395,10 @@ vips_foreign_operation_init( void )
 #ifdef HAVE_PNG
 	vips_foreign_load_png_get_type(); 
 	vips_foreign_load_png_buffer_get_type(); 
+	vips_foreign_load_png_source_get_type();
 	vips_foreign_save_png_file_get_type(); 
 	vips_foreign_save_png_buffer_get_type(); 
+	vips_foreign_save_png_target_get_type();
 #endif /*HAVE_PNG*/
 
 #ifdef HAVE_MATIO
@@ -1903,23 +2408,30 @@ vips_foreign_operation_init( void )
 #ifdef HAVE_JPEG
 	vips_foreign_load_jpeg_file_get_type(); 
 	vips_foreign_load_jpeg_buffer_get_type(); 
+	vips_foreign_load_jpeg_source_get_type();
 	vips_foreign_save_jpeg_file_get_type(); 
 	vips_foreign_save_jpeg_buffer_get_type(); 
+	vips_foreign_save_jpeg_target_get_type();
 	vips_foreign_save_jpeg_mime_get_type(); 
+	vips_foreign_jpeg_transform_get_type();
 #endif /*HAVE_JPEG*/
 
 #ifdef HAVE_LIBWEBP
 	vips_foreign_load_webp_file_get_type(); 
 	vips_foreign_load_webp_buffer_get_type(); 
+	vips_foreign_load_webp_source_get_type();
 	vips_foreign_save_webp_file_get_type(); 
 	vips_foreign_save_webp_buffer_get_type(); 
+	vips_foreign_save_webp_target_get_type();
 #endif /*HAVE_LIBWEBP*/
 
 #ifdef HAVE_TIFF
 	vips_foreign_load_tiff_file_get_type(); 
 	vips_foreign_load_tiff_buffer_get_type(); 
+	vips_foreign_load_tiff_source_get_type();
 	vips_foreign_save_tiff_file_get_type(); 
 	vips_foreign_save_tiff_buffer_get_type(); 
+	vips_foreign_save_tiff_target_get_type();
 #endif /*HAVE_TIFF*/
 
 #ifdef HAVE_OPENSLIDE
@@ -1952,6 +2464,4 @@ vips_foreign_operation_init( void )
 	vips_foreign_load_openexr_get_type(); 
 #endif /*HAVE_OPENEXR*/
 
-	vips__foreign_load_operation = 
-		g_quark_from_static_string( "vips-foreign-load-operation" ); 
 }
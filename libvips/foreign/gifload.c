@@ -18,6 +18,9 @@
  * 21/11/17
  * 	- add "gif-delay", "gif-loop", "gif-comment" metadata
  * 	- add dispose handling
+ * 14/10/18
+ * 	- add @shrink
+ * 	- only decompress frames back from the last key frame before @page
  */
 
 /*
@@ -102,12 +105,21 @@ typedef struct _VipsForeignLoadGif {
 	 */
 	int n;
 
+	/* Shrink by this much during load.
+	 */
+	int shrink;
+
 	GifFileType *file;
 
 	/* The current read position, in pages.
 	 */
 	int current_page;
 
+	/* Frames before this are stepped over without decompressing. See
+	 * vips_foreign_load_gif_scan().
+	 */
+	int first_frame;
+
 	/* Set for EOF detected.
 	 */
 	gboolean eof;
@@ -154,7 +166,13 @@ typedef struct _VipsForeignLoadGif {
 
 } VipsForeignLoadGif;
 
-typedef VipsForeignLoadClass VipsForeignLoadGifClass;
+typedef struct _VipsForeignLoadGifClass {
+	VipsForeignLoadClass parent_class;
+
+	/* Close and reopen gif->file at the start of the input.
+	 */
+	int (*open)( VipsForeignLoadGif *gif );
+} VipsForeignLoadGifClass;
 
 G_DEFINE_ABSTRACT_TYPE( VipsForeignLoadGif, vips_foreign_load_gif, 
 	VIPS_TYPE_FOREIGN_LOAD );
@@ -390,16 +408,18 @@ vips_foreign_load_gif_is_a( const char *filename )
 	return( 0 );
 }
 
+/* Render every @step pixel of @p to @q.
+ */
 static void
 vips_foreign_load_gif_render_line( VipsForeignLoadGif *gif,
-	int width, VipsPel * restrict q, VipsPel * restrict p )
+	int width, int step, VipsPel * restrict q, VipsPel * restrict p )
 {
 	ColorMapObject *map = gif->file->Image.ColorMap ?
 		gif->file->Image.ColorMap : gif->file->SColorMap;
 
 	int x;
 
-	for( x = 0; x < width; x++ ) {
+	for( x = 0; x < width; x += step ) {
 		VipsPel v = p[x];
 		
 		if( map &&
@@ -436,12 +456,36 @@ vips_foreign_load_gif_render_line( VipsForeignLoadGif *gif,
 	}
 }
 
-/* Render the current gif frame into an RGBA buffer. GIFs can accumulate, 
- * depending on the current dispose mode.
+/* Render line y of the current frame, if it's on our shrink grid. We keep
+ * pixels at multiples of shrink, so pixels are independent and GIF
+ * accumulation still works.
+ */
+static void
+vips_foreign_load_gif_render_shrink( VipsForeignLoadGif *gif,
+	VipsImage *out, int y )
+{
+	GifFileType *file = gif->file;
+	const int shrink = gif->shrink;
+	const int top = file->Image.Top + y;
+	const int left = file->Image.Left;
+
+	/* The first pixel of the line on the grid.
+	 */
+	const int x0 = (shrink - left % shrink) % shrink;
+
+	if( top % shrink == 0 &&
+		x0 < file->Image.Width )
+		vips_foreign_load_gif_render_line( gif,
+			file->Image.Width - x0, shrink,
+			VIPS_IMAGE_ADDR( out,
+				(left + x0) / shrink, top / shrink ),
+			gif->line + x0 );
+}
+
+/* Check the current frame, and note whether it adds colour.
  */
 static int
-vips_foreign_load_gif_render( VipsForeignLoadGif *gif, 
-	VipsImage *previous, VipsImage *out )
+vips_foreign_load_gif_check_frame( VipsForeignLoadGif *gif )
 {
 	VipsObjectClass *class = VIPS_OBJECT_GET_CLASS( gif );
 	GifFileType *file = gif->file;
@@ -451,9 +495,9 @@ vips_foreign_load_gif_render( VipsForeignLoadGif *gif,
 	/* Check that the frame lies within our image.
 	 */
 	if( file->Image.Left < 0 ||
-		file->Image.Left + file->Image.Width > out->Xsize ||
+		file->Image.Left + file->Image.Width > file->SWidth ||
 		file->Image.Top < 0 ||
-		file->Image.Top + file->Image.Height > out->Ysize ) {
+		file->Image.Top + file->Image.Height > file->SHeight ) {
 		vips_error( class->nickname, 
 			"%s", _( "frame is outside image area" ) ); 
 		return( -1 ); 
@@ -474,6 +518,21 @@ vips_foreign_load_gif_render( VipsForeignLoadGif *gif,
 			}
 	}
 
+	return( 0 );
+}
+
+/* Render the current gif frame into an RGBA buffer. GIFs can accumulate,
+ * depending on the current dispose mode.
+ */
+static int
+vips_foreign_load_gif_render( VipsForeignLoadGif *gif,
+	VipsImage *previous, VipsImage *out )
+{
+	GifFileType *file = gif->file;
+
+	if( vips_foreign_load_gif_check_frame( gif ) )
+		return( -1 );
+
 	/* We need a line buffer to decompress to.
 	 */
 	if( !gif->line ) 
@@ -495,17 +554,14 @@ vips_foreign_load_gif_render( VipsForeignLoadGif *gif,
 			for( y = InterlacedOffset[i]; 
 				y < file->Image.Height;
 			  	y += InterlacedJumps[i] ) {
-				VipsPel *q = VIPS_IMAGE_ADDR( out, 
-					file->Image.Left, file->Image.Top + y );
-
 				if( DGifGetLine( gif->file, gif->line, 
 					file->Image.Width ) == GIF_ERROR ) {
 					vips_foreign_load_gif_error( gif ); 
 					return( -1 ); 
 				}
 
-				vips_foreign_load_gif_render_line( gif, 
-					file->Image.Width, q, gif->line ); 
+				vips_foreign_load_gif_render_shrink( gif,
+					out, y );
 			}
 		}
 	}
@@ -518,23 +574,62 @@ vips_foreign_load_gif_render( VipsForeignLoadGif *gif,
 			file->Image.Left, file->Image.Top ); 
 
 		for( y = 0; y < file->Image.Height; y++ ) {
-			VipsPel *q = VIPS_IMAGE_ADDR( out, 
-				file->Image.Left, file->Image.Top + y );
-
 			if( DGifGetLine( gif->file, gif->line, 
 				file->Image.Width ) == GIF_ERROR ) {
 				vips_foreign_load_gif_error( gif ); 
 				return( -1 ); 
 			}
 
-			vips_foreign_load_gif_render_line( gif, 
-				file->Image.Width, q, gif->line ); 
+			vips_foreign_load_gif_render_shrink( gif, out, y );
 		}
 	}
 
 	return( 0 );
 }
 
+/* Step over the compressed pixels of the current frame. This is much
+ * quicker than decompressing them.
+ */
+static int
+vips_foreign_load_gif_skip( VipsForeignLoadGif *gif )
+{
+	int code_size;
+	GifByteType *block;
+
+	if( vips_foreign_load_gif_check_frame( gif ) )
+		return( -1 );
+
+	if( DGifGetCode( gif->file, &code_size, &block ) == GIF_ERROR ) {
+		vips_foreign_load_gif_error( gif );
+		return( -1 );
+	}
+
+	while( block )
+		if( DGifGetCodeNext( gif->file, &block ) == GIF_ERROR ) {
+			vips_foreign_load_gif_error( gif );
+			return( -1 );
+		}
+
+	return( 0 );
+}
+
+/* After rendering, a frame which covers the whole screen, and which has no
+ * pixels that let the previous frame show through, no longer depends on
+ * earlier frames.
+ */
+static gboolean
+vips_foreign_load_gif_is_key( VipsForeignLoadGif *gif )
+{
+	GifFileType *file = gif->file;
+
+	return( file->Image.Left == 0 &&
+		file->Image.Top == 0 &&
+		file->Image.Width == file->SWidth &&
+		file->Image.Height == file->SHeight &&
+		(gif->transparency == -1 ||
+		 gif->dispose != DISPOSE_DO_NOT) );
+}
+
 static int
 vips_foreign_load_gif_extension_next( VipsForeignLoadGif *gif,
 	GifByteType **extension )
@@ -716,7 +811,12 @@ vips_foreign_load_gif_page( VipsForeignLoadGif *gif,
 				return( -1 ); 
 			}
 
-			if( vips_foreign_load_gif_render( gif, previous, out ) )
+			if( gif->current_page < gif->first_frame ) {
+				if( vips_foreign_load_gif_skip( gif ) )
+					return( -1 );
+			}
+			else if( vips_foreign_load_gif_render( gif,
+				previous, out ) )
 				return( -1 ); 
 
 			n_pages += 1;
@@ -755,6 +855,79 @@ vips_foreign_load_gif_page( VipsForeignLoadGif *gif,
 	return( 0 );
 }
 
+/* Loading a late page means decoding every frame before it. Make a quick
+ * pass that steps over the compressed pixels to find the last key frame at
+ * or before @page, then reopen. The real pass starts rendering from the
+ * key frame, since nothing earlier can change the result.
+ */
+static int
+vips_foreign_load_gif_scan( VipsForeignLoadGif *gif )
+{
+	VipsForeignLoadGifClass *class =
+		(VipsForeignLoadGifClass *) VIPS_OBJECT_GET_CLASS( gif );
+
+	GifRecordType record;
+	int n_frames;
+	int key;
+
+	n_frames = 0;
+	key = 0;
+
+	do {
+		if( DGifGetRecordType( gif->file, &record ) == GIF_ERROR ) {
+			vips_foreign_load_gif_error( gif );
+			return( -1 );
+		}
+
+		switch( record ) {
+		case IMAGE_DESC_RECORD_TYPE:
+			if( DGifGetImageDesc( gif->file ) == GIF_ERROR ) {
+				vips_foreign_load_gif_error( gif );
+				return( -1 );
+			}
+
+			if( vips_foreign_load_gif_is_key( gif ) )
+				key = n_frames;
+			if( vips_foreign_load_gif_skip( gif ) )
+				return( -1 );
+
+			n_frames += 1;
+
+			break;
+
+		case EXTENSION_RECORD_TYPE:
+			if( vips_foreign_load_gif_extension( gif ) )
+				return( -1 );
+			break;
+
+		case TERMINATE_RECORD_TYPE:
+			gif->eof = TRUE;
+			break;
+
+		default:
+			break;
+		}
+	} while( n_frames <= gif->page &&
+		!gif->eof );
+
+	VIPS_DEBUG_MSG( "gifload: page %d has key frame %d\n",
+		gif->page, key );
+
+	/* Back to the start, with the per-frame state reset. Whole-file
+	 * things, like the comment and delay, will be seen again in the same
+	 * order.
+	 */
+	if( class->open( gif ) )
+		return( -1 );
+	gif->current_page = 0;
+	gif->eof = FALSE;
+	gif->transparency = -1;
+	gif->dispose = 0;
+	gif->first_frame = key;
+
+	return( 0 );
+}
+
 static VipsImage *
 vips_foreign_load_gif_new_page( VipsForeignLoadGif *gif )
 {
@@ -763,7 +936,9 @@ vips_foreign_load_gif_new_page( VipsForeignLoadGif *gif )
 	out = vips_image_new_memory();
 
 	vips_image_init_fields( out, 
-		gif->file->SWidth, gif->file->SHeight, 4, VIPS_FORMAT_UCHAR,
+		VIPS_ROUND_UP( gif->file->SWidth, gif->shrink ) / gif->shrink,
+		VIPS_ROUND_UP( gif->file->SHeight, gif->shrink ) / gif->shrink,
+		4, VIPS_FORMAT_UCHAR,
 		VIPS_CODING_NONE, VIPS_INTERPRETATION_sRGB, 1.0, 1.0 );
 
 	/* We will have the whole GIF frame in memory, so we can render any 
@@ -819,6 +994,10 @@ vips_foreign_load_gif_pages( VipsForeignLoadGif *gif, VipsImage **out )
 	frames = NULL;
 	previous = NULL;
 
+	if( gif->page > 0 &&
+		vips_foreign_load_gif_scan( gif ) )
+		return( -1 );
+
 	/* Accumulate any start stuff up to the first frame we need.
 	 */
 	if( !(frame = vips_foreign_load_gif_new_page( gif )) ) 
@@ -1014,12 +1193,20 @@ vips_foreign_load_gif_class_init( VipsForeignLoadGifClass *class )
 		G_STRUCT_OFFSET( VipsForeignLoadGif, n ),
 		-1, 100000, 1 );
 
+	VIPS_ARG_INT( class, "shrink", 11,
+		_( "Shrink" ),
+		_( "Shrink factor on load" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsForeignLoadGif, shrink ),
+		1, 1024, 1 );
+
 }
 
 static void
 vips_foreign_load_gif_init( VipsForeignLoadGif *gif )
 {
 	gif->n = 1;
+	gif->shrink = 1;
 	gif->transparency = -1;
 	gif->delay = 4;
 	gif->loop = 0;
@@ -1041,13 +1228,23 @@ typedef VipsForeignLoadGifClass VipsForeignLoadGifFileClass;
 G_DEFINE_TYPE( VipsForeignLoadGifFile, vips_foreign_load_gif_file, 
 	vips_foreign_load_gif_get_type() );
 
+static int
+vips_foreign_load_gif_file_open( VipsForeignLoadGif *gif )
+{
+	VipsForeignLoadGifFile *file = (VipsForeignLoadGifFile *) gif;
+
+	vips_foreign_load_gif_close( gif );
+
+	return( vips_foreign_load_gif_open( gif, file->filename ) );
+}
+
 static int
 vips_foreign_load_gif_file_header( VipsForeignLoad *load )
 {
 	VipsForeignLoadGif *gif = (VipsForeignLoadGif *) load;
 	VipsForeignLoadGifFile *file = (VipsForeignLoadGifFile *) load;
 
-	if( vips_foreign_load_gif_open( gif, file->filename ) ) 
+	if( vips_foreign_load_gif_file_open( gif ) )
 		return( -1 ); 
 
 	VIPS_SETSTR( load->out->filename, file->filename );
@@ -1068,6 +1265,7 @@ vips_foreign_load_gif_file_class_init(
 	VipsObjectClass *object_class = (VipsObjectClass *) class;
 	VipsForeignClass *foreign_class = (VipsForeignClass *) class;
 	VipsForeignLoadClass *load_class = (VipsForeignLoadClass *) class;
+	VipsForeignLoadGifClass *gif_class = (VipsForeignLoadGifClass *) class;
 
 	gobject_class->set_property = vips_object_set_property;
 	gobject_class->get_property = vips_object_get_property;
@@ -1080,6 +1278,8 @@ vips_foreign_load_gif_file_class_init(
 	load_class->is_a = vips_foreign_load_gif_is_a;
 	load_class->header = vips_foreign_load_gif_file_header;
 
+	gif_class->open = vips_foreign_load_gif_file_open;
+
 	VIPS_ARG_STRING( class, "filename", 1, 
 		_( "Filename" ),
 		_( "Filename to load from" ),
@@ -1132,17 +1332,27 @@ vips_giflib_buffer_read( GifFileType *file, GifByteType *buf, int n )
 }
 
 static int
-vips_foreign_load_gif_buffer_header( VipsForeignLoad *load )
+vips_foreign_load_gif_buffer_open( VipsForeignLoadGif *gif )
 {
-	VipsForeignLoadGif *gif = (VipsForeignLoadGif *) load;
-	VipsForeignLoadGifBuffer *buffer = (VipsForeignLoadGifBuffer *) load;
+	VipsForeignLoadGifBuffer *buffer = (VipsForeignLoadGifBuffer *) gif;
+
+	vips_foreign_load_gif_close( gif );
 
 	/* Init the read point.
 	 */
 	buffer->p = buffer->buf->data;
 	buffer->bytes_to_go = buffer->buf->length;
 
-	if( vips_foreign_load_gif_open_buffer( gif, vips_giflib_buffer_read ) ) 
+	return( vips_foreign_load_gif_open_buffer( gif,
+		vips_giflib_buffer_read ) );
+}
+
+static int
+vips_foreign_load_gif_buffer_header( VipsForeignLoad *load )
+{
+	VipsForeignLoadGif *gif = (VipsForeignLoadGif *) load;
+
+	if( vips_foreign_load_gif_buffer_open( gif ) )
 		return( -1 ); 
 
 	return( vips_foreign_load_gif_load( load ) );
@@ -1155,6 +1365,7 @@ vips_foreign_load_gif_buffer_class_init(
 	GObjectClass *gobject_class = G_OBJECT_CLASS( class );
 	VipsObjectClass *object_class = (VipsObjectClass *) class;
 	VipsForeignLoadClass *load_class = (VipsForeignLoadClass *) class;
+	VipsForeignLoadGifClass *gif_class = (VipsForeignLoadGifClass *) class;
 
 	gobject_class->set_property = vips_object_set_property;
 	gobject_class->get_property = vips_object_get_property;
@@ -1165,6 +1376,8 @@ vips_foreign_load_gif_buffer_class_init(
 	load_class->is_a_buffer = vips_foreign_load_gif_is_a_buffer;
 	load_class->header = vips_foreign_load_gif_buffer_header;
 
+	gif_class->open = vips_foreign_load_gif_buffer_open;
+
 	VIPS_ARG_BOXED( class, "buffer", 1, 
 		_( "Buffer" ),
 		_( "Buffer to load from" ),
@@ -1191,6 +1404,7 @@ vips_foreign_load_gif_buffer_init( VipsForeignLoadGifBuffer *buffer )
  *
  * * @page: %gint, page (frame) to read
  * * @n: %gint, load this many pages
+ * * @shrink: %gint, shrink by this much on load
  *
  * Read a GIF file into a VIPS image.  Rendering uses the giflib library.
  *
@@ -1204,6 +1418,14 @@ vips_foreign_load_gif_buffer_init( VipsForeignLoadGifBuffer *buffer )
  * The whole GIF is rendered into memory on header access. The output image
  * will be 1, 2, 3 or 4 bands depending on what the reader finds in the file. 
  *
+ * Frames before @page are only decompressed back to the last frame which
+ * completely replaces the screen, so loading a late page of a long
+ * animation is quick.
+ *
+ * Use @shrink to specify a shrink-on-load factor. Frames are subsampled as
+ * they are decompressed, so only every @shrink pixel is rendered and held
+ * in memory.
+ *
  * See also: vips_image_new_from_file().
  *
  * Returns: 0 on success, -1 on error.
@@ -1232,6 +1454,7 @@ vips_gifload( const char *filename, VipsImage **out, ... )
  *
  * * @page: %gint, page (frame) to read
  * * @n: %gint, load this many pages
+ * * @shrink: %gint, shrink by this much on load
  *
  * Read a GIF-formatted memory block into a VIPS image. Exactly as
  * vips_gifload(), but read from a memory buffer. 
@@ -0,0 +1,1408 @@
+/* save as GIF
+ *
+ * 14/10/18
+ * 	- first version, with a native quantiser and LZW coder
+ */
+
+/*
+
+    This file is part of VIPS.
+
+    VIPS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA
+
+ */
+
+/*
+
+    These files are distributed with VIPS - http://www.vips.ecs.soton.ac.uk
+
+ */
+
+/* Frames (pages, see VIPS_META_PAGE_HEIGHT) are gathered from the sink one
+ * at a time. Each finished frame is handed to a worker which builds a 5 bit
+ * per channel histogram, picks a palette, maps the pixels and LZW-codes the
+ * result. Frames are written to the target in order as their workers
+ * finish, so no more than a few frames are ever held in memory.
+ *
+ * The palette is a median cut over the histogram cells followed by a couple
+ * of k-means passes, again over the cells rather than the pixels. The first
+ * frame's palette is made in the sink thread and becomes the global colour
+ * table. Later frames reuse it if the error is not much worse than it was for
+ * the first frame, and only make a local table if it is.
+ */
+
+/*
+#define DEBUG
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /*HAVE_CONFIG_H*/
+#include <vips/intl.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <vips/vips.h>
+#include <vips/internal.h>
+#include <vips/debug.h>
+
+#include "pforeign.h"
+
+/* Histogram cells are 5 bits per channel.
+ */
+#define GIF_CELL_BITS (5)
+#define GIF_N_CELLS (1 << (3 * GIF_CELL_BITS))
+#define GIF_CELL( R, G, B ) \
+	((((R) >> 3) << 10) | (((G) >> 3) << 5) | ((B) >> 3))
+
+/* Refine the median cut palette with this many k-means passes.
+ */
+#define GIF_KMEANS_PASSES (2)
+
+/* LZW codes are at most 12 bits. The hash table needs to be comfortably
+ * larger than the 4096 codes.
+ */
+#define GIF_LZW_MAX_CODE (4095)
+#define GIF_LZW_HASH_SIZE (8192)
+
+typedef struct _GifPalette {
+	/* Number of colours. If transparent is set, index n is the
+	 * transparent pixel.
+	 */
+	int n;
+	gboolean transparent;
+	VipsPel rgb[256][3];
+
+	/* Bits per index, enough for n colours plus the transparent one.
+	 */
+	int bits;
+
+	/* RMS error for the frame the palette was made for.
+	 */
+	double error;
+} GifPalette;
+
+/* A non-empty histogram cell.
+ */
+typedef struct _GifCell {
+	VipsPel key[3];			/* Cell coordinates, 0 - 31 */
+	guint32 count;
+	float mean[3];			/* Mean colour of the pixels */
+} GifCell;
+
+/* A median cut box, a range of cells.
+ */
+typedef struct _GifBox {
+	int start;
+	int end;
+	guint64 count;
+	int min[3];
+	int max[3];
+} GifBox;
+
+typedef struct _GifFrame {
+	struct _VipsForeignSaveGif *gif;
+
+	int page;
+	VipsPel *pixels;		/* RGB(A) for the whole frame */
+	VipsPel *index;			/* Palette indexes */
+
+	/* The palette is made in the sink thread for the first frame, in
+	 * the worker for the rest.
+	 */
+	gboolean local;			/* Needs a local colour table */
+	GifPalette palette;
+
+	/* Everything from the graphic control extension to the end of the
+	 * image data.
+	 */
+	VipsDbuf out;
+
+	VipsSemaphore done;
+	gboolean error;
+} GifFrame;
+
+typedef struct _VipsForeignSaveGif {
+	VipsForeignSave parent_object;
+
+	/* Subclasses set this before we build.
+	 */
+	VipsTarget *target;
+
+	/* Bits per pixel, 1 - 8.
+	 */
+	int bitdepth;
+
+	/* Reuse the global palette when we can.
+	 */
+	gboolean reuse;
+
+	/* How much worse the global palette may be before a frame gets its
+	 * own.
+	 */
+	double interpalette_maxerror;
+
+	int page_height;
+	int n_pages;
+	int delay;
+	int loop;
+
+	/* The global colour table, from the first frame.
+	 */
+	GifPalette global;
+
+	/* Frame being filled, and frames in flight, oldest first.
+	 */
+	GifFrame *frame;
+	GQueue frames;
+} VipsForeignSaveGif;
+
+typedef VipsForeignSaveClass VipsForeignSaveGifClass;
+
+G_DEFINE_ABSTRACT_TYPE( VipsForeignSaveGif, vips_foreign_save_gif,
+	VIPS_TYPE_FOREIGN_SAVE );
+
+static void
+gif_frame_free( GifFrame *frame )
+{
+	VIPS_FREE( frame->pixels );
+	VIPS_FREE( frame->index );
+	vips_dbuf_destroy( &frame->out );
+	vips_semaphore_destroy( &frame->done );
+	g_free( frame );
+}
+
+static GifFrame *
+gif_frame_new( VipsForeignSaveGif *gif, int page )
+{
+	VipsImage *ready = VIPS_FOREIGN_SAVE( gif )->ready;
+	size_t n_pels = (size_t) ready->Xsize * gif->page_height;
+
+	GifFrame *frame;
+
+	frame = g_new0( GifFrame, 1 );
+	frame->gif = gif;
+	frame->page = page;
+	vips_dbuf_init( &frame->out );
+	vips_semaphore_init( &frame->done, 0, "done" );
+	if( !(frame->pixels = vips_malloc( NULL, n_pels * ready->Bands )) ||
+		!(frame->index = vips_malloc( NULL, n_pels )) ) {
+		gif_frame_free( frame );
+		return( NULL );
+	}
+
+	return( frame );
+}
+
+static void
+vips_foreign_save_gif_dispose( GObject *gobject )
+{
+	VipsForeignSaveGif *gif = (VipsForeignSaveGif *) gobject;
+
+	GifFrame *frame;
+
+	/* Workers may still be busy if we've had an error.
+	 */
+	while( (frame = g_queue_pop_head( &gif->frames )) ) {
+		vips_semaphore_down( &frame->done );
+		gif_frame_free( frame );
+	}
+	VIPS_FREEF( gif_frame_free, gif->frame );
+	VIPS_UNREF( gif->target );
+
+	G_OBJECT_CLASS( vips_foreign_save_gif_parent_class )->
+		dispose( gobject );
+}
+
+/* Build the list of non-empty cells for a frame. Return the number of cells,
+ * or -1 for error.
+ */
+static int
+gif_frame_histogram( GifFrame *frame, GifCell *cells, gboolean *transparent )
+{
+	VipsImage *ready = VIPS_FOREIGN_SAVE( frame->gif )->ready;
+	size_t n_pels = (size_t) ready->Xsize * frame->gif->page_height;
+	int bands = ready->Bands;
+
+	guint32 *count;
+	guint64 *sum;
+	VipsPel *p;
+	size_t i;
+	int n;
+
+	if( !(count = VIPS_ARRAY( NULL, GIF_N_CELLS, guint32 )) ||
+		!(sum = VIPS_ARRAY( NULL, 3 * GIF_N_CELLS, guint64 )) ) {
+		VIPS_FREE( count );
+		return( -1 );
+	}
+	memset( count, 0, GIF_N_CELLS * sizeof( guint32 ) );
+	memset( sum, 0, 3 * GIF_N_CELLS * sizeof( guint64 ) );
+
+	*transparent = FALSE;
+	p = frame->pixels;
+	for( i = 0; i < n_pels; i++ ) {
+		if( bands == 4 &&
+			p[3] < 128 )
+			*transparent = TRUE;
+		else {
+			int c = GIF_CELL( p[0], p[1], p[2] );
+
+			count[c] += 1;
+			sum[3 * c] += p[0];
+			sum[3 * c + 1] += p[1];
+			sum[3 * c + 2] += p[2];
+		}
+
+		p += bands;
+	}
+
+	n = 0;
+	for( i = 0; i < GIF_N_CELLS; i++ )
+		if( count[i] ) {
+			GifCell *cell = &cells[n++];
+			int j;
+
+			cell->key[0] = (i >> 10) & 31;
+			cell->key[1] = (i >> 5) & 31;
+			cell->key[2] = i & 31;
+			cell->count = count[i];
+			for( j = 0; j < 3; j++ )
+				cell->mean[j] = (double) sum[3 * i + j] /
+					count[i];
+		}
+
+	vips_free( count );
+	vips_free( sum );
+
+	return( n );
+}
+
+#define GIF_CELL_COMPARE( AXIS ) \
+static int \
+gif_cell_compare##AXIS( const void *a, const void *b ) \
+{ \
+	return( (int) ((const GifCell *) a)->key[AXIS] - \
+		(int) ((const GifCell *) b)->key[AXIS] ); \
+}
+
+GIF_CELL_COMPARE( 0 )
+GIF_CELL_COMPARE( 1 )
+GIF_CELL_COMPARE( 2 )
+
+static void
+gif_box_update( GifBox *box, GifCell *cells )
+{
+	int i, j;
+
+	box->count = 0;
+	for( j = 0; j < 3; j++ ) {
+		box->min[j] = 31;
+		box->max[j] = 0;
+	}
+
+	for( i = box->start; i < box->end; i++ ) {
+		box->count += cells[i].count;
+		for( j = 0; j < 3; j++ ) {
+			box->min[j] = VIPS_MIN( box->min[j], cells[i].key[j] );
+			box->max[j] = VIPS_MAX( box->max[j], cells[i].key[j] );
+		}
+	}
+}
+
+static int
+gif_box_axis( GifBox *box )
+{
+	int axis;
+	int j;
+
+	axis = 0;
+	for( j = 1; j < 3; j++ )
+		if( box->max[j] - box->min[j] >
+			box->max[axis] - box->min[axis] )
+			axis = j;
+
+	return( axis );
+}
+
+/* Squared distance to the nearest palette entry, and its index.
+ */
+static double
+gif_palette_nearest( GifPalette *palette, float *rgb, int *index )
+{
+	double best;
+	int i;
+
+	best = -1;
+	*index = 0;
+	for( i = 0; i < palette->n; i++ ) {
+		double dr = rgb[0] - palette->rgb[i][0];
+		double dg = rgb[1] - palette->rgb[i][1];
+		double db = rgb[2] - palette->rgb[i][2];
+		double d = dr * dr + dg * dg + db * db;
+
+		if( best < 0 ||
+			d < best ) {
+			best = d;
+			*index = i;
+		}
+	}
+
+	return( best );
+}
+
+/* Fill the cell -> index table and return the RMS error.
+ */
+static double
+gif_palette_map( GifPalette *palette,
+	GifCell *cells, int n_cells, VipsPel *map )
+{
+	double error;
+	guint64 count;
+	int i;
+
+	error = 0.0;
+	count = 0;
+	for( i = 0; i < n_cells; i++ ) {
+		GifCell *cell = &cells[i];
+		int index;
+
+		error += cell->count *
+			gif_palette_nearest( palette, cell->mean, &index );
+		count += cell->count;
+		map[(cell->key[0] << 10) | (cell->key[1] << 5) | cell->key[2]] =
+			index;
+	}
+
+	return( count ? sqrt( error / count ) : 0.0 );
+}
+
+static void
+gif_palette_set_bits( GifPalette *palette )
+{
+	int n = palette->n + (palette->transparent ? 1 : 0);
+
+	palette->bits = 1;
+	while( (1 << palette->bits) < n )
+		palette->bits += 1;
+}
+
+/* Median cut to at most max_colours, then refine with k-means.
+ */
+static void
+gif_palette_build( GifPalette *palette,
+	GifCell *cells, int n_cells, int max_colours )
+{
+	GifBox box[256];
+	int n_boxes;
+	int i, j, k;
+
+	n_boxes = 0;
+	if( n_cells > 0 ) {
+		box[0].start = 0;
+		box[0].end = n_cells;
+		gif_box_update( &box[0], cells );
+		n_boxes = 1;
+	}
+
+	while( n_boxes < max_colours ) {
+		GifBox *split;
+		double best;
+		guint64 half;
+		guint64 count;
+		int axis;
+		int mid;
+
+		/* Split the box with the most pixels by the greatest
+		 * extent.
+		 */
+		split = NULL;
+		best = 0;
+		for( i = 0; i < n_boxes; i++ )
+			if( box[i].end - box[i].start > 1 ) {
+				GifBox *b = &box[i];
+				int a = gif_box_axis( b );
+				double score = (double) b->count *
+					(b->max[a] - b->min[a]);
+
+				if( score > best ) {
+					best = score;
+					split = b;
+				}
+			}
+		if( !split )
+			break;
+
+		axis = gif_box_axis( split );
+		qsort( cells + split->start, split->end - split->start,
+			sizeof( GifCell ),
+			axis == 0 ? gif_cell_compare0 :
+			axis == 1 ? gif_cell_compare1 : gif_cell_compare2 );
+
+		half = split->count / 2;
+		count = 0;
+		for( mid = split->start; mid < split->end - 1; mid++ ) {
+			count += cells[mid].count;
+			if( count >= half )
+				break;
+		}
+		mid += 1;
+
+		box[n_boxes].start = mid;
+		box[n_boxes].end = split->end;
+		split->end = mid;
+		gif_box_update( split, cells );
+		gif_box_update( &box[n_boxes], cells );
+		n_boxes += 1;
+	}
+
+	/* Each colour starts as the mean of its box.
+	 */
+	palette->n = n_boxes;
+	for( i = 0; i < n_boxes; i++ ) {
+		double sum[3] = { 0.0, 0.0, 0.0 };
+
+		for( k = box[i].start; k < box[i].end; k++ )
+			for( j = 0; j < 3; j++ )
+				sum[j] += cells[k].count * cells[k].mean[j];
+		for( j = 0; j < 3; j++ )
+			palette->rgb[i][j] = VIPS_CLIP( 0,
+				VIPS_RINT( sum[j] / box[i].count ), 255 );
+	}
+
+	for( k = 0; k < GIF_KMEANS_PASSES; k++ ) {
+		double sum[256][3];
+		guint64 count[256];
+
+		memset( sum, 0, sizeof( sum ) );
+		memset( count, 0, sizeof( count ) );
+		for( i = 0; i < n_cells; i++ ) {
+			int index;
+
+			(void) gif_palette_nearest( palette,
+				cells[i].mean, &index );
+			count[index] += cells[i].count;
+			for( j = 0; j < 3; j++ )
+				sum[index][j] +=
+					cells[i].count * cells[i].mean[j];
+		}
+
+		for( i = 0; i < palette->n; i++ )
+			if( count[i] )
+				for( j = 0; j < 3; j++ )
+					palette->rgb[i][j] = VIPS_CLIP( 0,
+						VIPS_RINT( sum[i][j] /
+							count[i] ), 255 );
+	}
+}
+
+/* Pick a palette for a frame and fill the cell -> index table.
+ */
+static int
+gif_frame_quantise( GifFrame *frame, VipsPel *map )
+{
+	VipsForeignSaveGif *gif = frame->gif;
+
+	GifCell *cells;
+	gboolean transparent;
+	int n_cells;
+	int max_colours;
+
+	if( !(cells = VIPS_ARRAY( NULL, GIF_N_CELLS, GifCell )) )
+		return( -1 );
+	if( (n_cells = gif_frame_histogram( frame,
+		cells, &transparent )) < 0 ) {
+		vips_free( cells );
+		return( -1 );
+	}
+
+	/* See if the global table will do. It can't if we need a
+	 * transparent index and it has none, or if it has no colours.
+	 */
+	if( frame->page > 0 &&
+		gif->reuse &&
+		(!transparent || gif->global.transparent) &&
+		(n_cells == 0 || gif->global.n > 0) ) {
+		double error;
+
+		error = gif_palette_map( &gif->global, cells, n_cells, map );
+		if( error <= gif->global.error + gif->interpalette_maxerror ) {
+			frame->palette = gif->global;
+			frame->local = FALSE;
+			vips_free( cells );
+
+			return( 0 );
+		}
+	}
+
+	max_colours = (1 << gif->bitdepth) - (transparent ? 1 : 0);
+	memset( &frame->palette, 0, sizeof( GifPalette ) );
+	frame->palette.transparent = transparent;
+	gif_palette_build( &frame->palette, cells, n_cells, max_colours );
+	gif_palette_set_bits( &frame->palette );
+	frame->palette.error =
+		gif_palette_map( &frame->palette, cells, n_cells, map );
+	frame->local = frame->page > 0;
+
+	vips_free( cells );
+
+	return( 0 );
+}
+
+static void
+gif_frame_apply( GifFrame *frame, VipsPel *map )
+{
+	VipsImage *ready = VIPS_FOREIGN_SAVE( frame->gif )->ready;
+	size_t n_pels = (size_t) ready->Xsize * frame->gif->page_height;
+	int bands = ready->Bands;
+	int transparent = frame->palette.n;
+
+	VipsPel *p;
+	size_t i;
+
+	p = frame->pixels;
+	for( i = 0; i < n_pels; i++ ) {
+		if( bands == 4 &&
+			p[3] < 128 )
+			frame->index[i] = transparent;
+		else
+			frame->index[i] = map[GIF_CELL( p[0], p[1], p[2] )];
+
+		p += bands;
+	}
+}
+
+/* LZW codes are packed LSB first and written as a series of sub-blocks of
+ * up to 255 bytes.
+ */
+typedef struct _GifLzw {
+	VipsDbuf *out;
+	guint32 bits;
+	int n_bits;
+	VipsPel block[256];
+	int block_length;
+	gboolean error;
+} GifLzw;
+
+static void
+gif_lzw_flush( GifLzw *lzw )
+{
+	if( lzw->block_length > 0 ) {
+		lzw->block[0] = lzw->block_length;
+		if( !vips_dbuf_write( lzw->out,
+			lzw->block, lzw->block_length + 1 ) )
+			lzw->error = TRUE;
+		lzw->block_length = 0;
+	}
+}
+
+static void
+gif_lzw_byte( GifLzw *lzw, int byte )
+{
+	lzw->block[++lzw->block_length] = byte;
+	if( lzw->block_length == 255 )
+		gif_lzw_flush( lzw );
+}
+
+static void
+gif_lzw_code( GifLzw *lzw, int code, int code_size )
+{
+	lzw->bits |= (guint32) code << lzw->n_bits;
+	lzw->n_bits += code_size;
+	while( lzw->n_bits >= 8 ) {
+		gif_lzw_byte( lzw, lzw->bits & 0xff );
+		lzw->bits >>= 8;
+		lzw->n_bits -= 8;
+	}
+}
+
+/* The usual GIF LZW: a string table of (prefix code, next pixel) in a hash,
+ * with a clear code when the table fills.
+ */
+static int
+gif_lzw_encode( VipsDbuf *out, VipsPel *index, size_t n, int bits )
+{
+	int min_code_size = VIPS_MAX( 2, bits );
+	int clear = 1 << min_code_size;
+	int eoi = clear + 1;
+
+	GifLzw lzw;
+	guint32 key[GIF_LZW_HASH_SIZE];
+	guint16 value[GIF_LZW_HASH_SIZE];
+	VipsPel byte;
+	int code_size;
+	int max_code;
+	int prefix;
+	size_t i;
+
+	memset( &lzw, 0, sizeof( lzw ) );
+	lzw.out = out;
+
+	byte = min_code_size;
+	if( !vips_dbuf_write( out, &byte, 1 ) )
+		return( -1 );
+
+	/* key is (prefix << 8 | pixel) + 1, so zero means empty.
+	 */
+	memset( key, 0, sizeof( key ) );
+	code_size = min_code_size + 1;
+	max_code = eoi;
+	gif_lzw_code( &lzw, clear, code_size );
+
+	prefix = n > 0 ? index[0] : 0;
+	for( i = 1; i < n; i++ ) {
+		guint32 k = (((guint32) prefix << 8) | index[i]) + 1;
+		guint32 h = (k * 2654435761U) >> 19;
+
+		while( key[h] &&
+			key[h] != k )
+			h = (h + 1) & (GIF_LZW_HASH_SIZE - 1);
+
+		if( key[h] ) {
+			prefix = value[h];
+			continue;
+		}
+
+		gif_lzw_code( &lzw, prefix, code_size );
+
+		max_code += 1;
+		key[h] = k;
+		value[h] = max_code;
+		if( max_code >= (1 << code_size) )
+			code_size += 1;
+
+		if( max_code == GIF_LZW_MAX_CODE ) {
+			gif_lzw_code( &lzw, clear, code_size );
+			memset( key, 0, sizeof( key ) );
+			code_size = min_code_size + 1;
+			max_code = eoi;
+		}
+
+		prefix = index[i];
+	}
+
+	if( n > 0 ) {
+		gif_lzw_code( &lzw, prefix, code_size );
+
+		/* The decoder adds a code for that, and may widen.
+		 */
+		max_code += 1;
+		if( max_code >= (1 << code_size) &&
+			code_size < 12 )
+			code_size += 1;
+	}
+	gif_lzw_code( &lzw, eoi, code_size );
+	if( lzw.n_bits > 0 )
+		gif_lzw_byte( &lzw, lzw.bits & 0xff );
+	gif_lzw_flush( &lzw );
+
+	/* Block terminator.
+	 */
+	byte = 0;
+	if( lzw.error ||
+		!vips_dbuf_write( out, &byte, 1 ) )
+		return( -1 );
+
+	return( 0 );
+}
+
+static gboolean
+gif_write_u16( VipsDbuf *dbuf, int value )
+{
+	VipsPel buf[2];
+
+	buf[0] = value & 0xff;
+	buf[1] = (value >> 8) & 0xff;
+
+	return( vips_dbuf_write( dbuf, buf, 2 ) );
+}
+
+static gboolean
+gif_write_palette( VipsDbuf *dbuf, GifPalette *palette )
+{
+	VipsPel table[256][3];
+
+	memset( table, 0, sizeof( table ) );
+	memcpy( table, palette->rgb, palette->n * 3 );
+
+	return( vips_dbuf_write( dbuf,
+		(VipsPel *) table, 3 * (1 << palette->bits) ) );
+}
+
+static int
+gif_frame_encode( GifFrame *frame )
+{
+	VipsForeignSaveGif *gif = frame->gif;
+	VipsImage *ready = VIPS_FOREIGN_SAVE( gif )->ready;
+	GifPalette *palette = &frame->palette;
+
+	VipsPel buf[8];
+
+	/* Graphic control extension. Frames are complete images, so
+	 * transparent areas must clear what was there before.
+	 */
+	buf[0] = 0x21;
+	buf[1] = 0xf9;
+	buf[2] = 4;
+	buf[3] = palette->transparent ? (2 << 2) | 1 : 1 << 2;
+	if( !vips_dbuf_write( &frame->out, buf, 4 ) ||
+		!gif_write_u16( &frame->out, gif->delay ) )
+		return( -1 );
+	buf[0] = palette->transparent ? palette->n : 0;
+	buf[1] = 0;
+	if( !vips_dbuf_write( &frame->out, buf, 2 ) )
+		return( -1 );
+
+	/* Image descriptor.
+	 */
+	buf[0] = 0x2c;
+	if( !vips_dbuf_write( &frame->out, buf, 1 ) ||
+		!gif_write_u16( &frame->out, 0 ) ||
+		!gif_write_u16( &frame->out, 0 ) ||
+		!gif_write_u16( &frame->out, ready->Xsize ) ||
+		!gif_write_u16( &frame->out, gif->page_height ) )
+		return( -1 );
+	buf[0] = frame->local ? 0x80 | (palette->bits - 1) : 0;
+	if( !vips_dbuf_write( &frame->out, buf, 1 ) )
+		return( -1 );
+	if( frame->local &&
+		!gif_write_palette( &frame->out, palette ) )
+		return( -1 );
+
+	if( gif_lzw_encode( &frame->out, frame->index,
+		(size_t) ready->Xsize * gif->page_height, palette->bits ) )
+		return( -1 );
+
+	return( 0 );
+}
+
+/* Run in a worker.
+ */
+static void *
+gif_frame_work( void *a )
+{
+	GifFrame *frame = (GifFrame *) a;
+
+	VipsPel *map;
+
+	/* The first frame has been mapped already, see gif_frame_submit().
+	 */
+	if( frame->page > 0 ) {
+		if( !(map = vips_malloc( NULL, GIF_N_CELLS )) ||
+			gif_frame_quantise( frame, map ) )
+			frame->error = TRUE;
+		else
+			gif_frame_apply( frame, map );
+		VIPS_FREE( map );
+	}
+
+	if( !frame->error &&
+		gif_frame_encode( frame ) )
+		frame->error = TRUE;
+
+	/* We don't need the pixels any more.
+	 */
+	VIPS_FREE( frame->pixels );
+	VIPS_FREE( frame->index );
+
+	vips_semaphore_up( &frame->done );
+
+	return( NULL );
+}
+
+/* Write the oldest frame, waiting for it if necessary.
+ */
+static int
+gif_frame_emit( VipsForeignSaveGif *gif )
+{
+	GifFrame *frame = (GifFrame *) g_queue_pop_head( &gif->frames );
+
+	unsigned char *data;
+	size_t length;
+	int result;
+
+	vips_semaphore_down( &frame->done );
+	if( frame->error ) {
+		vips_error( "gifsave", "%s", _( "unable to encode frame" ) );
+		gif_frame_free( frame );
+		return( -1 );
+	}
+
+	data = vips_dbuf_string( &frame->out, &length );
+	result = vips_target_write( gif->target, data, length );
+	gif_frame_free( frame );
+
+	return( result );
+}
+
+/* Header, logical screen descriptor, global colour table and loop count.
+ */
+static int
+gif_write_header( VipsForeignSaveGif *gif )
+{
+	VipsImage *ready = VIPS_FOREIGN_SAVE( gif )->ready;
+
+	VipsDbuf dbuf;
+	VipsPel buf[3];
+	unsigned char *data;
+	size_t length;
+	int result;
+
+	vips_dbuf_init( &dbuf );
+	buf[0] = 0x80 | (7 << 4) | (gif->global.bits - 1);
+	buf[1] = 0;
+	buf[2] = 0;
+	result = 0;
+	if( !vips_dbuf_write( &dbuf, (unsigned char *) "GIF89a", 6 ) ||
+		!gif_write_u16( &dbuf, ready->Xsize ) ||
+		!gif_write_u16( &dbuf, gif->page_height ) ||
+		!vips_dbuf_write( &dbuf, buf, 3 ) ||
+		!gif_write_palette( &dbuf, &gif->global ) )
+		result = -1;
+
+	if( !result &&
+		gif->n_pages > 1 ) {
+		VipsPel app[] = { 0x21, 0xff, 11 };
+		VipsPel sub[] = { 3, 1 };
+
+		if( !vips_dbuf_write( &dbuf, app, 3 ) ||
+			!vips_dbuf_write( &dbuf,
+				(unsigned char *) "NETSCAPE2.0", 11 ) ||
+			!vips_dbuf_write( &dbuf, sub, 2 ) ||
+			!gif_write_u16( &dbuf, gif->loop ) ||
+			!vips_dbuf_write( &dbuf, buf + 1, 1 ) )
+			result = -1;
+	}
+
+	if( !result ) {
+		data = vips_dbuf_string( &dbuf, &length );
+		result = vips_target_write( gif->target, data, length );
+	}
+	vips_dbuf_destroy( &dbuf );
+
+	return( result );
+}
+
+static int
+gif_frame_submit( VipsForeignSaveGif *gif )
+{
+	GifFrame *frame = gif->frame;
+
+	/* The first frame sets the global colour table, and we need that
+	 * before we can start any other frame. Do it here, then the LZW in
+	 * the background.
+	 */
+	if( frame->page == 0 ) {
+		VipsPel *map;
+
+		if( !(map = vips_malloc( NULL, GIF_N_CELLS )) )
+			return( -1 );
+		if( gif_frame_quantise( frame, map ) ) {
+			vips_free( map );
+			return( -1 );
+		}
+		gif_frame_apply( frame, map );
+		vips_free( map );
+
+		gif->global = frame->palette;
+		if( gif_write_header( gif ) )
+			return( -1 );
+	}
+
+	gif->frame = NULL;
+	g_queue_push_tail( &gif->frames, frame );
+	if( vips__worker_spawn( gif_frame_work, frame ) ) {
+		vips_error_clear();
+		gif_frame_work( frame );
+	}
+
+	/* Limit the number of frames in flight.
+	 */
+	while( g_queue_get_length( &gif->frames ) >
+		2 * vips_concurrency_get() )
+		if( gif_frame_emit( gif ) )
+			return( -1 );
+
+	return( 0 );
+}
+
+static int
+gif_write_block( VipsRegion *region, VipsRect *area, void *a )
+{
+	VipsForeignSaveGif *gif = (VipsForeignSaveGif *) a;
+	VipsImage *ready = VIPS_FOREIGN_SAVE( gif )->ready;
+	size_t line = VIPS_IMAGE_SIZEOF_LINE( ready );
+
+	int y;
+
+	for( y = area->top; y < VIPS_RECT_BOTTOM( area ); y++ ) {
+		int page = y / gif->page_height;
+		int line_in_page = y % gif->page_height;
+
+		if( !gif->frame &&
+			!(gif->frame = gif_frame_new( gif, page )) )
+			return( -1 );
+
+		memcpy( gif->frame->pixels + line * line_in_page,
+			VIPS_REGION_ADDR( region, 0, y ), line );
+
+		if( line_in_page == gif->page_height - 1 &&
+			gif_frame_submit( gif ) )
+			return( -1 );
+	}
+
+	return( 0 );
+}
+
+static int
+vips_foreign_save_gif_build( VipsObject *object )
+{
+	VipsForeignSave *save = (VipsForeignSave *) object;
+	VipsForeignSaveGif *gif = (VipsForeignSaveGif *) object;
+
+	VipsImage *ready;
+	VipsPel trailer;
+
+	if( VIPS_OBJECT_CLASS( vips_foreign_save_gif_parent_class )->
+		build( object ) )
+		return( -1 );
+
+	ready = save->ready;
+
+	gif->page_height = ready->Ysize;
+	if( vips_image_get_typeof( ready, VIPS_META_PAGE_HEIGHT ) ) {
+		int page_height;
+
+		if( vips_image_get_int( ready,
+			VIPS_META_PAGE_HEIGHT, &page_height ) )
+			return( -1 );
+		if( page_height > 0 &&
+			page_height < ready->Ysize &&
+			ready->Ysize % page_height == 0 )
+			gif->page_height = page_height;
+	}
+	gif->n_pages = ready->Ysize / gif->page_height;
+
+	if( ready->Xsize > 65535 ||
+		gif->page_height > 65535 ) {
+		vips_error( "gifsave", "%s", _( "frame too large" ) );
+		return( -1 );
+	}
+
+	if( vips_image_get_typeof( ready, "gif-delay" ) &&
+		vips_image_get_int( ready, "gif-delay", &gif->delay ) )
+		return( -1 );
+	if( vips_image_get_typeof( ready, "gif-loop" ) &&
+		vips_image_get_int( ready, "gif-loop", &gif->loop ) )
+		return( -1 );
+	gif->delay = VIPS_CLIP( 0, gif->delay, 65535 );
+	gif->loop = VIPS_CLIP( 0, gif->loop, 65535 );
+
+	if( vips_sink_disc( ready, gif_write_block, gif ) )
+		return( -1 );
+
+	while( !g_queue_is_empty( &gif->frames ) )
+		if( gif_frame_emit( gif ) )
+			return( -1 );
+
+	trailer = 0x3b;
+	if( vips_target_write( gif->target, &trailer, 1 ) ||
+		vips_target_finish( gif->target ) )
+		return( -1 );
+
+	return( 0 );
+}
+
+#define UC VIPS_FORMAT_UCHAR
+
+/* Type promotion for save ... just always go to uchar.
+ */
+static int bandfmt_gif[10] = {
+/* UC  C   US  S   UI  I   F   X   D   DX */
+   UC, UC, UC, UC, UC, UC, UC, UC, UC, UC
+};
+
+static const char *vips__gif_suffs[] = { ".gif", NULL };
+
+static void
+vips_foreign_save_gif_class_init( VipsForeignSaveGifClass *class )
+{
+	GObjectClass *gobject_class = G_OBJECT_CLASS( class );
+	VipsObjectClass *object_class = (VipsObjectClass *) class;
+	VipsForeignClass *foreign_class = (VipsForeignClass *) class;
+	VipsForeignSaveClass *save_class = (VipsForeignSaveClass *) class;
+
+	gobject_class->dispose = vips_foreign_save_gif_dispose;
+	gobject_class->set_property = vips_object_set_property;
+	gobject_class->get_property = vips_object_get_property;
+
+	object_class->nickname = "gifsave_base";
+	object_class->description = _( "save as gif" );
+	object_class->build = vips_foreign_save_gif_build;
+
+	foreign_class->suffs = vips__gif_suffs;
+
+	save_class->saveable = VIPS_SAVEABLE_RGBA_ONLY;
+	save_class->format_table = bandfmt_gif;
+
+	VIPS_ARG_INT( class, "bitdepth", 10,
+		_( "Bit depth" ),
+		_( "Number of bits per pixel" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsForeignSaveGif, bitdepth ),
+		1, 8, 8 );
+
+	VIPS_ARG_BOOL( class, "reuse", 11,
+		_( "Reuse palette" ),
+		_( "Reuse the global palette for later frames" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsForeignSaveGif, reuse ),
+		TRUE );
+
+	VIPS_ARG_DOUBLE( class, "interpalette_maxerror", 12,
+		_( "Maximum inter-palette error" ),
+		_( "Maximum extra error before a frame gets a local palette" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsForeignSaveGif, interpalette_maxerror ),
+		0, 256, 3.0 );
+}
+
+static void
+vips_foreign_save_gif_init( VipsForeignSaveGif *gif )
+{
+	gif->bitdepth = 8;
+	gif->reuse = TRUE;
+	gif->interpalette_maxerror = 3.0;
+	g_queue_init( &gif->frames );
+}
+
+typedef struct _VipsForeignSaveGifFile {
+	VipsForeignSaveGif parent_object;
+
+	/* Filename for save.
+	 */
+	char *filename;
+
+} VipsForeignSaveGifFile;
+
+typedef VipsForeignSaveGifClass VipsForeignSaveGifFileClass;
+
+G_DEFINE_TYPE( VipsForeignSaveGifFile, vips_foreign_save_gif_file,
+	vips_foreign_save_gif_get_type() );
+
+static int
+vips_foreign_save_gif_file_build( VipsObject *object )
+{
+	VipsForeignSaveGif *gif = (VipsForeignSaveGif *) object;
+	VipsForeignSaveGifFile *file = (VipsForeignSaveGifFile *) object;
+
+	if( !(gif->target = vips_target_new_to_file( file->filename )) )
+		return( -1 );
+
+	if( VIPS_OBJECT_CLASS( vips_foreign_save_gif_file_parent_class )->
+		build( object ) )
+		return( -1 );
+
+	return( 0 );
+}
+
+static void
+vips_foreign_save_gif_file_class_init( VipsForeignSaveGifFileClass *class )
+{
+	GObjectClass *gobject_class = G_OBJECT_CLASS( class );
+	VipsObjectClass *object_class = (VipsObjectClass *) class;
+
+	gobject_class->set_property = vips_object_set_property;
+	gobject_class->get_property = vips_object_get_property;
+
+	object_class->nickname = "gifsave";
+	object_class->description = _( "save image to gif file" );
+	object_class->build = vips_foreign_save_gif_file_build;
+
+	VIPS_ARG_STRING( class, "filename", 1,
+		_( "Filename" ),
+		_( "Filename to save to" ),
+		VIPS_ARGUMENT_REQUIRED_INPUT,
+		G_STRUCT_OFFSET( VipsForeignSaveGifFile, filename ),
+		NULL );
+}
+
+static void
+vips_foreign_save_gif_file_init( VipsForeignSaveGifFile *file )
+{
+}
+
+typedef struct _VipsForeignSaveGifBuffer {
+	VipsForeignSaveGif parent_object;
+
+	/* Save to a buffer.
+	 */
+	VipsArea *buf;
+
+} VipsForeignSaveGifBuffer;
+
+typedef VipsForeignSaveGifClass VipsForeignSaveGifBufferClass;
+
+G_DEFINE_TYPE( VipsForeignSaveGifBuffer, vips_foreign_save_gif_buffer,
+	vips_foreign_save_gif_get_type() );
+
+static int
+vips_foreign_save_gif_buffer_build( VipsObject *object )
+{
+	VipsForeignSaveGif *gif = (VipsForeignSaveGif *) object;
+	VipsForeignSaveGifBuffer *buffer = (VipsForeignSaveGifBuffer *) object;
+
+	unsigned char *obuf;
+	size_t olen;
+	VipsBlob *blob;
+
+	if( !(gif->target = vips_target_new_to_memory()) )
+		return( -1 );
+
+	if( VIPS_OBJECT_CLASS( vips_foreign_save_gif_buffer_parent_class )->
+		build( object ) )
+		return( -1 );
+
+	if( !(obuf = vips_target_steal( gif->target, &olen )) )
+		return( -1 );
+
+	/* obuf is a g_free() buffer, not vips_free().
+	 */
+	blob = vips_blob_new( (VipsCallbackFn) g_free, obuf, olen );
+	g_object_set( buffer, "buffer", blob, NULL );
+	vips_area_unref( VIPS_AREA( blob ) );
+
+	return( 0 );
+}
+
+static void
+vips_foreign_save_gif_buffer_class_init(
+	VipsForeignSaveGifBufferClass *class )
+{
+	GObjectClass *gobject_class = G_OBJECT_CLASS( class );
+	VipsObjectClass *object_class = (VipsObjectClass *) class;
+
+	gobject_class->set_property = vips_object_set_property;
+	gobject_class->get_property = vips_object_get_property;
+
+	object_class->nickname = "gifsave_buffer";
+	object_class->description = _( "save image to gif buffer" );
+	object_class->build = vips_foreign_save_gif_buffer_build;
+
+	VIPS_ARG_BOXED( class, "buffer", 1,
+		_( "Buffer" ),
+		_( "Buffer to save to" ),
+		VIPS_ARGUMENT_REQUIRED_OUTPUT,
+		G_STRUCT_OFFSET( VipsForeignSaveGifBuffer, buf ),
+		VIPS_TYPE_BLOB );
+}
+
+static void
+vips_foreign_save_gif_buffer_init( VipsForeignSaveGifBuffer *buffer )
+{
+}
+
+typedef struct _VipsForeignSaveGifTarget {
+	VipsForeignSaveGif parent_object;
+
+	/* Save to a target.
+	 */
+	VipsTarget *target;
+
+} VipsForeignSaveGifTarget;
+
+typedef VipsForeignSaveGifClass VipsForeignSaveGifTargetClass;
+
+G_DEFINE_TYPE( VipsForeignSaveGifTarget, vips_foreign_save_gif_target,
+	vips_foreign_save_gif_get_type() );
+
+static int
+vips_foreign_save_gif_target_build( VipsObject *object )
+{
+	VipsForeignSaveGif *gif = (VipsForeignSaveGif *) object;
+	VipsForeignSaveGifTarget *target = (VipsForeignSaveGifTarget *) object;
+
+	gif->target = target->target;
+	g_object_ref( gif->target );
+
+	if( VIPS_OBJECT_CLASS( vips_foreign_save_gif_target_parent_class )->
+		build( object ) )
+		return( -1 );
+
+	return( 0 );
+}
+
+static void
+vips_foreign_save_gif_target_class_init(
+	VipsForeignSaveGifTargetClass *class )
+{
+	GObjectClass *gobject_class = G_OBJECT_CLASS( class );
+	VipsObjectClass *object_class = (VipsObjectClass *) class;
+
+	gobject_class->set_property = vips_object_set_property;
+	gobject_class->get_property = vips_object_get_property;
+
+	object_class->nickname = "gifsave_target";
+	object_class->description = _( "save image to gif target" );
+	object_class->build = vips_foreign_save_gif_target_build;
+
+	VIPS_ARG_OBJECT( class, "target", 1,
+		_( "Target" ),
+		_( "Target to save to" ),
+		VIPS_ARGUMENT_REQUIRED_INPUT,
+		G_STRUCT_OFFSET( VipsForeignSaveGifTarget, target ),
+		VIPS_TYPE_TARGET );
+}
+
+static void
+vips_foreign_save_gif_target_init( VipsForeignSaveGifTarget *target )
+{
+}
+
+/**
+ * vips_gifsave: (method)
+ * @in: image to save
+ * @filename: file to write to
+ * @...: %NULL-terminated list of optional named arguments
+ *
+ * Optional arguments:
+ *
+ * * @bitdepth: %gint, number of bits per pixel
+ * * @reuse: %gboolean, reuse the global palette for later frames
+ * * @interpalette_maxerror: %gdouble, maximum extra error for reuse
+ *
+ * Write a VIPS image to a file as GIF. This is a native encoder, it does not
+ * need giflib or ImageMagick.
+ *
+ * The image is converted to sRGB with an optional alpha before saving. Pixels
+ * with alpha less than 128 are written as transparent.
+ *
+ * The image is quantised to 2 ** @bitdepth colours (default 256) with a
+ * median cut over a 15-bit histogram, refined with k-means. There is no
+ * dithering.
+ *
+ * If the image has #VIPS_META_PAGE_HEIGHT set, each page is saved as a
+ * frame. The "gif-delay" and "gif-loop" metadata items, as attached by
+ * vips_gifload(), set the frame delay in centiseconds and the loop count.
+ * The palette of the first frame is used as the global colour table.
+ * Set @reuse to %FALSE to give every later frame a local colour table,
+ * otherwise later frames only get one if the global table gives an RMS
+ * error more than @interpalette_maxerror (default 3) worse than it did for
+ * the first frame.
+ *
+ * Frames are quantised and coded in parallel and written in order, so only
+ * a few frames are held in memory at once.
+ *
+ * See also: vips_gifload(), vips_image_write_to_file().
+ *
+ * Returns: 0 on success, -1 on error.
+ */
+int
+vips_gifsave( VipsImage *in, const char *filename, ... )
+{
+	va_list ap;
+	int result;
+
+	va_start( ap, filename );
+	result = vips_call_split( "gifsave", ap, in, filename );
+	va_end( ap );
+
+	return( result );
+}
+
+/**
+ * vips_gifsave_buffer: (method)
+ * @in: image to save
+ * @buf: (array length=len) (element-type guint8): return output buffer here
+ * @len: (type gsize): return output length here
+ * @...: %NULL-terminated list of optional named arguments
+ *
+ * Optional arguments:
+ *
+ * * @bitdepth: %gint, number of bits per pixel
+ * * @reuse: %gboolean, reuse the global palette for later frames
+ * * @interpalette_maxerror: %gdouble, maximum extra error for reuse
+ *
+ * As vips_gifsave(), but save to a memory buffer.
+ *
+ * The address of the buffer is returned in @buf, the length of the buffer in
+ * @len. You are responsible for freeing the buffer with g_free() when you
+ * are done with it.
+ *
+ * See also: vips_gifsave(), vips_image_write_to_file().
+ *
+ * Returns: 0 on success, -1 on error.
+ */
+int
+vips_gifsave_buffer( VipsImage *in, void **buf, size_t *len, ... )
+{
+	va_list ap;
+	VipsArea *area;
+	int result;
+
+	area = NULL;
+
+	va_start( ap, len );
+	result = vips_call_split( "gifsave_buffer", ap, in, &area );
+	va_end( ap );
+
+	if( !result &&
+		area ) {
+		if( buf ) {
+			*buf = area->data;
+			area->free_fn = NULL;
+		}
+		if( len )
+			*len = area->length;
+
+		vips_area_unref( area );
+	}
+
+	return( result );
+}
+
+/**
+ * vips_gifsave_target: (method)
+ * @in: image to save
+ * @target: save image to this target
+ * @...: %NULL-terminated list of optional named arguments
+ *
+ * Optional arguments:
+ *
+ * * @bitdepth: %gint, number of bits per pixel
+ * * @reuse: %gboolean, reuse the global palette for later frames
+ * * @interpalette_maxerror: %gdouble, maximum extra error for reuse
+ *
+ * As vips_gifsave(), but save to a target.
+ *
+ * See also: vips_gifsave(), vips_image_write_to_target().
+ *
+ * Returns: 0 on success, -1 on error.
+ */
+int
+vips_gifsave_target( VipsImage *in, VipsTarget *target, ... )
+{
+	va_list ap;
+	int result;
+
+	va_start( ap, target );
+	result = vips_call_split( "gifsave_target", ap, in, target );
+	va_end( ap );
+
+	return( result );
+}
@@ -98,6 +98,17 @@
  * 	- set interlaced=1 for interlaced images
  * 10/4/18
  * 	- strict round down on shrink-on-load
+ * 14/10/18
+ * 	- decode in parallel if there are restart markers on MCU row
+ * 	  boundaries
+ * 	- shrink 16 and 32, reading raw YCbCr planes where we can
+ * 	- read from / write to VipsSource and VipsTarget
+ * 	- decode progressive images a scan at a time if there are
+ * 	  ::preview handlers
+ * 	- stop inside the row loop if the pipeline is killed, see
+ * 	  vips_thread_iskilled()
+ * 15/10/18
+ * 	- mmap regular files and decode from memory, falling back to stdio
  */
 
 /*
@@ -155,7 +166,7 @@
 /* Stuff we track during a read.
  */
 typedef struct _ReadJpeg {
-	/* Shrink by this much during load. 1, 2, 4, 8.
+	/* Shrink by this much during load. 1, 2, 4, 8, 16, 32.
 	 */
 	int shrink;
 
@@ -167,6 +178,10 @@ typedef struct _ReadJpeg {
 	 */
 	char *filename;
 
+	/* Used for source input only.
+	 */
+	VipsSource *source;
+
 	struct jpeg_decompress_struct cinfo;
         ErrorManager eman;
 	gboolean invert_pels;
@@ -186,6 +201,38 @@ typedef struct _ReadJpeg {
 	 */
 	int output_width;
 	int output_height;
+
+	/* The whole compressed image. This is the caller's buffer, or for
+	 * file input we map the file to data_mapped, or if we can't map it,
+	 * load the file to data_owned.
+	 */
+	const VipsPel *data;
+	size_t data_length;
+	void *data_owned;
+	void *data_mapped;
+
+	/* Set if we can decode bands of the image in parallel, see
+	 * readjpeg_parallel_init().
+	 */
+	gboolean parallel;
+	size_t header_length;		/* Up to the end of SOS */
+	size_t sof_height;		/* Offset of height in SOF */
+	int intervals_per_chunk;	/* Restart intervals per chunk */
+	int chunk_height;		/* Image rows per chunk */
+	int n_chunks;
+	size_t *chunk_offset;		/* Entropy data for each chunk */
+	int overlap;			/* Extra chunks for upsampling */
+	int band_height;		/* Output rows per band */
+
+	/* Set if we shrink beyond what libjpeg can do by reading raw YCbCr
+	 * planes, see readjpeg_raw_init().
+	 */
+	gboolean raw;
+	int raw_imcu_rows;		/* iMCU rows per output line */
+	int raw_hbox[3];		/* Box size in each plane */
+	int raw_vbox[3];
+	int raw_stride[3];
+	VipsPel *raw_buf[3];		/* raw_vbox rows of each plane */
 } ReadJpeg;
 
 /* This can be called many times.
@@ -194,6 +241,7 @@ static int
 readjpeg_free( ReadJpeg *jpeg )
 {
 	int result;
+	int i;
 
 	result = 0;
 
@@ -214,12 +262,26 @@ readjpeg_free( ReadJpeg *jpeg )
 
 	VIPS_FREEF( fclose, jpeg->eman.fp );
 	VIPS_FREE( jpeg->filename );
+	VIPS_FREE( jpeg->data_owned );
+	VIPS_UNREF( jpeg->source );
+	VIPS_FREE( jpeg->chunk_offset );
+	for( i = 0; i < 3; i++ )
+		VIPS_FREE( jpeg->raw_buf[i] );
 	jpeg->eman.fp = NULL;
 
 	/* I don't think this can fail. It's harmless to call many times. 
 	 */
 	jpeg_destroy_decompress( &jpeg->cinfo );
 
+	/* After the decompressor, since it might be pointing into the map.
+	 */
+	if( jpeg->data_mapped ) {
+		vips__munmap( jpeg->data_mapped, jpeg->data_length );
+		jpeg->data_mapped = NULL;
+		jpeg->data = NULL;
+		jpeg->data_length = 0;
+	}
+
 	return( result );
 }
 
@@ -233,6 +295,7 @@ static ReadJpeg *
 readjpeg_new( VipsImage *out, int shrink, gboolean fail, gboolean autorotate )
 {
 	ReadJpeg *jpeg;
+	int i;
 
 	if( !(jpeg = VIPS_NEW( out, ReadJpeg )) )
 		return( NULL );
@@ -240,12 +303,22 @@ readjpeg_new( VipsImage *out, int shrink, gboolean fail, gboolean autorotate )
 	jpeg->shrink = shrink;
 	jpeg->fail = fail;
 	jpeg->filename = NULL;
+	jpeg->source = NULL;
         jpeg->cinfo.err = jpeg_std_error( &jpeg->eman.pub );
 	jpeg->eman.pub.error_exit = vips__new_error_exit;
 	jpeg->eman.pub.output_message = vips__new_output_message;
 	jpeg->eman.fp = NULL;
 	jpeg->y_pos = 0;
 	jpeg->autorotate = autorotate;
+	jpeg->data = NULL;
+	jpeg->data_length = 0;
+	jpeg->data_owned = NULL;
+	jpeg->data_mapped = NULL;
+	jpeg->parallel = FALSE;
+	jpeg->chunk_offset = NULL;
+	jpeg->raw = FALSE;
+	for( i = 0; i < 3; i++ )
+		jpeg->raw_buf[i] = NULL;
 
 	/* This is used by the error handlers to signal invalidate on the
 	 * output image.
@@ -266,12 +339,24 @@ readjpeg_new( VipsImage *out, int shrink, gboolean fail, gboolean autorotate )
 	return( jpeg );
 }
 
-/* Set input to a file.
+static void readjpeg_buffer( ReadJpeg *jpeg, const void *buf, size_t len );
+
+/* Set input to a file. We decode straight from a map of the file if we can,
+ * or fall back to stdio for things like pipes. 
  */
 static int
 readjpeg_file( ReadJpeg *jpeg, const char *filename )
 {
 	jpeg->filename = g_strdup( filename );
+
+	if( (jpeg->data_mapped = 
+		vips__mmap_file( filename, &jpeg->data_length )) ) {
+		jpeg->data = (const VipsPel *) jpeg->data_mapped;
+		readjpeg_buffer( jpeg, jpeg->data, jpeg->data_length );
+
+		return( 0 );
+	}
+
         if( !(jpeg->eman.fp = vips__file_open_read( filename, NULL, FALSE )) ) 
                 return( -1 );
         jpeg_stdio_src( &jpeg->cinfo, jpeg->eman.fp );
@@ -354,7 +439,7 @@ read_jpeg_header( ReadJpeg *jpeg, VipsImage *out )
 	 * for YUV YCCK etc.
 	 */
 	jpeg_read_header( cinfo, TRUE );
-	cinfo->scale_denom = jpeg->shrink;
+	cinfo->scale_denom = VIPS_MIN( jpeg->shrink, 8 );
 	cinfo->scale_num = 1;
 	jpeg_calc_output_dimensions( cinfo );
 
@@ -649,6 +734,11 @@ read_jpeg_generate( VipsRegion *or,
 	for( y = 0; y < r->height; y++ ) {
 		JSAMPROW row_pointer[1];
 
+		if( vips_thread_iskilled() ) {
+			VIPS_GATE_STOP( "read_jpeg_generate: work" );
+			return( -1 );
+		}
+
 		row_pointer[0] = (JSAMPLE *) 
 			VIPS_REGION_ADDR( or, 0, r->top + y );
 
@@ -675,6 +765,710 @@ read_jpeg_generate( VipsRegion *or,
 	return( 0 );
 }
 
+/* Shrink by more than 8.
+ *
+ * libjpeg can only shrink by up to 8 during IDCT. For larger shrinks of
+ * YCbCr images we read raw planes at 1/8 scale, box shrink each plane at
+ * its own resolution, and only then convert to RGB. This means we never
+ * upsample chroma or colour convert at the larger size.
+ */
+
+#if JPEG_LIB_VERSION >= 70
+#define RAW_H_SCALED( C ) ((C)->DCT_h_scaled_size)
+#define RAW_V_SCALED( C ) ((C)->DCT_v_scaled_size)
+#define RAW_MIN_H_SCALED( C ) ((C)->min_DCT_h_scaled_size)
+#define RAW_MIN_V_SCALED( C ) ((C)->min_DCT_v_scaled_size)
+#else /*JPEG_LIB_VERSION < 70*/
+#define RAW_H_SCALED( C ) ((C)->DCT_scaled_size)
+#define RAW_V_SCALED( C ) ((C)->DCT_scaled_size)
+#define RAW_MIN_H_SCALED( C ) ((C)->min_DCT_scaled_size)
+#define RAW_MIN_V_SCALED( C ) ((C)->min_DCT_scaled_size)
+#endif /*JPEG_LIB_VERSION >= 70*/
+
+/* Can we use raw read for this image? The header must have been read. Call
+ * before jpeg_start_decompress().
+ */
+static gboolean
+readjpeg_raw_init( ReadJpeg *jpeg )
+{
+	struct jpeg_decompress_struct *cinfo = &jpeg->cinfo;
+	int factor = jpeg->shrink / 8;
+
+	int lines;
+	int i;
+
+	if( jpeg->shrink <= 8 ||
+		cinfo->jpeg_color_space != JCS_YCbCr ||
+		cinfo->out_color_space != JCS_RGB ||
+		cinfo->num_components != 3 )
+		return( FALSE );
+
+	/* Each output line must be made from a whole number of iMCU rows,
+	 * and from a whole number of samples in each plane.
+	 */
+	lines = cinfo->max_v_samp_factor * RAW_MIN_V_SCALED( cinfo );
+	if( factor % lines != 0 )
+		return( FALSE );
+	jpeg->raw_imcu_rows = factor / lines;
+
+	for( i = 0; i < 3; i++ ) {
+		jpeg_component_info *comp = &cinfo->comp_info[i];
+		int h = factor * comp->h_samp_factor * RAW_H_SCALED( comp );
+		int h_max = cinfo->max_h_samp_factor *
+			RAW_MIN_H_SCALED( cinfo );
+
+		if( h % h_max != 0 )
+			return( FALSE );
+
+		jpeg->raw_hbox[i] = h / h_max;
+		jpeg->raw_vbox[i] = jpeg->raw_imcu_rows *
+			comp->v_samp_factor * RAW_V_SCALED( comp );
+		jpeg->raw_stride[i] = comp->width_in_blocks *
+			RAW_H_SCALED( comp );
+	}
+
+	for( i = 0; i < 3; i++ )
+		if( !(jpeg->raw_buf[i] = VIPS_ARRAY( NULL,
+			jpeg->raw_vbox[i] * jpeg->raw_stride[i], VipsPel )) )
+			return( FALSE );
+
+	cinfo->raw_data_out = TRUE;
+	jpeg->raw = TRUE;
+
+	return( TRUE );
+}
+
+/* Box shrink plane @i at @x.
+ */
+static int
+readjpeg_raw_box( ReadJpeg *jpeg, int i, int x )
+{
+	int hbox = jpeg->raw_hbox[i];
+	int vbox = jpeg->raw_vbox[i];
+	int n = hbox * vbox;
+	VipsPel *p = jpeg->raw_buf[i] + x * hbox;
+
+	int sum;
+	int bx, by;
+
+	sum = 0;
+	for( by = 0; by < vbox; by++ ) {
+		for( bx = 0; bx < hbox; bx++ )
+			sum += p[bx];
+
+		p += jpeg->raw_stride[i];
+	}
+
+	return( (sum + n / 2) / n );
+}
+
+/* The YCbCr -> RGB transform libjpeg uses, in 16 bit fixed point.
+ */
+#define RAW_FIX( X ) ((int) ((X) * (1 << 16) + 0.5))
+
+static void
+readjpeg_raw_line( ReadJpeg *jpeg, VipsPel *q )
+{
+	int x;
+
+	for( x = 0; x < jpeg->output_width; x++ ) {
+		int y = readjpeg_raw_box( jpeg, 0, x );
+		int cb = readjpeg_raw_box( jpeg, 1, x ) - 128;
+		int cr = readjpeg_raw_box( jpeg, 2, x ) - 128;
+
+		int r = y +
+			((RAW_FIX( 1.40200 ) * cr + (1 << 15)) >> 16);
+		int g = y +
+			((-RAW_FIX( 0.34414 ) * cb - RAW_FIX( 0.71414 ) * cr +
+			  (1 << 15)) >> 16);
+		int b = y +
+			((RAW_FIX( 1.77200 ) * cb + (1 << 15)) >> 16);
+
+		q[0] = VIPS_CLIP( 0, r, 255 );
+		q[1] = VIPS_CLIP( 0, g, 255 );
+		q[2] = VIPS_CLIP( 0, b, 255 );
+
+		q += 3;
+	}
+}
+
+static int
+read_jpeg_raw_generate( VipsRegion *or,
+	void *seq, void *a, void *b, gboolean *stop )
+{
+        VipsRect *r = &or->valid;
+	ReadJpeg *jpeg = (ReadJpeg *) a;
+	struct jpeg_decompress_struct *cinfo = &jpeg->cinfo;
+	int lines = cinfo->max_v_samp_factor * RAW_MIN_V_SCALED( cinfo );
+
+	JSAMPROW rows[3][MAX_SAMP_FACTOR * DCTSIZE];
+	JSAMPARRAY planes[3];
+	int y, i, j, k;
+
+	VIPS_GATE_START( "read_jpeg_raw_generate: work" );
+
+	/* We're inside a vips_sequential(), so we should always be asked for
+	 * full-width strips in order.
+	 */
+	g_assert( r->left == 0 );
+	g_assert( r->width == or->im->Xsize );
+
+	if( r->top != jpeg->y_pos ) {
+		VIPS_GATE_STOP( "read_jpeg_raw_generate: work" );
+		vips_error( "VipsJpeg",
+			_( "out of order read at line %d" ), jpeg->y_pos );
+
+		return( -1 );
+	}
+
+	/* Here for longjmp() from vips__new_error_exit().
+	 */
+	if( setjmp( jpeg->eman.jmp ) ) {
+		VIPS_GATE_STOP( "read_jpeg_raw_generate: work" );
+
+		return( -1 );
+	}
+
+	/* As read_jpeg_generate(), fail on any warnings if fail is set.
+	 */
+	if( jpeg->eman.pub.num_warnings > 0 &&
+		jpeg->fail ) {
+		VIPS_GATE_STOP( "read_jpeg_raw_generate: work" );
+		jpeg->eman.pub.num_warnings = 0;
+
+		return( -1 );
+	}
+
+	for( i = 0; i < 3; i++ )
+		planes[i] = rows[i];
+
+	for( y = 0; y < r->height; y++ ) {
+		for( j = 0; j < jpeg->raw_imcu_rows; j++ ) {
+			for( i = 0; i < 3; i++ ) {
+				int n = jpeg->raw_vbox[i] /
+					jpeg->raw_imcu_rows;
+
+				for( k = 0; k < n; k++ )
+					rows[i][k] = jpeg->raw_buf[i] +
+						(j * n + k) *
+							jpeg->raw_stride[i];
+			}
+
+			jpeg_read_raw_data( cinfo, planes, lines );
+		}
+
+		readjpeg_raw_line( jpeg,
+			VIPS_REGION_ADDR( or, 0, r->top + y ) );
+
+		jpeg->y_pos += 1;
+	}
+
+	if( jpeg->y_pos >= or->im->Ysize )
+		jpeg_destroy_decompress( &jpeg->cinfo );
+
+	VIPS_GATE_STOP( "read_jpeg_raw_generate: work" );
+
+	return( 0 );
+}
+
+/* Parallel decode.
+ *
+ * If the image is baseline with restart markers at MCU row boundaries, we
+ * can split the entropy coded data into chunks of rows which decode
+ * independently. Each thread makes a small JPEG stream for the chunks it
+ * needs (the header with the height patched, the chunks, and an EOI) and
+ * decodes that with its own decompressor.
+ *
+ * Vertically subsampled chroma needs the rows either side for fancy
+ * upsampling, so for those images we decode an extra chunk above and below
+ * each band and throw it away.
+ */
+
+/* Try to make bands at least this many output rows high.
+ */
+#define PARALLEL_BAND_HEIGHT (128)
+
+static void readjpeg_source_buffer( j_decompress_ptr cinfo,
+	const void *buf, size_t len );
+
+/* Find the end of the SOS segment, and the position of the height in SOF.
+ */
+static int
+readjpeg_parallel_header( ReadJpeg *jpeg )
+{
+	const VipsPel *data = jpeg->data;
+	size_t length = jpeg->data_length;
+
+	size_t p;
+
+	jpeg->sof_height = 0;
+	jpeg->header_length = 0;
+
+	if( length < 4 ||
+		data[0] != 0xff ||
+		data[1] != 0xd8 )
+		return( -1 );
+
+	p = 2;
+	while( p + 4 <= length ) {
+		int marker;
+		size_t seg_length;
+
+		if( data[p] != 0xff )
+			return( -1 );
+		marker = data[p + 1];
+
+		/* Fill bytes.
+		 */
+		if( marker == 0xff ) {
+			p += 1;
+			continue;
+		}
+
+		seg_length = (data[p + 2] << 8) | data[p + 3];
+		if( seg_length < 2 ||
+			p + 2 + seg_length > length )
+			return( -1 );
+
+		/* Baseline and extended sequential Huffman only.
+		 */
+		if( marker == 0xc0 ||
+			marker == 0xc1 ) {
+			if( seg_length < 8 )
+				return( -1 );
+			jpeg->sof_height = p + 5;
+		}
+		else if( marker >= 0xc2 &&
+			marker <= 0xcf &&
+			marker != 0xc4 &&
+			marker != 0xc8 &&
+			marker != 0xcc )
+			return( -1 );
+
+		if( marker == 0xda ) {
+			jpeg->header_length = p + 2 + seg_length;
+			break;
+		}
+
+		p += 2 + seg_length;
+	}
+
+	if( !jpeg->sof_height ||
+		!jpeg->header_length )
+		return( -1 );
+
+	return( 0 );
+}
+
+/* Find the start of each chunk in the entropy coded data. The markers must
+ * count up in sequence, and the scan must end with EOI.
+ */
+static int
+readjpeg_parallel_index( ReadJpeg *jpeg, int n_intervals )
+{
+	const VipsPel *data = jpeg->data;
+	size_t length = jpeg->data_length;
+
+	size_t p;
+	int interval;
+
+	if( !(jpeg->chunk_offset =
+		VIPS_ARRAY( NULL, jpeg->n_chunks + 1, size_t )) )
+		return( -1 );
+	jpeg->chunk_offset[0] = jpeg->header_length;
+
+	interval = 0;
+	for( p = jpeg->header_length; p + 1 < length; p++ ) {
+		int marker;
+
+		if( data[p] != 0xff )
+			continue;
+		marker = data[p + 1];
+
+		/* Stuffed zero, or fill.
+		 */
+		if( marker == 0 ||
+			marker == 0xff )
+			continue;
+
+		if( marker < 0xd0 ||
+			marker > 0xd7 )
+			break;
+
+		if( marker - 0xd0 != interval % 8 )
+			return( -1 );
+		interval += 1;
+		p += 1;
+
+		if( interval % jpeg->intervals_per_chunk == 0 ) {
+			int chunk = interval / jpeg->intervals_per_chunk;
+
+			if( chunk >= jpeg->n_chunks )
+				return( -1 );
+			jpeg->chunk_offset[chunk] = p + 1;
+		}
+	}
+
+	/* We need EOI, and n_intervals - 1 markers.
+	 */
+	if( p + 1 >= length ||
+		data[p + 1] != JPEG_EOI ||
+		interval != n_intervals - 1 )
+		return( -1 );
+
+	/* The end of the final chunk. Add the size of a marker, so every
+	 * chunk ends two bytes before the start of the next.
+	 */
+	jpeg->chunk_offset[jpeg->n_chunks] = p + 2;
+
+	return( 0 );
+}
+
+/* Can we decode this image in parallel? Set up the chunk index if we can.
+ * The header must have been read.
+ */
+static gboolean
+readjpeg_parallel_init( ReadJpeg *jpeg )
+{
+	struct jpeg_decompress_struct *cinfo = &jpeg->cinfo;
+
+	int mcu_width;
+	int mcu_height;
+	int mcus_per_row;
+	int mcu_rows;
+	int chunk_rows;
+	int n_intervals;
+	int chunk_out;
+	int band_chunks;
+
+	if( vips_concurrency_get() < 2 ||
+		jpeg->shrink > 8 ||
+		cinfo->restart_interval == 0 ||
+		cinfo->progressive_mode ||
+		cinfo->comps_in_scan != cinfo->num_components ||
+		cinfo->image_height == 0 )
+		return( FALSE );
+
+#if JPEG_LIB_VERSION >= 80
+	if( cinfo->block_size != DCTSIZE )
+		return( FALSE );
+#endif /*JPEG_LIB_VERSION >= 80*/
+
+	/* A single component scan is not interleaved and has 1 block per
+	 * MCU.
+	 */
+	if( cinfo->num_components == 1 ) {
+		mcu_width = DCTSIZE;
+		mcu_height = DCTSIZE;
+	}
+	else {
+		mcu_width = cinfo->max_h_samp_factor * DCTSIZE;
+		mcu_height = cinfo->max_v_samp_factor * DCTSIZE;
+	}
+	mcus_per_row = VIPS_ROUND_UP( cinfo->image_width, mcu_width ) /
+		mcu_width;
+	mcu_rows = VIPS_ROUND_UP( cinfo->image_height, mcu_height ) /
+		mcu_height;
+
+	/* Restart intervals must fall on row boundaries.
+	 */
+	if( cinfo->restart_interval % mcus_per_row == 0 ) {
+		jpeg->intervals_per_chunk = 1;
+		chunk_rows = cinfo->restart_interval / mcus_per_row;
+	}
+	else if( mcus_per_row % cinfo->restart_interval == 0 ) {
+		jpeg->intervals_per_chunk =
+			mcus_per_row / cinfo->restart_interval;
+		chunk_rows = 1;
+	}
+	else
+		return( FALSE );
+
+	jpeg->chunk_height = chunk_rows * mcu_height;
+	jpeg->n_chunks = VIPS_ROUND_UP( mcu_rows, chunk_rows ) / chunk_rows;
+	jpeg->overlap = cinfo->num_components > 1 &&
+		cinfo->max_v_samp_factor > 1 ? 1 : 0;
+	n_intervals = (VIPS_ROUND_UP( (gint64) mcus_per_row * mcu_rows,
+		cinfo->restart_interval ) / cinfo->restart_interval);
+
+	/* mcu_height is a multiple of 8, so this is exact.
+	 */
+	chunk_out = jpeg->chunk_height / jpeg->shrink;
+	band_chunks = VIPS_MAX( 1,
+		VIPS_ROUND_UP( PARALLEL_BAND_HEIGHT, chunk_out ) / chunk_out );
+	jpeg->band_height = band_chunks * chunk_out;
+
+	/* Not worth it if there's only one band, or if the overlap would
+	 * more than double the work.
+	 */
+	if( jpeg->n_chunks <= band_chunks ||
+		(jpeg->overlap &&
+		 band_chunks < 2) )
+		return( FALSE );
+
+	/* For file input, we need the whole file in memory. libjpeg is
+	 * reading from this fp, so we must put the file position back.
+	 */
+	if( !jpeg->data ) {
+		long pos;
+		size_t length;
+
+		if( !jpeg->eman.fp ||
+			(pos = ftell( jpeg->eman.fp )) < 0 )
+			return( FALSE );
+
+		jpeg->data_owned = vips__file_read( jpeg->eman.fp,
+			jpeg->filename, &length );
+		if( fseek( jpeg->eman.fp, pos, SEEK_SET ) ) {
+			vips_error_clear();
+			return( FALSE );
+		}
+		if( !jpeg->data_owned ) {
+			vips_error_clear();
+			return( FALSE );
+		}
+		jpeg->data = jpeg->data_owned;
+		jpeg->data_length = length;
+	}
+
+	if( readjpeg_parallel_header( jpeg ) ||
+		readjpeg_parallel_index( jpeg, n_intervals ) ) {
+		vips_error_clear();
+		VIPS_FREE( jpeg->chunk_offset );
+		return( FALSE );
+	}
+
+#ifdef DEBUG
+	printf( "readjpeg_parallel_init: %d chunks of %d rows, "
+		"band height %d, overlap %d\n",
+		jpeg->n_chunks, jpeg->chunk_height,
+		jpeg->band_height, jpeg->overlap );
+#endif /*DEBUG*/
+
+	return( TRUE );
+}
+
+/* Make a JPEG stream for chunks first to last. buf must be large enough.
+ */
+static size_t
+readjpeg_parallel_stream( ReadJpeg *jpeg, VipsPel *buf, int first, int last )
+{
+	struct jpeg_decompress_struct *cinfo = &jpeg->cinfo;
+	size_t start = jpeg->chunk_offset[first];
+	size_t end = jpeg->chunk_offset[last + 1] - 2;
+	int top = first * jpeg->chunk_height;
+	int bottom = VIPS_MIN( cinfo->image_height,
+		(last + 1) * jpeg->chunk_height );
+	int base = (first * jpeg->intervals_per_chunk) % 8;
+
+	VipsPel *q;
+	size_t i;
+
+	memcpy( buf, jpeg->data, jpeg->header_length );
+	buf[jpeg->sof_height] = (bottom - top) >> 8;
+	buf[jpeg->sof_height + 1] = (bottom - top) & 0xff;
+
+	/* Copy the entropy coded data, renumbering restart markers so the
+	 * first interval is followed by RST0.
+	 */
+	q = buf + jpeg->header_length;
+	memcpy( q, jpeg->data + start, end - start );
+	for( i = 0; i + 1 < end - start; i++ )
+		if( q[i] == 0xff ) {
+			int marker = q[i + 1];
+
+			if( marker >= 0xd0 &&
+				marker <= 0xd7 ) {
+				q[i + 1] = 0xd0 +
+					(marker - 0xd0 + 8 - base) % 8;
+				i += 1;
+			}
+			else if( marker == 0 )
+				i += 1;
+		}
+	q += end - start;
+
+	q[0] = 0xff;
+	q[1] = JPEG_EOI;
+	q += 2;
+
+	return( q - buf );
+}
+
+/* Per-thread decode state.
+ */
+typedef struct _ReadJpegSequence {
+	ReadJpeg *jpeg;
+
+	struct jpeg_decompress_struct cinfo;
+	ErrorManager eman;
+	gboolean created;
+
+	/* The stream we build for each band.
+	 */
+	VipsPel *buf;
+	size_t buf_size;
+
+	/* Somewhere to decode overlap rows to.
+	 */
+	VipsPel *line;
+} ReadJpegSequence;
+
+static int
+read_jpeg_parallel_stop( void *vseq, void *a, void *b )
+{
+	ReadJpegSequence *seq = (ReadJpegSequence *) vseq;
+
+	if( seq->eman.pub.num_warnings != 0 )
+		g_warning( _( "read gave %ld warnings" ),
+			seq->eman.pub.num_warnings );
+	if( seq->created )
+		jpeg_destroy_decompress( &seq->cinfo );
+	VIPS_FREE( seq->buf );
+	VIPS_FREE( seq->line );
+	VIPS_FREE( seq );
+
+	return( 0 );
+}
+
+static void *
+read_jpeg_parallel_start( VipsImage *out, void *a, void *b )
+{
+	ReadJpeg *jpeg = (ReadJpeg *) a;
+
+	ReadJpegSequence *seq;
+
+	if( !(seq = VIPS_NEW( NULL, ReadJpegSequence )) )
+		return( NULL );
+	seq->jpeg = jpeg;
+	seq->created = FALSE;
+	seq->buf = NULL;
+	seq->buf_size = 0;
+	seq->line = NULL;
+	seq->cinfo.err = jpeg_std_error( &seq->eman.pub );
+	seq->eman.pub.error_exit = vips__new_error_exit;
+	seq->eman.pub.output_message = vips__new_output_message;
+	seq->eman.fp = NULL;
+	seq->cinfo.client_data = jpeg->cinfo.client_data;
+
+	if( !(seq->line = VIPS_ARRAY( NULL,
+		VIPS_IMAGE_SIZEOF_LINE( out ), VipsPel )) ) {
+		read_jpeg_parallel_stop( seq, a, b );
+		return( NULL );
+	}
+
+	if( setjmp( seq->eman.jmp ) ) {
+		read_jpeg_parallel_stop( seq, a, b );
+		return( NULL );
+	}
+
+	jpeg_create_decompress( &seq->cinfo );
+	seq->created = TRUE;
+
+	return( seq );
+}
+
+static int
+read_jpeg_parallel_generate( VipsRegion *or,
+	void *vseq, void *a, void *b, gboolean *stop )
+{
+	ReadJpegSequence *seq = (ReadJpegSequence *) vseq;
+	ReadJpeg *jpeg = (ReadJpeg *) a;
+	struct jpeg_decompress_struct *cinfo = &seq->cinfo;
+        VipsRect *r = &or->valid;
+	int chunk_out = jpeg->chunk_height / jpeg->shrink;
+	int first = VIPS_MAX( 0, r->top / chunk_out - jpeg->overlap );
+	int last = VIPS_MIN( jpeg->n_chunks - 1,
+		(VIPS_RECT_BOTTOM( r ) - 1) / chunk_out + jpeg->overlap );
+	int sz = or->im->Xsize * or->im->Bands;
+	size_t size = jpeg->header_length +
+		jpeg->chunk_offset[last + 1] - jpeg->chunk_offset[first];
+
+	size_t length;
+	int y;
+
+#ifdef DEBUG_VERBOSE
+	printf( "read_jpeg_parallel_generate: %p line %d, %d rows, "
+		"chunks %d to %d\n",
+		g_thread_self(), r->top, r->height, first, last );
+#endif /*DEBUG_VERBOSE*/
+
+	/* We're inside a tilecache where tiles are the full image width.
+	 */
+	g_assert( r->left == 0 );
+	g_assert( r->width == or->im->Xsize );
+
+	if( size > seq->buf_size ) {
+		VIPS_FREE( seq->buf );
+		seq->buf_size = 0;
+		if( !(seq->buf = VIPS_ARRAY( NULL, size, VipsPel )) )
+			return( -1 );
+		seq->buf_size = size;
+	}
+
+	VIPS_GATE_START( "read_jpeg_parallel_generate: work" );
+
+	/* Here for longjmp() from vips__new_error_exit().
+	 */
+	if( setjmp( seq->eman.jmp ) ) {
+		jpeg_abort_decompress( cinfo );
+		VIPS_GATE_STOP( "read_jpeg_parallel_generate: work" );
+
+		return( -1 );
+	}
+
+	length = readjpeg_parallel_stream( jpeg, seq->buf, first, last );
+	readjpeg_source_buffer( cinfo, seq->buf, length );
+	jpeg_read_header( cinfo, TRUE );
+	cinfo->scale_denom = jpeg->shrink;
+	cinfo->scale_num = 1;
+	jpeg_start_decompress( cinfo );
+
+	if( cinfo->output_width != or->im->Xsize ||
+		cinfo->output_components != or->im->Bands ) {
+		jpeg_abort_decompress( cinfo );
+		VIPS_GATE_STOP( "read_jpeg_parallel_generate: work" );
+		vips_error( "VipsJpeg", "%s", _( "bad restart markers" ) );
+
+		return( -1 );
+	}
+
+	for( y = first * chunk_out; y < VIPS_RECT_BOTTOM( r ); y++ ) {
+		JSAMPROW row_pointer[1];
+
+		if( y < r->top )
+			row_pointer[0] = (JSAMPLE *) seq->line;
+		else
+			row_pointer[0] = (JSAMPLE *)
+				VIPS_REGION_ADDR( or, 0, y );
+
+		jpeg_read_scanlines( cinfo, &row_pointer[0], 1 );
+
+		if( jpeg->invert_pels &&
+			y >= r->top ) {
+			int x;
+
+			for( x = 0; x < sz; x++ )
+				row_pointer[0][x] = 255 - row_pointer[0][x];
+		}
+	}
+
+	jpeg_abort_decompress( cinfo );
+
+	VIPS_GATE_STOP( "read_jpeg_parallel_generate: work" );
+
+	/* As read_jpeg_generate(), fail on any warnings if fail is set.
+	 */
+	if( seq->eman.pub.num_warnings > 0 &&
+		jpeg->fail ) {
+		seq->eman.pub.num_warnings = 0;
+
+		return( -1 );
+	}
+
+	return( 0 );
+}
+
 /* Auto-rotate, if rotate_image is set.
  */
 static VipsImage *
@@ -705,6 +1499,200 @@ read_jpeg_rotate( VipsObject *process, VipsImage *im )
 	return( im );
 }
 
+/* Read with many threads into @raw, a header-only image.
+ */
+static int
+read_jpeg_image_parallel( ReadJpeg *jpeg, VipsImage *out, VipsImage *raw )
+{
+	VipsImage **t = (VipsImage **)
+		vips_object_local_array( VIPS_OBJECT( out ), 2 );
+
+	VipsImage *im;
+
+#ifdef DEBUG
+	printf( "read_jpeg_image_parallel: starting decompress\n" );
+#endif /*DEBUG*/
+
+	/* We've loaded everything we need, we can drop the decompressor and
+	 * the file.
+	 */
+	jpeg_destroy_decompress( &jpeg->cinfo );
+	VIPS_FREEF( fclose, jpeg->eman.fp );
+
+	/* Bands are expensive to make, so we must cache them. Each thread
+	 * makes bands independently.
+	 */
+	if( vips_image_generate( raw,
+		read_jpeg_parallel_start,
+		read_jpeg_parallel_generate,
+		read_jpeg_parallel_stop,
+		jpeg, NULL ) ||
+		vips_tilecache( raw, &t[0],
+			"tile_width", raw->Xsize,
+			"tile_height", jpeg->band_height,
+			"max_tiles", 2 * vips_concurrency_get(),
+			"threaded", TRUE,
+			NULL ) ||
+		vips_extract_area( t[0], &t[1],
+			0, 0, jpeg->output_width, jpeg->output_height, NULL ) )
+		return( -1 );
+
+	im = t[1];
+	if( jpeg->autorotate )
+		im = read_jpeg_rotate( VIPS_OBJECT( out ), im );
+
+	if( vips_image_write( im, out ) )
+		return( -1 );
+
+	return( 0 );
+}
+
+/* Crop, and shrink beyond what libjpeg can do.
+ */
+static int
+read_jpeg_post( ReadJpeg *jpeg, VipsImage *in, VipsImage **out )
+{
+	VipsImage *t;
+
+	if( !jpeg->raw &&
+		jpeg->shrink > 8 ) {
+		if( vips_shrink( in, &t,
+			jpeg->shrink / 8, jpeg->shrink / 8, NULL ) )
+			return( -1 );
+	}
+	else {
+		t = in;
+		g_object_ref( t );
+	}
+
+	if( vips_extract_area( t, out,
+		0, 0, jpeg->output_width, jpeg->output_height, NULL ) ) {
+		g_object_unref( t );
+		return( -1 );
+	}
+	g_object_unref( t );
+
+	return( 0 );
+}
+
+/* Send a snapshot of the partly-decoded image in @mem to any preview
+ * handlers on @out.
+ */
+static int
+read_jpeg_preview( ReadJpeg *jpeg, VipsImage *out, VipsImage *mem )
+{
+	VipsImage *snapshot;
+	VipsImage *t[3];
+	int result;
+
+	if( !(snapshot = vips_image_new_from_memory_copy(
+		VIPS_IMAGE_ADDR( mem, 0, 0 ), VIPS_IMAGE_SIZEOF_IMAGE( mem ),
+		mem->Xsize, mem->Ysize, mem->Bands, mem->BandFmt )) )
+		return( -1 );
+	snapshot->Type = mem->Type;
+
+	t[0] = snapshot;
+	t[1] = NULL;
+	t[2] = NULL;
+	result = 0;
+	if( read_jpeg_post( jpeg, t[0], &t[1] ) )
+		result = -1;
+	else if( jpeg->autorotate &&
+		vips_autorot_get_angle( mem ) != VIPS_ANGLE_D0 ) {
+		if( vips_rot( t[1], &t[2],
+			vips_autorot_get_angle( mem ), NULL ) )
+			result = -1;
+		else
+			vips_image_preview( out, t[2] );
+	}
+	else
+		vips_image_preview( out, t[1] );
+
+	VIPS_UNREF( t[2] );
+	VIPS_UNREF( t[1] );
+	VIPS_UNREF( t[0] );
+
+	return( result );
+}
+
+/* Progressive images are decoded a scan at a time in buffered-image mode,
+ * with a snapshot after each scan. Each scan is a full IDCT of the image,
+ * so this is much slower than a plain read, and we only do it when there
+ * are ::preview handlers.
+ */
+static int
+read_jpeg_image_progressive( ReadJpeg *jpeg, VipsImage *out,
+	VipsImage *header )
+{
+	struct jpeg_decompress_struct *cinfo = &jpeg->cinfo;
+	VipsImage **t = (VipsImage **)
+		vips_object_local_array( VIPS_OBJECT( out ), 2 );
+	int sz = cinfo->output_width * cinfo->output_components;
+
+	VipsImage *im;
+	int x, y;
+
+#ifdef DEBUG
+	printf( "read_jpeg_image_progressive: starting decompress\n" );
+#endif /*DEBUG*/
+
+	t[0] = vips_image_new_memory();
+	if( vips_image_pipelinev( t[0],
+		VIPS_DEMAND_STYLE_THINSTRIP, header, NULL ) ||
+		vips_image_write_prepare( t[0] ) )
+		return( -1 );
+
+	cinfo->buffered_image = TRUE;
+	jpeg_start_decompress( cinfo );
+
+	while( !jpeg_input_complete( cinfo ) ) {
+		jpeg_start_output( cinfo, cinfo->input_scan_number );
+
+		for( y = 0; y < t[0]->Ysize; y++ ) {
+			JSAMPROW row_pointer[1];
+
+			row_pointer[0] = (JSAMPLE *)
+				VIPS_IMAGE_ADDR( t[0], 0, y );
+			jpeg_read_scanlines( cinfo, &row_pointer[0], 1 );
+
+			if( jpeg->invert_pels )
+				for( x = 0; x < sz; x++ )
+					row_pointer[0][x] =
+						255 - row_pointer[0][x];
+		}
+
+		jpeg_finish_output( cinfo );
+
+		if( jpeg->eman.pub.num_warnings > 0 &&
+			jpeg->fail ) {
+			jpeg->eman.pub.num_warnings = 0;
+			return( -1 );
+		}
+
+		/* The final scan is the image itself.
+		 */
+		if( !jpeg_input_complete( cinfo ) &&
+			read_jpeg_preview( jpeg, out, t[0] ) )
+			return( -1 );
+	}
+
+	/* The coefficient buffer can be large, free it now.
+	 */
+	jpeg_destroy_decompress( cinfo );
+
+	if( read_jpeg_post( jpeg, t[0], &t[1] ) )
+		return( -1 );
+	im = t[1];
+
+	if( jpeg->autorotate )
+		im = read_jpeg_rotate( VIPS_OBJECT( out ), im );
+
+	if( vips_image_write( im, out ) )
+		return( -1 );
+
+	return( 0 );
+}
+
 /* Read a cinfo to a VIPS image.
  */
 static int
@@ -712,7 +1700,7 @@ read_jpeg_image( ReadJpeg *jpeg, VipsImage *out )
 {
 	struct jpeg_decompress_struct *cinfo = &jpeg->cinfo;
 	VipsImage **t = (VipsImage **) 
-		vips_object_local_array( VIPS_OBJECT( out ), 3 );
+		vips_object_local_array( VIPS_OBJECT( out ), 4 );
 
 	VipsImage *im;
 
@@ -725,6 +1713,21 @@ read_jpeg_image( ReadJpeg *jpeg, VipsImage *out )
 	if( read_jpeg_header( jpeg, t[0] ) )
 		return( -1 );
 
+	if( readjpeg_parallel_init( jpeg ) )
+		return( read_jpeg_image_parallel( jpeg, out, t[0] ) );
+
+	/* Raw read makes exactly the output size.
+	 */
+	if( readjpeg_raw_init( jpeg ) ) {
+		t[0]->Xsize = jpeg->output_width;
+		t[0]->Ysize = jpeg->output_height;
+	}
+
+	if( !jpeg->raw &&
+		jpeg_has_multiple_scans( cinfo ) &&
+		vips_image_preview_wanted( out ) )
+		return( read_jpeg_image_progressive( jpeg, out, t[0] ) );
+
 	jpeg_start_decompress( cinfo );
 
 #ifdef DEBUG
@@ -735,16 +1738,20 @@ read_jpeg_image( ReadJpeg *jpeg, VipsImage *out )
 	 * full lines of pixels and will attempt to write beyond the buffer.
 	 */
 	if( vips_image_generate( t[0], 
-		NULL, read_jpeg_generate, NULL, 
-		jpeg, NULL ) ||
+		NULL, jpeg->raw ? read_jpeg_raw_generate : read_jpeg_generate,
+		NULL, jpeg, NULL ) ||
 		vips_sequential( t[0], &t[1], 
 			"tile_height", 8,
-			NULL ) ||
-		vips_extract_area( t[1], &t[2], 
-			0, 0, jpeg->output_width, jpeg->output_height, NULL ) )
+			NULL ) )
+		return( -1 );
+	im = t[1];
+
+	/* libjpeg can only shrink by up to 8, we must do the rest.
+	 */
+	if( read_jpeg_post( jpeg, im, &t[3] ) )
 		return( -1 );
+	im = t[3];
 
-	im = t[2];
 	if( jpeg->autorotate )
 		im = read_jpeg_rotate( VIPS_OBJECT( out ), im );
 
@@ -949,9 +1956,8 @@ term_source (j_decompress_ptr cinfo)
  */
 
 static void
-readjpeg_buffer (ReadJpeg *jpeg, const void *buf, size_t len)
+readjpeg_source_buffer (j_decompress_ptr cinfo, const void *buf, size_t len)
 {
-  j_decompress_ptr cinfo = &jpeg->cinfo;
   InputBuffer *src;
 
   /* Empty buffer is a fatal error.
@@ -985,6 +1991,12 @@ readjpeg_buffer (ReadJpeg *jpeg, const void *buf, size_t len)
   src->pub.next_input_byte = buf;
 }
 
+static void
+readjpeg_buffer (ReadJpeg *jpeg, const void *buf, size_t len)
+{
+  readjpeg_source_buffer (&jpeg->cinfo, buf, len);
+}
+
 int
 vips__jpeg_read_buffer( const void *buf, size_t len, VipsImage *out, 
 	gboolean header_only, int shrink, int fail, gboolean autorotate )
@@ -1000,6 +2012,8 @@ vips__jpeg_read_buffer( const void *buf, size_t len, VipsImage *out,
 	/* Set input to buffer.
 	 */
 	readjpeg_buffer( jpeg, buf, len );
+	jpeg->data = (const VipsPel *) buf;
+	jpeg->data_length = len;
 
 	if( vips__jpeg_read( jpeg, out, header_only ) ) 
 		return( -1 );
@@ -1007,6 +2021,115 @@ vips__jpeg_read_buffer( const void *buf, size_t len, VipsImage *out,
 	return( 0 );
 }
 
+/* Read from a VipsSource. libjpeg pulls bytes through this source manager,
+ * so we never need the whole file in memory.
+ */
+
+#define SOURCE_BUFFER_SIZE (4096)
+
+typedef struct {
+	/* Public jpeg fields.
+	 */
+	struct jpeg_source_mgr pub;
+
+	/* Private stuff during read.
+	 */
+	VipsSource *source;
+	JOCTET buf[SOURCE_BUFFER_SIZE];
+} InputSource;
+
+static boolean
+fill_input_source( j_decompress_ptr cinfo )
+{
+	static const JOCTET eoi_buffer[4] = {
+		(JOCTET) 0xFF, (JOCTET) JPEG_EOI, 0, 0
+	};
+
+	InputSource *src = (InputSource *) cinfo->src;
+
+	gint64 bytes_read;
+
+	if( (bytes_read = vips_source_read( src->source,
+		src->buf, SOURCE_BUFFER_SIZE )) > 0 ) {
+		src->pub.next_input_byte = src->buf;
+		src->pub.bytes_in_buffer = bytes_read;
+	}
+	else {
+		/* End of source, or a read error. Insert a fake EOI marker
+		 * and let the warning handler decide.
+		 */
+		WARNMS( cinfo, JWRN_JPEG_EOF );
+		src->pub.next_input_byte = eoi_buffer;
+		src->pub.bytes_in_buffer = 2;
+	}
+
+	return( TRUE );
+}
+
+static void
+readjpeg_source( ReadJpeg *jpeg, VipsSource *source )
+{
+	j_decompress_ptr cinfo = &jpeg->cinfo;
+
+	InputSource *src;
+
+	jpeg->source = source;
+	g_object_ref( source );
+
+	if( !cinfo->src )
+		cinfo->src = (struct jpeg_source_mgr *)
+			(*cinfo->mem->alloc_small)( (j_common_ptr) cinfo,
+				JPOOL_PERMANENT, sizeof( InputSource ) );
+
+	src = (InputSource *) cinfo->src;
+	src->source = source;
+	src->pub.init_source = init_source;
+	src->pub.fill_input_buffer = fill_input_source;
+	src->pub.skip_input_data = skip_input_data;
+	src->pub.resync_to_restart = jpeg_resync_to_restart;
+	src->pub.term_source = term_source;
+	src->pub.bytes_in_buffer = 0;
+	src->pub.next_input_byte = NULL;
+}
+
+int
+vips__jpeg_read_source( VipsSource *source, VipsImage *out,
+	gboolean header_only, int shrink, int fail, gboolean autorotate )
+{
+	ReadJpeg *jpeg;
+
+	if( !(jpeg = readjpeg_new( out, shrink, fail, autorotate )) )
+		return( -1 );
+
+	if( setjmp( jpeg->eman.jmp ) )
+		return( -1 );
+
+	/* Sources already in memory can use the buffer reader, and that lets
+	 * us decode in parallel.
+	 */
+	if( source->data ) {
+		jpeg->source = source;
+		g_object_ref( source );
+		readjpeg_buffer( jpeg, source->data, source->length );
+		jpeg->data = source->data;
+		jpeg->data_length = source->length;
+	}
+	else
+		readjpeg_source( jpeg, source );
+
+	if( !header_only &&
+		vips_source_decode( source ) )
+		return( -1 );
+
+	if( vips__jpeg_read( jpeg, out, header_only ) )
+		return( -1 );
+
+	if( header_only )
+		readjpeg_free( jpeg );
+
+	return( 0 );
+}
+
 int
 vips__isjpeg_buffer( const void *buf, size_t len )
 {
@@ -4,6 +4,12 @@
  * 	- wrap a class around the jpeg writer
  * 29/11/11
  * 	- split to make load, load from buffer and load from file
+ * 14/10/18
+ * 	- allow shrink 16 and 32
+ * 	- add jpegload_source
+ * 	- document ::preview
+ * 15/10/18
+ * 	- add ->header_filename() for vips_foreign_probe()
  */
 
 /*
@@ -104,7 +110,9 @@ vips_foreign_load_jpeg_build( VipsObject *object )
 	if( jpeg->shrink != 1 && 
 		jpeg->shrink != 2 && 
 		jpeg->shrink != 4 && 
-		jpeg->shrink != 8 ) {
+		jpeg->shrink != 8 &&
+		jpeg->shrink != 16 &&
+		jpeg->shrink != 32 ) {
 		vips_error( "VipsFormatLoadJpeg", 
 			_( "bad shrink factor %d" ), jpeg->shrink );
 		return( -1 );
@@ -138,7 +146,7 @@ vips_foreign_load_jpeg_class_init( VipsForeignLoadJpegClass *class )
 		_( "Shrink factor on load" ),
 		VIPS_ARGUMENT_OPTIONAL_INPUT,
 		G_STRUCT_OFFSET( VipsForeignLoadJpeg, shrink ),
-		1, 16, 1 );
+		1, 32, 1 );
 
 	VIPS_ARG_BOOL( class, "autorotate", 12, 
 		_( "Autorotate" ), 
@@ -188,6 +196,13 @@ vips_foreign_load_jpeg_file_header( VipsForeignLoad *load )
 	return( 0 );
 }
 
+static int
+vips_foreign_load_jpeg_file_header_filename( const char *filename, 
+	VipsImage *out )
+{
+	return( vips__jpeg_read_file( filename, out, TRUE, 1, FALSE, FALSE ) );
+}
+
 static int
 vips_foreign_load_jpeg_file_load( VipsForeignLoad *load )
 {
@@ -223,6 +238,8 @@ vips_foreign_load_jpeg_file_class_init( VipsForeignLoadJpegFileClass *class )
 
 	load_class->is_a = vips_foreign_load_jpeg_file_is_a;
 	load_class->header = vips_foreign_load_jpeg_file_header;
+	load_class->header_filename = 
+		vips_foreign_load_jpeg_file_header_filename;
 	load_class->load = vips_foreign_load_jpeg_file_load;
 
 	VIPS_ARG_STRING( class, "filename", 1, 
@@ -315,6 +332,90 @@ vips_foreign_load_jpeg_buffer_init( VipsForeignLoadJpegBuffer *buffer )
 {
 }
 
+typedef struct _VipsForeignLoadJpegSource {
+	VipsForeignLoadJpeg parent_object;
+
+	/* Load from a source.
+	 */
+	VipsSource *source;
+
+} VipsForeignLoadJpegSource;
+
+typedef VipsForeignLoadJpegClass VipsForeignLoadJpegSourceClass;
+
+G_DEFINE_TYPE( VipsForeignLoadJpegSource, vips_foreign_load_jpeg_source,
+	vips_foreign_load_jpeg_get_type() );
+
+static int
+vips_foreign_load_jpeg_source_header( VipsForeignLoad *load )
+{
+	VipsForeignLoadJpeg *jpeg = (VipsForeignLoadJpeg *) load;
+	VipsForeignLoadJpegSource *source = (VipsForeignLoadJpegSource *) load;
+
+	if( vips_source_rewind( source->source ) ||
+		vips__jpeg_read_source( source->source,
+			load->out, TRUE, jpeg->shrink, load->fail,
+			jpeg->autorotate ) )
+		return( -1 );
+
+	return( 0 );
+}
+
+static int
+vips_foreign_load_jpeg_source_load( VipsForeignLoad *load )
+{
+	VipsForeignLoadJpeg *jpeg = (VipsForeignLoadJpeg *) load;
+	VipsForeignLoadJpegSource *source = (VipsForeignLoadJpegSource *) load;
+
+	if( vips_source_rewind( source->source ) ||
+		vips__jpeg_read_source( source->source,
+			load->real, FALSE, jpeg->shrink, load->fail,
+			jpeg->autorotate ) )
+		return( -1 );
+
+	return( 0 );
+}
+
+static gboolean
+vips_foreign_load_jpeg_source_is_a( VipsSource *source )
+{
+	unsigned char *data;
+
+	return( (data = vips_source_sniff( source, 2 )) &&
+		vips__isjpeg_buffer( data, 2 ) );
+}
+
+static void
+vips_foreign_load_jpeg_source_class_init(
+	VipsForeignLoadJpegSourceClass *class )
+{
+	GObjectClass *gobject_class = G_OBJECT_CLASS( class );
+	VipsObjectClass *object_class = (VipsObjectClass *) class;
+	VipsForeignLoadClass *load_class = (VipsForeignLoadClass *) class;
+
+	gobject_class->set_property = vips_object_set_property;
+	gobject_class->get_property = vips_object_get_property;
+
+	object_class->nickname = "jpegload_source";
+	object_class->description = _( "load jpeg from source" );
+
+	load_class->is_a_source = vips_foreign_load_jpeg_source_is_a;
+	load_class->header = vips_foreign_load_jpeg_source_header;
+	load_class->load = vips_foreign_load_jpeg_source_load;
+
+	VIPS_ARG_OBJECT( class, "source", 1,
+		_( "Source" ),
+		_( "Source to load from" ),
+		VIPS_ARGUMENT_REQUIRED_INPUT,
+		G_STRUCT_OFFSET( VipsForeignLoadJpegSource, source ),
+		VIPS_TYPE_SOURCE );
+}
+
+static void
+vips_foreign_load_jpeg_source_init( VipsForeignLoadJpegSource *source )
+{
+}
+
 #endif /*HAVE_JPEG*/
 
 /**
@@ -334,8 +435,10 @@ vips_foreign_load_jpeg_buffer_init( VipsForeignLoadJpegBuffer *buffer )
  * including CMYK and YCbCr.
  *
  * @shrink means shrink by this integer factor during load.  Possible values 
- * are 1, 2, 4 and 8. Shrinking during read is very much faster than 
- * decompressing the whole image and then shrinking later.
+ * are 1, 2, 4, 8, 16 and 32. Shrinking during read is very much faster than
+ * decompressing the whole image and then shrinking later. libjpeg can only
+ * shrink by up to 8, so for 16 and 32 YCbCr images are read as raw planes,
+ * box shrunk at their own resolution and then converted to RGB.
  *
  * Setting @fail to %TRUE makes the JPEG reader fail on any errors. 
  * This can be useful for detecting truncated files, for example. Normally 
@@ -382,6 +485,12 @@ vips_foreign_load_jpeg_buffer_init( VipsForeignLoadJpegBuffer *buffer )
  * The EXIF thumbnail, if present, is attached to the image as 
  * "jpeg-thumbnail-data". See vips_image_get_blob().
  *
+ * If you connect to #VipsImage::preview on the image before the pixels are
+ * read, progressive images are decoded a scan at a time and each refinement
+ * is sent to your handler. This is much slower than a plain decode, but the
+ * first snapshot arrives quickly. Use @shrink as well for fast previews of
+ * large images.
+ *
  * See also: vips_jpegload_buffer(), vips_image_new_from_file(), vips_autorot().
  *
  * Returns: 0 on success, -1 on error.
@@ -442,3 +551,37 @@ vips_jpegload_buffer( void *buf, size_t len, VipsImage **out, ... )
 
 	return( result );
 }
+
+/**
+ * vips_jpegload_source:
+ * @source: source to load from
+ * @out: (out): image to write
+ * @...: %NULL-terminated list of optional named arguments
+ *
+ * Optional arguments:
+ *
+ * * @shrink: %gint, shrink by this much on load
+ * * @fail: %gboolean, fail on errors
+ * * @autorotate: %gboolean, use exif Orientation tag to rotate the image
+ *   during load
+ *
+ * Read a JPEG-formatted source into a VIPS image. Exactly as
+ * vips_jpegload(), but read from a #VipsSource. Bytes are pulled from
+ * @source as decode proceeds.
+ *
+ * See also: vips_jpegload(), vips_image_new_from_source().
+ *
+ * Returns: 0 on success, -1 on error.
+ */
+int
+vips_jpegload_source( VipsSource *source, VipsImage **out, ... )
+{
+	va_list ap;
+	int result;
+
+	va_start( ap, out );
+	result = vips_call_split( "jpegload_source", ap, source, out );
+	va_end( ap );
+
+	return( result );
+}
@@ -2,6 +2,9 @@
  *
  * 24/11/11
  * 	- wrap a class around the jpeg writer
+ * 14/10/18
+ * 	- add jpegsave_target
+ * 	- add restart_interval
  */
 
 /*
@@ -108,6 +111,10 @@ typedef struct _VipsForeignSaveJpeg {
 	 */
 	int quant_table;
 
+	/* Restart markers every this many MCU rows.
+	 */
+	int restart_interval;
+
 } VipsForeignSaveJpeg;
 
 typedef VipsForeignSaveClass VipsForeignSaveJpegClass;
@@ -208,6 +215,13 @@ vips_foreign_save_jpeg_class_init( VipsForeignSaveJpegClass *class )
 		G_STRUCT_OFFSET( VipsForeignSaveJpeg, quant_table ),
 		0, 8, 0 );
 
+	VIPS_ARG_INT( class, "restart_interval", 19,
+		_( "Restart interval" ),
+		_( "Add restart markers every this many MCU rows" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsForeignSaveJpeg, restart_interval ),
+		0, 10000, 0 );
+
 }
 
 static void
@@ -245,7 +259,8 @@ vips_foreign_save_jpeg_file_build( VipsObject *object )
 		jpeg->Q, jpeg->profile, jpeg->optimize_coding, 
 		jpeg->interlace, save->strip, jpeg->no_subsample,
 		jpeg->trellis_quant, jpeg->overshoot_deringing,
-		jpeg->optimize_scans, jpeg->quant_table ) )
+		jpeg->optimize_scans, jpeg->quant_table,
+		jpeg->restart_interval ) )
 		return( -1 );
 
 	return( 0 );
@@ -310,7 +325,8 @@ vips_foreign_save_jpeg_buffer_build( VipsObject *object )
 		&obuf, &olen, jpeg->Q, jpeg->profile, jpeg->optimize_coding, 
 		jpeg->interlace, save->strip, jpeg->no_subsample,
 		jpeg->trellis_quant, jpeg->overshoot_deringing,
-		jpeg->optimize_scans, jpeg->quant_table ) )
+		jpeg->optimize_scans, jpeg->quant_table,
+		jpeg->restart_interval ) )
 		return( -1 );
 
 	/* obuf is a g_free() buffer, not vips_free().
@@ -349,6 +365,71 @@ vips_foreign_save_jpeg_buffer_init( VipsForeignSaveJpegBuffer *file )
 {
 }
 
+typedef struct _VipsForeignSaveJpegTarget {
+	VipsForeignSaveJpeg parent_object;
+
+	/* Save to a target.
+	 */
+	VipsTarget *target;
+
+} VipsForeignSaveJpegTarget;
+
+typedef VipsForeignSaveJpegClass VipsForeignSaveJpegTargetClass;
+
+G_DEFINE_TYPE( VipsForeignSaveJpegTarget, vips_foreign_save_jpeg_target,
+	vips_foreign_save_jpeg_get_type() );
+
+static int
+vips_foreign_save_jpeg_target_build( VipsObject *object )
+{
+	VipsForeignSave *save = (VipsForeignSave *) object;
+	VipsForeignSaveJpeg *jpeg = (VipsForeignSaveJpeg *) object;
+	VipsForeignSaveJpegTarget *target =
+		(VipsForeignSaveJpegTarget *) object;
+
+	if( VIPS_OBJECT_CLASS( vips_foreign_save_jpeg_target_parent_class )->
+		build( object ) )
+		return( -1 );
+
+	if( vips__jpeg_write_target( save->ready, target->target,
+		jpeg->Q, jpeg->profile, jpeg->optimize_coding,
+		jpeg->interlace, save->strip, jpeg->no_subsample,
+		jpeg->trellis_quant, jpeg->overshoot_deringing,
+		jpeg->optimize_scans, jpeg->quant_table,
+		jpeg->restart_interval ) ||
+		vips_target_finish( target->target ) )
+		return( -1 );
+
+	return( 0 );
+}
+
+static void
+vips_foreign_save_jpeg_target_class_init(
+	VipsForeignSaveJpegTargetClass *class )
+{
+	GObjectClass *gobject_class = G_OBJECT_CLASS( class );
+	VipsObjectClass *object_class = (VipsObjectClass *) class;
+
+	gobject_class->set_property = vips_object_set_property;
+	gobject_class->get_property = vips_object_get_property;
+
+	object_class->nickname = "jpegsave_target";
+	object_class->description = _( "save image to jpeg target" );
+	object_class->build = vips_foreign_save_jpeg_target_build;
+
+	VIPS_ARG_OBJECT( class, "target", 1,
+		_( "Target" ),
+		_( "Target to save to" ),
+		VIPS_ARGUMENT_REQUIRED_INPUT,
+		G_STRUCT_OFFSET( VipsForeignSaveJpegTarget, target ),
+		VIPS_TYPE_TARGET );
+}
+
+static void
+vips_foreign_save_jpeg_target_init( VipsForeignSaveJpegTarget *target )
+{
+}
+
 typedef struct _VipsForeignSaveJpegMime {
 	VipsForeignSaveJpeg parent_object;
 
@@ -376,7 +457,8 @@ vips_foreign_save_jpeg_mime_build( VipsObject *object )
 		&obuf, &olen, jpeg->Q, jpeg->profile, jpeg->optimize_coding, 
 		jpeg->interlace, save->strip, jpeg->no_subsample,
 		jpeg->trellis_quant, jpeg->overshoot_deringing,
-		jpeg->optimize_scans, jpeg->quant_table ) )
+		jpeg->optimize_scans, jpeg->quant_table,
+		jpeg->restart_interval ) )
 		return( -1 );
 
 	printf( "Content-length: %zu\r\n", olen );
@@ -429,6 +511,7 @@ vips_foreign_save_jpeg_mime_init( VipsForeignSaveJpegMime *mime )
  * * @overshoot_deringing: %gboolean, overshoot samples with extreme values
  * * @optimize_scans: %gboolean, split DCT coefficients into separate scans
  * * @quant_table: %gint, quantization table index
+ * * @restart_interval: %gint, restart markers every this many MCU rows
  *
  * Write a VIPS image to a file as JPEG.
  *
@@ -497,6 +580,14 @@ vips_foreign_save_jpeg_mime_init( VipsForeignSaveJpegMime *mime )
  * Tables 5-7 are based on older research papers, but generally achieve worse
  * compression ratios and/or quality than 2 or 4.
  *
+ * Set @restart_interval to add a restart marker every that many rows of
+ * MCUs (an MCU is 16 rows with the default chroma subsampling, 8 without).
+ * Restart markers make the file a little larger, but limit the damage from
+ * a corrupt byte and let decoders work in parallel. If the Huffman tables
+ * are fixed (no @optimize_coding, @interlace, @trellis_quant or
+ * @optimize_scans), large images are also encoded in parallel, a stripe of
+ * restart intervals at a time. The output is the same as a serial encode.
+ *
  * The image is automatically converted to RGB, Monochrome or CMYK before 
  * saving. 
  *
@@ -544,6 +635,7 @@ vips_jpegsave( VipsImage *in, const char *filename, ... )
  * * @overshoot_deringing: %gboolean, overshoot samples with extreme values
  * * @optimize_scans: %gboolean, split DCT coefficients into separate scans
  * * @quant_table: %gint, quantization table index
+ * * @restart_interval: %gint, restart markers every this many MCU rows
  *
  * As vips_jpegsave(), but save to a memory buffer. 
  *
@@ -583,6 +675,46 @@ vips_jpegsave_buffer( VipsImage *in, void **buf, size_t *len, ... )
 	return( result );
 }
 
+/**
+ * vips_jpegsave_target: (method)
+ * @in: image to save
+ * @target: save image to this target
+ * @...: %NULL-terminated list of optional named arguments
+ *
+ * Optional arguments:
+ *
+ * * @Q: %gint, quality factor
+ * * @profile: filename of ICC profile to attach
+ * * @optimize_coding: %gboolean, compute optimal Huffman coding tables
+ * * @interlace: %gboolean, write an interlaced (progressive) jpeg
+ * * @strip: %gboolean, remove all metadata from image
+ * * @no_subsample: %gboolean, disable chroma subsampling
+ * * @trellis_quant: %gboolean, apply trellis quantisation to each 8x8 block
+ * * @overshoot_deringing: %gboolean, overshoot samples with extreme values
+ * * @optimize_scans: %gboolean, split DCT coefficients into separate scans
+ * * @quant_table: %gint, quantization table index
+ * * @restart_interval: %gint, restart markers every this many MCU rows
+ *
+ * As vips_jpegsave(), but save to a target. Compressed bytes are written
+ * to @target as they are made.
+ *
+ * See also: vips_jpegsave(), vips_image_write_to_target().
+ *
+ * Returns: 0 on success, -1 on error.
+ */
+int
+vips_jpegsave_target( VipsImage *in, VipsTarget *target, ... )
+{
+	va_list ap;
+	int result;
+
+	va_start( ap, target );
+	result = vips_call_split( "jpegsave_target", ap, in, target );
+	va_end( ap );
+
+	return( result );
+}
+
 /**
  * vips_jpegsave_mime: (method)
  * @in: image to save 
@@ -600,6 +732,7 @@ vips_jpegsave_buffer( VipsImage *in, void **buf, size_t *len, ... )
  * * @overshoot_deringing: %gboolean, overshoot samples with extreme values
  * * @optimize_scans: %gboolean, split DCT coefficients into separate scans
  * * @quant_table: %gint, quantization table index
+ * * @restart_interval: %gint, restart markers every this many MCU rows
  *
  * As vips_jpegsave(), but save as a mime jpeg on stdout.
  *
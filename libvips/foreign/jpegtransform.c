@@ -0,0 +1,661 @@
+/* lossless rotate and crop of jpeg files
+ *
+ * 14/10/18
+ * 	- from jpeg2vips.c
+ */
+
+/*
+
+    This file is part of VIPS.
+
+    VIPS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA
+
+ */
+
+/*
+
+    These files are distributed with VIPS - http://www.vips.ecs.soton.ac.uk
+
+ */
+
+/*
+#define DEBUG
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /*HAVE_CONFIG_H*/
+#include <vips/intl.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+
+#include <vips/vips.h>
+#include <vips/internal.h>
+
+#include "pforeign.h"
+
+#ifdef HAVE_JPEG
+
+#include "jpeg.h"
+
+typedef struct _VipsForeignJpegTransform {
+	VipsOperation parent_instance;
+
+	/* Filenames.
+	 */
+	char *in;
+	char *out;
+
+	VipsAngle angle;
+	gboolean autorotate;
+
+	/* Crop, in output coordinates.
+	 */
+	int left;
+	int top;
+	int width;
+	int height;
+
+	/* The source and destination. They share an error manager, and
+	 * eman.fp is the output file.
+	 */
+	struct jpeg_decompress_struct src;
+	struct jpeg_compress_struct dst;
+	ErrorManager eman;
+	FILE *fp;
+
+	/* The source EXIF, if any, parsed to a header-only image.
+	 */
+	VipsImage *exif;
+} VipsForeignJpegTransform;
+
+typedef VipsOperationClass VipsForeignJpegTransformClass;
+
+G_DEFINE_TYPE( VipsForeignJpegTransform, vips_foreign_jpeg_transform,
+	VIPS_TYPE_OPERATION );
+
+static void
+vips_foreign_jpeg_transform_free( VipsForeignJpegTransform *transform )
+{
+	/* Safe to call many times, and on never-created objects.
+	 */
+	jpeg_destroy_compress( &transform->dst );
+	jpeg_destroy_decompress( &transform->src );
+
+	VIPS_FREEF( fclose, transform->eman.fp );
+	VIPS_FREEF( fclose, transform->fp );
+	VIPS_UNREF( transform->exif );
+}
+
+static void
+vips_foreign_jpeg_transform_dispose( GObject *gobject )
+{
+	VipsForeignJpegTransform *transform =
+		(VipsForeignJpegTransform *) gobject;
+
+	vips_foreign_jpeg_transform_free( transform );
+
+	G_OBJECT_CLASS( vips_foreign_jpeg_transform_parent_class )->
+		dispose( gobject );
+}
+
+/* Parse the first APP1 block which starts "Exif" to an image, so we can
+ * see the orientation and update the tags.
+ */
+static int
+vips_foreign_jpeg_transform_exif( VipsForeignJpegTransform *transform )
+{
+	struct jpeg_decompress_struct *src = &transform->src;
+
+	jpeg_saved_marker_ptr p;
+
+	for( p = src->marker_list; p; p = p->next )
+		if( p->marker == JPEG_APP0 + 1 &&
+			p->data_length > 4 &&
+			vips_isprefix( "Exif", (char *) p->data ) ) {
+			VipsImage *exif;
+			void *data;
+
+			if( !(data = vips_malloc( NULL, p->data_length )) )
+				return( -1 );
+			memcpy( data, p->data, p->data_length );
+
+			exif = vips_image_new();
+			vips_image_init_fields( exif,
+				src->image_width, src->image_height,
+				src->num_components,
+				VIPS_FORMAT_UCHAR, VIPS_CODING_NONE,
+				VIPS_INTERPRETATION_MULTIBAND,
+				1.0, 1.0 );
+			vips_image_set_blob( exif, VIPS_META_EXIF_NAME,
+				(VipsCallbackFn) vips_free,
+				data, p->data_length );
+			transform->exif = exif;
+
+			if( vips__exif_parse( exif ) )
+				return( -1 );
+
+			break;
+		}
+
+	return( 0 );
+}
+
+/* Transform a block of coefficients. Transposing the pixels transposes the
+ * coefficients, and mirroring the pixels negates the odd frequencies in
+ * that direction.
+ */
+static void
+vips_foreign_jpeg_transform_block( VipsAngle angle,
+	JCOEFPTR from, JCOEFPTR to )
+{
+	int x, y;
+
+	switch( angle ) {
+	case VIPS_ANGLE_D90:
+		for( y = 0; y < DCTSIZE; y++ )
+			for( x = 0; x < DCTSIZE; x++ )
+				to[y * DCTSIZE + x] = (x & 1) ?
+					-from[x * DCTSIZE + y] :
+					from[x * DCTSIZE + y];
+		break;
+
+	case VIPS_ANGLE_D180:
+		for( y = 0; y < DCTSIZE; y++ )
+			for( x = 0; x < DCTSIZE; x++ )
+				to[y * DCTSIZE + x] = ((x + y) & 1) ?
+					-from[y * DCTSIZE + x] :
+					from[y * DCTSIZE + x];
+		break;
+
+	case VIPS_ANGLE_D270:
+		for( y = 0; y < DCTSIZE; y++ )
+			for( x = 0; x < DCTSIZE; x++ )
+				to[y * DCTSIZE + x] = (y & 1) ?
+					-from[x * DCTSIZE + y] :
+					from[x * DCTSIZE + y];
+		break;
+
+	default:
+		memcpy( to, from, DCTSIZE2 * sizeof( JCOEF ) );
+		break;
+	}
+}
+
+static int
+vips_foreign_jpeg_transform_build( VipsObject *object )
+{
+	VipsForeignJpegTransform *transform =
+		(VipsForeignJpegTransform *) object;
+	struct jpeg_decompress_struct *src = &transform->src;
+	struct jpeg_compress_struct *dst = &transform->dst;
+
+	VipsAngle angle;
+	gboolean transpose;
+	int mcu_width, mcu_height;
+	int src_width, src_height;
+	int width, height;
+	int out_mcu_width, out_mcu_height;
+	jvirt_barray_ptr *src_coef;
+	jvirt_barray_ptr *dst_coef;
+	int dst_across[MAX_COMPONENTS];
+	int dst_down[MAX_COMPONENTS];
+	jpeg_saved_marker_ptr p;
+	int i;
+
+	if( VIPS_OBJECT_CLASS( vips_foreign_jpeg_transform_parent_class )->
+		build( object ) )
+		return( -1 );
+
+	src->err = jpeg_std_error( &transform->eman.pub );
+	dst->err = &transform->eman.pub;
+	transform->eman.pub.error_exit = vips__new_error_exit;
+	transform->eman.pub.output_message = vips__new_output_message;
+	transform->eman.fp = NULL;
+	src->client_data = NULL;
+	dst->client_data = NULL;
+
+	/* Here for longjmp() from vips__new_error_exit().
+	 */
+	if( setjmp( transform->eman.jmp ) ) {
+		vips_foreign_jpeg_transform_free( transform );
+		return( -1 );
+	}
+
+	jpeg_create_decompress( src );
+	jpeg_create_compress( dst );
+
+	if( !(transform->fp =
+		vips__file_open_read( transform->in, NULL, FALSE )) )
+		return( -1 );
+	jpeg_stdio_src( src, transform->fp );
+
+	/* Copy all COM and APPn sections over.
+	 */
+	jpeg_save_markers( src, JPEG_COM, 0xffff );
+	for( i = 0; i < 16; i++ )
+		jpeg_save_markers( src, JPEG_APP0 + i, 0xffff );
+
+	jpeg_read_header( src, TRUE );
+
+	if( vips_foreign_jpeg_transform_exif( transform ) )
+		return( -1 );
+
+	angle = transform->angle;
+	if( transform->autorotate &&
+		transform->exif )
+		angle = (angle + vips_autorot_get_angle( transform->exif )) %
+			VIPS_ANGLE_LAST;
+	transpose = angle == VIPS_ANGLE_D90 || angle == VIPS_ANGLE_D270;
+
+	/* We can only mirror whole iMCUs, so we must trim partial iMCUs from
+	 * the edges we move to the top or left.
+	 */
+	if( src->num_components == 1 ) {
+		mcu_width = DCTSIZE;
+		mcu_height = DCTSIZE;
+	}
+	else {
+		mcu_width = src->max_h_samp_factor * DCTSIZE;
+		mcu_height = src->max_v_samp_factor * DCTSIZE;
+	}
+	src_width = src->image_width;
+	src_height = src->image_height;
+	if( angle == VIPS_ANGLE_D180 ||
+		angle == VIPS_ANGLE_D270 )
+		src_width = src_width / mcu_width * mcu_width;
+	if( angle == VIPS_ANGLE_D90 ||
+		angle == VIPS_ANGLE_D180 )
+		src_height = src_height / mcu_height * mcu_height;
+	if( src_width == 0 ||
+		src_height == 0 ) {
+		vips_error( "jpegtransform", "%s", _( "image too small" ) );
+		return( -1 );
+	}
+
+	if( transpose ) {
+		width = src_height;
+		height = src_width;
+		out_mcu_width = mcu_height;
+		out_mcu_height = mcu_width;
+	}
+	else {
+		width = src_width;
+		height = src_height;
+		out_mcu_width = mcu_width;
+		out_mcu_height = mcu_height;
+	}
+
+	/* The crop must start on an iMCU boundary.
+	 */
+	if( !vips_object_argument_isset( object, "width" ) )
+		transform->width = width - transform->left;
+	if( !vips_object_argument_isset( object, "height" ) )
+		transform->height = height - transform->top;
+	if( transform->left % out_mcu_width != 0 ||
+		transform->top % out_mcu_height != 0 ) {
+		vips_error( "jpegtransform",
+			_( "crop must start on a %d x %d boundary" ),
+			out_mcu_width, out_mcu_height );
+		return( -1 );
+	}
+	if( transform->width <= 0 ||
+		transform->height <= 0 ||
+		transform->left + transform->width > width ||
+		transform->top + transform->height > height ) {
+		vips_error( "jpegtransform", "%s", _( "bad crop" ) );
+		return( -1 );
+	}
+
+	/* Make the output coefficient arrays. These must be requested before
+	 * jpeg_read_coefficients(), which will realize them for us.
+	 */
+	dst_coef = (jvirt_barray_ptr *) (*src->mem->alloc_small)(
+		(j_common_ptr) src, JPOOL_IMAGE,
+		sizeof( jvirt_barray_ptr ) * src->num_components );
+	for( i = 0; i < src->num_components; i++ ) {
+		jpeg_component_info *comp = &src->comp_info[i];
+		int h = transpose ? comp->v_samp_factor : comp->h_samp_factor;
+		int v = transpose ? comp->h_samp_factor : comp->v_samp_factor;
+		int max_h = transpose ?
+			src->max_v_samp_factor : src->max_h_samp_factor;
+		int max_v = transpose ?
+			src->max_h_samp_factor : src->max_v_samp_factor;
+		int width_in_blocks = VIPS_ROUND_UP(
+			(gint64) transform->width * h, max_h * DCTSIZE ) /
+			(max_h * DCTSIZE);
+		int height_in_blocks = VIPS_ROUND_UP(
+			(gint64) transform->height * v, max_v * DCTSIZE ) /
+			(max_v * DCTSIZE);
+
+		dst_across[i] = VIPS_ROUND_UP( width_in_blocks, h );
+		dst_down[i] = VIPS_ROUND_UP( height_in_blocks, v );
+		dst_coef[i] = (*src->mem->request_virt_barray)(
+			(j_common_ptr) src, JPOOL_IMAGE, TRUE,
+			dst_across[i], dst_down[i], v );
+	}
+
+	src_coef = jpeg_read_coefficients( src );
+
+	for( i = 0; i < src->num_components; i++ ) {
+		jpeg_component_info *comp = &src->comp_info[i];
+		int h = src->num_components == 1 ? 1 : comp->h_samp_factor;
+		int v = src->num_components == 1 ? 1 : comp->v_samp_factor;
+		int src_blocks_across = VIPS_ROUND_UP( comp->width_in_blocks,
+			comp->h_samp_factor );
+		int src_blocks_down = VIPS_ROUND_UP( comp->height_in_blocks,
+			comp->v_samp_factor );
+
+		/* The number of blocks we use in the source, and the crop
+		 * offset in output blocks.
+		 */
+		int blocks_across = src_width / mcu_width * h;
+		int blocks_down = src_height / mcu_height * v;
+		int left = transform->left / out_mcu_width *
+			(transpose ? v : h);
+		int top = transform->top / out_mcu_height *
+			(transpose ? h : v);
+
+		int x, y;
+
+		for( y = 0; y < dst_down[i]; y++ ) {
+			JBLOCKROW row = (*src->mem->access_virt_barray)(
+				(j_common_ptr) src, dst_coef[i],
+				y, 1, TRUE )[0];
+
+			for( x = 0; x < dst_across[i]; x++ ) {
+				int ox = x + left;
+				int oy = y + top;
+
+				int u, w;
+				JBLOCKROW from;
+
+				switch( angle ) {
+				case VIPS_ANGLE_D90:
+					u = oy;
+					w = blocks_down - 1 - ox;
+					break;
+
+				case VIPS_ANGLE_D180:
+					u = blocks_across - 1 - ox;
+					w = blocks_down - 1 - oy;
+					break;
+
+				case VIPS_ANGLE_D270:
+					u = blocks_across - 1 - oy;
+					w = ox;
+					break;
+
+				default:
+					u = ox;
+					w = oy;
+					break;
+				}
+
+				/* Blocks past the edge of the source stay
+				 * zero.
+				 */
+				if( u < 0 ||
+					w < 0 ||
+					u >= src_blocks_across ||
+					w >= src_blocks_down )
+					continue;
+
+				from = (*src->mem->access_virt_barray)(
+					(j_common_ptr) src, src_coef[i],
+					w, 1, FALSE )[0];
+				vips_foreign_jpeg_transform_block( angle,
+					from[u], row[x] );
+			}
+		}
+	}
+
+	if( !(transform->eman.fp =
+		vips__file_open_write( transform->out, FALSE )) )
+		return( -1 );
+	jpeg_stdio_dest( dst, transform->eman.fp );
+
+	jpeg_copy_critical_parameters( src, dst );
+	dst->image_width = transform->width;
+	dst->image_height = transform->height;
+	dst->optimize_coding = TRUE;
+	if( jpeg_has_multiple_scans( src ) )
+		jpeg_simple_progression( dst );
+
+	if( transpose ) {
+		for( i = 0; i < dst->num_components; i++ ) {
+			jpeg_component_info *comp = &dst->comp_info[i];
+
+			VIPS_SWAP( int, comp->h_samp_factor,
+				comp->v_samp_factor );
+		}
+
+		for( i = 0; i < NUM_QUANT_TBLS; i++ ) {
+			JQUANT_TBL *table = dst->quant_tbl_ptrs[i];
+			UINT16 *q;
+
+			int x, y;
+
+			if( !table )
+				continue;
+
+			q = table->quantval;
+			for( y = 0; y < DCTSIZE; y++ )
+				for( x = y + 1; x < DCTSIZE; x++ )
+					VIPS_SWAP( UINT16,
+						q[y * DCTSIZE + x],
+						q[x * DCTSIZE + y] );
+		}
+
+		VIPS_SWAP( UINT16, dst->X_density, dst->Y_density );
+	}
+
+	jpeg_write_coefficients( dst, dst_coef );
+
+	/* Update the EXIF for the new geometry and orientation.
+	 */
+	if( transform->exif ) {
+		VipsImage *exif = transform->exif;
+
+		exif->Xsize = transform->width;
+		exif->Ysize = transform->height;
+		if( transpose )
+			VIPS_SWAP( double, exif->Xres, exif->Yres );
+		if( transform->autorotate )
+			vips_image_set_int( exif, VIPS_META_ORIENTATION, 1 );
+
+		if( vips__exif_update( exif ) )
+			return( -1 );
+	}
+
+	for( p = src->marker_list; p; p = p->next ) {
+		/* libjpeg writes the JFIF and Adobe markers itself.
+		 */
+		if( dst->write_JFIF_header &&
+			p->marker == JPEG_APP0 &&
+			p->data_length >= 5 &&
+			vips_isprefix( "JFIF", (char *) p->data ) )
+			continue;
+		if( dst->write_Adobe_marker &&
+			p->marker == JPEG_APP0 + 14 &&
+			p->data_length >= 5 &&
+			vips_isprefix( "Adobe", (char *) p->data ) )
+			continue;
+
+		if( transform->exif &&
+			p->marker == JPEG_APP0 + 1 &&
+			p->data_length > 4 &&
+			vips_isprefix( "Exif", (char *) p->data ) ) {
+			void *data;
+			size_t length;
+
+			if( vips_image_get_blob( transform->exif,
+				VIPS_META_EXIF_NAME, &data, &length ) )
+				return( -1 );
+			jpeg_write_marker( dst, p->marker,
+				(const JOCTET *) data, length );
+
+			/* Only update the first one.
+			 */
+			VIPS_UNREF( transform->exif );
+		}
+		else
+			jpeg_write_marker( dst, p->marker,
+				p->data, p->data_length );
+	}
+
+	jpeg_finish_compress( dst );
+	(void) jpeg_finish_decompress( src );
+
+	vips_foreign_jpeg_transform_free( transform );
+
+	return( 0 );
+}
+
+static void
+vips_foreign_jpeg_transform_class_init( VipsForeignJpegTransformClass *class )
+{
+	GObjectClass *gobject_class = G_OBJECT_CLASS( class );
+	VipsObjectClass *object_class = (VipsObjectClass *) class;
+	VipsOperationClass *operation_class = VIPS_OPERATION_CLASS( class );
+
+	gobject_class->dispose = vips_foreign_jpeg_transform_dispose;
+	gobject_class->set_property = vips_object_set_property;
+	gobject_class->get_property = vips_object_get_property;
+
+	object_class->nickname = "jpegtransform";
+	object_class->description = _( "losslessly rotate and crop a jpeg" );
+	object_class->build = vips_foreign_jpeg_transform_build;
+
+	/* We write a file, so don't cache.
+	 */
+	operation_class->flags = VIPS_OPERATION_NOCACHE;
+
+	VIPS_ARG_STRING( class, "in", 1,
+		_( "Input" ),
+		_( "Filename to load from" ),
+		VIPS_ARGUMENT_REQUIRED_INPUT,
+		G_STRUCT_OFFSET( VipsForeignJpegTransform, in ),
+		NULL );
+
+	VIPS_ARG_STRING( class, "out", 2,
+		_( "Output" ),
+		_( "Filename to save to" ),
+		VIPS_ARGUMENT_REQUIRED_INPUT,
+		G_STRUCT_OFFSET( VipsForeignJpegTransform, out ),
+		NULL );
+
+	VIPS_ARG_ENUM( class, "angle", 3,
+		_( "Angle" ),
+		_( "Angle to rotate image" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsForeignJpegTransform, angle ),
+		VIPS_TYPE_ANGLE, VIPS_ANGLE_D0 );
+
+	VIPS_ARG_BOOL( class, "autorotate", 4,
+		_( "Autorotate" ),
+		_( "Rotate image using exif orientation" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsForeignJpegTransform, autorotate ),
+		FALSE );
+
+	VIPS_ARG_INT( class, "left", 5,
+		_( "Left" ),
+		_( "Left edge of crop" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsForeignJpegTransform, left ),
+		0, VIPS_MAX_COORD, 0 );
+
+	VIPS_ARG_INT( class, "top", 6,
+		_( "Top" ),
+		_( "Top edge of crop" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsForeignJpegTransform, top ),
+		0, VIPS_MAX_COORD, 0 );
+
+	VIPS_ARG_INT( class, "width", 7,
+		_( "Width" ),
+		_( "Width of crop" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsForeignJpegTransform, width ),
+		1, VIPS_MAX_COORD, 1 );
+
+	VIPS_ARG_INT( class, "height", 8,
+		_( "Height" ),
+		_( "Height of crop" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsForeignJpegTransform, height ),
+		1, VIPS_MAX_COORD, 1 );
+}
+
+static void
+vips_foreign_jpeg_transform_init( VipsForeignJpegTransform *transform )
+{
+	transform->angle = VIPS_ANGLE_D0;
+}
+
+#endif /*HAVE_JPEG*/
+
+/**
+ * vips_jpegtransform:
+ * @in: file to load
+ * @out: file to write to
+ * @...: %NULL-terminated list of optional named arguments
+ *
+ * Optional arguments:
+ *
+ * * @angle: #VipsAngle, rotate by this much
+ * * @autorotate: %gboolean, use exif Orientation tag to rotate the image
+ * * @left: %gint, left edge of crop
+ * * @top: %gint, top edge of crop
+ * * @width: %gint, width of crop
+ * * @height: %gint, height of crop
+ *
+ * Rotate and crop a JPEG file without decompressing it. The DCT
+ * coefficients are moved and copied, so there is no loss of quality, and
+ * it is much faster than vips_jpegload() followed by vips_rot() or
+ * vips_extract_area() and vips_jpegsave().
+ *
+ * Set @autorotate to rotate by the EXIF orientation tag, and set the tag
+ * to 1 in the output. @angle is applied after any autorotate.
+ *
+ * Blocks can only be moved whole, so partial MCUs (usually 8 or 16 pixels)
+ * along the edges which rotation moves to the top or left are trimmed off.
+ * The crop area is in rotated coordinates, and @left and @top must be on
+ * an MCU boundary. @width and @height default to the rest of the image.
+ *
+ * All COM and APPn sections are copied to the output, with EXIF updated
+ * for the new size and orientation.
+ *
+ * See also: vips_autorot(), vips_extract_area(), vips_jpegload().
+ *
+ * Returns: 0 on success, -1 on error.
+ */
+int
+vips_jpegtransform( const char *in, const char *out, ... )
+{
+	va_list ap;
+	int result;
+
+	va_start( ap, out );
+	result = vips_call_split( "jpegtransform", ap, in, out );
+	va_end( ap );
+
+	return( result );
+}
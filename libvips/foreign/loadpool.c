@@ -0,0 +1,353 @@
+/* a pool of opened file loaders
+ *
+ * 14/10/18
+ * 	- first version
+ */
+
+/*
+
+    This file is part of VIPS.
+
+    VIPS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA
+
+ */
+
+/*
+
+    These files are distributed with VIPS - http://www.vips.ecs.soton.ac.uk
+
+ */
+
+/* The operation cache will often keep a loader alive between requests, but
+ * it does not notice if the file changes, and a burst of other operations
+ * can push a hot file out. This pool holds opened loads explicitly, keyed by
+ * filename, load options, mtime and size, and only closes them when they
+ * have been idle for a while or when we are over the open file limit.
+ *
+ * Entries are random access images, so any number of threads can make
+ * regions on them at once and they all share the loader's tile cache and
+ * file handle.
+ */
+
+/*
+#define DEBUG
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /*HAVE_CONFIG_H*/
+#include <vips/intl.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <vips/vips.h>
+#include <vips/internal.h>
+#include <vips/debug.h>
+
+typedef struct _VipsLoadPoolEntry {
+	/* The canonical "filename[options]" we were opened with.
+	 */
+	char *key;
+
+	/* The file as it was when we opened it. If any of these change, the
+	 * entry is stale.
+	 */
+	gint64 mtime;
+	gint64 size;
+	gint64 ino;
+
+	VipsImage *image;
+
+	/* g_get_monotonic_time() of the last get.
+	 */
+	gint64 last_used;
+} VipsLoadPoolEntry;
+
+/* Map key to VipsLoadPoolEntry.
+ */
+static GHashTable *vips_load_pool_table = NULL;
+static GMutex *vips_load_pool_lock = NULL;
+
+/* Close entries which have not been used for this many seconds.
+ */
+static double vips_load_pool_idle = 30.0;
+
+static void *
+vips_load_pool_init( void *data )
+{
+	vips_load_pool_table = g_hash_table_new( g_str_hash, g_str_equal );
+	vips_load_pool_lock = vips_g_mutex_new();
+
+	return( NULL );
+}
+
+static void
+vips_load_pool_entry_free( VipsLoadPoolEntry *entry )
+{
+	VIPS_UNREF( entry->image );
+	VIPS_FREE( entry->key );
+	g_free( entry );
+}
+
+/* Fill the stamp fields of @entry from the file, or return -1.
+ */
+static int
+vips_load_pool_stat( const char *filename, VipsLoadPoolEntry *entry )
+{
+#ifdef OS_WIN32
+	struct _stati64 st;
+
+	if( _stati64( filename, &st ) == -1 ) {
+#else /*!OS_WIN32*/
+	struct stat st;
+
+	if( stat( filename, &st ) == -1 ) {
+#endif /*OS_WIN32*/
+		vips_error_system( errno, "VipsForeignLoad",
+			_( "unable to stat \"%s\"" ), filename );
+		return( -1 );
+	}
+
+	entry->mtime = st.st_mtime;
+	entry->size = st.st_size;
+	entry->ino = st.st_ino;
+
+	return( 0 );
+}
+
+static gboolean
+vips_load_pool_stale( VipsLoadPoolEntry *entry, VipsLoadPoolEntry *stamp )
+{
+	return( entry->mtime != stamp->mtime ||
+		entry->size != stamp->size ||
+		entry->ino != stamp->ino );
+}
+
+/* Call with the lock held.
+ */
+static void
+vips_load_pool_remove( VipsLoadPoolEntry *entry )
+{
+	VIPS_DEBUG_MSG( "vips_load_pool_remove: %s\n", entry->key );
+
+	g_hash_table_remove( vips_load_pool_table, entry->key );
+	vips_load_pool_entry_free( entry );
+}
+
+static void
+vips_load_pool_find_oldest( gpointer key, gpointer value, gpointer data )
+{
+	VipsLoadPoolEntry *entry = (VipsLoadPoolEntry *) value;
+	VipsLoadPoolEntry **oldest = (VipsLoadPoolEntry **) data;
+
+	if( !*oldest ||
+		entry->last_used < (*oldest)->last_used )
+		*oldest = entry;
+}
+
+/* Drop idle entries, then drop least-recently-used entries until we are
+ * inside the file limit. Call with the lock held.
+ */
+static void
+vips_load_pool_trim( void )
+{
+	gint64 now = g_get_monotonic_time();
+	int max_files = vips_cache_get_max_files();
+
+	for(;;) {
+		VipsLoadPoolEntry *oldest;
+
+		oldest = NULL;
+		g_hash_table_foreach( vips_load_pool_table,
+			vips_load_pool_find_oldest, &oldest );
+		if( !oldest )
+			break;
+
+		if( now - oldest->last_used >
+				vips_load_pool_idle * G_USEC_PER_SEC ||
+			g_hash_table_size( vips_load_pool_table ) >
+				max_files ||
+			vips_tracked_get_files() > max_files )
+			vips_load_pool_remove( oldest );
+		else
+			break;
+	}
+}
+
+/**
+ * vips_foreign_load_pool_get:
+ * @name: file to load, with any load options in square brackets
+ *
+ * Return a reference to an opened load of @name, opening it if necessary.
+ * The load is kept in a pool, so later calls with the same @name will share
+ * it and the header, directory and any tile cache are only made once. This
+ * is useful for tile servers which make many small vips_extract_area()
+ * requests on the same large file.
+ *
+ * Load options must be given in the filename, for example
+ * "slide.svs[level=2]". The load is always random access, so any number of
+ * threads can read from it at once.
+ *
+ * Each call checks the modification time, size and inode of the file, and
+ * reopens it if any have changed. Entries are closed when they have been unused
+ * for vips_foreign_load_pool_set_idle() seconds, or when there are more
+ * open files than vips_cache_set_max_files() allows. This happens during
+ * vips_foreign_load_pool_get() calls, there's no background thread.
+ *
+ * Unref the result when you are done with it.
+ *
+ * See also: vips_image_new_from_file(), vips_foreign_load_pool_drop_all().
+ *
+ * Returns: (transfer full): the image, or %NULL on error.
+ */
+VipsImage *
+vips_foreign_load_pool_get( const char *name )
+{
+	static GOnce once = G_ONCE_INIT;
+
+	char filename[VIPS_PATH_MAX];
+	char option_string[VIPS_PATH_MAX];
+	char *key;
+	VipsLoadPoolEntry stamp;
+	VipsLoadPoolEntry *entry;
+	VipsImage *image;
+
+	VIPS_ONCE( &once, (GThreadFunc) vips_load_pool_init, NULL );
+
+	vips__filename_split8( name, filename, option_string );
+	if( vips_load_pool_stat( filename, &stamp ) )
+		return( NULL );
+	key = g_strdup_printf( "%s%s", filename, option_string );
+
+	g_mutex_lock( vips_load_pool_lock );
+
+	if( (entry = g_hash_table_lookup( vips_load_pool_table, key )) &&
+		vips_load_pool_stale( entry, &stamp ) ) {
+		VIPS_DEBUG_MSG( "vips_foreign_load_pool_get: stale %s\n", key );
+		vips_load_pool_remove( entry );
+		entry = NULL;
+	}
+
+	if( entry ) {
+		entry->last_used = g_get_monotonic_time();
+		image = entry->image;
+		g_object_ref( image );
+	}
+	else
+		image = NULL;
+
+	vips_load_pool_trim();
+
+	g_mutex_unlock( vips_load_pool_lock );
+
+	if( image ) {
+		g_free( key );
+		return( image );
+	}
+
+	/* Open outside the lock, a header read can be slow.
+	 */
+	if( !(image = vips_image_new_from_file( name,
+		"access", VIPS_ACCESS_RANDOM,
+		NULL )) ) {
+		g_free( key );
+		return( NULL );
+	}
+
+	g_mutex_lock( vips_load_pool_lock );
+
+	/* Another thread may have opened it while we were reading.
+	 * Use theirs so there's only ever one open.
+	 */
+	if( (entry = g_hash_table_lookup( vips_load_pool_table, key )) &&
+		!vips_load_pool_stale( entry, &stamp ) ) {
+		g_object_unref( image );
+		image = entry->image;
+		g_object_ref( image );
+		entry->last_used = g_get_monotonic_time();
+		g_free( key );
+	}
+	else {
+		if( entry )
+			vips_load_pool_remove( entry );
+
+		entry = g_new( VipsLoadPoolEntry, 1 );
+		entry->key = key;
+		entry->mtime = stamp.mtime;
+		entry->size = stamp.size;
+		entry->ino = stamp.ino;
+		entry->image = image;
+		entry->last_used = g_get_monotonic_time();
+		g_object_ref( image );
+		g_hash_table_insert( vips_load_pool_table, entry->key, entry );
+
+		VIPS_DEBUG_MSG( "vips_foreign_load_pool_get: opened %s\n",
+			entry->key );
+	}
+
+	vips_load_pool_trim();
+
+	g_mutex_unlock( vips_load_pool_lock );
+
+	return( image );
+}
+
+/**
+ * vips_foreign_load_pool_set_idle:
+ * @seconds: close pooled loads which have been unused for this long
+ *
+ * Set how long an unused load stays in the pool. The default is 30 seconds.
+ *
+ * See also: vips_foreign_load_pool_get().
+ */
+void
+vips_foreign_load_pool_set_idle( double seconds )
+{
+	vips_load_pool_idle = VIPS_MAX( 0.0, seconds );
+}
+
+static gboolean
+vips_load_pool_drop_fn( gpointer key, gpointer value, gpointer data )
+{
+	vips_load_pool_entry_free( (VipsLoadPoolEntry *) value );
+
+	return( TRUE );
+}
+
+/**
+ * vips_foreign_load_pool_drop_all:
+ *
+ * Close every load in the pool. Images you still hold a reference to stay
+ * valid, they are just no longer shared. This is called for you by
+ * vips_shutdown().
+ *
+ * See also: vips_foreign_load_pool_get().
+ */
+void
+vips_foreign_load_pool_drop_all( void )
+{
+	if( vips_load_pool_table ) {
+		g_mutex_lock( vips_load_pool_lock );
+		g_hash_table_foreach_remove( vips_load_pool_table,
+			vips_load_pool_drop_fn, NULL );
+		g_mutex_unlock( vips_load_pool_lock );
+	}
+}
@@ -57,6 +57,9 @@
  * 	- try using GetImageChannelDepth() instead of ->depth
  * 24/4/18
  * 	- add format hint
+ * 14/10/18
+ * 	- free frames we won't use straight after read
+ * 	- fetch bands of lines in one call, unpack inside the lock
  */
 
 /*
@@ -528,6 +531,16 @@ parse_header( Read *read )
 		p = GetNextImageInList( p );
 	}
 
+	/* We'll never read any frames after the last one we use, so free
+	 * them now. For big multi-frame files this can save a lot of memory.
+	 * Unlink by hand, since not all libMagicks have SplitImageList().
+	 */
+	if( p ) {
+		read->frames[read->n_frames - 1]->next = NULL;
+		p->previous = NULL;
+		DestroyImageList( p );
+	}
+
 	if( read->n_frames > 1 ) {
 		vips_image_set_int( im, VIPS_META_PAGE_HEIGHT, im->Ysize );
 		im->Ysize *= read->n_frames;
@@ -722,28 +735,38 @@ magick_fill_region( VipsRegion *out,
 	Read *read = (Read *) a;
 	VipsRect *r = &out->valid;
 	int y;
+	int n;
 
-	for( y = 0; y < r->height; y++ ) {
+	/* Fetch a band of lines from each frame we hit.
+	 */
+	for( y = 0; y < r->height; y += n ) {
 		int top = r->top + y;
 		int frame = top / read->frame_height;
 		int line = top % read->frame_height;
 
 		PixelPacket *pixels;
+		int z;
 
-		g_mutex_lock( read->lock );
-		pixels = get_pixels( read->frames[frame], 
-			r->left, line, r->width, 1 );
-		g_mutex_unlock( read->lock );
+		n = VIPS_MIN( read->frame_height - line, r->height - y );
 
-		if( !pixels ) {
+		/* The pixels are in a buffer shared by all threads, so we
+		 * must unpack before we unlock.
+		 */
+		g_mutex_lock( read->lock );
+		if( !(pixels = get_pixels( read->frames[frame],
+			r->left, line, r->width, n )) ) {
+			g_mutex_unlock( read->lock );
 			vips_foreign_load_invalidate( read->im );
 			vips_error( "magick2vips", 
 				"%s", _( "unable to read pixels" ) );
 			return( -1 );
 		}
 
-		unpack_pixels( read->im, VIPS_REGION_ADDR( out, r->left, top ), 
-			pixels, r->width );
+		for( z = 0; z < n; z++ )
+			unpack_pixels( read->im,
+				VIPS_REGION_ADDR( out, r->left, top + z ),
+				pixels + z * r->width, r->width );
+		g_mutex_unlock( read->lock );
 	}
 
 	return( 0 );
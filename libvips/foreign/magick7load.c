@@ -6,6 +6,10 @@
  * 	- add @n, deprecate @all_frames (just sets n = -1)
  * 24/4/18
  * 	- add format hint
+ * 14/10/18
+ * 	- free frames we won't use straight after load
+ * 	- per-thread cache views, so threads can fetch pixels in parallel
+ * 	- fetch bands of lines in one call
  */
 
 /*
@@ -78,10 +82,9 @@ typedef struct _VipsForeignLoadMagick7 {
 
 	int n_frames;			/* Number of frames in file */
 	Image **frames;			/* An Image* for each frame */
-	CacheView **cache_view; 	/* A CacheView for each frame */
 	int frame_height;	
 
-	/* Mutex to serialise calls to libMagick during threaded read.
+	/* Mutex to serialise cache view create and destroy.
 	 */
 	GMutex *lock;
 
@@ -263,19 +266,13 @@ vips_foreign_load_magick7_dispose( GObject *gobject )
 {
 	VipsForeignLoadMagick7 *magick7 = (VipsForeignLoadMagick7 *) gobject;
 
-	int i;
-
 #ifdef DEBUG
 	printf( "vips_foreign_load_magick7_dispose: %p\n", gobject ); 
 #endif /*DEBUG*/
 
-	for( i = 0; i < magick7->n_frames; i++ ) {
-		VIPS_FREEF( DestroyCacheView, magick7->cache_view[i] ); 
-	}
 	VIPS_FREEF( DestroyImageList, magick7->image );
 	VIPS_FREEF( DestroyImageInfo, magick7->image_info ); 
 	VIPS_FREE( magick7->frames );
-	VIPS_FREE( magick7->cache_view );
 	VIPS_FREEF( DestroyExceptionInfo, magick7->exception ); 
 	VIPS_FREEF( vips_g_mutex_free, magick7->lock );
 
@@ -621,30 +618,95 @@ vips_foreign_load_magick7_parse( VipsForeignLoadMagick7 *magick7,
 	} \
 }
 
+/* Per-thread read state. Each thread has its own set of cache views and its
+ * own exception, so threads can fetch pixels from the pixel cache at the
+ * same time.
+ */
+typedef struct _VipsForeignLoadMagick7Seq {
+	VipsForeignLoadMagick7 *magick7;
+
+	CacheView **cache_view; 	/* A CacheView for each frame */
+	ExceptionInfo *exception;
+} VipsForeignLoadMagick7Seq;
+
+static int
+vips_foreign_load_magick7_stop( void *vseq, void *a, void *b )
+{
+	VipsForeignLoadMagick7Seq *seq = (VipsForeignLoadMagick7Seq *) vseq;
+	VipsForeignLoadMagick7 *magick7 = seq->magick7;
+
+	int i;
+
+	if( seq->cache_view ) {
+		g_mutex_lock( magick7->lock );
+		for( i = 0; i < magick7->n_frames; i++ )
+			VIPS_FREEF( DestroyCacheView, seq->cache_view[i] );
+		g_mutex_unlock( magick7->lock );
+	}
+	VIPS_FREE( seq->cache_view );
+	VIPS_FREEF( DestroyExceptionInfo, seq->exception );
+	g_free( seq );
+
+	return( 0 );
+}
+
+static void *
+vips_foreign_load_magick7_start( VipsImage *out, void *a, void *b )
+{
+	VipsForeignLoadMagick7 *magick7 = (VipsForeignLoadMagick7 *) a;
+
+	VipsForeignLoadMagick7Seq *seq;
+	int i;
+
+	seq = g_new0( VipsForeignLoadMagick7Seq, 1 );
+	seq->magick7 = magick7;
+	seq->exception = AcquireExceptionInfo();
+	if( !(seq->cache_view = VIPS_ARRAY( NULL,
+		magick7->n_frames, CacheView * )) ) {
+		vips_foreign_load_magick7_stop( seq, a, b );
+		return( NULL );
+	}
+
+	/* Creating a view takes a reference to the pixel cache, so we lock
+	 * around it. Reads through the views need no lock.
+	 */
+	g_mutex_lock( magick7->lock );
+	for( i = 0; i < magick7->n_frames; i++ )
+		seq->cache_view[i] = AcquireVirtualCacheView(
+			magick7->frames[i], seq->exception );
+	g_mutex_unlock( magick7->lock );
+
+	return( seq );
+}
+
 static int
 vips_foreign_load_magick7_fill_region( VipsRegion *or, 
-	void *seq, void *a, void *b, gboolean *stop )
+	void *vseq, void *a, void *b, gboolean *stop )
 {
+	VipsForeignLoadMagick7Seq *seq = (VipsForeignLoadMagick7Seq *) vseq;
 	VipsForeignLoadMagick7 *magick7 = (VipsForeignLoadMagick7 *) a;
 	VipsRect *r = &or->valid;
 	VipsImage *im = or->im;
 
 	int y;
+	int n;
 
-	for( y = 0; y < r->height; y++ ) {
+	/* Fetch a band of lines from each frame we hit.
+	 */
+	for( y = 0; y < r->height; y += n ) {
 		int top = r->top + y;
 		int frame = top / magick7->frame_height;
 		int line = top % magick7->frame_height;
 		Image *image = magick7->frames[frame];
 
-		Quantum * restrict p;
-		VipsPel * restrict q;
+		const Quantum * restrict p;
+		int z;
 
-		g_mutex_lock( magick7->lock );
-		p = GetCacheViewAuthenticPixels( magick7->cache_view[frame],
-			r->left, line, r->width, 1, 
-			magick7->exception );
-		g_mutex_unlock( magick7->lock );
+		n = VIPS_MIN( magick7->frame_height - line, r->height - y );
+
+		p = GetCacheViewVirtualPixels( seq->cache_view[frame],
+			r->left, line, r->width, n,
+			seq->exception );
 
 		if( !p ) 
 			/* This can happen if, for example, some frames of a
@@ -653,27 +715,30 @@ vips_foreign_load_magick7_fill_region( VipsRegion *or,
 			 */
 			continue;
 
-		q = VIPS_REGION_ADDR( or, r->left, top ); 
+		for( z = 0; z < n; z++ ) {
+			VipsPel * restrict q =
+				VIPS_REGION_ADDR( or, r->left, top + z );
 
-		switch( im->BandFmt ) {
-		case VIPS_FORMAT_UCHAR:
-			UNPACK( unsigned char ); 
-			break;
+			switch( im->BandFmt ) {
+			case VIPS_FORMAT_UCHAR:
+				UNPACK( unsigned char );
+				break;
 
-		case VIPS_FORMAT_USHORT:
-			UNPACK( unsigned short ); 
-			break;
+			case VIPS_FORMAT_USHORT:
+				UNPACK( unsigned short );
+				break;
 
-		case VIPS_FORMAT_FLOAT:
-			UNPACK( float ); 
-			break;
+			case VIPS_FORMAT_FLOAT:
+				UNPACK( float );
+				break;
 
-		case VIPS_FORMAT_DOUBLE:
-			UNPACK( double ); 
-			break;
+			case VIPS_FORMAT_DOUBLE:
+				UNPACK( double );
+				break;
 
-		default:
-			g_assert_not_reached();
+			default:
+				g_assert_not_reached();
+			}
 		}
 	}
 
@@ -707,16 +772,12 @@ vips_foreign_load_magick7_load( VipsForeignLoadMagick7 *magick7 )
 		p = GetNextImageInList( p );
 	}
 
-	/* And a cache_view for each frame.
+	/* We'll never read any frames after the last one we use, so free
+	 * them now. For big multi-frame files this can save a lot of memory.
 	 */
-	g_assert( !magick7->cache_view ); 
-	if( !(magick7->cache_view = VIPS_ARRAY( NULL, 
-		magick7->n_frames, CacheView * )) )
-		return( -1 );
-	for( i = 0; i < magick7->n_frames; i++ ) {
-		magick7->cache_view[i] = AcquireAuthenticCacheView( 
-			magick7->frames[i], magick7->exception );
-	}
+	if( magick7->n_frames > 0 )
+		VIPS_FREEF( DestroyImageList, SplitImageList(
+			magick7->frames[magick7->n_frames - 1] ) );
 
 #ifdef DEBUG
 	/* Only display the traits from frame0, they should all be the same.
@@ -726,7 +787,9 @@ vips_foreign_load_magick7_load( VipsForeignLoadMagick7 *magick7 )
 #endif /*DEBUG*/
 
 	if( vips_image_generate( load->out, 
-		NULL, vips_foreign_load_magick7_fill_region, NULL, 
+		vips_foreign_load_magick7_start,
+		vips_foreign_load_magick7_fill_region,
+		vips_foreign_load_magick7_stop,
 		magick7, NULL ) )
 		return( -1 );
 
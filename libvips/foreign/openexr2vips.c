@@ -14,6 +14,9 @@
  * 	- redo as a set of fns ready for wrapping in a new-style class
  * 17/9/16
  * 	- tag output as scRGB
+ * 14/10/18
+ * 	- decode tiles in parallel, one file per thread
+ * 	- read spans of tiles with ImfTiledInputReadTiles()
  */
 
 /*
@@ -233,101 +236,120 @@ vips__openexr_read_header( const char *filename, VipsImage *out )
 	return( 0 );
 }
 
-/* Allocate a tile buffer.
+/* Per-thread read state. The OpenEXR C API can't share a file between
+ * threads, so each thread opens the file and decodes on its own.
  */
+typedef struct _ReadSeq {
+	Read *read;
+
+	ImfTiledInputFile *tiles;
+
+	/* A span of tiles is decoded to here.
+	 */
+	ImfRgba *imf_buffer;
+	int buffer_size;
+} ReadSeq;
+
+static int
+vips__openexr_stop( void *vseq, void *a, void *b )
+{
+	ReadSeq *seq = (ReadSeq *) vseq;
+
+	VIPS_FREEF( ImfCloseTiledInputFile, seq->tiles );
+	VIPS_FREE( seq->imf_buffer );
+	g_free( seq );
+
+	return( 0 );
+}
+
 static void *
 vips__openexr_start( VipsImage *out, void *a, void *b )
 {
 	Read *read = (Read *) a;
-	ImfRgba *imf_buffer;
 
-	if( !(imf_buffer = VIPS_ARRAY( out,
-		read->tile_width * read->tile_height, ImfRgba )) )
+	ReadSeq *seq;
+
+	seq = g_new0( ReadSeq, 1 );
+	seq->read = read;
+	if( !(seq->tiles = ImfOpenTiledInputFile( read->filename )) ) {
+		get_imf_error();
+		vips__openexr_stop( seq, a, b );
 		return( NULL );
+	}
 
-	return( imf_buffer );
+	return( seq );
 }
 
 static int
 vips__openexr_generate( VipsRegion *out, 
-	void *seq, void *a, void *b, gboolean *top )
+	void *vseq, void *a, void *b, gboolean *top )
 {
-	ImfRgba *imf_buffer = (ImfRgba *) seq;
+	ReadSeq *seq = (ReadSeq *) vseq;
 	Read *read = (Read *) a;
 	VipsRect *r = &out->valid;
 
 	const int tw = read->tile_width;
 	const int th = read->tile_height;
 
-	/* Find top left of tiles we need.
+	/* The span of tiles we need.
 	 */
-	const int xs = (r->left / tw) * tw;
-	const int ys = (r->top / th) * th;
-
-	int x, y, z;
-	VipsRect image;
+	const int txs = r->left / tw;
+	const int tys = r->top / th;
+	const int txe = (VIPS_RECT_RIGHT( r ) - 1) / tw;
+	const int tye = (VIPS_RECT_BOTTOM( r ) - 1) / th;
 
-	/* Area of image.
+	/* The span in VIPS coordinates.
 	 */
-	image.left = 0;
-	image.top = 0;
-	image.width = read->out->Xsize;
-	image.height = read->out->Ysize;
-
-	for( y = ys; y < VIPS_RECT_BOTTOM( r ); y += th )
-		for( x = xs; x < VIPS_RECT_RIGHT( r ); x += tw ) {
-			VipsRect tile;
-			VipsRect hit;
-			int result;
-
-			if( !ImfTiledInputSetFrameBuffer( read->tiles,
-				imf_buffer - 
-					(read->window.left + x) -
-					(read->window.top + y) * tw,
-				1, tw ) ) {
-				vips_foreign_load_invalidate( read->out );
-				get_imf_error();
-				return( -1 );
-			}
+	const int xs = txs * tw;
+	const int ys = tys * th;
+	const int bw = (txe - txs + 1) * tw;
+	const int bh = (tye - tys + 1) * th;
+
+	int z;
+
+	if( bw * bh > seq->buffer_size ) {
+		VIPS_FREE( seq->imf_buffer );
+		if( !(seq->imf_buffer = VIPS_ARRAY( NULL, bw * bh, ImfRgba )) )
+			return( -1 );
+		seq->buffer_size = bw * bh;
+	}
+
+	if( !ImfTiledInputSetFrameBuffer( seq->tiles,
+		seq->imf_buffer -
+			(read->window.left + xs) -
+			(read->window.top + ys) * bw,
+		1, bw ) ) {
+		vips_foreign_load_invalidate( read->out );
+		get_imf_error();
+		return( -1 );
+	}
 
 #ifdef DEBUG
-			printf( "exr2vips: requesting tile %d x %d\n", 
-				x / tw, y / th );
+	printf( "exr2vips: requesting tiles %d x %d to %d x %d\n",
+		txs, tys, txe, tye );
 #endif /*DEBUG*/
 
-			result = ImfTiledInputReadTile( read->tiles, 
-				x / tw, y / th, 0, 0 );
-
-			if( !result ) {
-				get_imf_error();
-				return( -1 );
-			}
+	/* Read the whole span in one call. OpenEXR can decode several tiles
+	 * together, and we avoid a frame buffer change per tile.
+	 */
+	if( !ImfTiledInputReadTiles( seq->tiles,
+		txs, txe, tys, tye, 0, 0 ) ) {
+		vips_foreign_load_invalidate( read->out );
+		get_imf_error();
+		return( -1 );
+	}
 
-			/* The tile in the file, in VIPS coordinates.
-			 */
-			tile.left = x;
-			tile.top = y;
-			tile.width = tw;
-			tile.height = th;
-			vips_rect_intersectrect( &tile, &image, &tile );
-
-			/* The part of this tile that hits the region.
-			 */
-			vips_rect_intersectrect( &tile, r, &hit );
-
-			/* Convert to float and write to the region.
-			 */
-			for( z = 0; z < hit.height; z++ ) {
-				ImfRgba *p = imf_buffer + 
-					(hit.left - tile.left) +
-					(hit.top - tile.top + z) * tw;
-				float *q = (float *) VIPS_REGION_ADDR( out,
-					hit.left, hit.top + z );
-
-				ImfHalfToFloatArray( 4 * hit.width, 
-					(ImfHalf *) p, q );
-			}
-		}
+	/* Convert to float and write to the region.
+	 */
+	for( z = 0; z < r->height; z++ ) {
+		ImfRgba *p = seq->imf_buffer +
+			(r->left - xs) +
+			(r->top - ys + z) * bw;
+		float *q = (float *) VIPS_REGION_ADDR( out,
+			r->left, r->top + z );
+
+		ImfHalfToFloatArray( 4 * r->width, (ImfHalf *) p, q );
+	}
 
 	return( 0 );
 }
@@ -352,18 +374,21 @@ vips__openexr_read( const char *filename, VipsImage *out )
 		read_header( read, raw );
 
 		if( vips_image_generate( raw, 
-			vips__openexr_start, vips__openexr_generate, NULL, 
+			vips__openexr_start, vips__openexr_generate,
+			vips__openexr_stop,
 			read, NULL ) )
 			return( -1 );
 
 		/* Copy to out, adding a cache. Enough tiles for a complete 
-		 * row, plus 50%.
+		 * row, plus 50%. Each thread has its own file, so the
+		 * cache can be threaded.
 		 */
 		if( vips_tilecache( raw, &t, 
 			"tile_width", read->tile_width, 
 			"tile_height", read->tile_height,
 			"max_tiles", (int) 
 				(1.5 * (1 + raw->Xsize / read->tile_width)),
+			"threaded", TRUE,
 			NULL ) ) 
 			return( -1 );
 		if( vips_image_write( t, out ) ) {
@@ -167,6 +167,9 @@ vips_foreign_load_openexr_init( VipsForeignLoadOpenexr *openexr )
  * OpenEXR colour management, image attributes, many pixel formats, anything
  * other than RGBA.
  *
+ * Tiled images are decoded in parallel, with each worker thread reading
+ * from its own copy of the file.
+ *
  * This reader uses the rather limited OpenEXR C API. It should really be
  * redone in C++.
  *
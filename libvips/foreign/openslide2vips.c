@@ -49,6 +49,9 @@
  * 	- unpremultiplication speedups for fully opaque/transparent pixels
  * 18/1/17
  * 	- reorganise to support invalidate on read error
+ * 14/10/18
+ * 	- add shrink, pick a level and block shrink the rest
+ * 	- batch runs of small native tiles into one read
  */
 
 /*
@@ -95,12 +98,19 @@
 
 #include <openslide.h>
 
+/* Read at least this many pixels across in each call to
+ * openslide_read_region(). Each call has a fixed cost for locking and tile
+ * lookup, so we batch runs of small native tiles together.
+ */
+#define OPENSLIDE_READ_WIDTH (512)
+
 typedef struct {
 	/* Params.
 	 */
 	char *filename;
 	VipsImage *out;
 	int32_t level;
+	int shrink;
 	gboolean autocrop;
 	char *associated;
 
@@ -115,10 +125,18 @@ typedef struct {
 	double downsample;
 	uint32_t bg;
 
+	/* After picking a level for @shrink, block shrink by this much more.
+	 */
+	int residual;
+
 	/* Try to get these from openslide properties.
 	 */
 	int tile_width;
 	int tile_height;
+
+	/* We read runs of native tiles this wide.
+	 */
+	int read_width;
 } ReadSlide;
 
 int
@@ -229,7 +247,7 @@ get_bounds( openslide_t *osr, VipsRect *rect )
 
 static ReadSlide *
 readslide_new( const char *filename, VipsImage *out, 
-	int level, gboolean autocrop, const char *associated )
+	int level, int shrink, gboolean autocrop, const char *associated )
 {
 	ReadSlide *rslide;
 
@@ -240,6 +258,13 @@ readslide_new( const char *filename, VipsImage *out,
 			"image" ) );
 		return( NULL );
 	}
+	if( shrink > 1 &&
+		(level || associated) ) {
+		vips_error( "openslide2vips",
+			"%s", _( "specify only one of shrink, level or "
+			"associated image" ) );
+		return( NULL );
+	}
 
 	rslide = VIPS_NEW( NULL, ReadSlide );
 	memset( rslide, 0, sizeof( *rslide ) );
@@ -249,6 +274,7 @@ readslide_new( const char *filename, VipsImage *out,
 	rslide->filename = g_strdup( filename );
 	rslide->out = out;
 	rslide->level = level;
+	rslide->shrink = VIPS_MAX( 1, shrink );
 	rslide->autocrop = autocrop;
 	rslide->associated = g_strdup( associated );
 
@@ -256,6 +282,7 @@ readslide_new( const char *filename, VipsImage *out,
 	 */
 	rslide->tile_width = 256;
 	rslide->tile_height = 256;
+	rslide->residual = 1;
 
 	return( rslide );
 }
@@ -283,6 +310,17 @@ readslide_parse( ReadSlide *rslide, VipsImage *image )
 		return( -1 );
 	}
 
+	/* Pick the smallest level which is no more shrunk than we need,
+	 * then block shrink the rest of the way.
+	 */
+	if( rslide->shrink > 1 &&
+		(rslide->level = openslide_get_best_level_for_downsample(
+			rslide->osr, rslide->shrink )) < 0 ) {
+		vips_error( "openslide2vips",
+			"%s", _( "unable to pick level for shrink" ) );
+		return( -1 );
+	}
+
 	if( rslide->level < 0 || 
 		rslide->level >= openslide_get_level_count( rslide->osr ) ) {
 		vips_error( "openslide2vips",
@@ -326,6 +364,19 @@ readslide_parse( ReadSlide *rslide, VipsImage *image )
 		if( value )
 			VIPS_DEBUG_MSG( "readslide_new: found tile-size\n" );
 
+		/* Gather short runs of native tiles into a single read.
+		 */
+		rslide->read_width = rslide->tile_width * VIPS_MAX( 1,
+			OPENSLIDE_READ_WIDTH / rslide->tile_width );
+
+		/* Allow a little slop in the level downsample, it's often
+		 * not quite an integer.
+		 */
+		if( rslide->shrink > 1 &&
+			rslide->downsample > 0 )
+			rslide->residual = VIPS_MAX( 1, (int)
+				(rslide->shrink / rslide->downsample + 0.01) );
+
 		/* Some images have a bounds in the header. Crop to 
 		 * that if autocrop is set. 
 		 */
@@ -406,15 +457,27 @@ readslide_parse( ReadSlide *rslide, VipsImage *image )
 
 int
 vips__openslide_read_header( const char *filename, VipsImage *out, 
-	int level, gboolean autocrop, char *associated )
+	int level, int shrink, gboolean autocrop, char *associated )
 {
 	ReadSlide *rslide;
 
 	if( !(rslide = readslide_new( filename, 
-		out, level, autocrop, associated )) ||
+		out, level, shrink, autocrop, associated )) ||
 		readslide_parse( rslide, out ) )
 		return( -1 );
 
+	/* This must match the size vips_shrink() will make in
+	 * vips__openslide_read().
+	 */
+	if( rslide->residual > 1 ) {
+		double residual = rslide->residual;
+
+		out->Xsize =
+			VIPS_MAX( 1, VIPS_ROUND_UINT( out->Xsize / residual ) );
+		out->Ysize =
+			VIPS_MAX( 1, VIPS_ROUND_UINT( out->Ysize / residual ) );
+	}
+
 	return( 0 );
 }
 
@@ -473,11 +536,11 @@ vips__openslide_generate( VipsRegion *out,
 		r->width, r->height, r->left, r->top );
 
 	/* We're inside a cache, so requests should always be
-	 * tile_width by tile_height pixels and on a tile boundary.
+	 * read_width by tile_height pixels and on a tile boundary.
 	 */
-	g_assert( (r->left % rslide->tile_width) == 0 );
+	g_assert( (r->left % rslide->read_width) == 0 );
 	g_assert( (r->top % rslide->tile_height) == 0 );
-	g_assert( r->width <= rslide->tile_width );
+	g_assert( r->width <= rslide->read_width );
 	g_assert( r->height <= rslide->tile_height );
 
 	/* The memory on the region should be contiguous for our ARGB->RGBA
@@ -515,16 +578,17 @@ vips__openslide_generate( VipsRegion *out,
 
 int
 vips__openslide_read( const char *filename, VipsImage *out, 
-	int level, gboolean autocrop )
+	int level, int shrink, gboolean autocrop )
 {
 	ReadSlide *rslide;
 	VipsImage *raw;
 	VipsImage *t;
 
-	VIPS_DEBUG_MSG( "vips__openslide_read: %s %d\n", 
-		filename, level );
+	VIPS_DEBUG_MSG( "vips__openslide_read: %s %d %d\n",
+		filename, level, shrink );
 
-	if( !(rslide = readslide_new( filename, out, level, autocrop, NULL )) )
+	if( !(rslide = readslide_new( filename,
+		out, level, shrink, autocrop, NULL )) )
 		return( -1 );
 
 	raw = vips_image_new();
@@ -539,13 +603,26 @@ vips__openslide_read( const char *filename, VipsImage *out,
 	 * 50%.
 	 */
 	if( vips_tilecache( raw, &t, 
-		"tile_width", rslide->tile_width, 
+		"tile_width", rslide->read_width,
 		"tile_height", rslide->tile_height,
 		"max_tiles", 
-			(int) (1.5 * (1 + raw->Xsize / rslide->tile_width)),
+			(int) (1.5 * (1 + raw->Xsize / rslide->read_width)),
 		"threaded", TRUE,
 		NULL ) ) 
 		return( -1 );
+
+	if( rslide->residual > 1 ) {
+		VipsImage *x;
+
+		if( vips_shrink( t, &x,
+			rslide->residual, rslide->residual, NULL ) ) {
+			g_object_unref( t );
+			return( -1 );
+		}
+		g_object_unref( t );
+		t = x;
+	}
+
 	if( vips_image_write( t, out ) ) {
 		g_object_unref( t );
 		return( -1 );
@@ -567,7 +644,8 @@ vips__openslide_read_associated( const char *filename, VipsImage *out,
 	VIPS_DEBUG_MSG( "vips__openslide_read_associated: %s %s\n", 
 		filename, associated );
 
-	if( !(rslide = readslide_new( filename, out, 0, FALSE, associated )) )
+	if( !(rslide = readslide_new( filename,
+		out, 0, 1, FALSE, associated )) )
 		return( -1 );
 
 	/* Memory buffer. Get associated directly to this, then copy to out.
@@ -9,6 +9,8 @@
  * 20/9/12
  * 	- add Leica filename suffix
  *	- drop glib log handler (unneeded with >= 3.3.0)
+ * 14/10/18
+ * 	- add shrink
  */
 
 /*
@@ -70,6 +72,10 @@ typedef struct _VipsForeignLoadOpenslide {
 	 */
 	int level;
 
+	/* Load the best level for this shrink, then block shrink the rest.
+	 */
+	int shrink;
+
 	/* Crop to image bounds.
 	 */
 	gboolean autocrop;
@@ -113,7 +119,7 @@ vips_foreign_load_openslide_header( VipsForeignLoad *load )
 	VipsForeignLoadOpenslide *openslide = (VipsForeignLoadOpenslide *) load;
 
 	if( vips__openslide_read_header( openslide->filename, load->out, 
-		openslide->level, openslide->autocrop, 
+		openslide->level, openslide->shrink, openslide->autocrop,
 		openslide->associated ) )
 		return( -1 );
 
@@ -129,7 +135,8 @@ vips_foreign_load_openslide_load( VipsForeignLoad *load )
 
 	if( !openslide->associated ) {
 		if( vips__openslide_read( openslide->filename, load->real, 
-			openslide->level, openslide->autocrop ) )
+			openslide->level, openslide->shrink,
+			openslide->autocrop ) )
 			return( -1 );
 	}
 	else {
@@ -210,11 +217,19 @@ vips_foreign_load_openslide_class_init( VipsForeignLoadOpenslideClass *class )
 		VIPS_ARGUMENT_OPTIONAL_INPUT, 
 		G_STRUCT_OFFSET( VipsForeignLoadOpenslide, associated ),
 		NULL );
+
+	VIPS_ARG_INT( class, "shrink", 13,
+		_( "Shrink" ),
+		_( "Shrink factor on load" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsForeignLoadOpenslide, shrink ),
+		1, 1000000, 1 );
 }
 
 static void
 vips_foreign_load_openslide_init( VipsForeignLoadOpenslide *openslide )
 {
+	openslide->shrink = 1;
 }
 
 #endif /*HAVE_OPENSLIDE*/
@@ -230,6 +245,7 @@ vips_foreign_load_openslide_init( VipsForeignLoadOpenslide *openslide )
  * * @level: load this level
  * * @associated: load this associated image
  * * @autocrop: crop to image bounds
+ * * @shrink: %gint, shrink by this factor on load
  *
  * Read a virtual slide supported by the OpenSlide library into a VIPS image.
  * OpenSlide supports images in Aperio, Hamamatsu, MIRAX, Sakura, Trestle,
@@ -240,6 +256,11 @@ vips_foreign_load_openslide_init( VipsForeignLoadOpenslide *openslide )
  * "levels".  By default, vips_openslideload() reads the highest-resolution
  * level (level 0).  Set @level to the level number you want.
  *
+ * Alternatively, set @shrink to the factor you want to shrink by. The
+ * largest level which is not more shrunk than this is read, and that is
+ * block shrunk by any remaining integer factor. This is much faster than
+ * reading level 0 and shrinking. You can't set both @shrink and @level.
+ *
  * In addition to the slide image itself, virtual slide formats sometimes
  * include additional images, such as a scan of the slide's barcode.
  * OpenSlide calls these "associated images".  To read an associated image,
@@ -8,6 +8,8 @@
  * 	- set page-height, if we can
  * 28/6/17
  * 	- use a much larger strip size, thanks bubba
+ * 14/10/18
+ * 	- render tiles in parallel, each thread with its own document
  */
 
 /*
@@ -62,6 +64,11 @@
 #include <cairo.h>
 #include <poppler.h>
 
+/* Render tiles this size. Each render call has to walk the whole page
+ * content, so tiles need to be quite large.
+ */
+#define PDF_TILE_SIZE (512)
+
 typedef struct _VipsForeignLoadPdf {
 	VipsForeignLoad parent_object;
 
@@ -81,9 +88,16 @@ typedef struct _VipsForeignLoadPdf {
 	 */
 	double scale;
 
-	/* Poppler is not thread-safe, so we run inside a single-threaded
-	 * cache. On the plus side, this means we only need one @page pointer,
-	 * even though we change this during _generate().
+	/* Open the document from this URI, or from this area of memory.
+	 * Owned by our subclasses.
+	 */
+	const char *uri;
+	const void *data;
+	size_t length;
+
+	/* Used to read the header. Poppler documents are not thread-safe,
+	 * so each render thread opens its own, see
+	 * vips_foreign_load_pdf_start().
 	 */
 	PopplerDocument *doc;
 	PopplerPage *page;
@@ -172,6 +186,87 @@ vips_foreign_load_pdf_get_page( VipsForeignLoadPdf *pdf, int page_no )
 	return( 0 );
 }
 
+static PopplerDocument *
+vips_foreign_load_pdf_open( VipsForeignLoadPdf *pdf )
+{
+	PopplerDocument *doc;
+	GError *error = NULL;
+
+	if( pdf->uri )
+		doc = poppler_document_new_from_file( pdf->uri, NULL, &error );
+	else
+		doc = poppler_document_new_from_data( (char *) pdf->data,
+			pdf->length, NULL, &error );
+	if( !doc ) {
+		vips_g_error( &error );
+		return( NULL );
+	}
+
+	return( doc );
+}
+
+/* Per-thread render state.
+ */
+typedef struct _VipsForeignLoadPdfSeq {
+	VipsForeignLoadPdf *pdf;
+
+	PopplerDocument *doc;
+	PopplerPage *page;
+	int current_page;
+} VipsForeignLoadPdfSeq;
+
+static int
+vips_foreign_load_pdf_stop( void *vseq, void *a, void *b )
+{
+	VipsForeignLoadPdfSeq *seq = (VipsForeignLoadPdfSeq *) vseq;
+
+	VIPS_UNREF( seq->page );
+	VIPS_UNREF( seq->doc );
+	g_free( seq );
+
+	return( 0 );
+}
+
+static void *
+vips_foreign_load_pdf_start( VipsImage *out, void *a, void *b )
+{
+	VipsForeignLoadPdf *pdf = (VipsForeignLoadPdf *) a;
+
+	VipsForeignLoadPdfSeq *seq;
+
+	seq = g_new0( VipsForeignLoadPdfSeq, 1 );
+	seq->pdf = pdf;
+	seq->current_page = -1;
+
+	if( !(seq->doc = vips_foreign_load_pdf_open( pdf )) ) {
+		vips_foreign_load_pdf_stop( seq, a, b );
+		return( NULL );
+	}
+
+	return( seq );
+}
+
+static int
+vips_foreign_load_pdf_seq_get_page( VipsForeignLoadPdfSeq *seq, int page_no )
+{
+	if( seq->current_page != page_no ) {
+		VipsObjectClass *class = VIPS_OBJECT_GET_CLASS( seq->pdf );
+
+		VIPS_UNREF( seq->page );
+		seq->current_page = -1;
+
+		if( !(seq->page = poppler_document_get_page( seq->doc,
+			page_no )) ) {
+			vips_error( class->nickname,
+				_( "unable to load page %d" ), page_no );
+			return( -1 );
+		}
+		seq->current_page = page_no;
+	}
+
+	return( 0 );
+}
+
 /* String-based metadata fields we extract.
  */
 typedef struct _VipsForeignLoadPdfMetadata {
@@ -200,9 +295,9 @@ vips_foreign_load_pdf_set_image( VipsForeignLoadPdf *pdf, VipsImage *out )
 	printf( "vips_foreign_load_pdf_set_image: %p\n", pdf );
 #endif /*DEBUG*/
 
-	/* We render to a linecache, so fat strips work well.
+	/* We render to a tilecache.
 	 */
-        vips_image_pipelinev( out, VIPS_DEMAND_STYLE_FATSTRIP, NULL );
+        vips_image_pipelinev( out, VIPS_DEMAND_STYLE_SMALLTILE, NULL );
 
 	/* Extract and attach metadata.
 	 */
@@ -306,8 +401,9 @@ vips_foreign_load_pdf_header( VipsForeignLoad *load )
 
 static int
 vips_foreign_load_pdf_generate( VipsRegion *or, 
-	void *seq, void *a, void *b, gboolean *stop )
+	void *vseq, void *a, void *b, gboolean *stop )
 {
+	VipsForeignLoadPdfSeq *seq = (VipsForeignLoadPdfSeq *) vseq;
 	VipsForeignLoadPdf *pdf = (VipsForeignLoadPdf *) a;
 	VipsRect *r = &or->valid;
 
@@ -355,12 +451,13 @@ vips_foreign_load_pdf_generate( VipsRegion *or,
 			(pdf->pages[i].left - rect.left) / pdf->scale, 
 			(pdf->pages[i].top - rect.top) / pdf->scale );
 
-		/* poppler is single-threaded, but we don't need to lock since 
-		 * we're running inside a non-threaded tilecache.
+		/* Each thread has its own document, so we don't need to
+		 * lock.
 		 */
-		if( vips_foreign_load_pdf_get_page( pdf, pdf->page_no + i ) )
-			return( -1 ); 
-		poppler_page_render( pdf->page, cr );
+		if( vips_foreign_load_pdf_seq_get_page( seq,
+			pdf->page_no + i ) )
+			return( -1 );
+		poppler_page_render( seq->page, cr );
 
 		cairo_destroy( cr );
 
@@ -395,17 +492,22 @@ vips_foreign_load_pdf_load( VipsForeignLoad *load )
 
 	vips_foreign_load_pdf_set_image( pdf, t[0] ); 
 	if( vips_image_generate( t[0], 
-		NULL, vips_foreign_load_pdf_generate, NULL, pdf, NULL ) )
+		vips_foreign_load_pdf_start,
+		vips_foreign_load_pdf_generate,
+		vips_foreign_load_pdf_stop,
+		pdf, NULL ) )
 		return( -1 );
 
-	/* Don't use tilecache to keep the number of calls to
-	 * pdf_page_render() low. Don't thread the cache, we rely on
-	 * locking to keep pdf single-threaded. Use a large strip size to
-	 * (again) keep the number of calls to page_render low. 
+	/* Tiles are rendered in parallel, each worker with its own document.
+	 * Keep enough tiles for a complete row, plus 50%.
 	 */
-	if( vips_linecache( t[0], &t[1],
-		"tile_height", VIPS_MIN( 5000, pdf->pages[0].height ), 
-		NULL ) ) 
+	if( vips_tilecache( t[0], &t[1],
+		"tile_width", PDF_TILE_SIZE,
+		"tile_height", PDF_TILE_SIZE,
+		"max_tiles",
+			(int) (1.5 * (1 + t[0]->Xsize / PDF_TILE_SIZE)),
+		"threaded", TRUE,
+		NULL ) )
 		return( -1 );
 	if( vips_image_write( t[1], load->real ) ) 
 		return( -1 );
@@ -519,11 +621,9 @@ vips_foreign_load_pdf_file_header( VipsForeignLoad *load )
 	}
 	g_free( path );
 
-	if( !(pdf->doc = poppler_document_new_from_file( 
-		file->uri, NULL, &error )) ) { 
-		vips_g_error( &error );
-		return( -1 ); 
-	}
+	pdf->uri = file->uri;
+	if( !(pdf->doc = vips_foreign_load_pdf_open( pdf )) )
+		return( -1 );
 
 	VIPS_SETSTR( load->out->filename, file->filename );
 
@@ -590,13 +690,10 @@ vips_foreign_load_pdf_buffer_header( VipsForeignLoad *load )
 	VipsForeignLoadPdfBuffer *buffer = 
 		(VipsForeignLoadPdfBuffer *) load;
 
-	GError *error = NULL;
-
-	if( !(pdf->doc = poppler_document_new_from_data( 
-		buffer->buf->data, buffer->buf->length, NULL, &error )) ) { 
-		vips_g_error( &error );
-		return( -1 ); 
-	}
+	pdf->data = buffer->buf->data;
+	pdf->length = buffer->buf->length;
+	if( !(pdf->doc = vips_foreign_load_pdf_open( pdf )) )
+		return( -1 );
 
 	return( vips_foreign_load_pdf_header( load ) );
 }
@@ -49,7 +49,8 @@ int vips__tiff_write( VipsImage *in, const char *filename,
 	gboolean bigtiff,
 	gboolean rgbjpeg,
 	gboolean properties,
-	gboolean strip );
+	gboolean strip,
+	VipsRegionShrink region_shrink );
 
 int vips__tiff_write_buf( VipsImage *in, 
 	void **obuf, size_t *olen, 
@@ -63,7 +64,8 @@ int vips__tiff_write_buf( VipsImage *in,
 	VipsForeignTiffResunit resunit, double xres, double yres,
 	gboolean bigtiff,
 	gboolean rgbjpeg,
-	gboolean properties, gboolean strip );
+	gboolean properties, gboolean strip,
+	VipsRegionShrink region_shrink );
 
 int vips__tiff_read_header( const char *filename, VipsImage *out, 
 	int page, int n, gboolean autorotate );
@@ -167,13 +169,28 @@ int vips__jpeg_write_file( VipsImage *in,
 	gboolean optimize_coding, gboolean progressive, gboolean strip,
 	gboolean no_subsample, gboolean trellis_quant,
 	gboolean overshoot_deringing, gboolean optimize_scans, 
-	int quant_table );
+	int quant_table, int restart_interval );
 int vips__jpeg_write_buffer( VipsImage *in, 
 	void **obuf, size_t *olen, int Q, const char *profile, 
 	gboolean optimize_coding, gboolean progressive, gboolean strip,
 	gboolean no_subsample, gboolean trellis_quant,
 	gboolean overshoot_deringing, gboolean optimize_scans, 
-	int quant_table );
+	int quant_table, int restart_interval );
+int vips__jpeg_write_target( VipsImage *in, VipsTarget *target,
+	int Q, const char *profile,
+	gboolean optimize_coding, gboolean progressive, gboolean strip,
+	gboolean no_subsample, gboolean trellis_quant,
+	gboolean overshoot_deringing, gboolean optimize_scans,
+	int quant_table, int restart_interval );
+
+typedef struct _VipsJpegEncoder VipsJpegEncoder;
+
+VipsJpegEncoder *vips__jpeg_encoder_new( int Q,
+	gboolean optimize_coding, gboolean progressive, gboolean no_subsample );
+void vips__jpeg_encoder_free( VipsJpegEncoder *encoder );
+int vips__jpeg_encoder_write( VipsJpegEncoder *encoder,
+	VipsPel **rows, int width, int height, int bands,
+	void **obuf, size_t *olen );
 
 int vips__isjpeg_buffer( const void *buf, size_t len );
 int vips__isjpeg( const char *filename );
@@ -181,17 +198,25 @@ int vips__jpeg_read_file( const char *name, VipsImage *out,
 	gboolean header_only, int shrink, gboolean fail, gboolean autorotate );
 int vips__jpeg_read_buffer( const void *buf, size_t len, VipsImage *out, 
 	gboolean header_only, int shrink, int fail, gboolean autorotate );
+int vips__jpeg_read_source( VipsSource *source, VipsImage *out,
+	gboolean header_only, int shrink, int fail, gboolean autorotate );
 
-int vips__png_header( const char *name, VipsImage *out );
-int vips__png_read( const char *name, VipsImage *out, gboolean fail );
+int vips__png_header( const char *name, VipsImage *out, int shrink );
+int vips__png_read( const char *name, VipsImage *out, gboolean fail,
+	int shrink );
 gboolean vips__png_ispng_buffer( const void *buf, size_t len );
 int vips__png_ispng( const char *filename );
 gboolean vips__png_isinterlaced( const char *filename );
 gboolean vips__png_isinterlaced_buffer( const void *buffer, size_t length );
 extern const char *vips__png_suffs[];
 int vips__png_read_buffer( const void *buffer, size_t length, VipsImage *out, 
-	gboolean fail );
-int vips__png_header_buffer( const void *buffer, size_t length, VipsImage *out );
+	gboolean fail, int shrink );
+int vips__png_header_buffer( const void *buffer, size_t length, VipsImage *out,
+	int shrink );
+int vips__png_read_source( VipsSource *source, VipsImage *out,
+	gboolean fail, int shrink );
+int vips__png_header_source( VipsSource *source, VipsImage *out, int shrink );
+gboolean vips__png_isinterlaced_source( VipsSource *source );
 
 int vips__png_write( VipsImage *in, const char *filename, 
 	int compress, int interlace, const char *profile,
@@ -199,6 +224,9 @@ int vips__png_write( VipsImage *in, const char *filename,
 int vips__png_write_buf( VipsImage *in, 
 	void **obuf, size_t *olen, int compression, int interlace, 
 	const char *profile, VipsForeignPngFilter filter, gboolean strip );
+int vips__png_write_target( VipsImage *in, VipsTarget *target,
+	int compression, int interlace,
+	const char *profile, VipsForeignPngFilter filter, gboolean strip );
 
 /* Map WEBP metadata names to vips names.
  */
@@ -229,19 +257,19 @@ int vips__webp_read_buffer( const void *buf, size_t len,
 int vips__webp_write_file( VipsImage *out, const char *filename, 
 	int Q, gboolean lossless, VipsForeignWebpPreset preset,
 	gboolean smart_subsample, gboolean near_lossless,
-	int alpha_q,
+	int alpha_q, int reduction_effort,
 	gboolean strip );
 int vips__webp_write_buffer( VipsImage *out, void **buf, size_t *len, 
 	int Q, gboolean lossless, VipsForeignWebpPreset preset,
 	gboolean smart_subsample, gboolean near_lossless,
-	int alpha_q,
+	int alpha_q, int reduction_effort,
 	gboolean strip );
 
 int vips__openslide_isslide( const char *filename );
 int vips__openslide_read_header( const char *filename, VipsImage *out, 
-	int level, gboolean autocrop, char *associated );
+	int level, int shrink, gboolean autocrop, char *associated );
 int vips__openslide_read( const char *filename, VipsImage *out, 
-	int level, gboolean autocrop );
+	int level, int shrink, gboolean autocrop );
 int vips__openslide_read_associated( const char *filename, VipsImage *out, 
 	const char *associated );
 
@@ -2,6 +2,12 @@
  *
  * 5/12/11
  * 	- from tiffload.c
+ * 14/10/18
+ * 	- add @shrink
+ * 	- add pngload_source
+ * 	- document ::preview
+ * 15/10/18
+ * 	- add ->header_filename() for vips_foreign_probe()
  */
 
 /*
@@ -59,6 +65,10 @@ typedef struct _VipsForeignLoadPng {
 	 */
 	char *filename; 
 
+	/* Shrink by this much during load.
+	 */
+	int shrink;
+
 } VipsForeignLoadPng;
 
 typedef VipsForeignLoadClass VipsForeignLoadPngClass;
@@ -93,7 +103,7 @@ vips_foreign_load_png_header( VipsForeignLoad *load )
 {
 	VipsForeignLoadPng *png = (VipsForeignLoadPng *) load;
 
-	if( vips__png_header( png->filename, load->out ) )
+	if( vips__png_header( png->filename, load->out, png->shrink ) )
 		return( -1 );
 
 	VIPS_SETSTR( load->out->filename, png->filename );
@@ -101,12 +111,20 @@ vips_foreign_load_png_header( VipsForeignLoad *load )
 	return( 0 );
 }
 
+static int
+vips_foreign_load_png_header_filename( const char *filename, 
+	VipsImage *out )
+{
+	return( vips__png_header( filename, out, 1 ) );
+}
+
 static int
 vips_foreign_load_png_load( VipsForeignLoad *load )
 {
 	VipsForeignLoadPng *png = (VipsForeignLoadPng *) load;
 
-	if( vips__png_read( png->filename, load->real, load->fail ) )
+	if( vips__png_read( png->filename, load->real, load->fail,
+		png->shrink ) )
 		return( -1 );
 
 	return( 0 );
@@ -137,6 +155,8 @@ vips_foreign_load_png_class_init( VipsForeignLoadPngClass *class )
 		vips_foreign_load_png_get_flags_filename;
 	load_class->get_flags = vips_foreign_load_png_get_flags;
 	load_class->header = vips_foreign_load_png_header;
+	load_class->header_filename = 
+		vips_foreign_load_png_header_filename;
 	load_class->load = vips_foreign_load_png_load;
 
 	VIPS_ARG_STRING( class, "filename", 1, 
@@ -145,11 +165,19 @@ vips_foreign_load_png_class_init( VipsForeignLoadPngClass *class )
 		VIPS_ARGUMENT_REQUIRED_INPUT, 
 		G_STRUCT_OFFSET( VipsForeignLoadPng, filename ),
 		NULL );
+
+	VIPS_ARG_INT( class, "shrink", 10,
+		_( "Shrink" ),
+		_( "Shrink factor on load" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsForeignLoadPng, shrink ),
+		1, 1024, 1 );
 }
 
 static void
 vips_foreign_load_png_init( VipsForeignLoadPng *png )
 {
+	png->shrink = 1;
 }
 
 typedef struct _VipsForeignLoadPngBuffer {
@@ -159,6 +187,10 @@ typedef struct _VipsForeignLoadPngBuffer {
 	 */
 	VipsArea *buf;
 
+	/* Shrink by this much during load.
+	 */
+	int shrink;
+
 } VipsForeignLoadPngBuffer;
 
 typedef VipsForeignLoadClass VipsForeignLoadPngBufferClass;
@@ -189,7 +221,7 @@ vips_foreign_load_png_buffer_header( VipsForeignLoad *load )
 	VipsForeignLoadPngBuffer *buffer = (VipsForeignLoadPngBuffer *) load;
 
 	if( vips__png_header_buffer( buffer->buf->data, buffer->buf->length, 
-		load->out ) )
+		load->out, buffer->shrink ) )
 		return( -1 );
 
 	return( 0 );
@@ -201,7 +233,7 @@ vips_foreign_load_png_buffer_load( VipsForeignLoad *load )
 	VipsForeignLoadPngBuffer *buffer = (VipsForeignLoadPngBuffer *) load;
 
 	if( vips__png_read_buffer( buffer->buf->data, buffer->buf->length, 
-		load->real, load->fail ) )
+		load->real, load->fail, buffer->shrink ) )
 		return( -1 );
 
 	return( 0 );
@@ -232,11 +264,124 @@ vips_foreign_load_png_buffer_class_init( VipsForeignLoadPngBufferClass *class )
 		G_STRUCT_OFFSET( VipsForeignLoadPngBuffer, buf ),
 		VIPS_TYPE_BLOB );
 
+	VIPS_ARG_INT( class, "shrink", 10,
+		_( "Shrink" ),
+		_( "Shrink factor on load" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsForeignLoadPngBuffer, shrink ),
+		1, 1024, 1 );
 }
 
 static void
 vips_foreign_load_png_buffer_init( VipsForeignLoadPngBuffer *buffer )
 {
+	buffer->shrink = 1;
+}
+
+typedef struct _VipsForeignLoadPngSource {
+	VipsForeignLoad parent_object;
+
+	/* Load from a source.
+	 */
+	VipsSource *source;
+
+	/* Shrink by this much during load.
+	 */
+	int shrink;
+
+} VipsForeignLoadPngSource;
+
+typedef VipsForeignLoadClass VipsForeignLoadPngSourceClass;
+
+G_DEFINE_TYPE( VipsForeignLoadPngSource, vips_foreign_load_png_source,
+	VIPS_TYPE_FOREIGN_LOAD );
+
+static VipsForeignFlags
+vips_foreign_load_png_source_get_flags( VipsForeignLoad *load )
+{
+	VipsForeignLoadPngSource *source = (VipsForeignLoadPngSource *) load;
+
+	VipsForeignFlags flags;
+
+	flags = 0;
+	if( vips__png_isinterlaced_source( source->source ) )
+		flags |= VIPS_FOREIGN_PARTIAL;
+	else
+		flags |= VIPS_FOREIGN_SEQUENTIAL;
+
+	return( flags );
+}
+
+static int
+vips_foreign_load_png_source_header( VipsForeignLoad *load )
+{
+	VipsForeignLoadPngSource *source = (VipsForeignLoadPngSource *) load;
+
+	if( vips__png_header_source( source->source,
+		load->out, source->shrink ) )
+		return( -1 );
+
+	return( 0 );
+}
+
+static int
+vips_foreign_load_png_source_load( VipsForeignLoad *load )
+{
+	VipsForeignLoadPngSource *source = (VipsForeignLoadPngSource *) load;
+
+	if( vips__png_read_source( source->source,
+		load->real, load->fail, source->shrink ) )
+		return( -1 );
+
+	return( 0 );
+}
+
+static gboolean
+vips_foreign_load_png_source_is_a( VipsSource *source )
+{
+	unsigned char *data;
+
+	return( (data = vips_source_sniff( source, 8 )) &&
+		vips__png_ispng_buffer( data, 8 ) );
+}
+
+static void
+vips_foreign_load_png_source_class_init( VipsForeignLoadPngSourceClass *class )
+{
+	GObjectClass *gobject_class = G_OBJECT_CLASS( class );
+	VipsObjectClass *object_class = (VipsObjectClass *) class;
+	VipsForeignLoadClass *load_class = (VipsForeignLoadClass *) class;
+
+	gobject_class->set_property = vips_object_set_property;
+	gobject_class->get_property = vips_object_get_property;
+
+	object_class->nickname = "pngload_source";
+	object_class->description = _( "load png from source" );
+
+	load_class->is_a_source = vips_foreign_load_png_source_is_a;
+	load_class->get_flags = vips_foreign_load_png_source_get_flags;
+	load_class->header = vips_foreign_load_png_source_header;
+	load_class->load = vips_foreign_load_png_source_load;
+
+	VIPS_ARG_OBJECT( class, "source", 1,
+		_( "Source" ),
+		_( "Source to load from" ),
+		VIPS_ARGUMENT_REQUIRED_INPUT,
+		G_STRUCT_OFFSET( VipsForeignLoadPngSource, source ),
+		VIPS_TYPE_SOURCE );
+
+	VIPS_ARG_INT( class, "shrink", 10,
+		_( "Shrink" ),
+		_( "Shrink factor on load" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsForeignLoadPngSource, shrink ),
+		1, 1024, 1 );
+}
+
+static void
+vips_foreign_load_png_source_init( VipsForeignLoadPngSource *source )
+{
+	source->shrink = 1;
 }
 
 #endif /*HAVE_PNG*/
@@ -247,11 +392,24 @@ vips_foreign_load_png_buffer_init( VipsForeignLoadPngBuffer *buffer )
  * @out: (out): decompressed image
  * @...: %NULL-terminated list of optional named arguments
  *
+ * Optional arguments:
+ *
+ * * @shrink: %gint, shrink by this much on load
+ *
  * Read a PNG file into a VIPS image. It can read all png images, including 8-
  * and 16-bit images, 1 and 3 channel, with and without an alpha channel.
  *
  * Any ICC profile is read and attached to the VIPS image.
  *
+ * Use @shrink to specify a shrink-on-load factor. Non-interlaced images are
+ * block averaged as they are decompressed, weighting colour by alpha.
+ * Interlaced images are subsampled, and only the first few Adam7 passes are
+ * decoded if @shrink is divisible by 2, 4 or 8.
+ *
+ * If you connect to #VipsImage::preview on the image before the pixels are
+ * read, interlaced images are decoded a pass at a time and each refinement
+ * is sent to your handler.
+ *
  * See also: vips_image_new_from_file().
  *
  * Returns: 0 on success, -1 on error.
@@ -276,6 +434,10 @@ vips_pngload( const char *filename, VipsImage **out, ... )
  * @out: (out): image to write
  * @...: %NULL-terminated list of optional named arguments
  *
+ * Optional arguments:
+ *
+ * * @shrink: %gint, shrink by this much on load
+ *
  * Read a PNG-formatted memory block into a VIPS image. It can read all png 
  * images, including 8- and 16-bit images, 1 and 3 channel, with and without 
  * an alpha channel.
@@ -309,4 +471,32 @@ vips_pngload_buffer( void *buf, size_t len, VipsImage **out, ... )
 	return( result );
 }
 
+/**
+ * vips_pngload_source:
+ * @source: source to load from
+ * @out: (out): image to write
+ * @...: %NULL-terminated list of optional named arguments
+ *
+ * Optional arguments:
+ *
+ * * @shrink: %gint, shrink by this much on load
+ *
+ * Exactly as vips_pngload(), but read from a #VipsSource. Non-interlaced
+ * images are decoded as bytes arrive.
+ *
+ * See also: vips_pngload(), vips_image_new_from_source().
+ *
+ * Returns: 0 on success, -1 on error.
+ */
+int
+vips_pngload_source( VipsSource *source, VipsImage **out, ... )
+{
+	va_list ap;
+	int result;
 
+	va_start( ap, out );
+	result = vips_call_split( "pngload_source", ap, source, out );
+	va_end( ap );
+
+	return( result );
+}
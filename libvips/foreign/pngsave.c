@@ -4,6 +4,8 @@
  * 	- wrap a class around the png writer
  * 16/7/12
  * 	- compression should be 0-9, not 1-10
+ * 14/10/18
+ * 	- add pngsave_target
  */
 
 /*
@@ -264,6 +266,63 @@ vips_foreign_save_png_buffer_init( VipsForeignSavePngBuffer *buffer )
 {
 }
 
+typedef struct _VipsForeignSavePngTarget {
+	VipsForeignSavePng parent_object;
+
+	VipsTarget *target;
+} VipsForeignSavePngTarget;
+
+typedef VipsForeignSavePngClass VipsForeignSavePngTargetClass;
+
+G_DEFINE_TYPE( VipsForeignSavePngTarget, vips_foreign_save_png_target,
+	vips_foreign_save_png_get_type() );
+
+static int
+vips_foreign_save_png_target_build( VipsObject *object )
+{
+	VipsForeignSave *save = (VipsForeignSave *) object;
+	VipsForeignSavePng *png = (VipsForeignSavePng *) object;
+	VipsForeignSavePngTarget *target = (VipsForeignSavePngTarget *) object;
+
+	if( VIPS_OBJECT_CLASS( vips_foreign_save_png_target_parent_class )->
+		build( object ) )
+		return( -1 );
+
+	if( vips__png_write_target( save->ready, target->target,
+		png->compression, png->interlace, png->profile, png->filter,
+		save->strip ) ||
+		vips_target_finish( target->target ) )
+		return( -1 );
+
+	return( 0 );
+}
+
+static void
+vips_foreign_save_png_target_class_init( VipsForeignSavePngTargetClass *class )
+{
+	GObjectClass *gobject_class = G_OBJECT_CLASS( class );
+	VipsObjectClass *object_class = (VipsObjectClass *) class;
+
+	gobject_class->set_property = vips_object_set_property;
+	gobject_class->get_property = vips_object_get_property;
+
+	object_class->nickname = "pngsave_target";
+	object_class->description = _( "save image to png target" );
+	object_class->build = vips_foreign_save_png_target_build;
+
+	VIPS_ARG_OBJECT( class, "target", 1,
+		_( "Target" ),
+		_( "Target to save to" ),
+		VIPS_ARGUMENT_REQUIRED_INPUT,
+		G_STRUCT_OFFSET( VipsForeignSavePngTarget, target ),
+		VIPS_TYPE_TARGET );
+}
+
+static void
+vips_foreign_save_png_target_init( VipsForeignSavePngTarget *target )
+{
+}
+
 #endif /*HAVE_PNG*/
 
 /**
@@ -372,3 +431,35 @@ vips_pngsave_buffer( VipsImage *in, void **buf, size_t *len, ... )
 
 	return( result );
 }
+
+/**
+ * vips_pngsave_target: (method)
+ * @in: image to save
+ * @target: save image to this target
+ * @...: %NULL-terminated list of optional named arguments
+ *
+ * Optional arguments:
+ *
+ * * @compression: compression level
+ * * @interlace: interlace image
+ * * @profile: ICC profile to embed
+ * * @filter: libpng row filter flag(s)
+ *
+ * As vips_pngsave(), but save to a target.
+ *
+ * See also: vips_pngsave(), vips_image_write_to_target().
+ *
+ * Returns: 0 on success, -1 on error.
+ */
+int
+vips_pngsave_target( VipsImage *in, VipsTarget *target, ... )
+{
+	va_list ap;
+	int result;
+
+	va_start( ap, target );
+	result = vips_call_split( "pngsave_target", ap, in, target );
+	va_end( ap );
+
+	return( result );
+}
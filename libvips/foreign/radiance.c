@@ -21,6 +21,8 @@
  * 	- use dbuf for buffer output
  * 4/4/17
  * 	- reduce stack use to help musl
+ * 15/10/18
+ * 	- index scanlines in mapped files and decode in parallel
  */
 
 /*
@@ -142,6 +144,8 @@
 #include <string.h>
 #include <ctype.h>
 #include <math.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #include <vips/vips.h>
 #include <vips/internal.h>
@@ -627,11 +631,12 @@ resolu2str(char *buf, RESOLU *rp)		/* convert resolution struct to line */
 #define BUFFER_MARGIN (256)
 
 /* Read from a FILE with a rolling memory buffer ... this lets us reduce the
- * number of fgetc() and gives us some very quick readahead.
+ * number of fgetc() and gives us some very quick readahead. A Buffer can
+ * also be a fixed window on a memory area, see buffer_init_memory().
  */
 
 typedef struct _Buffer { 
-	unsigned char text[BUFFER_SIZE + BUFFER_MARGIN];
+	unsigned char *text;
 	int length;
 	int position;
 	FILE *fp;
@@ -642,6 +647,7 @@ buffer_new( FILE *fp )
 {
 	Buffer *buffer = g_new0( Buffer, 1 );
 
+	buffer->text = g_malloc( BUFFER_SIZE + BUFFER_MARGIN );
 	buffer->length = 0;
 	buffer->position = 0;
 	buffer->fp = fp;
@@ -652,9 +658,22 @@ buffer_new( FILE *fp )
 static void
 buffer_free( Buffer *buffer )
 {
+	g_free( buffer->text ); 
 	g_free( buffer ); 
 }
 
+/* Set a Buffer up to read from @length bytes at @data. This is small enough
+ * to live on the stack. 
+ */
+static void
+buffer_init_memory( Buffer *buffer, const unsigned char *data, int length )
+{
+	buffer->text = (unsigned char *) data;
+	buffer->length = length;
+	buffer->position = 0;
+	buffer->fp = NULL;
+}
+
 /* Make sure there are at least @require bytes of readahead available.
  */
 static int
@@ -668,7 +687,8 @@ buffer_need( Buffer *buffer, int require )
 	g_assert( buffer->position <= buffer->length ); 
 
 	remaining = buffer->length - buffer->position;
-	if( remaining < require ) {
+	if( remaining < require &&
+		buffer->fp ) {
 		size_t len;
 
 		/* Areas can overlap.
@@ -684,11 +704,11 @@ buffer_need( Buffer *buffer, int require )
 			1, BUFFER_SIZE, buffer->fp );
 		buffer->length += len;
 		remaining = buffer->length - buffer->position;
+	}
 
-		if( remaining < require ) {
-			vips_error( "rad2vips", "%s", _( "end of file" ) ); 
-			return( -1 );
-		}
+	if( remaining < require ) {
+		vips_error( "rad2vips", "%s", _( "end of file" ) ); 
+		return( -1 );
 	}
 
 	return( 0 );
@@ -814,6 +834,48 @@ scanline_read( Buffer *buffer, COLR *scanline, int width )
 	return( 0 );
 }
 
+/* Skip over a new-style scanline in memory without decoding it. Return a
+ * pointer to the next scanline, or NULL if this is not a complete new-style
+ * scanline.
+ */
+static const unsigned char *
+scanline_skip( const unsigned char *p, const unsigned char *end, int width )
+{
+	int i, j;
+
+	if( width < MINELEN ||
+		width > MAXELEN ||
+		end - p < 4 ||
+		p[0] != 2 ||
+		p[1] != 2 ||
+		p[2] & 128 ||
+		((p[2] << 8) | p[3]) != width )
+		return( NULL );
+	p += 4;
+
+	for( i = 0; i < 4; i++ ) 
+		for( j = 0; j < width; ) {
+			int code, len;
+			gboolean run;
+
+			if( end - p < 2 )
+				return( NULL ); 
+
+			code = *p++;
+			run = code > 128;
+			len = run ? code & 127 : code; 
+
+			if( j + len > width ||
+				(!run && end - p < len) ) 
+				return( NULL );
+
+			p += run ? 1 : len;
+			j += len;
+		}
+
+	return( p );
+}
+
 /* An encoded scanline can't be larger than this.
  */
 #define MAX_LINE (2 * MAXELEN * sizeof( COLR ))
@@ -926,6 +988,15 @@ typedef struct {
 	RGBPRIMS prims;
 	RESOLU rs;
 	Buffer *buffer; 
+
+	/* If the file can be mapped and every scanline is new-style RLE, we
+	 * index the start of each scanline and decode them in parallel. 
+	 * line_offset has height + 1 entries, the last marks the end of
+	 * the final scanline.
+	 */
+	unsigned char *base;
+	size_t length;
+	gint64 *line_offset;
 } Read;
 
 int
@@ -954,6 +1025,11 @@ read_destroy( VipsObject *object, Read *read )
 	VIPS_FREE( read->filename );
 	VIPS_FREEF( fclose, read->fin );
 	VIPS_FREEF( buffer_free, read->buffer );
+	VIPS_FREE( read->line_offset );
+	if( read->base ) {
+		vips__munmap( read->base, read->length );
+		read->base = NULL;
+	}
 }
 
 static Read *
@@ -981,6 +1057,9 @@ read_new( const char *filename, VipsImage *out )
 	read->prims[2][1] = CIE_y_b;
 	read->prims[3][0] = CIE_x_w;
 	read->prims[3][1] = CIE_y_w;
+	read->base = NULL;
+	read->length = 0;
+	read->line_offset = NULL;
 
 	g_signal_connect( out, "close", 
 		G_CALLBACK( read_destroy ), read );
@@ -1140,6 +1219,127 @@ rad2vips_generate( VipsRegion *or,
 	return( 0 );
 }
 
+/* Map the file and find the start of every scanline. We only do this for
+ * regular files where every scanline is new-style RLE, anything else is read
+ * sequentially. Return 0 if we made an index.
+ */
+static int
+rad2vips_index( Read *read, VipsImage *out )
+{
+	int fd = fileno( read->fin );
+	int width = out->Xsize;
+	int height = out->Ysize;
+
+	struct stat st;
+	long start;
+	const unsigned char *p;
+	const unsigned char *end;
+	int y;
+
+	/* The header was read with stdio, so the pixels start at the current
+	 * file position.
+	 */
+	if( width < MINELEN ||
+		width > MAXELEN ||
+		(start = ftell( read->fin )) < 0 ||
+		fstat( fd, &st ) ||
+		!S_ISREG( st.st_mode ) ||
+		st.st_size <= start )
+		return( -1 );
+
+	if( !(read->base = vips__mmap( fd, FALSE, st.st_size, 0 )) )
+		return( -1 );
+	read->length = st.st_size;
+	read->line_offset = g_new( gint64, height + 1 );
+
+	p = read->base + start;
+	end = read->base + read->length;
+	for( y = 0; y < height; y++ ) {
+		read->line_offset[y] = p - read->base;
+		if( !(p = scanline_skip( p, end, width )) ) 
+			break;
+	}
+
+	if( y < height ) {
+#ifdef DEBUG
+		printf( "rad2vips_index: no index, stopped at line %d\n", y );
+#endif /*DEBUG*/
+
+		VIPS_FREE( read->line_offset );
+		vips__munmap( read->base, read->length );
+		read->base = NULL;
+
+		return( -1 );
+	}
+	read->line_offset[height] = p - read->base;
+
+	return( 0 );
+}
+
+static void *
+rad2vips_start( VipsImage *out, void *a, void *b )
+{
+	return( g_new( COLR, out->Xsize ) );
+}
+
+static int
+rad2vips_stop( void *seq, void *a, void *b )
+{
+	g_free( seq );
+
+	return( 0 );
+}
+
+/* Decode scanlines from the mapped file. Any thread can decode any line, so
+ * this does not need to be sequential.
+ */
+static int
+rad2vips_generate_indexed( VipsRegion *or, 
+	void *seq, void *a, void *b, gboolean *stop )
+{
+        VipsRect *r = &or->valid;
+	Read *read = (Read *) a; 
+	COLR *line = (COLR *) seq;
+	int width = or->im->Xsize;
+
+	int y;
+
+	VIPS_GATE_START( "rad2vips_generate_indexed: work" );
+
+	for( y = 0; y < r->height; y++ ) {
+		int top = r->top + y;
+		gint64 offset = read->line_offset[top];
+
+		Buffer buffer;
+		COLR *buf;
+
+		/* Decode straight to the region if it's the whole width.
+		 */
+		if( r->left == 0 &&
+			r->width == width )
+			buf = (COLR *) VIPS_REGION_ADDR( or, 0, top );
+		else
+			buf = line;
+
+		buffer_init_memory( &buffer, read->base + offset, 
+			read->line_offset[top + 1] - offset );
+		if( scanline_read( &buffer, buf, width ) ) {
+			vips_error( "rad2vips", 
+				_( "read error line %d" ), top );
+			VIPS_GATE_STOP( "rad2vips_generate_indexed: work" );
+			return( -1 );
+		}
+
+		if( buf == line )
+			memcpy( VIPS_REGION_ADDR( or, r->left, top ), 
+				line + r->left, r->width * sizeof( COLR ) );
+	}
+
+	VIPS_GATE_STOP( "rad2vips_generate_indexed: work" );
+
+	return( 0 );
+}
+
 int
 vips__rad_load( const char *filename, VipsImage *out )
 {
@@ -1159,11 +1359,26 @@ vips__rad_load( const char *filename, VipsImage *out )
 	if( rad2vips_get_header( read, t[0] ) )
 		return( -1 );
 
-	if( vips_image_generate( t[0], 
-		NULL, rad2vips_generate, NULL, read, NULL ) ||
-		vips_sequential( t[0], &t[1], "tile_height", 8, NULL ) ||
-		vips_image_write( t[1], out ) )
-		return( -1 );
+	if( !rad2vips_index( read, t[0] ) ) {
+		/* Everything we need is in the map now.
+		 */
+		VIPS_FREEF( buffer_free, read->buffer );
+		VIPS_FREEF( fclose, read->fin );
+
+		if( vips_image_generate( t[0], 
+			rad2vips_start, rad2vips_generate_indexed, 
+				rad2vips_stop, read, NULL ) ||
+			vips_image_write( t[0], out ) )
+			return( -1 );
+	}
+	else {
+		if( vips_image_generate( t[0], 
+			NULL, rad2vips_generate, NULL, read, NULL ) ||
+			vips_sequential( t[0], &t[1], 
+				"tile_height", 8, NULL ) ||
+			vips_image_write( t[1], out ) )
+			return( -1 );
+	}
 
 	return( 0 );
 }
@@ -2,6 +2,8 @@
  *
  * 5/12/11
  * 	- from tiffload.c
+ * 15/10/18
+ * 	- add ->header_filename() for vips_foreign_probe()
  */
 
 /*
@@ -95,6 +97,13 @@ vips_foreign_load_rad_header( VipsForeignLoad *load )
 	return( 0 );
 }
 
+static int
+vips_foreign_load_rad_header_filename( const char *filename, 
+	VipsImage *out )
+{
+	return( vips__rad_header( filename, out ) );
+}
+
 static int
 vips_foreign_load_rad_load( VipsForeignLoad *load )
 {
@@ -131,6 +140,8 @@ vips_foreign_load_rad_class_init( VipsForeignLoadRadClass *class )
 		vips_foreign_load_rad_get_flags_filename;
 	load_class->get_flags = vips_foreign_load_rad_get_flags;
 	load_class->header = vips_foreign_load_rad_header;
+	load_class->header_filename = 
+		vips_foreign_load_rad_header_filename;
 	load_class->load = vips_foreign_load_rad_load;
 
 	VIPS_ARG_STRING( class, "filename", 1, 
@@ -14,6 +14,8 @@
  * 	- handle scaling of svg files missing width and height attributes
  * 22/3/18 lovell
  * 	- svgload was missing is_a
+ * 14/10/18
+ * 	- render tiles in parallel, each thread with its own rsvg handle
  */
 
 /*
@@ -84,6 +86,12 @@
 #include <zlib.h>
 #endif
 
+/* Render tiles this size. rsvg skips elements outside the clip, but each
+ * call still has to walk the whole document, so tiles need to be quite
+ * large.
+ */
+#define SVG_TILE_SIZE (512)
+
 typedef struct _VipsForeignLoadSvg {
 	VipsForeignLoad parent_object;
 
@@ -99,6 +107,16 @@ typedef struct _VipsForeignLoadSvg {
 	 */
 	double cairo_scale;
 
+	/* Open the document from this file, or from this area of memory.
+	 * Owned by our subclasses.
+	 */
+	const char *filename;
+	const void *data;
+	size_t length;
+
+	/* Used to read the header. rsvg handles are not thread-safe, so each
+	 * render thread parses its own, see vips_foreign_load_svg_start().
+	 */
 	RsvgHandle *page;
 
 } VipsForeignLoadSvg;
@@ -221,6 +239,25 @@ vips_foreign_load_svg_dispose( GObject *gobject )
 		dispose( gobject );
 }
 
+static RsvgHandle *
+vips_foreign_load_svg_open( VipsForeignLoadSvg *svg )
+{
+	RsvgHandle *page;
+	GError *error = NULL;
+
+	if( svg->filename )
+		page = rsvg_handle_new_from_file( svg->filename, &error );
+	else
+		page = rsvg_handle_new_from_data( svg->data, svg->length,
+			&error );
+	if( !page ) {
+		vips_g_error( &error );
+		return( NULL );
+	}
+
+	return( page );
+}
+
 static VipsForeignFlags
 vips_foreign_load_svg_get_flags_filename( const char *filename )
 {
@@ -284,9 +321,9 @@ vips_foreign_load_svg_parse( VipsForeignLoadSvg *svg, VipsImage *out )
 		4, VIPS_FORMAT_UCHAR,
 		VIPS_CODING_NONE, VIPS_INTERPRETATION_sRGB, res, res );
 
-	/* We render to a linecache, so fat strips work well.
+	/* We render to a threaded tilecache.
 	 */
-        vips_image_pipelinev( out, VIPS_DEMAND_STYLE_FATSTRIP, NULL );
+        vips_image_pipelinev( out, VIPS_DEMAND_STYLE_SMALLTILE, NULL );
 
 }
 
@@ -300,10 +337,52 @@ vips_foreign_load_svg_header( VipsForeignLoad *load )
 	return( 0 );
 }
 
+/* Per-thread render state.
+ */
+typedef struct _VipsForeignLoadSvgSeq {
+	VipsForeignLoadSvg *svg;
+
+	RsvgHandle *page;
+} VipsForeignLoadSvgSeq;
+
+static int
+vips_foreign_load_svg_stop( void *vseq, void *a, void *b )
+{
+	VipsForeignLoadSvgSeq *seq = (VipsForeignLoadSvgSeq *) vseq;
+
+	VIPS_UNREF( seq->page );
+	g_free( seq );
+
+	return( 0 );
+}
+
+static void *
+vips_foreign_load_svg_start( VipsImage *out, void *a, void *b )
+{
+	VipsForeignLoadSvg *svg = (VipsForeignLoadSvg *) a;
+
+	VipsForeignLoadSvgSeq *seq;
+
+	seq = g_new0( VipsForeignLoadSvgSeq, 1 );
+	seq->svg = svg;
+
+	if( !(seq->page = vips_foreign_load_svg_open( svg )) ) {
+		vips_foreign_load_svg_stop( seq, a, b );
+		return( NULL );
+	}
+
+	/* Same as the DPI _parse() leaves on the header handle.
+	 */
+	rsvg_handle_set_dpi( seq->page, svg->dpi * svg->scale );
+
+	return( seq );
+}
+
 static int
 vips_foreign_load_svg_generate( VipsRegion *or, 
-	void *seq, void *a, void *b, gboolean *stop )
+	void *vseq, void *a, void *b, gboolean *stop )
 {
+	VipsForeignLoadSvgSeq *seq = (VipsForeignLoadSvgSeq *) vseq;
 	VipsForeignLoadSvg *svg = (VipsForeignLoadSvg *) a;
 	VipsObjectClass *class = VIPS_OBJECT_GET_CLASS( svg );
 	VipsRect *r = &or->valid;
@@ -324,14 +403,19 @@ vips_foreign_load_svg_generate( VipsRegion *or,
 	cr = cairo_create( surface );
 	cairo_surface_destroy( surface );
 
+	/* Clip to the tile so rsvg can skip elements which don't touch it.
+	 */
+	cairo_rectangle( cr, 0, 0, r->width, r->height );
+	cairo_clip( cr );
+
 	cairo_scale( cr, svg->cairo_scale, svg->cairo_scale );
 	cairo_translate( cr, -r->left / svg->cairo_scale,
 		-r->top / svg->cairo_scale );
 
-	/* rsvg is single-threaded, but we don't need to lock since we're
-	 * running inside a non-threaded tilecache.
+	/* Each thread has its own handle, so we don't need to lock.
 	 */
-	if( !rsvg_handle_render_cairo( svg->page, cr ) ) {
+	if( !rsvg_handle_render_cairo( seq->page, cr ) ) {
+		cairo_destroy( cr );
 		vips_operation_invalidate( VIPS_OPERATION( svg ) );
 		vips_error( class->nickname, 
 			"%s", _( "SVG rendering failed" ) );
@@ -357,38 +441,29 @@ vips_foreign_load_svg_load( VipsForeignLoad *load )
 	VipsImage **t = (VipsImage **) 
 		vips_object_local_array( (VipsObject *) load, 2 );
 
-	int tile_width;
-	int tile_height;
-	int n_lines;
-	int max_tiles;
-
-	/* Use this to pick a tile height for our strip cache.
-	 */
-	vips_get_tile_size( load->real,
-		&tile_width, &tile_height, &n_lines );
-
 	/* Read to this image, then cache to out, see below.
 	 */
 	t[0] = vips_image_new(); 
 
 	vips_foreign_load_svg_parse( svg, t[0] ); 
 	if( vips_image_generate( t[0], 
-		NULL, vips_foreign_load_svg_generate, NULL, svg, NULL ) )
+		vips_foreign_load_svg_start,
+		vips_foreign_load_svg_generate,
+		vips_foreign_load_svg_stop,
+		svg, NULL ) )
 		return( -1 );
 
-	/* librsvg starts to fail if any axis in a single render call is over 
-	 * 32767. Use a tilecache so we can render very wide images, though we
-	 * set it up like a linecache. 
-	 *
-	 * Don't thread the cache: we rely on this to keep calls to rsvg 
-	 * single-threaded.
+	/* Tiles are rendered in parallel, each worker with its own handle.
+	 * Small tiles also keep us well clear of the 32767 pixel limit on a
+	 * single librsvg render call. Keep enough tiles for a complete row,
+	 * plus 50%.
 	 */
-	max_tiles = 3 * VIPS_ROUND_UP( t[0]->Xsize, 30000 ) / 30000;
 	if( vips_tilecache( t[0], &t[1],
-		"tile_width", 30000,
-		"tile_height", tile_height,
-		"max_tiles", max_tiles,
-		"access", VIPS_ACCESS_SEQUENTIAL,
+		"tile_width", SVG_TILE_SIZE,
+		"tile_height", SVG_TILE_SIZE,
+		"max_tiles",
+			(int) (1.5 * (1 + t[0]->Xsize / SVG_TILE_SIZE)),
+		"threaded", TRUE,
 		NULL ) ) 
 		return( -1 );
 	if( vips_image_write( t[1], load->real ) ) 
@@ -470,13 +545,9 @@ vips_foreign_load_svg_file_header( VipsForeignLoad *load )
 	VipsForeignLoadSvg *svg = (VipsForeignLoadSvg *) load;
 	VipsForeignLoadSvgFile *file = (VipsForeignLoadSvgFile *) load;
 
-	GError *error = NULL;
-
-	if( !(svg->page = rsvg_handle_new_from_file( 
-		file->filename, &error )) ) { 
-		vips_g_error( &error );
-		return( -1 ); 
-	}
+	svg->filename = file->filename;
+	if( !(svg->page = vips_foreign_load_svg_open( svg )) )
+		return( -1 );
 
 	VIPS_SETSTR( load->out->filename, file->filename );
 
@@ -548,13 +619,10 @@ vips_foreign_load_svg_buffer_header( VipsForeignLoad *load )
 	VipsForeignLoadSvgBuffer *buffer = 
 		(VipsForeignLoadSvgBuffer *) load;
 
-	GError *error = NULL;
-
-	if( !(svg->page = rsvg_handle_new_from_data( 
-		buffer->buf->data, buffer->buf->length, &error )) ) { 
-		vips_g_error( &error );
-		return( -1 ); 
-	}
+	svg->data = buffer->buf->data;
+	svg->length = buffer->buf->length;
+	if( !(svg->page = vips_foreign_load_svg_open( svg )) )
+		return( -1 );
 
 	return( vips_foreign_load_svg_header( load ) );
 }
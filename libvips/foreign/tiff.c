@@ -5,6 +5,8 @@
  *
  * 26/8/17
  * 	- add openout_read, to help tiffsave_buffer for pyramids
+ * 14/10/18
+ * 	- add vips__tiff_openout_dbuf()
  */
 
 /*
@@ -440,5 +442,69 @@ vips__tiff_openout_buffer( VipsImage *image,
 	return( tiff );
 }
 
+/* TIFF output to a #VipsDbuf owned by the caller. TIFFClose() leaves the
+ * bytes in @dbuf.
+ */
+
+static tsize_t
+openout_dbuf_read( thandle_t st, tdata_t data, tsize_t size )
+{
+	VipsDbuf *dbuf = (VipsDbuf *) st;
+
+	return( vips_dbuf_read( dbuf, data, size ) );
+}
+
+static tsize_t
+openout_dbuf_write( thandle_t st, tdata_t data, tsize_t size )
+{
+	VipsDbuf *dbuf = (VipsDbuf *) st;
+
+	vips_dbuf_write( dbuf, data, size );
+
+	return( size );
+}
+
+static int
+openout_dbuf_close( thandle_t st )
+{
+	return( 0 );
+}
+
+static toff_t
+openout_dbuf_seek( thandle_t st, toff_t position, int whence )
+{
+	VipsDbuf *dbuf = (VipsDbuf *) st;
+
+	vips_dbuf_seek( dbuf, position, whence );
+
+	return( vips_dbuf_tell( dbuf ) );
+}
+
+TIFF *
+vips__tiff_openout_dbuf( VipsDbuf *dbuf )
+{
+	TIFF *tiff;
+
+#ifdef DEBUG
+	printf( "vips__tiff_openout_dbuf:\n" );
+#endif /*DEBUG*/
+
+	if( !(tiff = TIFFClientOpen( "memory output", "w",
+		(thandle_t) dbuf,
+		openout_dbuf_read,
+		openout_dbuf_write,
+		openout_dbuf_seek,
+		openout_dbuf_close,
+		openout_buffer_size,
+		openout_buffer_map,
+		openout_buffer_unmap )) ) {
+		vips_error( "vips__tiff_openout_dbuf", "%s",
+			_( "unable to open memory buffer for output" ) );
+		return( NULL );
+	}
+
+	return( tiff );
+}
+
 #endif /*HAVE_TIFF*/
 
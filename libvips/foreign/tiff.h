@@ -44,6 +44,7 @@ TIFF *vips__tiff_openin_buffer( VipsImage *image,
 	const void *data, size_t length );
 TIFF *vips__tiff_openout_buffer( VipsImage *image, 
 	gboolean bigtiff, void **out_data, size_t *out_length );
+TIFF *vips__tiff_openout_dbuf( VipsDbuf *dbuf );
 
 #ifdef __cplusplus
 }
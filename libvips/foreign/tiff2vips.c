@@ -177,6 +177,9 @@
  * 	- remove missing res warning
  * 19/5/17
  * 	- page > 0 could break edge tiles or strips
+ * 14/10/18
+ * 	- decode compressed tiles in parallel with a TIFF handle per thread
+ * 	- aligned tile reads select the right page for multi-page images
  */
 
 /*
@@ -274,6 +277,8 @@ typedef struct _Rtiff {
 	/* Parameters.
 	 */
 	char *filename;
+	const void *buf;
+	size_t len;
 	VipsImage *out;
 	int page;
 	int n;
@@ -296,6 +301,11 @@ typedef struct _Rtiff {
 	 */
 	gboolean memcpy;
 
+	/* Set if each sequence opens its own TIFF handle, so tiles can be
+	 * decompressed in parallel.
+	 */
+	gboolean threaded;
+
 	/* Geometry as read from the TIFF header. This is read for the first
 	 * page, and equal for all other pages. 
 	 */
@@ -1361,27 +1371,107 @@ rtiff_tile_size( Rtiff *rtiff )
 	return( TIFFTileRowSize( rtiff->tiff ) * rtiff->header.tile_height );
 }
 
-/* Allocate a tile buffer. Have one of these for each thread so we can unpack
- * to vips in parallel.
+/* Per-thread read state.
  */
+typedef struct _RtiffSeq {
+	Rtiff *rtiff;
+
+	/* Our own TIFF handle in threaded mode, or NULL to share
+	 * rtiff->tiff.
+	 */
+	TIFF *tiff;
+
+	/* The page we have set on our handle.
+	 */
+	int current_page;
+
+	/* A tile buffer, so we can unpack to vips in parallel.
+	 */
+	tdata_t buf;
+} RtiffSeq;
+
+static int
+rtiff_seq_stop( void *vseq, void *a, void *b )
+{
+	RtiffSeq *seq = (RtiffSeq *) vseq;
+
+	VIPS_FREEF( TIFFClose, seq->tiff );
+	VIPS_FREE( seq->buf );
+	vips_free( seq );
+
+	return( 0 );
+}
+
 static void *
 rtiff_seq_start( VipsImage *out, void *a, void *b )
 {
 	Rtiff *rtiff = (Rtiff *) a;
-	tsize_t size;
-	tdata_t *buf;
 
-	size = rtiff_tile_size( rtiff );
-	if( !(buf = vips_malloc( NULL, size )) )
+	RtiffSeq *seq;
+
+	if( !(seq = VIPS_NEW( NULL, RtiffSeq )) )
 		return( NULL );
+	seq->rtiff = rtiff;
+	seq->tiff = NULL;
+	seq->current_page = -1;
+	seq->buf = NULL;
+
+	if( rtiff->threaded ) {
+		if( rtiff->filename )
+			seq->tiff = vips__tiff_openin( rtiff->filename );
+		else
+			seq->tiff = vips__tiff_openin_buffer( rtiff->out,
+				rtiff->buf, rtiff->len );
+		if( !seq->tiff ) {
+			rtiff_seq_stop( seq, a, b );
+			return( NULL );
+		}
+	}
+
+	if( !(seq->buf = vips_malloc( NULL, rtiff_tile_size( rtiff ) )) ) {
+		rtiff_seq_stop( seq, a, b );
+		return( NULL );
+	}
+
+	return( (void *) seq );
+}
+
+static int
+rtiff_seq_set_page( RtiffSeq *seq, int page )
+{
+	Rtiff *rtiff = seq->rtiff;
+
+	if( !seq->tiff )
+		return( rtiff_set_page( rtiff, page ) );
+
+	if( seq->current_page != page ) {
+		if( !TIFFSetDirectory( seq->tiff, page ) ) {
+			vips_error( "tiff2vips",
+				_( "TIFF does not contain page %d" ), page );
+			return( -1 );
+		}
+
+		/* Changing directory resets the codec pseudo-tags, see
+		 * rtiff_pick_reader().
+		 */
+		if( rtiff->header.photometric_interpretation ==
+			PHOTOMETRIC_YCBCR )
+			TIFFSetField( seq->tiff,
+				TIFFTAG_JPEGCOLORMODE, JPEGCOLORMODE_RGB );
 
-	return( (void *) buf );
+		seq->current_page = page;
+	}
+
+	return( 0 );
 }
 
 static int
-rtiff_read_tile( Rtiff *rtiff, tdata_t *buf, int x, int y )
+rtiff_read_tile( RtiffSeq *seq, tdata_t *buf, int x, int y )
 {
-	if( TIFFReadTile( rtiff->tiff, buf, x, y, 0, 0 ) < 0 ) { 
+	Rtiff *rtiff = seq->rtiff;
+	TIFF *tiff = seq->tiff ? seq->tiff : rtiff->tiff;
+
+	if( TIFFReadTile( tiff, buf, x, y, 0, 0 ) < 0 ) {
 		vips_foreign_load_invalidate( rtiff->out );
 		return( -1 ); 
 	}
@@ -1395,13 +1485,16 @@ rtiff_read_tile( Rtiff *rtiff, tdata_t *buf, int x, int y )
  * region.
  */
 static int
-rtiff_fill_region_aligned( VipsRegion *out, void *seq, void *a, void *b )
+rtiff_fill_region_aligned( VipsRegion *out, void *vseq, void *a, void *b )
 {
+	RtiffSeq *seq = (RtiffSeq *) vseq;
 	Rtiff *rtiff = (Rtiff *) a;
 	VipsRect *r = &out->valid;
+	int page_no = r->top / rtiff->header.height;
+	int page_y = r->top % rtiff->header.height;
 
 	g_assert( (r->left % rtiff->header.tile_width) == 0 );
-	g_assert( (r->top % rtiff->header.tile_height) == 0 );
+	g_assert( (page_y % rtiff->header.tile_height) == 0 );
 	g_assert( r->width == rtiff->header.tile_width );
 	g_assert( r->height == rtiff->header.tile_height );
 	g_assert( VIPS_REGION_LSKIP( out ) == VIPS_REGION_SIZEOF_LINE( out ) );
@@ -1415,9 +1508,10 @@ rtiff_fill_region_aligned( VipsRegion *out, void *seq, void *a, void *b )
 
 	/* Read that tile directly into the vips tile.
 	 */
-	if( rtiff_read_tile( rtiff,
-		(tdata_t *) VIPS_REGION_ADDR( out, r->left, r->top ), 
-		r->left, r->top ) ) {
+	if( rtiff_seq_set_page( seq, rtiff->page + page_no ) ||
+		rtiff_read_tile( seq,
+			(tdata_t *) VIPS_REGION_ADDR( out, r->left, r->top ),
+			r->left, page_y ) ) {
 		VIPS_GATE_STOP( "rtiff_fill_region_aligned: work" ); 
 		return( -1 );
 	}
@@ -1431,9 +1525,10 @@ rtiff_fill_region_aligned( VipsRegion *out, void *seq, void *a, void *b )
  */
 static int
 rtiff_fill_region( VipsRegion *out, 
-	void *seq, void *a, void *b, gboolean *stop )
+	void *vseq, void *a, void *b, gboolean *stop )
 {
-	tdata_t *buf = (tdata_t *) seq;
+	RtiffSeq *seq = (RtiffSeq *) vseq;
+	tdata_t *buf = (tdata_t *) seq->buf;
 	Rtiff *rtiff = (Rtiff *) a;
 	int tile_width = rtiff->header.tile_width;
 	int tile_height = rtiff->header.tile_height;
@@ -1455,10 +1550,13 @@ rtiff_fill_region( VipsRegion *out,
 
 	/* Special case: we are filling a single tile exactly sized to match
 	 * the tiff tile and we have no repacking to do for this format.
+	 * The tile must also lie within a single page.
 	 */
 	if( rtiff->memcpy &&
 		r->left % tile_width == 0 &&
-		r->top % tile_height == 0 &&
+		(r->top % rtiff->header.height) % tile_height == 0 &&
+		(r->top % rtiff->header.height) + tile_height <=
+			rtiff->header.height &&
 		r->width == tile_width &&
 		r->height == tile_height &&
 		VIPS_REGION_LSKIP( out ) == VIPS_REGION_SIZEOF_LINE( out ) )
@@ -1489,8 +1587,8 @@ rtiff_fill_region( VipsRegion *out,
 			int xs = ((r->left + x) / tile_width) * tile_width;
 			int ys = (page_y / tile_height) * tile_height;
 
-			if( rtiff_set_page( rtiff, rtiff->page + page_no ) ||
-				rtiff_read_tile( rtiff, buf, xs, ys ) ) { 
+			if( rtiff_seq_set_page( seq, rtiff->page + page_no ) ||
+				rtiff_read_tile( seq, buf, xs, ys ) ) {
 				VIPS_GATE_STOP( "rtiff_fill_region: work" ); 
 				return( -1 );
 			}
@@ -1543,14 +1641,6 @@ rtiff_fill_region( VipsRegion *out,
 	return( 0 );
 }
 
-static int
-rtiff_seq_stop( void *seq, void *a, void *b )
-{
-	vips_free( seq );
-
-	return( 0 );
-}
-
 /* Auto-rotate handling. 
  */
 static int
@@ -1638,6 +1728,22 @@ rtiff_read_tilewise( Rtiff *rtiff, VipsImage *out )
 		}
 	}
 
+	/* A libtiff handle can only be used by one thread at a time, so with
+	 * a single handle the cache has to serialise tile decode. For
+	 * compressed images, where decode is most of the cost, give each
+	 * sequence its own handle and let the cache run threaded. The cache
+	 * then just stops several threads decoding the same tile.
+	 */
+	if( (rtiff->filename || rtiff->buf) &&
+		vips_concurrency_get() > 1 ) {
+		uint16 compression;
+
+		if( TIFFGetFieldDefaulted( rtiff->tiff,
+			TIFFTAG_COMPRESSION, &compression ) &&
+			compression != COMPRESSION_NONE )
+			rtiff->threaded = TRUE;
+	}
+
 	/* Even though this is a tiled reader, we hint thinstrip since with
 	 * the cache we are quite happy serving that if anything downstream 
 	 * would like it.
@@ -1655,6 +1761,7 @@ rtiff_read_tilewise( Rtiff *rtiff, VipsImage *out )
 		"tile_width", tile_width,
 		"tile_height", tile_height,
 		"max_tiles", 2 * (1 + t[0]->Xsize / tile_width),
+		"threaded", rtiff->threaded,
 		NULL ) ) 
 		return( -1 );
 	if( rtiff_autorotate( rtiff, t[1], &t[2] ) )
@@ -1979,6 +2086,8 @@ rtiff_new( VipsImage *out, int page, int n, gboolean autorotate )
 		return( NULL );
 
 	rtiff->filename = NULL;
+	rtiff->buf = NULL;
+	rtiff->len = 0;
 	rtiff->out = out;
 	rtiff->page = page;
 	rtiff->n = n;
@@ -1988,6 +2097,7 @@ rtiff_new( VipsImage *out, int page, int n, gboolean autorotate )
 	rtiff->sfn = NULL;
 	rtiff->client = NULL;
 	rtiff->memcpy = FALSE;
+	rtiff->threaded = FALSE;
 	rtiff->plane_buf = NULL;
 	rtiff->contig_buf = NULL;
 
@@ -2226,6 +2336,9 @@ rtiff_new_buffer( const void *buf, size_t len, VipsImage *out,
 		rtiff_header_read_all( rtiff ) )
 		return( NULL );
 
+	rtiff->buf = buf;
+	rtiff->len = len;
+
 	return( rtiff );
 }
 
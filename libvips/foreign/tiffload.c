@@ -4,6 +4,11 @@
  * 	- from tiffload.c
  * 27/1/17
  * 	- add get_flags for buffer loader
+ * 14/10/18
+ * 	- note parallel tile decode
+ * 	- add tiffload_source
+ * 15/10/18
+ * 	- add ->header_filename() for vips_foreign_probe()
  */
 
 /*
@@ -176,6 +181,13 @@ vips_foreign_load_tiff_file_header( VipsForeignLoad *load )
 	return( 0 );
 }
 
+static int
+vips_foreign_load_tiff_file_header_filename( const char *filename, 
+	VipsImage *out )
+{
+	return( vips__tiff_read_header( filename, out, 0, 1, FALSE ) );
+}
+
 static int
 vips_foreign_load_tiff_file_load( VipsForeignLoad *load )
 {
@@ -216,6 +228,8 @@ vips_foreign_load_tiff_file_class_init( VipsForeignLoadTiffFileClass *class )
 		vips_foreign_load_tiff_file_get_flags_filename;
 	load_class->get_flags = vips_foreign_load_tiff_file_get_flags;
 	load_class->header = vips_foreign_load_tiff_file_header;
+	load_class->header_filename = 
+		vips_foreign_load_tiff_file_header_filename;
 	load_class->load = vips_foreign_load_tiff_file_load;
 
 	VIPS_ARG_STRING( class, "filename", 1, 
@@ -321,6 +335,145 @@ vips_foreign_load_tiff_buffer_init( VipsForeignLoadTiffBuffer *buffer )
 {
 }
 
+typedef struct _VipsForeignLoadTiffSource {
+	VipsForeignLoadTiff parent_object;
+
+	/* Load from a source.
+	 */
+	VipsSource *source;
+
+} VipsForeignLoadTiffSource;
+
+typedef VipsForeignLoadTiffClass VipsForeignLoadTiffSourceClass;
+
+G_DEFINE_TYPE( VipsForeignLoadTiffSource, vips_foreign_load_tiff_source,
+	vips_foreign_load_tiff_get_type() );
+
+/* libtiff needs random access, and tile decode reopens the file once per
+ * thread. File sources use the file loader, anything else is read to memory
+ * and goes through the buffer loader.
+ */
+
+static VipsForeignFlags
+vips_foreign_load_tiff_source_get_flags( VipsForeignLoad *load )
+{
+	VipsForeignLoadTiffSource *source = (VipsForeignLoadTiffSource *) load;
+
+	const void *data;
+	size_t length;
+	VipsForeignFlags flags;
+
+	flags = 0;
+	if( source->source->filename ) {
+		if( vips__istifftiled( source->source->filename ) )
+			flags |= VIPS_FOREIGN_PARTIAL;
+		else
+			flags |= VIPS_FOREIGN_SEQUENTIAL;
+	}
+	else if( (data = vips_source_map( source->source, &length )) ) {
+		if( vips__istifftiled_buffer( data, length ) )
+			flags |= VIPS_FOREIGN_PARTIAL;
+		else
+			flags |= VIPS_FOREIGN_SEQUENTIAL;
+	}
+
+	return( flags );
+}
+
+static int
+vips_foreign_load_tiff_source_header( VipsForeignLoad *load )
+{
+	VipsForeignLoadTiff *tiff = (VipsForeignLoadTiff *) load;
+	VipsForeignLoadTiffSource *source = (VipsForeignLoadTiffSource *) load;
+
+	const void *data;
+	size_t length;
+
+	if( source->source->filename ) {
+		if( vips__tiff_read_header( source->source->filename,
+			load->out, tiff->page, tiff->n, tiff->autorotate ) )
+			return( -1 );
+	}
+	else {
+		if( !(data = vips_source_map( source->source, &length )) ||
+			vips__tiff_read_header_buffer( data, length, load->out,
+				tiff->page, tiff->n, tiff->autorotate ) )
+			return( -1 );
+	}
+
+	return( 0 );
+}
+
+static int
+vips_foreign_load_tiff_source_load( VipsForeignLoad *load )
+{
+	VipsForeignLoadTiff *tiff = (VipsForeignLoadTiff *) load;
+	VipsForeignLoadTiffSource *source = (VipsForeignLoadTiffSource *) load;
+
+	const void *data;
+	size_t length;
+
+	if( source->source->filename ) {
+		if( vips__tiff_read( source->source->filename,
+			load->real, tiff->page, tiff->n, tiff->autorotate ) )
+			return( -1 );
+	}
+	else {
+		if( !(data = vips_source_map( source->source, &length )) ||
+			vips__tiff_read_buffer( data, length, load->real,
+				tiff->page, tiff->n, tiff->autorotate ) )
+			return( -1 );
+
+		/* Tiles are read on demand from the mapped bytes.
+		 */
+		g_object_ref( source->source );
+		vips_object_local( load->real, source->source );
+	}
+
+	return( 0 );
+}
+
+static gboolean
+vips_foreign_load_tiff_source_is_a( VipsSource *source )
+{
+	unsigned char *data;
+
+	return( (data = vips_source_sniff( source, 4 )) &&
+		vips__istiff_buffer( data, 4 ) );
+}
+
+static void
+vips_foreign_load_tiff_source_class_init(
+	VipsForeignLoadTiffSourceClass *class )
+{
+	GObjectClass *gobject_class = G_OBJECT_CLASS( class );
+	VipsObjectClass *object_class = (VipsObjectClass *) class;
+	VipsForeignLoadClass *load_class = (VipsForeignLoadClass *) class;
+
+	gobject_class->set_property = vips_object_set_property;
+	gobject_class->get_property = vips_object_get_property;
+
+	object_class->nickname = "tiffload_source";
+	object_class->description = _( "load tiff from source" );
+
+	load_class->is_a_source = vips_foreign_load_tiff_source_is_a;
+	load_class->get_flags = vips_foreign_load_tiff_source_get_flags;
+	load_class->header = vips_foreign_load_tiff_source_header;
+	load_class->load = vips_foreign_load_tiff_source_load;
+
+	VIPS_ARG_OBJECT( class, "source", 1,
+		_( "Source" ),
+		_( "Source to load from" ),
+		VIPS_ARGUMENT_REQUIRED_INPUT,
+		G_STRUCT_OFFSET( VipsForeignLoadTiffSource, source ),
+		VIPS_TYPE_SOURCE );
+}
+
+static void
+vips_foreign_load_tiff_source_init( VipsForeignLoadTiffSource *source )
+{
+}
+
 #endif /*HAVE_TIFF*/
 
 /**
@@ -359,6 +512,9 @@ vips_foreign_load_tiff_buffer_init( VipsForeignLoadTiffBuffer *buffer )
  * operations will use #VIPS_META_ORIENTATION, if present, to set the
  * orientation of output images. 
  *
+ * Compressed tiled images are decoded in parallel: each thread opens its own
+ * handle on the file or buffer.
+ *
  * Any ICC profile is read and attached to the VIPS image as
  * #VIPS_META_ICC_NAME. Any XMP metadata is read and attached to the image
  * as #VIPS_META_XMP_NAME. Any IPTC is attached as #VIPS_META_IPTC_NAME. The
@@ -426,3 +582,36 @@ vips_tiffload_buffer( void *buf, size_t len, VipsImage **out, ... )
 
 	return( result );
 }
+
+/**
+ * vips_tiffload_source:
+ * @source: source to load from
+ * @out: (out): image to write
+ * @...: %NULL-terminated list of optional named arguments
+ *
+ * Optional arguments:
+ *
+ * * @page: %gint, load this page
+ * * @n: %gint, load this many pages
+ * * @autorotate: %gboolean, use orientation tag to rotate the image
+ *   during load
+ *
+ * Exactly as vips_tiffload(), but read from a #VipsSource. TIFF needs random
+ * access, so sources which are not files are read to memory first.
+ *
+ * See also: vips_tiffload(), vips_image_new_from_source().
+ *
+ * Returns: 0 on success, -1 on error.
+ */
+int
+vips_tiffload_source( VipsSource *source, VipsImage **out, ... )
+{
+	va_list ap;
+	int result;
+
+	va_start( ap, out );
+	result = vips_call_split( "tiffload_source", ap, source, out );
+	va_end( ap );
+
+	return( result );
+}
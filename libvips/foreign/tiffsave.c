@@ -12,6 +12,9 @@
  * 	- convert for jpg if jpg compression is on
  * 19/10/17
  * 	- predictor defaults to horizontal, reducing file size, usually
+ * 14/10/18
+ * 	- add tiffsave_target
+ * 	- add @region_shrink
  */
 
 /*
@@ -85,6 +88,7 @@ typedef struct _VipsForeignSaveTiff {
 	gboolean bigtiff;
 	gboolean rgbjpeg;
 	gboolean properties;
+	VipsRegionShrink region_shrink;
 } VipsForeignSaveTiff;
 
 typedef VipsForeignSaveClass VipsForeignSaveTiffClass;
@@ -293,6 +297,13 @@ vips_foreign_save_tiff_class_init( VipsForeignSaveTiffClass *class )
 		G_STRUCT_OFFSET( VipsForeignSaveTiff, properties ),
 		FALSE );
 
+	VIPS_ARG_ENUM( class, "region_shrink", 22,
+		_( "Region shrink" ),
+		_( "Method to shrink regions" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsForeignSaveTiff, region_shrink ),
+		VIPS_TYPE_REGION_SHRINK, VIPS_REGION_SHRINK_MEAN );
+
 }
 
 static void
@@ -306,6 +317,7 @@ vips_foreign_save_tiff_init( VipsForeignSaveTiff *tiff )
 	tiff->resunit = VIPS_FOREIGN_TIFF_RESUNIT_CM;
 	tiff->xres = 1.0;
 	tiff->yres = 1.0;
+	tiff->region_shrink = VIPS_REGION_SHRINK_MEAN;
 }
 
 typedef struct _VipsForeignSaveTiffFile {
@@ -341,7 +353,8 @@ vips_foreign_save_tiff_file_build( VipsObject *object )
 		tiff->bigtiff,
 		tiff->rgbjpeg,
 		tiff->properties,
-		save->strip ) )
+		save->strip,
+		tiff->region_shrink ) )
 		return( -1 );
 
 	return( 0 );
@@ -409,7 +422,8 @@ vips_foreign_save_tiff_buffer_build( VipsObject *object )
 		tiff->bigtiff,
 		tiff->rgbjpeg,
 		tiff->properties,
-		save->strip ) )
+		save->strip,
+		tiff->region_shrink ) )
 		return( -1 );
 
 	/* vips__tiff_write_buf() makes a buffer that needs g_free(), not
@@ -448,6 +462,88 @@ vips_foreign_save_tiff_buffer_init( VipsForeignSaveTiffBuffer *buffer )
 {
 }
 
+typedef struct _VipsForeignSaveTiffTarget {
+	VipsForeignSaveTiff parent_object;
+
+	VipsTarget *target;
+} VipsForeignSaveTiffTarget;
+
+typedef VipsForeignSaveTiffClass VipsForeignSaveTiffTargetClass;
+
+G_DEFINE_TYPE( VipsForeignSaveTiffTarget, vips_foreign_save_tiff_target,
+	vips_foreign_save_tiff_get_type() );
+
+static int
+vips_foreign_save_tiff_target_build( VipsObject *object )
+{
+	VipsForeignSave *save = (VipsForeignSave *) object;
+	VipsForeignSaveTiff *tiff = (VipsForeignSaveTiff *) object;
+	VipsForeignSaveTiffTarget *target =
+		(VipsForeignSaveTiffTarget *) object;
+
+	void *obuf;
+	size_t olen;
+
+	if( VIPS_OBJECT_CLASS( vips_foreign_save_tiff_target_parent_class )->
+		build( object ) )
+		return( -1 );
+
+	/* libtiff seeks back to patch offsets as it writes, so we must make
+	 * the file in memory before we can send it to the target.
+	 */
+	if( vips__tiff_write_buf( save->ready, &obuf, &olen,
+		tiff->compression, tiff->Q, tiff->predictor,
+		tiff->profile,
+		tiff->tile, tiff->tile_width, tiff->tile_height,
+		tiff->pyramid,
+		tiff->squash,
+		tiff->miniswhite,
+		tiff->resunit, tiff->xres, tiff->yres,
+		tiff->bigtiff,
+		tiff->rgbjpeg,
+		tiff->properties,
+		save->strip,
+		tiff->region_shrink ) )
+		return( -1 );
+
+	if( vips_target_write( target->target, obuf, olen ) ) {
+		g_free( obuf );
+		return( -1 );
+	}
+	g_free( obuf );
+
+	if( vips_target_finish( target->target ) )
+		return( -1 );
+
+	return( 0 );
+}
+
+static void
+vips_foreign_save_tiff_target_class_init( VipsForeignSaveTiffTargetClass *class )
+{
+	GObjectClass *gobject_class = G_OBJECT_CLASS( class );
+	VipsObjectClass *object_class = (VipsObjectClass *) class;
+
+	gobject_class->set_property = vips_object_set_property;
+	gobject_class->get_property = vips_object_get_property;
+
+	object_class->nickname = "tiffsave_target";
+	object_class->description = _( "save image to tiff target" );
+	object_class->build = vips_foreign_save_tiff_target_build;
+
+	VIPS_ARG_OBJECT( class, "target", 1,
+		_( "Target" ),
+		_( "Target to save to" ),
+		VIPS_ARGUMENT_REQUIRED_INPUT,
+		G_STRUCT_OFFSET( VipsForeignSaveTiffTarget, target ),
+		VIPS_TYPE_TARGET );
+}
+
+static void
+vips_foreign_save_tiff_target_init( VipsForeignSaveTiffTarget *target )
+{
+}
+
 #endif /*HAVE_TIFF*/
 
 /**
@@ -474,6 +570,7 @@ vips_foreign_save_tiff_buffer_init( VipsForeignSaveTiffBuffer *buffer )
  * * @bigtiff: set %TRUE to write a BigTiff file
  * * @properties: set %TRUE to write an IMAGEDESCRIPTION tag
  * * @strip: set %TRUE to block metadata save
+ * * @region_shrink: #VipsRegionShrink how to shrink each 2x2 region
  * * @page_height: %gint for page height for multi-page save
  *
  * Write a VIPS image to a file as TIFF.
@@ -536,6 +633,10 @@ vips_foreign_save_tiff_buffer_init( VipsForeignSaveTiffBuffer *buffer )
  * xml. If @properties is not set, the value of #VIPS_META_IMAGEDESCRIPTION is
  * used instead.
  *
+ * Use @region_shrink to pick how each pyramid layer is made from the one
+ * above. The default is the mean, use #VIPS_REGION_SHRINK_MODE, for
+ * example, for label maps.
+ *
  * The value of #VIPS_META_XMP_NAME is written to
  * the XMP tag. #VIPS_META_ORIENTATION (if set) is used to set the value of 
  * the orientation
@@ -585,6 +686,7 @@ vips_tiffsave( VipsImage *in, const char *filename, ... )
  * * @bigtiff: set %TRUE to write a BigTiff file
  * * @properties: set %TRUE to write an IMAGEDESCRIPTION tag
  * * @strip: set %TRUE to block metadata save
+ * * @region_shrink: #VipsRegionShrink how to shrink each 2x2 region
  * * @page_height: %gint for page height for multi-page save
  *
  * As vips_tiffsave(), but save to a memory buffer. 
@@ -624,3 +726,49 @@ vips_tiffsave_buffer( VipsImage *in, void **buf, size_t *len, ... )
 
 	return( result );
 }
+
+/**
+ * vips_tiffsave_target: (method)
+ * @in: image to save
+ * @target: save image to this target
+ * @...: %NULL-terminated list of optional named arguments
+ *
+ * Optional arguments:
+ *
+ * * @compression: use this #VipsForeignTiffCompression
+ * * @Q: %gint quality factor
+ * * @predictor: use this #VipsForeignTiffPredictor
+ * * @profile: filename of ICC profile to attach
+ * * @tile: set %TRUE to write a tiled tiff
+ * * @tile_width: %gint for tile size
+ * * @tile_height: %gint for tile size
+ * * @pyramid: set %TRUE to write an image pyramid
+ * * @squash: set %TRUE to squash 8-bit images down to 1 bit
+ * * @miniswhite: set %TRUE to write 1-bit images as MINISWHITE
+ * * @resunit: #VipsForeignTiffResunit for resolution unit
+ * * @xres: %gdouble horizontal resolution in pixels/mm
+ * * @yres: %gdouble vertical resolution in pixels/mm
+ * * @bigtiff: set %TRUE to write a BigTiff file
+ * * @properties: set %TRUE to write an IMAGEDESCRIPTION tag
+ * * @strip: set %TRUE to block metadata save
+ * * @region_shrink: #VipsRegionShrink how to shrink each 2x2 region
+ * * @page_height: %gint for page height for multi-page save
+ *
+ * As vips_tiffsave(), but save to a target.
+ *
+ * See also: vips_tiffsave(), vips_image_write_to_target().
+ *
+ * Returns: 0 on success, -1 on error.
+ */
+int
+vips_tiffsave_target( VipsImage *in, VipsTarget *target, ... )
+{
+	va_list ap;
+	int result;
+
+	va_start( ap, target );
+	result = vips_call_split( "tiffsave_target", ap, in, target );
+	va_end( ap );
+
+	return( result );
+}
@@ -86,6 +86,11 @@
  * 	- use dbuf for memory output
  * 19/12/17 Lovell
  * 	- fix a leak with an error during buffer output
+ * 14/10/18
+ * 	- add vips__jpeg_encoder_*() for dzsave
+ * 	- read from / write to VipsSource and VipsTarget
+ * 	- use a chunked buffer for memory output
+ * 	- add restart_interval, and encode stripes in parallel when we can
  */
 
 /*
@@ -199,11 +204,40 @@ typedef struct {
 	char *profile_bytes;
 	size_t profile_length;
 	VipsImage *inverted;
+
+	/* Set if we are encoding stripes in parallel, see
+	 * write_parallel_init().
+	 */
+	gboolean parallel;
+	int stripe_height;		/* Rows per stripe */
+	int y;				/* Rows copied so far */
+	struct _WriteStripe *stripe;	/* Stripe we are filling */
+	GQueue stripes;			/* Stripes in flight, in order */
+	VipsPel *header;		/* Tables from the first stripe */
+	size_t header_length;
+	int n_restart;			/* RST markers written so far */
 } Write;
 
+static void write_stripe_free( struct _WriteStripe *stripe );
+static void write_stripe_wait( struct _WriteStripe *stripe );
+static gboolean write_parallel_init( Write *write, VipsImage *in,
+	int restart_interval );
+static int write_parallel( Write *write, VipsImage *in );
+
 static void
 write_destroy( Write *write )
 {
+	struct _WriteStripe *stripe;
+
+	/* Workers may still be compressing stripes if we've had an error.
+	 */
+	while( (stripe = g_queue_pop_head( &write->stripes )) ) {
+		write_stripe_wait( stripe );
+		write_stripe_free( stripe );
+	}
+	VIPS_FREEF( write_stripe_free, write->stripe );
+	VIPS_FREE( write->header );
+
 	jpeg_destroy_compress( &write->cinfo );
 	VIPS_FREEF( fclose, write->eman.fp );
 	VIPS_FREE( write->row_pointer );
@@ -230,6 +264,7 @@ write_new( VipsImage *in )
 	write->profile_bytes = NULL;
 	write->profile_length = 0;
 	write->inverted = NULL;
+	g_queue_init( &write->stripes );
 
         return( write );
 }
@@ -418,7 +453,8 @@ static int
 write_vips( Write *write, int qfac, const char *profile, 
 	gboolean optimize_coding, gboolean progressive, gboolean strip, 
 	gboolean no_subsample, gboolean trellis_quant,
-	gboolean overshoot_deringing, gboolean optimize_scans, int quant_table )
+	gboolean overshoot_deringing, gboolean optimize_scans, int quant_table,
+	int restart_interval )
 {
 	VipsImage *in;
 	J_COLOR_SPACE space;
@@ -583,6 +619,11 @@ write_vips( Write *write, int qfac, const char *profile,
 	if( strip ) 
 		write->cinfo.write_JFIF_header = FALSE;
 
+	/* A restart marker every few MCU rows.
+	 */
+	write->cinfo.restart_in_rows = restart_interval;
+	write->parallel = write_parallel_init( write, in, restart_interval );
+
 	/* Build compress tables.
 	 */
 	jpeg_start_compress( &write->cinfo, TRUE );
@@ -610,6 +651,11 @@ write_vips( Write *write, int qfac, const char *profile,
 			return( -1 );
 	}
 
+	/* The parallel path writes the rest of the file itself.
+	 */
+	if( write->parallel )
+		return( write_parallel( write, in ) );
+
 	/* Write data. Note that the write function grabs the longjmp()!
 	 */
 	if( vips_sink_disc( in, write_jpeg_block, write ) )
@@ -634,7 +680,8 @@ vips__jpeg_write_file( VipsImage *in,
 	const char *filename, int Q, const char *profile, 
 	gboolean optimize_coding, gboolean progressive, gboolean strip, 
 	gboolean no_subsample, gboolean trellis_quant,
-	gboolean overshoot_deringing, gboolean optimize_scans, int quant_table )
+	gboolean overshoot_deringing, gboolean optimize_scans, int quant_table,
+	int restart_interval )
 {
 	Write *write;
 
@@ -667,7 +714,7 @@ vips__jpeg_write_file( VipsImage *in,
 	if( write_vips( write, 
 		Q, profile, optimize_coding, progressive, strip, no_subsample,
 		trellis_quant, overshoot_deringing, optimize_scans, 
-		quant_table ) ) {
+		quant_table, restart_interval ) ) {
 		write_destroy( write );
 		return( -1 );
 	}
@@ -688,9 +735,14 @@ typedef struct {
 	/* Private stuff during write.
 	 */
 
-	/* Build the output area here.
+	/* Build the output area here. It's a list of chunks, so data never
+	 * moves as it grows.
 	 */
-	VipsDbuf dbuf;
+	VipsCbuf cbuf;
+
+	/* The size of the area we handed to libjpeg.
+	 */
+	size_t available;
 
 	/* Write the generated area here.
 	 */
@@ -706,12 +758,13 @@ empty_output_buffer( j_compress_ptr cinfo )
 {
 	OutputBuffer *buf = (OutputBuffer *) cinfo->dest;
 
-	size_t size;
+	vips_cbuf_advance( &buf->cbuf,
+		buf->available - buf->pub.free_in_buffer );
 
-	vips_dbuf_allocate( &buf->dbuf, 10000 ); 
-	buf->pub.next_output_byte = 
-		(JOCTET *) vips_dbuf_get_write( &buf->dbuf, &size );
-	buf->pub.free_in_buffer = size;
+	if( !(buf->pub.next_output_byte = (JOCTET *)
+		vips_cbuf_get_write( &buf->cbuf, 10000, &buf->available )) )
+		ERREXIT( cinfo, JERR_OUT_OF_MEMORY );
+	buf->pub.free_in_buffer = buf->available;
 
 	/* TRUE means we've made some more space.
 	 */
@@ -725,7 +778,9 @@ init_destination( j_compress_ptr cinfo )
 {
 	OutputBuffer *buf = (OutputBuffer *) cinfo->dest;
 
-	vips_dbuf_init( &buf->dbuf ); 
+	vips_cbuf_destroy( &buf->cbuf );
+	buf->available = 0;
+	buf->pub.free_in_buffer = 0;
 	empty_output_buffer( cinfo ); 
 }
 
@@ -737,7 +792,7 @@ buf_destroy( j_compress_ptr cinfo )
 	if( cinfo->dest ) {
 		OutputBuffer *buf = (OutputBuffer *) cinfo->dest;
 
-		vips_dbuf_destroy( &buf->dbuf );
+		vips_cbuf_destroy( &buf->cbuf );
 	}
 }
 
@@ -753,13 +808,14 @@ term_destination( j_compress_ptr cinfo )
 	size_t size;
 
 	/* We probably won't have filled the area that was last allocated in 
-	 * empty_output_buffer(). Chop the data size down to the length that
-	 * was actually written.
+	 * empty_output_buffer(). Only add the part that was actually written.
 	 */
-	vips_dbuf_seek( &buf->dbuf, -buf->pub.free_in_buffer, SEEK_END );
-	vips_dbuf_truncate( &buf->dbuf ); 
+	vips_cbuf_advance( &buf->cbuf,
+		buf->available - buf->pub.free_in_buffer );
+	buf->available = 0;
 
-	*(buf->obuf) = vips_dbuf_steal( &buf->dbuf, &size );
+	if( !(*(buf->obuf) = vips_cbuf_steal( &buf->cbuf, &size )) )
+		ERREXIT( cinfo, JERR_OUT_OF_MEMORY );
 	*(buf->olen) = size; 
 }
 
@@ -783,6 +839,11 @@ buf_dest( j_compress_ptr cinfo, void **obuf, size_t *olen )
 			(*cinfo->mem->alloc_small) 
 				( (j_common_ptr) cinfo, JPOOL_PERMANENT,
 				  sizeof( OutputBuffer ) );
+
+		/* So buf_destroy() is always safe.
+		 */
+		vips_cbuf_init( &((OutputBuffer *) cinfo->dest)->cbuf );
+		((OutputBuffer *) cinfo->dest)->available = 0;
 	}
 
 	buf = (OutputBuffer *) cinfo->dest;
@@ -796,12 +857,526 @@ buf_dest( j_compress_ptr cinfo, void **obuf, size_t *olen )
 	buf->olen = olen;
 }
 
+/* Parallel encode.
+ *
+ * With a restart interval and fixed Huffman tables, each run of restart
+ * intervals can be entropy-coded on its own: restart markers reset the DC
+ * predictors and byte-align the data. We cut the image into stripes of
+ * whole intervals, compress each stripe as a separate small JPEG on a
+ * worker, and splice the scan data together in order, renumbering the RST
+ * markers as we go.
+ *
+ * The main compressor writes the file header and any metadata, then we
+ * take the tables from the first stripe, patch in the full image height,
+ * and write everything else through the destination manager ourselves.
+ */
+
+/* Aim for about this many pixels per stripe.
+ */
+#define JPEG_STRIPE_PIXELS (1024 * 1024)
+
+typedef struct _WriteStripe {
+	/* The main compressor, to copy parameters from.
+	 */
+	j_compress_ptr template;
+
+	/* Rows to compress.
+	 */
+	VipsPel *data;
+	int width;
+	int height;
+	size_t sizeof_line;
+
+	/* Set by the worker.
+	 */
+	VipsPel *out;
+	size_t out_length;
+	gboolean error;
+	VipsSemaphore done;
+
+	/* Found by write_stripe_parse().
+	 */
+	size_t header_start;
+	size_t data_start;
+} WriteStripe;
+
+static void
+write_stripe_wait( WriteStripe *stripe )
+{
+	vips_semaphore_down( &stripe->done );
+}
+
+static void
+write_stripe_free( WriteStripe *stripe )
+{
+	VIPS_FREE( stripe->data );
+	VIPS_FREE( stripe->out );
+	vips_semaphore_destroy( &stripe->done );
+	g_free( stripe );
+}
+
+/* Set up a stripe compressor to make exactly the same scan data as @from
+ * would. We copy the quant tables rather than recompute them, so any
+ * warnings about parameters only appear once.
+ */
+static void
+write_stripe_params( j_compress_ptr cinfo, j_compress_ptr from,
+	int width, int height )
+{
+	int i;
+
+	cinfo->image_width = width;
+	cinfo->image_height = height;
+	cinfo->input_components = from->input_components;
+	cinfo->in_color_space = from->in_color_space;
+
+#ifdef HAVE_JPEG_EXT_PARAMS
+	if( jpeg_c_int_param_supported( cinfo, JINT_COMPRESS_PROFILE ) )
+		jpeg_c_set_int_param( cinfo,
+			JINT_COMPRESS_PROFILE, JCP_FASTEST );
+#endif /*HAVE_JPEG_EXT_PARAMS*/
+
+	jpeg_set_defaults( cinfo );
+	jpeg_set_colorspace( cinfo, from->jpeg_color_space );
+
+	for( i = 0; i < from->num_components; i++ ) {
+		cinfo->comp_info[i].h_samp_factor =
+			from->comp_info[i].h_samp_factor;
+		cinfo->comp_info[i].v_samp_factor =
+			from->comp_info[i].v_samp_factor;
+		cinfo->comp_info[i].quant_tbl_no =
+			from->comp_info[i].quant_tbl_no;
+	}
+
+	for( i = 0; i < NUM_QUANT_TBLS; i++ )
+		if( from->quant_tbl_ptrs[i] ) {
+			if( !cinfo->quant_tbl_ptrs[i] )
+				cinfo->quant_tbl_ptrs[i] =
+					jpeg_alloc_quant_table(
+						(j_common_ptr) cinfo );
+			memcpy( cinfo->quant_tbl_ptrs[i]->quantval,
+				from->quant_tbl_ptrs[i]->quantval,
+				sizeof( from->quant_tbl_ptrs[i]->quantval ) );
+		}
+
+#ifdef HAVE_JPEG_EXT_PARAMS
+	if( jpeg_c_bool_param_supported( from,
+		JBOOLEAN_OVERSHOOT_DERINGING ) )
+		jpeg_c_set_bool_param( cinfo, JBOOLEAN_OVERSHOOT_DERINGING,
+			jpeg_c_get_bool_param( from,
+				JBOOLEAN_OVERSHOOT_DERINGING ) );
+#endif /*HAVE_JPEG_EXT_PARAMS*/
+
+	cinfo->dct_method = from->dct_method;
+	cinfo->restart_in_rows = from->restart_in_rows;
+
+	/* We only want the tables and the scan data.
+	 */
+	cinfo->write_JFIF_header = FALSE;
+	cinfo->write_Adobe_marker = FALSE;
+}
+
+static void *
+write_stripe_compress( void *a )
+{
+	WriteStripe *stripe = (WriteStripe *) a;
+
+	struct jpeg_compress_struct cinfo;
+	ErrorManager eman;
+	JSAMPROW row_pointer[1];
+
+	memset( &cinfo, 0, sizeof( cinfo ) );
+	cinfo.err = jpeg_std_error( &eman.pub );
+	eman.pub.error_exit = vips__new_error_exit;
+	eman.pub.output_message = vips__new_output_message;
+	eman.fp = NULL;
+
+	if( setjmp( eman.jmp ) ) {
+		buf_destroy( &cinfo );
+		jpeg_destroy_compress( &cinfo );
+		stripe->error = TRUE;
+		vips_semaphore_up( &stripe->done );
+
+		return( NULL );
+	}
+
+	jpeg_create_compress( &cinfo );
+	buf_dest( &cinfo, (void **) &stripe->out, &stripe->out_length );
+	write_stripe_params( &cinfo, stripe->template,
+		stripe->width, stripe->height );
+
+	jpeg_start_compress( &cinfo, TRUE );
+	while( cinfo.next_scanline < cinfo.image_height ) {
+		row_pointer[0] = (JSAMPROW) (stripe->data +
+			cinfo.next_scanline * stripe->sizeof_line);
+		jpeg_write_scanlines( &cinfo, row_pointer, 1 );
+	}
+	jpeg_finish_compress( &cinfo );
+
+	buf_destroy( &cinfo );
+	jpeg_destroy_compress( &cinfo );
+
+	/* We don't need the pixels any more.
+	 */
+	VIPS_FREE( stripe->data );
+
+	vips_semaphore_up( &stripe->done );
+
+	return( NULL );
+}
+
+/* Walk the markers in a stripe. The header is from the first table to the end
+ * of SOS, the scan data runs from there to just before EOI. Patch the frame
+ * height as we go.
+ */
+static int
+write_stripe_parse( WriteStripe *stripe, int height )
+{
+	VipsPel *p = stripe->out;
+	size_t length = stripe->out_length;
+
+	size_t i;
+
+	if( length < 4 ||
+		p[0] != 0xff ||
+		p[1] != 0xd8 ||
+		p[length - 2] != 0xff ||
+		p[length - 1] != 0xd9 )
+		goto bad;
+
+	stripe->header_start = 0;
+	for( i = 2; ; ) {
+		int marker;
+		size_t size;
+
+		if( i + 4 > length ||
+			p[i] != 0xff )
+			goto bad;
+		marker = p[i + 1];
+		size = 2 + ((p[i + 2] << 8) | p[i + 3]);
+		if( i + size > length )
+			goto bad;
+
+		/* Skip any APP or COM markers before the tables.
+		 */
+		if( !stripe->header_start &&
+			(marker < 0xe0 || marker > 0xef) &&
+			marker != 0xfe )
+			stripe->header_start = i;
+
+		/* SOF0 or SOF1.
+		 */
+		if( marker == 0xc0 ||
+			marker == 0xc1 ) {
+			if( size < 7 )
+				goto bad;
+			p[i + 5] = (height >> 8) & 0xff;
+			p[i + 6] = height & 0xff;
+		}
+
+		i += size;
+
+		if( marker == 0xda )
+			break;
+	}
+	stripe->data_start = i;
+
+	return( 0 );
+
+bad:
+	vips_error( "vips2jpeg", "%s", _( "bad stripe" ) );
+	return( -1 );
+}
+
+/* Send bytes to the destination manager, just as libjpeg does.
+ */
+static void
+write_bytes( j_compress_ptr cinfo, const VipsPel *data, size_t length )
+{
+	struct jpeg_destination_mgr *dest = cinfo->dest;
+
+	while( length > 0 ) {
+		size_t n;
+
+		if( dest->free_in_buffer == 0 &&
+			!(*dest->empty_output_buffer)( cinfo ) )
+			ERREXIT( cinfo, JERR_CANT_SUSPEND );
+
+		n = VIPS_MIN( length, dest->free_in_buffer );
+		memcpy( dest->next_output_byte, data, n );
+		dest->next_output_byte += n;
+		dest->free_in_buffer -= n;
+		data += n;
+		length -= n;
+	}
+}
+
+static void
+write_restart( Write *write )
+{
+	VipsPel marker[2];
+
+	marker[0] = 0xff;
+	marker[1] = 0xd0 + (write->n_restart & 7);
+	write_bytes( &write->cinfo, marker, 2 );
+	write->n_restart += 1;
+}
+
+/* Write the oldest stripe, waiting for it to be compressed if necessary.
+ */
+static int
+write_stripe_emit( Write *write )
+{
+	WriteStripe *stripe = 
+		(WriteStripe *) g_queue_pop_head( &write->stripes );
+
+	VipsPel *header;
+	size_t header_length;
+	VipsPel *p;
+	size_t length;
+	size_t i;
+
+	write_stripe_wait( stripe );
+	if( stripe->error ||
+		write_stripe_parse( stripe, write->cinfo.image_height ) ) {
+		write_stripe_free( stripe );
+		return( -1 );
+	}
+
+	header = stripe->out + stripe->header_start;
+	header_length = stripe->data_start - stripe->header_start;
+
+	/* Catch any longjmp()s from the destination manager.
+	 */
+	if( setjmp( write->eman.jmp ) ) {
+		write_stripe_free( stripe );
+		return( -1 );
+	}
+
+	if( !write->header ) {
+		/* The first stripe: write the tables and the scan header.
+		 */
+		if( !(write->header = vips_malloc( NULL, header_length )) ) {
+			write_stripe_free( stripe );
+			return( -1 );
+		}
+		memcpy( write->header, header, header_length );
+		write->header_length = header_length;
+
+		write_bytes( &write->cinfo, header, header_length );
+	}
+	else {
+		/* Every stripe must be coded with the same tables.
+		 */
+		if( header_length != write->header_length ||
+			memcmp( header, write->header, header_length ) ) {
+			vips_error( "vips2jpeg",
+				"%s", _( "stripe tables differ" ) );
+			write_stripe_free( stripe );
+			return( -1 );
+		}
+
+		write_restart( write );
+	}
+
+	/* The scan data, with the stripe's own RST markers renumbered to
+	 * follow on from ours. Stuffed 0xff bytes are followed by 0, so any
+	 * 0xff 0xdN is a marker.
+	 */
+	p = stripe->out + stripe->data_start;
+	length = stripe->out_length - 2 - stripe->data_start;
+	for( i = 0; i + 1 < length; i++ )
+		if( p[i] == 0xff &&
+			p[i + 1] >= 0xd0 &&
+			p[i + 1] <= 0xd7 ) {
+			p[i + 1] = 0xd0 + (write->n_restart & 7);
+			write->n_restart += 1;
+			i += 1;
+		}
+	write_bytes( &write->cinfo, p, length );
+
+	write_stripe_free( stripe );
+
+	return( 0 );
+}
+
+static int
+write_stripe_submit( Write *write )
+{
+	WriteStripe *stripe = write->stripe;
+
+	write->stripe = NULL;
+
+	g_queue_push_tail( &write->stripes, stripe );
+	if( vips__worker_spawn( write_stripe_compress, stripe ) ) {
+		/* No worker, compress right here.
+		 */
+		vips_error_clear();
+		write_stripe_compress( stripe );
+	}
+
+	/* Limit the number of stripes in flight.
+	 */
+	while( g_queue_get_length( &write->stripes ) >
+		2 * vips_concurrency_get() )
+		if( write_stripe_emit( write ) )
+			return( -1 );
+
+	return( 0 );
+}
+
+static int
+write_stripe_new( Write *write, VipsImage *in )
+{
+	WriteStripe *stripe;
+
+	stripe = g_new0( WriteStripe, 1 );
+	vips_semaphore_init( &stripe->done, 0, "done" );
+	stripe->template = &write->cinfo;
+	stripe->width = in->Xsize;
+	stripe->height = VIPS_MIN( write->stripe_height,
+		in->Ysize - write->y );
+	stripe->sizeof_line = VIPS_IMAGE_SIZEOF_LINE( in );
+	if( !(stripe->data = vips_malloc( NULL,
+		stripe->height * stripe->sizeof_line )) ) {
+		write_stripe_free( stripe );
+		return( -1 );
+	}
+	write->stripe = stripe;
+
+	return( 0 );
+}
+
+static int
+write_jpeg_block_parallel( VipsRegion *region, VipsRect *area, void *a )
+{
+	Write *write = (Write *) a;
+	VipsImage *in = region->im;
+
+	int i;
+
+	g_assert( area->left == 0 );
+	g_assert( area->width == in->Xsize );
+
+	for( i = 0; i < area->height; i++ ) {
+		WriteStripe *stripe;
+		int y;
+
+		if( !write->stripe &&
+			write_stripe_new( write, in ) )
+			return( -1 );
+		stripe = write->stripe;
+
+		y = write->y % write->stripe_height;
+		memcpy( stripe->data + y * stripe->sizeof_line,
+			VIPS_REGION_ADDR( region, 0, area->top + i ),
+			stripe->sizeof_line );
+		write->y += 1;
+
+		if( y == stripe->height - 1 &&
+			write_stripe_submit( write ) )
+			return( -1 );
+	}
+
+	return( 0 );
+}
+
+/* Can we encode stripes in parallel? We need a restart interval, fixed
+ * Huffman tables, a single scan, and enough image to be worth it.
+ */
+static gboolean
+write_parallel_init( Write *write, VipsImage *in, int restart_interval )
+{
+	j_compress_ptr cinfo = &write->cinfo;
+
+	int max_h;
+	int max_v;
+	int mcus_per_row;
+	int interval_height;
+	int n_intervals;
+	int i;
+
+	if( restart_interval <= 0 ||
+		cinfo->optimize_coding ||
+		cinfo->scan_info ||
+		vips_concurrency_get() < 2 )
+		return( FALSE );
+
+#ifdef HAVE_JPEG_EXT_PARAMS
+	if( jpeg_c_bool_param_supported( cinfo, JBOOLEAN_TRELLIS_QUANT ) &&
+		jpeg_c_get_bool_param( cinfo, JBOOLEAN_TRELLIS_QUANT ) )
+		return( FALSE );
+#endif /*HAVE_JPEG_EXT_PARAMS*/
+
+	/* The MCU size.
+	 */
+	max_h = 1;
+	max_v = 1;
+	for( i = 0; i < cinfo->num_components; i++ ) {
+		max_h = VIPS_MAX( max_h, cinfo->comp_info[i].h_samp_factor );
+		max_v = VIPS_MAX( max_v, cinfo->comp_info[i].v_samp_factor );
+	}
+	if( cinfo->num_components == 1 )
+		max_h = max_v = 1;
+	mcus_per_row = VIPS_ROUND_UP( in->Xsize, 8 * max_h ) / (8 * max_h);
+
+	/* libjpeg would clip a longer interval, and then intervals no longer
+	 * start on a row.
+	 */
+	if( (gint64) restart_interval * mcus_per_row > 65535 )
+		return( FALSE );
+
+	/* Whole intervals per stripe.
+	 */
+	interval_height = restart_interval * 8 * max_v;
+	n_intervals = VIPS_MAX( 1,
+		JPEG_STRIPE_PIXELS / ((gint64) in->Xsize * interval_height) );
+	write->stripe_height = n_intervals * interval_height;
+	if( write->stripe_height >= in->Ysize )
+		return( FALSE );
+
+	write->y = 0;
+	write->n_restart = 0;
+
+	return( TRUE );
+}
+
+/* jpeg_start_compress() has written the file header and we've added any
+ * metadata. Write the rest of the file.
+ */
+static int
+write_parallel( Write *write, VipsImage *in )
+{
+	static const VipsPel eoi[2] = { 0xff, 0xd9 };
+
+	if( vips_sink_disc( in, write_jpeg_block_parallel, write ) )
+		return( -1 );
+
+	while( !g_queue_is_empty( &write->stripes ) )
+		if( write_stripe_emit( write ) )
+			return( -1 );
+
+	if( setjmp( write->eman.jmp ) )
+		return( -1 );
+
+	write_bytes( &write->cinfo, eoi, 2 );
+	(*write->cinfo.dest->term_destination)( &write->cinfo );
+
+	/* We've done the job of jpeg_finish_compress(), just reset the
+	 * compressor.
+	 */
+	jpeg_abort_compress( &write->cinfo );
+
+	return( 0 );
+}
+
 int
 vips__jpeg_write_buffer( VipsImage *in, 
 	void **obuf, size_t *olen, int Q, const char *profile, 
 	gboolean optimize_coding, gboolean progressive,
 	gboolean strip, gboolean no_subsample, gboolean trellis_quant,
-	gboolean overshoot_deringing, gboolean optimize_scans, int quant_table )
+	gboolean overshoot_deringing, gboolean optimize_scans, int quant_table,
+	int restart_interval )
 {
 	Write *write;
 
@@ -833,7 +1408,7 @@ vips__jpeg_write_buffer( VipsImage *in,
 	if( write_vips( write, 
 		Q, profile, optimize_coding, progressive, strip, no_subsample,
 		trellis_quant, overshoot_deringing, optimize_scans, 
-		quant_table ) ) {
+		quant_table, restart_interval ) ) {
 		buf_destroy( &write->cinfo );
 		write_destroy( write );
 
@@ -845,6 +1420,239 @@ vips__jpeg_write_buffer( VipsImage *in,
 	return( 0 );
 }
 
+/* And again, but write to a VipsTarget.
+ */
+
+#define TARGET_BUFFER_SIZE (4096)
+
+typedef struct {
+	/* Public jpeg fields.
+	 */
+	struct jpeg_destination_mgr pub;
+
+	/* Private stuff during write.
+	 */
+	VipsTarget *target;
+	JOCTET buf[TARGET_BUFFER_SIZE];
+} OutputTarget;
+
+METHODDEF(void)
+init_destination_target( j_compress_ptr cinfo )
+{
+	OutputTarget *dest = (OutputTarget *) cinfo->dest;
+
+	dest->pub.next_output_byte = dest->buf;
+	dest->pub.free_in_buffer = TARGET_BUFFER_SIZE;
+}
+
+/* The buffer is full, write it all out.
+ */
+METHODDEF(boolean)
+empty_output_target( j_compress_ptr cinfo )
+{
+	OutputTarget *dest = (OutputTarget *) cinfo->dest;
+
+	if( vips_target_write( dest->target,
+		dest->buf, TARGET_BUFFER_SIZE ) )
+		ERREXIT( cinfo, JERR_FILE_WRITE );
+
+	dest->pub.next_output_byte = dest->buf;
+	dest->pub.free_in_buffer = TARGET_BUFFER_SIZE;
+
+	return( TRUE );
+}
+
+/* Write any remaining bytes.
+ */
+METHODDEF(void)
+term_destination_target( j_compress_ptr cinfo )
+{
+	OutputTarget *dest = (OutputTarget *) cinfo->dest;
+
+	if( vips_target_write( dest->target, dest->buf,
+		TARGET_BUFFER_SIZE - dest->pub.free_in_buffer ) )
+		ERREXIT( cinfo, JERR_FILE_WRITE );
+}
+
+static void
+target_dest( j_compress_ptr cinfo, VipsTarget *target )
+{
+	OutputTarget *dest;
+
+	if( !cinfo->dest )
+		cinfo->dest = (struct jpeg_destination_mgr *)
+			(*cinfo->mem->alloc_small)
+				( (j_common_ptr) cinfo, JPOOL_PERMANENT,
+				  sizeof( OutputTarget ) );
+
+	dest = (OutputTarget *) cinfo->dest;
+	dest->pub.init_destination = init_destination_target;
+	dest->pub.empty_output_buffer = empty_output_target;
+	dest->pub.term_destination = term_destination_target;
+	dest->target = target;
+}
+
+int
+vips__jpeg_write_target( VipsImage *in, VipsTarget *target,
+	int Q, const char *profile,
+	gboolean optimize_coding, gboolean progressive,
+	gboolean strip, gboolean no_subsample, gboolean trellis_quant,
+	gboolean overshoot_deringing, gboolean optimize_scans, int quant_table,
+	int restart_interval )
+{
+	Write *write;
+
+	if( !(write = write_new( in )) )
+		return( -1 );
+
+	if( setjmp( write->eman.jmp ) ) {
+		/* Here for longjmp() from new_error_exit().
+		 */
+		write_destroy( write );
+
+		return( -1 );
+	}
+        jpeg_create_compress( &write->cinfo );
+
+	target_dest( &write->cinfo, target );
+
+	if( write_vips( write,
+		Q, profile, optimize_coding, progressive, strip, no_subsample,
+		trellis_quant, overshoot_deringing, optimize_scans,
+		quant_table, restart_interval ) ) {
+		write_destroy( write );
+		return( -1 );
+	}
+	write_destroy( write );
+
+	return( 0 );
+}
+
+/* A compressor we can reuse for many small images, see dzsave. The libjpeg
+ * object is made once, and each image is encoded straight from a set of row
+ * pointers, with no VipsImage, pipeline or metadata. Output is always
+ * stripped.
+ */
+struct _VipsJpegEncoder {
+	struct jpeg_compress_struct cinfo;
+	ErrorManager eman;
+
+	int Q;
+	gboolean optimize_coding;
+	gboolean progressive;
+	gboolean no_subsample;
+};
+
+void
+vips__jpeg_encoder_free( VipsJpegEncoder *encoder )
+{
+	buf_destroy( &encoder->cinfo );
+	jpeg_destroy_compress( &encoder->cinfo );
+
+	g_free( encoder );
+}
+
+VipsJpegEncoder *
+vips__jpeg_encoder_new( int Q,
+	gboolean optimize_coding, gboolean progressive, gboolean no_subsample )
+{
+	VipsJpegEncoder *encoder;
+
+	if( !(encoder = g_new0( VipsJpegEncoder, 1 )) )
+		return( NULL );
+
+	encoder->Q = Q;
+	encoder->optimize_coding = optimize_coding;
+	encoder->progressive = progressive;
+	encoder->no_subsample = no_subsample;
+	encoder->cinfo.err = jpeg_std_error( &encoder->eman.pub );
+	encoder->eman.pub.error_exit = vips__new_error_exit;
+	encoder->eman.pub.output_message = vips__new_output_message;
+	encoder->eman.fp = NULL;
+
+	if( setjmp( encoder->eman.jmp ) ) {
+		vips__jpeg_encoder_free( encoder );
+		return( NULL );
+	}
+	jpeg_create_compress( &encoder->cinfo );
+
+	/* Attach our destination now, so buf_destroy() is always safe.
+	 */
+	buf_dest( &encoder->cinfo, NULL, NULL );
+
+	return( encoder );
+}
+
+/* Compress @height rows of @width uchar pixels, each with 1 or 3 @bands.
+ * Safe to call from many threads, as long as each has its own encoder.
+ */
+int
+vips__jpeg_encoder_write( VipsJpegEncoder *encoder,
+	VipsPel **rows, int width, int height, int bands,
+	void **obuf, size_t *olen )
+{
+	struct jpeg_compress_struct *cinfo = &encoder->cinfo;
+
+	JDIMENSION n;
+
+	g_assert( bands == 1 || bands == 3 );
+
+	*obuf = NULL;
+	*olen = 0;
+
+	if( setjmp( encoder->eman.jmp ) ) {
+		/* Abort leaves the object ready for the next image.
+		 */
+		jpeg_abort_compress( cinfo );
+		buf_destroy( cinfo );
+
+		return( -1 );
+	}
+
+	buf_dest( cinfo, obuf, olen );
+
+	cinfo->image_width = width;
+	cinfo->image_height = height;
+	cinfo->input_components = bands;
+	cinfo->in_color_space = bands == 3 ? JCS_RGB : JCS_GRAYSCALE;
+
+#ifdef HAVE_JPEG_EXT_PARAMS
+	if( jpeg_c_int_param_supported( cinfo, JINT_COMPRESS_PROFILE ) )
+		jpeg_c_set_int_param( cinfo,
+			JINT_COMPRESS_PROFILE, JCP_FASTEST );
+#endif
+
+	/* Exactly the settings write_vips() would use.
+	 */
+	jpeg_set_defaults( cinfo );
+	cinfo->optimize_coding = encoder->optimize_coding;
+	jpeg_set_quality( cinfo, encoder->Q, TRUE );
+	if( encoder->progressive )
+		jpeg_simple_progression( cinfo );
+	if( encoder->no_subsample ||
+		encoder->Q > 90 ) {
+		int i;
+
+		for( i = 0; i < bands; i++ ) {
+			cinfo->comp_info[i].h_samp_factor = 1;
+			cinfo->comp_info[i].v_samp_factor = 1;
+		}
+	}
+	cinfo->write_JFIF_header = FALSE;
+
+	jpeg_start_compress( cinfo, TRUE );
+
+	for( n = 0; n < (JDIMENSION) height; )
+		n += jpeg_write_scanlines( cinfo,
+			(JSAMPARRAY) rows + n, height - n );
+
+	/* term_destination() hands the finished buffer to @obuf.
+	 */
+	jpeg_finish_compress( cinfo );
+
+	return( 0 );
+}
+
 const char *vips__jpeg_suffs[] = { ".jpg", ".jpeg", ".jpe", NULL };
 
 #endif /*HAVE_JPEG*/
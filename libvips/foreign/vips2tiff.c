@@ -176,6 +176,12 @@
  * 24/10/17
  * 	- no error on page-height not a factor of image height, just don't
  * 	  write multipage
+ * 14/10/18
+ * 	- compress tiles on worker threads and write with TIFFWriteRawTile()
+ * 	- shrink pyramid strips in parallel slices
+ * 	- copy pyramid layers as raw tiles, with the JPEG tables
+ * 	- reuse the compressed bytes of single-colour tiles
+ * 	- add @region_shrink
  */
 
 /*
@@ -271,6 +277,20 @@ struct _Layer {
 	VipsRegion *strip;		/* The current strip of pixels */
 	VipsRegion *copy;		/* Pixels we copy to the next strip */
 
+	/* Set once we've copied the JPEG tables from a parallel-compressed
+	 * tile into this directory.
+	 */
+	gboolean jpegtables;
+
+	/* The compressed bytes of the last single-colour tile we wrote, and
+	 * its pixel. Later tiles of just that colour reuse these bytes
+	 * rather than being compressed again. Background often fills much
+	 * of a slide.
+	 */
+	VipsPel *blank;
+	tsize_t blank_length;
+	VipsPel *blank_pel;
+
 	Layer *below;			/* The smaller layer below us */
 	Layer *above;			/* The larger layer above */
 };
@@ -309,6 +329,7 @@ struct _Wtiff {
 	int rgbjpeg;			/* True for RGB not YCbCr */
 	int properties;			/* Set to save XML props */
 	int strip;			/* Don't write metadata */
+	VipsRegionShrink region_shrink;	/* How to shrink pyramid layers */
 
 	/* True if we've detected a toilet-roll image, plus the page height,
 	 * which has been checked to be a factor of im->Ysize.
@@ -320,6 +341,17 @@ struct _Wtiff {
 	 * roll mode.
 	 */
 	int image_height;
+
+	/* Compress tiles on worker threads. @tiles holds the WtiffTile we
+	 * have submitted, in write order. @photometric etc. are read back
+	 * from the top layer header to set up each tile compressor.
+	 */
+	gboolean parallel;
+	GQueue tiles;
+	uint16 samples_per_pixel;
+	uint16 bits_per_sample;
+	uint16 sample_format;
+	uint16 photometric;
 };
 
 /* Embed an ICC profile from a file.
@@ -388,6 +420,10 @@ wtiff_layer_new( Wtiff *wtiff, Layer *above, int width, int height )
 	layer->y = 0;
 	layer->strip = NULL;
 	layer->copy = NULL;
+	layer->jpegtables = FALSE;
+	layer->blank = NULL;
+	layer->blank_length = 0;
+	layer->blank_pel = NULL;
 
 	layer->below = NULL;
 	layer->above = above;
@@ -732,6 +768,13 @@ wtiff_layer_rewind( Wtiff *wtiff, Layer *layer )
 	layer->y = 0;
 	layer->write_y = 0;
 
+	/* A new directory needs its own JPEG tables, so tiles must go
+	 * through the compressor again.
+	 */
+	layer->jpegtables = FALSE;
+	VIPS_FREE( layer->blank );
+	VIPS_FREE( layer->blank_pel );
+
 	return( 0 );
 }
 
@@ -811,6 +854,8 @@ layer_free( Layer *layer )
 	VIPS_UNREF( layer->copy );
 	VIPS_UNREF( layer->image );
 	VIPS_FREEF( TIFFClose, layer->tif );
+	VIPS_FREE( layer->blank );
+	VIPS_FREE( layer->blank_pel );
 }
 
 /* Free an entire pyramid.
@@ -824,9 +869,263 @@ layer_free_all( Layer *layer )
 	layer_free( layer );
 }
 
+/* A tile being compressed on a worker.
+ */
+typedef struct _WtiffTile {
+	Wtiff *wtiff;
+	Layer *layer;
+
+	/* Tile number in layer->tif, and the packed pixels.
+	 */
+	ttile_t number;
+	VipsPel *buf;
+	tsize_t length;
+
+	/* The worker writes a one-tile TIFF here. The compressed tile is
+	 * @size bytes at @offset.
+	 */
+	VipsDbuf dbuf;
+	toff_t offset;
+	toff_t size;
+
+	/* JPEG tables and reference levels, if the codec made any.
+	 */
+	void *jpegtables;
+	uint32 jpegtables_length;
+	float refbw[6];
+	gboolean has_refbw;
+
+	/* Set if every pixel in @buf is the same.
+	 */
+	gboolean uniform;
+
+	gboolean error;
+	VipsSemaphore done;
+} WtiffTile;
+
+static void
+wtiff_tile_free( WtiffTile *tile )
+{
+	vips_dbuf_destroy( &tile->dbuf );
+	VIPS_FREE( tile->buf );
+	VIPS_FREE( tile->jpegtables );
+	vips_semaphore_destroy( &tile->done );
+	g_free( tile );
+}
+
+/* Set the fields the codec needs on a one-tile TIFF.
+ */
+static void
+wtiff_tile_header( Wtiff *wtiff, TIFF *tif )
+{
+	TIFFSetField( tif, TIFFTAG_IMAGEWIDTH, wtiff->tilew );
+	TIFFSetField( tif, TIFFTAG_IMAGELENGTH, wtiff->tileh );
+	TIFFSetField( tif, TIFFTAG_TILEWIDTH, wtiff->tilew );
+	TIFFSetField( tif, TIFFTAG_TILELENGTH, wtiff->tileh );
+	TIFFSetField( tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG );
+	TIFFSetField( tif, TIFFTAG_SAMPLESPERPIXEL, wtiff->samples_per_pixel );
+	TIFFSetField( tif, TIFFTAG_BITSPERSAMPLE, wtiff->bits_per_sample );
+	TIFFSetField( tif, TIFFTAG_SAMPLEFORMAT, wtiff->sample_format );
+	TIFFSetField( tif, TIFFTAG_PHOTOMETRIC, wtiff->photometric );
+	TIFFSetField( tif, TIFFTAG_COMPRESSION, wtiff->compression );
+
+	if( wtiff->compression == COMPRESSION_JPEG ) {
+		TIFFSetField( tif, TIFFTAG_JPEGQUALITY, wtiff->jpqual );
+		if( wtiff->photometric == PHOTOMETRIC_YCBCR )
+			TIFFSetField( tif,
+				TIFFTAG_JPEGCOLORMODE, JPEGCOLORMODE_RGB );
+	}
+
+	if( wtiff->predictor != VIPS_FOREIGN_TIFF_PREDICTOR_NONE )
+		TIFFSetField( tif, TIFFTAG_PREDICTOR, wtiff->predictor );
+}
+
+/* Run on a worker: compress a tile by writing it to a one-tile TIFF in
+ * memory, then note where libtiff put the compressed bytes.
+ */
+static void *
+wtiff_tile_compress( void *a )
+{
+	WtiffTile *tile = (WtiffTile *) a;
+	Wtiff *wtiff = tile->wtiff;
+
+	TIFF *tif;
+	toff_t *offsets;
+	toff_t *byte_counts;
+
+	tile->error = TRUE;
+
+	if( (tif = vips__tiff_openout_dbuf( &tile->dbuf )) ) {
+		wtiff_tile_header( wtiff, tif );
+
+		if( TIFFWriteEncodedTile( tif, 0,
+				tile->buf, tile->length ) >= 0 &&
+			TIFFGetField( tif, TIFFTAG_TILEOFFSETS, &offsets ) &&
+			TIFFGetField( tif,
+				TIFFTAG_TILEBYTECOUNTS, &byte_counts ) ) {
+			tile->offset = offsets[0];
+			tile->size = byte_counts[0];
+			tile->error = FALSE;
+		}
+
+		/* JPEG tiles are abbreviated streams, the tables go in the
+		 * directory. They depend only on the settings, so any tile's
+		 * tables will do for the whole layer.
+		 */
+		if( !tile->error &&
+			wtiff->compression == COMPRESSION_JPEG ) {
+			uint32 length;
+			void *data;
+			float *refbw;
+
+			if( TIFFGetField( tif,
+				TIFFTAG_JPEGTABLES, &length, &data ) &&
+				(tile->jpegtables = vips_malloc( NULL,
+					length )) ) {
+				memcpy( tile->jpegtables, data, length );
+				tile->jpegtables_length = length;
+			}
+
+			if( TIFFGetField( tif,
+				TIFFTAG_REFERENCEBLACKWHITE, &refbw ) ) {
+				memcpy( tile->refbw, refbw,
+					6 * sizeof( float ) );
+				tile->has_refbw = TRUE;
+			}
+		}
+
+		TIFFClose( tif );
+	}
+
+	vips_semaphore_up( &tile->done );
+
+	return( NULL );
+}
+
+/* Bytes per pixel in a packed tile. Tiles which repeat the same group of
+ * this many bytes are a single colour.
+ */
+static int
+wtiff_tile_pel_size( Wtiff *wtiff )
+{
+	return( VIPS_MAX( 1,
+		wtiff->samples_per_pixel * wtiff->bits_per_sample / 8 ) );
+}
+
+static gboolean
+wtiff_tile_uniform( Wtiff *wtiff, WtiffTile *tile )
+{
+	const int pel_size = wtiff_tile_pel_size( wtiff );
+	VipsPel * restrict p = tile->buf;
+
+	tsize_t i;
+
+	for( i = pel_size; i < tile->length; i++ )
+		if( p[i] != p[i - pel_size] )
+			return( FALSE );
+
+	return( TRUE );
+}
+
+static void
+wtiff_tile_remember( Wtiff *wtiff, Layer *layer,
+	WtiffTile *tile, VipsPel *data )
+{
+	const int pel_size = wtiff_tile_pel_size( wtiff );
+
+	if( layer->blank &&
+		memcmp( layer->blank_pel, tile->buf, pel_size ) == 0 )
+		return;
+
+	VIPS_FREE( layer->blank );
+	VIPS_FREE( layer->blank_pel );
+	if( !(layer->blank = vips_malloc( NULL, tile->size )) ||
+		!(layer->blank_pel = vips_malloc( NULL, pel_size )) ) {
+		VIPS_FREE( layer->blank );
+		vips_error_clear();
+		return;
+	}
+	memcpy( layer->blank, data, tile->size );
+	layer->blank_length = tile->size;
+	memcpy( layer->blank_pel, tile->buf, pel_size );
+}
+
+/* Wait for the oldest tile and write it.
+ */
+static int
+wtiff_tile_emit( Wtiff *wtiff )
+{
+	WtiffTile *tile = (WtiffTile *) g_queue_pop_head( &wtiff->tiles );
+	Layer *layer = tile->layer;
+
+	int result;
+
+	vips_semaphore_down( &tile->done );
+
+	result = 0;
+	if( tile->error )
+		result = -1;
+	else {
+		VipsPel *data = vips_dbuf_string( &tile->dbuf, NULL );
+
+		if( tile->jpegtables &&
+			!layer->jpegtables ) {
+			TIFFSetField( layer->tif, TIFFTAG_JPEGTABLES,
+				tile->jpegtables_length, tile->jpegtables );
+			if( tile->has_refbw )
+				TIFFSetField( layer->tif,
+					TIFFTAG_REFERENCEBLACKWHITE,
+					tile->refbw );
+			layer->jpegtables = TRUE;
+		}
+
+		if( TIFFWriteRawTile( layer->tif, tile->number,
+			data + tile->offset, tile->size ) < 0 )
+			result = -1;
+
+		/* Remember single-colour tiles for wtiff_tile_submit().
+		 */
+		if( !result &&
+			tile->uniform )
+			wtiff_tile_remember( wtiff, layer, tile,
+				data + tile->offset );
+	}
+
+	if( result )
+		vips_error( "vips2tiff", "%s", _( "TIFF write tile failed" ) );
+
+	wtiff_tile_free( tile );
+
+	return( result );
+}
+
+/* Write all outstanding tiles. Call before finishing a directory.
+ */
+static int
+wtiff_tile_drain( Wtiff *wtiff )
+{
+	int result;
+
+	result = 0;
+	while( !g_queue_is_empty( &wtiff->tiles ) )
+		if( wtiff_tile_emit( wtiff ) )
+			result = -1;
+
+	return( result );
+}
+
 static void
 wtiff_free( Wtiff *wtiff )
 {
+	WtiffTile *tile;
+
+	/* Wait for and discard any tiles still being compressed.
+	 */
+	while( (tile = (WtiffTile *) g_queue_pop_head( &wtiff->tiles )) ) {
+		vips_semaphore_down( &tile->done );
+		wtiff_tile_free( tile );
+	}
+
 	wtiff_delete_temps( wtiff );
 
 	VIPS_FREEF( vips_free, wtiff->tbuf );
@@ -891,7 +1190,8 @@ wtiff_new( VipsImage *im, const char *filename,
 	gboolean bigtiff,
 	gboolean rgbjpeg,
 	gboolean properties,
-	gboolean strip )
+	gboolean strip,
+	VipsRegionShrink region_shrink )
 {
 	Wtiff *wtiff;
 
@@ -919,8 +1219,11 @@ wtiff_new( VipsImage *im, const char *filename,
 	wtiff->rgbjpeg = rgbjpeg;
 	wtiff->properties = properties;
 	wtiff->strip = strip;
+	wtiff->region_shrink = region_shrink;
 	wtiff->toilet_roll = FALSE;
 	wtiff->page_height = -1;
+	wtiff->parallel = FALSE;
+	g_queue_init( &wtiff->tiles );
 
 	/* Updated below if we discover toilet roll mode.
 	 */
@@ -1062,6 +1365,26 @@ wtiff_new( VipsImage *im, const char *filename,
 		return( NULL );
 	}
 
+	/* libtiff compresses each tile inside TIFFWriteTile(), on our single
+	 * write thread. For compressed tiled images, compress on workers
+	 * instead and write the results with TIFFWriteRawTile().
+	 */
+	if( wtiff->tile &&
+		wtiff->compression != COMPRESSION_NONE &&
+		vips_concurrency_get() > 1 ) {
+		TIFF *tif = wtiff->layer->tif;
+
+		wtiff->parallel = TRUE;
+		TIFFGetFieldDefaulted( tif,
+			TIFFTAG_SAMPLESPERPIXEL, &wtiff->samples_per_pixel );
+		TIFFGetFieldDefaulted( tif,
+			TIFFTAG_BITSPERSAMPLE, &wtiff->bits_per_sample );
+		TIFFGetFieldDefaulted( tif,
+			TIFFTAG_SAMPLEFORMAT, &wtiff->sample_format );
+		TIFFGetFieldDefaulted( tif,
+			TIFFTAG_PHOTOMETRIC, &wtiff->photometric );
+	}
+
 	return( wtiff );
 }
 
@@ -1249,6 +1572,71 @@ wtiff_pack2tiff( Wtiff *wtiff, Layer *layer,
 	}
 }
 
+/* Pack a tile and start compressing it on a worker. Only a few tiles per
+ * thread are in flight at once.
+ */
+static int
+wtiff_tile_submit( Wtiff *wtiff, Layer *layer,
+	VipsRegion *strip, VipsRect *area )
+{
+	WtiffTile *tile;
+
+	tile = g_new0( WtiffTile, 1 );
+	tile->wtiff = wtiff;
+	tile->layer = layer;
+	tile->number = TIFFComputeTile( layer->tif,
+		area->left, area->top, 0, 0 );
+	tile->length = TIFFTileSize( layer->tif );
+	vips_dbuf_init( &tile->dbuf );
+	vips_semaphore_init( &tile->done, 0, "done" );
+	if( !(tile->buf = vips_malloc( NULL, tile->length )) ) {
+		wtiff_tile_free( tile );
+		return( -1 );
+	}
+
+	/* Edge tiles: keep the padding deterministic.
+	 */
+	if( area->width < wtiff->tilew ||
+		area->height < wtiff->tileh )
+		memset( tile->buf, 0, tile->length );
+	wtiff_pack2tiff( wtiff, layer, strip, area, tile->buf );
+
+	/* A tile of the same colour as a tile we've already written can just
+	 * reuse those compressed bytes. libtiff will still write a copy,
+	 * since many readers can't handle shared or empty tiles, but we skip
+	 * the compressor.
+	 */
+	tile->uniform = wtiff_tile_uniform( wtiff, tile );
+	if( tile->uniform &&
+		layer->blank &&
+		memcmp( layer->blank_pel, tile->buf,
+			wtiff_tile_pel_size( wtiff ) ) == 0 ) {
+		tile->uniform = FALSE;
+		tile->offset = 0;
+		tile->size = layer->blank_length;
+		tile->error = !vips_dbuf_write( &tile->dbuf,
+			layer->blank, layer->blank_length );
+		vips_semaphore_up( &tile->done );
+		g_queue_push_tail( &wtiff->tiles, tile );
+	}
+	else {
+		g_queue_push_tail( &wtiff->tiles, tile );
+		if( vips__worker_spawn( wtiff_tile_compress, tile ) ) {
+			/* Can't get a worker, compress inline.
+			 */
+			vips_error_clear();
+			wtiff_tile_compress( tile );
+		}
+	}
+
+	while( g_queue_get_length( &wtiff->tiles ) >
+		2 * vips_concurrency_get() )
+		if( wtiff_tile_emit( wtiff ) )
+			return( -1 );
+
+	return( 0 );
+}
+
 /* Write a set of tiles across the strip.
  */
 static int
@@ -1274,6 +1662,12 @@ wtiff_layer_write_tile( Wtiff *wtiff, Layer *layer, VipsRegion *strip )
 		tile.height = wtiff->tileh;
 		vips_rect_intersectrect( &tile, &image, &tile );
 
+		if( wtiff->parallel ) {
+			if( wtiff_tile_submit( wtiff, layer, strip, &tile ) )
+				return( -1 );
+			continue;
+		}
+
 		/* Have to repack pixels.
 		 */
 		wtiff_pack2tiff( wtiff, layer, strip, &tile, wtiff->tbuf );
@@ -1344,6 +1738,85 @@ wtiff_layer_write_strip( Wtiff *wtiff, Layer *layer, VipsRegion *strip )
 
 static int layer_strip_arrived( Layer *layer );
 
+/* Shrink jobs must be at least this wide to be worth a thread.
+ */
+#define SHRINK_MIN_WIDTH (256)
+
+/* Most slices we split a shrink into.
+ */
+#define SHRINK_MAX_SLICES (64)
+
+/* A vertical slice of a shrink.
+ */
+typedef struct _LayerShrink {
+	VipsRegion *from;
+	VipsRegion *to;
+	VipsRect target;
+	VipsRegionShrink method;
+	VipsSemaphore *finished;
+} LayerShrink;
+
+static void *
+layer_shrink_slice( void *a )
+{
+	LayerShrink *shrink = (LayerShrink *) a;
+
+	(void) vips_region_shrink_method( shrink->from, shrink->to,
+		&shrink->target, shrink->method );
+	vips_semaphore_up( shrink->finished );
+
+	return( NULL );
+}
+
+/* As vips_region_shrink_method(), but split @target into vertical slices
+ * and run them on workers. The regions are already buffered, so the slices
+ * are independent.
+ */
+static void
+layer_region_shrink( VipsRegion *from, VipsRegion *to, VipsRect *target,
+	VipsRegionShrink method )
+{
+	LayerShrink shrink[SHRINK_MAX_SLICES];
+	VipsSemaphore finished;
+	int n;
+	int i;
+
+	n = VIPS_CLIP( 1, target->width / SHRINK_MIN_WIDTH,
+		VIPS_MIN( vips_concurrency_get(), SHRINK_MAX_SLICES ) );
+	if( n == 1 ) {
+		(void) vips_region_shrink_method( from, to, target, method );
+		return;
+	}
+
+	vips_semaphore_init( &finished, 0, "finished" );
+
+	for( i = 0; i < n; i++ ) {
+		int left = target->left + target->width * i / n;
+		int right = target->left + target->width * (i + 1) / n;
+
+		shrink[i].from = from;
+		shrink[i].to = to;
+		shrink[i].target.left = left;
+		shrink[i].target.top = target->top;
+		shrink[i].target.width = right - left;
+		shrink[i].target.height = target->height;
+		shrink[i].method = method;
+		shrink[i].finished = &finished;
+	}
+
+	/* Hand all but the first slice to workers, and do that one here.
+	 */
+	for( i = 1; i < n; i++ )
+		if( vips__worker_spawn( layer_shrink_slice, &shrink[i] ) ) {
+			vips_error_clear();
+			layer_shrink_slice( &shrink[i] );
+		}
+	layer_shrink_slice( &shrink[0] );
+
+	vips_semaphore_downn( &finished, n );
+	vips_semaphore_destroy( &finished );
+}
+
 /* Shrink what pixels we can from this strip into the layer below. If the
  * strip below fills, recurse.
  */
@@ -1392,7 +1865,8 @@ layer_strip_shrink( Layer *layer )
 		if( vips_rect_isempty( &target ) ) 
 			break;
 
-		(void) vips_region_shrink( from, to, &target );
+		layer_region_shrink( from, to, &target,
+			layer->wtiff->region_shrink );
 
 		below->write_y += target.height;
 
@@ -1559,6 +2033,8 @@ wtiff_copy_tiff( Wtiff *wtiff, TIFF *out, TIFF *in )
 	uint32 i32;
 	uint16 i16;
 	float f;
+	toff_t *byte_counts;
+	toff_t max_count;
 	tdata_t buf;
 	ttile_t tile;
 	ttile_t n;
@@ -1622,18 +2098,41 @@ wtiff_copy_tiff( Wtiff *wtiff, TIFF *out, TIFF *in )
 			wtiff_embed_imagedescription( wtiff, out ) )
 			return( -1 );
 
-	buf = vips_malloc( NULL, TIFFTileSize( in ) );
+	/* We copy the compressed tiles, so the JPEG tables must come too.
+	 * Without them, the raw tiles can't be decoded.
+	 */
+	if( wtiff->compression == COMPRESSION_JPEG ) {
+		uint32 length;
+		void *data;
+		float *refbw;
+
+		if( TIFFGetField( in, TIFFTAG_JPEGTABLES, &length, &data ) )
+			TIFFSetField( out, TIFFTAG_JPEGTABLES, length, data );
+		if( TIFFGetField( in, TIFFTAG_REFERENCEBLACKWHITE, &refbw ) )
+			TIFFSetField( out, TIFFTAG_REFERENCEBLACKWHITE, refbw );
+	}
+
+	if( !TIFFGetField( in, TIFFTAG_TILEBYTECOUNTS, &byte_counts ) ) {
+		vips_error( "vips2tiff", "%s", _( "no tile byte counts" ) );
+		return( -1 );
+	}
+
 	n = TIFFNumberOfTiles( in );
+	max_count = 0;
+	for( tile = 0; tile < n; tile++ )
+		max_count = VIPS_MAX( max_count, byte_counts[tile] );
+
+	/* Copy the tiles without decompressing and recompressing them. This
+	 * is much quicker, and JPEG layers don't lose quality again.
+	 */
+	if( !(buf = vips_malloc( NULL, VIPS_MAX( 1, max_count ) )) )
+		return( -1 );
 	for( tile = 0; tile < n; tile++ ) {
 		tsize_t len;
 
-		/* It'd be good to use TIFFReadRawTile()/TIFFWtiffRawTile() 
-		 * here to save compression/decompression, but sadly it seems
-		 * not to work :-( investigate at some point.
-		 */
-		len = TIFFReadEncodedTile( in, tile, buf, -1 );
+		len = TIFFReadRawTile( in, tile, buf, byte_counts[tile] );
 		if( len < 0 ||
-			TIFFWriteEncodedTile( out, tile, buf, len ) < 0 ) {
+			TIFFWriteRawTile( out, tile, buf, len ) < 0 ) {
 			vips_free( buf );
 			return( -1 );
 		}
@@ -1703,7 +2202,8 @@ wtiff_write_image( Wtiff *wtiff )
 				0, y, wtiff->im->Xsize, wtiff->page_height,
 				NULL ) )
 				return( -1 ); 
-			if( vips_sink_disc( page, write_strip, wtiff ) ) {
+			if( vips_sink_disc( page, write_strip, wtiff ) ||
+				wtiff_tile_drain( wtiff ) ) {
 				g_object_unref( page );
 				return( -1 );
 			}
@@ -1726,7 +2226,8 @@ wtiff_write_image( Wtiff *wtiff )
 		printf( "wtiff_write_image: pyramid mode\n" ); 
 #endif /*DEBUG*/
 
-		if( vips_sink_disc( wtiff->im, write_strip, wtiff ) ) 
+		if( vips_sink_disc( wtiff->im, write_strip, wtiff ) ||
+			wtiff_tile_drain( wtiff ) )
 			return( -1 );
 
 		if( !TIFFWriteDirectory( wtiff->layer->tif ) ) 
@@ -1751,7 +2252,8 @@ wtiff_write_image( Wtiff *wtiff )
 		printf( "wtiff_write_image: single-image mode\n" ); 
 #endif /*DEBUG*/
 
-		if( vips_sink_disc( wtiff->im, write_strip, wtiff ) ) 
+		if( vips_sink_disc( wtiff->im, write_strip, wtiff ) ||
+			wtiff_tile_drain( wtiff ) )
 			return( -1 );
 	}
 
@@ -1770,7 +2272,8 @@ vips__tiff_write( VipsImage *in, const char *filename,
 	VipsForeignTiffResunit resunit, double xres, double yres,
 	gboolean bigtiff,
 	gboolean rgbjpeg,
-	gboolean properties, gboolean strip )
+	gboolean properties, gboolean strip,
+	VipsRegionShrink region_shrink )
 {
 	Wtiff *wtiff;
 
@@ -1787,7 +2290,7 @@ vips__tiff_write( VipsImage *in, const char *filename,
 		compression, Q, predictor, profile,
 		tile, tile_width, tile_height, pyramid, squash,
 		miniswhite, resunit, xres, yres, bigtiff, rgbjpeg, 
-		properties, strip )) )
+		properties, strip, region_shrink )) )
 		return( -1 );
 
 	if( wtiff_write_image( wtiff ) ) { 
@@ -1813,7 +2316,8 @@ vips__tiff_write_buf( VipsImage *in,
 	VipsForeignTiffResunit resunit, double xres, double yres,
 	gboolean bigtiff,
 	gboolean rgbjpeg,
-	gboolean properties, gboolean strip )
+	gboolean properties, gboolean strip,
+	VipsRegionShrink region_shrink )
 {
 	Wtiff *wtiff;
 
@@ -1826,7 +2330,7 @@ vips__tiff_write_buf( VipsImage *in,
 		compression, Q, predictor, profile,
 		tile, tile_width, tile_height, pyramid, squash,
 		miniswhite, resunit, xres, yres, bigtiff, rgbjpeg, 
-		properties, strip )) )
+		properties, strip, region_shrink )) )
 		return( -1 );
 
 	wtiff->obuf = obuf;
@@ -8,6 +8,9 @@
  * 	- used advanced encoding API, expose controls 
  * 8/11/16
  * 	- add metadata write
+ * 14/10/18
+ * 	- add reduction_effort, set thread_level, import strips from a sink
+ * 	  rather than a memory copy
  */
 
 /*
@@ -62,6 +65,22 @@
 typedef int (*webp_import)( WebPPicture *picture,
 	const uint8_t *rgb, int stride );
 
+/* State for importing pixels into a picture as the sink generates them.
+ */
+typedef struct {
+	WebPPicture *pic;
+	VipsImage *in;
+	webp_import import;
+
+	/* Lossy import works in 2x2 chroma blocks, so an odd line at the
+	 * end of one strip must wait for the first line of the next. line
+	 * has room for two lines, line_y is the position of the waiting
+	 * line, or -1.
+	 */
+	VipsPel *line;
+	int line_y;
+} VipsWebPImport;
+
 static WebPPreset
 get_preset( VipsForeignWebpPreset preset )
 {
@@ -228,15 +247,149 @@ memory_write( const uint8_t *data, size_t data_size,
 	return( vips_webp_writer_append( writer, data, data_size ) ); 
 }
 
+/* Import a set of RGB(A) lines to our picture. This is the use_argb path, we
+ * can pack straight into the picture.
+ */
+static void
+vips_webp_import_argb( VipsWebPImport *import,
+	VipsPel *p, size_t stride, int top, int height )
+{
+	WebPPicture *pic = import->pic;
+	int bands = import->in->Bands;
+
+	int x, y;
+
+	for( y = 0; y < height; y++ ) {
+		VipsPel *q = p + y * stride;
+		uint32_t *argb = pic->argb + (top + y) * pic->argb_stride;
+
+		for( x = 0; x < pic->width; x++ ) {
+			uint32_t a = bands == 4 ? q[3] : 255;
+
+			argb[x] = (a << 24) | (q[0] << 16) | (q[1] << 8) | q[2];
+			q += bands;
+		}
+	}
+}
+
+/* Import an even number of lines, or the final lines of the image, to the
+ * YUV planes of our picture. We import to a small temporary picture, then
+ * copy the planes across.
+ */
+static int
+vips_webp_import_yuv( VipsWebPImport *import,
+	VipsPel *p, size_t stride, int top, int height )
+{
+	WebPPicture *pic = import->pic;
+	int uv_width = (pic->width + 1) / 2;
+
+	WebPPicture strip;
+	int y;
+
+	g_assert( !(top & 1) );
+
+	if( !WebPPictureInit( &strip ) ) {
+		vips_error( "vips2webp",
+			"%s", _( "picture version error" ) );
+		return( -1 );
+	}
+	strip.width = pic->width;
+	strip.height = height;
+
+	if( !import->import( &strip, p, stride ) ) {
+		WebPPictureFree( &strip );
+		vips_error( "vips2webp", "%s", _( "picture memory error" ) );
+		return( -1 );
+	}
+
+	for( y = 0; y < height; y++ )
+		memcpy( pic->y + (top + y) * pic->y_stride,
+			strip.y + y * strip.y_stride, pic->width );
+
+	for( y = 0; y < (height + 1) / 2; y++ ) {
+		memcpy( pic->u + (top / 2 + y) * pic->uv_stride,
+			strip.u + y * strip.uv_stride, uv_width );
+		memcpy( pic->v + (top / 2 + y) * pic->uv_stride,
+			strip.v + y * strip.uv_stride, uv_width );
+	}
+
+	/* The import will drop the alpha plane if this strip happens to be
+	 * opaque.
+	 */
+	if( pic->a )
+		for( y = 0; y < height; y++ ) {
+			uint8_t *q = pic->a + (top + y) * pic->a_stride;
+
+			if( strip.a )
+				memcpy( q, strip.a + y * strip.a_stride,
+					pic->width );
+			else
+				memset( q, 255, pic->width );
+		}
+
+	WebPPictureFree( &strip );
+
+	return( 0 );
+}
+
+static int
+vips_webp_import_block( VipsRegion *region, VipsRect *area, void *a )
+{
+	VipsWebPImport *import = (VipsWebPImport *) a;
+	WebPPicture *pic = import->pic;
+	size_t stride = VIPS_REGION_LSKIP( region );
+	size_t sizeof_line = VIPS_IMAGE_SIZEOF_LINE( import->in );
+
+	VipsPel *p;
+	int top;
+	int height;
+
+	p = VIPS_REGION_ADDR( region, 0, area->top );
+	top = area->top;
+	height = area->height;
+
+	if( pic->use_argb ) {
+		vips_webp_import_argb( import, p, stride, top, height );
+		return( 0 );
+	}
+
+	/* Pair any waiting line with the first line of this strip.
+	 */
+	if( import->line_y >= 0 ) {
+		memcpy( import->line + sizeof_line, p, sizeof_line );
+		if( vips_webp_import_yuv( import,
+			import->line, sizeof_line, import->line_y, 2 ) )
+			return( -1 );
+		import->line_y = -1;
+
+		p += stride;
+		top += 1;
+		height -= 1;
+	}
+
+	if( (height & 1) &&
+		top + height < pic->height ) {
+		memcpy( import->line, p + (height - 1) * stride, sizeof_line );
+		import->line_y = top + height - 1;
+		height -= 1;
+	}
+
+	if( height > 0 &&
+		vips_webp_import_yuv( import, p, stride, top, height ) )
+		return( -1 );
+
+	return( 0 );
+}
+
 static int
 write_webp( WebPPicture *pic, VipsImage *in,
 	int Q, gboolean lossless, VipsForeignWebpPreset preset,
 	gboolean smart_subsample, gboolean near_lossless,
-	int alpha_q )
+	int alpha_q, int reduction_effort )
 {
-	VipsImage *memory;
 	WebPConfig config;
-	webp_import import;
+	VipsWebPImport import;
+	int result;
 
 	if( !WebPConfigInit( &config ) ) {
 		vips_error( "vips2webp",
@@ -281,37 +434,57 @@ write_webp( WebPPicture *pic, VipsImage *in,
 		g_warning( "%s", _( "smart_subsample unsupported" ) );
 #endif
 
+	config.method = reduction_effort;
+
+#if WEBP_ENCODER_ABI_VERSION >= 0x0200
+	/* Let the encoder run the analysis and entropy passes in a thread
+	 * of their own if we have threads to spare.
+	 */
+	config.thread_level = vips_concurrency_get() > 1;
+#endif
+
 	if( !WebPValidateConfig( &config ) ) {
 		vips_error( "vips2webp", "%s", _( "invalid configuration" ) );
 		return( -1 );
 	}
 
-	if( !(memory = vips_image_copy_memory( in )) )
+	/* Rather than making a memory copy of the whole of @in and then
+	 * importing that, allocate the final picture and import strips
+	 * of lines as the sink generates them.
+	 */
+	pic->width = in->Xsize;
+	pic->height = in->Ysize;
+	if( !pic->use_argb &&
+		in->Bands == 4 )
+		pic->colorspace = WEBP_YUV420A;
+	if( !WebPPictureAlloc( pic ) ) {
+		vips_error( "vips2webp", "%s", _( "picture memory error" ) );
 		return( -1 );
+	}
 
-	pic->width = memory->Xsize;
-	pic->height = memory->Ysize;
-
+	import.pic = pic;
+	import.in = in;
 	if( in->Bands == 4 )
-		import = WebPPictureImportRGBA;
+		import.import = WebPPictureImportRGBA;
 	else
-		import = WebPPictureImportRGB;
+		import.import = WebPPictureImportRGB;
+	import.line_y = -1;
+	if( !(import.line =
+		vips_malloc( NULL, 2 * VIPS_IMAGE_SIZEOF_LINE( in ) )) )
+		return( -1 );
 
-	if( !import( pic, VIPS_IMAGE_ADDR( memory, 0, 0 ),
-		VIPS_IMAGE_SIZEOF_LINE( memory ) ) ) {
-		VIPS_UNREF( memory );
-		vips_error( "vips2webp", "%s", _( "picture memory error" ) );
+	result = vips_sink_disc( in, vips_webp_import_block, &import );
+
+	vips_free( import.line );
+
+	if( result )
 		return( -1 );
-	}
 
 	if( !WebPEncode( &config, pic ) ) {
-		VIPS_UNREF( memory );
 		vips_error( "vips2webp", "%s", _( "unable to encode" ) );
 		return( -1 );
 	}
 
-	VIPS_UNREF( memory );
-
 	return( 0 );
 }
 
@@ -516,7 +689,7 @@ int
 vips__webp_write_file( VipsImage *in, const char *filename, 
 	int Q, gboolean lossless, VipsForeignWebpPreset preset,
 	gboolean smart_subsample, gboolean near_lossless,
-	int alpha_q, gboolean strip )
+	int alpha_q, int reduction_effort, gboolean strip )
 {
 	WebPPicture pic;
 	VipsWebPWriter writer;
@@ -533,7 +706,7 @@ vips__webp_write_file( VipsImage *in, const char *filename,
 	pic.custom_ptr = &writer;
 
 	if( write_webp( &pic, in, Q, lossless, preset, smart_subsample,
-		near_lossless, alpha_q ) ) {
+		near_lossless, alpha_q, reduction_effort ) ) {
 		WebPPictureFree( &pic );
 		vips_webp_writer_unset( &writer );
 		return( -1 );
@@ -570,7 +743,7 @@ int
 vips__webp_write_buffer( VipsImage *in, void **obuf, size_t *olen, 
 	int Q, gboolean lossless, VipsForeignWebpPreset preset,
 	gboolean smart_subsample, gboolean near_lossless,
-	int alpha_q, gboolean strip )
+	int alpha_q, int reduction_effort, gboolean strip )
 {
 	WebPPicture pic;
 	VipsWebPWriter writer;
@@ -586,7 +759,7 @@ vips__webp_write_buffer( VipsImage *in, void **obuf, size_t *olen,
 	pic.custom_ptr = &writer;
 
 	if( write_webp( &pic, in, Q, lossless, preset, smart_subsample,
-		near_lossless, alpha_q ) ) {
+		near_lossless, alpha_q, reduction_effort ) ) {
 		WebPPictureFree( &pic );
 		vips_webp_writer_unset( &writer );
 		return( -1 );
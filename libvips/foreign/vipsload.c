@@ -155,6 +155,9 @@ vips_foreign_load_vips_init( VipsForeignLoadVips *vips )
  *
  * Read in a vips image. 
  *
+ * Files written by vips_vipssave() with @tile set are read a tile at a
+ * time, mapping only the tiles each area needs.
+ *
  * See also: vips_vipssave().
  *
  * Returns: 0 on success, -1 on error.
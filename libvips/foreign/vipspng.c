@@ -67,6 +67,15 @@
  * 	- better @fail handling with truncated PNGs
  * 9/4/18
  * 	- set interlaced=1 for interlaced images
+ * 14/10/18
+ * 	- add shrink-on-load
+ * 	- deflate in parallel for non-interlaced save
+ * 	- read from / write to VipsSource and VipsTarget
+ * 	- read interlaced images a pass at a time if there are ::preview
+ * 	  handlers
+ * 	- use a chunked buffer for memory output
+ * 15/10/18
+ * 	- mmap regular files and read from memory, falling back to stdio
  */
 
 /*
@@ -111,6 +120,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 
 #include <vips/vips.h>
 #include <vips/internal.h>
@@ -120,6 +130,10 @@
 
 #include <png.h>
 
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif /*HAVE_ZLIB*/
+
 #if PNG_LIBPNG_VER < 10003
 #error "PNG library too old."
 #endif
@@ -156,20 +170,35 @@ typedef struct {
 	VipsImage *out;
 	gboolean fail;
 
+	/* Shrink by this much during load.
+	 */
+	int shrink;
+
 	int y_pos;
 	png_structp pPng;
 	png_infop pInfo;
 	png_bytep *row_pointer;
 
+	/* For shrink-on-load, a line buffer and block sums.
+	 */
+	png_bytep line;
+	guint64 *sum;
+
 	/* For FILE input.
 	 */
 	FILE *fp;
 
-	/* For memory input.
+	/* For memory input. For file input, this can also be a map of the
+	 * file.
 	 */
 	const void *buffer;
 	size_t length;
 	size_t read_pos;
+	void *mapped;
+
+	/* For source input.
+	 */
+	VipsSource *source;
 
 } Read;
 
@@ -179,9 +208,18 @@ static void
 read_destroy( Read *read )
 {
 	VIPS_FREEF( fclose, read->fp );
+	VIPS_UNREF( read->source );
 	if( read->pPng )
 		png_destroy_read_struct( &read->pPng, &read->pInfo, NULL );
+	if( read->mapped ) {
+		vips__munmap( read->mapped, read->length );
+		read->mapped = NULL;
+		read->buffer = NULL;
+		read->length = 0;
+	}
 	VIPS_FREE( read->row_pointer );
+	VIPS_FREE( read->line );
+	VIPS_FREE( read->sum );
 }
 
 static void
@@ -191,7 +229,7 @@ read_close_cb( VipsImage *out, Read *read )
 }
 
 static Read *
-read_new( VipsImage *out, gboolean fail )
+read_new( VipsImage *out, gboolean fail, int shrink )
 {
 	Read *read;
 
@@ -200,15 +238,20 @@ read_new( VipsImage *out, gboolean fail )
 
 	read->name = NULL;
 	read->fail = fail;
+	read->shrink = shrink;
 	read->out = out;
 	read->y_pos = 0;
 	read->pPng = NULL;
 	read->pInfo = NULL;
 	read->row_pointer = NULL;
+	read->line = NULL;
+	read->sum = NULL;
 	read->fp = NULL;
 	read->buffer = NULL;
 	read->length = 0;
 	read->read_pos = 0;
+	read->mapped = NULL;
+	read->source = NULL;
 
 	g_signal_connect( out, "close", 
 		G_CALLBACK( read_close_cb ), read ); 
@@ -236,18 +279,45 @@ read_new( VipsImage *out, gboolean fail )
 	return( read );
 }
 
+static void
+vips_png_read_buffer( png_structp pPng, png_bytep data, png_size_t length )
+{
+	Read *read = png_get_io_ptr( pPng ); 
+
+#ifdef DEBUG
+	printf( "vips_png_read_buffer: read %zd bytes\n", length ); 
+#endif /*DEBUG*/
+
+	if( read->read_pos + length > read->length )
+		png_error( pPng, "not enough data in buffer" );
+
+	memcpy( data, read->buffer + read->read_pos, length );
+	read->read_pos += length;
+}
+
 static Read *
-read_new_filename( VipsImage *out, const char *name, gboolean fail )
+read_new_filename( VipsImage *out, const char *name, gboolean fail,
+	int shrink )
 {
 	Read *read;
 
-	if( !(read = read_new( out, fail )) )
+	if( !(read = read_new( out, fail, shrink )) )
 		return( NULL );
 
 	read->name = vips_strdup( VIPS_OBJECT( out ), name );
 
-        if( !(read->fp = vips__file_open_read( name, NULL, FALSE )) ) 
-		return( NULL );
+	/* Read from a map of the file if we can, or fall back to stdio for
+	 * things like pipes.
+	 */
+	if( (read->mapped = vips__mmap_file( name, &read->length )) ) {
+		read->buffer = read->mapped;
+		png_set_read_fn( read->pPng, read, vips_png_read_buffer ); 
+	}
+	else {
+		if( !(read->fp = vips__file_open_read( name, NULL, FALSE )) ) 
+			return( NULL );
+		png_init_io( read->pPng, read->fp );
+	}
 
 	/* Catch PNG errors from png_read_info().
 	 */
@@ -257,7 +327,6 @@ read_new_filename( VipsImage *out, const char *name, gboolean fail )
 	/* Read enough of the file that png_get_interlace_type() will start
 	 * working.
 	 */
-	png_init_io( read->pPng, read->fp );
 	png_read_info( read->pPng, read->pInfo );
 
 	return( read );
@@ -387,10 +456,21 @@ png2vips_header( Read *read, VipsImage *out )
 		break;
 	}
 
+	/* If we've been asked to shrink, interlaced images will be read from
+	 * the first few Adam7 passes, so we need libpng to do the interlace
+	 * handling for us. We also read a pass at a time for previews.
+	 */
+	if( (read->shrink > 1 ||
+		vips_image_preview_wanted( read->out )) &&
+		interlace_type != PNG_INTERLACE_NONE )
+		(void) png_set_interlace_handling( read->pPng );
+
 	/* Set VIPS header.
 	 */
 	vips_image_init_fields( out,
-		width, height, bands,
+		VIPS_ROUND_UP( width, read->shrink ) / read->shrink,
+		VIPS_ROUND_UP( height, read->shrink ) / read->shrink,
+		bands,
 		bit_depth > 8 ? 
 			VIPS_FORMAT_USHORT : VIPS_FORMAT_UCHAR,
 		VIPS_CODING_NONE, interpretation, 
@@ -434,7 +514,7 @@ png2vips_header( Read *read, VipsImage *out )
 	 */
 	png_read_update_info( read->pPng, read->pInfo );
 	if( png_get_rowbytes( read->pPng, read->pInfo ) != 
-		VIPS_IMAGE_SIZEOF_LINE( out ) ) {
+		VIPS_IMAGE_SIZEOF_PEL( out ) * width ) {
 		vips_error( "vipspng", 
 			"%s", _( "unable to read PNG header" ) );
 		return( -1 );
@@ -451,11 +531,11 @@ png2vips_header( Read *read, VipsImage *out )
 /* Read a PNG file header into a VIPS header.
  */
 int
-vips__png_header( const char *name, VipsImage *out )
+vips__png_header( const char *name, VipsImage *out, int shrink )
 {
 	Read *read;
 
-	if( !(read = read_new_filename( out, name, TRUE )) ||
+	if( !(read = read_new_filename( out, name, TRUE, shrink )) ||
 		png2vips_header( read, out ) ) 
 		return( -1 );
 
@@ -502,6 +582,258 @@ png2vips_interlace( Read *read, VipsImage *out )
 	return( 0 );
 }
 
+/* Read an interlaced image a pass at a time, sending a snapshot to any
+ * preview handlers after each pass. libpng fills the display rows with
+ * blocks of pixels from the passes so far, and after the last pass they
+ * hold the final image.
+ */
+static int
+png2vips_interlace_preview( Read *read, VipsImage *out )
+{
+	const int n_passes = 7;
+
+	int pass;
+	int y;
+
+#ifdef DEBUG
+	printf( "png2vips_interlace_preview: reading by pass\n" );
+#endif /*DEBUG*/
+
+	if( vips_image_write_prepare( out ) )
+		return( -1 );
+
+	if( setjmp( png_jmpbuf( read->pPng ) ) )
+		return( -1 );
+
+	if( !(read->row_pointer = VIPS_ARRAY( NULL, out->Ysize, png_bytep )) )
+		return( -1 );
+	for( y = 0; y < out->Ysize; y++ )
+		read->row_pointer[y] = VIPS_IMAGE_ADDR( out, 0, y );
+
+	for( pass = 0; pass < n_passes; pass++ ) {
+		png_read_rows( read->pPng,
+			NULL, read->row_pointer, out->Ysize );
+
+		if( pass < n_passes - 1 ) {
+			VipsImage *snapshot;
+
+			if( !(snapshot = vips_image_new_from_memory_copy(
+				VIPS_IMAGE_ADDR( out, 0, 0 ),
+				VIPS_IMAGE_SIZEOF_IMAGE( out ),
+				out->Xsize, out->Ysize,
+				out->Bands, out->BandFmt )) )
+				return( -1 );
+			snapshot->Type = out->Type;
+			vips_image_preview( read->out, snapshot );
+			g_object_unref( snapshot );
+		}
+	}
+
+	png_read_end( read->pPng, NULL );
+
+	read_destroy( read );
+
+	return( 0 );
+}
+
+/* Shrink-on-load for interlaced images. We only need the pixels on a grid of
+ * @shrink, and the first few Adam7 passes may give us all of those. Decode
+ * just those passes, then subsample to out.
+ */
+static int
+png2vips_interlace_shrink( Read *read, VipsImage *out )
+{
+	const int shrink = read->shrink;
+	const int height = png_get_image_height( read->pPng, read->pInfo );
+	const int rowbytes = png_get_rowbytes( read->pPng, read->pInfo );
+	const int ps = VIPS_IMAGE_SIZEOF_PEL( out );
+
+	int n_passes;
+	int pass;
+	int x, y;
+
+	/* After pass 1 we have every 8th pixel in both directions, after 3
+	 * every 4th, after 5 every 2nd.
+	 */
+	if( shrink % 8 == 0 )
+		n_passes = 1;
+	else if( shrink % 4 == 0 )
+		n_passes = 3;
+	else if( shrink % 2 == 0 )
+		n_passes = 5;
+	else
+		n_passes = 7;
+
+#ifdef DEBUG
+	printf( "png2vips_interlace_shrink: shrink %d, %d passes\n",
+		shrink, n_passes );
+#endif /*DEBUG*/
+
+	if( vips_image_write_prepare( out ) )
+		return( -1 );
+
+	/* Full-width lines, but only for the rows we keep.
+	 */
+	if( !(read->line = VIPS_ARRAY( NULL,
+		(size_t) rowbytes * out->Ysize, png_byte )) )
+		return( -1 );
+
+	if( setjmp( png_jmpbuf( read->pPng ) ) )
+		return( -1 );
+
+	/* libpng wants every row of every pass, but we can pass NULL for
+	 * rows we don't need.
+	 */
+	for( pass = 0; pass < n_passes; pass++ )
+		for( y = 0; y < height; y++ ) {
+			png_bytep row = y % shrink == 0 ?
+				read->line + (size_t) rowbytes * (y / shrink) :
+				NULL;
+
+			png_read_row( read->pPng, row, NULL );
+		}
+
+	for( y = 0; y < out->Ysize; y++ ) {
+		VipsPel *p = read->line + (size_t) rowbytes * y;
+		VipsPel *q = VIPS_IMAGE_ADDR( out, 0, y );
+
+		for( x = 0; x < out->Xsize; x++ ) {
+			memcpy( q, p, ps );
+
+			q += ps;
+			p += ps * shrink;
+		}
+	}
+
+	/* We've not read all the passes, so we can't png_read_end().
+	 */
+	read_destroy( read );
+
+	return( 0 );
+}
+
+/* Read the next row of a non-interlaced image.
+ */
+static int
+png2vips_read_row( Read *read, png_bytep q, int y )
+{
+	/* We need to catch errors from read_row().
+	 */
+	if( !setjmp( png_jmpbuf( read->pPng ) ) )
+		png_read_row( read->pPng, q, NULL );
+	else {
+		/* We've failed to read some pixels. Knock this
+		 * operation out of cache.
+		 */
+		vips_foreign_load_invalidate( read->out );
+
+#ifdef DEBUG
+		printf( "png2vips_read_row: png_read_row() failed, "
+			"line %d\n", y );
+		printf( "png2vips_read_row: file %s\n", read->name );
+		printf( "png2vips_read_row: thread %p\n",
+			g_thread_self() );
+#endif /*DEBUG*/
+
+		/* And bail if fail is on. We have to add an error
+		 * message, since the handler we install just does
+		 * g_warning().
+		 */
+		if( read->fail ) {
+			vips_error( "vipspng",
+				"%s", _( "libpng read error" ) );
+			return( -1 );
+		}
+	}
+
+	return( 0 );
+}
+
+/* Sum a line into the block sums. Colour is weighted by alpha, if there is
+ * one, as a premultiplied shrink would.
+ */
+#define SUM_LINE( TYPE ) { \
+	TYPE *p = (TYPE *) read->line; \
+	\
+	for( x = 0; x < width; x++ ) { \
+		guint64 *s = read->sum + (x / shrink) * bands; \
+		guint64 a = has_alpha ? p[bands - 1] : 1; \
+		\
+		for( b = 0; b < n_colour; b++ ) \
+			s[b] += a * p[b]; \
+		if( has_alpha ) \
+			s[bands - 1] += a; \
+		\
+		p += bands; \
+	} \
+}
+
+/* Average the block sums to an output line.
+ */
+#define AVERAGE_LINE( TYPE ) { \
+	TYPE *q = (TYPE *) pq; \
+	\
+	for( x = 0; x < out->Xsize; x++ ) { \
+		guint64 *s = read->sum + x * bands; \
+		guint64 n = (guint64) VIPS_MIN( shrink, width - x * shrink ) * \
+			n_lines; \
+		guint64 w = has_alpha ? s[bands - 1] : n; \
+		\
+		for( b = 0; b < n_colour; b++ ) \
+			q[b] = w ? (s[b] + w / 2) / w : 0; \
+		if( has_alpha ) \
+			q[bands - 1] = (s[bands - 1] + n / 2) / n; \
+		\
+		q += bands; \
+	} \
+}
+
+/* Shrink-on-load for non-interlaced images. Read @shrink lines and block
+ * average to make the next line of output.
+ */
+static int
+png2vips_shrink_line( Read *read, VipsImage *out, VipsPel *pq )
+{
+	const int shrink = read->shrink;
+	const int width = png_get_image_width( read->pPng, read->pInfo );
+	const int height = png_get_image_height( read->pPng, read->pInfo );
+	const int bands = out->Bands;
+	const gboolean has_alpha = bands == 2 || bands == 4;
+	const int n_colour = has_alpha ? bands - 1 : bands;
+	const int top = read->y_pos * shrink;
+	const int n_lines = VIPS_MIN( shrink, height - top );
+
+	int x, y, b;
+
+	if( !read->line ) {
+		if( !(read->line = VIPS_ARRAY( NULL,
+			png_get_rowbytes( read->pPng, read->pInfo ),
+			png_byte )) ||
+			!(read->sum = VIPS_ARRAY( NULL,
+				out->Xsize * bands, guint64 )) )
+			return( -1 );
+	}
+
+	memset( read->sum, 0, out->Xsize * bands * sizeof( guint64 ) );
+
+	for( y = 0; y < n_lines; y++ ) {
+		if( png2vips_read_row( read, read->line, top + y ) )
+			return( -1 );
+
+		if( out->BandFmt == VIPS_FORMAT_USHORT )
+			SUM_LINE( unsigned short )
+		else
+			SUM_LINE( unsigned char )
+	}
+
+	if( out->BandFmt == VIPS_FORMAT_USHORT )
+		AVERAGE_LINE( unsigned short )
+	else
+		AVERAGE_LINE( unsigned char )
+
+	return( 0 );
+}
+
 static int
 png2vips_generate( VipsRegion *or, 
 	void *seq, void *a, void *b, gboolean *stop )
@@ -540,34 +872,12 @@ png2vips_generate( VipsRegion *or,
 	for( y = 0; y < r->height; y++ ) {
 		png_bytep q = (png_bytep) VIPS_REGION_ADDR( or, 0, r->top + y );
 
-		/* We need to catch errors from read_row().
-		 */
-		if( !setjmp( png_jmpbuf( read->pPng ) ) ) 
-			png_read_row( read->pPng, q, NULL );
-		else { 
-			/* We've failed to read some pixels. Knock this 
-			 * operation out of cache. 
-			 */
-			vips_foreign_load_invalidate( read->out );
-
-#ifdef DEBUG
-			printf( "png2vips_generate: png_read_row() failed, "
-				"line %d\n", r->top + y ); 
-			printf( "png2vips_generate: file %s\n", read->name );
-			printf( "png2vips_generate: thread %p\n", 
-				g_thread_self() );
-#endif /*DEBUG*/
-
-			/* And bail if fail is on. We have to add an error
-			 * message, since the handler we install just does
-			 * g_warning().
-			 */
-			if( read->fail ) {
-				vips_error( "vipspng", 
-					"%s", _( "libpng read error" ) ); 
+		if( read->shrink > 1 ) {
+			if( png2vips_shrink_line( read, or->im, q ) )
 				return( -1 );
-			}
 		}
+		else if( png2vips_read_row( read, q, r->top + y ) )
+			return( -1 );
 
 		read->y_pos += 1;
 	}
@@ -606,7 +916,7 @@ vips__png_isinterlaced( const char *filename )
 	int interlace_type;
 
 	image = vips_image_new();
-	if( !(read = read_new_filename( image, filename, TRUE )) ) {
+	if( !(read = read_new_filename( image, filename, TRUE, 1 )) ) {
 		g_object_unref( image );
 		return( -1 );
 	}
@@ -629,7 +939,11 @@ png2vips_image( Read *read, VipsImage *out )
 		 */
 		t[0] = vips_image_new_memory();
 		if( png2vips_header( read, t[0] ) ||
-			png2vips_interlace( read, t[0] ) ||
+			(read->shrink > 1 ?
+				png2vips_interlace_shrink( read, t[0] ) :
+			 vips_image_preview_wanted( read->out ) ?
+				png2vips_interlace_preview( read, t[0] ) :
+				png2vips_interlace( read, t[0] )) ||
 			vips_image_write( t[0], out ) )
 			return( -1 );
 	}
@@ -650,7 +964,8 @@ png2vips_image( Read *read, VipsImage *out )
 }
 
 int
-vips__png_read( const char *filename, VipsImage *out, gboolean fail )
+vips__png_read( const char *filename, VipsImage *out, gboolean fail,
+	int shrink )
 {
 	Read *read;
 
@@ -658,7 +973,7 @@ vips__png_read( const char *filename, VipsImage *out, gboolean fail )
 	printf( "vips__png_read: reading \"%s\"\n", filename );
 #endif /*DEBUG*/
 
-	if( !(read = read_new_filename( out, filename, fail )) ||
+	if( !(read = read_new_filename( out, filename, fail, shrink )) ||
 		png2vips_image( read, out ) )
 		return( -1 ); 
 
@@ -688,29 +1003,13 @@ vips__png_ispng( const char *filename )
 		vips__png_ispng_buffer( buf, 8 ) ); 
 }
 
-static void
-vips_png_read_buffer( png_structp pPng, png_bytep data, png_size_t length )
-{
-	Read *read = png_get_io_ptr( pPng ); 
-
-#ifdef DEBUG
-	printf( "vips_png_read_buffer: read %zd bytes\n", length ); 
-#endif /*DEBUG*/
-
-	if( read->read_pos + length > read->length )
-		png_error( pPng, "not enough data in buffer" );
-
-	memcpy( data, read->buffer + read->read_pos, length );
-	read->read_pos += length;
-}
-
 static Read *
 read_new_buffer( VipsImage *out, const void *buffer, size_t length, 
-	gboolean fail )
+	gboolean fail, int shrink )
 {
 	Read *read;
 
-	if( !(read = read_new( out, fail )) )
+	if( !(read = read_new( out, fail, shrink )) )
 		return( NULL );
 
 	read->length = length;
@@ -732,11 +1031,12 @@ read_new_buffer( VipsImage *out, const void *buffer, size_t length,
 }
 
 int
-vips__png_header_buffer( const void *buffer, size_t length, VipsImage *out )
+vips__png_header_buffer( const void *buffer, size_t length, VipsImage *out,
+	int shrink )
 {
 	Read *read;
 
-	if( !(read = read_new_buffer( out, buffer, length, TRUE )) ||
+	if( !(read = read_new_buffer( out, buffer, length, TRUE, shrink )) ||
 		png2vips_header( read, out ) ) 
 		return( -1 );
 
@@ -745,11 +1045,11 @@ vips__png_header_buffer( const void *buffer, size_t length, VipsImage *out )
 
 int
 vips__png_read_buffer( const void *buffer, size_t length, VipsImage *out, 
-	gboolean fail )
+	gboolean fail, int shrink )
 {
 	Read *read;
 
-	if( !(read = read_new_buffer( out, buffer, length, fail )) ||
+	if( !(read = read_new_buffer( out, buffer, length, fail, shrink )) ||
 		png2vips_image( read, out ) )
 		return( -1 ); 
 
@@ -768,7 +1068,94 @@ vips__png_isinterlaced_buffer( const void *buffer, size_t length )
 
 	image = vips_image_new();
 
-	if( !(read = read_new_buffer( image, buffer, length, TRUE )) ) { 
+	if( !(read = read_new_buffer( image, buffer, length, TRUE, 1 )) ) {
+		g_object_unref( image );
+		return( -1 );
+	}
+	interlace_type = png_get_interlace_type( read->pPng, read->pInfo );
+	g_object_unref( image );
+
+	return( interlace_type != PNG_INTERLACE_NONE );
+}
+
+static void
+vips_png_read_source( png_structp pPng, png_bytep data, png_size_t length )
+{
+	Read *read = png_get_io_ptr( pPng );
+
+	while( length > 0 ) {
+		gint64 bytes_read;
+
+		if( (bytes_read = vips_source_read( read->source,
+			data, length )) <= 0 )
+			png_error( pPng, "not enough data in source" );
+
+		data += bytes_read;
+		length -= bytes_read;
+	}
+}
+
+static Read *
+read_new_source( VipsImage *out, VipsSource *source,
+	gboolean fail, int shrink )
+{
+	Read *read;
+
+	if( vips_source_rewind( source ) ||
+		!(read = read_new( out, fail, shrink )) )
+		return( NULL );
+
+	read->source = source;
+	g_object_ref( source );
+
+	png_set_read_fn( read->pPng, read, vips_png_read_source );
+
+	/* Catch PNG errors from png_read_info().
+	 */
+	if( setjmp( png_jmpbuf( read->pPng ) ) )
+		return( NULL );
+
+	png_read_info( read->pPng, read->pInfo );
+
+	return( read );
+}
+
+int
+vips__png_header_source( VipsSource *source, VipsImage *out, int shrink )
+{
+	Read *read;
+
+	if( !(read = read_new_source( out, source, TRUE, shrink )) ||
+		png2vips_header( read, out ) )
+		return( -1 );
+
+	return( 0 );
+}
+
+int
+vips__png_read_source( VipsSource *source, VipsImage *out,
+	gboolean fail, int shrink )
+{
+	Read *read;
+
+	if( !(read = read_new_source( out, source, fail, shrink )) ||
+		vips_source_decode( source ) ||
+		png2vips_image( read, out ) )
+		return( -1 );
+
+	return( 0 );
+}
+
+gboolean
+vips__png_isinterlaced_source( VipsSource *source )
+{
+	VipsImage *image;
+	Read *read;
+	int interlace_type;
+
+	image = vips_image_new();
+
+	if( !(read = read_new_source( image, source, TRUE, 1 )) ) {
 		g_object_unref( image );
 		return( -1 );
 	}
@@ -787,19 +1174,56 @@ typedef struct {
 	VipsImage *memory;
 
 	FILE *fp;
-	VipsDbuf dbuf;
+	VipsCbuf cbuf;
+	VipsTarget *target;
 
 	png_structp pPng;
 	png_infop pInfo;
 	png_bytep *row_pointer;
+
+#ifdef HAVE_ZLIB
+	/* Set if we are deflating in parallel, see write_parallel_init().
+	 */
+	gboolean parallel;
+	int compress;
+	VipsForeignPngFilter filter;
+	int bpp;
+	int rowbytes;
+	int rows_per_chunk;
+	VipsPel *row;			/* Byteswap buffer */
+	VipsPel *prev;			/* Previous row, unfiltered */
+	VipsPel *dictionary;		/* End of the previous chunk */
+	size_t dictionary_length;
+	int y;				/* Rows filtered so far */
+	struct _WriteChunk *chunk;	/* Chunk we are filling */
+	GQueue chunks;			/* Chunks in flight, in order */
+	uLong adler;
+#endif /*HAVE_ZLIB*/
 } Write;
 
+#ifdef HAVE_ZLIB
+static void write_chunk_free( struct _WriteChunk *chunk );
+static void write_chunk_wait( struct _WriteChunk *chunk );
+#endif /*HAVE_ZLIB*/
+
 static void
 write_finish( Write *write )
 {
+#ifdef HAVE_ZLIB
+	struct _WriteChunk *chunk;
+
+	/* Workers may still be compressing chunks if we've had an error.
+	 */
+	while( (chunk = g_queue_pop_head( &write->chunks )) ) {
+		write_chunk_wait( chunk );
+		write_chunk_free( chunk );
+	}
+	VIPS_FREEF( write_chunk_free, write->chunk );
+#endif /*HAVE_ZLIB*/
+
 	VIPS_FREEF( fclose, write->fp );
 	VIPS_UNREF( write->memory );
-	vips_dbuf_destroy( &write->dbuf );
+	vips_cbuf_destroy( &write->cbuf );
 	if( write->pPng )
 		png_destroy_write_struct( &write->pPng, &write->pInfo );
 }
@@ -821,7 +1245,7 @@ write_new( VipsImage *in )
 	write->in = in;
 	write->memory = NULL;
 	write->fp = NULL;
-	vips_dbuf_init( &write->dbuf );
+	vips_cbuf_init( &write->cbuf );
 	g_signal_connect( in, "close", 
 		G_CALLBACK( write_destroy ), write ); 
 
@@ -877,6 +1301,436 @@ write_png_block( VipsRegion *region, VipsRect *area, void *a )
 	return( 0 );
 }
 
+#ifdef HAVE_ZLIB
+
+/* Parallel deflate.
+ *
+ * For non-interlaced images we filter the rows ourselves and deflate chunks
+ * of rows on pooled workers, pigz-style. Each chunk is a raw deflate stream
+ * primed with the last 32kb of the chunk before, and all but the last end
+ * on a byte boundary with Z_SYNC_FLUSH, so the chunks simply concatenate.
+ * We add the zlib header and adler32 trailer and write IDATs in order.
+ */
+
+/* Filtered bytes per chunk.
+ */
+#define PNG_CHUNK_SIZE (256 * 1024)
+
+/* The deflate window.
+ */
+#define PNG_WINDOW_SIZE (32 * 1024)
+
+typedef struct _WriteChunk {
+	/* Filtered rows to compress.
+	 */
+	VipsPel *data;
+	size_t length;
+
+	/* Prime the compressor with the end of the previous chunk.
+	 */
+	VipsPel dictionary[PNG_WINDOW_SIZE];
+	size_t dictionary_length;
+
+	int level;
+	int strategy;
+	gboolean first;
+	gboolean last;
+
+	/* Set by the worker. out has space for the zlib header and trailer.
+	 */
+	VipsPel *out;
+	size_t out_length;
+	uLong adler;
+	gboolean error;
+	VipsSemaphore done;
+} WriteChunk;
+
+/* Wait for a chunk to be compressed.
+ */
+static void
+write_chunk_wait( WriteChunk *chunk )
+{
+	vips_semaphore_down( &chunk->done );
+}
+
+static void
+write_chunk_free( WriteChunk *chunk )
+{
+	VIPS_FREE( chunk->data );
+	VIPS_FREE( chunk->out );
+	vips_semaphore_destroy( &chunk->done );
+	g_free( chunk );
+}
+
+static void *
+write_chunk_deflate( void *a )
+{
+	WriteChunk *chunk = (WriteChunk *) a;
+
+	z_stream stream;
+	size_t bound;
+	int offset;
+	int result;
+
+	memset( &stream, 0, sizeof( stream ) );
+	if( deflateInit2( &stream, chunk->level, Z_DEFLATED,
+		-15, 8, chunk->strategy ) != Z_OK ) {
+		chunk->error = TRUE;
+		vips_semaphore_up( &chunk->done );
+
+		return( NULL );
+	}
+
+	if( chunk->dictionary_length )
+		deflateSetDictionary( &stream,
+			chunk->dictionary, chunk->dictionary_length );
+
+	/* Room for the zlib header, the sync flush and the adler32.
+	 */
+	bound = deflateBound( &stream, chunk->length ) + 16;
+	offset = chunk->first ? 2 : 0;
+	if( !(chunk->out = vips_malloc( NULL, offset + bound + 4 )) ) {
+		chunk->error = TRUE;
+		deflateEnd( &stream );
+		vips_semaphore_up( &chunk->done );
+
+		return( NULL );
+	}
+
+	stream.next_in = chunk->data;
+	stream.avail_in = chunk->length;
+	stream.next_out = chunk->out + offset;
+	stream.avail_out = bound;
+	result = deflate( &stream, chunk->last ? Z_FINISH : Z_SYNC_FLUSH );
+	if( result != (chunk->last ? Z_STREAM_END : Z_OK) ||
+		stream.avail_in != 0 )
+		chunk->error = TRUE;
+	chunk->out_length = offset + stream.total_out;
+	deflateEnd( &stream );
+
+	chunk->adler = adler32( adler32( 0L, Z_NULL, 0 ),
+		chunk->data, chunk->length );
+
+	vips_semaphore_up( &chunk->done );
+
+	return( NULL );
+}
+
+/* Write the oldest chunk, waiting for it to be compressed if necessary.
+ */
+static int
+write_chunk_emit( Write *write )
+{
+	WriteChunk *chunk = (WriteChunk *) g_queue_pop_head( &write->chunks );
+
+	write_chunk_wait( chunk );
+	if( chunk->error ) {
+		vips_error( "vips2png", "%s", _( "deflate failed" ) );
+		write_chunk_free( chunk );
+		return( -1 );
+	}
+
+	if( chunk->first ) {
+		int level = chunk->level;
+		int flevel = level < 2 ?
+			0 : (level < 6 ? 1 : (level == 6 ? 2 : 3));
+		unsigned int header = (0x78 << 8) | (flevel << 6);
+
+		header += 31 - (header % 31);
+		chunk->out[0] = header >> 8;
+		chunk->out[1] = header & 0xff;
+	}
+
+	write->adler = chunk->first ?
+		chunk->adler :
+		adler32_combine( write->adler, chunk->adler, chunk->length );
+
+	if( chunk->last ) {
+		VipsPel *q = chunk->out + chunk->out_length;
+
+		q[0] = (write->adler >> 24) & 0xff;
+		q[1] = (write->adler >> 16) & 0xff;
+		q[2] = (write->adler >> 8) & 0xff;
+		q[3] = write->adler & 0xff;
+		chunk->out_length += 4;
+	}
+
+	/* Catch PNG errors from png_write_chunk().
+	 */
+	if( setjmp( png_jmpbuf( write->pPng ) ) ) {
+		write_chunk_free( chunk );
+		return( -1 );
+	}
+
+	png_write_chunk( write->pPng, (png_const_bytep) "IDAT",
+		chunk->out, chunk->out_length );
+
+	write_chunk_free( chunk );
+
+	return( 0 );
+}
+
+static int
+write_chunk_submit( Write *write, gboolean last )
+{
+	WriteChunk *chunk = write->chunk;
+	size_t n = VIPS_MIN( chunk->length, PNG_WINDOW_SIZE );
+
+	write->chunk = NULL;
+	chunk->last = last;
+
+	/* The next chunk is primed with the end of this one.
+	 */
+	memcpy( write->dictionary, chunk->data + chunk->length - n, n );
+	write->dictionary_length = n;
+
+	g_queue_push_tail( &write->chunks, chunk );
+	if( vips__worker_spawn( write_chunk_deflate, chunk ) ) {
+		/* No worker, compress right here.
+		 */
+		vips_error_clear();
+		write_chunk_deflate( chunk );
+	}
+
+	/* Limit the number of chunks in flight.
+	 */
+	while( g_queue_get_length( &write->chunks ) >
+		2 * vips_concurrency_get() )
+		if( write_chunk_emit( write ) )
+			return( -1 );
+
+	return( 0 );
+}
+
+static int
+write_chunk_new( Write *write )
+{
+	WriteChunk *chunk;
+
+	chunk = g_new0( WriteChunk, 1 );
+	vips_semaphore_init( &chunk->done, 0, "done" );
+	chunk->level = write->compress;
+	chunk->strategy = write->filter == VIPS_FOREIGN_PNG_FILTER_NONE ?
+		Z_DEFAULT_STRATEGY : Z_FILTERED;
+	chunk->first = write->y == 0;
+	memcpy( chunk->dictionary, write->dictionary,
+		write->dictionary_length );
+	chunk->dictionary_length = write->dictionary_length;
+	if( !(chunk->data = vips_malloc( NULL,
+		write->rows_per_chunk * (1 + write->rowbytes) )) ) {
+		write_chunk_free( chunk );
+		return( -1 );
+	}
+	write->chunk = chunk;
+
+	return( 0 );
+}
+
+static int
+write_paeth( int a, int b, int c )
+{
+	int p = b - c;
+	int q = a - c;
+	int pa = abs( p );
+	int pb = abs( q );
+	int pc = abs( p + q );
+
+	if( pa <= pb &&
+		pa <= pc )
+		return( a );
+	else if( pb <= pc )
+		return( b );
+	else
+		return( c );
+}
+
+/* Filter @row with @type into @q. Only every @step bytes-per-pixel are
+ * visited, and we return the sum of the absolute values of the residuals,
+ * as libpng's heuristic does.
+ */
+static int
+write_filter_row( Write *write, int type,
+	VipsPel *row, VipsPel *prev, VipsPel *q, int step )
+{
+	int bpp = write->bpp;
+	int rowbytes = write->rowbytes;
+
+	int sum;
+	int i, j;
+
+	sum = 0;
+	for( i = 0; i < rowbytes; i += step * bpp )
+		for( j = i; j < i + bpp; j++ ) {
+			int x = row[j];
+			int a = j >= bpp ? row[j - bpp] : 0;
+			int b = prev[j];
+			int c = j >= bpp ? prev[j - bpp] : 0;
+
+			VipsPel r;
+
+			switch( type ) {
+			case PNG_FILTER_VALUE_SUB:
+				r = x - a;
+				break;
+
+			case PNG_FILTER_VALUE_UP:
+				r = x - b;
+				break;
+
+			case PNG_FILTER_VALUE_AVG:
+				r = x - ((a + b) >> 1);
+				break;
+
+			case PNG_FILTER_VALUE_PAETH:
+				r = x - write_paeth( a, b, c );
+				break;
+
+			case PNG_FILTER_VALUE_NONE:
+			default:
+				r = x;
+				break;
+			}
+
+			if( q )
+				q[j] = r;
+			sum += r < 128 ? r : 256 - r;
+		}
+
+	return( sum );
+}
+
+/* Pick a filter by trying each allowed type on every 4th pixel, then filter
+ * the whole row with it. This is much cheaper than libpng's exhaustive
+ * search, and picks the same filter almost all the time.
+ */
+static void
+write_filter( Write *write, VipsPel *row, VipsPel *prev, VipsPel *q )
+{
+	static const int masks[] = {
+		VIPS_FOREIGN_PNG_FILTER_NONE,
+		VIPS_FOREIGN_PNG_FILTER_SUB,
+		VIPS_FOREIGN_PNG_FILTER_UP,
+		VIPS_FOREIGN_PNG_FILTER_AVG,
+		VIPS_FOREIGN_PNG_FILTER_PAETH
+	};
+
+	int best;
+	int n;
+	int i;
+
+	best = PNG_FILTER_VALUE_NONE;
+	n = 0;
+	for( i = 0; i < VIPS_NUMBER( masks ); i++ )
+		if( write->filter & masks[i] ) {
+			best = i;
+			n += 1;
+		}
+
+	if( n > 1 ) {
+		int best_sum;
+
+		best_sum = INT_MAX;
+		for( i = 0; i < VIPS_NUMBER( masks ); i++ )
+			if( write->filter & masks[i] ) {
+				int sum = write_filter_row( write,
+					i, row, prev, NULL, 4 );
+
+				if( sum < best_sum ) {
+					best = i;
+					best_sum = sum;
+				}
+			}
+	}
+
+	q[0] = best;
+	write_filter_row( write, best, row, prev, q + 1, 1 );
+}
+
+static int
+write_png_block_parallel( VipsRegion *region, VipsRect *area, void *a )
+{
+	Write *write = (Write *) a;
+	VipsImage *in = region->im;
+
+	int i, x;
+
+	g_assert( area->left == 0 );
+	g_assert( area->width == in->Xsize );
+	g_assert( area->top + area->height <= in->Ysize );
+
+	for( i = 0; i < area->height; i++ ) {
+		VipsPel *p = VIPS_REGION_ADDR( region, 0, area->top + i );
+		VipsPel *row;
+
+		if( !write->chunk &&
+			write_chunk_new( write ) )
+			return( -1 );
+
+		/* PNG is always big-endian.
+		 */
+		if( in->BandFmt == VIPS_FORMAT_USHORT &&
+			!vips_amiMSBfirst() ) {
+			for( x = 0; x < write->rowbytes; x += 2 ) {
+				write->row[x] = p[x + 1];
+				write->row[x + 1] = p[x];
+			}
+			row = write->row;
+		}
+		else
+			row = p;
+
+		write_filter( write, row, write->prev,
+			write->chunk->data + write->chunk->length );
+		write->chunk->length += 1 + write->rowbytes;
+		memcpy( write->prev, row, write->rowbytes );
+		write->y += 1;
+
+		if( write->y == in->Ysize ||
+			write->chunk->length >= write->rows_per_chunk *
+				(1 + write->rowbytes) ) {
+			if( write_chunk_submit( write, write->y == in->Ysize ) )
+				return( -1 );
+		}
+	}
+
+	return( 0 );
+}
+
+/* Can we use the parallel deflate path?
+ */
+static gboolean
+write_parallel_init( Write *write, VipsImage *in,
+	int compress, int interlace, VipsForeignPngFilter filter )
+{
+	size_t rowbytes = VIPS_IMAGE_SIZEOF_LINE( in );
+
+	if( interlace ||
+		vips_concurrency_get() < 2 ||
+		(1 + rowbytes) * in->Ysize <= PNG_CHUNK_SIZE )
+		return( FALSE );
+
+	write->compress = compress;
+	write->filter = filter;
+	write->bpp = VIPS_IMAGE_SIZEOF_PEL( in );
+	write->rowbytes = rowbytes;
+	write->rows_per_chunk = VIPS_MAX( 1, PNG_CHUNK_SIZE / (1 + rowbytes) );
+	if( !(write->row = VIPS_ARRAY( in, rowbytes, VipsPel )) ||
+		!(write->prev = VIPS_ARRAY( in, rowbytes, VipsPel )) ||
+		!(write->dictionary =
+			VIPS_ARRAY( in, PNG_WINDOW_SIZE, VipsPel )) ) {
+		vips_error_clear();
+		return( FALSE );
+	}
+
+	/* The row before the first is zero, see the PNG spec.
+	 */
+	memset( write->prev, 0, rowbytes );
+
+	return( TRUE );
+}
+
+#endif /*HAVE_ZLIB*/
+
 /* Write a VIPS image to PNG.
  */
 static int
@@ -920,6 +1774,11 @@ write_vips( Write *write,
 		return( -1 );
 	}
 
+#ifdef HAVE_ZLIB
+	write->parallel = write_parallel_init( write, in,
+		compress, interlace, filter );
+#endif /*HAVE_ZLIB*/
+
 	/* Set compression parameters.
 	 */
 	png_set_compression_level( write->pPng, compress );
@@ -1010,6 +1869,29 @@ write_vips( Write *write,
 
 	/* Write data.
 	 */
+#ifdef HAVE_ZLIB
+	if( write->parallel ) {
+		if( vips_sink_disc( in, write_png_block_parallel, write ) )
+			return( -1 );
+
+		while( !g_queue_is_empty( &write->chunks ) )
+			if( write_chunk_emit( write ) )
+				return( -1 );
+
+		/* We've written the IDATs behind libpng's back, so
+		 * png_write_end() would fail. There's nothing after IDAT,
+		 * so just add the IEND.
+		 */
+		if( setjmp( png_jmpbuf( write->pPng ) ) )
+			return( -1 );
+
+		png_write_chunk( write->pPng, (png_const_bytep) "IEND",
+			NULL, 0 );
+
+		return( 0 );
+	}
+#endif /*HAVE_ZLIB*/
+
 	for( i = 0; i < nb_passes; i++ ) 
 		if( vips_sink_disc( in, write_png_block, write ) )
 			return( -1 );
@@ -1068,7 +1950,8 @@ user_write_data( png_structp png_ptr, png_bytep data, png_size_t length )
 {
 	Write *write = (Write *) png_get_io_ptr( png_ptr );
 
-	vips_dbuf_write( &write->dbuf, data, length ); 
+	if( !vips_cbuf_write( &write->cbuf, data, length ) )
+		png_error( png_ptr, "not enough memory" );
 }
 
 int
@@ -1093,7 +1976,47 @@ vips__png_write_buf( VipsImage *in,
 		return( -1 );
 	}
 
-	*obuf = vips_dbuf_steal( &write->dbuf, olen );
+	if( !(*obuf = vips_cbuf_steal( &write->cbuf, olen )) ) {
+		write_finish( write );
+		return( -1 );
+	}
+
+	write_finish( write );
+
+	return( 0 );
+}
+
+static void
+user_write_target( png_structp png_ptr, png_bytep data, png_size_t length )
+{
+	Write *write = (Write *) png_get_io_ptr( png_ptr );
+
+	if( vips_target_write( write->target, data, length ) )
+		png_error( png_ptr, "unable to write to target" );
+}
+
+int
+vips__png_write_target( VipsImage *in, VipsTarget *target,
+	int compression, int interlace,
+	const char *profile, VipsForeignPngFilter filter, gboolean strip )
+{
+	Write *write;
+
+	if( !(write = write_new( in )) )
+		return( -1 );
+
+	write->target = target;
+	png_set_write_fn( write->pPng, write, user_write_target, NULL );
+
+	/* Convert it!
+	 */
+	if( write_vips( write,
+		compression, interlace, profile, filter, strip ) ) {
+		vips_error( "vips2png",
+			"%s", _( "unable to write to target" ) );
+
+		return( -1 );
+	}
 
 	write_finish( write );
 
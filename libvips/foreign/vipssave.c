@@ -1,6 +1,8 @@
 /* save to vips
  *
  * 24/11/11
+ * 14/10/18
+ * 	- add tile, tile_width, tile_height
  */
 
 /*
@@ -53,6 +55,12 @@ typedef struct _VipsForeignSaveVips {
 
 	char *filename;
 
+	/* Write a tiled layout with tiles this size.
+	 */
+	gboolean tile;
+	int tile_width;
+	int tile_height;
+
 } VipsForeignSaveVips;
 
 typedef VipsForeignSaveClass VipsForeignSaveVipsClass;
@@ -72,6 +80,10 @@ vips_foreign_save_vips_build( VipsObject *object )
 		build( object ) )
 		return( -1 );
 
+	if( vips->tile )
+		return( vips__write_tiled( save->ready, vips->filename,
+			vips->tile_width, vips->tile_height ) );
+
 	if( !(x = vips_image_new_mode( vips->filename, "w" )) )
 		return( -1 );
 	if( vips_image_write( save->ready, x ) ) {
@@ -116,11 +128,34 @@ vips_foreign_save_vips_class_init( VipsForeignSaveVipsClass *class )
 		VIPS_ARGUMENT_REQUIRED_INPUT, 
 		G_STRUCT_OFFSET( VipsForeignSaveVips, filename ),
 		NULL );
+
+	VIPS_ARG_BOOL( class, "tile", 10,
+		_( "Tile" ),
+		_( "Write a tiled layout" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsForeignSaveVips, tile ),
+		FALSE );
+
+	VIPS_ARG_INT( class, "tile_width", 11,
+		_( "Tile width" ),
+		_( "Tile width in pixels" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsForeignSaveVips, tile_width ),
+		1, 32768, 128 );
+
+	VIPS_ARG_INT( class, "tile_height", 12,
+		_( "Tile height" ),
+		_( "Tile height in pixels" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsForeignSaveVips, tile_height ),
+		1, 32768, 128 );
 }
 
 static void
 vips_foreign_save_vips_init( VipsForeignSaveVips *vips )
 {
+	vips->tile_width = 128;
+	vips->tile_height = 128;
 }
 
 /**
@@ -129,8 +164,21 @@ vips_foreign_save_vips_init( VipsForeignSaveVips *vips )
  * @filename: file to write to 
  * @...: %NULL-terminated list of optional named arguments
  *
+ * Optional arguments:
+ *
+ * * @tile: %gboolean, write a tiled layout
+ * * @tile_width: %gint for tile size
+ * * @tile_height: %gint for tile size
+ *
  * Write @in to @filename in VIPS format.
  *
+ * Set @tile to write pixels as a set of uncompressed tiles of
+ * @tile_width by @tile_height pixels, each starting on a page boundary,
+ * plus an index. Readers only map the tiles an area needs, which makes
+ * random access to very wide images much cheaper. Tiled files can't be
+ * opened for in-place modification, and need this version of libvips or
+ * later to read.
+ *
  * See also: vips_vipsload().
  *
  * Returns: 0 on success, -1 on error.
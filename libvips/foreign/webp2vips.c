@@ -10,6 +10,11 @@
  * 	- support XMP/ICC/EXIF metadata
  * 18/10/17
  * 	- sniff file type from magic number
+ * 14/10/18
+ * 	- decode incrementally with WebPIDecoder as regions are requested
+ * 15/10/18
+ * 	- map files with vips__mmap_file(), with a read-ahead hint, and fall
+ * 	  back to reading the file into memory for pipes
  */
 
 /*
@@ -64,6 +69,10 @@
 
 #include "pforeign.h"
 
+/* Feed compressed data to the incremental decoder in chunks this size.
+ */
+#define WEBP_CHUNK_SIZE (64 * 1024)
+
 /* What we track during a read.
  */
 typedef struct {
@@ -71,8 +80,8 @@ typedef struct {
 	 */
 	char *filename;
 
-	/* Memory source. We use gint64 rather than size_t since we use
-	 * vips_file_length() and vips__mmap() for file sources.
+	/* Memory source. We use gint64 rather than size_t since we count 
+	 * bytes fed to the decoder with it.
 	 */
 	const void *data;
 	gint64 length;
@@ -86,9 +95,11 @@ typedef struct {
 	int width;
 	int height;
 
-	/* If we are opening a file object, the fd.
+	/* For file sources, the map of the file, or if we can't map it, the
+	 * file read into memory.
 	 */
-	int fd;
+	void *mapped;
+	void *data_owned;
 
 	/* Decoder config.
 	 */
@@ -97,6 +108,10 @@ typedef struct {
 	/* Incremental decoder state.
 	 */
 	WebPIDecoder *idec;
+
+	/* The number of bytes of data we have passed to idec so far.
+	 */
+	gint64 fed;
 } Read;
 
 int
@@ -132,15 +147,12 @@ read_free( Read *read )
 	VIPS_FREEF( WebPIDelete, read->idec );
 	WebPFreeDecBuffer( &read->config.output );
 
-	if( read->fd > 0 &&
-		read->data &&
-		read->length > 0 ) { 
-		vips__munmap( read->data, read->length ); 
-		read->data = NULL;
-		read->length = 0;
+	if( read->mapped ) { 
+		vips__munmap( read->mapped, read->length ); 
+		read->mapped = NULL;
 	}
 
-	VIPS_FREEF( vips_tracked_close, read->fd ); 
+	VIPS_FREE( read->data_owned ); 
 	VIPS_FREE( read->filename );
 	VIPS_FREE( read );
 
@@ -159,22 +171,30 @@ read_new( const char *filename, const void *data, size_t length, int shrink )
 	read->data = data;
 	read->length = length;
 	read->shrink = shrink;
-	read->fd = 0;
+	read->mapped = NULL;
+	read->data_owned = NULL;
 	read->idec = NULL;
+	read->fed = 0;
 
 	if( read->filename ) { 
-		/* libwebp makes streaming from a file source very hard. We 
-		 * have to read to a full memory buffer, then copy to out.
-		 *
-		 * mmap the input file, it's slightly quicker.
+		size_t file_length;
+
+		/* mmap the input file, then feed it to the incremental
+		 * decoder a chunk at a time as pixels are needed. If we can't
+		 * map it, for example for a pipe, read it into memory.
 		 */
-		if( (read->fd = vips__open_image_read( read->filename )) < 0 ||
-			(read->length = vips_file_length( read->fd )) < 0 ||
-			!(read->data = vips__mmap( read->fd, 
-				FALSE, read->length, 0 )) ) {
+		if( (read->mapped = 
+			vips__mmap_file( read->filename, &file_length )) ) 
+			read->data = read->mapped;
+		else if( (read->data_owned = vips__file_read_name( 
+			read->filename, NULL, &file_length )) )
+			read->data = read->data_owned;
+		else {
 			read_free( read );
 			return( NULL );
 		}
+
+		read->length = file_length;
 	}
 
 	WebPInitDecoderConfig( &read->config );
@@ -197,6 +217,7 @@ read_new( const char *filename, const void *data, size_t length, int shrink )
 	if( read->width == 0 ||
 		read->height == 0 ) {
 		vips_error( "webp", "%s", _( "bad setting for shrink" ) ); 
+		read_free( read );
 		return( NULL ); 
 	}
 
@@ -296,30 +317,100 @@ vips__webp_read_file_header( const char *filename, VipsImage *out, int shrink )
 	return( 0 );
 }
 
+/* Feed the next chunk of compressed data to the decoder.
+ */
 static int
-read_image( Read *read, VipsImage *out )
+read_update( Read *read )
 {
-	VipsImage **t = (VipsImage **) 
-		vips_object_local_array( VIPS_OBJECT( out ), 3 );
+	VP8StatusCode status;
 
-	t[0] = vips_image_new_memory();
-	if( read_header( read, t[0] ) )
+	if( read->fed >= read->length ) {
+		vips_error( "webp2vips", "%s", _( "truncated webp image" ) );
 		return( -1 );
-	if( vips_image_write_prepare( t[0] ) ) 
+	}
+
+	read->fed = VIPS_MIN( read->length, read->fed + WEBP_CHUNK_SIZE );
+	status = WebPIUpdate( read->idec,
+		(const uint8_t *) read->data, read->fed );
+	if( status != VP8_STATUS_OK &&
+		status != VP8_STATUS_SUSPENDED ) {
+		vips_error( "webp2vips", "%s", _( "unable to read pixels" ) );
 		return( -1 );
+	}
+
+	return( 0 );
+}
+
+static int
+read_webp_generate( VipsRegion *or,
+	void *seq, void *a, void *b, gboolean *stop )
+{
+        VipsRect *r = &or->valid;
+	Read *read = (Read *) a;
+	int sizeof_pel = VIPS_IMAGE_SIZEOF_PEL( or->im );
+
+	uint8_t *rgb;
+	int last_y;
+	int width;
+	int height;
+	int stride;
+	int y;
+
+	/* The decoder writes whole lines to its output buffer as
+	 * macroblock rows complete. Keep feeding it until it has finished
+	 * all the lines we need.
+	 */
+	for(;;) {
+		rgb = WebPIDecGetRGB( read->idec,
+			&last_y, &width, &height, &stride );
+		if( rgb &&
+			last_y >= VIPS_RECT_BOTTOM( r ) )
+			break;
+
+		if( read_update( read ) )
+			return( -1 );
+	}
+
+	for( y = 0; y < r->height; y++ )
+		memcpy( VIPS_REGION_ADDR( or, r->left, r->top + y ),
+			rgb + (r->top + y) * stride + r->left * sizeof_pel,
+			r->width * sizeof_pel );
+
+	return( 0 );
+}
 
-	read->config.output.u.RGBA.rgba = VIPS_IMAGE_ADDR( t[0], 0, 0 );
-	read->config.output.u.RGBA.stride = VIPS_IMAGE_SIZEOF_LINE( t[0] );
-	read->config.output.u.RGBA.size = VIPS_IMAGE_SIZEOF_IMAGE( t[0] );
-	read->config.output.is_external_memory = 1;
+static void
+read_close_cb( VipsImage *image, Read *read )
+{
+	read_free( read );
+}
 
-	if( WebPDecode( (uint8_t *) read->data, read->length, 
-		&read->config) != VP8_STATUS_OK ) {
-		vips_error( "webp2vips", "%s", _( "unable to read pixels" ) ); 
+static int
+read_image( Read *read, VipsImage *out )
+{
+	VipsImage **t = (VipsImage **)
+		vips_object_local_array( VIPS_OBJECT( out ), 2 );
+
+	g_signal_connect( out, "close",
+		G_CALLBACK( read_close_cb ), read );
+
+	/* libwebp allocates the output buffer for us. Features were parsed
+	 * in read_new(), so start with no data and feed it in
+	 * read_webp_generate().
+	 */
+	if( !(read->idec = WebPIDecode( NULL, 0, &read->config )) ) {
+		vips_error( "webp2vips", "%s", _( "unable to start decoder" ) );
 		return( -1 );
 	}
 
-	if( vips_image_write( t[0], out ) )
+	t[0] = vips_image_new();
+	if( read_header( read, t[0] ) )
+		return( -1 );
+
+	if( vips_image_generate( t[0],
+		NULL, read_webp_generate, NULL, read, NULL ) ||
+		vips_sequential( t[0], &t[1], NULL ) ||
+		vips_image_write( t[1], out ) )
 		return( -1 );
 
 	return( 0 );
@@ -336,11 +427,11 @@ vips__webp_read_file( const char *filename, VipsImage *out, int shrink )
 		return( -1 );
 	}
 
+	/* read is freed when out closes.
+	 */
 	if( read_image( read, out ) )
 		return( -1 );
 
-	read_free( read );
-
 	return( 0 );
 }
 
@@ -381,8 +472,6 @@ vips__webp_read_buffer( const void *buf, size_t len, VipsImage *out,
 	if( read_image( read, out ) )
 		return( -1 );
 
-	read_free( read );
-
 	return( 0 );
 }
 
@@ -4,6 +4,11 @@
  * 	- from pngload.c
  * 28/2/16
  * 	- add @shrink
+ * 14/10/18
+ * 	- now sequential
+ * 	- add webpload_source
+ * 15/10/18
+ * 	- add ->header_filename() for vips_foreign_probe()
  */
 
 /*
@@ -67,7 +72,7 @@ G_DEFINE_ABSTRACT_TYPE( VipsForeignLoadWebp, vips_foreign_load_webp,
 static VipsForeignFlags
 vips_foreign_load_webp_get_flags( VipsForeignLoad *load )
 {
-	return( 0 );
+	return( VIPS_FOREIGN_SEQUENTIAL );
 }
 
 static int
@@ -128,7 +133,7 @@ G_DEFINE_TYPE( VipsForeignLoadWebpFile, vips_foreign_load_webp_file,
 static VipsForeignFlags
 vips_foreign_load_webp_file_get_flags_filename( const char *filename )
 {
-	return( 0 );
+	return( VIPS_FOREIGN_SEQUENTIAL );
 }
 
 static gboolean
@@ -152,6 +157,13 @@ vips_foreign_load_webp_file_header( VipsForeignLoad *load )
 	return( 0 );
 }
 
+static int
+vips_foreign_load_webp_file_header_filename( const char *filename, 
+	VipsImage *out )
+{
+	return( vips__webp_read_file_header( filename, out, 1 ) );
+}
+
 static int
 vips_foreign_load_webp_file_load( VipsForeignLoad *load )
 {
@@ -186,6 +198,8 @@ vips_foreign_load_webp_file_class_init( VipsForeignLoadWebpFileClass *class )
 		vips_foreign_load_webp_file_get_flags_filename;
 	load_class->is_a = vips_foreign_load_webp_file_is_a;
 	load_class->header = vips_foreign_load_webp_file_header;
+	load_class->header_filename = 
+		vips_foreign_load_webp_file_header_filename;
 	load_class->load = vips_foreign_load_webp_file_load;
 
 	VIPS_ARG_STRING( class, "filename", 1, 
@@ -277,6 +291,106 @@ vips_foreign_load_webp_buffer_init( VipsForeignLoadWebpBuffer *buffer )
 {
 }
 
+typedef struct _VipsForeignLoadWebpSource {
+	VipsForeignLoadWebp parent_object;
+
+	/* Load from a source.
+	 */
+	VipsSource *source;
+
+} VipsForeignLoadWebpSource;
+
+typedef VipsForeignLoadWebpClass VipsForeignLoadWebpSourceClass;
+
+G_DEFINE_TYPE( VipsForeignLoadWebpSource, vips_foreign_load_webp_source,
+	vips_foreign_load_webp_get_type() );
+
+/* libwebp wants the metadata chunks, and they can come after the image
+ * data, so we map the whole source and use the buffer reader.
+ */
+static int
+vips_foreign_load_webp_source_header( VipsForeignLoad *load )
+{
+	VipsForeignLoadWebp *webp = (VipsForeignLoadWebp *) load;
+	VipsForeignLoadWebpSource *source = (VipsForeignLoadWebpSource *) load;
+
+	const void *data;
+	size_t length;
+
+	if( !(data = vips_source_map( source->source, &length )) ||
+		vips__webp_read_buffer_header( data, length,
+			load->out, webp->shrink ) )
+		return( -1 );
+
+	return( 0 );
+}
+
+static int
+vips_foreign_load_webp_source_load( VipsForeignLoad *load )
+{
+	VipsForeignLoadWebp *webp = (VipsForeignLoadWebp *) load;
+	VipsForeignLoadWebpSource *source = (VipsForeignLoadWebpSource *) load;
+
+	const void *data;
+	size_t length;
+
+	if( !(data = vips_source_map( source->source, &length )) ||
+		vips__webp_read_buffer( data, length,
+			load->real, webp->shrink ) )
+		return( -1 );
+
+	/* Decode is incremental, so the mapped bytes must live as long as
+	 * the image.
+	 */
+	g_object_ref( source->source );
+	vips_object_local( load->real, source->source );
+
+	return( 0 );
+}
+
+static gboolean
+vips_foreign_load_webp_source_is_a( VipsSource *source )
+{
+	unsigned char *data;
+
+	return( (data = vips_source_sniff( source, 12 )) &&
+		vips__iswebp_buffer( data, 12 ) );
+}
+
+static void
+vips_foreign_load_webp_source_class_init(
+	VipsForeignLoadWebpSourceClass *class )
+{
+	GObjectClass *gobject_class = G_OBJECT_CLASS( class );
+	VipsObjectClass *object_class = (VipsObjectClass *) class;
+	VipsForeignClass *foreign_class = (VipsForeignClass *) class;
+	VipsForeignLoadClass *load_class = (VipsForeignLoadClass *) class;
+
+	gobject_class->set_property = vips_object_set_property;
+	gobject_class->get_property = vips_object_get_property;
+
+	object_class->nickname = "webpload_source";
+	object_class->description = _( "load webp from source" );
+
+	foreign_class->priority = -50;
+
+	load_class->is_a_source = vips_foreign_load_webp_source_is_a;
+	load_class->header = vips_foreign_load_webp_source_header;
+	load_class->load = vips_foreign_load_webp_source_load;
+
+	VIPS_ARG_OBJECT( class, "source", 1,
+		_( "Source" ),
+		_( "Source to load from" ),
+		VIPS_ARGUMENT_REQUIRED_INPUT,
+		G_STRUCT_OFFSET( VipsForeignLoadWebpSource, source ),
+		VIPS_TYPE_SOURCE );
+}
+
+static void
+vips_foreign_load_webp_source_init( VipsForeignLoadWebpSource *source )
+{
+}
+
 #endif /*HAVE_LIBWEBP*/
 
 /**
@@ -353,3 +467,34 @@ vips_webpload_buffer( void *buf, size_t len, VipsImage **out, ... )
 
 	return( result );
 }
+
+/**
+ * vips_webpload_source:
+ * @source: source to load from
+ * @out: (out): image to write
+ * @...: %NULL-terminated list of optional named arguments
+ *
+ * Optional arguments:
+ *
+ * * @shrink: %gint, shrink by this much on load
+ *
+ * Exactly as vips_webpload(), but read from a #VipsSource. WebP keeps
+ * metadata after the image data, so the whole source is read to memory
+ * first.
+ *
+ * See also: vips_webpload(), vips_image_new_from_source().
+ *
+ * Returns: 0 on success, -1 on error.
+ */
+int
+vips_webpload_source( VipsSource *source, VipsImage **out, ... )
+{
+	va_list ap;
+	int result;
+
+	va_start( ap, out );
+	result = vips_call_split( "webpload_source", ap, source, out );
+	va_end( ap );
+
+	return( result );
+}
@@ -2,6 +2,9 @@
  *
  * 24/11/11
  * 	- wrap a class around the webp writer
+ * 14/10/18
+ * 	- add @reduction_effort
+ * 	- add webpsave_target
  */
 
 /*
@@ -76,6 +79,10 @@ typedef struct _VipsForeignSaveWebp {
 	 */
 	int alpha_q;
 
+	/* Level of CPU effort to reduce file size, 0 - 6.
+	 */
+	int reduction_effort;
+
 } VipsForeignSaveWebp;
 
 typedef VipsForeignSaveClass VipsForeignSaveWebpClass;
@@ -154,6 +161,13 @@ vips_foreign_save_webp_class_init( VipsForeignSaveWebpClass *class )
 		G_STRUCT_OFFSET( VipsForeignSaveWebp, alpha_q ),
 		0, 100, 100 );
 
+	VIPS_ARG_INT( class, "reduction_effort", 16,
+		_( "Reduction effort" ),
+		_( "Level of CPU effort to reduce file size" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsForeignSaveWebp, reduction_effort ),
+		0, 6, 4 );
+
 }
 
 static void
@@ -161,6 +175,7 @@ vips_foreign_save_webp_init( VipsForeignSaveWebp *webp )
 {
 	webp->Q = 75;
 	webp->alpha_q = 100;
+	webp->reduction_effort = 4;
 }
 
 typedef struct _VipsForeignSaveWebpFile {
@@ -191,7 +206,7 @@ vips_foreign_save_webp_file_build( VipsObject *object )
 	if( vips__webp_write_file( save->ready, file->filename, 
 		webp->Q, webp->lossless, webp->preset,
 		webp->smart_subsample, webp->near_lossless,
-		webp->alpha_q, save->strip ) )
+		webp->alpha_q, webp->reduction_effort, save->strip ) )
 		return( -1 );
 
 	return( 0 );
@@ -255,7 +270,7 @@ vips_foreign_save_webp_buffer_build( VipsObject *object )
 	if( vips__webp_write_buffer( save->ready, &obuf, &olen, 
 		webp->Q, webp->lossless, webp->preset,
 		webp->smart_subsample, webp->near_lossless,
-		webp->alpha_q, save->strip ) )
+		webp->alpha_q, webp->reduction_effort, save->strip ) )
 		return( -1 );
 
 	/* obuf is a g_free() buffer, not vips_free().
@@ -294,6 +309,83 @@ vips_foreign_save_webp_buffer_init( VipsForeignSaveWebpBuffer *file )
 {
 }
 
+typedef struct _VipsForeignSaveWebpTarget {
+	VipsForeignSaveWebp parent_object;
+
+	/* Save to a target.
+	 */
+	VipsTarget *target;
+
+} VipsForeignSaveWebpTarget;
+
+typedef VipsForeignSaveWebpClass VipsForeignSaveWebpTargetClass;
+
+G_DEFINE_TYPE( VipsForeignSaveWebpTarget, vips_foreign_save_webp_target,
+	vips_foreign_save_webp_get_type() );
+
+static int
+vips_foreign_save_webp_target_build( VipsObject *object )
+{
+	VipsForeignSave *save = (VipsForeignSave *) object;
+	VipsForeignSaveWebp *webp = (VipsForeignSaveWebp *) object;
+	VipsForeignSaveWebpTarget *target =
+		(VipsForeignSaveWebpTarget *) object;
+
+	void *obuf;
+	size_t olen;
+
+	if( VIPS_OBJECT_CLASS( vips_foreign_save_webp_target_parent_class )->
+		build( object ) )
+		return( -1 );
+
+	/* libwebp encodes the whole image before it writes anything, so we
+	 * can't avoid making the compressed image in memory.
+	 */
+	if( vips__webp_write_buffer( save->ready, &obuf, &olen,
+		webp->Q, webp->lossless, webp->preset,
+		webp->smart_subsample, webp->near_lossless,
+		webp->alpha_q, webp->reduction_effort, save->strip ) )
+		return( -1 );
+
+	if( vips_target_write( target->target, obuf, olen ) ) {
+		g_free( obuf );
+		return( -1 );
+	}
+	g_free( obuf );
+
+	if( vips_target_finish( target->target ) )
+		return( -1 );
+
+	return( 0 );
+}
+
+static void
+vips_foreign_save_webp_target_class_init(
+	VipsForeignSaveWebpTargetClass *class )
+{
+	GObjectClass *gobject_class = G_OBJECT_CLASS( class );
+	VipsObjectClass *object_class = (VipsObjectClass *) class;
+
+	gobject_class->set_property = vips_object_set_property;
+	gobject_class->get_property = vips_object_get_property;
+
+	object_class->nickname = "webpsave_target";
+	object_class->description = _( "save image to webp target" );
+	object_class->build = vips_foreign_save_webp_target_build;
+
+	VIPS_ARG_OBJECT( class, "target", 1,
+		_( "Target" ),
+		_( "Target to save to" ),
+		VIPS_ARGUMENT_REQUIRED_INPUT,
+		G_STRUCT_OFFSET( VipsForeignSaveWebpTarget, target ),
+		VIPS_TYPE_TARGET );
+}
+
+static void
+vips_foreign_save_webp_target_init( VipsForeignSaveWebpTarget *target )
+{
+}
+
 typedef struct _VipsForeignSaveWebpMime {
 	VipsForeignSaveWebp parent_object;
 
@@ -320,7 +412,7 @@ vips_foreign_save_webp_mime_build( VipsObject *object )
 	if( vips__webp_write_buffer( save->ready, &obuf, &olen, 
 		webp->Q, webp->lossless, webp->preset,
 		webp->smart_subsample, webp->near_lossless,
-		webp->alpha_q, save->strip ) )
+		webp->alpha_q, webp->reduction_effort, save->strip ) )
 		return( -1 );
 
 	printf( "Content-length: %zu\r\n", olen );
@@ -369,6 +461,7 @@ vips_foreign_save_webp_mime_init( VipsForeignSaveWebpMime *mime )
  * * @smart_subsample: %gboolean, enables high quality chroma subsampling
  * * @near_lossless: %gboolean, preprocess in lossless mode (controlled by Q)
  * * @alpha_q: %gint, set alpha quality in lossless mode
+ * * @reduction_effort: %gint, level of CPU effort to reduce file size
  * * @strip: %gboolean, remove all metadata from image
  *
  * Write an image to a file in WebP format. 
@@ -387,6 +480,9 @@ vips_foreign_save_webp_mime_init( VipsForeignSaveWebpMime *mime )
  * with @Q 80, 60, 40 or 20 to apply increasing amounts of preprocessing
  * which improves the near-lossless compression ratio by up to 50%.
  *
+ * Use @reduction_effort to trade CPU time for file size. It has the range
+ * 0 - 6, with the default 4. 0 is fastest, 6 gives the smallest files.
+ *
  * The writer will attach ICC, EXIF and XMP metadata, unless @strip is set to
  * %TRUE. 
  *
@@ -422,6 +518,7 @@ vips_webpsave( VipsImage *in, const char *filename, ... )
  * * @smart_subsample: %gboolean, enables high quality chroma subsampling
  * * @near_lossless: %gboolean, preprocess in lossless mode (controlled by Q)
  * * @alpha_q: %gint, set alpha quality in lossless mode
+ * * @reduction_effort: %gint, level of CPU effort to reduce file size
  * * @strip: %gboolean, remove all metadata from image
  *
  * As vips_webpsave(), but save to a memory buffer.
@@ -462,6 +559,42 @@ vips_webpsave_buffer( VipsImage *in, void **buf, size_t *len, ... )
 	return( result );
 }
 
+/**
+ * vips_webpsave_target: (method)
+ * @in: image to save
+ * @target: save image to this target
+ * @...: %NULL-terminated list of optional named arguments
+ *
+ * Optional arguments:
+ *
+ * * @Q: %gint, quality factor
+ * * @lossless: %gboolean, enables lossless compression
+ * * @preset: #VipsForeignWebpPreset, choose lossy compression preset
+ * * @smart_subsample: %gboolean, enables high quality chroma subsampling
+ * * @near_lossless: %gboolean, preprocess in lossless mode (controlled by Q)
+ * * @alpha_q: %gint, set alpha quality in lossless mode
+ * * @reduction_effort: %gint, level of CPU effort to reduce file size
+ * * @strip: %gboolean, remove all metadata from image
+ *
+ * As vips_webpsave(), but save to a target.
+ *
+ * See also: vips_webpsave(), vips_image_write_to_target().
+ *
+ * Returns: 0 on success, -1 on error.
+ */
+int
+vips_webpsave_target( VipsImage *in, VipsTarget *target, ... )
+{
+	va_list ap;
+	int result;
+
+	va_start( ap, target );
+	result = vips_call_split( "webpsave_target", ap, in, target );
+	va_end( ap );
+
+	return( result );
+}
+
 /**
  * vips_webpsave_mime: (method)
  * @in: image to save 
@@ -475,6 +608,7 @@ vips_webpsave_buffer( VipsImage *in, void **buf, size_t *len, ... )
  * * @smart_subsample: %gboolean, enables high quality chroma subsampling
  * * @near_lossless: %gboolean, preprocess in lossless mode (controlled by Q)
  * * @alpha_q: %gint, set alpha quality in lossless mode
+ * * @reduction_effort: %gint, level of CPU effort to reduce file size
  * * @strip: %gboolean, remove all metadata from image
  *
  * As vips_webpsave(), but save as a mime webp on stdout.
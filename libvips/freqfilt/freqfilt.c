@@ -2,6 +2,10 @@
  *
  * properties:
  * 	- single output image
+ *
+ * 14/10/18
+ * 	- add a process-wide fftw plan cache, with wisdom and threaded plans
+ * 	- add vips__fft_plan() so convfft can share the cache and the lock
  */
 
 /*
@@ -155,6 +159,317 @@ vips__fftproc( VipsObject *context,
 	return( 0 );
 }
 
+#ifdef HAVE_FFTW
+
+/* Plans are slow to make, especially with FFTW_MEASURE, so we keep them in
+ * a process-wide cache. We drop unused plans when the cache gets larger
+ * than this.
+ */
+#define VIPS_FFT_PLAN_MAX (100)
+
+/* A cached plan. Plans depend on the transform and the size, on whether
+ * it's in place, on the alignment of the buffers it will run on, and on
+ * the number of threads.
+ */
+struct _VipsFftPlan {
+	VipsFftKind kind;
+	int width;
+	int height;
+	gboolean in_place;
+	int in_align;
+	int out_align;
+	int n_threads;
+
+	fftw_plan plan;
+
+	/* Number of active users. We can only destroy a plan when this is
+	 * zero.
+	 */
+	int ref_count;
+};
+
+/* The planner is not threadsafe, so this lock protects all planner calls
+ * as well as the cache.
+ */
+static GMutex *vips__fft_lock = NULL;
+static GHashTable *vips__fft_plans = NULL;
+
+/* Load and save wisdom here.
+ */
+static const char *vips__fft_wisdom = NULL;
+
+static guint
+vips__fft_plan_hash( VipsFftPlan *key )
+{
+	return( (guint) key->kind ^
+		((guint) key->width << 3) ^
+		((guint) key->height << 17) ^
+		((guint) key->in_place << 30) ^
+		((guint) key->in_align << 5) ^
+		((guint) key->out_align << 11) ^
+		((guint) key->n_threads << 24) );
+}
+
+static gboolean
+vips__fft_plan_equal( VipsFftPlan *a, VipsFftPlan *b )
+{
+	return( a->kind == b->kind &&
+		a->width == b->width &&
+		a->height == b->height &&
+		a->in_place == b->in_place &&
+		a->in_align == b->in_align &&
+		a->out_align == b->out_align &&
+		a->n_threads == b->n_threads );
+}
+
+static void
+vips__fft_plan_free( VipsFftPlan *plan )
+{
+	VIPS_FREEF( fftw_destroy_plan, plan->plan );
+	g_free( plan );
+}
+
+static void *
+vips__fft_once_init( void *client )
+{
+	vips__fft_lock = vips_g_mutex_new();
+	vips__fft_plans = g_hash_table_new_full(
+		(GHashFunc) vips__fft_plan_hash,
+		(GEqualFunc) vips__fft_plan_equal,
+		NULL,
+		(GDestroyNotify) vips__fft_plan_free );
+
+#ifdef HAVE_FFTW_THREADS
+	fftw_init_threads();
+#endif /*HAVE_FFTW_THREADS*/
+
+	if( (vips__fft_wisdom = g_getenv( "VIPS_FFTW_WISDOM" )) &&
+		!fftw_import_wisdom_from_filename( vips__fft_wisdom ) )
+		g_info( "unable to load fftw wisdom from \"%s\"",
+			vips__fft_wisdom );
+
+	return( NULL );
+}
+
+static gboolean
+vips__fft_plan_unused( VipsFftPlan *key, VipsFftPlan *plan, void *a )
+{
+	return( plan->ref_count == 0 );
+}
+
+/* Number of doubles in the input and output buffers for a transform.
+ */
+static void
+vips__fft_plan_size( VipsFftKind kind, int width, int height,
+	guint64 *in_size, guint64 *out_size )
+{
+	const guint64 full = (guint64) width * height;
+	const guint64 half = (guint64) (width / 2 + 1) * height * 2;
+
+	switch( kind ) {
+	case VIPS_FFT_FORWARD_R2C:
+		*in_size = full;
+		*out_size = half;
+		break;
+
+	case VIPS_FFT_FORWARD_C2C:
+	case VIPS_FFT_BACKWARD_C2C:
+		*in_size = full * 2;
+		*out_size = full * 2;
+		break;
+
+	case VIPS_FFT_BACKWARD_C2R:
+		*in_size = half;
+		*out_size = full;
+		break;
+
+	default:
+		g_assert_not_reached();
+	}
+}
+
+/* Make the fftw plan. Yes, they really do use nx for height and ny for
+ * width. Planning overwrites the buffers, so we plan on scratch memory
+ * offset to match the alignment of the buffers we will run on.
+ */
+static fftw_plan
+vips__fft_plan_make( VipsFftPlan *key )
+{
+	/* Enough to match any SIMD alignment fftw will ask for.
+	 */
+	const int pad = 64;
+
+	guint64 in_size, out_size;
+	void *in_buf, *out_buf;
+	double *in, *out;
+	fftw_plan plan;
+
+	vips__fft_plan_size( key->kind, key->width, key->height,
+		&in_size, &out_size );
+	if( !(in_buf = fftw_malloc( in_size * sizeof( double ) + pad )) )
+		return( NULL );
+	in = (double *) ((char *) in_buf + key->in_align);
+	if( key->in_place ) {
+		out_buf = NULL;
+		out = in;
+	}
+	else {
+		if( !(out_buf = fftw_malloc( out_size * sizeof( double ) +
+			pad )) ) {
+			fftw_free( in_buf );
+			return( NULL );
+		}
+		out = (double *) ((char *) out_buf + key->out_align);
+	}
+
+#ifdef HAVE_FFTW_THREADS
+	fftw_plan_with_nthreads( key->n_threads );
+#endif /*HAVE_FFTW_THREADS*/
+
+	switch( key->kind ) {
+	case VIPS_FFT_FORWARD_R2C:
+		plan = fftw_plan_dft_r2c_2d( key->height, key->width,
+			in, (fftw_complex *) out, FFTW_MEASURE );
+		break;
+
+	case VIPS_FFT_FORWARD_C2C:
+	case VIPS_FFT_BACKWARD_C2C:
+		plan = fftw_plan_dft_2d( key->height, key->width,
+			(fftw_complex *) in, (fftw_complex *) out,
+			key->kind == VIPS_FFT_FORWARD_C2C ?
+				FFTW_FORWARD : FFTW_BACKWARD,
+			FFTW_MEASURE );
+		break;
+
+	case VIPS_FFT_BACKWARD_C2R:
+		plan = fftw_plan_dft_c2r_2d( key->height, key->width,
+			(fftw_complex *) in, out, FFTW_MEASURE );
+		break;
+
+	default:
+		g_assert_not_reached();
+
+		/* Stop compiler warnings.
+		 */
+		plan = NULL;
+	}
+
+	fftw_free( in_buf );
+	if( out_buf )
+		fftw_free( out_buf );
+
+	return( plan );
+}
+
+/* Get a plan for a transform with @n_threads threads that will run on @in
+ * and @out. Plans are shared and must be released with 
+ * vips__fft_plan_release() once executed. Use the new-array execute 
+ * functions, eg. fftw_execute_dft(), to run them.
+ *
+ * All fftw planning in libvips must go through here: the planner is 
+ * process-wide and not threadsafe. 
+ */
+VipsFftPlan *
+vips__fft_plan( VipsObject *context, VipsFftKind kind,
+	int width, int height, int n_threads, void *in, void *out )
+{
+	static GOnce once = G_ONCE_INIT;
+
+	VipsObjectClass *class = VIPS_OBJECT_GET_CLASS( context );
+
+	VipsFftPlan key;
+	VipsFftPlan *plan;
+
+	VIPS_ONCE( &once, (GThreadFunc) vips__fft_once_init, NULL );
+
+	key.kind = kind;
+	key.width = width;
+	key.height = height;
+	key.in_place = in == out;
+	key.in_align = fftw_alignment_of( (double *) in );
+	key.out_align = fftw_alignment_of( (double *) out );
+#ifdef HAVE_FFTW_THREADS
+	key.n_threads = VIPS_MAX( 1, n_threads );
+#else /*!HAVE_FFTW_THREADS*/
+	key.n_threads = 1;
+#endif /*HAVE_FFTW_THREADS*/
+
+	g_mutex_lock( vips__fft_lock );
+
+	if( !(plan = g_hash_table_lookup( vips__fft_plans, &key )) ) {
+		if( g_hash_table_size( vips__fft_plans ) >=
+			VIPS_FFT_PLAN_MAX )
+			g_hash_table_foreach_remove( vips__fft_plans,
+				(GHRFunc) vips__fft_plan_unused, NULL );
+
+		plan = g_new( VipsFftPlan, 1 );
+		*plan = key;
+		plan->ref_count = 0;
+		if( !(plan->plan = vips__fft_plan_make( plan )) ) {
+			g_free( plan );
+			g_mutex_unlock( vips__fft_lock );
+			vips_error( class->nickname,
+				"%s", _( "unable to create transform plan" ) );
+			return( NULL );
+		}
+
+		g_hash_table_insert( vips__fft_plans, plan, plan );
+
+		if( vips__fft_wisdom &&
+			!fftw_export_wisdom_to_filename( vips__fft_wisdom ) )
+			g_info( "unable to save fftw wisdom to \"%s\"",
+				vips__fft_wisdom );
+	}
+
+	plan->ref_count += 1;
+
+	g_mutex_unlock( vips__fft_lock );
+
+	return( plan );
+}
+
+/* As vips__fft_plan(), but plan for a whole-image transform, so use all our
+ * threads.
+ */
+VipsFftPlan *
+vips__fft_plan_get( VipsObject *context, VipsFftKind kind,
+	int width, int height, void *in, void *out )
+{
+	return( vips__fft_plan( context, kind, width, height, 
+		vips_concurrency_get(), in, out ) );
+}
+
+fftw_plan
+vips__fft_plan_fftw( VipsFftPlan *plan )
+{
+	return( plan->plan );
+}
+
+void
+vips__fft_plan_release( VipsFftPlan *plan )
+{
+	g_mutex_lock( vips__fft_lock );
+	g_assert( plan->ref_count > 0 );
+	plan->ref_count -= 1;
+	g_mutex_unlock( vips__fft_lock );
+}
+
+#endif /*HAVE_FFTW*/
+
+/* Called from vips_shutdown() to free cached plans.
+ */
+void
+vips__fft_shutdown( void )
+{
+#ifdef HAVE_FFTW
+	if( vips__fft_lock ) {
+		g_mutex_lock( vips__fft_lock );
+		g_hash_table_remove_all( vips__fft_plans );
+		g_mutex_unlock( vips__fft_lock );
+	}
+#endif /*HAVE_FFTW*/
+}
+
 /* Called from iofuncs to init all operations in this dir. Use a plugin system
  * instead?
  */
@@ -164,6 +479,7 @@ vips_freqfilt_operation_init( void )
 #ifdef HAVE_FFTW
 	extern GType vips_fwfft_get_type( void ); 
 	extern GType vips_invfft_get_type( void ); 
+	extern GType vips_phasecor_batch_get_type( void );
 #endif /*HAVE_FFTW*/
 	extern GType vips_freqmult_get_type( void ); 
 	extern GType vips_spectrum_get_type( void ); 
@@ -172,6 +488,7 @@ vips_freqfilt_operation_init( void )
 #ifdef HAVE_FFTW
 	vips_fwfft_get_type(); 
 	vips_invfft_get_type(); 
+	vips_phasecor_batch_get_type();
 #endif /*HAVE_FFTW*/
 	vips_freqmult_get_type(); 
 	vips_spectrum_get_type(); 
@@ -37,6 +37,8 @@
  * 	- reduce memuse
  * 3/1/14
  * 	- redone as a class
+ * 14/10/18
+ * 	- use the shared plan cache
  */
 
 /*
@@ -103,9 +105,8 @@ rfwfft1( VipsObject *object, VipsImage *in, VipsImage **out )
 	const int half_width = in->Xsize / 2 + 1;
 
 	double *half_complex;
-	double *planner_scratch;
 
-	fftw_plan plan;
+	VipsFftPlan *plan;
 	double *buf, *q, *p;
 	int x, y;
 
@@ -120,28 +121,17 @@ rfwfft1( VipsObject *object, VipsImage *in, VipsImage **out )
 		vips_image_write( t[0], t[1] ) )
 		return( -1 ); 
 
-	/* Make the plan for the transform. Yes, they really do use nx for
-	 * height and ny for width. Use a separate scratch buffer for the
-	 * planner, we can't overwrite real->data
-	 */
-	if( !(planner_scratch = VIPS_ARRAY( fwfft, 
-		VIPS_IMAGE_N_PELS( in ), double )) )
-		return( -1 );
 	if( !(half_complex = VIPS_ARRAY( fwfft, 
 		in->Ysize * half_width * 2, double )) )
 		return( -1 );
-	if( !(plan = fftw_plan_dft_r2c_2d( in->Ysize, in->Xsize,
-		planner_scratch, (fftw_complex *) half_complex,
-		0 )) ) {
-                vips_error( class->nickname, 
-			"%s", _( "unable to create transform plan" ) );
+	if( !(plan = vips__fft_plan_get( object, VIPS_FFT_FORWARD_R2C,
+		in->Xsize, in->Ysize, t[1]->data, half_complex )) )
 		return( -1 );
-	}
 
-	fftw_execute_dft_r2c( plan,
+	fftw_execute_dft_r2c( vips__fft_plan_fftw( plan ),
 		(double *) t[1]->data, (fftw_complex *) half_complex );
 
-	fftw_destroy_plan( plan );
+	vips__fft_plan_release( plan );
 
 	/* Write to out as another memory buffer. 
 	 */
@@ -219,8 +209,7 @@ cfwfft1( VipsObject *object, VipsImage *in, VipsImage **out )
 	VipsImage **t = (VipsImage **) vips_object_local_array( object, 4 );
 	VipsObjectClass *class = VIPS_OBJECT_GET_CLASS( fwfft );
 
-	fftw_plan plan;
-	double *planner_scratch;
+	VipsFftPlan *plan;
 	double *buf, *q, *p;
 	int x, y;
 
@@ -235,28 +224,14 @@ cfwfft1( VipsObject *object, VipsImage *in, VipsImage **out )
 		vips_image_write( t[0], t[1] ) )
 		return( -1 ); 
 
-	/* We have to have a separate buffer for the planner to work on.
-	 */
-	if( !(planner_scratch = VIPS_ARRAY( fwfft, 
-		VIPS_IMAGE_N_PELS( in ) * 2, double )) )
+	if( !(plan = vips__fft_plan_get( object, VIPS_FFT_FORWARD_C2C,
+		in->Xsize, in->Ysize, t[1]->data, t[1]->data )) )
 		return( -1 );
 
-	/* Make the plan for the transform.
-	 */
-	if( !(plan = fftw_plan_dft_2d( in->Ysize, in->Xsize,
-		(fftw_complex *) planner_scratch, 
-		(fftw_complex *) planner_scratch,
-		FFTW_FORWARD, 
-		0 )) ) {
-                vips_error( class->nickname, 
-			"%s", _( "unable to create transform plan" ) );
-		return( -1 );
-	}
-
-	fftw_execute_dft( plan,
+	fftw_execute_dft( vips__fft_plan_fftw( plan ),
 		(fftw_complex *) t[1]->data, (fftw_complex *) t[1]->data );
 
-	fftw_destroy_plan( plan );
+	vips__fft_plan_release( plan );
 
 	/* Write to out as another memory buffer. 
 	 */
@@ -355,6 +330,12 @@ vips_fwfft_init( VipsFwfft *fwfft )
  * VIPS uses the fftw Fourier Transform library. If this library was not
  * available when VIPS was configured, these functions will fail.
  *
+ * Transform plans are cached, so repeated transforms of the same size are
+ * quick. Set the environment variable `VIPS_FFTW_WISDOM` to the name of a
+ * file to load fftw wisdom from on first use, and to save new wisdom to.
+ * If fftw was built with thread support, transforms use up to
+ * vips_concurrency_get() threads.
+ *
  * See also: vips_invfft().
  *
  * Returns: 0 on success, -1 on error.
@@ -37,6 +37,10 @@ extern "C" {
 
 #include <vips/vector.h>
 
+#ifdef HAVE_FFTW
+#include <fftw3.h>
+#endif /*HAVE_FFTW*/
+
 #define VIPS_TYPE_FREQFILT (vips_freqfilt_get_type())
 #define VIPS_FREQFILT( obj ) \
 	(G_TYPE_CHECK_INSTANCE_CAST( (obj), \
@@ -72,6 +76,29 @@ typedef int (*VipsFftProcessFn)( VipsObject *, VipsImage *, VipsImage ** );
 int vips__fftproc( VipsObject *context, 
 	VipsImage *in, VipsImage **out, VipsFftProcessFn fn );
 
+#ifdef HAVE_FFTW
+
+/* The transforms we cache plans for. The R2C and C2R forms work on the
+ * half-complex layout.
+ */
+typedef enum {
+	VIPS_FFT_FORWARD_R2C,
+	VIPS_FFT_FORWARD_C2C,
+	VIPS_FFT_BACKWARD_C2C,
+	VIPS_FFT_BACKWARD_C2R
+} VipsFftKind;
+
+typedef struct _VipsFftPlan VipsFftPlan;
+
+VipsFftPlan *vips__fft_plan( VipsObject *context, VipsFftKind kind,
+	int width, int height, int n_threads, void *in, void *out );
+VipsFftPlan *vips__fft_plan_get( VipsObject *context, VipsFftKind kind,
+	int width, int height, void *in, void *out );
+fftw_plan vips__fft_plan_fftw( VipsFftPlan *plan );
+void vips__fft_plan_release( VipsFftPlan *plan );
+
+#endif /*HAVE_FFTW*/
+
 #ifdef __cplusplus
 }
 #endif /*__cplusplus*/
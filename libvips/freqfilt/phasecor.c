@@ -9,6 +9,8 @@
  * 	- gtkdoc
  * 3/1/14
  * 	- redone as a class
+ * 14/10/18
+ * 	- don't transform again if the input is already double complex
  */
 
 /*
@@ -75,13 +77,13 @@ vips_phasecor_build( VipsObject *object )
 	in1 = freqfilt->in;
 	in2 = phasecor->in2;
 
-	if( in1->BandFmt != VIPS_FORMAT_COMPLEX ) {
+	if( !vips_band_format_iscomplex( in1->BandFmt ) ) {
 		if( vips_fwfft( in1, &t[0], NULL ) )
 			return( -1 );
 		in1 = t[0];
 	}
 
-	if( in2->BandFmt != VIPS_FORMAT_COMPLEX ) {
+	if( !vips_band_format_iscomplex( in2->BandFmt ) ) {
 		if( vips_fwfft( in2, &t[1], NULL ) )
 			return( -1 );
 		in2 = t[1];
@@ -131,7 +133,9 @@ vips_phasecor_init( VipsPhasecor *phasecor )
  * Convert the two input images to Fourier space, calculate phase-correlation,
  * back to real space.
  *
- * See also: vips_fwfft(), vips_cross_phase(), 
+ * To register many pairs of images, vips_phasecor_batch() is much faster.
+ *
+ * See also: vips_fwfft(), vips_cross_phase(), vips_phasecor_batch().
  *
  * Returns: 0 on success, -1 on error.
  */
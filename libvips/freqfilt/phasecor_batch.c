@@ -0,0 +1,411 @@
+/* phase correlation for many pairs of images
+ *
+ * 14/10/18
+ * 	- from phasecor.c
+ */
+
+/*
+
+    This file is part of VIPS.
+
+    VIPS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA
+
+ */
+
+/*
+
+    These files are distributed with VIPS - http://www.vips.ecs.soton.ac.uk
+
+ */
+
+/*
+#define DEBUG
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /*HAVE_CONFIG_H*/
+#include <vips/intl.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <vips/vips.h>
+#include <vips/internal.h>
+#include "pfreqfilt.h"
+
+#ifdef HAVE_FFTW
+
+typedef struct _VipsPhasecorBatch {
+	VipsOperation parent_instance;
+
+	VipsArrayImage *in;
+	VipsArrayInt *pairs;
+	VipsImage *out;
+	int max_offset;
+
+	/* The forward transform of each input, made on first use and
+	 * dropped after the last pair that needs it.
+	 */
+	VipsImage **fft;
+	int *last_use;
+
+} VipsPhasecorBatch;
+
+typedef VipsOperationClass VipsPhasecorBatchClass;
+
+G_DEFINE_TYPE( VipsPhasecorBatch, vips_phasecor_batch, VIPS_TYPE_OPERATION );
+
+static void
+vips_phasecor_batch_dispose( GObject *gobject )
+{
+	VipsPhasecorBatch *batch = (VipsPhasecorBatch *) gobject;
+
+	if( batch->fft ) {
+		int i;
+
+		for( i = 0; i < VIPS_AREA( batch->in )->n; i++ )
+			VIPS_UNREF( batch->fft[i] );
+		VIPS_FREE( batch->fft );
+	}
+	VIPS_FREE( batch->last_use );
+
+	G_OBJECT_CLASS( vips_phasecor_batch_parent_class )->dispose( gobject );
+}
+
+/* Get the transform of an input as a double complex memory image.
+ */
+static double *
+vips_phasecor_batch_fft( VipsPhasecorBatch *batch, int i )
+{
+	if( !batch->fft[i] ) {
+		VipsImage **in = vips_array_image_get( batch->in, NULL );
+
+		VipsImage *t;
+
+		if( vips_fwfft( in[i], &t, NULL ) )
+			return( NULL );
+		batch->fft[i] = vips_image_copy_memory( t );
+		g_object_unref( t );
+		if( !batch->fft[i] )
+			return( NULL );
+	}
+
+	return( (double *) batch->fft[i]->data );
+}
+
+/* Wrap a coordinate in the correlation surface to a signed offset.
+ */
+static int
+vips_phasecor_batch_signed( int x, int size )
+{
+	return( x < (size + 1) / 2 ? x : x - size );
+}
+
+/* Fit a parabola through three samples and return the offset of the
+ * vertex from the centre one.
+ */
+static double
+vips_phasecor_batch_parabola( double l, double c, double r )
+{
+	double d = l - 2.0 * c + r;
+
+	if( d == 0.0 )
+		return( 0.0 );
+
+	return( VIPS_CLIP( -0.5, 0.5 * (l - r) / d, 0.5 ) );
+}
+
+/* Correlate one pair, write dx, dy and peak to row.
+ */
+static int
+vips_phasecor_batch_pair( VipsPhasecorBatch *batch,
+	double *left, double *right, double *surface, double *row )
+{
+	VipsImage **in = vips_array_image_get( batch->in, NULL );
+	const int width = in[0]->Xsize;
+	const int height = in[0]->Ysize;
+	const guint64 size = (guint64) width * height;
+	const int rx = batch->max_offset > 0 ?
+		VIPS_MIN( batch->max_offset, width / 2 ) : width / 2;
+	const int ry = batch->max_offset > 0 ?
+		VIPS_MIN( batch->max_offset, height / 2 ) : height / 2;
+
+	VipsFftPlan *plan;
+	guint64 i;
+	int x, y;
+	int best_x, best_y;
+	double best;
+	double *p;
+
+	/* The normalised cross power spectrum, left * conj( right ), as
+	 * vips_cross_phase().
+	 */
+	for( i = 0; i < size; i++ ) {
+		double *l = left + 2 * i;
+		double *r = right + 2 * i;
+		double re = l[0] * r[0] + l[1] * r[1];
+		double im = l[1] * r[0] - l[0] * r[1];
+		double mod = sqrt( re * re + im * im );
+
+		if( mod == 0.0 ) {
+			surface[2 * i] = 0.0;
+			surface[2 * i + 1] = 0.0;
+		}
+		else {
+			surface[2 * i] = re / mod;
+			surface[2 * i + 1] = im / mod;
+		}
+	}
+
+	if( !(plan = vips__fft_plan_get( VIPS_OBJECT( batch ),
+		VIPS_FFT_BACKWARD_C2C, width, height, surface, surface )) )
+		return( -1 );
+	fftw_execute_dft( vips__fft_plan_fftw( plan ),
+		(fftw_complex *) surface, (fftw_complex *) surface );
+	vips__fft_plan_release( plan );
+
+	/* Search the window for the peak in the real part.
+	 */
+#define REAL( X, Y ) \
+	(surface[2 * ((guint64) \
+		(((Y) + height) % height) * width + \
+		(((X) + width) % width))])
+
+	best_x = 0;
+	best_y = 0;
+	best = REAL( 0, 0 );
+	for( y = -ry; y <= ry; y++ )
+		for( x = -rx; x <= rx; x++ )
+			if( REAL( x, y ) > best ) {
+				best = REAL( x, y );
+				best_x = x;
+				best_y = y;
+			}
+
+	/* Wrap the peak back into range, it might have been found at the
+	 * far edge of an even-sized surface.
+	 */
+	best_x = vips_phasecor_batch_signed(
+		(best_x + width) % width, width );
+	best_y = vips_phasecor_batch_signed(
+		(best_y + height) % height, height );
+
+	p = row;
+	p[0] = best_x + vips_phasecor_batch_parabola(
+		REAL( best_x - 1, best_y ), best, REAL( best_x + 1, best_y ) );
+	p[1] = best_y + vips_phasecor_batch_parabola(
+		REAL( best_x, best_y - 1 ), best, REAL( best_x, best_y + 1 ) );
+	p[2] = best / size;
+
+	return( 0 );
+}
+
+static int
+vips_phasecor_batch_build( VipsObject *object )
+{
+	VipsObjectClass *class = VIPS_OBJECT_GET_CLASS( object );
+	VipsPhasecorBatch *batch = (VipsPhasecorBatch *) object;
+
+	VipsImage **in;
+	int n;
+	int *pairs;
+	int n_pairs;
+	VipsImage *out;
+	double *surface;
+	int i;
+
+	if( VIPS_OBJECT_CLASS( vips_phasecor_batch_parent_class )->
+		build( object ) )
+		return( -1 );
+
+	in = vips_array_image_get( batch->in, &n );
+	pairs = vips_array_int_get( batch->pairs, &n_pairs );
+	if( n < 1 ) {
+		vips_error( class->nickname, "%s", _( "no input images" ) );
+		return( -1 );
+	}
+	if( n_pairs % 2 != 0 ) {
+		vips_error( class->nickname,
+			"%s", _( "pairs must have an even number of elements" ) );
+		return( -1 );
+	}
+	n_pairs /= 2;
+	for( i = 0; i < 2 * n_pairs; i++ )
+		if( pairs[i] < 0 ||
+			pairs[i] >= n ) {
+			vips_error( class->nickname,
+				"%s", _( "pair index out of range" ) );
+			return( -1 );
+		}
+	for( i = 0; i < n; i++ )
+		if( vips_check_mono( class->nickname, in[i] ) ||
+			vips_check_uncoded( class->nickname, in[i] ) ||
+			vips_check_size_same( class->nickname, in[0], in[i] ) )
+			return( -1 );
+
+	/* Find the last pair that uses each image, so we can free the
+	 * transforms as we go.
+	 */
+	batch->fft = VIPS_ARRAY( NULL, n, VipsImage * );
+	batch->last_use = VIPS_ARRAY( NULL, n, int );
+	if( !batch->fft ||
+		!batch->last_use )
+		return( -1 );
+	for( i = 0; i < n; i++ ) {
+		batch->fft[i] = NULL;
+		batch->last_use[i] = -1;
+	}
+	for( i = 0; i < 2 * n_pairs; i++ )
+		batch->last_use[pairs[i]] = i / 2;
+
+	if( !(surface = VIPS_ARRAY( object,
+		VIPS_IMAGE_N_PELS( in[0] ) * 2, double )) )
+		return( -1 );
+
+	out = vips_image_new_matrix( 3, VIPS_MAX( 1, n_pairs ) );
+	g_object_set( object, "out", out, NULL );
+
+	for( i = 0; i < n_pairs; i++ ) {
+		int a = pairs[2 * i];
+		int b = pairs[2 * i + 1];
+
+		double *left, *right;
+
+		if( !(left = vips_phasecor_batch_fft( batch, a )) ||
+			!(right = vips_phasecor_batch_fft( batch, b )) ||
+			vips_phasecor_batch_pair( batch, left, right, surface,
+				VIPS_MATRIX( out, 0, i ) ) )
+			return( -1 );
+
+		if( batch->last_use[a] == i )
+			VIPS_UNREF( batch->fft[a] );
+		if( batch->last_use[b] == i )
+			VIPS_UNREF( batch->fft[b] );
+	}
+
+	return( 0 );
+}
+
+static void
+vips_phasecor_batch_class_init( VipsPhasecorBatchClass *class )
+{
+	GObjectClass *gobject_class = G_OBJECT_CLASS( class );
+	VipsObjectClass *vobject_class = VIPS_OBJECT_CLASS( class );
+
+	gobject_class->dispose = vips_phasecor_batch_dispose;
+	gobject_class->set_property = vips_object_set_property;
+	gobject_class->get_property = vips_object_get_property;
+
+	vobject_class->nickname = "phasecor_batch";
+	vobject_class->description =
+		_( "find offsets between many pairs of images" );
+	vobject_class->build = vips_phasecor_batch_build;
+
+	VIPS_ARG_BOXED( class, "in", 0,
+		_( "Input" ),
+		_( "Array of input images" ),
+		VIPS_ARGUMENT_REQUIRED_INPUT,
+		G_STRUCT_OFFSET( VipsPhasecorBatch, in ),
+		VIPS_TYPE_ARRAY_IMAGE );
+
+	VIPS_ARG_BOXED( class, "pairs", 1,
+		_( "Pairs" ),
+		_( "Index of first and second image in each pair" ),
+		VIPS_ARGUMENT_REQUIRED_INPUT,
+		G_STRUCT_OFFSET( VipsPhasecorBatch, pairs ),
+		VIPS_TYPE_ARRAY_INT );
+
+	VIPS_ARG_IMAGE( class, "out", 2,
+		_( "Output" ),
+		_( "Offset and peak for each pair" ),
+		VIPS_ARGUMENT_REQUIRED_OUTPUT,
+		G_STRUCT_OFFSET( VipsPhasecorBatch, out ) );
+
+	VIPS_ARG_INT( class, "max_offset", 3,
+		_( "Max offset" ),
+		_( "Search offsets up to this far, 0 for anywhere" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsPhasecorBatch, max_offset ),
+		0, 100000000, 0 );
+
+}
+
+static void
+vips_phasecor_batch_init( VipsPhasecorBatch *batch )
+{
+}
+
+#endif /*HAVE_FFTW*/
+
+/**
+ * vips_phasecor_batch:
+ * @in: (array length=n) (transfer none): array of input images
+ * @n: number of input images
+ * @pairs: (array length=n_pairs): index of first and second image in
+ * each pair
+ * @n_pairs: number of elements in @pairs, twice the number of pairs
+ * @out: (out): output matrix
+ * @...: %NULL-terminated list of optional named arguments
+ *
+ * Optional arguments:
+ *
+ * * @max_offset: %gint, only search offsets up to this far
+ *
+ * Find the offset between many pairs of images by phase correlation, for
+ * example, the overlaps between neighbouring tiles in a mosaic.
+ *
+ * All images in @in must be one-band and the same size. @pairs holds the
+ * index of the first and second image of each pair. Each image is
+ * transformed once, however many pairs it is in, and the transform is freed
+ * after the last pair that uses it, so list pairs in scan order to keep
+ * memory use low.
+ *
+ * @out is a matrix with a row for each pair. The columns are the
+ * sub-pixel x and y offset of the correlation peak, as found by
+ * vips_phasecor() and vips_maxpos(), and the peak height, between 0 and 1.
+ * Larger peaks mean a more reliable match.
+ *
+ * Use @max_offset to only search offsets up to that many pixels in x and y.
+ * This avoids false matches far from the expected position.
+ *
+ * See also: vips_phasecor(), vips_fwfft().
+ *
+ * Returns: 0 on success, -1 on error.
+ */
+int
+vips_phasecor_batch( VipsImage **in, int n, const int *pairs, int n_pairs,
+	VipsImage **out, ... )
+{
+	VipsArrayImage *in_array;
+	VipsArrayInt *pairs_array;
+	va_list ap;
+	int result;
+
+	in_array = vips_array_image_new( in, n );
+	pairs_array = vips_array_int_new( pairs, n_pairs );
+
+	va_start( ap, out );
+	result = vips_call_split( "phasecor_batch", ap,
+		in_array, pairs_array, out );
+	va_end( ap );
+
+	vips_area_unref( VIPS_AREA( in_array ) );
+	vips_area_unref( VIPS_AREA( pairs_array ) );
+
+	return( result );
+}
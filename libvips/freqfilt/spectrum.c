@@ -16,6 +16,8 @@
  * 	- cleanups
  * 3/1/14
  * 	- redone as a class
+ * 14/10/18
+ * 	- don't transform again if the input is already double complex
  */
 
 /*
@@ -75,7 +77,7 @@ vips_spectrum_build( VipsObject *object )
 
 	in = freqfilt->in;
 
-	if( in->BandFmt != VIPS_FORMAT_COMPLEX ) {
+	if( !vips_band_format_iscomplex( in->BandFmt ) ) {
 		if( vips_fwfft( in, &t[0], NULL ) )
 			return( -1 );
 		in = t[0];
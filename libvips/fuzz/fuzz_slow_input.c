@@ -0,0 +1,134 @@
+/* fuzz target for libfuzzer: find inputs which are valid but slow
+ *
+ * 14/10/18
+ * 	- first version
+ */
+
+/*
+
+    This file is part of VIPS.
+
+    VIPS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA
+
+ */
+
+/*
+
+    These files are distributed with VIPS - http://www.vips.ecs.soton.ac.uk
+
+ */
+
+/* Load and process each input under a time and memory budget, and abort()
+ * if it goes over, so libfuzzer saves the input. Set the budget with
+ * VIPS_FUZZ_MAX_TIME (seconds, default 1) and VIPS_FUZZ_MAX_MEM (bytes of
+ * tracked memory, default 100m).
+ *
+ * The load limits (see vips_foreign_load_set_limits()) are set from the
+ * memory budget, so huge declared sizes fail in the header check and
+ * are not reported. Anything which still gets past them is a problem.
+ */
+
+/*
+#define VIPS_DEBUG
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /*HAVE_CONFIG_H*/
+#include <vips/intl.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vips/vips.h>
+#include <vips/internal.h>
+
+typedef struct _FuzzBudget {
+	GTimer *timer;
+	double max_time;
+	size_t max_mem;
+	size_t mem;
+
+	/* Set if we went over.
+	 */
+	gboolean over;
+} FuzzBudget;
+
+/* Stop the computation as soon as it goes over, there's no point waiting
+ * for the end.
+ */
+static void
+fuzz_slow_input_eval( VipsImage *image, VipsProgress *progress,
+	FuzzBudget *budget )
+{
+	if( g_timer_elapsed( budget->timer, NULL ) > budget->max_time ||
+		vips_tracked_get_mem() - budget->mem > budget->max_mem ) {
+		budget->over = TRUE;
+		vips_image_set_kill( image, TRUE );
+	}
+}
+
+int
+vips__fuzztarget_slow_input( const guint8 *data, size_t size )
+{
+	static FuzzBudget budget = { NULL, 1.0, 100 * 1024 * 1024 };
+
+	VipsImage *image;
+	double d;
+
+	if( !budget.timer ) {
+		const char *env;
+
+		if( (env = g_getenv( "VIPS_FUZZ_MAX_TIME" )) )
+			budget.max_time = g_ascii_strtod( env, NULL );
+		if( (env = g_getenv( "VIPS_FUZZ_MAX_MEM" )) )
+			budget.max_mem = vips__parse_size( env );
+
+		/* Every pixel is at least a byte, so the byte limit is
+		 * enough.
+		 */
+		vips_foreign_load_set_limits( 0, 1000, budget.max_mem );
+		budget.timer = g_timer_new();
+	}
+
+	g_timer_start( budget.timer );
+	budget.mem = vips_tracked_get_mem();
+	budget.over = FALSE;
+
+	/* libfuzzer does not allow error return.
+	 */
+	if( (image = vips_image_new_from_buffer( data, size, "", NULL )) ) {
+		vips_image_set_progress( image, TRUE );
+		g_signal_connect( image, "eval",
+			G_CALLBACK( fuzz_slow_input_eval ), &budget );
+
+		(void) vips_avg( image, &d, NULL );
+
+		g_object_unref( image );
+	}
+
+	/* A slow header read won't have triggered eval, so check again.
+	 */
+	if( budget.over ||
+		g_timer_elapsed( budget.timer, NULL ) > budget.max_time ) {
+		fprintf( stderr, "vips__fuzztarget_slow_input: "
+			"over budget after %gs\n",
+			g_timer_elapsed( budget.timer, NULL ) );
+		abort();
+	}
+
+	return( 0 );
+}
@@ -17,6 +17,8 @@
  * 	- redone as a class
  * 19/6/17
  * 	- make output format always == input format, thanks Simon
+ * 14/10/18
+ * 	- add @hist, so we can equalise in a single pass
  */
 
 /*
@@ -64,6 +66,10 @@ typedef struct _VipsHistEqual {
 	/* -1 for all bands, or the band we scan.
 	 */
 	int which;
+
+	/* Equalise with this histogram, rather than one of @in.
+	 */
+	VipsImage *hist;
 } VipsHistEqual;
 
 typedef VipsOperationClass VipsHistEqualClass;
@@ -73,21 +79,39 @@ G_DEFINE_TYPE( VipsHistEqual, vips_hist_equal, VIPS_TYPE_OPERATION );
 static int
 vips_hist_equal_build( VipsObject *object )
 {
+	VipsObjectClass *class = VIPS_OBJECT_GET_CLASS( object );
 	VipsHistEqual *equal = (VipsHistEqual *) object; 
 	VipsImage **t = (VipsImage **) vips_object_local_array( object, 5 );
 
+	VipsImage *hist;
+
 	g_object_set( equal, "out", vips_image_new(), NULL ); 
 
 	if( VIPS_OBJECT_CLASS( vips_hist_equal_parent_class )->build( object ) )
 		return( -1 );
 
+	/* If we've been given a histogram, we don't need to scan @in, and
+	 * the whole thing can stream.
+	 */
+	if( equal->hist ) {
+		if( vips_check_hist( class->nickname, equal->hist ) ||
+			vips_check_bands_1orn( class->nickname,
+				equal->in, equal->hist ) )
+			return( -1 );
+		hist = equal->hist;
+	}
+	else {
+		if( vips_hist_find( equal->in, &t[0],
+			"band", equal->which,
+			NULL ) )
+			return( -1 );
+		hist = t[0];
+	}
+
 	/* norm can return a uchar output for a ushort input if the range is
 	 * small, so make sure we cast back to the input type again.
 	 */
-	if( vips_hist_find( equal->in, &t[0], 
-			"band", equal->which,
-			NULL ) ||
-		vips_hist_cum( t[0], &t[1], NULL ) ||
+	if( vips_hist_cum( hist, &t[1], NULL ) ||
 		vips_hist_norm( t[1], &t[2], NULL ) ||
 		vips_cast( t[2], &t[3], equal->in->BandFmt, NULL ) ||
 		vips_maplut( equal->in, &t[4], t[3], NULL ) ||
@@ -128,6 +152,12 @@ vips_hist_equal_class_init( VipsHistEqualClass *class )
 		VIPS_ARGUMENT_OPTIONAL_INPUT, 
 		G_STRUCT_OFFSET( VipsHistEqual, which ),
 		-1, 100000, -1 );
+
+	VIPS_ARG_IMAGE( class, "hist", 111,
+		_( "Histogram" ),
+		_( "Equalise with this histogram" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsHistEqual, hist ) );
 }
 
 static void
@@ -145,11 +175,20 @@ vips_hist_equal_init( VipsHistEqual *equal )
  * Optional arguments:
  *
  * * @band: band to equalise
+ * * @hist: equalise with this histogram
  *
  * Histogram-equalise @in. Equalise using band @bandno, or if @bandno is -1,
  * equalise bands independently. The output format is always the same as the
  * input format. 
  *
+ * Normally vips_hist_equal() needs two passes over @in: one to find the
+ * histogram, and one to map the pixels. If you set @hist, it is used
+ * instead and @in is only read once, as it is mapped. @hist can be any
+ * histogram from vips_hist_find() with one band, or the same number
+ * of bands as @in. It is normalised before use, so it can come from
+ * a cheap shrink-on-load preview of @in, or from the previous frame of a
+ * sequence. @band is ignored.
+ *
  * See also: 
  *
  * Returns: 0 on success, -1 on error
@@ -27,6 +27,10 @@
  * 	  current value
  * 	- scale result by 255, not 256, to avoid overflow
  * 	- off by 1 fix for odd window widths
+ * 14/10/18
+ * 	- slide the line-start histogram down, rather than rebuilding it for
+ * 	  every line
+ * 	- add @tiled, for tile-interpolated CLAHE
  */
 
 /*
@@ -64,6 +68,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 
 #include <vips/vips.h>
 #include <vips/internal.h>
@@ -78,6 +83,15 @@ typedef struct _VipsHistLocal {
 	int height;
 
 	int max_slope;
+	gboolean tiled;
+
+	/* For the tiled mode: the number of tiles, and a lazily made lookup
+	 * table for each one, @bands * 256 entries.
+	 */
+	int tiles_across;
+	int tiles_down;
+	VipsPel **luts;
+	GMutex *lock;
 
 } VipsHistLocal;
 
@@ -85,6 +99,23 @@ typedef VipsOperationClass VipsHistLocalClass;
 
 G_DEFINE_TYPE( VipsHistLocal, vips_hist_local, VIPS_TYPE_OPERATION );
 
+static void
+vips_hist_local_dispose( GObject *gobject )
+{
+	VipsHistLocal *local = (VipsHistLocal *) gobject;
+
+	if( local->luts ) {
+		int i;
+
+		for( i = 0; i < local->tiles_across * local->tiles_down; i++ )
+			VIPS_FREE( local->luts[i] );
+		VIPS_FREE( local->luts );
+	}
+	VIPS_FREEF( vips_g_mutex_free, local->lock );
+
+	G_OBJECT_CLASS( vips_hist_local_parent_class )->dispose( gobject );
+}
+
 /* Our sequence value: the region this sequence is using, and local stats.
  */
 typedef struct {
@@ -93,6 +124,18 @@ typedef struct {
 	/* A 256-element hist for every band.
 	 */
 	unsigned int **hist;
+
+	/* The hist for the start of the last line we made, so we can slide
+	 * it down to the next line rather than rebuilding it.
+	 */
+	unsigned int **line_hist;
+	gboolean line_valid;
+	int line_left;
+	int line_y;
+
+	/* Tiled mode uses this region to find tile histograms.
+	 */
+	VipsRegion *tile_ir;
 } VipsHistLocalSequence;
 
 static int
@@ -102,6 +145,7 @@ vips_hist_local_stop( void *vseq, void *a, void *b )
 	VipsImage *in = (VipsImage *) a;
 
 	VIPS_UNREF( seq->ir );
+	VIPS_UNREF( seq->tile_ir );
 	if( seq->hist &&
 		in ) {
 		int i; 
@@ -110,6 +154,14 @@ vips_hist_local_stop( void *vseq, void *a, void *b )
 			VIPS_FREE( seq->hist[i] );
 		VIPS_FREE( seq->hist );
 	}
+	if( seq->line_hist &&
+		in ) {
+		int i;
+
+		for( i = 0; i < in->Bands; i++ )
+			VIPS_FREE( seq->line_hist[i] );
+		VIPS_FREE( seq->line_hist );
+	}
 	VIPS_FREE( seq );
 
 	return( 0 );
@@ -127,18 +179,31 @@ vips_hist_local_start( VipsImage *out, void *a, void *b )
 		 return( NULL );
 	seq->ir = NULL;
 	seq->hist = NULL;
+	seq->line_hist = NULL;
+	seq->line_valid = FALSE;
+	seq->tile_ir = NULL;
 
 	if( !(seq->ir = vips_region_new( in )) || 
-		!(seq->hist = VIPS_ARRAY( NULL, in->Bands, unsigned int * )) ) {
+		!(seq->tile_ir = vips_region_new( in )) ||
+		!(seq->hist = VIPS_ARRAY( NULL,
+			in->Bands, unsigned int * )) ||
+		!(seq->line_hist = VIPS_ARRAY( NULL,
+			in->Bands, unsigned int * )) ) {
 		vips_hist_local_stop( seq, NULL, NULL );
 		return( NULL ); 
 	}
+	for( i = 0; i < in->Bands; i++ ) {
+		seq->hist[i] = NULL;
+		seq->line_hist[i] = NULL;
+	}
 
 	for( i = 0; i < in->Bands; i++ )
-		if( !(seq->hist[i] = VIPS_ARRAY( NULL, 256, unsigned int )) ) {
-		vips_hist_local_stop( seq, NULL, NULL );
-		return( NULL ); 
-	}
+		if( !(seq->hist[i] = VIPS_ARRAY( NULL, 256, unsigned int )) ||
+			!(seq->line_hist[i] =
+				VIPS_ARRAY( NULL, 256, unsigned int )) ) {
+			vips_hist_local_stop( seq, in, NULL );
+			return( NULL );
+		}
 
 	return( seq );
 }
@@ -158,6 +223,15 @@ vips_hist_local_generate( VipsRegion *or,
 	int y;
 	int lsk;
 	int centre;		/* Offset to move to centre of window */
+	gboolean slide;
+
+	/* If this region follows on from the last one this sequence made, we
+	 * can slide the line-start histogram down. We need one extra line
+	 * above the region for this.
+	 */
+	slide = seq->line_valid &&
+		seq->line_left == r->left &&
+		seq->line_y == r->top - 1;
 
 	/* What part of ir do we need?
 	 */
@@ -165,6 +239,10 @@ vips_hist_local_generate( VipsRegion *or,
 	irect.top = r->top;
 	irect.width = r->width + local->width; 
 	irect.height = r->height + local->height; 
+	if( slide ) {
+		irect.top -= 1;
+		irect.height += 1;
+	}
 	if( vips_region_prepare( seq->ir, &irect ) )
 		return( -1 );
 
@@ -182,19 +260,40 @@ vips_hist_local_generate( VipsRegion *or,
 		VipsPel * restrict p1;
 		int x, i, j, b;
 
-		/* Find histogram for the start of this line. 
+		/* Find histogram for the start of this line. We can usually
+		 * slide the start of the previous line down: remove the top
+		 * line of the window and add a new bottom line.
 		 */
-		for( b = 0; b < bands; b++ )
-			memset( seq->hist[b], 0, 256 * sizeof( unsigned int ) );
-		p1 = p;
-		for( j = 0; j < local->height; j++ ) {
-			for( i = 0, x = 0; x < local->width; x++ )
-				for( b = 0; b < bands; b++, i++ )
-					seq->hist[b][p1[i]] += 1;
+		if( slide ||
+			y > 0 ) {
+			VipsPel * restrict p2;
 
-			p1 += lsk;
+			p1 = p - lsk;
+			p2 = p1 + lsk * local->height;
+			for( i = 0, x = 0; x < local->width; x++ )
+				for( b = 0; b < bands; b++, i++ ) {
+					seq->line_hist[b][p1[i]] -= 1;
+					seq->line_hist[b][p2[i]] += 1;
+				}
+		}
+		else {
+			for( b = 0; b < bands; b++ )
+				memset( seq->line_hist[b], 0,
+					256 * sizeof( unsigned int ) );
+			p1 = p;
+			for( j = 0; j < local->height; j++ ) {
+				for( i = 0, x = 0; x < local->width; x++ )
+					for( b = 0; b < bands; b++, i++ )
+						seq->line_hist[b][p1[i]] += 1;
+
+				p1 += lsk;
+			}
 		}
 
+		for( b = 0; b < bands; b++ )
+			memcpy( seq->hist[b], seq->line_hist[b],
+				256 * sizeof( unsigned int ) );
+
 		/* Loop for output pels.
 		 */
 		for( x = 0; x < r->width; x++ ) {
@@ -275,6 +374,182 @@ vips_hist_local_generate( VipsRegion *or,
 		}
 	}
 
+	seq->line_valid = TRUE;
+	seq->line_left = r->left;
+	seq->line_y = r->top + r->height - 1;
+
+	return( 0 );
+}
+
+/* Get the lookup table for a tile, making it if necessary. Several threads
+ * can make the same table at once, but only one will be kept.
+ */
+static VipsPel *
+vips_hist_local_tile_lut( VipsHistLocal *local,
+	VipsHistLocalSequence *seq, int tx, int ty )
+{
+	VipsImage *in = seq->tile_ir->im;
+	const int bands = in->Bands;
+	const int max_slope = local->max_slope;
+	const int n = ty * local->tiles_across + tx;
+
+	VipsRect image;
+	VipsRect tile;
+	VipsPel *lut;
+	unsigned int hist[256];
+	int npels;
+	int b, i, x, y;
+
+	g_mutex_lock( local->lock );
+	lut = local->luts[n];
+	g_mutex_unlock( local->lock );
+	if( lut )
+		return( lut );
+
+	image.left = 0;
+	image.top = 0;
+	image.width = in->Xsize;
+	image.height = in->Ysize;
+	tile.left = tx * local->width;
+	tile.top = ty * local->height;
+	tile.width = local->width;
+	tile.height = local->height;
+	vips_rect_intersectrect( &tile, &image, &tile );
+	npels = tile.width * tile.height;
+
+	if( vips_region_prepare( seq->tile_ir, &tile ) ||
+		!(lut = VIPS_ARRAY( NULL, bands * 256, VipsPel )) )
+		return( NULL );
+
+	for( b = 0; b < bands; b++ ) {
+		int sum;
+		int sum_over;
+
+		memset( hist, 0, 256 * sizeof( unsigned int ) );
+		for( y = 0; y < tile.height; y++ ) {
+			VipsPel * restrict p = VIPS_REGION_ADDR( seq->tile_ir,
+				tile.left, tile.top + y ) + b;
+
+			for( x = 0; x < tile.width; x++ )
+				hist[p[x * bands]] += 1;
+		}
+
+		/* Clip the hist to the slope limit, if there is one, and
+		 * spread the excess over all bins, exactly as for the
+		 * untiled case.
+		 */
+		sum_over = 0;
+		if( max_slope > 0 )
+			for( i = 0; i < 256; i++ )
+				if( hist[i] > max_slope ) {
+					sum_over += hist[i] - max_slope;
+					hist[i] = max_slope;
+				}
+
+		sum = 0;
+		for( i = 0; i < 256; i++ ) {
+			sum += hist[i];
+			lut[b * 256 + i] =
+				255 * (sum + (i + 1) * sum_over / 256) / npels;
+		}
+	}
+
+	g_mutex_lock( local->lock );
+	if( !local->luts[n] )
+		local->luts[n] = lut;
+	else {
+		vips_free( lut );
+		lut = local->luts[n];
+	}
+	g_mutex_unlock( local->lock );
+
+	return( lut );
+}
+
+/* Find the tile to the top-left of a position, and the distance to the
+ * right and down. We interpolate between tile centres.
+ */
+static void
+vips_hist_local_tile_position( int pos, int size, int n_tiles,
+	int *t, double *w )
+{
+	double f = (pos + 0.5) / size - 0.5;
+	int t0 = VIPS_CLIP( 0, (int) floor( f ), n_tiles - 1 );
+
+	*t = t0;
+	*w = VIPS_CLIP( 0.0, f - t0, 1.0 );
+}
+
+/* Classic CLAHE: each pixel is mapped through the lookup tables of the four
+ * nearest tiles, and the results are blended bilinearly.
+ */
+static int
+vips_hist_local_generate_tiled( VipsRegion *or,
+	void *vseq, void *a, void *b, gboolean *stop )
+{
+	VipsHistLocalSequence *seq = (VipsHistLocalSequence *) vseq;
+	VipsImage *in = (VipsImage *) a;
+	VipsHistLocal *local = (VipsHistLocal *) b;
+	VipsRect *r = &or->valid;
+	const int bands = in->Bands;
+
+	int x, y, i;
+
+	if( vips_region_prepare( seq->ir, r ) )
+		return( -1 );
+
+	for( y = 0; y < r->height; y++ ) {
+		VipsPel * restrict p =
+			VIPS_REGION_ADDR( seq->ir, r->left, r->top + y );
+		VipsPel * restrict q =
+			VIPS_REGION_ADDR( or, r->left, r->top + y );
+
+		VipsPel *lut[4];
+		int ty0, ty1;
+		double wy;
+		int last_tx0;
+
+		vips_hist_local_tile_position( r->top + y,
+			local->height, local->tiles_down, &ty0, &wy );
+		ty1 = VIPS_MIN( ty0 + 1, local->tiles_down - 1 );
+
+		last_tx0 = -1;
+		for( x = 0; x < r->width; x++ ) {
+			int tx0, tx1;
+			double wx;
+
+			vips_hist_local_tile_position( r->left + x,
+				local->width, local->tiles_across, &tx0, &wx );
+			tx1 = VIPS_MIN( tx0 + 1, local->tiles_across - 1 );
+
+			if( tx0 != last_tx0 ) {
+				if( !(lut[0] = vips_hist_local_tile_lut( local,
+					seq, tx0, ty0 )) ||
+					!(lut[1] = vips_hist_local_tile_lut(
+						local, seq, tx1, ty0 )) ||
+					!(lut[2] = vips_hist_local_tile_lut(
+						local, seq, tx0, ty1 )) ||
+					!(lut[3] = vips_hist_local_tile_lut(
+						local, seq, tx1, ty1 )) )
+					return( -1 );
+				last_tx0 = tx0;
+			}
+
+			for( i = 0; i < bands; i++ ) {
+				int v = i * 256 + p[i];
+				double top = (1 - wx) * lut[0][v] +
+					wx * lut[1][v];
+				double bottom = (1 - wx) * lut[2][v] +
+					wx * lut[3][v];
+
+				q[i] = (1 - wy) * top + wy * bottom + 0.5;
+			}
+
+			p += bands;
+			q += bands;
+		}
+	}
+
 	return( 0 );
 }
 
@@ -305,6 +580,32 @@ vips_hist_local_build( VipsObject *object )
 		return( -1 );
 	}
 
+	if( local->tiled ) {
+		local->tiles_across =
+			VIPS_ROUND_UP( in->Xsize, local->width ) / local->width;
+		local->tiles_down =
+			VIPS_ROUND_UP( in->Ysize, local->height ) /
+				local->height;
+		if( !(local->luts = VIPS_ARRAY( NULL,
+			local->tiles_across * local->tiles_down, VipsPel * )) )
+			return( -1 );
+		memset( local->luts, 0, local->tiles_across *
+			local->tiles_down * sizeof( VipsPel * ) );
+
+		g_object_set( object, "out", vips_image_new(), NULL );
+
+		if( vips_image_pipelinev( local->out,
+			VIPS_DEMAND_STYLE_FATSTRIP, in, NULL ) ||
+			vips_image_generate( local->out,
+				vips_hist_local_start,
+				vips_hist_local_generate_tiled,
+				vips_hist_local_stop,
+				in, local ) )
+			return( -1 );
+
+		return( 0 );
+	}
+
 	/* Expand the input. 
 	 */
 	if( vips_embed( in, &t[1], 
@@ -347,6 +648,7 @@ vips_hist_local_class_init( VipsHistLocalClass *class )
 	GObjectClass *gobject_class = G_OBJECT_CLASS( class );
 	VipsObjectClass *object_class = (VipsObjectClass *) class;
 
+	gobject_class->dispose = vips_hist_local_dispose;
 	gobject_class->set_property = vips_object_set_property;
 	gobject_class->get_property = vips_object_get_property;
 
@@ -387,11 +689,19 @@ vips_hist_local_class_init( VipsHistLocalClass *class )
 		G_STRUCT_OFFSET( VipsHistLocal, max_slope ),
 		0, 100, 0 );
 
+	VIPS_ARG_BOOL( class, "tiled", 7,
+		_( "Tiled" ),
+		_( "Interpolate between tile histograms" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsHistLocal, tiled ),
+		FALSE );
+
 }
 
 static void
 vips_hist_local_init( VipsHistLocal *local )
 {
+	local->lock = vips_g_mutex_new();
 }
 
 /**
@@ -405,6 +715,7 @@ vips_hist_local_init( VipsHistLocal *local )
  * Optional arguments:
  *
  * * @max_slope: maximum brightening
+ * * @tiled: interpolate between tile histograms
  *
  * Performs local histogram equalisation on @in using a
  * window of size @width by @height centered on the input pixel. 
@@ -417,6 +728,12 @@ vips_hist_local_init( VipsHistLocal *local )
  * performed. A value of 3 is often used. Local histogram equalization with
  * contrast limiting is usually called CLAHE.
  *
+ * If @tiled is set, the image is split into tiles of size @width by @height
+ * and a histogram is found for each tile. Each output pixel is then
+ * interpolated bilinearly from the equalisations of the four nearest tiles.
+ * This is the classic CLAHE algorithm, and is much quicker than using a
+ * window around every pixel.
+ *
  * See also: vips_hist_equal().
  *
  * Returns: 0 on success, -1 on error
@@ -187,6 +187,11 @@ vips_hist_match_init( VipsHistMatch *match )
  * cumulative histograms, @out will be a LUT that adjusts the PDF of the image
  * from which @in was made to match the PDF of @ref's image. 
  *
+ * This works on histograms, not images, so @in and @ref can be made from
+ * something cheap, such as a shrink-on-load preview of the image, or the
+ * previous frame of a sequence. Apply @out with vips_maplut() for a single
+ * streaming pass over the full image.
+ *
  * See also: vips_maplut(), vips_hist_find(), vips_hist_norm(),
  * vips_hist_cum(). 
  *
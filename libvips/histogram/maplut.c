@@ -33,6 +33,12 @@
  * 	- convert to a class
  * 2/10/13
  * 	- add --band arg, replacing im_tone_map()
+ * 14/10/18
+ * 	- loops now work a line at a time, so maplut can join a fused chain
+ * 	- pad uchar tables to 256 entries
+ * 	- unroll 3 and 4 band uchar maps, use a vector shuffle for small
+ * 	  uchar tables
+ * 	- add @coarse
  */
 
 /*
@@ -70,8 +76,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 
 #include <vips/vips.h>
+#include <vips/simd.h>
+#include <vips/internal.h>
 
 typedef struct _VipsMaplut {
 	VipsOperation parent_instance;
@@ -80,6 +89,7 @@ typedef struct _VipsMaplut {
 	VipsImage *out;
 	VipsImage *lut;
 	int band; 
+	gboolean coarse;
 
 	int fmt;		/* LUT image BandFmt */
 	int nb;			/* Number of bands in lut */
@@ -88,9 +98,26 @@ typedef struct _VipsMaplut {
 	int clp;		/* Value we clip against */
 	VipsPel **table;	/* Lut converted to 2d array */
 	int overflow;		/* Number of overflows for non-uchar lut */
+	VipsBandFormat index_fmt;	/* Format of index image */
+	int index_bands;	/* Bands in index image */
+
+	/* Small uchar tables can use a vector shuffle.
+	 */
+	VipsSimdLutFn lut32;
+	VipsPel lut32_table[32];
+
+	/* For @coarse, every VIPS_MAPLUT_COARSE_STEP'th entry of the table,
+	 * as double.
+	 */
+	double **coarse_table;
 
 } VipsMaplut;
 
+/* Interpolate between every 64th element of large LUTs for @coarse.
+ */
+#define VIPS_MAPLUT_COARSE_SHIFT (6)
+#define VIPS_MAPLUT_COARSE_STEP (1 << VIPS_MAPLUT_COARSE_SHIFT)
+
 typedef VipsOperationClass VipsMaplutClass;
 
 G_DEFINE_TYPE( VipsMaplut, vips_maplut, VIPS_TYPE_OPERATION );
@@ -144,36 +171,32 @@ vips_maplut_start( VipsImage *out, void *a, void *b )
 #define loop( OUT ) { \
 	int b = maplut->nb; \
 	\
-	for( y = to; y < bo; y++ ) { \
-		for( z = 0; z < b; z++ ) { \
-			VipsPel *p = VIPS_REGION_ADDR( ir, le, y ); \
-			OUT *q = (OUT *) VIPS_REGION_ADDR( or, le, y ); \
-			OUT *tlut = (OUT *) maplut->table[z]; \
-			\
-			for( x = z; x < ne; x += b ) \
-				q[x] = tlut[p[x]]; \
-		} \
+	for( z = 0; z < b; z++ ) { \
+		VipsPel *p = in; \
+		OUT *q = (OUT *) out; \
+		OUT *tlut = (OUT *) maplut->table[z]; \
+		\
+		for( x = z; x < ne; x += b ) \
+			q[x] = tlut[p[x]]; \
 	} \
 }
 
 /* Map through n complex luts.
  */
 #define loopc( OUT ) { \
-	int b = in->Bands; \
+	int b = maplut->index_bands; \
 	\
-	for( y = to; y < bo; y++ ) { \
-		for( z = 0; z < b; z++ ) { \
-			VipsPel *p = VIPS_REGION_ADDR( ir, le, y ) + z; \
-			OUT *q = (OUT *) VIPS_REGION_ADDR( or, le, y ) + z * 2; \
-			OUT *tlut = (OUT *) maplut->table[z]; \
+	for( z = 0; z < b; z++ ) { \
+		VipsPel *p = in + z; \
+		OUT *q = (OUT *) out + z * 2; \
+		OUT *tlut = (OUT *) maplut->table[z]; \
+		\
+		for( x = 0; x < ne; x += b ) { \
+			int n = p[x] * 2; \
 			\
-			for( x = 0; x < ne; x += b ) { \
-				int n = p[x] * 2; \
-				\
-				q[0] = tlut[n]; \
-				q[1] = tlut[n + 1]; \
-				q += b * 2; \
-			} \
+			q[0] = tlut[n]; \
+			q[1] = tlut[n + 1]; \
+			q += b * 2; \
 		} \
 	} \
 }
@@ -181,48 +204,44 @@ vips_maplut_start( VipsImage *out, void *a, void *b )
 #define loopg( IN, OUT ) { \
 	int b = maplut->nb; \
 	\
-	for( y = to; y < bo; y++ ) { \
-		for( z = 0; z < b; z++ ) { \
-			IN *p = (IN *) VIPS_REGION_ADDR( ir, le, y ); \
-			OUT *q = (OUT *) VIPS_REGION_ADDR( or, le, y ); \
-			OUT *tlut = (OUT *) maplut->table[z]; \
+	for( z = 0; z < b; z++ ) { \
+		IN *p = (IN *) in; \
+		OUT *q = (OUT *) out; \
+		OUT *tlut = (OUT *) maplut->table[z]; \
+		\
+		for( x = z; x < ne; x += b ) { \
+			int index = p[x]; \
 			\
-			for( x = z; x < ne; x += b ) { \
-				int index = p[x]; \
-				\
-				if( index > maplut->clp ) { \
-					index = maplut->clp; \
-					seq->overflow++; \
-				} \
-				\
-				q[x] = tlut[index]; \
+			if( index > maplut->clp ) { \
+				index = maplut->clp; \
+				(*overflow)++; \
 			} \
+			\
+			q[x] = tlut[index]; \
 		} \
 	} \
 }
 
 #define loopcg( IN, OUT ) { \
-	int b = in->Bands; \
+	int b = maplut->index_bands; \
 	\
-	for( y = to; y < bo; y++ ) { \
-		for( z = 0; z < b; z++ ) { \
-			IN *p = (IN *) VIPS_REGION_ADDR( ir, le, y ) + z; \
-			OUT *q = (OUT *) VIPS_REGION_ADDR( or, le, y ) + z * 2; \
-			OUT *tlut = (OUT *) maplut->table[z]; \
+	for( z = 0; z < b; z++ ) { \
+		IN *p = (IN *) in + z; \
+		OUT *q = (OUT *) out + z * 2; \
+		OUT *tlut = (OUT *) maplut->table[z]; \
+		\
+		for( x = 0; x < ne; x += b ) { \
+			int index = p[x]; \
 			\
-			for( x = 0; x < ne; x += b ) { \
-				int index = p[x]; \
-				\
-				if( index > maplut->clp ) { \
-					index = maplut->clp; \
-					seq->overflow++; \
-				} \
-				\
-				q[0] = tlut[index * 2]; \
-				q[1] = tlut[index * 2 + 1]; \
-				\
-				q += b * 2; \
+			if( index > maplut->clp ) { \
+				index = maplut->clp; \
+				(*overflow)++; \
 			} \
+			\
+			q[0] = tlut[index * 2]; \
+			q[1] = tlut[index * 2 + 1]; \
+			\
+			q += b * 2; \
 		} \
 	} \
 }
@@ -231,32 +250,26 @@ vips_maplut_start( VipsImage *out, void *a, void *b )
  */
 #define loop1( OUT ) { \
 	OUT *tlut = (OUT *) maplut->table[0]; \
+	OUT *q = (OUT *) out; \
+	VipsPel *p = in; \
 	\
-	for( y = to; y < bo; y++ ) { \
-		OUT *q = (OUT *) VIPS_REGION_ADDR( or, le, y ); \
-		VipsPel *p = VIPS_REGION_ADDR( ir, le, y ); \
-		\
-		for( x = 0; x < ne; x++ ) \
-			q[x] = tlut[p[x]]; \
-	} \
+	for( x = 0; x < ne; x++ ) \
+		q[x] = tlut[p[x]]; \
 }
 
 /* Map image through one complex lut.
  */
 #define loop1c( OUT ) { \
 	OUT *tlut = (OUT *) maplut->table[0]; \
+	OUT *q = (OUT *) out; \
+	VipsPel *p = in; \
 	\
-	for( y = to; y < bo; y++ ) { \
-		OUT *q = (OUT *) VIPS_REGION_ADDR( or, le, y ); \
-		VipsPel *p = VIPS_REGION_ADDR( ir, le, y ); \
+	for( x = 0; x < ne; x++ ) { \
+		int n = p[x] * 2; \
 		\
-		for( x = 0; x < ne; x++ ) { \
-			int n = p[x] * 2; \
-			\
-			q[0] = tlut[n]; \
-			q[1] = tlut[n + 1]; \
-			q += 2; \
-		} \
+		q[0] = tlut[n]; \
+		q[1] = tlut[n + 1]; \
+		q += 2; \
 	} \
 }
 
@@ -265,43 +278,37 @@ vips_maplut_start( VipsImage *out, void *a, void *b )
  */
 #define loop1g( IN, OUT ) { \
 	OUT *tlut = (OUT *) maplut->table[0]; \
+	OUT *q = (OUT *) out; \
+	IN *p = (IN *) in; \
 	\
-	for( y = to; y < bo; y++ ) { \
-		OUT *q = (OUT *) VIPS_REGION_ADDR( or, le, y ); \
-		IN *p = (IN *) VIPS_REGION_ADDR( ir, le, y ); \
+	for( x = 0; x < ne; x++ ) { \
+		int index = p[x]; \
 		\
-		for( x = 0; x < ne; x++ ) { \
-			int index = p[x]; \
-			\
-			if( index > maplut->clp ) { \
-				index = maplut->clp; \
-				seq->overflow++; \
-			} \
-			\
-			q[x] = tlut[index]; \
+		if( index > maplut->clp ) { \
+			index = maplut->clp; \
+			(*overflow)++; \
 		} \
+		\
+		q[x] = tlut[index]; \
 	} \
 }
 
 #define loop1cg( IN, OUT ) { \
 	OUT *tlut = (OUT *) maplut->table[0]; \
+	OUT *q = (OUT *) out; \
+	IN *p = (IN *) in; \
 	\
-	for( y = to; y < bo; y++ ) { \
-		OUT *q = (OUT *) VIPS_REGION_ADDR( or, le, y ); \
-		IN *p = (IN *) VIPS_REGION_ADDR( ir, le, y ); \
+	for( x = 0; x < ne; x++ ) { \
+		int index = p[x]; \
 		\
-		for( x = 0; x < ne; x++ ) { \
-			int index = p[x]; \
-			\
-			if( index > maplut->clp ) { \
-				index = maplut->clp; \
-				seq->overflow++; \
-			} \
-			\
-			q[0] = tlut[index * 2]; \
-			q[1] = tlut[index * 2 + 1]; \
-			q += 2; \
+		if( index > maplut->clp ) { \
+			index = maplut->clp; \
+			(*overflow)++; \
 		} \
+		\
+		q[0] = tlut[index * 2]; \
+		q[1] = tlut[index * 2 + 1]; \
+		q += 2; \
 	} \
 }
 
@@ -309,17 +316,14 @@ vips_maplut_start( VipsImage *out, void *a, void *b )
  */
 #define loop1m( OUT ) { \
 	OUT **tlut = (OUT **) maplut->table; \
+	OUT *q = (OUT *) out; \
+	VipsPel *p = in; \
 	\
-	for( y = to; y < bo; y++ ) { \
-		OUT *q = (OUT *) VIPS_REGION_ADDR( or, le, y ); \
-		VipsPel *p = VIPS_REGION_ADDR( ir, le, y ); \
+	for( i = 0, x = 0; x < np; x++ ) { \
+		int n = p[x]; \
 		\
-		for( i = 0, x = 0; x < np; x++ ) { \
-			int n = p[x]; \
-			\
-			for( z = 0; z < maplut->nb; z++, i++ ) \
-				q[i] = tlut[z][n]; \
-		} \
+		for( z = 0; z < maplut->nb; z++, i++ ) \
+			q[i] = tlut[z][n]; \
 	} \
 }
 
@@ -327,19 +331,16 @@ vips_maplut_start( VipsImage *out, void *a, void *b )
  */
 #define loop1cm( OUT ) { \
 	OUT **tlut = (OUT **) maplut->table; \
+	OUT *q = (OUT *) out; \
+	VipsPel *p = in; \
 	\
-	for( y = to; y < bo; y++ ) { \
-		OUT *q = (OUT *) VIPS_REGION_ADDR( or, le, y ); \
-		VipsPel *p = VIPS_REGION_ADDR( ir, le, y ); \
+	for( x = 0; x < np; x++ ) { \
+		int n = p[x] * 2; \
 		\
-		for( x = 0; x < np; x++ ) { \
-			int n = p[x] * 2; \
-			\
-			for( z = 0; z < maplut->nb; z++ ) { \
-				q[0] = tlut[z][n]; \
-				q[1] = tlut[z][n+1]; \
-				q += 2; \
-			} \
+		for( z = 0; z < maplut->nb; z++ ) { \
+			q[0] = tlut[z][n]; \
+			q[1] = tlut[z][n+1]; \
+			q += 2; \
 		} \
 	} \
 }
@@ -348,22 +349,19 @@ vips_maplut_start( VipsImage *out, void *a, void *b )
  */
 #define loop1gm( IN, OUT ) { \
 	OUT **tlut = (OUT **) maplut->table; \
+	IN *p = (IN *) in; \
+	OUT *q = (OUT *) out; \
 	\
-	for( y = to; y < bo; y++ ) { \
-		IN *p = (IN *) VIPS_REGION_ADDR( ir, le, y ); \
-		OUT *q = (OUT *) VIPS_REGION_ADDR( or, le, y ); \
+	for( i = 0, x = 0; x < np; x++ ) { \
+		int n = p[x]; \
 		\
-		for( i = 0, x = 0; x < np; x++ ) { \
-			int n = p[x]; \
-			\
-			if( n > maplut->clp ) { \
-				n = maplut->clp; \
-				seq->overflow++; \
-			} \
-			\
-			for( z = 0; z < maplut->nb; z++, i++ ) \
-				q[i] = tlut[z][n]; \
+		if( n > maplut->clp ) { \
+			n = maplut->clp; \
+			(*overflow)++; \
 		} \
+		\
+		for( z = 0; z < maplut->nb; z++, i++ ) \
+			q[i] = tlut[z][n]; \
 	} \
 }
 
@@ -371,32 +369,131 @@ vips_maplut_start( VipsImage *out, void *a, void *b )
  */
 #define loop1cgm( IN, OUT ) { \
 	OUT **tlut = (OUT **) maplut->table; \
+	IN *p = (IN *) in; \
+	OUT *q = (OUT *) out; \
 	\
-	for( y = to; y < bo; y++ ) { \
-		IN *p = (IN *) VIPS_REGION_ADDR( ir, le, y ); \
-		OUT *q = (OUT *) VIPS_REGION_ADDR( or, le, y ); \
+	for( x = 0; x < np; x++ ) { \
+		int n = p[x]; \
+		\
+		if( n > maplut->clp ) { \
+			n = maplut->clp; \
+			(*overflow)++; \
+		} \
 		\
-		for( x = 0; x < np; x++ ) { \
-			int n = p[x]; \
+		for( z = 0; z < maplut->nb; z++ ) { \
+			q[0] = tlut[z][n * 2]; \
+			q[1] = tlut[z][n * 2 + 1]; \
+			q += 2; \
+		} \
+	} \
+}
+
+/* Map a 3 or 4 band uchar image through a LUT with the same number of bands,
+ * a pixel at a time. Tables are padded to 256 elements for uchar input, so
+ * we don't need to clip.
+ */
+#define loop3( OUT ) { \
+	OUT **tlut = (OUT **) maplut->table; \
+	OUT *t0 = tlut[0]; \
+	OUT *t1 = tlut[1]; \
+	OUT *t2 = tlut[2]; \
+	OUT *q = (OUT *) out; \
+	VipsPel *p = in; \
+	\
+	for( x = 0; x < ne; x += 3 ) { \
+		q[x] = t0[p[x]]; \
+		q[x + 1] = t1[p[x + 1]]; \
+		q[x + 2] = t2[p[x + 2]]; \
+	} \
+}
+
+#define loop4( OUT ) { \
+	OUT **tlut = (OUT **) maplut->table; \
+	OUT *t0 = tlut[0]; \
+	OUT *t1 = tlut[1]; \
+	OUT *t2 = tlut[2]; \
+	OUT *t3 = tlut[3]; \
+	OUT *q = (OUT *) out; \
+	VipsPel *p = in; \
+	\
+	for( x = 0; x < ne; x += 4 ) { \
+		q[x] = t0[p[x]]; \
+		q[x + 1] = t1[p[x + 1]]; \
+		q[x + 2] = t2[p[x + 2]]; \
+		q[x + 3] = t3[p[x + 3]]; \
+	} \
+}
+
+/* Map a 1-band uchar image through a 3 band LUT, eg. a palette.
+ */
+#define loop1m3( OUT ) { \
+	OUT **tlut = (OUT **) maplut->table; \
+	OUT *t0 = tlut[0]; \
+	OUT *t1 = tlut[1]; \
+	OUT *t2 = tlut[2]; \
+	OUT *q = (OUT *) out; \
+	VipsPel *p = in; \
+	\
+	for( x = 0; x < np; x++ ) { \
+		int n = p[x]; \
+		\
+		q[0] = t0[n]; \
+		q[1] = t1[n]; \
+		q[2] = t2[n]; \
+		q += 3; \
+	} \
+}
+
+/* Interpolate a coarse LUT for ushort input.
+ */
+#define loop_coarse( OUT, ROUND ) { \
+	int b = maplut->nb; \
+	\
+	for( z = 0; z < b; z++ ) { \
+		unsigned short *p = (unsigned short *) in; \
+		OUT *q = (OUT *) out; \
+		double *c = maplut->coarse_table[z]; \
+		\
+		for( x = z; x < ne; x += b ) { \
+			int index = p[x]; \
+			int k; \
+			double f; \
 			\
-			if( n > maplut->clp ) { \
-				n = maplut->clp; \
-				seq->overflow++; \
+			if( index > maplut->clp ) { \
+				index = maplut->clp; \
+				(*overflow)++; \
 			} \
 			\
-			for( z = 0; z < maplut->nb; z++ ) { \
-				q[0] = tlut[z][n * 2]; \
-				q[1] = tlut[z][n * 2 + 1]; \
-				q += 2; \
-			} \
+			k = index >> VIPS_MAPLUT_COARSE_SHIFT; \
+			f = (index & (VIPS_MAPLUT_COARSE_STEP - 1)) * \
+				(1.0 / VIPS_MAPLUT_COARSE_STEP); \
+			q[x] = ROUND( c[k] + (c[k + 1] - c[k]) * f ); \
 		} \
 	} \
 }
 
+#define NOROUND( V ) (V)
+
+/* Switch for non-complex LUT types.
+ */
+#define lut_switch( LOOP ) \
+	switch( maplut->fmt ) { \
+	case VIPS_FORMAT_UCHAR:		LOOP( unsigned char ); break; \
+	case VIPS_FORMAT_CHAR:		LOOP( char ); break; \
+	case VIPS_FORMAT_USHORT:	LOOP( unsigned short ); break; \
+	case VIPS_FORMAT_SHORT:		LOOP( short ); break; \
+	case VIPS_FORMAT_UINT:		LOOP( unsigned int ); break; \
+	case VIPS_FORMAT_INT:		LOOP( int ); break; \
+	case VIPS_FORMAT_FLOAT:		LOOP( float ); break; \
+	case VIPS_FORMAT_DOUBLE:	LOOP( double ); break; \
+	default: \
+		g_assert_not_reached(); \
+	}
+
 /* Switch for input types. Has to be uint type!
  */
 #define inner_switch( UCHAR, GEN, OUT ) \
-	switch( ir->im->BandFmt ) { \
+	switch( maplut->index_fmt ) { \
 	case VIPS_FORMAT_UCHAR:		UCHAR( OUT ); break; \
 	case VIPS_FORMAT_USHORT:	GEN( unsigned short, OUT ); break; \
 	case VIPS_FORMAT_UINT:		GEN( unsigned int, OUT ); break; \
@@ -434,6 +531,68 @@ vips_maplut_start( VipsImage *out, void *a, void *b )
 		g_assert_not_reached(); \
 	}
 
+/* Map a line of np pixels, ne elements in the output, counting overflows.
+ */
+static void
+vips_maplut_line( VipsMaplut *maplut, 
+	VipsPel *out, VipsPel *in, int np, int ne, int *overflow )
+{
+	int x, z, i;
+
+	if( maplut->coarse_table ) {
+		switch( maplut->fmt ) {
+		case VIPS_FORMAT_UCHAR:
+			loop_coarse( unsigned char, VIPS_RINT ); break;
+		case VIPS_FORMAT_CHAR:
+			loop_coarse( char, VIPS_RINT ); break;
+		case VIPS_FORMAT_USHORT:
+			loop_coarse( unsigned short, VIPS_RINT ); break;
+		case VIPS_FORMAT_SHORT:
+			loop_coarse( short, VIPS_RINT ); break;
+		case VIPS_FORMAT_UINT:
+			loop_coarse( unsigned int, VIPS_RINT ); break;
+		case VIPS_FORMAT_INT:
+			loop_coarse( int, VIPS_RINT ); break;
+		case VIPS_FORMAT_FLOAT:
+			loop_coarse( float, NOROUND ); break;
+		case VIPS_FORMAT_DOUBLE:
+			loop_coarse( double, NOROUND ); break;
+		default:
+			g_assert_not_reached();
+		}
+	}
+	else if( maplut->lut32 )
+		maplut->lut32( out, in, ne, maplut->lut32_table, maplut->clp );
+	else if( maplut->index_fmt == VIPS_FORMAT_UCHAR &&
+		!vips_band_format_iscomplex( maplut->fmt ) &&
+		maplut->nb == 3 &&
+		maplut->index_bands == 3 )
+		lut_switch( loop3 )
+	else if( maplut->index_fmt == VIPS_FORMAT_UCHAR &&
+		!vips_band_format_iscomplex( maplut->fmt ) &&
+		maplut->nb == 4 &&
+		maplut->index_bands == 4 )
+		lut_switch( loop4 )
+	else if( maplut->index_fmt == VIPS_FORMAT_UCHAR &&
+		!vips_band_format_iscomplex( maplut->fmt ) &&
+		maplut->nb == 3 &&
+		maplut->index_bands == 1 )
+		lut_switch( loop1m3 )
+	else if( maplut->nb == 1 )
+		/* One band lut.
+		 */
+		outer_switch( loop1, loop1c, loop1g, loop1cg ) 
+	else 
+		/* Many band lut.
+		 */
+		if( maplut->index_bands == 1 )
+			/* ... but 1 band input.
+			 */
+			outer_switch( loop1m, loop1cm, loop1gm, loop1cgm ) 
+		else
+			outer_switch( loop, loopc, loopg, loopcg )
+}
+
 /* Do a map.
  */
 static int 
@@ -441,7 +600,6 @@ vips_maplut_gen( VipsRegion *or, void *vseq, void *a, void *b,
 	gboolean *stop )
 {
 	VipsMaplutSequence *seq = (VipsMaplutSequence *) vseq;
-	VipsImage *in = (VipsImage *) a;
 	VipsMaplut *maplut = (VipsMaplut *) b;
 	VipsRegion *ir = seq->ir;
 	VipsRect *r = &or->valid;
@@ -451,28 +609,37 @@ vips_maplut_gen( VipsRegion *or, void *vseq, void *a, void *b,
 	int np = r->width;			/* Pels across region */
 	int ne = VIPS_REGION_N_ELEMENTS( or );	/* Number of elements */
 
-	int x, y, z, i;
+	int y;
 
 	if( vips_region_prepare( ir, r ) )
 		return( -1 );
 
-	if( maplut->nb == 1 )
-		/* One band lut.
-		 */
-		outer_switch( loop1, loop1c, loop1g, loop1cg ) 
-	else 
-		/* Many band lut.
-		 */
-		if( in->Bands == 1 )
-			/* ... but 1 band input.
-			 */
-			outer_switch( loop1m, loop1cm, loop1gm, loop1cgm ) 
-		else
-			outer_switch( loop, loopc, loopg, loopcg )
+	for( y = to; y < bo; y++ ) 
+		vips_maplut_line( maplut, 
+			VIPS_REGION_ADDR( or, le, y ), 
+			VIPS_REGION_ADDR( ir, le, y ), 
+			np, ne, &seq->overflow );
 
 	return( 0 );
 }
 
+/* A line at a time for pipeline fusion. There's no sequence to hold the
+ * overflow count, so add it in as we go.
+ */
+static void
+vips_maplut_point( VipsPel *out, VipsPel **in, int width, void *a )
+{
+	VipsMaplut *maplut = (VipsMaplut *) a;
+
+	int overflow;
+
+	overflow = 0;
+	vips_maplut_line( maplut, out, in[0], 
+		width, width * maplut->out->Bands, &overflow );
+	if( overflow )
+		g_atomic_int_add( &maplut->overflow, overflow );
+}
+
 /* Destroy a sequence value.
  */
 static int
@@ -503,6 +670,36 @@ static int bandfmt_maplut[10] = {
    UC, UC, US, US, UI, UI, UI, UI, UI, UI
 };
 
+/* Get a table element as a double.
+ */
+static double
+vips_maplut_element( VipsMaplut *maplut, int b, int x )
+{
+	VipsPel *p = maplut->table[b];
+
+	switch( maplut->fmt ) {
+	case VIPS_FORMAT_UCHAR:
+		return( ((unsigned char *) p)[x] );
+	case VIPS_FORMAT_CHAR:
+		return( ((signed char *) p)[x] );
+	case VIPS_FORMAT_USHORT:
+		return( ((unsigned short *) p)[x] );
+	case VIPS_FORMAT_SHORT:
+		return( ((short *) p)[x] );
+	case VIPS_FORMAT_UINT:
+		return( ((unsigned int *) p)[x] );
+	case VIPS_FORMAT_INT:
+		return( ((int *) p)[x] );
+	case VIPS_FORMAT_FLOAT:
+		return( ((float *) p)[x] );
+	case VIPS_FORMAT_DOUBLE:
+		return( ((double *) p)[x] );
+	default:
+		g_assert_not_reached();
+		return( 0.0 );
+	}
+}
+
 /* Repack lut into a set of band arrays. If we're just passing one band of the
  * image through the lut, put the identity function in the other bands. 
  */ 
@@ -562,6 +759,8 @@ vips_maplut_build( VipsObject *object )
 
 	VipsImage *in;
 	VipsImage *lut;
+	VipsImage *point[2];
+	int table_size;
 	int i;
 
 	g_object_set( object, "out", vips_image_new(), NULL ); 
@@ -630,13 +829,17 @@ vips_maplut_build( VipsObject *object )
 	else
 		maplut->nb = lut->Bands;
 
-	/* Attach tables.
+	/* Attach tables. uchar input can index all 256 elements without
+	 * clipping, so make sure they are there.
 	 */
+	table_size = maplut->sz;
+	if( in->BandFmt == VIPS_FORMAT_UCHAR )
+		table_size = VIPS_MAX( table_size, 256 );
 	if( !(maplut->table = VIPS_ARRAY( maplut, maplut->nb, VipsPel * )) ) 
                 return( -1 );
 	for( i = 0; i < maplut->nb; i++ )
 		if( !(maplut->table[i] = VIPS_ARRAY( maplut, 
-			maplut->sz * maplut->es, VipsPel )) )
+			table_size * maplut->es, VipsPel )) )
 			return( -1 );
 
 	/* Scan LUT and fill table.
@@ -666,11 +869,71 @@ vips_maplut_build( VipsObject *object )
 		g_assert_not_reached(); 
 	}
 
+	/* Pad out with the last element, as the clip would.
+	 */
+	for( i = 0; i < maplut->nb; i++ ) {
+		int x;
+
+		for( x = maplut->sz; x < table_size; x++ )
+			memcpy( maplut->table[i] + x * maplut->es,
+				maplut->table[i] + maplut->clp * maplut->es,
+				maplut->es );
+	}
+
+	maplut->index_fmt = in->BandFmt;
+	maplut->index_bands = in->Bands;
+
+	/* A one-band uchar table of up to 32 elements can go through a
+	 * vector shuffle.
+	 */
+	if( maplut->index_fmt == VIPS_FORMAT_UCHAR &&
+		maplut->es == 1 &&
+		maplut->nb == 1 &&
+		maplut->sz <= 32 &&
+		(maplut->lut32 = (VipsSimdLutFn)
+			vips_simd_get( VIPS_SIMD_LUT32, VIPS_FORMAT_UCHAR )) )
+		memcpy( maplut->lut32_table, maplut->table[0], 32 );
+
+	/* Make the coarse tables, if we can.
+	 */
+	if( maplut->coarse &&
+		maplut->index_fmt == VIPS_FORMAT_USHORT &&
+		!vips_band_format_iscomplex( maplut->fmt ) &&
+		(maplut->nb == 1 ||
+		 maplut->nb == maplut->index_bands) &&
+		maplut->sz > 4 * VIPS_MAPLUT_COARSE_STEP ) {
+		int n = (maplut->clp >> VIPS_MAPLUT_COARSE_SHIFT) + 2;
+
+		if( !(maplut->coarse_table =
+			VIPS_ARRAY( maplut, maplut->nb, double * )) )
+			return( -1 );
+
+		for( i = 0; i < maplut->nb; i++ ) {
+			int k;
+
+			if( !(maplut->coarse_table[i] =
+				VIPS_ARRAY( maplut, n, double )) )
+				return( -1 );
+
+			for( k = 0; k < n; k++ ) {
+				int x = VIPS_MIN( k * VIPS_MAPLUT_COARSE_STEP,
+					maplut->clp );
+
+				maplut->coarse_table[i][k] =
+					vips_maplut_element( maplut, i, x );
+			}
+		}
+	}
+
 	if( vips_image_generate( maplut->out,
 		vips_maplut_start, vips_maplut_gen, vips_maplut_stop, 
 		in, maplut ) )
 		return( -1 );
 
+	point[0] = in;
+	point[1] = NULL;
+	vips__point_attach( maplut->out, point, vips_maplut_point, maplut ); 
+
 	return( 0 );
 }
 
@@ -715,6 +978,13 @@ vips_maplut_class_init( VipsMaplutClass *class )
 		G_STRUCT_OFFSET( VipsMaplut, band ),
 		-1, 10000, -1 ); 
 
+	VIPS_ARG_BOOL( class, "coarse", 5,
+		_( "Coarse" ),
+		_( "Interpolate a coarse LUT for 16-bit input" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsMaplut, coarse ),
+		FALSE );
+
 }
 
 static void
@@ -733,6 +1003,7 @@ vips_maplut_init( VipsMaplut *maplut )
  * Optional arguments:
  *
  * * @band: apply one-band @lut to this band of @in
+ * * @coarse: interpolate a coarse LUT for 16-bit input
  *
  * Map an image through another image acting as a LUT (Look Up Table). 
  * The lut may have any type and the output image will be that type.
@@ -755,6 +1026,11 @@ vips_maplut_init( VipsMaplut *maplut )
  * separately. If @in has one band, then @lut may have many bands and
  * the output will have the same number of bands as @lut.
  *
+ * Set @coarse to map 16-bit input through every 64th element of @lut and
+ * interpolate linearly between them. This is much quicker for large tables,
+ * since the table is small enough to stay in cache, but it's only correct if
+ * @lut is smooth, for example, a tone curve.
+ *
  * See also: vips_hist_find(), vips_identity().
  *
  * Returns: 0 on success, -1 on error
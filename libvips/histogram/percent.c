@@ -15,6 +15,8 @@
  * 20/9/13
  * 	- wrap as a class
  * 	- more accurate
+ * 14/10/18
+ * 	- only find the row profile
  */
 
 /*
@@ -84,7 +86,9 @@ vips_percent_build( VipsObject *object )
 		vips_hist_norm( t[1], &t[2], NULL ) ||
 		vips_more_const1( t[2], &t[3], 
 			(percent->percent / 100.0) * t[2]->Xsize, NULL ) ||
-		vips_profile( t[3], &t[5], &t[6], NULL ) ||
+		vips_profile( t[3], &t[5], &t[6],
+			"skip_columns", TRUE,
+			NULL ) ||
 		vips_avg( t[6], &threshold, NULL ) ) 
 		return( -1 );
 
@@ -148,7 +152,9 @@ vips_percent_init( VipsPercent *percent )
  * The function works for uchar and ushort images only.  It can be used 
  * to threshold the scaled result of a filtering operation.
  *
- * See also: vips_hist_find(), vips_profile().
+ * To find several percentiles in one pass, use vips_percentiles().
+ *
+ * See also: vips_hist_find(), vips_profile(), vips_percentiles().
  *
  * Returns: 0 on success, -1 on error
  */
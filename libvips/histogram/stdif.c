@@ -24,6 +24,9 @@
  * 10/8/13	
  * 	- wrapped as a class using hist_local.c
  * 	- many bands
+ * 15/10/18
+ * 	- carry column sums down the region, so each output pixel is O(1)
+ * 	- add ushort and float support, with 64-bit and compensated sums
  */
 
 /*
@@ -61,6 +64,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include <math.h>
 
 #include <vips/vips.h>
@@ -90,121 +94,330 @@ G_DEFINE_TYPE( VipsStdif, vips_stdif, VIPS_TYPE_OPERATION );
  */
 #define MAX_BANDS (100)
 
+/* Per-thread state.
+ */
+typedef struct _VipsStdifSequence {
+	VipsRegion *ir;
+
+	/* The sum and sum of squares down each input column (and band) of
+	 * the window, carried down the region a line at a time. Integer
+	 * images use the 64-bit ones, float images use the double ones plus
+	 * a compensation term for each.
+	 */
+	gint64 *isum;
+	gint64 *isum2;
+	double *dsum;
+	double *dsum2;
+	double *dcomp;
+	double *dcomp2;
+
+	/* Number of elements allocated in each.
+	 */
+	int n;
+} VipsStdifSequence;
+
+static int
+vips_stdif_stop( void *vseq, void *a, void *b )
+{
+	VipsStdifSequence *seq = (VipsStdifSequence *) vseq;
+
+	VIPS_UNREF( seq->ir );
+	VIPS_FREE( seq->isum );
+	VIPS_FREE( seq->isum2 );
+	VIPS_FREE( seq->dsum );
+	VIPS_FREE( seq->dsum2 );
+	VIPS_FREE( seq->dcomp );
+	VIPS_FREE( seq->dcomp2 );
+	VIPS_FREE( seq );
+
+	return( 0 );
+}
+
+static void *
+vips_stdif_start( VipsImage *out, void *a, void *b )
+{
+	VipsImage *in = (VipsImage *) a;
+
+	VipsStdifSequence *seq;
+
+	if( !(seq = VIPS_NEW( NULL, VipsStdifSequence )) )
+		return( NULL );
+	seq->ir = NULL;
+	seq->isum = NULL;
+	seq->isum2 = NULL;
+	seq->dsum = NULL;
+	seq->dsum2 = NULL;
+	seq->dcomp = NULL;
+	seq->dcomp2 = NULL;
+	seq->n = 0;
+
+	if( !(seq->ir = vips_region_new( in )) ) {
+		vips_stdif_stop( seq, NULL, NULL );
+		return( NULL );
+	}
+
+	return( seq );
+}
+
+/* Make sure the column sums can hold n elements.
+ */
+static int
+vips_stdif_sequence_size( VipsStdifSequence *seq, int n, gboolean isfloat )
+{
+	if( seq->n < n ) {
+		VIPS_FREE( seq->isum );
+		VIPS_FREE( seq->isum2 );
+		VIPS_FREE( seq->dsum );
+		VIPS_FREE( seq->dsum2 );
+		VIPS_FREE( seq->dcomp );
+		VIPS_FREE( seq->dcomp2 );
+		seq->n = 0;
+
+		if( isfloat ) {
+			if( !(seq->dsum = VIPS_ARRAY( NULL, n, double )) ||
+				!(seq->dsum2 = VIPS_ARRAY( NULL, n, double )) ||
+				!(seq->dcomp = VIPS_ARRAY( NULL, n, double )) ||
+				!(seq->dcomp2 = VIPS_ARRAY( NULL, n, double )) )
+				return( -1 );
+		}
+		else {
+			if( !(seq->isum = VIPS_ARRAY( NULL, n, gint64 )) ||
+				!(seq->isum2 = VIPS_ARRAY( NULL, n, gint64 )) )
+				return( -1 );
+		}
+
+		seq->n = n;
+	}
+
+	return( 0 );
+}
+
+/* Add to a sum with Neumaier's compensation, so long runs of adds and
+ * subtracts down a column don't drift.
+ */
+static inline void
+vips_stdif_add( double *sum, double *comp, double v )
+{
+	double t = *sum + v;
+
+	if( fabs( *sum ) >= fabs( v ) )
+		*comp += (*sum - t) + v;
+	else
+		*comp += (v - t) + *sum;
+
+	*sum = t;
+}
+
+/* Transform one element, given the sums over its window.
+ */
+#define TRANSFORM( V, SUM, SUM2 ) { \
+	double mean = (double) (SUM) / npel; \
+	double var = VIPS_MAX( 0.0, (double) (SUM2) / npel - mean * mean ); \
+	double sig = sqrt( var ); \
+	\
+	res = f1 + f2 * mean + \
+		((double) (V) - mean) * (f3 / (stdif->s0 + stdif->b * sig)); \
+}
+
+/* Integer images. Column sums are exact, so we can just add the line
+ * entering the window and subtract the line leaving it.
+ */
+#define STDIF_INT( TYPE, MAX ) { \
+	gint64 * restrict cs = seq->isum; \
+	gint64 * restrict cs2 = seq->isum2; \
+	\
+	memset( cs, 0, ne * sizeof( gint64 ) ); \
+	memset( cs2, 0, ne * sizeof( gint64 ) ); \
+	for( j = 0; j < stdif->height; j++ ) { \
+		TYPE *p = (TYPE *) VIPS_REGION_ADDR( ir, r->left, r->top + j ); \
+		\
+		for( i = 0; i < ne; i++ ) { \
+			cs[i] += p[i]; \
+			cs2[i] += (gint64) p[i] * p[i]; \
+		} \
+	} \
+	\
+	for( y = 0; y < r->height; y++ ) { \
+		TYPE *p = (TYPE *) VIPS_REGION_ADDR( ir, r->left, r->top + y ); \
+		TYPE *pc = (TYPE *) VIPS_REGION_ADDR( ir, \
+			r->left + stdif->width / 2, \
+			r->top + y + stdif->height / 2 ); \
+		TYPE *q = (TYPE *) VIPS_REGION_ADDR( or, r->left, r->top + y ); \
+		\
+		gint64 sum[MAX_BANDS]; \
+		gint64 sum2[MAX_BANDS]; \
+		\
+		for( k = 0; k < bands; k++ ) { \
+			sum[k] = 0; \
+			sum2[k] = 0; \
+			for( x = 0; x < stdif->width; x++ ) { \
+				sum[k] += cs[x * bands + k]; \
+				sum2[k] += cs2[x * bands + k]; \
+			} \
+		} \
+		\
+		for( x = 0; x < r->width; x++ ) \
+			for( k = 0; k < bands; k++ ) { \
+				double res; \
+				\
+				i = x * bands + k; \
+				TRANSFORM( pc[i], sum[k], sum2[k] ); \
+				\
+				if( res < 0.0 ) \
+					q[i] = 0; \
+				else if( res >= MAX ) \
+					q[i] = MAX; \
+				else \
+					q[i] = res + 0.5; \
+				\
+				/* Slide the window right. \
+				 */ \
+				if( x < r->width - 1 ) { \
+					sum[k] += cs[i + wb] - cs[i]; \
+					sum2[k] += cs2[i + wb] - cs2[i]; \
+				} \
+			} \
+		\
+		/* Move the column sums down a line. \
+		 */ \
+		if( y < r->height - 1 ) { \
+			TYPE *p1 = (TYPE *) VIPS_REGION_ADDR( ir, \
+				r->left, r->top + y + stdif->height ); \
+			\
+			for( i = 0; i < ne; i++ ) { \
+				cs[i] += p1[i] - p[i]; \
+				cs2[i] += (gint64) p1[i] * p1[i] - \
+					(gint64) p[i] * p[i]; \
+			} \
+		} \
+	} \
+}
+
+/* Float images. Column sums carry a compensation term, window sums along a
+ * line are plain double.
+ */
+#define STDIF_FLOAT( TYPE ) { \
+	double * restrict cs = seq->dsum; \
+	double * restrict cs2 = seq->dsum2; \
+	double * restrict cc = seq->dcomp; \
+	double * restrict cc2 = seq->dcomp2; \
+	\
+	memset( cs, 0, ne * sizeof( double ) ); \
+	memset( cs2, 0, ne * sizeof( double ) ); \
+	memset( cc, 0, ne * sizeof( double ) ); \
+	memset( cc2, 0, ne * sizeof( double ) ); \
+	for( j = 0; j < stdif->height; j++ ) { \
+		TYPE *p = (TYPE *) VIPS_REGION_ADDR( ir, r->left, r->top + j ); \
+		\
+		for( i = 0; i < ne; i++ ) { \
+			vips_stdif_add( &cs[i], &cc[i], p[i] ); \
+			vips_stdif_add( &cs2[i], &cc2[i], \
+				(double) p[i] * p[i] ); \
+		} \
+	} \
+	\
+	for( y = 0; y < r->height; y++ ) { \
+		TYPE *p = (TYPE *) VIPS_REGION_ADDR( ir, r->left, r->top + y ); \
+		TYPE *pc = (TYPE *) VIPS_REGION_ADDR( ir, \
+			r->left + stdif->width / 2, \
+			r->top + y + stdif->height / 2 ); \
+		TYPE *q = (TYPE *) VIPS_REGION_ADDR( or, r->left, r->top + y ); \
+		\
+		double sum[MAX_BANDS]; \
+		double sum2[MAX_BANDS]; \
+		\
+		for( k = 0; k < bands; k++ ) { \
+			sum[k] = 0.0; \
+			sum2[k] = 0.0; \
+			for( x = 0; x < stdif->width; x++ ) { \
+				i = x * bands + k; \
+				sum[k] += cs[i] + cc[i]; \
+				sum2[k] += cs2[i] + cc2[i]; \
+			} \
+		} \
+		\
+		for( x = 0; x < r->width; x++ ) \
+			for( k = 0; k < bands; k++ ) { \
+				double res; \
+				\
+				i = x * bands + k; \
+				TRANSFORM( pc[i], sum[k], sum2[k] ); \
+				q[i] = res; \
+				\
+				if( x < r->width - 1 ) { \
+					sum[k] += (cs[i + wb] + cc[i + wb]) - \
+						(cs[i] + cc[i]); \
+					sum2[k] += (cs2[i + wb] + cc2[i + wb]) - \
+						(cs2[i] + cc2[i]); \
+				} \
+			} \
+		\
+		if( y < r->height - 1 ) { \
+			TYPE *p1 = (TYPE *) VIPS_REGION_ADDR( ir, \
+				r->left, r->top + y + stdif->height ); \
+			\
+			for( i = 0; i < ne; i++ ) { \
+				vips_stdif_add( &cs[i], &cc[i], p1[i] ); \
+				vips_stdif_add( &cs[i], &cc[i], -p[i] ); \
+				vips_stdif_add( &cs2[i], &cc2[i], \
+					(double) p1[i] * p1[i] ); \
+				vips_stdif_add( &cs2[i], &cc2[i], \
+					-(double) p[i] * p[i] ); \
+			} \
+		} \
+	} \
+}
+
 static int
 vips_stdif_generate( VipsRegion *or, 
 	void *vseq, void *a, void *b, gboolean *stop )
 {
 	VipsRect *r = &or->valid;
-	VipsRegion *ir = (VipsRegion *) vseq;
+	VipsStdifSequence *seq = (VipsStdifSequence *) vseq;
+	VipsRegion *ir = seq->ir;
 	VipsImage *in = (VipsImage *) a;
 	VipsStdif *stdif = (VipsStdif *) b;
 	int bands = in->Bands; 
-	int npel = stdif->width * stdif->width;
+	int npel = stdif->width * stdif->height;
+	double f1 = stdif->a * stdif->m0;
+	double f2 = 1.0 - stdif->a;
+	double f3 = stdif->b * stdif->s0;
+
+	/* Elements across the input we need, and the step from the column
+	 * leaving the window to the column entering it.
+	 */
+	int ne = (r->width + stdif->width - 1) * bands;
+	int wb = stdif->width * bands;
 
 	VipsRect irect;
-	int y;
-	int lsk;
-	int centre;			/* Offset to move to centre of window */
+	int x, y, i, j, k;
 
 	/* What part of ir do we need?
 	 */
-	irect.left = or->valid.left;
-	irect.top = or->valid.top;
-	irect.width = or->valid.width + stdif->width;
-	irect.height = or->valid.height + stdif->height;
-	if( vips_region_prepare( ir, &irect ) )
+	irect.left = r->left;
+	irect.top = r->top;
+	irect.width = r->width + stdif->width - 1;
+	irect.height = r->height + stdif->height - 1;
+	if( vips_region_prepare( ir, &irect ) ||
+		vips_stdif_sequence_size( seq, ne, 
+			in->BandFmt == VIPS_FORMAT_FLOAT ) )
 		return( -1 );
 
-	lsk = VIPS_REGION_LSKIP( ir );
-	centre = lsk * (stdif->height / 2) + stdif->width / 2;
-
-	for( y = 0; y < r->height; y++ ) {
-		/* Get input and output pointers for this line.
-		 */
-		VipsPel *p = VIPS_REGION_ADDR( ir, r->left, r->top + y );
-		VipsPel *q = VIPS_REGION_ADDR( or, r->left, r->top + y );
-
-		double f1 = stdif->a * stdif->m0;
-		double f2 = 1.0 - stdif->a;
-		double f3 = stdif->b * stdif->s0;
-
-		VipsPel *p1;
-		int x, i, j, b;
-
-		/* We will get int overflow for windows larger than about 256
-		 * x 256, sadly.
-		 */
-		unsigned int sum[MAX_BANDS];
-		unsigned int sum2[MAX_BANDS];
-
-		/* Find sum, sum of squares for the start of this line.
-		 */
-		for( b = 0; b < bands; b++ ) {
-			memset( sum, 0, bands * sizeof( unsigned int ) );
-			memset( sum2, 0, bands * sizeof( unsigned int ) );
-		}
-		p1 = p;
-		for( j = 0; j < stdif->height; j++ ) {
-			i = 0;
-			for( x = 0; x < stdif->width; x++ ) {
-				for( b = 0; b < bands; b++ ) { 
-					int t = p1[i++];
-
-					sum[b] += t;
-					sum2[b] += t * t;
-				}
-			}
-
-			p1 += lsk;
-		}
+	switch( in->BandFmt ) {
+	case VIPS_FORMAT_UCHAR:
+		STDIF_INT( unsigned char, UCHAR_MAX );
+		break;
 
-		/* Loop for output pels.
-		 */
-		for( x = 0; x < r->width; x++ ) {
-			for( b = 0; b < bands; b++ ) { 
-				/* Find stats.
-				 */
-				double mean = (double) sum[b] / npel;
-				double var = (double) sum2[b] / npel - 
-					(mean * mean);
-				double sig = sqrt( var );
-
-				/* Transform.
-				 */
-				double res = f1 + f2 * mean + 
-					((double) p[centre] - mean) * 
-					(f3 / (stdif->s0 + stdif->b * sig));
-
-				/* And write.
-				 */
-				if( res < 0.0 )
-					*q++ = 0;
-				else if( res >= 256.0 )
-					*q++ = 255;
-				else
-					*q++ = res + 0.5;
-
-				/* Adapt sums - remove the pels from the left 
-				 * hand column, add in pels for a new 
-				 * right-hand column.
-				 */
-				p1 = p;
-				for( j = 0; j < stdif->height; j++ ) {
-					int t1 = p1[0];
-					int t2 = p1[bands * stdif->width];
-
-					sum[b] -= t1;
-					sum2[b] -= t1 * t1;
-
-					sum[b] += t2;
-					sum2[b] += t2 * t2;
-
-					p1 += lsk;
-				}
-
-				p += 1;
-			}
-		}
+	case VIPS_FORMAT_USHORT:
+		STDIF_INT( unsigned short, USHRT_MAX );
+		break;
+
+	case VIPS_FORMAT_FLOAT:
+		STDIF_FLOAT( float );
+		break;
+
+	default:
+		g_assert_not_reached();
 	}
 
 	return( 0 );
@@ -228,8 +441,13 @@ vips_stdif_build( VipsObject *object )
 		return( -1 );
 	in = t[0]; 
 
-	if( vips_check_format( class->nickname, in, VIPS_FORMAT_UCHAR ) )
+	if( in->BandFmt != VIPS_FORMAT_UCHAR &&
+		in->BandFmt != VIPS_FORMAT_USHORT &&
+		in->BandFmt != VIPS_FORMAT_FLOAT ) {
+		vips_error( class->nickname, 
+			"%s", _( "image must be uchar, ushort or float" ) );
 		return( -1 );
+	}
 
 	if( stdif->width > in->Xsize || 
 		stdif->height > in->Ysize ) {
@@ -263,9 +481,9 @@ vips_stdif_build( VipsObject *object )
 	stdif->out->Ysize -= stdif->height - 1;
 
 	if( vips_image_generate( stdif->out, 
-		vips_start_one, 
+		vips_stdif_start, 
 		vips_stdif_generate, 
-		vips_stop_one, 
+		vips_stdif_stop, 
 		in, stdif ) )
 		return( -1 );
 
@@ -302,8 +520,6 @@ vips_stdif_class_init( VipsStdifClass *class )
 		VIPS_ARGUMENT_REQUIRED_OUTPUT, 
 		G_STRUCT_OFFSET( VipsStdif, out ) );
 
-	/* Windows larger than 256x256 will overflow sum2, see above.
-	 */
 	VIPS_ARG_INT( class, "width", 4, 
 		_( "Width" ), 
 		_( "Window width in pixels" ),
@@ -398,9 +614,9 @@ vips_stdif_init( VipsStdif *stdif )
  * vips stdif $VIPSHOME/pics/huysum.v fred.v 0.5 128 0.5 50 11 11
  * ]|
  *
- * The operation works on one-band uchar images only, and writes a one-band 
- * uchar image as its result. The output image has the same size as the 
- * input.
+ * The operation works on uchar, ushort and float images with any number of 
+ * bands, and writes an image of the same format, size and number of bands.
+ * Integer output is clipped to the range of the format.
  *
  * See also: vips_hist_local().
  *
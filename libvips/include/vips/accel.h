@@ -0,0 +1,78 @@
+/* accelerator kernels, for example on a GPU
+ *
+ * 14/10/18
+ * 	- first version
+ */
+
+/*
+
+    This file is part of VIPS.
+
+    VIPS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA
+
+ */
+
+/*
+
+    These files are distributed with VIPS - http://www.vips.ecs.soton.ac.uk
+
+ */
+
+#ifndef VIPS_ACCEL_H
+#define VIPS_ACCEL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif /*__cplusplus*/
+
+/* The kernels an accelerator can provide. Each is looked up by kernel and 
+ * band format, and each has its own function type, see below.
+ */
+typedef enum {
+	VIPS_ACCEL_REDUCEV,		/* VipsAccelReducevFn, by in format */
+	VIPS_ACCEL_LAST
+} VipsAccelKernel;
+
+/* height output lines of ne elements, out_lskip bytes apart. Output line y is
+ * made from the n_point input lines starting at line start[y] of in, with
+ * the n_point fixed-point mask at cy + y * n_point. Input lines are in_lskip
+ * bytes apart and there are in_height of them.
+ *
+ * Return non-zero to make the caller use the CPU for this region instead.
+ */
+typedef int (*VipsAccelReducevFn)( VipsPel *out, int out_lskip,
+	const VipsPel *in, int in_lskip, int in_height, 
+	int ne, int height, const int *start, const int *cy, int n_point );
+
+/* Set by the command-line --vips-accel switch and the VIPS_ACCEL env var.
+ */
+extern gboolean vips__accel_enabled;
+
+void vips_accel_init( void );
+gboolean vips_accel_isenabled( void );
+void vips_accel_set_enabled( gboolean enabled );
+void vips_accel_set_min_elements( int n );
+int vips_accel_get_min_elements( void );
+
+void vips_accel_register( VipsAccelKernel kernel, VipsBandFormat format,
+	void *fn );
+void *vips_accel_get( VipsAccelKernel kernel, VipsBandFormat format );
+
+#ifdef __cplusplus
+}
+#endif /*__cplusplus*/
+
+#endif /*VIPS_ACCEL_H*/
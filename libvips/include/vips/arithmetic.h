@@ -174,6 +174,30 @@ typedef enum {
 	VIPS_OPERATION_COMPLEXGET_LAST
 } VipsOperationComplexget;
 
+/** 
+ * VipsStatisticsFlags:
+ * @VIPS_STATISTICS_NONE: nothing
+ * @VIPS_STATISTICS_AVG: average, as vips_avg()
+ * @VIPS_STATISTICS_DEVIATE: standard deviation, as vips_deviate()
+ * @VIPS_STATISTICS_MIN: minimum, as vips_min()
+ * @VIPS_STATISTICS_MAX: maximum, as vips_max()
+ * @VIPS_STATISTICS_HIST: histogram, as vips_hist_find()
+ * @VIPS_STATISTICS_ALL: everything
+ *
+ * Pick the statistics for vips_statistics() to find.
+ *
+ * See also: vips_statistics().
+ */
+typedef enum /*< flags >*/ {
+	VIPS_STATISTICS_NONE = 0,
+	VIPS_STATISTICS_AVG = 1,
+	VIPS_STATISTICS_DEVIATE = 2,
+	VIPS_STATISTICS_MIN = 4,
+	VIPS_STATISTICS_MAX = 8,
+	VIPS_STATISTICS_HIST = 16,
+	VIPS_STATISTICS_ALL = 31
+} VipsStatisticsFlags;
+
 int vips_add( VipsImage *left, VipsImage *right, VipsImage **out, ... )
 	__attribute__((sentinel));
 int vips_sum( VipsImage **in, VipsImage **out, int n, ... )
@@ -376,12 +400,19 @@ int vips_avg( VipsImage *in, double *out, ... )
 	__attribute__((sentinel));
 int vips_deviate( VipsImage *in, double *out, ... )
 	__attribute__((sentinel));
+int vips_percentiles( VipsImage *in,
+	const double *percent, double *out, int n, ... )
+	__attribute__((sentinel));
 int vips_min( VipsImage *in, double *out, ... )
 	__attribute__((sentinel));
 int vips_max( VipsImage *in, double *out, ... )
 	__attribute__((sentinel));
 int vips_stats( VipsImage *in, VipsImage **out, ... )
 	__attribute__((sentinel));
+int vips_statistics( VipsImage *in, ... )
+	__attribute__((sentinel));
+int vips_tee( VipsImage *in, VipsImage **out, VipsOperation *statistic, ... )
+	__attribute__((sentinel));
 int vips_measure( VipsImage *in, VipsImage **out, int h, int v, ... )
 	__attribute__((sentinel));
 int vips_find_trim( VipsImage *in, 
@@ -389,6 +420,8 @@ int vips_find_trim( VipsImage *in,
 	__attribute__((sentinel));
 int vips_getpoint( VipsImage *in, double **vector, int *n, int x, int y, ... )
 	__attribute__((sentinel));
+int vips_getpoints( VipsImage *in, VipsImage **out, const int *xy, int n, ... )
+	__attribute__((sentinel));
 int vips_hist_find( VipsImage *in, VipsImage **out, ... )
 	__attribute__((sentinel));
 int vips_hist_find_ndim( VipsImage *in, VipsImage **out, ... )
@@ -404,6 +437,10 @@ int vips_project( VipsImage *in, VipsImage **columns, VipsImage **rows, ... )
 	__attribute__((sentinel));
 int vips_profile( VipsImage *in, VipsImage **columns, VipsImage **rows, ... )
 	__attribute__((sentinel));
+int vips_integral( VipsImage *in, VipsImage **out, ... )
+	__attribute__((sentinel));
+int vips_box_sum( VipsImage *integral, 
+	int left, int top, int width, int height, double *sum );
 
 #ifdef __cplusplus
 }
@@ -108,6 +108,8 @@ typedef enum {
 } VipsPCS;
 
 gboolean vips_colourspace_issupported( const VipsImage *image );
+const char *vips_colourspace_route( VipsInterpretation from,
+	VipsInterpretation to );
 int vips_colourspace( VipsImage *in, VipsImage **out, 
 	VipsInterpretation space, ... )
 	__attribute__((sentinel));
@@ -180,6 +182,11 @@ int vips_icc_ac2rc( VipsImage *in, VipsImage **out,
 gboolean vips_icc_is_compatible_profile( VipsImage *image, 
 	void *data, size_t data_length );
 
+int vips_colour_lut( VipsImage **out, ... )
+	__attribute__((sentinel));
+int vips_maplut3d( VipsImage *in, VipsImage **out, VipsImage *lut, ... )
+	__attribute__((sentinel));
+
 int vips_dE76( VipsImage *left, VipsImage *right, VipsImage **out, ... )
 	__attribute__((sentinel));
 int vips_dE00( VipsImage *left, VipsImage *right, VipsImage **out, ... )
@@ -155,6 +155,9 @@ int vips_flip( VipsImage *in, VipsImage **out, VipsDirection direction, ... )
 int vips_insert( VipsImage *main, VipsImage *sub, VipsImage **out, 
 	int x, int y, ... )
 	__attribute__((sentinel));
+int vips_insert_many( VipsImage *main, VipsImage **sub, VipsImage **out, 
+	int *x, int *y, int n, ... )
+	__attribute__((sentinel));
 int vips_join( VipsImage *in1, VipsImage *in2, VipsImage **out, 
 	VipsDirection direction, ... )
 	__attribute__((sentinel));
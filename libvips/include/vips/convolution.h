@@ -49,6 +49,8 @@ int vips_conv( VipsImage *in, VipsImage **out, VipsImage *mask, ... )
 	__attribute__((sentinel));
 int vips_convf( VipsImage *in, VipsImage **out, VipsImage *mask, ... )
 	__attribute__((sentinel));
+int vips_convfft( VipsImage *in, VipsImage **out, VipsImage *mask, ... )
+	__attribute__((sentinel));
 int vips_convi( VipsImage *in, VipsImage **out, VipsImage *mask, ... )
 	__attribute__((sentinel));
 int vips_conva( VipsImage *in, VipsImage **out, VipsImage *mask, ... )
@@ -69,6 +71,8 @@ int vips_spcor( VipsImage *in, VipsImage *ref, VipsImage **out, ... )
 	__attribute__((sentinel));
 int vips_fastcor( VipsImage *in, VipsImage *ref, VipsImage **out, ... )
 	__attribute__((sentinel));
+int vips_find_template( VipsImage *in, VipsImage *ref, int *x, int *y, ... )
+	__attribute__((sentinel));
 
 int vips_sobel( VipsImage *in, VipsImage **out, ... )
 	__attribute__((sentinel));
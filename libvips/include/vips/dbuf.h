@@ -77,6 +77,50 @@ off_t vips_dbuf_tell( VipsDbuf *dbuf );
 unsigned char *vips_dbuf_string( VipsDbuf *dbuf, size_t *size );
 unsigned char *vips_dbuf_steal( VipsDbuf *dbuf, size_t *size );
 
+/* An append-only buffer made of a list of chunks. Written bytes never move,
+ * so there are no realloc copies as it grows.
+ */
+
+typedef struct _VipsCbufChunk {
+	/*< private >*/
+	struct _VipsCbufChunk *next;
+
+	unsigned char *data;
+	size_t allocated_size;
+
+	/* Bytes in use. The unused tail of a chunk is not part of the data.
+	 */
+	size_t data_size;
+} VipsCbufChunk;
+
+typedef struct _VipsCbuf {
+	/* All fields are private.
+	 */
+	/*< private >*/
+
+	VipsCbufChunk *first;
+	VipsCbufChunk *last;
+
+	/* Total bytes in use over all chunks.
+	 */
+	size_t data_size;
+
+} VipsCbuf;
+
+typedef void *(*VipsCbufMapFn)( const unsigned char *data, size_t size,
+	void *a );
+
+void vips_cbuf_init( VipsCbuf *cbuf );
+void vips_cbuf_destroy( VipsCbuf *cbuf );
+unsigned char *vips_cbuf_get_write( VipsCbuf *cbuf,
+	size_t min_size, size_t *size );
+void vips_cbuf_advance( VipsCbuf *cbuf, size_t size );
+gboolean vips_cbuf_write( VipsCbuf *cbuf,
+	const unsigned char *data, size_t size );
+size_t vips_cbuf_size( VipsCbuf *cbuf );
+void *vips_cbuf_map( VipsCbuf *cbuf, VipsCbufMapFn fn, void *a );
+unsigned char *vips_cbuf_steal( VipsCbuf *cbuf, size_t *size );
+
 #endif /*VIPS_DBUF_H*/
 
 #ifdef __cplusplus
@@ -44,6 +44,14 @@ typedef enum {
 	VIPS_COMBINE_MODE_LAST
 } VipsCombineMode; 
 
+typedef enum {
+	VIPS_DRAW_SHAPE_LINE,
+	VIPS_DRAW_SHAPE_RECT,
+	VIPS_DRAW_SHAPE_CIRCLE,
+	VIPS_DRAW_SHAPE_MASK,
+	VIPS_DRAW_SHAPE_LAST
+} VipsDrawShape;
+
 int vips_draw_rect( VipsImage *image, 
 	double *ink, int n, int left, int top, int width, int height, ... ) 
 	__attribute__((sentinel));
@@ -88,6 +96,9 @@ int vips_draw_smudge( VipsImage *image,
 	int left, int top, int width, int height, ... ) 
 	__attribute__((sentinel));
 
+int vips_draw_batch( VipsImage *image, VipsImage *shapes, ... )
+	__attribute__((sentinel));
+
 #ifdef __cplusplus
 }
 #endif /*__cplusplus*/
@@ -11,6 +11,8 @@ GType vips_kernel_get_type (void) G_GNUC_CONST;
 #define VIPS_TYPE_KERNEL (vips_kernel_get_type())
 GType vips_size_get_type (void) G_GNUC_CONST;
 #define VIPS_TYPE_SIZE (vips_size_get_type())
+GType vips_thumbnail_quality_get_type (void) G_GNUC_CONST;
+#define VIPS_TYPE_THUMBNAIL_QUALITY (vips_thumbnail_quality_get_type())
 /* enumerations from "../../../libvips/include/vips/foreign.h" */
 GType vips_foreign_flags_get_type (void) G_GNUC_CONST;
 #define VIPS_TYPE_FOREIGN_FLAGS (vips_foreign_flags_get_type())
@@ -49,6 +51,8 @@ GType vips_operation_complex2_get_type (void) G_GNUC_CONST;
 #define VIPS_TYPE_OPERATION_COMPLEX2 (vips_operation_complex2_get_type())
 GType vips_operation_complexget_get_type (void) G_GNUC_CONST;
 #define VIPS_TYPE_OPERATION_COMPLEXGET (vips_operation_complexget_get_type())
+GType vips_statistics_flags_get_type (void) G_GNUC_CONST;
+#define VIPS_TYPE_STATISTICS_FLAGS (vips_statistics_flags_get_type())
 /* enumerations from "../../../libvips/include/vips/conversion.h" */
 GType vips_extend_get_type (void) G_GNUC_CONST;
 #define VIPS_TYPE_EXTEND (vips_extend_get_type())
@@ -88,6 +92,8 @@ GType vips_intent_get_type (void) G_GNUC_CONST;
 GType vips_pcs_get_type (void) G_GNUC_CONST;
 #define VIPS_TYPE_PCS (vips_pcs_get_type())
 /* enumerations from "../../../libvips/include/vips/operation.h" */
+GType vips_cache_policy_get_type (void) G_GNUC_CONST;
+#define VIPS_TYPE_CACHE_POLICY (vips_cache_policy_get_type())
 GType vips_operation_flags_get_type (void) G_GNUC_CONST;
 #define VIPS_TYPE_OPERATION_FLAGS (vips_operation_flags_get_type())
 /* enumerations from "../../../libvips/include/vips/convolution.h" */
@@ -99,12 +105,17 @@ GType vips_operation_morphology_get_type (void) G_GNUC_CONST;
 /* enumerations from "../../../libvips/include/vips/draw.h" */
 GType vips_combine_mode_get_type (void) G_GNUC_CONST;
 #define VIPS_TYPE_COMBINE_MODE (vips_combine_mode_get_type())
+GType vips_draw_shape_get_type (void) G_GNUC_CONST;
+#define VIPS_TYPE_DRAW_SHAPE (vips_draw_shape_get_type())
 /* enumerations from "../../../libvips/include/vips/basic.h" */
 GType vips_precision_get_type (void) G_GNUC_CONST;
 #define VIPS_TYPE_PRECISION (vips_precision_get_type())
 /* enumerations from "../../../libvips/include/vips/object.h" */
 GType vips_argument_flags_get_type (void) G_GNUC_CONST;
 #define VIPS_TYPE_ARGUMENT_FLAGS (vips_argument_flags_get_type())
+/* enumerations from "../../../libvips/include/vips/region.h" */
+GType vips_region_shrink_get_type (void) G_GNUC_CONST;
+#define VIPS_TYPE_REGION_SHRINK (vips_region_shrink_get_type())
 G_END_DECLS
 
 #endif /*VIPS_ENUM_TYPES_H*/
@@ -37,6 +37,8 @@ extern "C" {
 
 const char *vips_error_buffer( void );
 void vips_error_clear( void );
+const char *vips_error_thread_buffer( void );
+void vips_error_thread_clear( void );
 
 void vips_error_freeze( void );
 void vips_error_thaw( void );
@@ -184,6 +184,14 @@ typedef struct _VipsForeignLoadClass {
 	 */
 	gboolean (*is_a_buffer)( const void *data, size_t size );
 
+	/* Is a source in this format.
+	 *
+	 * This function should return %TRUE if the source contains an image of
+	 * this type. It can sniff bytes with vips_source_sniff(), but should
+	 * not otherwise read from the source.
+	 */
+	gboolean (*is_a_source)( VipsSource *source );
+
 	/* Get the flags from a filename. 
 	 *
 	 * This function should examine the file and return a set
@@ -225,6 +233,17 @@ typedef struct _VipsForeignLoadClass {
 	 * vips_error().
 	 */
 	int (*load)( VipsForeignLoad *load );
+
+	/* Read just the header of @filename into @out, with no operation. 
+	 *
+	 * This is used by vips_foreign_probe(). It only needs to set the
+	 * basic header fields and any orientation tag. If you don't define 
+	 * it, vips_foreign_probe() will build the loader instead.
+	 *
+	 * Return 0 for success, -1 for error, setting
+	 * vips_error().
+	 */
+	int (*header_filename)( const char *filename, VipsImage *out );
 } VipsForeignLoadClass;
 
 /* Don't put spaces around void here, it breaks gtk-doc.
@@ -233,14 +252,37 @@ GType vips_foreign_load_get_type(void);
 
 const char *vips_foreign_find_load( const char *filename );
 const char *vips_foreign_find_load_buffer( const void *data, size_t size );
+const char *vips_foreign_find_load_source( VipsSource *source );
 
 VipsForeignFlags vips_foreign_flags( const char *loader, const char *filename );
 gboolean vips_foreign_is_a( const char *loader, const char *filename );
 gboolean vips_foreign_is_a_buffer( const char *loader, 
 	const void *data, size_t size );
 
+/* The result of a vips_foreign_probe(). 
+ */
+typedef struct _VipsForeignProbe {
+	const char *loader;
+	int width;
+	int height;
+	int bands;
+	VipsBandFormat format;
+	int orientation;
+} VipsForeignProbe;
+
+int vips_foreign_probe( const char *filename, VipsForeignProbe *probe );
+
 void vips_foreign_load_invalidate( VipsImage *image );
 
+void vips_foreign_load_set_limits( guint64 max_pixels,
+	int max_pages, guint64 max_bytes );
+void vips_foreign_load_get_limits( guint64 *max_pixels,
+	int *max_pages, guint64 *max_bytes );
+
+VipsImage *vips_foreign_load_pool_get( const char *name );
+void vips_foreign_load_pool_set_idle( double seconds );
+void vips_foreign_load_pool_drop_all( void );
+
 #define VIPS_TYPE_FOREIGN_SAVE (vips_foreign_save_get_type())
 #define VIPS_FOREIGN_SAVE( obj ) \
 	(G_TYPE_CHECK_INSTANCE_CAST( (obj), \
@@ -343,6 +385,7 @@ GType vips_foreign_save_get_type(void);
 
 const char *vips_foreign_find_save( const char *filename );
 const char *vips_foreign_find_save_buffer( const char *suffix );
+const char *vips_foreign_find_save_target( const char *suffix );
 
 int vips_vipsload( const char *filename, VipsImage **out, ... )
 	__attribute__((sentinel));
@@ -356,13 +399,19 @@ int vips_jpegload( const char *filename, VipsImage **out, ... )
 	__attribute__((sentinel));
 int vips_jpegload_buffer( void *buf, size_t len, VipsImage **out, ... )
 	__attribute__((sentinel));
+int vips_jpegload_source( VipsSource *source, VipsImage **out, ... )
+	__attribute__((sentinel));
 
 int vips_jpegsave( VipsImage *in, const char *filename, ... )
 	__attribute__((sentinel));
 int vips_jpegsave_buffer( VipsImage *in, void **buf, size_t *len, ... )
 	__attribute__((sentinel));
+int vips_jpegsave_target( VipsImage *in, VipsTarget *target, ... )
+	__attribute__((sentinel));
 int vips_jpegsave_mime( VipsImage *in, ... )
 	__attribute__((sentinel));
+int vips_jpegtransform( const char *in, const char *out, ... )
+	__attribute__((sentinel));
 
 /**
  * VipsForeignWebpPreset:
@@ -389,11 +438,15 @@ int vips_webpload( const char *filename, VipsImage **out, ... )
 	__attribute__((sentinel));
 int vips_webpload_buffer( void *buf, size_t len, VipsImage **out, ... )
 	__attribute__((sentinel));
+int vips_webpload_source( VipsSource *source, VipsImage **out, ... )
+	__attribute__((sentinel));
 
 int vips_webpsave( VipsImage *in, const char *filename, ... )
 	__attribute__((sentinel));
 int vips_webpsave_buffer( VipsImage *in, void **buf, size_t *len, ... )
 	__attribute__((sentinel));
+int vips_webpsave_target( VipsImage *in, VipsTarget *target, ... )
+	__attribute__((sentinel));
 int vips_webpsave_mime( VipsImage *in, ... )
 	__attribute__((sentinel));
 
@@ -455,10 +508,14 @@ int vips_tiffload( const char *filename, VipsImage **out, ... )
 	__attribute__((sentinel));
 int vips_tiffload_buffer( void *buf, size_t len, VipsImage **out, ... )
 	__attribute__((sentinel));
+int vips_tiffload_source( VipsSource *source, VipsImage **out, ... )
+	__attribute__((sentinel));
 int vips_tiffsave( VipsImage *in, const char *filename, ... )
 	__attribute__((sentinel));
 int vips_tiffsave_buffer( VipsImage *in, void **buf, size_t *len, ... )
 	__attribute__((sentinel));
+int vips_tiffsave_target( VipsImage *in, VipsTarget *target, ... )
+	__attribute__((sentinel));
 
 int vips_openexrload( const char *filename, VipsImage **out, ... )
 	__attribute__((sentinel));
@@ -525,10 +582,14 @@ int vips_pngload( const char *filename, VipsImage **out, ... )
 	__attribute__((sentinel));
 int vips_pngload_buffer( void *buf, size_t len, VipsImage **out, ... )
 	__attribute__((sentinel));
+int vips_pngload_source( VipsSource *source, VipsImage **out, ... )
+	__attribute__((sentinel));
 int vips_pngsave( VipsImage *in, const char *filename, ... )
 	__attribute__((sentinel));
 int vips_pngsave_buffer( VipsImage *in, void **buf, size_t *len, ... )
 	__attribute__((sentinel));
+int vips_pngsave_target( VipsImage *in, VipsTarget *target, ... )
+	__attribute__((sentinel));
 
 int vips_ppmload( const char *filename, VipsImage **out, ... )
 	__attribute__((sentinel));
@@ -559,6 +620,12 @@ int vips_gifload( const char *filename, VipsImage **out, ... )
 	__attribute__((sentinel));
 int vips_gifload_buffer( void *buf, size_t len, VipsImage **out, ... )
 	__attribute__((sentinel));
+int vips_gifsave( VipsImage *in, const char *filename, ... )
+	__attribute__((sentinel));
+int vips_gifsave_buffer( VipsImage *in, void **buf, size_t *len, ... )
+	__attribute__((sentinel));
+int vips_gifsave_target( VipsImage *in, VipsTarget *target, ... )
+	__attribute__((sentinel));
 
 /**
  * VipsForeignDzLayout:
@@ -51,6 +51,9 @@ int vips_spectrum( VipsImage *in, VipsImage **out, ... )
 
 int vips_phasecor( VipsImage *in1, VipsImage *in2, VipsImage **out, ... )
 	__attribute__((sentinel));
+int vips_phasecor_batch( VipsImage **in, int n,
+	const int *pairs, int n_pairs, VipsImage **out, ... )
+	__attribute__((sentinel));
 
 #ifdef __cplusplus
 }
@@ -61,7 +61,23 @@ G_STMT_START { \
 		vips__thread_malloc_free( -((gint64) (SIZE)) ); \
 } G_STMT_END
 
+#define VIPS_GATE_OPERATION_MALLOC( SIZE ) \
+G_STMT_START { \
+	if( vips__operation_stats ) \
+		vips__operation_stats_malloc( (SIZE) ); \
+} G_STMT_END
+
+#define VIPS_GATE_LOCK( LOCK, STAT ) \
+G_STMT_START { \
+	if( vips__gate_stats ) \
+		vips__gate_lock( (LOCK), (STAT) ); \
+	else \
+		g_mutex_lock( LOCK ); \
+} G_STMT_END
+
 extern gboolean vips__thread_profile;
+extern gboolean vips__operation_stats;
+extern gboolean vips__gate_stats;
 
 void vips_profile_set( gboolean profile );
 
@@ -74,6 +90,92 @@ void vips__thread_gate_stop( const char *gate_name );
 
 void vips__thread_malloc_free( gint64 size );
 
+/* gate.h comes before rect.h in vips.h.
+ */
+struct _VipsRect;
+void vips__thread_gate_tile( const char *name,
+	const struct _VipsRect *rect, gint64 start, gint64 stop );
+
+/* Live counters for an operation nickname. Times are in microseconds.
+ */
+typedef struct _VipsOperationStats {
+	const char *nickname;
+
+	guint64 calls;		/* Calls to the generate function */
+	guint64 prepares;	/* vips_region_prepare() calls */
+	guint64 pixels;		/* Pixels generated */
+	guint64 time;		/* Time in generate, including upstream */
+	guint64 self_time;	/* Time in generate, excluding upstream */
+	guint64 bytes;		/* Tracked memory allocated in generate */
+} VipsOperationStats;
+
+/* Counters for a single image in a pipeline, see vips_image_graph_dot(). 
+ * Times are in microseconds.
+ */
+typedef struct _VipsImageStats {
+	guint64 calls;		/* Calls to the generate function */
+	guint64 pixels;		/* Pixels generated */
+	guint64 time;		/* Time in generate, including upstream */
+	guint64 self_time;	/* Time in generate, excluding upstream */
+	int sequences;		/* Sequences started */
+	int tile_width;		/* Largest area generated */
+	int tile_height;
+	size_t bsize;		/* Largest buffer generated into */
+} VipsImageStats;
+
+/* Track nested generate calls on a thread.
+ */
+typedef struct _VipsOperationStatsScope {
+	struct _VipsOperationStatsScope *parent;
+	VipsOperationStats *stats;
+	VipsImageStats *image_stats;
+	gint64 start;
+	gint64 child;
+} VipsOperationStatsScope;
+
+void vips_operation_stats_set( gboolean stats );
+VipsOperationStats *vips_operation_stats_snapshot( int *n );
+void vips_operation_stats_reset( void );
+char *vips_operation_stats_prometheus( void );
+
+VipsOperationStats *vips__operation_stats_get( const char *nickname );
+void vips__operation_stats_enter( VipsOperationStatsScope *scope, 
+	VipsOperationStats *stats, VipsImageStats *image_stats );
+void vips__operation_stats_leave( VipsOperationStatsScope *scope, 
+	int width, int height, size_t bsize );
+void vips__operation_stats_sequence( VipsImageStats *image_stats );
+void vips__operation_stats_copy( VipsImageStats *to, 
+	VipsImageStats *from );
+void vips__operation_stats_prepare( VipsOperationStats *stats );
+void vips__operation_stats_malloc( size_t size );
+
+/* The locks and calls we can count, see vips_gate_stats_set().
+ */
+typedef enum {
+	VIPS_GATE_STAT_ALLOCATE,	/* Threadpool allocate lock */
+	VIPS_GATE_STAT_BUFFER,		/* vips_buffer_unref_ref() */
+	VIPS_GATE_STAT_CACHE,		/* Operation cache shard locks */
+	VIPS_GATE_STAT_LAST
+} VipsGateStat;
+
+/* Counters for one lock, summed over all threads. Times are in
+ * microseconds.
+ */
+typedef struct _VipsGateStats {
+	const char *name;
+
+	guint64 calls;		/* Acquisitions, or calls */
+	guint64 contended;	/* Acquisitions which had to wait */
+	guint64 time;		/* Time waiting, or time in the call */
+} VipsGateStats;
+
+void vips_gate_stats_set( gboolean stats );
+void vips_gate_stats_snapshot( VipsGateStats *stats );
+void vips_gate_stats_reset( void );
+
+void vips__gate_lock( GMutex *lock, VipsGateStat stat );
+void vips__gate_time( VipsGateStat stat, gint64 time );
+
 #endif /*VIPS_GATE_H*/
 
 #ifdef __cplusplus
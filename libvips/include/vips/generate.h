@@ -53,6 +53,10 @@ int vips_sink_screen( VipsImage *in, VipsImage *out, VipsImage *mask,
 	int tile_width, int tile_height, int max_tiles,
 	int priority,
 	VipsSinkNotify notify_fn, void *a );
+void vips_sink_screen_viewport( VipsImage *out, VipsRect *viewport,
+	int dx, int dy );
+void vips_sink_screen_set_shared_mem( size_t max_mem );
+size_t vips_sink_screen_get_shared_mem( void );
 
 int vips_sink_memory( VipsImage *im );
 
@@ -67,6 +71,8 @@ int vips_image_generate( VipsImage *image,
 	VipsStartFn start_fn, VipsGenerateFn generate_fn, VipsStopFn stop_fn,
 	void *a, void *b
 );
+void vips_image_set_prefetch( VipsImage *image, 
+	VipsPrefetchFn prefetch_fn, void *a );
 
 int vips_image_pipeline_array( VipsImage *image, 
 	VipsDemandStyle hint, VipsImage **in );
@@ -143,6 +143,22 @@ extern "C" {
  */
 #define VIPS_META_PAGE_HEIGHT "page-height"
 
+/**
+ * VIPS_META_PART_WIDTH:
+ *
+ * The width of the whole image a part made by vips_image_write_area() was
+ * cut from. See vips_image_assemble_parts().
+ */
+#define VIPS_META_PART_WIDTH "vips-part-width"
+
+/**
+ * VIPS_META_PART_HEIGHT:
+ *
+ * The height of the whole image a part made by vips_image_write_area() was
+ * cut from. See vips_image_assemble_parts().
+ */
+#define VIPS_META_PART_HEIGHT "vips-part-height"
+
 guint64 vips_format_sizeof( VipsBandFormat format );
 guint64 vips_format_sizeof_unsafe( VipsBandFormat format );
 
@@ -140,6 +140,8 @@ typedef void *(*VipsStartFn)( struct _VipsImage *out, void *a, void *b );
 typedef int (*VipsGenerateFn)( struct _VipsRegion *out, 
 	void *seq, void *a, void *b, gboolean *stop );
 typedef int (*VipsStopFn)( void *seq, void *a, void *b );
+typedef void (*VipsPrefetchFn)( struct _VipsImage *image, 
+	const VipsRect *r, void *a );
 
 /* Struct we keep a record of execution time in. Passed to eval signal so
  * it can assess progress.
@@ -354,6 +356,10 @@ typedef struct _VipsImageClass {
 	 */
 	void (*minimise)( VipsImage *image );
 
+	/* A loader has a partial decode of this image.
+	 */
+	void (*preview)( VipsImage *image, VipsImage *snapshot );
+
 } VipsImageClass;
 
 /* Don't put spaces around void here, it breaks gtk-doc.
@@ -426,7 +432,11 @@ void vips_image_invalidate_all( VipsImage *image );
 
 void vips_image_minimise_all( VipsImage *image );
 
+gboolean vips_image_preview_wanted( VipsImage *image );
+void vips_image_preview( VipsImage *image, VipsImage *snapshot );
+
 void vips_image_set_progress( VipsImage *image, gboolean progress );
+void vips_image_set_deadline( VipsImage *image, double seconds );
 
 char *vips_filename_get_filename( const char *vips_filename );
 char *vips_filename_get_options( const char *vips_filename );
@@ -441,11 +451,19 @@ VipsImage *vips_image_new_from_file_raw( const char *filename,
 	int xsize, int ysize, int bands, guint64 offset );
 VipsImage *vips_image_new_from_memory( const void *data, size_t size,
 	int width, int height, int bands, VipsBandFormat format );
+VipsImage *vips_image_new_from_area( VipsArea *area, size_t stride,
+	int width, int height, int bands, VipsBandFormat format );
+VipsImage *vips_image_new_from_memory_notify( void *data, size_t stride,
+	int width, int height, int bands, VipsBandFormat format,
+	VipsCallbackFn release, void *user_data, GDestroyNotify destroy );
 VipsImage *vips_image_new_from_memory_copy( const void *data, size_t size,
 	int width, int height, int bands, VipsBandFormat format );
 VipsImage *vips_image_new_from_buffer( const void *buf, size_t len, 
 	const char *option_string, ... )
 	__attribute__((sentinel));
+VipsImage *vips_image_new_from_source( VipsSource *source,
+	const char *option_string, ... )
+	__attribute__((sentinel));
 VipsImage *vips_image_new_matrix( int width, int height );
 VipsImage *vips_image_new_matrixv( int width, int height, ... );
 VipsImage *vips_image_new_matrix_from_array( int width, int height, 
@@ -461,12 +479,32 @@ guint64 vips_get_disc_threshold( void );
 VipsImage *vips_image_new_temp_file( const char *format );
 
 int vips_image_write( VipsImage *image, VipsImage *out );
+
+typedef struct _VipsImageWriteAsync VipsImageWriteAsync;
+typedef void (*VipsImageWriteAsyncFn)( VipsImageWriteAsync *async, 
+	int result, void *a );
+
+VipsImageWriteAsync *vips_image_write_async( VipsImage *image, 
+	VipsImage *out, 
+	GMainContext *context, VipsImageWriteAsyncFn fn, void *a );
+void vips_image_write_async_cancel( VipsImageWriteAsync *async );
+VipsImage *vips_image_write_async_get_image( VipsImageWriteAsync *async );
+VipsImage *vips_image_write_async_get_out( VipsImageWriteAsync *async );
 int vips_image_write_to_file( VipsImage *image, const char *name, ... )
 	__attribute__((sentinel));
+int vips_image_write_area( VipsImage *image,
+	VipsRect *area, const char *filename );
+int vips_image_assemble_parts( const char *filename,
+	const char **parts, int n );
 int vips_image_write_to_buffer( VipsImage *in, 
 	const char *suffix, void **buf, size_t *size, ... )
 	__attribute__((sentinel));
+int vips_image_write_to_target( VipsImage *in,
+	const char *suffix, VipsTarget *target, ... )
+	__attribute__((sentinel));
 void *vips_image_write_to_memory( VipsImage *in, size_t *size );
+int vips_image_write_into_memory( VipsImage *in, 
+	void *data, size_t size, size_t stride );
 
 int vips_image_decode_predict( VipsImage *in, 
 	int *bands, VipsBandFormat *format );
@@ -479,7 +517,12 @@ gboolean vips_image_ispartial( VipsImage *image );
 gboolean vips_image_hasalpha( VipsImage *image );
 
 VipsImage *vips_image_copy_memory( VipsImage *image );
+VipsImage *vips_image_materialise( VipsImage *image );
 int vips_image_wio_input( VipsImage *image );
+void vips_image_get_window_stats( VipsImage *image, int *maps, int *remaps );
+char *vips_image_graph_dot( VipsImage *image );
+char *vips_image_graph_json( VipsImage *image );
+int vips_image_graph_write( VipsImage *image, const char *filename );
 int vips_image_pio_input( VipsImage *image );
 int vips_image_pio_output( VipsImage *image );
 int vips_image_inplace( VipsImage *image );
@@ -514,6 +557,7 @@ void vips_value_set_array_image( GValue *value, int n );
 int vips_reorder_prepare_many( VipsImage *image, 
 	struct _VipsRegion **regions, VipsRect *r );
 void vips_reorder_margin_hint( VipsImage *image, int margin );
+void vips_reorder_set_parallel( gboolean parallel );
 
 #ifdef __cplusplus
 }
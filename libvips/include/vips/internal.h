@@ -45,8 +45,18 @@ extern "C" {
  * We don't refcount at this level ... large meta values are refcounted by
  * their GValue implementation, see eg. MetaArea.
  */
+/* Image metadata. Images can share a table, it's copied when one of them 
+ * needs to change it.
+ */
+typedef struct _VipsMetaTable {
+	int ref_count;
+
+	GHashTable *hash;		/* Name to VipsMeta */
+	GSList *traverse;		/* VipsMeta in set order */
+} VipsMetaTable;
+
 typedef struct _VipsMeta {
-	VipsImage *im;
+	VipsMetaTable *table;
 
 	char *name;			/* strdup() of field name */
 	GValue value;			/* copy of value */
@@ -54,6 +64,9 @@ typedef struct _VipsMeta {
 
 int vips__exif_parse( VipsImage *image );
 int vips__exif_update( VipsImage *image );
+void vips__exif_expand( VipsImage *image );
+void vips__exif_set_pending( VipsImage *image, gboolean pending );
+gboolean vips__exif_get_pending( const VipsImage *image );
 
 void vips_check_init( void );
 
@@ -68,6 +81,12 @@ extern int vips__tile_height;
 extern int vips__fatstrip_height;
 extern int vips__thinstrip_height;
 
+/* Size tiles to fit this many bytes across the pipeline, 0 for fixed 
+ * geometry. Report the geometry we pick.
+ */
+extern int vips__tile_target;
+extern gboolean vips__tile_report;
+
 /* Default n threads.
  */
 extern int vips__concurrency;
@@ -97,12 +116,30 @@ extern int vips__info;
  */
 extern char *vips__disc_threshold;
 
+/* Number of sinkdisc write buffers, and a memory limit for them.
+ */
+extern int vips__disc_buffers;
+extern char *vips__disc_buffer_memory;
+
+/* Target size for mmap windows, and how to map large windows.
+ */
+extern char *vips__window_size;
+extern gboolean vips__window_populate;
+extern gboolean vips__window_hugepage;
+
 extern gboolean vips__cache_dump;
 extern gboolean vips__cache_trace;
 
 extern int vips__n_active_threads;
 
+gint64 vips__get_time( void );
+
 void vips__threadpool_init( void );
+void vips__threadpool_shutdown( void );
+void vips__fft_shutdown( void );
+void vips__error_thread_shutdown( void );
+int vips__error_mark( void );
+void vips__error_pop( int mark );
 
 void vips__cache_init( void );
 
@@ -124,26 +161,144 @@ int vips_image_open_output( VipsImage *image );
 void vips__link_break_all( VipsImage *im );
 void *vips__link_map( VipsImage *image, gboolean upstream, 
 	VipsSListMap2Fn fn, void *a, void *b );
+void vips__image_set_mem_hint( VipsImage *image, size_t size );
+
+/* Per-image state which is private to libvips. It hangs off the image as
+ * qdata so that VipsImage keeps its size and layout.
+ */
+typedef struct _VipsImagePrivate {
+	/* Live stats for the operation that made this image, if operation
+	 * stats were on when it was built. See vips_operation_stats_set().
+	 */
+	VipsOperationStats *stats;
+
+	/* And counters for just this image. Only updated if @stats is set.
+	 */
+	VipsImageStats generate_stats;
+
+	/* Spare regions on this image ready for reuse by vips_start_one()
+	 * and friends. They are still on @regions, but hold no ref to us.
+	 * Protected by sslock.
+	 */
+	GSList *spare_regions;
+	int n_spare_regions;
+
+	/* Optional handler for prefetch hints on a partial image, see
+	 * vips_image_set_prefetch().
+	 */
+	VipsPrefetchFn prefetch_fn;
+	void *prefetch_a;
+
+	/* Number of mmap windows we've made on this image, and the number of
+	 * times we've scrolled an existing window. See 
+	 * vips_image_get_window_stats().
+	 */
+	int window_maps;
+	int window_remaps;
+
+	/* Windows must start on a multiple of this, 0 until we've looked. 
+	 * Files on hugetlbfs need the huge page size.
+	 */
+	int window_pagesize;
+
+	/* Bytes between the start of lines in image memory, or 0 for lines
+	 * packed together. Only set for foreign memory, see 
+	 * vips_image_new_from_area().
+	 */
+	size_t stride;
+
+	/* Set if vips_image_wio_input() has swapped strided foreign memory 
+	 * for a packed copy. In-place operations must fail.
+	 */
+	gboolean packed_copy;
+
+	/* meta and meta_traverse on the image point into this, and it can 
+	 * be shared with other images. 
+	 */
+	VipsMetaTable *meta_table;
+
+	/* Tile size for .v files with a tiled layout, or 0 for the usual
+	 * scanline layout. These live in the spare bytes of the file header.
+	 */
+	int tile_width;
+	int tile_height;
+
+	/* The end of the pixel data in a tiled file with compressed tiles.
+	 */
+	gint64 tile_data_end;
+
+	/* g_get_monotonic_time() after which computation fails, or 0 for no
+	 * deadline. See vips_image_set_deadline().
+	 */
+	gint64 deadline;
+} VipsImagePrivate;
+
+VipsImagePrivate *vips__image_private( VipsImage *image );
+size_t vips__image_stride( VipsImage *image );
 
 char *vips__b64_encode( const unsigned char *data, size_t data_length );
 unsigned char *vips__b64_decode( const char *buffer, size_t *data_length );
 
+/* Extra flags for vips__mmap_full().
+ */
+#define VIPS__MMAP_POPULATE (1)
+#define VIPS__MMAP_HUGEPAGE (2)
+
 void *vips__mmap( int fd, int writeable, size_t length, gint64 offset );
+void *vips__mmap_full( int fd, int writeable, size_t length, gint64 offset, 
+	int extra );
+void *vips__mmap_anonymous( size_t length, int extra );
+void *vips__mmap_file( const char *filename, size_t *length );
 int vips__munmap( const void *start, size_t length );
+int vips_window_pagesize( VipsImage *im );
 int vips_mapfile( VipsImage * );
 int vips_mapfilerw( VipsImage * );
 int vips_remapfilerw( VipsImage * );
 
 void vips__buffer_init( void );
+void vips__buffer_thread_clear( void );
+void vips__buffer_thread_free_spare( void );
+void vips__tracked_thread_flush( void );
+int vips__worker_spawn( GThreadFunc func, void *data );
+
+/* Register the native kernels, see simd.c.
+ */
+void vips__simd_x86_init( void );
+void vips__simd_neon_init( void );
+
+/* Register the built-in accelerator kernels, see accel.c.
+ */
+void vips__accel_opencl_init( void );
+
+extern int vips__region_pool_hits;
+extern int vips__region_pool_misses;
+
+VipsRegion *vips__region_pool_get( VipsImage *image );
+void vips__region_pool_put( VipsRegion *region );
+void vips__region_pool_drain( VipsImage *image );
+
+gboolean vips__region_lane_start( VipsRegion *region, const VipsRect *r );
+int vips__region_lane_finish( VipsRegion *region, gint64 *time );
 
 void vips__copy_4byte( int swap, unsigned char *to, unsigned char *from );
 void vips__copy_2byte( gboolean swap, unsigned char *to, unsigned char *from );
 
 guint32 vips__file_magic( const char *filename );
+void vips__get_bytes_preload( const char *filename,
+	const unsigned char *buf, guint64 length, gboolean complete );
+/* The Compression header field for tiled .v files with LZ4 tiles. 1 and 2
+ * were used by very old vips for JPEG and LZW.
+ */
+#define VIPS__TILE_COMPRESSION_LZ4 (3)
+
 int vips__has_extension_block( VipsImage *im );
 void *vips__read_extension_block( VipsImage *im, int *size );
 int vips__write_extension_block( VipsImage *im, void *buf, int size );
 int vips__writehist( VipsImage *image );
+int vips__write_tiled( VipsImage *in, const char *filename,
+	int tile_width, int tile_height );
+int vips__write_tiled_output( VipsImage *image );
+int vips__assemble_parts( const char *filename, VipsImage **parts, int n );
 int vips__read_header_bytes( VipsImage *im, unsigned char *from );
 int vips__write_header_bytes( VipsImage *im, unsigned char *to );
 
@@ -157,6 +312,7 @@ gboolean vips_image_iskilled( VipsImage *image );
 void vips_image_set_kill( VipsImage *image, gboolean kill );
 VipsImage *vips_image_new_mode( const char *filename, const char *mode );
 
+VipsBandFormat vips__format_common( VipsBandFormat a, VipsBandFormat b );
 int vips__formatalike_vec( VipsImage **in, VipsImage **out, int n );
 int vips__sizealike_vec( VipsImage **in, VipsImage **out, int n );
 int vips__bandup( const char *domain, VipsImage *in, VipsImage **out, int n );
@@ -187,6 +343,8 @@ int vips__draw_flood_direct( VipsImage *image, VipsImage *test,
 	int serial, int x, int y );
 int vips__draw_mask_direct( VipsImage *image, VipsImage *mask, 
 	VipsPel *ink, int x, int y ); 
+int vips__draw_mask_clip( VipsImage *image, VipsImage *mask,
+	VipsPel *ink, int x, int y, VipsRect *clip );
 
 typedef void (*VipsDrawPoint)( VipsImage *image, 
 	int x, int y, void *client ); 
@@ -201,6 +359,11 @@ void vips__draw_circle_direct( VipsImage *image, int cx, int cy, int r,
 int vips__insert_just_one( VipsRegion *out, VipsRegion *in, int x, int y );
 int vips__insert_paste_region( VipsRegion *out, VipsRegion *in, VipsRect *pos );
 
+VipsBandFormat vips__pel_format( int ps );
+void vips__flip_line( VipsPel *q, const VipsPel *p, int width, int ps );
+gboolean vips__linear_get( VipsImage *image,
+	VipsImage **in, double *a, double *b );
+
 /* Register base vips interpolators, called during startup.
  */
 void vips__interpolate_init( void );
@@ -221,6 +384,12 @@ void vips_draw_operation_init( void );
 void vips_mosaicing_operation_init( void );
 void vips_cimg_operation_init( void );
 
+/* Register packages on first use, see optable.c.
+ */
+void vips__optable_init_all( void );
+GType vips__optable_find( const char *nickname );
+int vips__optable_check( void );
+
 guint64 vips__parse_size( const char *size_string );
 int vips__substitute( char *buf, size_t len, char *sub );
 
@@ -253,14 +422,40 @@ int vips__foreign_convert_saveable( VipsImage *in, VipsImage **ready,
 
 int vips__image_intize( VipsImage *in, VipsImage **out );
 
+extern gboolean vips__reorder_parallel;
+
 void vips__reorder_init( void );
 int vips__reorder_set_input( VipsImage *image, VipsImage **in );
 void vips__reorder_clear( VipsImage *image );
 
+/* Make a line of output from a line of each input, see fuse.c.
+ */
+typedef void (*VipsPointFn)( VipsPel *out, VipsPel **in, int width, void *a );
+
+extern gboolean vips__fuse_enabled;
+
+void vips__point_init( void );
+void vips__point_attach( VipsImage *out, VipsImage **in, 
+	VipsPointFn fn, void *a );
+void vips__point_fuse( VipsOperation *operation );
+VipsPointFn vips__point_get( VipsImage *image, VipsImage **in, void **a );
+
+/* Convolutions work in column strips with about this many bytes of input,
+ * 0 for no strips, see convolution.c.
+ */
+extern int vips__conv_block;
+
+/* Write every pipeline here as it finishes, see graph.c.
+ */
+extern char *vips__pipeline_graph;
+
 /* Window manager API.
  */
 VipsWindow *vips_window_take( VipsWindow *window, 
 	VipsImage *im, int top, int height );
+void vips__window_prefetch( VipsImage *im, int top, int height );
+
+void vips__image_prefetch( VipsImage *image, const VipsRect *r );
 
 #ifdef __cplusplus
 }
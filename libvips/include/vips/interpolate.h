@@ -64,6 +64,12 @@ typedef struct _VipsInterpolate {
 typedef void (*VipsInterpolateMethod)( VipsInterpolate *interpolate,
 	void *out, VipsRegion *in, double x, double y );
 
+/* Interpolate a span of n pixels. Write n pixels to "out", pixel i
+ * interpolated at position (x[i], y[i]) in "in".
+ */
+typedef void (*VipsInterpolateSpanMethod)( VipsInterpolate *interpolate,
+	void *out, VipsRegion *in, const double *x, const double *y, int n );
+
 typedef struct _VipsInterpolateClass {
 	VipsObjectClass parent_class;
 
@@ -85,6 +91,11 @@ typedef struct _VipsInterpolateClass {
 	 */
 	int (*get_window_offset)( VipsInterpolate *interpolate );
 	int window_offset;
+
+	/* Interpolate a whole span of pixels. The default calls
+	 * interpolate() for each one.
+	 */
+	VipsInterpolateSpanMethod interpolate_span;
 } VipsInterpolateClass;
 
 /* Don't put spaces around void here, it breaks gtk-doc.
@@ -93,6 +104,10 @@ GType vips_interpolate_get_type(void);
 void vips_interpolate( VipsInterpolate *interpolate,
 	void *out, VipsRegion *in, double x, double y );
 VipsInterpolateMethod vips_interpolate_get_method( VipsInterpolate *interpolate );
+void vips_interpolate_span( VipsInterpolate *interpolate,
+	void *out, VipsRegion *in, const double *x, const double *y, int n );
+VipsInterpolateSpanMethod
+	vips_interpolate_get_span_method( VipsInterpolate *interpolate );
 int vips_interpolate_get_window_size( VipsInterpolate *interpolate );
 int vips_interpolate_get_window_offset( VipsInterpolate *interpolate );
 
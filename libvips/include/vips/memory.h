@@ -73,6 +73,12 @@ void *vips_tracked_malloc( size_t size );
 size_t vips_tracked_get_mem( void );
 size_t vips_tracked_get_mem_highwater( void );
 int vips_tracked_get_allocs( void );
+guint64 vips_tracked_get_allocs_total( void );
+void vips_tracked_reset_highwater( void );
+void vips_tracked_trim( void );
+size_t vips_tracked_get_pool( void );
+guint64 vips_tracked_get_pool_hits( void );
+guint64 vips_tracked_get_pool_misses( void );
 
 int vips_tracked_open( const char *pathname, int flags, ... );
 int vips_tracked_close( int fd );
@@ -126,6 +126,18 @@ extern int _vips__argument_id;
 		pspec, (VipsArgumentFlags) (FLAGS), (PRIORITY), (OFFSET) ); \
 }
 
+#define VIPS_ARG_OBJECT( CLASS, NAME, PRIORITY, LONG, DESC, FLAGS, OFFSET, TYPE ) { \
+	GParamSpec *pspec; \
+	\
+	pspec = g_param_spec_object( (NAME), (LONG), (DESC),  \
+		TYPE, \
+		(GParamFlags) (G_PARAM_READWRITE) ); \
+	g_object_class_install_property( G_OBJECT_CLASS( CLASS ), \
+		_vips__argument_id++, pspec ); \
+	vips_object_class_install_argument( VIPS_OBJECT_CLASS( CLASS ), \
+		pspec, (VipsArgumentFlags) (FLAGS), (PRIORITY), (OFFSET) ); \
+}
+
 #define VIPS_ARG_BOOL( CLASS, NAME, PRIORITY, LONG, DESC, \
 	FLAGS, OFFSET, VALUE ) { \
 	GParamSpec *pspec; \
@@ -317,6 +329,12 @@ gboolean vips_object_argument_isset( VipsObject *object, const char *name );
 VipsArgumentFlags vips_object_get_argument_flags( VipsObject *object, 
 	const char *name );
 int vips_object_get_argument_priority( VipsObject *object, const char *name );
+int vips_object_class_argument_index( VipsObjectClass *object_class, 
+	const char *name );
+int vips_object_set_argument_by_index( VipsObject *object, int index, 
+	const GValue *value );
+int vips_object_get_argument_by_index( VipsObject *object, int index, 
+	GValue *value );
 
 /* We have to loop over an objects args in several places, and we can't always
  * use vips_argument_map(), the preferred looper. Have the loop code as a
@@ -43,6 +43,12 @@ typedef enum /*< flags >*/ {
 	VIPS_OPERATION_DEPRECATED = 8
 } VipsOperationFlags;
 
+typedef enum {
+	VIPS_CACHE_POLICY_LRU,
+	VIPS_CACHE_POLICY_GDS,
+	VIPS_CACHE_POLICY_LAST
+} VipsCachePolicy;
+
 #define VIPS_TYPE_OPERATION (vips_operation_get_type())
 #define VIPS_OPERATION( obj ) \
 	(G_TYPE_CHECK_INSTANCE_CAST( (obj), \
@@ -127,7 +133,21 @@ size_t vips_cache_get_max_mem( void );
 int vips_cache_get_max_files( void );
 void vips_cache_set_max_files( int max_files );
 void vips_cache_set_dump( gboolean dump );
+
+void vips_disk_cache_set_dir( const char *dir );
+char *vips_disk_cache_get_dir( void );
+void vips_disk_cache_set_max_bytes( guint64 max_bytes );
+guint64 vips_disk_cache_get_max_bytes( void );
+int vips_disk_cache_get_hits( void );
+int vips_disk_cache_get_misses( void );
+int vips_cache_operation_write_to_buffer( VipsOperation **operation,
+	const char *suffix, void **buf, size_t *size );
 void vips_cache_set_trace( gboolean trace );
+void vips_cache_set_policy( VipsCachePolicy policy );
+VipsCachePolicy vips_cache_get_policy( void );
+int vips_cache_get_hits( void );
+int vips_cache_get_misses( void );
+int vips_cache_get_evictions( void );
 
 /* Part of threadpool, really, but we want these in a header that gets scanned
  * for our typelib.
@@ -135,6 +155,9 @@ void vips_cache_set_trace( gboolean trace );
 void vips_concurrency_set( int concurrency );
 int vips_concurrency_get( void );
 
+void vips_numa_set( gboolean numa );
+gboolean vips_numa_get( void );
+
 #ifdef __cplusplus
 }
 #endif /*__cplusplus*/
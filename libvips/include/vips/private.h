@@ -52,6 +52,11 @@ extern "C" {
  */
 #define VIPS__WINDOW_MARGIN_BYTES (1024 * 1024 * 10)
 
+/* Private to iofuncs: windows this large or larger are populated or get huge 
+ * pages, if those modes are on.
+ */
+#define VIPS__WINDOW_LARGE (1024 * 1024 * 2)
+
 /* sizeof() a VIPS header on disc.
  */
 #define VIPS_SIZEOF_HEADER (64)
@@ -79,6 +84,8 @@ void vips_window_print( VipsWindow *window );
 typedef struct {
 	GHashTable *hash;	/* VipsImage -> VipsBufferCache* */
 	GThread *thread;	/* Just for sanity checking */
+	GSList *spare;		/* Unattached VipsBuffer we can reuse */
+	int n_spare;		/* Number of spares */
 } VipsBufferThread;
 
 /* Per-image buffer cache. This keeps a list of "done" VipsBuffer that this
@@ -150,6 +157,13 @@ typedef enum _RegionType {
 #define VIPS__THINSTRIP_HEIGHT (1)
 #define VIPS__FATSTRIP_HEIGHT (16)
 
+/* Limits for adaptive tile geometry, see vips_get_tile_size(). These must be 
+ * powers of two.
+ */
+#define VIPS__TILE_ADAPTIVE_MIN (32)
+#define VIPS__TILE_ADAPTIVE_MAX (256)
+#define VIPS__FATSTRIP_ADAPTIVE_MAX (64)
+
 /* Functions on regions.
  */
 struct _VipsRegion;
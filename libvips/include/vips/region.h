@@ -40,6 +40,25 @@
 extern "C" {
 #endif /*__cplusplus*/
 
+/**
+ * VipsRegionShrink:
+ * @VIPS_REGION_SHRINK_MEAN: use the average
+ * @VIPS_REGION_SHRINK_MEDIAN: use the lower of the two middle values
+ * @VIPS_REGION_SHRINK_MODE: use the most common value
+ * @VIPS_REGION_SHRINK_MAX: use the largest value
+ * @VIPS_REGION_SHRINK_MIN: use the smallest value
+ *
+ * How to calculate the output pixels when shrinking a 2x2 region.
+ */
+typedef enum {
+	VIPS_REGION_SHRINK_MEAN,
+	VIPS_REGION_SHRINK_MEDIAN,
+	VIPS_REGION_SHRINK_MODE,
+	VIPS_REGION_SHRINK_MAX,
+	VIPS_REGION_SHRINK_MIN,
+	VIPS_REGION_SHRINK_LAST
+} VipsRegionShrink;
+
 #define VIPS_TYPE_REGION (vips_region_get_type())
 #define VIPS_REGION( obj ) \
 	(G_TYPE_CHECK_INSTANCE_CAST( (obj), \
@@ -117,12 +136,15 @@ void vips_region_paint_pel( VipsRegion *reg,
 void vips_region_black( VipsRegion *reg );
 void vips_region_copy( VipsRegion *reg, VipsRegion *dest, 
 	const VipsRect *r, int x, int y );
+int vips_region_shrink_method( VipsRegion *from, VipsRegion *to,
+	const VipsRect *target, VipsRegionShrink method );
 int vips_region_shrink( VipsRegion *from, 
 	VipsRegion *to, const VipsRect *target );
 
 int vips_region_prepare( VipsRegion *reg, const VipsRect *r );
 int vips_region_prepare_to( VipsRegion *reg, 
 	VipsRegion *dest, const VipsRect *r, int x, int y );
+void vips_region_prefetch( VipsRegion *reg, const VipsRect *r );
 
 void vips_region_invalidate( VipsRegion *reg );
 
@@ -55,6 +55,13 @@ typedef enum {
 	VIPS_SIZE_LAST
 } VipsSize;
 
+typedef enum {
+	VIPS_THUMBNAIL_QUALITY_HIGH,
+	VIPS_THUMBNAIL_QUALITY_AUTO,
+	VIPS_THUMBNAIL_QUALITY_FAST,
+	VIPS_THUMBNAIL_QUALITY_LAST
+} VipsThumbnailQuality;
+
 int vips_shrink( VipsImage *in, VipsImage **out, 
 	double hshrink, double vshrink, ... )
 	__attribute__((sentinel));
@@ -78,6 +85,9 @@ int vips_thumbnail_buffer( void *buf, size_t len, VipsImage **out,
 	__attribute__((sentinel));
 int vips_thumbnail_image( VipsImage *in, VipsImage **out, int width, ... )
 	__attribute__((sentinel));
+int vips_thumbnail_multi( const char *filename, VipsImage **out,
+	const int *sizes, int n, ... )
+	__attribute__((sentinel));
 
 int vips_similarity( VipsImage *in, VipsImage **out, ... )
 	__attribute__((sentinel));
@@ -0,0 +1,296 @@
+/* native SIMD kernels with run-time dispatch
+ *
+ * 14/10/18
+ * 	- from vector.h
+ * 	- reduceh kernels do a whole line
+ * 	- add max and min
+ * 	- add lut32
+ * 	- add span and span_back
+ * 	- add relational and boolean
+ * 15/10/18
+ * 	- add rad2float
+ */
+
+/*
+
+    This file is part of VIPS.
+
+    VIPS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA
+
+ */
+
+/*
+
+    These files are distributed with VIPS - http://www.vips.ecs.soton.ac.uk
+
+ */
+
+#ifndef VIPS_SIMD_H
+#define VIPS_SIMD_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif /*__cplusplus*/
+
+/* The instruction sets we can dispatch to.
+ */
+typedef enum {
+	VIPS_SIMD_NONE = 0,
+	VIPS_SIMD_SSE41 = 1,
+	VIPS_SIMD_AVX2 = 2,
+	VIPS_SIMD_AVX512 = 4,
+	VIPS_SIMD_NEON = 8
+} VipsSimdFeatures;
+
+/* The kernels we have. Each is looked up by kernel and band format, and
+ * each has its own function type, see below.
+ */
+typedef enum {
+	VIPS_SIMD_LINEAR,		/* VipsSimdLinearFn, by in format */
+	VIPS_SIMD_CAST_FLOAT,		/* VipsSimdCastFn, by in format */
+	VIPS_SIMD_CLIP_FLOAT,		/* VipsSimdClipFn, by out format */
+	VIPS_SIMD_SHIFT_UCHAR,		/* VipsSimdShiftFn, by in format */
+	VIPS_SIMD_PREMULTIPLY,		/* VipsSimdAlphaFn, 4 bands */
+	VIPS_SIMD_UNPREMULTIPLY,	/* VipsSimdAlphaFn, 4 bands */
+	VIPS_SIMD_FLATTEN,		/* VipsSimdFlattenFn, 4 bands */
+	VIPS_SIMD_REDUCEH,		/* VipsSimdReducehFn, by in format */
+	VIPS_SIMD_REDUCEV,		/* VipsSimdReducevFn */
+	VIPS_SIMD_SHRINKH,		/* VipsSimdShrinkhFn, 4 bands */
+	VIPS_SIMD_SHRINKV,		/* VipsSimdShrinkvFn */
+	VIPS_SIMD_COMPOSITE,		/* VipsSimdCompositeFn, 4 bands */
+	VIPS_SIMD_MATRIX3,		/* VipsSimdMatrixFn, 3 bands */
+	VIPS_SIMD_XYZ2LAB,		/* VipsSimdLabFn, 3 bands */
+	VIPS_SIMD_LAB2XYZ,		/* VipsSimdLabFn, 3 bands */
+	VIPS_SIMD_DE00,			/* VipsSimdDifferenceFn, 3 bands */
+	VIPS_SIMD_SRGB2HSV,		/* VipsSimdPelFn, 3 bands */
+	VIPS_SIMD_SRGB2HUE,		/* VipsSimdPelFn, 3 bands to 1 */
+	VIPS_SIMD_HSV2SRGB,		/* VipsSimdPelFn, 3 bands */
+	VIPS_SIMD_TRANSPOSE,		/* VipsSimdTransposeFn, by pel size */
+	VIPS_SIMD_FLIP,			/* VipsSimdFlipFn, by pel size */
+	VIPS_SIMD_CONVH,		/* VipsSimdConvhFn, by in format */
+	VIPS_SIMD_CONVV,		/* VipsSimdConvvFn */
+	VIPS_SIMD_BILINEAR,		/* VipsSimdBilinearFn, 3 or 4 bands */
+	VIPS_SIMD_BICUBIC,		/* VipsSimdBicubicFn, 3 or 4 bands */
+	VIPS_SIMD_MAX,			/* VipsSimdMinmaxFn, uchar */
+	VIPS_SIMD_MIN,			/* VipsSimdMinmaxFn, uchar */
+	VIPS_SIMD_LUT32,		/* VipsSimdLutFn, uchar */
+	VIPS_SIMD_BLEND,		/* VipsSimdBlendFn, by format */
+	VIPS_SIMD_SPAN,			/* VipsSimdSpanFn, by pel size */
+	VIPS_SIMD_SPAN_BACK,		/* VipsSimdSpanFn, by pel size */
+	VIPS_SIMD_RELATIONAL,		/* VipsSimdRelationalFn, by format */
+	VIPS_SIMD_BOOLEAN,		/* VipsSimdBooleanFn, uchar */
+	VIPS_SIMD_SHRINK2,		/* VipsSimdShrink2Fn, by format */
+	VIPS_SIMD_RAD2FLOAT,		/* VipsSimdRadFn, uchar */
+	VIPS_SIMD_LAST
+} VipsSimdKernel;
+
+/* out[i] = a * in[i] + b, computed in float.
+ */
+typedef void (*VipsSimdLinearFn)( float *out, const VipsPel *in, int n,
+	float a, float b );
+
+/* Convert n elements to float.
+ */
+typedef void (*VipsSimdCastFn)( float *out, const VipsPel *in, int n );
+
+/* Floor and clip n floats to the kernel's format, counting the elements
+ * which fall outside the range.
+ */
+typedef void (*VipsSimdClipFn)( VipsPel *out, const float *in, int n,
+	int *underflow, int *overflow );
+
+/* Shift n elements down to uchar, keeping the most significant bits.
+ */
+typedef void (*VipsSimdShiftFn)( VipsPel *out, const VipsPel *in, int n );
+
+/* Premultiply or unpremultiply width 4-band pixels to float.
+ */
+typedef void (*VipsSimdAlphaFn)( float *out, const VipsPel *in, int width,
+	double max_alpha );
+
+/* Flatten width 4-band pixels to 3 bands over ink, or over black if ink is
+ * NULL. Alpha must be 0 to the maximum for the format.
+ */
+typedef void (*VipsSimdFlattenFn)( VipsPel *out, const VipsPel *in,
+	int width, const VipsPel *ink );
+
+/* width output pixels of 3 or 4 bands. Pixel x is made from the n_point
+ * input pixels from in + start[x] pixels, with mask phase[x] from coeff, a
+ * table of n_point coefficients for each phase. The table is fixed-point
+ * short for uchar, fixed-point int for ushort and double for float.
+ */
+typedef void (*VipsSimdReducehFn)( VipsPel *out, const VipsPel *in,
+	int width, int bands, const int *start, const int *phase,
+	const void *coeff, int n_point );
+
+/* ne output elements from n_point lines lskip bytes apart with a fixed-point
+ * mask.
+ */
+typedef void (*VipsSimdReducevFn)( VipsPel *out, const VipsPel *in,
+	int ne, int lskip, const int *cy, int n_point );
+
+/* width 4-band uchar or ushort output pixels, each the rounded average of
+ * hshrink input pixels.
+ */
+typedef void (*VipsSimdShrinkhFn)( VipsPel *out, const VipsPel *in,
+	int width, int hshrink );
+
+/* Add n elements to an int accumulator.
+ */
+typedef void (*VipsSimdShrinkvFn)( int *sum, const VipsPel *in, int n );
+
+/* Composite n 4-band images. in[0] is the base image, and image i is blended
+ * with mode[i - 1], or with mode[0] if n_mode is 1. Kernels only need to
+ * support OVER, MULTIPLY, SCREEN and DEST_IN.
+ */
+typedef void (*VipsSimdCompositeFn)( VipsPel *out, VipsPel **in, int n,
+	int width, const VipsBlendMode *mode, int n_mode,
+	const float *max_band, gboolean premultiplied );
+
+/* Multiply width 3-band float pixels by a 3x3 matrix, computing in double.
+ */
+typedef void (*VipsSimdMatrixFn)( float *out, const float *in, int width,
+	const double *matrix );
+
+/* Convert width 3-band float pixels between XYZ and Lab with a white point.
+ */
+typedef void (*VipsSimdLabFn)( float *out, const float *in, int width,
+	const double *white );
+
+/* The colour difference between width pairs of 3-band float pixels.
+ */
+typedef void (*VipsSimdDifferenceFn)( float *out,
+	const float *in1, const float *in2, int width );
+
+/* Convert width 3-band uchar pixels.
+ */
+typedef void (*VipsSimdPelFn)( VipsPel *out, const VipsPel *in, int width );
+
+/* Transpose width x height pixels: pixel i of output line j is pixel j of
+ * input line i. Either lskip can be negative. These are looked up by the
+ * format with the same size as a pixel, so UCHAR for 1-byte pixels, USHORT
+ * for 2, UINT for 4 and DOUBLE for 8.
+ */
+typedef void (*VipsSimdTransposeFn)( VipsPel *out, int out_lskip,
+	const VipsPel *in, int in_lskip, int width, int height );
+
+/* Copy width pixels, reversing their order. Looked up by pixel size, as
+ * VIPS_SIMD_TRANSPOSE.
+ */
+typedef void (*VipsSimdFlipFn)( VipsPel *out, const VipsPel *in, int width );
+
+/* ne float elements, each the sum of n_point input elements stride bytes
+ * apart times a mask. The mask is short for uchar, int for ushort and float
+ * for float input. Fixed-point sums must not overflow int.
+ */
+typedef void (*VipsSimdConvhFn)( float *out, const VipsPel *in,
+	int ne, int stride, const void *coeff, int n_point );
+
+/* ne float elements from n_point float lines stride bytes apart with a mask,
+ * plus an offset.
+ */
+typedef void (*VipsSimdConvvFn)( float *out, const float *in,
+	int ne, int stride, const float *coeff, int n_point, float offset );
+
+/* n 3- or 4-band pixels, pixel i interpolated from the 2x2 with top-left
+ * at in[i], with four fixed-point coefficients at coeff + i * 4.
+ */
+typedef void (*VipsSimdBilinearFn)( VipsPel *out, const VipsPel **in, int n,
+	int bands, int lskip, const int *coeff );
+
+/* n 3- or 4-band pixels, pixel i interpolated from the 4x4 with top-left
+ * at in[i], with fixed-point masks cx[i] and cy[i].
+ */
+typedef void (*VipsSimdBicubicFn)( VipsPel *out, const VipsPel **in, int n,
+	int bands, int lskip, const int **cx, const int **cy );
+
+/* out[i] = max (or min) of a[i] and b[i] for n elements. out can be the
+ * same as a or b.
+ */
+typedef void (*VipsSimdMinmaxFn)( VipsPel *out,
+	const VipsPel *a, const VipsPel *b, int n );
+
+/* Map n uchar elements through a table of 32 uchar entries. Indexes are
+ * clipped to clip first, which must be less than 32.
+ */
+typedef void (*VipsSimdLutFn)( VipsPel *out, const VipsPel *in, int n,
+	const VipsPel *table, int clip );
+
+/* Blend n elements of a and b with a coefficient for each element. For
+ * uchar and ushort the coefficients are int scaled by 4096, and out[i] is
+ * c1[i] * a[i] / 4096 + c2[i] * b[i] / 4096. For float they are double, and
+ * out[i] is c1[i] * a[i] + c2[i] * b[i], or just a[i] if c2[i] is zero, or
+ * b[i] if c1[i] is zero.
+ */
+typedef void (*VipsSimdBlendFn)( VipsPel *out,
+	const VipsPel *a, const VipsPel *b, int n,
+	const void *c1, const void *c2 );
+
+/* Count the pels from p which are equal to value (if equal is TRUE) or not
+ * equal to value (if equal is FALSE), stopping at the first that isn't, and
+ * looking at no more than n. span goes up memory from p, span_back goes down.
+ */
+typedef int (*VipsSimdSpanFn)( const VipsPel *p, int n,
+	const VipsPel *value, gboolean equal );
+
+/* out[i] is 255 if a[i] op b[i] holds and 0 if it doesn't, for n elements.
+ * If b is NULL, compare against the single element at c instead.
+ */
+typedef void (*VipsSimdRelationalFn)( VipsPel *out,
+	const VipsPel *a, const VipsPel *b, const VipsPel *c, int n,
+	VipsOperationRelational op );
+
+/* out[i] = a[i] op b[i] for n bytes, or against the single byte at c if b
+ * is NULL. op must be AND, OR or EOR. These are bitwise, so the uchar
+ * kernel works for any integer format.
+ */
+typedef void (*VipsSimdBooleanFn)( VipsPel *out,
+	const VipsPel *a, const VipsPel *b, const VipsPel *c, int n,
+	VipsOperationBoolean op );
+
+/* width output pixels of bands elements, each the mean of a 2x2 block from
+ * two input lines lskip bytes apart. Integer formats give (sum + 2) >> 2,
+ * float gives (((a + b) + c) + d) / 4 computed in float, where a and b are
+ * from the top line. Kernels need only support up to 4 bands and must do
+ * any others in C.
+ */
+typedef void (*VipsSimdShrink2Fn)( VipsPel *out, const VipsPel *in,
+	int lskip, int width, int bands );
+
+/* Unpack width 4-byte Radiance RGBE pixels to 3-band float. Each element is
+ * (m + 0.5) * 2 ** (e - 136) rounded once to float, or zero if e is zero.
+ */
+typedef void (*VipsSimdRadFn)( float *out, const VipsPel *in, int width );
+
+/* Cleared by the command-line --vips-nosimd switch and the VIPS_NOSIMD env
+ * var.
+ */
+extern gboolean vips__simd_enabled;
+
+void vips_simd_init( void );
+gboolean vips_simd_isenabled( void );
+void vips_simd_set_enabled( gboolean enabled );
+VipsSimdFeatures vips_simd_get_features( void );
+
+void vips_simd_register( VipsSimdKernel kernel, VipsBandFormat format,
+	VipsSimdFeatures features, void *fn );
+void *vips_simd_get( VipsSimdKernel kernel, VipsBandFormat format );
+
+#ifdef __cplusplus
+}
+#endif /*__cplusplus*/
+
+#endif /*VIPS_SIMD_H*/
@@ -0,0 +1,282 @@
+/* A byte source and a byte target for loaders and savers.
+ */
+
+/*
+
+    This file is part of VIPS.
+
+    VIPS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA
+
+ */
+
+/*
+
+    These files are distributed with VIPS - http://www.vips.ecs.soton.ac.uk
+
+ */
+
+#ifndef VIPS_STREAM_H
+#define VIPS_STREAM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif /*__cplusplus*/
+
+#define VIPS_TYPE_SOURCE (vips_source_get_type())
+#define VIPS_SOURCE( obj ) \
+	(G_TYPE_CHECK_INSTANCE_CAST( (obj), \
+	VIPS_TYPE_SOURCE, VipsSource ))
+#define VIPS_SOURCE_CLASS( klass ) \
+	(G_TYPE_CHECK_CLASS_CAST( (klass), \
+	VIPS_TYPE_SOURCE, VipsSourceClass))
+#define VIPS_IS_SOURCE( obj ) \
+	(G_TYPE_CHECK_INSTANCE_TYPE( (obj), VIPS_TYPE_SOURCE ))
+#define VIPS_IS_SOURCE_CLASS( klass ) \
+	(G_TYPE_CHECK_CLASS_TYPE( (klass), VIPS_TYPE_SOURCE ))
+#define VIPS_SOURCE_GET_CLASS( obj ) \
+	(G_TYPE_INSTANCE_GET_CLASS( (obj), \
+	VIPS_TYPE_SOURCE, VipsSourceClass ))
+
+/* Read bytes from a file descriptor, a file, an area of memory, or
+ * from callbacks (see #VipsSourceCustom).
+ */
+typedef struct _VipsSource {
+	VipsObject parent_object;
+
+	/*< private >*/
+
+	/* Read from this, or -1 for memory and custom sources.
+	 */
+	int descriptor;
+
+	/* TRUE if we opened the descriptor with vips_tracked_open().
+	 */
+	gboolean tracked_descriptor;
+
+	/* The file we opened, if any.
+	 */
+	char *filename;
+
+	/* A memory source.
+	 */
+	VipsBlob *blob;
+
+	/* The whole of the source in memory, either from the blob, or
+	 * because we have read all of a pipe in to support seek or map.
+	 */
+	const unsigned char *data;
+	gint64 length;
+	GByteArray *memory;
+
+	/* Position of the next byte, counting from the start.
+	 */
+	gint64 read_position;
+
+	/* TRUE if the descriptor or callbacks can't seek. We test on first
+	 * use.
+	 */
+	gboolean pipe_tested;
+	gboolean is_pipe;
+
+	/* Everything we have read from a pipe so far. We keep this until
+	 * decode starts so that loaders can rewind after sniffing and
+	 * reading the header.
+	 */
+	GByteArray *header_bytes;
+
+	/* Set by vips_source_decode(): we no longer need to rewind.
+	 */
+	gboolean decode;
+
+	/* Space for vips_source_sniff().
+	 */
+	GByteArray *sniff;
+
+} VipsSource;
+
+typedef struct _VipsSourceClass {
+	VipsObjectClass parent_class;
+
+	/* Read up to @length bytes to @data. Return the number of bytes
+	 * read, 0 for end of source, or -1 for error.
+	 */
+	gint64 (*read)( VipsSource *source, void *data, size_t length );
+
+	/* Seek as lseek(). Return the new position, or -1 if this
+	 * source can't seek.
+	 */
+	gint64 (*seek)( VipsSource *source, gint64 offset, int whence );
+
+} VipsSourceClass;
+
+GType vips_source_get_type( void );
+
+VipsSource *vips_source_new_from_descriptor( int descriptor );
+VipsSource *vips_source_new_from_file( const char *filename );
+VipsSource *vips_source_new_from_blob( VipsBlob *blob );
+VipsSource *vips_source_new_from_memory( const void *data, size_t length );
+
+gint64 vips_source_read( VipsSource *source, void *data, size_t length );
+gint64 vips_source_seek( VipsSource *source, gint64 offset, int whence );
+int vips_source_rewind( VipsSource *source );
+gint64 vips_source_length( VipsSource *source );
+const void *vips_source_map( VipsSource *source, size_t *length );
+gint64 vips_source_sniff_at_most( VipsSource *source,
+	unsigned char **data, size_t length );
+unsigned char *vips_source_sniff( VipsSource *source, size_t length );
+int vips_source_decode( VipsSource *source );
+
+#define VIPS_TYPE_SOURCE_CUSTOM (vips_source_custom_get_type())
+#define VIPS_SOURCE_CUSTOM( obj ) \
+	(G_TYPE_CHECK_INSTANCE_CAST( (obj), \
+	VIPS_TYPE_SOURCE_CUSTOM, VipsSourceCustom ))
+#define VIPS_SOURCE_CUSTOM_CLASS( klass ) \
+	(G_TYPE_CHECK_CLASS_CAST( (klass), \
+	VIPS_TYPE_SOURCE_CUSTOM, VipsSourceCustomClass))
+#define VIPS_IS_SOURCE_CUSTOM( obj ) \
+	(G_TYPE_CHECK_INSTANCE_TYPE( (obj), VIPS_TYPE_SOURCE_CUSTOM ))
+#define VIPS_IS_SOURCE_CUSTOM_CLASS( klass ) \
+	(G_TYPE_CHECK_CLASS_TYPE( (klass), VIPS_TYPE_SOURCE_CUSTOM ))
+#define VIPS_SOURCE_CUSTOM_GET_CLASS( obj ) \
+	(G_TYPE_INSTANCE_GET_CLASS( (obj), \
+	VIPS_TYPE_SOURCE_CUSTOM, VipsSourceCustomClass ))
+
+/* A source that reads by emitting the "read" and "seek" signals. Connect
+ * handlers before the first read.
+ */
+typedef struct _VipsSourceCustom {
+	VipsSource parent_object;
+
+} VipsSourceCustom;
+
+typedef struct _VipsSourceCustomClass {
+	VipsSourceClass parent_class;
+
+} VipsSourceCustomClass;
+
+GType vips_source_custom_get_type( void );
+
+VipsSourceCustom *vips_source_custom_new( void );
+
+#define VIPS_TYPE_TARGET (vips_target_get_type())
+#define VIPS_TARGET( obj ) \
+	(G_TYPE_CHECK_INSTANCE_CAST( (obj), \
+	VIPS_TYPE_TARGET, VipsTarget ))
+#define VIPS_TARGET_CLASS( klass ) \
+	(G_TYPE_CHECK_CLASS_CAST( (klass), \
+	VIPS_TYPE_TARGET, VipsTargetClass))
+#define VIPS_IS_TARGET( obj ) \
+	(G_TYPE_CHECK_INSTANCE_TYPE( (obj), VIPS_TYPE_TARGET ))
+#define VIPS_IS_TARGET_CLASS( klass ) \
+	(G_TYPE_CHECK_CLASS_TYPE( (klass), VIPS_TYPE_TARGET ))
+#define VIPS_TARGET_GET_CLASS( obj ) \
+	(G_TYPE_INSTANCE_GET_CLASS( (obj), \
+	VIPS_TYPE_TARGET, VipsTargetClass ))
+
+/* Buffer this many bytes of small writes.
+ */
+#define VIPS_TARGET_BUFFER_SIZE (8500)
+
+/* Write bytes to a file descriptor, a file, an area of memory, or to
+ * callbacks (see #VipsTargetCustom).
+ */
+typedef struct _VipsTarget {
+	VipsObject parent_object;
+
+	/*< private >*/
+
+	/* Write to this, or -1 for memory and custom targets.
+	 */
+	int descriptor;
+	gboolean tracked_descriptor;
+	char *filename;
+
+	/* Write to a memory buffer.
+	 */
+	gboolean memory;
+	GByteArray *memory_buffer;
+
+	/* vips_target_finish() has been called.
+	 */
+	gboolean finished;
+
+	/* Small writes are gathered here.
+	 */
+	unsigned char output_buffer[VIPS_TARGET_BUFFER_SIZE];
+	int write_point;
+
+} VipsTarget;
+
+typedef struct _VipsTargetClass {
+	VipsObjectClass parent_class;
+
+	/* Write @length bytes from @data. Return the number of bytes
+	 * written, or -1 for error.
+	 */
+	gint64 (*write)( VipsTarget *target, const void *data, size_t length );
+
+	/* All bytes have been written.
+	 */
+	void (*finish)( VipsTarget *target );
+
+} VipsTargetClass;
+
+GType vips_target_get_type( void );
+
+VipsTarget *vips_target_new_to_descriptor( int descriptor );
+VipsTarget *vips_target_new_to_file( const char *filename );
+VipsTarget *vips_target_new_to_memory( void );
+
+int vips_target_write( VipsTarget *target, const void *data, size_t length );
+int vips_target_finish( VipsTarget *target );
+unsigned char *vips_target_steal( VipsTarget *target, size_t *length );
+
+#define VIPS_TYPE_TARGET_CUSTOM (vips_target_custom_get_type())
+#define VIPS_TARGET_CUSTOM( obj ) \
+	(G_TYPE_CHECK_INSTANCE_CAST( (obj), \
+	VIPS_TYPE_TARGET_CUSTOM, VipsTargetCustom ))
+#define VIPS_TARGET_CUSTOM_CLASS( klass ) \
+	(G_TYPE_CHECK_CLASS_CAST( (klass), \
+	VIPS_TYPE_TARGET_CUSTOM, VipsTargetCustomClass))
+#define VIPS_IS_TARGET_CUSTOM( obj ) \
+	(G_TYPE_CHECK_INSTANCE_TYPE( (obj), VIPS_TYPE_TARGET_CUSTOM ))
+#define VIPS_IS_TARGET_CUSTOM_CLASS( klass ) \
+	(G_TYPE_CHECK_CLASS_TYPE( (klass), VIPS_TYPE_TARGET_CUSTOM ))
+#define VIPS_TARGET_CUSTOM_GET_CLASS( obj ) \
+	(G_TYPE_INSTANCE_GET_CLASS( (obj), \
+	VIPS_TYPE_TARGET_CUSTOM, VipsTargetCustomClass ))
+
+/* A target that writes by emitting the "write" and "finish" signals.
+ */
+typedef struct _VipsTargetCustom {
+	VipsTarget parent_object;
+
+} VipsTargetCustom;
+
+typedef struct _VipsTargetCustomClass {
+	VipsTargetClass parent_class;
+
+} VipsTargetCustomClass;
+
+GType vips_target_custom_get_type( void );
+
+VipsTargetCustom *vips_target_custom_new( void );
+
+#ifdef __cplusplus
+}
+#endif /*__cplusplus*/
+
+#endif /*VIPS_STREAM_H*/
@@ -53,6 +53,7 @@ GThread *vips_g_thread_new( const char *, GThreadFunc, gpointer );
 void *vips_g_thread_join( GThread *thread );
 
 gboolean vips_thread_isworker( void );
+gboolean vips_thread_iskilled( void );
 
 #ifdef __cplusplus
 }
@@ -93,6 +93,11 @@ typedef struct _VipsThreadState {
 	 */
 	gboolean stall;
 
+	/* In vips_threadpool_run_batch(), the data member of the unit we are 
+	 * processing.
+	 */
+	void *unit;
+
 } VipsThreadState;
 
 typedef struct _VipsThreadStateClass {
@@ -123,6 +128,15 @@ typedef int (*VipsThreadpoolAllocateFn)( VipsThreadState *state,
 /* A work function. This does a unit of work (eg. processing a tile or
  * whatever). Return non-zero for errors. 
  */
+typedef struct _VipsThreadUnit {
+	VipsRect pos;
+	void *data;
+} VipsThreadUnit;
+
+typedef int (*VipsThreadpoolAllocateBatchFn)( VipsThreadState *state,
+	void *a, VipsThreadUnit *units, int max_units, int *n_units, 
+	gboolean *stop );
+
 typedef int (*VipsThreadpoolWorkFn)( VipsThreadState *state, void *a );
 
 /* A progress function. This is run by the main thread once for every
@@ -136,9 +150,34 @@ int vips_threadpool_run( VipsImage *im,
 	VipsThreadpoolWorkFn work,
 	VipsThreadpoolProgressFn progress,
 	void *a );
+int vips_threadpool_run_batch( VipsImage *im, 
+	VipsThreadStartFn start, 
+	VipsThreadpoolAllocateBatchFn allocate_batch, 
+	VipsThreadpoolWorkFn work,
+	VipsThreadpoolProgressFn progress,
+	void *a );
 void vips_get_tile_size( VipsImage *im, 
 	int *tile_width, int *tile_height, int *n_lines );
 
+/* Reported at the end of a pipeline, see vips_pipeline_set_report().
+ */
+typedef struct _VipsPipelineStats {
+	VipsImage *image;	/* The image that was computed */
+	size_t estimate;	/* Estimated peak memory use */
+	size_t peak;		/* Largest increase in tracked memory */
+	int threads;		/* Threads we ran with */
+	int threads_wanted;	/* Threads we would have liked */
+	double wait;		/* Seconds waiting for the budget */
+} VipsPipelineStats;
+
+typedef void (*VipsPipelineReportFn)( VipsPipelineStats *stats, void *a );
+
+size_t vips_pipeline_estimate( VipsImage *image, int threads );
+void vips_pipeline_set_max_mem( size_t max_mem );
+size_t vips_pipeline_get_max_mem( void );
+size_t vips_pipeline_get_mem( void );
+void vips_pipeline_set_report( VipsPipelineReportFn report, void *a );
+
 #ifdef __cplusplus
 }
 #endif /*__cplusplus*/
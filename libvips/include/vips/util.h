@@ -339,6 +339,9 @@ char *vips_realpath( const char *path );
 
 guint32 vips__random( guint32 seed );
 guint32 vips__random_add( guint32 seed, int value );
+guint64 vips__random_counter( guint32 seed, guint32 x, guint32 y );
+void vips__random_gauss( guint32 seed, guint32 x, guint32 y,
+	double *z0, double *z1 );
 
 const char *vips__icc_dir( void );
 const char *vips__windows_prefix( void );
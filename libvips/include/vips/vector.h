@@ -2,6 +2,8 @@
  *
  * 29/10/10
  *	- from im_dilate hackery
+ * 14/10/18
+ * 	- add the compiled program cache
  */
 
 /*
@@ -44,6 +46,12 @@ extern "C" {
 
 #define VIPS_VECTOR_SOURCE_MAX (10)
 
+/* The default number of unused compiled programs we keep.
+ */
+#define VIPS_VECTOR_CACHE_MAX (200)
+
+struct _VipsVectorCacheEntry;
+
 /* An Orc program. 
  */
 typedef struct {
@@ -85,6 +93,15 @@ typedef struct {
 	/* Compiled successfully.
 	 */
 	gboolean compiled;
+
+	/* Everything we've added to the program so far, used to find
+	 * identical programs in the cache.
+	 */
+	GString *key;
+
+	/* Set if our program is shared with the compiled program cache.
+	 */
+	struct _VipsVectorCacheEntry *cache_entry;
 } VipsVector;
 
 /* An executor.
@@ -138,6 +155,11 @@ void vips_executor_run( VipsExecutor *executor );
 
 void vips_vector_to_fixed_point( double *in, int *out, int n, int scale );
 
+void vips_vector_cache_set_max( int max );
+int vips_vector_cache_get_max( void );
+int vips_vector_cache_get_size( void );
+void vips_vector_cache_drop_all( void );
+
 #ifdef __cplusplus
 }
 #endif /*__cplusplus*/
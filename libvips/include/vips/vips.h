@@ -118,6 +118,7 @@ extern "C" {
 #include <vips/private.h>
 
 #include <vips/mask.h>
+#include <vips/stream.h>
 #include <vips/image.h>
 #include <vips/memory.h>
 #include <vips/error.h>
@@ -177,6 +178,7 @@ extern "C" {
 		vips_init( ARGV0 ))
 
 int vips_init( const char *argv0 );
+void vips_operation_init_all( void );
 
 const char *vips_get_argv0( void );
 void vips_shutdown( void );
@@ -3,6 +3,8 @@
  *
  * 19/12/14
  * 	- quick hack
+ * 14/10/18
+ * 	- register all operations, they are now lazy
  */
 
 /*
@@ -65,6 +67,10 @@ main( int argc, char *argv[] )
 	if( VIPS_INIT( argv[0] ) )
 	        vips_error_exit( "unable to start VIPS" );
 
+	/* g-ir-scanner needs to see every type.
+	 */
+	vips_operation_init_all();
+
 	textdomain( GETTEXT_PACKAGE );
 	setlocale( LC_ALL, "" );
 
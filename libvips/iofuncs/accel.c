@@ -0,0 +1,197 @@
+/* accelerator kernels, for example on a GPU
+ *
+ * 14/10/18
+ * 	- first version
+ */
+
+/*
+
+    This file is part of VIPS.
+
+    VIPS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA
+
+ */
+
+/*
+
+    These files are distributed with VIPS - http://www.vips.ecs.soton.ac.uk
+
+ */
+
+/* This is like simd.c, but for kernels which run off the CPU. An
+ * accelerator registers a kernel for a band format, and operations look it up
+ * with vips_accel_get() when they are built. Kernels work on a whole region
+ * at once, since each call will usually mean an upload and a download, and
+ * can refuse any region, in which case the operation uses its CPU path for
+ * that region.
+ *
+ * The only built-in accelerator is OpenCL, see accel_opencl.c. Kernels are
+ * off by default, since the CPU is often faster for small images.
+ */
+
+/*
+#define DEBUG
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /*HAVE_CONFIG_H*/
+#include <vips/intl.h>
+
+#include <stdlib.h>
+
+#include <vips/vips.h>
+#include <vips/accel.h>
+#include <vips/internal.h>
+
+/* Set by the command-line --vips-accel switch and the VIPS_ACCEL env var.
+ */
+gboolean vips__accel_enabled = FALSE;
+
+/* Regions with fewer elements than this stay on the CPU.
+ */
+static int vips_accel_min_elements = 256 * 1024;
+
+/* The kernel for each kernel and format. This is only written during 
+ * startup, so we don't need a lock.
+ */
+static void *vips_accel_table[VIPS_ACCEL_LAST][VIPS_FORMAT_LAST];
+
+void
+vips_accel_init( void )
+{
+	static gboolean done = FALSE;
+
+	const char *env;
+
+	if( done )
+		return;
+	done = TRUE;
+
+	if( g_getenv( "VIPS_ACCEL" ) )
+		vips__accel_enabled = TRUE;
+	if( (env = g_getenv( "VIPS_ACCEL_MIN" )) )
+		vips_accel_min_elements = VIPS_MAX( 0, atoi( env ) );
+
+#ifdef HAVE_OPENCL
+	/* This just registers the kernels, the device is found on first
+	 * use.
+	 */
+	vips__accel_opencl_init();
+#endif /*HAVE_OPENCL*/
+}
+
+/**
+ * vips_accel_isenabled:
+ *
+ * Returns: %TRUE if accelerator kernels are enabled.
+ */
+gboolean
+vips_accel_isenabled( void )
+{
+	return( vips__accel_enabled );
+}
+
+/**
+ * vips_accel_set_enabled:
+ * @enabled: %TRUE to enable accelerator kernels
+ *
+ * Turn the accelerator kernels on or off. They are off by default. 
+ * Operations pick their kernel when they are built, so this won't affect
+ * pipelines which already exist.
+ *
+ * You can also use the `--vips-accel` command-line option or the
+ * `VIPS_ACCEL` environment variable to turn them on. 
+ */
+void
+vips_accel_set_enabled( gboolean enabled )
+{
+	vips__accel_enabled = enabled;
+}
+
+/**
+ * vips_accel_set_min_elements:
+ * @n: smallest region to send to the accelerator
+ *
+ * Regions with fewer than @n band elements are computed on the CPU, since
+ * the upload and download will usually cost more than the kernel saves.
+ * The default is 256k. You can also set this with the `VIPS_ACCEL_MIN`
+ * environment variable.
+ */
+void
+vips_accel_set_min_elements( int n )
+{
+	vips_accel_min_elements = VIPS_MAX( 0, n );
+}
+
+/**
+ * vips_accel_get_min_elements:
+ *
+ * Returns: the smallest region we send to the accelerator, see 
+ * vips_accel_set_min_elements().
+ */
+int
+vips_accel_get_min_elements( void )
+{
+	return( vips_accel_min_elements );
+}
+
+/**
+ * vips_accel_register:
+ * @kernel: kernel to register
+ * @format: band format this implementation handles
+ * @fn: the implementation
+ *
+ * Register an accelerated implementation of @kernel for @format. A later
+ * registration replaces an earlier one, so plugins can override the
+ * built-in accelerators.
+ *
+ * This must only be called during startup, before any operations run.
+ */
+void
+vips_accel_register( VipsAccelKernel kernel, VipsBandFormat format, 
+	void *fn )
+{
+	g_assert( kernel >= 0 && kernel < VIPS_ACCEL_LAST );
+	g_assert( format >= 0 && format < VIPS_FORMAT_LAST );
+
+	vips_accel_table[kernel][format] = fn;
+}
+
+/**
+ * vips_accel_get:
+ * @kernel: kernel to find
+ * @format: band format to find it for
+ *
+ * Find the accelerated implementation of @kernel for @format. Cast the
+ * result to the function type for that kernel, for example
+ * #VipsAccelReducevFn for #VIPS_ACCEL_REDUCEV.
+ *
+ * Returns: the kernel, or %NULL if there's nothing suitable or accelerator
+ * kernels are disabled.
+ */
+void *
+vips_accel_get( VipsAccelKernel kernel, VipsBandFormat format )
+{
+	if( !vips__accel_enabled ||
+		kernel < 0 ||
+		kernel >= VIPS_ACCEL_LAST ||
+		format < 0 ||
+		format >= VIPS_FORMAT_LAST )
+		return( NULL );
+
+	return( vips_accel_table[kernel][format] );
+}
@@ -0,0 +1,377 @@
+/* OpenCL accelerator kernels
+ *
+ * 14/10/18
+ * 	- first version
+ */
+
+/*
+
+    This file is part of VIPS.
+
+    VIPS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA
+
+ */
+
+/*
+
+    These files are distributed with VIPS - http://www.vips.ecs.soton.ac.uk
+
+ */
+
+/* Kernels for the first GPU we find. The device is found and the program
+ * built on the first call to a kernel, so this costs nothing unless 
+ * accelerator kernels are enabled and something uses them. If there's no GPU,
+ * or the build fails, every call returns -1 and operations stay on the CPU.
+ *
+ * There's one command queue and one set of kernel objects, and a lock around
+ * each call. The GPU is a single resource anyway, and each call is one 
+ * upload, one kernel and one blocking download.
+ */
+
+/*
+#define DEBUG
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /*HAVE_CONFIG_H*/
+#include <vips/intl.h>
+
+#ifdef HAVE_OPENCL
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#define CL_TARGET_OPENCL_VERSION 120
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#else /*!__APPLE__*/
+#include <CL/cl.h>
+#endif /*__APPLE__*/
+
+#include <vips/vips.h>
+#include <vips/accel.h>
+#include <vips/internal.h>
+
+/* Output line y is the fixed-point sum of n_point input lines from start[y],
+ * the same arithmetic as the C path in reducev.cpp.
+ */
+static const char *vips_opencl_reducev_source = 
+	"__kernel void\n"
+	"reducev_%s( __global const %s *in, int in_lskip,\n"
+	"	__global %s *out, int ne,\n"
+	"	__global const int *start, __global const int *cy,\n"
+	"	int n_point )\n"
+	"{\n"
+	"	int x = get_global_id( 0 );\n"
+	"	int y = get_global_id( 1 );\n"
+	"\n"
+	"	if( x < ne ) {\n"
+	"		__global const %s *p = in + start[y] * in_lskip + x;\n"
+	"		__global const int *c = cy + y * n_point;\n"
+	"		int sum;\n"
+	"		int i;\n"
+	"\n"
+	"		sum = 0;\n"
+	"		for( i = 0; i < n_point; i++ )\n"
+	"			sum += c[i] * p[i * in_lskip];\n"
+	"		sum = (sum + %d) >> %d;\n"
+	"		out[y * ne + x] = clamp( sum, 0, %d );\n"
+	"	}\n"
+	"}\n";
+
+typedef struct _VipsOpencl {
+	cl_context context;
+	cl_command_queue queue;
+	cl_program program;
+
+	cl_kernel reducev_uchar;
+	cl_kernel reducev_ushort;
+
+	GMutex *lock;
+} VipsOpencl;
+
+/* NULL if we have no device.
+ */
+static VipsOpencl *vips_opencl = NULL;
+
+static void
+vips_opencl_free( VipsOpencl *opencl )
+{
+	if( opencl->reducev_uchar ) 
+		clReleaseKernel( opencl->reducev_uchar );
+	if( opencl->reducev_ushort ) 
+		clReleaseKernel( opencl->reducev_ushort );
+	if( opencl->program ) 
+		clReleaseProgram( opencl->program );
+	if( opencl->queue ) 
+		clReleaseCommandQueue( opencl->queue );
+	if( opencl->context ) 
+		clReleaseContext( opencl->context );
+	VIPS_FREEF( vips_g_mutex_free, opencl->lock );
+	g_free( opencl );
+}
+
+static cl_int
+vips_opencl_find_gpu( cl_device_id *device )
+{
+	cl_platform_id platform[8];
+	cl_uint n_platform;
+	cl_uint i;
+
+	if( clGetPlatformIDs( VIPS_NUMBER( platform ), 
+		platform, &n_platform ) != CL_SUCCESS )
+		return( -1 );
+
+	for( i = 0; i < VIPS_MIN( n_platform, VIPS_NUMBER( platform ) ); i++ )
+		if( clGetDeviceIDs( platform[i], CL_DEVICE_TYPE_GPU, 
+			1, device, NULL ) == CL_SUCCESS )
+			return( 0 );
+
+	return( -1 );
+}
+
+static void
+vips_opencl_build_log( cl_program program, cl_device_id device )
+{
+	char log[4096];
+
+	if( clGetProgramBuildInfo( program, device, CL_PROGRAM_BUILD_LOG,
+		sizeof( log ) - 1, log, NULL ) == CL_SUCCESS ) {
+		log[sizeof( log ) - 1] = '\0';
+		g_warning( "opencl: build failed: %s", log );
+	}
+	else
+		g_warning( "opencl: build failed" );
+}
+
+static void *
+vips_opencl_device_init( void *data )
+{
+	cl_device_id device;
+	VipsOpencl *opencl;
+	cl_int err;
+	char *uchar_source;
+	char *ushort_source;
+	char *source;
+	const char *sources[1];
+	char name[256];
+
+	if( vips_opencl_find_gpu( &device ) ) {
+		g_info( "opencl: no GPU found" );
+		return( NULL );
+	}
+
+	opencl = g_new0( VipsOpencl, 1 );
+	opencl->lock = vips_g_mutex_new();
+
+	opencl->context = clCreateContext( NULL, 1, &device, NULL, NULL, &err );
+	if( err != CL_SUCCESS ) {
+		vips_opencl_free( opencl );
+		return( NULL );
+	}
+
+	opencl->queue = clCreateCommandQueue( opencl->context, 
+		device, 0, &err );
+	if( err != CL_SUCCESS ) {
+		vips_opencl_free( opencl );
+		return( NULL );
+	}
+
+	/* One kernel per format from the same template.
+	 */
+	uchar_source = g_strdup_printf( vips_opencl_reducev_source, 
+		"uchar", "uchar", "uchar", "uchar", 
+		VIPS_INTERPOLATE_SCALE >> 1, VIPS_INTERPOLATE_SHIFT, 
+		UCHAR_MAX );
+	ushort_source = g_strdup_printf( vips_opencl_reducev_source, 
+		"ushort", "ushort", "ushort", "ushort", 
+		VIPS_INTERPOLATE_SCALE >> 1, VIPS_INTERPOLATE_SHIFT, 
+		USHRT_MAX );
+	source = g_strconcat( uchar_source, ushort_source, NULL );
+	g_free( uchar_source );
+	g_free( ushort_source );
+
+	sources[0] = source;
+	opencl->program = clCreateProgramWithSource( opencl->context, 
+		1, sources, NULL, &err );
+	g_free( source );
+	if( err != CL_SUCCESS ) {
+		vips_opencl_free( opencl );
+		return( NULL );
+	}
+
+	if( clBuildProgram( opencl->program, 
+		1, &device, "", NULL, NULL ) != CL_SUCCESS ) {
+		vips_opencl_build_log( opencl->program, device );
+		vips_opencl_free( opencl );
+		return( NULL );
+	}
+
+	opencl->reducev_uchar = clCreateKernel( opencl->program, 
+		"reducev_uchar", &err );
+	if( err == CL_SUCCESS )
+		opencl->reducev_ushort = clCreateKernel( opencl->program, 
+			"reducev_ushort", &err );
+	if( err != CL_SUCCESS ) {
+		vips_opencl_free( opencl );
+		return( NULL );
+	}
+
+	if( clGetDeviceInfo( device, CL_DEVICE_NAME, 
+		sizeof( name ) - 1, name, NULL ) == CL_SUCCESS ) {
+		name[sizeof( name ) - 1] = '\0';
+		g_info( "opencl: using %s", name );
+	}
+
+	vips_opencl = opencl;
+
+	return( NULL );
+}
+
+static VipsOpencl *
+vips_opencl_get( void )
+{
+	static GOnce once = G_ONCE_INIT;
+
+	VIPS_ONCE( &once, (GThreadFunc) vips_opencl_device_init, NULL );
+
+	return( vips_opencl );
+}
+
+static int
+vips_opencl_reducev( cl_kernel kernel, size_t sizeof_element,
+	VipsPel *out, int out_lskip,
+	const VipsPel *in, int in_lskip, int in_height, 
+	int ne, int height, const int *start, const int *cy, int n_point )
+{
+	VipsOpencl *opencl = vips_opencl;
+
+	/* The input region need not be a whole buffer, so only copy the
+	 * bytes it covers.
+	 */
+	size_t in_size = (size_t) (in_height - 1) * in_lskip + 
+		ne * sizeof_element;
+	size_t out_size = (size_t) ne * height * sizeof_element;
+	cl_int in_elements = in_lskip / sizeof_element;
+	size_t global[2];
+	cl_mem buf[4];
+	cl_int err;
+	VipsPel *compact;
+	int y;
+
+	buf[0] = clCreateBuffer( opencl->context, 
+		CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 
+		in_size, (void *) in, &err );
+	buf[1] = clCreateBuffer( opencl->context, 
+		CL_MEM_WRITE_ONLY, out_size, NULL, &err );
+	buf[2] = clCreateBuffer( opencl->context, 
+		CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 
+		height * sizeof( int ), (void *) start, &err );
+	buf[3] = clCreateBuffer( opencl->context, 
+		CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 
+		height * n_point * sizeof( int ), (void *) cy, &err );
+
+	/* Round the width up to a workgroup-friendly size, the kernel 
+	 * checks x.
+	 */
+	global[0] = VIPS_ROUND_UP( ne, 64 );
+	global[1] = height;
+
+	compact = NULL;
+	if( buf[0] && buf[1] && buf[2] && buf[3] &&
+		(compact = vips_tracked_malloc( out_size )) ) {
+		g_mutex_lock( opencl->lock );
+
+		err = clSetKernelArg( kernel, 0, sizeof( cl_mem ), &buf[0] );
+		err |= clSetKernelArg( kernel, 1, sizeof( cl_int ), 
+			&in_elements );
+		err |= clSetKernelArg( kernel, 2, sizeof( cl_mem ), &buf[1] );
+		err |= clSetKernelArg( kernel, 3, sizeof( cl_int ), &ne );
+		err |= clSetKernelArg( kernel, 4, sizeof( cl_mem ), &buf[2] );
+		err |= clSetKernelArg( kernel, 5, sizeof( cl_mem ), &buf[3] );
+		err |= clSetKernelArg( kernel, 6, sizeof( cl_int ), &n_point );
+		if( err == CL_SUCCESS )
+			err = clEnqueueNDRangeKernel( opencl->queue, kernel, 
+				2, NULL, global, NULL, 0, NULL, NULL );
+		if( err == CL_SUCCESS )
+			err = clEnqueueReadBuffer( opencl->queue, buf[1], 
+				CL_TRUE, 0, out_size, compact, 0, NULL, NULL );
+
+		g_mutex_unlock( opencl->lock );
+	}
+	else
+		err = CL_OUT_OF_RESOURCES;
+
+	for( y = 0; y < VIPS_NUMBER( buf ); y++ )
+		if( buf[y] )
+			clReleaseMemObject( buf[y] );
+
+	if( err == CL_SUCCESS ) 
+		for( y = 0; y < height; y++ )
+			memcpy( out + y * out_lskip, 
+				compact + y * ne * sizeof_element, 
+				ne * sizeof_element );
+
+	if( compact )
+		vips_tracked_free( compact );
+
+	if( err != CL_SUCCESS ) {
+		g_info( "opencl: reducev failed with error %d", err );
+		return( -1 );
+	}
+
+	return( 0 );
+}
+
+static int
+vips_opencl_reducev_uchar( VipsPel *out, int out_lskip,
+	const VipsPel *in, int in_lskip, int in_height, 
+	int ne, int height, const int *start, const int *cy, int n_point )
+{
+	if( !vips_opencl_get() )
+		return( -1 );
+
+	return( vips_opencl_reducev( vips_opencl->reducev_uchar, 1,
+		out, out_lskip, in, in_lskip, in_height, 
+		ne, height, start, cy, n_point ) );
+}
+
+static int
+vips_opencl_reducev_ushort( VipsPel *out, int out_lskip,
+	const VipsPel *in, int in_lskip, int in_height, 
+	int ne, int height, const int *start, const int *cy, int n_point )
+{
+	if( !vips_opencl_get() )
+		return( -1 );
+
+	return( vips_opencl_reducev( vips_opencl->reducev_ushort, 2,
+		out, out_lskip, in, in_lskip, in_height, 
+		ne, height, start, cy, n_point ) );
+}
+
+void
+vips__accel_opencl_init( void )
+{
+	vips_accel_register( VIPS_ACCEL_REDUCEV, VIPS_FORMAT_UCHAR, 
+		vips_opencl_reducev_uchar );
+	vips_accel_register( VIPS_ACCEL_REDUCEV, VIPS_FORMAT_USHORT, 
+		vips_opencl_reducev_ushort );
+}
+
+#endif /*HAVE_OPENCL*/
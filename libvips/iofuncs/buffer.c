@@ -25,6 +25,9 @@
  * 	  buffers don't clog up the system
  * 13/10/16
  * 	- better solution: don't keep a buffercache for non-workers
+ * 14/10/18
+ * 	- workers now outlive pipelines, so add vips__buffer_thread_clear()
+ * 	  and keep a few spare buffers per thread to reuse on the next image
  */
 
 /*
@@ -86,6 +89,12 @@ static GSList *vips__buffer_cache_all = NULL;
  */
 static const int buffer_cache_max_reserve = 2; 
 
+/* The maximum number of unattached buffers we keep per thread. These are 
+ * salvaged from the reserve of images we've finished with and can be reused 
+ * for any image.
+ */
+static const int buffer_thread_max_spare = 4; 
+
 /* Workers have a BufferThread (and BufferCache) in a GPrivate they have 
  * exclusive access to.
  */
@@ -112,10 +121,14 @@ vips_buffer_dump( VipsBuffer *buffer, size_t *reserve, size_t *alive )
 {
 	vips_buffer_print( buffer ); 
 
-	g_assert( buffer->im );
 	g_assert( buffer->buf );
 
-	if( !buffer->cache &&
+	if( !buffer->im )
+		/* A per-thread spare.
+		 */
+		*reserve += buffer->bsize;
+
+	else if( !buffer->cache &&
 		!buffer->done ) {  
 		/* Global buffer, not linked to any cache.
 		 */
@@ -220,7 +233,17 @@ vips_buffer_free( VipsBuffer *buffer )
 static void
 buffer_thread_free( VipsBufferThread *buffer_thread )
 {
+	GSList *p;
+
+	/* Destroying the hash can add more spares, so this must come first.
+	 */
 	VIPS_FREEF( g_hash_table_destroy, buffer_thread->hash );
+
+	for( p = buffer_thread->spare; p; p = p->next ) 
+		vips_buffer_free( (VipsBuffer *) p->data );
+	VIPS_FREEF( g_slist_free, buffer_thread->spare );
+	buffer_thread->n_spare = 0;
+
 	VIPS_FREE( buffer_thread );
 }
 
@@ -257,10 +280,22 @@ buffer_cache_free( VipsBufferCache *cache )
 	}
 	VIPS_FREEF( g_slist_free, cache->buffers );
 
+	/* Reserve buffers are not attached to any pixels, so we can keep 
+	 * a few as spares for the next image this thread works on.
+	 */
 	for( p = cache->reserve; p; p = p->next ) {
 		VipsBuffer *buffer = (VipsBuffer *) p->data;
-
-		vips_buffer_free( buffer ); 
+		VipsBufferThread *buffer_thread = cache->buffer_thread;
+
+		if( buffer_thread->n_spare < buffer_thread_max_spare ) {
+			buffer->im = NULL;
+			buffer->cache = NULL;
+			buffer_thread->spare = 
+				g_slist_prepend( buffer_thread->spare, buffer );
+			buffer_thread->n_spare += 1;
+		}
+		else
+			vips_buffer_free( buffer ); 
 	}
 	VIPS_FREEF( g_slist_free, cache->reserve );
 
@@ -305,6 +340,8 @@ buffer_thread_new( void )
 		g_direct_hash, g_direct_equal, 
 		NULL, (GDestroyNotify) buffer_cache_free );
 	buffer_thread->thread = g_thread_self();
+	buffer_thread->spare = NULL;
+	buffer_thread->n_spare = 0;
 
 	return( buffer_thread );
 }
@@ -510,6 +547,22 @@ vips_buffer_new( VipsImage *im, VipsRect *area )
 		buffer->done = FALSE;
 		buffer->cache = NULL;
 	}
+	else if( cache &&
+		cache->buffer_thread->spare ) {
+		VipsBufferThread *buffer_thread = cache->buffer_thread;
+
+		buffer = (VipsBuffer *) buffer_thread->spare->data;
+		buffer_thread->spare = g_slist_delete_link( 
+			buffer_thread->spare, buffer_thread->spare ); 
+		buffer_thread->n_spare -= 1; 
+
+		g_assert( !buffer->im );
+		g_assert( !buffer->cache );
+
+		buffer->ref_count = 1;
+		buffer->im = im;
+		buffer->done = FALSE;
+	}
 	else {
 		buffer = g_new0( VipsBuffer, 1 );
 		buffer->ref_count = 1;
@@ -641,6 +694,39 @@ vips_buffer_unref_ref( VipsBuffer *old_buffer, VipsImage *im, VipsRect *area )
 	return( buffer );
 }
 
+/* Drop all the per-image buffer caches for this thread, keeping only spare 
+ * memory. Workers call this between jobs, since the images they were working 
+ * on may be freed as soon as the job is over.
+ */
+void
+vips__buffer_thread_clear( void )
+{
+	VipsBufferThread *buffer_thread;
+
+	if( vips_thread_isworker() &&
+		(buffer_thread = g_private_get( buffer_thread_key )) ) 
+		g_hash_table_remove_all( buffer_thread->hash );
+}
+
+/* Free this thread's spare buffers, for example because the thread has moved
+ * to another NUMA node.
+ */
+void
+vips__buffer_thread_free_spare( void )
+{
+	VipsBufferThread *buffer_thread;
+
+	if( vips_thread_isworker() &&
+		(buffer_thread = g_private_get( buffer_thread_key )) ) {
+		GSList *p;
+
+		for( p = buffer_thread->spare; p; p = p->next ) 
+			vips_buffer_free( (VipsBuffer *) p->data );
+		VIPS_FREEF( g_slist_free, buffer_thread->spare );
+		buffer_thread->n_spare = 0;
+	}
+}
+
 static void
 buffer_thread_destroy_notify( VipsBufferThread *buffer_thread )
 {
@@ -4,6 +4,13 @@
  * 	- try to make it compile on centos5
  * 7/7/12
  * 	- add a lock so we can run operations from many threads
+ * 14/10/18
+ * 	- split the cache into shards, each with its own lock and LRU list
+ * 	- hash operations before we take a lock
+ * 	- add vips_cache_set_policy() and hit/miss/eviction counters
+ * 	- fuse point operation chains after build
+ * 	- count shard lock contention with VIPS_GATE_LOCK()
+ * 	- take the shard lock when an operation signals "invalidate"
  */
 
 /*
@@ -91,17 +98,51 @@ static int vips_cache_max_files = 100;
  */
 static size_t vips_cache_max_mem = 100 * 1024 * 1024;
 
-/* Hold a ref to all "recent" operations.
+/* The cache is split into this many shards by operation hash. Each shard has
+ * its own lock, so threads building different operations don't contend.
  */
-static GHashTable *vips_cache_table = NULL;
+#define VIPS_CACHE_N_SHARDS (16)
 
-/* A 'time' counter: increment on all cache ops. Use this to detect LRU.
+/* A cache shard. We hold a ref to all "recent" operations in table, and keep
+ * the entries on an LRU list, least recently used at the head.
+ */
+typedef struct _VipsCacheShard {
+	GMutex *lock;
+	GHashTable *table;
+	GQueue lru;
+} VipsCacheShard;
+
+static VipsCacheShard vips_cache_shard[VIPS_CACHE_N_SHARDS];
+
+/* The total number of operations in all shards. Update with atomics.
+ */
+static int vips_cache_size = 0;
+
+/* A 'time' counter: increment on all cache ops. Use this to compare LRU
+ * between shards. Update with atomics.
  */
 static int vips_cache_time = 0;
 
-/* Protect cache access with this.
+/* Only one thread trims at once.
+ */
+static GMutex *vips_cache_trim_lock = NULL;
+
+/* How we pick operations to drop.
+ */
+static VipsCachePolicy vips_cache_policy = VIPS_CACHE_POLICY_LRU;
+
+/* The GreedyDual-Size inflation value. This is raised to the priority of each
+ * operation we evict, so operations which are not reused age out. Protect 
+ * with vips_cache_gds_lock, and don't take any other lock while you hold it.
+ */
+static double vips_cache_gds_clock = 0.0;
+static GMutex *vips_cache_gds_lock = NULL;
+
+/* Counters. Update with atomics.
  */
-static GMutex *vips_cache_lock = NULL;
+static int vips_cache_n_hits = 0;
+static int vips_cache_n_misses = 0;
+static int vips_cache_n_evictions = 0;
 
 /* Old versions of glib are missing these. When we abandon centos 5, switch to
  * g_int64_hash() and g_double_hash().
@@ -131,6 +172,20 @@ typedef struct _VipsOperationCacheEntry {
 	 * we can disconnect when we drop an operation.
 	 */
 	gulong invalidate_id;
+
+	/* How long the operation took to build, in microseconds, and how much
+	 * tracked memory it allocated. Used by VIPS_CACHE_POLICY_GDS.
+	 */
+	gint64 cost;
+	size_t size;
+
+	/* The GreedyDual-Size priority: the lowest is dropped first.
+	 */
+	double priority;
+
+	/* Our link in the shard's LRU list.
+	 */
+	GList link;
 } VipsOperationCacheEntry;
 
 /* Pass in the pspec so we can get the generic type. For example, a 
@@ -448,11 +503,20 @@ vips_operation_equal( VipsOperation *a, VipsOperation *b )
 void *
 vips__cache_once_init( void )
 {
-	vips_cache_lock = vips_g_mutex_new();
+	int i;
+
+	for( i = 0; i < VIPS_CACHE_N_SHARDS; i++ ) {
+		VipsCacheShard *shard = &vips_cache_shard[i];
+
+		shard->lock = vips_g_mutex_new();
+		shard->table = g_hash_table_new( 
+			(GHashFunc) vips_operation_hash, 
+			(GEqualFunc) vips_operation_equal );
+		g_queue_init( &shard->lru );
+	}
 
-	vips_cache_table = g_hash_table_new( 
-		(GHashFunc) vips_operation_hash, 
-		(GEqualFunc) vips_operation_equal );
+	vips_cache_trim_lock = vips_g_mutex_new();
+	vips_cache_gds_lock = vips_g_mutex_new();
 
 	return( NULL ); 
 }
@@ -465,6 +529,16 @@ vips__cache_init( void )
 	VIPS_ONCE( &once, (GThreadFunc) vips__cache_once_init, NULL );
 }
 
+/* Find the shard for an operation. This will compute the hash, if necessary,
+ * so call it before you take any locks.
+ */
+static VipsCacheShard *
+vips_cache_get_shard( VipsOperation *operation )
+{
+	return( &vips_cache_shard[vips_operation_hash( operation ) % 
+		VIPS_CACHE_N_SHARDS] );
+}
+
 static void *
 vips_cache_print_fn( void *value, void *a, void *b )
 {
@@ -488,15 +562,24 @@ vips_cache_print_fn( void *value, void *a, void *b )
 void
 vips_cache_print( void )
 {
-	g_mutex_lock( vips_cache_lock );
+	int i;
 
-	if( vips_cache_table ) {
-		printf( "Operation cache:\n" );
-		vips_hash_table_map( vips_cache_table, 
-			vips_cache_print_fn, NULL, NULL ); 
-	}
+	printf( "Operation cache:\n" );
 
-	g_mutex_unlock( vips_cache_lock );
+	for( i = 0; i < VIPS_CACHE_N_SHARDS; i++ ) {
+		VipsCacheShard *shard = &vips_cache_shard[i];
+
+		if( !shard->lock )
+			continue;
+
+		g_mutex_lock( shard->lock );
+
+		if( shard->table ) 
+			vips_hash_table_map( shard->table, 
+				vips_cache_print_fn, NULL, NULL ); 
+
+		g_mutex_unlock( shard->lock );
+	}
 }
 
 static void *
@@ -535,13 +618,15 @@ vips_cache_unref( VipsOperation *operation )
 	g_object_unref( operation );
 }
 
-/* Remove an operation from the cache.
+/* Remove an operation from the cache. The operation must be in the cache,
+ * and you must hold the shard lock.
  */
 static void
 vips_cache_remove( VipsOperation *operation )
 {
+	VipsCacheShard *shard = vips_cache_get_shard( operation );
 	VipsOperationCacheEntry *entry = (VipsOperationCacheEntry *)
-		g_hash_table_lookup( vips_cache_table, operation );
+		g_hash_table_lookup( shard->table, operation );
 
 #ifdef DEBUG
 	printf( "vips_cache_remove: trimming %p\n", operation );
@@ -554,12 +639,32 @@ vips_cache_remove( VipsOperation *operation )
 		entry->invalidate_id = 0;
 	}
 
-	g_hash_table_remove( vips_cache_table, operation );
+	g_hash_table_remove( shard->table, operation );
+	g_queue_unlink( &shard->lru, &entry->link );
+	g_atomic_int_add( &vips_cache_size, -1 );
 	vips_cache_unref( operation );
 
 	g_free( entry );
 }
 
+/* An operation has signalled "invalidate". This can come from any thread, 
+ * so we must take the shard lock, and the operation might already have 
+ * been dropped by another thread.
+ */
+static void
+vips_cache_invalidate_cb( VipsOperation *operation )
+{
+	VipsCacheShard *shard = vips_cache_get_shard( operation );
+
+	VIPS_GATE_LOCK( shard->lock, VIPS_GATE_STAT_CACHE );
+
+	if( shard->table &&
+		g_hash_table_lookup( shard->table, operation ) )
+		vips_cache_remove( operation );
+
+	g_mutex_unlock( shard->lock );
+}
+
 static void *
 vips_object_ref_arg( VipsObject *object,
 	GParamSpec *pspec,
@@ -582,30 +687,44 @@ vips_object_ref_arg( VipsObject *object,
 	return( NULL );
 }
 
+/* Move to the most-recently-used end of the shard LRU list.
+ */
 static void
-vips_operation_touch( VipsOperation *operation )
+vips_operation_touch( VipsCacheShard *shard, VipsOperation *operation )
 {
 	VipsOperationCacheEntry *entry = (VipsOperationCacheEntry *)
-		g_hash_table_lookup( vips_cache_table, operation );
+		g_hash_table_lookup( shard->table, operation );
 
-	vips_cache_time += 1;
-	entry->time = vips_cache_time;
+	entry->time = g_atomic_int_add( &vips_cache_time, 1 ) + 1;
+
+	/* GreedyDual-Size: value is build cost per byte held, so cheap 
+	 * operations holding lots of memory go first. Add one to the cost and
+	 * to the size (in kb) so that free operations still age by LRU.
+	 */
+	g_mutex_lock( vips_cache_gds_lock );
+	entry->priority = vips_cache_gds_clock + 
+		(1.0 + entry->cost) / (1.0 + entry->size / 1024.0);
+	g_mutex_unlock( vips_cache_gds_lock );
+
+	g_queue_unlink( &shard->lru, &entry->link );
+	g_queue_push_tail_link( &shard->lru, &entry->link );
 }
 
 /* Ref an operation for the cache. The operation itself, plus all the output 
  * objects it makes. 
  */
 static void
-vips_cache_ref( VipsOperation *operation )
+vips_cache_ref( VipsCacheShard *shard, VipsOperation *operation )
 {
 	g_object_ref( operation );
 	(void) vips_argument_map( VIPS_OBJECT( operation ),
 		vips_object_ref_arg, NULL, NULL );
-	vips_operation_touch( operation );
+	vips_operation_touch( shard, operation );
 }
 
 static void
-vips_cache_insert( VipsOperation *operation )
+vips_cache_insert( VipsCacheShard *shard, VipsOperation *operation,
+	gint64 cost, size_t size )
 {
 	VipsOperationCacheEntry *entry = g_new( VipsOperationCacheEntry, 1 );
 
@@ -616,35 +735,22 @@ vips_cache_insert( VipsOperation *operation )
 	entry->operation = operation;
 	entry->time = 0;
 	entry->invalidate_id = 0;
-
-	g_hash_table_insert( vips_cache_table, operation, entry );
-	vips_cache_ref( operation );
+	entry->cost = cost;
+	entry->size = size;
+	entry->priority = 0.0;
+	entry->link.data = entry;
+	entry->link.next = NULL;
+	entry->link.prev = NULL;
+
+	g_hash_table_insert( shard->table, operation, entry );
+	g_queue_push_tail_link( &shard->lru, &entry->link );
+	g_atomic_int_add( &vips_cache_size, 1 );
+	vips_cache_ref( shard, operation );
 
 	/* If the operation signals "invalidate", we must drop it.
 	 */
 	entry->invalidate_id = g_signal_connect( operation, "invalidate", 
-		G_CALLBACK( vips_cache_remove ), NULL ); 
-}
-
-static void *
-vips_cache_get_first_fn( void *value, void *a, void *b )
-{
-	return( value );
-}
-
-/* Return the first item.
- */
-static VipsOperation *
-vips_cache_get_first( void )
-{
-	VipsOperationCacheEntry *entry;
-
-	if( vips_cache_table &&
-		(entry = vips_hash_table_map( vips_cache_table, 
-			vips_cache_get_first_fn, NULL, NULL )) )
-		return( VIPS_OPERATION( entry->operation ) );
-
-	return( NULL ); 
+		G_CALLBACK( vips_cache_invalidate_cb ), NULL ); 
 }
 
 /**
@@ -656,53 +762,102 @@ vips_cache_get_first( void )
 void
 vips_cache_drop_all( void )
 {
-	g_mutex_lock( vips_cache_lock );
+	int i;
 
-	if( vips_cache_table ) {
-		VipsOperation *operation;
+	if( vips__cache_dump )
+		vips_cache_print();
 
-		if( vips__cache_dump )
-			vips_cache_print();
+	for( i = 0; i < VIPS_CACHE_N_SHARDS; i++ ) {
+		VipsCacheShard *shard = &vips_cache_shard[i];
 
-		/* We can't modify the hash in the callback from
-		 * g_hash_table_foreach() and friends. Repeatedly drop the
-		 * first item instead.
-		 */
-		while( (operation = vips_cache_get_first()) ) 
-			vips_cache_remove( operation );
+		if( !shard->lock )
+			continue;
 
-		VIPS_FREEF( g_hash_table_unref, vips_cache_table );
-	}
+		g_mutex_lock( shard->lock );
+
+		if( shard->table ) {
+			VipsOperationCacheEntry *entry;
+
+			/* We can't modify the hash in the callback from
+			 * g_hash_table_foreach() and friends. Repeatedly drop 
+			 * the LRU item instead.
+			 */
+			while( (entry = g_queue_peek_head( &shard->lru )) ) 
+				vips_cache_remove( entry->operation );
+
+			VIPS_FREEF( g_hash_table_unref, shard->table );
+		}
 
-	g_mutex_unlock( vips_cache_lock );
+		g_mutex_unlock( shard->lock );
+	}
 }
 
-static void
-vips_cache_get_lru_cb( VipsOperation *key, VipsOperationCacheEntry *value, 
-	VipsOperationCacheEntry **best )
+/* Find the item in a shard we'd like to drop next, and give it a score. Lower
+ * scores go first. You must hold the shard lock.
+ */
+static VipsOperationCacheEntry *
+vips_cache_shard_victim( VipsCacheShard *shard, double *score )
 {
-	if( !*best ||
-		(*best)->time > value->time )
-		*best = value;
+	VipsOperationCacheEntry *victim;
+	GList *p;
+
+	if( !shard->table )
+		return( NULL );
+
+	switch( vips_cache_policy ) {
+	case VIPS_CACHE_POLICY_GDS:
+		victim = NULL;
+		for( p = shard->lru.head; p; p = p->next ) {
+			VipsOperationCacheEntry *entry = 
+				(VipsOperationCacheEntry *) p->data;
+
+			if( !victim ||
+				entry->priority < victim->priority ) 
+				victim = entry;
+		}
+		if( victim )
+			*score = victim->priority;
+		break;
+
+	case VIPS_CACHE_POLICY_LRU:
+	default:
+		if( (victim = g_queue_peek_head( &shard->lru )) )
+			*score = victim->time;
+		break;
+	}
+
+	return( victim );
 }
 
-/* Get the least-recently-used cache item. 
- *
- * TODO ... will this be too expensive? probably not
+/* Find the shard holding the item we'd most like to drop, or NULL for an 
+ * empty cache.
  */
-static VipsOperation *
-vips_cache_get_lru( void )
+static VipsCacheShard *
+vips_cache_get_victim_shard( void )
 {
-	VipsOperationCacheEntry *entry;
-
-	entry = NULL;
-	g_hash_table_foreach( vips_cache_table,
-		(GHFunc) vips_cache_get_lru_cb, &entry );
+	VipsCacheShard *best;
+	double best_score;
+	int i;
+
+	best = NULL;
+	best_score = 0.0;
+	for( i = 0; i < VIPS_CACHE_N_SHARDS; i++ ) {
+		VipsCacheShard *shard = &vips_cache_shard[i];
+		double score;
+
+		g_mutex_lock( shard->lock );
+
+		if( vips_cache_shard_victim( shard, &score ) &&
+			(!best ||
+			 score < best_score) ) {
+			best = shard;
+			best_score = score;
+		}
 
-	if( entry )
-		return( entry->operation );
+		g_mutex_unlock( shard->lock );
+	}
 
-	return( NULL ); 
+	return( best ); 
 }
 
 /* Is the cache full? Drop until it's not.
@@ -710,23 +865,42 @@ vips_cache_get_lru( void )
 static void
 vips_cache_trim( void )
 {
-	VipsOperation *operation;
+	VipsCacheShard *shard;
 
-	g_mutex_lock( vips_cache_lock );
+	g_mutex_lock( vips_cache_trim_lock );
 
-	while( vips_cache_table &&
-		(g_hash_table_size( vips_cache_table ) > vips_cache_max ||
+	while( (g_atomic_int_get( &vips_cache_size ) > vips_cache_max ||
 		vips_tracked_get_files() > vips_cache_max_files ||
 		vips_tracked_get_mem() > vips_cache_max_mem) &&
-		(operation = vips_cache_get_lru()) ) {
+		(shard = vips_cache_get_victim_shard()) ) {
+		VipsOperationCacheEntry *entry;
+		double score;
+
+		/* The shard might have changed since we looked, just drop
+		 * whatever is now the best victim.
+		 */
+		g_mutex_lock( shard->lock );
+
+		if( (entry = vips_cache_shard_victim( shard, &score )) ) {
 #ifdef DEBUG
-		printf( "vips_cache_trim: trimming %p\n", operation );
+			printf( "vips_cache_trim: trimming %p\n", 
+				entry->operation );
 #endif /*DEBUG*/
 
-		vips_cache_remove( operation );
+			if( vips_cache_policy == VIPS_CACHE_POLICY_GDS ) {
+				g_mutex_lock( vips_cache_gds_lock );
+				vips_cache_gds_clock = entry->priority;
+				g_mutex_unlock( vips_cache_gds_lock );
+			}
+
+			vips_cache_remove( entry->operation );
+			g_atomic_int_inc( &vips_cache_n_evictions );
+		}
+
+		g_mutex_unlock( shard->lock );
 	}
 
-	g_mutex_unlock( vips_cache_lock );
+	g_mutex_unlock( vips_cache_trim_lock );
 }
 
 /**
@@ -741,6 +915,7 @@ vips_cache_trim( void )
 VipsOperation *
 vips_cache_operation_lookup( VipsOperation *operation )
 {
+	VipsCacheShard *shard;
 	VipsOperationCacheEntry *hit;
 	VipsOperation *result;
 
@@ -752,21 +927,29 @@ vips_cache_operation_lookup( VipsOperation *operation )
 	vips_object_print_dump( VIPS_OBJECT( operation ) );
 #endif /*VIPS_DEBUG*/
 
-	g_mutex_lock( vips_cache_lock );
+	/* This walks all the args to make the hash, do it before we lock.
+	 */
+	shard = vips_cache_get_shard( operation );
+
+	VIPS_GATE_LOCK( shard->lock, VIPS_GATE_STAT_CACHE );
 
 	result = NULL;
 
-	if( (hit = g_hash_table_lookup( vips_cache_table, operation )) ) {
+	if( shard->table &&
+		(hit = g_hash_table_lookup( shard->table, operation )) ) {
 		if( vips__cache_trace ) {
 			printf( "vips cache*: " );
 			vips_object_print_summary( VIPS_OBJECT( operation ) );
 		}
 
 		result = hit->operation;
-		vips_cache_ref( result );
+		vips_cache_ref( shard, result );
 	}
 
-	g_mutex_unlock( vips_cache_lock );
+	g_mutex_unlock( shard->lock );
+
+	g_atomic_int_inc( result ? 
+		&vips_cache_n_hits : &vips_cache_n_misses );
 
 #ifdef VIPS_DEBUG
 	printf( "vips_cache_operation_lookup: result = %p\n", result );
@@ -775,18 +958,19 @@ vips_cache_operation_lookup( VipsOperation *operation )
 	return( result );
 }
 
-/**
- * vips_cache_operation_add:
- * @operation: (transfer none): pointer to operation to add
- *
- * Add a built operation to the cache. The cache will ref the operation. 
+/* Add with a known build cost and memory footprint.
  */
-void
-vips_cache_operation_add( VipsOperation *operation )
+static void
+vips_cache_operation_add_cost( VipsOperation *operation, 
+	gint64 cost, size_t size )
 {
+	VipsCacheShard *shard;
+
 	g_assert( VIPS_OBJECT( operation )->constructed ); 
 
-	g_mutex_lock( vips_cache_lock );
+	shard = vips_cache_get_shard( operation );
+
+	VIPS_GATE_LOCK( shard->lock, VIPS_GATE_STAT_CACHE );
 
 #ifdef VIPS_DEBUG
 	printf( "vips_cache_operation_add: adding " );
@@ -797,7 +981,8 @@ vips_cache_operation_add( VipsOperation *operation )
 	 * we can get multiple adds. Let the first one win. See
 	 * https://github.com/jcupitt/libvips/pull/181
 	 */
-	if( !g_hash_table_lookup( vips_cache_table, operation ) ) {
+	if( shard->table &&
+		!g_hash_table_lookup( shard->table, operation ) ) {
 		VipsOperationFlags flags = 
 			vips_operation_get_flags( operation );
 		gboolean nocache = flags & VIPS_OPERATION_NOCACHE;
@@ -813,14 +998,26 @@ vips_cache_operation_add( VipsOperation *operation )
 		}
 
 		if( !nocache ) 
-			vips_cache_insert( operation );
+			vips_cache_insert( shard, operation, cost, size );
 	}
 
-	g_mutex_unlock( vips_cache_lock );
+	g_mutex_unlock( shard->lock );
 
 	vips_cache_trim();
 }
 
+/**
+ * vips_cache_operation_add:
+ * @operation: (transfer none): pointer to operation to add
+ *
+ * Add a built operation to the cache. The cache will ref the operation. 
+ */
+void
+vips_cache_operation_add( VipsOperation *operation )
+{
+	vips_cache_operation_add_cost( operation, 0, 0 );
+}
+
 /**
  * vips_cache_operation_buildp: (skip)
  * @operation: pointer to operation to lookup
@@ -836,6 +1033,8 @@ int
 vips_cache_operation_buildp( VipsOperation **operation )
 {
 	VipsOperation *hit;
+	gint64 start;
+	size_t mem;
 
 	g_assert( VIPS_IS_OPERATION( *operation ) );
 
@@ -857,10 +1056,24 @@ vips_cache_operation_buildp( VipsOperation **operation )
 		printf( "vips_cache_operation_buildp: cache miss, building\n" );
 #endif /*VIPS_DEBUG*/
 
+		/* Measure a build cost and memory footprint for the cost-aware
+		 * policy. Other threads can allocate at the same time, so
+		 * this is only an estimate.
+		 */
+		start = vips__get_time();
+		mem = vips_tracked_get_mem();
+
 		if( vips_object_build( VIPS_OBJECT( *operation ) ) ) 
 			return( -1 );
 
-		vips_cache_operation_add( *operation ); 
+		/* Collapse any chain of point operations we've just 
+		 * finished.
+		 */
+		vips__point_fuse( *operation );
+
+		vips_cache_operation_add_cost( *operation, 
+			vips__get_time() - start,
+			VIPS_MAX( mem, vips_tracked_get_mem() ) - mem ); 
 	}
 
 	return( 0 );
@@ -952,17 +1165,7 @@ vips_cache_get_max( void )
 int
 vips_cache_get_size( void )
 {
-	guint size;
-
-	g_mutex_lock( vips_cache_lock );
-
-	size = 0;
-	if( vips_cache_table )
-		size = g_hash_table_size( vips_cache_table );
-
-	g_mutex_unlock( vips_cache_lock );
-
-	return( size );
+	return( g_atomic_int_get( &vips_cache_size ) );
 }
 
 /**
@@ -1047,3 +1250,87 @@ vips_cache_set_trace( gboolean trace )
 {
 	vips__cache_trace = trace;
 }
+
+/**
+ * vips_cache_set_policy:
+ * @policy: how to pick operations to drop
+ *
+ * Set the way the cache picks operations to drop when it is full.
+ *
+ * #VIPS_CACHE_POLICY_LRU, the default, drops the least-recently-used 
+ * operation.
+ *
+ * #VIPS_CACHE_POLICY_GDS uses GreedyDual-Size. Each operation gets a priority
+ * from the time it took to build divided by the amount of tracked memory it 
+ * allocated, so expensive operations which hold little memory are kept in
+ * preference to cheap ones which hold a lot. Priorities age as operations 
+ * are dropped, so operations which are never reused will eventually go.
+ *
+ * See also: vips_cache_get_policy(), vips_cache_get_evictions().
+ */
+void
+vips_cache_set_policy( VipsCachePolicy policy )
+{
+	vips_cache_policy = policy;
+}
+
+/**
+ * vips_cache_get_policy:
+ *
+ * See also: vips_cache_set_policy().
+ *
+ * Returns: the current cache policy.
+ */
+VipsCachePolicy
+vips_cache_get_policy( void )
+{
+	return( vips_cache_policy );
+}
+
+/**
+ * vips_cache_get_hits:
+ *
+ * Get the number of times an operation has been found in cache.
+ *
+ * See also: vips_cache_get_misses(), vips_cache_get_evictions().
+ *
+ * Returns: the number of cache hits.
+ */
+int
+vips_cache_get_hits( void )
+{
+	return( g_atomic_int_get( &vips_cache_n_hits ) );
+}
+
+/**
+ * vips_cache_get_misses:
+ *
+ * Get the number of times an operation has been looked up in cache and not
+ * found.
+ *
+ * See also: vips_cache_get_hits(), vips_cache_get_evictions().
+ *
+ * Returns: the number of cache misses.
+ */
+int
+vips_cache_get_misses( void )
+{
+	return( g_atomic_int_get( &vips_cache_n_misses ) );
+}
+
+/**
+ * vips_cache_get_evictions:
+ *
+ * Get the number of operations the cache has dropped because it was full. 
+ * This does not include operations dropped by vips_cache_drop_all() or by
+ * invalidation.
+ *
+ * See also: vips_cache_get_hits(), vips_cache_set_policy().
+ *
+ * Returns: the number of cache evictions.
+ */
+int
+vips_cache_get_evictions( void )
+{
+	return( g_atomic_int_get( &vips_cache_n_evictions ) );
+}
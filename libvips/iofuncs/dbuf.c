@@ -1,4 +1,7 @@
 /* A dynamic memory buffer that expands as you write.
+ *
+ * 14/10/18
+ * 	- add VipsCbuf, a chunked append-only buffer
  */
 
 /*
@@ -388,3 +391,266 @@ vips_dbuf_string( VipsDbuf *dbuf, size_t *size )
 }
 
 
+
+/* Chunks grow with the amount of data, so there are only a few of them,
+ * but not without limit, so the unused tail of the last chunk stays small.
+ */
+#define VIPS_CBUF_MIN_CHUNK (16 * 1024)
+#define VIPS_CBUF_MAX_CHUNK (16 * 1024 * 1024)
+
+/**
+ * vips_cbuf_init:
+ * @cbuf: the buffer
+ *
+ * Initialize @cbuf.
+ *
+ * A #VipsCbuf is an append-only buffer made of a list of chunks. Bytes
+ * never move once they have been written, so unlike #VipsDbuf there are no
+ * realloc copies as the buffer grows. Use vips_cbuf_map() to walk the chunks,
+ * or vips_cbuf_steal() to get a single contiguous area.
+ */
+void
+vips_cbuf_init( VipsCbuf *cbuf )
+{
+	cbuf->first = NULL;
+	cbuf->last = NULL;
+	cbuf->data_size = 0;
+}
+
+/**
+ * vips_cbuf_destroy:
+ * @cbuf: the buffer
+ *
+ * Destroy @cbuf. This frees any allocated memory.
+ */
+void
+vips_cbuf_destroy( VipsCbuf *cbuf )
+{
+	VipsCbufChunk *chunk;
+	VipsCbufChunk *next;
+
+	for( chunk = cbuf->first; chunk; chunk = next ) {
+		next = chunk->next;
+
+		g_free( chunk->data );
+		g_free( chunk );
+	}
+
+	vips_cbuf_init( cbuf );
+}
+
+/**
+ * vips_cbuf_get_write:
+ * @cbuf: the buffer
+ * @min_size: at least this many bytes
+ * @size: (allow-none): optionally return length in bytes here
+ *
+ * Return a pointer to an area of at least @min_size bytes you can write to
+ * at the end of @cbuf, return the length of the area in @size. The area is
+ * not part of the data until you call vips_cbuf_advance().
+ *
+ * If the last chunk does not have @min_size bytes free, a new chunk is
+ * started and the unused end of the old chunk is left empty.
+ *
+ * Returns: (transfer none): start of write area, or %NULL on out of memory.
+ */
+unsigned char *
+vips_cbuf_get_write( VipsCbuf *cbuf, size_t min_size, size_t *size )
+{
+	VipsCbufChunk *last = cbuf->last;
+
+	if( !last ||
+		last->allocated_size - last->data_size < min_size ) {
+		size_t chunk_size = VIPS_MAX( min_size,
+			VIPS_CLIP( VIPS_CBUF_MIN_CHUNK,
+				cbuf->data_size, VIPS_CBUF_MAX_CHUNK ) );
+
+		VipsCbufChunk *chunk;
+
+		if( !(chunk = g_try_new( VipsCbufChunk, 1 )) ||
+			!(chunk->data = g_try_malloc( chunk_size )) ) {
+			g_free( chunk );
+			vips_error( "VipsCbuf", "%s", _( "out of memory" ) );
+			return( NULL );
+		}
+		chunk->next = NULL;
+		chunk->allocated_size = chunk_size;
+		chunk->data_size = 0;
+
+		if( last )
+			last->next = chunk;
+		else
+			cbuf->first = chunk;
+		cbuf->last = chunk;
+		last = chunk;
+	}
+
+	if( size )
+		*size = last->allocated_size - last->data_size;
+
+	return( last->data + last->data_size );
+}
+
+/**
+ * vips_cbuf_advance:
+ * @cbuf: the buffer
+ * @size: this many bytes have been written
+ *
+ * Add @size bytes written to the area returned by vips_cbuf_get_write() to
+ * the data. @size must not be more than the size of the area.
+ */
+void
+vips_cbuf_advance( VipsCbuf *cbuf, size_t size )
+{
+	if( size > 0 ) {
+		g_assert( cbuf->last );
+		g_assert( cbuf->last->data_size + size <=
+			cbuf->last->allocated_size );
+
+		cbuf->last->data_size += size;
+		cbuf->data_size += size;
+	}
+}
+
+/**
+ * vips_cbuf_write:
+ * @cbuf: the buffer
+ * @data: the data to write to the buffer
+ * @size: the size of the len to write
+ *
+ * Append @size bytes from @data. Large writes are split over the
+ * free space in the last chunk and a new chunk.
+ *
+ * Returns: %FALSE on out of memory, %TRUE otherwise.
+ */
+gboolean
+vips_cbuf_write( VipsCbuf *cbuf, const unsigned char *data, size_t size )
+{
+	while( size > 0 ) {
+		unsigned char *write;
+		size_t available;
+		size_t n;
+
+		/* Fill the end of the last chunk before we start another.
+		 */
+		if( !(write = vips_cbuf_get_write( cbuf, 1, &available )) )
+			return( FALSE );
+		if( available < size &&
+			available < VIPS_CBUF_MIN_CHUNK &&
+			!(write = vips_cbuf_get_write( cbuf, 
+				size, &available )) )
+			return( FALSE );
+
+		n = VIPS_MIN( size, available );
+		memcpy( write, data, n );
+		vips_cbuf_advance( cbuf, n );
+
+		data += n;
+		size -= n;
+	}
+
+	return( TRUE );
+}
+
+/**
+ * vips_cbuf_size:
+ * @cbuf: the buffer
+ *
+ * Returns: the number of bytes of data in @cbuf.
+ */
+size_t
+vips_cbuf_size( VipsCbuf *cbuf )
+{
+	return( cbuf->data_size );
+}
+
+/**
+ * vips_cbuf_map: (skip)
+ * @cbuf: the buffer
+ * @fn: function to call for each chunk
+ * @a: user data
+ *
+ * Call @fn for each chunk of data in @cbuf, in order. Empty chunks are
+ * skipped. If @fn returns non-%NULL, stop and return that value.
+ *
+ * Use this to write or upload @cbuf without making a contiguous copy.
+ *
+ * Returns: %NULL if @fn returned %NULL for every chunk, or the first
+ * non-%NULL value.
+ */
+void *
+vips_cbuf_map( VipsCbuf *cbuf, VipsCbufMapFn fn, void *a )
+{
+	VipsCbufChunk *chunk;
+	void *result;
+
+	for( chunk = cbuf->first; chunk; chunk = chunk->next )
+		if( chunk->data_size &&
+			(result = fn( chunk->data, chunk->data_size, a )) )
+			return( result );
+
+	return( NULL );
+}
+
+/**
+ * vips_cbuf_steal:
+ * @cbuf: the buffer
+ * @size: (allow-none): optionally return length in bytes here
+ *
+ * Destroy a buffer and return all the data in a single area. This must be
+ * freed with g_free(). If all the data is in one chunk, that chunk is
+ * returned and there is no copy. Otherwise, chunks are freed as they are
+ * copied.
+ *
+ * A `\0` is appended, but not included in the character count. This is so the
+ * pointer can be safely treated as a C string.
+ *
+ * Returns: (transfer full): the data, or %NULL on out of memory.
+ */
+unsigned char *
+vips_cbuf_steal( VipsCbuf *cbuf, size_t *size )
+{
+	VipsCbufChunk *first = cbuf->first;
+
+	unsigned char *data;
+
+	if( first &&
+		!first->next &&
+		first->data_size < first->allocated_size ) {
+		data = first->data;
+		first->data = NULL;
+	}
+	else {
+		VipsCbufChunk *chunk;
+		VipsCbufChunk *next;
+		size_t offset;
+
+		if( !(data = g_try_malloc( cbuf->data_size + 1 )) ) {
+			vips_error( "VipsCbuf", "%s", _( "out of memory" ) );
+			return( NULL );
+		}
+
+		offset = 0;
+		for( chunk = cbuf->first; chunk; chunk = next ) {
+			next = chunk->next;
+
+			memcpy( data + offset, chunk->data, chunk->data_size );
+			offset += chunk->data_size;
+
+			g_free( chunk->data );
+			g_free( chunk );
+		}
+		cbuf->first = NULL;
+
+		g_assert( offset == cbuf->data_size );
+	}
+
+	data[cbuf->data_size] = '\0';
+
+	if( size )
+		*size = cbuf->data_size;
+
+	vips_cbuf_destroy( cbuf );
+
+	return( data );
+}
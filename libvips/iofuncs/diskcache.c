@@ -0,0 +1,795 @@
+/* a persistent cache of saved operation results
+ *
+ * 15/10/18
+ * 	- first version
+ * 15/10/26
+ * 	- key files on nanosecond times, or a hash of the first few kb
+ */
+
+/*
+
+    This file is part of VIPS.
+
+    VIPS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA
+
+ */
+
+/*
+
+    These files are distributed with VIPS - http://www.vips.ecs.soton.ac.uk
+
+ */
+
+/*
+#define VIPS_DEBUG
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /*HAVE_CONFIG_H*/
+#include <vips/intl.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <glib/gstdio.h>
+
+#include <vips/vips.h>
+#include <vips/internal.h>
+#include <vips/debug.h>
+
+#ifdef OS_WIN32
+#ifndef S_ISREG
+#define S_ISREG(m) (!!(m & _S_IFREG))
+#endif
+#endif /*OS_WIN32*/
+
+/* Change this to invalidate every old cache entry, for example if the
+ * key format changes.
+ */
+#define VIPS_DISK_CACHE_VERSION "vips-disk-cache-2"
+
+/* Entries are named with the hex SHA-256 of the key.
+ */
+#define VIPS_DISK_CACHE_NAME_LENGTH (64)
+
+/* Rescan the cache directory after this many writes. Other processes write
+ * to the same directory, so our own count of bytes drifts.
+ */
+#define VIPS_DISK_CACHE_RESCAN (256)
+
+/* Where the cache lives, or NULL for disabled.
+ */
+static char *vips_disk_cache_dir = NULL;
+
+/* Default 1gb.
+ */
+static guint64 vips_disk_cache_max_bytes = 1024 * 1024 * 1024;
+
+/* Our estimate of the size of the cache, -1 if we've not scanned yet, and
+ * the number of writes since the last scan.
+ */
+static gint64 vips_disk_cache_bytes = -1;
+static int vips_disk_cache_writes = 0;
+static gboolean vips_disk_cache_trimming = FALSE;
+
+static GMutex *vips_disk_cache_lock = NULL;
+
+static int vips_disk_cache_n_hits = 0;
+static int vips_disk_cache_n_misses = 0;
+
+static void *
+vips_disk_cache_init_cb( void *data )
+{
+	vips_disk_cache_lock = vips_g_mutex_new();
+
+	return( NULL );
+}
+
+static void
+vips_disk_cache_init( void )
+{
+	static GOnce once = G_ONCE_INIT;
+
+	VIPS_ONCE( &once, vips_disk_cache_init_cb, NULL );
+}
+
+/* The cache dir, or NULL. Free with g_free().
+ */
+static char *
+vips_disk_cache_get_dir_copy( void )
+{
+	char *dir;
+
+	vips_disk_cache_init();
+
+	g_mutex_lock( vips_disk_cache_lock );
+	dir = g_strdup( vips_disk_cache_dir );
+	g_mutex_unlock( vips_disk_cache_lock );
+
+	return( dir );
+}
+
+/**
+ * vips_disk_cache_set_dir:
+ * @dir: (allow-none): directory to keep the disk cache in
+ *
+ * Set the directory vips_cache_operation_write_to_buffer() keeps saved
+ * results in. The directory is created if necessary. It can be shared
+ * between many processes. %NULL, the default, turns the disk cache off.
+ *
+ * You can also set this with the `VIPS_DISK_CACHE` environment variable.
+ *
+ * See also: vips_disk_cache_set_max_bytes().
+ */
+void
+vips_disk_cache_set_dir( const char *dir )
+{
+	vips_disk_cache_init();
+
+	g_mutex_lock( vips_disk_cache_lock );
+	VIPS_SETSTR( vips_disk_cache_dir, dir );
+	vips_disk_cache_bytes = -1;
+	vips_disk_cache_writes = 0;
+	g_mutex_unlock( vips_disk_cache_lock );
+}
+
+/**
+ * vips_disk_cache_get_dir:
+ *
+ * Get the disk cache directory, or %NULL if the disk cache is off.
+ *
+ * See also: vips_disk_cache_set_dir().
+ *
+ * Returns: (transfer full): the cache directory, free with g_free().
+ */
+char *
+vips_disk_cache_get_dir( void )
+{
+	return( vips_disk_cache_get_dir_copy() );
+}
+
+/**
+ * vips_disk_cache_set_max_bytes:
+ * @max_bytes: maximum size of the disk cache
+ *
+ * Set the maximum size of the disk cache. When a write takes the cache over
+ * this size, the least-recently-used entries are removed until it is back
+ * to 90% of @max_bytes. The default is 1gb.
+ *
+ * You can also set this with the `VIPS_DISK_CACHE_MAX` environment variable,
+ * for example "500m".
+ *
+ * See also: vips_disk_cache_set_dir().
+ */
+void
+vips_disk_cache_set_max_bytes( guint64 max_bytes )
+{
+	vips_disk_cache_init();
+
+	g_mutex_lock( vips_disk_cache_lock );
+	vips_disk_cache_max_bytes = max_bytes;
+	g_mutex_unlock( vips_disk_cache_lock );
+}
+
+/**
+ * vips_disk_cache_get_max_bytes:
+ *
+ * Get the maximum size of the disk cache.
+ *
+ * See also: vips_disk_cache_set_max_bytes().
+ *
+ * Returns: the maximum disk cache size in bytes.
+ */
+guint64
+vips_disk_cache_get_max_bytes( void )
+{
+	guint64 max_bytes;
+
+	vips_disk_cache_init();
+
+	g_mutex_lock( vips_disk_cache_lock );
+	max_bytes = vips_disk_cache_max_bytes;
+	g_mutex_unlock( vips_disk_cache_lock );
+
+	return( max_bytes );
+}
+
+/**
+ * vips_disk_cache_get_hits:
+ *
+ * Get the number of results this process has read from the disk cache.
+ *
+ * See also: vips_disk_cache_get_misses().
+ *
+ * Returns: the number of disk cache hits.
+ */
+int
+vips_disk_cache_get_hits( void )
+{
+	return( g_atomic_int_get( &vips_disk_cache_n_hits ) );
+}
+
+/**
+ * vips_disk_cache_get_misses:
+ *
+ * Get the number of cacheable results this process has had to compute.
+ *
+ * See also: vips_disk_cache_get_hits().
+ *
+ * Returns: the number of disk cache misses.
+ */
+int
+vips_disk_cache_get_misses( void )
+{
+	return( g_atomic_int_get( &vips_disk_cache_n_misses ) );
+}
+
+/* Hash this many bytes from the start of a file when we can't get
+ * sub-second file times.
+ */
+#define VIPS_DISK_CACHE_HEAD_SIZE (4096)
+
+/* Add the first few kb of a file to the key. Headers hold the size, 
+ * timestamps and so on, so this will usually spot a file rewritten within 
+ * the same second.
+ */
+static void
+vips_disk_cache_key_head( GChecksum *checksum, const char *filename )
+{
+	FILE *fp;
+	guchar head[VIPS_DISK_CACHE_HEAD_SIZE];
+	size_t n;
+
+	if( !(fp = g_fopen( filename, "rb" )) )
+		return;
+	n = fread( head, 1, VIPS_DISK_CACHE_HEAD_SIZE, fp );
+	fclose( fp );
+
+	g_checksum_update( checksum, (guchar *) "[head:", -1 );
+	g_checksum_update( checksum, head, n );
+	g_checksum_update( checksum, (guchar *) "]", -1 );
+}
+
+/* Add the identity of a file to the key, if str names one. Images are
+ * often replaced in place, so we must key on more than the path.
+ */
+static void
+vips_disk_cache_key_file( GChecksum *checksum, const char *str )
+{
+	char filename[VIPS_PATH_MAX];
+	char option_string[VIPS_PATH_MAX];
+	GStatBuf st;
+
+	vips__filename_split8( str, filename, option_string );
+	if( !g_stat( filename, &st ) &&
+		S_ISREG( st.st_mode ) ) {
+		char txt[256];
+		VipsBuf buf = VIPS_BUF_STATIC( txt );
+		gint64 mtime_nsec;
+		gint64 ctime_nsec;
+
+		/* One-second times miss a file rewritten in place within
+		 * the same second, so use nanoseconds where we can.
+		 */
+#if defined(HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC)
+		mtime_nsec = st.st_mtim.tv_nsec;
+		ctime_nsec = st.st_ctim.tv_nsec;
+#elif defined(HAVE_STRUCT_STAT_ST_MTIMESPEC_TV_NSEC)
+		mtime_nsec = st.st_mtimespec.tv_nsec;
+		ctime_nsec = st.st_ctimespec.tv_nsec;
+#else
+		mtime_nsec = 0;
+		ctime_nsec = 0;
+#endif
+
+		vips_buf_appendf( &buf,
+			"[file:%" G_GUINT64_FORMAT ":%" G_GUINT64_FORMAT
+			":%" G_GINT64_FORMAT 
+			":%" G_GINT64_FORMAT ".%09" G_GINT64_FORMAT
+			":%" G_GINT64_FORMAT ".%09" G_GINT64_FORMAT "]",
+			(guint64) st.st_dev,
+			(guint64) st.st_ino,
+			(gint64) st.st_size,
+			(gint64) st.st_mtime, mtime_nsec,
+			(gint64) st.st_ctime, ctime_nsec );
+		g_checksum_update( checksum,
+			(guchar *) vips_buf_all( &buf ), -1 );
+
+		/* No sub-second times on this platform, or the filesystem
+		 * only stores whole seconds: fall back to the file contents.
+		 */
+		if( mtime_nsec == 0 )
+			vips_disk_cache_key_head( checksum, filename );
+	}
+}
+
+static void
+vips_disk_cache_key_double( GChecksum *checksum, double d )
+{
+	char txt[G_ASCII_DTOSTR_BUF_SIZE];
+
+	/* Enough digits to round-trip, so nearby values don't collide.
+	 */
+	g_ascii_dtostr( txt, G_ASCII_DTOSTR_BUF_SIZE, d );
+	g_checksum_update( checksum, (guchar *) txt, -1 );
+	g_checksum_update( checksum, (guchar *) ",", 1 );
+}
+
+/* Add a value to the key. Return FALSE if it's something we can't identify
+ * outside this process, such as an image.
+ */
+static gboolean
+vips_disk_cache_key_value( GChecksum *checksum, const GValue *value )
+{
+	GType type = G_VALUE_TYPE( value );
+
+	if( type == G_TYPE_STRING ) {
+		const char *str = g_value_get_string( value );
+
+		if( str ) {
+			g_checksum_update( checksum, (guchar *) str, -1 );
+			vips_disk_cache_key_file( checksum, str );
+		}
+	}
+	else if( type == VIPS_TYPE_REF_STRING ) {
+		const char *str = vips_value_get_ref_string( value, NULL );
+
+		if( str )
+			g_checksum_update( checksum, (guchar *) str, -1 );
+	}
+	else if( type == G_TYPE_DOUBLE )
+		vips_disk_cache_key_double( checksum,
+			g_value_get_double( value ) );
+	else if( type == G_TYPE_FLOAT )
+		vips_disk_cache_key_double( checksum,
+			g_value_get_float( value ) );
+	else if( type == VIPS_TYPE_ARRAY_DOUBLE ) {
+		int n;
+		double *array = vips_value_get_array_double( value, &n );
+		int i;
+
+		for( i = 0; i < n; i++ )
+			vips_disk_cache_key_double( checksum, array[i] );
+	}
+	else if( type == VIPS_TYPE_ARRAY_INT ) {
+		int n;
+		int *array = vips_value_get_array_int( value, &n );
+		int i;
+
+		for( i = 0; i < n; i++ ) {
+			char txt[32];
+
+			vips_snprintf( txt, 32, "%d,", array[i] );
+			g_checksum_update( checksum, (guchar *) txt, -1 );
+		}
+	}
+	else if( type == VIPS_TYPE_BLOB ) {
+		size_t length;
+		void *data = vips_value_get_blob( value, &length );
+
+		if( data )
+			g_checksum_update( checksum, data, length );
+	}
+	else if( G_TYPE_IS_ENUM( type ) ||
+		G_TYPE_IS_FLAGS( type ) ||
+		type == G_TYPE_BOOLEAN ||
+		type == G_TYPE_INT ||
+		type == G_TYPE_UINT ||
+		type == G_TYPE_INT64 ||
+		type == G_TYPE_UINT64 ) {
+		/* These all print exactly.
+		 */
+		char *str = g_strdup_value_contents( value );
+
+		g_checksum_update( checksum, (guchar *) str, -1 );
+		g_free( str );
+	}
+	else
+		return( FALSE );
+
+	return( TRUE );
+}
+
+static void *
+vips_disk_cache_key_arg( VipsObject *object,
+	GParamSpec *pspec,
+	VipsArgumentClass *argument_class,
+	VipsArgumentInstance *argument_instance,
+	void *a, void *b )
+{
+	GChecksum *checksum = (GChecksum *) a;
+
+	if( (argument_class->flags & VIPS_ARGUMENT_CONSTRUCT) &&
+		(argument_class->flags & VIPS_ARGUMENT_INPUT) &&
+		argument_instance->assigned ) {
+		const char *name = g_param_spec_get_name( pspec );
+		GType type = G_PARAM_SPEC_VALUE_TYPE( pspec );
+		GValue value = { 0, };
+		gboolean ok;
+
+		g_value_init( &value, type );
+		g_object_get_property( G_OBJECT( object ), name, &value );
+
+		g_checksum_update( checksum, (guchar *) name, -1 );
+		g_checksum_update( checksum, (guchar *) "=", 1 );
+
+		/* Test the real type of object values, not the pspec type,
+		 * so an image in a plain object property is caught.
+		 */
+		if( G_VALUE_HOLDS_OBJECT( &value ) ) {
+			GObject *value_object = g_value_get_object( &value );
+
+			ok = !value_object ||
+				VIPS_IS_INTERPOLATE( value_object );
+			if( value_object &&
+				ok )
+				g_checksum_update( checksum, (guchar *)
+					G_OBJECT_TYPE_NAME( value_object ),
+					-1 );
+		}
+		else
+			ok = vips_disk_cache_key_value( checksum, &value );
+
+		g_checksum_update( checksum, (guchar *) "\n", 1 );
+
+		g_value_unset( &value );
+
+		if( !ok )
+			return( object );
+	}
+
+	return( NULL );
+}
+
+/* Make the key for an unbuilt operation and saver. Return NULL if we can't
+ * make a key that means the same thing in another process. Free with
+ * g_free().
+ */
+static char *
+vips_disk_cache_key( VipsOperation *operation, const char *suffix )
+{
+	VipsObjectClass *class = VIPS_OBJECT_GET_CLASS( operation );
+
+	GChecksum *checksum;
+	char *key;
+
+	if( vips_operation_get_flags( operation ) & VIPS_OPERATION_NOCACHE )
+		return( NULL );
+
+	checksum = g_checksum_new( G_CHECKSUM_SHA256 );
+
+	g_checksum_update( checksum,
+		(guchar *) VIPS_DISK_CACHE_VERSION "\n"
+			VIPS_VERSION "\n", -1 );
+	g_checksum_update( checksum, (guchar *) class->nickname, -1 );
+	g_checksum_update( checksum, (guchar *) "\n", 1 );
+
+	if( vips_argument_map( VIPS_OBJECT( operation ),
+		vips_disk_cache_key_arg, checksum, NULL ) ) {
+		g_checksum_free( checksum );
+		return( NULL );
+	}
+
+	/* The saver, with any options.
+	 */
+	g_checksum_update( checksum, (guchar *) "save=", -1 );
+	g_checksum_update( checksum, (guchar *) suffix, -1 );
+
+	key = g_strdup( g_checksum_get_string( checksum ) );
+	g_checksum_free( checksum );
+
+	return( key );
+}
+
+/* Entries are spread over 256 subdirectories by the first two hex digits.
+ */
+static char *
+vips_disk_cache_path( const char *dir, const char *key )
+{
+	char sub[3];
+
+	vips_strncpy( sub, key, 3 );
+
+	return( g_build_filename( dir, sub, key, NULL ) );
+}
+
+typedef struct _VipsDiskCacheEntry {
+	char *filename;
+	gint64 size;
+	gint64 time;
+} VipsDiskCacheEntry;
+
+static int
+vips_disk_cache_entry_compare( const void *a, const void *b )
+{
+	const VipsDiskCacheEntry *e1 = (const VipsDiskCacheEntry *) a;
+	const VipsDiskCacheEntry *e2 = (const VipsDiskCacheEntry *) b;
+
+	if( e1->time < e2->time )
+		return( -1 );
+	else if( e1->time > e2->time )
+		return( 1 );
+	else
+		return( 0 );
+}
+
+/* Scan the cache and drop least-recently-used entries until we are under
+ * 90% of max_bytes. Hits touch the mtime of an entry, so mtime order is LRU
+ * order. Return the size of the cache.
+ */
+static gint64
+vips_disk_cache_trim( const char *dir, guint64 max_bytes )
+{
+	GArray *entries;
+	GDir *top;
+	const char *sub;
+	gint64 total;
+	int i;
+
+	if( !(top = g_dir_open( dir, 0, NULL )) )
+		return( 0 );
+
+	entries = g_array_new( FALSE, FALSE, sizeof( VipsDiskCacheEntry ) );
+	total = 0;
+
+	while( (sub = g_dir_read_name( top )) ) {
+		char *subdir;
+		GDir *d;
+		const char *name;
+
+		if( strlen( sub ) != 2 )
+			continue;
+
+		subdir = g_build_filename( dir, sub, NULL );
+		if( !(d = g_dir_open( subdir, 0, NULL )) ) {
+			g_free( subdir );
+			continue;
+		}
+
+		while( (name = g_dir_read_name( d )) ) {
+			VipsDiskCacheEntry entry;
+			GStatBuf st;
+
+			/* Skip anything that's not an entry, like the temp
+			 * files of a write in progress.
+			 */
+			if( strlen( name ) != VIPS_DISK_CACHE_NAME_LENGTH )
+				continue;
+
+			entry.filename = g_build_filename( subdir, name, NULL );
+			if( g_stat( entry.filename, &st ) ) {
+				g_free( entry.filename );
+				continue;
+			}
+			entry.size = st.st_size;
+			entry.time = st.st_mtime;
+			g_array_append_val( entries, entry );
+			total += entry.size;
+		}
+
+		g_dir_close( d );
+		g_free( subdir );
+	}
+
+	g_dir_close( top );
+
+	if( (guint64) total > max_bytes ) {
+		guint64 target = max_bytes / 10 * 9;
+
+		g_array_sort( entries, vips_disk_cache_entry_compare );
+
+		for( i = 0; i < entries->len && (guint64) total > target; i++ ) {
+			VipsDiskCacheEntry *entry =
+				&g_array_index( entries, VipsDiskCacheEntry, i );
+
+			VIPS_DEBUG_MSG( "vips_disk_cache_trim: removing %s\n",
+				entry->filename );
+
+			/* Another process may have removed it already.
+			 */
+			(void) g_unlink( entry->filename );
+			total -= entry->size;
+		}
+	}
+
+	for( i = 0; i < entries->len; i++ )
+		g_free( g_array_index( entries, VipsDiskCacheEntry, i ).
+			filename );
+	g_array_free( entries, TRUE );
+
+	return( total );
+}
+
+/* Note a write of length bytes, and trim if we need to. Only one thread
+ * scans at once.
+ */
+static void
+vips_disk_cache_wrote( const char *dir, size_t length )
+{
+	gboolean scan;
+	guint64 max_bytes;
+
+	g_mutex_lock( vips_disk_cache_lock );
+	if( vips_disk_cache_bytes >= 0 )
+		vips_disk_cache_bytes += length;
+	vips_disk_cache_writes += 1;
+	max_bytes = vips_disk_cache_max_bytes;
+	scan = !vips_disk_cache_trimming &&
+		(vips_disk_cache_bytes < 0 ||
+		 (guint64) vips_disk_cache_bytes > max_bytes ||
+		 vips_disk_cache_writes >= VIPS_DISK_CACHE_RESCAN);
+	if( scan )
+		vips_disk_cache_trimming = TRUE;
+	g_mutex_unlock( vips_disk_cache_lock );
+
+	if( scan ) {
+		gint64 total = vips_disk_cache_trim( dir, max_bytes );
+
+		g_mutex_lock( vips_disk_cache_lock );
+		vips_disk_cache_bytes = total;
+		vips_disk_cache_writes = 0;
+		vips_disk_cache_trimming = FALSE;
+		g_mutex_unlock( vips_disk_cache_lock );
+	}
+}
+
+static void
+vips_disk_cache_put( const char *dir, const char *key,
+	const void *buf, size_t length )
+{
+	char *filename;
+	char *subdir;
+
+	filename = vips_disk_cache_path( dir, key );
+	subdir = g_path_get_dirname( filename );
+
+	/* g_file_set_contents() writes to a temp file and renames, so
+	 * readers in other processes never see a partial entry. Failure just
+	 * means we don't cache.
+	 */
+	if( !g_mkdir_with_parents( subdir, 0755 ) &&
+		g_file_set_contents( filename, buf, length, NULL ) )
+		vips_disk_cache_wrote( dir, length );
+
+	g_free( subdir );
+	g_free( filename );
+}
+
+static gboolean
+vips_disk_cache_get( const char *dir, const char *key,
+	void **buf, size_t *length )
+{
+	char *filename;
+	char *contents;
+	gsize contents_length;
+	gboolean hit;
+
+	filename = vips_disk_cache_path( dir, key );
+	hit = g_file_get_contents( filename,
+		&contents, &contents_length, NULL );
+	if( hit ) {
+		/* Touch for LRU.
+		 */
+		(void) g_utime( filename, NULL );
+
+		*buf = contents;
+		*length = contents_length;
+	}
+	g_free( filename );
+
+	return( hit );
+}
+
+/**
+ * vips_cache_operation_write_to_buffer:
+ * @operation: (transfer full): pointer to operation to build and save
+ * @suffix: format to write, with options, eg. ".jpg[Q=85]"
+ * @buf: (array length=size) (element-type guint8) (transfer full): return
+ * buffer start here
+ * @size: (type gsize): return buffer length here
+ *
+ * Build @operation, if necessary, and save its "out" image to a formatted
+ * memory buffer with vips_image_write_to_buffer().
+ *
+ * If the disk cache is on (see vips_disk_cache_set_dir()), the result is
+ * looked up there first. The key is a SHA-256 of the operation name, all
+ * of its input arguments, the identity (device, inode, size, mtime
+ * and ctime, to the nanosecond where the platform has it) of any input file 
+ * named by a string argument, the libvips version and @suffix. If file 
+ * times are only to the second, the first 4kb of the file is added too. 
+ * On a hit, the saved bytes are returned and
+ * @operation is not built at all, so no pipeline is made. On a miss, the
+ * operation is built with vips_cache_operation_buildp(), saved, and the
+ * result written to the disk cache.
+ *
+ * Operations with image arguments, or with
+ * #VIPS_OPERATION_NOCACHE set, are not looked up or stored, since we
+ * can't tell what they mean in another process. Operations which load
+ * their input from a file, such as thumbnail, are the ones to use.
+ *
+ * As with vips_cache_operation_buildp(), @operation may be swapped for a
+ * cached operation. Free it with vips_object_unref_outputs() and
+ * g_object_unref() afterwards. Free the returned buffer with g_free().
+ *
+ * See also: vips_disk_cache_set_dir(), vips_image_write_to_buffer().
+ *
+ * Returns: 0 on success, -1 on error.
+ */
+int
+vips_cache_operation_write_to_buffer( VipsOperation **operation,
+	const char *suffix, void **buf, size_t *size )
+{
+	char *dir;
+	char *key;
+	VipsImage *out;
+	int result;
+
+	g_assert( VIPS_IS_OPERATION( *operation ) );
+
+	key = NULL;
+	if( (dir = vips_disk_cache_get_dir_copy()) &&
+		(key = vips_disk_cache_key( *operation, suffix )) &&
+		vips_disk_cache_get( dir, key, buf, size ) ) {
+		VIPS_DEBUG_MSG( "vips_cache_operation_write_to_buffer: "
+			"hit %s\n", key );
+
+		g_atomic_int_inc( &vips_disk_cache_n_hits );
+		g_free( key );
+		g_free( dir );
+
+		return( 0 );
+	}
+
+	if( !g_object_class_find_property( G_OBJECT_GET_CLASS( *operation ),
+		"out" ) ) {
+		vips_error( "VipsOperation", "%s",
+			_( "operation has no \"out\" image" ) );
+		g_free( key );
+		g_free( dir );
+		return( -1 );
+	}
+
+	out = NULL;
+	result = 0;
+	if( vips_cache_operation_buildp( operation ) )
+		result = -1;
+	else {
+		g_object_get( *operation, "out", &out, NULL );
+		if( !VIPS_IS_IMAGE( out ) ||
+			vips_image_write_to_buffer( out, suffix, buf, size,
+				NULL ) )
+			result = -1;
+		VIPS_UNREF( out );
+	}
+
+	if( !result &&
+		key ) {
+		VIPS_DEBUG_MSG( "vips_cache_operation_write_to_buffer: "
+			"miss %s\n", key );
+
+		g_atomic_int_inc( &vips_disk_cache_n_misses );
+		vips_disk_cache_put( dir, key, *buf, *size );
+	}
+
+	g_free( key );
+	g_free( dir );
+
+	return( result );
+}
@@ -46,6 +46,25 @@ vips_size_get_type( void )
 
 	return( etype );
 }
+GType
+vips_thumbnail_quality_get_type( void )
+{
+	static GType etype = 0;
+
+	if( etype == 0 ) {
+		static const GEnumValue values[] = {
+			{VIPS_THUMBNAIL_QUALITY_HIGH, "VIPS_THUMBNAIL_QUALITY_HIGH", "high"},
+			{VIPS_THUMBNAIL_QUALITY_AUTO, "VIPS_THUMBNAIL_QUALITY_AUTO", "auto"},
+			{VIPS_THUMBNAIL_QUALITY_FAST, "VIPS_THUMBNAIL_QUALITY_FAST", "fast"},
+			{VIPS_THUMBNAIL_QUALITY_LAST, "VIPS_THUMBNAIL_QUALITY_LAST", "last"},
+			{0, NULL, NULL}
+		};
+
+		etype = g_enum_register_static( "VipsThumbnailQuality", values );
+	}
+
+	return( etype );
+}
 /* enumerations from "../../libvips/include/vips/foreign.h" */
 GType
 vips_foreign_flags_get_type( void )
@@ -598,6 +617,28 @@ vips_operation_complexget_get_type( void )
 
 	return( etype );
 }
+GType
+vips_statistics_flags_get_type( void )
+{
+	static GType etype = 0;
+
+	if( etype == 0 ) {
+		static const GFlagsValue values[] = {
+			{VIPS_STATISTICS_NONE, "VIPS_STATISTICS_NONE", "none"},
+			{VIPS_STATISTICS_AVG, "VIPS_STATISTICS_AVG", "avg"},
+			{VIPS_STATISTICS_DEVIATE, "VIPS_STATISTICS_DEVIATE", "deviate"},
+			{VIPS_STATISTICS_MIN, "VIPS_STATISTICS_MIN", "min"},
+			{VIPS_STATISTICS_MAX, "VIPS_STATISTICS_MAX", "max"},
+			{VIPS_STATISTICS_HIST, "VIPS_STATISTICS_HIST", "hist"},
+			{VIPS_STATISTICS_ALL, "VIPS_STATISTICS_ALL", "all"},
+			{0, NULL, NULL}
+		};
+		
+		etype = g_flags_register_static( "VipsStatisticsFlags", values );
+	}
+
+	return( etype );
+}
 /* enumerations from "../../libvips/include/vips/util.h" */
 GType
 vips_token_get_type( void )
@@ -807,6 +848,24 @@ vips_pcs_get_type( void )
 }
 /* enumerations from "../../libvips/include/vips/operation.h" */
 GType
+vips_cache_policy_get_type( void )
+{
+	static GType etype = 0;
+
+	if( etype == 0 ) {
+		static const GEnumValue values[] = {
+			{VIPS_CACHE_POLICY_LRU, "VIPS_CACHE_POLICY_LRU", "lru"},
+			{VIPS_CACHE_POLICY_GDS, "VIPS_CACHE_POLICY_GDS", "gds"},
+			{VIPS_CACHE_POLICY_LAST, "VIPS_CACHE_POLICY_LAST", "last"},
+			{0, NULL, NULL}
+		};
+		
+		etype = g_enum_register_static( "VipsCachePolicy", values );
+	}
+
+	return( etype );
+}
+GType
 vips_operation_flags_get_type( void )
 {
 	static GType etype = 0;
@@ -884,6 +943,26 @@ vips_combine_mode_get_type( void )
 
 	return( etype );
 }
+GType
+vips_draw_shape_get_type( void )
+{
+	static GType etype = 0;
+
+	if( etype == 0 ) {
+		static const GEnumValue values[] = {
+			{VIPS_DRAW_SHAPE_LINE, "VIPS_DRAW_SHAPE_LINE", "line"},
+			{VIPS_DRAW_SHAPE_RECT, "VIPS_DRAW_SHAPE_RECT", "rect"},
+			{VIPS_DRAW_SHAPE_CIRCLE, "VIPS_DRAW_SHAPE_CIRCLE", "circle"},
+			{VIPS_DRAW_SHAPE_MASK, "VIPS_DRAW_SHAPE_MASK", "mask"},
+			{VIPS_DRAW_SHAPE_LAST, "VIPS_DRAW_SHAPE_LAST", "last"},
+			{0, NULL, NULL}
+		};
+
+		etype = g_enum_register_static( "VipsDrawShape", values );
+	}
+
+	return( etype );
+}
 /* enumerations from "../../libvips/include/vips/basic.h" */
 GType
 vips_precision_get_type( void )
@@ -929,6 +1008,28 @@ vips_argument_flags_get_type( void )
 
 	return( etype );
 }
+/* enumerations from "../../libvips/include/vips/region.h" */
+GType
+vips_region_shrink_get_type( void )
+{
+	static GType etype = 0;
+
+	if( etype == 0 ) {
+		static const GEnumValue values[] = {
+			{VIPS_REGION_SHRINK_MEAN, "VIPS_REGION_SHRINK_MEAN", "mean"},
+			{VIPS_REGION_SHRINK_MEDIAN, "VIPS_REGION_SHRINK_MEDIAN", "median"},
+			{VIPS_REGION_SHRINK_MODE, "VIPS_REGION_SHRINK_MODE", "mode"},
+			{VIPS_REGION_SHRINK_MAX, "VIPS_REGION_SHRINK_MAX", "max"},
+			{VIPS_REGION_SHRINK_MIN, "VIPS_REGION_SHRINK_MIN", "min"},
+			{VIPS_REGION_SHRINK_LAST, "VIPS_REGION_SHRINK_LAST", "last"},
+			{0, NULL, NULL}
+		};
+
+		etype = g_enum_register_static( "VipsRegionShrink", values );
+	}
+
+	return( etype );
+}
 
 /* Generated data ends here */
 
@@ -14,6 +14,10 @@
  * 	- gtkdoc comments
  * 24/6/10
  * 	- fmt to error_exit() may be NULL
+ * 15/10/18
+ * 	- each thread has its own error buffer as well, see
+ * 	  vips_error_thread_buffer()
+ * 	- use a private lock, not vips__global_lock
  */
 
 /*
@@ -83,6 +87,13 @@
  * corruption), but it's sensible to only read and clear the buffer from the
  * main thread of execution.
  *
+ * Each thread also has a private error buffer holding just the messages it
+ * logged. Servers which handle many requests at once should use 
+ * vips_error_thread_buffer() and vips_error_thread_clear() instead, since
+ * messages from other requests will not be mixed in, and no lock is needed.
+ * Errors raised inside a computation are logged on the worker thread that
+ * hit them, so they only appear in the global buffer.
+ *
  * The general principle is: if you detect an error, log a message for the
  * user. If a function you call detects an error, just propogate it and don't
  * add another message.
@@ -133,6 +144,85 @@ static char vips_error_text[VIPS_MAX_ERROR] = "";
 static VipsBuf vips_error_buf = VIPS_BUF_STATIC( vips_error_text );
 static int vips_error_freeze_count = 0;
 
+/* Lock the global buffer and the freeze count with this. 
+ */
+static GMutex *vips_error_lock = NULL;
+
+/* The per-thread error buffer, made on the first error in that thread.
+ */
+typedef struct _VipsErrorThread {
+	char text[VIPS_MAX_ERROR];
+	VipsBuf buf;
+} VipsErrorThread;
+
+static GPrivate *vips_error_thread_key = NULL;
+
+static void
+vips_error_thread_free( VipsErrorThread *thread )
+{
+	g_free( thread );
+}
+
+static void *
+vips_error_init_once( void *data )
+{
+#ifdef HAVE_PRIVATE_INIT
+	static GPrivate private = 
+		G_PRIVATE_INIT( (GDestroyNotify) vips_error_thread_free );
+
+	vips_error_thread_key = &private;
+#else
+	vips_error_thread_key = g_private_new( 
+		(GDestroyNotify) vips_error_thread_free );
+#endif
+
+	vips_error_lock = vips_g_mutex_new();
+
+	return( NULL );
+}
+
+/* We can log errors before vips_init(), so init on first use.
+ */
+static void
+vips_error_init( void )
+{
+	static GOnce once = G_ONCE_INIT;
+
+	VIPS_ONCE( &once, vips_error_init_once, NULL );
+}
+
+static VipsErrorThread *
+vips_error_thread_get( gboolean create )
+{
+	VipsErrorThread *thread;
+
+	vips_error_init();
+
+	if( !(thread = g_private_get( vips_error_thread_key )) &&
+		create ) {
+		thread = g_new( VipsErrorThread, 1 );
+		thread->text[0] = '\0';
+		vips_buf_init_static( &thread->buf, 
+			thread->text, VIPS_MAX_ERROR );
+		g_private_set( vips_error_thread_key, thread );
+	}
+
+	return( thread );
+}
+
+/* Free this thread's error buffer, called from vips_thread_shutdown().
+ */
+void
+vips__error_thread_shutdown( void )
+{
+	VipsErrorThread *thread;
+
+	if( (thread = vips_error_thread_get( FALSE )) ) {
+		g_private_set( vips_error_thread_key, NULL );
+		vips_error_thread_free( thread );
+	}
+}
+
 /**
  * vips_error_freeze:
  *
@@ -142,10 +232,12 @@ static int vips_error_freeze_count = 0;
 void
 vips_error_freeze( void )
 {
-	g_mutex_lock( vips__global_lock );
+	vips_error_init();
+
+	g_mutex_lock( vips_error_lock );
 	g_assert( vips_error_freeze_count >= 0 );
 	vips_error_freeze_count += 1;
-	g_mutex_unlock( vips__global_lock );
+	g_mutex_unlock( vips_error_lock );
 }
 
 /**
@@ -156,10 +248,12 @@ vips_error_freeze( void )
 void
 vips_error_thaw( void )
 {
-	g_mutex_lock( vips__global_lock );
+	vips_error_init();
+
+	g_mutex_lock( vips_error_lock );
 	vips_error_freeze_count -= 1;
 	g_assert( vips_error_freeze_count >= 0 );
-	g_mutex_unlock( vips__global_lock );
+	g_mutex_unlock( vips_error_lock );
 }
 
 /**
@@ -177,13 +271,138 @@ vips_error_buffer( void )
 {
 	const char *msg;
 
-	g_mutex_lock( vips__global_lock );
+	vips_error_init();
+
+	g_mutex_lock( vips_error_lock );
 	msg = vips_buf_all( &vips_error_buf );
-	g_mutex_unlock( vips__global_lock );
+	g_mutex_unlock( vips_error_lock );
 
 	return( msg );
 }
 
+/**
+ * vips_error_thread_buffer: 
+ *
+ * Get the messages logged by the calling thread since it last called 
+ * vips_error_thread_clear() or vips_error_clear(). Unlike
+ * vips_error_buffer(), this takes no lock and does not include messages from
+ * other threads.
+ *
+ * The string is owned by the error system and must not be freed. It is only
+ * valid until the next error call from this thread.
+ *
+ * See also: vips_error_thread_clear(), vips_error_buffer().
+ *
+ * Returns: this thread's error buffer as a C string which must not be freed
+ */
+const char *
+vips_error_thread_buffer( void )
+{
+	VipsErrorThread *thread;
+
+	if( !(thread = vips_error_thread_get( FALSE )) )
+		return( "" );
+
+	return( vips_buf_all( &thread->buf ) );
+}
+
+/**
+ * vips_error_thread_clear: 
+ *
+ * Clear the calling thread's error buffer. The global buffer is not changed.
+ *
+ * See also: vips_error_thread_buffer(), vips_error_clear().
+ */
+void 
+vips_error_thread_clear( void )
+{
+	VipsErrorThread *thread;
+
+	if( (thread = vips_error_thread_get( FALSE )) )
+		vips_buf_rewind( &thread->buf );
+}
+
+/* The current position in the calling thread's error buffer, see 
+ * vips__error_pop().
+ */
+int
+vips__error_mark( void )
+{
+	VipsErrorThread *thread = vips_error_thread_get( TRUE );
+
+	return( thread->buf.i );
+}
+
+/* Remove the last copy of @msg from @buf. 
+ */
+static gboolean
+vips_error_buf_remove( VipsBuf *buf, const char *msg )
+{
+	size_t len = strlen( msg );
+	char *p;
+
+	if( len == 0 ||
+		!(p = g_strrstr( vips_buf_all( buf ), msg )) )
+		return( FALSE );
+
+	memmove( p, p + len, buf->i - (p - buf->base) - len );
+	buf->i -= len;
+	buf->base[buf->i] = '\0';
+	buf->lasti = VIPS_MIN( buf->lasti, buf->i );
+	buf->full = FALSE;
+
+	return( TRUE );
+}
+
+/* Drop the messages the calling thread has logged since @mark, from its own
+ * buffer and from the global buffer. Messages from other threads, and any
+ * logged before @mark, are left alone. 
+ */
+void
+vips__error_pop( int mark )
+{
+	VipsErrorThread *thread;
+	char *added;
+
+	/* The buffer may have been rewound since the mark was made, in which 
+	 * case we can't tell what was added.
+	 */
+	if( !(thread = vips_error_thread_get( FALSE )) ||
+		thread->buf.i <= mark )
+		return;
+
+	added = g_strdup( vips_buf_all( &thread->buf ) + mark );
+	thread->buf.i = mark;
+	thread->text[mark] = '\0';
+	thread->buf.lasti = VIPS_MIN( thread->buf.lasti, mark );
+	thread->buf.full = FALSE;
+
+	g_mutex_lock( vips_error_lock );
+
+	/* Messages from other threads may have landed in the middle of ours, 
+	 * in which case we remove them a line at a time.
+	 */
+	if( !vips_error_buf_remove( &vips_error_buf, added ) ) {
+		char **lines = g_strsplit( added, "\n", -1 );
+		int i;
+
+		for( i = 0; lines[i]; i++ ) 
+			if( lines[i][0] ) {
+				char *line = g_strconcat( lines[i], "\n", NULL );
+
+				(void) vips_error_buf_remove( 
+					&vips_error_buf, line );
+				g_free( line );
+			}
+
+		g_strfreev( lines );
+	}
+
+	g_mutex_unlock( vips_error_lock );
+
+	g_free( added );
+}
+
 /* Some systems do not have va_copy() ... this might work (it does on MSVC),
  * apparently.
  *
@@ -199,7 +418,8 @@ vips_error_buffer( void )
  * @fmt: printf()-style format string for the error
  * @ap: arguments to the format string
  *
- * Append a message to the error buffer.
+ * Append a message to the error buffer, and to the calling thread's error
+ * buffer.
  *
  * See also: vips_error().
  */
@@ -220,15 +440,36 @@ vips_verror( const char *domain, const char *fmt, va_list ap )
 }
 #endif /*VIPS_DEBUG*/
 
-	g_mutex_lock( vips__global_lock );
-	g_assert( vips_error_freeze_count >= 0 );
-	if( !vips_error_freeze_count ) {
+	vips_error_init();
+
+	/* A racy read is fine, freeze is only a hint to skip messages.
+	 */
+	if( !g_atomic_int_get( &vips_error_freeze_count ) ) {
+		VipsErrorThread *thread = vips_error_thread_get( TRUE );
+		VipsBuf *buf = &thread->buf;
+
+		int start;
+
+		/* Threads which never clear their buffer drop old 
+		 * messages, not new ones.
+		 */
+		if( buf->full )
+			vips_buf_rewind( buf );
+		start = buf->i;
+
+		/* Format once, into this thread's buffer, then copy the
+		 * message to the global buffer.
+		 */
 		if( domain ) 
-			vips_buf_appendf( &vips_error_buf, "%s: ", domain );
-		vips_buf_vappendf( &vips_error_buf, fmt, ap );
-		vips_buf_appends( &vips_error_buf, "\n" );
+			vips_buf_appendf( buf, "%s: ", domain );
+		vips_buf_vappendf( buf, fmt, ap );
+		vips_buf_appends( buf, "\n" );
+
+		g_mutex_lock( vips_error_lock );
+		vips_buf_appends( &vips_error_buf, 
+			vips_buf_all( buf ) + start );
+		g_mutex_unlock( vips_error_lock );
 	}
-	g_mutex_unlock( vips__global_lock );
 
 	if( vips__fatal )
 		vips_error_exit( "vips__fatal" );
@@ -343,9 +584,11 @@ vips_error_g( GError **error )
 
 	/* glib does not expect a trailing '\n' and vips always has one.
 	 */
-	g_mutex_lock( vips__global_lock );
+	vips_error_init();
+
+	g_mutex_lock( vips_error_lock );
 	vips_buf_removec( &vips_error_buf, '\n' );
-	g_mutex_unlock( vips__global_lock );
+	g_mutex_unlock( vips_error_lock );
 
 	g_set_error( error, vips_domain, -1, "%s", vips_error_buffer() );
 	vips_error_clear();
@@ -375,17 +618,21 @@ vips_g_error( GError **error )
 /**
  * vips_error_clear: 
  *
- * Clear and reset the error buffer. This is typically called after presenting
- * an error to the user.
+ * Clear and reset the error buffer, and the calling thread's error buffer. 
+ * This is typically called after presenting an error to the user.
  *
- * See also: vips_error_buffer().
+ * See also: vips_error_buffer(), vips_error_thread_clear().
  */
 void 
 vips_error_clear( void )
 {
-	g_mutex_lock( vips__global_lock );
+	vips_error_init();
+
+	g_mutex_lock( vips_error_lock );
 	vips_buf_rewind( &vips_error_buf );
-	g_mutex_unlock( vips__global_lock );
+	g_mutex_unlock( vips_error_lock );
+
+	vips_error_thread_clear();
 }
 
 /**
@@ -0,0 +1,371 @@
+/* fuse chains of point operations into a single generate
+ *
+ * 14/10/18
+ * 	- first version
+ */
+
+/*
+
+    This file is part of VIPS.
+
+    VIPS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA
+
+ */
+
+/*
+
+    These files are distributed with VIPS - http://www.vips.ecs.soton.ac.uk
+
+ */
+
+/* A chain like cast -> linear -> cast -> maplut makes four images, each with
+ * its own generate, its own regions and a full tile buffer per thread. Each
+ * of those tiles is written by one stage and read by the next, so we walk a
+ * lot of memory for very little work.
+ *
+ * Point operations (arithmetic, cast, maplut) attach a VipsPoint to their
+ * output with vips__point_attach() saying how to make one line of output
+ * from one line of each input. After an operation is built,
+ * vips__point_fuse() looks for a chain of these behind each output image
+ * and, if it finds one, replaces the output's generate with one that runs
+ * the whole chain a scanline at a time through a pair of small line buffers.
+ *
+ * The intermediate images are left alone, so anything else using them still
+ * works.
+ */
+
+/*
+#define DEBUG
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /*HAVE_CONFIG_H*/
+#include <vips/intl.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vips/vips.h>
+#include <vips/internal.h>
+#include <vips/debug.h>
+
+/* Max number of inputs to a stage we can fuse, and the longest chain.
+ */
+#define VIPS_POINT_MAX_INPUT (4)
+#define VIPS_POINT_MAX_STAGE (16)
+
+/* Cleared by the --vips-nofuse switch and the VIPS_NOFUSE env var.
+ */
+gboolean vips__fuse_enabled = TRUE;
+
+static GQuark vips__image_point_quark = 0;
+
+/* How to make an image a line at a time, attached to the output image.
+ */
+typedef struct _VipsPoint {
+	VipsImage *out;
+
+	/* Inputs, NULL-terminated. They are all the same size as @out. We
+	 * fuse through in[0].
+	 */
+	int n;
+	VipsImage *in[VIPS_POINT_MAX_INPUT + 1];
+
+	VipsPointFn fn;
+	void *a;
+} VipsPoint;
+
+/* A fused chain. stage[0] reads from base.
+ */
+typedef struct _VipsFuse {
+	VipsImage *base;
+
+	int n_stage;
+	VipsPoint *stage[VIPS_POINT_MAX_STAGE];
+
+	/* Biggest intermediate line, in bytes.
+	 */
+	size_t sizeof_line;
+} VipsFuse;
+
+typedef struct _VipsFuseSequence {
+	VipsRegion *base;
+
+	/* Regions on the extra inputs for each stage.
+	 */
+	VipsRegion *extra[VIPS_POINT_MAX_STAGE][VIPS_POINT_MAX_INPUT];
+
+	/* Intermediate results ping-pong between these.
+	 */
+	VipsPel *buf[2];
+} VipsFuseSequence;
+
+void
+vips__point_init( void )
+{
+	if( !vips__image_point_quark )
+		vips__image_point_quark =
+			g_quark_from_static_string( "vips-image-point" );
+
+	if( g_getenv( "VIPS_NOFUSE" ) )
+		vips__fuse_enabled = FALSE;
+}
+
+/* @out is made a line at a time by @fn from the NULL-terminated array of
+ * images @in, which must be the same size as @out. Line y of the output
+ * must depend only on line y of the inputs.
+ *
+ * Call this after vips_image_generate().
+ */
+void
+vips__point_attach( VipsImage *out, VipsImage **in, VipsPointFn fn, void *a )
+{
+	VipsPoint *point;
+	int i;
+
+	for( i = 0; in[i]; i++ )
+		if( i >= VIPS_POINT_MAX_INPUT ||
+			in[i]->Xsize != out->Xsize ||
+			in[i]->Ysize != out->Ysize )
+			return;
+
+	point = g_new( VipsPoint, 1 );
+	point->out = out;
+	point->n = i;
+	for( i = 0; i < point->n; i++ )
+		point->in[i] = in[i];
+	point->in[i] = NULL;
+	point->fn = fn;
+	point->a = a;
+
+	g_object_set_qdata_full( G_OBJECT( out ),
+		vips__image_point_quark, point, (GDestroyNotify) g_free );
+}
+
+static VipsPoint *
+vips_point_get( VipsImage *image )
+{
+	if( image->dtype != VIPS_IMAGE_PARTIAL )
+		return( NULL );
+
+	return( (VipsPoint *)
+		g_object_get_qdata( G_OBJECT( image ),
+			vips__image_point_quark ) );
+}
+
+/* If @image is made a line at a time from a single input, return the line
+ * function and its input. Statistics use this to run a cast on the fly
+ * rather than pulling pixels through another pipeline.
+ */
+VipsPointFn
+vips__point_get( VipsImage *image, VipsImage **in, void **a )
+{
+	VipsPoint *point;
+
+	if( !(point = vips_point_get( image )) ||
+		point->n != 1 )
+		return( NULL );
+
+	*in = point->in[0];
+	*a = point->a;
+
+	return( point->fn );
+}
+
+static int
+vips_fuse_stop( void *vseq, void *a, void *b )
+{
+	VipsFuseSequence *seq = (VipsFuseSequence *) vseq;
+	VipsFuse *fuse = (VipsFuse *) a;
+
+	int i, j;
+
+	VIPS_UNREF( seq->base );
+	for( i = 0; i < fuse->n_stage; i++ )
+		for( j = 0; j < VIPS_POINT_MAX_INPUT; j++ )
+			VIPS_UNREF( seq->extra[i][j] );
+	VIPS_FREE( seq->buf[0] );
+	VIPS_FREE( seq->buf[1] );
+	g_free( seq );
+
+	return( 0 );
+}
+
+static void *
+vips_fuse_start( VipsImage *out, void *a, void *b )
+{
+	VipsFuse *fuse = (VipsFuse *) a;
+
+	VipsFuseSequence *seq;
+	int i, j;
+
+	seq = g_new0( VipsFuseSequence, 1 );
+
+	if( !(seq->base = vips_region_new( fuse->base )) ||
+		!(seq->buf[0] = 
+			VIPS_ARRAY( NULL, fuse->sizeof_line, VipsPel )) ||
+		!(seq->buf[1] = 
+			VIPS_ARRAY( NULL, fuse->sizeof_line, VipsPel )) ) {
+		vips_fuse_stop( seq, a, b );
+		return( NULL );
+	}
+
+	for( i = 0; i < fuse->n_stage; i++ )
+		for( j = 1; j < fuse->stage[i]->n; j++ )
+			if( !(seq->extra[i][j] =
+				vips_region_new( fuse->stage[i]->in[j] )) ) {
+				vips_fuse_stop( seq, a, b );
+				return( NULL );
+			}
+
+	return( seq );
+}
+
+static int
+vips_fuse_gen( VipsRegion *or, void *vseq, void *a, void *b, gboolean *stop )
+{
+	VipsFuseSequence *seq = (VipsFuseSequence *) vseq;
+	VipsFuse *fuse = (VipsFuse *) a;
+	VipsRect *r = &or->valid;
+
+	int i, j, y;
+
+	if( vips_region_prepare( seq->base, r ) )
+		return( -1 );
+	for( i = 0; i < fuse->n_stage; i++ )
+		for( j = 1; j < fuse->stage[i]->n; j++ )
+			if( vips_region_prepare( seq->extra[i][j], r ) )
+				return( -1 );
+
+	VIPS_GATE_START( "vips_fuse_gen: work" );
+
+	for( y = r->top; y < VIPS_RECT_BOTTOM( r ); y++ ) {
+		VipsPel *p = VIPS_REGION_ADDR( seq->base, r->left, y );
+
+		for( i = 0; i < fuse->n_stage; i++ ) {
+			VipsPoint *stage = fuse->stage[i];
+
+			VipsPel *in[VIPS_POINT_MAX_INPUT + 1];
+			VipsPel *q;
+
+			in[0] = p;
+			for( j = 1; j < stage->n; j++ )
+				in[j] = VIPS_REGION_ADDR( seq->extra[i][j],
+					r->left, y );
+			in[j] = NULL;
+
+			if( i == fuse->n_stage - 1 )
+				q = VIPS_REGION_ADDR( or, r->left, y );
+			else
+				q = seq->buf[i & 1];
+
+			stage->fn( q, in, r->width, stage->a );
+
+			p = q;
+		}
+	}
+
+	VIPS_GATE_STOP( "vips_fuse_gen: work" );
+
+	return( 0 );
+}
+
+/* Try to fuse the chain of point operations behind @image.
+ */
+static void
+vips_point_fuse_image( VipsImage *image )
+{
+	VipsPoint *point;
+	VipsPoint *chain[VIPS_POINT_MAX_STAGE];
+	VipsFuse *fuse;
+	int n, i;
+
+	if( !(point = vips_point_get( image )) ||
+		image->start_fn == vips_fuse_start ||
+		image->regions )
+		return;
+
+	/* Walk back up in[0] collecting stages. We stop at anything which
+	 * isn't a plain point operation. Intermediates can have other
+	 * consumers, that's fine, we never touch their generate.
+	 */
+	n = 0;
+	chain[n++] = point;
+	while( n < VIPS_POINT_MAX_STAGE &&
+		(point = vips_point_get( point->in[0] )) )
+		chain[n++] = point;
+	if( n < 2 )
+		return;
+
+	fuse = VIPS_NEW( image, VipsFuse );
+	fuse->n_stage = n;
+	fuse->sizeof_line = 0;
+	for( i = 0; i < n; i++ ) {
+		fuse->stage[i] = chain[n - i - 1];
+
+		if( i < n - 1 )
+			fuse->sizeof_line = VIPS_MAX( fuse->sizeof_line,
+				VIPS_IMAGE_SIZEOF_LINE( fuse->stage[i]->out ) );
+	}
+	fuse->base = fuse->stage[0]->in[0];
+
+#ifdef DEBUG
+	printf( "vips_point_fuse_image: fused %d stages for %p\n", n, image );
+#endif /*DEBUG*/
+
+	/* The intermediate images stay upstream of @image, so invalidation
+	 * still works.
+	 */
+	image->start_fn = vips_fuse_start;
+	image->generate_fn = vips_fuse_gen;
+	image->stop_fn = vips_fuse_stop;
+	image->client1 = fuse;
+	image->client2 = NULL;
+}
+
+static void *
+vips_point_fuse_sub( VipsObject *object,
+	GParamSpec *pspec,
+	VipsArgumentClass *argument_class,
+	VipsArgumentInstance *argument_instance,
+	void *a, void *b )
+{
+	if( (argument_class->flags & VIPS_ARGUMENT_OUTPUT) &&
+		G_IS_PARAM_SPEC_OBJECT( pspec ) &&
+		G_PARAM_SPEC_VALUE_TYPE( pspec ) == VIPS_TYPE_IMAGE &&
+		argument_instance->assigned ) {
+		VipsImage *image = G_STRUCT_MEMBER( VipsImage *, object,
+			argument_class->offset );
+
+		if( image )
+			vips_point_fuse_image( image );
+	}
+
+	return( NULL );
+}
+
+/* Called by the operation cache after @operation has been built.
+ */
+void
+vips__point_fuse( VipsOperation *operation )
+{
+	if( !vips__fuse_enabled )
+		return;
+
+	(void) vips_argument_map( VIPS_OBJECT( operation ),
+		vips_point_fuse_sub, NULL, NULL );
+}
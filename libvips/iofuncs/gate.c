@@ -1,6 +1,12 @@
 /* gate.c --- thread profiling
  *
  * Written on: 18 nov 13
+ *
+ * 14/10/18
+ * 	- add live per-operation stats
+ * 	- keep per-image counters too, for vips_image_graph_dot()
+ * 	- add lock stats for scaling benchmarks
+ * 	- record the tile and image for each work unit in profiles
  */
 
 /*
@@ -43,6 +49,9 @@
 #endif /*HAVE_CONFIG_H*/
 #include <vips/intl.h>
 
+#include <stdlib.h>
+#include <string.h>
+
 #include <vips/vips.h>
 #include <vips/internal.h>
 #include <vips/debug.h>
@@ -66,6 +75,22 @@ typedef struct _VipsThreadGate {
 	VipsThreadGateBlock *stop;
 } VipsThreadGate; 
 
+/* A tile computed by a thread, and who computed it.
+ */
+typedef struct _VipsThreadTile {
+	const char *name;
+	VipsRect rect;
+	gint64 start;
+	gint64 stop;
+} VipsThreadTile;
+
+typedef struct _VipsThreadTileBlock {
+	struct _VipsThreadTileBlock *prev;
+
+	VipsThreadTile tile[VIPS_GATE_SIZE];
+	int i;
+} VipsThreadTileBlock;
+
 /* One of these in per-thread private storage. 
  */
 
@@ -76,6 +101,7 @@ typedef struct _VipsThreadProfile {
 	GThread *thread;
 	GHashTable *gates;
 	VipsThreadGate *memory;
+	VipsThreadTileBlock *tiles;
 } VipsThreadProfile; 
 
 gboolean vips__thread_profile = FALSE;
@@ -122,6 +148,24 @@ vips_thread_profile_save_gate( VipsThreadGate *gate, FILE *fp )
 	}
 }
 
+static void
+vips_thread_tile_block_save( VipsThreadTileBlock *block, FILE *fp )
+{
+	int i;
+
+	for( i = 0; i < block->i; i++ ) {
+		VipsThreadTile *tile = &block->tile[i];
+
+		fprintf( fp, "tile: %d %d %d %d "
+			"%" G_GINT64_FORMAT " %" G_GINT64_FORMAT " %s\n",
+			tile->rect.left, tile->rect.top,
+			tile->rect.width, tile->rect.height,
+			tile->start, tile->stop, tile->name );
+	}
+	if( block->prev )
+		vips_thread_tile_block_save( block->prev, fp );
+}
+
 static void
 vips_thread_profile_save_cb( gpointer key, gpointer value, gpointer data )
 {
@@ -154,6 +198,7 @@ vips_thread_profile_save( VipsThreadProfile *profile )
 	g_hash_table_foreach( profile->gates, 
 		vips_thread_profile_save_cb, vips__thread_fp );
 	vips_thread_profile_save_gate( profile->memory, vips__thread_fp ); 
+	vips_thread_tile_block_save( profile->tiles, vips__thread_fp );
 
 	g_mutex_unlock( vips__global_lock );
 }
@@ -165,6 +210,13 @@ vips_thread_gate_block_free( VipsThreadGateBlock *block )
 	VIPS_FREE( block );
 }
 
+static void
+vips_thread_tile_block_free( VipsThreadTileBlock *block )
+{
+	VIPS_FREEF( vips_thread_tile_block_free, block->prev );
+	VIPS_FREE( block );
+}
+
 static void
 vips_thread_gate_free( VipsThreadGate *gate )
 {
@@ -180,6 +232,7 @@ vips_thread_profile_free( VipsThreadProfile *profile )
 
 	VIPS_FREEF( g_hash_table_destroy, profile->gates );
 	VIPS_FREEF( vips_thread_gate_free, profile->memory );
+	VIPS_FREEF( vips_thread_tile_block_free, profile->tiles );
 	VIPS_FREE( profile );
 }
 
@@ -257,6 +310,7 @@ vips__thread_profile_attach( const char *thread_name )
 		g_direct_hash, g_str_equal, 
 		NULL, (GDestroyNotify) vips_thread_gate_free );
 	profile->memory = vips_thread_gate_new( "memory" ); 
+	profile->tiles = g_new0( VipsThreadTileBlock, 1 );
 	g_private_set( vips_thread_profile_key, profile );
 }
 
@@ -298,8 +352,10 @@ vips_thread_gate_block_add( VipsThreadGateBlock **block )
 	*block = new_block;
 }
 
-static gint64
-vips_get_time( void )
+/* Microseconds from some arbitrary start point.
+ */
+gint64
+vips__get_time( void )
 {
 #ifdef HAVE_MONOTONIC_TIME
 	return( g_get_monotonic_time() );  
@@ -320,7 +376,7 @@ vips__thread_gate_start( const char *gate_name )
 	VIPS_DEBUG_MSG_RED( "vips__thread_gate_start: %s\n", gate_name ); 
 
 	if( (profile = vips_thread_profile_get()) ) { 
-		gint64 time = vips_get_time(); 
+		gint64 time = vips__get_time(); 
 
 		VipsThreadGate *gate;
 
@@ -348,7 +404,7 @@ vips__thread_gate_stop( const char *gate_name )
 	VIPS_DEBUG_MSG_RED( "vips__thread_gate_stop: %s\n", gate_name ); 
 
 	if( (profile = vips_thread_profile_get()) ) { 
-		gint64 time = vips_get_time(); 
+		gint64 time = vips__get_time(); 
 
 		VipsThreadGate *gate;
 
@@ -368,6 +424,35 @@ vips__thread_gate_stop( const char *gate_name )
 	}
 }
 
+/* Record that this thread computed @rect of an image made by @name between
+ * @start and @stop. vipsprofile uses these to draw a heatmap of time spent
+ * on each part of an image. @name must be a static string.
+ */
+void
+vips__thread_gate_tile( const char *name, const VipsRect *rect,
+	gint64 start, gint64 stop )
+{
+	VipsThreadProfile *profile;
+
+	if( (profile = vips_thread_profile_get()) ) {
+		VipsThreadTile *tile;
+
+		if( profile->tiles->i >= VIPS_GATE_SIZE ) {
+			VipsThreadTileBlock *block;
+
+			block = g_new0( VipsThreadTileBlock, 1 );
+			block->prev = profile->tiles;
+			profile->tiles = block;
+		}
+
+		tile = &profile->tiles->tile[profile->tiles->i++];
+		tile->name = name;
+		tile->rect = *rect;
+		tile->start = start;
+		tile->stop = stop;
+	}
+}
+
 /* Record a malloc() or free(). Use -ve numbers for free.
  */
 void
@@ -383,7 +468,7 @@ vips__thread_malloc_free( gint64 size )
 #endif /*VIPS_DEBUG*/
 
 	if( (profile = vips_thread_profile_get()) ) { 
-		gint64 time = vips_get_time(); 
+		gint64 time = vips__get_time(); 
 		VipsThreadGate *gate = profile->memory;
 
 		if( gate->start->i >= VIPS_GATE_SIZE ) {
@@ -395,3 +480,562 @@ vips__thread_malloc_free( gint64 size )
 		gate->stop->time[gate->stop->i++] = size;
 	}
 }
+
+/* Live per-operation stats. Images made by an operation get a pointer to 
+ * the stats for that operation's nickname in postbuild, and 
+ * vips_region_generate() and friends update it as pixels are computed.
+ */
+gboolean vips__operation_stats = FALSE;
+
+/* Protects the table and every stats struct in it.
+ */
+static GMutex *vips_operation_stats_lock = NULL;
+
+/* nickname -> VipsOperationStats. Entries are never freed, so images can
+ * hold pointers to them for as long as they like.
+ */
+static GHashTable *vips_operation_stats_table = NULL;
+
+/* The innermost VipsOperationStatsScope for this thread.
+ */
+static GPrivate *vips_operation_stats_key = NULL;
+
+static void *
+vips_operation_stats_init_cb( void *data )
+{
+#ifdef HAVE_PRIVATE_INIT
+	static GPrivate private = G_PRIVATE_INIT( NULL );
+
+	vips_operation_stats_key = &private;
+#else
+	vips_operation_stats_key = g_private_new( NULL );
+#endif
+
+	vips_operation_stats_lock = vips_g_mutex_new();
+	vips_operation_stats_table = 
+		g_hash_table_new( g_str_hash, g_str_equal );
+
+	return( NULL );
+}
+
+static void
+vips_operation_stats_init( void )
+{
+	static GOnce once = G_ONCE_INIT;
+
+	VIPS_ONCE( &once, vips_operation_stats_init_cb, NULL );
+}
+
+/**
+ * vips_operation_stats_set:
+ * @stats: %TRUE to enable operation stats
+ *
+ * If set, vips will keep live counters for each operation nickname: pixels
+ * generated, time spent in the generate function, tracked memory allocated 
+ * and region prepare calls. Stats are only collected for images made by
+ * operations built after this is set. 
+ *
+ * You can also enable stats with the `VIPS_OPERATION_STATS` environment 
+ * variable or the `--vips-operation-stats` command-line flag.
+ *
+ * See also: vips_operation_stats_snapshot(), vips_profile_set().
+ */
+void
+vips_operation_stats_set( gboolean stats )
+{
+	vips_operation_stats_init();
+
+	vips__operation_stats = stats;
+}
+
+/* Get the stats for an operation nickname, making a new entry if
+ * necessary. 
+ */
+VipsOperationStats *
+vips__operation_stats_get( const char *nickname )
+{
+	VipsOperationStats *stats;
+
+	vips_operation_stats_init();
+
+	g_mutex_lock( vips_operation_stats_lock );
+
+	if( !(stats = g_hash_table_lookup( vips_operation_stats_table, 
+		nickname )) ) {
+		stats = g_new0( VipsOperationStats, 1 );
+		stats->nickname = g_intern_string( nickname );
+		g_hash_table_insert( vips_operation_stats_table, 
+			(char *) stats->nickname, stats );
+	}
+
+	g_mutex_unlock( vips_operation_stats_lock );
+
+	return( stats );
+}
+
+/* Enter and leave a generate function. Scopes nest, so we can record the 
+ * time spent in each operation with the time spent upstream taken off.
+ */
+void
+vips__operation_stats_enter( VipsOperationStatsScope *scope, 
+	VipsOperationStats *stats, VipsImageStats *image_stats )
+{
+	vips_operation_stats_init();
+
+	scope->stats = stats;
+	scope->image_stats = image_stats;
+	scope->parent = g_private_get( vips_operation_stats_key );
+	scope->child = 0;
+	scope->start = vips__get_time();
+	g_private_set( vips_operation_stats_key, scope );
+}
+
+void
+vips__operation_stats_leave( VipsOperationStatsScope *scope, 
+	int width, int height, size_t bsize )
+{
+	gint64 elapsed = vips__get_time() - scope->start;
+	guint64 pixels = (guint64) width * height;
+	gint64 self_time = VIPS_MAX( 0, elapsed - scope->child );
+
+	g_private_set( vips_operation_stats_key, scope->parent );
+	if( scope->parent )
+		scope->parent->child += elapsed;
+
+	g_mutex_lock( vips_operation_stats_lock );
+
+	scope->stats->calls += 1;
+	scope->stats->pixels += pixels;
+	scope->stats->time += elapsed;
+	scope->stats->self_time += self_time;
+
+	if( scope->image_stats ) {
+		VipsImageStats *image_stats = scope->image_stats;
+
+		image_stats->calls += 1;
+		image_stats->pixels += pixels;
+		image_stats->time += elapsed;
+		image_stats->self_time += self_time;
+		image_stats->tile_width = 
+			VIPS_MAX( image_stats->tile_width, width );
+		image_stats->tile_height = 
+			VIPS_MAX( image_stats->tile_height, height );
+		image_stats->bsize = VIPS_MAX( image_stats->bsize, bsize );
+	}
+
+	g_mutex_unlock( vips_operation_stats_lock );
+}
+
+/* A new sequence has started on an image. Each sequence holds a buffer, so
+ * this tells us how much memory the image is using.
+ */
+void
+vips__operation_stats_sequence( VipsImageStats *image_stats )
+{
+	vips_operation_stats_init();
+
+	g_mutex_lock( vips_operation_stats_lock );
+	image_stats->sequences += 1;
+	g_mutex_unlock( vips_operation_stats_lock );
+}
+
+/* Take a consistent copy of an image's counters.
+ */
+void
+vips__operation_stats_copy( VipsImageStats *to, VipsImageStats *from )
+{
+	vips_operation_stats_init();
+
+	g_mutex_lock( vips_operation_stats_lock );
+	*to = *from;
+	g_mutex_unlock( vips_operation_stats_lock );
+}
+
+void
+vips__operation_stats_prepare( VipsOperationStats *stats )
+{
+	g_mutex_lock( vips_operation_stats_lock );
+	stats->prepares += 1;
+	g_mutex_unlock( vips_operation_stats_lock );
+}
+
+/* Charge a tracked malloc() to the operation this thread is generating
+ * for, if any.
+ */
+void
+vips__operation_stats_malloc( size_t size )
+{
+	VipsOperationStatsScope *scope;
+
+	vips_operation_stats_init();
+
+	if( (scope = g_private_get( vips_operation_stats_key )) ) {
+		g_mutex_lock( vips_operation_stats_lock );
+		scope->stats->bytes += size;
+		g_mutex_unlock( vips_operation_stats_lock );
+	}
+}
+
+static int
+vips_operation_stats_compare( const void *a, const void *b )
+{
+	const VipsOperationStats *s1 = (const VipsOperationStats *) a;
+	const VipsOperationStats *s2 = (const VipsOperationStats *) b;
+
+	if( s1->self_time > s2->self_time )
+		return( -1 );
+	else if( s1->self_time < s2->self_time )
+		return( 1 );
+	else
+		return( strcmp( s1->nickname, s2->nickname ) );
+}
+
+/**
+ * vips_operation_stats_snapshot:
+ * @n: (out): return the number of operations here
+ *
+ * Take a consistent copy of the live operation stats, one #VipsOperationStats
+ * for each operation nickname seen since stats were enabled, sorted by 
+ * self time, hottest first. 
+ *
+ * Free the array with g_free().
+ *
+ * See also: vips_operation_stats_set(), vips_operation_stats_prometheus().
+ *
+ * Returns: (transfer full): an array of stats
+ */
+VipsOperationStats *
+vips_operation_stats_snapshot( int *n )
+{
+	VipsOperationStats *snapshot;
+	GHashTableIter iter;
+	gpointer value;
+	int i;
+
+	vips_operation_stats_init();
+
+	g_mutex_lock( vips_operation_stats_lock );
+
+	*n = g_hash_table_size( vips_operation_stats_table );
+	snapshot = g_new( VipsOperationStats, VIPS_MAX( 1, *n ) );
+
+	i = 0;
+	g_hash_table_iter_init( &iter, vips_operation_stats_table );
+	while( g_hash_table_iter_next( &iter, NULL, &value ) )
+		snapshot[i++] = *((VipsOperationStats *) value);
+
+	g_mutex_unlock( vips_operation_stats_lock );
+
+	qsort( snapshot, *n, sizeof( VipsOperationStats ), 
+		vips_operation_stats_compare );
+
+	return( snapshot );
+}
+
+/**
+ * vips_operation_stats_reset:
+ *
+ * Zero all the live operation stats. 
+ *
+ * See also: vips_operation_stats_snapshot().
+ */
+void
+vips_operation_stats_reset( void )
+{
+	GHashTableIter iter;
+	gpointer value;
+
+	vips_operation_stats_init();
+
+	g_mutex_lock( vips_operation_stats_lock );
+
+	g_hash_table_iter_init( &iter, vips_operation_stats_table );
+	while( g_hash_table_iter_next( &iter, NULL, &value ) ) {
+		VipsOperationStats *stats = (VipsOperationStats *) value;
+		const char *nickname = stats->nickname;
+
+		memset( stats, 0, sizeof( VipsOperationStats ) );
+		stats->nickname = nickname;
+	}
+
+	g_mutex_unlock( vips_operation_stats_lock );
+}
+
+/* The counters we export, and how to scale them.
+ */
+static struct {
+	const char *name;
+	const char *help;
+	glong offset;
+	double scale;
+} vips_operation_stats_metric[] = {
+	{ "vips_operation_generate_calls_total", 
+		"Calls to the operation's generate function.",
+		G_STRUCT_OFFSET( VipsOperationStats, calls ), 1.0 },
+	{ "vips_operation_prepare_calls_total", 
+		"Region prepare calls on images made by the operation.",
+		G_STRUCT_OFFSET( VipsOperationStats, prepares ), 1.0 },
+	{ "vips_operation_pixels_total", 
+		"Pixels generated by the operation.",
+		G_STRUCT_OFFSET( VipsOperationStats, pixels ), 1.0 },
+	{ "vips_operation_generate_seconds_total", 
+		"Time in the generate function, including upstream operations.",
+		G_STRUCT_OFFSET( VipsOperationStats, time ), 1e-6 },
+	{ "vips_operation_generate_self_seconds_total", 
+		"Time in the generate function, excluding upstream operations.",
+		G_STRUCT_OFFSET( VipsOperationStats, self_time ), 1e-6 },
+	{ "vips_operation_allocated_bytes_total", 
+		"Tracked memory allocated while generating.",
+		G_STRUCT_OFFSET( VipsOperationStats, bytes ), 1.0 }
+};
+
+/**
+ * vips_operation_stats_prometheus:
+ *
+ * Format a snapshot of the live operation stats in the Prometheus text 
+ * exposition format, one counter family per stat with an `operation` label
+ * for each nickname.
+ *
+ * Free the result with g_free().
+ *
+ * See also: vips_operation_stats_snapshot().
+ *
+ * Returns: (transfer full): the formatted stats
+ */
+char *
+vips_operation_stats_prometheus( void )
+{
+	VipsOperationStats *snapshot;
+	int n;
+	GString *out;
+	int i, j;
+
+	snapshot = vips_operation_stats_snapshot( &n );
+	out = g_string_new( NULL );
+
+	for( i = 0; i < VIPS_NUMBER( vips_operation_stats_metric ); i++ ) {
+		const char *name = vips_operation_stats_metric[i].name;
+
+		g_string_append_printf( out, "# HELP %s %s\n", 
+			name, vips_operation_stats_metric[i].help );
+		g_string_append_printf( out, "# TYPE %s counter\n", name );
+
+		for( j = 0; j < n; j++ ) {
+			guint64 value = G_STRUCT_MEMBER( guint64, &snapshot[j],
+				vips_operation_stats_metric[i].offset );
+
+			g_string_append_printf( out, 
+				"%s{operation=\"%s\"} %.17g\n",
+				name, snapshot[j].nickname, 
+				value * vips_operation_stats_metric[i].scale );
+		}
+	}
+
+	g_free( snapshot );
+
+	return( g_string_free( out, FALSE ) );
+}
+
+/* Set to enable lock and buffer stats, see vips_gate_stats_set().
+ */
+gboolean vips__gate_stats = FALSE;
+
+/* Each thread counts into its own array of stats, so collecting them adds no
+ * contention of its own. Live arrays are on this list, stats from threads
+ * which have exited are summed into retired.
+ */
+static GMutex *vips_gate_stats_lock = NULL;
+static GSList *vips_gate_stats_live = NULL;
+static VipsGateStats vips_gate_stats_retired[VIPS_GATE_STAT_LAST];
+static GPrivate *vips_gate_stats_key = NULL;
+
+static const char *vips_gate_stats_name[VIPS_GATE_STAT_LAST] = {
+	"allocate",
+	"buffer",
+	"cache"
+};
+
+static void
+vips_gate_stats_sum( VipsGateStats *to, VipsGateStats *from )
+{
+	int i;
+
+	for( i = 0; i < VIPS_GATE_STAT_LAST; i++ ) {
+		to[i].calls += from[i].calls;
+		to[i].contended += from[i].contended;
+		to[i].time += from[i].time;
+	}
+}
+
+static void
+vips_gate_stats_retire( gpointer data )
+{
+	VipsGateStats *stats = (VipsGateStats *) data;
+
+	g_mutex_lock( vips_gate_stats_lock );
+
+	vips_gate_stats_sum( vips_gate_stats_retired, stats );
+	vips_gate_stats_live = g_slist_remove( vips_gate_stats_live, stats );
+
+	g_mutex_unlock( vips_gate_stats_lock );
+
+	g_free( stats );
+}
+
+static void *
+vips_gate_stats_init_cb( void *data )
+{
+#ifdef HAVE_PRIVATE_INIT
+	static GPrivate private = G_PRIVATE_INIT( vips_gate_stats_retire );
+
+	vips_gate_stats_key = &private;
+#else
+	vips_gate_stats_key = g_private_new( vips_gate_stats_retire );
+#endif
+
+	vips_gate_stats_lock = vips_g_mutex_new();
+
+	return( NULL );
+}
+
+static void
+vips_gate_stats_init( void )
+{
+	static GOnce once = G_ONCE_INIT;
+
+	VIPS_ONCE( &once, vips_gate_stats_init_cb, NULL );
+}
+
+static VipsGateStats *
+vips_gate_stats_thread( void )
+{
+	VipsGateStats *stats;
+
+	vips_gate_stats_init();
+
+	if( !(stats = g_private_get( vips_gate_stats_key )) ) {
+		stats = g_new0( VipsGateStats, VIPS_GATE_STAT_LAST );
+
+		g_mutex_lock( vips_gate_stats_lock );
+		vips_gate_stats_live =
+			g_slist_prepend( vips_gate_stats_live, stats );
+		g_mutex_unlock( vips_gate_stats_lock );
+
+		g_private_set( vips_gate_stats_key, stats );
+	}
+
+	return( stats );
+}
+
+/**
+ * vips_gate_stats_set:
+ * @stats: %TRUE to enable lock stats
+ *
+ * If set, vips will count acquisitions of the threadpool allocate lock and
+ * the operation cache locks, how many of those had to wait, and the total
+ * time spent waiting. It also counts calls to vips_buffer_unref_ref() and the
+ * time spent in them.
+ *
+ * This is useful for measuring how well vips scales with the number of
+ * threads, see `benchmark/vipsscale`.
+ *
+ * You can also enable stats with the `VIPS_GATE_STATS` environment
+ * variable or the `--vips-gate-stats` command-line flag.
+ *
+ * See also: vips_gate_stats_snapshot(), vips_operation_stats_set().
+ */
+void
+vips_gate_stats_set( gboolean stats )
+{
+	vips_gate_stats_init();
+
+	vips__gate_stats = stats;
+}
+
+/**
+ * vips_gate_stats_snapshot:
+ * @stats: (out caller-allocates): an array of #VIPS_GATE_STAT_LAST stats
+ *
+ * Sum the lock stats over all threads into @stats, indexed by
+ * #VipsGateStat. Times are in microseconds.
+ *
+ * See also: vips_gate_stats_set(), vips_gate_stats_reset().
+ */
+void
+vips_gate_stats_snapshot( VipsGateStats *stats )
+{
+	GSList *p;
+	int i;
+
+	vips_gate_stats_init();
+
+	memset( stats, 0, VIPS_GATE_STAT_LAST * sizeof( VipsGateStats ) );
+
+	g_mutex_lock( vips_gate_stats_lock );
+
+	vips_gate_stats_sum( stats, vips_gate_stats_retired );
+	for( p = vips_gate_stats_live; p; p = p->next )
+		vips_gate_stats_sum( stats, (VipsGateStats *) p->data );
+
+	g_mutex_unlock( vips_gate_stats_lock );
+
+	for( i = 0; i < VIPS_GATE_STAT_LAST; i++ )
+		stats[i].name = vips_gate_stats_name[i];
+}
+
+/**
+ * vips_gate_stats_reset:
+ *
+ * Zero the lock stats. Call this while no pipelines are running, or some
+ * counts may be lost.
+ *
+ * See also: vips_gate_stats_snapshot().
+ */
+void
+vips_gate_stats_reset( void )
+{
+	GSList *p;
+
+	vips_gate_stats_init();
+
+	g_mutex_lock( vips_gate_stats_lock );
+
+	memset( vips_gate_stats_retired, 0,
+		VIPS_GATE_STAT_LAST * sizeof( VipsGateStats ) );
+	for( p = vips_gate_stats_live; p; p = p->next )
+		memset( p->data, 0,
+			VIPS_GATE_STAT_LAST * sizeof( VipsGateStats ) );
+
+	g_mutex_unlock( vips_gate_stats_lock );
+}
+
+/* Lock, counting the acquisition and any time we had to wait. Use via
+ * VIPS_GATE_LOCK().
+ */
+void
+vips__gate_lock( GMutex *lock, VipsGateStat stat )
+{
+	VipsGateStats *stats = &vips_gate_stats_thread()[stat];
+
+	stats->calls += 1;
+
+	if( !g_mutex_trylock( lock ) ) {
+		gint64 start = vips__get_time();
+
+		g_mutex_lock( lock );
+
+		stats->contended += 1;
+		stats->time += vips__get_time() - start;
+	}
+}
+
+/* Count one call of @time microseconds.
+ */
+void
+vips__gate_time( VipsGateStat stat, gint64 time )
+{
+	VipsGateStats *stats = &vips_gate_stats_thread()[stat];
+
+	stats->calls += 1;
+	stats->time += time;
+}
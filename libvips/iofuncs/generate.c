@@ -53,6 +53,10 @@
  * 7/7/12
  * 	- lock around link make/break so we can process an image from many
  * 	  threads
+ * 14/10/18
+ * 	- start/stop one/many reuse spare regions
+ * 	- add vips_image_set_prefetch()
+ * 	- write tiled OPENOUT images with vips__write_tiled_output()
  */
 
 /*
@@ -440,6 +444,9 @@ vips_image_pipelinev( VipsImage *image, VipsDemandStyle hint, ... )
  *
  * Start function for one image in. Input image is @a.
  *
+ * The region may be a spare left on @a by an earlier vips_stop_one(), rather
+ * than a new one. 
+ *
  * See also: vips_image_generate().
  */
 void *
@@ -447,7 +454,7 @@ vips_start_one( VipsImage *out, void *a, void *b )
 {
 	VipsImage *in = (VipsImage *) a;
 
-	return( vips_region_new( in ) );
+	return( vips__region_pool_get( in ) );
 }
 
 /**
@@ -465,7 +472,7 @@ vips_stop_one( void *seq, void *a, void *b )
 {
 	VipsRegion *reg = (VipsRegion *) seq;
 
-	g_object_unref( reg );
+	vips__region_pool_put( reg );
 
 	return( 0 );
 }
@@ -490,7 +497,7 @@ vips_stop_many( void *seq, void *a, void *b )
 		int i;
 
 		for( i = 0; ar[i]; i++ )
-			g_object_unref( ar[i] );
+			vips__region_pool_put( ar[i] );
 		vips_free( (char *) ar );
 	}
 
@@ -529,7 +536,7 @@ vips_start_many( VipsImage *out, void *a, void *b )
 	/* Create a set of regions.
 	 */
 	for( i = 0; i < n; i++ )
-		if( !(ar[i] = vips_region_new( in[i] )) ) {
+		if( !(ar[i] = vips__region_pool_get( in[i] )) ) {
 			vips_stop_many( ar, NULL, NULL );
 			return( NULL );
 		}
@@ -749,7 +756,10 @@ vips_image_generate( VipsImage *image,
                 if( vips_image_write_prepare( image ) )
                         return( -1 );
 
-                if( image->dtype == VIPS_IMAGE_OPENOUT ) 
+                if( image->dtype == VIPS_IMAGE_OPENOUT &&
+			image->tile_width > 0 )
+			res = vips__write_tiled_output( image );
+                else if( image->dtype == VIPS_IMAGE_OPENOUT )
 			res = vips_sink_disc( image,
 				(VipsRegionWrite) write_vips, NULL );
                 else 
@@ -784,3 +794,29 @@ vips_image_generate( VipsImage *image,
 
         return( 0 );
 }
+
+/**
+ * vips_image_set_prefetch:
+ * @image: partial image to set the handler on
+ * @prefetch_fn: (scope notified): handle prefetch hints with this function
+ * @a: user data
+ *
+ * Attach a handler for prefetch hints to a partial image. When something
+ * calls vips_region_prefetch() on a region of @image, @prefetch_fn is called
+ * with the area, clipped to the image. It should start any I/O it can for
+ * that area and return immediately without blocking.
+ *
+ * Operations which pass pixels through unaltered, like caches and lazy
+ * loaders, can use this to pass hints on to their input.
+ *
+ * See also: vips_region_prefetch(), vips_image_generate().
+ */
+void
+vips_image_set_prefetch( VipsImage *image, 
+	VipsPrefetchFn prefetch_fn, void *a )
+{
+	VipsImagePrivate *private = vips__image_private( image );
+
+	private->prefetch_fn = prefetch_fn;
+	private->prefetch_a = a;
+}
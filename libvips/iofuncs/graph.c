@@ -0,0 +1,366 @@
+/* dump a pipeline as a graph
+ *
+ * 14/10/18
+ * 	- first version
+ */
+
+/*
+
+    This file is part of VIPS.
+
+    VIPS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA
+
+ */
+
+/*
+
+    These files are distributed with VIPS - http://www.vips.ecs.soton.ac.uk
+
+ */
+
+/*
+#define DEBUG
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /*HAVE_CONFIG_H*/
+#include <vips/intl.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vips/vips.h>
+#include <vips/internal.h>
+
+/* Set by --vips-pipeline-graph and VIPS_PIPELINE_GRAPH. Every computed
+ * pipeline is written here as it finishes.
+ */
+char *vips__pipeline_graph = NULL;
+
+/* One node of the graph.
+ */
+typedef struct _VipsGraphNode {
+	VipsImage *image;
+	const char *nickname;
+	const char *filename;
+
+	int tile_width;
+	int tile_height;
+	int n_lines;
+
+	VipsImageStats stats;
+
+	/* Upstream images, we take a copy under the global lock.
+	 */
+	GSList *upstream;
+} VipsGraphNode;
+
+static void *
+vips_graph_node_add( VipsImage *image, GSList **nodes, void *b )
+{
+	VipsImagePrivate *private;
+	VipsGraphNode *node;
+
+	node = g_new0( VipsGraphNode, 1 );
+	node->image = image;
+	private = vips__image_private( image );
+	node->nickname = private->stats ? private->stats->nickname : NULL;
+	node->filename = vips_image_get_filename( image );
+
+	vips_get_tile_size( image,
+		&node->tile_width, &node->tile_height, &node->n_lines );
+	vips__operation_stats_copy( &node->stats, &private->generate_stats );
+
+	g_mutex_lock( vips__global_lock );
+	node->upstream = g_slist_copy( image->upstream );
+	g_mutex_unlock( vips__global_lock );
+
+	*nodes = g_slist_prepend( *nodes, node );
+
+	return( NULL );
+}
+
+static void
+vips_graph_node_free( VipsGraphNode *node )
+{
+	g_slist_free( node->upstream );
+	g_free( node );
+}
+
+/* Get the nodes upstream of @image. The caller's ref on @image keeps 
+ * everything upstream of it alive, so we don't need to ref the nodes.
+ */
+static GSList *
+vips_graph_nodes( VipsImage *image )
+{
+	GSList *nodes;
+
+	nodes = NULL;
+	(void) vips__link_map( image, TRUE,
+		(VipsSListMap2Fn) vips_graph_node_add, &nodes, NULL );
+
+	return( nodes );
+}
+
+static void
+vips_graph_nodes_free( GSList *nodes )
+{
+	g_slist_free_full( nodes, (GDestroyNotify) vips_graph_node_free );
+}
+
+/* Estimate of the bytes held by a node: one buffer per sequence.
+ */
+static size_t
+vips_graph_node_buffered( VipsGraphNode *node )
+{
+	return( node->stats.bsize * VIPS_MAX( 1, node->stats.sequences ) );
+}
+
+/* Append @str as a quoted string with " and \ escaped. JSON needs other 
+ * control characters escaped too, DOT just wants newlines as \n.
+ */
+static void
+vips_graph_append_quoted( GString *out, const char *str, gboolean json )
+{
+	const char *p;
+
+	g_string_append_c( out, '"' );
+	for( p = str; *p; p++ )
+		if( *p == '"' ||
+			*p == '\\' ) {
+			g_string_append_c( out, '\\' );
+			g_string_append_c( out, *p );
+		}
+		else if( *p == '\n' ) 
+			g_string_append( out, "\\n" );
+		else if( json &&
+			(unsigned char) *p < 32 )
+			g_string_append_printf( out, "\\u%04x", *p );
+		else
+			g_string_append_c( out, *p );
+	g_string_append_c( out, '"' );
+}
+
+static const char *
+vips_graph_node_name( VipsGraphNode *node )
+{
+	if( node->nickname )
+		return( node->nickname );
+	else if( node->filename )
+		return( node->filename );
+	else
+		return( "image" );
+}
+
+/**
+ * vips_image_graph_dot: (method)
+ * @image: image to dump
+ *
+ * Make a description of @image and every image upstream of it in the
+ * graphviz DOT language. Each node shows the image size and format, the
+ * demand style, the tile geometry vips will use and, if operation stats
+ * were enabled when the pipeline was built, the largest area generated,
+ * an estimate of the memory buffered, and the time spent in generate with
+ * and without upstream time.
+ *
+ * Free the result with g_free().
+ *
+ * See also: vips_image_graph_json(), vips_operation_stats_set().
+ *
+ * Returns: (transfer full): the graph
+ */
+char *
+vips_image_graph_dot( VipsImage *image )
+{
+	GSList *nodes;
+	GString *out;
+	GSList *p, *q;
+
+	nodes = vips_graph_nodes( image );
+	out = g_string_new( NULL );
+
+	g_string_append( out, "digraph pipeline {\n" );
+	g_string_append( out, "\tnode [shape=box];\n" );
+
+	for( p = nodes; p; p = p->next ) {
+		VipsGraphNode *node = (VipsGraphNode *) p->data;
+		VipsImage *im = node->image;
+
+		char label[1024];
+		VipsBuf buf = VIPS_BUF_STATIC( label );
+
+		vips_buf_appendf( &buf, "%s\n", vips_graph_node_name( node ) );
+		vips_buf_appendf( &buf, "%dx%d %d bands %s\n",
+			im->Xsize, im->Ysize, im->Bands,
+			vips_enum_nick( VIPS_TYPE_BAND_FORMAT, im->BandFmt ) );
+		vips_buf_appendf( &buf, "%s, %s, tile %dx%d\n",
+			vips_enum_nick( VIPS_TYPE_IMAGE_TYPE, im->dtype ),
+			vips_enum_nick( VIPS_TYPE_DEMAND_STYLE, im->dhint ),
+			node->tile_width, node->tile_height );
+		if( node->stats.calls ) {
+			vips_buf_appendf( &buf, "%" G_GUINT64_FORMAT " calls, "
+				"max %dx%d, %zd bytes\n",
+				node->stats.calls,
+				node->stats.tile_width,
+				node->stats.tile_height,
+				vips_graph_node_buffered( node ) );
+			vips_buf_appendf( &buf, "%.3gs (%.3gs self)",
+				node->stats.time / 1e6,
+				node->stats.self_time / 1e6 );
+		}
+
+		g_string_append_printf( out, "\t\"%p\" [label=", im );
+		vips_graph_append_quoted( out, vips_buf_all( &buf ), FALSE );
+		g_string_append( out, "];\n" );
+
+		for( q = node->upstream; q; q = q->next )
+			g_string_append_printf( out,
+				"\t\"%p\" -> \"%p\";\n", q->data, im );
+	}
+
+	g_string_append( out, "}\n" );
+
+	vips_graph_nodes_free( nodes );
+
+	return( g_string_free( out, FALSE ) );
+}
+
+/**
+ * vips_image_graph_json: (method)
+ * @image: image to dump
+ *
+ * As vips_image_graph_dot(), but make a JSON object with a `nodes` and
+ * an `edges` array. Times are in microseconds.
+ *
+ * Free the result with g_free().
+ *
+ * See also: vips_image_graph_dot().
+ *
+ * Returns: (transfer full): the graph
+ */
+char *
+vips_image_graph_json( VipsImage *image )
+{
+	GSList *nodes;
+	GString *out;
+	GSList *p, *q;
+	gboolean first;
+
+	nodes = vips_graph_nodes( image );
+	out = g_string_new( NULL );
+
+	g_string_append( out, "{\n  \"nodes\": [" );
+	for( p = nodes; p; p = p->next ) {
+		VipsGraphNode *node = (VipsGraphNode *) p->data;
+		VipsImage *im = node->image;
+
+		g_string_append_printf( out, "%s\n    {\"id\": \"%p\", ",
+			p == nodes ? "" : ",", im );
+		g_string_append( out, "\"name\": " );
+		vips_graph_append_quoted( out, 
+			vips_graph_node_name( node ), TRUE );
+		g_string_append_printf( out,
+			", \"width\": %d, \"height\": %d, \"bands\": %d, "
+			"\"format\": \"%s\", \"dtype\": \"%s\", "
+			"\"demand\": \"%s\", "
+			"\"tile_width\": %d, \"tile_height\": %d, "
+			"\"n_lines\": %d, ",
+			im->Xsize, im->Ysize, im->Bands,
+			vips_enum_nick( VIPS_TYPE_BAND_FORMAT, im->BandFmt ),
+			vips_enum_nick( VIPS_TYPE_IMAGE_TYPE, im->dtype ),
+			vips_enum_nick( VIPS_TYPE_DEMAND_STYLE, im->dhint ),
+			node->tile_width, node->tile_height, node->n_lines );
+		g_string_append_printf( out,
+			"\"calls\": %" G_GUINT64_FORMAT ", "
+			"\"pixels\": %" G_GUINT64_FORMAT ", "
+			"\"time\": %" G_GUINT64_FORMAT ", "
+			"\"self_time\": %" G_GUINT64_FORMAT ", "
+			"\"sequences\": %d, "
+			"\"max_tile_width\": %d, \"max_tile_height\": %d, "
+			"\"bytes_buffered\": %zd}",
+			node->stats.calls,
+			node->stats.pixels,
+			node->stats.time,
+			node->stats.self_time,
+			node->stats.sequences,
+			node->stats.tile_width,
+			node->stats.tile_height,
+			vips_graph_node_buffered( node ) );
+	}
+	g_string_append( out, "\n  ],\n  \"edges\": [" );
+
+	first = TRUE;
+	for( p = nodes; p; p = p->next ) {
+		VipsGraphNode *node = (VipsGraphNode *) p->data;
+
+		for( q = node->upstream; q; q = q->next ) {
+			g_string_append_printf( out,
+				"%s\n    {\"from\": \"%p\", \"to\": \"%p\"}",
+				first ? "" : ",", q->data, node->image );
+			first = FALSE;
+		}
+	}
+	g_string_append( out, "\n  ]\n}\n" );
+
+	vips_graph_nodes_free( nodes );
+
+	return( g_string_free( out, FALSE ) );
+}
+
+/**
+ * vips_image_graph_write: (method)
+ * @image: image to dump
+ * @filename: file to write to
+ *
+ * Write the pipeline behind @image to @filename. If @filename ends in
+ * `.json`, it's written with vips_image_graph_json(), otherwise it's
+ * written as DOT with vips_image_graph_dot().
+ *
+ * The `--vips-pipeline-graph` command-line flag and the
+ * `VIPS_PIPELINE_GRAPH` environment variable make vips call this for every
+ * pipeline as it finishes computing, so the file holds the last one.
+ *
+ * Returns: 0 on success, -1 on error.
+ */
+int
+vips_image_graph_write( VipsImage *image, const char *filename )
+{
+	char *graph;
+	FILE *fp;
+
+	if( vips_iscasepostfix( filename, ".json" ) )
+		graph = vips_image_graph_json( image );
+	else
+		graph = vips_image_graph_dot( image );
+
+	if( !(fp = vips__file_open_write( filename, TRUE )) ) {
+		g_free( graph );
+		return( -1 );
+	}
+
+	if( vips__file_write( graph, strlen( graph ), 1, fp ) ) {
+		fclose( fp );
+		g_free( graph );
+		return( -1 );
+	}
+
+	fclose( fp );
+	g_free( graph );
+
+	return( 0 );
+}
@@ -26,6 +26,11 @@
  * 	- return header enums as enums, not ints
  * 	- vips_image_get_*() all convert everything to target type if they can
  * 	- rename "field" as "name" in docs
+ * 14/10/18
+ * 	- images share a refcounted meta table, copied on write, so copying
+ * 	  fields down a pipeline is O(1)
+ * 	- make the exif-ifd* fields from the EXIF block on first use
+ * 	- pass the deadline down the pipeline
  */
 
 /*
@@ -214,19 +219,25 @@ vips_format_sizeof_unsafe( VipsBandFormat format )
 	return( vips__image_sizeof_bandformat[format] );
 }
 
+/* The meta table for an image, if any. It lives in VipsImagePrivate so that
+ * VipsImage keeps its size.
+ */
+#define META_TABLE( IMAGE ) \
+	(vips__image_private( (VipsImage *) (IMAGE) )->meta_table)
+
 #ifdef DEBUG
 /* Check that this meta is on the hash table.
  */
 static void *
-meta_sanity_on_hash( VipsMeta *meta, VipsImage *im )
+meta_sanity_on_hash( VipsMeta *meta, VipsMetaTable *table )
 {
 	VipsMeta *found;
 
-	if( meta->im != im )
-		printf( "*** field \"%s\" has incorrect im\n", 
+	if( meta->table != table )
+		printf( "*** field \"%s\" has incorrect table\n", 
 			meta->name );
 
-	if( !(found = g_hash_table_lookup( im->meta, meta->name )) )
+	if( !(found = g_hash_table_lookup( table->hash, meta->name )) )
 		printf( "*** field \"%s\" is on traverse but not in hash\n", 
 			meta->name );
 
@@ -238,17 +249,18 @@ meta_sanity_on_hash( VipsMeta *meta, VipsImage *im )
 }
 
 static void
-meta_sanity_on_traverse( const char *name, VipsMeta *meta, VipsImage *im )
+meta_sanity_on_traverse( const char *name, VipsMeta *meta, 
+	VipsMetaTable *table )
 {
 	if( meta->name != name )
 		printf( "*** field \"%s\" has incorrect name\n", 
 			meta->name );
 
-	if( meta->im != im )
-		printf( "*** field \"%s\" has incorrect im\n", 
+	if( meta->table != table )
+		printf( "*** field \"%s\" has incorrect table\n", 
 			meta->name );
 
-	if( !g_slist_find( im->meta_traverse, meta ) )
+	if( !g_slist_find( table->traverse, meta ) )
 		printf( "*** field \"%s\" is in hash but not on traverse\n", 
 			meta->name );
 }
@@ -256,11 +268,23 @@ meta_sanity_on_traverse( const char *name, VipsMeta *meta, VipsImage *im )
 static void
 meta_sanity( const VipsImage *im )
 {
-	if( im->meta )
-		g_hash_table_foreach( im->meta, 
-			(GHFunc) meta_sanity_on_traverse, (void *) im );
-	vips_slist_map2( im->meta_traverse, 
-		(VipsSListMap2Fn) meta_sanity_on_hash, (void *) im, NULL );
+	VipsMetaTable *table = META_TABLE( im );
+
+	if( !table ) {
+		if( im->meta || 
+			im->meta_traverse )
+			printf( "*** image has meta but no table\n" );
+		return;
+	}
+
+	if( im->meta != table->hash ||
+		im->meta_traverse != table->traverse )
+		printf( "*** image meta is out of sync with table\n" );
+
+	g_hash_table_foreach( table->hash, 
+		(GHFunc) meta_sanity_on_traverse, table );
+	vips_slist_map2( table->traverse, 
+		(VipsSListMap2Fn) meta_sanity_on_hash, table, NULL );
 }
 #endif /*DEBUG*/
 
@@ -278,22 +302,24 @@ meta_free( VipsMeta *meta )
 }
 #endif /*DEBUG*/
 
-	if( meta->im )
-		meta->im->meta_traverse = 
-			g_slist_remove( meta->im->meta_traverse, meta );
+	if( meta->table )
+		meta->table->traverse = 
+			g_slist_remove( meta->table->traverse, meta );
 
 	g_value_unset( &meta->value );
 	g_free( meta->name );
 	g_free( meta );
 }
 
+/* Make a VipsMeta, but don't attach it to anything.
+ */
 static VipsMeta *
-meta_new( VipsImage *image, const char *name, GValue *value )
+meta_new_detached( const char *name, const GValue *value )
 {
 	VipsMeta *meta;
 
 	meta = g_new( VipsMeta, 1 );
-	meta->im = image;
+	meta->table = NULL;
 	meta->name = NULL;
 	memset( &meta->value, 0, sizeof( GValue ) );
 	meta->name = g_strdup( name );
@@ -314,9 +340,6 @@ meta_new( VipsImage *image, const char *name, GValue *value )
 	 */
 	(void) g_value_transform( value, &meta->value );
 
-	image->meta_traverse = g_slist_append( image->meta_traverse, meta );
-	g_hash_table_replace( image->meta, meta->name, meta ); 
-
 #ifdef DEBUG
 {
 	char *str_value;
@@ -330,23 +353,135 @@ meta_new( VipsImage *image, const char *name, GValue *value )
 	return( meta );
 }
 
+static VipsMetaTable *
+meta_table_new( void )
+{
+	VipsMetaTable *table;
+
+	table = g_new( VipsMetaTable, 1 );
+	table->ref_count = 1;
+	table->hash = g_hash_table_new_full( g_str_hash, g_str_equal,
+		NULL, (GDestroyNotify) meta_free );
+	table->traverse = NULL;
+
+	return( table );
+}
+
+static void
+meta_table_unref( VipsMetaTable *table )
+{
+	g_assert( table->ref_count > 0 );
+
+	if( g_atomic_int_dec_and_test( &table->ref_count ) ) {
+		g_hash_table_destroy( table->hash );
+		g_assert( !table->traverse );
+		g_free( table );
+	}
+}
+
+/* Copy a table, keeping traverse order. The values are copied with 
+ * g_value_copy(), so big things like blobs are shared, not duplicated.
+ */
+static VipsMetaTable *
+meta_table_copy( VipsMetaTable *table )
+{
+	VipsMetaTable *copy;
+	GSList *p;
+
+	copy = meta_table_new();
+	for( p = table->traverse; p; p = p->next ) {
+		VipsMeta *meta = (VipsMeta *) p->data;
+		VipsMeta *meta_copy = meta_new_detached( meta->name, 
+			&meta->value );
+
+		meta_copy->table = copy;
+		copy->traverse = g_slist_prepend( copy->traverse, meta_copy );
+		g_hash_table_replace( copy->hash, meta_copy->name, meta_copy ); 
+	}
+	copy->traverse = g_slist_reverse( copy->traverse );
+
+	return( copy );
+}
+
+/* The public meta and meta_traverse fields on the image are just a view of
+ * the table, update them after any change.
+ */
+static void
+meta_sync( VipsImage *image )
+{
+	VipsMetaTable *table = META_TABLE( image );
+
+	if( table ) {
+		image->meta = table->hash;
+		image->meta_traverse = table->traverse;
+	}
+	else {
+		image->meta = NULL;
+		image->meta_traverse = NULL;
+	}
+}
+
+/* Make sure @image has a table it can change: make one if there's none, 
+ * copy it if it's shared.
+ */
+static VipsMetaTable *
+meta_writeable( VipsImage *image )
+{
+	VipsImagePrivate *private = vips__image_private( image );
+
+	if( !private->meta_table ) 
+		private->meta_table = meta_table_new();
+	else if( g_atomic_int_get( &private->meta_table->ref_count ) > 1 ) {
+		VipsMetaTable *copy = meta_table_copy( private->meta_table );
+
+		meta_table_unref( private->meta_table );
+		private->meta_table = copy;
+	}
+	meta_sync( image );
+
+	return( private->meta_table );
+}
+
+/* Set a field, replacing any old value.
+ */
+static VipsMeta *
+meta_new( VipsImage *image, const char *name, const GValue *value )
+{
+	VipsMetaTable *table = meta_writeable( image );
+	VipsMeta *meta = meta_new_detached( name, value );
+
+	/* Remove any old field before we append, so traverse stays in
+	 * set order and meta_free() doesn't have to search far.
+	 */
+	g_hash_table_remove( table->hash, name ); 
+
+	meta->table = table;
+	table->traverse = g_slist_append( table->traverse, meta );
+	g_hash_table_replace( table->hash, meta->name, meta ); 
+	meta_sync( image );
+
+	return( meta );
+}
+
 /* Destroy all the meta on an image.
  */
 void
 vips__meta_destroy( VipsImage *image )
 {
-	VIPS_FREEF( g_hash_table_destroy, image->meta );
-	g_assert( !image->meta_traverse );
+	VIPS_FREEF( meta_table_unref, META_TABLE( image ) );
+	meta_sync( image );
 }
 
+/* Share @table with @image, dropping any meta @image had before. This is
+ * the fast path for copying meta down a pipeline.
+ */
 static void
-meta_init( VipsImage *im )
+meta_share( VipsImage *image, VipsMetaTable *table )
 {
-	if( !im->meta ) {
-		g_assert( !im->meta_traverse );
-		im->meta = g_hash_table_new_full( g_str_hash, g_str_equal,
-			NULL, (GDestroyNotify) meta_free );
-	}
+	g_atomic_int_inc( &table->ref_count );
+	VIPS_FREEF( meta_table_unref, META_TABLE( image ) );
+	META_TABLE( image ) = table;
+	meta_sync( image );
 }
 
 /**
@@ -860,28 +995,151 @@ meta_cp_field( VipsMeta *meta, VipsImage *dst )
 	return( NULL );
 }
 
-/* Copy meta on to dst. 
+/* Copy meta on to dst. If dst has no meta of its own we can just share
+ * src's table, otherwise we have to merge field by field.
  */
 static int
 meta_cp( VipsImage *dst, const VipsImage *src )
 {
-	if( src->meta ) {
-		/* Loop, copying fields.
-		 */
-		meta_init( dst );
-		vips_slist_map2( src->meta_traverse,
+	VipsMetaTable *table = META_TABLE( src );
+
+	if( !table ||
+		!table->traverse ||
+		table == META_TABLE( dst ) )
+		return( 0 );
+
+	if( !META_TABLE( dst ) ||
+		!META_TABLE( dst )->traverse ) 
+		meta_share( dst, table );
+	else 
+		vips_slist_map2( table->traverse,
 			(VipsSListMap2Fn) meta_cp_field, dst, NULL );
-	}
+
+#ifdef DEBUG
+	meta_sanity( dst );
+#endif /*DEBUG*/
 
 	return( 0 );
 }
 
+/* Qdata for the lazy exif-ifd* state. We keep it off the image struct so 
+ * VipsImage doesn't change size.
+ */
+static GQuark meta_exif_pending_quark = 0;
+static GQuark meta_retired_quark = 0;
+
+/* Expansions are rare, so one lock for all images is fine.
+ */
+static GMutex *meta_exif_lock = NULL;
+
+static void *
+meta_exif_init( void *client )
+{
+	meta_exif_pending_quark = 
+		g_quark_from_static_string( "vips-exif-pending" );
+	meta_retired_quark = 
+		g_quark_from_static_string( "vips-meta-retired" );
+	meta_exif_lock = vips_g_mutex_new();
+
+	return( NULL );
+}
+
+static void
+meta_exif_once( void )
+{
+	static GOnce once = G_ONCE_INIT;
+
+	VIPS_ONCE( &once, meta_exif_init, NULL );
+}
+
+void
+vips__exif_set_pending( VipsImage *image, gboolean pending )
+{
+	meta_exif_once();
+
+	g_object_set_qdata( G_OBJECT( image ), meta_exif_pending_quark, 
+		GINT_TO_POINTER( pending ) );
+}
+
+gboolean
+vips__exif_get_pending( const VipsImage *image )
+{
+	meta_exif_once();
+
+	return( GPOINTER_TO_INT( g_object_get_qdata( G_OBJECT( image ), 
+		meta_exif_pending_quark ) ) );
+}
+
+static void
+meta_retired_free( GSList *retired )
+{
+	g_slist_free_full( retired, (GDestroyNotify) meta_table_unref );
+}
+
+/* The exif-ifd* fields are made from the EXIF block the first time anyone
+ * looks for one, see vips__exif_expand(). A NULL name means all fields.
+ *
+ * The image can be shared between threads and other threads can be reading
+ * its meta table while we do this, so we expand into a copy and then swap
+ * it in. The old table is kept until the image is finalized, since other 
+ * threads may still be looking at it.
+ */
+static void
+meta_exif_expand( const VipsImage *image, const char *name )
+{
+	VipsImage *im = (VipsImage *) image;
+
+	if( !(!name ||
+		 vips_isprefix( "exif-ifd", name )) ||
+		!vips__exif_get_pending( image ) )
+		return;
+
+	g_mutex_lock( meta_exif_lock );
+
+	/* Another thread may have expanded while we waited.
+	 */
+	if( vips__exif_get_pending( image ) ) {
+		VipsImage *scratch = vips_image_new();
+		VipsImage *in[2] = { im, NULL };
+
+		(void) vips__image_copy_fields_array( scratch, in );
+		vips__exif_set_pending( scratch, FALSE );
+		vips__exif_expand( scratch );
+
+		if( META_TABLE( scratch ) &&
+			META_TABLE( scratch ) != META_TABLE( im ) ) {
+			GSList *retired;
+
+			retired = g_object_steal_qdata( G_OBJECT( im ), 
+				meta_retired_quark );
+			if( META_TABLE( im ) )
+				retired = g_slist_prepend( retired, 
+					META_TABLE( im ) );
+			g_object_set_qdata_full( G_OBJECT( im ), 
+				meta_retired_quark, retired, 
+				(GDestroyNotify) meta_retired_free );
+
+			g_atomic_int_inc( &META_TABLE( scratch )->ref_count );
+			META_TABLE( im ) = META_TABLE( scratch );
+			meta_sync( im );
+		}
+
+		g_object_unref( scratch );
+
+		vips__exif_set_pending( im, FALSE );
+	}
+
+	g_mutex_unlock( meta_exif_lock );
+}
+
 /* We have to have this as a separate entry point so we can support the old
  * vips7 API.
  */
 int 
 vips__image_copy_fields_array( VipsImage *out, VipsImage *in[] )
 {
+	VipsImagePrivate *private = vips__image_private( out );
+
 	int i;
 	int ni;
 
@@ -919,6 +1177,23 @@ vips__image_copy_fields_array( VipsImage *out, VipsImage *in[] )
 		if( meta_cp( out, in[i] ) )
 			return( -1 );
 
+	/* Any unexpanded EXIF comes along too.
+	 */
+	for( i = 0; i < ni; i++ )
+		if( vips__exif_get_pending( in[i] ) )
+			vips__exif_set_pending( out, TRUE );
+
+	/* The earliest deadline wins, see vips_image_set_deadline().
+	 */
+	for( i = 0; i < ni; i++ ) {
+		gint64 deadline = vips__image_private( in[i] )->deadline;
+
+		if( deadline &&
+			(!private->deadline ||
+			 deadline < private->deadline) )
+			private->deadline = deadline;
+	}
+
 	/* Merge hists first to last.
 	 */
 	for( i = 0; in[i]; i++ )
@@ -958,7 +1233,10 @@ vips_image_set( VipsImage *image, const char *name, GValue *value )
 	g_assert( name );
 	g_assert( value );
 
-	meta_init( image );
+	/* Expand first, so we override the value from the EXIF block.
+	 */
+	meta_exif_expand( image, name );
+
 	(void) meta_new( image, name, value );
 
 	/* If we're setting an EXIF data block, we need to automatically expand 
@@ -1079,6 +1357,7 @@ vips_image_get( const VipsImage *image, const char *name, GValue *value_copy )
 		}
 	}
 
+	meta_exif_expand( image, name );
 	if( image->meta && 
 		(meta = g_hash_table_lookup( image->meta, name )) ) {
 		g_value_init( value_copy, G_VALUE_TYPE( &meta->value ) );
@@ -1127,6 +1406,7 @@ vips_image_get_typeof( const VipsImage *image, const char *name )
 			return( g_type_from_name( field->type ) ); 
 	}
 
+	meta_exif_expand( image, name );
 	if( image->meta && 
 		(meta = g_hash_table_lookup( image->meta, name )) ) 
 		return( G_VALUE_TYPE( &meta->value ) );
@@ -1151,17 +1431,31 @@ vips_image_get_typeof( const VipsImage *image, const char *name )
 gboolean
 vips_image_remove( VipsImage *image, const char *name )
 {
-	if( image->meta && 
-		g_hash_table_remove( image->meta, name ) )
-		return( TRUE );
+	VipsMetaTable *table;
+
+	meta_exif_expand( image, name );
+
+	/* Only unshare the table if there's something to remove.
+	 */
+	if( !META_TABLE( image ) ||
+		!g_hash_table_lookup( META_TABLE( image )->hash, name ) )
+		return( FALSE );
 
-	return( FALSE );
+	table = meta_writeable( image );
+	(void) g_hash_table_remove( table->hash, name );
+	meta_sync( image );
+
+	return( TRUE );
 }
 
+/* meta can be shared between images, so we must pass the image down
+ * rather than getting it from the meta.
+ */
 static void *
-vips_image_map_fn( VipsMeta *meta, VipsImageMapFn fn, void *a )
+vips_image_map_fn( VipsMeta *meta, 
+	VipsImage *image, VipsImageMapFn fn, void *a, void *b )
 {
-	return( fn( meta->im, meta->name, &meta->value, a ) );
+	return( fn( image, meta->name, &meta->value, a ) );
 }
 
 /**
@@ -1187,6 +1481,8 @@ vips_image_map( VipsImage *image, VipsImageMapFn fn, void *a )
 	GValue value = { 0 };
 	void *result;
 
+	meta_exif_expand( image, NULL );
+
 	for( i = 0; i < VIPS_NUMBER( vips_header_fields ); i++ ) {
 		HeaderField *field = &vips_header_fields[i];
 
@@ -1199,8 +1495,9 @@ vips_image_map( VipsImage *image, VipsImageMapFn fn, void *a )
 	}
 
 	if( image->meta_traverse && 
-		(result = vips_slist_map2( image->meta_traverse, 
-			(VipsSListMap2Fn) vips_image_map_fn, fn, a )) )
+		(result = vips_slist_map4( image->meta_traverse, 
+			(VipsSListMap4Fn) vips_image_map_fn, 
+			image, fn, a, NULL )) )
 		return( result );
 
 	return( NULL );
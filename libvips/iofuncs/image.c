@@ -16,6 +16,21 @@
  * 	- more severing for vips_image_write()
  * 3/4/18
  * 	- better rules for hasalpha
+ * 14/10/18
+ * 	- add vips_image_write_async()
+ * 	- add vips_image_new_from_area() and vips_image_write_into_memory()
+ * 	  for refcounted and strided foreign memory
+ * 	- write the pipeline graph on posteval if requested
+ * 	- add vips_image_new_from_source(), vips_image_write_to_target()
+ * 	- VIPS_DISC_COMPRESS makes compressed tiled temp files
+ * 	- add vips_image_materialise()
+ * 	- add the ::preview signal
+ * 	- add vips_image_write_area() and vips_image_assemble_parts()
+ * 	- add vips_image_set_deadline()
+ * 	- ::eval is sent at most every 100ms
+ * 	- add vips_image_new_from_memory_notify()
+ * 	- vips_image_inplace() refuses strided foreign memory
+ * 	- keep private state in VipsImagePrivate, off the public struct
  */
 
 /*
@@ -372,6 +387,7 @@ enum {
 	SIG_WRITTEN,		
 	SIG_INVALIDATE,		
 	SIG_MINIMISE,		
+	SIG_PREVIEW,
 	SIG_LAST
 };
 
@@ -379,6 +395,21 @@ enum {
  */
 int vips__progress = 0;
 
+/* Send ::eval at most this often, in microseconds.
+ */
+#define VIPS_PROGRESS_INTERVAL (100000)
+
+/* Our private progress state. The public part must be first so that 
+ * image->time can point to this, and VipsProgress keeps its size.
+ */
+typedef struct _VipsProgressPrivate {
+	VipsProgress progress;
+
+	/* g_get_monotonic_time() of the last ::eval.
+	 */
+	gint64 last_eval;
+} VipsProgressPrivate;
+
 /* A string giving the image size (in bytes of uncompressed image) above which 
  * we decompress to disc on open.  Can be eg. "12m" for 12 megabytes.
  */
@@ -386,8 +417,23 @@ char *vips__disc_threshold = NULL;
 
 static guint vips_image_signals[SIG_LAST] = { 0 };
 
+/* VipsImagePrivate hangs off each image with this.
+ */
+static GQuark vips_image_private_quark = 0;
+
 G_DEFINE_TYPE( VipsImage, vips_image, VIPS_TYPE_OBJECT );
 
+/* Get the private state for an image. This is made in _init() and freed
+ * after _finalize().
+ */
+VipsImagePrivate *
+vips__image_private( VipsImage *image )
+{
+	return( (VipsImagePrivate *) 
+		g_object_get_qdata( G_OBJECT( image ), 
+			vips_image_private_quark ) );
+}
+
 /**
  * vips_progress_set:
  * @progress: %TRUE to enable progress messages
@@ -504,6 +550,10 @@ vips_image_dispose( GObject *gobject )
 
 	vips_object_preclose( VIPS_OBJECT( gobject ) );
 
+	/* Spare regions hold no ref to us, so they can still be around.
+	 */
+	vips__region_pool_drain( image );
+
 	/* We have to junk the fd in dispose, since we run this for rewind and
 	 * we must close and reopen the file when we switch from write to
 	 * read.
@@ -1089,6 +1139,9 @@ vips_image_class_init( VipsImageClass *class )
 	 */
 	vips_check_init(); 
 
+	vips_image_private_quark = 
+		g_quark_from_static_string( "vips-image-private" ); 
+
 	gobject_class->finalize = vips_image_finalize;
 	gobject_class->dispose = vips_image_dispose;
 	gobject_class->set_property = vips_object_set_property;
@@ -1356,6 +1409,33 @@ vips_image_class_init( VipsImageClass *class )
 		g_cclosure_marshal_VOID__VOID,
 		G_TYPE_NONE, 0 );
 
+	/**
+	 * VipsImage::preview:
+	 * @image: the image being loaded
+	 * @snapshot: a partial decode of @image
+	 *
+	 * The ::preview signal is emitted by loaders which can decode
+	 * progressively, such as jpegload for progressive JPEG and pngload
+	 * for interlaced PNG. Each time another scan or pass has been
+	 * decoded, @snapshot is a complete image of the same size as
+	 * @image, but at lower quality.
+	 *
+	 * @snapshot stays valid while the handler runs. Ref it, or copy
+	 * the pixels, to keep it. The signal may be emitted from a worker
+	 * thread.
+	 *
+	 * Loaders only use the slower progressive decode if a handler is
+	 * connected when the load starts, see vips_image_preview_wanted().
+	 */
+	vips_image_signals[SIG_PREVIEW] = g_signal_new( "preview",
+		G_TYPE_FROM_CLASS( class ),
+		G_SIGNAL_RUN_LAST,
+		G_STRUCT_OFFSET( VipsImageClass, preview ),
+		NULL, NULL,
+		g_cclosure_marshal_VOID__OBJECT,
+		G_TYPE_NONE, 1,
+		VIPS_TYPE_IMAGE );
+
 }
 
 static void
@@ -1381,6 +1461,9 @@ vips_image_init( VipsImage *image )
 
 	image->mode = g_strdup( "p" );
 
+	g_object_set_qdata_full( G_OBJECT( image ), vips_image_private_quark, 
+		g_new0( VipsImagePrivate, 1 ), (GDestroyNotify) g_free ); 
+
 #ifdef DEBUG_LEAK
 	g_object_set_qdata_full( G_OBJECT( image ), vips__image_pixels_quark, 
 		g_new0( VipsImagePixels, 1 ), (GDestroyNotify) g_free ); 
@@ -1473,6 +1556,52 @@ vips_image_minimise_all( VipsImage *image )
 		(VipsSListMap2Fn) vips_image_minimise_all_cb, NULL, NULL );
 }
 
+/* Loaders decode to an internal image, and (like eval signals) previews
+ * appear on the image the user can see.
+ */
+static VipsImage *
+vips_image_preview_target( VipsImage *image )
+{
+	return( image->progress_signal ? image->progress_signal : image );
+}
+
+/**
+ * vips_image_preview_wanted: (method)
+ * @image: image being loaded
+ *
+ * Loaders call this to decide whether to decode progressively.
+ *
+ * See also: vips_image_preview().
+ *
+ * Returns: %TRUE if there are handlers for #VipsImage::preview on @image.
+ */
+gboolean
+vips_image_preview_wanted( VipsImage *image )
+{
+	return( g_signal_has_handler_pending(
+		vips_image_preview_target( image ),
+		vips_image_signals[SIG_PREVIEW], 0, FALSE ) );
+}
+
+/**
+ * vips_image_preview: (method)
+ * @image: image being loaded
+ * @snapshot: partial decode of @image
+ *
+ * Loaders call this to emit #VipsImage::preview with a partial decode of
+ * @image.
+ *
+ * See also: vips_image_preview_wanted().
+ */
+void
+vips_image_preview( VipsImage *image, VipsImage *snapshot )
+{
+	VIPS_DEBUG_MSG( "vips_image_preview: %p\n", image );
+
+	g_signal_emit( vips_image_preview_target( image ),
+		vips_image_signals[SIG_PREVIEW], 0, snapshot );
+}
+
 /* Attach a new time struct, if necessary, and reset it.
  */
 static int
@@ -1483,8 +1612,11 @@ vips_progress_add( VipsImage *image )
 	VIPS_DEBUG_MSG( "vips_progress_add: %p\n", image );
 
 	if( !(progress = image->time) ) {
-		if( !(image->time = VIPS_NEW( NULL, VipsProgress )) )
+		VipsProgressPrivate *private;
+
+		if( !(private = VIPS_NEW( NULL, VipsProgressPrivate )) )
 			return( -1 );
+		image->time = &private->progress;
 		progress = image->time;
 
 		progress->im = image;
@@ -1500,6 +1632,7 @@ vips_progress_add( VipsImage *image )
 	progress->tpels = VIPS_IMAGE_N_PELS( image );
 	progress->npels = 0;
 	progress->percent = 0;
+	((VipsProgressPrivate *) progress)->last_eval = 0;
 
 	return( 0 );
 }
@@ -1555,6 +1688,11 @@ vips_image_eval( VipsImage *image, guint64 processed )
 {
 	if( image->progress_signal &&
 		image->time ) {
+		VipsProgressPrivate *private = 
+			(VipsProgressPrivate *) image->time;
+
+		gint64 now;
+
 		VIPS_DEBUG_MSG( "vips_image_eval: %p\n", image );
 
 		g_assert( vips_object_sanity( 
@@ -1570,6 +1708,17 @@ vips_image_eval( VipsImage *image, guint64 processed )
 			vips_progress_update( image->progress_signal->time, 
 				processed );
 
+		/* Sinks call us for every tile, and a signal emission costs
+		 * much more than a tile of a cheap pipeline. Throttle the 
+		 * signal to something a progress bar can use, but always 
+		 * send the final one.
+		 */
+		now = g_get_monotonic_time();
+		if( processed < image->time->tpels &&
+			now - private->last_eval < VIPS_PROGRESS_INTERVAL )
+			return;
+		private->last_eval = now;
+
 		if( !vips_image_get_typeof( image, "hide-progress" ) )
 			g_signal_emit( image->progress_signal, 
 				vips_image_signals[SIG_EVAL], 0, 
@@ -1580,6 +1729,10 @@ vips_image_eval( VipsImage *image, guint64 processed )
 void
 vips_image_posteval( VipsImage *image )
 {
+	if( vips__pipeline_graph &&
+		vips_image_graph_write( image, vips__pipeline_graph ) ) 
+		g_warning( "%s", vips_error_buffer() ); 
+
 	if( image->progress_signal &&
 		image->progress_signal->time ) { 
 		VIPS_DEBUG_MSG( "vips_image_posteval: %p\n", image );
@@ -1618,6 +1771,36 @@ vips_image_set_progress( VipsImage *image, gboolean progress )
 }
 
 
+/**
+ * vips_image_set_deadline: (method)
+ * @image: image to limit
+ * @seconds: time allowed from now, or 0 to remove the deadline
+ *
+ * Computation of @image will fail if it is still running @seconds from now.
+ * Use this to stop work on requests which have already timed out.
+ *
+ * The deadline is checked between tiles, like vips_image_set_kill(), and
+ * also within long-running generate functions and loaders, see
+ * vips_thread_iskilled(), so a single slow tile can be interrupted.
+ *
+ * The deadline passes down the pipeline, so you can set it on the input
+ * image and it'll apply to everything you make from it, including any
+ * conversions savers make before they write.
+ *
+ * See also: vips_image_set_kill(), vips_image_iskilled().
+ */
+void
+vips_image_set_deadline( VipsImage *image, double seconds )
+{
+	VipsImagePrivate *private = vips__image_private( image );
+
+	if( seconds > 0 )
+		private->deadline = g_get_monotonic_time() +
+			seconds * G_USEC_PER_SEC;
+	else
+		private->deadline = 0;
+}
+
 /**
  * vips_image_iskilled: (method)
  * @image: image to test
@@ -1625,6 +1808,9 @@ vips_image_set_progress( VipsImage *image, gboolean progress )
  * If @image has been killed (see vips_image_set_kill()), set an error message,
  * clear the #VipsImage.kill flag and return %FALSE. Otherwise return %TRUE.
  *
+ * An image whose deadline has passed (see vips_image_set_deadline()) also
+ * counts as killed.
+ *
  * Handy for loops which need to run sets of threads which can fail. 
  *
  * See also: vips_image_set_kill().
@@ -1634,6 +1820,8 @@ vips_image_set_progress( VipsImage *image, gboolean progress )
 gboolean
 vips_image_iskilled( VipsImage *image )
 {
+	gint64 deadline = vips__image_private( image )->deadline;
+
 	gboolean kill;
 
 	kill = image->kill;
@@ -1651,6 +1839,13 @@ vips_image_iskilled( VipsImage *image )
 		 */
 		vips_image_set_kill( image, FALSE );
 	}
+	else if( deadline &&
+		g_get_monotonic_time() > deadline ) {
+		vips_error( "VipsImage",
+			_( "deadline passed for image \"%s\"" ),
+			image->filename );
+		kill = TRUE;
+	}
 
 	return( kill );
 }
@@ -2057,6 +2252,187 @@ vips_image_new_from_memory( const void *data, size_t size,
 	return( image );
 }
 
+static void
+vips_image_new_from_area_cb( VipsImage *image, VipsArea *area )
+{
+	vips_area_unref( area );
+}
+
+/* Bytes between the start of lines in image memory. Only foreign memory,
+ * see vips_image_new_from_area(), can have padding between lines.
+ */
+size_t
+vips__image_stride( VipsImage *image )
+{
+	VipsImagePrivate *private = vips__image_private( image );
+
+	return( private->stride ? 
+		private->stride : VIPS_IMAGE_SIZEOF_LINE( image ) );
+}
+
+/**
+ * vips_image_new_from_area: (constructor)
+ * @area: (transfer none): memory to wrap
+ * @stride: bytes between the start of lines, 0 for packed lines
+ * @width: image width
+ * @height: image height
+ * @bands: image bands (or bytes per pixel)
+ * @format: image format
+ *
+ * Like vips_image_new_from_memory(), but the memory is held by a refcounted
+ * #VipsArea. The image takes a ref to @area and drops it on close, so the
+ * area's free function runs when the last image using it has gone. This lets
+ * you hand buffers you don't own, such as decoded video frames, to a 
+ * pipeline with no copy and no guessing about lifetime. For example:
+ *
+ * |[
+ * VipsArea *area = vips_area_new( (VipsCallbackFn) my_frame_free, frame );
+ * VipsImage *image = vips_image_new_from_area( area, frame->pitch,
+ *   frame->width, frame->height, 4, VIPS_FORMAT_UCHAR );
+ * vips_area_unref( area );
+ * ]|
+ *
+ * Lines can be @stride bytes apart, for example to allow for alignment 
+ * padding. Set @stride to 0 for packed lines. Regions on the image
+ * point straight at the memory, see vips_region_image(), so pipelines 
+ * never copy it. Operations which need the whole image with packed lines, 
+ * see vips_image_wio_input(), will make a packed copy. In-place 
+ * operations, see vips_image_inplace(), can't work on a copy, so they fail
+ * on strided images.
+ *
+ * If @area->length is set, it is checked against the image size.
+ *
+ * See also: vips_image_new_from_memory(), vips_area_new(),
+ * vips_image_write_into_memory().
+ *
+ * Returns: (transfer full): the new #VipsImage, or %NULL on error.
+ */
+VipsImage *
+vips_image_new_from_area( VipsArea *area, size_t stride,
+	int width, int height, int bands, VipsBandFormat format )
+{
+	VipsImage *image;
+	size_t sizeof_line;
+	guint64 size;
+
+	vips_check_init();
+
+	if( !(image = vips_image_new_from_memory( area->data, 0, 
+		width, height, bands, format )) )
+		return( NULL );
+
+	sizeof_line = VIPS_IMAGE_SIZEOF_LINE( image );
+	if( stride > 0 &&
+		stride < sizeof_line ) {
+		vips_error( "VipsImage",
+			_( "stride too small --- should be at least "
+				"%zd bytes, you passed %zd" ),
+			sizeof_line, stride ); 
+		VIPS_UNREF( image );
+		return( NULL );
+	}
+	if( stride != sizeof_line )
+		vips__image_private( image )->stride = stride;
+
+	size = (guint64) vips__image_stride( image ) * (height - 1) + 
+		sizeof_line;
+	if( area->length > 0 && 
+		area->length < size ) {
+		vips_error( "VipsImage",
+			_( "memory area too small --- "
+				"should be %zd bytes, you passed %zd" ),
+			(size_t) size, area->length ); 
+		VIPS_UNREF( image );
+		return( NULL );
+	}
+
+	vips_area_copy( area );
+	g_signal_connect( image, "close", 
+		G_CALLBACK( vips_image_new_from_area_cb ), area );
+
+	return( image );
+}
+
+typedef struct _VipsImageNotify {
+	VipsCallbackFn release;
+	void *data;
+	void *user_data;
+	GDestroyNotify destroy;
+} VipsImageNotify;
+
+static void
+vips_image_notify_free( VipsImageNotify *notify )
+{
+	if( notify->release )
+		notify->release( notify->data, notify->user_data );
+	if( notify->destroy )
+		notify->destroy( notify->user_data );
+	g_free( notify );
+}
+
+static void
+vips_image_new_from_memory_notify_cb( VipsImage *image,
+	VipsImageNotify *notify )
+{
+	vips_image_notify_free( notify );
+}
+
+/**
+ * vips_image_new_from_memory_notify: (constructor)
+ * @data: (type gpointer): start of the pixels
+ * @stride: bytes between the start of lines, 0 for packed lines
+ * @width: image width
+ * @height: image height
+ * @bands: image bands (or bytes per pixel)
+ * @format: image format
+ * @release: (scope notified) (closure user_data) (destroy destroy): called
+ *   with @data and @user_data when the image closes
+ * @user_data: (nullable): passed to @release
+ * @destroy: (nullable): called to free @user_data after @release
+ *
+ * Like vips_image_new_from_area(), but the owner of @data is told with a
+ * callback rather than by a #VipsArea. This is the form bindings can use
+ * to wrap memory they manage, for example a numpy array from Python, with
+ * no copy. The binding keeps @user_data alive until @destroy is called,
+ * and must not free or move @data before then.
+ *
+ * @destroy is called even if the image can't be made.
+ *
+ * See also: vips_image_new_from_area(), vips_image_get_data().
+ *
+ * Returns: (transfer full): the new #VipsImage, or %NULL on error.
+ */
+VipsImage *
+vips_image_new_from_memory_notify( void *data, size_t stride,
+	int width, int height, int bands, VipsBandFormat format,
+	VipsCallbackFn release, void *user_data, GDestroyNotify destroy )
+{
+	VipsImageNotify *notify;
+	VipsArea *area;
+	VipsImage *image;
+
+	notify = g_new( VipsImageNotify, 1 );
+	notify->release = release;
+	notify->data = data;
+	notify->user_data = user_data;
+	notify->destroy = destroy;
+
+	area = vips_area_new( NULL, data );
+	image = vips_image_new_from_area( area, stride,
+		width, height, bands, format );
+	vips_area_unref( area );
+	if( !image ) {
+		notify->release = NULL;
+		vips_image_notify_free( notify );
+		return( NULL );
+	}
+
+	g_signal_connect( image, "close",
+		G_CALLBACK( vips_image_new_from_memory_notify_cb ), notify );
+
+	return( image );
+}
+
 static void
 vips_image_new_from_memory_copy_cb( VipsImage *image, void *data_copy )
 {
@@ -2161,6 +2537,48 @@ vips_image_new_from_buffer( const void *buf, size_t len,
 	return( out ); 
 }
 
+/**
+ * vips_image_new_from_source: (constructor)
+ * @source: (transfer none): source to fetch image from
+ * @option_string: set of extra options as a string
+ * @...: %NULL-terminated list of optional named arguments
+ *
+ * Loads an image from the formatted source @source, using the loader
+ * recommended by vips_foreign_find_load_source().
+ *
+ * Load options may be given in @option_string as "[name=value,...]" or given as
+ * a NULL-terminated list of name-value pairs at the end of the arguments.
+ * Options given in the function call override options given in the string.
+ *
+ * See also: vips_image_write_to_target().
+ *
+ * Returns: (transfer full): the new #VipsImage, or %NULL on error.
+ */
+VipsImage *
+vips_image_new_from_source( VipsSource *source,
+	const char *option_string, ... )
+{
+	const char *operation_name;
+	va_list ap;
+	int result;
+	VipsImage *out;
+
+	vips_check_init();
+
+	if( !(operation_name = vips_foreign_find_load_source( source )) )
+		return( NULL );
+
+	va_start( ap, option_string );
+	result = vips_call_split_option_string( operation_name,
+		option_string, ap, source, &out );
+	va_end( ap );
+
+	if( result )
+		return( NULL );
+
+	return( out );
+}
+
 /**
  * vips_image_new_matrix: (constructor)
  * @width: image width
@@ -2438,6 +2856,27 @@ vips_get_disc_threshold( void )
 	return( threshold );
 }
 
+/* TRUE if temporary .v files should be compressed, see
+ * vips_image_new_temp_file().
+ */
+static gboolean
+vips_image_temp_compress( void )
+{
+	static gboolean done = FALSE;
+	static gboolean compress = FALSE;
+
+	if( !done ) {
+		done = TRUE;
+
+#ifdef HAVE_LZ4
+		if( g_getenv( "VIPS_DISC_COMPRESS" ) )
+			compress = TRUE;
+#endif /*HAVE_LZ4*/
+	}
+
+	return( compress );
+}
+
 /**
  * vips_image_new_temp_file: (constructor)
  * @format: format of file
@@ -2454,6 +2893,11 @@ vips_get_disc_threshold( void )
  * vips uses g_mkstemp() to make the temporary filename. They generally look
  * something like "vips-12-EJKJFGH.v".
  *
+ * If the environment variable VIPS_DISC_COMPRESS is set, temporary .v files
+ * are written as compressed tiles. This can make them much smaller, and
+ * often faster, since less data goes to and from the disc. It needs vips
+ * to have been built with lz4.
+ *
  * See also: vips_image_new().
  *
  * Returns: the new #VipsImage, or %NULL on error.
@@ -2478,6 +2922,15 @@ vips_image_new_temp_file( const char *format )
 
 	vips_image_set_delete_on_close( image, TRUE );
 
+	if( vips_image_temp_compress() &&
+		vips_iscasepostfix( format, ".v" ) ) {
+		VipsImagePrivate *private = vips__image_private( image );
+
+		private->tile_width = 128;
+		private->tile_height = 128;
+		image->Compression = VIPS__TILE_COMPRESSION_LZ4;
+	}
+
 	return( image );
 }
 
@@ -2557,6 +3010,219 @@ vips_image_write( VipsImage *image, VipsImage *out )
 	return( 0 );
 }
 
+/* An async write in progress.
+ */
+struct _VipsImageWriteAsync {
+	VipsImage *image;
+	VipsImage *out;
+
+	GMainContext *context;
+	VipsImageWriteAsyncFn fn;
+	void *a;
+
+	int result;
+};
+
+/* Writes waiting for a driver, and the number of drivers running. We run
+ * at most vips_concurrency_get() writes at once, each of which will use 
+ * that many workers.
+ */
+static GMutex *vips_image_write_async_lock = NULL;
+static GQueue vips_image_write_async_queue = G_QUEUE_INIT;
+static int vips_image_write_async_n_drivers = 0;
+
+static void *
+vips_image_write_async_init( void *data )
+{
+	vips_image_write_async_lock = vips_g_mutex_new();
+
+	return( NULL );
+}
+
+static void
+vips_image_write_async_free( VipsImageWriteAsync *async )
+{
+	VIPS_UNREF( async->image );
+	VIPS_UNREF( async->out );
+	VIPS_FREEF( g_main_context_unref, async->context );
+	g_free( async );
+}
+
+/* Runs in the caller's main context.
+ */
+static gboolean
+vips_image_write_async_done( void *data )
+{
+	VipsImageWriteAsync *async = (VipsImageWriteAsync *) data;
+
+	if( async->fn )
+		async->fn( async, async->result, async->a );
+
+	vips_image_write_async_free( async );
+
+	return( FALSE );
+}
+
+/* Runs on a pooled worker: write images from the queue until it's empty.
+ */
+static void *
+vips_image_write_async_driver( void *data )
+{
+	for(;;) {
+		VipsImageWriteAsync *async;
+		GSource *source;
+
+		g_mutex_lock( vips_image_write_async_lock );
+		if( !(async = g_queue_pop_head( 
+			&vips_image_write_async_queue )) ) 
+			vips_image_write_async_n_drivers -= 1;
+		g_mutex_unlock( vips_image_write_async_lock );
+
+		if( !async )
+			break;
+
+		async->result = vips_image_write( async->image, async->out );
+
+		source = g_idle_source_new();
+		g_source_set_callback( source, 
+			vips_image_write_async_done, async, NULL );
+		g_source_attach( source, async->context );
+		g_source_unref( source );
+	}
+
+	return( NULL );
+}
+
+/**
+ * VipsImageWriteAsyncFn:
+ * @async: the write that has finished
+ * @result: 0 on success, -1 on error 
+ * @a: user data
+ *
+ * Called in the #GMainContext passed to vips_image_write_async() when the
+ * write has finished. On error, see vips_error_buffer() for details. 
+ *
+ * @async is freed when this function returns.
+ */
+
+/**
+ * vips_image_write_async: (method)
+ * @image: image to write
+ * @out: write to this image
+ * @context: (nullable): call @fn in this context, or %NULL for the default
+ * @fn: (nullable): call this when the write is done
+ * @a: user data for @fn
+ *
+ * Start writing @image to @out in the background, exactly as 
+ * vips_image_write(), and return immediately. The write runs on the libvips
+ * worker pool, and when it finishes @fn is called from an idle source in 
+ * @context. One thread running a main loop can drive many writes at once in
+ * this way. 
+ *
+ * At most vips_concurrency_get() writes run at the same time, any more are 
+ * queued. 
+ *
+ * @image and @out are reffed for the duration of the write, so you can unref
+ * them as soon as this call returns. All writes must have finished before
+ * you call vips_shutdown().
+ *
+ * See also: vips_image_write_async_cancel(), vips_image_write().
+ *
+ * Returns: (transfer none): a handle for the write, or %NULL on error.
+ */
+VipsImageWriteAsync *
+vips_image_write_async( VipsImage *image, VipsImage *out, 
+	GMainContext *context, VipsImageWriteAsyncFn fn, void *a )
+{
+	static GOnce once = G_ONCE_INIT;
+
+	VipsImageWriteAsync *async;
+	gboolean start;
+
+	VIPS_ONCE( &once, vips_image_write_async_init, NULL );
+
+	async = g_new0( VipsImageWriteAsync, 1 );
+	async->image = image;
+	g_object_ref( image );
+	async->out = out;
+	g_object_ref( out );
+	async->context = g_main_context_ref( context ? 
+		context : g_main_context_default() );
+	async->fn = fn;
+	async->a = a;
+
+	g_mutex_lock( vips_image_write_async_lock );
+	g_queue_push_tail( &vips_image_write_async_queue, async );
+	start = vips_image_write_async_n_drivers < vips_concurrency_get();
+	if( start ) 
+		vips_image_write_async_n_drivers += 1;
+	g_mutex_unlock( vips_image_write_async_lock );
+
+	if( start &&
+		vips__worker_spawn( vips_image_write_async_driver, NULL ) ) {
+		gboolean queued;
+
+		g_mutex_lock( vips_image_write_async_lock );
+		vips_image_write_async_n_drivers -= 1;
+
+		/* Another driver may have picked up our write already. 
+		 */
+		queued = g_queue_remove( &vips_image_write_async_queue, 
+			async );
+		g_mutex_unlock( vips_image_write_async_lock );
+
+		if( queued ) {
+			vips_image_write_async_free( async );
+			return( NULL );
+		}
+	}
+
+	return( async );
+}
+
+/**
+ * vips_image_write_async_cancel: 
+ * @async: write to cancel
+ *
+ * Ask a write started by vips_image_write_async() to stop. This uses 
+ * vips_image_set_kill() on the source image, so the write fails soon after
+ * with an error, and the completion function sees a @result of -1. 
+ *
+ * Only call this from the thread running the write's #GMainContext, and only
+ * before the completion function has run.
+ *
+ * See also: vips_image_write_async(), vips_image_set_kill().
+ */
+void
+vips_image_write_async_cancel( VipsImageWriteAsync *async )
+{
+	vips_image_set_kill( async->image, TRUE );
+}
+
+/**
+ * vips_image_write_async_get_image: 
+ * @async: write to fetch from
+ *
+ * Returns: (transfer none): the image being written.
+ */
+VipsImage *
+vips_image_write_async_get_image( VipsImageWriteAsync *async )
+{
+	return( async->image );
+}
+
+/**
+ * vips_image_write_async_get_out: 
+ * @async: write to fetch from
+ *
+ * Returns: (transfer none): the image being written to.
+ */
+VipsImage *
+vips_image_write_async_get_out( VipsImageWriteAsync *async )
+{
+	return( async->out );
+}
+
 /**
  * vips_image_write_to_file: (method)
  * @image: image to write
@@ -2595,6 +3261,123 @@ vips_image_write_to_file( VipsImage *image, const char *name, ... )
 	return( result );
 }
 
+/**
+ * vips_image_write_area: (method)
+ * @image: image to write
+ * @area: the part of @image to compute
+ * @filename: write the part to this vips file
+ *
+ * Compute just @area of @image and write it to @filename, which must be a
+ * vips format file. Only the pixels in @area are calculated, so several
+ * machines can each render a band or a range of tiles of the same very
+ * large pipeline, and the parts can then be stitched together cheaply with
+ * vips_image_assemble_parts().
+ *
+ * The position of the part is recorded in the Xoffset and Yoffset image
+ * fields, and the size of the whole image in #VIPS_META_PART_WIDTH and
+ * #VIPS_META_PART_HEIGHT.
+ *
+ * See also: vips_image_assemble_parts(), vips_extract_area().
+ *
+ * Returns: 0 on success, or -1 on error.
+ */
+int
+vips_image_write_area( VipsImage *image,
+	VipsRect *area, const char *filename )
+{
+	VipsRect whole;
+	VipsRect clipped;
+	VipsImage *t[2];
+	int result;
+
+	whole.left = 0;
+	whole.top = 0;
+	whole.width = image->Xsize;
+	whole.height = image->Ysize;
+	vips_rect_intersectrect( area, &whole, &clipped );
+	if( vips_rect_isempty( &clipped ) ) {
+		vips_error( "VipsImage", "%s", _( "area outside image" ) );
+		return( -1 );
+	}
+
+	if( !vips_foreign_find_save( filename ) ||
+		strcmp( vips_foreign_find_save( filename ),
+			"VipsForeignSaveVips" ) != 0 ) {
+		vips_error( "VipsImage",
+			_( "\"%s\" is not a vips file" ), filename );
+		return( -1 );
+	}
+
+	if( vips_extract_area( image, &t[0],
+		clipped.left, clipped.top, clipped.width, clipped.height,
+		NULL ) )
+		return( -1 );
+	if( vips_copy( t[0], &t[1],
+		"xoffset", clipped.left,
+		"yoffset", clipped.top,
+		NULL ) ) {
+		g_object_unref( t[0] );
+		return( -1 );
+	}
+	g_object_unref( t[0] );
+
+	vips_image_set_int( t[1], VIPS_META_PART_WIDTH, image->Xsize );
+	vips_image_set_int( t[1], VIPS_META_PART_HEIGHT, image->Ysize );
+
+	result = vips_image_write_to_file( t[1], filename, NULL );
+
+	g_object_unref( t[1] );
+
+	return( result );
+}
+
+/**
+ * vips_image_assemble_parts:
+ * @filename: write the whole image to this vips file
+ * @parts: (array length=n): the part files
+ * @n: number of parts
+ *
+ * Stitch the parts made by vips_image_write_area() into a single vips file.
+ * The pixels are copied straight from the part files to their place in the
+ * output, nothing is decoded or computed, so this is about as fast as
+ * copying the files. Any areas no part covers are zero.
+ *
+ * The parts must all have the same number of bands, format and coding.
+ * Metadata is taken from the first part. Save the result to another
+ * format, tiff or deepzoom for example, in the usual way.
+ *
+ * See also: vips_image_write_area().
+ *
+ * Returns: 0 on success, or -1 on error.
+ */
+int
+vips_image_assemble_parts( const char *filename, const char **parts, int n )
+{
+	VipsImage **images;
+	int result;
+	int i;
+
+	images = VIPS_ARRAY( NULL, n + 1, VipsImage * );
+	for( i = 0; i < n + 1; i++ )
+		images[i] = NULL;
+
+	result = 0;
+	for( i = 0; i < n; i++ )
+		if( !(images[i] = vips_image_new_mode( parts[i], "r" )) ) {
+			result = -1;
+			break;
+		}
+
+	if( !result )
+		result = vips__assemble_parts( filename, images, n );
+
+	for( i = 0; i < n; i++ )
+		VIPS_UNREF( images[i] );
+	g_free( images );
+
+	return( result );
+}
+
 /**
  * vips_image_write_to_buffer: (method)
  * @in: image to write
@@ -2653,6 +3436,48 @@ vips_image_write_to_buffer( VipsImage *in,
 	return( result );
 }
 
+/**
+ * vips_image_write_to_target: (method)
+ * @in: image to write
+ * @suffix: format to write
+ * @target: target to write to
+ * @...: %NULL-terminated list of optional named arguments
+ *
+ * Writes @in to @target in a format specified by @suffix.
+ *
+ * Save options may be appended to @suffix as "[name=value,...]" or given as
+ * a NULL-terminated list of name-value pairs at the end of the arguments.
+ * Options given in the function call override options given in the suffix.
+ *
+ * You can call the various save operations directly if you wish, see
+ * vips_jpegsave_target(), for example.
+ *
+ * See also: vips_image_write_to_file(), vips_image_new_from_source().
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int
+vips_image_write_to_target( VipsImage *in,
+	const char *suffix, VipsTarget *target, ... )
+{
+	char filename[VIPS_PATH_MAX];
+	char option_string[VIPS_PATH_MAX];
+	const char *operation_name;
+	va_list ap;
+	int result;
+
+	vips__filename_split8( suffix, filename, option_string );
+	if( !(operation_name = vips_foreign_find_save_target( filename )) )
+		return( -1 );
+
+	va_start( ap, target );
+	result = vips_call_split_option_string( operation_name, option_string,
+		ap, in, target );
+	va_end( ap );
+
+	return( result );
+}
+
 /**
  * vips_image_write_to_memory: (method)
  * @in: image to write
@@ -2698,6 +3523,44 @@ vips_image_write_to_memory( VipsImage *in, size_t *size_out )
 	return( buf ); 
 }
 
+/**
+ * vips_image_write_into_memory: (method)
+ * @in: image to write
+ * @data: (array length=size) (element-type guint8) (transfer none): write here
+ * @size: (type gsize): length of memory area
+ * @stride: bytes between the start of lines, 0 for packed lines
+ *
+ * Like vips_image_write_to_memory(), but writes @in into memory you supply.
+ * Lines are written @stride bytes apart, so you can render straight into a 
+ * frame or texture buffer with a pitch. The pixels are computed by
+ * vips_sink_memory(), with no extra copy.
+ *
+ * See also: vips_image_write_to_memory(), vips_image_new_from_area().
+ *
+ * Returns: 0 on success, or -1 on error.
+ */
+int
+vips_image_write_into_memory( VipsImage *in, 
+	void *data, size_t size, size_t stride )
+{
+	VipsArea *area;
+	VipsImage *x;
+	int result;
+
+	area = vips_area_new( NULL, data );
+	area->length = size;
+	x = vips_image_new_from_area( area, stride, 
+		in->Xsize, in->Ysize, in->Bands, in->BandFmt );
+	vips_area_unref( area );
+	if( !x )
+		return( -1 );
+
+	result = vips_image_write( in, x );
+	g_object_unref( x );
+
+	return( result ); 
+}
+
 /**
  * vips_image_decode: (method)
  * @in: image to decode
@@ -2998,6 +3861,15 @@ vips_image_write_line( VipsImage *image, int ypos, VipsPel *linebuffer )
 	/* Is this the start of eval?
 	 */
 	if( ypos == 0 ) {
+		VipsImagePrivate *private = vips__image_private( image );
+
+		/* Lines are written in order straight to the file, so we
+		 * can't use the tiled layout.
+		 */
+		private->tile_width = 0;
+		private->tile_height = 0;
+		image->Compression = 0;
+
 		if( vips__image_wio_output( image ) )
 			return( -1 );
 
@@ -3014,7 +3886,8 @@ vips_image_write_line( VipsImage *image, int ypos, VipsPel *linebuffer )
 	switch( image->dtype ) {
 	case VIPS_IMAGE_SETBUF:
 	case VIPS_IMAGE_SETBUF_FOREIGN:
-		memcpy( VIPS_IMAGE_ADDR( image, 0, ypos ), 
+		memcpy( image->data + 
+			(guint64) ypos * vips__image_stride( image ), 
 			linebuffer, linesize );
 		break;
 
@@ -3165,6 +4038,111 @@ vips_image_copy_memory( VipsImage *image )
 	return( new );
 }
 
+static int
+vips_image_materialise_free( void *data, VipsArea *area )
+{
+	return( vips__munmap( data, area->length ) );
+}
+
+/* A memory image in its own anonymous mapping, so large images can get huge
+ * pages. Fall back to an ordinary memory image if we can't map.
+ */
+static VipsImage *
+vips_image_materialise_memory( VipsImage *image )
+{
+	size_t size = VIPS_IMAGE_SIZEOF_IMAGE( image );
+
+	void *data;
+	VipsArea *area;
+	VipsImage *new;
+
+	/* Only worth asking for huge pages if we'd fill at least one.
+	 */
+	if( !(data = vips__mmap_anonymous( size,
+		size >= 2 * 1024 * 1024 ? VIPS__MMAP_HUGEPAGE : 0 )) )
+		return( vips_image_new_memory() );
+
+	area = vips_area_new( (VipsCallbackFn) vips_image_materialise_free,
+		data );
+	area->length = size;
+	new = vips_image_new_from_area( area, 0,
+		image->Xsize, image->Ysize, image->Bands, image->BandFmt );
+	vips_area_unref( area );
+
+	return( new );
+}
+
+/**
+ * vips_image_materialise: (method)
+ * @image: image to compute
+ *
+ * Compute @image once, so that several pipelines can read the result without
+ * copying it and without computing @image again.
+ *
+ * If @image is already in memory or in a file, just ref and return.
+ * Otherwise, if @image is larger than vips_get_disc_threshold(), compute it
+ * to a temporary file, which is compressed if VIPS_DISC_COMPRESS is set,
+ * see vips_image_new_temp_file(). If not, compute it to memory. Large
+ * memory images get their own mapping and are given huge pages if the
+ * system supports them.
+ *
+ * The result is an ordinary #VipsImage, so it is reference counted, and
+ * the memory or file is freed when the last pipeline using it has gone.
+ * Regions on memory results point straight at the pixels, see
+ * vips_region_image(). Don't modify the result, other pipelines may be
+ * reading it.
+ *
+ * This operation is thread-safe.
+ *
+ * See also: vips_image_copy_memory(), vips_get_disc_threshold().
+ *
+ * Returns: (transfer full): the new #VipsImage, or %NULL on error.
+ */
+VipsImage *
+vips_image_materialise( VipsImage *image )
+{
+	VipsImage *new;
+
+	switch( image->dtype ) {
+	case VIPS_IMAGE_SETBUF:
+	case VIPS_IMAGE_SETBUF_FOREIGN:
+	case VIPS_IMAGE_MMAPIN:
+	case VIPS_IMAGE_MMAPINRW:
+	case VIPS_IMAGE_OPENIN:
+		/* Already computed.
+		 */
+		new = image;
+		g_object_ref( new );
+		break;
+
+	case VIPS_IMAGE_OPENOUT:
+	case VIPS_IMAGE_PARTIAL:
+		if( VIPS_IMAGE_SIZEOF_IMAGE( image ) >
+			vips_get_disc_threshold() )
+			new = vips_image_new_temp_file( "%s.v" );
+		else
+			new = vips_image_materialise_memory( image );
+		if( !new )
+			return( NULL );
+
+		/* Temp files need rewinding before we can read them.
+		 */
+		if( vips_image_write( image, new ) ||
+			vips_image_pio_input( new ) ) {
+			g_object_unref( new );
+			return( NULL );
+		}
+		break;
+
+	default:
+		vips_error( "vips_image_materialise",
+			"%s", _( "image not readable" ) );
+		return( NULL );
+	}
+
+	return( new );
+}
+
 /**
  * vips_image_wio_input: (method)
  * @image: image to transform
@@ -3208,6 +4186,27 @@ vips_image_wio_input( VipsImage *image )
 			return( -1 );
 		}
 
+		/* VIPS_IMAGE_ADDR() needs packed lines, so strided foreign 
+		 * memory must be copied. Regions which are already attached 
+		 * still point at the foreign memory, but that stays valid
+		 * until we close.
+		 */
+		if( vips__image_stride( image ) != 
+			VIPS_IMAGE_SIZEOF_LINE( image ) ) {
+			t1 = vips_image_new_memory();
+			if( vips_image_write( image, t1 ) ) {
+				g_object_unref( t1 );
+				return( -1 );
+			}
+
+			image->dtype = VIPS_IMAGE_SETBUF;
+			image->data = t1->data; 
+			vips__image_private( image )->stride = 0;
+			vips__image_private( image )->packed_copy = TRUE;
+			t1->data = NULL;
+			g_object_unref( t1 );
+		}
+
 		break;
 
 	case VIPS_IMAGE_MMAPIN:
@@ -3255,8 +4254,9 @@ vips_image_wio_input( VipsImage *image )
 		image->client2 = NULL;
 
 		/* ... and that may confuse any regions which are trying to
-		 * generate from this image.
+		 * generate from this image. Spare regions can just go.
 		 */
+		vips__region_pool_drain( image );
 		if( image->regions ) 
 			g_warning( "rewinding image with active regions" ); 
 
@@ -3361,6 +4361,16 @@ vips__image_wio_output( VipsImage *image )
 int
 vips_image_inplace( VipsImage *image )
 {
+	/* vips_image_wio_input() would make a packed copy of strided memory 
+	 * and draw operations would then never reach the caller's buffer.
+	 */
+	if( vips__image_stride( image ) != VIPS_IMAGE_SIZEOF_LINE( image ) ||
+		vips__image_private( image )->packed_copy ) {
+		vips_error( "vips_image_inplace", 
+			"%s", _( "can't draw on strided memory" ) );
+		return( -1 );
+	}
+
 	/* Do an vips_image_wio_input(). This will rewind, generate, etc.
 	 */
 	if( vips_image_wio_input( image ) ) 
@@ -28,6 +28,22 @@
  * 	- call _setmaxstdio() on win32
  * 4/8/17
  * 	- hide warnings is VIPS_WARNING is set
+ * 14/10/18
+ * 	- add --vips-vector-cache-max
+ * 	- add --vips-window-size, --vips-window-populate and
+ * 	  --vips-window-hugepage
+ * 	- add --vips-nofuse
+ * 	- add --vips-pipeline-graph
+ * 	- free the fft plan cache on shutdown
+ * 	- add --vips-gate-stats and VIPS_GATE_STATS
+ * 	- add --vips-pipeline-max-mem
+ * 	- add --vips-load-max-pixels, --vips-load-max-pages and
+ * 	  --vips-load-max-bytes
+ * 	- register operation packages on first use, add
+ * 	  vips_operation_init_all()
+ * 	- close the loader pool on shutdown
+ * 	- add --vips-accel
+ * 	- add VIPS_DISK_CACHE and VIPS_DISK_CACHE_MAX
  */
 
 /*
@@ -88,6 +104,8 @@
 #include <vips/thread.h>
 #include <vips/internal.h>
 #include <vips/vector.h>
+#include <vips/simd.h>
+#include <vips/accel.h>
 
 /* abort() on the first warning or error.
  */
@@ -165,9 +183,12 @@ vips_get_argv0( void )
  *
  * + creates the main vips types, including #VipsImage and friends
  *
- * + loads any plugins from $libdir/vips-x.y/, where x and y are the
+ * + loads any vips7 plugins from $libdir/vips-x.y/, where x and y are the
  *   major and minor version numbers for this VIPS.
  *
+ * Operation classes are registered and initialised when they are first
+ * looked up, see vips_operation_init_all().
+ *
  * + if your platform supports atexit(), VIPS_INIT() will ask for
  *   vips_shutdown() to be called on program exit
  *
@@ -246,6 +267,52 @@ vips_load_plugins( const char *fmt, ... )
 	return( result );
 }
 
+static void *
+vips_operation_init_all_cb( void *client )
+{
+	const char *libdir;
+
+	vips__optable_init_all();
+
+	/* Load any vips8 plugins from the vips libdir. Keep going, even if
+	 * some plugins fail to load.
+	 */
+	if( (libdir = vips_guess_libdir( vips_get_argv0(), "VIPSHOME" )) )
+		(void) vips_load_plugins( "%s/vips-plugins-%d.%d",
+			libdir, VIPS_MAJOR_VERSION, VIPS_MINOR_VERSION );
+
+	return( NULL );
+}
+
+/**
+ * vips_operation_init_all:
+ *
+ * Register every operation class and load any vips8 plugins (from
+ * $libdir/vips-plugins-x.y/).
+ *
+ * vips_init() only registers the base types. Operation classes are
+ * registered by package when vips_type_find() or vips_operation_new() first
+ * looks up one of their nicknames, and only the classes that are used get
+ * initialised. This makes startup much quicker for programs which only run
+ * a few operations.
+ *
+ * Functions which walk the type tree, such as vips_type_map_all() and
+ * vips_foreign_find_load(), call this for you, so you only need it if you
+ * look up types some other way, for example with g_type_from_name().
+ * Bindings which introspect the whole library can call this once after
+ * vips_init(), or you can set the environment variable VIPS_INIT_ALL to
+ * register everything during vips_init(), as older versions did.
+ *
+ * It is safe to call this many times.
+ */
+void
+vips_operation_init_all( void )
+{
+	static GOnce once = G_ONCE_INIT;
+
+	VIPS_ONCE( &once, (GThreadFunc) vips_operation_init_all_cb, NULL );
+}
+
 /* Install this log handler to hide warning messages.
  */
 static void
@@ -371,6 +438,32 @@ vips_init( const char *argv0 )
 	 */
 	if( g_getenv( "VIPS_TRACE" ) )
 		vips_cache_set_trace( TRUE );
+	if( g_getenv( "VIPS_OPERATION_STATS" ) )
+		vips_operation_stats_set( TRUE );
+	if( g_getenv( "VIPS_GATE_STATS" ) )
+		vips_gate_stats_set( TRUE );
+	if( g_getenv( "VIPS_LOAD_MAX_PIXELS" ) ||
+		g_getenv( "VIPS_LOAD_MAX_PAGES" ) ||
+		g_getenv( "VIPS_LOAD_MAX_BYTES" ) ) {
+		const char *max_pixels = g_getenv( "VIPS_LOAD_MAX_PIXELS" );
+		const char *max_pages = g_getenv( "VIPS_LOAD_MAX_PAGES" );
+		const char *max_bytes = g_getenv( "VIPS_LOAD_MAX_BYTES" );
+
+		vips_foreign_load_set_limits(
+			max_pixels ? vips__parse_size( max_pixels ) : 0,
+			max_pages ? atoi( max_pages ) : 0,
+			max_bytes ? vips__parse_size( max_bytes ) : 0 );
+	}
+	if( g_getenv( "VIPS_DISK_CACHE" ) )
+		vips_disk_cache_set_dir( g_getenv( "VIPS_DISK_CACHE" ) );
+	if( g_getenv( "VIPS_DISK_CACHE_MAX" ) )
+		vips_disk_cache_set_max_bytes( 
+			vips__parse_size( g_getenv( "VIPS_DISK_CACHE_MAX" ) ) );
+	if( g_getenv( "VIPS_PIPELINE_GRAPH" ) ) {
+		VIPS_SETSTR( vips__pipeline_graph, 
+			g_getenv( "VIPS_PIPELINE_GRAPH" ) );
+		vips_operation_stats_set( TRUE );
+	}
 
 	/* Register base vips types.
 	 */
@@ -391,27 +484,16 @@ vips_init( const char *argv0 )
 	 */
 	vips__reorder_init();
 
-	/* Start up packages.
+	/* Point operation fusion.
 	 */
-	(void) vips_system_get_type();
-	vips_arithmetic_operation_init();
-	vips_conversion_operation_init();
-	vips_create_operation_init();
-	vips_foreign_operation_init();
-	vips_resample_operation_init();
-	vips_colour_operation_init();
-	vips_histogram_operation_init();
-	vips_convolution_operation_init();
-	vips_freqfilt_operation_init();
-	vips_morphology_operation_init();
-	vips_draw_operation_init();
-	vips_mosaicing_operation_init();
+	vips__point_init();
 
-	/* Load any vips8 plugins from the vips libdir. Keep going, even if
-	 * some plugins fail to load. 
+	/* Start up packages. Just VipsOperation, the rest are registered
+	 * on first lookup, see optable.c.
 	 */
-	(void) vips_load_plugins( "%s/vips-plugins-%d.%d", 
-		libdir, VIPS_MAJOR_VERSION, VIPS_MINOR_VERSION );
+	(void) vips_system_get_type();
+	if( g_getenv( "VIPS_INIT_ALL" ) )
+		vips_operation_init_all();
 
 	/* Load up any vips7 plugins in the vips libdir. We don't error on 
 	 * failure, it's too annoying to have VIPS refuse to start because of 
@@ -434,6 +516,8 @@ vips_init( const char *argv0 )
 	/* Get the run-time compiler going.
 	 */
 	vips_vector_init();
+	vips_simd_init();
+	vips_accel_init();
 
 #ifdef HAVE_GSF
 	/* Use this for structured file write.
@@ -502,6 +586,9 @@ vips_leak( void )
 			vips_tracked_get_files() );
 	}
 
+	vips_buf_appendf( &buf, "regions: %d reused, %d created\n",
+		vips__region_pool_hits, vips__region_pool_misses );
+
 	vips_buf_appendf( &buf, "memory: high-water mark " );
 	vips_buf_append_size( &buf, vips_tracked_get_mem_highwater() );
 	vips_buf_appends( &buf, "\n" );
@@ -543,6 +630,7 @@ void
 vips_thread_shutdown( void )
 {
 	vips__thread_profile_detach();
+	vips__error_thread_shutdown();
 }
 
 /**
@@ -562,7 +650,9 @@ vips_shutdown( void )
 	printf( "vips_shutdown:\n" );
 #endif /*DEBUG*/
 
+	vips_foreign_load_pool_drop_all();
 	vips_cache_drop_all();
+	vips_vector_cache_drop_all();
 
 	im_close_plugins();
 
@@ -578,8 +668,14 @@ vips_shutdown( void )
 
 	vips__render_shutdown();
 
+	vips__threadpool_shutdown();
+
+	vips__fft_shutdown();
+
 	vips_thread_shutdown();
 
+	vips_tracked_trim();
+
 	vips__thread_profile_stop();
 
 #ifdef HAVE_GSF
@@ -654,6 +750,18 @@ vips_lib_version_cb( const gchar *option_name, const gchar *value,
 	exit( 0 );
 }
 
+/* We need operation stats for the per-node timings.
+ */
+static gboolean
+vips_pipeline_graph_cb( const gchar *option_name, const gchar *value, 
+	gpointer data, GError **error )
+{
+	VIPS_SETSTR( vips__pipeline_graph, value );
+	vips_operation_stats_set( TRUE );
+
+	return( TRUE ); 
+}
+
 static gboolean
 vips_cache_max_cb( const gchar *option_name, const gchar *value, 
 	gpointer data, GError **error )
@@ -672,6 +780,56 @@ vips_cache_max_memory_cb( const gchar *option_name, const gchar *value,
 	return( TRUE ); 
 }
 
+static gboolean
+vips_pipeline_max_mem_cb( const gchar *option_name, const gchar *value,
+	gpointer data, GError **error )
+{
+	vips_pipeline_set_max_mem( vips__parse_size( value ) );
+
+	return( TRUE );
+}
+
+static gboolean
+vips_load_max_pixels_cb( const gchar *option_name, const gchar *value,
+	gpointer data, GError **error )
+{
+	int max_pages;
+	guint64 max_bytes;
+
+	vips_foreign_load_get_limits( NULL, &max_pages, &max_bytes );
+	vips_foreign_load_set_limits( vips__parse_size( value ),
+		max_pages, max_bytes );
+
+	return( TRUE );
+}
+
+static gboolean
+vips_load_max_pages_cb( const gchar *option_name, const gchar *value,
+	gpointer data, GError **error )
+{
+	guint64 max_pixels;
+	guint64 max_bytes;
+
+	vips_foreign_load_get_limits( &max_pixels, NULL, &max_bytes );
+	vips_foreign_load_set_limits( max_pixels, atoi( value ), max_bytes );
+
+	return( TRUE );
+}
+
+static gboolean
+vips_load_max_bytes_cb( const gchar *option_name, const gchar *value,
+	gpointer data, GError **error )
+{
+	guint64 max_pixels;
+	int max_pages;
+
+	vips_foreign_load_get_limits( &max_pixels, &max_pages, NULL );
+	vips_foreign_load_set_limits( max_pixels, max_pages,
+		vips__parse_size( value ) );
+
+	return( TRUE );
+}
+
 static gboolean
 vips_cache_max_files_cb( const gchar *option_name, const gchar *value, 
 	gpointer data, GError **error )
@@ -681,6 +839,15 @@ vips_cache_max_files_cb( const gchar *option_name, const gchar *value,
 	return( TRUE ); 
 }
 
+static gboolean
+vips_vector_cache_max_cb( const gchar *option_name, const gchar *value, 
+	gpointer data, GError **error )
+{
+	vips_vector_cache_set_max( vips__parse_size( value ) );
+
+	return( TRUE ); 
+}
+
 static GOptionEntry option_entries[] = {
 	{ "vips-info", 0, G_OPTION_FLAG_HIDDEN | G_OPTION_FLAG_NO_ARG, 
 		G_OPTION_ARG_CALLBACK, (gpointer) &vips_lib_info_cb,
@@ -703,6 +870,12 @@ static GOptionEntry option_entries[] = {
 	{ "vips-fatstrip-height", 0, G_OPTION_FLAG_HIDDEN, 
 		G_OPTION_ARG_INT, &vips__fatstrip_height, 
 		N_( "set fatstrip height to N (DEBUG)" ), "N" },
+	{ "vips-tile-target", 0, 0, 
+		G_OPTION_ARG_INT, &vips__tile_target, 
+		N_( "size tiles to fit N bytes across the pipeline" ), "N" },
+	{ "vips-tile-report", 0, 0, 
+		G_OPTION_ARG_NONE, &vips__tile_report, 
+		N_( "report tile geometry" ), NULL },
 	{ "vips-progress", 0, 0, 
 		G_OPTION_ARG_NONE, &vips__progress, 
 		N_( "show progress feedback" ), NULL },
@@ -712,12 +885,55 @@ static GOptionEntry option_entries[] = {
 	{ "vips-profile", 0, 0, 
 		G_OPTION_ARG_NONE, &vips__thread_profile, 
 		N_( "profile and dump timing on exit" ), NULL },
+	{ "vips-operation-stats", 0, 0, 
+		G_OPTION_ARG_NONE, &vips__operation_stats, 
+		N_( "keep live per-operation stats" ), NULL },
+	{ "vips-gate-stats", 0, 0,
+		G_OPTION_ARG_NONE, &vips__gate_stats,
+		N_( "count lock contention" ), NULL },
+	{ "vips-pipeline-graph", 0, 0, 
+		G_OPTION_ARG_CALLBACK, (gpointer) &vips_pipeline_graph_cb,
+		N_( "write each pipeline to FILE as DOT or JSON" ), "FILE" },
 	{ "vips-disc-threshold", 0, 0, 
 		G_OPTION_ARG_STRING, &vips__disc_threshold, 
 		N_( "images larger than N are decompressed to disc" ), "N" },
+	{ "vips-disc-buffers", 0, 0, 
+		G_OPTION_ARG_INT, &vips__disc_buffers, 
+		N_( "write to disc through a ring of N buffers" ), "N" },
+	{ "vips-disc-buffer-memory", 0, 0, 
+		G_OPTION_ARG_STRING, &vips__disc_buffer_memory, 
+		N_( "disc write buffers can use at most N bytes" ), "N" },
+	{ "vips-window-size", 0, 0, 
+		G_OPTION_ARG_STRING, &vips__window_size, 
+		N_( "map disc images through windows of about N bytes" ), "N" },
+	{ "vips-window-populate", 0, 0, 
+		G_OPTION_ARG_NONE, &vips__window_populate, 
+		N_( "populate large mmap windows when they are made" ), NULL },
+	{ "vips-window-hugepage", 0, 0, 
+		G_OPTION_ARG_NONE, &vips__window_hugepage, 
+		N_( "use huge pages for large mmap windows" ), NULL },
 	{ "vips-novector", 0, G_OPTION_FLAG_REVERSE, 
 		G_OPTION_ARG_NONE, &vips__vector_enabled, 
 		N_( "disable vectorised versions of operations" ), NULL },
+	{ "vips-nosimd", 0, G_OPTION_FLAG_REVERSE, 
+		G_OPTION_ARG_NONE, &vips__simd_enabled, 
+		N_( "disable native SIMD versions of operations" ), NULL },
+	{ "vips-accel", 0, 0,
+		G_OPTION_ARG_NONE, &vips__accel_enabled,
+		N_( "use accelerator kernels, eg. OpenCL, where possible" ),
+		NULL },
+	{ "vips-conv-block", 0, 0,
+		G_OPTION_ARG_INT, &vips__conv_block,
+		N_( "convolve in strips of about N bytes of input" ), "N" },
+	{ "vips-parallel-prepare", 0, 0,
+		G_OPTION_ARG_NONE, &vips__reorder_parallel,
+		N_( "prepare slow inputs in parallel" ), NULL },
+	{ "vips-nofuse", 0, G_OPTION_FLAG_REVERSE, 
+		G_OPTION_ARG_NONE, &vips__fuse_enabled, 
+		N_( "don't fuse chains of point operations" ), NULL },
+	{ "vips-vector-cache-max", 0, 0, 
+		G_OPTION_ARG_CALLBACK, (gpointer) &vips_vector_cache_max_cb,
+		N_( "keep at most N unused compiled vector programs" ), "N" },
 	{ "vips-cache-max", 0, 0, 
 		G_OPTION_ARG_CALLBACK, (gpointer) &vips_cache_max_cb,
 		N_( "cache at most N operations" ), "N" },
@@ -727,6 +943,18 @@ static GOptionEntry option_entries[] = {
 	{ "vips-cache-max-files", 0, 0, 
 		G_OPTION_ARG_CALLBACK, (gpointer) &vips_cache_max_files_cb,
 		N_( "allow at most N open files" ), "N" },
+	{ "vips-pipeline-max-mem", 0, 0,
+		G_OPTION_ARG_CALLBACK, (gpointer) &vips_pipeline_max_mem_cb,
+		N_( "let running pipelines use at most N bytes" ), "N" },
+	{ "vips-load-max-pixels", 0, 0,
+		G_OPTION_ARG_CALLBACK, (gpointer) &vips_load_max_pixels_cb,
+		N_( "refuse to load images of more than N pixels" ), "N" },
+	{ "vips-load-max-pages", 0, 0,
+		G_OPTION_ARG_CALLBACK, (gpointer) &vips_load_max_pages_cb,
+		N_( "refuse to load more than N pages or frames" ), "N" },
+	{ "vips-load-max-bytes", 0, 0,
+		G_OPTION_ARG_CALLBACK, (gpointer) &vips_load_max_bytes_cb,
+		N_( "refuse to load images of more than N bytes" ), "N" },
 	{ "vips-cache-trace", 0, 0, 
 		G_OPTION_ARG_NONE, &vips__cache_trace, 
 		N_( "trace operation cache" ), NULL },
@@ -22,6 +22,11 @@
  * 	- set NOCACHE if we can ... helps OS X performance a lot
  * 25/3/11
  * 	- move to vips_ namespace
+ * 14/10/18
+ * 	- add vips__mmap_full() with MAP_POPULATE and MADV_HUGEPAGE hints
+ * 	- add vips__mmap_anonymous()
+ * 15/10/18
+ * 	- add vips__mmap_file() for loaders
  */
 
 /*
@@ -74,6 +79,7 @@
 #include <sys/file.h>
 #endif /*HAVE_SYS_FILE_H*/
 #include <sys/stat.h>
+#include <fcntl.h>
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
 #endif /*HAVE_UNISTD_H*/
@@ -84,19 +90,24 @@
 #endif /*OS_WIN32*/
 
 #include <vips/vips.h>
+#include <vips/internal.h>
 
 #ifdef OS_WIN32
 #include <windows.h>
 #endif /*OS_WIN32*/
 
+/* @extra is a set of VIPS__MMAP_* flags. They are only hints, and are
+ * ignored on platforms which don't support them.
+ */
 void *
-vips__mmap( int fd, int writeable, size_t length, gint64 offset )
+vips__mmap_full( int fd, int writeable, size_t length, gint64 offset, 
+	int extra )
 {
 	void *baseaddr;
 
 #ifdef DEBUG
-	printf( "vips__mmap: length = 0x%zx, offset = 0x%lx\n", 
-		length, offset );
+	printf( "vips__mmap_full: length = 0x%zx, offset = 0x%lx, "
+		"extra = %d\n", length, offset, extra );
 #endif /*DEBUG*/
 
 #ifdef OS_WIN32
@@ -169,6 +180,13 @@ vips__mmap( int fd, int writeable, size_t length, gint64 offset )
 	flags |= MAP_NOCACHE;
 #endif /*MAP_NOCACHE*/
 
+	/* Fault all the pages in now, rather than one at a time as we scan.
+	 */
+#ifdef MAP_POPULATE
+	if( extra & VIPS__MMAP_POPULATE )
+		flags |= MAP_POPULATE;
+#endif /*MAP_POPULATE*/
+
 	/* Casting gint64 to off_t should be safe, even on *nixes without
 	 * LARGEFILE.
 	 */
@@ -182,12 +200,111 @@ vips__mmap( int fd, int writeable, size_t length, gint64 offset )
 			"expect a crash soon" ), strerror( errno ) );
 		return( NULL ); 
 	}
+
+	/* Ask for transparent huge pages. File-backed mappings only get them 
+	 * on kernels with read-only THP for filesystems, but the hint is 
+	 * harmless elsewhere.
+	 */
+#if defined(HAVE_MADVISE) && defined(MADV_HUGEPAGE)
+	if( extra & VIPS__MMAP_HUGEPAGE )
+		(void) madvise( baseaddr, length, MADV_HUGEPAGE );
+#endif /*HAVE_MADVISE && MADV_HUGEPAGE*/
 }
 #endif /*OS_WIN32*/
 
 	return( baseaddr );
 }
 
+void *
+vips__mmap( int fd, int writeable, size_t length, gint64 offset )
+{
+	return( vips__mmap_full( fd, writeable, length, offset, 0 ) );
+}
+
+/* Map length bytes of zeroed, private memory, for example for a big memory
+ * image. @extra is a set of VIPS__MMAP_* flags, as vips__mmap_full(). Free
+ * with vips__munmap().
+ *
+ * Returns NULL with no error set if we can't do this on this platform, so
+ * callers can fall back to vips_tracked_malloc().
+ */
+void *
+vips__mmap_anonymous( size_t length, int extra )
+{
+#if defined(HAVE_SYS_MMAN_H) && defined(MAP_ANONYMOUS)
+	void *baseaddr;
+	int flags;
+
+	flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+#ifdef MAP_POPULATE
+	if( extra & VIPS__MMAP_POPULATE )
+		flags |= MAP_POPULATE;
+#endif /*MAP_POPULATE*/
+
+	baseaddr = mmap( 0, length, PROT_READ | PROT_WRITE, flags, -1, 0 );
+	if( baseaddr == MAP_FAILED )
+		return( NULL );
+
+	/* Anonymous mappings are where THP works best.
+	 */
+#if defined(HAVE_MADVISE) && defined(MADV_HUGEPAGE)
+	if( extra & VIPS__MMAP_HUGEPAGE )
+		(void) madvise( baseaddr, length, MADV_HUGEPAGE );
+#endif /*HAVE_MADVISE && MADV_HUGEPAGE*/
+
+	return( baseaddr );
+#else /*!HAVE_SYS_MMAN_H || !MAP_ANONYMOUS*/
+	return( NULL );
+#endif /*HAVE_SYS_MMAN_H && MAP_ANONYMOUS*/
+}
+
+/* Map the whole of @filename read-only, for loaders which can decode from 
+ * memory. This saves copying through stdio buffers and the read() calls. We 
+ * hint that access will be sequential, so the kernel reads ahead. 
+ *
+ * Returns NULL with no error set if we can't map the file, for example if 
+ * it's empty, a pipe or a device, or if this platform does not support it, 
+ * so callers can fall back to stdio. Free with vips__munmap().
+ */
+void *
+vips__mmap_file( const char *filename, size_t *length )
+{
+#if defined(HAVE_SYS_MMAN_H) && !defined(OS_WIN32)
+	int fd;
+	struct stat st;
+	void *baseaddr;
+
+	if( (fd = open( filename, O_RDONLY )) == -1 )
+		return( NULL );
+
+	if( fstat( fd, &st ) ||
+		!S_ISREG( st.st_mode ) ||
+		st.st_size <= 0 ||
+		(guint64) st.st_size > G_MAXSIZE ) {
+		close( fd );
+		return( NULL );
+	}
+
+	/* The mapping stays valid after the fd is closed.
+	 */
+	baseaddr = mmap( 0, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+	close( fd );
+	if( baseaddr == MAP_FAILED ) 
+		return( NULL );
+
+#if defined(HAVE_MADVISE) && defined(MADV_SEQUENTIAL)
+	(void) madvise( baseaddr, st.st_size, MADV_SEQUENTIAL );
+#endif /*HAVE_MADVISE && MADV_SEQUENTIAL*/
+
+	*length = st.st_size;
+
+	return( baseaddr );
+#else /*!HAVE_SYS_MMAN_H || OS_WIN32*/
+	return( NULL );
+#endif /*HAVE_SYS_MMAN_H && !OS_WIN32*/
+}
+
 int
 vips__munmap( const void *start, size_t length )
 {
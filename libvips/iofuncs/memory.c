@@ -22,6 +22,11 @@
  * 21/9/11
  * 	- rename as vips_tracked_malloc() to emphasise difference from
  * 	  g_malloc()/g_free()
+ * 14/10/18
+ * 	- tracked memory is pooled in size classes with per-thread magazines
+ * 	- add vips_tracked_trim() and pool stats
+ * 	- add vips_tracked_get_allocs_total() and
+ * 	  vips_tracked_reset_highwater()
  */
 
 /*
@@ -64,9 +69,13 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
+#ifdef HAVE_MALLOC_TRIM
+#include <malloc.h>
+#endif /*HAVE_MALLOC_TRIM*/
 
 #include <vips/vips.h>
 #include <vips/thread.h>
+#include <vips/internal.h>
 
 /**
  * SECTION: memory
@@ -88,6 +97,12 @@
  * only suitable for large allocations internal to the library, for example
  * pixel buffers. libvips watches the total amount of live tracked memory and
  * uses this information to decide when to trim caches.
+ *
+ * Tracked memory is pooled. Blocks are rounded up to one of a set of size
+ * classes, and freed blocks are kept in a small per-thread magazine and a
+ * shared depot ready for reuse, so the pixel buffers libvips churns through
+ * come back from the pool rather than from malloc(). Use vips_tracked_trim()
+ * to hand pooled memory back to the OS.
  */
 
 /* g_assert_not_reached() on memory errors.
@@ -106,8 +121,65 @@ static int vips_tracked_allocs = 0;
 static size_t vips_tracked_mem = 0;
 static int vips_tracked_files = 0;
 static size_t vips_tracked_mem_highwater = 0;
+static guint64 vips_tracked_allocs_total = 0;
 static GMutex *vips_tracked_mutex = NULL;
 
+/* Tracked blocks are rounded up to a size class. Classes run from 4kB to
+ * 32MB in quarter-power-of-two steps, so we never waste more than 25%, and
+ * the common tile and strip buffer sizes all land in a class. Larger blocks 
+ * go straight to malloc().
+ */
+#define VIPS_TRACKED_CLASS_MIN_SHIFT (12)
+#define VIPS_TRACKED_CLASS_MAX_SHIFT (25)
+#define VIPS_TRACKED_N_CLASSES \
+	((VIPS_TRACKED_CLASS_MAX_SHIFT - VIPS_TRACKED_CLASS_MIN_SHIFT) * 4 + 1)
+
+/* Each thread keeps up to this many free blocks per class.
+ */
+#define VIPS_TRACKED_MAGAZINE_SIZE (4)
+
+/* Keep at most this many bytes of free blocks in the pool, in the depot and
+ * in all the magazines. Anything over this goes back to the OS on free.
+ */
+static size_t vips_tracked_pool_max = 64 * 1024 * 1024;
+
+/* Every tracked block starts with one of these. We leave 16 bytes for it
+ * to make sure we don't break alignment rules.
+ */
+typedef struct _VipsTrackedHeader {
+	/* Size of the whole block, including the header.
+	 */
+	size_t size;
+
+	/* The size class, or -1 for unpooled blocks.
+	 */
+	int index;
+} VipsTrackedHeader;
+
+/* A per-thread set of free blocks, a stack per class. We can pop and push 
+ * these without taking the pool lock.
+ */
+typedef struct _VipsTrackedMagazine {
+	void *block[VIPS_TRACKED_N_CLASSES][VIPS_TRACKED_MAGAZINE_SIZE];
+	int n[VIPS_TRACKED_N_CLASSES];
+} VipsTrackedMagazine;
+
+static GPrivate *vips_tracked_magazine_key = NULL;
+
+/* The shared depot: a list of free blocks per class, linked through the
+ * first pointer after the header. Protected by vips_tracked_mutex.
+ */
+static void *vips_tracked_depot[VIPS_TRACKED_N_CLASSES];
+
+/* Bytes of free blocks in the depot and in all magazines, plus reuse 
+ * stats. Protected by vips_tracked_mutex.
+ */
+static size_t vips_tracked_pool = 0;
+static guint64 vips_tracked_pool_hits = 0;
+static guint64 vips_tracked_pool_misses = 0;
+
+#define VIPS_TRACKED_NEXT( B ) (*((void **) ((char *) (B) + 16)))
+
 /**
  * VIPS_NEW:
  * @OBJ: allocate memory local to @OBJ, or %NULL for no auto-free
@@ -228,6 +300,93 @@ vips_free( void *buf )
 	return( 0 );
 }
 
+/* Find the size class for a block, or -1 for a block too large to pool. 
+ */
+static int
+vips_tracked_class( size_t size )
+{
+	int shift;
+	size_t base;
+	size_t step;
+
+	if( size > ((size_t) 1 << VIPS_TRACKED_CLASS_MAX_SHIFT) )
+		return( -1 );
+	if( size <= ((size_t) 1 << VIPS_TRACKED_CLASS_MIN_SHIFT) )
+		return( 0 );
+
+	for( shift = VIPS_TRACKED_CLASS_MIN_SHIFT; 
+		((size_t) 1 << (shift + 1)) < size; shift++ )
+		;
+	base = (size_t) 1 << shift;
+	step = base / 4;
+
+	return( (shift - VIPS_TRACKED_CLASS_MIN_SHIFT) * 4 + 
+		(size - base + step - 1) / step );
+}
+
+static size_t
+vips_tracked_class_size( int index )
+{
+	int shift;
+	size_t base;
+
+	if( index == 0 )
+		return( (size_t) 1 << VIPS_TRACKED_CLASS_MIN_SHIFT );
+
+	shift = VIPS_TRACKED_CLASS_MIN_SHIFT + (index - 1) / 4;
+	base = (size_t) 1 << shift;
+
+	return( base + ((index - 1) % 4 + 1) * (base / 4) );
+}
+
+static VipsTrackedMagazine *
+vips_tracked_magazine_get( void )
+{
+	VipsTrackedMagazine *magazine;
+
+	if( !(magazine = g_private_get( vips_tracked_magazine_key )) ) {
+		magazine = g_new0( VipsTrackedMagazine, 1 );
+		g_private_set( vips_tracked_magazine_key, magazine );
+	}
+
+	return( magazine );
+}
+
+/* Move one class of a magazine to the depot. Call with the pool lock held.
+ */
+static void
+vips_tracked_magazine_flush_class( VipsTrackedMagazine *magazine, int index )
+{
+	while( magazine->n[index] > 0 ) {
+		void *block = magazine->block[index][--magazine->n[index]];
+
+		VIPS_TRACKED_NEXT( block ) = vips_tracked_depot[index];
+		vips_tracked_depot[index] = block;
+	}
+}
+
+static void
+vips_tracked_magazine_flush( VipsTrackedMagazine *magazine )
+{
+	int i;
+
+	for( i = 0; i < VIPS_TRACKED_N_CLASSES; i++ )
+		vips_tracked_magazine_flush_class( magazine, i );
+}
+
+static void
+vips_tracked_magazine_destroy_notify( VipsTrackedMagazine *magazine )
+{
+	/* GPrivate has stopped working by this point in destruction, be 
+	 * careful not to touch that. 
+	 */
+	g_mutex_lock( vips_tracked_mutex );
+	vips_tracked_magazine_flush( magazine );
+	g_mutex_unlock( vips_tracked_mutex );
+
+	g_free( magazine );
+}
+
 /**
  * vips_tracked_free:
  * @s: (transfer full): memory to free
@@ -236,6 +395,8 @@ vips_free( void *buf )
  * memory that was previously allocated with vips_tracked_malloc() with a 
  * %NULL first argument.
  *
+ * The block may be kept in the pool for reuse, see vips_tracked_trim().
+ *
  * See also: vips_tracked_malloc().
  */
 void
@@ -245,7 +406,15 @@ vips_tracked_free( void *s )
 	 * alignment rules are kept.
 	 */
 	void *start = (void *) ((char *) s - 16);
-	size_t size = *((size_t *) start);
+	VipsTrackedHeader *header = (VipsTrackedHeader *) start;
+	size_t size = header->size;
+	int index = header->index;
+
+	VipsTrackedMagazine *magazine;
+	gboolean keep;
+
+	magazine = index >= 0 ? vips_tracked_magazine_get() : NULL;
+	keep = FALSE;
 
 	g_mutex_lock( vips_tracked_mutex );
 
@@ -261,9 +430,23 @@ vips_tracked_free( void *s )
 	vips_tracked_mem -= size;
 	vips_tracked_allocs -= 1;
 
+	if( magazine &&
+		vips_tracked_pool + size <= vips_tracked_pool_max ) {
+		/* Full magazine? Pass the blocks we have over to the depot
+		 * so other threads can use them.
+		 */
+		if( magazine->n[index] >= VIPS_TRACKED_MAGAZINE_SIZE )
+			vips_tracked_magazine_flush_class( magazine, index );
+
+		magazine->block[index][magazine->n[index]++] = start;
+		vips_tracked_pool += size;
+		keep = TRUE;
+	}
+
 	g_mutex_unlock( vips_tracked_mutex );
 
-	g_free( start );
+	if( !keep )
+		g_free( start );
 
 	VIPS_GATE_FREE( size ); 
 }
@@ -271,6 +454,16 @@ vips_tracked_free( void *s )
 static void
 vips_tracked_init_mutex( void )
 {
+#ifdef HAVE_PRIVATE_INIT
+	static GPrivate private = G_PRIVATE_INIT( 
+		(GDestroyNotify) vips_tracked_magazine_destroy_notify );
+
+	vips_tracked_magazine_key = &private;
+#else
+	vips_tracked_magazine_key = g_private_new( 
+		(GDestroyNotify) vips_tracked_magazine_destroy_notify );
+#endif
+
 	vips_tracked_mutex = vips_g_mutex_new(); 
 }
 
@@ -290,18 +483,25 @@ vips_tracked_init( void )
  * Allocate an area of memory that will be tracked by vips_tracked_get_mem()
  * and friends. 
  *
+ * The block is rounded up to a size class and taken from the pool of
+ * recently freed blocks, if possible.
+ *
  * If allocation fails, vips_malloc() returns %NULL and 
  * sets an error message.
  *
  * You must only free the memory returned with vips_tracked_free().
  *
- * See also: vips_tracked_free(), vips_malloc().
+ * See also: vips_tracked_free(), vips_malloc(), vips_tracked_trim().
  *
  * Returns: (transfer full): a pointer to the allocated memory, or %NULL on error.
  */
 void *
 vips_tracked_malloc( size_t size )
 {
+	int index;
+	VipsTrackedMagazine *magazine;
+	VipsTrackedHeader *header;
+	gboolean hit;
         void *buf;
 
 	vips_tracked_init(); 
@@ -312,7 +512,38 @@ vips_tracked_malloc( size_t size )
 	 */
 	size += 16;
 
-        if( !(buf = g_try_malloc( size )) ) {
+	buf = NULL;
+	magazine = NULL;
+	if( (index = vips_tracked_class( size )) >= 0 ) {
+		size = vips_tracked_class_size( index );
+		magazine = vips_tracked_magazine_get();
+
+		/* Empty magazine? Refill from the depot.
+		 */
+		if( magazine->n[index] == 0 ) {
+			g_mutex_lock( vips_tracked_mutex );
+
+			while( magazine->n[index] < 
+				VIPS_TRACKED_MAGAZINE_SIZE &&
+				vips_tracked_depot[index] ) {
+				void *block = vips_tracked_depot[index];
+
+				vips_tracked_depot[index] = 
+					VIPS_TRACKED_NEXT( block );
+				magazine->block[index][magazine->n[index]++] = 
+					block;
+			}
+
+			g_mutex_unlock( vips_tracked_mutex );
+		}
+
+		if( magazine->n[index] > 0 ) 
+			buf = magazine->block[index][--magazine->n[index]];
+	}
+	hit = buf != NULL;
+
+        if( !buf &&
+		!(buf = g_try_malloc( size )) ) {
 #ifdef DEBUG
 		g_assert_not_reached();
 #endif /*DEBUG*/
@@ -328,13 +559,22 @@ vips_tracked_malloc( size_t size )
 
 	g_mutex_lock( vips_tracked_mutex );
 
-	*((size_t *)buf) = size;
+	header = (VipsTrackedHeader *) buf;
+	if( hit ) {
+		vips_tracked_pool -= size;
+		vips_tracked_pool_hits += 1;
+	}
+	else if( magazine )
+		vips_tracked_pool_misses += 1;
+	header->size = size;
+	header->index = index;
 	buf = (void *) ((char *)buf + 16);
 
 	vips_tracked_mem += size;
 	if( vips_tracked_mem > vips_tracked_mem_highwater ) 
 		vips_tracked_mem_highwater = vips_tracked_mem;
 	vips_tracked_allocs += 1;
+	vips_tracked_allocs_total += 1;
 
 #ifdef DEBUG_VERBOSE
 	printf( "vips_tracked_malloc: %p, %zd bytes\n", buf, size ); 
@@ -343,10 +583,82 @@ vips_tracked_malloc( size_t size )
 	g_mutex_unlock( vips_tracked_mutex );
 
 	VIPS_GATE_MALLOC( size ); 
+	VIPS_GATE_OPERATION_MALLOC( size ); 
 
         return( buf );
 }
 
+/* Hand this thread's free blocks over to the depot. Workers call this after
+ * each job so that idle threads don't sit on memory vips_tracked_trim() can't
+ * reach.
+ */
+void
+vips__tracked_thread_flush( void )
+{
+	VipsTrackedMagazine *magazine;
+
+	vips_tracked_init(); 
+
+	if( (magazine = g_private_get( vips_tracked_magazine_key )) ) {
+		g_mutex_lock( vips_tracked_mutex );
+		vips_tracked_magazine_flush( magazine );
+		g_mutex_unlock( vips_tracked_mutex );
+	}
+}
+
+/**
+ * vips_tracked_trim:
+ *
+ * Free all the blocks held in the tracked memory pool and ask the C library
+ * to return any memory it can to the OS. Blocks held in the magazines of 
+ * other running threads are not freed.
+ *
+ * libvips calls this for you on vips_shutdown(). 
+ *
+ * See also: vips_tracked_get_pool(), vips_tracked_malloc().
+ */
+void
+vips_tracked_trim( void )
+{
+	VipsTrackedMagazine *magazine;
+	void *depot[VIPS_TRACKED_N_CLASSES];
+	int i;
+
+	vips_tracked_init(); 
+
+	magazine = g_private_get( vips_tracked_magazine_key );
+
+	g_mutex_lock( vips_tracked_mutex );
+
+	if( magazine )
+		vips_tracked_magazine_flush( magazine );
+
+	for( i = 0; i < VIPS_TRACKED_N_CLASSES; i++ ) {
+		void *block;
+
+		depot[i] = vips_tracked_depot[i];
+		vips_tracked_depot[i] = NULL;
+
+		for( block = depot[i]; block; 
+			block = VIPS_TRACKED_NEXT( block ) )
+			vips_tracked_pool -= vips_tracked_class_size( i );
+	}
+
+	g_mutex_unlock( vips_tracked_mutex );
+
+	for( i = 0; i < VIPS_TRACKED_N_CLASSES; i++ ) 
+		while( depot[i] ) {
+			void *block = depot[i];
+
+			depot[i] = VIPS_TRACKED_NEXT( block );
+			g_free( block );
+		}
+
+#ifdef HAVE_MALLOC_TRIM
+	malloc_trim( 0 );
+#endif /*HAVE_MALLOC_TRIM*/
+}
+
 /**
  * vips_tracked_open:
  * @pathname: name of file to open
@@ -505,6 +817,51 @@ vips_tracked_get_allocs( void )
 	return( n );
 }
 
+/**
+ * vips_tracked_get_allocs_total:
+ *
+ * Returns the number of calls to vips_tracked_malloc() since startup.
+ * Handy for counting the allocations an operation makes.
+ *
+ * Returns: the total number of allocations
+ */
+guint64
+vips_tracked_get_allocs_total( void )
+{
+	guint64 n;
+
+	vips_tracked_init();
+
+	g_mutex_lock( vips_tracked_mutex );
+
+	n = vips_tracked_allocs_total;
+
+	g_mutex_unlock( vips_tracked_mutex );
+
+	return( n );
+}
+
+/**
+ * vips_tracked_reset_highwater:
+ *
+ * Reset the value returned by vips_tracked_get_mem_highwater() to the number
+ * of bytes currently allocated, so you can find the peak memory use of a
+ * single operation.
+ *
+ * See also: vips_tracked_get_mem_highwater().
+ */
+void
+vips_tracked_reset_highwater( void )
+{
+	vips_tracked_init();
+
+	g_mutex_lock( vips_tracked_mutex );
+
+	vips_tracked_mem_highwater = vips_tracked_mem;
+
+	g_mutex_unlock( vips_tracked_mutex );
+}
+
 
 /**
  * vips_tracked_get_files:
@@ -529,3 +886,81 @@ vips_tracked_get_files( void )
 	return( n );
 }
 
+
+/**
+ * vips_tracked_get_pool:
+ *
+ * Returns the number of bytes of free memory held in the tracked memory pool
+ * ready for reuse. 
+ *
+ * See also: vips_tracked_trim().
+ *
+ * Returns: the number of pooled bytes
+ */
+size_t
+vips_tracked_get_pool( void )
+{
+	size_t pool;
+
+	vips_tracked_init(); 
+
+	g_mutex_lock( vips_tracked_mutex );
+
+	pool = vips_tracked_pool;
+
+	g_mutex_unlock( vips_tracked_mutex );
+
+	return( pool );
+}
+
+/**
+ * vips_tracked_get_pool_hits:
+ *
+ * Returns the number of vips_tracked_malloc() calls that were satisfied by 
+ * reusing a pooled block. 
+ *
+ * See also: vips_tracked_get_pool_misses().
+ *
+ * Returns: the number of pool hits
+ */
+guint64
+vips_tracked_get_pool_hits( void )
+{
+	guint64 n;
+
+	vips_tracked_init(); 
+
+	g_mutex_lock( vips_tracked_mutex );
+
+	n = vips_tracked_pool_hits;
+
+	g_mutex_unlock( vips_tracked_mutex );
+
+	return( n );
+}
+
+/**
+ * vips_tracked_get_pool_misses:
+ *
+ * Returns the number of poolable vips_tracked_malloc() calls that had to go
+ * to malloc() for a new block. 
+ *
+ * See also: vips_tracked_get_pool_hits().
+ *
+ * Returns: the number of pool misses
+ */
+guint64
+vips_tracked_get_pool_misses( void )
+{
+	guint64 n;
+
+	vips_tracked_init(); 
+
+	g_mutex_lock( vips_tracked_mutex );
+
+	n = vips_tracked_pool_misses;
+
+	g_mutex_unlock( vips_tracked_mutex );
+
+	return( n );
+}
@@ -838,6 +838,237 @@ vips_object_get_argument_priority( VipsObject *object, const char *name )
 	return( argument_class->priority );
 }
 
+/* The arguments for a class, in traverse order, so bindings can look an
+ * argument up once and then set it by position. We hang this off the 
+ * class's GType and build it on first use.
+ */
+typedef struct _VipsArgumentIndex {
+	int n;
+	VipsArgumentClass **argument;
+} VipsArgumentIndex;
+
+static GQuark vips__argument_index_quark = 0;
+
+static VipsArgumentIndex *
+vips_argument_index_get( VipsObjectClass *object_class )
+{
+	GType type = G_TYPE_FROM_CLASS( object_class );
+
+	VipsArgumentIndex *table;
+
+	/* The table never changes once it's been made, so only lock if we
+	 * need to make it.
+	 */
+	if( (table = g_type_get_qdata( type, vips__argument_index_quark )) ) 
+		return( table );
+
+	g_mutex_lock( vips__global_lock );
+
+	if( !(table = g_type_get_qdata( type, vips__argument_index_quark )) ) {
+		GSList *p;
+		int i;
+
+		table = g_new( VipsArgumentIndex, 1 );
+		table->n = g_slist_length( 
+			object_class->argument_table_traverse );
+		table->argument = g_new( VipsArgumentClass *, 
+			VIPS_MAX( 1, table->n ) );
+		for( i = 0, p = object_class->argument_table_traverse; 
+			p; i++, p = p->next )
+			table->argument[i] = (VipsArgumentClass *) p->data;
+
+		/* Never freed, classes live forever.
+		 */
+		g_type_set_qdata( type, vips__argument_index_quark, table ); 
+	}
+
+	g_mutex_unlock( vips__global_lock );
+
+	return( table );
+}
+
+/**
+ * vips_object_class_argument_index: 
+ * @object_class: the class to search
+ * @name: argument to find
+ *
+ * Find the position of an argument in a class. Bindings can do this once
+ * per class and argument, then use vips_object_set_argument_by_index() and
+ * vips_object_get_argument_by_index() to skip the name lookups on every 
+ * call.
+ *
+ * Positions are stable for the life of the program, but may change between
+ * libvips versions.
+ *
+ * Returns: the position of the argument, or -1 on error.
+ */
+int
+vips_object_class_argument_index( VipsObjectClass *object_class, 
+	const char *name )
+{
+	VipsArgumentIndex *table = vips_argument_index_get( object_class );
+
+	GParamSpec *pspec;
+	int i;
+
+	if( (pspec = g_object_class_find_property( 
+		G_OBJECT_CLASS( object_class ), name )) ) 
+		for( i = 0; i < table->n; i++ )
+			if( ((VipsArgument *) table->argument[i])->pspec == 
+				pspec )
+				return( i );
+
+	vips_error( object_class->nickname, 
+		_( "no vips argument named `%s'" ), name );
+
+	return( -1 );
+}
+
+/* Look up the three things you need to work with an argument, by position.
+ */
+static int
+vips_object_get_argument_at( VipsObject *object, int i,
+	GParamSpec **pspec,
+	VipsArgumentClass **argument_class,
+	VipsArgumentInstance **argument_instance )
+{
+	VipsObjectClass *class = VIPS_OBJECT_GET_CLASS( object );
+	VipsArgumentIndex *table = vips_argument_index_get( class );
+
+	if( i < 0 || 
+		i >= table->n ) {
+		vips_error( class->nickname, 
+			_( "no vips argument at position %d" ), i );
+		return( -1 );
+	}
+
+	*argument_class = table->argument[i];
+	*pspec = ((VipsArgument *) *argument_class)->pspec;
+
+	if( !(*argument_instance = vips__argument_get_instance( 
+		*argument_class, object )) ) {
+		vips_error( class->nickname, 
+			_( "argument `%s' has no instance" ), 
+			g_param_spec_get_name( *pspec ) );
+		return( -1 );
+	}
+
+	return( 0 );
+}
+
+/**
+ * vips_object_set_argument_by_index: 
+ * @object: object to set
+ * @index: argument position, see vips_object_class_argument_index()
+ * @value: value to set
+ *
+ * Set an argument by position. This is the same as g_object_set_property(),
+ * but without the name lookup. @value is converted to the argument's type
+ * if necessary, then validated against the argument's #GParamSpec, and 
+ * "notify" is emitted, just as g_object_set_property() would.
+ *
+ * See also: vips_object_class_argument_index().
+ *
+ * Returns: 0 on success, -1 on error.
+ */
+int
+vips_object_set_argument_by_index( VipsObject *object, int index, 
+	const GValue *value )
+{
+	const char *nickname = VIPS_OBJECT_GET_CLASS( object )->nickname;
+
+	GParamSpec *pspec;
+	VipsArgumentClass *argument_class;
+	VipsArgumentInstance *argument_instance;
+	GObjectClass *owner_class;
+	GValue converted = { 0 };
+
+	if( vips_object_get_argument_at( object, index,
+		&pspec, &argument_class, &argument_instance ) )
+		return( -1 );
+
+	/* The same checks as g_object_set_property().
+	 */
+	if( !(pspec->flags & G_PARAM_WRITABLE) ) {
+		vips_error( nickname, 
+			_( "argument `%s' is not writable" ), 
+			g_param_spec_get_name( pspec ) );
+		return( -1 );
+	}
+	if( (pspec->flags & G_PARAM_CONSTRUCT_ONLY) &&
+		object->constructed ) {
+		vips_error( nickname, 
+			_( "argument `%s' can only be set on construction" ), 
+			g_param_spec_get_name( pspec ) );
+		return( -1 );
+	}
+
+	g_value_init( &converted, G_PARAM_SPEC_VALUE_TYPE( pspec ) );
+	if( !g_value_transform( value, &converted ) ) {
+		g_value_unset( &converted );
+		vips_error( nickname, 
+			_( "can't convert %s to %s for `%s'" ), 
+			G_VALUE_TYPE_NAME( value ),
+			g_type_name( G_PARAM_SPEC_VALUE_TYPE( pspec ) ),
+			g_param_spec_get_name( pspec ) );
+		return( -1 );
+	}
+	if( g_param_value_validate( pspec, &converted ) &&
+		!(pspec->flags & G_PARAM_LAX_VALIDATION) ) {
+		g_value_unset( &converted );
+		vips_error( nickname, 
+			_( "value out of range for `%s'" ), 
+			g_param_spec_get_name( pspec ) );
+		return( -1 );
+	}
+
+	/* Call the set_property of the class that installed the pspec, as
+	 * g_object_set_property() does.
+	 */
+	owner_class = G_OBJECT_CLASS( g_type_class_peek( pspec->owner_type ) );
+	owner_class->set_property( G_OBJECT( object ), 
+		pspec->param_id, &converted, pspec );
+	g_value_unset( &converted );
+
+	g_object_notify_by_pspec( G_OBJECT( object ), pspec );
+
+	return( 0 );
+}
+
+/**
+ * vips_object_get_argument_by_index: 
+ * @object: object to fetch from
+ * @index: argument position, see vips_object_class_argument_index()
+ * @value: (out): return value here
+ *
+ * Get an argument by position. @value is initialised to the argument's 
+ * type, unset it with g_value_unset() when you're done.
+ *
+ * See also: vips_object_class_argument_index().
+ *
+ * Returns: 0 on success, -1 on error.
+ */
+int
+vips_object_get_argument_by_index( VipsObject *object, int index, 
+	GValue *value )
+{
+	GParamSpec *pspec;
+	VipsArgumentClass *argument_class;
+	VipsArgumentInstance *argument_instance;
+	GObjectClass *owner_class;
+
+	if( vips_object_get_argument_at( object, index,
+		&pspec, &argument_class, &argument_instance ) )
+		return( -1 );
+
+	owner_class = G_OBJECT_CLASS( g_type_class_peek( pspec->owner_type ) );
+	g_value_init( value, G_PARAM_SPEC_VALUE_TYPE( pspec ) );
+	owner_class->get_property( G_OBJECT( object ), 
+		pspec->param_id, value, pspec );
+
+	return( 0 );
+}
+
 static void
 vips_object_clear_member( VipsArgumentInstance *argument_instance )
 {
@@ -1543,6 +1774,10 @@ vips_object_class_init( VipsObjectClass *class )
 		vips__object_all_lock = vips_g_mutex_new();
 	}
 
+	if( !vips__argument_index_quark ) 
+		vips__argument_index_quark = 
+			g_quark_from_static_string( "vips-argument-index" ); 
+
 	gobject_class->dispose = vips_object_dispose;
 	gobject_class->finalize = vips_object_finalize;
 	gobject_class->set_property = vips_object_set_property;
@@ -2612,6 +2847,10 @@ vips_type_map( GType base, VipsTypeMap2Fn fn, void *a, void *b )
 	unsigned int i;
 	void *result;
 
+	/* Operations are registered lazily, make sure they are all there.
+	 */
+	vips_operation_init_all();
+
 	child = g_type_children( base, &n_children );
 	result = NULL;
 	for( i = 0; i < n_children && !result; i++ )
@@ -2730,6 +2969,8 @@ vips_class_find( const char *basename, const char *nickname )
 	VipsObjectClass *class;
 	GType base;
 
+	vips_operation_init_all();
+
 	if( !(base = g_type_from_name( classname )) )
 		return( NULL );
 	class = vips_class_map_all( base, 
@@ -2814,6 +3055,17 @@ vips_type_find( const char *basename, const char *nickname )
 	GType base;
 	GType type;
 
+	/* Most lookups are operations by nickname. This registers just the
+	 * package we need and avoids initialising every class to build
+	 * the nickname hash.
+	 */
+	if( (type = vips__optable_find( nickname )) &&
+		(base = g_type_from_name( classname )) &&
+		g_type_is_a( type, base ) )
+		return( type );
+
+	/* Anything else needs all the types, see vips_type_map().
+	 */
 	VIPS_ONCE( &once, (GThreadFunc) vips_class_build_hash, NULL ); 
 
 	hit = (NicknameGType *) 
@@ -2,6 +2,9 @@
  *
  * 30/12/14
  * 	- display default/min/max for pspec in usage
+ * 14/10/18
+ * 	- attach operation stats to output images in postbuild
+ * 	- also attach stats when profiling, for tile names
  */
 
 /*
@@ -547,6 +550,58 @@ vips_operation_summary( VipsObject *object, VipsBuf *buf )
 		summary( object, buf );
 }
 
+static void *
+vips_operation_postbuild_stats_arg( VipsObject *object, 
+	GParamSpec *pspec,
+	VipsArgumentClass *argument_class,
+	VipsArgumentInstance *argument_instance,
+	void *a, void *b )
+{
+	VipsOperationStats *stats = (VipsOperationStats *) a;
+
+	if( (argument_class->flags & VIPS_ARGUMENT_OUTPUT) &&
+		argument_instance->assigned &&
+		G_PARAM_SPEC_VALUE_TYPE( pspec ) == VIPS_TYPE_IMAGE ) {
+		VipsImage *image = G_STRUCT_MEMBER( VipsImage *, 
+			object, argument_class->offset );
+
+		VipsImagePrivate *private;
+
+		/* Images passed straight through from upstream keep the
+		 * stats of the operation that made them.
+		 */
+		if( image &&
+			(private = vips__image_private( image )) &&
+			!private->stats )
+			private->stats = stats;
+	}
+
+	return( NULL );
+}
+
+static int
+vips_operation_postbuild( VipsObject *object )
+{
+	if( VIPS_OBJECT_CLASS( vips_operation_parent_class )->
+		postbuild( object ) )
+		return( -1 );
+
+	/* Profiles use the stats nickname to label tiles, see
+	 * vips__thread_gate_tile().
+	 */
+	if( vips__operation_stats ||
+		vips__thread_profile ) {
+		VipsObjectClass *object_class = VIPS_OBJECT_GET_CLASS( object );
+		VipsOperationStats *stats = 
+			vips__operation_stats_get( object_class->nickname );
+
+		vips_argument_map( object,
+			vips_operation_postbuild_stats_arg, stats, NULL );
+	}
+
+	return( 0 );
+}
+
 static VipsOperationFlags
 vips_operation_real_get_flags( VipsOperation *operation ) 
 {
@@ -568,6 +623,7 @@ vips_operation_class_init( VipsOperationClass *class )
 	vobject_class->description = _( "operations" );
 	vobject_class->summary = vips_operation_summary;
 	vobject_class->dump = vips_operation_dump;
+	vobject_class->postbuild = vips_operation_postbuild;
 
 	class->usage = vips_operation_usage;
 	class->get_flags = vips_operation_real_get_flags;
@@ -0,0 +1,552 @@
+/* register operation classes on first use
+ *
+ * 14/10/18
+ * 	- first version
+ * 	- one GOnce per package, add vips__optable_check()
+ */
+
+/*
+
+    This file is part of VIPS.
+    
+    VIPS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA
+
+ */
+
+/*
+
+    These files are distributed with VIPS - http://www.vips.ecs.soton.ac.uk
+
+ */
+
+/* vips_init() used to register every operation class, and the first
+ * vips_type_find() then initialised every class to build a nickname table.
+ * That's hundreds of GTypes and thousands of arg specs before the first
+ * call.
+ *
+ * Instead, this table maps nicknames to type names and the package which
+ * registers them. A lookup registers just that package, and only the
+ * class which is actually used gets initialised.
+ *
+ * The table doesn't need to be complete or exact. If a nickname is missing,
+ * or the package doesn't register the type in this build (a loader whose
+ * library isn't there, say), vips_type_find() falls back to
+ * vips_operation_init_all() and a full search. Add new operations here to
+ * keep them fast to find. "vips --check-optable", run by test/test_cli.sh,
+ * compares the table against the registered operations.
+ */
+
+/*
+#define DEBUG
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /*HAVE_CONFIG_H*/
+#include <vips/intl.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vips/vips.h>
+#include <vips/internal.h>
+
+typedef enum {
+	VIPS_PACKAGE_BASE,
+	VIPS_PACKAGE_ARITHMETIC,
+	VIPS_PACKAGE_CONVERSION,
+	VIPS_PACKAGE_CREATE,
+	VIPS_PACKAGE_FOREIGN,
+	VIPS_PACKAGE_RESAMPLE,
+	VIPS_PACKAGE_COLOUR,
+	VIPS_PACKAGE_HISTOGRAM,
+	VIPS_PACKAGE_CONVOLUTION,
+	VIPS_PACKAGE_FREQFILT,
+	VIPS_PACKAGE_MORPHOLOGY,
+	VIPS_PACKAGE_DRAW,
+	VIPS_PACKAGE_MOSAICING,
+	VIPS_PACKAGE_LAST
+} VipsPackage;
+
+typedef struct _VipsPackageInit {
+	void (*init)( void );
+
+	/* init() runs exactly once.
+	 */
+	GOnce once;
+} VipsPackageInit;
+
+/* In the order vips_init() used to register them. vips_init() still 
+ * registers the base types, such as the interpolators.
+ */
+static VipsPackageInit vips_optable_package[VIPS_PACKAGE_LAST] = {
+	{ NULL, G_ONCE_INIT },
+	{ vips_arithmetic_operation_init, G_ONCE_INIT },
+	{ vips_conversion_operation_init, G_ONCE_INIT },
+	{ vips_create_operation_init, G_ONCE_INIT },
+	{ vips_foreign_operation_init, G_ONCE_INIT },
+	{ vips_resample_operation_init, G_ONCE_INIT },
+	{ vips_colour_operation_init, G_ONCE_INIT },
+	{ vips_histogram_operation_init, G_ONCE_INIT },
+	{ vips_convolution_operation_init, G_ONCE_INIT },
+	{ vips_freqfilt_operation_init, G_ONCE_INIT },
+	{ vips_morphology_operation_init, G_ONCE_INIT },
+	{ vips_draw_operation_init, G_ONCE_INIT },
+	{ vips_mosaicing_operation_init, G_ONCE_INIT }
+};
+
+typedef struct _VipsOptableEntry {
+	const char *nickname;
+	const char *type_name;
+	VipsPackage package;
+} VipsOptableEntry;
+
+/* Sorted by nickname. Some nicknames have several types, for example
+ * magickload for ImageMagick 6 and 7, and only one will be registered.
+ */
+static const VipsOptableEntry vips_optable[] = {
+	{ "CMC2LCh", "VipsCMC2LCh", VIPS_PACKAGE_COLOUR },
+	{ "HSV2sRGB", "VipsHSV2sRGB", VIPS_PACKAGE_COLOUR },
+	{ "LCh2CMC", "VipsLCh2CMC", VIPS_PACKAGE_COLOUR },
+	{ "LCh2Lab", "VipsLCh2Lab", VIPS_PACKAGE_COLOUR },
+	{ "Lab2LCh", "VipsLab2LCh", VIPS_PACKAGE_COLOUR },
+	{ "Lab2LabQ", "VipsLab2LabQ", VIPS_PACKAGE_COLOUR },
+	{ "Lab2LabS", "VipsLab2LabS", VIPS_PACKAGE_COLOUR },
+	{ "Lab2XYZ", "VipsLab2XYZ", VIPS_PACKAGE_COLOUR },
+	{ "LabQ2Lab", "VipsLabQ2Lab", VIPS_PACKAGE_COLOUR },
+	{ "LabQ2LabS", "VipsLabQ2LabS", VIPS_PACKAGE_COLOUR },
+	{ "LabQ2sRGB", "VipsLabQ2sRGB", VIPS_PACKAGE_COLOUR },
+	{ "LabS2Lab", "VipsLabS2Lab", VIPS_PACKAGE_COLOUR },
+	{ "LabS2LabQ", "VipsLabS2LabQ", VIPS_PACKAGE_COLOUR },
+	{ "XYZ2Lab", "VipsXYZ2Lab", VIPS_PACKAGE_COLOUR },
+	{ "XYZ2Yxy", "VipsXYZ2Yxy", VIPS_PACKAGE_COLOUR },
+	{ "XYZ2scRGB", "VipsXYZ2scRGB", VIPS_PACKAGE_COLOUR },
+	{ "Yxy2XYZ", "VipsYxy2XYZ", VIPS_PACKAGE_COLOUR },
+	{ "abs", "VipsAbs", VIPS_PACKAGE_ARITHMETIC },
+	{ "add", "VipsAdd", VIPS_PACKAGE_ARITHMETIC },
+	{ "affine", "VipsAffine", VIPS_PACKAGE_RESAMPLE },
+	{ "analyzeload", "VipsForeignLoadAnalyze", VIPS_PACKAGE_FOREIGN },
+	{ "arrayjoin", "VipsArrayjoin", VIPS_PACKAGE_CONVERSION },
+	{ "autorot", "VipsAutorot", VIPS_PACKAGE_CONVERSION },
+	{ "avg", "VipsAvg", VIPS_PACKAGE_ARITHMETIC },
+	{ "bandbool", "VipsBandbool", VIPS_PACKAGE_CONVERSION },
+	{ "bandfold", "VipsBandfold", VIPS_PACKAGE_CONVERSION },
+	{ "bandjoin", "VipsBandjoin", VIPS_PACKAGE_CONVERSION },
+	{ "bandjoin_const", "VipsBandjoinConst", VIPS_PACKAGE_CONVERSION },
+	{ "bandmean", "VipsBandmean", VIPS_PACKAGE_CONVERSION },
+	{ "bandrank", "VipsBandrank", VIPS_PACKAGE_CONVERSION },
+	{ "bandunfold", "VipsBandunfold", VIPS_PACKAGE_CONVERSION },
+	{ "bicubic", "VipsInterpolateBicubic", VIPS_PACKAGE_BASE },
+	{ "bilinear", "VipsInterpolateBilinear", VIPS_PACKAGE_BASE },
+	{ "black", "VipsBlack", VIPS_PACKAGE_CREATE },
+	{ "boolean", "VipsBoolean", VIPS_PACKAGE_ARITHMETIC },
+	{ "boolean_const", "VipsBooleanConst", VIPS_PACKAGE_ARITHMETIC },
+	{ "buildlut", "VipsBuildlut", VIPS_PACKAGE_CREATE },
+	{ "byteswap", "VipsByteswap", VIPS_PACKAGE_CONVERSION },
+	{ "cache", "VipsCache", VIPS_PACKAGE_CONVERSION },
+	{ "canny", "VipsCanny", VIPS_PACKAGE_CONVOLUTION },
+	{ "cast", "VipsCast", VIPS_PACKAGE_CONVERSION },
+	{ "colour_fused", "VipsColourFused", VIPS_PACKAGE_COLOUR },
+	{ "colour_lut", "VipsColourLut", VIPS_PACKAGE_COLOUR },
+	{ "colourspace", "VipsColourspace", VIPS_PACKAGE_COLOUR },
+	{ "compass", "VipsCompass", VIPS_PACKAGE_CONVOLUTION },
+	{ "complex", "VipsComplex", VIPS_PACKAGE_ARITHMETIC },
+	{ "complex2", "VipsComplex2", VIPS_PACKAGE_ARITHMETIC },
+	{ "complexform", "VipsComplexform", VIPS_PACKAGE_ARITHMETIC },
+	{ "complexget", "VipsComplexget", VIPS_PACKAGE_ARITHMETIC },
+	{ "composite", "VipsComposite", VIPS_PACKAGE_CONVERSION },
+	{ "composite2", "VipsComposite2", VIPS_PACKAGE_CONVERSION },
+	{ "conv", "VipsConv", VIPS_PACKAGE_CONVOLUTION },
+	{ "conva", "VipsConva", VIPS_PACKAGE_CONVOLUTION },
+	{ "convasep", "VipsConvasep", VIPS_PACKAGE_CONVOLUTION },
+	{ "convf", "VipsConvf", VIPS_PACKAGE_CONVOLUTION },
+	{ "convfft", "VipsConvfft", VIPS_PACKAGE_CONVOLUTION },
+	{ "convi", "VipsConvi", VIPS_PACKAGE_CONVOLUTION },
+	{ "convsep", "VipsConvsep", VIPS_PACKAGE_CONVOLUTION },
+	{ "copy", "VipsCopy", VIPS_PACKAGE_CONVERSION },
+	{ "countlines", "VipsCountlines", VIPS_PACKAGE_MORPHOLOGY },
+	{ "crop", "crop", VIPS_PACKAGE_CONVERSION },
+	{ "csvload", "VipsForeignLoadCsv", VIPS_PACKAGE_FOREIGN },
+	{ "csvsave", "VipsForeignSaveCsv", VIPS_PACKAGE_FOREIGN },
+	{ "dE00", "VipsdE00", VIPS_PACKAGE_COLOUR },
+	{ "dE76", "VipsdE76", VIPS_PACKAGE_COLOUR },
+	{ "dECMC", "VipsdECMC", VIPS_PACKAGE_COLOUR },
+	{ "deviate", "VipsDeviate", VIPS_PACKAGE_ARITHMETIC },
+	{ "divide", "VipsDivide", VIPS_PACKAGE_ARITHMETIC },
+	{ "draw_batch", "VipsDrawBatch", VIPS_PACKAGE_DRAW },
+	{ "draw_circle", "VipsDrawCircle", VIPS_PACKAGE_DRAW },
+	{ "draw_flood", "VipsDrawFlood", VIPS_PACKAGE_DRAW },
+	{ "draw_image", "VipsDrawImage", VIPS_PACKAGE_DRAW },
+	{ "draw_line", "VipsDrawLine", VIPS_PACKAGE_DRAW },
+	{ "draw_mask", "VipsDrawMask", VIPS_PACKAGE_DRAW },
+	{ "draw_rect", "VipsDrawRect", VIPS_PACKAGE_DRAW },
+	{ "draw_smudge", "VipsDrawSmudge", VIPS_PACKAGE_DRAW },
+	{ "dzsave", "VipsForeignSaveDzFile", VIPS_PACKAGE_FOREIGN },
+	{ "dzsave_buffer", "VipsForeignSaveDzBuffer", VIPS_PACKAGE_FOREIGN },
+	{ "embed", "VipsEmbed", VIPS_PACKAGE_CONVERSION },
+	{ "extract_area", "VipsExtractArea", VIPS_PACKAGE_CONVERSION },
+	{ "extract_band", "VipsExtractBand", VIPS_PACKAGE_CONVERSION },
+	{ "eye", "VipsEye", VIPS_PACKAGE_CREATE },
+	{ "falsecolour", "VipsFalsecolour", VIPS_PACKAGE_CONVERSION },
+	{ "fastcor", "VipsFastcor", VIPS_PACKAGE_CONVOLUTION },
+	{ "fill_nearest", "VipsFillNearest", VIPS_PACKAGE_MORPHOLOGY },
+	{ "find_template", "VipsFindTemplate", VIPS_PACKAGE_CONVOLUTION },
+	{ "find_trim", "VipsFindTrim", VIPS_PACKAGE_ARITHMETIC },
+	{ "fitsload", "VipsForeignLoadFits", VIPS_PACKAGE_FOREIGN },
+	{ "fitssave", "VipsForeignSaveFits", VIPS_PACKAGE_FOREIGN },
+	{ "flatten", "VipsFlatten", VIPS_PACKAGE_CONVERSION },
+	{ "flip", "VipsFlip", VIPS_PACKAGE_CONVERSION },
+	{ "float2rad", "VipsFloat2rad", VIPS_PACKAGE_COLOUR },
+	{ "fractsurf", "VipsFractsurf", VIPS_PACKAGE_CREATE },
+	{ "freqmult", "VipsFreqmult", VIPS_PACKAGE_FREQFILT },
+	{ "fwfft", "VipsFwfft", VIPS_PACKAGE_FREQFILT },
+	{ "gamma", "VipsGamma", VIPS_PACKAGE_CONVERSION },
+	{ "gaussblur", "VipsGaussblur", VIPS_PACKAGE_CONVOLUTION },
+	{ "gaussmat", "VipsGaussmat", VIPS_PACKAGE_CREATE },
+	{ "gaussnoise", "VipsGaussnoise", VIPS_PACKAGE_CREATE },
+	{ "getpoint", "VipsGetpoint", VIPS_PACKAGE_ARITHMETIC },
+	{ "getpoints", "VipsGetpoints", VIPS_PACKAGE_ARITHMETIC },
+	{ "gifload", "VipsForeignLoadGifFile", VIPS_PACKAGE_FOREIGN },
+	{ "gifload_buffer", "VipsForeignLoadGifBuffer", VIPS_PACKAGE_FOREIGN },
+	{ "gifsave", "VipsForeignSaveGifFile", VIPS_PACKAGE_FOREIGN },
+	{ "gifsave_buffer", "VipsForeignSaveGifBuffer", VIPS_PACKAGE_FOREIGN },
+	{ "gifsave_target", "VipsForeignSaveGifTarget", VIPS_PACKAGE_FOREIGN },
+	{ "globalbalance", "VipsGlobalbalance", VIPS_PACKAGE_MOSAICING },
+	{ "gravity", "VipsGravity", VIPS_PACKAGE_CONVERSION },
+	{ "grey", "VipsGrey", VIPS_PACKAGE_CREATE },
+	{ "grid", "VipsGrid", VIPS_PACKAGE_CONVERSION },
+	{ "hist_cum", "VipsHistCum", VIPS_PACKAGE_HISTOGRAM },
+	{ "hist_entropy", "VipsHistEntropy", VIPS_PACKAGE_HISTOGRAM },
+	{ "hist_equal", "VipsHistEqual", VIPS_PACKAGE_HISTOGRAM },
+	{ "hist_find", "VipsHistFind", VIPS_PACKAGE_ARITHMETIC },
+	{ "hist_find_indexed", "VipsHistFindIndexed", VIPS_PACKAGE_ARITHMETIC },
+	{ "hist_find_ndim", "VipsHistFindNDim", VIPS_PACKAGE_ARITHMETIC },
+	{ "hist_ismonotonic", "VipsHistIsmonotonic", VIPS_PACKAGE_HISTOGRAM },
+	{ "hist_local", "VipsHistLocal", VIPS_PACKAGE_HISTOGRAM },
+	{ "hist_match", "VipsHistMatch", VIPS_PACKAGE_HISTOGRAM },
+	{ "hist_norm", "VipsHistNorm", VIPS_PACKAGE_HISTOGRAM },
+	{ "hist_plot", "VipsHistPlot", VIPS_PACKAGE_HISTOGRAM },
+	{ "hough_circle", "VipsHoughCircle", VIPS_PACKAGE_ARITHMETIC },
+	{ "hough_line", "VipsHoughLine", VIPS_PACKAGE_ARITHMETIC },
+	{ "icc_export", "VipsIccExport", VIPS_PACKAGE_COLOUR },
+	{ "icc_import", "VipsIccImport", VIPS_PACKAGE_COLOUR },
+	{ "icc_transform", "VipsIccTransform", VIPS_PACKAGE_COLOUR },
+	{ "identity", "VipsIdentity", VIPS_PACKAGE_CREATE },
+	{ "ifthenelse", "VipsIfthenelse", VIPS_PACKAGE_CONVERSION },
+	{ "insert", "VipsInsert", VIPS_PACKAGE_CONVERSION },
+	{ "insert_many", "VipsInsertMany", VIPS_PACKAGE_CONVERSION },
+	{ "integral", "VipsIntegral", VIPS_PACKAGE_ARITHMETIC },
+	{ "invert", "VipsInvert", VIPS_PACKAGE_ARITHMETIC },
+	{ "invertlut", "VipsInvertlut", VIPS_PACKAGE_CREATE },
+	{ "invfft", "VipsInvfft", VIPS_PACKAGE_FREQFILT },
+	{ "join", "VipsJoin", VIPS_PACKAGE_CONVERSION },
+	{ "jpegload", "VipsForeignLoadJpegFile", VIPS_PACKAGE_FOREIGN },
+	{ "jpegload_buffer", "VipsForeignLoadJpegBuffer",
+		VIPS_PACKAGE_FOREIGN },
+	{ "jpegload_source", "VipsForeignLoadJpegSource",
+		VIPS_PACKAGE_FOREIGN },
+	{ "jpegsave", "VipsForeignSaveJpegFile", VIPS_PACKAGE_FOREIGN },
+	{ "jpegsave_buffer", "VipsForeignSaveJpegBuffer",
+		VIPS_PACKAGE_FOREIGN },
+	{ "jpegsave_mime", "VipsForeignSaveJpegMime", VIPS_PACKAGE_FOREIGN },
+	{ "jpegsave_target", "VipsForeignSaveJpegTarget",
+		VIPS_PACKAGE_FOREIGN },
+	{ "jpegtransform", "VipsForeignJpegTransform", VIPS_PACKAGE_FOREIGN },
+	{ "labelregions", "VipsLabelregions", VIPS_PACKAGE_MORPHOLOGY },
+	{ "lbb", "VipsInterpolateLbb", VIPS_PACKAGE_BASE },
+	{ "linear", "VipsLinear", VIPS_PACKAGE_ARITHMETIC },
+	{ "linecache", "VipsLineCache", VIPS_PACKAGE_CONVERSION },
+	{ "logmat", "VipsLogmat", VIPS_PACKAGE_CREATE },
+	{ "magickload", "VipsForeignLoadMagickFile", VIPS_PACKAGE_FOREIGN },
+	{ "magickload", "VipsForeignLoadMagick7File", VIPS_PACKAGE_FOREIGN },
+	{ "magickload_buffer", "VipsForeignLoadMagickBuffer",
+		VIPS_PACKAGE_FOREIGN },
+	{ "magickload_buffer", "VipsForeignLoadMagick7Buffer",
+		VIPS_PACKAGE_FOREIGN },
+	{ "magicksave", "VipsForeignSaveMagickFile", VIPS_PACKAGE_FOREIGN },
+	{ "magicksave_buffer", "VipsForeignSaveMagickBuffer",
+		VIPS_PACKAGE_FOREIGN },
+	{ "mapim", "VipsMapim", VIPS_PACKAGE_RESAMPLE },
+	{ "maplut", "VipsMaplut", VIPS_PACKAGE_HISTOGRAM },
+	{ "maplut3d", "VipsMaplut3d", VIPS_PACKAGE_COLOUR },
+	{ "mask_butterworth", "VipsMaskButterworth", VIPS_PACKAGE_CREATE },
+	{ "mask_butterworth_band", "VipsMaskButterworthBand",
+		VIPS_PACKAGE_CREATE },
+	{ "mask_butterworth_ring", "VipsMaskButterworthRing",
+		VIPS_PACKAGE_CREATE },
+	{ "mask_fractal", "VipsMaskFractal", VIPS_PACKAGE_CREATE },
+	{ "mask_gaussian", "VipsMaskGaussian", VIPS_PACKAGE_CREATE },
+	{ "mask_gaussian_band", "VipsMaskGaussianBand", VIPS_PACKAGE_CREATE },
+	{ "mask_gaussian_ring", "VipsMaskGaussianRing", VIPS_PACKAGE_CREATE },
+	{ "mask_ideal", "VipsMaskIdeal", VIPS_PACKAGE_CREATE },
+	{ "mask_ideal_band", "VipsMaskIdealBand", VIPS_PACKAGE_CREATE },
+	{ "mask_ideal_ring", "VipsMaskIdealRing", VIPS_PACKAGE_CREATE },
+	{ "match", "VipsMatch", VIPS_PACKAGE_MOSAICING },
+	{ "math", "VipsMath", VIPS_PACKAGE_ARITHMETIC },
+	{ "math2", "VipsMath2", VIPS_PACKAGE_ARITHMETIC },
+	{ "math2_const", "VipsMath2Const", VIPS_PACKAGE_ARITHMETIC },
+	{ "matload", "VipsForeignLoadMat", VIPS_PACKAGE_FOREIGN },
+	{ "matrixload", "VipsForeignLoadMatrix", VIPS_PACKAGE_FOREIGN },
+	{ "matrixprint", "VipsForeignPrintMatrix", VIPS_PACKAGE_FOREIGN },
+	{ "matrixsave", "VipsForeignSaveMatrix", VIPS_PACKAGE_FOREIGN },
+	{ "max", "VipsMax", VIPS_PACKAGE_ARITHMETIC },
+	{ "measure", "VipsMeasure", VIPS_PACKAGE_ARITHMETIC },
+	{ "merge", "VipsMerge", VIPS_PACKAGE_MOSAICING },
+	{ "min", "VipsMin", VIPS_PACKAGE_ARITHMETIC },
+	{ "morph", "VipsMorph", VIPS_PACKAGE_MORPHOLOGY },
+	{ "mosaic", "VipsMosaic", VIPS_PACKAGE_MOSAICING },
+	{ "mosaic1", "VipsMosaic1", VIPS_PACKAGE_MOSAICING },
+	{ "msb", "VipsMsb", VIPS_PACKAGE_CONVERSION },
+	{ "multiply", "VipsMultiply", VIPS_PACKAGE_ARITHMETIC },
+	{ "nearest", "VipsInterpolateNearest", VIPS_PACKAGE_BASE },
+	{ "nohalo", "VipsInterpolateNohalo", VIPS_PACKAGE_BASE },
+	{ "openexrload", "VipsForeignLoadOpenexr", VIPS_PACKAGE_FOREIGN },
+	{ "openslideload", "VipsForeignLoadOpenslide", VIPS_PACKAGE_FOREIGN },
+	{ "pdfload", "VipsForeignLoadPdfFile", VIPS_PACKAGE_FOREIGN },
+	{ "pdfload_buffer", "VipsForeignLoadPdfBuffer", VIPS_PACKAGE_FOREIGN },
+	{ "percent", "VipsPercent", VIPS_PACKAGE_HISTOGRAM },
+	{ "percentiles", "VipsPercentiles", VIPS_PACKAGE_ARITHMETIC },
+	{ "perlin", "VipsPerlin", VIPS_PACKAGE_CREATE },
+	{ "phasecor", "VipsPhasecor", VIPS_PACKAGE_FREQFILT },
+	{ "phasecor_batch", "VipsPhasecorBatch", VIPS_PACKAGE_FREQFILT },
+	{ "pngload", "VipsForeignLoadPng", VIPS_PACKAGE_FOREIGN },
+	{ "pngload_buffer", "VipsForeignLoadPngBuffer", VIPS_PACKAGE_FOREIGN },
+	{ "pngload_source", "VipsForeignLoadPngSource", VIPS_PACKAGE_FOREIGN },
+	{ "pngsave", "VipsForeignSavePngFile", VIPS_PACKAGE_FOREIGN },
+	{ "pngsave_buffer", "VipsForeignSavePngBuffer", VIPS_PACKAGE_FOREIGN },
+	{ "pngsave_target", "VipsForeignSavePngTarget", VIPS_PACKAGE_FOREIGN },
+	{ "ppmload", "VipsForeignLoadPpm", VIPS_PACKAGE_FOREIGN },
+	{ "ppmsave", "VipsForeignSavePpm", VIPS_PACKAGE_FOREIGN },
+	{ "premultiply", "VipsPremultiply", VIPS_PACKAGE_CONVERSION },
+	{ "profile", "VipsProfile", VIPS_PACKAGE_ARITHMETIC },
+	{ "project", "VipsProject", VIPS_PACKAGE_ARITHMETIC },
+	{ "quadratic", "VipsQuadratic", VIPS_PACKAGE_RESAMPLE },
+	{ "rad2float", "VipsRad2float", VIPS_PACKAGE_COLOUR },
+	{ "radload", "VipsForeignLoadRad", VIPS_PACKAGE_FOREIGN },
+	{ "radsave", "VipsForeignSaveRadFile", VIPS_PACKAGE_FOREIGN },
+	{ "radsave_buffer", "VipsForeignSaveRadBuffer", VIPS_PACKAGE_FOREIGN },
+	{ "rank", "VipsRank", VIPS_PACKAGE_MORPHOLOGY },
+	{ "rawload", "VipsForeignLoadRaw", VIPS_PACKAGE_FOREIGN },
+	{ "rawsave", "VipsForeignSaveRaw", VIPS_PACKAGE_FOREIGN },
+	{ "rawsave_fd", "VipsForeignSaveRawFd", VIPS_PACKAGE_FOREIGN },
+	{ "recomb", "VipsRecomb", VIPS_PACKAGE_CONVERSION },
+	{ "reduce", "VipsReduce", VIPS_PACKAGE_RESAMPLE },
+	{ "reduceh", "VipsReduceh", VIPS_PACKAGE_RESAMPLE },
+	{ "reducev", "VipsReducev", VIPS_PACKAGE_RESAMPLE },
+	{ "relational", "VipsRelational", VIPS_PACKAGE_ARITHMETIC },
+	{ "relational_const", "VipsRelationalConst", VIPS_PACKAGE_ARITHMETIC },
+	{ "remainder", "VipsRemainder", VIPS_PACKAGE_ARITHMETIC },
+	{ "remainder_const", "VipsRemainderConst", VIPS_PACKAGE_ARITHMETIC },
+	{ "remosaic", "VipsRemosaic", VIPS_PACKAGE_MOSAICING },
+	{ "replicate", "VipsReplicate", VIPS_PACKAGE_CONVERSION },
+	{ "resize", "VipsResize", VIPS_PACKAGE_RESAMPLE },
+	{ "rot", "VipsRot", VIPS_PACKAGE_CONVERSION },
+	{ "rot45", "VipsRot45", VIPS_PACKAGE_CONVERSION },
+	{ "rotate", "VipsRotate", VIPS_PACKAGE_RESAMPLE },
+	{ "round", "VipsRound", VIPS_PACKAGE_ARITHMETIC },
+	{ "sRGB2HSV", "VipssRGB2HSV", VIPS_PACKAGE_COLOUR },
+	{ "sRGB2scRGB", "VipssRGB2scRGB", VIPS_PACKAGE_COLOUR },
+	{ "scRGB2BW", "VipsscRGB2BW", VIPS_PACKAGE_COLOUR },
+	{ "scRGB2XYZ", "VipsscRGB2XYZ", VIPS_PACKAGE_COLOUR },
+	{ "scRGB2sRGB", "VipsscRGB2sRGB", VIPS_PACKAGE_COLOUR },
+	{ "scale", "VipsScale", VIPS_PACKAGE_CONVERSION },
+	{ "sequential", "VipsSequential", VIPS_PACKAGE_CONVERSION },
+	{ "sharpen", "VipsSharpen", VIPS_PACKAGE_CONVOLUTION },
+	{ "shrink", "VipsShrink", VIPS_PACKAGE_RESAMPLE },
+	{ "shrinkh", "VipsShrinkh", VIPS_PACKAGE_RESAMPLE },
+	{ "shrinkv", "VipsShrinkv", VIPS_PACKAGE_RESAMPLE },
+	{ "sign", "VipsSign", VIPS_PACKAGE_ARITHMETIC },
+	{ "similarity", "VipsSimilarity", VIPS_PACKAGE_RESAMPLE },
+	{ "sines", "VipsSines", VIPS_PACKAGE_CREATE },
+	{ "smartcrop", "VipsSmartcrop", VIPS_PACKAGE_CONVERSION },
+	{ "sobel", "VipsSobel", VIPS_PACKAGE_CONVOLUTION },
+	{ "spcor", "VipsSpcor", VIPS_PACKAGE_CONVOLUTION },
+	{ "spectrum", "VipsSpectrum", VIPS_PACKAGE_FREQFILT },
+	{ "statistics", "VipsStatistics", VIPS_PACKAGE_ARITHMETIC },
+	{ "stats", "VipsStats", VIPS_PACKAGE_ARITHMETIC },
+	{ "stdif", "VipsStdif", VIPS_PACKAGE_HISTOGRAM },
+	{ "subsample", "VipsSubsample", VIPS_PACKAGE_CONVERSION },
+	{ "subtract", "VipsSubtract", VIPS_PACKAGE_ARITHMETIC },
+	{ "sum", "VipsSum", VIPS_PACKAGE_ARITHMETIC },
+	{ "svgload", "VipsForeignLoadSvgFile", VIPS_PACKAGE_FOREIGN },
+	{ "svgload_buffer", "VipsForeignLoadSvgBuffer", VIPS_PACKAGE_FOREIGN },
+	{ "tee", "VipsTee", VIPS_PACKAGE_ARITHMETIC },
+	{ "text", "VipsText", VIPS_PACKAGE_CREATE },
+	{ "thumbnail", "VipsThumbnailFile", VIPS_PACKAGE_RESAMPLE },
+	{ "thumbnail_buffer", "VipsThumbnailBuffer", VIPS_PACKAGE_RESAMPLE },
+	{ "thumbnail_image", "VipsThumbnailImage", VIPS_PACKAGE_RESAMPLE },
+	{ "tiffload", "VipsForeignLoadTiffFile", VIPS_PACKAGE_FOREIGN },
+	{ "tiffload_buffer", "VipsForeignLoadTiffBuffer",
+		VIPS_PACKAGE_FOREIGN },
+	{ "tiffload_source", "VipsForeignLoadTiffSource",
+		VIPS_PACKAGE_FOREIGN },
+	{ "tiffsave", "VipsForeignSaveTiffFile", VIPS_PACKAGE_FOREIGN },
+	{ "tiffsave_buffer", "VipsForeignSaveTiffBuffer",
+		VIPS_PACKAGE_FOREIGN },
+	{ "tiffsave_target", "VipsForeignSaveTiffTarget",
+		VIPS_PACKAGE_FOREIGN },
+	{ "tilecache", "VipsTileCache", VIPS_PACKAGE_CONVERSION },
+	{ "tonelut", "VipsTonelut", VIPS_PACKAGE_CREATE },
+	{ "unpremultiply", "VipsUnpremultiply", VIPS_PACKAGE_CONVERSION },
+	{ "vipsload", "VipsForeignLoadVips", VIPS_PACKAGE_FOREIGN },
+	{ "vipssave", "VipsForeignSaveVips", VIPS_PACKAGE_FOREIGN },
+	{ "vsqbs", "VipsInterpolateVsqbs", VIPS_PACKAGE_BASE },
+	{ "webpload", "VipsForeignLoadWebpFile", VIPS_PACKAGE_FOREIGN },
+	{ "webpload_buffer", "VipsForeignLoadWebpBuffer",
+		VIPS_PACKAGE_FOREIGN },
+	{ "webpload_source", "VipsForeignLoadWebpSource",
+		VIPS_PACKAGE_FOREIGN },
+	{ "webpsave", "VipsForeignSaveWebpFile", VIPS_PACKAGE_FOREIGN },
+	{ "webpsave_buffer", "VipsForeignSaveWebpBuffer",
+		VIPS_PACKAGE_FOREIGN },
+	{ "webpsave_mime", "VipsForeignSaveWebpMime", VIPS_PACKAGE_FOREIGN },
+	{ "webpsave_target", "VipsForeignSaveWebpTarget",
+		VIPS_PACKAGE_FOREIGN },
+	{ "worley", "VipsWorley", VIPS_PACKAGE_CREATE },
+	{ "wrap", "VipsWrap", VIPS_PACKAGE_CONVERSION },
+	{ "xyz", "VipsXyz", VIPS_PACKAGE_CREATE },
+	{ "zone", "VipsZone", VIPS_PACKAGE_CREATE },
+	{ "zoom", "VipsZoom", VIPS_PACKAGE_CONVERSION },
+};
+
+/* nickname -> the first VipsOptableEntry with that nickname.
+ */
+static GHashTable *vips_optable_table = NULL;
+
+static void *
+vips_optable_build( void *client )
+{
+	int i;
+
+	vips_optable_table = g_hash_table_new( g_str_hash, g_str_equal );
+	for( i = 0; i < VIPS_NUMBER( vips_optable ); i++ ) 
+		if( !g_hash_table_lookup( vips_optable_table, 
+			vips_optable[i].nickname ) )
+			g_hash_table_insert( vips_optable_table,
+				(gpointer) vips_optable[i].nickname,
+				(gpointer) &vips_optable[i] );
+
+	return( NULL );
+}
+
+static void *
+vips_optable_package_once( void *client )
+{
+	VipsPackageInit *init = (VipsPackageInit *) client;
+
+#ifdef DEBUG
+	printf( "vips_optable_package_once: %d\n", 
+		(int) (init - vips_optable_package) );
+#endif /*DEBUG*/
+
+	if( init->init )
+		init->init();
+
+	return( NULL );
+}
+
+static void
+vips_optable_package_init( VipsPackage package )
+{
+	VipsPackageInit *init = &vips_optable_package[package];
+
+	VIPS_ONCE( &init->once, vips_optable_package_once, init );
+}
+
+/* Register every package. 
+ */
+void
+vips__optable_init_all( void )
+{
+	int i;
+
+	for( i = 0; i < VIPS_PACKAGE_LAST; i++ )
+		vips_optable_package_init( i );
+}
+
+/* Find the type for a nickname, registering its package if necessary. 0
+ * for not in the table, or not in this build.
+ */
+GType
+vips__optable_find( const char *nickname )
+{
+	static GOnce once = G_ONCE_INIT;
+
+	const VipsOptableEntry *entry;
+	const VipsOptableEntry *end;
+
+	VIPS_ONCE( &once, (GThreadFunc) vips_optable_build, NULL ); 
+
+	if( !(entry = (const VipsOptableEntry *) 
+		g_hash_table_lookup( vips_optable_table, nickname )) )
+		return( 0 );
+
+	end = vips_optable + VIPS_NUMBER( vips_optable );
+	for( ; entry < end && strcmp( entry->nickname, nickname ) == 0; 
+		entry++ ) {
+		GType type;
+
+		vips_optable_package_init( entry->package );
+		if( (type = g_type_from_name( entry->type_name )) )
+			return( type );
+	}
+
+	return( 0 );
+}
+
+static void *
+vips_optable_check_type( GType type, void *a )
+{
+	int *n_missing = (int *) a;
+	VipsObjectClass *class;
+	int i;
+
+	if( G_TYPE_IS_ABSTRACT( type ) )
+		return( NULL );
+
+	class = VIPS_OBJECT_CLASS( g_type_class_ref( type ) );
+	for( i = 0; i < VIPS_NUMBER( vips_optable ); i++ )
+		if( strcmp( vips_optable[i].nickname, class->nickname ) == 0 &&
+			strcmp( vips_optable[i].type_name, 
+				g_type_name( type ) ) == 0 )
+			break;
+	if( i == VIPS_NUMBER( vips_optable ) ) {
+		vips_error( "optable", _( "%s (%s) is not in the table" ),
+			g_type_name( type ), class->nickname );
+		*n_missing += 1;
+	}
+	g_type_class_unref( class );
+
+	return( NULL );
+}
+
+/* Check that every operation this build registers is in the table, with
+ * the right type name. Used by "make check" to stop the table going stale.
+ */
+int
+vips__optable_check( void )
+{
+	int n_missing;
+
+	vips__optable_init_all();
+
+	n_missing = 0;
+	vips_type_map_all( VIPS_TYPE_OPERATION, 
+		(VipsTypeMapFn) vips_optable_check_type, &n_missing );
+
+	return( n_missing ? -1 : 0 );
+}
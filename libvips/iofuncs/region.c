@@ -43,6 +43,16 @@
  * 	- move on top of VipsObject, rename as VipsRegion
  * 23/2/17
  * 	- multiply transparent images through alpha in vips_region_shrink()
+ * 14/10/18
+ * 	- update operation stats on prepare and generate
+ * 	- add a per-image pool of spare regions
+ * 	- add vips_region_prefetch()
+ * 	- vips_region_image() supports strided image memory
+ * 	- record tile size and buffer size in per-image stats
+ * 	- time vips_buffer_unref_ref() for vips_gate_stats_set()
+ * 	- add lanes, helper threads which prepare a region in parallel with
+ * 	  its owner
+ * 	- add vips_region_shrink_method(), plus a SIMD kernel for the mean
  */
 
 /*
@@ -96,6 +106,7 @@
 #include <vips/internal.h>
 #include <vips/thread.h>
 #include <vips/debug.h>
+#include <vips/simd.h>
 
 /**
  * SECTION: region
@@ -241,11 +252,26 @@ vips__region_start( VipsRegion *region )
 
                         return( -1 );
                 }
+
+		if( vips__operation_stats ) {
+			VipsImagePrivate *private = 
+				vips__image_private( image );
+
+			if( private->stats )
+				vips__operation_stats_sequence( 
+					&private->generate_stats );
+		}
         }
 
         return( 0 );
 }
 
+/* See vips__region_lane_start().
+ */
+static GQuark vips__region_lane_quark = 0;
+
+static void vips_region_lane_stop( VipsRegion *region );
+
 /* Call a stop function if a sequence is running in this VipsRegion. 
  */
 void
@@ -253,6 +279,8 @@ vips__region_stop( VipsRegion *region )
 {
 	VipsImage *image = region->im;
 
+	vips_region_lane_stop( region );
+
         if( region->seq && image->stop_fn ) {
 		int result;
 
@@ -450,6 +478,144 @@ vips__region_no_ownership( VipsRegion *region )
 	g_mutex_unlock( region->im->sslock );
 }
 
+/* Stats for the spare region pool, see vips__region_pool_get().
+ */
+int vips__region_pool_hits = 0;
+int vips__region_pool_misses = 0;
+
+/* Keep at most this many spare regions per image.
+ */
+#define VIPS_REGION_POOL_MAX (2 * vips_concurrency_get())
+
+/* Get a region on @image, reusing a spare if we can. Sequence start 
+ * functions use this, see vips_start_one(), so pipelines that are run 
+ * many times don't keep making and finalizing region objects.
+ */
+VipsRegion *
+vips__region_pool_get( VipsImage *image )
+{
+	VipsImagePrivate *private = vips__image_private( image );
+
+	VipsRegion *region;
+
+	region = NULL;
+
+	g_mutex_lock( image->sslock );
+
+	if( private->spare_regions ) {
+		region = (VipsRegion *) private->spare_regions->data;
+		private->spare_regions = g_slist_delete_link( 
+			private->spare_regions, private->spare_regions );
+		private->n_spare_regions -= 1;
+
+		/* Spares don't hold a ref to their image.
+		 */
+		g_object_ref( image );
+	}
+
+	g_mutex_unlock( image->sslock );
+
+	if( !region ) {
+		g_atomic_int_inc( &vips__region_pool_misses );
+
+		return( vips_region_new( image ) );
+	}
+
+	g_atomic_int_inc( &vips__region_pool_hits );
+
+	vips__region_take_ownership( region );
+
+	return( region );
+}
+
+/* Finished with a region from vips__region_pool_get(). Stop the sequence, 
+ * drop any pixels and keep the region object for reuse. The caller's ref 
+ * passes to the pool.
+ */
+void
+vips__region_pool_put( VipsRegion *region )
+{
+	VipsImage *image = region->im;
+	VipsImagePrivate *private = vips__image_private( image );
+
+	gboolean spare;
+
+	/* Someone else has a ref, or it's been through a close: we can't 
+	 * reuse it.
+	 */
+	if( G_OBJECT( region )->ref_count != 1 ||
+		VIPS_OBJECT( region )->preclose ) {
+		g_object_unref( region );
+		return;
+	}
+
+	vips__region_stop( region );
+	VIPS_FREEF( vips_window_unref, region->window );
+	VIPS_FREEF( vips_buffer_unref, region->buffer );
+
+	region->valid.left = 0;
+	region->valid.top = 0;
+	region->valid.width = 0;
+	region->valid.height = 0;
+	region->type = VIPS_REGION_NONE;
+	region->data = NULL;
+	region->bpl = 0;
+	region->invalid = FALSE;
+
+	spare = FALSE;
+
+	g_mutex_lock( image->sslock );
+
+	if( private->n_spare_regions < VIPS_REGION_POOL_MAX ) {
+		region->thread = NULL;
+		private->spare_regions = 
+			g_slist_prepend( private->spare_regions, region );
+		private->n_spare_regions += 1;
+		spare = TRUE;
+	}
+
+	g_mutex_unlock( image->sslock );
+
+	/* The spare region no longer holds a ref to the image. This can 
+	 * dispose @image, and that will free the spare we just made.
+	 */
+	if( spare )
+		g_object_unref( image );
+	else
+		g_object_unref( region );
+}
+
+/* Free all spare regions on an image. Called from image dispose and when 
+ * an image is rewound.
+ */
+void
+vips__region_pool_drain( VipsImage *image )
+{
+	VipsImagePrivate *private = vips__image_private( image );
+
+	GSList *spare;
+	GSList *p;
+
+	g_mutex_lock( image->sslock );
+
+	spare = private->spare_regions;
+	private->spare_regions = NULL;
+	private->n_spare_regions = 0;
+
+	g_mutex_unlock( image->sslock );
+
+	for( p = spare; p; p = p->next ) {
+		VipsRegion *region = (VipsRegion *) p->data;
+
+		/* Region dispose will drop the image ref we give back here.
+		 */
+		g_object_ref( image );
+		g_object_unref( region );
+	}
+
+	g_slist_free( spare );
+}
+
 static int
 vips_region_build( VipsObject *object )
 {
@@ -491,6 +657,9 @@ vips_region_class_init( VipsRegionClass *class )
 	vobject_class->dump = vips_region_dump;
 	vobject_class->sanity = vips_region_sanity;
 	vobject_class->build = vips_region_build;
+
+	vips__region_lane_quark =
+		g_quark_from_static_string( "vips-region-lane" );
 }
 
 static void
@@ -603,12 +772,18 @@ vips_region_buffer( VipsRegion *reg, const VipsRect *r )
 			return( -1 );
 	}
 	else {
+		gint64 start = vips__gate_stats ? vips__get_time() : 0;
+
 		/* We combine buffer unref and new buffer ref in one call 
 		 * to reduce malloc/free cycling.
 		 */
 		if( !(reg->buffer = 
 			vips_buffer_unref_ref( reg->buffer, im, &clipped )) ) 
 			return( -1 );
+
+		if( vips__gate_stats )
+			vips__gate_time( VIPS_GATE_STAT_BUFFER,
+				vips__get_time() - start );
 	}
 
 	/* Init new stuff.
@@ -670,8 +845,14 @@ vips_region_image( VipsRegion *reg, const VipsRect *r )
 		 * incompletely calculated memory buffer. Just set valid to r.
 		 */
 		reg->valid = clipped;
-		reg->bpl = VIPS_IMAGE_SIZEOF_LINE( image );
-		reg->data = VIPS_IMAGE_ADDR( image, clipped.left, clipped.top );
+
+		/* Foreign memory can have a line stride. Regions can 
+		 * handle that, so there's no need to copy.
+		 */
+		reg->bpl = vips__image_stride( image );
+		reg->data = image->data + 
+			(guint64) clipped.top * reg->bpl +
+			(guint64) clipped.left * VIPS_IMAGE_SIZEOF_PEL( image );
 		reg->type = VIPS_REGION_OTHER_IMAGE;
 	}
 	else if( image->dtype == VIPS_IMAGE_OPENIN ) {
@@ -1213,6 +1394,8 @@ vips_region_shrink_uncoded( VipsRegion *from,
 	int ls = VIPS_REGION_LSKIP( from );
 	int ps = VIPS_IMAGE_SIZEOF_PEL( from->im );
 	int nb = from->im->Bands;
+	VipsSimdShrink2Fn simd = (VipsSimdShrink2Fn)
+		vips_simd_get( VIPS_SIMD_SHRINK2, from->im->BandFmt );
 
 	int x, y, z;
 
@@ -1222,6 +1405,11 @@ vips_region_shrink_uncoded( VipsRegion *from,
 		VipsPel *q = VIPS_REGION_ADDR( to, 
 			target->left, target->top + y );
 
+		if( simd ) {
+			simd( q, p, ls, target->width, nb );
+			continue;
+		}
+
 		/* Process this line of pels.
 		 */
 		switch( from->im->BandFmt ) {
@@ -1331,20 +1519,121 @@ vips_region_shrink_alpha( VipsRegion *from,
 	}
 }
 
+/* The lower of the two middle values of four, so always one of the inputs.
+ */
+#define MEDIAN4( A, B, C, D ) \
+	VIPS_MAX( VIPS_MIN( A, B ), VIPS_MIN( C, D ) )
+
+/* The most common of four values, or the first if they are all different.
+ */
+#define MODE4( A, B, C, D ) \
+	((A) == (B) || (A) == (C) || (A) == (D) ? (A) : \
+	 (B) == (C) || (B) == (D) ? (B) : \
+	 (C) == (D) ? (C) : (A))
+
+#define MAX4( A, B, C, D ) \
+	VIPS_MAX( VIPS_MAX( A, B ), VIPS_MAX( C, D ) )
+
+#define MIN4( A, B, C, D ) \
+	VIPS_MIN( VIPS_MIN( A, B ), VIPS_MIN( C, D ) )
+
+#define SHRINK_TYPE_RANK( TYPE, OP ) \
+	for( x = 0; x < target->width; x++ ) { \
+		TYPE *tp = (TYPE *) p; \
+		TYPE *tp1 = (TYPE *) (p + ls); \
+		TYPE *tq = (TYPE *) q; \
+		\
+		for( z = 0; z < nb; z++ ) \
+			tq[z] = OP( tp[z], tp[z + nb], tp1[z], tp1[z + nb] ); \
+		\
+		/* Move on two pels in input. \
+		 */ \
+		p += ps << 1; \
+		q += ps; \
+	}
+
+#define SHRINK_RANK_SWITCH( OP ) \
+	switch( from->im->BandFmt ) { \
+	case VIPS_FORMAT_UCHAR:	\
+		SHRINK_TYPE_RANK( unsigned char, OP );  break; \
+	case VIPS_FORMAT_CHAR:	\
+		SHRINK_TYPE_RANK( signed char, OP );  break; \
+	case VIPS_FORMAT_USHORT: \
+		SHRINK_TYPE_RANK( unsigned short, OP );  break; \
+	case VIPS_FORMAT_SHORT:	\
+		SHRINK_TYPE_RANK( signed short, OP );  break; \
+	case VIPS_FORMAT_UINT: \
+		SHRINK_TYPE_RANK( unsigned int, OP );  break; \
+	case VIPS_FORMAT_INT: \
+		SHRINK_TYPE_RANK( signed int, OP );  break; \
+	case VIPS_FORMAT_FLOAT:	\
+		SHRINK_TYPE_RANK( float, OP );  break; \
+	case VIPS_FORMAT_DOUBLE: \
+		SHRINK_TYPE_RANK( double, OP );  break; \
+	\
+	default: \
+		g_assert_not_reached(); \
+	}
+
+/* Generate area @target in @to using pixels in @from with one of the
+ * non-mean methods. Non-complex. Bands are all treated alike, alpha too.
+ */
+static void
+vips_region_shrink_rank( VipsRegion *from,
+	VipsRegion *to, const VipsRect *target, VipsRegionShrink method )
+{
+	int ls = VIPS_REGION_LSKIP( from );
+	int ps = VIPS_IMAGE_SIZEOF_PEL( from->im );
+	int nb = from->im->Bands;
+
+	int x, y, z;
+
+	for( y = 0; y < target->height; y++ ) {
+		VipsPel *p = VIPS_REGION_ADDR( from,
+			target->left * 2, (target->top + y) * 2 );
+		VipsPel *q = VIPS_REGION_ADDR( to,
+			target->left, target->top + y );
+
+		switch( method ) {
+		case VIPS_REGION_SHRINK_MEDIAN:
+			SHRINK_RANK_SWITCH( MEDIAN4 ); break;
+
+		case VIPS_REGION_SHRINK_MODE:
+			SHRINK_RANK_SWITCH( MODE4 ); break;
+
+		case VIPS_REGION_SHRINK_MAX:
+			SHRINK_RANK_SWITCH( MAX4 ); break;
+
+		case VIPS_REGION_SHRINK_MIN:
+			SHRINK_RANK_SWITCH( MIN4 ); break;
+
+		default:
+			g_assert_not_reached();
+		}
+	}
+}
+
 /**
- * vips_region_shrink:
+ * vips_region_shrink_method:
  * @from: source region 
  * @to: (inout): destination region 
  * @target: #VipsRect of pixels you need to copy
+ * @method: method to use when generating target pixels
  *
  * Write the pixels @target in @to from the x2 larger area in @from.
- * Non-complex uncoded images and LABQ only. Images with alpha (see
- * vips_image_hasalpha()) shrink with pixels scaled by alpha to avoid fringing.
+ * Non-complex uncoded images and LABQ only.
  *
- * See also: vips_region_copy().
+ * #VIPS_REGION_SHRINK_MEAN averages each 2x2 block. Images with alpha (see
+ * vips_image_hasalpha()) shrink with pixels scaled by alpha to avoid
+ * fringing. The other methods pick one of the four values for each band,
+ * so they are useful for label maps and masks, where an average would
+ * make values which are not in the image. LABQ images always use the mean.
+ *
+ * See also: vips_region_shrink(), vips_region_copy().
  */
 int
-vips_region_shrink( VipsRegion *from, VipsRegion *to, const VipsRect *target )
+vips_region_shrink_method( VipsRegion *from, VipsRegion *to,
+	const VipsRect *target, VipsRegionShrink method )
 {
 	VipsImage *image = from->im;
 
@@ -1355,7 +1644,9 @@ vips_region_shrink( VipsRegion *from, VipsRegion *to, const VipsRect *target )
 		if( vips_check_noncomplex(  "vips_region_shrink", image ) )
 			return( -1 );
 
-		if( vips_image_hasalpha( image ) ) 
+		if( method != VIPS_REGION_SHRINK_MEAN )
+			vips_region_shrink_rank( from, to, target, method );
+		else if( vips_image_hasalpha( image ) )
 			vips_region_shrink_alpha( from, to, target );
 		else
 			vips_region_shrink_uncoded( from, to, target );
@@ -1366,6 +1657,24 @@ vips_region_shrink( VipsRegion *from, VipsRegion *to, const VipsRect *target )
 	return( 0 );
 }
 
+/**
+ * vips_region_shrink:
+ * @from: source region
+ * @to: (inout): destination region
+ * @target: #VipsRect of pixels you need to copy
+ *
+ * Write the pixels @target in @to from the x2 larger area in @from by
+ * averaging each 2x2 block.
+ *
+ * See also: vips_region_shrink_method(), vips_region_copy().
+ */
+int
+vips_region_shrink( VipsRegion *from, VipsRegion *to, const VipsRect *target )
+{
+	return( vips_region_shrink_method( from, to, target,
+		VIPS_REGION_SHRINK_MEAN ) );
+}
+
 /* Generate into a region. 
  */
 static int
@@ -1373,7 +1682,9 @@ vips_region_generate( VipsRegion *reg )
 {
 	VipsImage *im = reg->im;
 
+	VipsImagePrivate *private;
 	gboolean stop;
+	int result;
 
         /* Start new sequence, if necessary.
          */
@@ -1383,7 +1694,22 @@ vips_region_generate( VipsRegion *reg )
 	/* Ask for evaluation.
 	 */
 	stop = FALSE;
-	if( im->generate_fn( reg, reg->seq, im->client1, im->client2, &stop ) )
+	if( vips__operation_stats && 
+		(private = vips__image_private( im ))->stats ) {
+		VipsOperationStatsScope scope;
+
+		vips__operation_stats_enter( &scope, 
+			private->stats, &private->generate_stats );
+		result = im->generate_fn( reg, 
+			reg->seq, im->client1, im->client2, &stop );
+		vips__operation_stats_leave( &scope, 
+			reg->valid.width, reg->valid.height,
+			reg->buffer ? reg->buffer->bsize : 0 );
+	}
+	else
+		result = im->generate_fn( reg, 
+			reg->seq, im->client1, im->client2, &stop );
+	if( result )
 		return( -1 );
 	if( stop ) {
 		vips_error( "vips_region_generate", 
@@ -1427,6 +1753,13 @@ vips_region_prepare( VipsRegion *reg, const VipsRect *r )
 	if( vips_image_iskilled( im ) )
 		return( -1 );
 
+	if( vips__operation_stats ) {
+		VipsImagePrivate *private = vips__image_private( im );
+
+		if( private->stats )
+			vips__operation_stats_prepare( private->stats );
+	}
+
 	/* We use save for sanity checking valid: we test at the end that the
 	 * pixels we have generated are indeed all the ones that were asked
 	 * for.
@@ -1484,6 +1817,66 @@ vips_region_prepare( VipsRegion *reg, const VipsRect *r )
 	return( 0 );
 }
 
+void
+vips__image_prefetch( VipsImage *image, const VipsRect *r )
+{
+	VipsImagePrivate *private;
+	VipsRect area;
+	VipsRect clipped;
+
+	area.left = 0;
+	area.top = 0;
+	area.width = image->Xsize;
+	area.height = image->Ysize;
+	vips_rect_intersectrect( r, &area, &clipped );
+	if( vips_rect_isempty( &clipped ) )
+		return;
+
+	switch( image->dtype ) {
+	case VIPS_IMAGE_PARTIAL:
+		private = vips__image_private( image );
+		if( private->prefetch_fn )
+			private->prefetch_fn( image, 
+				&clipped, private->prefetch_a );
+		break;
+
+	case VIPS_IMAGE_MMAPIN:
+	case VIPS_IMAGE_MMAPINRW:
+	case VIPS_IMAGE_OPENIN:
+		vips__window_prefetch( image, clipped.top, clipped.height );
+		break;
+
+	default:
+		/* Memory images are already there.
+		 */
+		break;
+	}
+}
+
+/** 
+ * vips_region_prefetch: (method)
+ * @reg: region to hint
+ * @r: #VipsRect of pixels you will probably ask for soon
+ *
+ * Tell the image behind @reg that you will probably need the pixels in @r 
+ * soon. This never blocks and never computes pixels, it just gives file
+ * sources a chance to start reading before you call vips_region_prepare().
+ * It can hide a lot of I/O latency on slow or network filesystems.
+ *
+ * Images mapped from disc turn the hint into madvise() or 
+ * posix_fadvise(). Partial images pass it to the handler set with
+ * vips_image_set_prefetch(), if any, and otherwise ignore it.
+ *
+ * See also: vips_region_prepare(), vips_image_set_prefetch().
+ */
+void
+vips_region_prefetch( VipsRegion *reg, const VipsRect *r )
+{
+	vips__region_check_ownership( reg );
+
+	vips__image_prefetch( reg->im, r );
+}
+
 /* We need to make pixels using reg's generate function, and write the result
  * to dest.
  */
@@ -1560,6 +1953,13 @@ vips_region_prepare_to( VipsRegion *reg,
 	if( vips_image_iskilled( im ) )
 		return( -1 );
 
+	if( vips__operation_stats ) {
+		VipsImagePrivate *private = vips__image_private( im );
+
+		if( private->stats )
+			vips__operation_stats_prepare( private->stats );
+	}
+
 	/* Sanity check.
 	 */
 	if( !dest->data || 
@@ -1680,6 +2080,167 @@ vips_region_prepare_to( VipsRegion *reg,
 	return( 0 );
 }
 
+/* A lane is a helper thread which prepares one region in parallel with the
+ * thread that owns it, see vips_reorder_prepare_many().
+ *
+ * Regions, their sequences and their buffers all belong to the thread that
+ * made them, so the lane can't work on the owner's region. Instead, it
+ * makes and keeps its own region on the same image, and the owner attaches
+ * to that with vips_region_region() when the prepare is done. A lane lives
+ * as long as the sequence on its owner.
+ */
+typedef struct _VipsRegionLane {
+	/* The region we help, and the region we calculate into. ->region is
+	 * made and used only on our thread.
+	 */
+	VipsRegion *owner;
+	VipsRegion *region;
+
+	GThread *thread;
+	VipsSemaphore go;
+	VipsSemaphore done;
+
+	/* The job, the result, and how long it took.
+	 */
+	VipsRect r;
+	int result;
+	gint64 time;
+
+	gboolean exit;
+} VipsRegionLane;
+
+static void *
+vips_region_lane_main( void *a )
+{
+	VipsRegionLane *lane = (VipsRegionLane *) a;
+
+	for(;;) {
+		gint64 start;
+
+		vips_semaphore_down( &lane->go );
+		if( lane->exit )
+			break;
+
+		start = g_get_monotonic_time();
+
+		if( !lane->region &&
+			!(lane->region = vips__region_pool_get(
+				lane->owner->im )) )
+			lane->result = -1;
+		else
+			lane->result =
+				vips_region_prepare( lane->region, &lane->r );
+
+		lane->time = g_get_monotonic_time() - start;
+
+		vips_semaphore_up( &lane->done );
+	}
+
+	/* Our region must go on the thread that made it.
+	 */
+	VIPS_FREEF( vips__region_pool_put, lane->region );
+
+	return( NULL );
+}
+
+static void
+vips_region_lane_free( VipsRegionLane *lane )
+{
+	if( lane->thread ) {
+		lane->exit = TRUE;
+		vips_semaphore_up( &lane->go );
+		(void) vips_g_thread_join( lane->thread );
+		lane->thread = NULL;
+	}
+
+	vips_semaphore_destroy( &lane->go );
+	vips_semaphore_destroy( &lane->done );
+	g_free( lane );
+}
+
+/* Get the lane for @owner, making one if necessary.
+ */
+static VipsRegionLane *
+vips_region_lane_get( VipsRegion *owner )
+{
+	VipsRegionLane *lane;
+
+	if( (lane = g_object_get_qdata( G_OBJECT( owner ),
+		vips__region_lane_quark )) )
+		return( lane );
+
+	lane = g_new0( VipsRegionLane, 1 );
+	lane->owner = owner;
+	vips_semaphore_init( &lane->go, 0, "go" );
+	vips_semaphore_init( &lane->done, 0, "done" );
+	if( !(lane->thread = vips_g_thread_new( "lane",
+		vips_region_lane_main, lane )) ) {
+		vips_region_lane_free( lane );
+		return( NULL );
+	}
+
+	g_object_set_qdata_full( G_OBJECT( owner ), vips__region_lane_quark,
+		lane, (GDestroyNotify) vips_region_lane_free );
+
+	return( lane );
+}
+
+/* The lane shares the owner's sequence lifetime.
+ */
+static void
+vips_region_lane_stop( VipsRegion *region )
+{
+	if( g_object_get_qdata( G_OBJECT( region ),
+		vips__region_lane_quark ) )
+		g_object_set_qdata( G_OBJECT( region ),
+			vips__region_lane_quark, NULL );
+}
+
+/* Start preparing @r for @region on its lane. Return FALSE if there's no
+ * lane, and the caller must prepare @region itself.
+ */
+gboolean
+vips__region_lane_start( VipsRegion *region, const VipsRect *r )
+{
+	VipsRegionLane *lane;
+
+	vips__region_check_ownership( region );
+
+	if( !(lane = vips_region_lane_get( region )) ) {
+		vips_error_clear();
+		return( FALSE );
+	}
+
+	lane->r = *r;
+	vips_semaphore_up( &lane->go );
+
+	return( TRUE );
+}
+
+/* Wait for the lane to finish, then attach @region to the pixels it made.
+ * The time the lane spent preparing goes in @time.
+ */
+int
+vips__region_lane_finish( VipsRegion *region, gint64 *time )
+{
+	VipsRegionLane *lane = g_object_get_qdata( G_OBJECT( region ),
+		vips__region_lane_quark );
+
+	VIPS_GATE_START( "vips__region_lane_finish: wait" );
+	vips_semaphore_down( &lane->done );
+	VIPS_GATE_STOP( "vips__region_lane_finish: wait" );
+
+	if( time )
+		*time = lane->time;
+
+	if( lane->result ||
+		vips_region_region( region, lane->region,
+			&lane->r, lane->r.left, lane->r.top ) )
+		return( -1 );
+
+	return( 0 );
+}
+
 /* Don't use this, use vips_reorder_prepare_many() instead.
  */
 int
@@ -2,6 +2,12 @@
  *
  * 11/1/17
  * 	- first version
+ * 14/10/18
+ * 	- measure the cost of each input and use it to break ties in the
+ * 	  recomp order
+ * 	- send prefetch hints to the later inputs before we prepare the
+ * 	  first
+ * 	- add vips_reorder_set_parallel()
  */
 
 /*
@@ -40,6 +46,8 @@
 #endif /*HAVE_CONFIG_H*/
 #include <vips/intl.h>
 
+#include <string.h>
+
 #include <vips/vips.h>
 #include <vips/internal.h>
 #include <vips/debug.h>
@@ -66,6 +74,24 @@ typedef struct _VipsReorder {
 	int *score;
 	int *recomp_order;
 
+	/* The measured cost of preparing each input: total time in
+	 * microseconds and total bytes. All threads add to these without a
+	 * lock, so they are only approximate.
+	 */
+	gint64 *time;
+	gint64 *bytes;
+
+	/* Count calls to vips_reorder_prepare_many(). When we reach next_sort
+	 * we make a new recomp_order using the measured cost.
+	 */
+	int n_calls;
+	int next_sort;
+
+	/* Old recomp_order arrays. Other threads may still be walking them,
+	 * so we can't free them until we are freed.
+	 */
+	GSList *old_order;
+
 	/* Source images are images with no input images, so file load, 
 	 * vips_black(), etc. NULL-terminated array.
 	 *
@@ -80,6 +106,24 @@ typedef struct _VipsReorder {
 
 GQuark vips__image_reorder_quark = 0; 
 
+/* Prepare expensive inputs on lanes, see vips_reorder_set_parallel().
+ */
+gboolean vips__reorder_parallel = FALSE;
+
+/* The number of lanes working right now, over all pipelines. We allow at
+ * most vips_concurrency_get().
+ */
+static int vips__reorder_lanes = 0;
+
+/* Use at most this many lanes per prepare.
+ */
+#define VIPS_REORDER_MAX_LANES (8)
+
+/* Only inputs which take longer than this to prepare, in microseconds, are
+ * worth sending to a lane.
+ */
+#define VIPS_REORDER_LANE_MIN_TIME (100)
+
 #ifdef DEBUG
 static void
 vips_reorder_print( VipsReorder *reorder )
@@ -93,8 +137,10 @@ vips_reorder_print( VipsReorder *reorder )
 	printf( "n_inputs = %d\n", reorder->n_inputs );
 	printf( " n      score       order\n" );
 	for( i = 0; i < reorder->n_inputs; i++ ) {
-		printf( "%2d - %8d, %8d, ", 
-			i, reorder->score[i], reorder->recomp_order[i] );
+		printf( "%2d - %8d, %8d, %8" G_GINT64_FORMAT "us, "
+			"%8" G_GINT64_FORMAT " bytes, ",
+			i, reorder->score[i], reorder->recomp_order[i],
+			reorder->time[i], reorder->bytes[i] );
 		vips_object_print_name( VIPS_OBJECT( reorder->input[i] ) );
 		printf( "\n" );
 	}
@@ -121,6 +167,12 @@ vips_reorder_free( VipsReorder *reorder )
 	VIPS_FREE( reorder->input ); 
 	VIPS_FREE( reorder->score ); 
 	VIPS_FREE( reorder->recomp_order ); 
+	VIPS_FREE( reorder->time );
+	VIPS_FREE( reorder->bytes );
+	if( reorder->old_order ) {
+		g_slist_free_full( reorder->old_order, g_free );
+		reorder->old_order = NULL;
+	}
 	VIPS_FREE( reorder->source ); 
 	VIPS_FREE( reorder->cumulative_margin ); 
 }
@@ -147,6 +199,11 @@ vips_reorder_get( VipsImage *image )
 	reorder->input = NULL;
 	reorder->score = NULL;
 	reorder->recomp_order = NULL;
+	reorder->time = NULL;
+	reorder->bytes = NULL;
+	reorder->n_calls = 0;
+	reorder->next_sort = 16;
+	reorder->old_order = NULL;
 	reorder->n_sources = 0;
 	reorder->source = NULL;
 	reorder->cumulative_margin = NULL;
@@ -167,6 +224,65 @@ vips_reorder_compare_score( const void *a, const void *b, void *arg )
 	return( reorder->score[i2] - reorder->score[i1] );
 }
 
+/* Time per byte, in nanoseconds.
+ */
+static double
+vips_reorder_cost( VipsReorder *reorder, int i )
+{
+	return( 1000.0 * reorder->time[i] / VIPS_MAX( 1, reorder->bytes[i] ) );
+}
+
+/* The margin score first, since sharing caches matters most. For ties,
+ * cheap inputs first, so slow inputs have longest to act on the prefetch
+ * hints we send them.
+ */
+static int
+vips_reorder_compare_cost( const void *a, const void *b, void *arg )
+{
+	int i1 = *((int *) a);
+	int i2 = *((int *) b);
+	VipsReorder *reorder = (VipsReorder *) arg;
+
+	double c1;
+	double c2;
+
+	if( reorder->score[i1] != reorder->score[i2] )
+		return( reorder->score[i2] - reorder->score[i1] );
+
+	c1 = vips_reorder_cost( reorder, i1 );
+	c2 = vips_reorder_cost( reorder, i2 );
+
+	return( c1 < c2 ? -1 : c1 > c2 ? 1 : i1 - i2 );
+}
+
+/* Make a new recomp order from the measured costs. Threads walking the old
+ * one can carry on, we free it when the image closes.
+ */
+static void
+vips_reorder_resort( VipsReorder *reorder )
+{
+	int *order;
+	int *old;
+
+	if( !(order = VIPS_ARRAY( NULL, reorder->n_inputs, int )) )
+		return;
+
+	g_mutex_lock( reorder->image->sslock );
+
+	old = reorder->recomp_order;
+	memcpy( order, old, reorder->n_inputs * sizeof( int ) );
+	g_qsort_with_data( order, reorder->n_inputs, sizeof( int ),
+		vips_reorder_compare_cost, reorder );
+	g_atomic_pointer_set( &reorder->recomp_order, order );
+	reorder->old_order = g_slist_prepend( reorder->old_order, old );
+
+	g_mutex_unlock( reorder->image->sslock );
+
+#ifdef DEBUG
+	vips_reorder_print( reorder );
+#endif /*DEBUG*/
+}
+
 int
 vips__reorder_set_input( VipsImage *image, VipsImage **in )
 {
@@ -211,17 +327,23 @@ vips__reorder_set_input( VipsImage *image, VipsImage **in )
 	reorder->input = VIPS_ARRAY( NULL, reorder->n_inputs + 1, VipsImage * );
 	reorder->score = VIPS_ARRAY( NULL, reorder->n_inputs, int );
 	reorder->recomp_order = VIPS_ARRAY( NULL, reorder->n_inputs, int );
+	reorder->time = VIPS_ARRAY( NULL, reorder->n_inputs, gint64 );
+	reorder->bytes = VIPS_ARRAY( NULL, reorder->n_inputs, gint64 );
 	if( !reorder->input )
 		return( -1 );
 	if( reorder->n_inputs && 
 		(!reorder->score ||
-		 !reorder->recomp_order) )
+		 !reorder->recomp_order ||
+		 !reorder->time ||
+		 !reorder->bytes) )
 		return( -1 );
 
 	for( i = 0; i < reorder->n_inputs; i++ ) {
 		reorder->input[i] = in[i];
 		reorder->score[i] = 0;
 		reorder->recomp_order[i] = i;
+		reorder->time[i] = 0;
+		reorder->bytes[i] = 0;
 	}
 	reorder->input[i] = NULL;
 
@@ -312,6 +434,122 @@ vips__reorder_set_input( VipsImage *image, VipsImage **in )
 	return( 0 );
 }
 
+static void
+vips_reorder_record( VipsReorder *reorder, int i, gint64 time, VipsRect *r )
+{
+	reorder->time[i] += time;
+	reorder->bytes[i] += (gint64) r->width * r->height *
+		VIPS_IMAGE_SIZEOF_PEL( reorder->input[i] );
+}
+
+/* Send the most expensive inputs to lanes, then prepare the rest here while
+ * they run.
+ */
+static int
+vips_reorder_prepare_parallel( VipsReorder *reorder, int *order,
+	VipsRegion **regions, VipsRect *r )
+{
+	int n_calls = VIPS_MAX( 1, reorder->n_calls );
+
+	int lane[VIPS_REORDER_MAX_LANES];
+	int n_lanes;
+	gint64 start;
+	int result;
+	int i, j;
+
+	/* The costliest inputs are at the end of the order. order[0] is
+	 * always ours.
+	 */
+	n_lanes = 0;
+	for( i = reorder->n_inputs - 1;
+		i > 0 && n_lanes < VIPS_REORDER_MAX_LANES; i-- ) {
+		int k = order[i];
+
+		if( reorder->time[k] / n_calls < VIPS_REORDER_LANE_MIN_TIME )
+			continue;
+
+		if( g_atomic_int_add( &vips__reorder_lanes, 1 ) >=
+			vips_concurrency_get() ) {
+			(void) g_atomic_int_add( &vips__reorder_lanes, -1 );
+			break;
+		}
+
+		if( !vips__region_lane_start( regions[k], r ) ) {
+			(void) g_atomic_int_add( &vips__reorder_lanes, -1 );
+			break;
+		}
+
+		lane[n_lanes++] = k;
+	}
+
+	result = 0;
+	start = g_get_monotonic_time();
+
+	for( i = 0; i < reorder->n_inputs; i++ ) {
+		int k = order[i];
+
+		gint64 stop;
+
+		for( j = 0; j < n_lanes; j++ )
+			if( lane[j] == k )
+				break;
+		if( j < n_lanes )
+			continue;
+
+		/* We must wait for the lanes even if this fails.
+		 */
+		if( vips_region_prepare( regions[k], r ) ) {
+			result = -1;
+			break;
+		}
+
+		stop = g_get_monotonic_time();
+		vips_reorder_record( reorder, k, stop - start, r );
+		start = stop;
+	}
+
+	for( j = 0; j < n_lanes; j++ ) {
+		gint64 time;
+
+		if( vips__region_lane_finish( regions[lane[j]], &time ) )
+			result = -1;
+		(void) g_atomic_int_add( &vips__reorder_lanes, -1 );
+
+		vips_reorder_record( reorder, lane[j], time, r );
+	}
+
+	return( result );
+}
+
+/**
+ * vips_reorder_set_parallel:
+ * @parallel: prepare expensive inputs in parallel
+ *
+ * If @parallel is set, vips_reorder_prepare_many() sends the inputs which
+ * take longest to prepare to
+ * helper threads and prepares the others itself while they run. A tile of
+ * vips_bandjoin() of several slow loads, for example, then takes as long
+ * as the slowest input, rather than the sum of them all.
+ *
+ * Each helper is tied to one input of one sequence and keeps its own region
+ * on that input, so this costs extra memory and extra threads, though the
+ * threads are idle unless there's a slow input to work on. Inputs are only
+ * sent to helpers once their measured cost is high enough to be worth the
+ * handoff, and at most vips_concurrency_get() helpers are working at once
+ * over all pipelines, so we never run more than twice as many
+ * threads as there are workers.
+ *
+ * The default is off. You can also set this with the environment variable
+ * VIPS_PARALLEL_PREPARE or the command-line flag --vips-parallel-prepare.
+ *
+ * See also: vips_reorder_prepare_many(), vips_concurrency_set().
+ */
+void
+vips_reorder_set_parallel( gboolean parallel )
+{
+	vips__reorder_parallel = parallel;
+}
+
 /**
  * vips_reorder_prepare_many: (method)
  * @image: the image that's being written
@@ -324,6 +562,15 @@ vips__reorder_set_input( VipsImage *image, VipsImage **in )
  * It tries to request the regions in the order which will cause least
  * recomputation. This can give a large speedup, in some cases. 
  *
+ * It also times each prepare, and after a few calls it uses the measured
+ * cost per byte to order inputs which are otherwise equal, cheapest first.
+ * Before the first prepare it sends a prefetch hint for @r to the
+ * other inputs (see vips_region_prefetch()), so file-backed inputs can
+ * start reading while the earlier inputs compute.
+ *
+ * With vips_reorder_set_parallel(), slow inputs are prepared on helper
+ * threads at the same time.
+ *
  * See also: vips_region_prepare(), vips_reorder_margin_hint().
  *
  * Returns: 0 on success, or -1 on error.
@@ -333,13 +580,57 @@ vips_reorder_prepare_many( VipsImage *image, VipsRegion **regions, VipsRect *r )
 {
 	VipsReorder *reorder = vips_reorder_get( image );
 
+	int *order;
+	gint64 start;
 	int i;
 
+	/* Nothing to reorder.
+	 */
+	if( reorder->n_inputs < 2 ) {
+		for( i = 0; i < reorder->n_inputs; i++ )
+			if( vips_region_prepare( regions[i], r ) )
+				return( -1 );
+
+		return( 0 );
+	}
+
+	if( g_atomic_int_add( &reorder->n_calls, 1 ) ==
+		reorder->next_sort ) {
+		vips_reorder_resort( reorder );
+
+		/* Sort less often as the costs settle down.
+		 */
+		if( reorder->next_sort < 4096 )
+			reorder->next_sort *= 4;
+	}
+
+	order = (int *) g_atomic_pointer_get( &reorder->recomp_order );
+
+	for( i = 1; i < reorder->n_inputs; i++ )
+		vips__image_prefetch( regions[order[i]]->im, r );
+
+	/* Wait for some measurements before we pick inputs for lanes.
+	 */
+	if( vips__reorder_parallel &&
+		reorder->n_calls > 16 )
+		return( vips_reorder_prepare_parallel( reorder,
+			order, regions, r ) );
+
+	start = g_get_monotonic_time();
+
 	for( i = 0; i < reorder->n_inputs; i++ ) { 
-		g_assert( regions[i] );
+		VipsRegion *region = regions[order[i]];
+
+		gint64 stop;
 
-		if( vips_region_prepare( regions[reorder->recomp_order[i]], r ) )
+		g_assert( region );
+
+		if( vips_region_prepare( region, r ) )
 			return( -1 );
+
+		stop = g_get_monotonic_time();
+		vips_reorder_record( reorder, order[i], stop - start, r );
+		start = stop;
 	}
 
 	return( 0 );
@@ -383,4 +674,7 @@ vips__reorder_init( void )
 	if( !vips__image_reorder_quark )
 		vips__image_reorder_quark = 
 			g_quark_from_static_string( "vips-image-reorder" ); 
+
+	if( g_getenv( "VIPS_PARALLEL_PREPARE" ) )
+		vips__reorder_parallel = TRUE;
 }
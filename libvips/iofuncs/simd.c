@@ -0,0 +1,230 @@
+/* native SIMD kernels with run-time dispatch
+ *
+ * 14/10/18
+ * 	- from vector.c
+ */
+
+/*
+
+    This file is part of VIPS.
+
+    VIPS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA
+
+ */
+
+/*
+
+    These files are distributed with VIPS - http://www.vips.ecs.soton.ac.uk
+
+ */
+
+/* This is the other half of the vector system. vector.c generates code at
+ * run-time with Orc, but Orc is often missing or disabled, and it can't do
+ * most of the float ops we need. Here we have a set of hand-written kernels
+ * for various instruction sets and pick the best one for this CPU at startup.
+ *
+ * Operations look kernels up with vips_simd_get() and fall back to their own
+ * C loop if there's nothing for their format.
+ */
+
+/*
+#define DEBUG
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /*HAVE_CONFIG_H*/
+#include <vips/intl.h>
+
+#include <stdlib.h>
+
+#include <vips/vips.h>
+#include <vips/simd.h>
+#include <vips/internal.h>
+
+/* Cleared by the command-line --vips-nosimd switch and the VIPS_NOSIMD env
+ * var.
+ */
+gboolean vips__simd_enabled = TRUE;
+
+/* What this CPU can do, set by vips_simd_init().
+ */
+static VipsSimdFeatures vips_simd_features = VIPS_SIMD_NONE;
+
+typedef struct _VipsSimdEntry {
+	void *fn;
+	VipsSimdFeatures features;
+} VipsSimdEntry;
+
+/* The best kernel we've seen so far for each kernel and format. This is only
+ * written during vips_simd_init(), so we don't need a lock.
+ */
+static VipsSimdEntry vips_simd_table[VIPS_SIMD_LAST][VIPS_FORMAT_LAST];
+
+static VipsSimdFeatures
+vips_simd_detect( void )
+{
+	VipsSimdFeatures features;
+
+	features = VIPS_SIMD_NONE;
+
+#ifdef HAVE_SIMD_X86
+	__builtin_cpu_init();
+	if( __builtin_cpu_supports( "sse4.1" ) )
+		features |= VIPS_SIMD_SSE41;
+	if( __builtin_cpu_supports( "avx2" ) )
+		features |= VIPS_SIMD_AVX2;
+	if( __builtin_cpu_supports( "avx512f" ) )
+		features |= VIPS_SIMD_AVX512;
+#endif /*HAVE_SIMD_X86*/
+
+#ifdef HAVE_SIMD_NEON
+	/* NEON is part of the base aarch64 ISA.
+	 */
+	features |= VIPS_SIMD_NEON;
+#endif /*HAVE_SIMD_NEON*/
+
+	return( features );
+}
+
+void
+vips_simd_init( void )
+{
+	static gboolean done = FALSE;
+
+	if( done )
+		return;
+	done = TRUE;
+
+	vips_simd_features = vips_simd_detect();
+
+	if( g_getenv( "VIPS_NOSIMD" ) )
+		vips__simd_enabled = FALSE;
+
+#ifdef HAVE_SIMD_X86
+	vips__simd_x86_init();
+#endif /*HAVE_SIMD_X86*/
+
+#ifdef HAVE_SIMD_NEON
+	vips__simd_neon_init();
+#endif /*HAVE_SIMD_NEON*/
+
+	g_info( "simd:%s%s%s%s%s",
+		vips_simd_features == VIPS_SIMD_NONE ? " none" : "",
+		vips_simd_features & VIPS_SIMD_SSE41 ? " sse4.1" : "",
+		vips_simd_features & VIPS_SIMD_AVX2 ? " avx2" : "",
+		vips_simd_features & VIPS_SIMD_AVX512 ? " avx512" : "",
+		vips_simd_features & VIPS_SIMD_NEON ? " neon" : "" );
+}
+
+/**
+ * vips_simd_isenabled:
+ *
+ * Returns: %TRUE if SIMD kernels are enabled and this CPU has at least one
+ * instruction set we have kernels for.
+ */
+gboolean
+vips_simd_isenabled( void )
+{
+	return( vips__simd_enabled &&
+		vips_simd_features != VIPS_SIMD_NONE );
+}
+
+/**
+ * vips_simd_set_enabled:
+ * @enabled: %TRUE to enable SIMD kernels
+ *
+ * Turn the SIMD kernels on or off. Some operations pick their kernel when
+ * they are built, so this may not affect pipelines which already exist.
+ *
+ * You can also use the `--vips-nosimd` command-line option or the
+ * `VIPS_NOSIMD` environment variable to turn them off.
+ */
+void
+vips_simd_set_enabled( gboolean enabled )
+{
+	vips__simd_enabled = enabled;
+}
+
+/**
+ * vips_simd_get_features:
+ *
+ * Returns: the set of instruction sets this CPU supports that we have
+ * kernels for.
+ */
+VipsSimdFeatures
+vips_simd_get_features( void )
+{
+	return( vips_simd_features );
+}
+
+/**
+ * vips_simd_register:
+ * @kernel: kernel to register
+ * @format: band format this implementation handles
+ * @features: instruction sets this implementation needs
+ * @fn: the implementation
+ *
+ * Register an implementation of @kernel for @format. The implementation is
+ * ignored if this CPU lacks any of @features, and it only replaces an
+ * existing implementation if it needs a later instruction set.
+ *
+ * This must only be called during startup, before any operations run.
+ */
+void
+vips_simd_register( VipsSimdKernel kernel, VipsBandFormat format,
+	VipsSimdFeatures features, void *fn )
+{
+	VipsSimdEntry *entry;
+
+	g_assert( kernel >= 0 && kernel < VIPS_SIMD_LAST );
+	g_assert( format >= 0 && format < VIPS_FORMAT_LAST );
+
+	if( (features & vips_simd_features) != features )
+		return;
+
+	entry = &vips_simd_table[kernel][format];
+	if( !entry->fn ||
+		features > entry->features ) {
+		entry->fn = fn;
+		entry->features = features;
+	}
+}
+
+/**
+ * vips_simd_get:
+ * @kernel: kernel to find
+ * @format: band format to find it for
+ *
+ * Find the best implementation of @kernel for @format on this CPU. Cast the
+ * result to the function type for that kernel, for example
+ * #VipsSimdLinearFn for #VIPS_SIMD_LINEAR.
+ *
+ * Returns: the kernel, or %NULL if there's nothing suitable or SIMD has been
+ * disabled.
+ */
+void *
+vips_simd_get( VipsSimdKernel kernel, VipsBandFormat format )
+{
+	if( !vips__simd_enabled ||
+		kernel < 0 ||
+		kernel >= VIPS_SIMD_LAST ||
+		format < 0 ||
+		format >= VIPS_FORMAT_LAST )
+		return( NULL );
+
+	return( vips_simd_table[kernel][format].fn );
+}
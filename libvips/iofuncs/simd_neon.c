@@ -0,0 +1,1987 @@
+/* NEON kernels
+ *
+ * 14/10/18
+ * 	- first version
+ * 	- reduceh works on lines and does 3 bands
+ * 	- add uchar max and min
+ * 	- add lut32
+ * 	- add span and span_back
+ * 	- add relational and boolean
+ * 15/10/18
+ * 	- add rad2float
+ */
+
+/*
+
+    This file is part of VIPS.
+
+    VIPS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA
+
+ */
+
+/*
+
+    These files are distributed with VIPS - http://www.vips.ecs.soton.ac.uk
+
+ */
+
+/* aarch64 only, where NEON is always there. As with the x86 kernels, each
+ * one must match the C loop it replaces exactly, see simd_x86.c.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /*HAVE_CONFIG_H*/
+#include <vips/intl.h>
+
+#include <string.h>
+#include <math.h>
+
+#include <vips/vips.h>
+#include <vips/simd.h>
+#include <vips/internal.h>
+
+#ifdef HAVE_SIMD_NEON
+
+#include <arm_neon.h>
+
+/* The round and shift for fixed-point masks, see unsigned_fixed_round() in
+ * resample/templates.h.
+ */
+#define ROUND_BY (VIPS_INTERPOLATE_SCALE >> 1)
+
+/* Four bytes to four int lanes, avoiding an 8-byte read.
+ */
+static inline int32x4_t
+load4( const VipsPel *p )
+{
+	uint32_t v;
+
+	memcpy( &v, p, 4 );
+
+	return( vreinterpretq_s32_u32( vmovl_u16( vget_low_u16(
+		vmovl_u8( vreinterpret_u8_u32( vdup_n_u32( v ) ) ) ) ) ) );
+}
+
+/* Saturate four int lanes to uchar and write.
+ */
+static inline void
+store4( VipsPel *q, int32x4_t v )
+{
+	uint16x4_t s = vqmovun_s32( v );
+	uint8x8_t b = vqmovn_u16( vcombine_u16( s, s ) );
+	uint32_t i = vget_lane_u32( vreinterpret_u32_u8( b ), 0 );
+
+	memcpy( q, &i, 4 );
+}
+
+/* Load eight elements as two float vectors.
+ */
+#define LOAD8_UCHAR( P, LO, HI ) { \
+	uint16x8_t s = vmovl_u8( vld1_u8( P ) ); \
+	\
+	LO = vcvtq_f32_u32( vmovl_u16( vget_low_u16( s ) ) ); \
+	HI = vcvtq_f32_u32( vmovl_u16( vget_high_u16( s ) ) ); \
+}
+
+#define LOAD8_USHORT( P, LO, HI ) { \
+	uint16x8_t s = vld1q_u16( P ); \
+	\
+	LO = vcvtq_f32_u32( vmovl_u16( vget_low_u16( s ) ) ); \
+	HI = vcvtq_f32_u32( vmovl_u16( vget_high_u16( s ) ) ); \
+}
+
+#define LOAD8_SHORT( P, LO, HI ) { \
+	int16x8_t s = vld1q_s16( P ); \
+	\
+	LO = vcvtq_f32_s32( vmovl_s16( vget_low_s16( s ) ) ); \
+	HI = vcvtq_f32_s32( vmovl_s16( vget_high_s16( s ) ) ); \
+}
+
+#define LOAD8_FLOAT( P, LO, HI ) { \
+	LO = vld1q_f32( P ); \
+	HI = vld1q_f32( (P) + 4 ); \
+}
+
+/* out = a * in + b, see LOOP1 in arithmetic/linear.c. We do the tail with
+ * the vector path too, so the compiler treats every element the same way.
+ */
+#define LINEAR( NAME, TYPE, LOAD ) \
+static void \
+NAME( float *out, const VipsPel *in, int n, float a, float b ) \
+{ \
+	const TYPE * restrict p = (TYPE *) in; \
+	const float32x4_t va = vdupq_n_f32( a ); \
+	const float32x4_t vb = vdupq_n_f32( b ); \
+	\
+	float32x4_t lo, hi; \
+	int x; \
+	\
+	for( x = 0; x + 8 <= n; x += 8 ) { \
+		LOAD( p + x, lo, hi ); \
+		vst1q_f32( out + x, vaddq_f32( vmulq_f32( va, lo ), vb ) ); \
+		vst1q_f32( out + x + 4, \
+			vaddq_f32( vmulq_f32( va, hi ), vb ) ); \
+	} \
+	\
+	if( x < n ) { \
+		TYPE t[8] = { 0 }; \
+		float o[8]; \
+		\
+		memcpy( t, p + x, (n - x) * sizeof( TYPE ) ); \
+		LOAD( t, lo, hi ); \
+		vst1q_f32( o, vaddq_f32( vmulq_f32( va, lo ), vb ) ); \
+		vst1q_f32( o + 4, vaddq_f32( vmulq_f32( va, hi ), vb ) ); \
+		memcpy( out + x, o, (n - x) * sizeof( float ) ); \
+	} \
+}
+
+LINEAR( linear_uchar_neon, unsigned char, LOAD8_UCHAR )
+LINEAR( linear_ushort_neon, unsigned short, LOAD8_USHORT )
+LINEAR( linear_short_neon, signed short, LOAD8_SHORT )
+LINEAR( linear_float_neon, float, LOAD8_FLOAT )
+
+/* Convert to float.
+ */
+#define CAST( NAME, TYPE, LOAD ) \
+static void \
+NAME( float *out, const VipsPel *in, int n ) \
+{ \
+	const TYPE * restrict p = (TYPE *) in; \
+	\
+	float32x4_t lo, hi; \
+	int x; \
+	\
+	for( x = 0; x + 8 <= n; x += 8 ) { \
+		LOAD( p + x, lo, hi ); \
+		vst1q_f32( out + x, lo ); \
+		vst1q_f32( out + x + 4, hi ); \
+	} \
+	for( ; x < n; x++ ) \
+		out[x] = p[x]; \
+}
+
+CAST( cast_uchar_neon, unsigned char, LOAD8_UCHAR )
+CAST( cast_ushort_neon, unsigned short, LOAD8_USHORT )
+CAST( cast_short_neon, signed short, LOAD8_SHORT )
+
+/* Floor, count and clip four floats, see VIPS_CLIP_FLOAT_INT in
+ * conversion/cast.c.
+ */
+static inline uint32x4_t
+clip4( const float *p, float32x4_t vmax, int *underflow, int *overflow )
+{
+	const float32x4_t zero = vdupq_n_f32( 0 );
+
+	float32x4_t v = vrndmq_f32( vld1q_f32( p ) );
+
+	*underflow += vaddvq_u32( vshrq_n_u32( vcltq_f32( v, zero ), 31 ) );
+	*overflow += vaddvq_u32( vshrq_n_u32( vcgtq_f32( v, vmax ), 31 ) );
+
+	v = vminq_f32( vmaxq_f32( v, zero ), vmax );
+
+	return( vcvtq_u32_f32( v ) );
+}
+
+#define CLIP( NAME, TYPE, MAX, STORE ) \
+static void \
+NAME( VipsPel *out, const float *in, int n, \
+	int *underflow, int *overflow ) \
+{ \
+	TYPE * restrict q = (TYPE *) out; \
+	const float32x4_t vmax = vdupq_n_f32( MAX ); \
+	\
+	int x; \
+	\
+	for( x = 0; x + 8 <= n; x += 8 ) { \
+		uint32x4_t a = clip4( in + x, vmax, underflow, overflow ); \
+		uint32x4_t b = clip4( in + x + 4, vmax, underflow, overflow ); \
+		uint16x8_t s = vcombine_u16( vmovn_u32( a ), vmovn_u32( b ) ); \
+		\
+		STORE; \
+	} \
+	\
+	for( ; x < n; x++ ) { \
+		float v = VIPS_FLOOR( in[x] ); \
+		\
+		if( v < 0 ) { \
+			*underflow += 1; \
+			v = 0; \
+		} \
+		else if( v > MAX ) { \
+			*overflow += 1; \
+			v = MAX; \
+		} \
+		\
+		q[x] = v; \
+	} \
+}
+
+CLIP( clip_uchar_neon, unsigned char, UCHAR_MAX,
+	vst1_u8( q + x, vmovn_u16( s ) ) )
+CLIP( clip_ushort_neon, unsigned short, USHRT_MAX,
+	vst1q_u16( q + x, s ) )
+
+/* ushort to uchar by dropping the bottom eight bits, see VIPS_SHIFT_RIGHT in
+ * conversion/cast.c.
+ */
+static void
+shift_ushort_neon( VipsPel *out, const VipsPel *in, int n )
+{
+	const unsigned short * restrict p = (unsigned short *) in;
+
+	int x;
+
+	for( x = 0; x + 8 <= n; x += 8 )
+		vst1_u8( out + x, vshrn_n_u16( vld1q_u16( p + x ), 8 ) );
+
+	for( ; x < n; x++ )
+		out[x] = p[x] >> 8;
+}
+
+/* Alpha scaled to 0 - 1 for four pixels. The divide is in double, as
+ * premultiply.c does it.
+ */
+static inline float32x4_t
+nalpha4( float32x4_t clip, float64x2_t vmax )
+{
+	float64x2_t lo = vdivq_f64(
+		vcvt_f64_f32( vget_low_f32( clip ) ), vmax );
+	float64x2_t hi = vdivq_f64( vcvt_high_f64_f32( clip ), vmax );
+
+	return( vcvt_high_f32_f64( vcvt_f32_f64( lo ), hi ) );
+}
+
+/* Load eight 4-band pixels as four bands of two float vectors.
+ */
+#define ALPHA_LOAD_UCHAR( P, V ) { \
+	uint8x8x4_t s = vld4_u8( P ); \
+	int b; \
+	\
+	for( b = 0; b < 4; b++ ) { \
+		uint16x8_t w = vmovl_u8( s.val[b] ); \
+		\
+		V[b][0] = vcvtq_f32_u32( vmovl_u16( vget_low_u16( w ) ) ); \
+		V[b][1] = vcvtq_f32_u32( vmovl_u16( vget_high_u16( w ) ) ); \
+	} \
+}
+
+#define ALPHA_LOAD_USHORT( P, V ) { \
+	uint16x8x4_t s = vld4q_u16( P ); \
+	int b; \
+	\
+	for( b = 0; b < 4; b++ ) { \
+		V[b][0] = vcvtq_f32_u32( vmovl_u16( \
+			vget_low_u16( s.val[b] ) ) ); \
+		V[b][1] = vcvtq_f32_u32( vmovl_u16( \
+			vget_high_u16( s.val[b] ) ) ); \
+	} \
+}
+
+#define ALPHA_LOAD_FLOAT( P, V ) { \
+	float32x4x4_t lo = vld4q_f32( P ); \
+	float32x4x4_t hi = vld4q_f32( (P) + 16 ); \
+	int b; \
+	\
+	for( b = 0; b < 4; b++ ) { \
+		V[b][0] = lo.val[b]; \
+		V[b][1] = hi.val[b]; \
+	} \
+}
+
+/* Premultiply 4-band pixels to float, see PRE_RGBA in
+ * conversion/premultiply.c. CAP is the largest alpha we allow, the clip in
+ * the C version truncates to the input type.
+ */
+#define PREMULTIPLY( NAME, IN, LOAD, CAP ) \
+static void \
+NAME( float *out, const VipsPel *in, int width, double max_alpha ) \
+{ \
+	const IN * restrict p = (IN *) in; \
+	const float64x2_t vmax = vdupq_n_f64( max_alpha ); \
+	const float32x4_t cap = vdupq_n_f32( CAP ); \
+	const float32x4_t zero = vdupq_n_f32( 0.0 ); \
+	\
+	int x, h; \
+	\
+	for( x = 0; x + 8 <= width; x += 8 ) { \
+		float32x4_t v[4][2]; \
+		\
+		LOAD( p, v ); \
+		\
+		for( h = 0; h < 2; h++ ) { \
+			float32x4_t n = nalpha4( vmaxq_f32( \
+				vminq_f32( v[3][h], cap ), zero ), vmax ); \
+			float32x4x4_t o; \
+			\
+			o.val[0] = vmulq_f32( v[0][h], n ); \
+			o.val[1] = vmulq_f32( v[1][h], n ); \
+			o.val[2] = vmulq_f32( v[2][h], n ); \
+			o.val[3] = v[3][h]; \
+			vst4q_f32( out + 16 * h, o ); \
+		} \
+		\
+		p += 32; \
+		out += 32; \
+	} \
+	\
+	for( ; x < width; x++ ) { \
+		IN alpha = p[3]; \
+		IN clip_alpha = VIPS_CLIP( 0, alpha, max_alpha ); \
+		float nalpha = (float) clip_alpha / max_alpha; \
+		\
+		out[0] = p[0] * nalpha; \
+		out[1] = p[1] * nalpha; \
+		out[2] = p[2] * nalpha; \
+		out[3] = alpha; \
+		\
+		p += 4; \
+		out += 4; \
+	} \
+}
+
+PREMULTIPLY( premultiply_uchar_neon, unsigned char,
+	ALPHA_LOAD_UCHAR, floor( max_alpha ) )
+PREMULTIPLY( premultiply_ushort_neon, unsigned short,
+	ALPHA_LOAD_USHORT, floor( max_alpha ) )
+PREMULTIPLY( premultiply_float_neon, float,
+	ALPHA_LOAD_FLOAT, max_alpha )
+
+/* Unpremultiply 4-band pixels to float, see UNPRE_RGBA in
+ * conversion/unpremultiply.c. Zero alpha makes black.
+ */
+#define UNPREMULTIPLY( NAME, IN, LOAD, CAP ) \
+static void \
+NAME( float *out, const VipsPel *in, int width, double max_alpha ) \
+{ \
+	const IN * restrict p = (IN *) in; \
+	const float64x2_t vmax = vdupq_n_f64( max_alpha ); \
+	const float32x4_t cap = vdupq_n_f32( CAP ); \
+	const float32x4_t zero = vdupq_n_f32( 0.0 ); \
+	\
+	int x, h, b; \
+	\
+	for( x = 0; x + 8 <= width; x += 8 ) { \
+		float32x4_t v[4][2]; \
+		\
+		LOAD( p, v ); \
+		\
+		for( h = 0; h < 2; h++ ) { \
+			float32x4_t clip = vmaxq_f32( \
+				vminq_f32( v[3][h], cap ), zero ); \
+			float32x4_t n = nalpha4( clip, vmax ); \
+			uint32x4_t black = vceqq_f32( clip, zero ); \
+			float32x4x4_t o; \
+			\
+			for( b = 0; b < 3; b++ ) \
+				o.val[b] = vreinterpretq_f32_u32( vbicq_u32( \
+					vreinterpretq_u32_f32( \
+						vdivq_f32( v[b][h], n ) ), \
+					black ) ); \
+			o.val[3] = clip; \
+			vst4q_f32( out + 16 * h, o ); \
+		} \
+		\
+		p += 32; \
+		out += 32; \
+	} \
+	\
+	for( ; x < width; x++ ) { \
+		IN alpha = p[3]; \
+		IN clip_alpha = VIPS_CLIP( 0, alpha, max_alpha ); \
+		float nalpha = (float) clip_alpha / max_alpha; \
+		\
+		if( clip_alpha == 0 ) { \
+			out[0] = 0; \
+			out[1] = 0; \
+			out[2] = 0; \
+		} \
+		else { \
+			out[0] = p[0] / nalpha; \
+			out[1] = p[1] / nalpha; \
+			out[2] = p[2] / nalpha; \
+		} \
+		out[3] = clip_alpha; \
+		\
+		p += 4; \
+		out += 4; \
+	} \
+}
+
+UNPREMULTIPLY( unpremultiply_uchar_neon, unsigned char,
+	ALPHA_LOAD_UCHAR, floor( max_alpha ) )
+UNPREMULTIPLY( unpremultiply_ushort_neon, unsigned short,
+	ALPHA_LOAD_USHORT, floor( max_alpha ) )
+UNPREMULTIPLY( unpremultiply_float_neon, float,
+	ALPHA_LOAD_FLOAT, max_alpha )
+
+/* Flatten eight RGBA uchar pixels with alpha 0 - 255, see VIPS_FLATTEN in
+ * conversion/flatten.c. The sums fit in 16 bits, and x / 255 is
+ * (x + 1 + (x >> 8)) >> 8 over that range.
+ */
+static void
+flatten_uchar_neon( VipsPel *out, const VipsPel *in, int width,
+	const VipsPel *ink )
+{
+	int x, b;
+
+	for( x = 0; x + 8 <= width; x += 8 ) {
+		uint8x8x4_t s = vld4_u8( in );
+		uint8x8_t na = vsub_u8( vdup_n_u8( UCHAR_MAX ), s.val[3] );
+		uint8x8x3_t o;
+
+		for( b = 0; b < 3; b++ ) {
+			uint16x8_t t = vmull_u8( s.val[b], s.val[3] );
+
+			if( ink )
+				t = vmlal_u8( t, vdup_n_u8( ink[b] ), na );
+			t = vaddq_u16( vsraq_n_u16( t, t, 8 ),
+				vdupq_n_u16( 1 ) );
+			o.val[b] = vshrn_n_u16( t, 8 );
+		}
+		vst3_u8( out, o );
+
+		in += 32;
+		out += 24;
+	}
+
+	for( ; x < width; x++ ) {
+		int alpha = in[3];
+
+		for( b = 0; b < 3; b++ )
+			out[b] = (in[b] * alpha +
+				(ink ? ink[b] : 0) * (UCHAR_MAX - alpha)) /
+				UCHAR_MAX;
+
+		in += 4;
+		out += 3;
+	}
+}
+
+/* Flatten four RGBA ushort pixels with alpha 0 - 65535. The sums fit in
+ * 32 bits, and x / 65535 is (x + (x >> 16) + 1) >> 16 over that range.
+ */
+static void
+flatten_ushort_neon( VipsPel *out, const VipsPel *in, int width,
+	const VipsPel *ink )
+{
+	const unsigned short * restrict p = (unsigned short *) in;
+	unsigned short * restrict q = (unsigned short *) out;
+	const unsigned short * restrict bg = (unsigned short *) ink;
+
+	int x, b;
+
+	for( x = 0; x + 4 <= width; x += 4 ) {
+		uint16x4x4_t s = vld4_u16( p );
+		uint16x4_t na = vsub_u16( vdup_n_u16( USHRT_MAX ), s.val[3] );
+		uint16x4x3_t o;
+
+		for( b = 0; b < 3; b++ ) {
+			uint32x4_t t = vmull_u16( s.val[b], s.val[3] );
+
+			if( ink )
+				t = vmlal_u16( t, vdup_n_u16( bg[b] ), na );
+			t = vaddq_u32( vsraq_n_u32( t, t, 16 ),
+				vdupq_n_u32( 1 ) );
+			o.val[b] = vshrn_n_u32( t, 16 );
+		}
+		vst3_u16( q, o );
+
+		p += 16;
+		q += 12;
+	}
+
+	for( ; x < width; x++ ) {
+		unsigned int alpha = p[3];
+
+		for( b = 0; b < 3; b++ )
+			q[b] = ((double) p[b] * alpha +
+				(double) (ink ? bg[b] : 0) *
+					(USHRT_MAX - alpha)) / USHRT_MAX;
+
+		p += 4;
+		q += 3;
+	}
+}
+
+/* A 3- or 4-band uchar pixel to four int lanes. We never read past the end
+ * of a 3-band pixel.
+ */
+static inline int32x4_t
+load_pel( const VipsPel *p, int bands )
+{
+	VipsPel v[4] = { 0 };
+
+	if( bands == 4 )
+		return( load4( p ) );
+
+	memcpy( v, p, 3 );
+
+	return( load4( v ) );
+}
+
+/* width uchar pixels from a fixed-point mask table, see
+ * reduceh_unsigned_int_tab() in resample/reduceh.cpp.
+ */
+static void
+reduceh_uchar_neon( VipsPel *out, const VipsPel *in,
+	int width, int bands, const int *start, const int *phase,
+	const void *coeff, int n_point )
+{
+	const short *c = (short *) coeff;
+
+	int x;
+
+	for( x = 0; x < width; x++ ) {
+		const VipsPel *p = in + start[x] * bands;
+		const short *cx = c + phase[x] * n_point;
+
+		int32x4_t sum;
+		VipsPel q[4];
+		int i;
+
+		sum = vdupq_n_s32( 0 );
+		for( i = 0; i < n_point; i++ )
+			sum = vmlaq_n_s32( sum,
+				load_pel( p + i * bands, bands ), cx[i] );
+
+		sum = vshrq_n_s32( vaddq_s32( sum, vdupq_n_s32( ROUND_BY ) ),
+			VIPS_INTERPOLATE_SHIFT );
+		store4( q, sum );
+		memcpy( out + x * bands, q, bands );
+	}
+}
+
+/* ne elements from n_point lines, see reducev_unsigned_int_tab() in
+ * resample/reducev.cpp.
+ */
+#define REDUCEV_TAIL( TYPE, MAX ) { \
+	const TYPE * restrict p = (TYPE *) in; \
+	TYPE * restrict q = (TYPE *) out; \
+	\
+	for( ; z < ne; z++ ) { \
+		int sum; \
+		int i; \
+		\
+		sum = 0; \
+		for( i = 0; i < n_point; i++ ) \
+			sum += cy[i] * p[z + i * l1]; \
+		sum = (sum + ROUND_BY) >> VIPS_INTERPOLATE_SHIFT; \
+		\
+		q[z] = VIPS_CLIP( 0, sum, MAX ); \
+	} \
+}
+
+#define REDUCEV_ROUND( V ) \
+	vqmovun_s32( vshrq_n_s32( vaddq_s32( V, vdupq_n_s32( ROUND_BY ) ), \
+		VIPS_INTERPOLATE_SHIFT ) )
+
+static void
+reducev_uchar_neon( VipsPel *out, const VipsPel *in,
+	int ne, int lskip, const int *cy, int n_point )
+{
+	const int l1 = lskip;
+
+	int z;
+
+	for( z = 0; z + 8 <= ne; z += 8 ) {
+		int32x4_t lo, hi;
+		uint16x8_t s;
+		int i;
+
+		lo = vdupq_n_s32( 0 );
+		hi = vdupq_n_s32( 0 );
+		for( i = 0; i < n_point; i++ ) {
+			int16x8_t p = vreinterpretq_s16_u16(
+				vmovl_u8( vld1_u8( in + z + i * l1 ) ) );
+
+			lo = vmlaq_n_s32( lo,
+				vmovl_s16( vget_low_s16( p ) ), cy[i] );
+			hi = vmlaq_n_s32( hi,
+				vmovl_s16( vget_high_s16( p ) ), cy[i] );
+		}
+
+		s = vcombine_u16( REDUCEV_ROUND( lo ), REDUCEV_ROUND( hi ) );
+		vst1_u8( out + z, vqmovn_u16( s ) );
+	}
+
+	REDUCEV_TAIL( unsigned char, UCHAR_MAX );
+}
+
+static void
+reducev_ushort_neon( VipsPel *out, const VipsPel *in,
+	int ne, int lskip, const int *cy, int n_point )
+{
+	const int l1 = lskip / sizeof( unsigned short );
+	const unsigned short *pin = (unsigned short *) in;
+
+	int z;
+
+	for( z = 0; z + 8 <= ne; z += 8 ) {
+		int32x4_t lo, hi;
+		uint16x8_t s;
+		int i;
+
+		lo = vdupq_n_s32( 0 );
+		hi = vdupq_n_s32( 0 );
+		for( i = 0; i < n_point; i++ ) {
+			uint16x8_t p = vld1q_u16( pin + z + i * l1 );
+
+			lo = vmlaq_n_s32( lo, vreinterpretq_s32_u32(
+				vmovl_u16( vget_low_u16( p ) ) ), cy[i] );
+			hi = vmlaq_n_s32( hi, vreinterpretq_s32_u32(
+				vmovl_u16( vget_high_u16( p ) ) ), cy[i] );
+		}
+
+		s = vcombine_u16( REDUCEV_ROUND( lo ), REDUCEV_ROUND( hi ) );
+		vst1q_u16( (unsigned short *) out + z, s );
+	}
+
+	REDUCEV_TAIL( unsigned short, USHRT_MAX );
+}
+
+/* ne float elements from n_point taps stride bytes apart, see
+ * vips_convsep_convh_uchar() in convolution/convsep.c.
+ */
+#define CONVH_INT( TYPE, CTYPE ) { \
+	const TYPE * restrict p = (TYPE *) in; \
+	const CTYPE * restrict c = (CTYPE *) coeff; \
+	const int s = stride / sizeof( TYPE ); \
+	\
+	for( ; z < ne; z++ ) { \
+		int sum; \
+		int i; \
+		\
+		sum = 0; \
+		for( i = 0; i < n_point; i++ ) \
+			sum += c[i] * p[z + i * s]; \
+		\
+		out[z] = sum; \
+	} \
+}
+
+/* Multiply, then add, so we round as the C loop does.
+ */
+#define CONV_FLOAT( OFFSET ) { \
+	const float * restrict p = (float *) in; \
+	const int s = stride / sizeof( float ); \
+	\
+	for( z = 0; z + 4 <= ne; z += 4 ) { \
+		float32x4_t sum; \
+		int i; \
+		\
+		sum = vdupq_n_f32( 0 ); \
+		for( i = 0; i < n_point; i++ ) \
+			sum = vaddq_f32( sum, vmulq_n_f32( \
+				vld1q_f32( p + z + i * s ), c[i] ) ); \
+		\
+		vst1q_f32( out + z, vaddq_f32( sum, vdupq_n_f32( OFFSET ) ) ); \
+	} \
+	\
+	for( ; z < ne; z++ ) { \
+		float sum; \
+		int i; \
+		\
+		sum = 0; \
+		for( i = 0; i < n_point; i++ ) \
+			sum += c[i] * p[z + i * s]; \
+		\
+		out[z] = sum + OFFSET; \
+	} \
+}
+
+static void
+convh_uchar_neon( float *out, const VipsPel *in,
+	int ne, int stride, const void *coeff, int n_point )
+{
+	const short *c = (short *) coeff;
+
+	int z;
+
+	for( z = 0; z + 8 <= ne; z += 8 ) {
+		int32x4_t lo, hi;
+		int i;
+
+		lo = vdupq_n_s32( 0 );
+		hi = vdupq_n_s32( 0 );
+		for( i = 0; i < n_point; i++ ) {
+			int16x8_t p = vreinterpretq_s16_u16(
+				vmovl_u8( vld1_u8( in + z + i * stride ) ) );
+
+			lo = vmlal_n_s16( lo, vget_low_s16( p ), c[i] );
+			hi = vmlal_n_s16( hi, vget_high_s16( p ), c[i] );
+		}
+
+		vst1q_f32( out + z, vcvtq_f32_s32( lo ) );
+		vst1q_f32( out + z + 4, vcvtq_f32_s32( hi ) );
+	}
+
+	CONVH_INT( unsigned char, short );
+}
+
+static void
+convh_ushort_neon( float *out, const VipsPel *in,
+	int ne, int stride, const void *coeff, int n_point )
+{
+	const int *c = (int *) coeff;
+	const int s = stride / sizeof( unsigned short );
+	const unsigned short *pin = (unsigned short *) in;
+
+	int z;
+
+	for( z = 0; z + 8 <= ne; z += 8 ) {
+		int32x4_t lo, hi;
+		int i;
+
+		lo = vdupq_n_s32( 0 );
+		hi = vdupq_n_s32( 0 );
+		for( i = 0; i < n_point; i++ ) {
+			uint16x8_t p = vld1q_u16( pin + z + i * s );
+
+			lo = vmlaq_n_s32( lo, vreinterpretq_s32_u32(
+				vmovl_u16( vget_low_u16( p ) ) ), c[i] );
+			hi = vmlaq_n_s32( hi, vreinterpretq_s32_u32(
+				vmovl_u16( vget_high_u16( p ) ) ), c[i] );
+		}
+
+		vst1q_f32( out + z, vcvtq_f32_s32( lo ) );
+		vst1q_f32( out + z + 4, vcvtq_f32_s32( hi ) );
+	}
+
+	CONVH_INT( unsigned short, int );
+}
+
+static void
+convh_float_neon( float *out, const VipsPel *in,
+	int ne, int stride, const void *coeff, int n_point )
+{
+	const float *c = (float *) coeff;
+
+	int z;
+
+	CONV_FLOAT( 0 );
+}
+
+static void
+convv_float_neon( float *out, const float *fin,
+	int ne, int stride, const float *c, int n_point, float offset )
+{
+	const VipsPel *in = (VipsPel *) fin;
+
+	int z;
+
+	CONV_FLOAT( offset );
+}
+
+/* Average groups of hshrink 4-band uchar pixels, see ISHRINK in
+ * resample/shrinkh.c. Use float for the divide, see simd_x86.c.
+ */
+static void
+shrinkh_uchar_neon( VipsPel *out, const VipsPel *in, int width, int hshrink )
+{
+	const int32x4_t round = vdupq_n_s32( hshrink / 2 );
+	const float32x4_t div = vdupq_n_f32( hshrink );
+
+	int x, i, b;
+
+	/* (sum + 1) / 2 is a rounding halving add. vld2 splits pairs of pixels
+	 * into even and odd.
+	 */
+	if( hshrink == 2 ) {
+		for( x = 0; x + 4 <= width; x += 4 ) {
+			uint32x4x2_t v = vld2q_u32( (const uint32_t *) in );
+
+			vst1q_u8( out, vrhaddq_u8(
+				vreinterpretq_u8_u32( v.val[0] ),
+				vreinterpretq_u8_u32( v.val[1] ) ) );
+
+			in += 32;
+			out += 16;
+		}
+		for( ; x < width; x++ ) {
+			for( b = 0; b < 4; b++ )
+				out[b] = (in[b] + in[b + 4] + 1) >> 1;
+
+			in += 8;
+			out += 4;
+		}
+
+		return;
+	}
+
+	if( hshrink > 4096 ) {
+		for( x = 0; x < width; x++ )
+			for( b = 0; b < 4; b++ ) {
+				int sum;
+
+				sum = 0;
+				for( i = 0; i < hshrink; i++ )
+					sum += in[x * hshrink * 4 + i * 4 + b];
+
+				out[x * 4 + b] = (sum + hshrink / 2) / hshrink;
+			}
+
+		return;
+	}
+
+	for( x = 0; x < width; x++ ) {
+		int32x4_t sum;
+
+		sum = vdupq_n_s32( 0 );
+		for( i = 0; i < hshrink; i++ )
+			sum = vaddq_s32( sum, load4( in + i * 4 ) );
+
+		sum = vcvtq_s32_f32( vdivq_f32(
+			vcvtq_f32_s32( vaddq_s32( sum, round ) ), div ) );
+		store4( out, sum );
+
+		in += hshrink * 4;
+		out += 4;
+	}
+}
+
+/* Add a line to an accumulator, see ADD in resample/shrinkv.c.
+ */
+static void
+shrinkv_uchar_neon( int *sum, const VipsPel *in, int n )
+{
+	int x;
+
+	for( x = 0; x + 8 <= n; x += 8 ) {
+		uint16x8_t p = vmovl_u8( vld1_u8( in + x ) );
+
+		vst1q_s32( sum + x, vaddq_s32( vld1q_s32( sum + x ),
+			vreinterpretq_s32_u32(
+				vmovl_u16( vget_low_u16( p ) ) ) ) );
+		vst1q_s32( sum + x + 4, vaddq_s32( vld1q_s32( sum + x + 4 ),
+			vreinterpretq_s32_u32(
+				vmovl_u16( vget_high_u16( p ) ) ) ) );
+	}
+	for( ; x < n; x++ )
+		sum[x] += in[x];
+}
+
+static void
+shrinkv_ushort_neon( int *sum, const VipsPel *in, int n )
+{
+	const unsigned short * restrict p = (unsigned short *) in;
+
+	int x;
+
+	for( x = 0; x + 8 <= n; x += 8 ) {
+		uint16x8_t v = vld1q_u16( p + x );
+
+		vst1q_s32( sum + x, vaddq_s32( vld1q_s32( sum + x ),
+			vreinterpretq_s32_u32(
+				vmovl_u16( vget_low_u16( v ) ) ) ) );
+		vst1q_s32( sum + x + 4, vaddq_s32( vld1q_s32( sum + x + 4 ),
+			vreinterpretq_s32_u32(
+				vmovl_u16( vget_high_u16( v ) ) ) ) );
+	}
+	for( ; x < n; x++ )
+		sum[x] += p[x];
+}
+
+/* Blend one pixel A into B, see composite_blend_sse41() in simd_x86.c. The
+ * alpha is in every element of aA and aB, and the result alpha goes to aB.
+ */
+static inline float32x4_t
+composite_blend_neon( VipsBlendMode mode,
+	float32x4_t A, float32x4_t aA, float32x4_t B, float32x4_t *aB )
+{
+	const float32x4_t one = vdupq_n_f32( 1.0 );
+
+	float32x4_t aR;
+	float32x4_t f;
+
+	switch( mode ) {
+	case VIPS_BLEND_MODE_DEST_IN:
+		aR = vmulq_f32( aA, *aB );
+		break;
+
+	case VIPS_BLEND_MODE_MULTIPLY:
+	case VIPS_BLEND_MODE_SCREEN:
+		aR = vaddq_f32( aA, vmulq_f32( *aB, vsubq_f32( one, aA ) ) );
+		f = vmulq_f32( A, B );
+		if( mode == VIPS_BLEND_MODE_SCREEN )
+			f = vsubq_f32( vaddq_f32( A, B ), f );
+		B = vaddq_f32( vaddq_f32(
+			vmulq_f32( vsubq_f32( one, *aB ), A ),
+			vmulq_f32( vsubq_f32( one, aA ), B ) ),
+			vmulq_f32( vmulq_f32( aA, *aB ), f ) );
+		break;
+
+	default:
+		g_assert( mode == VIPS_BLEND_MODE_OVER );
+
+		aR = vaddq_f32( aA, vmulq_f32( *aB, vsubq_f32( one, aA ) ) );
+		B = vaddq_f32( A, vmulq_f32( vsubq_f32( one, aA ), B ) );
+		break;
+	}
+
+	*aB = aR;
+
+	return( vsetq_lane_f32( vgetq_lane_f32( aR, 0 ), B, 3 ) );
+}
+
+/* Composite 4-band uchar images, see vips_combine_pixels3() in
+ * conversion/composite.cpp.
+ */
+static void
+composite_uchar_neon( VipsPel *out, VipsPel **in, int n, int width,
+	const VipsBlendMode *mode, int n_mode,
+	const float *max_band, gboolean premultiplied )
+{
+	const float32x4_t max = vld1q_f32( max_band );
+	const float32x4_t zero = vdupq_n_f32( 0.0 );
+	const float32x4_t high = vdupq_n_f32( UCHAR_MAX );
+
+	int x, i;
+
+	for( x = 0; x < width; x++ ) {
+		float32x4_t B;
+		float32x4_t aB;
+
+		B = vdivq_f32( vcvtq_f32_s32( load4( in[0] + x * 4 ) ), max );
+		aB = vdupq_laneq_f32( B, 3 );
+		if( !premultiplied )
+			B = vsetq_lane_f32( vgetq_lane_f32( B, 3 ),
+				vmulq_f32( B, aB ), 3 );
+
+		for( i = 1; i < n; i++ ) {
+			float32x4_t A;
+			float32x4_t aA;
+
+			A = vdivq_f32( vcvtq_f32_s32(
+				load4( in[i] + x * 4 ) ), max );
+			aA = vdupq_laneq_f32( A, 3 );
+			if( !premultiplied )
+				A = vmulq_f32( A, aA );
+
+			B = composite_blend_neon(
+				n_mode == 1 ? mode[0] : mode[i - 1],
+				A, aA, B, &aB );
+		}
+
+		if( !premultiplied ) {
+			float aR = vgetq_lane_f32( aB, 0 );
+
+			if( aR == 0 )
+				B = vsetq_lane_f32( aR, zero, 3 );
+			else
+				B = vsetq_lane_f32( aR, vdivq_f32( B, aB ), 3 );
+		}
+
+		B = vmulq_f32( B, max );
+		B = vminq_f32( vmaxq_f32( B, zero ), high );
+
+		store4( out + x * 4, 
+			vreinterpretq_s32_u32( vcvtq_u32_f32( B ) ) );
+	}
+}
+
+/* Multiply 3-band float pixels by a 3x3 matrix, see vips_col_scRGB2XYZ().
+ * The C version computes in double, so we must too.
+ */
+static void
+matrix3_neon( float *out, const float *in, int width, const double *matrix )
+{
+	const double c0[4] = { matrix[0], matrix[3], matrix[6], 0 };
+	const double c1[4] = { matrix[1], matrix[4], matrix[7], 0 };
+	const double c2[4] = { matrix[2], matrix[5], matrix[8], 0 };
+	const float64x2_t c0lo = vld1q_f64( c0 );
+	const float64x2_t c0hi = vld1q_f64( c0 + 2 );
+	const float64x2_t c1lo = vld1q_f64( c1 );
+	const float64x2_t c1hi = vld1q_f64( c1 + 2 );
+	const float64x2_t c2lo = vld1q_f64( c2 );
+	const float64x2_t c2hi = vld1q_f64( c2 + 2 );
+
+	int x;
+
+	for( x = 0; x < width; x++ ) {
+		const float *p = in + x * 3;
+		float *q = out + x * 3;
+		const float64x2_t r = vdupq_n_f64( p[0] );
+		const float64x2_t g = vdupq_n_f64( p[1] );
+		const float64x2_t b = vdupq_n_f64( p[2] );
+
+		float64x2_t lo, hi;
+
+		lo = vmulq_f64( c0lo, r );
+		lo = vaddq_f64( lo, vmulq_f64( c1lo, g ) );
+		lo = vaddq_f64( lo, vmulq_f64( c2lo, b ) );
+		hi = vmulq_f64( c0hi, r );
+		hi = vaddq_f64( hi, vmulq_f64( c1hi, g ) );
+		hi = vaddq_f64( hi, vmulq_f64( c2hi, b ) );
+
+		vst1_f32( q, vcvt_f32_f64( lo ) );
+		q[2] = vget_lane_f32( vcvt_f32_f64( hi ), 0 );
+	}
+}
+
+/* Transpose width x height pixels of ps bytes, see VipsSimdTransposeFn. The
+ * vector transpose uses this for the edges.
+ */
+static void
+transpose_c( VipsPel *out, int out_lskip,
+	const VipsPel *in, int in_lskip, int width, int height, int ps )
+{
+	int i, j;
+
+	for( j = 0; j < height; j++ ) {
+		VipsPel *q = out + j * out_lskip;
+		const VipsPel *p = in + j * ps;
+
+		for( i = 0; i < width; i++ ) {
+			memcpy( q, p, ps );
+			q += ps;
+			p += in_lskip;
+		}
+	}
+}
+
+/* 4 x 4 blocks of 4-byte pixels.
+ */
+static void
+transpose_uint_neon( VipsPel *out, int out_lskip,
+	const VipsPel *in, int in_lskip, int width, int height )
+{
+	int wb = width & ~3;
+	int hb = height & ~3;
+
+	int i, j;
+
+	for( j = 0; j < hb; j += 4 )
+		for( i = 0; i < wb; i += 4 ) {
+			const VipsPel *p = in + i * in_lskip + j * 4;
+			VipsPel *q = out + j * out_lskip + i * 4;
+
+			uint32x4x2_t t01 = vtrnq_u32(
+				vld1q_u32( (uint32_t *) p ),
+				vld1q_u32( (uint32_t *) (p + in_lskip) ) );
+			uint32x4x2_t t23 = vtrnq_u32(
+				vld1q_u32( (uint32_t *) (p + 2 * in_lskip) ),
+				vld1q_u32( (uint32_t *) (p + 3 * in_lskip) ) );
+
+			vst1q_u32( (uint32_t *) q, vcombine_u32(
+				vget_low_u32( t01.val[0] ),
+				vget_low_u32( t23.val[0] ) ) );
+			vst1q_u32( (uint32_t *) (q + out_lskip), vcombine_u32(
+				vget_low_u32( t01.val[1] ),
+				vget_low_u32( t23.val[1] ) ) );
+			vst1q_u32( (uint32_t *) (q + 2 * out_lskip),
+				vcombine_u32(
+					vget_high_u32( t01.val[0] ),
+					vget_high_u32( t23.val[0] ) ) );
+			vst1q_u32( (uint32_t *) (q + 3 * out_lskip),
+				vcombine_u32(
+					vget_high_u32( t01.val[1] ),
+					vget_high_u32( t23.val[1] ) ) );
+		}
+
+	transpose_c( out + wb * 4, out_lskip, in + wb * in_lskip, in_lskip,
+		width - wb, hb, 4 );
+	transpose_c( out + hb * out_lskip, out_lskip, in + hb * 4, in_lskip,
+		width, height - hb, 4 );
+}
+
+/* Reverse the pixels in each 16-byte vector, and walk the vectors
+ * backwards. vrev64 reverses within each half, then vext swaps the halves.
+ */
+#define FLIP_NEON( NAME, PS, REV ) \
+static void \
+flip_ ## NAME ## _neon( VipsPel *out, const VipsPel *in, int width ) \
+{ \
+	int n = width * PS; \
+	\
+	int x; \
+	\
+	for( x = 0; x + 16 <= n; x += 16 ) { \
+		uint8x16_t v = REV( vld1q_u8( in + n - x - 16 ) ); \
+		\
+		vst1q_u8( out + x, vextq_u8( v, v, 8 ) ); \
+	} \
+	\
+	for( ; x < n; x += PS ) \
+		memcpy( out + x, in + n - x - PS, PS ); \
+}
+
+#define REV_UCHAR( V ) vrev64q_u8( V )
+#define REV_USHORT( V ) \
+	vreinterpretq_u8_u16( vrev64q_u16( vreinterpretq_u16_u8( V ) ) )
+#define REV_UINT( V ) \
+	vreinterpretq_u8_u32( vrev64q_u32( vreinterpretq_u32_u8( V ) ) )
+#define REV_DOUBLE( V ) (V)
+
+FLIP_NEON( uchar, 1, REV_UCHAR )
+FLIP_NEON( ushort, 2, REV_USHORT )
+FLIP_NEON( uint, 4, REV_UINT )
+FLIP_NEON( double, 8, REV_DOUBLE )
+
+/* Elementwise max and min of two lines of uchar, for morphology/morph.c.
+ */
+#define MINMAX_NEON( NAME, OP, C ) \
+static void \
+NAME ## _uchar_neon( VipsPel *out, \
+	const VipsPel *a, const VipsPel *b, int n ) \
+{ \
+	int x; \
+	\
+	for( x = 0; x + 16 <= n; x += 16 ) \
+		vst1q_u8( out + x, \
+			OP( vld1q_u8( a + x ), vld1q_u8( b + x ) ) ); \
+	\
+	for( ; x < n; x++ ) \
+		out[x] = C( a[x], b[x] ); \
+}
+
+MINMAX_NEON( max, vmaxq_u8, VIPS_MAX )
+MINMAX_NEON( min, vminq_u8, VIPS_MIN )
+
+/* Relational ops for arithmetic/relational.c, 16 elements to 16 bytes of
+ * 0/255 mask at a time. NEON has unsigned and float compares, and vceq
+ * is false for NaN, so NOTEQ as its inverse matches C.
+ */
+#define REL_NEON_EQUAL( S, A, B ) vceqq_ ## S( A, B )
+#define REL_NEON_LESS( S, A, B ) vcltq_ ## S( A, B )
+#define REL_NEON_LESSEQ( S, A, B ) vcleq_ ## S( A, B )
+#define REL_NEON_MORE( S, A, B ) vcgtq_ ## S( A, B )
+#define REL_NEON_MOREEQ( S, A, B ) vcgeq_ ## S( A, B )
+
+#define REL_NEON_NOTEQ_u8( A, B ) vmvnq_u8( vceqq_u8( A, B ) )
+#define REL_NEON_NOTEQ_u16( A, B ) vmvnq_u16( vceqq_u16( A, B ) )
+#define REL_NEON_NOTEQ_f32( A, B ) vmvnq_u32( vceqq_f32( A, B ) )
+
+#define REL_NEON_EQUAL_u8( A, B ) REL_NEON_EQUAL( u8, A, B )
+#define REL_NEON_LESS_u8( A, B ) REL_NEON_LESS( u8, A, B )
+#define REL_NEON_LESSEQ_u8( A, B ) REL_NEON_LESSEQ( u8, A, B )
+#define REL_NEON_MORE_u8( A, B ) REL_NEON_MORE( u8, A, B )
+#define REL_NEON_MOREEQ_u8( A, B ) REL_NEON_MOREEQ( u8, A, B )
+#define REL_NEON_EQUAL_u16( A, B ) REL_NEON_EQUAL( u16, A, B )
+#define REL_NEON_LESS_u16( A, B ) REL_NEON_LESS( u16, A, B )
+#define REL_NEON_LESSEQ_u16( A, B ) REL_NEON_LESSEQ( u16, A, B )
+#define REL_NEON_MORE_u16( A, B ) REL_NEON_MORE( u16, A, B )
+#define REL_NEON_MOREEQ_u16( A, B ) REL_NEON_MOREEQ( u16, A, B )
+#define REL_NEON_EQUAL_f32( A, B ) REL_NEON_EQUAL( f32, A, B )
+#define REL_NEON_LESS_f32( A, B ) REL_NEON_LESS( f32, A, B )
+#define REL_NEON_LESSEQ_f32( A, B ) REL_NEON_LESSEQ( f32, A, B )
+#define REL_NEON_MORE_f32( A, B ) REL_NEON_MORE( f32, A, B )
+#define REL_NEON_MOREEQ_f32( A, B ) REL_NEON_MOREEQ( f32, A, B )
+
+#define REL16_UCHAR( OP ) \
+	REL_NEON_ ## OP ## _u8( vld1q_u8( ta + x ), \
+		tb ? vld1q_u8( tb + x ) : vc )
+
+#define REL8_USHORT( OP, I ) \
+	vmovn_u16( REL_NEON_ ## OP ## _u16( vld1q_u16( ta + x + I ), \
+		tb ? vld1q_u16( tb + x + I ) : vc ) )
+
+#define REL16_USHORT( OP ) \
+	vcombine_u8( REL8_USHORT( OP, 0 ), REL8_USHORT( OP, 8 ) )
+
+#define REL4_FLOAT( OP, I ) \
+	vmovn_u32( REL_NEON_ ## OP ## _f32( vld1q_f32( ta + x + I ), \
+		tb ? vld1q_f32( tb + x + I ) : vc ) )
+
+#define REL16_FLOAT( OP ) \
+	vcombine_u8( \
+		vmovn_u16( vcombine_u16( \
+			REL4_FLOAT( OP, 0 ), REL4_FLOAT( OP, 4 ) ) ), \
+		vmovn_u16( vcombine_u16( \
+			REL4_FLOAT( OP, 8 ), REL4_FLOAT( OP, 12 ) ) ) )
+
+#define REL_LOOP( REL16, OP, C ) { \
+	for( x = 0; x + 16 <= n; x += 16 ) \
+		vst1q_u8( out + x, REL16( OP ) ); \
+	\
+	for( ; x < n; x++ ) \
+		out[x] = (ta[x] C (tb ? tb[x] : tc)) ? 255 : 0; \
+}
+
+#define REL_SWITCH( REL16 ) { \
+	switch( op ) { \
+	case VIPS_OPERATION_RELATIONAL_EQUAL: \
+		REL_LOOP( REL16, EQUAL, == ); \
+		break; \
+	\
+	case VIPS_OPERATION_RELATIONAL_NOTEQ: \
+		REL_LOOP( REL16, NOTEQ, != ); \
+		break; \
+	\
+	case VIPS_OPERATION_RELATIONAL_LESS: \
+		REL_LOOP( REL16, LESS, < ); \
+		break; \
+	\
+	case VIPS_OPERATION_RELATIONAL_LESSEQ: \
+		REL_LOOP( REL16, LESSEQ, <= ); \
+		break; \
+	\
+	case VIPS_OPERATION_RELATIONAL_MORE: \
+		REL_LOOP( REL16, MORE, > ); \
+		break; \
+	\
+	case VIPS_OPERATION_RELATIONAL_MOREEQ: \
+		REL_LOOP( REL16, MOREEQ, >= ); \
+		break; \
+	\
+	default: \
+		g_assert_not_reached(); \
+	} \
+}
+
+static void
+relational_uchar_neon( VipsPel *out,
+	const VipsPel *a, const VipsPel *b, const VipsPel *c, int n,
+	VipsOperationRelational op )
+{
+	const uint8_t *ta = a;
+	const uint8_t *tb = b;
+	const uint8_t tc = b ? 0 : *c;
+	const uint8x16_t vc = vdupq_n_u8( tc );
+
+	int x;
+
+	REL_SWITCH( REL16_UCHAR );
+}
+
+static void
+relational_ushort_neon( VipsPel *out,
+	const VipsPel *a, const VipsPel *b, const VipsPel *c, int n,
+	VipsOperationRelational op )
+{
+	const uint16_t *ta = (const uint16_t *) a;
+	const uint16_t *tb = (const uint16_t *) b;
+	const uint16_t tc = b ? 0 : *((const uint16_t *) c);
+	const uint16x8_t vc = vdupq_n_u16( tc );
+
+	int x;
+
+	REL_SWITCH( REL16_USHORT );
+}
+
+static void
+relational_float_neon( VipsPel *out,
+	const VipsPel *a, const VipsPel *b, const VipsPel *c, int n,
+	VipsOperationRelational op )
+{
+	const float *ta = (const float *) a;
+	const float *tb = (const float *) b;
+	const float tc = b ? 0 : *((const float *) c);
+	const float32x4_t vc = vdupq_n_f32( tc );
+
+	int x;
+
+	REL_SWITCH( REL16_FLOAT );
+}
+
+/* Bitwise and, or and eor for arithmetic/boolean.c, good for any integer
+ * format.
+ */
+#define BOOL_LOOP( OP ) { \
+	if( b ) \
+		for( ; x + 16 <= n; x += 16 ) \
+			vst1q_u8( out + x, \
+				OP( vld1q_u8( a + x ), vld1q_u8( b + x ) ) ); \
+	else \
+		for( ; x + 16 <= n; x += 16 ) \
+			vst1q_u8( out + x, OP( vld1q_u8( a + x ), vc ) ); \
+}
+
+static void
+boolean_uchar_neon( VipsPel *out,
+	const VipsPel *a, const VipsPel *b, const VipsPel *c, int n,
+	VipsOperationBoolean op )
+{
+	const VipsPel cc = b ? 0 : *c;
+	const uint8x16_t vc = vdupq_n_u8( cc );
+
+	int x;
+
+	x = 0;
+	switch( op ) {
+	case VIPS_OPERATION_BOOLEAN_AND:
+		BOOL_LOOP( vandq_u8 );
+		break;
+
+	case VIPS_OPERATION_BOOLEAN_OR:
+		BOOL_LOOP( vorrq_u8 );
+		break;
+
+	case VIPS_OPERATION_BOOLEAN_EOR:
+		BOOL_LOOP( veorq_u8 );
+		break;
+
+	default:
+		g_assert_not_reached();
+	}
+
+	for( ; x < n; x++ ) {
+		VipsPel r = b ? b[x] : cc;
+
+		switch( op ) {
+		case VIPS_OPERATION_BOOLEAN_AND: out[x] = a[x] & r; break;
+		case VIPS_OPERATION_BOOLEAN_OR: out[x] = a[x] | r; break;
+		default: out[x] = a[x] ^ r; break;
+		}
+	}
+}
+
+/* Runs of pels equal or not equal to a value, for draw/draw_flood.c. NEON
+ * has no movemask, so we narrow the compare to four bits per byte instead.
+ */
+static inline guint64
+span_mask_neon( uint8x16_t c )
+{
+	return( vget_lane_u64( vreinterpret_u64_u8(
+		vshrn_n_u16( vreinterpretq_u16_u8( c ), 4 ) ), 0 ) );
+}
+
+#define SPAN_NEON( NAME, S, TYPE, DUP, LOAD, CMP, CAST ) \
+static int \
+span_ ## NAME ## _neon( const VipsPel *p, int n, \
+	const VipsPel *value, gboolean equal ) \
+{ \
+	guint64 flip = equal ? ~((guint64) 0) : 0; \
+	TYPE v; \
+	int x; \
+	\
+	memcpy( &v, value, S ); \
+	\
+	for( x = 0; x + 16 / S <= n; x += 16 / S ) { \
+		uint8x16_t c = CAST( CMP( LOAD( p + x * S ), DUP( v ) ) ); \
+		guint64 stop = span_mask_neon( c ) ^ flip; \
+		\
+		if( stop ) \
+			return( x + __builtin_ctzll( stop ) / (4 * S) ); \
+	} \
+	\
+	for( ; x < n; x++ ) \
+		if( (memcmp( p + x * S, value, S ) == 0) != equal ) \
+			break; \
+	\
+	return( x ); \
+} \
+\
+static int \
+span_back_ ## NAME ## _neon( const VipsPel *p, int n, \
+	const VipsPel *value, gboolean equal ) \
+{ \
+	guint64 flip = equal ? ~((guint64) 0) : 0; \
+	TYPE v; \
+	int x; \
+	\
+	memcpy( &v, value, S ); \
+	\
+	for( x = 0; x + 16 / S <= n; x += 16 / S ) { \
+		uint8x16_t c = CAST( CMP( \
+			LOAD( p - x * S - 16 + S ), DUP( v ) ) ); \
+		guint64 stop = span_mask_neon( c ) ^ flip; \
+		\
+		if( stop ) \
+			return( x + 16 / S - 1 - \
+				(63 - __builtin_clzll( stop )) / (4 * S) ); \
+	} \
+	\
+	for( ; x < n; x++ ) \
+		if( (memcmp( p - x * S, value, S ) == 0) != equal ) \
+			break; \
+	\
+	return( x ); \
+}
+
+#define LOAD_U8( P ) vld1q_u8( P )
+#define LOAD_U16( P ) vreinterpretq_u16_u8( vld1q_u8( P ) )
+#define LOAD_U32( P ) vreinterpretq_u32_u8( vld1q_u8( P ) )
+#define CAST_U8( V ) (V)
+
+SPAN_NEON( uchar, 1, guint8, vdupq_n_u8, LOAD_U8, vceqq_u8, CAST_U8 )
+SPAN_NEON( ushort, 2, guint16, vdupq_n_u16, LOAD_U16, vceqq_u16,
+	vreinterpretq_u8_u16 )
+SPAN_NEON( uint, 4, guint32, vdupq_n_u32, LOAD_U32, vceqq_u32,
+	vreinterpretq_u8_u32 )
+
+/* A 32-entry table is a single two-register table lookup.
+ */
+static void
+lut32_uchar_neon( VipsPel *out, const VipsPel *in, int n,
+	const VipsPel *table, int clip )
+{
+	uint8x16x2_t t;
+	uint8x16_t vclip = vdupq_n_u8( clip );
+
+	int x;
+
+	t.val[0] = vld1q_u8( table );
+	t.val[1] = vld1q_u8( table + 16 );
+
+	for( x = 0; x + 16 <= n; x += 16 )
+		vst1q_u8( out + x, vqtbl2q_u8( t,
+			vminq_u8( vld1q_u8( in + x ), vclip ) ) );
+
+	for( ; x < n; x++ )
+		out[x] = table[VIPS_MIN( in[x], clip )];
+}
+
+/* Blend for mosaicing, see simd_x86.c.
+ */
+static inline uint32x4_t
+blend_u32_neon( uint32x4_t a, uint32x4_t b, const int *c1, const int *c2 )
+{
+	uint32x4_t t1 =
+		vmulq_u32( a, vreinterpretq_u32_s32( vld1q_s32( c1 ) ) );
+	uint32x4_t t2 =
+		vmulq_u32( b, vreinterpretq_u32_s32( vld1q_s32( c2 ) ) );
+
+	return( vaddq_u32( vshrq_n_u32( t1, 12 ), vshrq_n_u32( t2, 12 ) ) );
+}
+
+/* 8 ushort elements.
+ */
+static inline uint16x8_t
+blend_u16_neon( uint16x8_t a, uint16x8_t b, const int *c1, const int *c2 )
+{
+	uint32x4_t lo = blend_u32_neon( vmovl_u16( vget_low_u16( a ) ),
+		vmovl_u16( vget_low_u16( b ) ), c1, c2 );
+	uint32x4_t hi = blend_u32_neon( vmovl_u16( vget_high_u16( a ) ),
+		vmovl_u16( vget_high_u16( b ) ), c1 + 4, c2 + 4 );
+
+	return( vcombine_u16( vqmovn_u32( lo ), vqmovn_u32( hi ) ) );
+}
+
+static void
+blend_uchar_neon( VipsPel *out, const VipsPel *a, const VipsPel *b, int n,
+	const void *vc1, const void *vc2 )
+{
+	const int *c1 = (const int *) vc1;
+	const int *c2 = (const int *) vc2;
+
+	int x;
+
+	for( x = 0; x + 16 <= n; x += 16 ) {
+		uint8x16_t pa = vld1q_u8( a + x );
+		uint8x16_t pb = vld1q_u8( b + x );
+		uint16x8_t lo = blend_u16_neon( vmovl_u8( vget_low_u8( pa ) ),
+			vmovl_u8( vget_low_u8( pb ) ), c1 + x, c2 + x );
+		uint16x8_t hi = blend_u16_neon( vmovl_u8( vget_high_u8( pa ) ),
+			vmovl_u8( vget_high_u8( pb ) ),
+			c1 + x + 8, c2 + x + 8 );
+
+		vst1q_u8( out + x, vcombine_u8( vqmovn_u16( lo ),
+			vqmovn_u16( hi ) ) );
+	}
+
+	for( ; x < n; x++ )
+		out[x] = c1[x] * a[x] / 4096 + c2[x] * b[x] / 4096;
+}
+
+static void
+blend_ushort_neon( VipsPel *vout,
+	const VipsPel *va, const VipsPel *vb, int n,
+	const void *vc1, const void *vc2 )
+{
+	unsigned short *out = (unsigned short *) vout;
+	const unsigned short *a = (const unsigned short *) va;
+	const unsigned short *b = (const unsigned short *) vb;
+	const int *c1 = (const int *) vc1;
+	const int *c2 = (const int *) vc2;
+
+	int x;
+
+	for( x = 0; x + 8 <= n; x += 8 )
+		vst1q_u16( out + x, blend_u16_neon(
+			vld1q_u16( a + x ), vld1q_u16( b + x ),
+			c1 + x, c2 + x ) );
+
+	for( ; x < n; x++ )
+		out[x] = c1[x] * a[x] / 4096 + c2[x] * b[x] / 4096;
+}
+
+static inline float64x2_t
+blend_f64_neon( float64x2_t a, float64x2_t b,
+	const double *c1, const double *c2 )
+{
+	float64x2_t vc1 = vld1q_f64( c1 );
+	float64x2_t vc2 = vld1q_f64( c2 );
+	float64x2_t r = vaddq_f64( vmulq_f64( vc1, a ), vmulq_f64( vc2, b ) );
+
+	r = vbslq_f64( vceqzq_f64( vc1 ), b, r );
+
+	return( vbslq_f64( vceqzq_f64( vc2 ), a, r ) );
+}
+
+static void
+blend_float_neon( VipsPel *vout,
+	const VipsPel *va, const VipsPel *vb, int n,
+	const void *vc1, const void *vc2 )
+{
+	float *out = (float *) vout;
+	const float *a = (const float *) va;
+	const float *b = (const float *) vb;
+	const double *c1 = (const double *) vc1;
+	const double *c2 = (const double *) vc2;
+
+	int x;
+
+	for( x = 0; x + 4 <= n; x += 4 ) {
+		float32x4_t pa = vld1q_f32( a + x );
+		float32x4_t pb = vld1q_f32( b + x );
+		float64x2_t lo = blend_f64_neon(
+			vcvt_f64_f32( vget_low_f32( pa ) ),
+			vcvt_f64_f32( vget_low_f32( pb ) ),
+			c1 + x, c2 + x );
+		float64x2_t hi = blend_f64_neon(
+			vcvt_high_f64_f32( pa ), vcvt_high_f64_f32( pb ),
+			c1 + x + 2, c2 + x + 2 );
+
+		vst1q_f32( out + x,
+			vcvt_high_f32_f64( vcvt_f32_f64( lo ), hi ) );
+	}
+
+	for( ; x < n; x++ )
+		if( c2[x] == 0.0 )
+			out[x] = a[x];
+		else if( c1[x] == 0.0 )
+			out[x] = b[x];
+		else
+			out[x] = c1[x] * a[x] + c2[x] * b[x];
+}
+
+/* The C loop for the 2x2 mean, from output element x to the end of the
+ * line. x must be at the start of a pixel.
+ */
+#define SHRINK2_TAIL_INT( TYPE ) { \
+	const TYPE *p = (const TYPE *) in; \
+	const TYPE *p1 = (const TYPE *) (in + lskip); \
+	TYPE *q = (TYPE *) out; \
+	\
+	for( ; x < ne; x++ ) { \
+		const int i = 2 * x - x % bands; \
+		\
+		q[x] = (p[i] + p[i + bands] + p1[i] + p1[i + bands] + 2) >> 2; \
+	} \
+}
+
+/* vldN deinterleaves the bands, so a pairwise add is the sum of each even
+ * and odd pixel, and the rounding narrow does the + 2 >> 2.
+ */
+#define SHRINK2_UCHAR_NEON( N ) \
+	for( ; x + 8 * N <= ne; x += 8 * N ) { \
+		uint8x16x##N##_t a = vld##N##q_u8( in + 2 * x ); \
+		uint8x16x##N##_t b = vld##N##q_u8( in + lskip + 2 * x ); \
+		uint8x8x##N##_t o; \
+		int z; \
+		\
+		for( z = 0; z < N; z++ ) \
+			o.val[z] = vrshrn_n_u16( vaddq_u16( \
+				vpaddlq_u8( a.val[z] ), \
+				vpaddlq_u8( b.val[z] ) ), 2 ); \
+		vst##N##_u8( out + x, o ); \
+	}
+
+static void
+shrink2_uchar_neon( VipsPel *out, const VipsPel *in,
+	int lskip, int width, int bands )
+{
+	const int ne = width * bands;
+
+	int x;
+
+	x = 0;
+	switch( bands ) {
+	case 1:
+		for( ; x + 8 <= ne; x += 8 )
+			vst1_u8( out + x, vrshrn_n_u16( vaddq_u16(
+				vpaddlq_u8( vld1q_u8( in + 2 * x ) ),
+				vpaddlq_u8( vld1q_u8( in + lskip + 2 * x ) ) ),
+				2 ) );
+		break;
+
+	case 2:
+		SHRINK2_UCHAR_NEON( 2 );
+		break;
+
+	case 3:
+		SHRINK2_UCHAR_NEON( 3 );
+		break;
+
+	case 4:
+		SHRINK2_UCHAR_NEON( 4 );
+		break;
+
+	default:
+		break;
+	}
+
+	SHRINK2_TAIL_INT( unsigned char );
+}
+
+#define SHRINK2_USHORT_NEON( N ) \
+	for( ; x + 4 * N <= ne; x += 4 * N ) { \
+		uint16x8x##N##_t a = vld##N##q_u16( p + 2 * x ); \
+		uint16x8x##N##_t b = vld##N##q_u16( p1 + 2 * x ); \
+		uint16x4x##N##_t o; \
+		int z; \
+		\
+		for( z = 0; z < N; z++ ) \
+			o.val[z] = vrshrn_n_u32( vaddq_u32( \
+				vpaddlq_u16( a.val[z] ), \
+				vpaddlq_u16( b.val[z] ) ), 2 ); \
+		vst##N##_u16( q + x, o ); \
+	}
+
+static void
+shrink2_ushort_neon( VipsPel *out, const VipsPel *in,
+	int lskip, int width, int bands )
+{
+	const int ne = width * bands;
+	const unsigned short *p = (const unsigned short *) in;
+	const unsigned short *p1 = (const unsigned short *) (in + lskip);
+	unsigned short *q = (unsigned short *) out;
+
+	int x;
+
+	x = 0;
+	switch( bands ) {
+	case 1:
+		for( ; x + 4 <= ne; x += 4 )
+			vst1_u16( q + x, vrshrn_n_u32( vaddq_u32(
+				vpaddlq_u16( vld1q_u16( p + 2 * x ) ),
+				vpaddlq_u16( vld1q_u16( p1 + 2 * x ) ) ),
+				2 ) );
+		break;
+
+	case 2:
+		SHRINK2_USHORT_NEON( 2 );
+		break;
+
+	case 3:
+		SHRINK2_USHORT_NEON( 3 );
+		break;
+
+	case 4:
+		SHRINK2_USHORT_NEON( 4 );
+		break;
+
+	default:
+		break;
+	}
+
+	SHRINK2_TAIL_INT( unsigned short );
+}
+
+/* Float adds in the same order as the C loop, so the results match. a and
+ * b are 8 pixels of one band from each line.
+ */
+static inline float32x4_t
+shrink2_f32( float32x4_t a0, float32x4_t a1, float32x4_t b0, float32x4_t b1 )
+{
+	float32x4_t sum;
+
+	sum = vaddq_f32( vuzp1q_f32( a0, a1 ), vuzp2q_f32( a0, a1 ) );
+	sum = vaddq_f32( sum, vuzp1q_f32( b0, b1 ) );
+	sum = vaddq_f32( sum, vuzp2q_f32( b0, b1 ) );
+
+	return( vmulq_n_f32( sum, 0.25 ) );
+}
+
+#define SHRINK2_FLOAT_NEON( N ) \
+	for( ; x + 4 * N <= ne; x += 4 * N ) { \
+		float32x4x##N##_t a0 = vld##N##q_f32( p + 2 * x ); \
+		float32x4x##N##_t a1 = vld##N##q_f32( p + 2 * x + 4 * N ); \
+		float32x4x##N##_t b0 = vld##N##q_f32( p1 + 2 * x ); \
+		float32x4x##N##_t b1 = vld##N##q_f32( p1 + 2 * x + 4 * N ); \
+		float32x4x##N##_t o; \
+		int z; \
+		\
+		for( z = 0; z < N; z++ ) \
+			o.val[z] = shrink2_f32( a0.val[z], a1.val[z], \
+				b0.val[z], b1.val[z] ); \
+		vst##N##q_f32( q + x, o ); \
+	}
+
+static void
+shrink2_float_neon( VipsPel *out, const VipsPel *in,
+	int lskip, int width, int bands )
+{
+	const int ne = width * bands;
+	const float *p = (const float *) in;
+	const float *p1 = (const float *) (in + lskip);
+	float *q = (float *) out;
+
+	int x;
+
+	x = 0;
+	switch( bands ) {
+	case 1:
+		for( ; x + 4 <= ne; x += 4 )
+			vst1q_f32( q + x, shrink2_f32(
+				vld1q_f32( p + 2 * x ),
+				vld1q_f32( p + 2 * x + 4 ),
+				vld1q_f32( p1 + 2 * x ),
+				vld1q_f32( p1 + 2 * x + 4 ) ) );
+		break;
+
+	case 2:
+		SHRINK2_FLOAT_NEON( 2 );
+		break;
+
+	case 3:
+		SHRINK2_FLOAT_NEON( 3 );
+		break;
+
+	case 4:
+		SHRINK2_FLOAT_NEON( 4 );
+		break;
+
+	default:
+		break;
+	}
+
+	for( ; x < ne; x++ ) {
+		const int i = 2 * x - x % bands;
+
+		q[x] = (p[i] + p[i + bands] + p1[i] + p1[i + bands]) / 4;
+	}
+}
+
+/* One RGBE pixel in C, see colr_color() in colour/rad2float.c.
+ */
+static inline void
+rad2float_pel( float *q, const VipsPel *p )
+{
+	if( p[3] == 0 )
+		q[0] = q[1] = q[2] = 0.0;
+	else {
+		double f = ldexp( 1.0, (int) p[3] - (128 + 8) );
+
+		q[0] = (p[0] + 0.5) * f;
+		q[1] = (p[1] + 0.5) * f;
+		q[2] = (p[2] + 0.5) * f;
+	}
+}
+
+/* Four elements of 2m + 1 as float.
+ */
+static inline float32x4_t
+rad2float_mant( uint16x4_t m )
+{
+	return( vcvtq_f32_u32( vaddq_u32( vshll_n_u16( m, 1 ),
+		vdupq_n_u32( 1 ) ) ) );
+}
+
+/* Four pixels from the deinterleaved bands, see rad2float_ps() in
+ * simd_x86.c for the maths.
+ */
+static inline void
+rad2float_4( float *q, uint16x4_t r, uint16x4_t g, uint16x4_t b,
+	uint16x4_t e )
+{
+	uint32x4_t e32 = vmovl_u16( e );
+	float32x4_t f = vreinterpretq_f32_u32( vshlq_n_u32(
+		vsubq_u32( e32, vdupq_n_u32( 10 ) ), 23 ) );
+	uint32x4_t zero = vceqq_u32( e32, vdupq_n_u32( 0 ) );
+	float32x4x3_t o;
+
+#define BAND( Z, M ) \
+	o.val[Z] = vreinterpretq_f32_u32( vbicq_u32( vreinterpretq_u32_f32( \
+		vmulq_f32( rad2float_mant( M ), f ) ), zero ) );
+
+	BAND( 0, r );
+	BAND( 1, g );
+	BAND( 2, b );
+
+#undef BAND
+
+	vst3q_f32( q, o );
+}
+
+static void
+rad2float_neon( float *out, const VipsPel *in, int width )
+{
+	int x;
+	int i;
+
+	/* vld4 splits eight pixels into bands. Groups with a tiny exponent,
+	 * where the result would be denormal, are done in C.
+	 */
+	for( x = 0; x + 8 <= width; x += 8 ) {
+		const VipsPel *p = in + 4 * x;
+		float *q = out + 3 * x;
+		uint8x8x4_t v = vld4_u8( p );
+		uint8x8_t tiny = vclt_u8( vsub_u8( v.val[3], vdup_n_u8( 1 ) ),
+			vdup_n_u8( 10 ) );
+
+		if( vmaxv_u8( tiny ) ) {
+			for( i = 0; i < 8; i++ )
+				rad2float_pel( q + 3 * i, p + 4 * i );
+		}
+		else {
+			uint16x8_t r = vmovl_u8( v.val[0] );
+			uint16x8_t g = vmovl_u8( v.val[1] );
+			uint16x8_t b = vmovl_u8( v.val[2] );
+			uint16x8_t e = vmovl_u8( v.val[3] );
+
+			rad2float_4( q, vget_low_u16( r ), vget_low_u16( g ),
+				vget_low_u16( b ), vget_low_u16( e ) );
+			rad2float_4( q + 12, vget_high_u16( r ), 
+				vget_high_u16( g ), vget_high_u16( b ), 
+				vget_high_u16( e ) );
+		}
+	}
+
+	for( ; x < width; x++ )
+		rad2float_pel( out + 3 * x, in + 4 * x );
+}
+
+void
+vips__simd_neon_init( void )
+{
+	VipsSimdFeatures neon = VIPS_SIMD_NEON;
+
+	vips_simd_register( VIPS_SIMD_LINEAR, VIPS_FORMAT_UCHAR,
+		neon, linear_uchar_neon );
+	vips_simd_register( VIPS_SIMD_LINEAR, VIPS_FORMAT_USHORT,
+		neon, linear_ushort_neon );
+	vips_simd_register( VIPS_SIMD_LINEAR, VIPS_FORMAT_SHORT,
+		neon, linear_short_neon );
+	vips_simd_register( VIPS_SIMD_LINEAR, VIPS_FORMAT_FLOAT,
+		neon, linear_float_neon );
+
+	vips_simd_register( VIPS_SIMD_CAST_FLOAT, VIPS_FORMAT_UCHAR,
+		neon, cast_uchar_neon );
+	vips_simd_register( VIPS_SIMD_CAST_FLOAT, VIPS_FORMAT_USHORT,
+		neon, cast_ushort_neon );
+	vips_simd_register( VIPS_SIMD_CAST_FLOAT, VIPS_FORMAT_SHORT,
+		neon, cast_short_neon );
+
+	vips_simd_register( VIPS_SIMD_CLIP_FLOAT, VIPS_FORMAT_UCHAR,
+		neon, clip_uchar_neon );
+	vips_simd_register( VIPS_SIMD_CLIP_FLOAT, VIPS_FORMAT_USHORT,
+		neon, clip_ushort_neon );
+
+	vips_simd_register( VIPS_SIMD_SHIFT_UCHAR, VIPS_FORMAT_USHORT,
+		neon, shift_ushort_neon );
+
+	vips_simd_register( VIPS_SIMD_PREMULTIPLY, VIPS_FORMAT_UCHAR,
+		neon, premultiply_uchar_neon );
+	vips_simd_register( VIPS_SIMD_PREMULTIPLY, VIPS_FORMAT_USHORT,
+		neon, premultiply_ushort_neon );
+	vips_simd_register( VIPS_SIMD_PREMULTIPLY, VIPS_FORMAT_FLOAT,
+		neon, premultiply_float_neon );
+	vips_simd_register( VIPS_SIMD_UNPREMULTIPLY, VIPS_FORMAT_UCHAR,
+		neon, unpremultiply_uchar_neon );
+	vips_simd_register( VIPS_SIMD_UNPREMULTIPLY, VIPS_FORMAT_USHORT,
+		neon, unpremultiply_ushort_neon );
+	vips_simd_register( VIPS_SIMD_UNPREMULTIPLY, VIPS_FORMAT_FLOAT,
+		neon, unpremultiply_float_neon );
+	vips_simd_register( VIPS_SIMD_FLATTEN, VIPS_FORMAT_UCHAR,
+		neon, flatten_uchar_neon );
+	vips_simd_register( VIPS_SIMD_FLATTEN, VIPS_FORMAT_USHORT,
+		neon, flatten_ushort_neon );
+
+	vips_simd_register( VIPS_SIMD_REDUCEH, VIPS_FORMAT_UCHAR,
+		neon, reduceh_uchar_neon );
+
+	vips_simd_register( VIPS_SIMD_REDUCEV, VIPS_FORMAT_UCHAR,
+		neon, reducev_uchar_neon );
+	vips_simd_register( VIPS_SIMD_REDUCEV, VIPS_FORMAT_USHORT,
+		neon, reducev_ushort_neon );
+
+	vips_simd_register( VIPS_SIMD_CONVH, VIPS_FORMAT_UCHAR,
+		neon, convh_uchar_neon );
+	vips_simd_register( VIPS_SIMD_CONVH, VIPS_FORMAT_USHORT,
+		neon, convh_ushort_neon );
+	vips_simd_register( VIPS_SIMD_CONVH, VIPS_FORMAT_FLOAT,
+		neon, convh_float_neon );
+	vips_simd_register( VIPS_SIMD_CONVV, VIPS_FORMAT_FLOAT,
+		neon, convv_float_neon );
+
+	vips_simd_register( VIPS_SIMD_SHRINKH, VIPS_FORMAT_UCHAR,
+		neon, shrinkh_uchar_neon );
+
+	vips_simd_register( VIPS_SIMD_SHRINKV, VIPS_FORMAT_UCHAR,
+		neon, shrinkv_uchar_neon );
+	vips_simd_register( VIPS_SIMD_SHRINKV, VIPS_FORMAT_USHORT,
+		neon, shrinkv_ushort_neon );
+
+	vips_simd_register( VIPS_SIMD_COMPOSITE, VIPS_FORMAT_UCHAR,
+		neon, composite_uchar_neon );
+
+	vips_simd_register( VIPS_SIMD_MATRIX3, VIPS_FORMAT_FLOAT,
+		neon, matrix3_neon );
+
+	vips_simd_register( VIPS_SIMD_TRANSPOSE, VIPS_FORMAT_UINT,
+		neon, transpose_uint_neon );
+
+	vips_simd_register( VIPS_SIMD_FLIP, VIPS_FORMAT_UCHAR,
+		neon, flip_uchar_neon );
+	vips_simd_register( VIPS_SIMD_FLIP, VIPS_FORMAT_USHORT,
+		neon, flip_ushort_neon );
+	vips_simd_register( VIPS_SIMD_FLIP, VIPS_FORMAT_UINT,
+		neon, flip_uint_neon );
+	vips_simd_register( VIPS_SIMD_FLIP, VIPS_FORMAT_DOUBLE,
+		neon, flip_double_neon );
+
+	vips_simd_register( VIPS_SIMD_MAX, VIPS_FORMAT_UCHAR,
+		neon, max_uchar_neon );
+	vips_simd_register( VIPS_SIMD_MIN, VIPS_FORMAT_UCHAR,
+		neon, min_uchar_neon );
+
+	vips_simd_register( VIPS_SIMD_LUT32, VIPS_FORMAT_UCHAR,
+		neon, lut32_uchar_neon );
+
+	vips_simd_register( VIPS_SIMD_BLEND, VIPS_FORMAT_UCHAR,
+		neon, blend_uchar_neon );
+	vips_simd_register( VIPS_SIMD_BLEND, VIPS_FORMAT_USHORT,
+		neon, blend_ushort_neon );
+	vips_simd_register( VIPS_SIMD_BLEND, VIPS_FORMAT_FLOAT,
+		neon, blend_float_neon );
+
+	vips_simd_register( VIPS_SIMD_SPAN, VIPS_FORMAT_UCHAR,
+		neon, span_uchar_neon );
+	vips_simd_register( VIPS_SIMD_SPAN, VIPS_FORMAT_USHORT,
+		neon, span_ushort_neon );
+	vips_simd_register( VIPS_SIMD_SPAN, VIPS_FORMAT_UINT,
+		neon, span_uint_neon );
+	vips_simd_register( VIPS_SIMD_SPAN_BACK, VIPS_FORMAT_UCHAR,
+		neon, span_back_uchar_neon );
+	vips_simd_register( VIPS_SIMD_SPAN_BACK, VIPS_FORMAT_USHORT,
+		neon, span_back_ushort_neon );
+	vips_simd_register( VIPS_SIMD_SPAN_BACK, VIPS_FORMAT_UINT,
+		neon, span_back_uint_neon );
+
+	vips_simd_register( VIPS_SIMD_RELATIONAL, VIPS_FORMAT_UCHAR,
+		neon, relational_uchar_neon );
+	vips_simd_register( VIPS_SIMD_RELATIONAL, VIPS_FORMAT_USHORT,
+		neon, relational_ushort_neon );
+	vips_simd_register( VIPS_SIMD_RELATIONAL, VIPS_FORMAT_FLOAT,
+		neon, relational_float_neon );
+
+	vips_simd_register( VIPS_SIMD_BOOLEAN, VIPS_FORMAT_UCHAR,
+		neon, boolean_uchar_neon );
+
+	vips_simd_register( VIPS_SIMD_SHRINK2, VIPS_FORMAT_UCHAR,
+		neon, shrink2_uchar_neon );
+	vips_simd_register( VIPS_SIMD_SHRINK2, VIPS_FORMAT_USHORT,
+		neon, shrink2_ushort_neon );
+	vips_simd_register( VIPS_SIMD_SHRINK2, VIPS_FORMAT_FLOAT,
+		neon, shrink2_float_neon );
+
+	vips_simd_register( VIPS_SIMD_RAD2FLOAT, VIPS_FORMAT_UCHAR,
+		neon, rad2float_neon );
+}
+
+#endif /*HAVE_SIMD_NEON*/
@@ -0,0 +1,4339 @@
+/* SSE4.1, AVX2 and AVX-512 kernels
+ *
+ * 14/10/18
+ * 	- first version
+ * 	- reduceh works on lines, add ushort, float and AVX2 versions
+ * 	- add bilinear and bicubic uchar kernels
+ * 	- add uchar max and min
+ * 	- add lut32
+ * 	- add span and span_back
+ * 	- add relational and boolean
+ * 15/10/18
+ * 	- add rad2float
+ */
+
+/*
+
+    This file is part of VIPS.
+
+    VIPS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA
+
+ */
+
+/*
+
+    These files are distributed with VIPS - http://www.vips.ecs.soton.ac.uk
+
+ */
+
+/* We build everything with the target attribute, so the rest of libvips
+ * does not need to be compiled for a particular x86 level. vips_simd_init()
+ * checks the CPU before registering anything from here.
+ *
+ * Each kernel must give exactly the same result as the C loop it replaces,
+ * so watch the order of operations, and don't let the compiler contract
+ * mul/add pairs.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /*HAVE_CONFIG_H*/
+#include <vips/intl.h>
+
+#include <string.h>
+#include <math.h>
+
+#include <vips/vips.h>
+#include <vips/simd.h>
+#include <vips/internal.h>
+
+#ifdef HAVE_SIMD_X86
+
+#include <immintrin.h>
+
+#define SSE41 __attribute__((target("sse4.1")))
+#define AVX2 __attribute__((target("avx2")))
+#define AVX512 __attribute__((target("avx512f")))
+
+/* The round and shift for fixed-point masks, see unsigned_fixed_round() in
+ * resample/templates.h.
+ */
+#define ROUND_BY (VIPS_INTERPOLATE_SCALE >> 1)
+
+/* Four bytes to a vector, avoiding unaligned int reads.
+ */
+static inline __m128i
+load4( const VipsPel *p )
+{
+	int v;
+
+	memcpy( &v, p, 4 );
+
+	return( _mm_cvtsi32_si128( v ) );
+}
+
+static inline void
+store4( VipsPel *q, __m128i v )
+{
+	int i = _mm_cvtsi128_si32( v );
+
+	memcpy( q, &i, 4 );
+}
+
+/* Convert four elements of uchar/ushort/short/float to a float vector.
+ */
+#define LOAD4_UCHAR( P ) \
+	_mm_cvtepi32_ps( _mm_cvtepu8_epi32( load4( P ) ) )
+#define LOAD4_USHORT( P ) \
+	_mm_cvtepi32_ps( _mm_cvtepu16_epi32( \
+		_mm_loadl_epi64( (__m128i *) (P) ) ) )
+#define LOAD4_SHORT( P ) \
+	_mm_cvtepi32_ps( _mm_cvtepi16_epi32( \
+		_mm_loadl_epi64( (__m128i *) (P) ) ) )
+#define LOAD4_FLOAT( P ) \
+	_mm_loadu_ps( (float *) (P) )
+
+#define LOAD8_UCHAR( P ) \
+	_mm256_cvtepi32_ps( _mm256_cvtepu8_epi32( \
+		_mm_loadl_epi64( (__m128i *) (P) ) ) )
+#define LOAD8_USHORT( P ) \
+	_mm256_cvtepi32_ps( _mm256_cvtepu16_epi32( \
+		_mm_loadu_si128( (__m128i *) (P) ) ) )
+#define LOAD8_SHORT( P ) \
+	_mm256_cvtepi32_ps( _mm256_cvtepi16_epi32( \
+		_mm_loadu_si128( (__m128i *) (P) ) ) )
+#define LOAD8_FLOAT( P ) \
+	_mm256_loadu_ps( (float *) (P) )
+
+#define LOAD16_UCHAR( P ) \
+	_mm512_cvtepi32_ps( _mm512_cvtepu8_epi32( \
+		_mm_loadu_si128( (__m128i *) (P) ) ) )
+#define LOAD16_USHORT( P ) \
+	_mm512_cvtepi32_ps( _mm512_cvtepu16_epi32( \
+		_mm256_loadu_si256( (__m256i *) (P) ) ) )
+#define LOAD16_SHORT( P ) \
+	_mm512_cvtepi32_ps( _mm512_cvtepi16_epi32( \
+		_mm256_loadu_si256( (__m256i *) (P) ) ) )
+#define LOAD16_FLOAT( P ) \
+	_mm512_loadu_ps( (float *) (P) )
+
+/* out = a * in + b, see LOOP1 in arithmetic/linear.c.
+ */
+#define LINEAR( NAME, ATTR, TYPE, N, VTYPE, LOAD, SET1, MUL, ADD, STORE ) \
+static void ATTR \
+NAME( float *out, const VipsPel *in, int n, float a, float b ) \
+{ \
+	const TYPE * restrict p = (TYPE *) in; \
+	const VTYPE va = SET1( a ); \
+	const VTYPE vb = SET1( b ); \
+	\
+	int x; \
+	\
+	for( x = 0; x + N <= n; x += N ) \
+		STORE( out + x, ADD( MUL( va, LOAD( p + x ) ), vb ) ); \
+	\
+	/* Do the tail with the vector ops too, the compiler would fuse a \
+	 * scalar a * x + b on targets with FMA. \
+	 */ \
+	if( x < n ) { \
+		TYPE t[N] = { 0 }; \
+		float o[N]; \
+		\
+		memcpy( t, p + x, (n - x) * sizeof( TYPE ) ); \
+		STORE( o, ADD( MUL( va, LOAD( t ) ), vb ) ); \
+		memcpy( out + x, o, (n - x) * sizeof( float ) ); \
+	} \
+}
+
+#define LINEAR_SSE41( NAME, TYPE, LOAD ) \
+	LINEAR( NAME, SSE41, TYPE, 4, __m128, LOAD, \
+		_mm_set1_ps, _mm_mul_ps, _mm_add_ps, _mm_storeu_ps )
+#define LINEAR_AVX2( NAME, TYPE, LOAD ) \
+	LINEAR( NAME, AVX2, TYPE, 8, __m256, LOAD, \
+		_mm256_set1_ps, _mm256_mul_ps, _mm256_add_ps, _mm256_storeu_ps )
+/* AVX-512 has FMA, and gcc will fuse a plain _mm512_mul_ps() with the add.
+ * The rounding variant is opaque to the optimiser.
+ */
+#define MUL512( A, B ) _mm512_mul_round_ps( A, B, _MM_FROUND_CUR_DIRECTION )
+
+#define LINEAR_AVX512( NAME, TYPE, LOAD ) \
+	LINEAR( NAME, AVX512, TYPE, 16, __m512, LOAD, \
+		_mm512_set1_ps, MUL512, _mm512_add_ps, _mm512_storeu_ps )
+
+LINEAR_SSE41( linear_uchar_sse41, unsigned char, LOAD4_UCHAR )
+LINEAR_SSE41( linear_ushort_sse41, unsigned short, LOAD4_USHORT )
+LINEAR_SSE41( linear_short_sse41, signed short, LOAD4_SHORT )
+LINEAR_SSE41( linear_float_sse41, float, LOAD4_FLOAT )
+
+LINEAR_AVX2( linear_uchar_avx2, unsigned char, LOAD8_UCHAR )
+LINEAR_AVX2( linear_ushort_avx2, unsigned short, LOAD8_USHORT )
+LINEAR_AVX2( linear_short_avx2, signed short, LOAD8_SHORT )
+LINEAR_AVX2( linear_float_avx2, float, LOAD8_FLOAT )
+
+LINEAR_AVX512( linear_uchar_avx512, unsigned char, LOAD16_UCHAR )
+LINEAR_AVX512( linear_ushort_avx512, unsigned short, LOAD16_USHORT )
+LINEAR_AVX512( linear_short_avx512, signed short, LOAD16_SHORT )
+LINEAR_AVX512( linear_float_avx512, float, LOAD16_FLOAT )
+
+/* Convert to float.
+ */
+#define CAST( NAME, ATTR, TYPE, N, LOAD, STORE ) \
+static void ATTR \
+NAME( float *out, const VipsPel *in, int n ) \
+{ \
+	const TYPE * restrict p = (TYPE *) in; \
+	\
+	int x; \
+	\
+	for( x = 0; x + N <= n; x += N ) \
+		STORE( out + x, LOAD( p + x ) ); \
+	for( ; x < n; x++ ) \
+		out[x] = p[x]; \
+}
+
+CAST( cast_uchar_sse41, SSE41, unsigned char, 4, LOAD4_UCHAR, _mm_storeu_ps )
+CAST( cast_ushort_sse41, SSE41, unsigned short, 4,
+	LOAD4_USHORT, _mm_storeu_ps )
+CAST( cast_short_sse41, SSE41, signed short, 4, LOAD4_SHORT, _mm_storeu_ps )
+
+CAST( cast_uchar_avx2, AVX2, unsigned char, 8,
+	LOAD8_UCHAR, _mm256_storeu_ps )
+CAST( cast_ushort_avx2, AVX2, unsigned short, 8,
+	LOAD8_USHORT, _mm256_storeu_ps )
+CAST( cast_short_avx2, AVX2, signed short, 8,
+	LOAD8_SHORT, _mm256_storeu_ps )
+
+CAST( cast_uchar_avx512, AVX512, unsigned char, 16,
+	LOAD16_UCHAR, _mm512_storeu_ps )
+CAST( cast_ushort_avx512, AVX512, unsigned short, 16,
+	LOAD16_USHORT, _mm512_storeu_ps )
+CAST( cast_short_avx512, AVX512, signed short, 16,
+	LOAD16_SHORT, _mm512_storeu_ps )
+
+/* Floor, count and clip four floats, see VIPS_CLIP_FLOAT_INT in
+ * conversion/cast.c.
+ */
+static inline __m128i SSE41
+clip4( const float *p, __m128 vmax, int *underflow, int *overflow )
+{
+	__m128 v = _mm_floor_ps( _mm_loadu_ps( p ) );
+
+	*underflow += __builtin_popcount(
+		_mm_movemask_ps( _mm_cmplt_ps( v, _mm_setzero_ps() ) ) );
+	*overflow += __builtin_popcount(
+		_mm_movemask_ps( _mm_cmpgt_ps( v, vmax ) ) );
+
+	v = _mm_min_ps( _mm_max_ps( v, _mm_setzero_ps() ), vmax );
+
+	return( _mm_cvttps_epi32( v ) );
+}
+
+static void SSE41
+clip_uchar_sse41( VipsPel *out, const float *in, int n,
+	int *underflow, int *overflow )
+{
+	const __m128 vmax = _mm_set1_ps( UCHAR_MAX );
+
+	int x;
+
+	for( x = 0; x + 8 <= n; x += 8 ) {
+		__m128i a = clip4( in + x, vmax, underflow, overflow );
+		__m128i b = clip4( in + x + 4, vmax, underflow, overflow );
+		__m128i s = _mm_packus_epi32( a, b );
+
+		_mm_storel_epi64( (__m128i *) (out + x),
+			_mm_packus_epi16( s, s ) );
+	}
+
+	for( ; x < n; x++ ) {
+		float v = VIPS_FLOOR( in[x] );
+
+		if( v < 0 ) {
+			*underflow += 1;
+			v = 0;
+		}
+		else if( v > UCHAR_MAX ) {
+			*overflow += 1;
+			v = UCHAR_MAX;
+		}
+
+		out[x] = v;
+	}
+}
+
+static void SSE41
+clip_ushort_sse41( VipsPel *out, const float *in, int n,
+	int *underflow, int *overflow )
+{
+	unsigned short * restrict q = (unsigned short *) out;
+	const __m128 vmax = _mm_set1_ps( USHRT_MAX );
+
+	int x;
+
+	for( x = 0; x + 8 <= n; x += 8 ) {
+		__m128i a = clip4( in + x, vmax, underflow, overflow );
+		__m128i b = clip4( in + x + 4, vmax, underflow, overflow );
+
+		_mm_storeu_si128( (__m128i *) (q + x),
+			_mm_packus_epi32( a, b ) );
+	}
+
+	for( ; x < n; x++ ) {
+		float v = VIPS_FLOOR( in[x] );
+
+		if( v < 0 ) {
+			*underflow += 1;
+			v = 0;
+		}
+		else if( v > USHRT_MAX ) {
+			*overflow += 1;
+			v = USHRT_MAX;
+		}
+
+		q[x] = v;
+	}
+}
+
+/* ushort to uchar by dropping the bottom eight bits, see VIPS_SHIFT_RIGHT in
+ * conversion/cast.c.
+ */
+static void SSE41
+shift_ushort_sse41( VipsPel *out, const VipsPel *in, int n )
+{
+	const unsigned short * restrict p = (unsigned short *) in;
+
+	int x;
+
+	for( x = 0; x + 16 <= n; x += 16 ) {
+		__m128i a = _mm_srli_epi16(
+			_mm_loadu_si128( (__m128i *) (p + x) ), 8 );
+		__m128i b = _mm_srli_epi16(
+			_mm_loadu_si128( (__m128i *) (p + x + 8) ), 8 );
+
+		_mm_storeu_si128( (__m128i *) (out + x),
+			_mm_packus_epi16( a, b ) );
+	}
+
+	for( ; x < n; x++ )
+		out[x] = p[x] >> 8;
+}
+
+static void AVX2
+shift_ushort_avx2( VipsPel *out, const VipsPel *in, int n )
+{
+	const unsigned short * restrict p = (unsigned short *) in;
+
+	int x;
+
+	for( x = 0; x + 32 <= n; x += 32 ) {
+		__m256i a = _mm256_srli_epi16(
+			_mm256_loadu_si256( (__m256i *) (p + x) ), 8 );
+		__m256i b = _mm256_srli_epi16(
+			_mm256_loadu_si256( (__m256i *) (p + x + 16) ), 8 );
+
+		/* packus works within lanes, so put the quads back in
+		 * order.
+		 */
+		_mm256_storeu_si256( (__m256i *) (out + x),
+			_mm256_permute4x64_epi64(
+				_mm256_packus_epi16( a, b ), 0xd8 ) );
+	}
+
+	shift_ushort_sse41( out + x, (VipsPel *) (p + x), n - x );
+}
+
+/* The alpha of four RGBA pixels.
+ */
+static inline __m128 SSE41
+alpha4( const __m128 *v )
+{
+	return( _mm_movehl_ps( _mm_unpackhi_ps( v[2], v[3] ),
+		_mm_unpackhi_ps( v[0], v[1] ) ) );
+}
+
+/* Alpha scaled to 0 - 1 for four pixels. The divide is in double, as
+ * premultiply.c does it.
+ */
+static inline __m128 SSE41
+nalpha4( __m128 clip, __m128d vmax )
+{
+	__m128d lo = _mm_div_pd( _mm_cvtps_pd( clip ), vmax );
+	__m128d hi = _mm_div_pd( _mm_cvtps_pd(
+		_mm_movehl_ps( clip, clip ) ), vmax );
+
+	return( _mm_movelh_ps( _mm_cvtpd_ps( lo ), _mm_cvtpd_ps( hi ) ) );
+}
+
+#define BCAST( V, K ) _mm_shuffle_ps( V, V, _MM_SHUFFLE( K, K, K, K ) )
+
+/* Premultiply pixel K of a group of four.
+ */
+#define PRE_PEL( K ) \
+	_mm_storeu_ps( out + 4 * (K), _mm_blend_ps( \
+		_mm_mul_ps( v[K], BCAST( n, K ) ), BCAST( a, K ), 8 ) )
+
+/* Premultiply 4-band pixels to float, see PRE_RGBA in
+ * conversion/premultiply.c. CAP is the largest alpha we allow, the clip in
+ * the C version truncates to the input type.
+ */
+#define PREMULTIPLY( NAME, IN, LOAD, CAP ) \
+static void SSE41 \
+NAME( float *out, const VipsPel *in, int width, double max_alpha ) \
+{ \
+	IN * restrict p = (IN *) in; \
+	const __m128d vmax = _mm_set1_pd( max_alpha ); \
+	const __m128 cap = _mm_set1_ps( CAP ); \
+	\
+	int x, i; \
+	\
+	for( x = 0; x + 4 <= width; x += 4 ) { \
+		__m128 v[4]; \
+		__m128 a, n; \
+		\
+		for( i = 0; i < 4; i++ ) \
+			v[i] = LOAD( p + 4 * i ); \
+		a = alpha4( v ); \
+		n = nalpha4( _mm_max_ps( _mm_min_ps( a, cap ), \
+			_mm_setzero_ps() ), vmax ); \
+		\
+		PRE_PEL( 0 ); \
+		PRE_PEL( 1 ); \
+		PRE_PEL( 2 ); \
+		PRE_PEL( 3 ); \
+		\
+		p += 16; \
+		out += 16; \
+	} \
+	\
+	for( ; x < width; x++ ) { \
+		IN alpha = p[3]; \
+		IN clip_alpha = VIPS_CLIP( 0, alpha, max_alpha ); \
+		float nalpha = (float) clip_alpha / max_alpha; \
+		\
+		out[0] = p[0] * nalpha; \
+		out[1] = p[1] * nalpha; \
+		out[2] = p[2] * nalpha; \
+		out[3] = alpha; \
+		\
+		p += 4; \
+		out += 4; \
+	} \
+}
+
+PREMULTIPLY( premultiply_uchar_sse41, unsigned char,
+	LOAD4_UCHAR, floor( max_alpha ) )
+PREMULTIPLY( premultiply_ushort_sse41, unsigned short,
+	LOAD4_USHORT, floor( max_alpha ) )
+PREMULTIPLY( premultiply_float_sse41, float,
+	LOAD4_FLOAT, max_alpha )
+
+/* Unpremultiply pixel K of a group of four. Zero alpha makes black.
+ */
+#define UNPRE_PEL( K ) \
+	_mm_storeu_ps( out + 4 * (K), _mm_blend_ps( _mm_andnot_ps( \
+		_mm_cmpeq_ps( BCAST( clip, K ), _mm_setzero_ps() ), \
+		_mm_div_ps( v[K], BCAST( n, K ) ) ), BCAST( clip, K ), 8 ) )
+
+/* Unpremultiply 4-band pixels to float, see UNPRE_RGBA in
+ * conversion/unpremultiply.c. One vector divide does all three bands.
+ */
+#define UNPREMULTIPLY( NAME, IN, LOAD, CAP ) \
+static void SSE41 \
+NAME( float *out, const VipsPel *in, int width, double max_alpha ) \
+{ \
+	IN * restrict p = (IN *) in; \
+	const __m128d vmax = _mm_set1_pd( max_alpha ); \
+	const __m128 cap = _mm_set1_ps( CAP ); \
+	\
+	int x, i; \
+	\
+	for( x = 0; x + 4 <= width; x += 4 ) { \
+		__m128 v[4]; \
+		__m128 clip, n; \
+		\
+		for( i = 0; i < 4; i++ ) \
+			v[i] = LOAD( p + 4 * i ); \
+		clip = _mm_max_ps( _mm_min_ps( alpha4( v ), cap ), \
+			_mm_setzero_ps() ); \
+		n = nalpha4( clip, vmax ); \
+		\
+		UNPRE_PEL( 0 ); \
+		UNPRE_PEL( 1 ); \
+		UNPRE_PEL( 2 ); \
+		UNPRE_PEL( 3 ); \
+		\
+		p += 16; \
+		out += 16; \
+	} \
+	\
+	for( ; x < width; x++ ) { \
+		IN alpha = p[3]; \
+		IN clip_alpha = VIPS_CLIP( 0, alpha, max_alpha ); \
+		float nalpha = (float) clip_alpha / max_alpha; \
+		\
+		if( clip_alpha == 0 ) { \
+			out[0] = 0; \
+			out[1] = 0; \
+			out[2] = 0; \
+		} \
+		else { \
+			out[0] = p[0] / nalpha; \
+			out[1] = p[1] / nalpha; \
+			out[2] = p[2] / nalpha; \
+		} \
+		out[3] = clip_alpha; \
+		\
+		p += 4; \
+		out += 4; \
+	} \
+}
+
+UNPREMULTIPLY( unpremultiply_uchar_sse41, unsigned char,
+	LOAD4_UCHAR, floor( max_alpha ) )
+UNPREMULTIPLY( unpremultiply_ushort_sse41, unsigned short,
+	LOAD4_USHORT, floor( max_alpha ) )
+UNPREMULTIPLY( unpremultiply_float_sse41, float,
+	LOAD4_FLOAT, max_alpha )
+
+/* Flatten four RGBA uchar pixels with alpha 0 - 255, see VIPS_FLATTEN in
+ * conversion/flatten.c. Everything fits in 16 bits, and the divide by 255
+ * is a multiply-high and a shift.
+ */
+static void SSE41
+flatten_uchar_sse41( VipsPel *out, const VipsPel *in, int width,
+	const VipsPel *ink )
+{
+	const __m128i aidx = _mm_setr_epi8(
+		6, 7, 6, 7, 6, 7, 6, 7, 14, 15, 14, 15, 14, 15, 14, 15 );
+	const __m128i pack = _mm_setr_epi8(
+		0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1 );
+	const __m128i max = _mm_set1_epi16( UCHAR_MAX );
+	const __m128i recip = _mm_set1_epi16( (short) 0x8081 );
+	const __m128i bg = ink ?
+		_mm_setr_epi16( ink[0], ink[1], ink[2], 0,
+			ink[0], ink[1], ink[2], 0 ) :
+		_mm_setzero_si128();
+
+	int x;
+
+	for( x = 0; x + 4 <= width; x += 4 ) {
+		__m128i v = _mm_loadu_si128( (__m128i *) in );
+		__m128i half[2];
+		__m128i a, t;
+		int i;
+
+		half[0] = _mm_cvtepu8_epi16( v );
+		half[1] = _mm_cvtepu8_epi16( _mm_srli_si128( v, 8 ) );
+
+		for( i = 0; i < 2; i++ ) {
+			a = _mm_shuffle_epi8( half[i], aidx );
+			t = _mm_add_epi16( _mm_mullo_epi16( half[i], a ),
+				_mm_mullo_epi16( bg,
+					_mm_sub_epi16( max, a ) ) );
+			half[i] = _mm_srli_epi16( _mm_mulhi_epu16( t, recip ),
+				7 );
+		}
+
+		v = _mm_shuffle_epi8( _mm_packus_epi16( half[0], half[1] ),
+			pack );
+		_mm_storel_epi64( (__m128i *) out, v );
+		store4( out + 8, _mm_srli_si128( v, 8 ) );
+
+		in += 16;
+		out += 12;
+	}
+
+	for( ; x < width; x++ ) {
+		int alpha = in[3];
+		int b;
+
+		for( b = 0; b < 3; b++ )
+			out[b] = (in[b] * alpha +
+				(ink ? ink[b] : 0) * (UCHAR_MAX - alpha)) /
+				UCHAR_MAX;
+
+		in += 4;
+		out += 3;
+	}
+}
+
+/* Flatten two RGBA ushort pixels with alpha 0 - 65535. The sums fit in
+ * 32 bits, and x / 65535 is (x + (x >> 16) + 1) >> 16 over that range.
+ */
+static void SSE41
+flatten_ushort_sse41( VipsPel *out, const VipsPel *in, int width,
+	const VipsPel *ink )
+{
+	unsigned short * restrict p = (unsigned short *) in;
+	unsigned short * restrict q = (unsigned short *) out;
+	unsigned short * restrict bg16 = (unsigned short *) ink;
+	const __m128i pack = _mm_setr_epi8(
+		0, 1, 2, 3, 4, 5, 8, 9, 10, 11, 12, 13, -1, -1, -1, -1 );
+	const __m128i max = _mm_set1_epi32( USHRT_MAX );
+	const __m128i one = _mm_set1_epi32( 1 );
+	const __m128i bg = ink ?
+		_mm_setr_epi32( bg16[0], bg16[1], bg16[2], 0 ) :
+		_mm_setzero_si128();
+
+	int x;
+
+	for( x = 0; x + 2 <= width; x += 2 ) {
+		__m128i v = _mm_loadu_si128( (__m128i *) p );
+		__m128i pel[2];
+		__m128i a, t;
+		int i;
+
+		pel[0] = _mm_cvtepu16_epi32( v );
+		pel[1] = _mm_cvtepu16_epi32( _mm_srli_si128( v, 8 ) );
+
+		for( i = 0; i < 2; i++ ) {
+			a = _mm_shuffle_epi32( pel[i],
+				_MM_SHUFFLE( 3, 3, 3, 3 ) );
+			t = _mm_add_epi32( _mm_mullo_epi32( pel[i], a ),
+				_mm_mullo_epi32( bg,
+					_mm_sub_epi32( max, a ) ) );
+			t = _mm_add_epi32( _mm_add_epi32( t,
+				_mm_srli_epi32( t, 16 ) ), one );
+			pel[i] = _mm_srli_epi32( t, 16 );
+		}
+
+		v = _mm_shuffle_epi8( _mm_packus_epi32( pel[0], pel[1] ),
+			pack );
+		_mm_storel_epi64( (__m128i *) q, v );
+		store4( (VipsPel *) (q + 4), _mm_srli_si128( v, 8 ) );
+
+		p += 8;
+		q += 6;
+	}
+
+	for( ; x < width; x++ ) {
+		unsigned int alpha = p[3];
+		int b;
+
+		for( b = 0; b < 3; b++ )
+			q[b] = ((double) p[b] * alpha +
+				(double) (ink ? bg16[b] : 0) *
+					(USHRT_MAX - alpha)) / USHRT_MAX;
+
+		p += 4;
+		q += 3;
+	}
+}
+
+/* Load and save a 3- or 4-band uchar pixel. We never touch memory past the
+ * end of a 3-band pixel, and the fourth lane is ignored.
+ */
+static inline __m128i
+load_pel_uchar( const VipsPel *p, int bands )
+{
+	if( bands == 4 )
+		return( load4( p ) );
+	else
+		return( _mm_cvtsi32_si128(
+			p[0] | (p[1] << 8) | (p[2] << 16) ) );
+}
+
+static inline void
+store_pel_uchar( VipsPel *q, __m128i v, int bands )
+{
+	int i = _mm_cvtsi128_si32( v );
+
+	memcpy( q, &i, bands );
+}
+
+/* Interleave the bytes of pixels a and b and widen, so one madd against a
+ * pair of coefficients gives ca * a + cb * b for each band.
+ */
+#define REDUCEH_PAIR_UCHAR( A, B ) \
+	_mm_cvtepu8_epi16( _mm_unpacklo_epi8( A, B ) )
+#define REDUCEH_COEFF_UCHAR( CA, CB ) \
+	((int) ((unsigned short) (CA)) | ((int) (CB) << 16))
+
+/* The fixed-point sum for one uchar output pixel, see
+ * reduceh_unsigned_int_tab() in resample/reduceh.cpp. Taps go in pairs, with
+ * a zero coefficient against an odd last tap.
+ */
+static inline __m128i SSE41
+reduceh_uchar_sum_sse41( const VipsPel *p, int bands,
+	const short *c, int n_point )
+{
+	__m128i sum;
+	int i;
+
+	sum = _mm_setzero_si128();
+	for( i = 0; i + 2 <= n_point; i += 2 ) {
+		__m128i v = REDUCEH_PAIR_UCHAR(
+			load_pel_uchar( p + i * bands, bands ),
+			load_pel_uchar( p + (i + 1) * bands, bands ) );
+		__m128i cc = _mm_set1_epi32(
+			REDUCEH_COEFF_UCHAR( c[i], c[i + 1] ) );
+
+		sum = _mm_add_epi32( sum, _mm_madd_epi16( v, cc ) );
+	}
+	if( i < n_point ) {
+		__m128i v = REDUCEH_PAIR_UCHAR(
+			load_pel_uchar( p + i * bands, bands ),
+			_mm_setzero_si128() );
+		__m128i cc = _mm_set1_epi32( REDUCEH_COEFF_UCHAR( c[i], 0 ) );
+
+		sum = _mm_add_epi32( sum, _mm_madd_epi16( v, cc ) );
+	}
+
+	return( _mm_srai_epi32(
+		_mm_add_epi32( sum, _mm_set1_epi32( ROUND_BY ) ),
+		VIPS_INTERPOLATE_SHIFT ) );
+}
+
+static void SSE41
+reduceh_uchar_sse41( VipsPel *out, const VipsPel *in,
+	int width, int bands, const int *start, const int *phase,
+	const void *coeff, int n_point )
+{
+	const short *c = (short *) coeff;
+
+	int x;
+
+	for( x = 0; x < width; x++ ) {
+		__m128i sum = reduceh_uchar_sum_sse41( in + start[x] * bands,
+			bands, c + phase[x] * n_point, n_point );
+
+		sum = _mm_packus_epi32( sum, sum );
+		store_pel_uchar( out + x * bands,
+			_mm_packus_epi16( sum, sum ), bands );
+	}
+}
+
+/* Two output pixels at once, one in each 128-bit lane.
+ */
+static void AVX2
+reduceh_uchar_avx2( VipsPel *out, const VipsPel *in,
+	int width, int bands, const int *start, const int *phase,
+	const void *coeff, int n_point )
+{
+	const short *c = (short *) coeff;
+
+	int x;
+
+	for( x = 0; x + 2 <= width; x += 2 ) {
+		const VipsPel *pa = in + start[x] * bands;
+		const VipsPel *pb = in + start[x + 1] * bands;
+		const short *ca = c + phase[x] * n_point;
+		const short *cb = c + phase[x + 1] * n_point;
+		VipsPel *q = out + x * bands;
+
+		__m256i sum;
+		__m128i lo, hi, s;
+		int i;
+
+		sum = _mm256_setzero_si256();
+		for( i = 0; i < n_point; i += 2 ) {
+			/* A zero coefficient and pixel for the odd last tap.
+			 */
+			const int odd = i + 1 == n_point;
+			__m128i a1 = odd ? _mm_setzero_si128() :
+				load_pel_uchar( pa + (i + 1) * bands, bands );
+			__m128i b1 = odd ? _mm_setzero_si128() :
+				load_pel_uchar( pb + (i + 1) * bands, bands );
+			__m128i va = REDUCEH_PAIR_UCHAR(
+				load_pel_uchar( pa + i * bands, bands ), a1 );
+			__m128i vb = REDUCEH_PAIR_UCHAR(
+				load_pel_uchar( pb + i * bands, bands ), b1 );
+			__m128i cca = _mm_set1_epi32( REDUCEH_COEFF_UCHAR(
+				ca[i], odd ? 0 : ca[i + 1] ) );
+			__m128i ccb = _mm_set1_epi32( REDUCEH_COEFF_UCHAR(
+				cb[i], odd ? 0 : cb[i + 1] ) );
+
+			sum = _mm256_add_epi32( sum, _mm256_madd_epi16(
+				_mm256_inserti128_si256(
+					_mm256_castsi128_si256( va ), vb, 1 ),
+				_mm256_inserti128_si256(
+					_mm256_castsi128_si256( cca ),
+					ccb, 1 ) ) );
+		}
+
+		sum = _mm256_srai_epi32(
+			_mm256_add_epi32( sum, _mm256_set1_epi32( ROUND_BY ) ),
+			VIPS_INTERPOLATE_SHIFT );
+		lo = _mm256_castsi256_si128( sum );
+		hi = _mm256_extracti128_si256( sum, 1 );
+		s = _mm_packus_epi32( lo, hi );
+		s = _mm_packus_epi16( s, s );
+
+		store_pel_uchar( q, s, bands );
+		store_pel_uchar( q + bands, _mm_srli_si128( s, 4 ), bands );
+	}
+
+	if( x < width )
+		reduceh_uchar_sse41( out + x * bands, in,
+			1, bands, start + x, phase + x, coeff, n_point );
+}
+
+/* ushort uses a 32-bit multiply, see reduceh_unsigned_int_tab().
+ */
+static inline __m128i
+load_pel_ushort( const VipsPel *p, int bands )
+{
+	if( bands == 4 )
+		return( _mm_loadl_epi64( (__m128i *) p ) );
+	else {
+		unsigned short v[4] = { 0 };
+
+		memcpy( v, p, 3 * sizeof( unsigned short ) );
+
+		return( _mm_loadl_epi64( (__m128i *) v ) );
+	}
+}
+
+static void SSE41
+reduceh_ushort_sse41( VipsPel *out, const VipsPel *in,
+	int width, int bands, const int *start, const int *phase,
+	const void *coeff, int n_point )
+{
+	const int ps = bands * sizeof( unsigned short );
+	const int *c = (int *) coeff;
+
+	int x;
+
+	for( x = 0; x < width; x++ ) {
+		const VipsPel *p = in + start[x] * ps;
+		const int *cx = c + phase[x] * n_point;
+
+		__m128i sum;
+		unsigned short v[8];
+		int i;
+
+		sum = _mm_setzero_si128();
+		for( i = 0; i < n_point; i++ )
+			sum = _mm_add_epi32( sum, _mm_mullo_epi32(
+				_mm_cvtepu16_epi32(
+					load_pel_ushort( p + i * ps, bands ) ),
+				_mm_set1_epi32( cx[i] ) ) );
+
+		sum = _mm_srai_epi32(
+			_mm_add_epi32( sum, _mm_set1_epi32( ROUND_BY ) ),
+			VIPS_INTERPOLATE_SHIFT );
+		_mm_storeu_si128( (__m128i *) v, _mm_packus_epi32( sum, sum ) );
+		memcpy( out + x * ps, v, ps );
+	}
+}
+
+/* float sums in double, see reduceh_float_tab().
+ */
+static inline __m128
+load_pel_float( const VipsPel *p, int bands )
+{
+	const float *f = (float *) p;
+
+	if( bands == 4 )
+		return( _mm_loadu_ps( f ) );
+	else
+		return( _mm_setr_ps( f[0], f[1], f[2], 0.0 ) );
+}
+
+static inline void
+store_pel_float( VipsPel *q, __m128 v, int bands )
+{
+	float f[4];
+
+	_mm_storeu_ps( f, v );
+	memcpy( q, f, bands * sizeof( float ) );
+}
+
+static void SSE41
+reduceh_float_sse41( VipsPel *out, const VipsPel *in,
+	int width, int bands, const int *start, const int *phase,
+	const void *coeff, int n_point )
+{
+	const int ps = bands * sizeof( float );
+	const double *c = (double *) coeff;
+
+	int x;
+
+	for( x = 0; x < width; x++ ) {
+		const VipsPel *p = in + start[x] * ps;
+		const double *cx = c + phase[x] * n_point;
+
+		__m128d lo, hi;
+		int i;
+
+		lo = _mm_setzero_pd();
+		hi = _mm_setzero_pd();
+		for( i = 0; i < n_point; i++ ) {
+			__m128 v = load_pel_float( p + i * ps, bands );
+			__m128d cc = _mm_set1_pd( cx[i] );
+
+			lo = _mm_add_pd( lo,
+				_mm_mul_pd( cc, _mm_cvtps_pd( v ) ) );
+			hi = _mm_add_pd( hi, _mm_mul_pd( cc,
+				_mm_cvtps_pd( _mm_movehl_ps( v, v ) ) ) );
+		}
+
+		store_pel_float( out + x * ps,
+			_mm_movelh_ps( _mm_cvtpd_ps( lo ), _mm_cvtpd_ps( hi ) ),
+			bands );
+	}
+}
+
+static void AVX2
+reduceh_float_avx2( VipsPel *out, const VipsPel *in,
+	int width, int bands, const int *start, const int *phase,
+	const void *coeff, int n_point )
+{
+	const int ps = bands * sizeof( float );
+	const double *c = (double *) coeff;
+
+	int x;
+
+	for( x = 0; x < width; x++ ) {
+		const VipsPel *p = in + start[x] * ps;
+		const double *cx = c + phase[x] * n_point;
+
+		__m256d sum;
+		int i;
+
+		sum = _mm256_setzero_pd();
+		for( i = 0; i < n_point; i++ ) {
+			__m128 v = load_pel_float( p + i * ps, bands );
+
+			sum = _mm256_add_pd( sum,
+				_mm256_mul_pd( _mm256_set1_pd( cx[i] ),
+					_mm256_cvtps_pd( v ) ) );
+		}
+
+		store_pel_float( out + x * ps, _mm256_cvtpd_ps( sum ), bands );
+	}
+}
+
+/* ne elements from n_point lines, see reducev_unsigned_int_tab() in
+ * resample/reducev.cpp.
+ */
+#define REDUCEV_SUM( R, VTYPE, LOAD, SET1, MUL, ADD, SRAI ) { \
+	VTYPE sum; \
+	int i; \
+	\
+	sum = SET1( 0 ); \
+	for( i = 0; i < n_point; i++ ) \
+		sum = ADD( sum, MUL( LOAD( p + i * l1 ), SET1( cy[i] ) ) ); \
+	\
+	R = SRAI( ADD( sum, SET1( ROUND_BY ) ), VIPS_INTERPOLATE_SHIFT ); \
+}
+
+#define REDUCEV( TYPE, MAX ) { \
+	const TYPE * restrict p = (TYPE *) in; \
+	TYPE * restrict q = (TYPE *) out; \
+	const int l1 = lskip / sizeof( TYPE ); \
+	\
+	for( ; z < ne; z++ ) { \
+		int sum; \
+		int i; \
+		\
+		sum = 0; \
+		for( i = 0; i < n_point; i++ ) \
+			sum += cy[i] * p[z + i * l1]; \
+		sum = (sum + ROUND_BY) >> VIPS_INTERPOLATE_SHIFT; \
+		\
+		q[z] = VIPS_CLIP( 0, sum, MAX ); \
+	} \
+}
+
+#define LOAD4I_UCHAR( P ) _mm_cvtepu8_epi32( load4( (VipsPel *) (P) ) )
+#define LOAD4I_USHORT( P ) \
+	_mm_cvtepu16_epi32( _mm_loadl_epi64( (__m128i *) (P) ) )
+#define LOAD8I_UCHAR( P ) \
+	_mm256_cvtepu8_epi32( _mm_loadl_epi64( (__m128i *) (P) ) )
+#define LOAD8I_USHORT( P ) \
+	_mm256_cvtepu16_epi32( _mm_loadu_si128( (__m128i *) (P) ) )
+
+#define REDUCEV_SSE41( LOAD, R ) \
+	REDUCEV_SUM( R, __m128i, LOAD, _mm_set1_epi32, \
+		_mm_mullo_epi32, _mm_add_epi32, _mm_srai_epi32 )
+#define REDUCEV_AVX2( LOAD, R ) \
+	REDUCEV_SUM( R, __m256i, LOAD, _mm256_set1_epi32, \
+		_mm256_mullo_epi32, _mm256_add_epi32, _mm256_srai_epi32 )
+
+static void SSE41
+reducev_uchar_sse41( VipsPel *out, const VipsPel *in,
+	int ne, int lskip, const int *cy, int n_point )
+{
+	const int l1 = lskip;
+
+	int z;
+
+	for( z = 0; z + 8 <= ne; z += 8 ) {
+		const VipsPel *p = in + z;
+
+		__m128i a, b, s;
+
+		REDUCEV_SSE41( LOAD4I_UCHAR, a );
+		p += 4;
+		REDUCEV_SSE41( LOAD4I_UCHAR, b );
+
+		s = _mm_packus_epi32( a, b );
+		_mm_storel_epi64( (__m128i *) (out + z),
+			_mm_packus_epi16( s, s ) );
+	}
+
+	REDUCEV( unsigned char, UCHAR_MAX );
+}
+
+static void SSE41
+reducev_ushort_sse41( VipsPel *out, const VipsPel *in,
+	int ne, int lskip, const int *cy, int n_point )
+{
+	const int l1 = lskip / sizeof( unsigned short );
+
+	int z;
+
+	for( z = 0; z + 8 <= ne; z += 8 ) {
+		const unsigned short *p = (unsigned short *) in + z;
+
+		__m128i a, b;
+
+		REDUCEV_SSE41( LOAD4I_USHORT, a );
+		p += 4;
+		REDUCEV_SSE41( LOAD4I_USHORT, b );
+
+		_mm_storeu_si128( (__m128i *) ((unsigned short *) out + z),
+			_mm_packus_epi32( a, b ) );
+	}
+
+	REDUCEV( unsigned short, USHRT_MAX );
+}
+
+static void AVX2
+reducev_uchar_avx2( VipsPel *out, const VipsPel *in,
+	int ne, int lskip, const int *cy, int n_point )
+{
+	const int l1 = lskip;
+
+	int z;
+
+	for( z = 0; z + 16 <= ne; z += 16 ) {
+		const VipsPel *p = in + z;
+
+		__m256i a, b, s;
+
+		REDUCEV_AVX2( LOAD8I_UCHAR, a );
+		p += 8;
+		REDUCEV_AVX2( LOAD8I_UCHAR, b );
+
+		/* The 256-bit packs work within 128-bit lanes, so we must
+		 * put the elements back in order.
+		 */
+		s = _mm256_permute4x64_epi64( _mm256_packus_epi32( a, b ),
+			_MM_SHUFFLE( 3, 1, 2, 0 ) );
+		_mm_storeu_si128( (__m128i *) (out + z),
+			_mm_packus_epi16( _mm256_castsi256_si128( s ),
+				_mm256_extracti128_si256( s, 1 ) ) );
+	}
+
+	REDUCEV( unsigned char, UCHAR_MAX );
+}
+
+static void AVX2
+reducev_ushort_avx2( VipsPel *out, const VipsPel *in,
+	int ne, int lskip, const int *cy, int n_point )
+{
+	const int l1 = lskip / sizeof( unsigned short );
+
+	int z;
+
+	for( z = 0; z + 16 <= ne; z += 16 ) {
+		const unsigned short *p = (unsigned short *) in + z;
+
+		__m256i a, b, s;
+
+		REDUCEV_AVX2( LOAD8I_USHORT, a );
+		p += 8;
+		REDUCEV_AVX2( LOAD8I_USHORT, b );
+
+		s = _mm256_permute4x64_epi64( _mm256_packus_epi32( a, b ),
+			_MM_SHUFFLE( 3, 1, 2, 0 ) );
+		_mm256_storeu_si256( (__m256i *) ((unsigned short *) out + z),
+			s );
+	}
+
+	REDUCEV( unsigned short, USHRT_MAX );
+}
+
+/* ne float elements from n_point taps stride bytes apart, see
+ * vips_convsep_convh_uchar() in convolution/convsep.c.
+ */
+#define CONVH_INT( TYPE, CTYPE ) { \
+	const TYPE * restrict p = (TYPE *) in; \
+	const CTYPE * restrict c = (CTYPE *) coeff; \
+	const int s = stride / sizeof( TYPE ); \
+	\
+	for( ; z < ne; z++ ) { \
+		int sum; \
+		int i; \
+		\
+		sum = 0; \
+		for( i = 0; i < n_point; i++ ) \
+			sum += c[i] * p[z + i * s]; \
+		\
+		out[z] = sum; \
+	} \
+}
+
+#define CONV_FLOAT( OFFSET ) { \
+	const float * restrict p = (float *) in; \
+	const int s = stride / sizeof( float ); \
+	\
+	for( ; z < ne; z++ ) { \
+		float sum; \
+		int i; \
+		\
+		sum = 0; \
+		for( i = 0; i < n_point; i++ ) \
+			sum += c[i] * p[z + i * s]; \
+		\
+		out[z] = sum + OFFSET; \
+	} \
+}
+
+/* Two taps at a time with madd: interleave the two input lines, and pack the
+ * two coefficients into each 32-bit lane.
+ */
+#define CONVH_PAIR( I ) \
+	((unsigned short) c[I] | \
+	 ((I) + 1 < n_point ? (unsigned int) (unsigned short) c[(I) + 1] : 0) \
+		<< 16)
+
+static void SSE41
+convh_uchar_sse41( float *out, const VipsPel *in,
+	int ne, int stride, const void *coeff, int n_point )
+{
+	const short *c = (short *) coeff;
+
+	int z;
+
+	for( z = 0; z + 8 <= ne; z += 8 ) {
+		__m128i lo, hi;
+		int i;
+
+		lo = _mm_setzero_si128();
+		hi = _mm_setzero_si128();
+		for( i = 0; i < n_point; i += 2 ) {
+			const VipsPel *p = in + z + i * stride;
+			const __m128i cc = _mm_set1_epi32( CONVH_PAIR( i ) );
+
+			__m128i a, b;
+
+			a = _mm_cvtepu8_epi16(
+				_mm_loadl_epi64( (__m128i *) p ) );
+			b = i + 1 < n_point ?
+				_mm_cvtepu8_epi16( _mm_loadl_epi64(
+					(__m128i *) (p + stride) ) ) :
+				a;
+			lo = _mm_add_epi32( lo, _mm_madd_epi16(
+				_mm_unpacklo_epi16( a, b ), cc ) );
+			hi = _mm_add_epi32( hi, _mm_madd_epi16(
+				_mm_unpackhi_epi16( a, b ), cc ) );
+		}
+
+		_mm_storeu_ps( out + z, _mm_cvtepi32_ps( lo ) );
+		_mm_storeu_ps( out + z + 4, _mm_cvtepi32_ps( hi ) );
+	}
+
+	CONVH_INT( unsigned char, short );
+}
+
+static void SSE41
+convh_ushort_sse41( float *out, const VipsPel *in,
+	int ne, int stride, const void *coeff, int n_point )
+{
+	const int *c = (int *) coeff;
+	const int s = stride / sizeof( unsigned short );
+
+	int z;
+
+	for( z = 0; z + 8 <= ne; z += 8 ) {
+		const unsigned short *p = (unsigned short *) in + z;
+
+		__m128i lo, hi;
+		int i;
+
+		lo = _mm_setzero_si128();
+		hi = _mm_setzero_si128();
+		for( i = 0; i < n_point; i++ ) {
+			const __m128i cc = _mm_set1_epi32( c[i] );
+
+			lo = _mm_add_epi32( lo, _mm_mullo_epi32(
+				LOAD4I_USHORT( p + i * s ), cc ) );
+			hi = _mm_add_epi32( hi, _mm_mullo_epi32(
+				LOAD4I_USHORT( p + i * s + 4 ), cc ) );
+		}
+
+		_mm_storeu_ps( out + z, _mm_cvtepi32_ps( lo ) );
+		_mm_storeu_ps( out + z + 4, _mm_cvtepi32_ps( hi ) );
+	}
+
+	CONVH_INT( unsigned short, int );
+}
+
+#define CONV_FLOAT_SSE41( OFFSET ) { \
+	for( z = 0; z + 4 <= ne; z += 4 ) { \
+		__m128 sum; \
+		int i; \
+		\
+		sum = _mm_setzero_ps(); \
+		for( i = 0; i < n_point; i++ ) \
+			sum = _mm_add_ps( sum, \
+				_mm_mul_ps( _mm_set1_ps( c[i] ), _mm_loadu_ps( \
+					(float *) (in + i * stride) + z ) ) ); \
+		\
+		_mm_storeu_ps( out + z, \
+			_mm_add_ps( sum, _mm_set1_ps( OFFSET ) ) ); \
+	} \
+	\
+	CONV_FLOAT( OFFSET ); \
+}
+
+static void SSE41
+convh_float_sse41( float *out, const VipsPel *in,
+	int ne, int stride, const void *coeff, int n_point )
+{
+	const float *c = (float *) coeff;
+
+	int z;
+
+	CONV_FLOAT_SSE41( 0 );
+}
+
+static void SSE41
+convv_float_sse41( float *out, const float *fin,
+	int ne, int stride, const float *c, int n_point, float offset )
+{
+	const VipsPel *in = (VipsPel *) fin;
+
+	int z;
+
+	CONV_FLOAT_SSE41( offset );
+}
+
+static void AVX2
+convh_uchar_avx2( float *out, const VipsPel *in,
+	int ne, int stride, const void *coeff, int n_point )
+{
+	const short *c = (short *) coeff;
+
+	int z;
+
+	for( z = 0; z + 16 <= ne; z += 16 ) {
+		__m256i lo, hi;
+		int i;
+
+		lo = _mm256_setzero_si256();
+		hi = _mm256_setzero_si256();
+		for( i = 0; i < n_point; i += 2 ) {
+			const VipsPel *p = in + z + i * stride;
+			const __m256i cc = _mm256_set1_epi32( CONVH_PAIR( i ) );
+
+			__m256i a, b;
+
+			a = _mm256_cvtepu8_epi16(
+				_mm_loadu_si128( (__m128i *) p ) );
+			b = i + 1 < n_point ?
+				_mm256_cvtepu8_epi16( _mm_loadu_si128(
+					(__m128i *) (p + stride) ) ) :
+				a;
+			lo = _mm256_add_epi32( lo, _mm256_madd_epi16(
+				_mm256_unpacklo_epi16( a, b ), cc ) );
+			hi = _mm256_add_epi32( hi, _mm256_madd_epi16(
+				_mm256_unpackhi_epi16( a, b ), cc ) );
+		}
+
+		/* The unpacks work within 128-bit lanes, so lo has elements
+		 * 0 - 3 and 8 - 11.
+		 */
+		_mm256_storeu_ps( out + z, _mm256_cvtepi32_ps(
+			_mm256_permute2x128_si256( lo, hi, 0x20 ) ) );
+		_mm256_storeu_ps( out + z + 8, _mm256_cvtepi32_ps(
+			_mm256_permute2x128_si256( lo, hi, 0x31 ) ) );
+	}
+
+	CONVH_INT( unsigned char, short );
+}
+
+static void AVX2
+convh_ushort_avx2( float *out, const VipsPel *in,
+	int ne, int stride, const void *coeff, int n_point )
+{
+	const int *c = (int *) coeff;
+	const int s = stride / sizeof( unsigned short );
+
+	int z;
+
+	for( z = 0; z + 8 <= ne; z += 8 ) {
+		const unsigned short *p = (unsigned short *) in + z;
+
+		__m256i sum;
+		int i;
+
+		sum = _mm256_setzero_si256();
+		for( i = 0; i < n_point; i++ )
+			sum = _mm256_add_epi32( sum, _mm256_mullo_epi32(
+				LOAD8I_USHORT( p + i * s ),
+				_mm256_set1_epi32( c[i] ) ) );
+
+		_mm256_storeu_ps( out + z, _mm256_cvtepi32_ps( sum ) );
+	}
+
+	CONVH_INT( unsigned short, int );
+}
+
+#define CONV_FLOAT_AVX2( OFFSET ) { \
+	for( z = 0; z + 8 <= ne; z += 8 ) { \
+		__m256 sum; \
+		int i; \
+		\
+		sum = _mm256_setzero_ps(); \
+		for( i = 0; i < n_point; i++ ) \
+			sum = _mm256_add_ps( sum, \
+				_mm256_mul_ps( _mm256_set1_ps( c[i] ), \
+					_mm256_loadu_ps( (float *) \
+						(in + i * stride) + z ) ) ); \
+		\
+		_mm256_storeu_ps( out + z, \
+			_mm256_add_ps( sum, _mm256_set1_ps( OFFSET ) ) ); \
+	} \
+	\
+	CONV_FLOAT( OFFSET ); \
+}
+
+static void AVX2
+convh_float_avx2( float *out, const VipsPel *in,
+	int ne, int stride, const void *coeff, int n_point )
+{
+	const float *c = (float *) coeff;
+
+	int z;
+
+	CONV_FLOAT_AVX2( 0 );
+}
+
+static void AVX2
+convv_float_avx2( float *out, const float *fin,
+	int ne, int stride, const float *c, int n_point, float offset )
+{
+	const VipsPel *in = (VipsPel *) fin;
+
+	int z;
+
+	CONV_FLOAT_AVX2( offset );
+}
+
+/* Average groups of hshrink 4-band uchar pixels, see ISHRINK in
+ * resample/shrinkh.c.
+ *
+ * We need (sum + hshrink / 2) / hshrink, and there's no integer divide, so
+ * we use float. This is exact as long as sum fits in the mantissa, so huge
+ * shrinks take the C path.
+ */
+static void SSE41
+shrinkh_uchar_sse41( VipsPel *out, const VipsPel *in, int width, int hshrink )
+{
+	const __m128i round = _mm_set1_epi32( hshrink / 2 );
+	const __m128 div = _mm_set1_ps( hshrink );
+
+	int x, i, b;
+
+	/* (sum + 1) / 2 is just pavgb. Split four pairs of pixels into even
+	 * and odd and average them.
+	 */
+	if( hshrink == 2 ) {
+		for( x = 0; x + 4 <= width; x += 4 ) {
+			__m128 a = _mm_castsi128_ps(
+				_mm_loadu_si128( (__m128i *) in ) );
+			__m128 c = _mm_castsi128_ps(
+				_mm_loadu_si128( (__m128i *) (in + 16) ) );
+			__m128i even = _mm_castps_si128( _mm_shuffle_ps( a, c,
+				_MM_SHUFFLE( 2, 0, 2, 0 ) ) );
+			__m128i odd = _mm_castps_si128( _mm_shuffle_ps( a, c,
+				_MM_SHUFFLE( 3, 1, 3, 1 ) ) );
+
+			_mm_storeu_si128( (__m128i *) out,
+				_mm_avg_epu8( even, odd ) );
+
+			in += 32;
+			out += 16;
+		}
+		for( ; x < width; x++ ) {
+			for( b = 0; b < 4; b++ )
+				out[b] = (in[b] + in[b + 4] + 1) >> 1;
+
+			in += 8;
+			out += 4;
+		}
+
+		return;
+	}
+
+	if( hshrink > 4096 ) {
+		for( x = 0; x < width; x++ )
+			for( b = 0; b < 4; b++ ) {
+				int sum;
+
+				sum = 0;
+				for( i = 0; i < hshrink; i++ )
+					sum += in[x * hshrink * 4 + i * 4 + b];
+
+				out[x * 4 + b] = (sum + hshrink / 2) / hshrink;
+			}
+
+		return;
+	}
+
+	for( x = 0; x < width; x++ ) {
+		__m128i sum;
+
+		sum = _mm_setzero_si128();
+		for( i = 0; i < hshrink; i++ )
+			sum = _mm_add_epi32( sum,
+				_mm_cvtepu8_epi32( load4( in + i * 4 ) ) );
+
+		sum = _mm_cvttps_epi32( _mm_div_ps(
+			_mm_cvtepi32_ps( _mm_add_epi32( sum, round ) ), div ) );
+		sum = _mm_packus_epi32( sum, sum );
+		store4( out, _mm_packus_epi16( sum, sum ) );
+
+		in += hshrink * 4;
+		out += 4;
+	}
+}
+
+/* As shrinkh_uchar_sse41(), but for 4-band ushort. The float divide is only
+ * exact for smaller shrinks here.
+ */
+static void SSE41
+shrinkh_ushort_sse41( VipsPel *out, const VipsPel *in,
+	int width, int hshrink )
+{
+	const unsigned short * restrict p = (unsigned short *) in;
+	unsigned short * restrict q = (unsigned short *) out;
+	const __m128i round = _mm_set1_epi32( hshrink / 2 );
+	const __m128 div = _mm_set1_ps( hshrink );
+
+	int x, i, b;
+
+	if( hshrink == 2 ) {
+		for( x = 0; x + 2 <= width; x += 2 ) {
+			__m128i a = _mm_loadu_si128( (__m128i *) p );
+			__m128i c = _mm_loadu_si128( (__m128i *) (p + 8) );
+
+			_mm_storeu_si128( (__m128i *) q, _mm_avg_epu16(
+				_mm_unpacklo_epi64( a, c ),
+				_mm_unpackhi_epi64( a, c ) ) );
+
+			p += 16;
+			q += 8;
+		}
+		for( ; x < width; x++ ) {
+			for( b = 0; b < 4; b++ )
+				q[b] = (p[b] + p[b + 4] + 1) >> 1;
+
+			p += 8;
+			q += 4;
+		}
+
+		return;
+	}
+
+	if( hshrink > 256 ) {
+		for( x = 0; x < width; x++ )
+			for( b = 0; b < 4; b++ ) {
+				int sum;
+
+				sum = 0;
+				for( i = 0; i < hshrink; i++ )
+					sum += p[x * hshrink * 4 + i * 4 + b];
+
+				q[x * 4 + b] = (sum + hshrink / 2) / hshrink;
+			}
+
+		return;
+	}
+
+	for( x = 0; x < width; x++ ) {
+		__m128i sum;
+
+		sum = _mm_setzero_si128();
+		for( i = 0; i < hshrink; i++ )
+			sum = _mm_add_epi32( sum, _mm_cvtepu16_epi32(
+				_mm_loadl_epi64( (__m128i *) (p + i * 4) ) ) );
+
+		sum = _mm_cvttps_epi32( _mm_div_ps(
+			_mm_cvtepi32_ps( _mm_add_epi32( sum, round ) ), div ) );
+		_mm_storel_epi64( (__m128i *) q, _mm_packus_epi32( sum, sum ) );
+
+		p += hshrink * 4;
+		q += 4;
+	}
+}
+
+/* Add a line to an accumulator, see ADD in resample/shrinkv.c.
+ */
+#define SHRINKV( NAME, ATTR, TYPE, N, VTYPE, LOAD, LOADI, ADD, STORE ) \
+static void ATTR \
+NAME( int *sum, const VipsPel *in, int n ) \
+{ \
+	const TYPE * restrict p = (TYPE *) in; \
+	\
+	int x; \
+	\
+	for( x = 0; x + N <= n; x += N ) \
+		STORE( (VTYPE *) (sum + x), \
+			ADD( LOADI( (VTYPE *) (sum + x) ), LOAD( p + x ) ) ); \
+	for( ; x < n; x++ ) \
+		sum[x] += p[x]; \
+}
+
+SHRINKV( shrinkv_uchar_sse41, SSE41, unsigned char, 4, __m128i,
+	LOAD4I_UCHAR, _mm_loadu_si128, _mm_add_epi32, _mm_storeu_si128 )
+SHRINKV( shrinkv_ushort_sse41, SSE41, unsigned short, 4, __m128i,
+	LOAD4I_USHORT, _mm_loadu_si128, _mm_add_epi32, _mm_storeu_si128 )
+SHRINKV( shrinkv_uchar_avx2, AVX2, unsigned char, 8, __m256i,
+	LOAD8I_UCHAR, _mm256_loadu_si256, _mm256_add_epi32,
+	_mm256_storeu_si256 )
+SHRINKV( shrinkv_ushort_avx2, AVX2, unsigned short, 8, __m256i,
+	LOAD8I_USHORT, _mm256_loadu_si256, _mm256_add_epi32,
+	_mm256_storeu_si256 )
+
+/* Blend one pixel A into B with one of the modes native composite supports,
+ * see vips_composite_base_blend3() in conversion/composite.cpp. The alpha
+ * is in every element of aA and aB, and the result alpha goes to aB.
+ */
+static inline __m128 SSE41
+composite_blend_sse41( VipsBlendMode mode,
+	__m128 A, __m128 aA, __m128 B, __m128 *aB )
+{
+	const __m128 one = _mm_set1_ps( 1.0 );
+
+	__m128 aR;
+	__m128 f;
+
+	switch( mode ) {
+	case VIPS_BLEND_MODE_DEST_IN:
+		aR = _mm_mul_ps( aA, *aB );
+		break;
+
+	case VIPS_BLEND_MODE_MULTIPLY:
+	case VIPS_BLEND_MODE_SCREEN:
+		aR = _mm_add_ps( aA, _mm_mul_ps( *aB, _mm_sub_ps( one, aA ) ) );
+		f = _mm_mul_ps( A, B );
+		if( mode == VIPS_BLEND_MODE_SCREEN )
+			f = _mm_sub_ps( _mm_add_ps( A, B ), f );
+		B = _mm_add_ps( _mm_add_ps(
+			_mm_mul_ps( _mm_sub_ps( one, *aB ), A ),
+			_mm_mul_ps( _mm_sub_ps( one, aA ), B ) ),
+			_mm_mul_ps( _mm_mul_ps( aA, *aB ), f ) );
+		break;
+
+	default:
+		g_assert( mode == VIPS_BLEND_MODE_OVER );
+
+		aR = _mm_add_ps( aA, _mm_mul_ps( *aB, _mm_sub_ps( one, aA ) ) );
+		B = _mm_add_ps( A, _mm_mul_ps( _mm_sub_ps( one, aA ), B ) );
+		break;
+	}
+
+	*aB = aR;
+
+	return( _mm_blend_ps( B, aR, 8 ) );
+}
+
+/* Composite pixels start to end of 4-band uchar or ushort images, one at a
+ * time.
+ */
+static inline void SSE41
+composite_range_sse41( VipsPel *out, VipsPel **in, int n,
+	int start, int end, const VipsBlendMode *mode, int n_mode,
+	const float *max_band, gboolean premultiplied, int size )
+{
+	const __m128 max = _mm_loadu_ps( max_band );
+	const __m128 high = _mm_set1_ps( size == 1 ? UCHAR_MAX : USHRT_MAX );
+
+	int x, i;
+
+	for( x = start; x < end; x++ ) {
+		__m128 B;
+		__m128 aB;
+		__m128i s;
+
+		B = _mm_div_ps( size == 1 ?
+			LOAD4_UCHAR( in[0] + x * 4 ) :
+			LOAD4_USHORT( in[0] + x * 8 ), max );
+		aB = _mm_shuffle_ps( B, B, _MM_SHUFFLE( 3, 3, 3, 3 ) );
+		if( !premultiplied )
+			B = _mm_blend_ps( _mm_mul_ps( B, aB ), B, 8 );
+
+		for( i = 1; i < n; i++ ) {
+			__m128 A;
+			__m128 aA;
+
+			A = _mm_div_ps( size == 1 ?
+				LOAD4_UCHAR( in[i] + x * 4 ) :
+				LOAD4_USHORT( in[i] + x * 8 ), max );
+			aA = _mm_shuffle_ps( A, A, _MM_SHUFFLE( 3, 3, 3, 3 ) );
+			if( !premultiplied )
+				A = _mm_mul_ps( A, aA );
+
+			B = composite_blend_sse41(
+				n_mode == 1 ? mode[0] : mode[i - 1],
+				A, aA, B, &aB );
+		}
+
+		if( !premultiplied ) {
+			if( _mm_cvtss_f32( aB ) == 0 )
+				B = _mm_blend_ps( _mm_setzero_ps(), B, 8 );
+			else
+				B = _mm_blend_ps( _mm_div_ps( B, aB ), B, 8 );
+		}
+
+		B = _mm_mul_ps( B, max );
+		B = _mm_min_ps( _mm_max_ps( B, _mm_setzero_ps() ), high );
+
+		s = _mm_cvttps_epi32( B );
+		s = _mm_packus_epi32( s, s );
+		if( size == 1 )
+			store4( out + x * 4, _mm_packus_epi16( s, s ) );
+		else
+			_mm_storel_epi64( (__m128i *) (out + x * 8), s );
+	}
+}
+
+static void SSE41
+composite_uchar_sse41( VipsPel *out, VipsPel **in, int n, int width,
+	const VipsBlendMode *mode, int n_mode,
+	const float *max_band, gboolean premultiplied )
+{
+	composite_range_sse41( out, in, n, 0, width,
+		mode, n_mode, max_band, premultiplied, 1 );
+}
+
+static void SSE41
+composite_ushort_sse41( VipsPel *out, VipsPel **in, int n, int width,
+	const VipsBlendMode *mode, int n_mode,
+	const float *max_band, gboolean premultiplied )
+{
+	composite_range_sse41( out, in, n, 0, width,
+		mode, n_mode, max_band, premultiplied, 2 );
+}
+
+
+/* Eight 4-band uchar or ushort pixels to four float vectors, one per band.
+ */
+static inline void AVX2
+composite_load8_avx2( const VipsPel *p, int size, __m256 *v )
+{
+	__m128i lo, hi;
+
+	if( size == 1 ) {
+		__m256i t;
+
+		/* Gather each band of each four pixels into a 32-bit
+		 * element, then move elements so lo is R and G, hi B and A.
+		 */
+		t = _mm256_shuffle_epi8( _mm256_loadu_si256( (__m256i *) p ),
+			_mm256_setr_epi8(
+				0, 4, 8, 12, 1, 5, 9, 13,
+				2, 6, 10, 14, 3, 7, 11, 15,
+				0, 4, 8, 12, 1, 5, 9, 13,
+				2, 6, 10, 14, 3, 7, 11, 15 ) );
+		t = _mm256_permutevar8x32_epi32( t,
+			_mm256_setr_epi32( 0, 4, 1, 5, 2, 6, 3, 7 ) );
+		lo = _mm256_castsi256_si128( t );
+		hi = _mm256_extracti128_si256( t, 1 );
+
+		v[0] = _mm256_cvtepi32_ps( _mm256_cvtepu8_epi32( lo ) );
+		v[1] = _mm256_cvtepi32_ps( _mm256_cvtepu8_epi32(
+			_mm_srli_si128( lo, 8 ) ) );
+		v[2] = _mm256_cvtepi32_ps( _mm256_cvtepu8_epi32( hi ) );
+		v[3] = _mm256_cvtepi32_ps( _mm256_cvtepu8_epi32(
+			_mm_srli_si128( hi, 8 ) ) );
+	}
+	else {
+		const __m256i shuf = _mm256_setr_epi8(
+			0, 1, 8, 9, 2, 3, 10, 11,
+			4, 5, 12, 13, 6, 7, 14, 15,
+			0, 1, 8, 9, 2, 3, 10, 11,
+			4, 5, 12, 13, 6, 7, 14, 15 );
+		const __m256i perm =
+			_mm256_setr_epi32( 0, 4, 1, 5, 2, 6, 3, 7 );
+
+		__m256i t0, t1;
+
+		/* Each of t0 and t1 is four pixels as RRRR GGGG BBBB AAAA.
+		 */
+		t0 = _mm256_permutevar8x32_epi32( _mm256_shuffle_epi8(
+			_mm256_loadu_si256( (__m256i *) p ), shuf ), perm );
+		t1 = _mm256_permutevar8x32_epi32( _mm256_shuffle_epi8(
+			_mm256_loadu_si256( (__m256i *) (p + 32) ), shuf ),
+			perm );
+		lo = _mm256_castsi256_si128( t0 );
+		hi = _mm256_castsi256_si128( t1 );
+		v[0] = _mm256_cvtepi32_ps( _mm256_cvtepu16_epi32(
+			_mm_unpacklo_epi64( lo, hi ) ) );
+		v[1] = _mm256_cvtepi32_ps( _mm256_cvtepu16_epi32(
+			_mm_unpackhi_epi64( lo, hi ) ) );
+		lo = _mm256_extracti128_si256( t0, 1 );
+		hi = _mm256_extracti128_si256( t1, 1 );
+		v[2] = _mm256_cvtepi32_ps( _mm256_cvtepu16_epi32(
+			_mm_unpacklo_epi64( lo, hi ) ) );
+		v[3] = _mm256_cvtepi32_ps( _mm256_cvtepu16_epi32(
+			_mm_unpackhi_epi64( lo, hi ) ) );
+	}
+}
+
+/* And back again. Elements must already be clipped to range.
+ */
+static inline void AVX2
+composite_store8_avx2( VipsPel *q, int size, __m256 *v )
+{
+	__m256i rg, ba;
+
+	/* Both are (for uchar) four pixels of two bands per lane.
+	 */
+	rg = _mm256_packus_epi32( _mm256_cvttps_epi32( v[0] ),
+		_mm256_cvttps_epi32( v[1] ) );
+	ba = _mm256_packus_epi32( _mm256_cvttps_epi32( v[2] ),
+		_mm256_cvttps_epi32( v[3] ) );
+
+	if( size == 1 )
+		_mm256_storeu_si256( (__m256i *) q, _mm256_shuffle_epi8(
+			_mm256_packus_epi16( rg, ba ),
+			_mm256_setr_epi8(
+				0, 4, 8, 12, 1, 5, 9, 13,
+				2, 6, 10, 14, 3, 7, 11, 15,
+				0, 4, 8, 12, 1, 5, 9, 13,
+				2, 6, 10, 14, 3, 7, 11, 15 ) ) );
+	else {
+		__m256i rb = _mm256_unpacklo_epi16( rg, ba );
+		__m256i ga = _mm256_unpackhi_epi16( rg, ba );
+
+		/* Pixels 0, 1, 4, 5, then 2, 3, 6, 7.
+		 */
+		__m256i p0 = _mm256_unpacklo_epi16( rb, ga );
+		__m256i p1 = _mm256_unpackhi_epi16( rb, ga );
+
+		_mm256_storeu_si256( (__m256i *) q,
+			_mm256_permute2x128_si256( p0, p1, 0x20 ) );
+		_mm256_storeu_si256( (__m256i *) (q + 32),
+			_mm256_permute2x128_si256( p0, p1, 0x31 ) );
+	}
+}
+
+/* Composite eight pixels, one vector per band, see
+ * composite_blend_sse41(). The operations are in the same order, so the
+ * results are identical.
+ */
+static inline void AVX2
+composite8_avx2( VipsPel *out, VipsPel **in, int n, int x,
+	const VipsBlendMode *mode, int n_mode,
+	const __m256 *max, const __m256 high, gboolean premultiplied,
+	int size )
+{
+	const __m256 one = _mm256_set1_ps( 1.0 );
+
+	__m256 B[4];
+	__m256 A[4];
+	__m256 f;
+	__m256 mask;
+	int i, b;
+
+	composite_load8_avx2( in[0] + x * 4 * size, size, B );
+	for( b = 0; b < 4; b++ )
+		B[b] = _mm256_div_ps( B[b], max[b] );
+	if( !premultiplied )
+		for( b = 0; b < 3; b++ )
+			B[b] = _mm256_mul_ps( B[b], B[3] );
+
+	for( i = 1; i < n; i++ ) {
+		VipsBlendMode m = n_mode == 1 ? mode[0] : mode[i - 1];
+
+		composite_load8_avx2( in[i] + x * 4 * size, size, A );
+		for( b = 0; b < 4; b++ )
+			A[b] = _mm256_div_ps( A[b], max[b] );
+		if( !premultiplied )
+			for( b = 0; b < 3; b++ )
+				A[b] = _mm256_mul_ps( A[b], A[3] );
+
+		switch( m ) {
+		case VIPS_BLEND_MODE_DEST_IN:
+			B[3] = _mm256_mul_ps( A[3], B[3] );
+			break;
+
+		case VIPS_BLEND_MODE_MULTIPLY:
+		case VIPS_BLEND_MODE_SCREEN:
+			for( b = 0; b < 3; b++ ) {
+				f = _mm256_mul_ps( A[b], B[b] );
+				if( m == VIPS_BLEND_MODE_SCREEN )
+					f = _mm256_sub_ps( _mm256_add_ps(
+						A[b], B[b] ), f );
+				B[b] = _mm256_add_ps( _mm256_add_ps(
+					_mm256_mul_ps(
+						_mm256_sub_ps( one, B[3] ),
+						A[b] ),
+					_mm256_mul_ps(
+						_mm256_sub_ps( one, A[3] ),
+						B[b] ) ),
+					_mm256_mul_ps(
+						_mm256_mul_ps( A[3], B[3] ),
+						f ) );
+			}
+			B[3] = _mm256_add_ps( A[3], _mm256_mul_ps( B[3],
+				_mm256_sub_ps( one, A[3] ) ) );
+			break;
+
+		default:
+			g_assert( m == VIPS_BLEND_MODE_OVER );
+
+			for( b = 0; b < 3; b++ )
+				B[b] = _mm256_add_ps( A[b], _mm256_mul_ps(
+					_mm256_sub_ps( one, A[3] ), B[b] ) );
+			B[3] = _mm256_add_ps( A[3], _mm256_mul_ps( B[3],
+				_mm256_sub_ps( one, A[3] ) ) );
+			break;
+		}
+	}
+
+	if( !premultiplied ) {
+		mask = _mm256_cmp_ps( B[3], _mm256_setzero_ps(), _CMP_EQ_OQ );
+		for( b = 0; b < 3; b++ )
+			B[b] = _mm256_blendv_ps( _mm256_div_ps( B[b], B[3] ),
+				_mm256_setzero_ps(), mask );
+	}
+
+	for( b = 0; b < 4; b++ )
+		B[b] = _mm256_min_ps( _mm256_max_ps(
+			_mm256_mul_ps( B[b], max[b] ),
+			_mm256_setzero_ps() ), high );
+
+	composite_store8_avx2( out + x * 4 * size, size, B );
+}
+
+/* Composite 4-band uchar or ushort images, eight pixels at a time.
+ */
+static inline void AVX2
+composite_any_avx2( VipsPel *out, VipsPel **in, int n, int width,
+	const VipsBlendMode *mode, int n_mode,
+	const float *max_band, gboolean premultiplied, int size )
+{
+	const __m256 high = _mm256_set1_ps( size == 1 ? UCHAR_MAX : USHRT_MAX );
+
+	__m256 max[4];
+	int x, b;
+
+	for( b = 0; b < 4; b++ )
+		max[b] = _mm256_set1_ps( max_band[b] );
+
+	for( x = 0; x + 8 <= width; x += 8 )
+		composite8_avx2( out, in, n, x,
+			mode, n_mode, max, high, premultiplied, size );
+
+	composite_range_sse41( out, in, n, x, width,
+		mode, n_mode, max_band, premultiplied, size );
+}
+
+static void AVX2
+composite_uchar_avx2( VipsPel *out, VipsPel **in, int n, int width,
+	const VipsBlendMode *mode, int n_mode,
+	const float *max_band, gboolean premultiplied )
+{
+	composite_any_avx2( out, in, n, width,
+		mode, n_mode, max_band, premultiplied, 1 );
+}
+
+static void AVX2
+composite_ushort_avx2( VipsPel *out, VipsPel **in, int n, int width,
+	const VipsBlendMode *mode, int n_mode,
+	const float *max_band, gboolean premultiplied )
+{
+	composite_any_avx2( out, in, n, width,
+		mode, n_mode, max_band, premultiplied, 2 );
+}
+
+/* Multiply 3-band float pixels by a 3x3 matrix, see vips_col_scRGB2XYZ().
+ * The C version computes in double, so we must too.
+ */
+static void AVX2
+matrix3_avx2( float *out, const float *in, int width, const double *matrix )
+{
+	const __m256d c0 = _mm256_setr_pd( matrix[0], matrix[3], matrix[6], 0 );
+	const __m256d c1 = _mm256_setr_pd( matrix[1], matrix[4], matrix[7], 0 );
+	const __m256d c2 = _mm256_setr_pd( matrix[2], matrix[5], matrix[8], 0 );
+
+	int x;
+
+	for( x = 0; x < width; x++ ) {
+		const float *p = in + x * 3;
+		float *q = out + x * 3;
+
+		__m256d v;
+		__m128 f;
+
+		v = _mm256_mul_pd( c0, _mm256_set1_pd( p[0] ) );
+		v = _mm256_add_pd( v, _mm256_mul_pd( c1,
+			_mm256_set1_pd( p[1] ) ) );
+		v = _mm256_add_pd( v, _mm256_mul_pd( c2,
+			_mm256_set1_pd( p[2] ) ) );
+		f = _mm256_cvtpd_ps( v );
+
+		/* We can write a 4th element over the next pixel, since
+		 * we'll overwrite it on the next loop, but not for the last
+		 * pixel.
+		 */
+		if( x < width - 1 )
+			_mm_storeu_ps( q, f );
+		else {
+			float t[4];
+
+			_mm_storeu_ps( t, f );
+			q[0] = t[0];
+			q[1] = t[1];
+			q[2] = t[2];
+		}
+	}
+}
+
+/* The Lab f() function, see vips_XYZ2Lab_f() in colour/XYZ2Lab.c. This
+ * is the same sequence of steps, so results are identical.
+ */
+static inline __m256d AVX2
+XYZ2Lab_f_avx2( __m256d t )
+{
+	const __m256d two = _mm256_set1_pd( 2.0 );
+
+	__m256d lin;
+	__m128i i;
+	__m256d y, y3;
+	__m256d mask;
+	int n;
+
+	lin = _mm256_add_pd( _mm256_mul_pd( _mm256_set1_pd( 7.787 ), t ),
+		_mm256_set1_pd( 16.0 / 116.0 ) );
+
+	/* First guess from the float bits, then two Halley steps.
+	 */
+	i = _mm_castps_si128( _mm256_cvtpd_ps( t ) );
+	i = _mm_cvttps_epi32( _mm_mul_ps( _mm_cvtepi32_ps( i ),
+		_mm_set1_ps( 1.0f / 3.0f ) ) );
+	i = _mm_add_epi32( i, _mm_set1_epi32( 709921077 ) );
+	y = _mm256_cvtps_pd( _mm_castsi128_ps( i ) );
+
+	for( n = 0; n < 2; n++ ) {
+		y3 = _mm256_mul_pd( _mm256_mul_pd( y, y ), y );
+		y = _mm256_div_pd( _mm256_mul_pd( y, _mm256_add_pd( y3,
+			_mm256_mul_pd( two, t ) ) ),
+			_mm256_add_pd( _mm256_mul_pd( two, y3 ), t ) );
+	}
+
+	mask = _mm256_cmp_pd( t, _mm256_set1_pd( 0.008856 ), _CMP_LT_OQ );
+
+	return( _mm256_blendv_pd( y, lin, mask ) );
+}
+
+/* Four XYZ pixels to Lab, see vips_XYZ2Lab_line() in colour/XYZ2Lab.c.
+ */
+static inline void AVX2
+XYZ2Lab4_avx2( float *q, const float *p, const __m256d *scale )
+{
+	__m256d fx, fy, fz;
+	float t[3][4];
+	int i;
+
+	fx = XYZ2Lab_f_avx2( _mm256_mul_pd( scale[0], _mm256_cvtps_pd(
+		_mm_setr_ps( p[0], p[3], p[6], p[9] ) ) ) );
+	fy = XYZ2Lab_f_avx2( _mm256_mul_pd( scale[1], _mm256_cvtps_pd(
+		_mm_setr_ps( p[1], p[4], p[7], p[10] ) ) ) );
+	fz = XYZ2Lab_f_avx2( _mm256_mul_pd( scale[2], _mm256_cvtps_pd(
+		_mm_setr_ps( p[2], p[5], p[8], p[11] ) ) ) );
+
+	_mm_storeu_ps( t[0], _mm256_cvtpd_ps( _mm256_sub_pd(
+		_mm256_mul_pd( _mm256_set1_pd( 116.0 ), fy ),
+		_mm256_set1_pd( 16.0 ) ) ) );
+	_mm_storeu_ps( t[1], _mm256_cvtpd_ps( _mm256_mul_pd(
+		_mm256_set1_pd( 500.0 ), _mm256_sub_pd( fx, fy ) ) ) );
+	_mm_storeu_ps( t[2], _mm256_cvtpd_ps( _mm256_mul_pd(
+		_mm256_set1_pd( 200.0 ), _mm256_sub_pd( fy, fz ) ) ) );
+
+	for( i = 0; i < 4; i++ ) {
+		q[i * 3] = t[0][i];
+		q[i * 3 + 1] = t[1][i];
+		q[i * 3 + 2] = t[2][i];
+	}
+}
+
+static void AVX2
+XYZ2Lab_avx2( float *out, const float *in, int width, const double *white )
+{
+	__m256d s[3];
+	int x;
+
+	s[0] = _mm256_set1_pd( 1.0 / white[0] );
+	s[1] = _mm256_set1_pd( 1.0 / white[1] );
+	s[2] = _mm256_set1_pd( 1.0 / white[2] );
+
+	for( x = 0; x + 4 <= width; x += 4 )
+		XYZ2Lab4_avx2( out + x * 3, in + x * 3, s );
+
+	if( x < width ) {
+		float t[12] = { 0 };
+		float o[12];
+
+		memcpy( t, in + x * 3, (width - x) * 3 * sizeof( float ) );
+		XYZ2Lab4_avx2( o, t, s );
+		memcpy( out + x * 3, o, (width - x) * 3 * sizeof( float ) );
+	}
+}
+
+/* X or Z from its cube root, see vips_Lab2XYZ_line() in colour/Lab2XYZ.c.
+ */
+static inline __m128 AVX2
+Lab2XYZ_cube_avx2( __m256d tmp, __m256d white )
+{
+	__m256d lin;
+	__m256d cube;
+	__m256d mask;
+
+	lin = _mm256_div_pd( _mm256_mul_pd( white,
+		_mm256_sub_pd( tmp, _mm256_set1_pd( 0.13793 ) ) ),
+		_mm256_set1_pd( 7.787 ) );
+	cube = _mm256_mul_pd( _mm256_mul_pd( _mm256_mul_pd( white, tmp ),
+		tmp ), tmp );
+	mask = _mm256_cmp_pd( tmp, _mm256_set1_pd( 0.2069 ), _CMP_LT_OQ );
+
+	return( _mm256_cvtpd_ps( _mm256_blendv_pd( cube, lin, mask ) ) );
+}
+
+/* Four Lab pixels to XYZ, see vips_Lab2XYZ_line() in colour/Lab2XYZ.c. The
+ * C version works in double, so we compute both sides of each branch in
+ * double and blend.
+ */
+static inline void AVX2
+Lab2XYZ4_avx2( float *q, const float *p, const __m256d *white )
+{
+	__m256d L, a, b;
+	__m256d Ylin, Ycube;
+	__m256d cbylin, cbycube;
+	__m256d mask;
+	__m256d Y, cby;
+	__m128 X, Z;
+	float t[3][4];
+	int i;
+
+	L = _mm256_cvtps_pd( _mm_setr_ps( p[0], p[3], p[6], p[9] ) );
+	a = _mm256_cvtps_pd( _mm_setr_ps( p[1], p[4], p[7], p[10] ) );
+	b = _mm256_cvtps_pd( _mm_setr_ps( p[2], p[5], p[8], p[11] ) );
+
+	/* Y is a float in the C version, so round it before we find cby.
+	 */
+	Ylin = _mm256_cvtps_pd( _mm256_cvtpd_ps( _mm256_div_pd(
+		_mm256_mul_pd( L, white[1] ), _mm256_set1_pd( 903.3 ) ) ) );
+	cbylin = _mm256_add_pd( _mm256_mul_pd( _mm256_set1_pd( 7.787 ),
+		_mm256_div_pd( Ylin, white[1] ) ),
+		_mm256_set1_pd( 16.0 / 116.0 ) );
+
+	cbycube = _mm256_div_pd( _mm256_add_pd( L, _mm256_set1_pd( 16.0 ) ),
+		_mm256_set1_pd( 116.0 ) );
+	Ycube = _mm256_mul_pd( _mm256_mul_pd( _mm256_mul_pd( white[1],
+		cbycube ), cbycube ), cbycube );
+
+	mask = _mm256_cmp_pd( L, _mm256_set1_pd( 8.0 ), _CMP_LT_OQ );
+	Y = _mm256_blendv_pd( Ycube, Ylin, mask );
+	cby = _mm256_blendv_pd( cbycube, cbylin, mask );
+
+	X = Lab2XYZ_cube_avx2( _mm256_add_pd(
+		_mm256_div_pd( a, _mm256_set1_pd( 500.0 ) ), cby ), white[0] );
+	Z = Lab2XYZ_cube_avx2( _mm256_sub_pd( cby,
+		_mm256_div_pd( b, _mm256_set1_pd( 200.0 ) ) ), white[2] );
+
+	_mm_storeu_ps( t[0], X );
+	_mm_storeu_ps( t[1], _mm256_cvtpd_ps( Y ) );
+	_mm_storeu_ps( t[2], Z );
+
+	for( i = 0; i < 4; i++ ) {
+		q[i * 3] = t[0][i];
+		q[i * 3 + 1] = t[1][i];
+		q[i * 3 + 2] = t[2][i];
+	}
+}
+
+static void AVX2
+Lab2XYZ_avx2( float *out, const float *in, int width, const double *white )
+{
+	__m256d w[3];
+	int x;
+
+	w[0] = _mm256_set1_pd( white[0] );
+	w[1] = _mm256_set1_pd( white[1] );
+	w[2] = _mm256_set1_pd( white[2] );
+
+	for( x = 0; x + 4 <= width; x += 4 )
+		Lab2XYZ4_avx2( out + x * 3, in + x * 3, w );
+
+	if( x < width ) {
+		float t[12] = { 0 };
+		float o[12];
+
+		memcpy( t, in + x * 3, (width - x) * 3 * sizeof( float ) );
+		Lab2XYZ4_avx2( o, t, w );
+		memcpy( out + x * 3, o, (width - x) * 3 * sizeof( float ) );
+	}
+}
+
+/* Sin and cos of x degrees, see vips_dE00_sincos() in colour/dE00.c.
+ */
+static inline void AVX2
+dE00_sincos_avx2( __m256d x, __m256d *sin_out, __m256d *cos_out )
+{
+	const __m256d sign = _mm256_set1_pd( -0.0 );
+
+	__m256d n;
+	__m128i q;
+	__m256d r, z;
+	__m256d s, c, t;
+	__m256d odd, neg;
+
+	n = _mm256_floor_pd( _mm256_add_pd(
+		_mm256_div_pd( x, _mm256_set1_pd( 90.0 ) ),
+		_mm256_set1_pd( 0.5 ) ) );
+	q = _mm256_cvtpd_epi32( n );
+	r = _mm256_mul_pd( _mm256_sub_pd( x,
+		_mm256_mul_pd( _mm256_set1_pd( 90.0 ), n ) ),
+		_mm256_set1_pd( VIPS_PI / 180.0 ) );
+	z = _mm256_mul_pd( r, r );
+
+	s = _mm256_set1_pd( 1.58962301576546568060e-10 );
+	s = _mm256_sub_pd( _mm256_mul_pd( s, z ),
+		_mm256_set1_pd( 2.50507477628578072866e-8 ) );
+	s = _mm256_add_pd( _mm256_mul_pd( s, z ),
+		_mm256_set1_pd( 2.75573136213857245213e-6 ) );
+	s = _mm256_sub_pd( _mm256_mul_pd( s, z ),
+		_mm256_set1_pd( 1.98412698295895385996e-4 ) );
+	s = _mm256_add_pd( _mm256_mul_pd( s, z ),
+		_mm256_set1_pd( 8.33333333332211858878e-3 ) );
+	s = _mm256_sub_pd( _mm256_mul_pd( s, z ),
+		_mm256_set1_pd( 1.66666666666666307295e-1 ) );
+	s = _mm256_add_pd( r, _mm256_mul_pd( _mm256_mul_pd( r, z ), s ) );
+
+	c = _mm256_set1_pd( -1.13585365213876817300e-11 );
+	c = _mm256_add_pd( _mm256_mul_pd( c, z ),
+		_mm256_set1_pd( 2.08757008419747316778e-9 ) );
+	c = _mm256_sub_pd( _mm256_mul_pd( c, z ),
+		_mm256_set1_pd( 2.75573141792967388112e-7 ) );
+	c = _mm256_add_pd( _mm256_mul_pd( c, z ),
+		_mm256_set1_pd( 2.48015872888517045348e-5 ) );
+	c = _mm256_sub_pd( _mm256_mul_pd( c, z ),
+		_mm256_set1_pd( 1.38888888888730564116e-3 ) );
+	c = _mm256_add_pd( _mm256_mul_pd( c, z ),
+		_mm256_set1_pd( 4.16666666666665929218e-2 ) );
+	c = _mm256_add_pd( _mm256_sub_pd( _mm256_set1_pd( 1.0 ),
+		_mm256_mul_pd( _mm256_set1_pd( 0.5 ), z ) ),
+		_mm256_mul_pd( _mm256_mul_pd( z, z ), c ) );
+
+	/* Quadrant masks, widened to 64 bits.
+	 */
+	odd = _mm256_castsi256_pd( _mm256_cvtepi32_epi64( _mm_cmpeq_epi32(
+		_mm_and_si128( q, _mm_set1_epi32( 1 ) ),
+		_mm_set1_epi32( 1 ) ) ) );
+	neg = _mm256_castsi256_pd( _mm256_cvtepi32_epi64( _mm_cmpeq_epi32(
+		_mm_and_si128( q, _mm_set1_epi32( 2 ) ),
+		_mm_set1_epi32( 2 ) ) ) );
+
+	t = s;
+	s = _mm256_blendv_pd( s, c, odd );
+	c = _mm256_blendv_pd( c, _mm256_xor_pd( t, sign ), odd );
+	s = _mm256_blendv_pd( s, _mm256_xor_pd( s, sign ), neg );
+	c = _mm256_blendv_pd( c, _mm256_xor_pd( c, sign ), neg );
+
+	*sin_out = s;
+	*cos_out = c;
+}
+
+/* Hue in degrees, see vips_dE00_hue() in colour/dE00.c.
+ */
+static inline __m256d AVX2
+dE00_hue_avx2( __m256d a, __m256d b )
+{
+	const __m256d sign = _mm256_set1_pd( -0.0 );
+	const __m256d zero = _mm256_setzero_pd();
+
+	__m256d ax, ay, mx, mn;
+	__m256d t, t1, z, p, q, h;
+	__m256d mask;
+
+	ax = _mm256_andnot_pd( sign, a );
+	ay = _mm256_andnot_pd( sign, b );
+	mx = _mm256_max_pd( ax, ay );
+	mn = _mm256_min_pd( ax, ay );
+
+	t = _mm256_blendv_pd( zero, _mm256_div_pd( mn, mx ),
+		_mm256_cmp_pd( mx, zero, _CMP_GT_OQ ) );
+
+	mask = _mm256_cmp_pd( t, _mm256_set1_pd( 0.66 ), _CMP_GT_OQ );
+	t1 = _mm256_div_pd( _mm256_sub_pd( t, _mm256_set1_pd( 1.0 ) ),
+		_mm256_add_pd( t, _mm256_set1_pd( 1.0 ) ) );
+	t = _mm256_blendv_pd( t, t1, mask );
+	h = _mm256_blendv_pd( zero, _mm256_set1_pd( 45.0 ), mask );
+
+	z = _mm256_mul_pd( t, t );
+	p = _mm256_set1_pd( -8.750608600031904122785e-1 );
+	p = _mm256_sub_pd( _mm256_mul_pd( p, z ),
+		_mm256_set1_pd( 1.615753718733365076637e1 ) );
+	p = _mm256_sub_pd( _mm256_mul_pd( p, z ),
+		_mm256_set1_pd( 7.500855792314704667340e1 ) );
+	p = _mm256_sub_pd( _mm256_mul_pd( p, z ),
+		_mm256_set1_pd( 1.228866684490136173410e2 ) );
+	p = _mm256_sub_pd( _mm256_mul_pd( p, z ),
+		_mm256_set1_pd( 6.485021904942025371773e1 ) );
+	q = _mm256_add_pd( z, _mm256_set1_pd( 2.485846490142306297962e1 ) );
+	q = _mm256_add_pd( _mm256_mul_pd( q, z ),
+		_mm256_set1_pd( 1.650270098316988542046e2 ) );
+	q = _mm256_add_pd( _mm256_mul_pd( q, z ),
+		_mm256_set1_pd( 4.328810604912902668951e2 ) );
+	q = _mm256_add_pd( _mm256_mul_pd( q, z ),
+		_mm256_set1_pd( 4.853903996359136964868e2 ) );
+	q = _mm256_add_pd( _mm256_mul_pd( q, z ),
+		_mm256_set1_pd( 1.945506571482613964425e2 ) );
+	h = _mm256_add_pd( h, _mm256_mul_pd( _mm256_add_pd( t,
+		_mm256_mul_pd( t, _mm256_div_pd( _mm256_mul_pd( z, p ), q ) ) ),
+		_mm256_set1_pd( 180.0 / VIPS_PI ) ) );
+
+	h = _mm256_blendv_pd( h, _mm256_sub_pd( _mm256_set1_pd( 90.0 ), h ),
+		_mm256_cmp_pd( ay, ax, _CMP_GT_OQ ) );
+	h = _mm256_blendv_pd( h, _mm256_sub_pd( _mm256_set1_pd( 180.0 ), h ),
+		_mm256_cmp_pd( a, zero, _CMP_LT_OQ ) );
+	h = _mm256_blendv_pd( h, _mm256_sub_pd( _mm256_set1_pd( 360.0 ), h ),
+		_mm256_cmp_pd( b, zero, _CMP_LT_OQ ) );
+
+	return( h );
+}
+
+/* exp(), see vips_dE00_exp() in colour/dE00.c.
+ */
+static inline __m256d AVX2
+dE00_exp_avx2( __m256d x )
+{
+	__m256d n, r, z, p, q;
+	__m256i bits;
+
+	n = _mm256_floor_pd( _mm256_add_pd( _mm256_mul_pd( x,
+		_mm256_set1_pd( 1.4426950408889634073599 ) ),
+		_mm256_set1_pd( 0.5 ) ) );
+	r = _mm256_sub_pd( _mm256_sub_pd( x,
+		_mm256_mul_pd( n, _mm256_set1_pd( 6.93145751953125e-1 ) ) ),
+		_mm256_mul_pd( n,
+			_mm256_set1_pd( 1.42860682030941723212e-6 ) ) );
+	z = _mm256_mul_pd( r, r );
+
+	p = _mm256_set1_pd( 1.26177193074810590878e-4 );
+	p = _mm256_add_pd( _mm256_mul_pd( p, z ),
+		_mm256_set1_pd( 3.02994407707441961300e-2 ) );
+	p = _mm256_add_pd( _mm256_mul_pd( p, z ),
+		_mm256_set1_pd( 9.99999999999999999910e-1 ) );
+	p = _mm256_mul_pd( p, r );
+	q = _mm256_set1_pd( 3.00198505138664455042e-6 );
+	q = _mm256_add_pd( _mm256_mul_pd( q, z ),
+		_mm256_set1_pd( 2.52448340349684104192e-3 ) );
+	q = _mm256_add_pd( _mm256_mul_pd( q, z ),
+		_mm256_set1_pd( 2.27265548208155028766e-1 ) );
+	q = _mm256_add_pd( _mm256_mul_pd( q, z ),
+		_mm256_set1_pd( 2.00000000000000000009e0 ) );
+	r = _mm256_add_pd( _mm256_set1_pd( 1.0 ),
+		_mm256_mul_pd( _mm256_set1_pd( 2.0 ),
+			_mm256_div_pd( p, _mm256_sub_pd( q, p ) ) ) );
+
+	bits = _mm256_cvtepi32_epi64( _mm256_cvtpd_epi32( n ) );
+	bits = _mm256_slli_epi64( _mm256_add_epi64( bits,
+		_mm256_set1_epi64x( 1023 ) ), 52 );
+
+	return( _mm256_mul_pd( r, _mm256_castsi256_pd( bits ) ) );
+}
+
+/* Four pixels of dE00, see vips_dE00_fast() in colour/dE00.c.
+ */
+static inline __m256d AVX2
+dE00_4_avx2( __m256d L1, __m256d a1, __m256d b1,
+	__m256d L2, __m256d a2, __m256d b2 )
+{
+	const __m256d sign = _mm256_set1_pd( -0.0 );
+	const __m256d p257 = _mm256_set1_pd( 6103515625.0 );
+	const __m256d half = _mm256_set1_pd( 0.5 );
+	const __m256d one = _mm256_set1_pd( 1.0 );
+	const __m256d two = _mm256_set1_pd( 2.0 );
+
+	__m256d C1, C2, Cb, Cb7, G;
+	__m256d a1d, C1d, h1d, a2d, C2d, h2d;
+	__m256d Ldb, Cdb, dh;
+	__m256d hdb, hdbd, dtheta, Cdb7, RC, RT, T;
+	__m256d Ldb50, SL, SC, SH;
+	__m256d dhd, dLd, dCd, dHd;
+	__m256d nL, nC, nH;
+	__m256d s, c1, c2, c3, c4;
+	__m256d mask;
+
+#define POW7( X ) _mm256_mul_pd( _mm256_mul_pd( _mm256_mul_pd( \
+	_mm256_mul_pd( _mm256_mul_pd( _mm256_mul_pd( \
+		X, X ), X ), X ), X ), X ), X )
+#define HYPOT( A, B ) _mm256_sqrt_pd( _mm256_add_pd( \
+	_mm256_mul_pd( A, A ), _mm256_mul_pd( B, B ) ) )
+
+	C1 = HYPOT( a1, b1 );
+	C2 = HYPOT( a2, b2 );
+	Cb = _mm256_div_pd( _mm256_add_pd( C1, C2 ), two );
+	Cb7 = POW7( Cb );
+	G = _mm256_mul_pd( half, _mm256_sub_pd( one, _mm256_sqrt_pd(
+		_mm256_div_pd( Cb7, _mm256_add_pd( Cb7, p257 ) ) ) ) );
+
+	a1d = _mm256_mul_pd( _mm256_add_pd( one, G ), a1 );
+	C1d = HYPOT( a1d, b1 );
+	h1d = dE00_hue_avx2( a1d, b1 );
+
+	a2d = _mm256_mul_pd( _mm256_add_pd( one, G ), a2 );
+	C2d = HYPOT( a2d, b2 );
+	h2d = dE00_hue_avx2( a2d, b2 );
+
+	Ldb = _mm256_div_pd( _mm256_add_pd( L1, L2 ), two );
+	Cdb = _mm256_div_pd( _mm256_add_pd( C1d, C2d ), two );
+	dh = _mm256_sub_pd( h1d, h2d );
+
+	mask = _mm256_cmp_pd( _mm256_andnot_pd( sign, dh ),
+		_mm256_set1_pd( 180.0 ), _CMP_LT_OQ );
+	hdb = _mm256_blendv_pd(
+		_mm256_div_pd( _mm256_andnot_pd( sign, _mm256_sub_pd(
+			_mm256_add_pd( h1d, h2d ),
+			_mm256_set1_pd( 360.0 ) ) ), two ),
+		_mm256_div_pd( _mm256_add_pd( h1d, h2d ), two ),
+		mask );
+	dhd = _mm256_blendv_pd(
+		_mm256_sub_pd( _mm256_set1_pd( 360.0 ), dh ),
+		dh,
+		mask );
+
+	hdbd = _mm256_div_pd( _mm256_sub_pd( hdb, _mm256_set1_pd( 275.0 ) ),
+		_mm256_set1_pd( 25.0 ) );
+	dtheta = _mm256_mul_pd( _mm256_set1_pd( 30.0 ), dE00_exp_avx2(
+		_mm256_xor_pd( _mm256_mul_pd( hdbd, hdbd ), sign ) ) );
+	Cdb7 = POW7( Cdb );
+	RC = _mm256_mul_pd( two, _mm256_sqrt_pd(
+		_mm256_div_pd( Cdb7, _mm256_add_pd( Cdb7, p257 ) ) ) );
+
+	dE00_sincos_avx2( _mm256_mul_pd( two, dtheta ), &s, &c1 );
+	RT = _mm256_mul_pd( _mm256_xor_pd( s, sign ), RC );
+
+	dE00_sincos_avx2( _mm256_sub_pd( hdb, _mm256_set1_pd( 30.0 ) ),
+		&s, &c1 );
+	dE00_sincos_avx2( _mm256_mul_pd( two, hdb ), &s, &c2 );
+	dE00_sincos_avx2( _mm256_add_pd(
+		_mm256_mul_pd( _mm256_set1_pd( 3.0 ), hdb ),
+		_mm256_set1_pd( 6.0 ) ), &s, &c3 );
+	dE00_sincos_avx2( _mm256_sub_pd(
+		_mm256_mul_pd( _mm256_set1_pd( 4.0 ), hdb ),
+		_mm256_set1_pd( 63.0 ) ), &s, &c4 );
+	T = _mm256_sub_pd( one,
+		_mm256_mul_pd( _mm256_set1_pd( 0.17 ), c1 ) );
+	T = _mm256_add_pd( T, _mm256_mul_pd( _mm256_set1_pd( 0.24 ), c2 ) );
+	T = _mm256_add_pd( T, _mm256_mul_pd( _mm256_set1_pd( 0.32 ), c3 ) );
+	T = _mm256_sub_pd( T, _mm256_mul_pd( _mm256_set1_pd( 0.20 ), c4 ) );
+
+	Ldb50 = _mm256_sub_pd( Ldb, _mm256_set1_pd( 50.0 ) );
+	SL = _mm256_add_pd( one, _mm256_div_pd( _mm256_mul_pd( _mm256_mul_pd(
+		_mm256_set1_pd( 0.015 ), Ldb50 ), Ldb50 ),
+		_mm256_sqrt_pd( _mm256_add_pd( _mm256_set1_pd( 20.0 ),
+			_mm256_mul_pd( Ldb50, Ldb50 ) ) ) ) );
+	SC = _mm256_add_pd( one,
+		_mm256_mul_pd( _mm256_set1_pd( 0.045 ), Cdb ) );
+	SH = _mm256_add_pd( one, _mm256_mul_pd(
+		_mm256_mul_pd( _mm256_set1_pd( 0.015 ), Cdb ), T ) );
+
+	dE00_sincos_avx2( _mm256_div_pd( dhd, two ), &s, &c1 );
+	dLd = _mm256_sub_pd( L1, L2 );
+	dCd = _mm256_sub_pd( C1d, C2d );
+	dHd = _mm256_mul_pd( _mm256_mul_pd( two,
+		_mm256_sqrt_pd( _mm256_mul_pd( C1d, C2d ) ) ), s );
+
+	nL = _mm256_div_pd( dLd, SL );
+	nC = _mm256_div_pd( dCd, SC );
+	nH = _mm256_div_pd( dHd, SH );
+
+#undef POW7
+#undef HYPOT
+
+	return( _mm256_sqrt_pd( _mm256_add_pd( _mm256_add_pd( _mm256_add_pd(
+		_mm256_mul_pd( nL, nL ), _mm256_mul_pd( nC, nC ) ),
+		_mm256_mul_pd( nH, nH ) ),
+		_mm256_mul_pd( _mm256_mul_pd( RT, nC ), nH ) ) ) );
+}
+
+/* dE00 for width pairs of Lab pixels.
+ */
+static void AVX2
+dE00_avx2( float *out, const float *in1, const float *in2, int width )
+{
+	int x;
+
+	for( x = 0; x + 4 <= width; x += 4 ) {
+		const float *p1 = in1 + x * 3;
+		const float *p2 = in2 + x * 3;
+
+		__m256d dE;
+
+		dE = dE00_4_avx2(
+			_mm256_cvtps_pd( _mm_setr_ps(
+				p1[0], p1[3], p1[6], p1[9] ) ),
+			_mm256_cvtps_pd( _mm_setr_ps(
+				p1[1], p1[4], p1[7], p1[10] ) ),
+			_mm256_cvtps_pd( _mm_setr_ps(
+				p1[2], p1[5], p1[8], p1[11] ) ),
+			_mm256_cvtps_pd( _mm_setr_ps(
+				p2[0], p2[3], p2[6], p2[9] ) ),
+			_mm256_cvtps_pd( _mm_setr_ps(
+				p2[1], p2[4], p2[7], p2[10] ) ),
+			_mm256_cvtps_pd( _mm_setr_ps(
+				p2[2], p2[5], p2[8], p2[11] ) ) );
+		_mm_storeu_ps( out + x, _mm256_cvtpd_ps( dE ) );
+	}
+
+	if( x < width ) {
+		float t1[12] = { 0 };
+		float t2[12] = { 0 };
+		float o[4];
+
+		memcpy( t1, in1 + x * 3, (width - x) * 3 * sizeof( float ) );
+		memcpy( t2, in2 + x * 3, (width - x) * 3 * sizeof( float ) );
+		dE00_avx2( o, t1, t2, 4 );
+		memcpy( out + x, o, (width - x) * sizeof( float ) );
+	}
+}
+
+/* Deinterleave eight 3-band uchar pixels to int32.
+ */
+static inline void AVX2
+load3x8_avx2( const VipsPel *p, __m256i *a, __m256i *b, __m256i *c )
+{
+	__m128i lo = _mm_loadu_si128( (__m128i *) p );
+	__m128i hi = _mm_loadl_epi64( (__m128i *) (p + 16) );
+
+	*a = _mm256_cvtepu8_epi32( _mm_or_si128(
+		_mm_shuffle_epi8( lo, _mm_setr_epi8(
+			0, 3, 6, 9, 12, 15, -1, -1,
+			-1, -1, -1, -1, -1, -1, -1, -1 ) ),
+		_mm_shuffle_epi8( hi, _mm_setr_epi8(
+			-1, -1, -1, -1, -1, -1, 2, 5,
+			-1, -1, -1, -1, -1, -1, -1, -1 ) ) ) );
+	*b = _mm256_cvtepu8_epi32( _mm_or_si128(
+		_mm_shuffle_epi8( lo, _mm_setr_epi8(
+			1, 4, 7, 10, 13, -1, -1, -1,
+			-1, -1, -1, -1, -1, -1, -1, -1 ) ),
+		_mm_shuffle_epi8( hi, _mm_setr_epi8(
+			-1, -1, -1, -1, -1, 0, 3, 6,
+			-1, -1, -1, -1, -1, -1, -1, -1 ) ) ) );
+	*c = _mm256_cvtepu8_epi32( _mm_or_si128(
+		_mm_shuffle_epi8( lo, _mm_setr_epi8(
+			2, 5, 8, 11, 14, -1, -1, -1,
+			-1, -1, -1, -1, -1, -1, -1, -1 ) ),
+		_mm_shuffle_epi8( hi, _mm_setr_epi8(
+			-1, -1, -1, -1, -1, 1, 4, 7,
+			-1, -1, -1, -1, -1, -1, -1, -1 ) ) ) );
+}
+
+/* Eight int32 in 0 - 255 to eight bytes in the low half.
+ */
+static inline __m128i AVX2
+pack8_avx2( __m256i v )
+{
+	__m256i t;
+
+	t = _mm256_packus_epi32( v, v );
+	t = _mm256_packus_epi16( t, t );
+
+	return( _mm_unpacklo_epi32( _mm256_castsi256_si128( t ),
+		_mm256_extracti128_si256( t, 1 ) ) );
+}
+
+/* Interleave eight pixels of three int32 bands to 24 uchars.
+ */
+static inline void AVX2
+store3x8_avx2( VipsPel *q, __m256i a, __m256i b, __m256i c )
+{
+	__m128i ab = _mm_unpacklo_epi64( pack8_avx2( a ), pack8_avx2( b ) );
+	__m128i cc = pack8_avx2( c );
+
+	_mm_storeu_si128( (__m128i *) q, _mm_or_si128(
+		_mm_shuffle_epi8( ab, _mm_setr_epi8(
+			0, 8, -1, 1, 9, -1, 2, 10,
+			-1, 3, 11, -1, 4, 12, -1, 5 ) ),
+		_mm_shuffle_epi8( cc, _mm_setr_epi8(
+			-1, -1, 0, -1, -1, 1, -1, -1,
+			2, -1, -1, 3, -1, -1, 4, -1 ) ) ) );
+	_mm_storel_epi64( (__m128i *) (q + 16), _mm_or_si128(
+		_mm_shuffle_epi8( ab, _mm_setr_epi8(
+			13, -1, 6, 14, -1, 7, 15, -1,
+			-1, -1, -1, -1, -1, -1, -1, -1 ) ),
+		_mm_shuffle_epi8( cc, _mm_setr_epi8(
+			-1, 5, -1, -1, 6, -1, -1, 7,
+			-1, -1, -1, -1, -1, -1, -1, -1 ) ) ) );
+}
+
+/* Eight sRGB pixels to HSV, see vips_sRGB2HSV_line() in
+ * colour/sRGB2HSV.c. We compute all four cases and blend. Hue is found in
+ * double, like the C version, so we match it exactly. With @hue_only, we
+ * write just the hue.
+ */
+static inline void AVX2
+sRGB2HSV8_avx2( VipsPel *q, const VipsPel *p, gboolean hue_only )
+{
+	__m256i R, G, B;
+	__m256i mx, mn, delta;
+	__m256i a, b, c;
+	__m256i sd, wrap;
+	__m256 f;
+	__m128i lo, hi;
+	__m256i H, S;
+	__m256i zero;
+
+	load3x8_avx2( p, &R, &G, &B );
+
+	mx = _mm256_max_epi32( R, _mm256_max_epi32( G, B ) );
+	mn = _mm256_min_epi32( R, _mm256_min_epi32( G, B ) );
+	delta = _mm256_sub_epi32( mx, mn );
+
+	/* a is the top-level branch, b picks red or blue below it, c red or
+	 * green.
+	 */
+	a = _mm256_cmpgt_epi32( B, G );
+	b = _mm256_cmpgt_epi32( R, B );
+	c = _mm256_cmpgt_epi32( R, G );
+	sd = _mm256_blendv_epi8(
+		_mm256_blendv_epi8( _mm256_sub_epi32( B, R ),
+			_mm256_sub_epi32( G, B ), c ),
+		_mm256_blendv_epi8( _mm256_sub_epi32( R, G ),
+			_mm256_sub_epi32( G, B ), b ), a );
+	wrap = _mm256_blendv_epi8(
+		_mm256_blendv_epi8( _mm256_set1_epi32( 85 ),
+			_mm256_setzero_si256(), c ),
+		_mm256_blendv_epi8( _mm256_set1_epi32( 170 ),
+			_mm256_set1_epi32( 255 ), b ), a );
+
+	f = _mm256_div_ps( _mm256_cvtepi32_ps( sd ),
+		_mm256_cvtepi32_ps( delta ) );
+	lo = _mm256_cvttpd_epi32( _mm256_add_pd( _mm256_mul_pd(
+		_mm256_set1_pd( 42.5 ),
+		_mm256_cvtps_pd( _mm256_castps256_ps128( f ) ) ),
+		_mm256_cvtepi32_pd( _mm256_castsi256_si128( wrap ) ) ) );
+	hi = _mm256_cvttpd_epi32( _mm256_add_pd( _mm256_mul_pd(
+		_mm256_set1_pd( 42.5 ),
+		_mm256_cvtps_pd( _mm256_extractf128_ps( f, 1 ) ) ),
+		_mm256_cvtepi32_pd( _mm256_extracti128_si256( wrap, 1 ) ) ) );
+	H = _mm256_inserti128_si256( _mm256_castsi128_si256( lo ), hi, 1 );
+
+	/* Zero hue for grey, and everything for black. The divisions can
+	 * give junk there.
+	 */
+	zero = _mm256_setzero_si256();
+	H = _mm256_andnot_si256( _mm256_cmpeq_epi32( delta, zero ), H );
+	H = _mm256_andnot_si256( _mm256_cmpeq_epi32( mx, zero ), H );
+	if( hue_only ) {
+		_mm_storel_epi64( (__m128i *) q, pack8_avx2( H ) );
+
+		return;
+	}
+
+	S = _mm256_cvttps_epi32( _mm256_div_ps(
+		_mm256_cvtepi32_ps( _mm256_mullo_epi32( delta,
+			_mm256_set1_epi32( 255 ) ) ),
+		_mm256_cvtepi32_ps( mx ) ) );
+	S = _mm256_andnot_si256( _mm256_cmpeq_epi32( mx, zero ), S );
+
+	store3x8_avx2( q, H, S, mx );
+}
+
+static inline void AVX2
+sRGB2HSV_any_avx2( VipsPel *out, const VipsPel *in, int width,
+	gboolean hue_only )
+{
+	int ps = hue_only ? 1 : 3;
+	int x;
+
+	for( x = 0; x + 8 <= width; x += 8 )
+		sRGB2HSV8_avx2( out + x * ps, in + x * 3, hue_only );
+
+	if( x < width ) {
+		VipsPel t[24] = { 0 };
+		VipsPel o[24];
+
+		memcpy( t, in + x * 3, (width - x) * 3 );
+		sRGB2HSV8_avx2( o, t, hue_only );
+		memcpy( out + x * ps, o, (width - x) * ps );
+	}
+}
+
+static void AVX2
+sRGB2HSV_avx2( VipsPel *out, const VipsPel *in, int width )
+{
+	sRGB2HSV_any_avx2( out, in, width, FALSE );
+}
+
+static void AVX2
+sRGB2hue_avx2( VipsPel *out, const VipsPel *in, int width )
+{
+	sRGB2HSV_any_avx2( out, in, width, TRUE );
+}
+
+/* The C version of HSV2sRGB computes c and x in double and rounds to float.
+ */
+static inline __m128 AVX2
+HSV2sRGB_c_avx2( __m128i VS )
+{
+	return( _mm256_cvtpd_ps( _mm256_div_pd( _mm256_cvtepi32_pd( VS ),
+		_mm256_set1_pd( 255.0 ) ) ) );
+}
+
+static inline __m128 AVX2
+HSV2sRGB_x_avx2( __m128 c, __m128i H )
+{
+	__m256d t, r, y;
+
+	/* fmod( t, 2 ) for positive t. This is exact.
+	 */
+	t = _mm256_div_pd( _mm256_cvtepi32_pd( H ), _mm256_set1_pd( 42.5 ) );
+	r = _mm256_sub_pd( t, _mm256_mul_pd( _mm256_set1_pd( 2.0 ),
+		_mm256_floor_pd( _mm256_mul_pd( t,
+			_mm256_set1_pd( 0.5 ) ) ) ) );
+	y = _mm256_sub_pd( _mm256_set1_pd( 1.0 ), _mm256_andnot_pd(
+		_mm256_set1_pd( -0.0 ),
+		_mm256_sub_pd( r, _mm256_set1_pd( 1.0 ) ) ) );
+
+	return( _mm256_cvtpd_ps( _mm256_mul_pd( _mm256_cvtps_pd( c ), y ) ) );
+}
+
+/* Eight HSV pixels to sRGB, see vips_HSV2sRGB_line() in colour/HSV2sRGB.c.
+ * Each output is one of c + m, x + m or m, depending on the sextant.
+ */
+static inline void AVX2
+HSV2sRGB8_avx2( VipsPel *q, const VipsPel *p )
+{
+	__m256i H, S, V, VS;
+	__m256 c, x, m;
+	__m256 cm, xm;
+	__m256 g1, g2, g3, g4, g5;
+	__m256 s0, s1, s2, s3, s4, s5;
+	__m256 R, G, B;
+
+	load3x8_avx2( p, &H, &S, &V );
+	VS = _mm256_mullo_epi32( V, S );
+
+	c = _mm256_insertf128_ps( _mm256_castps128_ps256(
+		HSV2sRGB_c_avx2( _mm256_castsi256_si128( VS ) ) ),
+		HSV2sRGB_c_avx2( _mm256_extracti128_si256( VS, 1 ) ), 1 );
+	x = _mm256_insertf128_ps( _mm256_castps128_ps256(
+		HSV2sRGB_x_avx2( _mm256_castps256_ps128( c ),
+			_mm256_castsi256_si128( H ) ) ),
+		HSV2sRGB_x_avx2( _mm256_extractf128_ps( c, 1 ),
+			_mm256_extracti128_si256( H, 1 ) ), 1 );
+	m = _mm256_sub_ps( _mm256_cvtepi32_ps( V ), c );
+	cm = _mm256_add_ps( c, m );
+	xm = _mm256_add_ps( x, m );
+
+	/* H is an int, so H < 42.5 is H <= 42, and so on.
+	 */
+	g1 = _mm256_castsi256_ps(
+		_mm256_cmpgt_epi32( H, _mm256_set1_epi32( 42 ) ) );
+	g2 = _mm256_castsi256_ps(
+		_mm256_cmpgt_epi32( H, _mm256_set1_epi32( 84 ) ) );
+	g3 = _mm256_castsi256_ps(
+		_mm256_cmpgt_epi32( H, _mm256_set1_epi32( 127 ) ) );
+	g4 = _mm256_castsi256_ps(
+		_mm256_cmpgt_epi32( H, _mm256_set1_epi32( 169 ) ) );
+	g5 = _mm256_castsi256_ps(
+		_mm256_cmpgt_epi32( H, _mm256_set1_epi32( 212 ) ) );
+	s0 = _mm256_andnot_ps( g1, _mm256_castsi256_ps(
+		_mm256_set1_epi32( -1 ) ) );
+	s1 = _mm256_andnot_ps( g2, g1 );
+	s2 = _mm256_andnot_ps( g3, g2 );
+	s3 = _mm256_andnot_ps( g4, g3 );
+	s4 = _mm256_andnot_ps( g5, g4 );
+	s5 = g5;
+
+	R = _mm256_blendv_ps( m, cm, _mm256_or_ps( s0, s5 ) );
+	R = _mm256_blendv_ps( R, xm, _mm256_or_ps( s1, s4 ) );
+	G = _mm256_blendv_ps( m, cm, _mm256_or_ps( s1, s2 ) );
+	G = _mm256_blendv_ps( G, xm, _mm256_or_ps( s0, s3 ) );
+	B = _mm256_blendv_ps( m, cm, _mm256_or_ps( s3, s4 ) );
+	B = _mm256_blendv_ps( B, xm, _mm256_or_ps( s2, s5 ) );
+
+	store3x8_avx2( q, _mm256_cvttps_epi32( R ),
+		_mm256_cvttps_epi32( G ), _mm256_cvttps_epi32( B ) );
+}
+
+static void AVX2
+HSV2sRGB_avx2( VipsPel *out, const VipsPel *in, int width )
+{
+	int x;
+
+	for( x = 0; x + 8 <= width; x += 8 )
+		HSV2sRGB8_avx2( out + x * 3, in + x * 3 );
+
+	if( x < width ) {
+		VipsPel t[24] = { 0 };
+		VipsPel o[24];
+
+		memcpy( t, in + x * 3, (width - x) * 3 );
+		HSV2sRGB8_avx2( o, t );
+		memcpy( out + x * 3, o, (width - x) * 3 );
+	}
+}
+
+/* Transpose width x height pixels of ps bytes, see VipsSimdTransposeFn. The
+ * vector transposes use this for the edges.
+ */
+static void
+transpose_c( VipsPel *out, int out_lskip,
+	const VipsPel *in, int in_lskip, int width, int height, int ps )
+{
+	int i, j;
+
+	for( j = 0; j < height; j++ ) {
+		VipsPel *q = out + j * out_lskip;
+		const VipsPel *p = in + j * ps;
+
+		for( i = 0; i < width; i++ ) {
+			memcpy( q, p, ps );
+			q += ps;
+			p += in_lskip;
+		}
+	}
+}
+
+/* Transpose in N x N blocks. Interleaving row k with row k + N / 2 log2(N)
+ * times transposes the block.
+ */
+#define TRANSPOSE_SSE41( NAME, PS, N, LOG_N, TYPE ) \
+static void SSE41 \
+transpose_ ## NAME ## _sse41( VipsPel *out, int out_lskip, \
+	const VipsPel *in, int in_lskip, int width, int height ) \
+{ \
+	int wb = width - width % N; \
+	int hb = height - height % N; \
+	\
+	__m128i r[N]; \
+	__m128i t[N]; \
+	int i, j, k, s; \
+	\
+	for( j = 0; j < hb; j += N ) \
+		for( i = 0; i < wb; i += N ) { \
+			for( k = 0; k < N; k++ ) \
+				r[k] = _mm_loadu_si128( (__m128i *) \
+					(in + (i + k) * in_lskip + j * PS) ); \
+			\
+			for( s = 0; s < LOG_N; s++ ) { \
+				for( k = 0; k < N / 2; k++ ) { \
+					t[2 * k] = _mm_unpacklo_ ## TYPE( \
+						r[k], r[k + N / 2] ); \
+					t[2 * k + 1] = _mm_unpackhi_ ## TYPE( \
+						r[k], r[k + N / 2] ); \
+				} \
+				memcpy( r, t, sizeof( r ) ); \
+			} \
+			\
+			for( k = 0; k < N; k++ ) \
+				_mm_storeu_si128( (__m128i *) \
+					(out + (j + k) * out_lskip + i * PS), \
+					r[k] ); \
+		} \
+	\
+	transpose_c( out + wb * PS, out_lskip, in + wb * in_lskip, in_lskip, \
+		width - wb, hb, PS ); \
+	transpose_c( out + hb * out_lskip, out_lskip, in + hb * PS, in_lskip, \
+		width, height - hb, PS ); \
+}
+
+TRANSPOSE_SSE41( uchar, 1, 16, 4, epi8 )
+TRANSPOSE_SSE41( ushort, 2, 8, 3, epi16 )
+TRANSPOSE_SSE41( uint, 4, 4, 2, epi32 )
+TRANSPOSE_SSE41( double, 8, 2, 1, epi64 )
+
+/* 8 x 8 blocks of 4-byte pixels.
+ */
+static void AVX2
+transpose_uint_avx2( VipsPel *out, int out_lskip,
+	const VipsPel *in, int in_lskip, int width, int height )
+{
+	int wb = width & ~7;
+	int hb = height & ~7;
+
+	__m256 r[8];
+	__m256 t[8];
+	__m256 u[8];
+	int i, j, k;
+
+	for( j = 0; j < hb; j += 8 )
+		for( i = 0; i < wb; i += 8 ) {
+			for( k = 0; k < 8; k++ )
+				r[k] = _mm256_loadu_ps( (float *)
+					(in + (i + k) * in_lskip + j * 4) );
+
+			for( k = 0; k < 8; k += 2 ) {
+				t[k] = _mm256_unpacklo_ps( r[k], r[k + 1] );
+				t[k + 1] = _mm256_unpackhi_ps( r[k], r[k + 1] );
+			}
+
+			for( k = 0; k < 8; k += 4 ) {
+				u[k] = _mm256_shuffle_ps( t[k], t[k + 2],
+					0x44 );
+				u[k + 1] = _mm256_shuffle_ps( t[k], t[k + 2],
+					0xee );
+				u[k + 2] = _mm256_shuffle_ps( t[k + 1],
+					t[k + 3], 0x44 );
+				u[k + 3] = _mm256_shuffle_ps( t[k + 1],
+					t[k + 3], 0xee );
+			}
+
+			for( k = 0; k < 4; k++ ) {
+				r[k] = _mm256_permute2f128_ps( u[k], u[k + 4],
+					0x20 );
+				r[k + 4] = _mm256_permute2f128_ps( u[k],
+					u[k + 4], 0x31 );
+			}
+
+			for( k = 0; k < 8; k++ )
+				_mm256_storeu_ps( (float *)
+					(out + (j + k) * out_lskip + i * 4),
+					r[k] );
+		}
+
+	transpose_c( out + wb * 4, out_lskip, in + wb * in_lskip, in_lskip,
+		width - wb, hb, 4 );
+	transpose_c( out + hb * out_lskip, out_lskip, in + hb * 4, in_lskip,
+		width, height - hb, 4 );
+}
+
+/* 4 x 4 blocks of 8-byte pixels.
+ */
+static void AVX2
+transpose_double_avx2( VipsPel *out, int out_lskip,
+	const VipsPel *in, int in_lskip, int width, int height )
+{
+	int wb = width & ~3;
+	int hb = height & ~3;
+
+	__m256d r[4];
+	__m256d t[4];
+	int i, j, k;
+
+	for( j = 0; j < hb; j += 4 )
+		for( i = 0; i < wb; i += 4 ) {
+			for( k = 0; k < 4; k++ )
+				r[k] = _mm256_loadu_pd( (double *)
+					(in + (i + k) * in_lskip + j * 8) );
+
+			for( k = 0; k < 4; k += 2 ) {
+				t[k] = _mm256_unpacklo_pd( r[k], r[k + 1] );
+				t[k + 1] = _mm256_unpackhi_pd( r[k], r[k + 1] );
+			}
+
+			for( k = 0; k < 2; k++ ) {
+				r[k] = _mm256_permute2f128_pd( t[k], t[k + 2],
+					0x20 );
+				r[k + 2] = _mm256_permute2f128_pd( t[k],
+					t[k + 2], 0x31 );
+			}
+
+			for( k = 0; k < 4; k++ )
+				_mm256_storeu_pd( (double *)
+					(out + (j + k) * out_lskip + i * 8),
+					r[k] );
+		}
+
+	transpose_c( out + wb * 8, out_lskip, in + wb * in_lskip, in_lskip,
+		width - wb, hb, 8 );
+	transpose_c( out + hb * out_lskip, out_lskip, in + hb * 8, in_lskip,
+		width, height - hb, 8 );
+}
+
+/* Reverse the pixels in each 16-byte vector with a byte shuffle, and walk
+ * the vectors backwards.
+ */
+static inline void SSE41
+flip_any_sse41( VipsPel *out, const VipsPel *in, int width, int ps,
+	__m128i mask )
+{
+	int n = width * ps;
+
+	int x;
+
+	for( x = 0; x + 16 <= n; x += 16 )
+		_mm_storeu_si128( (__m128i *) (out + x), _mm_shuffle_epi8(
+			_mm_loadu_si128( (__m128i *) (in + n - x - 16) ),
+			mask ) );
+
+	for( ; x < n; x += ps )
+		memcpy( out + x, in + n - x - ps, ps );
+}
+
+/* The same, 32 bytes at a time. The shuffle works within each 128-bit lane,
+ * so we swap the lanes afterwards.
+ */
+static inline void AVX2
+flip_any_avx2( VipsPel *out, const VipsPel *in, int width, int ps,
+	__m128i mask )
+{
+	__m256i mask2 = _mm256_broadcastsi128_si256( mask );
+	int n = width * ps;
+
+	int x;
+
+	for( x = 0; x + 32 <= n; x += 32 )
+		_mm256_storeu_si256( (__m256i *) (out + x),
+			_mm256_permute4x64_epi64( _mm256_shuffle_epi8(
+				_mm256_loadu_si256( (__m256i *)
+					(in + n - x - 32) ),
+				mask2 ), 0x4e ) );
+
+	flip_any_sse41( out + x, in, width - x / ps, ps, mask );
+}
+
+#define FLIP_MASK_UCHAR _mm_setr_epi8( \
+	15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0 )
+#define FLIP_MASK_USHORT _mm_setr_epi8( \
+	14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1 )
+#define FLIP_MASK_UINT _mm_setr_epi8( \
+	12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3 )
+#define FLIP_MASK_DOUBLE _mm_setr_epi8( \
+	8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7 )
+
+static void SSE41
+flip_uchar_sse41( VipsPel *out, const VipsPel *in, int width )
+{
+	flip_any_sse41( out, in, width, 1, FLIP_MASK_UCHAR );
+}
+
+static void SSE41
+flip_ushort_sse41( VipsPel *out, const VipsPel *in, int width )
+{
+	flip_any_sse41( out, in, width, 2, FLIP_MASK_USHORT );
+}
+
+static void SSE41
+flip_uint_sse41( VipsPel *out, const VipsPel *in, int width )
+{
+	flip_any_sse41( out, in, width, 4, FLIP_MASK_UINT );
+}
+
+static void SSE41
+flip_double_sse41( VipsPel *out, const VipsPel *in, int width )
+{
+	flip_any_sse41( out, in, width, 8, FLIP_MASK_DOUBLE );
+}
+
+static void AVX2
+flip_uchar_avx2( VipsPel *out, const VipsPel *in, int width )
+{
+	flip_any_avx2( out, in, width, 1, FLIP_MASK_UCHAR );
+}
+
+static void AVX2
+flip_ushort_avx2( VipsPel *out, const VipsPel *in, int width )
+{
+	flip_any_avx2( out, in, width, 2, FLIP_MASK_USHORT );
+}
+
+static void AVX2
+flip_uint_avx2( VipsPel *out, const VipsPel *in, int width )
+{
+	flip_any_avx2( out, in, width, 4, FLIP_MASK_UINT );
+}
+
+static void AVX2
+flip_double_avx2( VipsPel *out, const VipsPel *in, int width )
+{
+	flip_any_avx2( out, in, width, 8, FLIP_MASK_DOUBLE );
+}
+
+/* n 3- or 4-band uchar pixels, each made from the 2x2 at in[i] with four
+ * fixed-point coefficients, see BILINEAR_INT() in resample/interpolate.c.
+ */
+static void SSE41
+bilinear_uchar_sse41( VipsPel *out, const VipsPel **in, int n,
+	int bands, int lskip, const int *coeff )
+{
+	const __m128i round = _mm_set1_epi32( ROUND_BY );
+
+	int i;
+
+	for( i = 0; i < n; i++ ) {
+		const VipsPel *p1 = in[i];
+		const VipsPel *p3 = p1 + lskip;
+		const int *c = coeff + i * 4;
+
+		__m128i top = _mm_madd_epi16(
+			REDUCEH_PAIR_UCHAR(
+				load_pel_uchar( p1, bands ),
+				load_pel_uchar( p1 + bands, bands ) ),
+			_mm_set1_epi32( REDUCEH_COEFF_UCHAR( c[0], c[1] ) ) );
+		__m128i bottom = _mm_madd_epi16(
+			REDUCEH_PAIR_UCHAR(
+				load_pel_uchar( p3, bands ),
+				load_pel_uchar( p3 + bands, bands ) ),
+			_mm_set1_epi32( REDUCEH_COEFF_UCHAR( c[2], c[3] ) ) );
+		__m128i sum = _mm_srai_epi32(
+			_mm_add_epi32( _mm_add_epi32( top, bottom ), round ),
+			VIPS_INTERPOLATE_SHIFT );
+
+		sum = _mm_packus_epi32( sum, sum );
+		store_pel_uchar( out + i * bands,
+			_mm_packus_epi16( sum, sum ), bands );
+	}
+}
+
+/* One rounded row of a 4x4 bicubic, see bicubic_unsigned_int() in
+ * resample/templates.h.
+ */
+static inline __m128i SSE41
+bicubic_uchar_row_sse41( const VipsPel *p, int bands,
+	__m128i c01, __m128i c23 )
+{
+	__m128i a = _mm_madd_epi16(
+		REDUCEH_PAIR_UCHAR(
+			load_pel_uchar( p, bands ),
+			load_pel_uchar( p + bands, bands ) ), c01 );
+	__m128i b = _mm_madd_epi16(
+		REDUCEH_PAIR_UCHAR(
+			load_pel_uchar( p + 2 * bands, bands ),
+			load_pel_uchar( p + 3 * bands, bands ) ), c23 );
+
+	return( _mm_srai_epi32(
+		_mm_add_epi32( _mm_add_epi32( a, b ),
+			_mm_set1_epi32( ROUND_BY ) ),
+		VIPS_INTERPOLATE_SHIFT ) );
+}
+
+/* n 3- or 4-band uchar pixels, each made from the 4x4 with top-left at
+ * in[i] and masks cx[i] and cy[i].
+ */
+static void SSE41
+bicubic_uchar_sse41( VipsPel *out, const VipsPel **in, int n,
+	int bands, int lskip, const int **cx, const int **cy )
+{
+	int i, j;
+
+	for( i = 0; i < n; i++ ) {
+		const int *x = cx[i];
+		const int *y = cy[i];
+		const __m128i c01 =
+			_mm_set1_epi32( REDUCEH_COEFF_UCHAR( x[0], x[1] ) );
+		const __m128i c23 =
+			_mm_set1_epi32( REDUCEH_COEFF_UCHAR( x[2], x[3] ) );
+
+		__m128i sum;
+
+		sum = _mm_setzero_si128();
+		for( j = 0; j < 4; j++ ) {
+			__m128i r = bicubic_uchar_row_sse41( in[i] + j * lskip,
+				bands, c01, c23 );
+
+			sum = _mm_add_epi32( sum,
+				_mm_mullo_epi32( r, _mm_set1_epi32( y[j] ) ) );
+		}
+		sum = _mm_srai_epi32(
+			_mm_add_epi32( sum, _mm_set1_epi32( ROUND_BY ) ),
+			VIPS_INTERPOLATE_SHIFT );
+
+		/* packus clips to 0 - 255 for us.
+		 */
+		sum = _mm_packus_epi32( sum, sum );
+		store_pel_uchar( out + i * bands,
+			_mm_packus_epi16( sum, sum ), bands );
+	}
+}
+
+/* Elementwise max and min of two lines of uchar, for the van Herk running
+ * max and min in morphology/morph.c.
+ */
+#define MINMAX_X86( NAME, C ) \
+static void SSE41 \
+NAME ## _uchar_sse41( VipsPel *out, \
+	const VipsPel *a, const VipsPel *b, int n ) \
+{ \
+	int x; \
+	\
+	for( x = 0; x + 16 <= n; x += 16 ) \
+		_mm_storeu_si128( (__m128i *) (out + x), \
+			_mm_ ## NAME ## _epu8( \
+				_mm_loadu_si128( (__m128i *) (a + x) ), \
+				_mm_loadu_si128( (__m128i *) (b + x) ) ) ); \
+	\
+	for( ; x < n; x++ ) \
+		out[x] = C( a[x], b[x] ); \
+} \
+\
+static void AVX2 \
+NAME ## _uchar_avx2( VipsPel *out, \
+	const VipsPel *a, const VipsPel *b, int n ) \
+{ \
+	int x; \
+	\
+	for( x = 0; x + 32 <= n; x += 32 ) \
+		_mm256_storeu_si256( (__m256i *) (out + x), \
+			_mm256_ ## NAME ## _epu8( \
+				_mm256_loadu_si256( (__m256i *) (a + x) ), \
+				_mm256_loadu_si256( (__m256i *) (b + x) ) ) ); \
+	\
+	NAME ## _uchar_sse41( out + x, a + x, b + x, n - x ); \
+}
+
+MINMAX_X86( max, VIPS_MAX )
+MINMAX_X86( min, VIPS_MIN )
+
+/* Relational ops, for arithmetic/relational.c. Each block of 16 elements
+ * gives 16 bytes of 0/255 mask. There are no unsigned compares, so we go
+ * through min and max: a <= b is min(a, b) == a. Float compares are
+ * ordered except for !=, as in C, so NaN behaves the same.
+ */
+#define REL_U8_EQUAL( A, B ) _mm_cmpeq_epi8( A, B )
+#define REL_U8_NOTEQ( A, B ) _mm_xor_si128( _mm_cmpeq_epi8( A, B ), ones )
+#define REL_U8_LESS( A, B ) \
+	_mm_xor_si128( _mm_cmpeq_epi8( _mm_max_epu8( A, B ), A ), ones )
+#define REL_U8_LESSEQ( A, B ) _mm_cmpeq_epi8( _mm_min_epu8( A, B ), A )
+#define REL_U8_MORE( A, B ) REL_U8_LESS( B, A )
+#define REL_U8_MOREEQ( A, B ) REL_U8_LESSEQ( B, A )
+
+#define REL_U16_EQUAL( A, B ) _mm_cmpeq_epi16( A, B )
+#define REL_U16_NOTEQ( A, B ) _mm_xor_si128( _mm_cmpeq_epi16( A, B ), ones )
+#define REL_U16_LESS( A, B ) \
+	_mm_xor_si128( _mm_cmpeq_epi16( _mm_max_epu16( A, B ), A ), ones )
+#define REL_U16_LESSEQ( A, B ) _mm_cmpeq_epi16( _mm_min_epu16( A, B ), A )
+#define REL_U16_MORE( A, B ) REL_U16_LESS( B, A )
+#define REL_U16_MOREEQ( A, B ) REL_U16_LESSEQ( B, A )
+
+#define REL_F32_EQUAL( A, B ) _mm_castps_si128( _mm_cmpeq_ps( A, B ) )
+#define REL_F32_NOTEQ( A, B ) _mm_castps_si128( _mm_cmpneq_ps( A, B ) )
+#define REL_F32_LESS( A, B ) _mm_castps_si128( _mm_cmplt_ps( A, B ) )
+#define REL_F32_LESSEQ( A, B ) _mm_castps_si128( _mm_cmple_ps( A, B ) )
+#define REL_F32_MORE( A, B ) _mm_castps_si128( _mm_cmpgt_ps( A, B ) )
+#define REL_F32_MOREEQ( A, B ) _mm_castps_si128( _mm_cmpge_ps( A, B ) )
+
+/* 16 results from a and b (or the constant vector vc), packing the masks
+ * down to bytes. packs keeps -1 as -1, so the masks survive.
+ */
+#define REL16_UCHAR( OP ) \
+	REL_U8_ ## OP( _mm_loadu_si128( (__m128i *) (a + x) ), \
+		b ? _mm_loadu_si128( (__m128i *) (b + x) ) : vc )
+
+#define REL16_USHORT( OP ) \
+	_mm_packs_epi16( \
+		REL_U16_ ## OP( \
+			_mm_loadu_si128( (__m128i *) (ta + x) ), \
+			tb ? _mm_loadu_si128( (__m128i *) (tb + x) ) : vc ), \
+		REL_U16_ ## OP( \
+			_mm_loadu_si128( (__m128i *) (ta + x + 8) ), \
+			tb ? \
+				_mm_loadu_si128( (__m128i *) (tb + x + 8) ) : \
+				vc ) )
+
+#define REL4_FLOAT( OP, I ) \
+	REL_F32_ ## OP( _mm_loadu_ps( ta + x + I ), \
+		tb ? _mm_loadu_ps( tb + x + I ) : vc )
+
+#define REL16_FLOAT( OP ) \
+	_mm_packs_epi16( \
+		_mm_packs_epi32( REL4_FLOAT( OP, 0 ), REL4_FLOAT( OP, 4 ) ), \
+		_mm_packs_epi32( REL4_FLOAT( OP, 8 ), REL4_FLOAT( OP, 12 ) ) )
+
+#define REL_LOOP( REL16, OP, C ) { \
+	for( x = 0; x + 16 <= n; x += 16 ) \
+		_mm_storeu_si128( (__m128i *) (out + x), REL16( OP ) ); \
+	\
+	for( ; x < n; x++ ) \
+		out[x] = (ta[x] C (tb ? tb[x] : tc)) ? 255 : 0; \
+}
+
+#define REL_SWITCH( REL16 ) { \
+	switch( op ) { \
+	case VIPS_OPERATION_RELATIONAL_EQUAL: \
+		REL_LOOP( REL16, EQUAL, == ); \
+		break; \
+	\
+	case VIPS_OPERATION_RELATIONAL_NOTEQ: \
+		REL_LOOP( REL16, NOTEQ, != ); \
+		break; \
+	\
+	case VIPS_OPERATION_RELATIONAL_LESS: \
+		REL_LOOP( REL16, LESS, < ); \
+		break; \
+	\
+	case VIPS_OPERATION_RELATIONAL_LESSEQ: \
+		REL_LOOP( REL16, LESSEQ, <= ); \
+		break; \
+	\
+	case VIPS_OPERATION_RELATIONAL_MORE: \
+		REL_LOOP( REL16, MORE, > ); \
+		break; \
+	\
+	case VIPS_OPERATION_RELATIONAL_MOREEQ: \
+		REL_LOOP( REL16, MOREEQ, >= ); \
+		break; \
+	\
+	default: \
+		g_assert_not_reached(); \
+	} \
+}
+
+static void SSE41
+relational_uchar_sse41( VipsPel *out,
+	const VipsPel *a, const VipsPel *b, const VipsPel *c, int n,
+	VipsOperationRelational op )
+{
+	const VipsPel *ta = a;
+	const VipsPel *tb = b;
+	const VipsPel tc = b ? 0 : *c;
+	const __m128i vc = _mm_set1_epi8( (char) tc );
+	const __m128i ones = _mm_set1_epi8( -1 );
+
+	int x;
+
+	REL_SWITCH( REL16_UCHAR );
+}
+
+static void SSE41
+relational_ushort_sse41( VipsPel *out,
+	const VipsPel *a, const VipsPel *b, const VipsPel *c, int n,
+	VipsOperationRelational op )
+{
+	const unsigned short *ta = (const unsigned short *) a;
+	const unsigned short *tb = (const unsigned short *) b;
+	const unsigned short tc = b ? 0 : *((const unsigned short *) c);
+	const __m128i vc = _mm_set1_epi16( (short) tc );
+	const __m128i ones = _mm_set1_epi8( -1 );
+
+	int x;
+
+	REL_SWITCH( REL16_USHORT );
+}
+
+static void SSE41
+relational_float_sse41( VipsPel *out,
+	const VipsPel *a, const VipsPel *b, const VipsPel *c, int n,
+	VipsOperationRelational op )
+{
+	const float *ta = (const float *) a;
+	const float *tb = (const float *) b;
+	const float tc = b ? 0 : *((const float *) c);
+	const __m128 vc = _mm_set1_ps( tc );
+
+	int x;
+
+	REL_SWITCH( REL16_FLOAT );
+}
+
+/* Bitwise and, or and eor, for arithmetic/boolean.c. These work on bytes,
+ * so they are good for any integer format.
+ */
+#define BOOL_SWITCH( N, LOAD, STORE, SET1, AND, OR, XOR ) { \
+	const VipsPel cc = b ? 0 : *c; \
+	\
+	int x; \
+	\
+	x = 0; \
+	switch( op ) { \
+	case VIPS_OPERATION_BOOLEAN_AND: \
+		BOOL_LOOP( N, LOAD, STORE, SET1, AND ); \
+		break; \
+	\
+	case VIPS_OPERATION_BOOLEAN_OR: \
+		BOOL_LOOP( N, LOAD, STORE, SET1, OR ); \
+		break; \
+	\
+	case VIPS_OPERATION_BOOLEAN_EOR: \
+		BOOL_LOOP( N, LOAD, STORE, SET1, XOR ); \
+		break; \
+	\
+	default: \
+		g_assert_not_reached(); \
+	} \
+	\
+	for( ; x < n; x++ ) { \
+		VipsPel r = b ? b[x] : cc; \
+		\
+		switch( op ) { \
+		case VIPS_OPERATION_BOOLEAN_AND: out[x] = a[x] & r; break; \
+		case VIPS_OPERATION_BOOLEAN_OR: out[x] = a[x] | r; break; \
+		default: out[x] = a[x] ^ r; break; \
+		} \
+	} \
+}
+
+#define BOOL_LOOP( N, LOAD, STORE, SET1, OP ) { \
+	if( b ) \
+		for( ; x + N <= n; x += N ) \
+			STORE( (void *) (out + x), \
+				OP( LOAD( (void *) (a + x) ), \
+					LOAD( (void *) (b + x) ) ) ); \
+	else \
+		for( ; x + N <= n; x += N ) \
+			STORE( (void *) (out + x), \
+				OP( LOAD( (void *) (a + x) ), \
+					SET1( (char) cc ) ) ); \
+}
+
+static void SSE41
+boolean_uchar_sse41( VipsPel *out,
+	const VipsPel *a, const VipsPel *b, const VipsPel *c, int n,
+	VipsOperationBoolean op )
+{
+	BOOL_SWITCH( 16,
+		_mm_loadu_si128, _mm_storeu_si128, _mm_set1_epi8,
+		_mm_and_si128, _mm_or_si128, _mm_xor_si128 );
+}
+
+static void AVX2
+boolean_uchar_avx2( VipsPel *out,
+	const VipsPel *a, const VipsPel *b, const VipsPel *c, int n,
+	VipsOperationBoolean op )
+{
+	BOOL_SWITCH( 32,
+		_mm256_loadu_si256, _mm256_storeu_si256, _mm256_set1_epi8,
+		_mm256_and_si256, _mm256_or_si256, _mm256_xor_si256 );
+}
+
+/* Find runs of pels equal or not equal to a value, for the flood fill in
+ * draw/draw_flood.c. We compare whole pels as 1, 2 or 4 byte elements,
+ * then use the byte mask to find the first pel that stops the run.
+ */
+#define SPAN_X86( NAME, S, CMP128, SET128, CMP256, SET256, TYPE ) \
+static int SSE41 \
+span_ ## NAME ## _sse41( const VipsPel *p, int n, \
+	const VipsPel *value, gboolean equal ) \
+{ \
+	TYPE v; \
+	__m128i vv; \
+	unsigned int flip = equal ? 0xffff : 0; \
+	int x; \
+	\
+	memcpy( &v, value, S ); \
+	vv = SET128( v ); \
+	\
+	for( x = 0; x + 16 / S <= n; x += 16 / S ) { \
+		__m128i c = CMP128( \
+			_mm_loadu_si128( (__m128i *) (p + x * S) ), vv ); \
+		unsigned int stop = _mm_movemask_epi8( c ) ^ flip; \
+		\
+		if( stop ) \
+			return( x + __builtin_ctz( stop ) / S ); \
+	} \
+	\
+	for( ; x < n; x++ ) \
+		if( (memcmp( p + x * S, value, S ) == 0) != equal ) \
+			break; \
+	\
+	return( x ); \
+} \
+\
+static int SSE41 \
+span_back_ ## NAME ## _sse41( const VipsPel *p, int n, \
+	const VipsPel *value, gboolean equal ) \
+{ \
+	TYPE v; \
+	__m128i vv; \
+	unsigned int flip = equal ? 0xffff : 0; \
+	int x; \
+	\
+	memcpy( &v, value, S ); \
+	vv = SET128( v ); \
+	\
+	/* Each block ends with the pel x steps down from p. \
+	 */ \
+	for( x = 0; x + 16 / S <= n; x += 16 / S ) { \
+		__m128i c = CMP128( _mm_loadu_si128( \
+			(__m128i *) (p - x * S - 16 + S) ), vv ); \
+		unsigned int stop = _mm_movemask_epi8( c ) ^ flip; \
+		\
+		if( stop ) \
+			return( x + 16 / S - 1 - \
+				(31 - __builtin_clz( stop )) / S ); \
+	} \
+	\
+	for( ; x < n; x++ ) \
+		if( (memcmp( p - x * S, value, S ) == 0) != equal ) \
+			break; \
+	\
+	return( x ); \
+} \
+\
+static int AVX2 \
+span_ ## NAME ## _avx2( const VipsPel *p, int n, \
+	const VipsPel *value, gboolean equal ) \
+{ \
+	TYPE v; \
+	__m256i vv; \
+	unsigned int flip = equal ? 0xffffffff : 0; \
+	int x; \
+	\
+	memcpy( &v, value, S ); \
+	vv = SET256( v ); \
+	\
+	for( x = 0; x + 32 / S <= n; x += 32 / S ) { \
+		__m256i c = CMP256( \
+			_mm256_loadu_si256( (__m256i *) (p + x * S) ), vv ); \
+		unsigned int stop = \
+			(unsigned int) _mm256_movemask_epi8( c ) ^ flip; \
+		\
+		if( stop ) \
+			return( x + __builtin_ctz( stop ) / S ); \
+	} \
+	\
+	return( x + span_ ## NAME ## _sse41( p + x * S, n - x, \
+		value, equal ) ); \
+} \
+\
+static int AVX2 \
+span_back_ ## NAME ## _avx2( const VipsPel *p, int n, \
+	const VipsPel *value, gboolean equal ) \
+{ \
+	TYPE v; \
+	__m256i vv; \
+	unsigned int flip = equal ? 0xffffffff : 0; \
+	int x; \
+	\
+	memcpy( &v, value, S ); \
+	vv = SET256( v ); \
+	\
+	for( x = 0; x + 32 / S <= n; x += 32 / S ) { \
+		__m256i c = CMP256( _mm256_loadu_si256( \
+			(__m256i *) (p - x * S - 32 + S) ), vv ); \
+		unsigned int stop = \
+			(unsigned int) _mm256_movemask_epi8( c ) ^ flip; \
+		\
+		if( stop ) \
+			return( x + 32 / S - 1 - \
+				(31 - __builtin_clz( stop )) / S ); \
+	} \
+	\
+	return( x + span_back_ ## NAME ## _sse41( p - x * S, n - x, \
+		value, equal ) ); \
+}
+
+SPAN_X86( uchar, 1, _mm_cmpeq_epi8, _mm_set1_epi8,
+	_mm256_cmpeq_epi8, _mm256_set1_epi8, unsigned char )
+SPAN_X86( ushort, 2, _mm_cmpeq_epi16, _mm_set1_epi16,
+	_mm256_cmpeq_epi16, _mm256_set1_epi16, unsigned short )
+SPAN_X86( uint, 4, _mm_cmpeq_epi32, _mm_set1_epi32,
+	_mm256_cmpeq_epi32, _mm256_set1_epi32, unsigned int )
+
+/* Look up 16 indexes in a 32-entry table with a shuffle for each half and
+ * a blend on bit 4.
+ */
+static inline __m128i SSE41
+lut32_sse41( __m128i v, __m128i t0, __m128i t1, __m128i vclip )
+{
+	__m128i index = _mm_min_epu8( v, vclip );
+	__m128i hi = _mm_cmpgt_epi8( index, _mm_set1_epi8( 15 ) );
+
+	return( _mm_blendv_epi8( _mm_shuffle_epi8( t0, index ),
+		_mm_shuffle_epi8( t1, index ), hi ) );
+}
+
+static void SSE41
+lut32_uchar_sse41( VipsPel *out, const VipsPel *in, int n,
+	const VipsPel *table, int clip )
+{
+	__m128i t0 = _mm_loadu_si128( (__m128i *) table );
+	__m128i t1 = _mm_loadu_si128( (__m128i *) (table + 16) );
+	__m128i vclip = _mm_set1_epi8( clip );
+
+	int x;
+
+	for( x = 0; x + 16 <= n; x += 16 )
+		_mm_storeu_si128( (__m128i *) (out + x), lut32_sse41(
+			_mm_loadu_si128( (__m128i *) (in + x) ),
+			t0, t1, vclip ) );
+
+	for( ; x < n; x++ )
+		out[x] = table[VIPS_MIN( in[x], clip )];
+}
+
+/* The same, 32 at a time. The shuffle works within each lane, so we need
+ * the table in both lanes.
+ */
+static void AVX2
+lut32_uchar_avx2( VipsPel *out, const VipsPel *in, int n,
+	const VipsPel *table, int clip )
+{
+	__m256i t0 = _mm256_broadcastsi128_si256(
+		_mm_loadu_si128( (__m128i *) table ) );
+	__m256i t1 = _mm256_broadcastsi128_si256(
+		_mm_loadu_si128( (__m128i *) (table + 16) ) );
+	__m256i vclip = _mm256_set1_epi8( clip );
+	__m256i v15 = _mm256_set1_epi8( 15 );
+
+	int x;
+
+	for( x = 0; x + 32 <= n; x += 32 ) {
+		__m256i index = _mm256_min_epu8(
+			_mm256_loadu_si256( (__m256i *) (in + x) ), vclip );
+		__m256i hi = _mm256_cmpgt_epi8( index, v15 );
+
+		_mm256_storeu_si256( (__m256i *) (out + x),
+			_mm256_blendv_epi8( _mm256_shuffle_epi8( t0, index ),
+				_mm256_shuffle_epi8( t1, index ), hi ) );
+	}
+
+	lut32_uchar_sse41( out + x, in + x, n - x, table, clip );
+}
+
+/* Blend lines for mosaicing/im_lrmerge.c and im_tbmerge.c. The int forms
+ * need no rounding: the coefficients are <= 4096 and non-negative, so the
+ * divides are shifts.
+ */
+static inline __m128i SSE41
+blend_epi32_sse41( __m128i a, __m128i b, const int *c1, const int *c2 )
+{
+	__m128i t1 = _mm_mullo_epi32( a,
+		_mm_loadu_si128( (__m128i *) c1 ) );
+	__m128i t2 = _mm_mullo_epi32( b,
+		_mm_loadu_si128( (__m128i *) c2 ) );
+
+	return( _mm_add_epi32( _mm_srli_epi32( t1, 12 ),
+		_mm_srli_epi32( t2, 12 ) ) );
+}
+
+static void SSE41
+blend_uchar_sse41( VipsPel *out, const VipsPel *a, const VipsPel *b, int n,
+	const void *vc1, const void *vc2 )
+{
+	const int *c1 = (const int *) vc1;
+	const int *c2 = (const int *) vc2;
+
+	int x;
+
+	for( x = 0; x + 16 <= n; x += 16 ) {
+		__m128i va = _mm_loadu_si128( (__m128i *) (a + x) );
+		__m128i vb = _mm_loadu_si128( (__m128i *) (b + x) );
+		__m128i r[4];
+		int i;
+
+		for( i = 0; i < 4; i++ ) {
+			r[i] = blend_epi32_sse41(
+				_mm_cvtepu8_epi32( va ),
+				_mm_cvtepu8_epi32( vb ),
+				c1 + x + i * 4, c2 + x + i * 4 );
+			va = _mm_srli_si128( va, 4 );
+			vb = _mm_srli_si128( vb, 4 );
+		}
+
+		_mm_storeu_si128( (__m128i *) (out + x),
+			_mm_packus_epi16( _mm_packus_epi32( r[0], r[1] ),
+				_mm_packus_epi32( r[2], r[3] ) ) );
+	}
+
+	for( ; x < n; x++ )
+		out[x] = c1[x] * a[x] / 4096 + c2[x] * b[x] / 4096;
+}
+
+static void SSE41
+blend_ushort_sse41( VipsPel *vout,
+	const VipsPel *va, const VipsPel *vb, int n,
+	const void *vc1, const void *vc2 )
+{
+	unsigned short *out = (unsigned short *) vout;
+	const unsigned short *a = (const unsigned short *) va;
+	const unsigned short *b = (const unsigned short *) vb;
+	const int *c1 = (const int *) vc1;
+	const int *c2 = (const int *) vc2;
+
+	int x;
+
+	for( x = 0; x + 8 <= n; x += 8 ) {
+		__m128i pa = _mm_loadu_si128( (__m128i *) (a + x) );
+		__m128i pb = _mm_loadu_si128( (__m128i *) (b + x) );
+		__m128i r0 = blend_epi32_sse41(
+			_mm_cvtepu16_epi32( pa ), _mm_cvtepu16_epi32( pb ),
+			c1 + x, c2 + x );
+		__m128i r1 = blend_epi32_sse41(
+			_mm_cvtepu16_epi32( _mm_srli_si128( pa, 8 ) ),
+			_mm_cvtepu16_epi32( _mm_srli_si128( pb, 8 ) ),
+			c1 + x + 4, c2 + x + 4 );
+
+		_mm_storeu_si128( (__m128i *) (out + x),
+			_mm_packus_epi32( r0, r1 ) );
+	}
+
+	for( ; x < n; x++ )
+		out[x] = c1[x] * a[x] / 4096 + c2[x] * b[x] / 4096;
+}
+
+/* Two doubles, with the selects for the zero coefficients.
+ */
+static inline __m128d SSE41
+blend_pd_sse41( __m128d a, __m128d b, const double *c1, const double *c2 )
+{
+	__m128d zero = _mm_setzero_pd();
+	__m128d vc1 = _mm_loadu_pd( c1 );
+	__m128d vc2 = _mm_loadu_pd( c2 );
+	__m128d r = _mm_add_pd( _mm_mul_pd( vc1, a ), _mm_mul_pd( vc2, b ) );
+
+	r = _mm_blendv_pd( r, b, _mm_cmpeq_pd( vc1, zero ) );
+
+	return( _mm_blendv_pd( r, a, _mm_cmpeq_pd( vc2, zero ) ) );
+}
+
+static void SSE41
+blend_float_sse41( VipsPel *vout,
+	const VipsPel *va, const VipsPel *vb, int n,
+	const void *vc1, const void *vc2 )
+{
+	float *out = (float *) vout;
+	const float *a = (const float *) va;
+	const float *b = (const float *) vb;
+	const double *c1 = (const double *) vc1;
+	const double *c2 = (const double *) vc2;
+
+	int x;
+
+	for( x = 0; x + 4 <= n; x += 4 ) {
+		__m128 pa = _mm_loadu_ps( a + x );
+		__m128 pb = _mm_loadu_ps( b + x );
+		__m128d lo = blend_pd_sse41(
+			_mm_cvtps_pd( pa ), _mm_cvtps_pd( pb ),
+			c1 + x, c2 + x );
+		__m128d hi = blend_pd_sse41(
+			_mm_cvtps_pd( _mm_movehl_ps( pa, pa ) ),
+			_mm_cvtps_pd( _mm_movehl_ps( pb, pb ) ),
+			c1 + x + 2, c2 + x + 2 );
+
+		_mm_storeu_ps( out + x,
+			_mm_movelh_ps( _mm_cvtpd_ps( lo ),
+				_mm_cvtpd_ps( hi ) ) );
+	}
+
+	for( ; x < n; x++ )
+		if( c2[x] == 0.0 )
+			out[x] = a[x];
+		else if( c1[x] == 0.0 )
+			out[x] = b[x];
+		else
+			out[x] = c1[x] * a[x] + c2[x] * b[x];
+}
+
+static inline __m256i AVX2
+blend_epi32_avx2( __m256i a, __m256i b, const int *c1, const int *c2 )
+{
+	__m256i t1 = _mm256_mullo_epi32( a,
+		_mm256_loadu_si256( (__m256i *) c1 ) );
+	__m256i t2 = _mm256_mullo_epi32( b,
+		_mm256_loadu_si256( (__m256i *) c2 ) );
+
+	return( _mm256_add_epi32( _mm256_srli_epi32( t1, 12 ),
+		_mm256_srli_epi32( t2, 12 ) ) );
+}
+
+/* 16 elements to 16 ints in two halves, blended and packed back to
+ * ushort in order.
+ */
+static inline __m256i AVX2
+blend_16_avx2( __m128i a0, __m128i b0, __m128i a1, __m128i b1,
+	const int *c1, const int *c2, gboolean uchar )
+{
+	__m256i r0, r1;
+
+	if( uchar ) {
+		r0 = blend_epi32_avx2(
+			_mm256_cvtepu8_epi32( a0 ), _mm256_cvtepu8_epi32( b0 ),
+			c1, c2 );
+		r1 = blend_epi32_avx2(
+			_mm256_cvtepu8_epi32( a1 ), _mm256_cvtepu8_epi32( b1 ),
+			c1 + 8, c2 + 8 );
+	}
+	else {
+		r0 = blend_epi32_avx2(
+			_mm256_cvtepu16_epi32( a0 ),
+			_mm256_cvtepu16_epi32( b0 ),
+			c1, c2 );
+		r1 = blend_epi32_avx2(
+			_mm256_cvtepu16_epi32( a1 ),
+			_mm256_cvtepu16_epi32( b1 ),
+			c1 + 8, c2 + 8 );
+	}
+
+	return( _mm256_permute4x64_epi64( _mm256_packus_epi32( r0, r1 ),
+		0xd8 ) );
+}
+
+static void AVX2
+blend_uchar_avx2( VipsPel *out, const VipsPel *a, const VipsPel *b, int n,
+	const void *vc1, const void *vc2 )
+{
+	const int *c1 = (const int *) vc1;
+	const int *c2 = (const int *) vc2;
+
+	int x;
+
+	for( x = 0; x + 16 <= n; x += 16 ) {
+		__m128i pa = _mm_loadu_si128( (__m128i *) (a + x) );
+		__m128i pb = _mm_loadu_si128( (__m128i *) (b + x) );
+		__m256i r = blend_16_avx2( pa, pb,
+			_mm_srli_si128( pa, 8 ), _mm_srli_si128( pb, 8 ),
+			c1 + x, c2 + x, TRUE );
+
+		_mm_storeu_si128( (__m128i *) (out + x),
+			_mm_packus_epi16( _mm256_castsi256_si128( r ),
+				_mm256_extracti128_si256( r, 1 ) ) );
+	}
+
+	blend_uchar_sse41( out + x, a + x, b + x, n - x, c1 + x, c2 + x );
+}
+
+static void AVX2
+blend_ushort_avx2( VipsPel *vout,
+	const VipsPel *va, const VipsPel *vb, int n,
+	const void *vc1, const void *vc2 )
+{
+	unsigned short *out = (unsigned short *) vout;
+	const unsigned short *a = (const unsigned short *) va;
+	const unsigned short *b = (const unsigned short *) vb;
+	const int *c1 = (const int *) vc1;
+	const int *c2 = (const int *) vc2;
+
+	int x;
+
+	for( x = 0; x + 16 <= n; x += 16 )
+		_mm256_storeu_si256( (__m256i *) (out + x), blend_16_avx2(
+			_mm_loadu_si128( (__m128i *) (a + x) ),
+			_mm_loadu_si128( (__m128i *) (b + x) ),
+			_mm_loadu_si128( (__m128i *) (a + x + 8) ),
+			_mm_loadu_si128( (__m128i *) (b + x + 8) ),
+			c1 + x, c2 + x, FALSE ) );
+
+	blend_ushort_sse41( (VipsPel *) (out + x),
+		(VipsPel *) (a + x), (VipsPel *) (b + x), n - x,
+		c1 + x, c2 + x );
+}
+
+static inline __m256d AVX2
+blend_pd_avx2( __m256d a, __m256d b, const double *c1, const double *c2 )
+{
+	__m256d zero = _mm256_setzero_pd();
+	__m256d vc1 = _mm256_loadu_pd( c1 );
+	__m256d vc2 = _mm256_loadu_pd( c2 );
+	__m256d r = _mm256_add_pd( _mm256_mul_pd( vc1, a ),
+		_mm256_mul_pd( vc2, b ) );
+
+	r = _mm256_blendv_pd( r, b, _mm256_cmp_pd( vc1, zero, _CMP_EQ_OQ ) );
+
+	return( _mm256_blendv_pd( r, a,
+		_mm256_cmp_pd( vc2, zero, _CMP_EQ_OQ ) ) );
+}
+
+static void AVX2
+blend_float_avx2( VipsPel *vout,
+	const VipsPel *va, const VipsPel *vb, int n,
+	const void *vc1, const void *vc2 )
+{
+	float *out = (float *) vout;
+	const float *a = (const float *) va;
+	const float *b = (const float *) vb;
+	const double *c1 = (const double *) vc1;
+	const double *c2 = (const double *) vc2;
+
+	int x;
+
+	for( x = 0; x + 8 <= n; x += 8 ) {
+		__m256 pa = _mm256_loadu_ps( a + x );
+		__m256 pb = _mm256_loadu_ps( b + x );
+		__m256d lo = blend_pd_avx2(
+			_mm256_cvtps_pd( _mm256_castps256_ps128( pa ) ),
+			_mm256_cvtps_pd( _mm256_castps256_ps128( pb ) ),
+			c1 + x, c2 + x );
+		__m256d hi = blend_pd_avx2(
+			_mm256_cvtps_pd( _mm256_extractf128_ps( pa, 1 ) ),
+			_mm256_cvtps_pd( _mm256_extractf128_ps( pb, 1 ) ),
+			c1 + x + 4, c2 + x + 4 );
+
+		_mm256_storeu_ps( out + x, _mm256_insertf128_ps(
+			_mm256_castps128_ps256( _mm256_cvtpd_ps( lo ) ),
+			_mm256_cvtpd_ps( hi ), 1 ) );
+	}
+
+	blend_float_sse41( (VipsPel *) (out + x),
+		(VipsPel *) (a + x), (VipsPel *) (b + x), n - x,
+		c1 + x, c2 + x );
+}
+
+/* The C loop for the 2x2 mean, from output element x to the end of the
+ * line. x must be at the start of a pixel.
+ */
+#define SHRINK2_TAIL_INT( TYPE ) { \
+	const TYPE *p = (const TYPE *) in; \
+	const TYPE *p1 = (const TYPE *) (in + lskip); \
+	TYPE *q = (TYPE *) out; \
+	\
+	for( ; x < ne; x++ ) { \
+		const int i = 2 * x - x % bands; \
+		\
+		q[x] = (p[i] + p[i + bands] + p1[i] + p1[i + bands] + 2) >> 2; \
+	} \
+}
+
+/* Make the pshufb masks which pick the even and the odd pixels of ps bytes
+ * out of 16, packed into the low bytes. Return the number of pairs of
+ * pixels we can do from 16 bytes.
+ */
+static int
+shrink2_masks( int ps, VipsPel *even, VipsPel *odd )
+{
+	int n = 16 / (2 * ps);
+
+	int i;
+
+	for( i = 0; i < 16; i++ ) {
+		int k = i / ps;
+		int b = i % ps;
+
+		if( k < n ) {
+			even[i] = 2 * k * ps + b;
+			odd[i] = (2 * k + 1) * ps + b;
+		}
+		else {
+			even[i] = 0x80;
+			odd[i] = 0x80;
+		}
+	}
+
+	return( n );
+}
+
+/* Pick with a mask and widen.
+ */
+static inline __m128i SSE41
+shrink2_epu8( __m128i p, __m128i mask )
+{
+	return( _mm_cvtepu8_epi16( _mm_shuffle_epi8( p, mask ) ) );
+}
+
+static inline __m128i SSE41
+shrink2_epu16( __m128i p, __m128i mask )
+{
+	return( _mm_cvtepu16_epi32( _mm_shuffle_epi8( p, mask ) ) );
+}
+
+static void SSE41
+shrink2_uchar_sse41( VipsPel *out, const VipsPel *in,
+	int lskip, int width, int bands )
+{
+	const int ne = width * bands;
+
+	VipsPel even_mask[16];
+	VipsPel odd_mask[16];
+	int step;
+	int x;
+
+	/* Each step reads 16 bytes from each line and writes 8, though
+	 * only the first step bytes are finished.
+	 */
+	x = 0;
+	step = shrink2_masks( bands, even_mask, odd_mask ) * bands;
+	if( step ) {
+		__m128i even = _mm_loadu_si128( (__m128i *) even_mask );
+		__m128i odd = _mm_loadu_si128( (__m128i *) odd_mask );
+		__m128i two = _mm_set1_epi16( 2 );
+
+		for( ; x + 8 <= ne; x += step ) {
+			__m128i p = _mm_loadu_si128( (__m128i *) (in + 2 * x) );
+			__m128i p1 = _mm_loadu_si128(
+				(__m128i *) (in + lskip + 2 * x) );
+			__m128i sum;
+
+			sum = _mm_add_epi16( shrink2_epu8( p, even ),
+				shrink2_epu8( p, odd ) );
+			sum = _mm_add_epi16( sum, shrink2_epu8( p1, even ) );
+			sum = _mm_add_epi16( sum, shrink2_epu8( p1, odd ) );
+sum = _mm_srli_epi16( _mm_add_epi16( sum, two ), 2 );
+
+			_mm_storel_epi64( (__m128i *) (out + x),
+				_mm_packus_epi16( sum, sum ) );
+		}
+	}
+
+	SHRINK2_TAIL_INT( unsigned char );
+}
+
+static void SSE41
+shrink2_ushort_sse41( VipsPel *out, const VipsPel *in,
+	int lskip, int width, int bands )
+{
+	const int ne = width * bands;
+
+	VipsPel even_mask[16];
+	VipsPel odd_mask[16];
+	int step;
+	int x;
+
+	/* Each step reads 8 elements from each line and writes 4.
+	 */
+	x = 0;
+	step = shrink2_masks( 2 * bands, even_mask, odd_mask ) * bands;
+	if( step ) {
+		__m128i even = _mm_loadu_si128( (__m128i *) even_mask );
+		__m128i odd = _mm_loadu_si128( (__m128i *) odd_mask );
+		__m128i two = _mm_set1_epi32( 2 );
+
+		for( ; x + 4 <= ne; x += step ) {
+			__m128i p = _mm_loadu_si128(
+				(__m128i *) (in + 4 * x) );
+			__m128i p1 = _mm_loadu_si128(
+				(__m128i *) (in + lskip + 4 * x) );
+			__m128i sum;
+
+			sum = _mm_add_epi32( shrink2_epu16( p, even ),
+				shrink2_epu16( p, odd ) );
+			sum = _mm_add_epi32( sum, shrink2_epu16( p1, even ) );
+			sum = _mm_add_epi32( sum, shrink2_epu16( p1, odd ) );
+sum = _mm_srli_epi32( _mm_add_epi32( sum, two ), 2 );
+
+			_mm_storel_epi64( (__m128i *) (out + 2 * x),
+				_mm_packus_epi32( sum, sum ) );
+		}
+	}
+
+	SHRINK2_TAIL_INT( unsigned short );
+}
+
+#define EVEN1 _MM_SHUFFLE( 2, 0, 2, 0 )
+#define ODD1 _MM_SHUFFLE( 3, 1, 3, 1 )
+#define EVEN2 _MM_SHUFFLE( 1, 0, 1, 0 )
+#define ODD2 _MM_SHUFFLE( 3, 2, 3, 2 )
+
+/* Float adds in the same order as the C loop, so the results match.
+ */
+static inline __m128 SSE41
+shrink2_ps( __m128 a, __m128 b, __m128 c, __m128 d )
+{
+	__m128 sum = _mm_add_ps( _mm_add_ps( _mm_add_ps( a, b ), c ), d );
+
+	return( _mm_mul_ps( sum, _mm_set1_ps( 0.25 ) ) );
+}
+
+static void SSE41
+shrink2_float_sse41( VipsPel *vout, const VipsPel *in,
+	int lskip, int width, int bands )
+{
+	const int ne = width * bands;
+	const float *p = (const float *) in;
+	const float *p1 = (const float *) (in + lskip);
+	float *q = (float *) vout;
+
+	int x;
+
+	/* Each step reads 8 elements from each line and writes 4.
+	 */
+	x = 0;
+	for( ; bands <= 4 && bands != 3 && x + 4 <= ne; x += 4 ) {
+		__m128 a = _mm_loadu_ps( p + 2 * x );
+		__m128 b = _mm_loadu_ps( p + 2 * x + 4 );
+		__m128 a1 = _mm_loadu_ps( p1 + 2 * x );
+		__m128 b1 = _mm_loadu_ps( p1 + 2 * x + 4 );
+
+		/* Split into even and odd pixels. Four bands are already
+		 * split.
+		 */
+		if( bands == 1 ) {
+			__m128 e = _mm_shuffle_ps( a, b, EVEN1 );
+			__m128 o = _mm_shuffle_ps( a, b, ODD1 );
+			__m128 e1 = _mm_shuffle_ps( a1, b1, EVEN1 );
+			__m128 o1 = _mm_shuffle_ps( a1, b1, ODD1 );
+
+			a = e; b = o; a1 = e1; b1 = o1;
+		}
+		else if( bands == 2 ) {
+			__m128 e = _mm_shuffle_ps( a, b, EVEN2 );
+			__m128 o = _mm_shuffle_ps( a, b, ODD2 );
+			__m128 e1 = _mm_shuffle_ps( a1, b1, EVEN2 );
+			__m128 o1 = _mm_shuffle_ps( a1, b1, ODD2 );
+
+			a = e; b = o; a1 = e1; b1 = o1;
+		}
+
+		_mm_storeu_ps( q + x, shrink2_ps( a, b, a1, b1 ) );
+	}
+
+	for( ; x < ne; x++ ) {
+		const int i = 2 * x - x % bands;
+
+		q[x] = (p[i] + p[i + bands] + p1[i] + p1[i + bands]) / 4;
+	}
+}
+
+/* One RGBE pixel in C, see colr_color() in colour/rad2float.c.
+ */
+static inline void
+rad2float_pel( float *q, const VipsPel *p )
+{
+	if( p[3] == 0 )
+		q[0] = q[1] = q[2] = 0.0;
+	else {
+		double f = ldexp( 1.0, (int) p[3] - (128 + 8) );
+
+		q[0] = (p[0] + 0.5) * f;
+		q[1] = (p[1] + 0.5) * f;
+		q[2] = (p[2] + 0.5) * f;
+	}
+}
+
+/* pshufb masks to spread four RGBE pixels over three vectors of int lanes,
+ * the mantissas and the matching exponents.
+ */
+#define Z 0x80
+static const VipsPel rad2float_mant[3][16] = {
+	{ 0, Z, Z, Z, 1, Z, Z, Z, 2, Z, Z, Z, 4, Z, Z, Z },
+	{ 5, Z, Z, Z, 6, Z, Z, Z, 8, Z, Z, Z, 9, Z, Z, Z },
+	{ 10, Z, Z, Z, 12, Z, Z, Z, 13, Z, Z, Z, 14, Z, Z, Z }
+};
+static const VipsPel rad2float_exp[3][16] = {
+	{ 3, Z, Z, Z, 3, Z, Z, Z, 3, Z, Z, Z, 7, Z, Z, Z },
+	{ 7, Z, Z, Z, 7, Z, Z, Z, 11, Z, Z, Z, 11, Z, Z, Z },
+	{ 11, Z, Z, Z, 15, Z, Z, Z, 15, Z, Z, Z, 15, Z, Z, Z }
+};
+#undef Z
+
+/* (m + 0.5) * 2 ** (e - 136) is (2m + 1) * 2 ** (e - 137). Both factors are
+ * exact in float and for e > 10 the product is a normal float, so a single
+ * float multiply rounds the same way as the double sum in C. Zero exponents
+ * give zero.
+ */
+static inline __m128 SSE41
+rad2float_ps( __m128i p, __m128i mant, __m128i exp )
+{
+	__m128i m = _mm_shuffle_epi8( p, mant );
+	__m128i e = _mm_shuffle_epi8( p, exp );
+	__m128 f = _mm_castsi128_ps( _mm_slli_epi32(
+		_mm_sub_epi32( e, _mm_set1_epi32( 10 ) ), 23 ) );
+	__m128 v = _mm_cvtepi32_ps( _mm_add_epi32(
+		_mm_slli_epi32( m, 1 ), _mm_set1_epi32( 1 ) ) );
+	__m128 zero = _mm_castsi128_ps(
+		_mm_cmpeq_epi32( e, _mm_setzero_si128() ) );
+
+	return( _mm_andnot_ps( zero, _mm_mul_ps( v, f ) ) );
+}
+
+static void SSE41
+rad2float_sse41( float *out, const VipsPel *in, int width )
+{
+	__m128i m0 = _mm_loadu_si128( (__m128i *) rad2float_mant[0] );
+	__m128i m1 = _mm_loadu_si128( (__m128i *) rad2float_mant[1] );
+	__m128i m2 = _mm_loadu_si128( (__m128i *) rad2float_mant[2] );
+	__m128i e0 = _mm_loadu_si128( (__m128i *) rad2float_exp[0] );
+	__m128i e1 = _mm_loadu_si128( (__m128i *) rad2float_exp[1] );
+	__m128i e2 = _mm_loadu_si128( (__m128i *) rad2float_exp[2] );
+
+	int x;
+	int i;
+
+	/* Four pixels at a time. Groups with a tiny exponent, where the
+	 * result would be denormal, are done in C.
+	 */
+	for( x = 0; x + 4 <= width; x += 4 ) {
+		const VipsPel *p = in + 4 * x;
+		float *q = out + 3 * x;
+
+		if( (VipsPel) (p[3] - 1) < 10 ||
+			(VipsPel) (p[7] - 1) < 10 ||
+			(VipsPel) (p[11] - 1) < 10 ||
+			(VipsPel) (p[15] - 1) < 10 ) {
+			for( i = 0; i < 4; i++ )
+				rad2float_pel( q + 3 * i, p + 4 * i );
+		}
+		else {
+			__m128i v = _mm_loadu_si128( (__m128i *) p );
+
+			_mm_storeu_ps( q, rad2float_ps( v, m0, e0 ) );
+			_mm_storeu_ps( q + 4, rad2float_ps( v, m1, e1 ) );
+			_mm_storeu_ps( q + 8, rad2float_ps( v, m2, e2 ) );
+		}
+	}
+
+	for( ; x < width; x++ )
+		rad2float_pel( out + 3 * x, in + 4 * x );
+}
+
+void
+vips__simd_x86_init( void )
+{
+	VipsSimdFeatures sse41 = VIPS_SIMD_SSE41;
+	VipsSimdFeatures avx2 = VIPS_SIMD_SSE41 | VIPS_SIMD_AVX2;
+	VipsSimdFeatures avx512 = avx2 | VIPS_SIMD_AVX512;
+
+	vips_simd_register( VIPS_SIMD_LINEAR, VIPS_FORMAT_UCHAR,
+		sse41, linear_uchar_sse41 );
+	vips_simd_register( VIPS_SIMD_LINEAR, VIPS_FORMAT_USHORT,
+		sse41, linear_ushort_sse41 );
+	vips_simd_register( VIPS_SIMD_LINEAR, VIPS_FORMAT_SHORT,
+		sse41, linear_short_sse41 );
+	vips_simd_register( VIPS_SIMD_LINEAR, VIPS_FORMAT_FLOAT,
+		sse41, linear_float_sse41 );
+	vips_simd_register( VIPS_SIMD_LINEAR, VIPS_FORMAT_UCHAR,
+		avx2, linear_uchar_avx2 );
+	vips_simd_register( VIPS_SIMD_LINEAR, VIPS_FORMAT_USHORT,
+		avx2, linear_ushort_avx2 );
+	vips_simd_register( VIPS_SIMD_LINEAR, VIPS_FORMAT_SHORT,
+		avx2, linear_short_avx2 );
+	vips_simd_register( VIPS_SIMD_LINEAR, VIPS_FORMAT_FLOAT,
+		avx2, linear_float_avx2 );
+	vips_simd_register( VIPS_SIMD_LINEAR, VIPS_FORMAT_UCHAR,
+		avx512, linear_uchar_avx512 );
+	vips_simd_register( VIPS_SIMD_LINEAR, VIPS_FORMAT_USHORT,
+		avx512, linear_ushort_avx512 );
+	vips_simd_register( VIPS_SIMD_LINEAR, VIPS_FORMAT_SHORT,
+		avx512, linear_short_avx512 );
+	vips_simd_register( VIPS_SIMD_LINEAR, VIPS_FORMAT_FLOAT,
+		avx512, linear_float_avx512 );
+
+	vips_simd_register( VIPS_SIMD_CAST_FLOAT, VIPS_FORMAT_UCHAR,
+		sse41, cast_uchar_sse41 );
+	vips_simd_register( VIPS_SIMD_CAST_FLOAT, VIPS_FORMAT_USHORT,
+		sse41, cast_ushort_sse41 );
+	vips_simd_register( VIPS_SIMD_CAST_FLOAT, VIPS_FORMAT_SHORT,
+		sse41, cast_short_sse41 );
+	vips_simd_register( VIPS_SIMD_CAST_FLOAT, VIPS_FORMAT_UCHAR,
+		avx2, cast_uchar_avx2 );
+	vips_simd_register( VIPS_SIMD_CAST_FLOAT, VIPS_FORMAT_USHORT,
+		avx2, cast_ushort_avx2 );
+	vips_simd_register( VIPS_SIMD_CAST_FLOAT, VIPS_FORMAT_SHORT,
+		avx2, cast_short_avx2 );
+	vips_simd_register( VIPS_SIMD_CAST_FLOAT, VIPS_FORMAT_UCHAR,
+		avx512, cast_uchar_avx512 );
+	vips_simd_register( VIPS_SIMD_CAST_FLOAT, VIPS_FORMAT_USHORT,
+		avx512, cast_ushort_avx512 );
+	vips_simd_register( VIPS_SIMD_CAST_FLOAT, VIPS_FORMAT_SHORT,
+		avx512, cast_short_avx512 );
+
+	vips_simd_register( VIPS_SIMD_CLIP_FLOAT, VIPS_FORMAT_UCHAR,
+		sse41, clip_uchar_sse41 );
+	vips_simd_register( VIPS_SIMD_CLIP_FLOAT, VIPS_FORMAT_USHORT,
+		sse41, clip_ushort_sse41 );
+
+	vips_simd_register( VIPS_SIMD_SHIFT_UCHAR, VIPS_FORMAT_USHORT,
+		sse41, shift_ushort_sse41 );
+	vips_simd_register( VIPS_SIMD_SHIFT_UCHAR, VIPS_FORMAT_USHORT,
+		avx2, shift_ushort_avx2 );
+
+	vips_simd_register( VIPS_SIMD_PREMULTIPLY, VIPS_FORMAT_UCHAR,
+		sse41, premultiply_uchar_sse41 );
+	vips_simd_register( VIPS_SIMD_PREMULTIPLY, VIPS_FORMAT_USHORT,
+		sse41, premultiply_ushort_sse41 );
+	vips_simd_register( VIPS_SIMD_PREMULTIPLY, VIPS_FORMAT_FLOAT,
+		sse41, premultiply_float_sse41 );
+	vips_simd_register( VIPS_SIMD_UNPREMULTIPLY, VIPS_FORMAT_UCHAR,
+		sse41, unpremultiply_uchar_sse41 );
+	vips_simd_register( VIPS_SIMD_UNPREMULTIPLY, VIPS_FORMAT_USHORT,
+		sse41, unpremultiply_ushort_sse41 );
+	vips_simd_register( VIPS_SIMD_UNPREMULTIPLY, VIPS_FORMAT_FLOAT,
+		sse41, unpremultiply_float_sse41 );
+	vips_simd_register( VIPS_SIMD_FLATTEN, VIPS_FORMAT_UCHAR,
+		sse41, flatten_uchar_sse41 );
+	vips_simd_register( VIPS_SIMD_FLATTEN, VIPS_FORMAT_USHORT,
+		sse41, flatten_ushort_sse41 );
+
+	vips_simd_register( VIPS_SIMD_REDUCEH, VIPS_FORMAT_UCHAR,
+		sse41, reduceh_uchar_sse41 );
+	vips_simd_register( VIPS_SIMD_REDUCEH, VIPS_FORMAT_USHORT,
+		sse41, reduceh_ushort_sse41 );
+	vips_simd_register( VIPS_SIMD_REDUCEH, VIPS_FORMAT_FLOAT,
+		sse41, reduceh_float_sse41 );
+	vips_simd_register( VIPS_SIMD_REDUCEH, VIPS_FORMAT_UCHAR,
+		avx2, reduceh_uchar_avx2 );
+	vips_simd_register( VIPS_SIMD_REDUCEH, VIPS_FORMAT_FLOAT,
+		avx2, reduceh_float_avx2 );
+
+	vips_simd_register( VIPS_SIMD_REDUCEV, VIPS_FORMAT_UCHAR,
+		sse41, reducev_uchar_sse41 );
+	vips_simd_register( VIPS_SIMD_REDUCEV, VIPS_FORMAT_USHORT,
+		sse41, reducev_ushort_sse41 );
+	vips_simd_register( VIPS_SIMD_REDUCEV, VIPS_FORMAT_UCHAR,
+		avx2, reducev_uchar_avx2 );
+	vips_simd_register( VIPS_SIMD_REDUCEV, VIPS_FORMAT_USHORT,
+		avx2, reducev_ushort_avx2 );
+
+	vips_simd_register( VIPS_SIMD_CONVH, VIPS_FORMAT_UCHAR,
+		sse41, convh_uchar_sse41 );
+	vips_simd_register( VIPS_SIMD_CONVH, VIPS_FORMAT_USHORT,
+		sse41, convh_ushort_sse41 );
+	vips_simd_register( VIPS_SIMD_CONVH, VIPS_FORMAT_FLOAT,
+		sse41, convh_float_sse41 );
+	vips_simd_register( VIPS_SIMD_CONVV, VIPS_FORMAT_FLOAT,
+		sse41, convv_float_sse41 );
+	vips_simd_register( VIPS_SIMD_CONVH, VIPS_FORMAT_UCHAR,
+		avx2, convh_uchar_avx2 );
+	vips_simd_register( VIPS_SIMD_CONVH, VIPS_FORMAT_USHORT,
+		avx2, convh_ushort_avx2 );
+	vips_simd_register( VIPS_SIMD_CONVH, VIPS_FORMAT_FLOAT,
+		avx2, convh_float_avx2 );
+	vips_simd_register( VIPS_SIMD_CONVV, VIPS_FORMAT_FLOAT,
+		avx2, convv_float_avx2 );
+
+	vips_simd_register( VIPS_SIMD_SHRINKH, VIPS_FORMAT_UCHAR,
+		sse41, shrinkh_uchar_sse41 );
+	vips_simd_register( VIPS_SIMD_SHRINKH, VIPS_FORMAT_USHORT,
+		sse41, shrinkh_ushort_sse41 );
+
+	vips_simd_register( VIPS_SIMD_SHRINKV, VIPS_FORMAT_UCHAR,
+		sse41, shrinkv_uchar_sse41 );
+	vips_simd_register( VIPS_SIMD_SHRINKV, VIPS_FORMAT_USHORT,
+		sse41, shrinkv_ushort_sse41 );
+	vips_simd_register( VIPS_SIMD_SHRINKV, VIPS_FORMAT_UCHAR,
+		avx2, shrinkv_uchar_avx2 );
+	vips_simd_register( VIPS_SIMD_SHRINKV, VIPS_FORMAT_USHORT,
+		avx2, shrinkv_ushort_avx2 );
+
+	vips_simd_register( VIPS_SIMD_COMPOSITE, VIPS_FORMAT_UCHAR,
+		sse41, composite_uchar_sse41 );
+	vips_simd_register( VIPS_SIMD_COMPOSITE, VIPS_FORMAT_USHORT,
+		sse41, composite_ushort_sse41 );
+	vips_simd_register( VIPS_SIMD_COMPOSITE, VIPS_FORMAT_UCHAR,
+		avx2, composite_uchar_avx2 );
+	vips_simd_register( VIPS_SIMD_COMPOSITE, VIPS_FORMAT_USHORT,
+		avx2, composite_ushort_avx2 );
+
+	vips_simd_register( VIPS_SIMD_MATRIX3, VIPS_FORMAT_FLOAT,
+		avx2, matrix3_avx2 );
+
+	vips_simd_register( VIPS_SIMD_XYZ2LAB, VIPS_FORMAT_FLOAT,
+		avx2, XYZ2Lab_avx2 );
+	vips_simd_register( VIPS_SIMD_LAB2XYZ, VIPS_FORMAT_FLOAT,
+		avx2, Lab2XYZ_avx2 );
+
+	vips_simd_register( VIPS_SIMD_DE00, VIPS_FORMAT_FLOAT,
+		avx2, dE00_avx2 );
+
+	vips_simd_register( VIPS_SIMD_SRGB2HSV, VIPS_FORMAT_UCHAR,
+		avx2, sRGB2HSV_avx2 );
+	vips_simd_register( VIPS_SIMD_SRGB2HUE, VIPS_FORMAT_UCHAR,
+		avx2, sRGB2hue_avx2 );
+	vips_simd_register( VIPS_SIMD_HSV2SRGB, VIPS_FORMAT_UCHAR,
+		avx2, HSV2sRGB_avx2 );
+
+	vips_simd_register( VIPS_SIMD_TRANSPOSE, VIPS_FORMAT_UCHAR,
+		sse41, transpose_uchar_sse41 );
+	vips_simd_register( VIPS_SIMD_TRANSPOSE, VIPS_FORMAT_USHORT,
+		sse41, transpose_ushort_sse41 );
+	vips_simd_register( VIPS_SIMD_TRANSPOSE, VIPS_FORMAT_UINT,
+		sse41, transpose_uint_sse41 );
+	vips_simd_register( VIPS_SIMD_TRANSPOSE, VIPS_FORMAT_DOUBLE,
+		sse41, transpose_double_sse41 );
+	vips_simd_register( VIPS_SIMD_TRANSPOSE, VIPS_FORMAT_UINT,
+		avx2, transpose_uint_avx2 );
+	vips_simd_register( VIPS_SIMD_TRANSPOSE, VIPS_FORMAT_DOUBLE,
+		avx2, transpose_double_avx2 );
+
+	vips_simd_register( VIPS_SIMD_FLIP, VIPS_FORMAT_UCHAR,
+		sse41, flip_uchar_sse41 );
+	vips_simd_register( VIPS_SIMD_FLIP, VIPS_FORMAT_USHORT,
+		sse41, flip_ushort_sse41 );
+	vips_simd_register( VIPS_SIMD_FLIP, VIPS_FORMAT_UINT,
+		sse41, flip_uint_sse41 );
+	vips_simd_register( VIPS_SIMD_FLIP, VIPS_FORMAT_DOUBLE,
+		sse41, flip_double_sse41 );
+	vips_simd_register( VIPS_SIMD_FLIP, VIPS_FORMAT_UCHAR,
+		avx2, flip_uchar_avx2 );
+	vips_simd_register( VIPS_SIMD_FLIP, VIPS_FORMAT_USHORT,
+		avx2, flip_ushort_avx2 );
+	vips_simd_register( VIPS_SIMD_FLIP, VIPS_FORMAT_UINT,
+		avx2, flip_uint_avx2 );
+	vips_simd_register( VIPS_SIMD_FLIP, VIPS_FORMAT_DOUBLE,
+		avx2, flip_double_avx2 );
+
+	vips_simd_register( VIPS_SIMD_BILINEAR, VIPS_FORMAT_UCHAR,
+		sse41, bilinear_uchar_sse41 );
+	vips_simd_register( VIPS_SIMD_BICUBIC, VIPS_FORMAT_UCHAR,
+		sse41, bicubic_uchar_sse41 );
+
+	vips_simd_register( VIPS_SIMD_MAX, VIPS_FORMAT_UCHAR,
+		sse41, max_uchar_sse41 );
+	vips_simd_register( VIPS_SIMD_MIN, VIPS_FORMAT_UCHAR,
+		sse41, min_uchar_sse41 );
+	vips_simd_register( VIPS_SIMD_MAX, VIPS_FORMAT_UCHAR,
+		avx2, max_uchar_avx2 );
+	vips_simd_register( VIPS_SIMD_MIN, VIPS_FORMAT_UCHAR,
+		avx2, min_uchar_avx2 );
+
+	vips_simd_register( VIPS_SIMD_LUT32, VIPS_FORMAT_UCHAR,
+		sse41, lut32_uchar_sse41 );
+	vips_simd_register( VIPS_SIMD_LUT32, VIPS_FORMAT_UCHAR,
+		avx2, lut32_uchar_avx2 );
+
+	vips_simd_register( VIPS_SIMD_BLEND, VIPS_FORMAT_UCHAR,
+		sse41, blend_uchar_sse41 );
+	vips_simd_register( VIPS_SIMD_BLEND, VIPS_FORMAT_USHORT,
+		sse41, blend_ushort_sse41 );
+	vips_simd_register( VIPS_SIMD_BLEND, VIPS_FORMAT_FLOAT,
+		sse41, blend_float_sse41 );
+	vips_simd_register( VIPS_SIMD_BLEND, VIPS_FORMAT_UCHAR,
+		avx2, blend_uchar_avx2 );
+	vips_simd_register( VIPS_SIMD_BLEND, VIPS_FORMAT_USHORT,
+		avx2, blend_ushort_avx2 );
+	vips_simd_register( VIPS_SIMD_BLEND, VIPS_FORMAT_FLOAT,
+		avx2, blend_float_avx2 );
+
+	vips_simd_register( VIPS_SIMD_SPAN, VIPS_FORMAT_UCHAR,
+		sse41, span_uchar_sse41 );
+	vips_simd_register( VIPS_SIMD_SPAN, VIPS_FORMAT_USHORT,
+		sse41, span_ushort_sse41 );
+	vips_simd_register( VIPS_SIMD_SPAN, VIPS_FORMAT_UINT,
+		sse41, span_uint_sse41 );
+	vips_simd_register( VIPS_SIMD_SPAN, VIPS_FORMAT_UCHAR,
+		avx2, span_uchar_avx2 );
+	vips_simd_register( VIPS_SIMD_SPAN, VIPS_FORMAT_USHORT,
+		avx2, span_ushort_avx2 );
+	vips_simd_register( VIPS_SIMD_SPAN, VIPS_FORMAT_UINT,
+		avx2, span_uint_avx2 );
+	vips_simd_register( VIPS_SIMD_SPAN_BACK, VIPS_FORMAT_UCHAR,
+		sse41, span_back_uchar_sse41 );
+	vips_simd_register( VIPS_SIMD_SPAN_BACK, VIPS_FORMAT_USHORT,
+		sse41, span_back_ushort_sse41 );
+	vips_simd_register( VIPS_SIMD_SPAN_BACK, VIPS_FORMAT_UINT,
+		sse41, span_back_uint_sse41 );
+	vips_simd_register( VIPS_SIMD_SPAN_BACK, VIPS_FORMAT_UCHAR,
+		avx2, span_back_uchar_avx2 );
+	vips_simd_register( VIPS_SIMD_SPAN_BACK, VIPS_FORMAT_USHORT,
+		avx2, span_back_ushort_avx2 );
+	vips_simd_register( VIPS_SIMD_SPAN_BACK, VIPS_FORMAT_UINT,
+		avx2, span_back_uint_avx2 );
+
+	vips_simd_register( VIPS_SIMD_RELATIONAL, VIPS_FORMAT_UCHAR,
+		sse41, relational_uchar_sse41 );
+	vips_simd_register( VIPS_SIMD_RELATIONAL, VIPS_FORMAT_USHORT,
+		sse41, relational_ushort_sse41 );
+	vips_simd_register( VIPS_SIMD_RELATIONAL, VIPS_FORMAT_FLOAT,
+		sse41, relational_float_sse41 );
+
+	vips_simd_register( VIPS_SIMD_BOOLEAN, VIPS_FORMAT_UCHAR,
+		sse41, boolean_uchar_sse41 );
+	vips_simd_register( VIPS_SIMD_BOOLEAN, VIPS_FORMAT_UCHAR,
+		avx2, boolean_uchar_avx2 );
+
+	vips_simd_register( VIPS_SIMD_SHRINK2, VIPS_FORMAT_UCHAR,
+		sse41, shrink2_uchar_sse41 );
+	vips_simd_register( VIPS_SIMD_SHRINK2, VIPS_FORMAT_USHORT,
+		sse41, shrink2_ushort_sse41 );
+	vips_simd_register( VIPS_SIMD_SHRINK2, VIPS_FORMAT_FLOAT,
+		sse41, shrink2_float_sse41 );
+
+	vips_simd_register( VIPS_SIMD_RAD2FLOAT, VIPS_FORMAT_UCHAR,
+		sse41, rad2float_sse41 );
+}
+
+#endif /*HAVE_SIMD_X86*/
@@ -9,6 +9,10 @@
  * 	- we could get stuck if allocate failed (thanks Tim)
  * 23/2/12
  * 	- we could deadlock if generate failed
+ * 14/10/18
+ * 	- ring of N buffers and a single writer thread, rather than strict
+ * 	  double-buffering
+ * 	- record wbuffer areas in profiles
  */
 
 /*
@@ -65,6 +69,12 @@
 
 #include "sink.h"
 
+/* Number of write buffers in the ring, and the most memory they can use. 
+ * Set from the command-line, see vips_sink_disc().
+ */
+int vips__disc_buffers = 0;
+char *vips__disc_buffer_memory = NULL;
+
 /* A buffer we are going to write to disc in a background thread.
  */
 typedef struct _WriteBuffer {
@@ -72,12 +82,11 @@ typedef struct _WriteBuffer {
 
 	VipsRegion *region;	/* Pixels */
 	VipsRect area;		/* Part of image this region covers */
-        VipsSemaphore go; 	/* Start bg thread loop */
+        VipsSemaphore go; 	/* Start bg write of this buffer */
         VipsSemaphore nwrite; 	/* Number of threads writing to region */
         VipsSemaphore done; 	/* Bg thread has done write */
         int write_errno;	/* Save write errors here */
-	GThread *thread;	/* BG writer thread */
-	gboolean kill;		/* Set to ask thread to exit */
+	gboolean busy;		/* Handed to the writer, done not yet seen */
 } WriteBuffer;
 
 /* Per-call state.
@@ -85,11 +94,22 @@ typedef struct _WriteBuffer {
 typedef struct _Write {
 	SinkBase sink_base;
 
-	/* We are current writing tiles to buf, buf_back is in the hands of
-	 * the bg write thread.
+	/* A ring of buffers. Workers generate tiles into ring[current], 
+	 * buffers before that are queued for the writer thread, which 
+	 * writes them in ring order. 
+	 */
+	WriteBuffer **ring;
+	int n_buffers;
+	int current;
+
+	GThread *thread;	/* BG writer thread */
+	gboolean kill;		/* Set to ask writer to exit */
+
+	/* The number of buffers we started, and the number of times we had
+	 * to wait for the writer before we could start one.
 	 */
-	WriteBuffer *buf;
-	WriteBuffer *buf_back;
+	int n_started;
+	int n_blocked;
 
 	/* The file format write operation.
 	 */
@@ -97,6 +117,9 @@ typedef struct _Write {
 	void *a;		
 } Write;
 
+#define WRITE_BUFFER( W, I ) ((W)->ring[(I) % (W)->n_buffers])
+#define WRITE_CURRENT( W ) WRITE_BUFFER( W, (W)->current )
+
 /* Our per-thread state ... we need to also track the buffer that pos is
  * supposed to write to.
  */
@@ -139,20 +162,6 @@ write_thread_state_new( VipsImage *im, void *a )
 static void
 wbuffer_free( WriteBuffer *wbuffer )
 {
-        /* Is there a thread running this region? Kill it!
-         */
-        if( wbuffer->thread ) {
-                wbuffer->kill = TRUE;
-		vips_semaphore_up( &wbuffer->go );
-
-		/* Return value is always NULL (see wbuffer_write_thread).
-		 */
-		(void) vips_g_thread_join( wbuffer->thread );
-		VIPS_DEBUG_MSG( "wbuffer_free: vips_g_thread_join()\n" );
-
-		wbuffer->thread = NULL;
-        }
-
 	VIPS_UNREF( wbuffer->region );
 	vips_semaphore_destroy( &wbuffer->go );
 	vips_semaphore_destroy( &wbuffer->nwrite );
@@ -170,25 +179,40 @@ wbuffer_write( WriteBuffer *wbuffer )
 
 	VIPS_GATE_START( "wbuffer_write: work" ); 
 
-	wbuffer->write_errno = write->write_fn( wbuffer->region, 
-		&wbuffer->area, write->a );
+	if( vips__thread_profile ) {
+		gint64 start = vips__get_time();
+
+		wbuffer->write_errno = write->write_fn( wbuffer->region,
+			&wbuffer->area, write->a );
+
+		vips__thread_gate_tile( "wbuffer_write", &wbuffer->area,
+			start, vips__get_time() );
+	}
+	else
+		wbuffer->write_errno = write->write_fn( wbuffer->region,
+			&wbuffer->area, write->a );
 
 	VIPS_GATE_STOP( "wbuffer_write: work" ); 
 }
 
-/* Run this as a thread to do a BG write.
+/* Run this as a thread to do BG writes. We step through the ring in order, 
+ * writing each buffer as it's handed to us.
  */
 static void *
 wbuffer_write_thread( void *data )
 {
-	WriteBuffer *wbuffer = (WriteBuffer *) data;
+	Write *write = (Write *) data;
+
+	int i;
+
+	for( i = 0; ; i++ ) {
+		WriteBuffer *wbuffer = WRITE_BUFFER( write, i );
 
-	for(;;) {
 		/* Wait to be told to write.
 		 */
 		vips_semaphore_down( &wbuffer->go );
 
-		if( wbuffer->kill )
+		if( write->kill )
 			break;
 
 		/* Now block until the last worker finishes on this buffer.
@@ -218,8 +242,7 @@ wbuffer_new( Write *write )
 	vips_semaphore_init( &wbuffer->nwrite, 0, "nwrite" );
 	vips_semaphore_init( &wbuffer->done, 0, "done" );
 	wbuffer->write_errno = 0;
-	wbuffer->thread = NULL;
-	wbuffer->kill = FALSE;
+	wbuffer->busy = FALSE;
 
 	if( !(wbuffer->region = vips_region_new( write->sink_base.im )) ) {
 		wbuffer_free( wbuffer );
@@ -230,42 +253,72 @@ wbuffer_new( Write *write )
 	 */
 	vips__region_no_ownership( wbuffer->region );
 
-	/* Make this last (picks up parts of wbuffer on startup).
-	 */
-	if( !(wbuffer->thread = vips_g_thread_new( "wbuffer", 
-		wbuffer_write_thread, wbuffer )) ) {  
-		wbuffer_free( wbuffer );
-		return( NULL );
-	}
-
 	return( wbuffer );
 }
 
-/* Block until the previous write completes, then write the front buffer.
+/* Wait for the writer to finish with a buffer. 
  */
 static int
-wbuffer_flush( Write *write )
+wbuffer_wait( WriteBuffer *wbuffer )
 {
-	VIPS_DEBUG_MSG( "wbuffer_flush:\n" );
-
-	/* Block until the other buffer has been written. We have to do this 
-	 * before we can set this buffer writing or we'll lose output ordering.
-	 */
-	if( write->buf->area.top > 0 ) {
-		vips_semaphore_down( &write->buf_back->done );
+	if( wbuffer->busy ) {
+		vips_semaphore_down( &wbuffer->done );
+		wbuffer->busy = FALSE;
 
 		/* Previous write suceeded?
 		 */
-		if( write->buf_back->write_errno ) {
-			vips_error_system( write->buf_back->write_errno,
+		if( wbuffer->write_errno ) {
+			vips_error_system( wbuffer->write_errno,
 				"wbuffer_write", "%s", _( "write failed" ) );
 			return( -1 ); 
 		}
 	}
 
+	return( 0 );
+}
+
+/* Hand the current buffer to the writer, then wait until we can start the 
+ * next one.
+ */
+static int
+wbuffer_flush( Write *write )
+{
+	WriteBuffer *next = WRITE_BUFFER( write, write->current + 1 );
+
+	VIPS_DEBUG_MSG( "wbuffer_flush:\n" );
+
+	/* Workers must only ever be computing tiles in two buffers at once, 
+	 * since pipelines with line caches are sized for that, see 
+	 * vips_get_tile_size(). Wait for the previous buffer to be computed,
+	 * though it need not be written yet.
+	 */
+	if( write->current > 0 ) {
+		WriteBuffer *previous = 
+			WRITE_BUFFER( write, write->current - 1 );
+
+		vips_semaphore_downn( &previous->nwrite, 0 );
+	}
+
 	/* Set the background writer going for this buffer.
 	 */
-	vips_semaphore_up( &write->buf->go );
+	WRITE_CURRENT( write )->busy = TRUE;
+	vips_semaphore_up( &WRITE_CURRENT( write )->go );
+
+	/* The next buffer in the ring might still be queued for write. If it 
+	 * is, the writer has fallen a whole ring behind and we have to block.
+	 */
+	if( next->busy ) {
+		write->n_blocked += 1;
+
+		VIPS_GATE_START( "wbuffer_flush: wait" ); 
+
+		if( wbuffer_wait( next ) ) {
+			VIPS_GATE_STOP( "wbuffer_flush: wait" ); 
+			return( -1 );
+		}
+
+		VIPS_GATE_STOP( "wbuffer_flush: wait" ); 
+	}
 
 	return( 0 );
 }
@@ -318,6 +371,8 @@ wbuffer_allocate_fn( VipsThreadState *state, void *a, gboolean *stop )
 	Write *write = (Write *) a;
 	SinkBase *sink_base = (SinkBase *) write;
 
+	VipsRect *area = &WRITE_CURRENT( write )->area;
+
 	VipsRect image;
 	VipsRect tile;
 
@@ -326,17 +381,17 @@ wbuffer_allocate_fn( VipsThreadState *state, void *a, gboolean *stop )
 	/* Is the state x/y OK? New line or maybe new buffer or maybe even 
 	 * all done.
 	 */
-	if( sink_base->x >= write->buf->area.width ) {
+	if( sink_base->x >= area->width ) {
 		sink_base->x = 0;
 		sink_base->y += sink_base->tile_height;
 
-		if( sink_base->y >= VIPS_RECT_BOTTOM( &write->buf->area ) ) {
+		if( sink_base->y >= VIPS_RECT_BOTTOM( area ) ) {
 			VIPS_DEBUG_MSG( "wbuffer_allocate_fn: "
 				"finished top = %d, height = %d\n",
-				write->buf->area.top, write->buf->area.height );
+				area->top, area->height );
 
-			/* Block until the write of the previous buffer 
-			 * is done, then set write of this buffer going.
+			/* Set write of this buffer going, then block 
+			 * until the next buffer is free.
 			 */
 			if( wbuffer_flush( write ) ) {
 				*stop = TRUE;
@@ -354,13 +409,14 @@ wbuffer_allocate_fn( VipsThreadState *state, void *a, gboolean *stop )
 				"starting top = %d, height = %d\n",
 				sink_base->y, sink_base->n_lines );
 
-			/* Swap buffers.
+			/* Move on to the next buffer.
 			 */
-			VIPS_SWAP( WriteBuffer *, write->buf, write->buf_back );
+			write->current += 1;
+			write->n_started += 1;
 
 			/* Position buf at the new y.
 			 */
-			if( wbuffer_position( write->buf, 
+			if( wbuffer_position( WRITE_CURRENT( write ), 
 				sink_base->y, sink_base->n_lines ) ) {
 				*stop = TRUE;
 				return( -1 );
@@ -387,7 +443,7 @@ wbuffer_allocate_fn( VipsThreadState *state, void *a, gboolean *stop )
 
 	/* The thread needs to know which buffer it's writing to.
 	 */
-	wstate->buf = write->buf;
+	wstate->buf = WRITE_CURRENT( write );
 
 	VIPS_DEBUG_MSG( "  thread %p allocated "
 		"left = %d, top = %d, width = %d, height = %d\n", 
@@ -396,7 +452,7 @@ wbuffer_allocate_fn( VipsThreadState *state, void *a, gboolean *stop )
 
 	/* Add to the number of writers on the buffer.
 	 */
-	vips_semaphore_upn( &write->buf->nwrite, -1 );
+	vips_semaphore_upn( &WRITE_CURRENT( write )->nwrite, -1 );
 
 	/* Move state on.
 	 */
@@ -409,12 +465,54 @@ wbuffer_allocate_fn( VipsThreadState *state, void *a, gboolean *stop )
 	return( 0 );
 }
 
+/* Our VipsThreadpoolAllocateBatchFn ... allocate up to max_units tiles with
+ * wbuffer_allocate_fn(). 
+ */
+static int
+wbuffer_allocate_batch_fn( VipsThreadState *state, void *a, 
+	VipsThreadUnit *units, int max_units, int *n_units, gboolean *stop )
+{
+	WriteThreadState *wstate =  (WriteThreadState *) state;
+	Write *write = (Write *) a;
+	SinkBase *sink_base = (SinkBase *) write;
+
+	int n;
+
+	for( n = 0; n < max_units; n++ ) {
+		VipsRect *area = &WRITE_CURRENT( write )->area;
+
+		/* Don't let a batch cross into the next buffer. Starting a
+		 * buffer waits for the one before to be computed, and 
+		 * that could need tiles we hold in this batch. 
+		 */
+		if( n > 0 &&
+			sink_base->x >= area->width &&
+			sink_base->y + sink_base->tile_height >= 
+				VIPS_RECT_BOTTOM( area ) )
+			break;
+
+		if( wbuffer_allocate_fn( state, a, stop ) ) 
+			return( -1 );
+		if( *stop )
+			break;
+
+		units[n].pos = state->pos;
+		units[n].data = wstate->buf;
+	}
+
+	*n_units = n;
+
+	return( 0 );
+}
+
 /* Our VipsThreadpoolWork function ... generate a tile!
  */
 static int
 wbuffer_work_fn( VipsThreadState *state, void *a )
 {
-	WriteThreadState *wstate = (WriteThreadState *) state;
+	/* The buffer this unit should write to.
+	 */
+	WriteBuffer *wbuffer = (WriteBuffer *) state->unit;
 
 	int result;
 
@@ -422,7 +520,7 @@ wbuffer_work_fn( VipsThreadState *state, void *a )
 		g_thread_self(), 
 		state->pos.left, state->pos.top );
 
-	result = vips_region_prepare_to( state->reg, wstate->buf->region, 
+	result = vips_region_prepare_to( state->reg, wbuffer->region, 
 		&state->pos, state->pos.left, state->pos.top );
 
 	VIPS_DEBUG_MSG( "wbuffer_work_fn: thread %p result = %d\n", 
@@ -430,28 +528,123 @@ wbuffer_work_fn( VipsThreadState *state, void *a )
 
 	/* Tell the bg write thread we've left.
 	 */
-	vips_semaphore_upn( &wstate->buf->nwrite, 1 );
+	vips_semaphore_upn( &wbuffer->nwrite, 1 );
 
 	return( result );
 }
 
-static void
+/* Pick the number of buffers in the ring. At least two, and no more than 
+ * fits in the memory limit.
+ */
+static int
+write_get_n_buffers( Write *write )
+{
+	VipsImage *im = write->sink_base.im;
+	size_t buffer_size = VIPS_IMAGE_SIZEOF_LINE( im ) * 
+		VIPS_MIN( im->Ysize, write->sink_base.n_lines );
+
+	const char *env;
+	int n_buffers;
+	guint64 max_memory;
+
+	n_buffers = 2;
+	if( (env = g_getenv( "VIPS_DISC_BUFFERS" )) )
+		n_buffers = atoi( env );
+	if( vips__disc_buffers > 0 )
+		n_buffers = vips__disc_buffers;
+
+	/* 100mb default.
+	 */
+	max_memory = 100 * 1024 * 1024;
+	if( (env = g_getenv( "VIPS_DISC_BUFFER_MEMORY" )) )
+		max_memory = vips__parse_size( env );
+	if( vips__disc_buffer_memory ) 
+		max_memory = vips__parse_size( vips__disc_buffer_memory );
+
+	if( buffer_size > 0 &&
+		n_buffers > max_memory / buffer_size )
+		n_buffers = max_memory / buffer_size;
+
+	/* There's no point having more buffers than there are in the 
+	 * image.
+	 */
+	n_buffers = VIPS_MIN( n_buffers, 
+		VIPS_ROUND_UP( im->Ysize, write->sink_base.n_lines ) / 
+			write->sink_base.n_lines + 1 );
+
+	return( VIPS_MAX( 2, n_buffers ) );
+}
+
+static int
 write_init( Write *write, 
 	VipsImage *image, VipsRegionWrite write_fn, void *a )
 {
+	int i;
+
 	vips_sink_base_init( &write->sink_base, image );
 
-	write->buf = wbuffer_new( write );
-	write->buf_back = wbuffer_new( write );
+	write->ring = NULL;
+	write->n_buffers = 0;
+	write->current = 0;
+	write->thread = NULL;
+	write->kill = FALSE;
+	write->n_started = 1;
+	write->n_blocked = 0;
 	write->write_fn = write_fn;
 	write->a = a;
+
+	write->n_buffers = write_get_n_buffers( write );
+	if( !(write->ring = 
+		VIPS_ARRAY( NULL, write->n_buffers, WriteBuffer * )) )
+		return( -1 );
+	for( i = 0; i < write->n_buffers; i++ ) 
+		write->ring[i] = NULL;
+	for( i = 0; i < write->n_buffers; i++ ) 
+		if( !(write->ring[i] = wbuffer_new( write )) )
+			return( -1 );
+
+	VIPS_DEBUG_MSG( "write_init: %d buffers\n", write->n_buffers );
+
+	/* Make this last (picks up parts of write on startup).
+	 */
+	if( !(write->thread = vips_g_thread_new( "wbuffer", 
+		wbuffer_write_thread, write )) ) 
+		return( -1 );
+
+	return( 0 );
 }
 
 static void
 write_free( Write *write )
 {
-	VIPS_FREEF( wbuffer_free, write->buf );
-	VIPS_FREEF( wbuffer_free, write->buf_back );
+	int i;
+
+        /* Is there a writer running? Kill it! It could be waiting on any 
+	 * of the buffers.
+         */
+	if( write->thread ) {
+		write->kill = TRUE;
+		for( i = 0; i < write->n_buffers; i++ ) 
+			vips_semaphore_up( &write->ring[i]->go );
+
+		/* Return value is always NULL (see wbuffer_write_thread).
+		 */
+		(void) vips_g_thread_join( write->thread );
+		VIPS_DEBUG_MSG( "write_free: vips_g_thread_join()\n" );
+
+		write->thread = NULL;
+	}
+
+	if( write->ring ) {
+		for( i = 0; i < write->n_buffers; i++ ) 
+			VIPS_FREEF( wbuffer_free, write->ring[i] );
+		VIPS_FREE( write->ring );
+	}
+
+	if( write->n_blocked )
+		g_info( "vips_sink_disc: "
+			"%d of %d buffers waited for the writer",
+			write->n_blocked, write->n_started );
 }
 
 /**
@@ -485,6 +678,12 @@ write_free( Write *write )
  * disc files. Things like vips_jpegsave(), for example, use this to write
  * images to files in JPEG format. 
  *
+ * Sections are written by a background thread from a ring of buffers, so
+ * computation can run ahead of a slow @write_fn. There are two buffers by
+ * default. Set `VIPS_DISC_BUFFERS` or `--vips-disc-buffers` for more, up to 
+ * a memory limit of `VIPS_DISC_BUFFER_MEMORY` or `--vips-disc-buffer-memory`,
+ * 100mb by default. 
+ *
  * See also: vips_concurrency_set().
  *
  * Returns: 0 on success, -1 on error.
@@ -494,36 +693,39 @@ vips_sink_disc( VipsImage *im, VipsRegionWrite write_fn, void *a )
 {
 	Write write;
 	int result;
+	int i;
 
 	vips_image_preeval( im );
 
-	write_init( &write, im, write_fn, a );
-
 	result = 0;
-	if( !write.buf || 
-		!write.buf_back || 
-		wbuffer_position( write.buf, 0, write.sink_base.n_lines ) ||
-		vips_threadpool_run( im, 
+	if( write_init( &write, im, write_fn, a ) ||
+		wbuffer_position( WRITE_CURRENT( &write ), 
+			0, write.sink_base.n_lines ) ||
+		vips_threadpool_run_batch( im, 
 			write_thread_state_new, 
-			wbuffer_allocate_fn, 
+			wbuffer_allocate_batch_fn, 
 			wbuffer_work_fn, 
 			vips_sink_base_progress, 
 			&write ) )  
 		result = -1;
 
-	/* Just before allocate signalled stop, it set write.buf writing. We
-	 * need to wait for this write to finish. 
+	/* Just before allocate signalled stop, it set the current buffer 
+	 * writing. We need to wait for this and any other queued writes to
+	 * finish. 
 	 *
-	 * We can't just free the buffers (which will wait for the bg threads 
-	 * to finish), since the bg thread might see the kill before it gets a 
-	 * chance to write.
+	 * We can't just free the buffers (which will kill the bg thread), 
+	 * since the bg thread might see the kill before it gets a chance to 
+	 * write.
 	 *
-	 * If the pool exited with an error, write.buf might not have been
-	 * started (if the allocate failed), and in any case, we don't care if
-	 * the final write went through or not.
+	 * If the pool exited with an error, the current buffer might not 
+	 * have been started (if the allocate failed), and in any case, we 
+	 * don't care if the final write went through or not.
 	 */
 	if( !result ) 
-		vips_semaphore_down( &write.buf->done );
+		for( i = 0; i < write.n_buffers; i++ ) 
+			if( wbuffer_wait( WRITE_BUFFER( &write, 
+				write.current + 1 + i ) ) )
+				result = -1;
 
 	vips_image_posteval( im );
 
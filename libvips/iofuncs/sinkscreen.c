@@ -10,6 +10,10 @@
  * 1/12/15
  * 	- don't do anything to out or mask after they have closed
  * 	- only run the bg render thread when there's work to do
+ * 14/10/18
+ * 	- several bg render threads, each working on a different render
+ * 	- add vips_sink_screen_viewport() to cancel and prefetch tiles
+ * 	- add an optional tile store shared between renders
  */
 
 /*
@@ -94,6 +98,12 @@ typedef struct {
 	 */
 	gboolean dirty;
 
+	/* The tile was taken off the dirty list by
+	 * vips_sink_screen_viewport() before it was painted. Queue it again
+	 * if it's asked for.
+	 */
+	gboolean cancelled;
+
 	/* Time of last use, for LRU flush 
 	 */
 	int ticks;
@@ -143,6 +153,11 @@ typedef struct _Render {
 	 * anything to them until we shut down too.
 	 */
 	gboolean shutdown;
+
+	/* Set this to make the bg thread working on this render stop and
+	 * reschedule.
+	 */
+	gboolean reschedule;
 } Render;
 
 /* Our per-thread state.
@@ -150,9 +165,6 @@ typedef struct _Render {
 typedef struct _RenderThreadState {
 	VipsThreadState parent_object;
 
-	/* The tile that should be calculated.
-	 */
-	Tile *tile;
 } RenderThreadState;
 
 typedef struct _RenderThreadStateClass {
@@ -162,25 +174,50 @@ typedef struct _RenderThreadStateClass {
 
 G_DEFINE_TYPE( RenderThreadState, render_thread_state, VIPS_TYPE_THREAD_STATE );
 
-/* The BG thread which sits waiting to do some calculations, and the semaphore
- * it waits on holding the number of renders with dirty tiles. 
+/* The BG threads which sit waiting to do some calculations. Each takes a
+ * render off the dirty list, so they usually work on different renders. A
+ * render can go back on the list and be picked up by a second thread while
+ * the first is still working on it, but that's safe, since tiles are handed
+ * out under render->lock.
  */
-static GThread *render_thread = NULL;
+#define RENDER_THREADS_MAX (4)
+static GThread *render_threads[RENDER_THREADS_MAX];
+static int render_n_threads = 0;
 
-/* Set this to ask the render thread to quit.
+/* Set this to ask the render threads to quit.
  */
 static gboolean render_kill = FALSE;
 
-/* All the renders with dirty tiles, and a semaphore that the bg render thread
- * waits on.
+/* All the renders with dirty tiles, and a semaphore that the bg render
+ * threads wait on.
  */
 static GMutex *render_dirty_lock = NULL;
 static GSList *render_dirty_all = NULL;
 static VipsSemaphore n_render_dirty_sem; 
 
-/* Set this to make the bg thread stop and reschedule.
+/* A tile in the shared store. The region holds a ref to the source image,
+ * so the pointer in the key can't be reused while we have the tile.
  */
-static gboolean render_reschedule = FALSE;
+typedef struct _SharedTile {
+	VipsImage *in;
+	VipsRect area;
+	VipsRegion *region;
+	size_t size;
+
+	/* Our link in shared_lru.
+	 */
+	GList *link;
+} SharedTile;
+
+/* Tiles painted by any render, keyed by source image and area, so renders
+ * of the same image can skip work another render has already done. Off
+ * until vips_sink_screen_set_shared_mem() sets a memory limit.
+ */
+static GMutex *shared_lock = NULL;
+static GHashTable *shared_tiles = NULL;
+static GQueue shared_lru = G_QUEUE_INIT;
+static size_t shared_mem = 0;
+static size_t shared_max_mem = 0;
 
 static void
 render_thread_state_class_init( RenderThreadStateClass *class )
@@ -194,7 +231,6 @@ render_thread_state_class_init( RenderThreadStateClass *class )
 static void
 render_thread_state_init( RenderThreadState *state )
 {
-	state->tile = NULL;
 }
 
 static VipsThreadState *
@@ -205,6 +241,146 @@ render_thread_state_new( VipsImage *im, void *a )
 		vips_thread_state_set, im, a ) ) );
 }
 
+static guint
+shared_tile_hash( gconstpointer key )
+{
+	SharedTile *shared = (SharedTile *) key;
+
+	int x = shared->area.left / shared->area.width;
+	int y = shared->area.top / shared->area.height;
+
+	return( g_direct_hash( shared->in ) ^ (x << 16 ^ y) );
+}
+
+static gboolean
+shared_tile_equal( gconstpointer a, gconstpointer b )
+{
+	SharedTile *shared1 = (SharedTile *) a;
+	SharedTile *shared2 = (SharedTile *) b;
+
+	return( shared1->in == shared2->in &&
+		vips_rect_equalsrect( &shared1->area, &shared2->area ) );
+}
+
+/* Remove from the store and free. Call with shared_lock held.
+ */
+static void
+shared_tile_remove( SharedTile *shared )
+{
+	g_hash_table_remove( shared_tiles, shared );
+	g_queue_delete_link( &shared_lru, shared->link );
+	shared_mem -= shared->size;
+
+	VIPS_UNREF( shared->region );
+	g_free( shared );
+}
+
+/* Drop least-recently-used tiles until we are under the limit. Call with
+ * shared_lock held.
+ */
+static void
+shared_tile_trim( void )
+{
+	while( shared_mem > shared_max_mem &&
+		!g_queue_is_empty( &shared_lru ) )
+		shared_tile_remove( (SharedTile *)
+			g_queue_peek_tail( &shared_lru ) );
+}
+
+/* Look up a tile. Invalid tiles are removed. Call with shared_lock held.
+ */
+static SharedTile *
+shared_tile_lookup( VipsImage *in, VipsRect *area )
+{
+	SharedTile key;
+	SharedTile *shared;
+
+	key.in = in;
+	key.area = *area;
+	if( (shared = (SharedTile *)
+		g_hash_table_lookup( shared_tiles, &key )) &&
+		shared->region->invalid ) {
+		shared_tile_remove( shared );
+		shared = NULL;
+	}
+
+	return( shared );
+}
+
+/* Try to fill a tile from the store.
+ */
+static gboolean
+shared_tile_get( VipsImage *in, VipsRegion *region, VipsRect *area )
+{
+	gboolean found;
+	SharedTile *shared;
+
+	if( !shared_max_mem )
+		return( FALSE );
+
+	found = FALSE;
+
+	g_mutex_lock( shared_lock );
+
+	if( (shared = shared_tile_lookup( in, area )) &&
+		!vips_region_buffer( region, area ) ) {
+		vips_region_copy( shared->region, region,
+			&shared->region->valid,
+			shared->region->valid.left,
+			shared->region->valid.top );
+
+		g_queue_unlink( &shared_lru, shared->link );
+		g_queue_push_head_link( &shared_lru, shared->link );
+
+		found = TRUE;
+	}
+
+	g_mutex_unlock( shared_lock );
+
+	return( found );
+}
+
+/* Add a freshly painted tile to the store.
+ */
+static void
+shared_tile_put( VipsImage *in, VipsRegion *region, VipsRect *area )
+{
+	SharedTile *shared;
+
+	if( !shared_max_mem )
+		return;
+
+	g_mutex_lock( shared_lock );
+
+	if( !shared_tile_lookup( in, area ) ) {
+		shared = g_new( SharedTile, 1 );
+		shared->in = in;
+		shared->area = *area;
+		shared->size = VIPS_REGION_SIZEOF_LINE( region ) *
+			region->valid.height;
+
+		if( !(shared->region = vips_region_new( in )) ||
+			vips_region_buffer( shared->region, area ) ) {
+			VIPS_UNREF( shared->region );
+			g_free( shared );
+		}
+		else {
+			vips_region_copy( region, shared->region,
+				&region->valid,
+				region->valid.left, region->valid.top );
+
+			g_hash_table_insert( shared_tiles, shared, shared );
+			g_queue_push_head( &shared_lru, shared );
+			shared->link = g_queue_peek_head_link( &shared_lru );
+			shared_mem += shared->size;
+
+			shared_tile_trim();
+		}
+	}
+
+	g_mutex_unlock( shared_lock );
+}
+
 static void *
 tile_free( Tile *tile )
 {
@@ -228,7 +404,7 @@ render_free( Render *render )
 		render_dirty_all = g_slist_remove( render_dirty_all, render );
 
 		/* We don't need to adjust the semaphore: if it's too high, 
-		 * the render thread will just loop and decrement next time 
+		 * a render thread will just loop and decrement next time
 		 * render_dirty_all is NULL.
 		 */
 	}
@@ -339,11 +515,29 @@ tile_dirty_set( Tile *tile )
 		render->dirty = g_slist_prepend( render->dirty, tile );
 		tile->dirty = TRUE;
 		tile->painted = FALSE;
+		tile->cancelled = FALSE;
 	}
 	else
 		g_assert( g_slist_find( render->dirty, tile ) );
 }
 
+/* Add a tile to the end of the dirty list, so it's painted after everything
+ * else. For prefetch.
+ */
+static void
+tile_dirty_append( Tile *tile )
+{
+	Render *render = tile->render;
+
+	if( !tile->dirty ) {
+		g_assert( !g_slist_find( render->dirty, tile ) );
+		render->dirty = g_slist_append( render->dirty, tile );
+		tile->dirty = TRUE;
+		tile->painted = FALSE;
+		tile->cancelled = FALSE;
+	}
+}
+
 /* Bump a tile to the front of the dirty list, if it's there.
  */
 static void
@@ -361,26 +555,37 @@ tile_dirty_bump( Tile *tile )
 		g_assert( !g_slist_find( render->dirty, tile ) );
 }
 
+/* Take up to max_units dirty tiles in one go.
+ */
 static int 
-render_allocate( VipsThreadState *state, void *a, gboolean *stop )
+render_allocate_batch( VipsThreadState *state, void *a, 
+	VipsThreadUnit *units, int max_units, int *n_units, gboolean *stop )
 {
 	Render *render = (Render *) a;
-	RenderThreadState *rstate = (RenderThreadState *) state;
-	Tile *tile;
+
+	int n;
 
 	g_mutex_lock( render->lock );
 
-	if( render_reschedule || 
-		!(tile = render_tile_dirty_get( render )) ) {
-		VIPS_DEBUG_MSG_GREEN( "render_allocate: stopping\n" );
-		*stop = TRUE;
-		rstate->tile = NULL;
+	for( n = 0; n < max_units; n++ ) {
+		Tile *tile;
+
+		if( render_kill ||
+			render->reschedule ||
+			!(tile = render_tile_dirty_get( render )) ) {
+			VIPS_DEBUG_MSG_GREEN( "render_allocate: stopping\n" );
+			*stop = TRUE;
+			break;
+		}
+
+		units[n].pos = tile->area;
+		units[n].data = tile;
 	}
-	else 
-		rstate->tile = tile;
 
 	g_mutex_unlock( render->lock );
 
+	*n_units = n;
+
 	return( 0 );
 }
 
@@ -388,20 +593,32 @@ static int
 render_work( VipsThreadState *state, void *a )
 {
 	Render *render = (Render *) a;
-	RenderThreadState *rstate = (RenderThreadState *) state;
-	Tile *tile = rstate->tile;
+	Tile *tile = (Tile *) state->unit;
 
 	g_assert( tile );
 
 	VIPS_DEBUG_MSG( "calculating tile %p %dx%d\n", 
 		tile, tile->area.left, tile->area.top );
 
-	if( vips_region_prepare_to( state->reg, tile->region, 
-		&tile->area, tile->area.left, tile->area.top ) ) {
-		VIPS_DEBUG_MSG_RED( "render_work: "
-			"vips_region_prepare_to() failed: %s\n",
-			vips_error_buffer() ); 
-		return( -1 );
+	/* Another render may have painted this tile already.
+	 */
+	if( shared_tile_get( render->in, tile->region, &tile->area ) )
+		VIPS_DEBUG_MSG( "render_work: shared tile for %p\n", tile );
+	else {
+		if( vips_region_prepare_to( state->reg, tile->region,
+			&tile->area, tile->area.left, tile->area.top ) ) {
+			VIPS_DEBUG_MSG_RED( "render_work: "
+				"vips_region_prepare_to() failed: %s\n",
+				vips_error_buffer() );
+			return( -1 );
+		}
+
+		/* Don't share the pixels if the tile was moved while we
+		 * worked.
+		 */
+		if( vips_rect_equalsrect( &state->pos, &tile->area ) )
+			shared_tile_put( render->in,
+				tile->region, &tile->area );
 	}
 	tile->painted = TRUE;
 
@@ -433,23 +650,35 @@ vips__render_shutdown( void )
 	/* We may come here without having inited.
 	 */
 	if( render_dirty_lock ) {
-		g_mutex_lock( render_dirty_lock );
+		GThread *threads[RENDER_THREADS_MAX];
+		int n_threads;
+		int i;
 
-		if( render_thread ) { 
-			GThread *thread;
+		g_mutex_lock( render_dirty_lock );
 
-			thread = render_thread;
-			render_reschedule = TRUE;
-			render_kill = TRUE;
+		n_threads = render_n_threads;
+		for( i = 0; i < n_threads; i++ )
+			threads[i] = render_threads[i];
+		render_n_threads = 0;
+		render_kill = TRUE;
 
-			g_mutex_unlock( render_dirty_lock );
+		g_mutex_unlock( render_dirty_lock );
 
+		/* Wake every thread, they will see render_kill and exit.
+		 */
+		for( i = 0; i < n_threads; i++ )
 			vips_semaphore_up( &n_render_dirty_sem ); 
 
-			(void) vips_g_thread_join( thread );
-		}
-		else
-			g_mutex_unlock( render_dirty_lock );
+		for( i = 0; i < n_threads; i++ )
+			(void) vips_g_thread_join( threads[i] );
+
+		/* Drop the refs the shared store holds.
+		 */
+		g_mutex_lock( shared_lock );
+		while( !g_queue_is_empty( &shared_lru ) )
+			shared_tile_remove( (SharedTile *)
+				g_queue_peek_tail( &shared_lru ) );
+		g_mutex_unlock( shared_lock );
 	}
 }
 
@@ -522,7 +751,7 @@ render_close_cb( VipsImage *image, Render *render )
 	 * make it drop it's ref and think again.
 	 */
 	VIPS_DEBUG_MSG_GREEN( "render_close_cb: reschedule\n" );
-	render_reschedule = TRUE;
+	render->reschedule = TRUE;
 
 	return( 0 );
 }
@@ -570,6 +799,7 @@ render_new( VipsImage *in, VipsImage *out, VipsImage *mask,
 	render->dirty = NULL;
 
 	render->shutdown = FALSE;
+	render->reschedule = FALSE;
 
 	/* Both out and mask must close before we can free the render.
 	 */
@@ -614,6 +844,7 @@ tile_new( Render *render )
 	tile->region = NULL;
 	tile->painted = FALSE;
 	tile->dirty = FALSE;
+	tile->cancelled = FALSE;
 	tile->ticks = render->ticks;
 
 	if( !(tile->region = vips_region_new( render->in )) ) {
@@ -646,6 +877,7 @@ render_tile_add( Tile *tile, VipsRect *area )
 
 	tile->area = *area;
 	tile->painted = FALSE;
+	tile->cancelled = FALSE;
 
 	/* Ignore buffer allocate errors, there's not much we could do with 
 	 * them.
@@ -723,9 +955,16 @@ tile_queue( Tile *tile, VipsRegion *reg )
 		 */
 		g_mutex_unlock( render->lock );
 
-		if( vips_region_prepare_to( reg, tile->region, 
-			&tile->area, tile->area.left, tile->area.top ) ) 
-			VIPS_DEBUG_MSG_RED( "tile_queue: prepare failed\n" ); 
+		if( !shared_tile_get( render->in,
+			tile->region, &tile->area ) ) {
+			if( vips_region_prepare_to( reg, tile->region,
+				&tile->area, tile->area.left, tile->area.top ) )
+				VIPS_DEBUG_MSG_RED( "tile_queue: "
+					"prepare failed\n" );
+			else
+				shared_tile_put( render->in,
+					tile->region, &tile->area );
+		}
 
 		g_mutex_lock( render->lock );
 
@@ -741,6 +980,19 @@ tile_test_clean_ticks( VipsRect *key, Tile *value, Tile **best )
 			*best = value;
 }
 
+/* As tile_test_clean_ticks(), but only for tiles which are in the shared
+ * store. Call with shared_lock held.
+ */
+static void
+tile_test_shared_ticks( VipsRect *key, Tile *value, Tile **best )
+{
+	if( value->painted )
+		if( !*best || value->ticks < (*best)->ticks )
+			if( shared_tile_lookup( value->render->in,
+				&value->area ) )
+				*best = value;
+}
+
 /* Pick a painted tile to reuse. Search for LRU (slow!).
  */
 static Tile *
@@ -749,8 +1001,20 @@ render_tile_get_painted( Render *render )
 	Tile *tile;
 
 	tile = NULL;
-	g_hash_table_foreach( render->tiles,
-		(GHFunc) tile_test_clean_ticks, &tile );
+
+	/* Prefer tiles we can get back from the shared store with a copy
+	 * rather than a recalculation.
+	 */
+	if( shared_max_mem ) {
+		g_mutex_lock( shared_lock );
+		g_hash_table_foreach( render->tiles,
+			(GHFunc) tile_test_shared_ticks, &tile );
+		g_mutex_unlock( shared_lock );
+	}
+
+	if( !tile )
+		g_hash_table_foreach( render->tiles,
+			(GHFunc) tile_test_clean_ticks, &tile );
 
 	if( tile ) {
 		VIPS_DEBUG_MSG( "render_tile_get_painted: "
@@ -773,9 +1037,10 @@ render_tile_request( Render *render, VipsRegion *reg, VipsRect *area )
 
 	if( (tile = render_tile_lookup( render, area )) ) {
 		/* We already have a tile at this position. If it's invalid,
-		 * ask for a repaint.
+		 * or was cancelled before it was painted, ask for a repaint.
 		 */
-		if( tile->region->invalid ) 
+		if( tile->region->invalid ||
+			tile->cancelled )
 			tile_queue( tile, reg );
 		else
 			tile_touch( tile );
@@ -811,6 +1076,97 @@ render_tile_request( Render *render, VipsRegion *reg, VipsRect *area )
 	return( tile );
 }
 
+static gboolean
+rect_overlaps( VipsRect *a, VipsRect *b )
+{
+	VipsRect overlap;
+
+	vips_rect_intersectrect( a, b, &overlap );
+
+	return( !vips_rect_isempty( &overlap ) );
+}
+
+/* Prefetch the tiles in @predicted which aren't visible. Tiles go on the end
+ * of the dirty list, nearest the viewport first, and we never evict a tile
+ * which is visible to make room.
+ */
+static void
+render_prefetch( Render *render, VipsRect *visible, VipsRect *predicted,
+	int dx, int dy )
+{
+	int tile_width = render->tile_width;
+	int tile_height = render->tile_height;
+
+	int xs, ys, xe, ye;
+	int x, y;
+
+	if( vips_rect_isempty( predicted ) )
+		return;
+
+	/* Tile positions of the top-left and bottom-right tiles we need.
+	 */
+	xs = predicted->left / tile_width;
+	ys = predicted->top / tile_height;
+	xe = (VIPS_RECT_RIGHT( predicted ) - 1) / tile_width;
+	ye = (VIPS_RECT_BOTTOM( predicted ) - 1) / tile_height;
+
+	/* Walk in the direction of the pan, so nearer tiles are queued first.
+	 */
+	if( dx < 0 )
+		VIPS_SWAP( int, xs, xe );
+	if( dy < 0 )
+		VIPS_SWAP( int, ys, ye );
+
+	for( y = ys; ; y += dy < 0 ? -1 : 1 ) {
+		for( x = xs; ; x += dx < 0 ? -1 : 1 ) {
+			VipsRect area;
+			Tile *tile;
+
+			area.left = x * tile_width;
+			area.top = y * tile_height;
+			area.width = tile_width;
+			area.height = tile_height;
+
+			if( !rect_overlaps( &area, visible ) ) {
+				if( (tile = render_tile_lookup( render,
+					&area )) ) {
+					if( tile->region->invalid ||
+						tile->cancelled )
+						tile_dirty_append( tile );
+				}
+				else if( render->ntiles < render->max_tiles ||
+					render->max_tiles == -1 ) {
+					if( !(tile = tile_new( render )) )
+						return;
+					render_tile_add( tile, &area );
+					tile_dirty_append( tile );
+				}
+				else {
+					if( !(tile = render_tile_get_painted(
+						render )) ||
+						rect_overlaps(
+							&tile->area, visible ) )
+						return;
+					render_tile_move( tile, &area );
+					tile_dirty_append( tile );
+				}
+
+				/* Keep it out of the way of the next
+				 * reuse.
+				 */
+				tile->ticks = render->ticks;
+				render->ticks += 1;
+			}
+
+			if( x == xe )
+				break;
+		}
+
+		if( y == ye )
+			break;
+	}
+}
+
 /* Copy what we can from the tile into the region.
  */
 static void
@@ -995,12 +1351,12 @@ render_thread_main( void *client )
 		VIPS_DEBUG_MSG_GREEN( "render_thread_main: "
 			"threadpool start\n" );
 
-		render_reschedule = FALSE;
-
 		if( (render = render_dirty_get()) ) {
-			if( vips_threadpool_run( render->in,
+			render->reschedule = FALSE;
+
+			if( vips_threadpool_run_batch( render->in,
 				render_thread_state_new,
-				render_allocate,
+				render_allocate_batch,
 				render_work,
 				NULL,
 				render ) )
@@ -1022,28 +1378,45 @@ render_thread_main( void *client )
 		}
 	}
 
-	/* We are exiting, so render_thread must now be NULL.
-	 */
-	render_thread = NULL; 
-
 	return( NULL );
 }
 
 static void
 vips_sink_screen_init( void )
 {
-	g_assert( !render_thread ); 
+	int n_threads;
+	int i;
+
+	g_assert( !render_n_threads );
 	g_assert( !render_dirty_lock ); 
 
 	render_dirty_lock = vips_g_mutex_new();
-	render_thread = vips_g_thread_new( "sink_screen",
-		render_thread_main, NULL );
 	vips_semaphore_init( &n_render_dirty_sem, 0, "n_render_dirty" );
 
-	g_assert( render_thread ); 
+	shared_lock = vips_g_mutex_new();
+	shared_tiles = g_hash_table_new( shared_tile_hash, shared_tile_equal );
+
+	/* Each render runs a threadpool of its own, so we don't need many of
+	 * these.
+	 */
+	n_threads = VIPS_CLIP( 1, vips_concurrency_get(), RENDER_THREADS_MAX );
+	for( i = 0; i < n_threads; i++ )
+		if( (render_threads[render_n_threads] = vips_g_thread_new(
+			"sink_screen", render_thread_main, NULL )) )
+			render_n_threads += 1;
+
+	g_assert( render_n_threads );
 	g_assert( render_dirty_lock ); 
 }
 
+static void
+vips_sink_screen_once( void )
+{
+	static GOnce once = G_ONCE_INIT;
+
+	VIPS_ONCE( &once, (GThreadFunc) vips_sink_screen_init, NULL );
+}
+
 /**
  * vips_sink_screen: (method)
  * @in: input image
@@ -1066,9 +1439,9 @@ vips_sink_screen_init( void )
  * The @mask image is a one-band uchar image and has 255 for pixels which are 
  * currently in cache and 0 for uncalculated pixels.
  *
- * Only a single sink is calculated at any one time, though many may be
- * alive. Use @priority to indicate which renders are more important:  
- * zero means normal
+ * A few sinks are calculated at once, each by a background thread, though
+ * many may be alive. Use @priority to indicate which renders are more
+ * important: zero means normal
  * priority, negative numbers are low priority, positive numbers high
  * priority.
  *
@@ -1089,8 +1462,12 @@ vips_sink_screen_init( void )
  * vips_region_prepare() on @out will always block until the pixels have been
  * calculated.
  *
- * See also: vips_tilecache(), vips_region_prepare(), 
- * vips_sink_disc(), vips_sink().
+ * Use vips_sink_screen_viewport() to tell the render which part of @out
+ * is visible and how it is moving. Use vips_sink_screen_set_shared_mem() to
+ * let renders of the same image share tiles.
+ *
+ * See also: vips_sink_screen_viewport(), vips_tilecache(),
+ * vips_region_prepare(), vips_sink_disc(), vips_sink().
  *
  * Returns: 0 on sucess, -1 on error.
  */
@@ -1101,11 +1478,9 @@ vips_sink_screen( VipsImage *in, VipsImage *out, VipsImage *mask,
 	int priority,
 	VipsSinkNotify notify_fn, void *a )
 {
-	static GOnce once = G_ONCE_INIT;
-
 	Render *render;
 
-	VIPS_ONCE( &once, (GThreadFunc) vips_sink_screen_init, NULL );
+	vips_sink_screen_once();
 
 	if( tile_width <= 0 || tile_height <= 0 || 
 		max_tiles < -1 ) {
@@ -1135,6 +1510,11 @@ vips_sink_screen( VipsImage *in, VipsImage *out, VipsImage *mask,
 
 	VIPS_DEBUG_MSG( "vips_sink_screen: max = %d, %p\n", max_tiles, render );
 
+	/* So vips_sink_screen_viewport() can find us. The render lives until
+	 * out closes.
+	 */
+	g_object_set_data( G_OBJECT( out ), "vips-sink-screen", render );
+
 	if( vips_image_generate( out, 
 		vips_start_one, image_fill, vips_stop_one, in, render ) )
 		return( -1 );
@@ -1146,6 +1526,139 @@ vips_sink_screen( VipsImage *in, VipsImage *out, VipsImage *mask,
 	return( 0 );
 }
 
+/**
+ * vips_sink_screen_viewport: (method)
+ * @out: output image from vips_sink_screen()
+ * @viewport: the area of @out which is visible
+ * @dx: horizontal movement expected before the next update
+ * @dy: vertical movement expected before the next update
+ *
+ * Tell a background render which part of @out the user can see and which
+ * way it's moving. Call this whenever the view changes.
+ *
+ * Queued tiles which are neither visible nor in the path of the view are
+ * dropped from the queue, and queued tiles which are visible are moved to
+ * the front. If @dx or @dy are non-zero, tiles in @viewport moved
+ * by @dx, @dy are queued after that, ready for when they come into view.
+ * Prefetching never evicts a visible tile from the cache.
+ *
+ * This does nothing if @out was not made by vips_sink_screen() with a
+ * notify function.
+ *
+ * See also: vips_sink_screen().
+ */
+void
+vips_sink_screen_viewport( VipsImage *out, VipsRect *viewport,
+	int dx, int dy )
+{
+	Render *render;
+	VipsRect image;
+	VipsRect visible;
+	VipsRect predicted;
+	VipsRect keep;
+	GSList *front;
+	GSList *back;
+	GSList *p;
+
+	if( !(render = (Render *)
+		g_object_get_data( G_OBJECT( out ), "vips-sink-screen" )) ||
+		!render->notify )
+		return;
+
+	image.left = 0;
+	image.top = 0;
+	image.width = out->Xsize;
+	image.height = out->Ysize;
+	vips_rect_intersectrect( viewport, &image, &visible );
+	predicted = visible;
+	predicted.left += dx;
+	predicted.top += dy;
+	vips_rect_intersectrect( &predicted, &image, &predicted );
+	vips_rect_unionrect( &visible, &predicted, &keep );
+
+	g_mutex_lock( render->lock );
+
+	/* Visible tiles to the front, then tiles we'll need soon, in their
+	 * current order. Cancel anything else.
+	 */
+	front = NULL;
+	back = NULL;
+	for( p = render->dirty; p; p = p->next ) {
+		Tile *tile = (Tile *) p->data;
+
+		if( rect_overlaps( &tile->area, &visible ) )
+			front = g_slist_prepend( front, tile );
+		else if( rect_overlaps( &tile->area, &keep ) )
+			back = g_slist_prepend( back, tile );
+		else {
+			VIPS_DEBUG_MSG( "vips_sink_screen_viewport: "
+				"cancelling %p\n", tile );
+			tile->dirty = FALSE;
+			tile->cancelled = TRUE;
+		}
+	}
+	g_slist_free( render->dirty );
+	render->dirty = g_slist_concat( g_slist_reverse( front ),
+		g_slist_reverse( back ) );
+
+	if( dx ||
+		dy )
+		render_prefetch( render, &visible, &predicted, dx, dy );
+
+	render_dirty_put( render );
+
+	g_mutex_unlock( render->lock );
+}
+
+/**
+ * vips_sink_screen_set_shared_mem:
+ * @max_mem: maximum number of bytes of shared tiles
+ *
+ * Renders made by vips_sink_screen() can share painted tiles through a
+ * process-wide store, so when several views show the same image, each tile
+ * is only calculated once. The store is off by default. Set a memory limit
+ * to turn it on, or zero to turn it off again. The least-recently-used
+ * tiles are dropped when the store goes over the limit.
+ *
+ * Renders only share tiles if they have the same #VipsImage as the source
+ * and the same tile size. The operation cache usually makes identical
+ * pipelines, for example two views of one file at one zoom, end in the
+ * same image.
+ *
+ * See also: vips_sink_screen(), vips_sink_screen_get_shared_mem().
+ */
+void
+vips_sink_screen_set_shared_mem( size_t max_mem )
+{
+	vips_sink_screen_once();
+
+	g_mutex_lock( shared_lock );
+	shared_max_mem = max_mem;
+	shared_tile_trim();
+	g_mutex_unlock( shared_lock );
+}
+
+/**
+ * vips_sink_screen_get_shared_mem:
+ *
+ * Returns: the number of bytes of tiles currently in the shared store.
+ *
+ * See also: vips_sink_screen_set_shared_mem().
+ */
+size_t
+vips_sink_screen_get_shared_mem( void )
+{
+	size_t mem;
+
+	vips_sink_screen_once();
+
+	g_mutex_lock( shared_lock );
+	mem = shared_mem;
+	g_mutex_unlock( shared_lock );
+
+	return( mem );
+}
+
 void
 vips__print_renders( void )
 {
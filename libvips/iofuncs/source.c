@@ -0,0 +1,910 @@
+/* A byte source for loaders.
+ *
+ * 14/10/18
+ * 	- from buffer.c
+ * 15/10/26
+ * 	- add new_from_string so the CLI can make sources from filenames
+ */
+
+/*
+
+    This file is part of VIPS.
+
+    VIPS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA
+
+ */
+
+/*
+
+    These files are distributed with VIPS - http://www.vips.ecs.soton.ac.uk
+
+ */
+
+/*
+#define VIPS_DEBUG
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /*HAVE_CONFIG_H*/
+#include <vips/intl.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif /*HAVE_UNISTD_H*/
+#include <fcntl.h>
+#ifdef OS_WIN32
+#include <io.h>
+#endif /*OS_WIN32*/
+
+#include <vips/vips.h>
+#include <vips/internal.h>
+#include <vips/debug.h>
+
+#include "vipsmarshal.h"
+
+/**
+ * SECTION: stream
+ * @short_description: byte sources and targets for loaders and savers
+ * @stability: Stable
+ * @see_also: <link linkend="libvips-foreign">foreign</link>
+ * @include: vips/vips.h
+ *
+ * A #VipsSource is a source of bytes for a loader. It can read from a file
+ * descriptor (perhaps a pipe or a socket), a file, an area of memory, or
+ * from a pair of callbacks (see #VipsSourceCustom). Loaders with the
+ * "_source" suffix, such as vips_jpegload_source(), start decoding as soon
+ * as the first bytes arrive.
+ *
+ * Sources that can't seek, such as pipes, keep everything they read until
+ * decode starts, so loaders can sniff the format and read the header, then
+ * rewind. If a loader needs to seek after that, or needs the whole file in
+ * memory, the rest of the pipe is read to memory.
+ *
+ * A #VipsTarget is the matching destination for savers. It can write to a
+ * file descriptor, a file, a memory buffer, or to a pair of callbacks (see
+ * #VipsTargetCustom).
+ *
+ * See also: vips_image_new_from_source(), vips_image_write_to_target().
+ */
+
+/* Try to make an O_BINARY ... sometimes need the leading '_'.
+ */
+#ifdef BINARY_OPEN
+#ifndef O_BINARY
+#ifdef _O_BINARY
+#define O_BINARY _O_BINARY
+#endif /*_O_BINARY*/
+#endif /*!O_BINARY*/
+#endif /*BINARY_OPEN*/
+
+/* If we have O_BINARY, add it to a mode flags set.
+ */
+#ifdef O_BINARY
+#define BINARYIZE(M) ((M) | O_BINARY)
+#else /*!O_BINARY*/
+#define BINARYIZE(M) (M)
+#endif /*O_BINARY*/
+
+#define MODE_READ BINARYIZE (O_RDONLY)
+
+/* Read pipes to memory in chunks this size.
+ */
+#define VIPS_SOURCE_CHUNK_SIZE (65536)
+
+G_DEFINE_TYPE( VipsSource, vips_source, VIPS_TYPE_OBJECT );
+
+static void
+vips_source_finalize( GObject *gobject )
+{
+	VipsSource *source = VIPS_SOURCE( gobject );
+
+	VIPS_DEBUG_MSG( "vips_source_finalize: %p\n", source );
+
+	if( source->descriptor != -1 ) {
+		if( source->tracked_descriptor )
+			vips_tracked_close( source->descriptor );
+		else
+			close( source->descriptor );
+		source->descriptor = -1;
+	}
+
+	VIPS_FREEF( g_byte_array_unref, source->memory );
+	VIPS_FREEF( g_byte_array_unref, source->header_bytes );
+	VIPS_FREEF( g_byte_array_unref, source->sniff );
+
+	G_OBJECT_CLASS( vips_source_parent_class )->finalize( gobject );
+}
+
+static int
+vips_source_build( VipsObject *object )
+{
+	VipsSource *source = VIPS_SOURCE( object );
+
+	VIPS_DEBUG_MSG( "vips_source_build: %p\n", source );
+
+	if( VIPS_OBJECT_CLASS( vips_source_parent_class )->build( object ) )
+		return( -1 );
+
+	if( vips_object_argument_isset( object, "filename" ) ) {
+		int fd;
+
+		if( (fd = vips_tracked_open( source->filename,
+			MODE_READ, 0 )) == -1 ) {
+			vips_error_system( errno,
+				VIPS_OBJECT_GET_CLASS( object )->nickname,
+				_( "unable to open \"%s\"" ),
+				source->filename );
+			return( -1 );
+		}
+
+		source->descriptor = fd;
+		source->tracked_descriptor = TRUE;
+	}
+	else if( vips_object_argument_isset( object, "descriptor" ) ) {
+		/* Take a copy, the caller keeps theirs.
+		 */
+		source->descriptor = dup( source->descriptor );
+		source->tracked_descriptor = FALSE;
+		if( source->descriptor == -1 ) {
+			vips_error_system( errno,
+				VIPS_OBJECT_GET_CLASS( object )->nickname,
+				"%s", _( "unable to dup descriptor" ) );
+			return( -1 );
+		}
+	}
+
+	if( vips_object_argument_isset( object, "blob" ) ) {
+		size_t length;
+
+		source->data = vips_blob_get( source->blob, &length );
+		source->length = length;
+	}
+
+	source->sniff = g_byte_array_new();
+
+	return( 0 );
+}
+
+/* Can we seek this source? If not, we must save bytes for rewind. We test
+ * on first use rather than in build so that custom sources can attach
+ * their signal handlers after construction.
+ */
+static void
+vips_source_test_pipe( VipsSource *source )
+{
+	VipsSourceClass *class = VIPS_SOURCE_GET_CLASS( source );
+
+	if( source->data ||
+		source->pipe_tested )
+		return;
+
+	source->pipe_tested = TRUE;
+	source->is_pipe = class->seek( source, 0, SEEK_CUR ) == -1;
+	if( source->is_pipe )
+		source->header_bytes = g_byte_array_new();
+}
+
+static gint64
+vips_source_read_real( VipsSource *source, void *data, size_t length )
+{
+	gint64 bytes_read;
+
+	do {
+		bytes_read = read( source->descriptor, data, length );
+	} while( bytes_read < 0 && errno == EINTR );
+
+	return( bytes_read );
+}
+
+static gint64
+vips_source_seek_real( VipsSource *source, gint64 offset, int whence )
+{
+	if( source->descriptor == -1 )
+		return( -1 );
+
+#ifdef OS_WIN32
+	return( _lseeki64( source->descriptor, offset, whence ) );
+#else /*!OS_WIN32*/
+	return( lseek( source->descriptor, offset, whence ) );
+#endif /*OS_WIN32*/
+}
+
+static VipsObject *
+vips_source_new_from_string( const char *string )
+{
+	/* We mustn't _build() the object here, the caller does that.
+	 */
+	return( VIPS_OBJECT( g_object_new( VIPS_TYPE_SOURCE,
+		"filename", string,
+		NULL ) ) );
+}
+
+static void
+vips_source_class_init( VipsSourceClass *class )
+{
+	GObjectClass *gobject_class = G_OBJECT_CLASS( class );
+	VipsObjectClass *object_class = (VipsObjectClass *) class;
+
+	gobject_class->finalize = vips_source_finalize;
+	gobject_class->set_property = vips_object_set_property;
+	gobject_class->get_property = vips_object_get_property;
+
+	object_class->nickname = "source";
+	object_class->description = _( "input stream" );
+	object_class->new_from_string = vips_source_new_from_string;
+	object_class->build = vips_source_build;
+
+	class->read = vips_source_read_real;
+	class->seek = vips_source_seek_real;
+
+	VIPS_ARG_INT( class, "descriptor", 1,
+		_( "Descriptor" ),
+		_( "File descriptor for read" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsSource, descriptor ),
+		-1, 1000000000, -1 );
+
+	VIPS_ARG_STRING( class, "filename", 2,
+		_( "Filename" ),
+		_( "Name of file to open" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsSource, filename ),
+		NULL );
+
+	VIPS_ARG_BOXED( class, "blob", 3,
+		_( "Blob" ),
+		_( "Blob to load from" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsSource, blob ),
+		VIPS_TYPE_BLOB );
+
+}
+
+static void
+vips_source_init( VipsSource *source )
+{
+	source->descriptor = -1;
+	source->length = -1;
+}
+
+/**
+ * vips_source_new_from_descriptor:
+ * @descriptor: read from this file descriptor
+ *
+ * Create a source attached to a file descriptor. @descriptor is
+ * duplicated, so you can close it after this call.
+ *
+ * If @descriptor can't seek (a pipe or a socket, for example), bytes are
+ * kept in memory as they are read so that loaders can rewind after reading
+ * the header.
+ *
+ * Returns: a new #VipsSource, or %NULL on error.
+ */
+VipsSource *
+vips_source_new_from_descriptor( int descriptor )
+{
+	VipsSource *source;
+
+	source = VIPS_SOURCE( g_object_new( VIPS_TYPE_SOURCE,
+		"descriptor", descriptor,
+		NULL ) );
+
+	if( vips_object_build( VIPS_OBJECT( source ) ) ) {
+		VIPS_UNREF( source );
+		return( NULL );
+	}
+
+	return( source );
+}
+
+/**
+ * vips_source_new_from_file:
+ * @filename: read from this file
+ *
+ * Create a source attached to a file.
+ *
+ * Returns: a new #VipsSource, or %NULL on error.
+ */
+VipsSource *
+vips_source_new_from_file( const char *filename )
+{
+	VipsSource *source;
+
+	source = VIPS_SOURCE( g_object_new( VIPS_TYPE_SOURCE,
+		"filename", filename,
+		NULL ) );
+
+	if( vips_object_build( VIPS_OBJECT( source ) ) ) {
+		VIPS_UNREF( source );
+		return( NULL );
+	}
+
+	return( source );
+}
+
+/**
+ * vips_source_new_from_blob:
+ * @blob: memory area to load
+ *
+ * Create a source attached to an area of memory. The source holds a
+ * reference to @blob.
+ *
+ * Returns: a new #VipsSource, or %NULL on error.
+ */
+VipsSource *
+vips_source_new_from_blob( VipsBlob *blob )
+{
+	VipsSource *source;
+
+	source = VIPS_SOURCE( g_object_new( VIPS_TYPE_SOURCE,
+		"blob", blob,
+		NULL ) );
+
+	if( vips_object_build( VIPS_OBJECT( source ) ) ) {
+		VIPS_UNREF( source );
+		return( NULL );
+	}
+
+	return( source );
+}
+
+/**
+ * vips_source_new_from_memory:
+ * @data: memory area to load
+ * @length: size of memory area
+ *
+ * Create a source attached to an area of memory. The memory is not copied,
+ * so it must stay valid for as long as the source and any image loaded
+ * from it.
+ *
+ * Returns: a new #VipsSource, or %NULL on error.
+ */
+VipsSource *
+vips_source_new_from_memory( const void *data, size_t length )
+{
+	VipsBlob *blob;
+	VipsSource *source;
+
+	blob = vips_blob_new( NULL, data, length );
+	source = vips_source_new_from_blob( blob );
+	vips_area_unref( VIPS_AREA( blob ) );
+
+	return( source );
+}
+
+/**
+ * vips_source_read:
+ * @source: source to read from
+ * @data: buffer to fill
+ * @length: read up to this many bytes
+ *
+ * Read up to @length bytes from @source into @data.
+ *
+ * Returns: the number of bytes read, 0 on end of source, -1 on error.
+ */
+gint64
+vips_source_read( VipsSource *source, void *data, size_t length )
+{
+	VipsSourceClass *class = VIPS_SOURCE_GET_CLASS( source );
+
+	gint64 bytes_read;
+
+	vips_source_test_pipe( source );
+
+	if( source->data ) {
+		/* A memory source, or a pipe we've read to memory.
+		 */
+		bytes_read = VIPS_CLIP( 0,
+			source->length - source->read_position,
+			(gint64) length );
+		memcpy( data, source->data + source->read_position,
+			bytes_read );
+	}
+	else if( source->header_bytes &&
+		source->read_position < source->header_bytes->len ) {
+		/* We've rewound a pipe, replay the saved bytes.
+		 */
+		bytes_read = VIPS_MIN( (gint64) length,
+			source->header_bytes->len - source->read_position );
+		memcpy( data,
+			source->header_bytes->data + source->read_position,
+			bytes_read );
+	}
+	else {
+		if( (bytes_read = class->read( source, data, length )) < 0 ) {
+			vips_error_system( errno,
+				VIPS_OBJECT_GET_CLASS( source )->nickname,
+				"%s", _( "read error" ) );
+			return( -1 );
+		}
+
+		/* Keep saving pipe bytes until decode starts.
+		 */
+		if( source->header_bytes ) {
+			if( source->decode )
+				VIPS_FREEF( g_byte_array_unref,
+					source->header_bytes );
+			else
+				g_byte_array_append( source->header_bytes,
+					data, bytes_read );
+		}
+	}
+
+	source->read_position += bytes_read;
+
+	return( bytes_read );
+}
+
+/* Read the whole of a pipe to memory. We can only do this if we've kept all
+ * the bytes so far.
+ */
+static int
+vips_source_read_to_memory( VipsSource *source )
+{
+	VipsSourceClass *class = VIPS_SOURCE_GET_CLASS( source );
+
+	GByteArray *memory;
+	gint64 bytes_read;
+
+	g_assert( !source->data );
+
+	if( !source->header_bytes ) {
+		vips_error( VIPS_OBJECT_GET_CLASS( source )->nickname,
+			"%s", _( "unable to seek pipe after decode starts" ) );
+		return( -1 );
+	}
+
+	memory = source->header_bytes;
+	source->header_bytes = NULL;
+
+	do {
+		guint old_length = memory->len;
+
+		g_byte_array_set_size( memory,
+			old_length + VIPS_SOURCE_CHUNK_SIZE );
+		bytes_read = class->read( source,
+			memory->data + old_length, VIPS_SOURCE_CHUNK_SIZE );
+		g_byte_array_set_size( memory,
+			old_length + VIPS_MAX( 0, bytes_read ) );
+	} while( bytes_read > 0 );
+
+	if( bytes_read < 0 ) {
+		vips_error_system( errno,
+			VIPS_OBJECT_GET_CLASS( source )->nickname,
+			"%s", _( "read error" ) );
+		g_byte_array_unref( memory );
+		return( -1 );
+	}
+
+	source->memory = memory;
+	source->data = memory->data;
+	source->length = memory->len;
+
+	return( 0 );
+}
+
+/**
+ * vips_source_seek:
+ * @source: source to seek
+ * @offset: seek by this offset
+ * @whence: seek relative to this point, as lseek()
+ *
+ * Move the read position. Sources that can't seek will read the rest of the
+ * input to memory, unless the position is within the bytes saved before
+ * decode started.
+ *
+ * Returns: the new read position, or -1 on error.
+ */
+gint64
+vips_source_seek( VipsSource *source, gint64 offset, int whence )
+{
+	VipsSourceClass *class = VIPS_SOURCE_GET_CLASS( source );
+	const char *nick = VIPS_OBJECT_GET_CLASS( source )->nickname;
+
+	gint64 new_position;
+
+	vips_source_test_pipe( source );
+
+	if( !source->data &&
+		source->is_pipe ) {
+		if( whence == SEEK_SET &&
+			source->header_bytes &&
+			offset >= 0 &&
+			offset <= source->header_bytes->len ) {
+			/* Rewind within the saved bytes.
+			 */
+			source->read_position = offset;
+			return( offset );
+		}
+
+		if( vips_source_read_to_memory( source ) )
+			return( -1 );
+	}
+
+	if( source->data ) {
+		switch( whence ) {
+		case SEEK_SET:
+			new_position = offset;
+			break;
+
+		case SEEK_CUR:
+			new_position = source->read_position + offset;
+			break;
+
+		case SEEK_END:
+			new_position = source->length + offset;
+			break;
+
+		default:
+			vips_error( nick, "%s", _( "bad 'whence'" ) );
+			return( -1 );
+		}
+
+		if( new_position < 0 ||
+			new_position > source->length ) {
+			vips_error( nick,
+				_( "bad seek to %" G_GINT64_FORMAT ),
+				new_position );
+			return( -1 );
+		}
+	}
+	else if( (new_position = class->seek( source, offset, whence )) < 0 ) {
+		vips_error( nick, "%s", _( "seek error" ) );
+		return( -1 );
+	}
+
+	source->read_position = new_position;
+
+	return( new_position );
+}
+
+/**
+ * vips_source_rewind:
+ * @source: source to rewind
+ *
+ * Rewind @source to the start. This always works for sources which can seek,
+ * and for pipes until vips_source_decode() has been called.
+ *
+ * Returns: 0 on success, -1 on error.
+ */
+int
+vips_source_rewind( VipsSource *source )
+{
+	if( vips_source_seek( source, 0, SEEK_SET ) != 0 )
+		return( -1 );
+
+	return( 0 );
+}
+
+/**
+ * vips_source_length:
+ * @source: source to get the length of
+ *
+ * Find the total length of @source. For pipes, this will read the rest of
+ * the input to memory.
+ *
+ * Returns: the number of bytes in @source, or -1 on error.
+ */
+gint64
+vips_source_length( VipsSource *source )
+{
+	gint64 position;
+	gint64 length;
+
+	vips_source_test_pipe( source );
+
+	if( source->data )
+		return( source->length );
+
+	if( source->is_pipe ) {
+		if( vips_source_read_to_memory( source ) )
+			return( -1 );
+
+		return( source->length );
+	}
+
+	position = source->read_position;
+	if( (length = vips_source_seek( source, 0, SEEK_END )) < 0 ||
+		vips_source_seek( source, position, SEEK_SET ) < 0 )
+		return( -1 );
+
+	return( length );
+}
+
+/* Read the whole of a seekable source to memory.
+ */
+static int
+vips_source_read_seekable_to_memory( VipsSource *source )
+{
+	VipsSourceClass *class = VIPS_SOURCE_GET_CLASS( source );
+
+	gint64 total;
+	GByteArray *memory;
+	gint64 bytes_read;
+
+	if( (total = vips_source_length( source )) < 0 ||
+		class->seek( source, 0, SEEK_SET ) != 0 )
+		return( -1 );
+
+	memory = g_byte_array_sized_new( total );
+	g_byte_array_set_size( memory, total );
+	bytes_read = 0;
+	while( bytes_read < total ) {
+		gint64 n = class->read( source,
+			memory->data + bytes_read, total - bytes_read );
+
+		if( n <= 0 ) {
+			vips_error( VIPS_OBJECT_GET_CLASS( source )->nickname,
+				"%s", _( "read error" ) );
+			g_byte_array_unref( memory );
+			return( -1 );
+		}
+
+		bytes_read += n;
+	}
+
+	source->memory = memory;
+	source->data = memory->data;
+	source->length = memory->len;
+
+	return( 0 );
+}
+
+/**
+ * vips_source_map:
+ * @source: source to map
+ * @length: (allow-none): return the length of the source here
+ *
+ * Get the whole of @source as a single area of memory. Memory sources are
+ * returned directly, anything else is read to memory first. The memory is
+ * owned by @source.
+ *
+ * Only use this for formats which can't be decoded any other way.
+ *
+ * Returns: a pointer to the start of the source, or %NULL on error.
+ */
+const void *
+vips_source_map( VipsSource *source, size_t *length )
+{
+	vips_source_test_pipe( source );
+	if( !source->data ) {
+		if( source->is_pipe ) {
+			if( vips_source_read_to_memory( source ) )
+				return( NULL );
+		}
+		else {
+			if( vips_source_read_seekable_to_memory( source ) )
+				return( NULL );
+		}
+	}
+
+	if( length )
+		*length = source->length;
+
+	return( source->data );
+}
+
+/**
+ * vips_source_sniff_at_most:
+ * @source: peek this source
+ * @data: return a pointer to the bytes read here
+ * @length: max number of bytes to read
+ *
+ * Attempt to read up to @length bytes from the start of @source, then
+ * rewind. The bytes are owned by @source and are valid until the next
+ * sniff.
+ *
+ * Returns: the number of bytes read, or -1 on error.
+ */
+gint64
+vips_source_sniff_at_most( VipsSource *source,
+	unsigned char **data, size_t length )
+{
+	gint64 bytes_read;
+
+	if( vips_source_rewind( source ) )
+		return( -1 );
+
+	g_byte_array_set_size( source->sniff, length );
+
+	bytes_read = 0;
+	while( bytes_read < length ) {
+		gint64 n = vips_source_read( source,
+			source->sniff->data + bytes_read,
+			length - bytes_read );
+
+		if( n < 0 )
+			return( -1 );
+		if( n == 0 )
+			break;
+
+		bytes_read += n;
+	}
+
+	if( vips_source_rewind( source ) )
+		return( -1 );
+
+	*data = source->sniff->data;
+
+	return( bytes_read );
+}
+
+/**
+ * vips_source_sniff:
+ * @source: peek this source
+ * @length: number of bytes to peek at
+ *
+ * Return a pointer to the first @length bytes of @source, or %NULL if the
+ * source is shorter than that, then rewind. Use this to test file magic.
+ *
+ * Returns: a pointer to the bytes at the start of the file, or %NULL.
+ */
+unsigned char *
+vips_source_sniff( VipsSource *source, size_t length )
+{
+	unsigned char *data;
+
+	if( vips_source_sniff_at_most( source, &data, length ) != length )
+		return( NULL );
+
+	return( data );
+}
+
+/**
+ * vips_source_decode:
+ * @source: source
+ *
+ * Signal the end of header read and the start of decode. Pipes stop saving
+ * bytes for rewind after this.
+ *
+ * Returns: 0 on success, -1 on error.
+ */
+int
+vips_source_decode( VipsSource *source )
+{
+	source->decode = TRUE;
+
+	return( 0 );
+}
+
+G_DEFINE_TYPE( VipsSourceCustom, vips_source_custom, VIPS_TYPE_SOURCE );
+
+enum {
+	SIG_SEEK,
+	SIG_READ,
+	SIG_LAST
+};
+
+static guint vips_source_custom_signals[SIG_LAST] = { 0 };
+
+static gint64
+vips_source_custom_read_real( VipsSource *source, void *data, size_t length )
+{
+	gint64 bytes_read;
+
+	/* Return value if there's no attached handler.
+	 */
+	bytes_read = -1;
+
+	g_signal_emit( source, vips_source_custom_signals[SIG_READ], 0,
+		data, (gint64) length, &bytes_read );
+
+	return( bytes_read );
+}
+
+static gint64
+vips_source_custom_seek_real( VipsSource *source, gint64 offset, int whence )
+{
+	gint64 new_position;
+
+	/* No handler means we can't seek.
+	 */
+	new_position = -1;
+
+	g_signal_emit( source, vips_source_custom_signals[SIG_SEEK], 0,
+		offset, whence, &new_position );
+
+	return( new_position );
+}
+
+static void
+vips_source_custom_class_init( VipsSourceCustomClass *class )
+{
+	VipsObjectClass *object_class = VIPS_OBJECT_CLASS( class );
+	VipsSourceClass *source_class = VIPS_SOURCE_CLASS( class );
+
+	object_class->nickname = "source_custom";
+	object_class->description = _( "custom input stream" );
+
+	source_class->read = vips_source_custom_read_real;
+	source_class->seek = vips_source_custom_seek_real;
+
+	/**
+	 * VipsSourceCustom::read:
+	 * @source: the source being read
+	 * @buffer: %gpointer, buffer to fill
+	 * @length: %gint64, size of buffer
+	 *
+	 * This signal is emitted to read bytes from the source into @buffer.
+	 *
+	 * Returns: the number of bytes read, 0 for end of source, -1 for error.
+	 */
+	vips_source_custom_signals[SIG_READ] = g_signal_new( "read",
+		G_TYPE_FROM_CLASS( class ),
+		G_SIGNAL_ACTION,
+		0,
+		NULL, NULL,
+		vips_INT64__POINTER_INT64,
+		G_TYPE_INT64, 2,
+		G_TYPE_POINTER, G_TYPE_INT64 );
+
+	/**
+	 * VipsSourceCustom::seek:
+	 * @source: the source being seeked
+	 * @offset: %gint64, seek offset
+	 * @whence: %gint, seek origin
+	 *
+	 * This signal is emitted to seek the source. Leave it unconnected for
+	 * sources which can't seek, they will be treated as pipes.
+	 *
+	 * Returns: the new seek position, or -1 for error.
+	 */
+	vips_source_custom_signals[SIG_SEEK] = g_signal_new( "seek",
+		G_TYPE_FROM_CLASS( class ),
+		G_SIGNAL_ACTION,
+		0,
+		NULL, NULL,
+		vips_INT64__INT64_INT,
+		G_TYPE_INT64, 2,
+		G_TYPE_INT64, G_TYPE_INT );
+
+}
+
+static void
+vips_source_custom_init( VipsSourceCustom *source_custom )
+{
+}
+
+/**
+ * vips_source_custom_new:
+ *
+ * Create a #VipsSourceCustom. Attach signals to implement read and seek
+ * before the first read.
+ *
+ * Returns: a new #VipsSourceCustom, or %NULL on error.
+ */
+VipsSourceCustom *
+vips_source_custom_new( void )
+{
+	VipsSourceCustom *source_custom;
+
+	source_custom = VIPS_SOURCE_CUSTOM(
+		g_object_new( VIPS_TYPE_SOURCE_CUSTOM, NULL ) );
+
+	if( vips_object_build( VIPS_OBJECT( source_custom ) ) ) {
+		VIPS_UNREF( source_custom );
+		return( NULL );
+	}
+
+	return( source_custom );
+}
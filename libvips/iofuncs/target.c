@@ -0,0 +1,545 @@
+/* A byte target for savers.
+ *
+ * 14/10/18
+ * 	- from source.c
+ * 15/10/26
+ * 	- add new_from_string so the CLI can make targets from filenames
+ */
+
+/*
+
+    This file is part of VIPS.
+
+    VIPS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA
+
+ */
+
+/*
+
+    These files are distributed with VIPS - http://www.vips.ecs.soton.ac.uk
+
+ */
+
+/*
+#define VIPS_DEBUG
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /*HAVE_CONFIG_H*/
+#include <vips/intl.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif /*HAVE_UNISTD_H*/
+#include <fcntl.h>
+#ifdef OS_WIN32
+#include <io.h>
+#endif /*OS_WIN32*/
+
+#include <vips/vips.h>
+#include <vips/internal.h>
+#include <vips/debug.h>
+
+#include "vipsmarshal.h"
+
+/* Try to make an O_BINARY ... sometimes need the leading '_'.
+ */
+#ifdef BINARY_OPEN
+#ifndef O_BINARY
+#ifdef _O_BINARY
+#define O_BINARY _O_BINARY
+#endif /*_O_BINARY*/
+#endif /*!O_BINARY*/
+#endif /*BINARY_OPEN*/
+
+/* If we have O_BINARY, add it to a mode flags set.
+ */
+#ifdef O_BINARY
+#define BINARYIZE(M) ((M) | O_BINARY)
+#else /*!O_BINARY*/
+#define BINARYIZE(M) (M)
+#endif /*O_BINARY*/
+
+#define MODE_WRITE BINARYIZE (O_WRONLY | O_CREAT | O_TRUNC)
+
+G_DEFINE_TYPE( VipsTarget, vips_target, VIPS_TYPE_OBJECT );
+
+static void
+vips_target_finalize( GObject *gobject )
+{
+	VipsTarget *target = VIPS_TARGET( gobject );
+
+	VIPS_DEBUG_MSG( "vips_target_finalize: %p\n", target );
+
+	if( target->descriptor != -1 ) {
+		if( target->tracked_descriptor )
+			vips_tracked_close( target->descriptor );
+		else
+			close( target->descriptor );
+		target->descriptor = -1;
+	}
+
+	VIPS_FREEF( g_byte_array_unref, target->memory_buffer );
+
+	G_OBJECT_CLASS( vips_target_parent_class )->finalize( gobject );
+}
+
+static int
+vips_target_build( VipsObject *object )
+{
+	VipsTarget *target = VIPS_TARGET( object );
+
+	VIPS_DEBUG_MSG( "vips_target_build: %p\n", target );
+
+	if( VIPS_OBJECT_CLASS( vips_target_parent_class )->build( object ) )
+		return( -1 );
+
+	if( vips_object_argument_isset( object, "filename" ) ) {
+		int fd;
+
+		if( (fd = vips_tracked_open( target->filename,
+			MODE_WRITE, 00666 )) == -1 ) {
+			vips_error_system( errno,
+				VIPS_OBJECT_GET_CLASS( object )->nickname,
+				_( "unable to open \"%s\"" ),
+				target->filename );
+			return( -1 );
+		}
+
+		target->descriptor = fd;
+		target->tracked_descriptor = TRUE;
+	}
+	else if( vips_object_argument_isset( object, "descriptor" ) ) {
+		/* Take a copy, the caller keeps theirs.
+		 */
+		target->descriptor = dup( target->descriptor );
+		target->tracked_descriptor = FALSE;
+		if( target->descriptor == -1 ) {
+			vips_error_system( errno,
+				VIPS_OBJECT_GET_CLASS( object )->nickname,
+				"%s", _( "unable to dup descriptor" ) );
+			return( -1 );
+		}
+	}
+	else if( target->memory )
+		target->memory_buffer = g_byte_array_new();
+
+	return( 0 );
+}
+
+static gint64
+vips_target_write_real( VipsTarget *target, const void *data, size_t length )
+{
+	gint64 bytes_written;
+
+	if( target->memory_buffer ) {
+		g_byte_array_append( target->memory_buffer, data, length );
+
+		return( length );
+	}
+
+	do {
+		bytes_written = write( target->descriptor, data, length );
+	} while( bytes_written < 0 && errno == EINTR );
+
+	return( bytes_written );
+}
+
+static void
+vips_target_finish_real( VipsTarget *target )
+{
+}
+
+static VipsObject *
+vips_target_new_from_string( const char *string )
+{
+	/* We mustn't _build() the object here, the caller does that.
+	 */
+	return( VIPS_OBJECT( g_object_new( VIPS_TYPE_TARGET,
+		"filename", string,
+		NULL ) ) );
+}
+
+static void
+vips_target_class_init( VipsTargetClass *class )
+{
+	GObjectClass *gobject_class = G_OBJECT_CLASS( class );
+	VipsObjectClass *object_class = (VipsObjectClass *) class;
+
+	gobject_class->finalize = vips_target_finalize;
+	gobject_class->set_property = vips_object_set_property;
+	gobject_class->get_property = vips_object_get_property;
+
+	object_class->nickname = "target";
+	object_class->description = _( "output stream" );
+	object_class->new_from_string = vips_target_new_from_string;
+	object_class->build = vips_target_build;
+
+	class->write = vips_target_write_real;
+	class->finish = vips_target_finish_real;
+
+	VIPS_ARG_INT( class, "descriptor", 1,
+		_( "Descriptor" ),
+		_( "File descriptor for write" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsTarget, descriptor ),
+		-1, 1000000000, -1 );
+
+	VIPS_ARG_STRING( class, "filename", 2,
+		_( "Filename" ),
+		_( "Name of file to write to" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsTarget, filename ),
+		NULL );
+
+	VIPS_ARG_BOOL( class, "memory", 3,
+		_( "Memory" ),
+		_( "Write to a memory buffer" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsTarget, memory ),
+		FALSE );
+
+}
+
+static void
+vips_target_init( VipsTarget *target )
+{
+	target->descriptor = -1;
+}
+
+/**
+ * vips_target_new_to_descriptor:
+ * @descriptor: write to this file descriptor
+ *
+ * Create a target attached to a file descriptor. @descriptor is
+ * duplicated, so you can close it after this call.
+ *
+ * Returns: a new #VipsTarget, or %NULL on error.
+ */
+VipsTarget *
+vips_target_new_to_descriptor( int descriptor )
+{
+	VipsTarget *target;
+
+	target = VIPS_TARGET( g_object_new( VIPS_TYPE_TARGET,
+		"descriptor", descriptor,
+		NULL ) );
+
+	if( vips_object_build( VIPS_OBJECT( target ) ) ) {
+		VIPS_UNREF( target );
+		return( NULL );
+	}
+
+	return( target );
+}
+
+/**
+ * vips_target_new_to_file:
+ * @filename: write to this file
+ *
+ * Create a target attached to a file. The file is created, or truncated if
+ * it exists.
+ *
+ * Returns: a new #VipsTarget, or %NULL on error.
+ */
+VipsTarget *
+vips_target_new_to_file( const char *filename )
+{
+	VipsTarget *target;
+
+	target = VIPS_TARGET( g_object_new( VIPS_TYPE_TARGET,
+		"filename", filename,
+		NULL ) );
+
+	if( vips_object_build( VIPS_OBJECT( target ) ) ) {
+		VIPS_UNREF( target );
+		return( NULL );
+	}
+
+	return( target );
+}
+
+/**
+ * vips_target_new_to_memory:
+ *
+ * Create a target which accumulates bytes in memory. Use vips_target_steal()
+ * to get them once the saver is done.
+ *
+ * Returns: a new #VipsTarget, or %NULL on error.
+ */
+VipsTarget *
+vips_target_new_to_memory( void )
+{
+	VipsTarget *target;
+
+	target = VIPS_TARGET( g_object_new( VIPS_TYPE_TARGET,
+		"memory", TRUE,
+		NULL ) );
+
+	if( vips_object_build( VIPS_OBJECT( target ) ) ) {
+		VIPS_UNREF( target );
+		return( NULL );
+	}
+
+	return( target );
+}
+
+static int
+vips_target_write_unbuffered( VipsTarget *target,
+	const void *data, size_t length )
+{
+	VipsTargetClass *class = VIPS_TARGET_GET_CLASS( target );
+
+	while( length > 0 ) {
+		gint64 bytes_written;
+
+		bytes_written = class->write( target, data, length );
+
+		/* Zero bytes written is an error as well.
+		 */
+		if( bytes_written <= 0 ) {
+			vips_error_system( errno,
+				VIPS_OBJECT_GET_CLASS( target )->nickname,
+				"%s", _( "write error" ) );
+			return( -1 );
+		}
+
+		length -= bytes_written;
+		data = (const char *) data + bytes_written;
+	}
+
+	return( 0 );
+}
+
+static int
+vips_target_flush( VipsTarget *target )
+{
+	if( target->write_point > 0 ) {
+		if( vips_target_write_unbuffered( target,
+			target->output_buffer, target->write_point ) )
+			return( -1 );
+		target->write_point = 0;
+	}
+
+	return( 0 );
+}
+
+/**
+ * vips_target_write:
+ * @target: target to write to
+ * @data: bytes to write
+ * @length: number of bytes to write
+ *
+ * Write @length bytes from @data to @target. Small writes are gathered into
+ * larger blocks.
+ *
+ * Returns: 0 on success, -1 on error.
+ */
+int
+vips_target_write( VipsTarget *target, const void *data, size_t length )
+{
+	g_assert( !target->finished );
+
+	if( target->write_point + length > VIPS_TARGET_BUFFER_SIZE &&
+		vips_target_flush( target ) )
+		return( -1 );
+
+	if( length > VIPS_TARGET_BUFFER_SIZE ) {
+		if( vips_target_write_unbuffered( target, data, length ) )
+			return( -1 );
+	}
+	else {
+		memcpy( target->output_buffer + target->write_point,
+			data, length );
+		target->write_point += length;
+	}
+
+	return( 0 );
+}
+
+/**
+ * vips_target_finish:
+ * @target: target to finish
+ *
+ * Call this at the end of write to flush any buffered bytes and signal the
+ * end of output. Savers call this for you.
+ *
+ * Returns: 0 on success, -1 on error.
+ */
+int
+vips_target_finish( VipsTarget *target )
+{
+	VipsTargetClass *class = VIPS_TARGET_GET_CLASS( target );
+
+	if( target->finished )
+		return( 0 );
+
+	if( vips_target_flush( target ) )
+		return( -1 );
+
+	class->finish( target );
+	target->finished = TRUE;
+
+	return( 0 );
+}
+
+/**
+ * vips_target_steal:
+ * @target: memory target to take the result from
+ * @length: (allow-none): return the number of bytes here
+ *
+ * Memory targets only: take the bytes that have been written. The target is
+ * finished if necessary. You must free the result with g_free().
+ *
+ * Returns: (array length=length) (element-type guint8) (transfer full): the
+ * bytes written, or %NULL on error.
+ */
+unsigned char *
+vips_target_steal( VipsTarget *target, size_t *length )
+{
+	unsigned char *data;
+
+	if( !target->memory_buffer ) {
+		vips_error( VIPS_OBJECT_GET_CLASS( target )->nickname,
+			"%s", _( "not a memory target" ) );
+		return( NULL );
+	}
+
+	if( vips_target_finish( target ) )
+		return( NULL );
+
+	if( length )
+		*length = target->memory_buffer->len;
+	data = g_byte_array_free( target->memory_buffer, FALSE );
+	target->memory_buffer = NULL;
+
+	return( data );
+}
+
+G_DEFINE_TYPE( VipsTargetCustom, vips_target_custom, VIPS_TYPE_TARGET );
+
+enum {
+	SIG_WRITE,
+	SIG_FINISH,
+	SIG_LAST
+};
+
+static guint vips_target_custom_signals[SIG_LAST] = { 0 };
+
+static gint64
+vips_target_custom_write_real( VipsTarget *target,
+	const void *data, size_t length )
+{
+	gint64 bytes_written;
+
+	/* Return value if there's no attached handler.
+	 */
+	bytes_written = -1;
+
+	g_signal_emit( target, vips_target_custom_signals[SIG_WRITE], 0,
+		data, (gint64) length, &bytes_written );
+
+	return( bytes_written );
+}
+
+static void
+vips_target_custom_finish_real( VipsTarget *target )
+{
+	g_signal_emit( target, vips_target_custom_signals[SIG_FINISH], 0 );
+}
+
+static void
+vips_target_custom_class_init( VipsTargetCustomClass *class )
+{
+	VipsObjectClass *object_class = VIPS_OBJECT_CLASS( class );
+	VipsTargetClass *target_class = VIPS_TARGET_CLASS( class );
+
+	object_class->nickname = "target_custom";
+	object_class->description = _( "custom output stream" );
+
+	target_class->write = vips_target_custom_write_real;
+	target_class->finish = vips_target_custom_finish_real;
+
+	/**
+	 * VipsTargetCustom::write:
+	 * @target: the target being written to
+	 * @data: %gpointer, bytes to write
+	 * @length: %gint64, number of bytes
+	 *
+	 * This signal is emitted to write bytes to the target.
+	 *
+	 * Returns: the number of bytes written, or -1 for error.
+	 */
+	vips_target_custom_signals[SIG_WRITE] = g_signal_new( "write",
+		G_TYPE_FROM_CLASS( class ),
+		G_SIGNAL_ACTION,
+		0,
+		NULL, NULL,
+		vips_INT64__POINTER_INT64,
+		G_TYPE_INT64, 2,
+		G_TYPE_POINTER, G_TYPE_INT64 );
+
+	/**
+	 * VipsTargetCustom::finish:
+	 * @target: the target being finished
+	 *
+	 * This signal is emitted at the end of write. The target should do
+	 * any finishing necessary, for example closing a connection.
+	 */
+	vips_target_custom_signals[SIG_FINISH] = g_signal_new( "finish",
+		G_TYPE_FROM_CLASS( class ),
+		G_SIGNAL_ACTION,
+		0,
+		NULL, NULL,
+		g_cclosure_marshal_VOID__VOID,
+		G_TYPE_NONE, 0 );
+
+}
+
+static void
+vips_target_custom_init( VipsTargetCustom *target_custom )
+{
+}
+
+/**
+ * vips_target_custom_new:
+ *
+ * Create a #VipsTargetCustom. Attach signals to implement write and finish.
+ *
+ * Returns: a new #VipsTargetCustom, or %NULL on error.
+ */
+VipsTargetCustom *
+vips_target_custom_new( void )
+{
+	VipsTargetCustom *target_custom;
+
+	target_custom = VIPS_TARGET_CUSTOM(
+		g_object_new( VIPS_TYPE_TARGET_CUSTOM, NULL ) );
+
+	if( vips_object_build( VIPS_OBJECT( target_custom ) ) ) {
+		VIPS_UNREF( target_custom );
+		return( NULL );
+	}
+
+	return( target_custom );
+}
@@ -21,6 +21,18 @@
  * 23/4/17
  * 	- add ->stall
  * 	- don't depend on image width when setting n_lines
+ * 14/10/18
+ * 	- lease workers from a process-wide pool of idle threads rather than
+ * 	  creating and joining a new set for every vips_threadpool_run()
+ * 	- add vips_threadpool_run_batch(), with optional per-thread work 
+ * 	  queues and stealing
+ * 	- add vips_numa_set()
+ * 	- optional adaptive tile geometry in vips_get_tile_size()
+ * 	- count allocate lock contention with VIPS_GATE_LOCK()
+ * 	- add a global pipeline memory budget, see
+ * 	  vips_pipeline_set_max_mem()
+ * 	- record the tile for each work unit in profiles
+ * 	- add vips_thread_iskilled()
  */
 
 /*
@@ -59,6 +71,9 @@
 #ifdef HAVE_CONFIG_H
 #include <config.h>
 #endif /*HAVE_CONFIG_H*/
+#if defined(HAVE_SCHED_SETAFFINITY) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif /*HAVE_SCHED_SETAFFINITY*/
 #include <vips/intl.h>
 
 #include <stdio.h>
@@ -67,6 +82,9 @@
 #include <unistd.h>
 #endif /*HAVE_UNISTD_H*/
 #include <errno.h>
+#ifdef HAVE_SCHED_SETAFFINITY
+#include <sched.h>
+#endif /*HAVE_SCHED_SETAFFINITY*/
 
 #include <vips/vips.h>
 #include <vips/internal.h>
@@ -88,6 +106,10 @@
  * in turns to allocate units of work (a unit might be a tile in an image),
  * then run in parallel to process those units. An optional progress function
  * can be used to give feedback.
+ *
+ * Worker threads are kept in a process-wide pool between calls to
+ * vips_threadpool_run(), so running many small pipelines does not 
+ * repeatedly create and join threads. 
  */
 
 /* Maximum number of concurrent threads we allow. No reason for the limit,
@@ -102,6 +124,12 @@ int vips__tile_height = VIPS__TILE_HEIGHT;
 int vips__fatstrip_height = VIPS__FATSTRIP_HEIGHT;
 int vips__thinstrip_height = VIPS__THINSTRIP_HEIGHT;
 
+/* Adaptive tile geometry ... the per-tile working set we aim for, in bytes, 
+ * or 0 for the fixed sizes above.
+ */
+int vips__tile_target = 0;
+gboolean vips__tile_report = FALSE;
+
 /* Default n threads ... 0 means get from environment.
  */
 int vips__concurrency = 0;
@@ -114,10 +142,104 @@ int vips__n_active_threads = 0;
  */
 static GPrivate *is_worker_key = NULL;
 
+/* The image the threadpool this worker is running for is computing, see
+ * vips_thread_iskilled().
+ */
+static GPrivate *pipeline_key = NULL;
+
 /* Set to stall threads for debugging.
  */
 static gboolean vips__stall = FALSE;
 
+/* Set to make vips_threadpool_run_batch() allocate several work units at 
+ * once into per-thread queues, and let idle threads steal from their 
+ * neighbours. Set with the env var VIPS_WORK_STEAL. 
+ */
+static gboolean vips__work_steal = FALSE;
+
+/* The max number of units we allocate in one batch in work steal mode.
+ */
+#define VIPS__THREADPOOL_BATCH (8)
+
+/* Set to pin each threadpool to a NUMA node. Set with vips_numa_set() or the
+ * env var VIPS_NUMA.
+ */
+static gboolean vips__numa = FALSE;
+
+/* The pipeline memory budget, or 0 for no limit, and the amount currently
+ * reserved by running pipelines. Pools wait on the cond for reservations to
+ * be released.
+ */
+static size_t vips__pipeline_max_mem = 0;
+static size_t vips__pipeline_mem = 0;
+static GMutex *vips__pipeline_lock = NULL;
+static GCond *vips__pipeline_cond = NULL;
+
+/* Report per-pipeline memory use here.
+ */
+static VipsPipelineReportFn vips__pipeline_report = NULL;
+static void *vips__pipeline_report_a = NULL;
+
+/* Loaders attach the memory they will need for a decode to their output
+ * image with this.
+ */
+static GQuark vips__pipeline_hint_quark = 0;
+
+#ifdef HAVE_SCHED_SETAFFINITY
+/* The max number of NUMA nodes we look for.
+ */
+#define VIPS__MAX_NODES (64)
+
+/* The CPUs on each node, and the CPUs we started with. Read from /sys on 
+ * first use.
+ */
+static int vips__n_nodes = 0;
+static cpu_set_t vips__node_cpus[VIPS__MAX_NODES];
+static cpu_set_t vips__all_cpus;
+
+/* Assign pools to nodes round-robin.
+ */
+static int vips__next_node = 0;
+#endif /*HAVE_SCHED_SETAFFINITY*/
+
+/* A worker thread we keep between calls to vips_threadpool_run(). Pools lease
+ * workers from the idle list, give them a function to run, and hand them 
+ * back when the function returns.
+ */
+typedef struct _VipsWorker {
+	GThread *thread;
+
+	/* Up go to give the worker a job. The worker ups done when the job
+	 * has finished and it has dropped all per-job state.
+	 */
+	VipsSemaphore go;
+	VipsSemaphore done;
+
+	GThreadFunc func;
+	void *data;
+
+	/* The NUMA node the job should run on, and the node we are pinned to 
+	 * now, or -1 for no node.
+	 */
+	int node;
+	int pinned;
+
+	/* Set this, then up go, to make the worker exit.
+	 */
+	gboolean exit;
+
+	/* Nobody will wait for this job: put ourselves back on the idle
+	 * list when it's done, see vips__worker_spawn().
+	 */
+	gboolean detached;
+} VipsWorker;
+
+/* Workers waiting for a job. Protected by vips__worker_lock. 
+ */
+static GMutex *vips__worker_lock = NULL;
+static GSList *vips__worker_idle = NULL;
+static int vips__worker_n_idle = 0;
+
 /* Glib 2.32 revised the thread API. We need some compat functions.
  */
 
@@ -183,6 +305,53 @@ vips_thread_isworker( void )
 	return( g_private_get( is_worker_key ) != NULL );
 }
 
+/**
+ * vips_thread_iskilled:
+ *
+ * Long-running generate functions and loaders can call this every few
+ * scanlines to see if the image the current worker is computing has been
+ * killed, or has passed its deadline (see vips_image_set_deadline()). If it
+ * has, an error is set and you should return -1.
+ *
+ * Kill and deadlines are otherwise only checked between tiles, so this
+ * lets a single very slow tile be interrupted. It is cheap to call and
+ * always returns %FALSE outside a threadpool.
+ *
+ * See also: vips_image_set_deadline().
+ *
+ * Returns: %TRUE if computation should stop.
+ */
+gboolean
+vips_thread_iskilled( void )
+{
+	VipsImage *image;
+	gint64 deadline;
+
+	if( !pipeline_key ||
+		!(image = g_private_get( pipeline_key )) )
+		return( FALSE );
+
+	/* Don't clear kill, the sink will see it between tiles and stop
+	 * the other workers.
+	 */
+	if( image->kill ) {
+		vips_error( "VipsImage",
+			_( "killed for image \"%s\"" ), image->filename );
+		return( TRUE );
+	}
+
+	deadline = vips__image_private( image )->deadline;
+	if( deadline &&
+		g_get_monotonic_time() > deadline ) {
+		vips_error( "VipsImage",
+			_( "deadline passed for image \"%s\"" ),
+			image->filename );
+		return( TRUE );
+	}
+
+	return( FALSE );
+}
+
 typedef struct {
 	const char *domain; 
 	GThreadFunc func; 
@@ -290,6 +459,300 @@ vips_g_thread_join( GThread *thread )
 	return( result ); 
 }
 
+#ifdef HAVE_SCHED_SETAFFINITY
+/* Parse a sysfs cpulist, eg. "0-7,16-23".
+ */
+static void
+vips_numa_parse_cpulist( const char *str, cpu_set_t *set )
+{
+	const char *p;
+
+	CPU_ZERO( set );
+
+	for( p = str; *p; ) {
+		char *q;
+		long first;
+		long last;
+		long i;
+
+		first = strtol( p, &q, 10 );
+		if( q == p )
+			break;
+		p = q;
+
+		last = first;
+		if( *p == '-' ) {
+			last = strtol( p + 1, &q, 10 );
+			if( q == p + 1 )
+				break;
+			p = q;
+		}
+
+		for( i = first; i <= last && i < CPU_SETSIZE; i++ )
+			CPU_SET( i, set );
+
+		if( *p == ',' )
+			p += 1;
+		else
+			break;
+	}
+}
+
+static void *
+vips_numa_init( void *data )
+{
+	int i;
+
+	if( sched_getaffinity( 0, sizeof( vips__all_cpus ), &vips__all_cpus ) )
+		return( NULL );
+
+	for( i = 0; i < VIPS__MAX_NODES; i++ ) {
+		char filename[VIPS_PATH_MAX];
+		char *contents;
+		cpu_set_t cpus;
+
+		vips_snprintf( filename, VIPS_PATH_MAX, 
+			"/sys/devices/system/node/node%d/cpulist", i );
+		if( !g_file_get_contents( filename, &contents, NULL, NULL ) )
+			break;
+		vips_numa_parse_cpulist( contents, &cpus );
+		g_free( contents );
+
+		/* Only the CPUs we are allowed to use.
+		 */
+		CPU_AND( &cpus, &cpus, &vips__all_cpus );
+		if( CPU_COUNT( &cpus ) == 0 )
+			continue;
+
+		vips__node_cpus[vips__n_nodes++] = cpus;
+	}
+
+	VIPS_DEBUG_MSG( "vips_numa_init: found %d nodes\n", vips__n_nodes );
+
+	return( NULL );
+}
+
+/* The number of NUMA nodes we can pin to, or 0 if we can't pin.
+ */
+static int
+vips_numa_n_nodes( void )
+{
+	static GOnce once = G_ONCE_INIT;
+
+	(void) g_once( &once, (GThreadFunc) vips_numa_init, NULL );
+
+	return( vips__n_nodes > 1 ? vips__n_nodes : 0 );
+}
+#endif /*HAVE_SCHED_SETAFFINITY*/
+
+/* Pin the calling worker to a node, or to all our CPUs for -1.
+ */
+static void
+vips_worker_pin( VipsWorker *worker )
+{
+#ifdef HAVE_SCHED_SETAFFINITY
+	if( worker->node != worker->pinned ) {
+		cpu_set_t *cpus = worker->node >= 0 ?
+			&vips__node_cpus[worker->node] : &vips__all_cpus;
+
+		if( !sched_setaffinity( 0, sizeof( cpu_set_t ), cpus ) ) {
+			worker->pinned = worker->node;
+
+			/* Our spare buffers were first touched on the old 
+			 * node.
+			 */
+			vips__buffer_thread_free_spare();
+		}
+	}
+#endif /*HAVE_SCHED_SETAFFINITY*/
+}
+
+static void vips_worker_free( VipsWorker *worker );
+
+/* A detached worker has finished its job: go back on the idle list. We can't
+ * shut ourselves down, so if the list is full, shut down the worker that has
+ * been idle longest instead.
+ */
+static void
+vips_worker_park_self( VipsWorker *worker )
+{
+	VipsWorker *excess;
+
+	worker->func = NULL;
+	worker->data = NULL;
+	worker->detached = FALSE;
+
+	excess = NULL;
+
+	g_mutex_lock( vips__worker_lock );
+
+	vips__worker_idle = g_slist_prepend( vips__worker_idle, worker );
+	vips__worker_n_idle += 1;
+
+	if( vips__worker_n_idle > vips_concurrency_get() ) {
+		GSList *last = g_slist_last( vips__worker_idle );
+
+		excess = (VipsWorker *) last->data;
+		vips__worker_idle = g_slist_delete_link( vips__worker_idle, 
+			last );
+		vips__worker_n_idle -= 1;
+	}
+
+	g_mutex_unlock( vips__worker_lock );
+
+	if( excess )
+		vips_worker_free( excess );
+}
+
+static void *
+vips_worker_main( void *a )
+{
+	VipsWorker *worker = (VipsWorker *) a;
+
+	for(;;) {
+		vips_semaphore_down( &worker->go );
+
+		if( worker->exit )
+			break;
+
+		vips_worker_pin( worker );
+
+		(void) worker->func( worker->data );
+
+		/* Our buffer caches are keyed by image, and the images this
+		 * job used can be freed as soon as we signal done. Drop them
+		 * now, just as we would on thread exit.
+		 */
+		vips__buffer_thread_clear();
+		vips__tracked_thread_flush();
+
+		if( worker->detached ) 
+			vips_worker_park_self( worker );
+		else
+			vips_semaphore_up( &worker->done );
+	}
+
+	return( NULL );
+}
+
+static void
+vips_worker_free( VipsWorker *worker )
+{
+	if( worker->thread ) {
+		worker->exit = TRUE;
+		vips_semaphore_up( &worker->go );
+		(void) vips_g_thread_join( worker->thread );
+		worker->thread = NULL;
+	}
+
+	vips_semaphore_destroy( &worker->go );
+	vips_semaphore_destroy( &worker->done );
+	g_free( worker );
+}
+
+/* Get an idle worker, or make a new one.
+ */
+static VipsWorker *
+vips_worker_get( void )
+{
+	VipsWorker *worker;
+
+	worker = NULL;
+
+	g_mutex_lock( vips__worker_lock );
+
+	if( vips__worker_idle ) {
+		worker = (VipsWorker *) vips__worker_idle->data;
+		vips__worker_idle = g_slist_delete_link( vips__worker_idle, 
+			vips__worker_idle );
+		vips__worker_n_idle -= 1;
+	}
+
+	g_mutex_unlock( vips__worker_lock );
+
+	if( !worker ) {
+		worker = g_new0( VipsWorker, 1 );
+		worker->pinned = -1;
+		vips_semaphore_init( &worker->go, 0, "go" );
+		vips_semaphore_init( &worker->done, 0, "done" );
+
+		if( !(worker->thread = vips_g_thread_new( "worker", 
+			vips_worker_main, worker )) ) {
+			vips_worker_free( worker );
+			return( NULL );
+		}
+	}
+
+	return( worker );
+}
+
+/* Get a worker and set it running @func on @node.
+ */
+static VipsWorker *
+vips_worker_lease( GThreadFunc func, void *data, int node )
+{
+	VipsWorker *worker;
+
+	if( !(worker = vips_worker_get()) )
+		return( NULL );
+
+	worker->func = func;
+	worker->data = data;
+	worker->node = node;
+	vips_semaphore_up( &worker->go );
+
+	return( worker );
+}
+
+/* Wait for a worker to finish its job, then put it back on the idle list. We
+ * keep up to vips_concurrency_get() workers parked, any more than that are 
+ * shut down.
+ */
+static void
+vips_worker_release( VipsWorker *worker )
+{
+	gboolean keep;
+
+	vips_semaphore_down( &worker->done );
+	worker->func = NULL;
+	worker->data = NULL;
+
+	g_mutex_lock( vips__worker_lock );
+
+	keep = vips__worker_n_idle < vips_concurrency_get();
+	if( keep ) {
+		vips__worker_idle = g_slist_prepend( vips__worker_idle, 
+			worker );
+		vips__worker_n_idle += 1;
+	}
+
+	g_mutex_unlock( vips__worker_lock );
+
+	if( !keep )
+		vips_worker_free( worker );
+}
+
+/* Run @func on a pooled worker and don't wait for it. The worker returns
+ * itself to the pool when @func is done. All spawned jobs must have finished
+ * before vips_shutdown().
+ */
+int
+vips__worker_spawn( GThreadFunc func, void *data )
+{
+	VipsWorker *worker;
+
+	if( !(worker = vips_worker_get()) )
+		return( -1 );
+
+	worker->func = func;
+	worker->data = data;
+	worker->node = -1;
+	worker->detached = TRUE;
+	vips_semaphore_up( &worker->go );
+
+	return( 0 );
+}
+
 /**
  * vips_concurrency_set:
  * @concurrency: number of threads to run
@@ -427,6 +890,133 @@ vips_concurrency_get( void )
 	return( nthr );
 }
 
+/**
+ * vips_numa_set:
+ * @numa: %TRUE to enable NUMA-aware scheduling
+ *
+ * On hosts with more than one NUMA node, setting this makes each 
+ * #VipsThreadPool run on a single node. Pools are given to nodes 
+ * round-robin, their workers are pinned to the CPUs of that node, and the 
+ * number of workers is limited to the number of CPUs on the node. 
+ *
+ * Since buffers are allocated and first touched by the workers, a pipeline's
+ * pixels then stay in memory local to the node.
+ *
+ * This is off by default. You can also enable it with the environment 
+ * variable VIPS_NUMA. It has no effect on platforms which do not support
+ * thread pinning.
+ *
+ * See also: vips_numa_get(), vips_concurrency_set().
+ */
+void
+vips_numa_set( gboolean numa )
+{
+	vips__numa = numa;
+}
+
+/**
+ * vips_numa_get:
+ *
+ * Returns: %TRUE if NUMA-aware scheduling is enabled and available.
+ *
+ * See also: vips_numa_set().
+ */
+gboolean
+vips_numa_get( void )
+{
+#ifdef HAVE_SCHED_SETAFFINITY
+	return( vips__numa && 
+		vips_numa_n_nodes() > 0 );
+#else /*!HAVE_SCHED_SETAFFINITY*/
+	return( FALSE );
+#endif /*HAVE_SCHED_SETAFFINITY*/
+}
+
+/**
+ * vips_pipeline_set_max_mem:
+ * @max_mem: memory budget in bytes, or 0 for no limit
+ *
+ * Set a memory budget shared by all pipelines. Each call to
+ * vips_threadpool_run() (and so vips_sink_disc(), vips_sink() and friends)
+ * estimates its peak memory use with vips_pipeline_estimate() and reserves
+ * that much of the budget until it finishes.
+ *
+ * If the budget is short, the pipeline runs with fewer threads. If even one
+ * thread won't fit, it waits for other pipelines to finish. A pipeline
+ * which is larger than the whole budget still runs when nothing else is
+ * running, and pipelines started from inside a worker thread never wait.
+ *
+ * This is useful for services running many pipelines at once, where
+ * vips_cache_set_max_mem() alone can't stop many large decodes running
+ * together. You can also set the budget with the environment variable
+ * VIPS_PIPELINE_MAX_MEM or the command-line flag --vips-pipeline-max-mem.
+ *
+ * See also: vips_pipeline_get_mem(), vips_pipeline_set_report().
+ */
+void
+vips_pipeline_set_max_mem( size_t max_mem )
+{
+	g_mutex_lock( vips__pipeline_lock );
+	vips__pipeline_max_mem = max_mem;
+	g_cond_broadcast( vips__pipeline_cond );
+	g_mutex_unlock( vips__pipeline_lock );
+}
+
+/**
+ * vips_pipeline_get_max_mem:
+ *
+ * See also: vips_pipeline_set_max_mem().
+ *
+ * Returns: the pipeline memory budget, or 0 for no limit.
+ */
+size_t
+vips_pipeline_get_max_mem( void )
+{
+	return( vips__pipeline_max_mem );
+}
+
+/**
+ * vips_pipeline_get_mem:
+ *
+ * See also: vips_pipeline_set_max_mem().
+ *
+ * Returns: the part of the budget reserved by running pipelines.
+ */
+size_t
+vips_pipeline_get_mem( void )
+{
+	size_t mem;
+
+	g_mutex_lock( vips__pipeline_lock );
+	mem = vips__pipeline_mem;
+	g_mutex_unlock( vips__pipeline_lock );
+
+	return( mem );
+}
+
+/**
+ * vips_pipeline_set_report:
+ * @report: (scope notified) (allow-none): call this when a pipeline ends
+ * @a: client data for @report
+ *
+ * Call @report with a #VipsPipelineStats at the end of every pipeline.
+ * The report is made from the thread that ran the pipeline, so callers can
+ * match reports to their own work with thread-local state. Use the stats to
+ * tune the budget you set with vips_pipeline_set_max_mem().
+ *
+ * The peak is the largest increase in vips_tracked_get_mem() seen while
+ * the pipeline ran. With many pipelines running at once it will include
+ * some memory used by the others.
+ *
+ * Pass %NULL to stop reporting.
+ */
+void
+vips_pipeline_set_report( VipsPipelineReportFn report, void *a )
+{
+	vips__pipeline_report = report;
+	vips__pipeline_report_a = a;
+}
+
 G_DEFINE_TYPE( VipsThreadState, vips_thread_state, VIPS_TYPE_OBJECT );
 
 static void
@@ -474,6 +1064,7 @@ vips_thread_state_init( VipsThreadState *state )
 	state->reg = NULL;
 	state->stop = FALSE;
 	state->stall = FALSE;
+	state->unit = NULL;
 }
 
 void *
@@ -509,18 +1100,27 @@ typedef struct {
 
 	VipsThreadState *state;
 
-	/* Thread we are running.
-	 */
-        GThread *thread;  	
-
-	/* Set this to ask the thread to exit.
+	/* The worker we have leased to run us.
 	 */
-	gboolean exit;	
+	VipsWorker *worker;
 
 	/* Set by the thread if work or allocate return an error.
 	 */
 	gboolean error;	
 
+	/* In batch mode, units we have allocated but not yet processed. We 
+	 * take units from the head, thieves take them from the tail. Both
+	 * ends are protected by queue_lock.
+	 */
+	GMutex *queue_lock;
+	VipsThreadUnit *queue;
+	int head;
+	int tail;
+
+	/* Our position in pool->thr, so we know where to start stealing.
+	 */
+	int index;
+
 } VipsThread;
 
 /* What we track for a group of threads working together.
@@ -537,6 +1137,7 @@ typedef struct _VipsThreadpool {
 	 */
 	VipsThreadStartFn start; 
 	VipsThreadpoolAllocateFn allocate;
+	VipsThreadpoolAllocateBatchFn allocate_batch;
 	VipsThreadpoolWorkFn work;
 	GMutex *allocate_lock;
         void *a; 		/* User argument to start / allocate / etc. */
@@ -544,6 +1145,14 @@ typedef struct _VipsThreadpool {
 	int nthr;		/* Number of threads in pool */
 	VipsThread **thr;	/* Threads */
 
+	/* Max number of units to allocate per call to allocate_batch.
+	 */
+	int batch_size;
+
+	/* The NUMA node we run on, or -1.
+	 */
+	int node;
+
 	/* The caller blocks here until all threads finish.
 	 */
 	VipsSemaphore finish;	
@@ -559,6 +1168,22 @@ typedef struct _VipsThreadpool {
 	/* Set by Allocate (via an arg) to indicate normal end of computation.
 	 */
 	gboolean stop;
+
+	/* The memory estimate for the pipeline, the part of the budget we
+	 * hold, the number of threads we'd have liked, and how long we
+	 * waited for the budget.
+	 */
+	size_t estimate;
+	size_t reserved;
+	int nthr_wanted;
+	double wait;
+
+	/* Set if we are reporting. We sample tracked memory on every tick
+	 * and keep the largest increase.
+	 */
+	gboolean measure;
+	gint64 mem_start;
+	gint64 peak;
 } VipsThreadpool;
 
 /* Junk a thread.
@@ -566,18 +1191,16 @@ typedef struct _VipsThreadpool {
 static void
 vips_thread_free( VipsThread *thr )
 {
-        /* Is there a thread running this region? Kill it!
-         */
-        if( thr->thread ) {
-                thr->exit = 1;
-
-		/* Return value is always NULL (see thread_main_loop).
-		 */
-		(void) vips_g_thread_join( thr->thread );
-		thr->thread = NULL;
-        }
+	/* Is there a worker running this thread? Wait for it to finish and
+	 * hand it back.
+	 */
+	if( thr->worker ) {
+		vips_worker_release( thr->worker );
+		thr->worker = NULL;
+	}
 
 	VIPS_FREEF( g_object_unref, thr->state );
+	VIPS_FREEF( vips_g_mutex_free, thr->queue_lock );
 	thr->pool = NULL;
 }
 
@@ -599,10 +1222,35 @@ vips_thread_allocate( VipsThread *thr )
 	return( 0 );
 }
 
-/* Run this once per main loop. Get some work (single-threaded), then do it
- * (many-threaded).
- *
- * The very first workunit is also executed single-threaded. This gives
+/* Run a work unit. When profiling, note the tile and the operation that
+ * made the image for vipsprofile's heatmap.
+ */
+static int
+vips_thread_work( VipsThread *thr )
+{
+	VipsThreadpool *pool = thr->pool;
+
+	VipsImagePrivate *private;
+	gint64 start;
+	int result;
+
+	if( !vips__thread_profile )
+		return( pool->work( thr->state, pool->a ) );
+
+	start = vips__get_time();
+	result = pool->work( thr->state, pool->a );
+	private = vips__image_private( pool->im );
+	vips__thread_gate_tile(
+		private->stats ? private->stats->nickname : "image",
+		&thr->state->pos, start, vips__get_time() );
+
+	return( result );
+}
+
+/* Run this once per main loop. Get some work (single-threaded), then do it
+ * (many-threaded).
+ *
+ * The very first workunit is also executed single-threaded. This gives
  * loaders a change to seek to the correct spot, see vips_sequential().
  */
 static void
@@ -615,7 +1263,7 @@ vips_thread_work_unit( VipsThread *thr )
 
 	VIPS_GATE_START( "vips_thread_work_unit: wait" ); 
 
-	g_mutex_lock( pool->allocate_lock );
+	VIPS_GATE_LOCK( pool->allocate_lock, VIPS_GATE_STAT_ALLOCATE );
 
 	VIPS_GATE_STOP( "vips_thread_work_unit: wait" ); 
 
@@ -655,10 +1303,172 @@ vips_thread_work_unit( VipsThread *thr )
 
 	/* Process a work unit.
 	 */
-	if( pool->work( thr->state, pool->a ) ) { 
+	if( vips_thread_work( thr ) ) {
+		thr->error = TRUE;
+		pool->error = TRUE;
+	}
+}
+
+/* Take a unit from the head of our own queue.
+ */
+static gboolean
+vips_thread_unit_pop( VipsThread *thr, VipsThreadUnit *unit )
+{
+	gboolean found;
+
+	g_mutex_lock( thr->queue_lock );
+
+	found = thr->head < thr->tail;
+	if( found ) 
+		*unit = thr->queue[thr->head++];
+
+	g_mutex_unlock( thr->queue_lock );
+
+	return( found );
+}
+
+/* Our queue is empty: try to take a unit from the tail of a neighbour's 
+ * queue.
+ */
+static gboolean
+vips_thread_unit_steal( VipsThread *thr, VipsThreadUnit *unit )
+{
+	VipsThreadpool *pool = thr->pool;
+
+	int i;
+
+	for( i = 1; i < pool->nthr; i++ ) {
+		VipsThread *victim = 
+			pool->thr[(thr->index + i) % pool->nthr];
+
+		gboolean found;
+
+		g_mutex_lock( victim->queue_lock );
+
+		found = victim->head < victim->tail;
+		if( found ) 
+			*unit = victim->queue[--victim->tail];
+
+		g_mutex_unlock( victim->queue_lock );
+
+		if( found ) 
+			return( TRUE );
+	}
+
+	return( FALSE );
+}
+
+/* Refill our (empty) queue. Hold allocate_lock while you call this.
+ */
+static int
+vips_thread_allocate_batch( VipsThread *thr )
+{
+	VipsThreadpool *pool = thr->pool;
+
+	int n_units;
+
+	g_assert( !pool->stop );
+	g_assert( thr->head == thr->tail );
+
+	/* No one else touches the queue while head == tail, so we can fill it
+	 * without taking queue_lock.
+	 */
+	n_units = 0;
+	if( pool->allocate_batch( thr->state, pool->a, 
+		thr->queue, pool->batch_size, &n_units, &pool->stop ) ) 
+		return( -1 );
+	g_assert( n_units >= 0 && n_units <= pool->batch_size );
+
+	g_mutex_lock( thr->queue_lock );
+	thr->head = 0;
+	thr->tail = n_units;
+	g_mutex_unlock( thr->queue_lock );
+
+	return( 0 );
+}
+
+/* The batch version of vips_thread_work_unit(). Take a unit from our queue, 
+ * or steal one, or allocate a new batch, then process it. 
+ *
+ * Units which have been allocated are always processed, even after an error, 
+ * so that sinks can keep their counts of pending work balanced.
+ *
+ * Return FALSE when there's nothing more for this thread to do.
+ */
+static gboolean
+vips_thread_work_unit_batch( VipsThread *thr )
+{
+	VipsThreadpool *pool = thr->pool;
+
+	VipsThreadUnit unit;
+
+	if( !thr->state ) {
+		VIPS_GATE_LOCK( pool->allocate_lock, VIPS_GATE_STAT_ALLOCATE );
+
+		if( !pool->stop &&
+			!pool->error &&
+			!(thr->state = pool->start( pool->im, pool->a )) ) {
+			thr->error = TRUE;
+			pool->error = TRUE;
+		}
+
+		g_mutex_unlock( pool->allocate_lock );
+
+		if( !thr->state )
+			return( FALSE );
+	}
+
+	if( !vips_thread_unit_pop( thr, &unit ) ) {
+		if( pool->error )
+			return( FALSE );
+
+		if( pool->batch_size == 1 ||
+			!vips_thread_unit_steal( thr, &unit ) ) {
+			if( pool->stop )
+				return( FALSE );
+
+			VIPS_GATE_START( "vips_thread_work_unit_batch: wait" ); 
+
+			VIPS_GATE_LOCK( pool->allocate_lock,
+				VIPS_GATE_STAT_ALLOCATE );
+
+			VIPS_GATE_STOP( "vips_thread_work_unit_batch: wait" ); 
+
+			if( !pool->stop &&
+				!pool->error &&
+				vips_thread_allocate_batch( thr ) ) {
+				thr->error = TRUE;
+				pool->error = TRUE;
+			}
+
+			g_mutex_unlock( pool->allocate_lock );
+
+			/* We might have been given nothing, in which case
+			 * loop and try to steal again.
+			 */
+			if( !vips_thread_unit_pop( thr, &unit ) ) 
+				return( TRUE );
+		}
+	}
+
+	thr->state->pos = unit.pos;
+	thr->state->unit = unit.data;
+
+	if( thr->state->stall &&
+		vips__stall ) { 
+		g_usleep( 500000 ); 
+		thr->state->stall = FALSE;
+		printf( "vips_thread_work_unit_batch: "
+			"stall done, releasing y = %d ...\n", 
+			thr->state->pos.top ); 
+	}
+
+	if( vips_thread_work( thr ) ) {
 		thr->error = TRUE;
 		pool->error = TRUE;
 	}
+
+	return( TRUE );
 }
 
 /* What runs as a thread ... loop, waiting to be told to do stuff.
@@ -673,20 +1483,30 @@ vips_thread_main_loop( void *a )
 
 	VIPS_GATE_START( "vips_thread_main_loop: thread" ); 
 
+	g_private_set( pipeline_key, pool->im );
+
 	/* Process work units! Always tick, even if we are stopping, so the
 	 * main thread will wake up for exit. 
 	 */
 	for(;;) {
+		gboolean more;
+
 		VIPS_GATE_START( "vips_thread_work_unit: u" ); 
-		vips_thread_work_unit( thr );
+		if( pool->allocate_batch ) 
+			more = vips_thread_work_unit_batch( thr );
+		else {
+			vips_thread_work_unit( thr );
+			more = !pool->stop && !pool->error;
+		}
 		VIPS_GATE_STOP( "vips_thread_work_unit: u" ); 
 		vips_semaphore_up( &pool->tick );
 
-		if( pool->stop || 
-			pool->error )
+		if( !more )
 			break;
 	} 
 
+	g_private_set( pipeline_key, NULL );
+
 	/* We are exiting: tell the main thread. 
 	 */
 	vips_semaphore_up( &pool->finish );
@@ -696,10 +1516,11 @@ vips_thread_main_loop( void *a )
         return( NULL );
 }
 
-/* Attach another thread to a threadpool.
+/* Make another thread for a threadpool. It's not started until 
+ * vips_thread_start().
  */
 static VipsThread *
-vips_thread_new( VipsThreadpool *pool )
+vips_thread_new( VipsThreadpool *pool, int index )
 {
 	VipsThread *thr;
 
@@ -707,24 +1528,41 @@ vips_thread_new( VipsThreadpool *pool )
 		return( NULL );
 	thr->pool = pool;
 	thr->state = NULL;
-	thr->thread = NULL;
-	thr->exit = 0;
+	thr->worker = NULL;
 	thr->error = 0;
+	thr->queue_lock = vips_g_mutex_new();
+	thr->queue = NULL;
+	thr->head = 0;
+	thr->tail = 0;
+	thr->index = index;
+
+	if( pool->allocate_batch &&
+		!(thr->queue = VIPS_ARRAY( pool->im, 
+			pool->batch_size, VipsThreadUnit )) ) {
+		vips_thread_free( thr );
+		return( NULL );
+	}
 
 	/* We can't build the state here, it has to be done by the worker
 	 * itself the first time that allocate runs so that any regions are 
 	 * owned by the correct thread.
 	 */
 
-	if( !(thr->thread = vips_g_thread_new( "worker", 
-		vips_thread_main_loop, thr )) ) {  
-		vips_thread_free( thr );
-		return( NULL );
-	}
-
 	return( thr );
 }
 
+/* Set a thread running.
+ */
+static int
+vips_thread_start( VipsThread *thr )
+{
+	if( !(thr->worker = vips_worker_lease( vips_thread_main_loop, 
+		thr, thr->pool->node )) ) 
+		return( -1 );
+
+	return( 0 );
+}
+
 /* Kill all threads in a threadpool, if there are any.
  */
 static void
@@ -748,6 +1586,20 @@ vips_threadpool_kill_threads( VipsThreadpool *pool )
 
 /* This can be called multiple times, careful.
  */
+/* Hand back our part of the pipeline budget and wake any waiting pools.
+ */
+static void
+vips_pipeline_release( VipsThreadpool *pool )
+{
+	if( pool->reserved ) {
+		g_mutex_lock( vips__pipeline_lock );
+		vips__pipeline_mem -= pool->reserved;
+		pool->reserved = 0;
+		g_cond_broadcast( vips__pipeline_cond );
+		g_mutex_unlock( vips__pipeline_lock );
+	}
+}
+
 static int
 vips_threadpool_free( VipsThreadpool *pool )
 {
@@ -755,6 +1607,7 @@ vips_threadpool_free( VipsThreadpool *pool )
 		pool->im->filename, pool );
 
 	vips_threadpool_kill_threads( pool );
+	vips_pipeline_release( pool );
 	VIPS_FREEF( vips_g_mutex_free, pool->allocate_lock );
 	vips_semaphore_destroy( &pool->finish );
 	vips_semaphore_destroy( &pool->tick );
@@ -768,6 +1621,183 @@ vips_threadpool_new_cb( VipsImage *im, VipsThreadpool *pool )
 	vips_threadpool_free( pool );
 }
 
+void
+vips__image_set_mem_hint( VipsImage *image, size_t size )
+{
+	size_t *hint;
+
+	hint = g_new( size_t, 1 );
+	*hint = size;
+	g_object_set_qdata_full( G_OBJECT( image ),
+		vips__pipeline_hint_quark, hint, (GDestroyNotify) g_free );
+}
+
+typedef struct _VipsPipelineEstimate {
+	VipsImage *sink;
+	int tile_width;
+	int tile_height;
+
+	size_t per_thread;
+	size_t fixed;
+} VipsPipelineEstimate;
+
+static void *
+vips_pipeline_estimate_cb( VipsImage *image, void *a, void *b )
+{
+	VipsPipelineEstimate *estimate = (VipsPipelineEstimate *) a;
+	VipsImage *sink = estimate->sink;
+	size_t *hint;
+
+	/* Each thread holds about a tile of every computed image in the
+	 * pipeline. Images upstream of a shrink need proportionally larger
+	 * regions, though never more than the whole image. Images in memory
+	 * or on disc are already paid for.
+	 */
+	if( image->dtype == VIPS_IMAGE_PARTIAL ) {
+		double scale =
+			VIPS_MAX( 1.0, (double) image->Xsize / sink->Xsize ) *
+			VIPS_MAX( 1.0, (double) image->Ysize / sink->Ysize );
+		double tile = scale *
+			estimate->tile_width * estimate->tile_height *
+			VIPS_IMAGE_SIZEOF_PEL( image );
+
+		estimate->per_thread += VIPS_MIN( tile,
+			VIPS_IMAGE_SIZEOF_IMAGE( image ) );
+	}
+
+	/* A loader which will decode to memory on first use. Once the decode
+	 * has happened the load is linked to the decoded image, and that is
+	 * tracked memory.
+	 */
+	if( !image->upstream &&
+		(hint = g_object_get_qdata( G_OBJECT( image ),
+			vips__pipeline_hint_quark )) )
+		estimate->fixed += *hint;
+
+	return( NULL );
+}
+
+static void
+vips_pipeline_estimate_pool( VipsImage *image,
+	size_t *per_thread, size_t *fixed )
+{
+	VipsPipelineEstimate estimate;
+	int n_lines;
+
+	estimate.sink = image;
+	vips_get_tile_size( image,
+		&estimate.tile_width, &estimate.tile_height, &n_lines );
+	estimate.per_thread = 0;
+
+	/* Allow for the pair of line buffers vips_sink_disc() writes
+	 * through. Other sinks need less, but it's a small part of the
+	 * total.
+	 */
+	estimate.fixed = 2 * n_lines * VIPS_IMAGE_SIZEOF_LINE( image );
+
+	vips__link_map( image, TRUE,
+		(VipsSListMap2Fn) vips_pipeline_estimate_cb, &estimate, NULL );
+
+	*per_thread = estimate.per_thread;
+	*fixed = estimate.fixed;
+}
+
+/**
+ * vips_pipeline_estimate:
+ * @image: image to estimate
+ * @threads: number of worker threads
+ *
+ * Estimate the peak memory needed to compute @image with @threads workers.
+ * The estimate is made from the tile geometry vips_get_tile_size() would
+ * pick, a tile per thread for every image in the pipeline, the sink
+ * buffers, and any whole-image decodes loaders will need to make.
+ *
+ * It can't know about memory allocated by external libraries, or by
+ * operations which hold large internal buffers.
+ *
+ * See also: vips_pipeline_set_max_mem().
+ *
+ * Returns: estimated peak memory use in bytes.
+ */
+size_t
+vips_pipeline_estimate( VipsImage *image, int threads )
+{
+	size_t per_thread;
+	size_t fixed;
+
+	vips_pipeline_estimate_pool( image, &per_thread, &fixed );
+
+	return( fixed + VIPS_MAX( 1, threads ) * per_thread );
+}
+
+/* Estimate the pool's memory use and reserve it from the budget. If the
+ * budget is short we run with fewer threads, and if even one thread won't
+ * fit we wait for other pipelines to finish.
+ */
+static void
+vips_pipeline_admit( VipsThreadpool *pool )
+{
+	size_t per_thread;
+	size_t fixed;
+	gint64 start;
+
+	pool->nthr_wanted = pool->nthr;
+	pool->measure = vips__pipeline_report != NULL;
+	if( !vips__pipeline_max_mem &&
+		!pool->measure )
+		return;
+
+	vips_pipeline_estimate_pool( pool->im, &per_thread, &fixed );
+
+	if( vips__pipeline_max_mem ) {
+		start = g_get_monotonic_time();
+
+		g_mutex_lock( vips__pipeline_lock );
+
+		for(;;) {
+			size_t avail = vips__pipeline_max_mem >
+				vips__pipeline_mem ?
+				vips__pipeline_max_mem - vips__pipeline_mem :
+				0;
+			size_t n = avail > fixed ?
+				(avail - fixed) / VIPS_MAX( 1, per_thread ) :
+				0;
+
+			if( n >= 1 ) {
+				pool->nthr = VIPS_MIN( n, (size_t) pool->nthr );
+				break;
+			}
+
+			/* With nothing else running we must let this
+			 * through, or we'd wait forever. A pipeline started
+			 * from a worker mustn't wait either: the pipeline
+			 * it is working for holds a reservation.
+			 */
+			if( vips__pipeline_mem == 0 ||
+				vips_thread_isworker() ) {
+				pool->nthr = 1;
+				break;
+			}
+
+			g_cond_wait( vips__pipeline_cond,
+				vips__pipeline_lock );
+		}
+
+		pool->reserved = fixed + pool->nthr * per_thread;
+		vips__pipeline_mem += pool->reserved;
+
+		g_mutex_unlock( vips__pipeline_lock );
+
+		pool->wait = (g_get_monotonic_time() - start) / 1000000.0;
+	}
+
+	pool->estimate = fixed + pool->nthr * per_thread;
+
+	if( pool->nthr < pool->nthr_wanted )
+		vips_info( "threadpool", "pipeline memory budget: "
+			"%d threads, not %d", pool->nthr, pool->nthr_wanted );
+}
+
 static VipsThreadpool *
 vips_threadpool_new( VipsImage *im )
 {
@@ -783,14 +1813,24 @@ vips_threadpool_new( VipsImage *im )
 		return( NULL );
 	pool->im = im;
 	pool->allocate = NULL;
+	pool->allocate_batch = NULL;
 	pool->work = NULL;
 	pool->allocate_lock = vips_g_mutex_new();
 	pool->nthr = vips_concurrency_get();
 	pool->thr = NULL;
+	pool->batch_size = 1;
+	pool->node = -1;
 	vips_semaphore_init( &pool->finish, 0, "finish" );
 	vips_semaphore_init( &pool->tick, 0, "tick" );
 	pool->error = FALSE;
 	pool->stop = FALSE;
+	pool->estimate = 0;
+	pool->reserved = 0;
+	pool->nthr_wanted = 0;
+	pool->wait = 0.0;
+	pool->measure = FALSE;
+	pool->mem_start = 0;
+	pool->peak = 0;
 
 	/* If this is a tiny image, we won't need all nthr threads. Guess how
 	 * many tiles we might need to cover the image and use that to limit
@@ -802,6 +1842,20 @@ vips_threadpool_new( VipsImage *im )
 	n_tiles = VIPS_CLIP( 0, n_tiles, MAX_THREADS ); 
 	pool->nthr = VIPS_MIN( pool->nthr, n_tiles ); 
 
+#ifdef HAVE_SCHED_SETAFFINITY
+	/* In NUMA mode, run the whole pool on one node, and don't start more 
+	 * threads than the node has CPUs.
+	 */
+	if( vips_numa_get() ) {
+		pool->node = (g_atomic_int_add( &vips__next_node, 1 ) & 
+			G_MAXINT) % vips__n_nodes;
+		pool->nthr = VIPS_MIN( pool->nthr, 
+			CPU_COUNT( &vips__node_cpus[pool->node] ) ); 
+	}
+#endif /*HAVE_SCHED_SETAFFINITY*/
+
+	vips_pipeline_admit( pool );
+
 	/* Attach tidy-up callback.
 	 */
 	g_signal_connect( im, "close", 
@@ -829,10 +1883,24 @@ vips_threadpool_create_threads( VipsThreadpool *pool )
 	for( i = 0; i < pool->nthr; i++ )
 		pool->thr[i] = NULL;
 
-	/* Attach threads and start them working.
+	/* Make all the threads before we start any of them, so the array is 
+	 * complete for stealing.
 	 */
 	for( i = 0; i < pool->nthr; i++ )
-		if( !(pool->thr[i] = vips_thread_new( pool )) ) {
+		if( !(pool->thr[i] = vips_thread_new( pool, i )) ) {
+			vips_threadpool_kill_threads( pool );
+			return( -1 );
+		}
+
+	/* And start them working.
+	 */
+	for( i = 0; i < pool->nthr; i++ )
+		if( vips_thread_start( pool->thr[i] ) ) {
+			/* Only the threads we have started will ever hit
+			 * finish.
+			 */
+			pool->error = TRUE;
+			vips_semaphore_downn( &pool->finish, i );
 			vips_threadpool_kill_threads( pool );
 			return( -1 );
 		}
@@ -840,6 +1908,81 @@ vips_threadpool_create_threads( VipsThreadpool *pool )
 	return( 0 );
 }
 
+/* Run a pool we've set up and free it.
+ */
+static int
+vips_threadpool_run_pool( VipsThreadpool *pool, 
+	VipsThreadpoolProgressFn progress )
+{
+	VipsImage *im = pool->im;
+	int result;
+
+	if( pool->measure )
+		pool->mem_start = vips_tracked_get_mem();
+
+	/* Attach workers and set them going.
+	 */
+	if( vips_threadpool_create_threads( pool ) ) {
+		vips_threadpool_free( pool );
+		return( -1 );
+	}
+
+	for(;;) {
+		/* Wait for a tick from a worker.
+		 */
+		vips_semaphore_down( &pool->tick );
+
+		VIPS_DEBUG_MSG( "vips_threadpool_run: tick\n" );
+
+		if( pool->measure )
+			pool->peak = VIPS_MAX( pool->peak,
+				(gint64) vips_tracked_get_mem() -
+					pool->mem_start );
+
+		if( pool->stop || 
+			pool->error )
+			break;
+
+		if( progress &&
+			progress( pool->a ) ) 
+			pool->error = TRUE;
+
+		if( pool->stop || 
+			pool->error )
+			break;
+	}
+
+	/* Wait for them all to hit finish.
+	 */
+	vips_semaphore_downn( &pool->finish, pool->nthr );
+
+	/* Return 0 for success.
+	 */
+	result = pool->error ? -1 : 0;
+
+	/* Report from the thread that ran the pipeline, so callers can
+	 * match reports to their own work.
+	 */
+	if( pool->measure ) {
+		VipsPipelineStats stats;
+
+		stats.image = im;
+		stats.estimate = pool->estimate;
+		stats.peak = pool->peak;
+		stats.threads = pool->nthr;
+		stats.threads_wanted = pool->nthr_wanted;
+		stats.wait = pool->wait;
+
+		vips__pipeline_report( &stats, vips__pipeline_report_a );
+	}
+
+	vips_threadpool_free( pool );
+
+	vips_image_minimise_all( im );
+
+	return( result );
+}
+
 /**
  * VipsThreadpoolStartFn:
  * @a: client data
@@ -951,7 +2094,6 @@ vips_threadpool_run( VipsImage *im,
 	void *a )
 {
 	VipsThreadpool *pool; 
-	int result;
 
 	if( !(pool = vips_threadpool_new( im )) )
 		return( -1 );
@@ -961,46 +2103,93 @@ vips_threadpool_run( VipsImage *im,
 	pool->work = work;
 	pool->a = a;
 
-	/* Attach workers and set them going.
-	 */
-	if( vips_threadpool_create_threads( pool ) ) {
-		vips_threadpool_free( pool );
-		return( -1 );
-	}
-
-	for(;;) {
-		/* Wait for a tick from a worker.
-		 */
-		vips_semaphore_down( &pool->tick );
-
-		VIPS_DEBUG_MSG( "vips_threadpool_run: tick\n" );
-
-		if( pool->stop || 
-			pool->error )
-			break;
-
-		if( progress &&
-			progress( pool->a ) ) 
-			pool->error = TRUE;
+	return( vips_threadpool_run_pool( pool, progress ) );
+}
 
-		if( pool->stop || 
-			pool->error )
-			break;
-	}
+/**
+ * VipsThreadUnit:
+ * @pos: the area this unit covers
+ * @data: client data for this unit, eg. the buffer it should write to
+ *
+ * A unit of work, as allocated by #VipsThreadpoolAllocateBatchFn. Before 
+ * @work runs on a unit, @pos is copied to the state's pos and @data to the
+ * state's unit member.
+ */
 
-	/* Wait for them all to hit finish.
-	 */
-	vips_semaphore_downn( &pool->finish, pool->nthr );
+/**
+ * VipsThreadpoolAllocateBatchFn:
+ * @state: per-thread state
+ * @a: client data
+ * @units: fill this array with work units
+ * @max_units: the maximum number of units to allocate
+ * @n_units: (out): set this to the number of units allocated
+ * @stop: set this to signal end of computation
+ *
+ * This function is called to allocate up to @max_units new work units. Like 
+ * #VipsThreadpoolAllocateFn, it is always single-threaded. It can allocate 
+ * fewer than @max_units, for example if a batch would need to cross a 
+ * buffer boundary.
+ *
+ * It should set @stop to %TRUE when the job is done. Units allocated in 
+ * the same call as @stop is set are still processed.
+ *
+ * The units may be processed by any thread in the pool, not necessarily the
+ * one that allocated them.
+ *
+ * See also: vips_threadpool_run_batch().
+ *
+ * Returns: 0 on success, or -1 on error
+ */
 
-	/* Return 0 for success.
-	 */
-	result = pool->error ? -1 : 0;
+/**
+ * vips_threadpool_run_batch:
+ * @im: image to loop over
+ * @start: allocate per-thread state
+ * @allocate_batch: allocate a batch of work units
+ * @work: process a work unit
+ * @progress: give progress feedback about a work unit, or %NULL
+ * @a: client data
+ *
+ * As vips_threadpool_run(), but work is allocated with @allocate_batch.
+ *
+ * If the environment variable VIPS_WORK_STEAL is set, each thread allocates 
+ * several units at once into a private queue, and threads which find their 
+ * queue empty steal units from their neighbours before they go back to 
+ * @allocate_batch. This cuts contention on the allocate lock when there 
+ * are many threads and small tiles. 
+ *
+ * Otherwise, @allocate_batch is asked for a single unit at a time and
+ * behaviour is the same as vips_threadpool_run().
+ *
+ * Units which have been allocated are always passed to @work, even after an
+ * error.
+ *
+ * See also: vips_threadpool_run(), vips_concurrency_set().
+ *
+ * Returns: 0 on success, or -1 on error.
+ */
+int
+vips_threadpool_run_batch( VipsImage *im, 
+	VipsThreadStartFn start, 
+	VipsThreadpoolAllocateBatchFn allocate_batch, 
+	VipsThreadpoolWorkFn work,
+	VipsThreadpoolProgressFn progress, 
+	void *a )
+{
+	VipsThreadpool *pool; 
 
-	vips_threadpool_free( pool );
+	if( !(pool = vips_threadpool_new( im )) )
+		return( -1 );
 
-	vips_image_minimise_all( im );
+	pool->start = start;
+	pool->allocate_batch = allocate_batch;
+	pool->work = work;
+	pool->a = a;
+	if( vips__work_steal &&
+		pool->nthr > 1 )
+		pool->batch_size = VIPS__THREADPOOL_BATCH;
 
-	return( result );
+	return( vips_threadpool_run_pool( pool, progress ) );
 }
 
 /* Start up threadpools. This is called during vips_init.
@@ -1012,15 +2201,173 @@ vips__threadpool_init( void )
 	 */
 #ifdef HAVE_PRIVATE_INIT
 	static GPrivate private = { 0 }; 
+	static GPrivate pipeline_private = { 0 };
 
 	is_worker_key = &private;
+	pipeline_key = &pipeline_private;
 #else
 	if( !is_worker_key ) 
 		is_worker_key = g_private_new( NULL ); 
+	if( !pipeline_key )
+		pipeline_key = g_private_new( NULL );
 #endif
 
+	if( !vips__worker_lock )
+		vips__worker_lock = vips_g_mutex_new();
+
+	if( !vips__pipeline_lock ) {
+		vips__pipeline_lock = vips_g_mutex_new();
+		vips__pipeline_cond = vips_g_cond_new();
+		vips__pipeline_hint_quark =
+			g_quark_from_static_string( "vips-pipeline-hint" );
+	}
+
+	if( g_getenv( "VIPS_PIPELINE_MAX_MEM" ) )
+		vips__pipeline_max_mem =
+			vips__parse_size( g_getenv( "VIPS_PIPELINE_MAX_MEM" ) );
+
 	if( g_getenv( "VIPS_STALL" ) )
 		vips__stall = TRUE;
+
+	if( g_getenv( "VIPS_WORK_STEAL" ) )
+		vips__work_steal = TRUE;
+
+	if( g_getenv( "VIPS_NUMA" ) )
+		vips__numa = TRUE;
+
+	if( g_getenv( "VIPS_TILE_TARGET" ) )
+		vips__tile_target = 
+			vips__parse_size( g_getenv( "VIPS_TILE_TARGET" ) );
+
+	if( g_getenv( "VIPS_TILE_REPORT" ) )
+		vips__tile_report = TRUE;
+}
+
+/* Shut down any idle workers. This is called during vips_shutdown.
+ */
+void
+vips__threadpool_shutdown( void )
+{
+	GSList *idle;
+	GSList *p;
+
+	if( !vips__worker_lock )
+		return;
+
+	g_mutex_lock( vips__worker_lock );
+
+	idle = vips__worker_idle;
+	vips__worker_idle = NULL;
+	vips__worker_n_idle = 0;
+
+	g_mutex_unlock( vips__worker_lock );
+
+	for( p = idle; p; p = p->next )
+		vips_worker_free( (VipsWorker *) p->data );
+	g_slist_free( idle );
+}
+
+/* What we need to know about a pipeline to size tiles.
+ */
+typedef struct _VipsTilePipeline {
+	/* Number of images that will need a buffer.
+	 */
+	int n_images;
+
+	/* Sum of VIPS_IMAGE_SIZEOF_PEL() over those images. 
+	 */
+	size_t sizeof_pels;
+} VipsTilePipeline;
+
+static void *
+vips_tile_pipeline_add( VipsImage *image, VipsTilePipeline *pipeline, 
+	void *b )
+{
+	/* Only images with a generate function will have pixel buffers. 
+	 * Source images are usually in memory or mapped. 
+	 */
+	if( image->generate_fn ) {
+		pipeline->n_images += 1;
+		pipeline->sizeof_pels += VIPS_IMAGE_SIZEOF_PEL( image );
+	}
+
+	return( NULL );
+}
+
+/* Largest power of two <= n, limited to the range [min, max].
+ */
+static int
+vips_tile_pow2( size_t n, int min, int max )
+{
+	int size;
+
+	for( size = min; size < max && (size_t) size * 2 <= n; size *= 2 )
+		;
+
+	return( size );
+}
+
+/* Pick a tile geometry so that a tile's worth of pixels across the whole
+ * pipeline above @im comes to about vips__tile_target bytes. Single-band
+ * uchar pipelines get big tiles, deep pipelines of many-band float images 
+ * get small ones.
+ *
+ * Geometry is always a power of two within fixed limits, so n_lines can 
+ * stay independent of the image.
+ */
+static void
+vips_get_tile_size_adaptive( VipsImage *im, int *tile_width, int *tile_height )
+{
+	VipsTilePipeline pipeline;
+	size_t pixels;
+
+	pipeline.n_images = 0;
+	pipeline.sizeof_pels = 0;
+	(void) vips__link_map( im, TRUE, 
+		(VipsSListMap2Fn) vips_tile_pipeline_add, &pipeline, NULL );
+	pipeline.sizeof_pels = VIPS_MAX( pipeline.sizeof_pels, 
+		VIPS_IMAGE_SIZEOF_PEL( im ) );
+
+	pixels = vips__tile_target / pipeline.sizeof_pels;
+
+	switch( im->dhint ) {
+	case VIPS_DEMAND_STYLE_SMALLTILE:
+		/* Square tiles, so sqrt of the pixel count.
+		 */
+		*tile_width = vips_tile_pow2( sqrt( pixels ), 
+			VIPS__TILE_ADAPTIVE_MIN, VIPS__TILE_ADAPTIVE_MAX );
+		*tile_height = *tile_width;
+		break;
+
+	case VIPS_DEMAND_STYLE_ANY:
+	case VIPS_DEMAND_STYLE_FATSTRIP:
+		*tile_width = im->Xsize;
+		*tile_height = vips_tile_pow2( pixels / im->Xsize, 
+			1, VIPS__FATSTRIP_ADAPTIVE_MAX );
+		break;
+
+	case VIPS_DEMAND_STYLE_THINSTRIP:
+		/* Thinstrip operations really want single lines.
+		 */
+		*tile_width = im->Xsize;
+		*tile_height = vips__thinstrip_height;
+		break;
+
+	default:
+		g_assert_not_reached();
+	}
+
+	if( vips__tile_report ) 
+		printf( "vips_get_tile_size: %s %dx%d %d bands, "
+			"%d images in pipeline, %zd bytes per pixel, "
+			"%d x %d tiles, target %d bytes, working set %zd bytes\n",
+			vips_enum_nick( VIPS_TYPE_DEMAND_STYLE, im->dhint ),
+			im->Xsize, im->Ysize, im->Bands,
+			pipeline.n_images, pipeline.sizeof_pels, 
+			*tile_width, *tile_height, 
+			vips__tile_target, 
+			(size_t) *tile_width * *tile_height * 
+				pipeline.sizeof_pels );
 }
 
 /**
@@ -1037,6 +2384,12 @@ vips__threadpool_init( void )
  * The buffer height is the height of each buffer we fill in sink disc. Since
  * we have two buffers, the largest range of input locality is twice the output
  * buffer size, plus whatever margin we add for things like convolution. 
+ *
+ * If the `VIPS_TILE_TARGET` environment variable or the `--vips-tile-target` 
+ * flag is set to a size in bytes, tiles are sized so that one tile's worth 
+ * of pixels across every image in the pipeline comes to about that much,
+ * for example the size of your L2 cache. Set `VIPS_TILE_REPORT` or 
+ * `--vips-tile-report` to print the geometry that is picked and why.
  */
 void
 vips_get_tile_size( VipsImage *im, 
@@ -1073,6 +2426,9 @@ vips_get_tile_size( VipsImage *im,
 		g_assert_not_reached();
 	}
 
+	if( vips__tile_target > 0 )
+		vips_get_tile_size_adaptive( im, tile_width, tile_height );
+
 	/* We can't set n_lines for the current demand style: a later bit of
 	 * the pipeline might see a different hint and we need to synchronise
 	 * buffer sizes everywhere.
@@ -1088,6 +2444,20 @@ vips_get_tile_size( VipsImage *im,
 			typical_image_width;
 	*n_lines = VIPS_MAX( *n_lines, vips__fatstrip_height * nthr );
 	*n_lines = VIPS_MAX( *n_lines, vips__thinstrip_height * nthr );
+
+	/* Adaptive tiles can be anything up to the max size, so size buffers 
+	 * for the largest. They are always a power of two, so rounding up to 
+	 * the max keeps n_lines the same for every image in the pipeline.
+	 */
+	if( vips__tile_target > 0 ) {
+		*n_lines = VIPS_MAX( *n_lines, VIPS__TILE_ADAPTIVE_MAX * 
+			VIPS_ROUND_UP( VIPS__TILE_ADAPTIVE_MAX * nthr, 
+				typical_image_width ) / typical_image_width );
+		*n_lines = VIPS_MAX( *n_lines, 
+			VIPS__FATSTRIP_ADAPTIVE_MAX * nthr );
+		*n_lines = VIPS_ROUND_UP( *n_lines, VIPS__TILE_ADAPTIVE_MAX );
+	}
+
 	*n_lines = VIPS_ROUND_UP( *n_lines, *tile_height );
 
 	/* We make this assumption in several places.
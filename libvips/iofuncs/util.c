@@ -40,6 +40,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 #include <ctype.h>
 #include <errno.h>
 
@@ -844,18 +845,98 @@ vips__file_write( void *data, size_t size, size_t nmemb, FILE *stream )
 	return( 0 );
 }
 
+/* The start of a file, read once and shared between the is_a() sniffers
+ * while we pick a loader, see vips__get_bytes_preload().
+ */
+typedef struct _VipsGetBytesPreload {
+	char *filename;
+	const unsigned char *buf;
+	guint64 length;
+
+	/* TRUE if buf holds the whole file.
+	 */
+	gboolean complete;
+} VipsGetBytesPreload;
+
+static GPrivate *vips_get_bytes_preload_key = NULL;
+
+static void *
+vips_get_bytes_preload_init_cb( void *data )
+{
+#ifdef HAVE_PRIVATE_INIT
+	static GPrivate private = G_PRIVATE_INIT( NULL );
+
+	vips_get_bytes_preload_key = &private;
+#else
+	vips_get_bytes_preload_key = g_private_new( NULL );
+#endif
+
+	return( NULL );
+}
+
+static VipsGetBytesPreload *
+vips_get_bytes_preload_get( void )
+{
+	static GOnce once = G_ONCE_INIT;
+
+	VIPS_ONCE( &once, vips_get_bytes_preload_init_cb, NULL );
+
+	return( (VipsGetBytesPreload *)
+		g_private_get( vips_get_bytes_preload_key ) );
+}
+
+/* Until the next call, vips__get_bytes() on this thread will serve requests
+ * for @filename from @buf, which holds the first @length bytes of the file,
+ * or all of it if @complete is set. @buf must stay valid until
+ * vips__get_bytes_preload() is called again with a NULL @filename to clear.
+ */
+void
+vips__get_bytes_preload( const char *filename,
+	const unsigned char *buf, guint64 length, gboolean complete )
+{
+	VipsGetBytesPreload *preload = vips_get_bytes_preload_get();
+
+	if( preload ) {
+		g_private_set( vips_get_bytes_preload_key, NULL );
+		g_free( preload->filename );
+		g_free( preload );
+	}
+
+	if( filename ) {
+		preload = g_new( VipsGetBytesPreload, 1 );
+		preload->filename = g_strdup( filename );
+		preload->buf = buf;
+		preload->length = length;
+		preload->complete = complete;
+		g_private_set( vips_get_bytes_preload_key, preload );
+	}
+}
+
 /* Read a few bytes from the start of a file. This is used for sniffing file 
  * types, so we must read binary. 
  *
  * Return the number of bytes actually read (the file might be shorter than
  * len), or 0 for error.
+ *
+ * Requests for a file set with vips__get_bytes_preload() are served from
+ * memory.
  */
 guint64
 vips__get_bytes( const char *filename, unsigned char buf[], guint64 len )
 {
+	VipsGetBytesPreload *preload;
 	int fd;
 	guint64 bytes_read;
 
+	if( (preload = vips_get_bytes_preload_get()) &&
+		(len <= preload->length || preload->complete) &&
+		strcmp( preload->filename, filename ) == 0 ) {
+		bytes_read = VIPS_MIN( len, preload->length );
+		memcpy( buf, preload->buf, bytes_read );
+
+		return( bytes_read );
+	}
+
 	/* File may not even exist (for tmp images for example!)
 	 * so no hasty messages. And the file might be truncated, so no error
 	 * on read either.
@@ -1951,6 +2032,53 @@ vips__random_add( guint32 seed, int value )
 	return( vips__random( seed ) ); 
 }
 
+/* A counter-based generator, Philox-2x32-10. See:
+ *
+ * Salmon et al., "Parallel Random Numbers: As Easy as 1, 2, 3", SC11.
+ *
+ * There's no state: each (seed, x, y) maps to an independent 64-bit random
+ * number, so generators can compute any pixel directly and the output does
+ * not depend on tile order or the number of threads.
+ */
+guint64
+vips__random_counter( guint32 seed, guint32 x, guint32 y )
+{
+	guint32 key = seed;
+	guint32 c0 = x;
+	guint32 c1 = y;
+	int i;
+
+	for( i = 0; i < 10; i++ ) {
+		guint64 product = (guint64) 0xD256D193u * c0;
+
+		c0 = (guint32) (product >> 32) ^ key ^ c1;
+		c1 = (guint32) product;
+		key += 0x9E3779B9u;
+	}
+
+	return( ((guint64) c0 << 32) | c1 );
+}
+
+/* Two independent samples from a normal distribution with mean 0 and
+ * standard deviation 1, by Box-Muller from vips__random_counter().
+ */
+void
+vips__random_gauss( guint32 seed, guint32 x, guint32 y,
+	double *z0, double *z1 )
+{
+	guint64 r = vips__random_counter( seed, x, y );
+
+	/* u1 in (0, 1] so the log is finite, u2 in [0, 1).
+	 */
+	double u1 = ((r >> 32) + 1.0) / 4294967296.0;
+	double u2 = (r & 0xffffffffu) / 4294967296.0;
+	double radius = sqrt( -2.0 * log( u1 ) );
+	double theta = 2.0 * M_PI * u2;
+
+	*z0 = radius * cos( theta );
+	*z1 = radius * sin( theta );
+}
+
 static void *
 vips_icc_dir_once( void *null )
 {
@@ -2,6 +2,9 @@
  *
  * 29/10/10
  * 	- from morph hacking
+ * 14/10/18
+ * 	- share compiled programs with a cache, see
+ * 	  vips_vector_cache_set_max()
  */
 
 /*
@@ -68,6 +71,185 @@
  */
 gboolean vips__vector_enabled = TRUE;
 
+/* Compiling an orc program is slow, and operations like conv and morph build
+ * a new set of programs every time they are called, usually the same ones.
+ * We keep compiled programs here, indexed by a string which records every
+ * instruction and variable in the program, and share them between vectors.
+ *
+ * Programs which are in use are never removed. We keep up to
+ * vips_vector_cache_max unused programs around, dropping the least recently
+ * used first.
+ *
+ * Everything is protected by vips__global_lock, since we need to hold that
+ * while we compile anyway.
+ */
+typedef struct _VipsVectorCacheEntry {
+	/* Our key in the table.
+	 */
+	char *key;
+
+#ifdef HAVE_ORC
+	OrcProgram *program;
+#endif /*HAVE_ORC*/
+
+	/* The result of compiling the program. We cache failures too, there's
+	 * no point trying again.
+	 */
+	gboolean compiled;
+
+	/* Number of vectors using this program.
+	 */
+	int ref_count;
+
+	/* Last time we were used, for LRU.
+	 */
+	int time;
+} VipsVectorCacheEntry;
+
+static GHashTable *vips_vector_cache_table = NULL;
+static int vips_vector_cache_max = VIPS_VECTOR_CACHE_MAX;
+static int vips_vector_cache_time = 0;
+static int vips_vector_cache_hits = 0;
+static int vips_vector_cache_misses = 0;
+
+static void
+vips_vector_cache_entry_free( VipsVectorCacheEntry *entry )
+{
+	g_assert( entry->ref_count == 0 ); 
+
+#ifdef HAVE_ORC
+	VIPS_FREEF( orc_program_free, entry->program );
+#endif /*HAVE_ORC*/
+	VIPS_FREE( entry->key );
+	g_free( entry );
+}
+
+static void
+vips_vector_cache_get_lru_cb( const char *key, 
+	VipsVectorCacheEntry *entry, VipsVectorCacheEntry **best )
+{
+	if( entry->ref_count == 0 &&
+		(!*best || 
+		 entry->time < (*best)->time) )
+		*best = entry;
+}
+
+static int
+vips_vector_cache_n_unused( void )
+{
+	GHashTableIter iter;
+	gpointer value;
+	int n;
+
+	n = 0;
+	g_hash_table_iter_init( &iter, vips_vector_cache_table );
+	while( g_hash_table_iter_next( &iter, NULL, &value ) )
+		if( ((VipsVectorCacheEntry *) value)->ref_count == 0 )
+			n += 1;
+
+	return( n );
+}
+
+/* Drop unused programs until we are under the limit. You must hold
+ * vips__global_lock.
+ */
+static void
+vips_vector_cache_trim( int max )
+{
+	int n_unused;
+
+	if( !vips_vector_cache_table )
+		return;
+
+	for( n_unused = vips_vector_cache_n_unused(); 
+		n_unused > max; n_unused-- ) {
+		VipsVectorCacheEntry *entry;
+
+		entry = NULL;
+		g_hash_table_foreach( vips_vector_cache_table,
+			(GHFunc) vips_vector_cache_get_lru_cb, &entry );
+		g_assert( entry ); 
+
+		g_hash_table_remove( vips_vector_cache_table, entry->key );
+		vips_vector_cache_entry_free( entry );
+	}
+}
+
+/**
+ * vips_vector_cache_set_max:
+ * @max: maximum number of unused programs to keep
+ *
+ * Set the maximum number of compiled vector programs we keep while nothing
+ * is using them. Programs which are in use are not counted. Set 0 to disable
+ * the cache.
+ *
+ * You can also use the `--vips-vector-cache-max` command-line option or the
+ * `VIPS_VECTOR_CACHE_MAX` environment variable.
+ *
+ * See also: vips_vector_cache_get_size().
+ */
+void
+vips_vector_cache_set_max( int max )
+{
+	g_mutex_lock( vips__global_lock );
+	vips_vector_cache_max = VIPS_MAX( 0, max );
+	vips_vector_cache_trim( vips_vector_cache_max );
+	g_mutex_unlock( vips__global_lock );
+}
+
+/**
+ * vips_vector_cache_get_max:
+ *
+ * Returns: the maximum number of unused compiled vector programs we keep.
+ */
+int
+vips_vector_cache_get_max( void )
+{
+	return( vips_vector_cache_max );
+}
+
+/**
+ * vips_vector_cache_get_size:
+ *
+ * Returns: the number of compiled vector programs in the cache, including
+ * programs which are in use.
+ */
+int
+vips_vector_cache_get_size( void )
+{
+	int size;
+
+	g_mutex_lock( vips__global_lock );
+	size = vips_vector_cache_table ? 
+		g_hash_table_size( vips_vector_cache_table ) : 0;
+	g_mutex_unlock( vips__global_lock );
+
+	return( size );
+}
+
+/**
+ * vips_vector_cache_drop_all:
+ *
+ * Drop all unused programs from the compiled vector program cache. This is
+ * called by vips_shutdown().
+ */
+void
+vips_vector_cache_drop_all( void )
+{
+	if( !vips__global_lock )
+		return;
+
+	g_mutex_lock( vips__global_lock );
+	vips_vector_cache_trim( 0 );
+	if( vips_vector_cache_table &&
+		g_hash_table_size( vips_vector_cache_table ) == 0 ) 
+		VIPS_FREEF( g_hash_table_destroy, vips_vector_cache_table );
+	g_mutex_unlock( vips__global_lock );
+
+	g_info( "vector cache: %d hits, %d misses", 
+		vips_vector_cache_hits, vips_vector_cache_misses );
+}
+
 void
 vips_vector_error( VipsVector *vector )
 {
@@ -103,6 +285,10 @@ vips_vector_init( void )
 		g_getenv( "IM_NOVECTOR" ) ) 
 		vips__vector_enabled = FALSE;
 #endif /*HAVE_ORC*/
+
+	if( g_getenv( "VIPS_VECTOR_CACHE_MAX" ) ) 
+		vips_vector_cache_max = VIPS_MAX( 0, 
+			atoi( g_getenv( "VIPS_VECTOR_CACHE_MAX" ) ) );
 }
 
 gboolean 
@@ -124,6 +310,21 @@ vips_vector_set_enabled( gboolean enabled )
 void
 vips_vector_free( VipsVector *vector )
 {
+	/* If our program came from the cache, just drop our ref. The cache
+	 * will free it eventually.
+	 */
+	if( vector->cache_entry ) {
+		g_mutex_lock( vips__global_lock );
+		vector->cache_entry->ref_count -= 1;
+		g_assert( vector->cache_entry->ref_count >= 0 );
+		vector->cache_entry = NULL;
+#ifdef HAVE_ORC
+		vector->program = NULL;
+#endif /*HAVE_ORC*/
+		vips_vector_cache_trim( vips_vector_cache_max );
+		g_mutex_unlock( vips__global_lock );
+	}
+
 #ifdef HAVE_ORC
 	/* orc-0.4.19 will crash if you free programs. Update your orc, or
 	 * comment out this line. 
@@ -139,6 +340,10 @@ vips_vector_free( VipsVector *vector )
 #endif /*DEBUG_TRACE*/
 	VIPS_FREEF( orc_program_free, vector->program );
 #endif /*HAVE_ORC*/
+	if( vector->key ) {
+		g_string_free( vector->key, TRUE );
+		vector->key = NULL;
+	}
 	VIPS_FREE( vector->unique_name );
 	VIPS_FREE( vector );
 }
@@ -171,6 +376,8 @@ vips_vector_new( const char *name, int dsize )
 	vector->d1 = -1;
 
 	vector->compiled = FALSE;
+	vector->key = g_string_new( NULL );
+	vector->cache_entry = NULL;
 
 #ifdef HAVE_ORC
 	vector->program = orc_program_new();
@@ -196,6 +403,7 @@ vips_vector_asm2( VipsVector *vector,
 	const char *op, const char *a, const char *b )
 {
 	vector->n_instruction += 1;
+	g_string_append_printf( vector->key, "%s %s %s;", op, a, b );
 
 #ifdef DEBUG
 	 printf( "  %s %s %s\n", op, a, b );
@@ -215,6 +423,7 @@ vips_vector_asm3( VipsVector *vector,
 	const char *op, const char *a, const char *b, const char *c )
 {
 	vector->n_instruction += 1;
+	g_string_append_printf( vector->key, "%s %s %s %s;", op, a, b, c );
 
 #ifdef DEBUG
 	 printf( "  %s %s %s %s\n", op, a, b, c );
@@ -263,6 +472,8 @@ vips_vector_constant( VipsVector *vector, char *name, int value, int size )
 		if( !orc_program_add_constant( vector->program, 
 			size, value, name ) )
 			vips_vector_error( vector );
+		g_string_append_printf( vector->key, 
+			"c %d %d %s;", size, value, name );
 		vector->n_constant += 1;
 	}
 #endif /*HAVE_ORC*/
@@ -285,6 +496,7 @@ vips_vector_source_scanline( VipsVector *vector,
 		printf( "orc_program_add_source( %s, %d, \"%s\" );\n",
 			vector->unique_name, size, name );
 #endif /*DEBUG_TRACE*/
+		g_string_append_printf( vector->key, "sl %d %s;", size, name );
 		vector->sl[vector->n_scanline] = var;
 		vector->line[vector->n_scanline] = line;
 		vector->n_scanline += 1;
@@ -302,6 +514,7 @@ vips_vector_source_name( VipsVector *vector, const char *name, int size )
 
 	if( !(var = orc_program_add_source( vector->program, size, name )) )
 		vips_vector_error( vector ); 
+	g_string_append_printf( vector->key, "s %d %s;", size, name );
 	vector->s[vector->n_source] = var;
 #ifdef DEBUG_TRACE
 	printf( "orc_program_add_source( %s, %d, \"%s\" );\n", 
@@ -323,6 +536,7 @@ vips_vector_temporary( VipsVector *vector, const char *name, int size )
 
 	if( !orc_program_add_temporary( vector->program, size, name ) )
 		vips_vector_error( vector ); 
+	g_string_append_printf( vector->key, "t %d %s;", size, name );
 
 #ifdef DEBUG_TRACE
 	printf( "orc_program_add_temporary( %s, %d, \"%s\" );\n",
@@ -343,6 +557,7 @@ vips_vector_parameter( VipsVector *vector, const char *name, int size )
 	var = orc_program_add_parameter( vector->program, size, name );
 	if( !var )
 		vips_vector_error( vector ); 
+	g_string_append_printf( vector->key, "p %d %s;", size, name );
 
 #ifdef DEBUG_TRACE
 	printf( "orc_program_add_parameter( %s, %d, \"%s\" );\n",
@@ -365,6 +580,7 @@ vips_vector_destination( VipsVector *vector, const char *name, int size )
 	g_assert( orc_program_find_var_by_name( vector->program, name ) == -1 );
 
 	var = orc_program_add_destination( vector->program, size, name );
+	g_string_append_printf( vector->key, "d %d %s;", size, name );
 #ifdef DEBUG_TRACE
 	printf( "orc_program_add_destination( %d, \"%s\" );\n",
 		size, name );
@@ -414,18 +630,56 @@ gboolean
 vips_vector_compile( VipsVector *vector )
 {
 #ifdef HAVE_ORC
-	OrcCompileResult result;
+	VipsVectorCacheEntry *entry;
+	gboolean compiled;
+
+	g_assert( !vector->cache_entry );
 
-	/* Some orcs seem to be unstable with many compilers active at once.
+	/* Some orcs seem to be unstable with many compilers active at once,
+	 * so we compile inside the global lock. This protects the cache too.
 	 */
 	g_mutex_lock( vips__global_lock );
-	result = orc_program_compile( vector->program );
-	g_mutex_unlock( vips__global_lock );
 
+	if( !vips_vector_cache_table )
+		vips_vector_cache_table = 
+			g_hash_table_new( g_str_hash, g_str_equal );
+
+	if( (entry = g_hash_table_lookup( vips_vector_cache_table, 
+		vector->key->str )) ) {
+		/* An identical program has already been compiled. Use that 
+		 * instead of ours. Variables are numbered in the order they 
+		 * are added, so all the ids we've handed out are still valid.
+		 */
+		VIPS_FREEF( orc_program_free, vector->program );
+		vector->program = entry->program;
+		vips_vector_cache_hits += 1;
+	}
+	else {
+		OrcCompileResult result;
+
+		result = orc_program_compile( vector->program );
 #ifdef DEBUG_TRACE
-	printf( "orc_program_compile( %s );\n", vector->unique_name );
+		printf( "orc_program_compile( %s );\n", vector->unique_name );
 #endif /*DEBUG_TRACE*/
-	if( !ORC_COMPILE_RESULT_IS_SUCCESSFUL( result ) ) {
+
+		entry = g_new( VipsVectorCacheEntry, 1 );
+		entry->key = g_strdup( vector->key->str );
+		entry->program = vector->program;
+		entry->compiled = ORC_COMPILE_RESULT_IS_SUCCESSFUL( result );
+		entry->ref_count = 0;
+		g_hash_table_insert( vips_vector_cache_table, 
+			entry->key, entry );
+		vips_vector_cache_misses += 1;
+	}
+
+	entry->ref_count += 1;
+	entry->time = vips_vector_cache_time++;
+	vector->cache_entry = entry;
+	compiled = entry->compiled;
+
+	g_mutex_unlock( vips__global_lock );
+
+	if( !compiled ) {
 #ifdef DEBUG
 		printf( "*** error compiling %s\n", vector->name );
 #endif /*DEBUG*/
@@ -23,6 +23,10 @@
  * 	- validate strs as being utf-8 before we write
  * 9/4/18 Alexander--
  * 	- use O_TMPFILE, if available
+ * 14/10/18
+ * 	- add tiled layout with page-aligned tiles and a tile index
+ * 	- optional lz4 compression for tiled temp files
+ * 	- add vips__assemble_parts()
  */
 
 /*
@@ -98,6 +102,10 @@
 #include <vips/internal.h>
 #include <vips/debug.h>
 
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif /*HAVE_LZ4*/
+
 /**
  * SECTION: vips
  * @short_description: startup, shutdown, version
@@ -151,6 +159,15 @@
  */
 #define NAMESPACE_URI "http://www.vips.ecs.soton.ac.uk/" 
 
+/* Tiles in a tiled .v file start on a multiple of this many bytes, so each
+ * one can be mapped directly.
+ */
+#define VIPS_TILE_ALIGN (4096)
+
+/* Each entry in the tile index is a 64-bit offset and a 32-bit length.
+ */
+#define VIPS_TILE_INDEX_ENTRY (12)
+
 /* Open for read for image files. 
  */
 int
@@ -224,6 +241,63 @@ vips__open_image_write( const char *filename, gboolean temp )
 	return( fd );
 }
 
+/* A tiled file has a header, then a tile index, then page-aligned tiles,
+ * one after the other, then the XML extension. Edge tiles are stored at
+ * full size.
+ */
+/* The tile layout lives in VipsImagePrivate, so VipsImage keeps its size.
+ */
+#define TILE_WIDTH( I ) (vips__image_private( I )->tile_width)
+#define TILE_HEIGHT( I ) (vips__image_private( I )->tile_height)
+
+static gboolean
+image_is_tiled( VipsImage *image )
+{
+	return( TILE_WIDTH( image ) > 0 &&
+		TILE_HEIGHT( image ) > 0 );
+}
+
+static int
+tiled_across( VipsImage *image )
+{
+	return( VIPS_ROUND_UP( image->Xsize, TILE_WIDTH( image ) ) /
+		TILE_WIDTH( image ) );
+}
+
+static int
+tiled_down( VipsImage *image )
+{
+	return( VIPS_ROUND_UP( image->Ysize, TILE_HEIGHT( image ) ) /
+		TILE_HEIGHT( image ) );
+}
+
+static gint64
+tiled_n_tiles( VipsImage *image )
+{
+	return( (gint64) tiled_across( image ) * tiled_down( image ) );
+}
+
+static gint64
+tiled_tile_size( VipsImage *image )
+{
+	return( (gint64) TILE_WIDTH( image ) * TILE_HEIGHT( image ) *
+		VIPS_IMAGE_SIZEOF_PEL( image ) );
+}
+
+static gint64
+tiled_stride( VipsImage *image )
+{
+	return( VIPS_ROUND_UP( tiled_tile_size( image ), VIPS_TILE_ALIGN ) );
+}
+
+static gint64
+tiled_data_start( VipsImage *image )
+{
+	return( VIPS_ROUND_UP( image->sizeof_header +
+		tiled_n_tiles( image ) * VIPS_TILE_INDEX_ENTRY,
+		VIPS_TILE_ALIGN ) );
+}
+
 /* Predict the size of the header plus pixel data. Don't use off_t,
  * it's sometimes only 32 bits (eg. on many windows build environments) and we
  * want to always be 64 bit.
@@ -233,6 +307,14 @@ image_pixel_length( VipsImage *image )
 {
 	gint64 psize;
 
+	if( image_is_tiled( image ) &&
+		image->Compression == VIPS__TILE_COMPRESSION_LZ4 )
+		return( VIPS_MAX( vips__image_private( image )->tile_data_end,
+			tiled_data_start( image ) ) );
+	else if( image_is_tiled( image ) )
+		return( tiled_data_start( image ) +
+			tiled_n_tiles( image ) * tiled_stride( image ) );
+
 	switch( image->Coding ) {
 	case VIPS_CODING_LABQ:
 	case VIPS_CODING_RAD:
@@ -315,6 +397,8 @@ static FieldIO fields[] = {
 int
 vips__read_header_bytes( VipsImage *im, unsigned char *from )
 {
+	VipsImagePrivate *private = vips__image_private( im );
+
 	gboolean swap;
 	int i;
 
@@ -348,6 +432,13 @@ vips__read_header_bytes( VipsImage *im, unsigned char *from )
 		from += fields[i].size;
 	}
 
+	/* Then the tile size, zero for scanline files, in the spare bytes.
+	 */
+	vips__copy_4byte( swap, 
+		(unsigned char *) &private->tile_width, from );
+	vips__copy_4byte( swap, 
+		(unsigned char *) &private->tile_height, from + 4 );
+
 	/* Set this ourselves ... bbits is deprecated in the file format.
 	 */
 	im->Bbits = vips_format_sizeof( im->BandFmt ) << 3;
@@ -365,6 +456,10 @@ vips__read_header_bytes( VipsImage *im, unsigned char *from )
 	im->Ysize = VIPS_CLIP( 1, im->Ysize, VIPS_MAX_COORD );
 	im->Bands = VIPS_CLIP( 1, im->Bands, VIPS_MAX_COORD );
 	im->BandFmt = VIPS_CLIP( 0, im->BandFmt, VIPS_FORMAT_LAST - 1 );
+	private->tile_width = 
+		VIPS_CLIP( 0, private->tile_width, VIPS_MAX_COORD );
+	private->tile_height = 
+		VIPS_CLIP( 0, private->tile_height, VIPS_MAX_COORD );
 
 	/* Type, Coding, Offset, Res, etc. don't affect vips file layout, just 
 	 * pixel interpretation, don't clip them.
@@ -376,6 +471,8 @@ vips__read_header_bytes( VipsImage *im, unsigned char *from )
 int
 vips__write_header_bytes( VipsImage *im, unsigned char *to )
 {
+	VipsImagePrivate *private = vips__image_private( im );
+
 	/* Swap if the byte order we are asked to write the header in is
 	 * different from ours.
 	 */
@@ -404,6 +501,11 @@ vips__write_header_bytes( VipsImage *im, unsigned char *to )
 		q += fields[i].size;
 	}
 
+	vips__copy_4byte( swap, q, (unsigned char *) &private->tile_width );
+	vips__copy_4byte( swap, q + 4, 
+		(unsigned char *) &private->tile_height );
+	q += 8;
+
 	/* Pad spares with zeros.
 	 */
 	while( q - to < im->sizeof_header )
@@ -983,6 +1085,792 @@ vips__writehist( VipsImage *image )
 	return( 0 );
 }
 
+/* State for writing a tiled file.
+ */
+typedef struct _VipsTiledWrite {
+	/* Pixels come from here.
+	 */
+	VipsImage *in;
+
+	/* Holds the header fields we write, and the fd we write to.
+	 */
+	VipsImage *header;
+	int fd;
+
+	/* The tile index we build.
+	 */
+	gint64 *offset;
+	guint32 *length;
+
+	/* Compressed tiles are packed together from here.
+	 */
+	gint64 position;
+
+	/* Scanlines for the current row of tiles, a tile to assemble
+	 * output in, and a buffer for compressed tiles.
+	 */
+	VipsPel *strip;
+	int strip_top;
+	int strip_height;
+	VipsPel *tile;
+	VipsPel *compressed;
+	int compressed_size;
+} VipsTiledWrite;
+
+static void
+vips_tiled_write_free( VipsTiledWrite *write )
+{
+	VIPS_FREE( write->offset );
+	VIPS_FREE( write->length );
+	VIPS_FREE( write->strip );
+	VIPS_FREE( write->tile );
+	VIPS_FREE( write->compressed );
+}
+
+/* Write tile @i from write->tile.
+ */
+static int
+vips_tiled_write_tile( VipsTiledWrite *write, gint64 i )
+{
+	VipsImage *header = write->header;
+	gint64 tile_size = tiled_tile_size( header );
+
+	VipsPel *data;
+	gint64 length;
+
+#ifdef HAVE_LZ4
+	if( header->Compression == VIPS__TILE_COMPRESSION_LZ4 ) {
+		if( (length = LZ4_compress_default( (char *) write->tile,
+			(char *) write->compressed,
+			tile_size, write->compressed_size )) <= 0 ) {
+			vips_error( "VipsImage",
+				"%s", _( "unable to compress tile" ) );
+			return( -1 );
+		}
+		data = write->compressed;
+		write->offset[i] = write->position;
+		write->position += length;
+	}
+	else
+#endif /*HAVE_LZ4*/
+	{
+		data = write->tile;
+		length = tile_size;
+		write->offset[i] = tiled_data_start( header ) +
+			i * tiled_stride( header );
+	}
+	write->length[i] = length;
+
+	if( vips__seek( write->fd, write->offset[i] ) ||
+		vips__write( write->fd, data, length ) )
+		return( -1 );
+
+	return( 0 );
+}
+
+/* Write the row of tiles in the strip buffer.
+ */
+static int
+vips_tiled_write_strip( VipsTiledWrite *write )
+{
+	VipsImage *header = write->header;
+	size_t ps = VIPS_IMAGE_SIZEOF_PEL( header );
+	size_t ls = VIPS_IMAGE_SIZEOF_LINE( header );
+	int across = tiled_across( header );
+	int tile_width = TILE_WIDTH( header );
+	int tile_height = TILE_HEIGHT( header );
+	int ty = write->strip_top / tile_height;
+
+	int tx;
+
+	for( tx = 0; tx < across; tx++ ) {
+		int left = tx * tile_width;
+		int width = VIPS_MIN( tile_width, header->Xsize - left );
+
+		int y;
+
+		if( width < tile_width ||
+			write->strip_height < tile_height )
+			memset( write->tile, 0, tiled_tile_size( header ) );
+
+		for( y = 0; y < write->strip_height; y++ )
+			memcpy( write->tile + y * tile_width * ps,
+				write->strip + y * ls + left * ps,
+				width * ps );
+
+		if( vips_tiled_write_tile( write, (gint64) ty * across + tx ) )
+			return( -1 );
+	}
+
+	write->strip_top += write->strip_height;
+	write->strip_height = 0;
+
+	return( 0 );
+}
+
+/* Runs in the background write thread of vips_sink_disc(), so compression
+ * overlaps with computing the next strip.
+ */
+static int
+vips_tiled_write_block( VipsRegion *region, VipsRect *area, void *a )
+{
+	VipsTiledWrite *write = (VipsTiledWrite *) a;
+	VipsImage *header = write->header;
+	size_t ls = VIPS_IMAGE_SIZEOF_LINE( header );
+	int tile_height = TILE_HEIGHT( header );
+
+	int y;
+
+	for( y = 0; y < area->height; y++ ) {
+		memcpy( write->strip + write->strip_height * ls,
+			VIPS_REGION_ADDR( region, 0, area->top + y ), ls );
+		write->strip_height += 1;
+
+		if( write->strip_height == tile_height ||
+			write->strip_top + write->strip_height ==
+				header->Ysize )
+			if( vips_tiled_write_strip( write ) )
+				return( -1 );
+	}
+
+	return( 0 );
+}
+
+static int
+vips_tiled_write_index( VipsTiledWrite *write )
+{
+	VipsImage *header = write->header;
+	gint64 n_tiles = tiled_n_tiles( header );
+
+	unsigned char *index;
+	unsigned char *q;
+	gint64 i;
+
+	if( !(index = vips_malloc( NULL, n_tiles * VIPS_TILE_INDEX_ENTRY )) )
+		return( -1 );
+
+	/* We always write in native byte order.
+	 */
+	q = index;
+	for( i = 0; i < n_tiles; i++ ) {
+		guint64 offset = write->offset[i];
+
+		memcpy( q, &offset, 8 );
+		memcpy( q + 8, &write->length[i], 4 );
+		q += VIPS_TILE_INDEX_ENTRY;
+	}
+
+	if( vips__seek( write->fd, header->sizeof_header ) ||
+		vips__write( write->fd,
+			index, n_tiles * VIPS_TILE_INDEX_ENTRY ) ) {
+		vips_free( index );
+		return( -1 );
+	}
+	vips_free( index );
+
+	return( 0 );
+}
+
+/* Write the pixels of @in as tiles to @header->fd, after the header.
+ */
+static int
+vips_tiled_write( VipsImage *in, VipsImage *header, int fd )
+{
+	gint64 n_tiles = tiled_n_tiles( header );
+	gint64 tile_size = tiled_tile_size( header );
+
+	VipsTiledWrite write;
+
+	if( header->Coding != VIPS_CODING_NONE &&
+		header->Coding != VIPS_CODING_LABQ &&
+		header->Coding != VIPS_CODING_RAD ) {
+		vips_error( "VipsImage",
+			"%s", _( "unable to write this coding as tiles" ) );
+		return( -1 );
+	}
+
+	memset( &write, 0, sizeof( write ) );
+	write.in = in;
+	write.header = header;
+	write.fd = fd;
+	write.position = tiled_data_start( header );
+
+#ifdef HAVE_LZ4
+	if( header->Compression == VIPS__TILE_COMPRESSION_LZ4 ) {
+		write.compressed_size = LZ4_compressBound( tile_size );
+		if( !(write.compressed =
+			vips_malloc( NULL, write.compressed_size )) )
+			return( -1 );
+	}
+#else /*!HAVE_LZ4*/
+	header->Compression = 0;
+#endif /*HAVE_LZ4*/
+
+	if( !(write.offset = VIPS_ARRAY( NULL, n_tiles, gint64 )) ||
+		!(write.length = VIPS_ARRAY( NULL, n_tiles, guint32 )) ||
+		!(write.strip = vips_malloc( NULL,
+			VIPS_IMAGE_SIZEOF_LINE( header ) *
+				TILE_HEIGHT( header ) )) ||
+		!(write.tile = vips_malloc( NULL, tile_size )) ||
+		vips_sink_disc( in, vips_tiled_write_block, &write ) ||
+		vips_tiled_write_index( &write ) ) {
+		vips_tiled_write_free( &write );
+		return( -1 );
+	}
+
+	if( header->Compression == VIPS__TILE_COMPRESSION_LZ4 )
+		vips__image_private( header )->tile_data_end = 
+			write.position;
+
+	vips_tiled_write_free( &write );
+
+	return( 0 );
+}
+
+/* Write @in to @filename as a tiled .v file. Pixels are uncompressed, and
+ * each tile starts on a page boundary so readers can map just the tiles
+ * they need.
+ */
+int
+vips__write_tiled( VipsImage *in, const char *filename,
+	int tile_width, int tile_height )
+{
+	unsigned char buf[VIPS_SIZEOF_HEADER];
+	VipsImage *header;
+	int fd;
+	char *xml;
+
+	header = vips_image_new();
+	vips_image_init_fields( header,
+		in->Xsize, in->Ysize, in->Bands, in->BandFmt,
+		in->Coding, in->Type, in->Xres, in->Yres );
+	header->Xoffset = in->Xoffset;
+	header->Yoffset = in->Yoffset;
+	header->magic = vips_amiMSBfirst() ?
+		VIPS_MAGIC_SPARC : VIPS_MAGIC_INTEL;
+	TILE_WIDTH( header ) = tile_width;
+	TILE_HEIGHT( header ) = tile_height;
+
+	if( (fd = vips__open_image_write( filename, FALSE )) < 0 ) {
+		g_object_unref( header );
+		return( -1 );
+	}
+
+	/* The XML extension goes after the last tile.
+	 */
+	if( vips__write_header_bytes( header, buf ) ||
+		vips__write( fd, buf, VIPS_SIZEOF_HEADER ) ||
+		vips_tiled_write( in, header, fd ) ||
+		!(xml = build_xml( in )) ) {
+		vips_tracked_close( fd );
+		g_object_unref( header );
+		return( -1 );
+	}
+	if( vips__ftruncate( fd, image_pixel_length( header ) ) ||
+		vips__seek( fd, image_pixel_length( header ) ) ||
+		vips__write( fd, xml, strlen( xml ) ) ) {
+		g_free( xml );
+		vips_tracked_close( fd );
+		g_object_unref( header );
+		return( -1 );
+	}
+	g_free( xml );
+	vips_tracked_close( fd );
+	g_object_unref( header );
+
+	return( 0 );
+}
+
+/* Write the pixels of an OPENOUT image with a tile size set, see
+ * vips_image_new_temp_file(). The header is already there, and the XML is
+ * added by vips__writehist() when the image is written.
+ */
+int
+vips__write_tiled_output( VipsImage *image )
+{
+	g_assert( image->dtype == VIPS_IMAGE_OPENOUT );
+	g_assert( image_is_tiled( image ) );
+
+	return( vips_tiled_write( image, image, image->fd ) );
+}
+
+/* Copy the pixels of a part written by vips_image_write_area() into place in
+ * out. Rows are read in chunks, and written as one block if the part is the
+ * full width of the output.
+ */
+static int
+vips_assemble_part( VipsImage *out, VipsImage *part )
+{
+	size_t psize = VIPS_IMAGE_SIZEOF_PEL( out );
+	size_t part_line = VIPS_IMAGE_SIZEOF_LINE( part );
+	size_t out_line = VIPS_IMAGE_SIZEOF_LINE( out );
+	int chunk = VIPS_CLIP( 1, (1024 * 1024) / part_line, part->Ysize );
+
+	VipsPel *buf;
+	int y;
+
+	if( !(buf = vips_malloc( NULL, chunk * part_line )) )
+		return( -1 );
+
+	for( y = 0; y < part->Ysize; y += chunk ) {
+		int n = VIPS_MIN( chunk, part->Ysize - y );
+		gint64 to = VIPS_SIZEOF_HEADER +
+			(gint64) (part->Yoffset + y) * out_line +
+			(gint64) part->Xoffset * psize;
+		int i;
+
+		if( vips__seek( part->fd,
+			part->sizeof_header + (gint64) y * part_line ) )
+			goto error;
+		if( read( part->fd, buf, n * part_line ) !=
+			(ssize_t) (n * part_line) ) {
+			vips_error_system( errno, "VipsImage",
+				_( "unable to read data for \"%s\"" ),
+				part->filename );
+			goto error;
+		}
+
+		if( part_line == out_line ) {
+			if( vips__seek( out->fd, to ) ||
+				vips__write( out->fd, buf, n * part_line ) )
+				goto error;
+		}
+		else 
+			for( i = 0; i < n; i++ ) {
+				VipsPel *p = buf + i * part_line;
+
+				if( vips__seek( out->fd, to + i * out_line ) ||
+					vips__write( out->fd, p, part_line ) )
+					goto error;
+			}
+	}
+
+	vips_free( buf );
+
+	return( 0 );
+
+error:
+	vips_free( buf );
+
+	return( -1 );
+}
+
+/* Stitch parts made by vips_image_write_area() into a single vips file. The
+ * parts are opened vips images, "r" mode, and the pixels are copied across
+ * with no decode or re-encode. Areas no part covers are left as zero.
+ */
+int
+vips__assemble_parts( const char *filename, VipsImage **parts, int n )
+{
+	VipsImage *first;
+	VipsImage *in[2];
+	VipsImage *out;
+	int width;
+	int height;
+	int i;
+
+	if( n < 1 ) {
+		vips_error( "VipsImage", "%s", _( "no parts to assemble" ) );
+		return( -1 );
+	}
+	first = parts[0];
+
+	/* The full size is recorded in each part, but use the bounding box
+	 * of the parts if it's missing.
+	 */
+	if( vips_image_get_typeof( first, VIPS_META_PART_WIDTH ) &&
+		vips_image_get_typeof( first, VIPS_META_PART_HEIGHT ) ) {
+		if( vips_image_get_int( first, VIPS_META_PART_WIDTH, &width ) ||
+			vips_image_get_int( first,
+				VIPS_META_PART_HEIGHT, &height ) )
+			return( -1 );
+	}
+	else {
+		width = 0;
+		height = 0;
+		for( i = 0; i < n; i++ ) {
+			width = VIPS_MAX( width,
+				parts[i]->Xoffset + parts[i]->Xsize );
+			height = VIPS_MAX( height,
+				parts[i]->Yoffset + parts[i]->Ysize );
+		}
+	}
+
+	for( i = 0; i < n; i++ ) {
+		VipsImage *part = parts[i];
+
+		if( part->dtype != VIPS_IMAGE_OPENIN ||
+			image_is_tiled( part ) ) {
+			vips_error( "VipsImage",
+				_( "\"%s\" is not an untiled vips file" ),
+				part->filename );
+			return( -1 );
+		}
+
+		if( part->Bands != first->Bands ||
+			part->BandFmt != first->BandFmt ||
+			part->Coding != first->Coding ) {
+			vips_error( "VipsImage",
+				_( "\"%s\" does not match the first part" ),
+				part->filename );
+			return( -1 );
+		}
+
+		if( part->Xoffset < 0 ||
+			part->Yoffset < 0 ||
+			part->Xoffset + part->Xsize > width ||
+			part->Yoffset + part->Ysize > height ) {
+			vips_error( "VipsImage",
+				_( "\"%s\" is outside the image" ),
+				part->filename );
+			return( -1 );
+		}
+	}
+
+	in[0] = first;
+	in[1] = NULL;
+	out = vips_image_new_mode( filename, "w" );
+	if( vips__image_copy_fields_array( out, in ) ) {
+		g_object_unref( out );
+		return( -1 );
+	}
+	out->Xsize = width;
+	out->Ysize = height;
+	out->Xoffset = 0;
+	out->Yoffset = 0;
+	(void) vips_image_remove( out, VIPS_META_PART_WIDTH );
+	(void) vips_image_remove( out, VIPS_META_PART_HEIGHT );
+
+	/* Size the file first, so any gaps are holes.
+	 */
+	if( vips_image_write_prepare( out ) ||
+		vips__ftruncate( out->fd, VIPS_SIZEOF_HEADER +
+			VIPS_IMAGE_SIZEOF_IMAGE( out ) ) ) {
+		g_object_unref( out );
+		return( -1 );
+	}
+
+	for( i = 0; i < n; i++ )
+		if( vips_assemble_part( out, parts[i] ) ) {
+			g_object_unref( out );
+			return( -1 );
+		}
+
+	/* This writes the XML.
+	 */
+	if( vips_image_written( out ) ) {
+		g_object_unref( out );
+		return( -1 );
+	}
+
+	g_object_unref( out );
+
+	return( 0 );
+}
+
+/* The tile index from a tiled file.
+ */
+typedef struct _VipsTiled {
+	VipsImage *image;
+
+	int tile_width;
+	int tile_height;
+	int across;
+	gint64 *offset;
+	guint32 *length;
+} VipsTiled;
+
+/* Per-thread read state: the tile we have mapped, or decompressed.
+ */
+typedef struct _VipsTiledSeq {
+	VipsTiled *tiled;
+
+	int tile;
+	void *baseaddr;
+	size_t length;
+	VipsPel *data;
+
+	/* Decompress to here.
+	 */
+	VipsPel *buffer;
+} VipsTiledSeq;
+
+static void
+vips_tiled_unmap( VipsTiledSeq *seq )
+{
+	if( seq->baseaddr ) {
+		vips__munmap( seq->baseaddr, seq->length );
+		seq->baseaddr = NULL;
+		seq->length = 0;
+	}
+	seq->data = NULL;
+	seq->tile = -1;
+}
+
+static int
+vips_tiled_stop( void *vseq, void *a, void *b )
+{
+	VipsTiledSeq *seq = (VipsTiledSeq *) vseq;
+
+	vips_tiled_unmap( seq );
+	VIPS_FREE( seq->buffer );
+	g_free( seq );
+
+	return( 0 );
+}
+
+static void *
+vips_tiled_start( VipsImage *out, void *a, void *b )
+{
+	VipsTiled *tiled = (VipsTiled *) a;
+
+	VipsTiledSeq *seq;
+
+	seq = g_new0( VipsTiledSeq, 1 );
+	seq->tiled = tiled;
+	seq->tile = -1;
+
+	if( out->Compression == VIPS__TILE_COMPRESSION_LZ4 &&
+		!(seq->buffer = vips_malloc( NULL, tiled_tile_size( out ) )) ) {
+		vips_tiled_stop( seq, a, b );
+		return( NULL );
+	}
+
+	return( seq );
+}
+
+/* Map a tile, or map and decompress, unless we have it already.
+ */
+static int
+vips_tiled_map( VipsTiledSeq *seq, int tile )
+{
+	VipsTiled *tiled = seq->tiled;
+	VipsImage *image = tiled->image;
+
+	if( seq->tile != tile ) {
+		gint64 offset = tiled->offset[tile];
+		gint64 start =
+			VIPS_ROUND_DOWN( offset, vips_window_pagesize( image ) );
+		size_t length = tiled->length[tile] + (offset - start);
+
+		void *baseaddr;
+
+		vips_tiled_unmap( seq );
+		if( !(baseaddr = vips__mmap( image->fd, 0, length, start )) )
+			return( -1 );
+		seq->baseaddr = baseaddr;
+		seq->length = length;
+		seq->data = (VipsPel *) baseaddr + (offset - start);
+
+#ifdef HAVE_LZ4
+		if( image->Compression == VIPS__TILE_COMPRESSION_LZ4 ) {
+			int tile_size = tiled_tile_size( image );
+
+			if( LZ4_decompress_safe( (char *) seq->data,
+				(char *) seq->buffer,
+				tiled->length[tile],
+				tile_size ) != tile_size ) {
+				vips_tiled_unmap( seq );
+				vips_error( "VipsImage",
+					_( "bad tile %d in \"%s\"" ),
+					tile, image->filename );
+				return( -1 );
+			}
+
+			/* We can drop the mapping, we only need the
+			 * decompressed pixels.
+			 */
+			vips_tiled_unmap( seq );
+			seq->data = seq->buffer;
+		}
+#endif /*HAVE_LZ4*/
+
+		seq->tile = tile;
+	}
+
+	return( 0 );
+}
+
+static int
+vips_tiled_generate( VipsRegion *or,
+	void *vseq, void *a, void *b, gboolean *stop )
+{
+	VipsTiledSeq *seq = (VipsTiledSeq *) vseq;
+	VipsTiled *tiled = (VipsTiled *) a;
+	VipsImage *image = tiled->image;
+	VipsRect *r = &or->valid;
+	size_t ps = VIPS_IMAGE_SIZEOF_PEL( image );
+
+	int tx, ty;
+
+	for( ty = r->top / tiled->tile_height;
+		ty * tiled->tile_height < VIPS_RECT_BOTTOM( r ); ty++ )
+		for( tx = r->left / tiled->tile_width;
+			tx * tiled->tile_width < VIPS_RECT_RIGHT( r ); tx++ ) {
+			VipsRect tile;
+			VipsRect hit;
+			int y;
+
+			tile.left = tx * tiled->tile_width;
+			tile.top = ty * tiled->tile_height;
+			tile.width = tiled->tile_width;
+			tile.height = tiled->tile_height;
+			vips_rect_intersectrect( &tile, r, &hit );
+
+			if( vips_tiled_map( seq, tx + ty * tiled->across ) )
+				return( -1 );
+
+			for( y = 0; y < hit.height; y++ ) {
+				VipsPel *p = seq->data + ps *
+					((hit.top - tile.top + y) *
+					 tiled->tile_width +
+					 (hit.left - tile.left));
+				VipsPel *q = VIPS_REGION_ADDR( or,
+					hit.left, hit.top + y );
+
+				memcpy( q, p, ps * hit.width );
+			}
+		}
+
+	return( 0 );
+}
+
+/* Read and check the tile index. We need this before we can find the XML
+ * extension of a compressed file.
+ */
+static VipsTiled *
+vips_tiled_new( VipsImage *image )
+{
+	gboolean swap =
+		vips_amiMSBfirst() != (image->magic == VIPS_MAGIC_SPARC);
+	gint64 n_tiles = tiled_n_tiles( image );
+	gint64 tile_size = tiled_tile_size( image );
+	size_t index_length = n_tiles * VIPS_TILE_INDEX_ENTRY;
+
+	VipsTiled *tiled;
+	unsigned char *index;
+	gint64 max_length;
+	gint64 tile_data_end;
+	gint64 i;
+
+	if( (image->Coding != VIPS_CODING_NONE &&
+		image->Coding != VIPS_CODING_LABQ &&
+		image->Coding != VIPS_CODING_RAD) ||
+		tile_size > G_MAXINT ) {
+		vips_error( "VipsImage",
+			_( "unsupported tile layout in \"%s\"" ),
+			image->filename );
+		return( NULL );
+	}
+
+	switch( image->Compression ) {
+	case 0:
+		max_length = tile_size;
+		break;
+
+#ifdef HAVE_LZ4
+	case VIPS__TILE_COMPRESSION_LZ4:
+		max_length = LZ4_compressBound( tile_size );
+		break;
+#endif /*HAVE_LZ4*/
+
+	default:
+		vips_error( "VipsImage",
+			_( "unsupported tile compression in \"%s\"" ),
+			image->filename );
+		return( NULL );
+	}
+
+	if( !(tiled = VIPS_NEW( image, VipsTiled )) ||
+		!(tiled->offset = VIPS_ARRAY( image, n_tiles, gint64 )) ||
+		!(tiled->length = VIPS_ARRAY( image, n_tiles, guint32 )) ||
+		!(index = vips_malloc( NULL, index_length )) )
+		return( NULL );
+	tiled->image = image;
+	tiled->tile_width = TILE_WIDTH( image );
+	tiled->tile_height = TILE_HEIGHT( image );
+	tiled->across = tiled_across( image );
+
+	if( vips__seek( image->fd, image->sizeof_header ) ||
+		read( image->fd, index, index_length ) !=
+			(ssize_t) index_length ) {
+		vips_free( index );
+		vips_error( "VipsImage",
+			_( "unable to read tile index for \"%s\"" ),
+			image->filename );
+		return( NULL );
+	}
+
+	tile_data_end = tiled_data_start( image );
+	for( i = 0; i < n_tiles; i++ ) {
+		unsigned char *p = index + i * VIPS_TILE_INDEX_ENTRY;
+		guint64 offset;
+
+		memcpy( &offset, p, 8 );
+		if( swap )
+			offset = GUINT64_SWAP_LE_BE( offset );
+		tiled->offset[i] = offset;
+		vips__copy_4byte( swap,
+			(unsigned char *) &tiled->length[i], p + 8 );
+
+		/* Uncompressed tiles must be exactly one tile, and we must
+		 * never map beyond the end of the file.
+		 */
+		if( tiled->length[i] == 0 ||
+			tiled->length[i] > max_length ||
+			(image->Compression == 0 &&
+			 tiled->length[i] != tile_size) ||
+			tiled->offset[i] < image->sizeof_header ||
+			tiled->offset[i] + tiled->length[i] >
+				image->file_length ) {
+			vips_free( index );
+			vips_error( "VipsImage",
+				_( "bad tile index in \"%s\"" ),
+				image->filename );
+			return( NULL );
+		}
+
+		tile_data_end = VIPS_MAX( tile_data_end,
+			tiled->offset[i] + tiled->length[i] );
+	}
+	vips_free( index );
+
+	vips__image_private( image )->tile_data_end = tile_data_end;
+
+	return( tiled );
+}
+
+/* Attach a generate function that maps tiles on demand.
+ */
+static int
+vips_tiled_attach( VipsTiled *tiled )
+{
+	VipsImage *image = tiled->image;
+
+	/* Look up the mmap alignment now, before any threads start.
+	 */
+	(void) vips_window_pagesize( image );
+
+	/* We may be reopening an image we have just written, see
+	 * vips_image_rewind_output(). Drop the old generate functions.
+	 */
+	image->start_fn = NULL;
+	image->generate_fn = NULL;
+	image->stop_fn = NULL;
+	image->client1 = NULL;
+	image->client2 = NULL;
+
+	image->dtype = VIPS_IMAGE_PARTIAL;
+	if( vips_image_pipelinev( image,
+		VIPS_DEMAND_STYLE_SMALLTILE, NULL ) ||
+		vips_image_generate( image,
+			vips_tiled_start, vips_tiled_generate, vips_tiled_stop,
+			tiled, NULL ) )
+		return( -1 );
+
+	return( 0 );
+}
+
 /* Open the filename, read the header, some sanity checking.
  */
 int
@@ -995,6 +1883,7 @@ vips_image_open_input( VipsImage *image )
 
 	gint64 psize;
 	gint64 rsize;
+	VipsTiled *tiled;
 
 	image->dtype = VIPS_IMAGE_OPENIN;
 
@@ -1020,10 +1909,18 @@ vips_image_open_input( VipsImage *image )
 	 * able to read all the header fields we can, even if the actual data
 	 * isn't there. 
 	 */
-	psize = image_pixel_length( image );
 	if( (rsize = vips_file_length( image->fd )) == -1 ) 
 		return( -1 );
 	image->file_length = rsize;
+
+	/* Compressed tiled files need the index to find the end of the pixels.
+	 */
+	tiled = NULL;
+	if( image_is_tiled( image ) &&
+		!(tiled = vips_tiled_new( image )) )
+		return( -1 );
+
+	psize = image_pixel_length( image );
 	if( psize > rsize )
 		g_warning( _( "unable to read data for \"%s\", %s" ),
 			image->filename, _( "file has been truncated" ) );
@@ -1042,6 +1939,10 @@ vips_image_open_input( VipsImage *image )
 		vips_error_clear();
 	}
 
+	if( tiled &&
+		vips_tiled_attach( tiled ) )
+		return( -1 );
+
 	return( 0 );
 }
 
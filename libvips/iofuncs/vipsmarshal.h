@@ -14,6 +14,22 @@ extern void vips_INT__VOID (GClosure     *closure,
                             gpointer      invocation_hint,
                             gpointer      marshal_data);
 
+/* INT64:POINTER,INT64 (vipsmarshal.list:26) */
+extern void vips_INT64__POINTER_INT64 (GClosure     *closure,
+                                       GValue       *return_value,
+                                       guint         n_param_values,
+                                       const GValue *param_values,
+                                       gpointer      invocation_hint,
+                                       gpointer      marshal_data);
+
+/* INT64:INT64,INT (vipsmarshal.list:27) */
+extern void vips_INT64__INT64_INT (GClosure     *closure,
+                                   GValue       *return_value,
+                                   guint         n_param_values,
+                                   const GValue *param_values,
+                                   gpointer      invocation_hint,
+                                   gpointer      marshal_data);
+
 G_END_DECLS
 
 #endif /* __vips_MARSHAL_H__ */
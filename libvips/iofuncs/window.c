@@ -4,6 +4,10 @@
  *	- from region.c
  * 19/3/09
  *	- block mmaps of nodata images
+ * 14/10/18
+ * 	- add vips__window_prefetch()
+ * 	- tunable window size, populate and huge page modes, hugetlbfs
+ * 	  alignment, per-image map and remap counts
  */
 
 /*
@@ -53,6 +57,10 @@
 #ifdef HAVE_SYS_MMAN_H
 #include <sys/mman.h>
 #endif
+#include <fcntl.h>
+#ifdef HAVE_SYS_VFS_H
+#include <sys/vfs.h>
+#endif /*HAVE_SYS_VFS_H*/
 
 #include <vips/vips.h>
 #include <vips/internal.h>
@@ -76,6 +84,21 @@ int vips__window_margin_pixels = VIPS__WINDOW_MARGIN_PIXELS;
  */
 int vips__window_margin_bytes = VIPS__WINDOW_MARGIN_BYTES;
 
+/* Set by --vips-window-size. If set, size windows to about this many bytes
+ * instead.
+ */
+char *vips__window_size = NULL;
+
+/* Set by --vips-window-populate and --vips-window-hugepage. Large windows are
+ * populated when we map them, or get transparent huge pages.
+ */
+gboolean vips__window_populate = FALSE;
+gboolean vips__window_hugepage = FALSE;
+
+/* The magic number for hugetlbfs in statfs.f_type.
+ */
+#define VIPS__HUGETLBFS_MAGIC (0x958458f6)
+
 /* Track global mmap usage.
  */
 #ifdef DEBUG_TOTAL
@@ -207,12 +230,64 @@ vips_getpagesize( void )
 	return( pagesize );
 }
 
+/* Windows on this image must start on a multiple of this. Normally this is 
+ * the system page size, but files on hugetlbfs must be mapped in units of 
+ * the huge page size. Call with sslock held.
+ */
+int
+vips_window_pagesize( VipsImage *im )
+{
+	VipsImagePrivate *private = vips__image_private( im );
+
+	if( !private->window_pagesize ) {
+		private->window_pagesize = vips_getpagesize();
+
+#ifdef HAVE_SYS_VFS_H
+{
+		struct statfs buf;
+
+		if( !fstatfs( im->fd, &buf ) &&
+			buf.f_type == VIPS__HUGETLBFS_MAGIC &&
+			buf.f_bsize > private->window_pagesize ) 
+			private->window_pagesize = buf.f_bsize;
+}
+#endif /*HAVE_SYS_VFS_H*/
+
+#ifdef DEBUG
+		printf( "vips_window_pagesize: %s, 0x%x\n", 
+			im->filename, private->window_pagesize );
+#endif /*DEBUG*/
+	}
+
+	return( private->window_pagesize );
+}
+
+/* The set of VIPS__MMAP_* flags we should use for a window.
+ */
+static int
+vips_window_flags( size_t length )
+{
+	int flags;
+
+	flags = 0;
+	if( length >= VIPS__WINDOW_LARGE ) {
+		if( vips__window_populate ||
+			g_getenv( "VIPS_WINDOW_POPULATE" ) )
+			flags |= VIPS__MMAP_POPULATE;
+		if( vips__window_hugepage ||
+			g_getenv( "VIPS_WINDOW_HUGEPAGE" ) )
+			flags |= VIPS__MMAP_HUGEPAGE;
+	}
+
+	return( flags );
+}
+
 /* Map a window into a file.
  */
 static int
 vips_window_set( VipsWindow *window, int top, int height )
 {
-	int pagesize = vips_getpagesize();
+	int pagesize = vips_window_pagesize( window->im );
 
 	void *baseaddr;
 	gint64 start, end, pagestart;
@@ -228,6 +303,11 @@ vips_window_set( VipsWindow *window, int top, int height )
 	end = start + length;
 	pagelength = end - pagestart;
 
+	/* Huge page mappings must be a whole number of pages too.
+	 */
+	if( pagesize > vips_getpagesize() )
+		pagelength = VIPS_ROUND_UP( pagelength, pagesize );
+
 	/* Make sure we have enough file.
 	 */
 	if( end > window->im->file_length ) {
@@ -240,8 +320,8 @@ vips_window_set( VipsWindow *window, int top, int height )
 	if( vips_window_unmap( window ) )
 		return( -1 );
 
-	if( !(baseaddr = vips__mmap( window->im->fd, 
-		0, pagelength, pagestart )) )
+	if( !(baseaddr = vips__mmap_full( window->im->fd, 
+		0, pagelength, pagestart, vips_window_flags( pagelength ) )) )
 		return( -1 ); 
 
 	window->baseaddr = baseaddr;
@@ -350,6 +430,32 @@ vips_window_ref( VipsImage *im, int top, int height )
 	return( NULL );
 }
 
+/* The number of lines to add above and below a new window of height lines.
+ */
+static int
+vips_window_margin( VipsImage *im, int height )
+{
+	size_t sizeof_line = VIPS_IMAGE_SIZEOF_LINE( im );
+
+	const char *env;
+	guint64 target;
+
+	target = 0;
+	if( (env = g_getenv( "VIPS_WINDOW_SIZE" )) )
+		target = vips__parse_size( env );
+	if( vips__window_size )
+		target = vips__parse_size( vips__window_size );
+
+	if( target > 0 ) {
+		gint64 lines = target / sizeof_line;
+
+		return( VIPS_CLIP( 0, (lines - height) / 2, im->Ysize ) );
+	}
+
+	return( VIPS_MIN( vips__window_margin_pixels,
+		vips__window_margin_bytes / sizeof_line ) );
+}
+
 /* Update a window to make it enclose top/height. 
  */
 VipsWindow *
@@ -377,6 +483,8 @@ vips_window_take( VipsWindow *window, VipsImage *im, int top, int height )
 			return( NULL );
 		}
 
+		vips__image_private( im )->window_remaps += 1;
+
 		g_mutex_unlock( im->sslock );
 
 		return( window );
@@ -399,8 +507,7 @@ vips_window_take( VipsWindow *window, VipsImage *im, int top, int height )
 	/* We have to make a new window. Make it a bit bigger than strictly 
 	 * necessary.
 	 */
-	margin = VIPS_MIN( vips__window_margin_pixels,
-		vips__window_margin_bytes / VIPS_IMAGE_SIZEOF_LINE( im ) );
+	margin = vips_window_margin( im, height );
 	top -= margin;
 	height += margin * 2;
 	top = VIPS_CLIP( 0, top, im->Ysize - 1 );
@@ -411,11 +518,87 @@ vips_window_take( VipsWindow *window, VipsImage *im, int top, int height )
 		return( NULL );
 	}
 
+	vips__image_private( im )->window_maps += 1;
+
 	g_mutex_unlock( im->sslock );
 
 	return( window );
 }
 
+/* Hint that we'll need these lines soon. This must not block.
+ */
+void
+vips__window_prefetch( VipsImage *im, int top, int height )
+{
+	gint64 start, length;
+
+	start = im->sizeof_header + 
+		(gint64) VIPS_IMAGE_SIZEOF_LINE( im ) * top;
+	length = (gint64) VIPS_IMAGE_SIZEOF_LINE( im ) * height;
+
+	/* Don't hint beyond the end of the file, it might have been 
+	 * truncated.
+	 */
+	if( im->file_length > 0 )
+		length = VIPS_MIN( length, im->file_length - start );
+	if( length <= 0 )
+		return;
+
+#ifdef DEBUG
+	printf( "vips__window_prefetch: %s, top = %d, height = %d\n", 
+		im->filename, top, height );
+#endif /*DEBUG*/
+
+	if( im->dtype == VIPS_IMAGE_OPENIN ) {
+		/* We read through a set of small windows, so ask the 
+		 * kernel to start reading the file.
+		 */
+#ifdef HAVE_POSIX_FADVISE
+		if( im->fd != -1 )
+			(void) posix_fadvise( im->fd, 
+				start, length, POSIX_FADV_WILLNEED );
+#endif /*HAVE_POSIX_FADVISE*/
+	}
+	else if( im->baseaddr ) {
+		/* The whole file is mapped, hint the pages.
+		 */
+#ifdef HAVE_MADVISE
+		int pagesize = vips_getpagesize();
+		gint64 pagestart = start - start % pagesize;
+
+		(void) madvise( (char *) im->baseaddr + pagestart, 
+			start + length - pagestart, MADV_WILLNEED );
+#endif /*HAVE_MADVISE*/
+	}
+}
+
+/**
+ * vips_image_get_window_stats: (method)
+ * @image: image to get stats for
+ * @maps: (out) (allow-none): return the number of windows made here
+ * @remaps: (out) (allow-none): return the number of window scrolls here
+ *
+ * Large images opened from disc are read through a set of mmap() windows. 
+ * This gets the number of windows made on @image since it was opened, and
+ * the number of times an existing window was scrolled to a new position. 
+ * Each map or remap is a system call plus page faults, so high numbers can 
+ * mean the window size is too small for the access pattern. 
+ *
+ * See `--vips-window-size`, `--vips-window-populate` and 
+ * `--vips-window-hugepage`, or the `VIPS_WINDOW_SIZE`, 
+ * `VIPS_WINDOW_POPULATE` and `VIPS_WINDOW_HUGEPAGE` environment variables.
+ */
+void
+vips_image_get_window_stats( VipsImage *image, int *maps, int *remaps )
+{
+	VipsImagePrivate *private = vips__image_private( image );
+
+	if( maps )
+		*maps = private->window_maps;
+	if( remaps )
+		*remaps = private->window_remaps;
+}
+
 void
 vips_window_print( VipsWindow *window )
 {
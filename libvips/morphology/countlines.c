@@ -12,6 +12,8 @@
  * 	- gtk-doc
  * 17/1/14
  * 	- redone as a class, now just a convenience function
+ * 14/10/18
+ * 	- only find the projection we need
  */
 
 /*
@@ -95,7 +97,9 @@ vips_countlines_build( VipsObject *object )
 			vips_conv( t[1], &t[2], t[0], 
 				"precision", VIPS_PRECISION_INTEGER,
 				NULL ) ||
-			vips_project( t[2], &t[3], &t[4], NULL ) ||
+			vips_project( t[2], &t[3], &t[4],
+				"skip_rows", TRUE,
+				NULL ) ||
 			vips_avg( t[3], &nolines, NULL ) )
 			return( -1 ); 
 		break;
@@ -106,7 +110,9 @@ vips_countlines_build( VipsObject *object )
 			vips_conv( t[1], &t[2], t[0], 
 				"precision", VIPS_PRECISION_INTEGER,
 				NULL ) ||
-			vips_project( t[2], &t[3], &t[4], NULL ) ||
+			vips_project( t[2], &t[3], &t[4],
+				"skip_columns", TRUE,
+				NULL ) ||
 			vips_avg( t[4], &nolines, NULL ) )
 			return( -1 ); 
 		break;
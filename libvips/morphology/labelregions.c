@@ -4,6 +4,10 @@
  *	- renamed from im_segment()
  * 11/2/14
  * 	- redo as a class
+ * 14/10/18
+ * 	- label tiles in parallel with union-find, then merge and relabel,
+ * 	  don't flood fill from every pixel
+ * 	- add @stats
  */
 
 /*
@@ -39,6 +43,9 @@
 #include <vips/intl.h>
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
 
 #include <vips/vips.h>
 #include <vips/internal.h>
@@ -50,60 +57,327 @@ typedef struct _VipsLabelregions {
 
 	VipsImage *mask;
 	int segments; 
+	VipsImage *stats;
+
+	/* Size of the tiles we label in parallel.
+	 */
+	int tile_width;
+	int tile_height;
+	int tiles_across;
+	int tiles_down;
+
+	/* The first and last column and line of every tile, so we can
+	 * compare pixels across tile edges after the parallel pass.
+	 */
+	VipsPel *left_cols;
+	VipsPel *right_cols;
+	VipsPel *top_lines;
+	VipsPel *bottom_lines;
 } VipsLabelregions;
 
 typedef VipsMorphologyClass VipsLabelregionsClass;
 
 G_DEFINE_TYPE( VipsLabelregions, vips_labelregions, VIPS_TYPE_MORPHOLOGY );
 
+/* Label tiles of this size in parallel.
+ */
+#define VIPS_LABELREGIONS_TILE (256)
+
+static void
+vips_labelregions_dispose( GObject *gobject )
+{
+	VipsLabelregions *labelregions = (VipsLabelregions *) gobject;
+
+	VIPS_FREE( labelregions->left_cols );
+	VIPS_FREE( labelregions->right_cols );
+	VIPS_FREE( labelregions->top_lines );
+	VIPS_FREE( labelregions->bottom_lines );
+
+	G_OBJECT_CLASS( vips_labelregions_parent_class )->dispose( gobject );
+}
+
+/* The mask holds a union-find forest while we work: each element is the
+ * index of its parent pixel, and roots point to themselves. We always link
+ * to the smaller root, so a parent is never after its child in raster order.
+ */
+static inline int
+vips_labelregions_find( int *m, int i )
+{
+	while( m[i] != i ) {
+		m[i] = m[m[i]];
+		i = m[i];
+	}
+
+	return( i );
+}
+
+static inline void
+vips_labelregions_union( int *m, int i, int j )
+{
+	int ri = vips_labelregions_find( m, i );
+	int rj = vips_labelregions_find( m, j );
+
+	if( ri < rj )
+		m[rj] = ri;
+	else if( rj < ri )
+		m[ri] = rj;
+}
+
+/* Label a tile. All the links we make stay inside the tile, so tiles can be
+ * done in parallel.
+ */
+static int
+vips_labelregions_scan( VipsRegion *region,
+	void *seq, void *a, void *b, gboolean *stop )
+{
+	VipsLabelregions *labelregions = (VipsLabelregions *) a;
+	VipsImage *mask = labelregions->mask;
+	VipsRect *r = &region->valid;
+	int *m = (int *) mask->data;
+	const int width = mask->Xsize;
+	const int height = mask->Ysize;
+	const size_t ps = VIPS_IMAGE_SIZEOF_PEL( region->im );
+	const size_t lsk = VIPS_REGION_LSKIP( region );
+	const int tx = r->left / labelregions->tile_width;
+	const int ty = r->top / labelregions->tile_height;
+
+	int x, y;
+
+	for( y = 0; y < r->height; y++ ) {
+		VipsPel *p = VIPS_REGION_ADDR( region, r->left, r->top + y );
+		int i = (r->top + y) * width + r->left;
+
+		for( x = 0; x < r->width; x++ ) {
+			m[i] = i;
+
+			if( x > 0 &&
+				memcmp( p, p - ps, ps ) == 0 )
+				m[i] = vips_labelregions_find( m, i - 1 );
+			if( y > 0 &&
+				memcmp( p, p - lsk, ps ) == 0 )
+				vips_labelregions_union( m, i, i - width );
+
+			p += ps;
+			i += 1;
+		}
+
+		memcpy( labelregions->left_cols +
+				((size_t) tx * height + r->top + y) * ps,
+			VIPS_REGION_ADDR( region, r->left, r->top + y ), ps );
+		memcpy( labelregions->right_cols +
+				((size_t) tx * height + r->top + y) * ps,
+			VIPS_REGION_ADDR( region,
+				VIPS_RECT_RIGHT( r ) - 1, r->top + y ), ps );
+	}
+
+	memcpy( labelregions->top_lines +
+			((size_t) ty * width + r->left) * ps,
+		VIPS_REGION_ADDR( region, r->left, r->top ),
+		r->width * ps );
+	memcpy( labelregions->bottom_lines +
+			((size_t) ty * width + r->left) * ps,
+		VIPS_REGION_ADDR( region, r->left, VIPS_RECT_BOTTOM( r ) - 1 ),
+		r->width * ps );
+
+	return( 0 );
+}
+
+/* Join regions across tile edges.
+ */
+static void
+vips_labelregions_merge( VipsLabelregions *labelregions, size_t ps )
+{
+	VipsImage *mask = labelregions->mask;
+	int *m = (int *) mask->data;
+	const int width = mask->Xsize;
+	const int height = mask->Ysize;
+
+	int tx, ty, x, y;
+
+	for( tx = 1; tx < labelregions->tiles_across; tx++ ) {
+		VipsPel *left = labelregions->right_cols +
+			(size_t) (tx - 1) * height * ps;
+		VipsPel *right = labelregions->left_cols +
+			(size_t) tx * height * ps;
+		int i = tx * labelregions->tile_width;
+
+		for( y = 0; y < height; y++ ) {
+			if( memcmp( left, right, ps ) == 0 )
+				vips_labelregions_union( m, i - 1, i );
+
+			left += ps;
+			right += ps;
+			i += width;
+		}
+	}
+
+	for( ty = 1; ty < labelregions->tiles_down; ty++ ) {
+		VipsPel *top = labelregions->bottom_lines +
+			(size_t) (ty - 1) * width * ps;
+		VipsPel *bottom = labelregions->top_lines +
+			(size_t) ty * width * ps;
+		int i = ty * labelregions->tile_height * width;
+
+		for( x = 0; x < width; x++ ) {
+			if( memcmp( top, bottom, ps ) == 0 )
+				vips_labelregions_union( m, i - width, i );
+
+			top += ps;
+			bottom += ps;
+			i += 1;
+		}
+	}
+}
+
+/* Per-label stats: area, then the bounding box.
+ */
+typedef struct _VipsLabelregionsStats {
+	int area;
+	int left;
+	int top;
+	int right;
+	int bottom;
+} VipsLabelregionsStats;
+
+/* Replace the forest with labels numbered from 1 in raster order. Parents
+ * are always before children, so their label is ready when we need it.
+ */
+static void
+vips_labelregions_relabel( VipsLabelregions *labelregions )
+{
+	VipsImage *mask = labelregions->mask;
+	int *m = (int *) mask->data;
+	const int width = mask->Xsize;
+	const int height = mask->Ysize;
+
+	VipsLabelregionsStats *stats;
+	int n_stats;
+	int segments;
+	int x, y, i;
+
+	n_stats = 256;
+	stats = g_new( VipsLabelregionsStats, n_stats );
+
+	segments = 1;
+	i = 0;
+	for( y = 0; y < height; y++ )
+		for( x = 0; x < width; x++ ) {
+			int label;
+
+			if( m[i] == i ) {
+				if( segments >= n_stats ) {
+					n_stats *= 2;
+					stats = g_renew( VipsLabelregionsStats,
+						stats, n_stats );
+				}
+
+				label = segments++;
+				stats[label].area = 0;
+				stats[label].left = x;
+				stats[label].top = y;
+				stats[label].right = x;
+				stats[label].bottom = y;
+			}
+			else
+				label = m[m[i]];
+
+			m[i] = label;
+
+			stats[label].area += 1;
+			stats[label].left = VIPS_MIN( stats[label].left, x );
+			stats[label].right = VIPS_MAX( stats[label].right, x );
+			stats[label].bottom = y;
+
+			i += 1;
+		}
+
+	g_object_set( labelregions,
+		"segments", segments,
+		"stats", vips_image_new_matrix( 5, segments ),
+		NULL );
+
+	for( i = 0; i < 5; i++ )
+		*VIPS_MATRIX( labelregions->stats, i, 0 ) = 0.0;
+	for( i = 1; i < segments; i++ ) {
+		VipsImage *out = labelregions->stats;
+
+		*VIPS_MATRIX( out, 0, i ) = stats[i].area;
+		*VIPS_MATRIX( out, 1, i ) = stats[i].left;
+		*VIPS_MATRIX( out, 2, i ) = stats[i].top;
+		*VIPS_MATRIX( out, 3, i ) =
+			stats[i].right - stats[i].left + 1;
+		*VIPS_MATRIX( out, 4, i ) =
+			stats[i].bottom - stats[i].top + 1;
+	}
+
+	g_free( stats );
+}
+
 static int
 vips_labelregions_build( VipsObject *object )
 {
+	VipsObjectClass *class = VIPS_OBJECT_GET_CLASS( object );
 	VipsMorphology *morphology = VIPS_MORPHOLOGY( object );
+	VipsLabelregions *labelregions = (VipsLabelregions *) object;
 	VipsImage *in = morphology->in;
-	VipsImage **t = (VipsImage **) vips_object_local_array( object, 2 );
-	VipsImage *mask;
+	size_t ps = VIPS_IMAGE_SIZEOF_PEL( in );
 
-	int segments;
-	int *m;
-	int x, y;
+	VipsImage *mask;
 
 	if( VIPS_OBJECT_CLASS( vips_labelregions_parent_class )->
 		build( object ) )
 		return( -1 );
 
-	/* Create the zero mask image in memory.
+	/* We use pixel indexes as labels while we work.
+	 */
+	if( (guint64) in->Xsize * in->Ysize > INT_MAX ) {
+		vips_error( class->nickname, "%s", _( "image too large" ) );
+		return( -1 );
+	}
+
+	/* Create the mask image in memory.
 	 */
 	mask = vips_image_new_memory();
 	g_object_set( object,
 		"mask", mask,
 		NULL ); 
-	if( vips_black( &t[0], in->Xsize, in->Ysize, NULL ) ||
-		vips_cast( t[0], &t[1], VIPS_FORMAT_INT, NULL ) || 
-		vips_image_write( t[1], mask ) )
+	vips_image_init_fields( mask, in->Xsize, in->Ysize, 1,
+		VIPS_FORMAT_INT, VIPS_CODING_NONE,
+		VIPS_INTERPRETATION_MULTIBAND, 1.0, 1.0 );
+	if( vips_image_write_prepare( mask ) )
 		return( -1 );
 
-	segments = 1;
-	m = (int *) mask->data;
-	for( y = 0; y < mask->Ysize; y++ ) {
-		for( x = 0; x < mask->Xsize; x++ ) {
-			if( !m[x] ) {
-				/* Use a direct path for speed.
-				 */
-				if( vips__draw_flood_direct( mask, in, 
-					segments, x, y ) )
-					return( -1 ); 
-
-				segments += 1;
-			}
-		}
+	labelregions->tile_width = VIPS_LABELREGIONS_TILE;
+	labelregions->tile_height = VIPS_LABELREGIONS_TILE;
+	labelregions->tiles_across =
+		VIPS_ROUND_UP( in->Xsize, labelregions->tile_width ) /
+			labelregions->tile_width;
+	labelregions->tiles_down =
+		VIPS_ROUND_UP( in->Ysize, labelregions->tile_height ) /
+			labelregions->tile_height;
+	if( !(labelregions->left_cols = VIPS_ARRAY( NULL,
+			(size_t) labelregions->tiles_across * in->Ysize * ps,
+			VipsPel )) ||
+		!(labelregions->right_cols = VIPS_ARRAY( NULL,
+			(size_t) labelregions->tiles_across * in->Ysize * ps,
+			VipsPel )) ||
+		!(labelregions->top_lines = VIPS_ARRAY( NULL,
+			(size_t) labelregions->tiles_down * in->Xsize * ps,
+			VipsPel )) ||
+		!(labelregions->bottom_lines = VIPS_ARRAY( NULL,
+			(size_t) labelregions->tiles_down * in->Xsize * ps,
+			VipsPel )) )
+		return( -1 );
 
-		m += mask->Xsize;
-	}
+	if( vips_sink_tile( in,
+		labelregions->tile_width, labelregions->tile_height,
+		NULL, vips_labelregions_scan, NULL,
+		labelregions, NULL ) )
+		return( -1 );
 
-	g_object_set( object,
-		"segments", segments,
-		NULL ); 
+	vips_labelregions_merge( labelregions, ps );
+
+	vips_labelregions_relabel( labelregions );
 
 	return( 0 );
 }
@@ -114,6 +388,7 @@ vips_labelregions_class_init( VipsLabelregionsClass *class )
 	GObjectClass *gobject_class = G_OBJECT_CLASS( class );
 	VipsObjectClass *vobject_class = VIPS_OBJECT_CLASS( class );
 
+	gobject_class->dispose = vips_labelregions_dispose;
 	gobject_class->set_property = vips_object_set_property;
 	gobject_class->get_property = vips_object_get_property;
 
@@ -134,6 +409,12 @@ vips_labelregions_class_init( VipsLabelregionsClass *class )
 		G_STRUCT_OFFSET( VipsLabelregions, segments ),
 		0, 1000000000, 0 );
 
+	VIPS_ARG_IMAGE( class, "stats", 4,
+		_( "Stats" ),
+		_( "Area and bounding box of each region" ),
+		VIPS_ARGUMENT_OPTIONAL_OUTPUT,
+		G_STRUCT_OFFSET( VipsLabelregions, stats ) );
+
 }
 
 static void
@@ -150,6 +431,7 @@ vips_labelregions_init( VipsLabelregions *labelregions )
  * Optional arguments:
  *
  * * @segments: return number of regions found here
+ * * @stats: return region statistics here
  *
  * Repeatedly scans @in for regions of 4-connected pixels
  * with the same pixel value. Every time a region is discovered, those
@@ -164,6 +446,14 @@ vips_labelregions_init( VipsLabelregions *labelregions )
  * morphological operators to detect and isolate a series of objects, then use
  * vips_labelregions() to number them all.
  *
+ * @stats is a matrix with a row for every label, so it has @segments rows.
+ * Row 0 is unused. The columns are the area, then the left, top, width and
+ * height of the bounding box of the region.
+ *
+ * Tiles of @in are labelled in parallel and the results are joined up, so
+ * @in does not need to be in memory and can be very large. @mask is
+ * always in memory.
+ *
  * Use vips_hist_find_indexed() to (for example) find blob coordinates.
  *
  * See also: vips_hist_find_indexed().
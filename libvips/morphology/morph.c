@@ -2,6 +2,8 @@
  *
  * 23/10/13	
  * 	- from vips_conv()
+ * 14/10/18
+ * 	- use van Herk/Gil-Werman running max and min for rectangular masks
  */
 
 /*
@@ -42,8 +44,11 @@
 #include <vips/intl.h>
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include <vips/vips.h>
+#include <vips/simd.h>
 #include <vips/internal.h>
 
 #include "pmorphology.h"
@@ -69,12 +74,332 @@ typedef struct {
 	 */
 	VipsImage *M;
 
+	/* If the set elements of the mask make a rectangle, and everything
+	 * else is don't-care, this is the rectangle, relative to the top-left
+	 * of the mask.
+	 */
+	VipsRect rect;
+
 } VipsMorph;
 
 typedef VipsMorphologyClass VipsMorphClass;
 
 G_DEFINE_TYPE( VipsMorph, vips_morph, VIPS_TYPE_MORPHOLOGY );
 
+/* Rectangles with fewer elements than this go to the Orc hitmiss code, which
+ * will be quicker.
+ */
+#define VIPS_MORPH_RECT_THRESHOLD (10)
+
+/* Search the mask for a rectangle of set elements surrounded by don't care.
+ */
+static gboolean
+vips_morph_find_rect( VipsMorph *morph )
+{
+	VipsImage *M = morph->M;
+
+	int left, top, right, bottom;
+	int x, y;
+
+	left = M->Xsize;
+	top = M->Ysize;
+	right = -1;
+	bottom = -1;
+	for( y = 0; y < M->Ysize; y++ )
+		for( x = 0; x < M->Xsize; x++ ) {
+			double v = *VIPS_MATRIX( M, x, y );
+
+			if( v == 255 ) {
+				left = VIPS_MIN( left, x );
+				top = VIPS_MIN( top, y );
+				right = VIPS_MAX( right, x );
+				bottom = VIPS_MAX( bottom, y );
+			}
+			else if( v != 128 )
+				return( FALSE );
+		}
+	if( right < 0 )
+		return( FALSE );
+
+	for( y = top; y <= bottom; y++ )
+		for( x = left; x <= right; x++ )
+			if( *VIPS_MATRIX( M, x, y ) != 255 )
+				return( FALSE );
+
+	morph->rect.left = left;
+	morph->rect.top = top;
+	morph->rect.width = right - left + 1;
+	morph->rect.height = bottom - top + 1;
+
+	return( TRUE );
+}
+
+typedef struct {
+	VipsRegion *ir;
+
+	/* The horizontal pass goes to hbuf, one line for each input line.
+	 * The vertical pass needs a second area with the suffix max.
+	 */
+	VipsPel *hbuf;
+	VipsPel *sbuf;
+	size_t buf_size;
+
+	/* Prefix and suffix max for a line of the horizontal pass.
+	 */
+	VipsPel *prefix;
+	VipsPel *suffix;
+	size_t line_size;
+} VipsMorphRectSequence;
+
+static int
+vips_morph_rect_stop( void *vseq, void *a, void *b )
+{
+	VipsMorphRectSequence *seq = (VipsMorphRectSequence *) vseq;
+
+	VIPS_UNREF( seq->ir );
+	VIPS_FREE( seq->hbuf );
+	VIPS_FREE( seq->sbuf );
+	VIPS_FREE( seq->prefix );
+	VIPS_FREE( seq->suffix );
+	VIPS_FREE( seq );
+
+	return( 0 );
+}
+
+static void *
+vips_morph_rect_start( VipsImage *out, void *a, void *b )
+{
+	VipsImage *in = (VipsImage *) a;
+
+	VipsMorphRectSequence *seq;
+
+	if( !(seq = VIPS_NEW( NULL, VipsMorphRectSequence )) )
+		return( NULL );
+	seq->ir = NULL;
+	seq->hbuf = NULL;
+	seq->sbuf = NULL;
+	seq->buf_size = 0;
+	seq->prefix = NULL;
+	seq->suffix = NULL;
+	seq->line_size = 0;
+
+	if( !(seq->ir = vips_region_new( in )) ) {
+		vips_morph_rect_stop( seq, NULL, NULL );
+		return( NULL );
+	}
+
+	return( seq );
+}
+
+/* out[i] = max or min of a[i] and b[i].
+ */
+static void
+vips_morph_rect_line( VipsSimdMinmaxFn simd, gboolean dilate,
+	VipsPel *out, const VipsPel *a, const VipsPel *b, int n )
+{
+	int i;
+
+	if( simd )
+		simd( out, a, b, n );
+	else if( dilate )
+		for( i = 0; i < n; i++ )
+			out[i] = VIPS_MAX( a[i], b[i] );
+	else
+		for( i = 0; i < n; i++ )
+			out[i] = VIPS_MIN( a[i], b[i] );
+}
+
+/* The running max (or min) over a window of size elements, step apart, for
+ * n outputs. Split the input into blocks of size and find the prefix and
+ * suffix max within each block. Any window then covers the end of one block
+ * and the start of the next, so each output is just
+ * max( suffix[i], prefix[i + size - 1] ), about three comparisons per
+ * element whatever the window size.
+ */
+#define VAN_HERK( OP ) { \
+	const int ne = (n + size - 1) * step; \
+	const int block = size * step; \
+	\
+	int i, j; \
+	\
+	for( i = 0; i < ne; i += block ) { \
+		int end = VIPS_MIN( i + block, ne ); \
+		\
+		for( j = i; j < i + step; j++ ) \
+			prefix[j] = p[j]; \
+		for( ; j < end; j++ ) \
+			prefix[j] = OP( prefix[j - step], p[j] ); \
+		\
+		for( j = end - 1; j >= end - step; j-- ) \
+			suffix[j] = p[j]; \
+		for( ; j >= i; j-- ) \
+			suffix[j] = OP( suffix[j + step], p[j] ); \
+	} \
+	\
+	for( i = 0; i < n * step; i++ ) \
+		q[i] = OP( suffix[i], prefix[i + block - step] ); \
+}
+
+static void
+vips_morph_rect_horizontal( gboolean dilate, VipsPel * restrict q,
+	const VipsPel * restrict p, VipsPel * restrict prefix,
+	VipsPel * restrict suffix, int n, int size, int step )
+{
+	if( dilate )
+		VAN_HERK( VIPS_MAX )
+	else
+		VAN_HERK( VIPS_MIN )
+}
+
+static int
+vips_morph_rect_generate( VipsRegion *or,
+	void *vseq, void *a, void *b, gboolean *stop )
+{
+	VipsMorphRectSequence *seq = (VipsMorphRectSequence *) vseq;
+	VipsMorph *morph = (VipsMorph *) b;
+	VipsRegion *ir = seq->ir;
+	VipsRect *r = &or->valid;
+	const int bands = ir->im->Bands;
+	const int mw = morph->rect.width;
+	const int mh = morph->rect.height;
+	const gboolean dilate =
+		morph->morph == VIPS_OPERATION_MORPHOLOGY_DILATE;
+	const int ne = r->width * bands;
+	const int n_lines = r->height + mh - 1;
+
+	VipsSimdMinmaxFn simd;
+	VipsRect s;
+	size_t line_size;
+	size_t buf_size;
+	int x, y;
+
+	s.left = r->left;
+	s.top = r->top;
+	s.width = r->width + mw - 1;
+	s.height = n_lines;
+	if( vips_region_prepare( ir, &s ) )
+		return( -1 );
+
+	line_size = (size_t) s.width * bands;
+	if( line_size > seq->line_size ) {
+		VIPS_FREE( seq->prefix );
+		VIPS_FREE( seq->suffix );
+		if( !(seq->prefix = 
+				VIPS_ARRAY( NULL, line_size, VipsPel )) ||
+			!(seq->suffix = 
+				VIPS_ARRAY( NULL, line_size, VipsPel )) )
+			return( -1 );
+		seq->line_size = line_size;
+	}
+
+	buf_size = (size_t) ne * n_lines;
+	if( buf_size > seq->buf_size ) {
+		VIPS_FREE( seq->hbuf );
+		VIPS_FREE( seq->sbuf );
+		if( !(seq->hbuf = VIPS_ARRAY( NULL, buf_size, VipsPel )) ||
+			!(seq->sbuf = VIPS_ARRAY( NULL, buf_size, VipsPel )) )
+			return( -1 );
+		seq->buf_size = buf_size;
+	}
+
+	simd = (VipsSimdMinmaxFn) vips_simd_get(
+		dilate ? VIPS_SIMD_MAX : VIPS_SIMD_MIN, VIPS_FORMAT_UCHAR );
+
+	/* Horizontal pass, one line of hbuf for each input line.
+	 */
+	for( y = 0; y < n_lines; y++ )
+		vips_morph_rect_horizontal( dilate,
+			seq->hbuf + (size_t) y * ne,
+			VIPS_REGION_ADDR( ir, s.left, s.top + y ),
+			seq->prefix, seq->suffix, r->width, mw, bands );
+
+	/* Vertical pass. This works on whole lines, so we can use the vector
+	 * unit. Find suffix max within each block of mh lines in sbuf, then
+	 * prefix max in place in hbuf.
+	 */
+	for( y = 0; y < n_lines; y += mh ) {
+		int end = VIPS_MIN( y + mh, n_lines );
+
+		int i;
+
+		memcpy( seq->sbuf + (size_t) (end - 1) * ne,
+			seq->hbuf + (size_t) (end - 1) * ne, ne );
+		for( i = end - 2; i >= y; i-- )
+			vips_morph_rect_line( simd, dilate,
+				seq->sbuf + (size_t) i * ne,
+				seq->sbuf + (size_t) (i + 1) * ne,
+				seq->hbuf + (size_t) i * ne, ne );
+
+		for( i = y + 1; i < end; i++ )
+			vips_morph_rect_line( simd, dilate,
+				seq->hbuf + (size_t) i * ne,
+				seq->hbuf + (size_t) (i - 1) * ne,
+				seq->hbuf + (size_t) i * ne, ne );
+	}
+
+	for( y = 0; y < r->height; y++ ) {
+		VipsPel * restrict q =
+			VIPS_REGION_ADDR( or, r->left, r->top + y );
+
+		vips_morph_rect_line( simd, dilate, q,
+			seq->sbuf + (size_t) y * ne,
+			seq->hbuf + (size_t) (y + mh - 1) * ne, ne );
+
+		/* Any non-zero is set.
+		 */
+		for( x = 0; x < ne; x++ )
+			q[x] = q[x] ? 255 : 0;
+	}
+
+	return( 0 );
+}
+
+/* A rectangular mask is separable, and each direction can be done with a
+ * running max or min.
+ */
+static int
+vips_morph_rect( VipsMorph *morph, VipsImage *in )
+{
+	VipsImage **t = (VipsImage **)
+		vips_object_local_array( VIPS_OBJECT( morph ), 2 );
+	VipsImage *M = morph->M;
+	VipsRect *rect = &morph->rect;
+
+	/* Like the hitmiss code, treat non-zero as set.
+	 */
+	if( in->BandFmt != VIPS_FORMAT_UCHAR ) {
+		if( vips_notequal_const1( in, &t[0], 0, NULL ) )
+			return( -1 );
+		in = t[0];
+	}
+
+	/* The origin is at the mask centre, so pixel (x, y) needs the input
+	 * from (x - M->Xsize / 2 + rect->left, ...) for rect->width pixels.
+	 */
+	if( vips_embed( in, &t[1],
+		M->Xsize / 2 - rect->left, M->Ysize / 2 - rect->top,
+		in->Xsize + rect->width - 1, in->Ysize + rect->height - 1,
+		"extend", VIPS_EXTEND_COPY,
+		NULL ) )
+		return( -1 );
+	in = t[1];
+
+	if( vips_image_pipelinev( morph->out,
+		VIPS_DEMAND_STYLE_SMALLTILE, in, NULL ) )
+		return( -1 );
+	morph->out->Xsize -= rect->width - 1;
+	morph->out->Ysize -= rect->height - 1;
+
+	if( vips_image_generate( morph->out,
+		vips_morph_rect_start,
+		vips_morph_rect_generate,
+		vips_morph_rect_stop,
+		in, morph ) )
+		return( -1 );
+
+	return( 0 );
+}
+
 static int
 vips_morph_build( VipsObject *object )
 {
@@ -101,6 +426,18 @@ vips_morph_build( VipsObject *object )
 		return( -1 ); 
 	morph->M = t[1];
 
+	if( vips_morph_find_rect( morph ) &&
+		morph->rect.width * morph->rect.height >=
+			VIPS_MORPH_RECT_THRESHOLD ) {
+		if( vips_morph_rect( morph, in ) )
+			return( -1 );
+
+		vips_reorder_margin_hint( morph->out,
+			morph->rect.width * morph->rect.height );
+
+		return( 0 );
+	}
+
 	if( !(imsk = im_vips2imask( morph->M, class->nickname )) || 
 		!im_local_imask( morph->out, imsk ) )
 		return( -1 ); 
@@ -203,6 +540,11 @@ vips_morph_init( VipsMorph *morph )
  * vips_eorimage() 
  * for analogues of the usual set difference and set union operations.
  *
+ * If the set elements of @mask make a rectangle, and the rest of @mask is
+ * don't care, vips_morph() uses a separable running max or min, which takes
+ * about the same time whatever the size of the rectangle. Lines and boxes
+ * of any size are therefore cheap.
+ *
  * Operations are performed using the processor's vector unit,
  * if possible. Disable this with --vips-novector or IM_NOVECTOR.
  *
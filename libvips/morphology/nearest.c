@@ -2,6 +2,9 @@
  *
  * 31/10/17
  * 	- from labelregion 
+ * 14/10/18
+ * 	- use the Felzenszwalb and Huttenlocher exact distance transform,
+ * 	  columns then rows in parallel, rather than growing circles
  */
 
 /*
@@ -41,25 +44,14 @@
 #include <vips/intl.h>
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
 
 #include <vips/vips.h>
 #include <vips/internal.h>
 
 #include "pmorphology.h"
 
-/* A seed pixel. We fill outwards from each of these.
- */
-typedef struct _Seed {
-	int x;
-	int y;
-	int r;
-
-	/* Bits saying which octant can still grow. When they are all zero, the
-	 * seed is dead.
-	 */
-	int octant_mask;
-} Seed;
-
 typedef struct _VipsFillNearest {
 	VipsMorphology parent_instance;
 
@@ -71,15 +63,28 @@ typedef struct _VipsFillNearest {
 	int width;
 	int height;
 
-	/* All our seed pixels. There can be a lot of these.
+	/* For each pixel, the line of the nearest seed in the same column, or
+	 * -1 for columns with no seeds.
+	 */
+	int *column;
+
+	/* Set if we found any seeds.
 	 */
-	GArray *seeds;
+	gboolean has_seeds;
 } VipsFillNearest;
 
 typedef VipsMorphologyClass VipsFillNearestClass;
 
 G_DEFINE_TYPE( VipsFillNearest, vips_fill_nearest, VIPS_TYPE_MORPHOLOGY );
 
+/* Lines at a time for the row pass.
+ */
+#define VIPS_FILL_NEAREST_LINES (16)
+
+/* Columns at a time for the column pass.
+ */
+#define VIPS_FILL_NEAREST_COLUMNS (64)
+
 static void
 vips_fill_nearest_finalize( GObject *gobject )
 {
@@ -91,124 +96,196 @@ vips_fill_nearest_finalize( GObject *gobject )
 	printf( "\n" );
 #endif /*DEBUG*/
 
-	VIPS_FREEF( g_array_unref, nearest->seeds ); 
+	VIPS_FREE( nearest->column );
 
 	G_OBJECT_CLASS( vips_fill_nearest_parent_class )->finalize( gobject );
 }
 
-struct _Circle;
-typedef void (*VipsFillNearestPixel)( struct _Circle *circle, 
-	int x, int y, int octant );
+static inline gboolean
+vips_fill_nearest_isseed( VipsPel *p, int ps )
+{
+	int i;
 
-typedef struct _Circle {
-	VipsFillNearest *nearest;
-	Seed *seed;
-	int octant_mask;
-	VipsFillNearestPixel nearest_pixel;
-} Circle;
+	for( i = 0; i < ps; i++ )
+		if( p[i] )
+			return( TRUE );
 
-static void 
-vips_fill_nearest_pixel( Circle *circle, int x, int y, int octant )
+	return( FALSE );
+}
+
+/* Find the nearest seed in each column of a strip. Strips are the full
+ * height of the image. We walk down and then up the strip, a line at a
+ * time, to keep memory access sequential.
+ */
+static int
+vips_fill_nearest_column( VipsRegion *region,
+	void *seq, void *a, void *b, gboolean *stop )
 {
-	float *p;
-	float radius;
-	int dx, dy;
+	VipsFillNearest *nearest = (VipsFillNearest *) a;
+	VipsRect *r = &region->valid;
+	const int ps = VIPS_IMAGE_SIZEOF_PEL( region->im );
+	const int width = nearest->width;
 
-	if( (circle->seed->octant_mask & (1 << octant)) == 0 )
-		return;
+	int x, y;
 
-	/* We need to do this as float, or we'll have dithering along edges.
-	 */
-	p = (float *) VIPS_IMAGE_ADDR( circle->nearest->distance, x, y );
-	dx = x - circle->seed->x;
-	dy = y - circle->seed->y;
-	radius = sqrt( dx * dx + dy * dy );
-
-	if( p[0] == 0 ||
-		p[0] > radius ) {
-		VipsMorphology *morphology = VIPS_MORPHOLOGY( circle->nearest );
-		VipsImage *in = morphology->in;
-		int ps = VIPS_IMAGE_SIZEOF_PEL( in );
-		VipsPel *pi = VIPS_IMAGE_ADDR( in,
-			circle->seed->x, circle->seed->y );
-		VipsPel *qi = VIPS_IMAGE_ADDR( circle->nearest->out, 
-			x, y ); 
-
-		int i;
-
-		p[0] = radius;
-		circle->octant_mask |= 1 << octant;
-
-		for( i = 0; i < ps; i++ )
-			qi[i] = pi[i];
+	for( y = 0; y < r->height; y++ ) {
+		VipsPel *p = VIPS_REGION_ADDR( region, r->left, r->top + y );
+		int *q = nearest->column + (size_t) y * width + r->left;
+
+		for( x = 0; x < r->width; x++ ) {
+			if( vips_fill_nearest_isseed( p, ps ) ) {
+				q[x] = y;
+				nearest->has_seeds = TRUE;
+			}
+			else if( y > 0 )
+				q[x] = q[x - width];
+			else
+				q[x] = -1;
+
+			p += ps;
+		}
 	}
-}
 
-static void 
-vips_fill_nearest_pixel_clip( Circle *circle, int x, int y, int octant )
-{
-	if( (circle->seed->octant_mask & (1 << octant)) == 0 )
-		return;
-
-	if( x >= 0 &&
-		x < circle->nearest->width &&
-		y >= 0 &&
-		y < circle->nearest->height )
-		vips_fill_nearest_pixel( circle, x, y, octant );
+	for( y = r->height - 2; y >= 0; y-- ) {
+		int *q = nearest->column + (size_t) y * width + r->left;
+
+		for( x = 0; x < r->width; x++ ) {
+			int below = q[x + width];
+
+			if( below >= 0 &&
+				(q[x] < 0 ||
+				 below - y < y - q[x]) )
+				q[x] = below;
+		}
+	}
+
+	return( 0 );
 }
 
-static void
-vips_fill_nearest_scanline( VipsImage *image, 
-	int y, int x1, int x2, int quadrant, void *client )
+/* Buffers for the lower envelope of the parabolas along a line.
+ */
+typedef struct _VipsFillNearestSequence {
+	int *v;
+	double *z;
+	double *f;
+} VipsFillNearestSequence;
+
+static int
+vips_fill_nearest_stop( void *vseq, void *a, void *b )
 {
-	Circle *circle = (Circle *) client;
+	VipsFillNearestSequence *seq = (VipsFillNearestSequence *) vseq;
 
-	circle->nearest_pixel( circle, x1, y, quadrant );
-	circle->nearest_pixel( circle, x2, y, quadrant + 4 );
+	VIPS_FREE( seq->v );
+	VIPS_FREE( seq->z );
+	VIPS_FREE( seq->f );
+	VIPS_FREE( seq );
 
-	/* We have to do one point back as well, or we'll leave gaps at 
-	 * around 45 degrees.
-	 */
-	if( quadrant == 0 ) {
-		circle->nearest_pixel( circle, x1, y - 1, quadrant );
-		circle->nearest_pixel( circle, x2, y - 1, quadrant + 4 );
-	}
-	else if( quadrant == 1 ) {
-		circle->nearest_pixel( circle, x1, y + 1, quadrant );
-		circle->nearest_pixel( circle, x2, y + 1, quadrant + 4 );
-	}
-	else {
-		circle->nearest_pixel( circle, x1 + 1, y, quadrant );
-		circle->nearest_pixel( circle, x2 - 1, y, quadrant + 4 );
+	return( 0 );
+}
+
+static void *
+vips_fill_nearest_start( VipsImage *out, void *a, void *b )
+{
+	VipsFillNearest *nearest = (VipsFillNearest *) a;
+
+	VipsFillNearestSequence *seq;
+
+	if( !(seq = VIPS_NEW( NULL, VipsFillNearestSequence )) )
+		return( NULL );
+	seq->v = VIPS_ARRAY( NULL, nearest->width, int );
+	seq->z = VIPS_ARRAY( NULL, nearest->width + 1, double );
+	seq->f = VIPS_ARRAY( NULL, nearest->width, double );
+	if( !seq->v ||
+		!seq->z ||
+		!seq->f ) {
+		vips_fill_nearest_stop( seq, NULL, NULL );
+		return( NULL );
 	}
+
+	return( seq );
 }
 
-static void
-vips_fill_nearest_grow_seed( VipsFillNearest *nearest, Seed *seed )
+/* Each line is independent. The squared distance from (x, y) via column
+ * x' is a parabola in x, (x - x')^2 + f(x'), where f is the squared
+ * distance to the nearest seed in column x'. Find the lower envelope of the
+ * parabolas, then read it out.
+ */
+static int
+vips_fill_nearest_row( VipsRegion *region,
+	void *vseq, void *a, void *b, gboolean *stop )
 {
-	Circle circle;
+	VipsFillNearestSequence *seq = (VipsFillNearestSequence *) vseq;
+	VipsFillNearest *nearest = (VipsFillNearest *) a;
+	VipsImage *in = region->im;
+	VipsRect *r = &region->valid;
+	const int ps = VIPS_IMAGE_SIZEOF_PEL( in );
+	const int width = nearest->width;
+	int *v = seq->v;
+	double *z = seq->z;
+	double *f = seq->f;
 
-	circle.nearest = nearest;
-	circle.seed = seed;
-	circle.octant_mask = 0;
+	int x, y, i;
 
-	if( seed->x - seed->r >= 0 &&
-		seed->x + seed->r < nearest->width &&
-		seed->y - seed->r >= 0 &&
-		seed->y + seed->r < nearest->height )
-		circle.nearest_pixel = vips_fill_nearest_pixel;
-	else
-		circle.nearest_pixel = vips_fill_nearest_pixel_clip;
+	for( y = r->top; y < VIPS_RECT_BOTTOM( r ); y++ ) {
+		int *column = nearest->column + (size_t) y * width;
+		float *distance = (float *)
+			VIPS_IMAGE_ADDR( nearest->distance, 0, y );
+		VipsPel *q = VIPS_IMAGE_ADDR( nearest->out, 0, y );
 
-	vips__draw_circle_direct( nearest->distance, 
-		seed->x, seed->y, seed->r, vips_fill_nearest_scanline, &circle );
+		int k;
 
-	/* Update the action_mask for this seed. Next time, we can skip any 
-	 * octants where we failed to act this time. 
-	 */
-	seed->octant_mask = circle.octant_mask; 
+		k = -1;
+		for( x = 0; x < width; x++ ) {
+			double s;
+
+			if( column[x] < 0 )
+				continue;
+
+			f[x] = (double) (column[x] - y) * (column[x] - y);
+
+			s = 0.0;
+			while( k >= 0 ) {
+				s = ((f[x] + (double) x * x) -
+					(f[v[k]] + (double) v[k] * v[k])) /
+					(2.0 * (x - v[k]));
+				if( s > z[k] )
+					break;
+				k -= 1;
+			}
+
+			k += 1;
+			v[k] = x;
+			z[k] = k == 0 ? -HUGE_VAL : s;
+			z[k + 1] = HUGE_VAL;
+		}
+
+		/* No seeds in any column.
+		 */
+		if( k < 0 )
+			continue;
+
+		k = 0;
+		for( x = 0; x < width; x++ ) {
+			int sx, sy;
+			VipsPel *p;
 
-	seed->r += 1;
+			while( z[k + 1] < x )
+				k += 1;
+
+			sx = v[k];
+			sy = column[sx];
+			distance[x] = 
+				sqrt( (double) (x - sx) * (x - sx) + f[sx] );
+
+			p = VIPS_IMAGE_ADDR( in, sx, sy );
+			for( i = 0; i < ps; i++ )
+				q[i] = p[i];
+
+			q += ps;
+		}
+	}
+
+	return( 0 );
 }
 
 static int
@@ -218,9 +295,6 @@ vips_fill_nearest_build( VipsObject *object )
 	VipsFillNearest *nearest = (VipsFillNearest *) object;
 	VipsImage **t = (VipsImage **) vips_object_local_array( object, 2 );
 
-	int ps;
-	int x, y, i;
-
 	if( VIPS_OBJECT_CLASS( vips_fill_nearest_parent_class )->
 		build( object ) )
 		return( -1 );
@@ -230,69 +304,37 @@ vips_fill_nearest_build( VipsObject *object )
 	nearest->width = morphology->in->Xsize;
 	nearest->height = morphology->in->Ysize;
 
-	ps = VIPS_IMAGE_SIZEOF_PEL( morphology->in );
-	nearest->seeds = g_array_new( FALSE, FALSE, sizeof( Seed ) );
-	for( y = 0; y < nearest->height; y++ )  {
-		VipsPel *p;
-
-		p = VIPS_IMAGE_ADDR( morphology->in, 0, y ); 
-		for( x = 0; x < nearest->width; x++ ) {
-			for( i = 0; i < ps; i++ )
-				if( p[i] )
-					break;
-
-			if( i != ps ) { 
-				Seed *seed;
-
-				g_array_set_size( nearest->seeds, 
-					nearest->seeds->len + 1 );
-				seed = &g_array_index( nearest->seeds, 
-					Seed, nearest->seeds->len - 1 );
-				seed->x = x;
-				seed->y = y;
-				seed->r = 1;
-				seed->octant_mask = 255;
-			}
-
-			p += ps;
-		}
-	}
-
 	/* Create the output and distance images in memory.
 	 */
 	g_object_set( object, "distance", vips_image_new_memory(), NULL );
-	if( vips_black( &t[1], nearest->width, nearest->height, NULL ) ||
-		vips_cast( t[1], &t[2], VIPS_FORMAT_FLOAT, NULL ) || 
-		vips_image_write( t[2], nearest->distance ) )
+	if( vips_black( &t[0], nearest->width, nearest->height, NULL ) ||
+		vips_cast( t[0], &t[1], VIPS_FORMAT_FLOAT, NULL ) ||
+		vips_image_write( t[1], nearest->distance ) )
 		return( -1 );
 
 	g_object_set( object, "out", vips_image_new_memory(), NULL );
 	if( vips_image_write( morphology->in, nearest->out ) )
 		return( -1 );
 
-	while( nearest->seeds->len > 0 ) {
-#ifdef DEBUG
-		printf( "looping for %d seeds ...\n", nearest->seeds->len );
-#endif /*DEBUG*/
-
-		/* Grow all seeds by one pixel.
-		 */
-		for( i = 0; i < nearest->seeds->len; i++ ) 
-			vips_fill_nearest_grow_seed( nearest, 
-				&g_array_index( nearest->seeds, Seed, i ) );
+	/* Columns first, in parallel strips, then lines.
+	 */
+	if( !(nearest->column = VIPS_ARRAY( NULL,
+		(size_t) nearest->width * nearest->height, int )) )
+		return( -1 );
+	nearest->has_seeds = FALSE;
+	if( vips_sink_tile( morphology->in,
+		VIPS_FILL_NEAREST_COLUMNS, nearest->height,
+		NULL, vips_fill_nearest_column, NULL, nearest, NULL ) )
+		return( -1 );
 
-		/* Remove dead seeds.
-		 */
-		i = 0; 
-		while( i < nearest->seeds->len )  {
-			Seed *seed = &g_array_index( nearest->seeds, Seed, i );
+	if( nearest->has_seeds &&
+		vips_sink_tile( morphology->in,
+			nearest->width, VIPS_FILL_NEAREST_LINES,
+			vips_fill_nearest_start, vips_fill_nearest_row,
+			vips_fill_nearest_stop, nearest, NULL ) )
+		return( -1 );
 
-			if( seed->octant_mask == 0 )
-				g_array_remove_index_fast( nearest->seeds, i );
-			else
-				i += 1;
-		}
-	}
+	VIPS_FREE( nearest->column );
 
 	return( 0 );
 }
@@ -344,6 +386,10 @@ vips_fill_nearest_init( VipsFillNearest *nearest )
  * Fill outwards from every non-zero pixel in @in, setting pixels in @distance
  * and @value. 
  *
+ * This uses the exact Euclidean distance transform of Felzenszwalb and
+ * Huttenlocher, so the time taken depends only on the image size, not on the
+ * number or position of the non-zero pixels.
+ *
  * At the position of zero pixels in @in, @distance contains the distance to
  * the nearest non-zero pixel in @in, and @value contains the value of that
  * pixel.
@@ -58,6 +58,10 @@
  * 12/7/12
  * 	- always allocate local to an output descriptor ... stops ref cycles
  * 	  with the new base class
+ * 14/10/18
+ * 	- only read headers during parse, open images when we need pixels
+ * 	- find overlaps with a LeafIndex
+ * 	- large lr/tb mosaics are rebuilt with im__flat_mosaic()
  */
 
 /*
@@ -120,6 +124,11 @@
  */
 #define TRIVIAL (20 * 20)
 
+/* Mosaics with more leaves than this are rebuilt with im__flat_mosaic(), if
+ * they only use lr and tb joins.
+ */
+#define FLAT_LEAVES (100)
+
 /* Break a string into a list of strings. Write '\0's into the string. out
  * needs to be MAX_FILES long. -1 for error, otherwise number of args found.
 
@@ -162,19 +171,41 @@ break_items( char *line, char **out )
 }
 
 /* Try to open a file. If full path fails, try the current directory.
+ * Return a new reference.
  */
 IMAGE *
 im__global_open_image( SymbolTable *st, char *name )
 {
 	IMAGE *im;
 
-	if( (im = im_open_local( st->im, name, "r" )) || 
-		(im = im_open_local( st->im, im_skip_dir( name ), "r" )) ) 
+	if( (im = im_open( name, "r" )) ||
+		(im = im_open( im_skip_dir( name ), "r" )) )
 		return( im );
 
 	return( NULL );
 }
 
+/* Get the image for a leaf, opening it if we've not needed it before. The
+ * image is local to the symbol table.
+ */
+IMAGE *
+im__global_node_image( JoinNode *node )
+{
+	if( !node->im ) {
+		if( !node->filename ) {
+			im_error( "im_global_balance",
+				_( "unable to open \"%s\"" ), node->name );
+			return( NULL );
+		}
+
+		if( !(node->im = im_open_local( node->st->im,
+			node->filename, "r" )) )
+			return( NULL );
+	}
+
+	return( node->im );
+}
+
 static int
 junk_node( JoinNode *node )
 {
@@ -206,6 +237,8 @@ build_node( SymbolTable *st, char *name )
 	JoinNode *node = IM_NEW( st->im, JoinNode );
 	int n = hash( name );
 
+	IMAGE *im;
+
 	/* Fill fields.
 	 */
 	if( !node || !(node->name = im_strdup( st->im, name )) )
@@ -220,6 +253,7 @@ build_node( SymbolTable *st, char *name )
 	node->arg1 = NULL;
 	node->arg2 = NULL;
 	node->overlaps = NULL;
+	node->filename = NULL;
 	node->im = NULL;
 	node->index = 0;
 
@@ -227,13 +261,22 @@ build_node( SymbolTable *st, char *name )
 		(im_callback_fn) junk_node, node, NULL ) ) 
                 return( NULL );
 
-	/* Try to open.
+	/* Try to open. We only need the header for now, the file is opened
+	 * again by im__global_node_image() when we want pixels. This keeps
+	 * the number of open files down for large mosaics.
 	 */
-	if( (node->im = im__global_open_image( st, name )) ) {
+	if( (im = im__global_open_image( st, name )) ) {
 		/* There is a file there - set width and height.
 		 */
-		node->cumtrn.oarea.width = node->im->Xsize;
-		node->cumtrn.oarea.height = node->im->Ysize;
+		node->filename = im_strdup( st->im, im->filename );
+		node->cumtrn.iarea.width = im->Xsize;
+		node->cumtrn.iarea.height = im->Ysize;
+		node->cumtrn.oarea.width = im->Xsize;
+		node->cumtrn.oarea.height = im->Ysize;
+		g_object_unref( im );
+
+		if( !node->filename )
+			return( NULL );
 	}
 	else {
 		/* Clear the error buffer to lessen confusion.
@@ -307,6 +350,8 @@ im__build_symtab( IMAGE *out, int sz )
 	st->root = NULL;
 	st->leaf = NULL;
 	st->fac = NULL;
+	st->history = NULL;
+	st->index = NULL;
 
         if( im_add_close_callback( out, 
 		(im_callback_fn) junk_table, st, NULL ) ) 
@@ -418,15 +463,11 @@ calc_geometry( JoinNode *node )
 		break;
 
 	case JOIN_LEAF:
-		/* Just use leaf dimensions, if there are any.
+		/* Just use leaf dimensions, if there are any. iarea was set
+		 * from the header by build_node().
 		 */
-		if( node->im ) {
-			node->cumtrn.iarea.left = 0;
-			node->cumtrn.iarea.top = 0;
-			node->cumtrn.iarea.width = node->im->Xsize;
-			node->cumtrn.iarea.height = node->im->Ysize;
+		if( node->filename )
 			vips__transform_set_area( &node->cumtrn );
-		}
 		break;
 
 	default:
@@ -766,6 +807,10 @@ im__parse_desc( SymbolTable *st, IMAGE *in )
 	if( !(st->root = find_root( st )) )
 		return( -1 );
 
+	/* im__flat_mosaic() copies this to the output.
+	 */
+	st->history = in->history_list;
+
 	return( 0 );
 }
 
@@ -1187,15 +1232,12 @@ find_overlaps( JoinNode *node, SymbolTable *st )
 	if( node->type == JOIN_LEAF ) {
 		/* Check for image.
 		 */
-		if( !node->im ) {
-			im_error( "im_global_balance", 
-				_( "unable to open \"%s\"" ), node->name );
+		if( !im__global_node_image( node ) )
 			return( node );
-		}
 		if( !node->trnim ) 
 			error_exit( "global_balance: sanity failure #9834" );
 
-		return( im__map_table( st, 
+		return( im__leaf_index_map( st->index, &node->cumtrn.oarea,
 			(VipsSListMap2Fn) test_overlap, node, NULL ) );
 	}
 	
@@ -1296,7 +1338,7 @@ choose_leaf( JoinNode *node )
 static IMAGE *
 make_mos_image( SymbolTable *st, JoinNode *node, transform_fn tfn, void *a )
 {
-	IMAGE *im1, *im2, *out;
+	IMAGE *im1, *im2, *in, *out;
 
 	switch( node->type ) {
 	case JOIN_LR:
@@ -1344,8 +1386,10 @@ make_mos_image( SymbolTable *st, JoinNode *node, transform_fn tfn, void *a )
 	case JOIN_LEAF:
 		/* Trivial case!
 		 */
-		if( !(out = tfn( node, a )) )
+		if( !(in = im__global_node_image( node )) ||
+			!(out = tfn( node, in, a )) )
 			return( NULL );
+		vips_object_local( st->im, out );
 
 		break;
 
@@ -1365,6 +1409,31 @@ make_mos_image( SymbolTable *st, JoinNode *node, transform_fn tfn, void *a )
 	return( out );
 }
 
+/* Can we rebuild this mosaic with im__flat_mosaic()? We need a lot of
+ * leaves, since the flat builder blends a little differently, and only lr and
+ * tb joins.
+ */
+static void *
+count_flat( JoinNode *node, int *nleaves )
+{
+	switch( node->type ) {
+	case JOIN_LRROTSCALE:
+	case JOIN_TBROTSCALE:
+		return( node );
+
+	case JOIN_LEAF:
+		if( !node->filename )
+			return( node );
+		*nleaves += 1;
+		break;
+
+	default:
+		break;
+	}
+
+	return( NULL );
+}
+
 /* Re-build mosaic. 
  */
 int
@@ -1372,6 +1441,22 @@ im__build_mosaic( SymbolTable *st, IMAGE *out, transform_fn tfn, void *a )
 {
 	JoinNode *root = st->root;
 	IMAGE *im1, *im2;
+	int nleaves;
+
+	/* Large mosaics are quicker to build directly from the leaves than
+	 * with a tree of merges.
+	 */
+	nleaves = 0;
+	if( !im__map_table( st,
+		(VipsSListMap2Fn) count_flat, &nleaves, NULL ) &&
+		nleaves > FLAT_LEAVES ) {
+		gboolean done;
+
+		if( im__flat_mosaic( st, out, tfn, a, &done ) )
+			return( -1 );
+		if( done )
+			return( 0 );
+	}
 
 	switch( root->type ) {
 	case JOIN_LR:
@@ -1417,7 +1502,11 @@ im__build_mosaic( SymbolTable *st, IMAGE *out, transform_fn tfn, void *a )
 	case JOIN_LEAF:
 		/* Trivial case! Just one file in our mosaic.
 		 */
-		if( !(im1 = tfn( root, a )) || im_copy( im1, out ) )
+		if( !(im2 = im__global_node_image( root )) ||
+			!(im1 = tfn( root, im2, a )) )
+			return( -1 );
+		vips_object_local( st->im, im1 );
+		if( im_copy( im1, out ) )
 			return( -1 );
 
 		break;
@@ -1525,11 +1614,8 @@ generate_trn_leaves( JoinNode *node, SymbolTable *st )
 	if( node->type == JOIN_LEAF ) {
 		/* Check for image.
 		 */
-		if( !node->im ) {
-			im_error( "im_global_balance", 
-				_( "unable to open \"%s\"" ), node->name );
+		if( !im__global_node_image( node ) )
 			return( node );
-		}
 		if( node->trnim ) 
 			error_exit( "global_balance: sanity failure #765" );
 		
@@ -1577,9 +1663,10 @@ analyse_mosaic( SymbolTable *st, IMAGE *in )
 		(VipsSListMap2Fn) generate_trn_leaves, st, NULL ) )
 		return( -1 );
 
-	/* Find overlaps.
+	/* Find overlaps. Use an index so we only test nearby leaves.
 	 */
-	if( im__map_table( st, (VipsSListMap2Fn) find_overlaps, st, NULL ) )
+	if( !(st->index = im__leaf_index_new( st )) ||
+		im__map_table( st, (VipsSListMap2Fn) find_overlaps, st, NULL ) )
 		return( -1 );
 
 	/* Scan table, counting and indexing input images and joins. 
@@ -1607,107 +1694,145 @@ analyse_mosaic( SymbolTable *st, IMAGE *in )
 	return( 0 );
 }
 
+/* Copy to an image named after the leaf, so history lines on the rebuilt
+ * mosaic use the original names.
+ */
+static IMAGE *
+transform_name( JoinNode *node, IMAGE *in )
+{
+	IMAGE *out;
+
+	if( !(out = im_open( node->name, "p" )) )
+		return( NULL );
+	if( im_copy( in, out ) ) {
+		g_object_unref( out );
+		return( NULL );
+	}
+
+	return( out );
+}
+
 /* Scale im by fac --- if it's uchar/ushort, use a lut. If we can use a lut,
  * transform in linear space. If we can't, don't bother for efficiency.
  */
 static IMAGE *
-transform( JoinNode *node, double *gamma )
+transform( JoinNode *node, IMAGE *in, double *gamma )
 {
 	SymbolTable *st = node->st;
-	IMAGE *in = node->im;
 	double fac = st->fac[node->index];
 
-	IMAGE *out = im_open_local( st->im, node->name, "p" );
-
-	IMAGE *t1 = im_open_local( out, "transform:1", "p" );
-	IMAGE *t2 = im_open_local( out, "transform:2", "p" );
-	IMAGE *t3 = im_open_local( out, "transform:3", "p" );
-	IMAGE *t4 = im_open_local( out, "transform:4", "p" );
-	IMAGE *t5 = im_open_local( out, "transform:5", "p" );
-
-	if( !out || !t1 || !t2 || !t3 || !t4 || !t5 )
-		return( NULL );
+	VipsObject *context;
+	VipsImage **t;
+	IMAGE *out;
 
 	if( fac == 1.0 ) {
 		/* Easy!
 		 */
-		out = in;
+		g_object_ref( in );
+
+		return( in );
 	}
-	else if( in->BandFmt == IM_BANDFMT_UCHAR ) {
-		if( im_identity( t1, 1 ) || 
-			im_powtra( t1, t2, 1.0 / (*gamma) ) ||
-			im_lintra( fac, t2, 0.0, t3 ) ||
-			im_powtra( t3, t4, *gamma ) ||
-			im_clip2fmt( t4, t5, IM_BANDFMT_UCHAR ) ||
-			im_maplut( in, out, t5 ) )
+
+	context = VIPS_OBJECT( vips_image_new() );
+	t = (VipsImage **) vips_object_local_array( context, 6 );
+
+	if( in->BandFmt == IM_BANDFMT_UCHAR ) {
+		if( vips_identity( &t[0], NULL ) ||
+			vips_pow_const1( t[0], &t[1], 1.0 / (*gamma), NULL ) ||
+			vips_linear1( t[1], &t[2], fac, 0.0, NULL ) ||
+			vips_pow_const1( t[2], &t[3], *gamma, NULL ) ||
+			vips_cast( t[3], &t[4], IM_BANDFMT_UCHAR, NULL ) ||
+			vips_maplut( in, &t[5], t[4], NULL ) ) {
+			g_object_unref( context );
 			return( NULL );
+		}
 	}
 	else if( in->BandFmt == IM_BANDFMT_USHORT ) {
-		if( im_identity_ushort( t1, 1, 65535 ) || 
-			im_powtra( t1, t2, 1.0 / (*gamma) ) ||
-			im_lintra( fac, t2, 0.0, t3 ) ||
-			im_powtra( t3, t4, *gamma ) ||
-			im_clip2fmt( t4, t5, IM_BANDFMT_USHORT ) ||
-			im_maplut( in, out, t5 ) )
+		if( vips_identity( &t[0],
+				"ushort", TRUE, "size", 65535, NULL ) ||
+			vips_pow_const1( t[0], &t[1], 1.0 / (*gamma), NULL ) ||
+			vips_linear1( t[1], &t[2], fac, 0.0, NULL ) ||
+			vips_pow_const1( t[2], &t[3], *gamma, NULL ) ||
+			vips_cast( t[3], &t[4], IM_BANDFMT_USHORT, NULL ) ||
+			vips_maplut( in, &t[5], t[4], NULL ) ) {
+			g_object_unref( context );
 			return( NULL );
+		}
 	}
 	else {
-		/* Just im_lintra it.
+		/* Just vips_linear() it.
 		 */
-		if( im_lintra( fac, in, 0.0, t1 ) ||
-			im_clip2fmt( t1, out, in->BandFmt ) )
+		if( vips_linear1( in, &t[0], fac, 0.0, NULL ) ||
+			vips_cast( t[0], &t[5], in->BandFmt, NULL ) ) {
+			g_object_unref( context );
 			return( NULL );
+		}
 	}
 
+	out = transform_name( node, t[5] );
+
+	g_object_unref( context );
+
 	return( out );
 }
 
 /* As above, but output as float, not matched to input.
  */
 static IMAGE *
-transformf( JoinNode *node, double *gamma )
+transformf( JoinNode *node, IMAGE *in, double *gamma )
 {
 	SymbolTable *st = node->st;
-	IMAGE *in = node->im;
-	double fac = node->st->fac[node->index];
-
-	IMAGE *out = im_open_local( st->im, node->name, "p" );
-	IMAGE *t1 = im_open_local( out, "transform:1", "p" );
-	IMAGE *t2 = im_open_local( out, "transform:2", "p" );
-	IMAGE *t3 = im_open_local( out, "transform:3", "p" );
-	IMAGE *t4 = im_open_local( out, "transform:4", "p" );
+	double fac = st->fac[node->index];
 
-	if( !out || !t1 || !t2 || !t3 || !t4 )
-		return( NULL );
+	VipsObject *context;
+	VipsImage **t;
+	IMAGE *out;
 
 	if( fac == 1.0 ) {
 		/* Easy!
 		 */
-		out = in;
+		g_object_ref( in );
+
+		return( in );
 	}
-	else if( in->BandFmt == IM_BANDFMT_UCHAR ) {
-		if( im_identity( t1, 1 ) || 
-			im_powtra( t1, t2, 1/(*gamma) ) ||
-			im_lintra( fac, t2, 0.0, t3 ) ||
-			im_powtra( t3, t4, *gamma ) ||
-			im_maplut( in, out, t4 ) )
+
+	context = VIPS_OBJECT( vips_image_new() );
+	t = (VipsImage **) vips_object_local_array( context, 5 );
+
+	if( in->BandFmt == IM_BANDFMT_UCHAR ) {
+		if( vips_identity( &t[0], NULL ) ||
+			vips_pow_const1( t[0], &t[1], 1.0 / (*gamma), NULL ) ||
+			vips_linear1( t[1], &t[2], fac, 0.0, NULL ) ||
+			vips_pow_const1( t[2], &t[3], *gamma, NULL ) ||
+			vips_maplut( in, &t[4], t[3], NULL ) ) {
+			g_object_unref( context );
 			return( NULL );
+		}
 	}
 	else if( in->BandFmt == IM_BANDFMT_USHORT ) {
-		if( im_identity_ushort( t1, 1, 65535 ) || 
-			im_powtra( t1, t2, 1/(*gamma) ) ||
-			im_lintra( fac, t2, 0.0, t3 ) ||
-			im_powtra( t3, t4, *gamma ) ||
-			im_maplut( in, out, t4 ) )
+		if( vips_identity( &t[0],
+				"ushort", TRUE, "size", 65535, NULL ) ||
+			vips_pow_const1( t[0], &t[1], 1.0 / (*gamma), NULL ) ||
+			vips_linear1( t[1], &t[2], fac, 0.0, NULL ) ||
+			vips_pow_const1( t[2], &t[3], *gamma, NULL ) ||
+			vips_maplut( in, &t[4], t[3], NULL ) ) {
+			g_object_unref( context );
 			return( NULL );
+		}
 	}
 	else {
-		/* Just im_lintra it.
+		/* Just vips_linear() it.
 		 */
-		if( im_lintra( fac, in, 0.0, out ) )
+		if( vips_linear1( in, &t[4], fac, 0.0, NULL ) ) {
+			g_object_unref( context );
 			return( NULL );
+		}
 	}
 
+	out = transform_name( node, t[4] );
+
+	g_object_unref( context );
+
 	return( out );
 }
 
@@ -1836,6 +1961,13 @@ vips_globalbalance_init( VipsGlobalbalance *globalbalance )
  * history on @in, and the mosaic must have been built using only operations in
  * this package.
  *
+ * Mosaics of more than 100 images made with only vips_merge() and
+ * vips_mosaic() are not rebuilt as a tree of merges. Instead, images are
+ * placed directly and opened only while their pixels are needed, so there is
+ * no limit on the number of images. Overlaps are blended with a weighting
+ * which falls smoothly to zero at the edges of each image, rather than along
+ * a seam.
+ *
  * See also: vips_remosaic().
  *
  * Returns: 0 on success, -1 on error
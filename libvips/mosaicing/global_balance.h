@@ -2,6 +2,9 @@
  *
  * 1/11/01 JC
  *	- cut from global_balance.c
+ * 14/10/18
+ * 	- add LeafIndex and the flat mosaic builder
+ * 	- transform_fn makes a new ref from an image we pass in
  */
 
 /*
@@ -39,10 +42,12 @@ typedef enum _JoinType JoinType;
 typedef struct _OverlapInfo OverlapInfo;
 typedef struct _JoinNode JoinNode;
 typedef struct _SymbolTable SymbolTable;
+typedef struct _LeafIndex LeafIndex;
 
-/* Type of a transform function.
+/* Type of a transform function. Make a new reference to a transformed version
+ * of the image for a leaf.
  */
-typedef IMAGE *(*transform_fn)( JoinNode *, void * );
+typedef IMAGE *(*transform_fn)( JoinNode *, IMAGE *, void * );
 
 /* Join type.
  */
@@ -93,9 +98,12 @@ struct _JoinNode {
 	VipsTransformation thistrn;	/* Transformation for arg2 */
 
 	/* Special for leaves: all the join_nodes we overlap with, the
-	 * IMAGE for that file, and the index.
+	 * IMAGE for that file, and the index. We just read the header during
+	 * parse: filename is the file we found and im is only opened when
+	 * we need pixels.
 	 */
 	GSList *overlaps;
+	char *filename;
 	IMAGE *im;
 	IMAGE *trnim;		/* Transformed image .. used in 2nd pass */
 	int index;
@@ -117,11 +125,41 @@ struct _SymbolTable {
 	JoinNode *root;		/* Root of join tree */
 	JoinNode *leaf;		/* Leaf nominated to be 1.000 */
 	double *fac;		/* Correction factors */
+
+	GSList *history;	/* History of the mosaic we parsed */
+	LeafIndex *index;	/* Find leaves by position */
+};
+
+/* A grid of cells over the area covered by the leaves. Each cell has a list
+ * of the leaves which touch it.
+ */
+struct _LeafIndex {
+	int nleaf;
+	JoinNode **leaf;
+
+	Rect area;		/* Bounding box of all leaves */
+	int cell_width;
+	int cell_height;
+	int across;
+	int down;
+
+	/* Cell i has leaves cell_leaf[cell_start[i]] up to
+	 * cell_leaf[cell_start[i + 1] - 1].
+	 */
+	int *cell_start;
+	int *cell_leaf;
 };
 
 IMAGE *im__global_open_image( SymbolTable *st, char *name );
+IMAGE *im__global_node_image( JoinNode *node );
 SymbolTable *im__build_symtab( IMAGE *out, int sz );
 int im__parse_desc( SymbolTable *st, IMAGE *in );
 void *im__map_table( SymbolTable *st, VSListMap2Fn fn, void *a, void *b );
 int im__build_mosaic( SymbolTable *st, 
 	IMAGE *out, transform_fn tfn, void * );
+
+LeafIndex *im__leaf_index_new( SymbolTable *st );
+void *im__leaf_index_map( LeafIndex *index, Rect *area,
+	VSListMap2Fn fn, void *a, void *b );
+int im__flat_mosaic( SymbolTable *st, IMAGE *out,
+	transform_fn tfn, void *a, gboolean *done );
@@ -0,0 +1,876 @@
+/* Rebuild a mosaic directly from the leaves of the join tree.
+ *
+ * 14/10/18
+ * 	- first version, cut from global_balance.c
+ */
+
+/*
+
+    This file is part of VIPS.
+
+    VIPS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA
+
+ */
+
+/*
+
+    These files are distributed with VIPS - http://www.vips.ecs.soton.ac.uk
+
+ */
+
+/* Strategy: im__build_mosaic() makes a tree of lrmerge and tbmerge
+ * operations. This gets deep and needs every leaf open for large mosaics.
+ * Instead, find where each leaf ends up in the output, index them with a
+ * grid, and make each output tile by finding and blending the leaves which
+ * touch it. Leaves are opened on demand, and we only keep a few open.
+ */
+
+/* Define for debug output.
+#define DEBUG
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /*HAVE_CONFIG_H*/
+#include <vips/intl.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <vips/vips.h>
+#include <vips/transform.h>
+#include <vips/internal.h>
+
+#include "pmosaicing.h"
+#include "global_balance.h"
+
+/* Keep about this many leaves open. We can go over if more than this are in
+ * use at once.
+ */
+#define FLAT_MAX_OPEN (100)
+
+static void *
+leaf_index_count( JoinNode *node, LeafIndex *index )
+{
+	if( node->type == JOIN_LEAF )
+		index->nleaf += 1;
+
+	return( NULL );
+}
+
+static void *
+leaf_index_add( JoinNode *node, LeafIndex *index, int *n )
+{
+	if( node->type == JOIN_LEAF ) {
+		index->leaf[*n] = node;
+		*n += 1;
+	}
+
+	return( NULL );
+}
+
+/* The range of cells touched by a rect. FALSE for no cells.
+ */
+static gboolean
+leaf_index_cells( LeafIndex *index, Rect *area, Rect *cells )
+{
+	Rect clip;
+	int right;
+	int bottom;
+
+	im_rect_intersectrect( &index->area, area, &clip );
+	if( im_rect_isempty( &clip ) )
+		return( FALSE );
+
+	cells->left = (clip.left - index->area.left) / index->cell_width;
+	cells->top = (clip.top - index->area.top) / index->cell_height;
+	right = (IM_RECT_RIGHT( &clip ) - 1 - index->area.left) / 
+		index->cell_width;
+	bottom = (IM_RECT_BOTTOM( &clip ) - 1 - index->area.top) / 
+		index->cell_height;
+	cells->width = right - cells->left + 1;
+	cells->height = bottom - cells->top + 1;
+
+	return( TRUE );
+}
+
+/* Build an index for the leaves in a symbol table. The leaves must all be in
+ * their final position.
+ */
+LeafIndex *
+im__leaf_index_new( SymbolTable *st )
+{
+	LeafIndex *index;
+	gint64 total_width;
+	gint64 total_height;
+	int n;
+	int i, j, x, y;
+	int *count;
+
+	if( !(index = IM_NEW( st->im, LeafIndex )) )
+		return( NULL );
+	index->nleaf = 0;
+	im__map_table( st, (VipsSListMap2Fn) leaf_index_count, index, NULL );
+	if( !(index->leaf = IM_ARRAY( st->im,
+		VIPS_MAX( 1, index->nleaf ), JoinNode * )) )
+		return( NULL );
+	n = 0;
+	im__map_table( st, (VipsSListMap2Fn) leaf_index_add, index, &n );
+
+	/* Find the bounding box and average size of the leaves we can
+	 * place. Leaves with no file have no area, and are left out.
+	 */
+	index->area.left = 0;
+	index->area.top = 0;
+	index->area.width = 0;
+	index->area.height = 0;
+	total_width = 0;
+	total_height = 0;
+	n = 0;
+	for( i = 0; i < index->nleaf; i++ ) {
+		Rect *area = &index->leaf[i]->cumtrn.oarea;
+
+		if( im_rect_isempty( area ) )
+			continue;
+
+		if( n == 0 )
+			index->area = *area;
+		else
+			im_rect_unionrect( &index->area, area, &index->area );
+		total_width += area->width;
+		total_height += area->height;
+		n += 1;
+	}
+
+	/* Cells are about the size of a leaf, so most leaves touch four
+	 * cells. If the leaves are spread out, make the cells larger, so the
+	 * grid is not too much bigger than the number of leaves.
+	 */
+	index->cell_width = n > 0 ? VIPS_MAX( 1, total_width / n ) : 1;
+	index->cell_height = n > 0 ? VIPS_MAX( 1, total_height / n ) : 1;
+	for(;;) {
+		index->across = VIPS_ROUND_UP( index->area.width,
+			index->cell_width ) / index->cell_width;
+		index->down = VIPS_ROUND_UP( index->area.height,
+			index->cell_height ) / index->cell_height;
+
+		if( (gint64) index->across * index->down <= 4 * n + 16 )
+			break;
+
+		index->cell_width *= 2;
+		index->cell_height *= 2;
+	}
+
+	/* Count leaves in each cell, then fill.
+	 */
+	if( !(index->cell_start = IM_ARRAY( st->im,
+		index->across * index->down + 1, int )) ||
+		!(count = IM_ARRAY( NULL,
+			index->across * index->down + 1, int )) )
+		return( NULL );
+	memset( count, 0, (index->across * index->down + 1) * sizeof( int ) );
+
+	for( i = 0; i < index->nleaf; i++ ) {
+		Rect cells;
+
+		if( !leaf_index_cells( index,
+			&index->leaf[i]->cumtrn.oarea, &cells ) )
+			continue;
+
+		for( y = cells.top; y < IM_RECT_BOTTOM( &cells ); y++ )
+			for( x = cells.left; x < IM_RECT_RIGHT( &cells ); x++ )
+				count[x + y * index->across] += 1;
+	}
+
+	n = 0;
+	for( j = 0; j < index->across * index->down; j++ ) {
+		index->cell_start[j] = n;
+		n += count[j];
+		count[j] = 0;
+	}
+	index->cell_start[j] = n;
+
+	if( !(index->cell_leaf = IM_ARRAY( st->im,
+		VIPS_MAX( 1, n ), int )) ) {
+		im_free( count );
+		return( NULL );
+	}
+
+	for( i = 0; i < index->nleaf; i++ ) {
+		Rect cells;
+
+		if( !leaf_index_cells( index,
+			&index->leaf[i]->cumtrn.oarea, &cells ) )
+			continue;
+
+		for( y = cells.top; y < IM_RECT_BOTTOM( &cells ); y++ )
+			for( x = cells.left; x < IM_RECT_RIGHT( &cells ); x++ ) {
+				j = x + y * index->across;
+
+				index->cell_leaf[index->cell_start[j] +
+					count[j]] = i;
+				count[j] += 1;
+			}
+	}
+
+	im_free( count );
+
+#ifdef DEBUG
+	printf( "im__leaf_index_new: %d leaves, %d x %d cells of %d x %d\n",
+		index->nleaf, index->across, index->down,
+		index->cell_width, index->cell_height );
+#endif /*DEBUG*/
+
+	return( index );
+}
+
+/* Call fn on the index of each leaf which touches area. Each leaf is seen
+ * once, even if it's in several of the cells we search: we only take a leaf
+ * from the cell holding the top-left of its intersection with area.
+ */
+static void *
+leaf_index_map_index( LeafIndex *index, Rect *area,
+	void *(*fn)( LeafIndex *, int, void *, void * ), void *a, void *b )
+{
+	Rect cells;
+	int x, y, k;
+	void *result;
+
+	if( !leaf_index_cells( index, area, &cells ) )
+		return( NULL );
+
+	for( y = cells.top; y < IM_RECT_BOTTOM( &cells ); y++ )
+		for( x = cells.left; x < IM_RECT_RIGHT( &cells ); x++ ) {
+			int j = x + y * index->across;
+
+			for( k = index->cell_start[j];
+				k < index->cell_start[j + 1]; k++ ) {
+				int i = index->cell_leaf[k];
+				Rect *oarea = &index->leaf[i]->cumtrn.oarea;
+
+				Rect isect;
+				Rect first;
+
+				im_rect_intersectrect( oarea, area, &isect );
+				if( im_rect_isempty( &isect ) ||
+					!leaf_index_cells( index,
+						&isect, &first ) ||
+					first.left != x ||
+					first.top != y )
+					continue;
+
+				if( (result = fn( index, i, a, b )) )
+					return( result );
+			}
+		}
+
+	return( NULL );
+}
+
+static void *
+leaf_index_map_node( LeafIndex *index, int i, VSListMap2Fn fn, void **ab )
+{
+	return( fn( index->leaf[i], ab[0], ab[1] ) );
+}
+
+/* Call fn( node, a, b ) on every leaf which touches area, stopping if fn
+ * returns non-NULL.
+ */
+void *
+im__leaf_index_map( LeafIndex *index, Rect *area,
+	VSListMap2Fn fn, void *a, void *b )
+{
+	void *ab[2];
+
+	ab[0] = a;
+	ab[1] = b;
+
+	return( leaf_index_map_index( index, area,
+		(void *(*)( LeafIndex *, int, void *, void * ))
+			leaf_index_map_node, fn, ab ) );
+}
+
+/* A leaf for the flat builder. We open image on demand.
+ */
+typedef struct _FlatLeaf {
+	JoinNode *node;
+	Rect area;		/* Position in output */
+
+	/* Format and bands of the transformed leaf.
+	 */
+	VipsBandFormat format;
+	int bands;
+
+	IMAGE *image;		/* Transformed leaf, or NULL if closed */
+	int users;		/* Number of generate calls using image */
+} FlatLeaf;
+
+typedef struct _FlatMerge {
+	SymbolTable *st;
+	LeafIndex *index;
+	transform_fn tfn;
+	void *a;
+
+	/* One for each leaf in index.
+	 */
+	FlatLeaf *leaf;
+
+	/* Output format and bands.
+	 */
+	VipsBandFormat format;
+	int bands;
+
+	/* Open leaves with no users, oldest first.
+	 */
+	GMutex *lock;
+	GQueue idle;
+	int nopen;
+} FlatMerge;
+
+/* Per-thread state: the leaves for this tile, and a weighted mean and total
+ * weight for each pixel.
+ */
+typedef struct _FlatSequence {
+	FlatMerge *flat;
+
+	int *leaves;
+	int nleaves;
+	int szleaves;
+
+	double *mean;
+	double *weight;
+	int npels;
+} FlatSequence;
+
+static int
+flat_free( FlatMerge *flat )
+{
+	int i;
+
+	for( i = 0; i < flat->index->nleaf; i++ )
+		VIPS_UNREF( flat->leaf[i].image );
+	g_queue_clear( &flat->idle );
+	VIPS_FREEF( vips_g_mutex_free, flat->lock );
+
+	return( 0 );
+}
+
+/* Open the transformed image for a leaf.
+ */
+static IMAGE *
+flat_leaf_open( FlatMerge *flat, FlatLeaf *leaf )
+{
+	JoinNode *node = leaf->node;
+
+	IMAGE *in;
+	IMAGE *image;
+
+	/* global_balance will have the file open already from the analysis
+	 * pass.
+	 */
+	if( node->im ) {
+		in = node->im;
+		g_object_ref( in );
+	}
+	else if( !(in = im_open( node->filename, "r" )) )
+		return( NULL );
+
+	image = flat->tfn( node, in, flat->a );
+	g_object_unref( in );
+	if( !image )
+		return( NULL );
+
+	if( image->Xsize != leaf->area.width ||
+		image->Ysize != leaf->area.height ) {
+		im_error( "im_global_balance",
+			_( "image \"%s\" has changed size" ), node->name );
+		g_object_unref( image );
+		return( NULL );
+	}
+
+	return( image );
+}
+
+/* Get the image for leaf i, opening it if necessary.
+ */
+static IMAGE *
+flat_leaf_get( FlatMerge *flat, int i )
+{
+	FlatLeaf *leaf = &flat->leaf[i];
+
+	IMAGE *image;
+
+	g_mutex_lock( flat->lock );
+
+	if( !leaf->image ) {
+		FlatLeaf *old;
+
+		/* Close the images we've used least recently to make room.
+		 */
+		while( flat->nopen >= FLAT_MAX_OPEN &&
+			(old = (FlatLeaf *) g_queue_pop_head( &flat->idle )) ) {
+			VIPS_UNREF( old->image );
+			flat->nopen -= 1;
+		}
+
+		if( !(leaf->image = flat_leaf_open( flat, leaf )) ) {
+			g_mutex_unlock( flat->lock );
+			return( NULL );
+		}
+		flat->nopen += 1;
+	}
+	else if( leaf->users == 0 )
+		g_queue_remove( &flat->idle, leaf );
+
+	leaf->users += 1;
+	image = leaf->image;
+
+	g_mutex_unlock( flat->lock );
+
+	return( image );
+}
+
+static void
+flat_leaf_release( FlatMerge *flat, int i )
+{
+	FlatLeaf *leaf = &flat->leaf[i];
+
+	g_mutex_lock( flat->lock );
+
+	g_assert( leaf->users > 0 );
+
+	leaf->users -= 1;
+	if( leaf->users == 0 )
+		g_queue_push_tail( &flat->idle, leaf );
+
+	g_mutex_unlock( flat->lock );
+}
+
+static int
+flat_stop( void *vseq, void *a, void *b )
+{
+	FlatSequence *seq = (FlatSequence *) vseq;
+
+	VIPS_FREE( seq->leaves );
+	VIPS_FREE( seq->mean );
+	VIPS_FREE( seq->weight );
+	VIPS_FREE( seq );
+
+	return( 0 );
+}
+
+static void *
+flat_start( IMAGE *out, void *a, void *b )
+{
+	FlatMerge *flat = (FlatMerge *) a;
+
+	FlatSequence *seq;
+
+	if( !(seq = VIPS_NEW( NULL, FlatSequence )) )
+		return( NULL );
+
+	seq->flat = flat;
+	seq->leaves = NULL;
+	seq->nleaves = 0;
+	seq->szleaves = 0;
+	seq->mean = NULL;
+	seq->weight = NULL;
+	seq->npels = 0;
+
+	return( seq );
+}
+
+static void *
+flat_add_leaf( LeafIndex *index, int i, FlatSequence *seq, void *b )
+{
+	if( seq->nleaves >= seq->szleaves ) {
+		int sz = VIPS_MAX( 16, 2 * seq->szleaves );
+		int *leaves;
+
+		if( !(leaves = VIPS_ARRAY( NULL, sz, int )) )
+			return( seq );
+		if( seq->leaves )
+			memcpy( leaves, seq->leaves,
+				seq->nleaves * sizeof( int ) );
+		VIPS_FREE( seq->leaves );
+		seq->leaves = leaves;
+		seq->szleaves = sz;
+	}
+
+	seq->leaves[seq->nleaves++] = i;
+
+	return( NULL );
+}
+
+/* Add a leaf to the weighted mean of each pixel, skipping transparent
+ * pixels (all bands zero). The weight is the square of the distance to the
+ * nearest edge of the leaf, so blends fall smoothly to zero at the edges.
+ * A one-band leaf is used for all bands.
+ */
+#define ACCUMULATE( TYPE ) { \
+	for( y = 0; y < isect.height; y++ ) { \
+		const int oy = isect.top + y; \
+		const int dy = VIPS_MIN( oy - area->top + 1, \
+			IM_RECT_BOTTOM( area ) - oy ); \
+		TYPE *p = (TYPE *) IM_REGION_ADDR( ir, \
+			isect.left - area->left, oy - area->top ); \
+		int o = (oy - r->top) * r->width + isect.left - r->left; \
+		\
+		for( x = 0; x < isect.width; x++ ) { \
+			const int ox = isect.left + x; \
+			const int dx = VIPS_MIN( ox - area->left + 1, \
+				IM_RECT_RIGHT( area ) - ox ); \
+			const double d = VIPS_MIN( dx, dy ); \
+			\
+			for( k = 0; k < lb; k++ ) \
+				if( p[k] ) \
+					break; \
+			\
+			if( k < lb ) { \
+				double *m = seq->mean + o * bands; \
+				double w = d * d; \
+				double f; \
+				\
+				seq->weight[o] += w; \
+				f = w / seq->weight[o]; \
+				for( k = 0; k < bands; k++ ) \
+					m[k] += (p[lb == 1 ? 0 : k] - m[k]) * f; \
+			} \
+			\
+			p += lb; \
+			o += 1; \
+		} \
+	} \
+}
+
+/* Write the means to the output.
+ */
+#define IWRITE( TYPE ) { \
+	for( y = 0; y < r->height; y++ ) { \
+		TYPE *q = (TYPE *) IM_REGION_ADDR( or, r->left, r->top + y ); \
+		double *m = seq->mean + y * r->width * bands; \
+		\
+		for( x = 0; x < r->width * bands; x++ ) \
+			q[x] = VIPS_RINT( m[x] ); \
+	} \
+}
+
+#define FWRITE( TYPE ) { \
+	for( y = 0; y < r->height; y++ ) { \
+		TYPE *q = (TYPE *) IM_REGION_ADDR( or, r->left, r->top + y ); \
+		double *m = seq->mean + y * r->width * bands; \
+		\
+		for( x = 0; x < r->width * bands; x++ ) \
+			q[x] = m[x]; \
+	} \
+}
+
+#define SWITCH( I, F ) \
+	switch( format ) { \
+	case IM_BANDFMT_UCHAR: 	I( unsigned char ); break; \
+	case IM_BANDFMT_CHAR: 	I( signed char ); break; \
+	case IM_BANDFMT_USHORT: I( unsigned short ); break; \
+	case IM_BANDFMT_SHORT: 	I( signed short ); break; \
+	case IM_BANDFMT_UINT: 	I( unsigned int ); break; \
+	case IM_BANDFMT_INT: 	I( signed int ); break; \
+	case IM_BANDFMT_FLOAT: 	F( float ); break; \
+	case IM_BANDFMT_DOUBLE:	F( double ); break; \
+	\
+	default: \
+		g_assert_not_reached(); \
+	}
+
+/* Add leaf i to the mean.
+ */
+static int
+flat_gen_leaf( FlatSequence *seq, REGION *or, int i )
+{
+	FlatMerge *flat = seq->flat;
+	Rect *area = &flat->leaf[i].area;
+	Rect *r = &or->valid;
+	const int bands = flat->bands;
+
+	IMAGE *image;
+	REGION *ir;
+	Rect isect;
+	Rect need;
+	VipsBandFormat format;
+	int lb;
+	int x, y, k;
+
+	im_rect_intersectrect( area, r, &isect );
+	need = isect;
+	need.left -= area->left;
+	need.top -= area->top;
+
+	if( !(image = flat_leaf_get( flat, i )) )
+		return( -1 );
+	if( !(ir = im_region_create( image )) ) {
+		flat_leaf_release( flat, i );
+		return( -1 );
+	}
+	if( im_prepare( ir, &need ) ) {
+		im_region_free( ir );
+		flat_leaf_release( flat, i );
+		return( -1 );
+	}
+
+	format = image->BandFmt;
+	lb = image->Bands;
+	SWITCH( ACCUMULATE, ACCUMULATE );
+
+	im_region_free( ir );
+	flat_leaf_release( flat, i );
+
+	return( 0 );
+}
+
+static int
+flat_gen( REGION *or, void *vseq, void *a, void *b )
+{
+	FlatSequence *seq = (FlatSequence *) vseq;
+	FlatMerge *flat = (FlatMerge *) a;
+	Rect *r = &or->valid;
+	const int bands = flat->bands;
+	const int npels = r->width * r->height;
+	const VipsBandFormat format = flat->format;
+
+	int i, x, y;
+
+	/* Find the leaves we need.
+	 */
+	seq->nleaves = 0;
+	if( leaf_index_map_index( flat->index, r,
+		(void *(*)( LeafIndex *, int, void *, void * ))
+			flat_add_leaf, seq, NULL ) )
+		return( -1 );
+
+	if( seq->nleaves == 0 ) {
+		im_region_black( or );
+		return( 0 );
+	}
+
+	/* Just one leaf covering the whole of our tile, in the output format:
+	 * we can copy.
+	 */
+	if( seq->nleaves == 1 ) {
+		FlatLeaf *leaf = &flat->leaf[seq->leaves[0]];
+
+		if( im_rect_includesrect( &leaf->area, r ) &&
+			leaf->format == format &&
+			leaf->bands == bands ) {
+			IMAGE *image;
+			REGION *ir;
+			Rect need;
+
+			need = *r;
+			need.left -= leaf->area.left;
+			need.top -= leaf->area.top;
+
+			if( !(image = flat_leaf_get( flat, seq->leaves[0] )) )
+				return( -1 );
+			if( !(ir = im_region_create( image )) ||
+				im_prepare( ir, &need ) ) {
+				IM_FREEF( im_region_free, ir );
+				flat_leaf_release( flat, seq->leaves[0] );
+				return( -1 );
+			}
+			vips_region_copy( ir, or, &need, r->left, r->top );
+			im_region_free( ir );
+			flat_leaf_release( flat, seq->leaves[0] );
+
+			return( 0 );
+		}
+	}
+
+	if( npels > seq->npels ) {
+		VIPS_FREE( seq->mean );
+		VIPS_FREE( seq->weight );
+		if( !(seq->mean = VIPS_ARRAY( NULL, npels * bands, double )) ||
+			!(seq->weight = VIPS_ARRAY( NULL, npels, double )) ) {
+			seq->npels = 0;
+			return( -1 );
+		}
+		seq->npels = npels;
+	}
+	memset( seq->mean, 0, npels * bands * sizeof( double ) );
+	memset( seq->weight, 0, npels * sizeof( double ) );
+
+	for( i = 0; i < seq->nleaves; i++ )
+		if( flat_gen_leaf( seq, or, seq->leaves[i] ) )
+			return( -1 );
+
+	SWITCH( IWRITE, FWRITE );
+
+	return( 0 );
+}
+
+/* Open each leaf to find the output format. Set done to FALSE if we can't 
+ * make this mosaic.
+ */
+static int
+flat_header( FlatMerge *flat, IMAGE *out, gboolean *done )
+{
+	LeafIndex *index = flat->index;
+
+	gboolean first;
+	int i;
+
+	*done = FALSE;
+	first = TRUE;
+	for( i = 0; i < index->nleaf; i++ ) {
+		IMAGE *image;
+
+		if( im_rect_isempty( &flat->leaf[i].area ) )
+			continue;
+
+		if( !(image = flat_leaf_get( flat, i )) )
+			return( -1 );
+		flat->leaf[i].format = image->BandFmt;
+		flat->leaf[i].bands = image->Bands;
+
+		/* We don't blend coded or complex images, use a tree for
+		 * these.
+		 */
+		if( image->Coding != IM_CODING_NONE ||
+			vips_band_format_iscomplex( image->BandFmt ) ) {
+			flat_leaf_release( flat, i );
+			return( 0 );
+		}
+
+		if( first ) {
+			if( im_cp_desc( out, image ) ) {
+				flat_leaf_release( flat, i );
+				return( -1 );
+			}
+			flat->format = image->BandFmt;
+			flat->bands = image->Bands;
+			first = FALSE;
+		}
+		else {
+			flat->format = vips__format_common( flat->format,
+				image->BandFmt );
+
+			/* One-band leaves are used for every band, as
+			 * lrmerge does.
+			 */
+			if( image->Bands != 1 &&
+				flat->bands != 1 &&
+				image->Bands != flat->bands ) {
+				flat_leaf_release( flat, i );
+				return( 0 );
+			}
+			flat->bands = VIPS_MAX( flat->bands, image->Bands );
+		}
+
+		flat_leaf_release( flat, i );
+	}
+
+	if( first )
+		return( 0 );
+
+	*done = TRUE;
+
+	return( 0 );
+}
+
+/* Rebuild the mosaic in st directly from the leaves. The tree must have only
+ * lr and tb joins, and every leaf must have a file. Set done to FALSE if the
+ * leaves are not something we can blend and the tree must be used after
+ * all.
+ */
+int
+im__flat_mosaic( SymbolTable *st, IMAGE *out,
+	transform_fn tfn, void *a, gboolean *done )
+{
+	FlatMerge *flat;
+	int i;
+
+	*done = FALSE;
+
+	if( !st->index &&
+		!(st->index = im__leaf_index_new( st )) )
+		return( -1 );
+
+	if( !(flat = IM_NEW( out, FlatMerge )) )
+		return( -1 );
+	flat->st = st;
+	flat->index = st->index;
+	flat->tfn = tfn;
+	flat->a = a;
+	flat->format = IM_BANDFMT_UCHAR;
+	flat->bands = 1;
+	flat->lock = vips_g_mutex_new();
+	g_queue_init( &flat->idle );
+	flat->nopen = 0;
+	if( !(flat->leaf = IM_ARRAY( out,
+		VIPS_MAX( 1, flat->index->nleaf ), FlatLeaf )) ||
+		im_add_close_callback( out,
+			(im_callback_fn) flat_free, flat, NULL ) ) {
+		vips_g_mutex_free( flat->lock );
+		return( -1 );
+	}
+
+	for( i = 0; i < flat->index->nleaf; i++ ) {
+		FlatLeaf *leaf = &flat->leaf[i];
+
+		leaf->node = flat->index->leaf[i];
+		leaf->area = leaf->node->cumtrn.oarea;
+		leaf->format = IM_BANDFMT_UCHAR;
+		leaf->bands = 1;
+		leaf->image = NULL;
+		leaf->users = 0;
+	}
+
+	if( flat_header( flat, out, done ) )
+		return( -1 );
+	if( !*done ) {
+		/* The tree will open the leaves again, close ours.
+		 */
+		for( i = 0; i < flat->index->nleaf; i++ )
+			VIPS_UNREF( flat->leaf[i].image );
+		g_queue_clear( &flat->idle );
+		flat->nopen = 0;
+
+		return( 0 );
+	}
+
+	out->Xsize = st->root->cumtrn.oarea.width;
+	out->Ysize = st->root->cumtrn.oarea.height;
+	out->Bands = flat->bands;
+	out->BandFmt = flat->format;
+	out->Xoffset = 0;
+	out->Yoffset = 0;
+
+	/* The tree would have made a history like the one we parsed, use
+	 * that.
+	 */
+	out->history_list =
+		vips__gslist_gvalue_merge( out->history_list, st->history );
+
+#ifdef DEBUG
+	printf( "im__flat_mosaic: %d leaves, %d x %d pixels\n",
+		flat->index->nleaf, out->Xsize, out->Ysize );
+#endif /*DEBUG*/
+
+	if( vips_image_pipelinev( out, VIPS_DEMAND_STYLE_SMALLTILE, NULL ) ||
+		im_generate( out, flat_start, flat_gen, flat_stop, flat, NULL ) )
+		return( -1 );
+
+	return( 0 );
+}
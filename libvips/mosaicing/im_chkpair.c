@@ -15,6 +15,9 @@
  *	- order of args changed to help C++ API
  * 24/1/11
  * 	- gtk-doc
+ * 14/10/18
+ * 	- im__chkpair() searches points in parallel, correlating small windows
+ * 	  directly in memory and large ones with vips_find_template()
  */
 
 /*
@@ -51,9 +54,11 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 #include <vips/vips.h>
+#include <vips/thread.h>
 
 #include "pmosaicing.h"
 
@@ -88,29 +93,23 @@
  *
  * Returns: 0 on success, -1 on error
  */
-int 
-im_correl( IMAGE *ref, IMAGE *sec, 
+/* Use the pyramid search in vips_find_template() for windows at least this
+ * wide. It can only shrink references which are more than twice its minimum
+ * size, and smaller windows are quicker to correlate directly.
+ */
+#define CHKPAIR_PYRAMID_WINDOW (16)
+
+/* Find position of window and search area, and clip against image size.
+ */
+static void
+correl_areas( IMAGE *ref, IMAGE *sec,
 	int xref, int yref, int xsec, int ysec,
 	int hwindowsize, int hsearchsize,
-	double *correlation, int *x, int *y )
+	Rect *wincr, Rect *srhcr )
 {
-	IMAGE *surface = im_open( "surface", "t" );
-	IMAGE *t1, *t2, *t3, *t4;
-
 	Rect refr, secr;
 	Rect winr, srhr;
-	Rect wincr, srhcr;
 
-	if( !surface || 
-		!(t1 = im_open_local( surface, "correlate:1", "p" )) ||
-		!(t2 = im_open_local( surface, "correlate:1", "p" )) ||
-		!(t3 = im_open_local( surface, "correlate:1", "p" )) ||
-		!(t4 = im_open_local( surface, "correlate:1", "p" )) )
-		return( -1 );
-	
-	/* Find position of window and search area, and clip against image
-	 * size.
-	 */
 	refr.left = 0;
 	refr.top = 0;
 	refr.width = ref->Xsize;
@@ -119,7 +118,7 @@ im_correl( IMAGE *ref, IMAGE *sec,
 	winr.top = yref - hwindowsize;
 	winr.width = hwindowsize*2 + 1;
 	winr.height = hwindowsize*2 + 1;
-	im_rect_intersectrect( &refr, &winr, &wincr );
+	im_rect_intersectrect( &refr, &winr, wincr );
 
 	secr.left = 0;
 	secr.top = 0;
@@ -129,7 +128,29 @@ im_correl( IMAGE *ref, IMAGE *sec,
 	srhr.top = ysec - hsearchsize;
 	srhr.width = hsearchsize*2 + 1;
 	srhr.height = hsearchsize*2 + 1;
-	im_rect_intersectrect( &secr, &srhr, &srhcr );
+	im_rect_intersectrect( &secr, &srhr, srhcr );
+}
+
+int
+im_correl( IMAGE *ref, IMAGE *sec,
+	int xref, int yref, int xsec, int ysec,
+	int hwindowsize, int hsearchsize,
+	double *correlation, int *x, int *y )
+{
+	IMAGE *surface = im_open( "surface", "t" );
+	IMAGE *t1, *t2, *t3, *t4;
+
+	Rect wincr, srhcr;
+
+	if( !surface ||
+		!(t1 = im_open_local( surface, "correlate:1", "p" )) ||
+		!(t2 = im_open_local( surface, "correlate:1", "p" )) ||
+		!(t3 = im_open_local( surface, "correlate:1", "p" )) ||
+		!(t4 = im_open_local( surface, "correlate:1", "p" )) )
+		return( -1 );
+
+	correl_areas( ref, sec, xref, yref, xsec, ysec,
+		hwindowsize, hsearchsize, &wincr, &srhcr );
 
 	/* Extract window and search area.
 	 */
@@ -182,16 +203,270 @@ im_correl( IMAGE *ref, IMAGE *sec,
 	return( 0 );
 }
 
-int 
-im__chkpair( IMAGE *ref, IMAGE *sec, TIE_POINTS *points )
+/* State for a parallel tie-point search.
+ */
+typedef struct _Chkpair {
+	IMAGE *ref;
+	IMAGE *sec;
+	TIE_POINTS *points;
+
+	/* The next point to search, and set if any search fails.
+	 */
+	int next;
+	int error;
+} Chkpair;
+
+/* Each worker thread has one of these.
+ */
+typedef struct _ChkpairWorker {
+	Chkpair *chkpair;
+
+	REGION *rreg;
+	REGION *sreg;
+
+	/* The window, less its mean.
+	 */
+	double *window;
+
+	GThread *thread;
+} ChkpairWorker;
+
+/* Correlate with vips_find_template(). This is the same normalised
+ * correlation as im_correl(), but uses a pyramid search for large windows.
+ */
+static int
+chkpair_template( ChkpairWorker *worker, Rect *wincr, Rect *srhcr,
+	double *correlation, int *x, int *y )
 {
-	int i;
-	int x, y;
-	double correlation;
+	Chkpair *chkpair = worker->chkpair;
+	VipsImage *t[2];
+
+	if( vips_extract_area( chkpair->ref, &t[0],
+		wincr->left, wincr->top, wincr->width, wincr->height, NULL ) )
+		return( -1 );
+	if( vips_extract_area( chkpair->sec, &t[1],
+		srhcr->left, srhcr->top, srhcr->width, srhcr->height, NULL ) ) {
+		g_object_unref( t[0] );
+		return( -1 );
+	}
+	if( vips_find_template( t[1], t[0], x, y,
+		"score", correlation,
+		NULL ) ) {
+		g_object_unref( t[0] );
+		g_object_unref( t[1] );
+		return( -1 );
+	}
+	g_object_unref( t[0] );
+	g_object_unref( t[1] );
 
+	*x += srhcr->left;
+	*y += srhcr->top;
+
+	return( 0 );
+}
+
+/* Correlate a window against a search area held in memory. We search the
+ * same positions as im_spcor() and im_maxpos() in im_correl(), with pixels off
+ * the edge of the search area copied from the nearest edge pixel, so we
+ * find the same point, but without building a pipeline for every tie-point.
+ */
+static int
+chkpair_direct( ChkpairWorker *worker, Rect *wincr, Rect *srhcr,
+	double *correlation, int *x, int *y )
+{
+	const int ww = wincr->width;
+	const int wh = wincr->height;
+	const int n = ww * wh;
+	const int sw = srhcr->width;
+	const int sh = srhcr->height;
+
+	VipsPel *p;
+	VipsPel *q;
+	int lskip;
+	double sum;
+	double rmean;
+	double c1;
+	double best;
+	int bx, by;
+	int i, j, sx, sy;
+
+	if( vips_region_prepare( worker->rreg, wincr ) ||
+		vips_region_prepare( worker->sreg, srhcr ) )
+		return( -1 );
+
+	/* Window less its mean, and sqrt of its sum of squares.
+	 */
+	sum = 0.0;
+	for( j = 0; j < wh; j++ ) {
+		p = VIPS_REGION_ADDR( worker->rreg,
+			wincr->left, wincr->top + j );
+		for( i = 0; i < ww; i++ )
+			sum += p[i];
+	}
+	rmean = sum / n;
+
+	c1 = 0.0;
+	for( j = 0; j < wh; j++ ) {
+		p = VIPS_REGION_ADDR( worker->rreg,
+			wincr->left, wincr->top + j );
+		for( i = 0; i < ww; i++ ) {
+			double d = p[i] - rmean;
+
+			worker->window[j * ww + i] = d;
+			c1 += d * d;
+		}
+	}
+	c1 = sqrt( c1 );
+
+	q = VIPS_REGION_ADDR( worker->sreg, srhcr->left, srhcr->top );
+	lskip = VIPS_REGION_LSKIP( worker->sreg );
+
+	best = 0.0;
+	bx = 0;
+	by = 0;
+	for( sy = 0; sy < sh; sy++ )
+		for( sx = 0; sx < sw; sx++ ) {
+			double *w = worker->window;
+			double sum1, sum2, sum3;
+			double c2;
+			double cc;
+
+			/* Since the window has zero mean, the sum of products
+			 * does not need the mean of the search image.
+			 */
+			sum1 = 0.0;
+			sum2 = 0.0;
+			sum3 = 0.0;
+			for( j = 0; j < wh; j++ ) {
+				int yy = VIPS_CLIP( 0,
+					sy - wh / 2 + j, sh - 1 );
+				VipsPel *row = q + yy * lskip;
+
+				for( i = 0; i < ww; i++ ) {
+					int xx = VIPS_CLIP( 0,
+						sx - ww / 2 + i, sw - 1 );
+					double v = row[xx];
+
+					sum1 += v;
+					sum2 += v * v;
+					sum3 += w[i] * v;
+				}
+
+				w += ww;
+			}
+
+			c2 = c1 *
+				sqrt( VIPS_MAX( 0.0, sum2 - sum1 * sum1 / n ) );
+			cc = c2 == 0.0 ? 0.0 : sum3 / c2;
+
+			if( (sx == 0 && sy == 0) ||
+				cc > best ) {
+				best = cc;
+				bx = sx;
+				by = sy;
+			}
+		}
+
+	*correlation = best;
+	*x = bx + srhcr->left;
+	*y = by + srhcr->top;
+
+	return( 0 );
+}
+
+/* Search a single point.
+ */
+static int
+chkpair_point( ChkpairWorker *worker, int i )
+{
+	Chkpair *chkpair = worker->chkpair;
+	TIE_POINTS *points = chkpair->points;
 	const int hcor = points->halfcorsize;
 	const int harea = points->halfareasize;
 
+	Rect wincr, srhcr;
+	double correlation;
+	int x, y;
+
+	/* Search sec around the initial estimate of the displacement.
+	 */
+	correl_areas( chkpair->ref, chkpair->sec,
+		points->x_reference[i], points->y_reference[i],
+		points->x_reference[i] + points->deltax,
+		points->y_reference[i] + points->deltay,
+		hcor, harea, &wincr, &srhcr );
+	if( im_rect_isempty( &wincr ) ||
+		im_rect_isempty( &srhcr ) ) {
+		im_error( "im_chkpair",
+			"%s", _( "search area outside image" ) );
+		return( -1 );
+	}
+
+	if( 2 * hcor + 1 >= CHKPAIR_PYRAMID_WINDOW ) {
+		if( chkpair_template( worker, &wincr, &srhcr,
+			&correlation, &x, &y ) )
+			return( -1 );
+	}
+	else {
+		if( chkpair_direct( worker, &wincr, &srhcr,
+			&correlation, &x, &y ) )
+			return( -1 );
+	}
+
+	/* Each worker writes only to its own points.
+	 */
+	points->x_secondary[i] = x;
+	points->y_secondary[i] = y;
+	points->correlation[i] = correlation;
+	points->dx[i] = x - points->x_reference[i];
+	points->dy[i] = y - points->y_reference[i];
+
+	return( 0 );
+}
+
+/* Take points from the shared counter until they run out or something fails.
+ */
+static void *
+chkpair_work( void *a )
+{
+	ChkpairWorker *worker = (ChkpairWorker *) a;
+	Chkpair *chkpair = worker->chkpair;
+	const int size = 2 * chkpair->points->halfcorsize + 1;
+
+	/* Regions must be made in the thread that uses them.
+	 */
+	worker->rreg = vips_region_new( chkpair->ref );
+	worker->sreg = vips_region_new( chkpair->sec );
+	worker->window = VIPS_ARRAY( NULL, size * size, double );
+
+	if( !worker->window )
+		g_atomic_int_set( &chkpair->error, 1 );
+
+	while( !g_atomic_int_get( &chkpair->error ) ) {
+		int i = g_atomic_int_add( &chkpair->next, 1 );
+
+		if( i >= chkpair->points->nopoints )
+			break;
+
+		if( chkpair_point( worker, i ) )
+			g_atomic_int_set( &chkpair->error, 1 );
+	}
+
+	VIPS_FREE( worker->window );
+	VIPS_UNREF( worker->rreg );
+	VIPS_UNREF( worker->sreg );
+
+	return( NULL );
+}
+
+int
+im__chkpair( IMAGE *ref, IMAGE *sec, TIE_POINTS *points )
+{
+	Chkpair chkpair;
+	ChkpairWorker *worker;
+	int n_workers;
+	int i;
+
 	/* Check images.
 	 */
 	if( im_incheck( ref ) || im_incheck( sec ) ) 
@@ -206,29 +481,69 @@ im__chkpair( IMAGE *ref, IMAGE *sec, TIE_POINTS *points )
 		return( -1 );
 	}
 
-	for( i = 0; i < points->nopoints; i++ ) {
-		/* Find correlation point.
-		 */
-		if( im_correl( ref, sec, 
-			points->x_reference[i], points->y_reference[i],
-			points->x_reference[i], points->y_reference[i],
-			hcor, harea, 
-			&correlation, &x, &y ) ) 
-			return( -1 );
+	chkpair.ref = ref;
+	chkpair.sec = sec;
+	chkpair.points = points;
+	chkpair.next = 0;
+	chkpair.error = 0;
 
-		/* And note in x_secondary.
-		 */
-		points->x_secondary[i] = x;
-		points->y_secondary[i] = y;
-		points->correlation[i] = correlation;
+	/* Points are independent, so search them in parallel. Each worker
+	 * has its own regions on ref and sec.
+	 */
+	n_workers = VIPS_CLIP( 1, vips_concurrency_get(), points->nopoints );
+	if( !(worker = VIPS_ARRAY( NULL, n_workers, ChkpairWorker )) )
+		return( -1 );
+	memset( worker, 0, n_workers * sizeof( ChkpairWorker ) );
+	for( i = 0; i < n_workers; i++ )
+		worker[i].chkpair = &chkpair;
+
+	if( n_workers == 1 )
+		(void) chkpair_work( &worker[0] );
+	else {
+		for( i = 0; i < n_workers; i++ )
+			if( !(worker[i].thread = vips_g_thread_new( "chkpair",
+				chkpair_work, &worker[i] )) ) {
+				g_atomic_int_set( &chkpair.error, 1 );
+				break;
+			}
 
-		/* Note each dx, dy too.
-		 */
-		points->dx[i] = 
-			points->x_secondary[i] - points->x_reference[i];
-		points->dy[i] = 
-			points->y_secondary[i] - points->y_reference[i];
+		for( i = 0; i < n_workers; i++ )
+			if( worker[i].thread )
+				(void) vips_g_thread_join( worker[i].thread );
 	}
 
+	g_free( worker );
+
+	if( chkpair.error )
+		return( -1 );
+
+	return( 0 );
+}
+
+/* Estimate the displacement between a pair of overlaps with phase
+ * correlation and set it as the start point for im__chkpair(). The overlaps
+ * must be the same size.
+ */
+int
+im__chkpair_estimate( IMAGE *ref, IMAGE *sec, TIE_POINTS *points )
+{
+	VipsImage *in[2];
+	int pairs[2] = { 0, 1 };
+	VipsImage *t;
+	double *p;
+
+	in[0] = ref;
+	in[1] = sec;
+	if( vips_phasecor_batch( in, 2, pairs, 2, &t, NULL ) )
+		return( -1 );
+
+	/* The peak is at minus the displacement of sec.
+	 */
+	p = VIPS_MATRIX( t, 0, 0 );
+	points->deltax = -VIPS_ROUND_INT( p[0] );
+	points->deltay = -VIPS_ROUND_INT( p[1] );
+
+	g_object_unref( t );
+
 	return( 0 );
 }
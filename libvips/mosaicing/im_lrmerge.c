@@ -83,6 +83,11 @@
  * 	- match formats and bands automatically
  * 22/5/14
  * 	- wrap as a class
+ * 14/10/18
+ * 	- blend with a weight ramp per line, reused while the seam is
+ * 	  straight, and a SIMD blend kernel
+ * 	- skip the transparency test for lines with no zero elements
+ * 	- 64-bit products for int and uint blends
  */
 
 /*
@@ -175,6 +180,167 @@ im__make_blend_luts( void )
 	return( 0 );
 }
 
+/* Set the blend coefficients for pixel x to entry inx of the luts.
+ */
+void
+im__blend_set( MergeInfo *inf, void *c1, void *c2, int x, int inx )
+{
+	const int cb = inf->cb;
+
+	int b;
+
+	if( inf->isint ) {
+		int *p1 = (int *) c1 + x * cb;
+		int *p2 = (int *) c2 + x * cb;
+
+		for( b = 0; b < cb; b++ ) {
+			p1[b] = im__icoef1[inx];
+			p2[b] = im__icoef2[inx];
+		}
+	}
+	else {
+		double *p1 = (double *) c1 + x * cb;
+		double *p2 = (double *) c2 + x * cb;
+
+		for( b = 0; b < cb; b++ ) {
+			p1[b] = im__coef1[inx];
+			p2[b] = im__coef2[inx];
+		}
+	}
+}
+
+/* Is there a zero element anywhere in either line? If there isn't, there
+ * can't be any transparent pixels. This is quick, so it's worth doing before
+ * the pixel-by-pixel test.
+ */
+#define HAS_ZERO( TYPE ) { \
+	TYPE *tr = (TYPE *) r; \
+	TYPE *ts = (TYPE *) s; \
+	\
+	for( i = 0; i < ne; i++ ) \
+		zero |= (tr[i] == 0) | (ts[i] == 0); \
+}
+
+/* Patch the coefficients for transparent pixels, those with all bands zero.
+ * A transparent ref pixel takes sec, a transparent sec pixel takes ref.
+ */
+#define PATCH( TYPE ) { \
+	TYPE *tr = (TYPE *) r; \
+	TYPE *ts = (TYPE *) s; \
+	\
+	for( x = 0; x < width; x++ ) { \
+		for( b = 0; b < cb; b++ ) \
+			if( tr[b] ) \
+				break; \
+		if( b == cb ) \
+			im__blend_set( inf, c1, c2, x, BLEND_SEC ); \
+		else { \
+			for( b = 0; b < cb; b++ ) \
+				if( ts[b] ) \
+					break; \
+			if( b == cb ) \
+				im__blend_set( inf, c1, c2, x, BLEND_REF ); \
+		} \
+		\
+		tr += cb; \
+		ts += cb; \
+	} \
+}
+
+/* Blend elements with the coefficients. UINT and INT need 64-bit
+ * products.
+ */
+#define IBLEND( TYPE, ITYPE ) { \
+	TYPE *tr = (TYPE *) r; \
+	TYPE *ts = (TYPE *) s; \
+	TYPE *tq = (TYPE *) q; \
+	int *i1 = (int *) c1; \
+	int *i2 = (int *) c2; \
+	\
+	for( i = 0; i < ne; i++ ) \
+		tq[i] = (ITYPE) i1[i] * tr[i] / BLEND_SCALE + \
+			(ITYPE) i2[i] * ts[i] / BLEND_SCALE; \
+}
+
+/* Zero coefficients select, so we copy exactly, even for inf or nan.
+ */
+#define FBLEND( TYPE ) { \
+	TYPE *tr = (TYPE *) r; \
+	TYPE *ts = (TYPE *) s; \
+	TYPE *tq = (TYPE *) q; \
+	double *f1 = (double *) c1; \
+	double *f2 = (double *) c2; \
+	\
+	for( i = 0; i < ne; i++ ) \
+		if( f2[i] == 0.0 ) \
+			tq[i] = tr[i]; \
+		else if( f1[i] == 0.0 ) \
+			tq[i] = ts[i]; \
+		else \
+			tq[i] = f1[i] * tr[i] + f2[i] * ts[i]; \
+}
+
+/* Switch on the blend format. These are the real formats, complex and
+ * LABQ have been mapped to float or double.
+ */
+#define SWITCH( I, F ) \
+	switch( inf->format ) { \
+	case IM_BANDFMT_UCHAR: 	I( unsigned char, int ); break; \
+	case IM_BANDFMT_CHAR: 	I( signed char, int ); break; \
+	case IM_BANDFMT_USHORT: I( unsigned short, int ); break; \
+	case IM_BANDFMT_SHORT: 	I( signed short, int ); break; \
+	case IM_BANDFMT_UINT: 	I( unsigned int, gint64 ); break; \
+	case IM_BANDFMT_INT: 	I( signed int, gint64 ); break; \
+	case IM_BANDFMT_FLOAT: 	F( float ); break; \
+	case IM_BANDFMT_DOUBLE:	F( double ); break; \
+	\
+	default: \
+		g_assert_not_reached(); \
+	}
+
+/* The int args are ignored, they just keep SWITCH() simple.
+ */
+#define IHAS_ZERO( TYPE, ITYPE ) HAS_ZERO( TYPE )
+#define IPATCH( TYPE, ITYPE ) PATCH( TYPE )
+
+/* Blend a line of width pixels using the ramp in inf, patching it for any
+ * transparent pixels first.
+ */
+void
+im__blend_ramp_line( MergeInfo *inf,
+	VipsPel *q, VipsPel *r, VipsPel *s, int width )
+{
+	const int cb = inf->cb;
+	const int ne = width * cb;
+	const size_t size = (size_t) ne *
+		(inf->isint ? sizeof( int ) : sizeof( double ));
+
+	void *c1;
+	void *c2;
+	int zero;
+	int i, x, b;
+
+	zero = 0;
+	SWITCH( IHAS_ZERO, HAS_ZERO );
+
+	c1 = inf->ramp1;
+	c2 = inf->ramp2;
+	if( zero ) {
+		memcpy( inf->coef1, c1, size );
+		memcpy( inf->coef2, c2, size );
+		c1 = inf->coef1;
+		c2 = inf->coef2;
+
+		SWITCH( IPATCH, PATCH );
+	}
+
+	if( inf->blend_fn )
+		inf->blend_fn( q, r, s, ne, c1, c2 );
+	else {
+		SWITCH( IBLEND, FBLEND );
+	}
+}
+
 /* Return the position of the first non-zero pel from the left.
  */
 static int
@@ -385,150 +551,36 @@ make_firstlast( MergeInfo *inf, Overlapping *ovlap, Rect *oreg )
 	return( 0 );
 }
 
-/* Test pixel == 0.
+/* Build the ramp for a line of blend area, unless we already have it.
  */
-#define TEST_ZERO( TYPE, T, RESULT ) { \
-	TYPE *tt = (T); \
-	int ii; \
-	\
-	for( ii = 0; ii < cb; ii++ ) \
-		if( tt[i + ii] ) \
-			break; \
-	if( ii == cb )  \
-		(RESULT) = 1; \
-}
+static void
+lr_ramp( MergeInfo *inf, Rect *oreg, int first, int last )
+{
+	const int offset = first - oreg->left;
+	const int bwidth = last - first;
+	const int left = IM_CLIP( 0, offset, oreg->width );
+	const int right = IM_CLIP( left, last - oreg->left, oreg->width );
 
-/* Blend two integer images.
- */
-#define iblend( TYPE, B, IN1, IN2, OUT ) { \
-	TYPE *tr = (TYPE *) (IN1); \
-	TYPE *ts = (TYPE *) (IN2); \
-	TYPE *tq = (TYPE *) (OUT); \
-	const int cb = (B); \
-	const int left = IM_CLIP( 0, first - oreg->left, oreg->width ); \
-	const int right = IM_CLIP( left, last - oreg->left, oreg->width ); \
-	int ref_zero; \
-	int sec_zero; \
-	int x, b; \
-	int i; \
-	\
-	/* Left of the blend area. \
-	 */ \
-	for( i = 0, x = 0; x < left; x++ ) { \
-		ref_zero = 0; \
-		TEST_ZERO( TYPE, tr, ref_zero ); \
-		if( !ref_zero ) \
-			for( b = 0; b < cb; b++, i++ ) \
-				tq[i] = tr[i]; \
-		else \
-			for( b = 0; b < cb; b++, i++ ) \
-				tq[i] = ts[i]; \
-	} \
-	\
-	/* In blend area. \
-	 */ \
-	for( x = left; x < right; x++ ) { \
-		ref_zero = 0; \
-		sec_zero = 0; \
-		TEST_ZERO( TYPE, tr, ref_zero ); \
-		TEST_ZERO( TYPE, ts, sec_zero ); \
-		\
-		if( !ref_zero && !sec_zero ) { \
-			int inx = ((x + oreg->left - first) <<  \
-				BLEND_SHIFT) / bwidth; \
-			int c1 = im__icoef1[inx]; \
-			int c2 = im__icoef2[inx]; \
-			\
-			for( b = 0; b < cb; b++, i++ ) \
-				tq[i] = c1 * tr[i] / BLEND_SCALE + \
-					c2 * ts[i] / BLEND_SCALE; \
-		} \
-		else if( !ref_zero ) \
-			for( b = 0; b < cb; b++, i++ ) \
-				tq[i] = tr[i]; \
-		else \
-			for( b = 0; b < cb; b++, i++ ) \
-				tq[i] = ts[i]; \
-	} \
-	\
-	/* Right of blend.
-	 */ \
-	for( x = right; x < oreg->width; x++ ) { \
-		sec_zero = 0; \
-		TEST_ZERO( TYPE, ts, sec_zero ); \
-		if( !sec_zero ) \
-			for( b = 0; b < cb; b++, i++ )  \
-				tq[i] = ts[i]; \
-		else \
-			for( b = 0; b < cb; b++, i++ )  \
-				tq[i] = tr[i]; \
-	} \
-}
+	int x;
 
-/* Blend two float images.
- */
-#define fblend( TYPE, B, IN1, IN2, OUT ) { \
-	TYPE *tr = (TYPE *) (IN1); \
-	TYPE *ts = (TYPE *) (IN2); \
-	TYPE *tq = (TYPE *) (OUT); \
-	const int cb = (B); \
-	const int left = IM_CLIP( 0, first - oreg->left, oreg->width ); \
-	const int right = IM_CLIP( left, last - oreg->left, oreg->width ); \
-	int ref_zero; \
-	int sec_zero; \
-	int x, b; \
-	int i; \
-	\
-	/* Left of the blend area. \
-	 */ \
-	for( i = 0, x = 0; x < left; x++ ) { \
-		ref_zero = 0; \
-		TEST_ZERO( TYPE, tr, ref_zero ); \
-		if( !ref_zero ) \
-			for( b = 0; b < cb; b++, i++ ) \
-				tq[i] = tr[i]; \
-		else \
-			for( b = 0; b < cb; b++, i++ ) \
-				tq[i] = ts[i]; \
-	} \
-	\
-	/* In blend area. \
-	 */ \
-	for( x = left; x < right; x++ ) { \
-		ref_zero = 0; \
-		sec_zero = 0; \
-		TEST_ZERO( TYPE, tr, ref_zero ); \
-		TEST_ZERO( TYPE, ts, sec_zero ); \
-		\
-		if( !ref_zero && !sec_zero ) { \
-			int inx = ((x + oreg->left - first) <<  \
-				BLEND_SHIFT) / bwidth; \
-			double c1 = im__coef1[inx];  \
-			double c2 = im__coef2[inx];  \
-			\
-			for( b = 0; b < cb; b++, i++ ) \
-				tq[i] = c1 * tr[i] + c2 * ts[i]; \
-		} \
-		else if( !ref_zero ) \
-			for( b = 0; b < cb; b++, i++ ) \
-				tq[i] = tr[i]; \
-		else \
-			for( b = 0; b < cb; b++, i++ ) \
-				tq[i] = ts[i]; \
-	} \
-	\
-	/* Right of blend.
-	 */ \
-	for( x = right; x < oreg->width; x++ ) { \
-		sec_zero = 0; \
-		TEST_ZERO( TYPE, ts, sec_zero ); \
-		if( !sec_zero ) \
-			for( b = 0; b < cb; b++, i++ )  \
-				tq[i] = ts[i]; \
-		else \
-			for( b = 0; b < cb; b++, i++ )  \
-				tq[i] = tr[i]; \
-	} \
+	if( inf->ramp_offset == offset &&
+		inf->ramp_bwidth == bwidth &&
+		inf->ramp_width == oreg->width )
+		return;
+
+	/* Left of the blend area is ref, right is sec.
+	 */
+	for( x = 0; x < left; x++ )
+		im__blend_set( inf, inf->ramp1, inf->ramp2, x, BLEND_REF );
+	for( x = left; x < right; x++ )
+		im__blend_set( inf, inf->ramp1, inf->ramp2, x,
+			((x - offset) << BLEND_SHIFT) / bwidth );
+	for( x = right; x < oreg->width; x++ )
+		im__blend_set( inf, inf->ramp1, inf->ramp2, x, BLEND_SEC );
+
+	inf->ramp_offset = offset;
+	inf->ramp_bwidth = bwidth;
+	inf->ramp_width = oreg->width;
 }
 
 /* Left-right blend function for non-labpack images.
@@ -538,7 +590,6 @@ lr_blend( REGION *or, MergeInfo *inf, Overlapping *ovlap, Rect *oreg )
 {
 	REGION *rir = inf->rir;
 	REGION *sir = inf->sir;
-	IMAGE *im = or->im;
 
 	Rect prr, psr;
 	int y, yr, ys;
@@ -576,36 +627,9 @@ lr_blend( REGION *or, MergeInfo *inf, Overlapping *ovlap, Rect *oreg )
 		VipsPel *q = IM_REGION_ADDR( or, oreg->left, y );
 
 		const int j = y - ovlap->overlap.top;
-		const int first = ovlap->first[j];
-		const int last = ovlap->last[j];
-		const int bwidth = last - first;
-
-		switch( im->BandFmt ) {
-		case IM_BANDFMT_UCHAR: 	
-			iblend( unsigned char, im->Bands, pr, ps, q ); break; 
-		case IM_BANDFMT_CHAR: 	
-			iblend( signed char, im->Bands, pr, ps, q ); break; 
-		case IM_BANDFMT_USHORT: 
-			iblend( unsigned short, im->Bands, pr, ps, q ); break; 
-		case IM_BANDFMT_SHORT: 	
-			iblend( signed short, im->Bands, pr, ps, q ); break; 
-		case IM_BANDFMT_UINT: 	
-			iblend( unsigned int, im->Bands, pr, ps, q ); break; 
-		case IM_BANDFMT_INT: 	
-			iblend( signed int, im->Bands, pr, ps, q );  break; 
-		case IM_BANDFMT_FLOAT: 	
-			fblend( float, im->Bands, pr, ps, q ); break; 
-		case IM_BANDFMT_DOUBLE:	
-			fblend( double, im->Bands, pr, ps, q ); break; 
-		case IM_BANDFMT_COMPLEX:
-			fblend( float, im->Bands*2, pr, ps, q ); break; 
-		case IM_BANDFMT_DPCOMPLEX:
-			fblend( double, im->Bands*2, pr, ps, q ); break;
-
-		default:
-			im_error( "im_lrmerge", "%s", _( "internal error" ) );
-			return( -1 );
-		}
+
+		lr_ramp( inf, oreg, ovlap->first[j], ovlap->last[j] );
+		im__blend_ramp_line( inf, q, pr, ps, oreg->width );
 	}
 
 	return( 0 );
@@ -655,9 +679,6 @@ lr_blend_labpack( REGION *or, MergeInfo *inf, Overlapping *ovlap, Rect *oreg )
 		VipsPel *q = IM_REGION_ADDR( or, oreg->left, y );
 
 		const int j = y - ovlap->overlap.top;
-		const int first = ovlap->first[j];
-		const int last = ovlap->last[j];
-		const int bwidth = last - first;
 
 		float *fq = inf->merge;
 		float *r = inf->from1;
@@ -670,7 +691,10 @@ lr_blend_labpack( REGION *or, MergeInfo *inf, Overlapping *ovlap, Rect *oreg )
 
 		/* Blend as floats.
 		 */
-		fblend( float, 3, r, s, fq ); 
+		lr_ramp( inf, oreg, ovlap->first[j], ovlap->last[j] );
+		im__blend_ramp_line( inf,
+			(VipsPel *) fq, (VipsPel *) r, (VipsPel *) s,
+			oreg->width );
 
 		/* Re-pack to output buffer.
 		 */
@@ -982,6 +1006,10 @@ im__stop_merge( void *seq, void *a, void *b )
 		im_free( inf->merge );
 		inf->merge = NULL;
 	}
+	VIPS_FREE( inf->ramp1 );
+	VIPS_FREE( inf->ramp2 );
+	VIPS_FREE( inf->coef1 );
+	VIPS_FREE( inf->coef2 );
 	im_free( inf );
 
 	return( 0 );
@@ -994,6 +1022,7 @@ im__start_merge( IMAGE *out, void *a, void *b )
 {
 	Overlapping *ovlap = (Overlapping *) a;
 	MergeInfo *inf;
+	size_t size;
 
 	if( !(inf = IM_NEW( NULL, MergeInfo )) )
 		return( NULL );
@@ -1003,6 +1032,49 @@ im__start_merge( IMAGE *out, void *a, void *b )
 	inf->from1 = NULL;
 	inf->from2 = NULL;
 	inf->merge = NULL;
+	inf->ramp1 = NULL;
+	inf->ramp2 = NULL;
+	inf->coef1 = NULL;
+	inf->coef2 = NULL;
+	inf->ramp_offset = -1;
+	inf->ramp_bwidth = -1;
+	inf->ramp_width = -1;
+
+	/* The format we blend in.
+	 */
+	if( out->Coding == IM_CODING_LABQ ) {
+		inf->format = IM_BANDFMT_FLOAT;
+		inf->cb = 3;
+	}
+	else if( out->BandFmt == IM_BANDFMT_COMPLEX ) {
+		inf->format = IM_BANDFMT_FLOAT;
+		inf->cb = out->Bands * 2;
+	}
+	else if( out->BandFmt == IM_BANDFMT_DPCOMPLEX ) {
+		inf->format = IM_BANDFMT_DOUBLE;
+		inf->cb = out->Bands * 2;
+	}
+	else {
+		inf->format = out->BandFmt;
+		inf->cb = out->Bands;
+	}
+	inf->isint = vips_band_format_isint( inf->format );
+	inf->blend_fn = (VipsSimdBlendFn)
+		vips_simd_get( VIPS_SIMD_BLEND, inf->format );
+
+	size = (size_t) ovlap->blsize * inf->cb *
+		(inf->isint ? sizeof( int ) : sizeof( double ));
+	inf->ramp1 = vips_malloc( NULL, size );
+	inf->ramp2 = vips_malloc( NULL, size );
+	inf->coef1 = vips_malloc( NULL, size );
+	inf->coef2 = vips_malloc( NULL, size );
+	if( !inf->ramp1 ||
+		!inf->ramp2 ||
+		!inf->coef1 ||
+		!inf->coef2 ) {
+		im__stop_merge( inf, NULL, NULL );
+		return( NULL );
+	}
 
 	/* If this is going to be a IM_CODING_LABQ, we need IM_CODING_LABQ 
 	 * blend buffers.
@@ -6,6 +6,8 @@
  *	- detect size change
  * 10/4/06
  * 	- spot file-not-found
+ * 14/10/18
+ * 	- transform_fn now gets the image and returns a new ref
  */
 
 /*
@@ -74,21 +76,14 @@ typedef VipsOperationClass VipsRemosaicClass;
 G_DEFINE_TYPE( VipsRemosaic, vips_remosaic, VIPS_TYPE_OPERATION );
 
 static IMAGE *
-remosaic_fn( JoinNode *node, VipsRemosaic *remosaic )
+remosaic_fn( JoinNode *node, IMAGE *im, VipsRemosaic *remosaic )
 {
 	SymbolTable *st = node->st;
-	IMAGE *im = node->im;
 
 	IMAGE *out;
 	char filename[FILENAME_MAX];
 	char *p;
 
-	if( !im ) {
-		im_error( "im_remosaic", _( "file \"%s\" not found" ), 
-			node->name );
-		return( NULL );
-	}
-
 	/* Remove substring remosaic->old_str from in->filename, replace with
 	 * remosaic->new_str.
 	 */
@@ -115,6 +110,7 @@ remosaic_fn( JoinNode *node, VipsRemosaic *remosaic )
 			_( "substitute image \"%s\" is not "
 				"the same size as \"%s\"" ), 
 			filename, im->filename );
+		g_object_unref( out );
 		return( NULL );
 	}
 
@@ -212,6 +208,8 @@ vips_remosaic_init( VipsRemosaic *remosaic )
  * It's convenient for multispectral images. You can mosaic one band, then
  * use that mosaic as a template for mosaicing the others automatically.
  *
+ * Large mosaics are rebuilt as vips_globalbalance() does, see there.
+ *
  * See also: vips_globalbalance().
  *
  * Returns: 0 on success, -1 on error
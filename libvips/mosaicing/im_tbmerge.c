@@ -71,6 +71,9 @@
  * 24/1/11
  * 	- gtk-doc
  * 	- match formats and bands automatically
+ * 14/10/18
+ * 	- blend with a per-line weight ramp and a SIMD blend kernel
+ * 	- float blend took ref above the seam even when ref was transparent
  */
 
 /*
@@ -328,138 +331,38 @@ make_firstlast( MergeInfo *inf, Overlapping *ovlap, Rect *oreg )
 	return( 0 );
 }
 
-/* Test pixel == 0.
+/* Build the ramp for line y of the blend area. Each column has its own
+ * seam.
  */
-#define TEST_ZERO( TYPE, T, RESULT ) { \
-	TYPE *tt = (T); \
-	int ii; \
-	\
-	for( ii = 0; ii < cb; ii++ ) \
-		if( tt[i + ii] ) \
-			break; \
-	if( ii == cb )  \
-		(RESULT) = 1; \
-}
+static void
+tb_ramp( MergeInfo *inf, Rect *oreg, const int *first, const int *last,
+	int y )
+{
+	int x;
 
-/* Blend two integer images ... one scan-line.
- */
-#define iblend( TYPE, B, IN1, IN2, OUT ) { \
-	TYPE *tr = (TYPE *) (IN1); \
-	TYPE *ts = (TYPE *) (IN2); \
-	TYPE *tq = (TYPE *) (OUT); \
-	const int cb = (B); \
-	int ref_zero; \
-	int sec_zero; \
-	int x, b; \
-	int i; \
-	\
-	for( i = 0, x = 0; x < oreg->width; x++ ) { \
-		ref_zero = 0; \
-		sec_zero = 0; \
-		TEST_ZERO( TYPE, tr, ref_zero ); \
-		TEST_ZERO( TYPE, ts, sec_zero ); \
-		\
-		/* Above the bottom image? \
-		 */ \
-		if( y < first[x] ) { \
-			if( !ref_zero ) \
-				for( b = 0; b < cb; b++, i++ )  \
-					tq[i] = tr[i]; \
-			else \
-				for( b = 0; b < cb; b++, i++ )  \
-					tq[i] = ts[i]; \
-		} \
-		/* To the right? \
-		 */ \
-		else if( y >= last[x] ) { \
-			if( !sec_zero ) \
-				for( b = 0; b < cb; b++, i++ )  \
-					tq[i] = ts[i]; \
-			else \
-				for( b = 0; b < cb; b++, i++ )  \
-					tq[i] = tr[i]; \
-		} \
-		/* In blend area. \
-		 */ \
-		else { \
-			if( !ref_zero && !sec_zero ) { \
-				const int bheight = last[x] - first[x]; \
-				const int inx = ((y - first[x]) << \
-					BLEND_SHIFT) / bheight; \
-				int c1 = im__icoef1[inx];  \
-				int c2 = im__icoef2[inx];  \
-				\
-				for( b = 0; b < cb; b++, i++ ) \
-					tq[i] = c1*tr[i] / BLEND_SCALE + \
-						c2*ts[i] / BLEND_SCALE; \
-			} \
-			else if( !ref_zero ) \
-				for( b = 0; b < cb; b++, i++ )  \
-					tq[i] = tr[i]; \
-			else \
-				for( b = 0; b < cb; b++, i++ )  \
-					tq[i] = ts[i]; \
-		}  \
-	} \
-}
+	for( x = 0; x < oreg->width; x++ ) {
+		int inx;
 
-/* Blend two float images.
- */
-#define fblend( TYPE, B, IN1, IN2, OUT ) { \
-	TYPE *tr = (TYPE *) (IN1); \
-	TYPE *ts = (TYPE *) (IN2); \
-	TYPE *tq = (TYPE *) (OUT); \
-	int ref_zero; \
-	int sec_zero; \
-	const int cb = (B); \
-	int x, b; \
-	int i; \
-	\
-	for( i = 0, x = 0; x < oreg->width; x++ ) { \
-		ref_zero = 0; \
-		sec_zero = 0; \
-		TEST_ZERO( TYPE, tr, ref_zero ); \
-		TEST_ZERO( TYPE, ts, sec_zero ); \
-		\
-		/* Above the bottom image? \
-		 */ \
-		if( y < first[x] )  \
-			if( !ref_zero ) \
-				for( b = 0; b < cb; b++, i++ )  \
-					tq[i] = tr[i]; \
-			else \
-				for( b = 0; b < cb; b++, i++ )  \
-					tq[i] = tr[i]; \
-		/* To the right? \
-		 */ \
-		else if( y >= last[x] )  \
-			if( !sec_zero ) \
-				for( b = 0; b < cb; b++, i++ )  \
-					tq[i] = ts[i]; \
-			else \
-				for( b = 0; b < cb; b++, i++ )  \
-					tq[i] = tr[i]; \
-		/* In blend area. \
-		 */ \
-		else { \
-			if( !ref_zero && !sec_zero ) { \
-				const int bheight = last[x] - first[x]; \
-				const int inx = ((y - first[x]) << \
-					BLEND_SHIFT) / bheight; \
-				double c1 = im__coef1[inx];  \
-				double c2 = im__coef2[inx];  \
-				\
-				for( b = 0; b < cb; b++, i++ ) \
-					tq[i] = c1 * tr[i] + c2 * ts[i]; \
-			} \
-			else if( !ref_zero ) \
-				for( b = 0; b < cb; b++, i++ )  \
-					tq[i] = tr[i]; \
-			else \
-				for( b = 0; b < cb; b++, i++ )  \
-					tq[i] = ts[i]; \
-		}  \
-	} \
+		/* Above the bottom image?
+		 */
+		if( y < first[x] )
+			inx = BLEND_REF;
+		/* To the right?
+		 */
+		else if( y >= last[x] )
+			inx = BLEND_SEC;
+		/* In blend area.
+		 */
+		else
+			inx = ((y - first[x]) << BLEND_SHIFT) /
+				(last[x] - first[x]);
+
+		im__blend_set( inf, inf->ramp1, inf->ramp2, x, inx );
+	}
+
+	/* Not reusable by lr_ramp().
+	 */
+	inf->ramp_width = -1;
 }
 
 /* Top-bottom blend function for non-labpack images.
@@ -469,7 +372,6 @@ tb_blend( REGION *or, MergeInfo *inf, Overlapping *ovlap, Rect *oreg )
 {
 	REGION *rir = inf->rir;
 	REGION *sir = inf->sir;
-	IMAGE *im = or->im;
 
 	Rect prr, psr;
 	int y, yr, ys;
@@ -510,32 +412,8 @@ tb_blend( REGION *or, MergeInfo *inf, Overlapping *ovlap, Rect *oreg )
 		const int *first = ovlap->first + j;
 		const int *last = ovlap->last + j;
 
-		switch( im->BandFmt ) {
-		case IM_BANDFMT_UCHAR: 	
-			iblend( unsigned char, im->Bands, pr, ps, q ); break; 
-		case IM_BANDFMT_CHAR: 	
-			iblend( signed char, im->Bands, pr, ps, q ); break; 
-		case IM_BANDFMT_USHORT: 
-			iblend( unsigned short, im->Bands, pr, ps, q ); break; 
-		case IM_BANDFMT_SHORT: 	
-			iblend( signed short, im->Bands, pr, ps, q ); break; 
-		case IM_BANDFMT_UINT: 	
-			iblend( unsigned int, im->Bands, pr, ps, q ); break; 
-		case IM_BANDFMT_INT: 	
-			iblend( signed int, im->Bands, pr, ps, q );  break; 
-		case IM_BANDFMT_FLOAT: 	
-			fblend( float, im->Bands, pr, ps, q ); break; 
-		case IM_BANDFMT_DOUBLE:	
-			fblend( double, im->Bands, pr, ps, q ); break; 
-		case IM_BANDFMT_COMPLEX:
-			fblend( float, im->Bands*2, pr, ps, q ); break; 
-		case IM_BANDFMT_DPCOMPLEX:
-			fblend( double, im->Bands*2, pr, ps, q ); break;
-
-		default:
-			im_error( "im_tbmerge", "%s", _( "internal error" ) );
-			return( -1 );
-		}
+		tb_ramp( inf, oreg, first, last, y );
+		im__blend_ramp_line( inf, q, pr, ps, oreg->width );
 	}
 
 	return( 0 );
@@ -599,7 +477,10 @@ tb_blend_labpack( REGION *or, MergeInfo *inf, Overlapping *ovlap, Rect *oreg )
 
 		/* Blend as floats.
 		 */
-		fblend( float, 3, r, s, fq ); 
+		tb_ramp( inf, oreg, first, last, y );
+		im__blend_ramp_line( inf,
+			(VipsPel *) fq, (VipsPel *) r, (VipsPel *) s,
+			oreg->width );
 
 		/* Re-pack to output buffer.
 		 */
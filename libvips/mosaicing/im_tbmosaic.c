@@ -25,6 +25,8 @@
  * 	- remove balance stuff
  * 	- any mix of types and bands
  * 	- cleanups
+ * 14/10/18
+ * 	- add im__find_tboverlap_search() with a phasecor start estimate
  */
 
 /*
@@ -67,11 +69,15 @@
 
 #include "pmosaicing.h"
 
+/* With @phasecor, find the initial displacement by phase correlation of the
+ * overlaps, rather than trusting the tie-point, so the search still works
+ * when the tie-point is further off than @halfarea.
+ */
 int 
-im__find_tboverlap( IMAGE *ref_in, IMAGE *sec_in, IMAGE *out,
+im__find_tboverlap_search( IMAGE *ref_in, IMAGE *sec_in, IMAGE *out,
 	int bandno_in, 
 	int xref, int yref, int xsec, int ysec, 
-	int halfcorrelation, int halfarea,
+	int halfcorrelation, int halfarea, gboolean phasecor,
 	int *dx0, int *dy0,
 	double *scale1, double *angle1, double *dx1, double *dy1 )
 {
@@ -171,6 +177,12 @@ im__find_tboverlap( IMAGE *ref_in, IMAGE *sec_in, IMAGE *out,
 		p_points->deviation[i] = 0.0;
 	}
 
+	/* Start the search from the phase correlation peak.
+	 */
+	if( phasecor &&
+		im__chkpair_estimate( ref, sec, p_points ) )
+		return( -1 );
+
 	/* Search ref for possible tie-points. Sets: p_points->contrast, 
 	 * p_points->x,y_reference.
  	 */
@@ -214,6 +226,22 @@ im__find_tboverlap( IMAGE *ref_in, IMAGE *sec_in, IMAGE *out,
 	return( 0 );
 }
 
+int
+im__find_tboverlap( IMAGE *ref_in, IMAGE *sec_in, IMAGE *out,
+	int bandno_in,
+	int xref, int yref, int xsec, int ysec,
+	int halfcorrelation, int halfarea,
+	int *dx0, int *dy0,
+	double *scale1, double *angle1, double *dx1, double *dy1 )
+{
+	return( im__find_tboverlap_search( ref_in, sec_in, out,
+		bandno_in,
+		xref, yref, xsec, ysec,
+		halfcorrelation, halfarea, FALSE,
+		dx0, dy0,
+		scale1, angle1, dx1, dy1 ) );
+}
+
 int 
 im_tbmosaic( IMAGE *ref, IMAGE *sec, IMAGE *out, 
 	int bandno,
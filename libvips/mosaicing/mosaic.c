@@ -2,6 +2,8 @@
  *
  * 22/5/14
  * 	- from vips_mosaic()
+ * 14/10/18
+ * 	- add "phasecor"
  */
 
 /*
@@ -62,6 +64,7 @@ typedef struct {
 	int bandno;
 	int hwindow;
 	int harea;
+	gboolean phasecor;
 	int dx0;
 	int dy0;
 	double scale1;
@@ -100,10 +103,10 @@ vips_mosaic_build( VipsObject *object )
 
 	switch( mosaic->direction ) { 
 	case VIPS_DIRECTION_HORIZONTAL:
-		if( im__find_lroverlap( mosaic->ref, mosaic->sec, x,
+		if( im__find_lroverlap_search( mosaic->ref, mosaic->sec, x,
 			mosaic->bandno, 
 			mosaic->xref, mosaic->yref, mosaic->xsec, mosaic->ysec,
-			mosaic->hwindow, mosaic->harea, 
+			mosaic->hwindow, mosaic->harea, mosaic->phasecor,
 			&dx0, &dy0,
 			&scale1, &angle1, 
 			&dx1, &dy1 ) ) {
@@ -114,10 +117,10 @@ vips_mosaic_build( VipsObject *object )
 		break;
 
 	case VIPS_DIRECTION_VERTICAL:
-		if( im__find_tboverlap( mosaic->ref, mosaic->sec, x,
+		if( im__find_tboverlap_search( mosaic->ref, mosaic->sec, x,
 			mosaic->bandno, 
 			mosaic->xref, mosaic->yref, mosaic->xsec, mosaic->ysec,
-			mosaic->hwindow, mosaic->harea, 
+			mosaic->hwindow, mosaic->harea, mosaic->phasecor,
 			&dx0, &dy0,
 			&scale1, &angle1, 
 			&dx1, &dy1 ) ) {
@@ -299,6 +302,13 @@ vips_mosaic_class_init( VipsMosaicClass *class )
 		G_STRUCT_OFFSET( VipsMosaic, dy1 ),
 		-10000000.0, 10000000.0, 0.0 );
 
+	VIPS_ARG_BOOL( class, "phasecor", 18,
+		_( "Phase correlation" ),
+		_( "Find the initial offset with phase correlation" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsMosaic, phasecor ),
+		FALSE );
+
 }
 
 static void
@@ -328,6 +338,7 @@ vips_mosaic_init( VipsMosaic *mosaic )
  * * @hwindow: %gint, half window size
  * * @harea: %gint, half search size 
  * * @mblend: %gint, maximum blend size
+ * * @phasecor: %gboolean, find the initial offset with phase correlation
  *
  * This operation joins two images left-right (with @ref on the left) or
  * top-bottom (with @ref above) given an approximate overlap.
@@ -336,7 +347,13 @@ vips_mosaic_init( VipsMosaic *mosaic )
  * the pixel (@xref, @yref) in @ref. The overlap area is divided into three
  * sections, 20 high-contrast points in band @bandno of image @ref are found 
  * in each, and a window of pixels of size @hwindow around each high-contrast 
- * point is searched for in @sec over an area of @harea. 
+ * point is searched for in @sec over an area of @harea. The points are
+ * searched in parallel.
+ *
+ * Set @phasecor to find the displacement between the overlaps with
+ * vips_phasecor_batch() before the search starts. Use this when the
+ * tie-point might be more than @harea pixels out. It needs libvips to have
+ * been built with FFTW.
  *
  * A linear model is fitted to the 60 tie-points, points a long way from the
  * fit are discarded, and the model refitted until either too few points
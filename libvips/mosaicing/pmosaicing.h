@@ -36,6 +36,8 @@
 
  */
 
+#include <vips/simd.h>
+
 /* Number of entries in blend table. As a power of two as well, for >>ing.
  */
 #define BLEND_SHIFT (10)
@@ -45,6 +47,11 @@
  */
 #define BLEND_SCALE (4096)
 
+/* The lut entries which take just ref and just sec.
+ */
+#define BLEND_REF (0)
+#define BLEND_SEC (BLEND_SIZE - 1)
+
 struct _MergeInfo;
 struct _Overlapping;
 
@@ -96,6 +103,26 @@ typedef struct _MergeInfo {
 	float *from1;			/* IM_CODING_LABQ buffers */
 	float *from2;
 	float *merge;
+
+	/* We blend in this format, with cb elements per pixel. Complex
+	 * images blend as pairs of reals, LABQ as float Lab.
+	 */
+	VipsBandFormat format;
+	int cb;
+	gboolean isint;
+	VipsSimdBlendFn blend_fn;
+
+	/* Blend coefficients for a line, one per element, int for integer
+	 * formats and double otherwise. The ramp is the weighting for
+	 * opaque pixels. lr can reuse it from line to line while the
+	 * seam position stays the same. coef is the ramp with transparent
+	 * pixels patched.
+	 */
+	void *ramp1, *ramp2;
+	void *coef1, *coef2;
+	int ramp_offset;
+	int ramp_bwidth;
+	int ramp_width;
 } MergeInfo;
 
 /* Functions shared between lr and tb.
@@ -105,6 +132,9 @@ extern double *im__coef2;
 extern int *im__icoef1;
 extern int *im__icoef2;
 int im__make_blend_luts( void );
+void im__blend_set( MergeInfo *inf, void *c1, void *c2, int x, int inx );
+void im__blend_ramp_line( MergeInfo *inf,
+	VipsPel *q, VipsPel *r, VipsPel *s, int width );
 
 void im__add_mosaic_name( VipsImage *image );
 const char *im__get_mosaic_name( VipsImage *image );
@@ -167,6 +197,7 @@ typedef struct {
 } TIE_POINTS;
 
 int im__chkpair( IMAGE *, IMAGE *, TIE_POINTS *point );
+int im__chkpair_estimate( IMAGE *ref, IMAGE *sec, TIE_POINTS *points );
 int im__initialize( TIE_POINTS *points );
 int im__improve( TIE_POINTS *inpoints, TIE_POINTS *outpoints );
 int im__avgdxdy( TIE_POINTS *points, int *dx, int *dy );
@@ -188,3 +219,15 @@ int im__find_tboverlap( IMAGE *ref_in, IMAGE *sec_in, IMAGE *out,
 	int halfcorrelation, int halfarea,
 	int *dx0, int *dy0,
 	double *scale1, double *angle1, double *dx1, double *dy1 );
+int im__find_lroverlap_search( IMAGE *ref_in, IMAGE *sec_in, IMAGE *out,
+	int bandno_in,
+	int xref, int yref, int xsec, int ysec,
+	int halfcorrelation, int halfarea, gboolean phasecor,
+	int *dx0, int *dy0,
+	double *scale1, double *angle1, double *dx1, double *dy1 );
+int im__find_tboverlap_search( IMAGE *ref_in, IMAGE *sec_in, IMAGE *out,
+	int bandno_in,
+	int xref, int yref, int xsec, int ysec,
+	int halfcorrelation, int halfarea, gboolean phasecor,
+	int *dx0, int *dy0,
+	double *scale1, double *angle1, double *dx1, double *dy1 );
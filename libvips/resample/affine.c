@@ -88,6 +88,11 @@
  * 	- add "background" parameter
  * 	- better clipping means we have no jaggies on edges
  * 	- premultiply alpha 
+ * 14/10/18
+ * 	- prefetch input for the tile below
+ * 	- interpolate in spans with vips_interpolate_span()
+ * 	- cache input in tiles for rotates, resample in strips along the
+ * 	  rotated axis
  */
 
 /*
@@ -141,6 +146,14 @@
 
 #include "presample.h"
 
+/* Resample in strips this many pixels across when the input is cached.
+ */
+#define AFFINE_STRIP (16)
+
+/* The size of the input cache tiles.
+ */
+#define AFFINE_TILE (128)
+
 typedef struct _VipsAffine {
 	VipsResample parent_instance;
 
@@ -166,6 +179,11 @@ typedef struct _VipsAffine {
 	 */
 	VipsPel *ink;
 
+	/* Set if there's a tile cache on our input. We generate in strips
+	 * and try to reuse input.
+	 */
+	gboolean cached;
+
 } VipsAffine;
 
 typedef VipsResampleClass VipsAffineClass;
@@ -203,43 +221,20 @@ G_DEFINE_TYPE( VipsAffine, vips_affine, VIPS_TYPE_RESAMPLE );
  * output image, and that affinei_gen() is asked for.
  */
 
-static int
-vips_affine_gen( VipsRegion *or, void *seq, void *a, void *b, gboolean *stop )
+/* Find the area of the input image we need to make area @r of the output,
+ * in space 2.
+ */
+static void
+vips_affine_need( const VipsAffine *affine, const VipsImage *in, 
+	const VipsRect *r, VipsRect *clipped )
 {
-	VipsRegion *ir = (VipsRegion *) seq;
-	const VipsAffine *affine = (VipsAffine *) b;
-	const VipsImage *in = (VipsImage *) a;
 	const int window_size = 
 		vips_interpolate_get_window_size( affine->interpolate );
 	const int window_offset = 
 		vips_interpolate_get_window_offset( affine->interpolate );
-	const VipsInterpolateMethod interpolate = 
-		vips_interpolate_get_method( affine->interpolate );
-
-	/* Area we generate in the output image.
-	 */
-	const VipsRect *r = &or->valid;
-	const int le = r->left;
-	const int ri = VIPS_RECT_RIGHT( r );
-	const int to = r->top;
-	const int bo = VIPS_RECT_BOTTOM( r );
-
-	const VipsRect *iarea = &affine->trn.iarea;
 	const VipsRect *oarea = &affine->trn.oarea;
 
-	int ps = VIPS_IMAGE_SIZEOF_PEL( in );
-	int x, y, z;
-	
-	VipsRect image, want, need, clipped;
-
-#ifdef DEBUG_VERBOSE
-	printf( "vips_affine_gen: "
-		"generating left=%d, top=%d, width=%d, height=%d\n", 
-		r->left,
-		r->top,
-		r->width,
-		r->height );
-#endif /*DEBUG_VERBOSE*/
+	VipsRect image, want, need;
 
 	/* We are generating this chunk of the transformed image. This takes
 	 * us to space 4.
@@ -280,25 +275,40 @@ vips_affine_gen( VipsRegion *or, void *seq, void *a, void *b, gboolean *stop )
 	image.top = 0;
 	image.width = in->Xsize;
 	image.height = in->Ysize;
-	vips_rect_intersectrect( &need, &image, &clipped );
+	vips_rect_intersectrect( &need, &image, clipped );
+}
 
-#ifdef DEBUG_VERBOSE
-	printf( "vips_affine_gen: "
-		"preparing left=%d, top=%d, width=%d, height=%d\n", 
-		clipped.left,
-		clipped.top,
-		clipped.width,
-		clipped.height );
-#endif /*DEBUG_VERBOSE*/
+/* Resample output area @r from @ir, which must hold all of the input that
+ * @r needs.
+ */
+static void
+vips_affine_gen_area( const VipsAffine *affine, const VipsImage *in,
+	VipsRegion *or, VipsRegion *ir, const VipsRect *r )
+{
+	const int window_size = 
+		vips_interpolate_get_window_size( affine->interpolate );
+	const int window_offset = 
+		vips_interpolate_get_window_offset( affine->interpolate );
+	const VipsInterpolateSpanMethod interpolate_span =
+		vips_interpolate_get_span_method( affine->interpolate );
 
-	if( vips_rect_isempty( &clipped ) ) {
-		vips_region_paint_pel( or, r, affine->ink );
-		return( 0 );
-	}
-	if( vips_region_prepare( ir, &clipped ) )
-		return( -1 );
+	const int le = r->left;
+	const int ri = VIPS_RECT_RIGHT( r );
+	const int to = r->top;
+	const int bo = VIPS_RECT_BOTTOM( r );
 
-	VIPS_GATE_START( "vips_affine_gen: work" ); 
+	const VipsRect *iarea = &affine->trn.iarea;
+	const VipsRect *oarea = &affine->trn.oarea;
+
+	int ps = VIPS_IMAGE_SIZEOF_PEL( in );
+	int x, y, z;
+
+	/* Runs of in-range pixels are gathered and interpolated in one go.
+	 */
+	double span_x[MAX_SPAN];
+	double span_y[MAX_SPAN];
+	VipsPel *span_q;
+	int n;
 
 	/* Resample! x/y loop over pixels in the output image (5).
 	 */
@@ -343,6 +353,8 @@ vips_affine_gen( VipsRegion *or, void *seq, void *a, void *b, gboolean *stop )
 		iy += window_offset;
 
 		q = VIPS_REGION_ADDR( or, le, y );
+		span_q = q;
+		n = 0;
 
 		for( x = le; x < ri; x++ ) {
 			int fx, fy; 	
@@ -368,10 +380,25 @@ vips_affine_gen( VipsRegion *or, void *seq, void *a, void *b, gboolean *stop )
 					(int) iy - window_offset + 
 						window_size - 1 ) );
 
-				interpolate( affine->interpolate, 
-					q, ir, ix, iy );
+				if( n == 0 )
+					span_q = q;
+				span_x[n] = ix;
+				span_y[n] = iy;
+				n += 1;
+
+				if( n == MAX_SPAN ) {
+					interpolate_span( affine->interpolate,
+						span_q, ir, span_x, span_y, n );
+					n = 0;
+				}
 			}
 			else {
+				if( n > 0 ) {
+					interpolate_span( affine->interpolate,
+						span_q, ir, span_x, span_y, n );
+					n = 0;
+				}
+
 				/* Out of range: paint the background.
 				 */
 				for( z = 0; z < ps; z++ ) 
@@ -382,10 +409,151 @@ vips_affine_gen( VipsRegion *or, void *seq, void *a, void *b, gboolean *stop )
 			iy += ddy;
 			q += ps;
 		}
+
+		if( n > 0 )
+			interpolate_span( affine->interpolate,
+				span_q, ir, span_x, span_y, n );
 	}
+}
+
+/* Prepare the input for output area @r and resample it.
+ */
+static int
+vips_affine_gen_rect( const VipsAffine *affine, const VipsImage *in,
+	VipsRegion *or, VipsRegion *ir, const VipsRect *r )
+{
+	VipsRect clipped;
+
+	vips_affine_need( affine, in, r, &clipped );
+
+#ifdef DEBUG_VERBOSE
+	printf( "vips_affine_gen_rect: "
+		"preparing left=%d, top=%d, width=%d, height=%d\n",
+		clipped.left,
+		clipped.top,
+		clipped.width,
+		clipped.height );
+#endif /*DEBUG_VERBOSE*/
+
+	if( vips_rect_isempty( &clipped ) ) {
+		vips_region_paint_pel( or, r, affine->ink );
+		return( 0 );
+	}
+	if( vips_region_prepare( ir, &clipped ) )
+		return( -1 );
+
+	VIPS_GATE_START( "vips_affine_gen: work" );
+
+	vips_affine_gen_area( affine, in, or, ir, r );
 
 	VIPS_GATE_STOP( "vips_affine_gen: work" ); 
 
+	return( 0 );
+}
+
+/* For large rotations, the bounding box of the input under a whole output
+ * tile can be many times larger than the input we actually use. Strips of
+ * output along the rotated axis have much tighter boxes.
+ *
+ * Find the number of input pixels we'd prepare for @r with horizontal and
+ * with vertical strips. Return FALSE if doing the whole of @r in one go is
+ * close enough, or set @vertical to the better direction.
+ */
+static gboolean
+vips_affine_pick_strip( const VipsAffine *affine, const VipsImage *in,
+	const VipsRect *r, gboolean *vertical )
+{
+	VipsRect strip, need;
+	double whole, hcost, vcost;
+
+	vips_affine_need( affine, in, r, &need );
+	whole = (double) need.width * need.height;
+
+	strip = *r;
+	strip.height = VIPS_MIN( AFFINE_STRIP, r->height );
+	vips_affine_need( affine, in, &strip, &need );
+	hcost = (double) need.width * need.height *
+		VIPS_ROUND_UP( r->height, AFFINE_STRIP ) / AFFINE_STRIP;
+
+	strip = *r;
+	strip.width = VIPS_MIN( AFFINE_STRIP, r->width );
+	vips_affine_need( affine, in, &strip, &need );
+	vcost = (double) need.width * need.height *
+		VIPS_ROUND_UP( r->width, AFFINE_STRIP ) / AFFINE_STRIP;
+
+	if( 2 * VIPS_MIN( hcost, vcost ) > whole )
+		return( FALSE );
+
+	*vertical = vcost < hcost;
+
+	return( TRUE );
+}
+
+static int
+vips_affine_gen( VipsRegion *or, void *seq, void *a, void *b, gboolean *stop )
+{
+	VipsRegion *ir = (VipsRegion *) seq;
+	const VipsAffine *affine = (VipsAffine *) b;
+	const VipsImage *in = (VipsImage *) a;
+
+	/* Area we generate in the output image.
+	 */
+	const VipsRect *r = &or->valid;
+
+	VipsRect next;
+	gboolean vertical;
+
+#ifdef DEBUG_VERBOSE
+	printf( "vips_affine_gen: "
+		"generating left=%d, top=%d, width=%d, height=%d\n",
+		r->left,
+		r->top,
+		r->width,
+		r->height );
+#endif /*DEBUG_VERBOSE*/
+
+	/* Other threads are probably working on the rest of this row of
+	 * tiles, so the next new input is likely to be under this tile.
+	 * Give the source a chance to start reading it.
+	 */
+	next = *r;
+	next.top += r->height;
+	vips_affine_need( affine, in, &next, &next );
+	vips_region_prefetch( ir, &next );
+
+	/* With a cache on our input, small strips are cheap to prepare, and
+	 * neighbouring strips and tiles share cache tiles.
+	 */
+	if( affine->cached &&
+		vips_affine_pick_strip( affine, in, r, &vertical ) ) {
+		VipsRect strip;
+		int i;
+
+		strip = *r;
+		if( vertical )
+			for( i = r->left; i < VIPS_RECT_RIGHT( r );
+				i += AFFINE_STRIP ) {
+				strip.left = i;
+				strip.width = VIPS_MIN( AFFINE_STRIP,
+					VIPS_RECT_RIGHT( r ) - i );
+				if( vips_affine_gen_rect( affine, in,
+					or, ir, &strip ) )
+					return( -1 );
+			}
+		else
+			for( i = r->top; i < VIPS_RECT_BOTTOM( r );
+				i += AFFINE_STRIP ) {
+				strip.top = i;
+				strip.height = VIPS_MIN( AFFINE_STRIP,
+					VIPS_RECT_BOTTOM( r ) - i );
+				if( vips_affine_gen_rect( affine, in,
+					or, ir, &strip ) )
+					return( -1 );
+			}
+	}
+	else if( vips_affine_gen_rect( affine, in, or, ir, r ) )
+		return( -1 );
+
 	VIPS_COUNT_PIXELS( or, "vips_affine_gen" ); 
 
 	return( 0 );
@@ -397,7 +565,7 @@ vips_affine_build( VipsObject *object )
 	VipsObjectClass *class = VIPS_OBJECT_GET_CLASS( object );
 	VipsResample *resample = VIPS_RESAMPLE( object );
 	VipsAffine *affine = (VipsAffine *) object;
-	VipsImage **t = (VipsImage **) vips_object_local_array( object, 7 );
+	VipsImage **t = (VipsImage **) vips_object_local_array( object, 8 );
 
 	VipsImage *in;
 	VipsDemandStyle hint; 
@@ -558,6 +726,33 @@ vips_affine_build( VipsObject *object )
 	else 
 		hint = VIPS_DEMAND_STYLE_SMALLTILE;
 
+	/* With a rotate or shear, each output tile needs a skewed chunk of
+	 * input, and neighbouring tiles need overlapping chunks. Cache the
+	 * input in tiles so each input pixel is computed about once.
+	 *
+	 * Size the cache for the input under two rows of output tiles. The
+	 * input under a row is about as wide as the input diagonal, and as
+	 * high as a tile divided by the scale factor.
+	 */
+	affine->cached = FALSE;
+	if( hint == VIPS_DEMAND_STYLE_SMALLTILE ) {
+		double scale = sqrt( VIPS_FABS(
+			affine->trn.a * affine->trn.d -
+			affine->trn.b * affine->trn.c ) );
+		int across = 2 + (in->Xsize + in->Ysize) / AFFINE_TILE;
+		int down = 2 + vips__tile_height / (scale * AFFINE_TILE);
+
+		if( vips_tilecache( in, &t[7],
+			"tile_width", AFFINE_TILE,
+			"tile_height", AFFINE_TILE,
+			"max_tiles", 2 * across * down,
+			"threaded", TRUE,
+			NULL ) )
+			return( -1 );
+		in = t[7];
+		affine->cached = TRUE;
+	}
+
 	t[4] = vips_image_new();
 	if( vips_image_pipelinev( t[4], hint, in, NULL ) )
 		return( -1 );
@@ -735,6 +930,10 @@ vips_affine_init( VipsAffine *affine )
  *
  * @interpolate defaults to bilinear. 
  *
+ * If the transform includes a rotate or shear, the input is cached in tiles
+ * and each output tile is resampled in strips along the rotated axis, so
+ * each input pixel is only computed about once.
+ *
  * @idx, @idy, @odx, @ody default to zero.
  *
  * This operation does not change xres or yres. The image resolution needs to
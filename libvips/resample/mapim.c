@@ -2,6 +2,13 @@
  *
  * 15/11/15
  * 	- from affine.c
+ * 14/10/18
+ * 	- prefetch the input area the next tile will likely need
+ * 	- interpolate in spans with vips_interpolate_span()
+ * 	- find index bounds per sub-tile and resample sub-tiles separately for
+ * 	  curved maps
+ * 	- stop inside the row loop if the pipeline is killed, see
+ * 	  vips_thread_iskilled()
  */
 
 /*
@@ -70,6 +77,12 @@ typedef VipsResampleClass VipsMapimClass;
 
 G_DEFINE_TYPE( VipsMapim, vips_mapim, VIPS_TYPE_RESAMPLE );
 
+/* Split output tiles into sub-tiles at least this size, and at most this
+ * many across and down, each with its own input bounds.
+ */
+#define MAPIM_SUBTILE (16)
+#define MAPIM_SUBTILES (8)
+
 #define MINMAX( TYPE ) { \
 	TYPE * restrict p1 = (TYPE *) p; \
 	\
@@ -159,6 +172,27 @@ vips_mapim_region_minmax( VipsRegion *region, VipsRect *r, VipsRect *bounds )
 	bounds->height = 1 + max_y - min_y;
 }
 
+/* Runs of in-range pixels are gathered into spans and interpolated in one
+ * call.
+ */
+#define SPAN_FLUSH { \
+	if( n > 0 ) { \
+		interpolate_span( mapim->interpolate, span_q, ir[0], \
+			span_x, span_y, n ); \
+		n = 0; \
+	} \
+}
+
+#define SPAN_ADD( X, Y ) { \
+	if( n == 0 ) \
+		span_q = q; \
+	span_x[n] = (X); \
+	span_y[n] = (Y); \
+	n += 1; \
+	if( n == MAX_SPAN ) \
+		SPAN_FLUSH; \
+}
+
 #define ULOOKUP( TYPE ) { \
 	TYPE * restrict p1 = (TYPE *) p; \
 	\
@@ -168,16 +202,17 @@ vips_mapim_region_minmax( VipsRegion *region, VipsRect *r, VipsRect *bounds )
 		\
 		if( px >= resample->in->Xsize || \
 			py >= resample->in->Ysize ) { \
+			SPAN_FLUSH; \
 			for( z = 0; z < ps; z++ )  \
 				q[z] = 0; \
 		} \
 		else \
-			interpolate( mapim->interpolate, q, ir[0], \
-				px + window_offset, py + window_offset ); \
+			SPAN_ADD( px + window_offset, py + window_offset ); \
 		\
 		p1 += 2; \
 		q += ps; \
 	} \
+	SPAN_FLUSH; \
 }
 
 #define LOOKUP( TYPE ) { \
@@ -191,99 +226,97 @@ vips_mapim_region_minmax( VipsRegion *region, VipsRect *r, VipsRect *bounds )
 			px >= resample->in->Xsize || \
 			py < 0 || \
 			py >= resample->in->Ysize ) { \
+			SPAN_FLUSH; \
 			for( z = 0; z < ps; z++ )  \
 				q[z] = 0; \
 		} \
 		else \
-			interpolate( mapim->interpolate, q, ir[0], \
-				px + window_offset, py + window_offset ); \
+			SPAN_ADD( px + window_offset, py + window_offset ); \
 		\
 		p1 += 2; \
 		q += ps; \
 	} \
+	SPAN_FLUSH; \
 }
 
-static int
-vips_mapim_gen( VipsRegion *or, void *seq, void *a, void *b, gboolean *stop )
+/* Expand the bounds of a set of index values by the interpolation stencil
+ * and clip against the input image.
+ */
+static void
+vips_mapim_bounds_clip( const VipsMapim *mapim, const VipsImage *in,
+	const VipsRect *bounds, VipsRect *clipped )
 {
-	VipsRect *r = &or->valid;
-	VipsRegion **ir = (VipsRegion **) seq;
-	const VipsImage **in_array = (const VipsImage **) a;
-	const VipsMapim *mapim = (VipsMapim *) b; 
-	const VipsResample *resample = VIPS_RESAMPLE( mapim );
-	const VipsImage *in = in_array[0];
 	const int window_size = 
 		vips_interpolate_get_window_size( mapim->interpolate );
-	const int window_offset = 
-		vips_interpolate_get_window_offset( mapim->interpolate );
-	const VipsInterpolateMethod interpolate = 
-		vips_interpolate_get_method( mapim->interpolate );
-	const int ps = VIPS_IMAGE_SIZEOF_PEL( in );
-
-	VipsRect bounds, image, clipped;
-	int x, y, z;
-	
-#ifdef DEBUG_VERBOSE
-	printf( "vips_mapim_gen: "
-		"generating left=%d, top=%d, width=%d, height=%d\n", 
-		r->left,
-		r->top,
-		r->width,
-		r->height );
-#endif /*DEBUG_VERBOSE*/
 
-	/* Fetch the chunk of the mapim image we need, and find the max/min in
-	 * x and y.
-	 */
-	if( vips_region_prepare( ir[1], r ) )
-		return( -1 );
+	VipsRect need, image;
 
-	VIPS_GATE_START( "vips_mapim_gen: work" ); 
-
-	vips_mapim_region_minmax( ir[1], r, &bounds ); 
-
-	VIPS_GATE_STOP( "vips_mapim_gen: work" ); 
-
-	/* The bounding box of that area is what we will need from @in. Add
-	 * enough for the interpolation stencil as well.
-	 */
-	bounds.width += window_size - 1;
-	bounds.height += window_size - 1;
+	need = *bounds;
+	need.width += window_size - 1;
+	need.height += window_size - 1;
 
-	/* Clip against the source image.
-	 */
 	image.left = 0;
 	image.top = 0;
 	image.width = in->Xsize;
 	image.height = in->Ysize;
-	vips_rect_intersectrect( &bounds, &image, &clipped );
+	vips_rect_intersectrect( &need, &image, clipped );
+}
+
+/* Resample output area @r, reading area @clipped of the input.
+ */
+static int
+vips_mapim_gen_rect( VipsRegion *or, VipsRegion **ir,
+	const VipsMapim *mapim, const VipsImage *in,
+	const VipsRect *r, const VipsRect *clipped )
+{
+	const VipsResample *resample = VIPS_RESAMPLE( mapim );
+	const int window_offset = 
+		vips_interpolate_get_window_offset( mapim->interpolate );
+	const VipsInterpolateSpanMethod interpolate_span =
+		vips_interpolate_get_span_method( mapim->interpolate );
+	const int ps = VIPS_IMAGE_SIZEOF_PEL( in );
+
+	double span_x[MAX_SPAN];
+	double span_y[MAX_SPAN];
+	VipsPel *span_q;
+	int n;
+	int x, y, z;
 
 #ifdef DEBUG_VERBOSE
-	printf( "vips_mapim_gen: "
+	printf( "vips_mapim_gen_rect: "
 		"preparing left=%d, top=%d, width=%d, height=%d\n", 
-		clipped.left,
-		clipped.top,
-		clipped.width,
-		clipped.height );
+		clipped->left,
+		clipped->top,
+		clipped->width,
+		clipped->height );
 #endif /*DEBUG_VERBOSE*/
 
-	if( vips_rect_isempty( &clipped ) ) {
-		vips_region_black( or );
+	if( vips_rect_isempty( clipped ) ) {
+		vips_region_paint( or, r, 0 );
 		return( 0 );
 	}
-	if( vips_region_prepare( ir[0], &clipped ) )
+	if( vips_region_prepare( ir[0], clipped ) )
 		return( -1 );
 
 	VIPS_GATE_START( "vips_mapim_gen: work" ); 
 
 	/* Resample! x/y loop over pixels in the output image (5).
 	 */
+	span_q = NULL;
+	n = 0;
 	for( y = 0; y < r->height; y++ ) {
 		VipsPel * restrict p = 
 			VIPS_REGION_ADDR( ir[1], r->left, y + r->top );
 		VipsPel * restrict q = 
 			VIPS_REGION_ADDR( or, r->left, y + r->top );
 
+		/* A wild map can make a tile very slow.
+		 */
+		if( vips_thread_iskilled() ) {
+			VIPS_GATE_STOP( "vips_mapim_gen: work" );
+			return( -1 );
+		}
+
 		switch( ir[1]->im->BandFmt ) {
 		case VIPS_FORMAT_UCHAR: 	
 			ULOOKUP( unsigned char ); break; 
@@ -317,6 +350,129 @@ vips_mapim_gen( VipsRegion *or, void *seq, void *a, void *b, gboolean *stop )
 	return( 0 );
 }
 
+static int
+vips_mapim_gen( VipsRegion *or, void *seq, void *a, void *b, gboolean *stop )
+{
+	VipsRect *r = &or->valid;
+	VipsRegion **ir = (VipsRegion **) seq;
+	const VipsImage **in_array = (const VipsImage **) a;
+	const VipsMapim *mapim = (VipsMapim *) b;
+	const VipsImage *in = in_array[0];
+	const int window_size =
+		vips_interpolate_get_window_size( mapim->interpolate );
+
+	/* The bounds of each sub-tile, and the input area each needs.
+	 */
+	VipsRect sub[MAPIM_SUBTILES * MAPIM_SUBTILES];
+	VipsRect sub_clipped[MAPIM_SUBTILES * MAPIM_SUBTILES];
+
+	VipsRect bounds, clipped;
+	VipsRect row, edge, next;
+	int across, down, sub_width, sub_height, n_sub;
+	double sub_area;
+	int i, x, y;
+
+#ifdef DEBUG_VERBOSE
+	printf( "vips_mapim_gen: "
+		"generating left=%d, top=%d, width=%d, height=%d\n",
+		r->left,
+		r->top,
+		r->width,
+		r->height );
+#endif /*DEBUG_VERBOSE*/
+
+	/* Fetch the chunk of the mapim image we need.
+	 */
+	if( vips_region_prepare( ir[1], r ) )
+		return( -1 );
+
+	VIPS_GATE_START( "vips_mapim_gen: work" );
+
+	/* Split @r into a grid of up to MAPIM_SUBTILES x MAPIM_SUBTILES
+	 * sub-tiles, each at least MAPIM_SUBTILE pixels across, and find the
+	 * index bounds of each one. The bounds of @r are the union, so this
+	 * costs no more than a single scan.
+	 */
+	across = VIPS_CLIP( 1, r->width / MAPIM_SUBTILE, MAPIM_SUBTILES );
+	down = VIPS_CLIP( 1, r->height / MAPIM_SUBTILE, MAPIM_SUBTILES );
+	sub_width = VIPS_ROUND_UP( r->width, across ) / across;
+	sub_height = VIPS_ROUND_UP( r->height, down ) / down;
+
+	n_sub = 0;
+	sub_area = 0.0;
+	for( y = r->top; y < VIPS_RECT_BOTTOM( r ); y += sub_height )
+		for( x = r->left; x < VIPS_RECT_RIGHT( r ); x += sub_width ) {
+			VipsRect *s = &sub[n_sub];
+			VipsRect index_bounds;
+
+			s->left = x;
+			s->top = y;
+			s->width = VIPS_MIN( sub_width,
+				VIPS_RECT_RIGHT( r ) - x );
+			s->height = VIPS_MIN( sub_height,
+				VIPS_RECT_BOTTOM( r ) - y );
+
+			vips_mapim_region_minmax( ir[1], s, &index_bounds );
+			vips_mapim_bounds_clip( mapim, in,
+				&index_bounds, &sub_clipped[n_sub] );
+			sub_area += (double) sub_clipped[n_sub].width *
+				sub_clipped[n_sub].height;
+
+			if( n_sub == 0 )
+				bounds = index_bounds;
+			else
+				vips_rect_unionrect( &bounds, &index_bounds,
+					&bounds );
+
+			n_sub += 1;
+		}
+
+	/* Guess where the tile below us will read from by extrapolating from
+	 * the centre of the tile to its bottom edge, and hint that.
+	 */
+	row = *r;
+	row.top = VIPS_RECT_BOTTOM( r ) - 1;
+	row.height = 1;
+	vips_mapim_region_minmax( ir[1], &row, &edge );
+	next = bounds;
+	next.left += 2 * (edge.left + edge.width / 2 -
+		(bounds.left + bounds.width / 2));
+	next.top += 2 * (edge.top + edge.height / 2 -
+		(bounds.top + bounds.height / 2));
+
+	VIPS_GATE_STOP( "vips_mapim_gen: work" );
+
+	/* The bounding box of that area is what we will need from @in. Add
+	 * enough for the interpolation stencil as well.
+	 */
+	vips_mapim_bounds_clip( mapim, in, &bounds, &clipped );
+
+	next.width += window_size - 1;
+	next.height += window_size - 1;
+	vips_region_prefetch( ir[0], &next );
+
+	if( vips_rect_isempty( &clipped ) ) {
+		vips_region_black( or );
+		return( 0 );
+	}
+
+	/* With a strongly curved map the box around the whole tile can be
+	 * many times larger than the pixels we sample. If the sub-tile boxes
+	 * add up to much less, prepare and resample them one by one.
+	 */
+	if( n_sub > 1 &&
+		2 * sub_area < (double) clipped.width * clipped.height ) {
+		for( i = 0; i < n_sub; i++ )
+			if( vips_mapim_gen_rect( or, ir, mapim, in,
+				&sub[i], &sub_clipped[i] ) )
+				return( -1 );
+	}
+	else if( vips_mapim_gen_rect( or, ir, mapim, in, r, &clipped ) )
+		return( -1 );
+
+	return( 0 );
+}
+
 static int
 vips_mapim_build( VipsObject *object )
 {
@@ -13,6 +13,10 @@
  *
  * Nohalo level 1 with LBB finishing scheme by N. Robidoux and
  * C. Racette, 11-18/5/2010
+ *
+ * 14/10/18
+ * 	- add a span method which shares the subdivision between outputs
+ * 	  in the same input cell
  */
 
 /*
@@ -306,6 +310,11 @@ typedef struct _VipsInterpolateNohaloClass {
  * speed tests performed on a recent multicore Intel chip, especially
  * when enlarging a sharp image by a large factor, hence the choice.
  */
+/*
+ * The most outputs we do with one subdivision.
+ */
+#define NOHALO_MAX_RUN (8)
+
 #define NOHALO_MINMOD(a,b,a_times_a,a_times_b) \
   ( ( (a_times_b)>=0. ) ? ( (a_times_a)<=(a_times_b) ? (a) : (b) ) : 0. )
 
@@ -1219,6 +1228,121 @@ lbbicubic( const double c00,
   return newval;
 }
 
+/*
+ * The LBB coefficients for a sampling location relative to the
+ * nearest pixel centre, in the order lbbicubic() takes them. They
+ * depend only on the location, so a span of outputs in the same input
+ * cell can compute them all first and then share the nohalo
+ * subdivision.
+ */
+static void inline
+nohalo_coefficients( const double          x_0,
+                   const double          y_0,
+                         double* restrict c )
+{
+  const int sign_of_x_0 = 2 * ( x_0 >= 0. ) - 1;
+  const int sign_of_y_0 = 2 * ( y_0 >= 0. ) - 1;
+
+  const double xp1over2   = ( 2 * sign_of_x_0 ) * x_0;
+  const double xm1over2   = xp1over2 - 1.0;
+  const double onepx      = 0.5 + xp1over2;
+  const double onemx      = 1.5 - xp1over2;
+  const double xp1over2sq = xp1over2 * xp1over2;
+
+  const double yp1over2   = ( 2 * sign_of_y_0 ) * y_0;
+  const double ym1over2   = yp1over2 - 1.0;
+  const double onepy      = 0.5 + yp1over2;
+  const double onemy      = 1.5 - yp1over2;
+  const double yp1over2sq = yp1over2 * yp1over2;
+
+  const double xm1over2sq = xm1over2 * xm1over2;
+  const double ym1over2sq = ym1over2 * ym1over2;
+
+  const double twice1px = onepx + onepx;
+  const double twice1py = onepy + onepy;
+  const double twice1mx = onemx + onemx;
+  const double twice1my = onemy + onemy;
+
+  const double xm1over2sq_times_ym1over2sq = xm1over2sq * ym1over2sq;
+  const double xp1over2sq_times_ym1over2sq = xp1over2sq * ym1over2sq;
+  const double xp1over2sq_times_yp1over2sq = xp1over2sq * yp1over2sq;
+  const double xm1over2sq_times_yp1over2sq = xm1over2sq * yp1over2sq;
+
+  const double four_times_1px_times_1py = twice1px * twice1py;
+  const double four_times_1mx_times_1py = twice1mx * twice1py;
+  const double twice_xp1over2_times_1py = xp1over2 * twice1py;
+  const double twice_xm1over2_times_1py = xm1over2 * twice1py;
+
+  const double twice_xm1over2_times_1my = xm1over2 * twice1my;
+  const double twice_xp1over2_times_1my = xp1over2 * twice1my;
+  const double four_times_1mx_times_1my = twice1mx * twice1my;
+  const double four_times_1px_times_1my = twice1px * twice1my;
+
+  const double twice_1px_times_ym1over2 = twice1px * ym1over2;
+  const double twice_1mx_times_ym1over2 = twice1mx * ym1over2;
+  const double xp1over2_times_ym1over2  = xp1over2 * ym1over2;
+  const double xm1over2_times_ym1over2  = xm1over2 * ym1over2;
+
+  const double xm1over2_times_yp1over2  = xm1over2 * yp1over2;
+  const double xp1over2_times_yp1over2  = xp1over2 * yp1over2;
+  const double twice_1mx_times_yp1over2 = twice1mx * yp1over2;
+  const double twice_1px_times_yp1over2 = twice1px * yp1over2;
+
+
+  const double c00 =
+    four_times_1px_times_1py * xm1over2sq_times_ym1over2sq;
+  const double c00dx =
+    twice_xp1over2_times_1py * xm1over2sq_times_ym1over2sq;
+  const double c00dy =
+    twice_1px_times_yp1over2 * xm1over2sq_times_ym1over2sq;
+  const double c00dxdy =
+     xp1over2_times_yp1over2 * xm1over2sq_times_ym1over2sq;
+
+  const double c10 =
+    four_times_1mx_times_1py * xp1over2sq_times_ym1over2sq;
+  const double c10dx =
+    twice_xm1over2_times_1py * xp1over2sq_times_ym1over2sq;
+  const double c10dy =
+    twice_1mx_times_yp1over2 * xp1over2sq_times_ym1over2sq;
+  const double c10dxdy =
+     xm1over2_times_yp1over2 * xp1over2sq_times_ym1over2sq;
+
+  const double c01 =
+    four_times_1px_times_1my * xm1over2sq_times_yp1over2sq;
+  const double c01dx =
+    twice_xp1over2_times_1my * xm1over2sq_times_yp1over2sq;
+  const double c01dy =
+    twice_1px_times_ym1over2 * xm1over2sq_times_yp1over2sq;
+  const double c01dxdy =
+     xp1over2_times_ym1over2 * xm1over2sq_times_yp1over2sq;
+
+  const double c11 =
+    four_times_1mx_times_1my * xp1over2sq_times_yp1over2sq;
+  const double c11dx =
+    twice_xm1over2_times_1my * xp1over2sq_times_yp1over2sq;
+  const double c11dy =
+    twice_1mx_times_ym1over2 * xp1over2sq_times_yp1over2sq;
+  const double c11dxdy =
+     xm1over2_times_ym1over2 * xp1over2sq_times_yp1over2sq;
+
+  c[0] = c00;
+  c[1] = c10;
+  c[2] = c01;
+  c[3] = c11;
+  c[4] = c00dx;
+  c[5] = c10dx;
+  c[6] = c01dx;
+  c[7] = c11dx;
+  c[8] = c00dy;
+  c[9] = c10dy;
+  c[10] = c01dy;
+  c[11] = c11dy;
+  c[12] = c00dxdy;
+  c[13] = c10dxdy;
+  c[14] = c01dxdy;
+  c[15] = c11dxdy;
+}
+
 /*
  * Call Nohalo+LBB with a careful type conversion as a parameter.
  *
@@ -1232,16 +1356,21 @@ lbbicubic( const double c00,
                          const void*  restrict pin,   \
                          const int             bands, \
                          const int             lskip, \
-                         const double          x_0,   \
-                         const double          y_0 )  \
+                         const double* restrict x_0,  \
+                         const double* restrict y_0,  \
+                         const int             n )    \
   { \
     T* restrict out = (T *) pout; \
     \
     const T* restrict in = (T *) pin; \
     \
     \
-    const int sign_of_x_0 = 2 * ( x_0 >= 0. ) - 1; \
-    const int sign_of_y_0 = 2 * ( y_0 >= 0. ) - 1; \
+    /* \
+     * All the locations are in the same quadrant of the same cell, \
+     * so the signs are the same for all of them. \
+     */ \
+    const int sign_of_x_0 = 2 * ( x_0[0] >= 0. ) - 1; \
+    const int sign_of_y_0 = 2 * ( y_0[0] >= 0. ) - 1; \
     \
     \
     const int shift_forw_1_pix = sign_of_x_0 * bands; \
@@ -1282,92 +1411,14 @@ lbbicubic( const double c00,
     const int cin_thr_shift =                    shift_forw_2_row; \
     const int cin_fou_shift = shift_forw_1_pix + shift_forw_2_row; \
     \
-    \
-    const double xp1over2   = ( 2 * sign_of_x_0 ) * x_0; \
-    const double xm1over2   = xp1over2 - 1.0; \
-    const double onepx      = 0.5 + xp1over2; \
-    const double onemx      = 1.5 - xp1over2; \
-    const double xp1over2sq = xp1over2 * xp1over2; \
-    \
-    const double yp1over2   = ( 2 * sign_of_y_0 ) * y_0; \
-    const double ym1over2   = yp1over2 - 1.0; \
-    const double onepy      = 0.5 + yp1over2; \
-    const double onemy      = 1.5 - yp1over2; \
-    const double yp1over2sq = yp1over2 * yp1over2; \
-    \
-    const double xm1over2sq = xm1over2 * xm1over2; \
-    const double ym1over2sq = ym1over2 * ym1over2; \
-    \
-    const double twice1px = onepx + onepx; \
-    const double twice1py = onepy + onepy; \
-    const double twice1mx = onemx + onemx; \
-    const double twice1my = onemy + onemy; \
-    \
-    const double xm1over2sq_times_ym1over2sq = xm1over2sq * ym1over2sq; \
-    const double xp1over2sq_times_ym1over2sq = xp1over2sq * ym1over2sq; \
-    const double xp1over2sq_times_yp1over2sq = xp1over2sq * yp1over2sq; \
-    const double xm1over2sq_times_yp1over2sq = xm1over2sq * yp1over2sq; \
-    \
-    const double four_times_1px_times_1py = twice1px * twice1py; \
-    const double four_times_1mx_times_1py = twice1mx * twice1py; \
-    const double twice_xp1over2_times_1py = xp1over2 * twice1py; \
-    const double twice_xm1over2_times_1py = xm1over2 * twice1py; \
-    \
-    const double twice_xm1over2_times_1my = xm1over2 * twice1my; \
-    const double twice_xp1over2_times_1my = xp1over2 * twice1my; \
-    const double four_times_1mx_times_1my = twice1mx * twice1my; \
-    const double four_times_1px_times_1my = twice1px * twice1my; \
-    \
-    const double twice_1px_times_ym1over2 = twice1px * ym1over2; \
-    const double twice_1mx_times_ym1over2 = twice1mx * ym1over2; \
-    const double xp1over2_times_ym1over2  = xp1over2 * ym1over2; \
-    const double xm1over2_times_ym1over2  = xm1over2 * ym1over2; \
-    \
-    const double xm1over2_times_yp1over2  = xm1over2 * yp1over2; \
-    const double xp1over2_times_yp1over2  = xp1over2 * yp1over2; \
-    const double twice_1mx_times_yp1over2 = twice1mx * yp1over2; \
-    const double twice_1px_times_yp1over2 = twice1px * yp1over2; \
-    \
-    \
-    const double c00 = \
-      four_times_1px_times_1py * xm1over2sq_times_ym1over2sq; \
-    const double c00dx = \
-      twice_xp1over2_times_1py * xm1over2sq_times_ym1over2sq; \
-    const double c00dy = \
-      twice_1px_times_yp1over2 * xm1over2sq_times_ym1over2sq; \
-    const double c00dxdy = \
-       xp1over2_times_yp1over2 * xm1over2sq_times_ym1over2sq; \
-    \
-    const double c10 = \
-      four_times_1mx_times_1py * xp1over2sq_times_ym1over2sq; \
-    const double c10dx = \
-      twice_xm1over2_times_1py * xp1over2sq_times_ym1over2sq; \
-    const double c10dy = \
-      twice_1mx_times_yp1over2 * xp1over2sq_times_ym1over2sq; \
-    const double c10dxdy = \
-       xm1over2_times_yp1over2 * xp1over2sq_times_ym1over2sq; \
-    \
-    const double c01 = \
-      four_times_1px_times_1my * xm1over2sq_times_yp1over2sq; \
-    const double c01dx = \
-      twice_xp1over2_times_1my * xm1over2sq_times_yp1over2sq; \
-    const double c01dy = \
-      twice_1px_times_ym1over2 * xm1over2sq_times_yp1over2sq; \
-    const double c01dxdy = \
-       xp1over2_times_ym1over2 * xm1over2sq_times_yp1over2sq; \
-    \
-    const double c11 = \
-      four_times_1mx_times_1my * xp1over2sq_times_yp1over2sq; \
-    const double c11dx = \
-      twice_xm1over2_times_1my * xp1over2sq_times_yp1over2sq; \
-    const double c11dy = \
-      twice_1mx_times_ym1over2 * xp1over2sq_times_yp1over2sq; \
-    const double c11dxdy = \
-       xm1over2_times_ym1over2 * xp1over2sq_times_yp1over2sq; \
-    \
+    double c[NOHALO_MAX_RUN][16]; \
     \
     int band = bands; \
+    int i; \
+    \
     \
+    for( i = 0; i < n; i++ ) \
+      nohalo_coefficients( x_0[i], y_0[i], c[i] ); \
     \
     do \
       { \
@@ -1414,46 +1465,50 @@ lbbicubic( const double c00,
                             &qua_thr,            \
                             &qua_fou );          \
         \
-        const double double_result =        \
-          lbbicubic( c00,                   \
-                     c10,                   \
-                     c01,                   \
-                     c11,                   \
-                     c00dx,                 \
-                     c10dx,                 \
-                     c01dx,                 \
-                     c11dx,                 \
-                     c00dy,                 \
-                     c10dy,                 \
-                     c01dy,                 \
-                     c11dy,                 \
-                     c00dxdy,               \
-                     c10dxdy,               \
-                     c01dxdy,               \
-                     c11dxdy,               \
-                     uno_one,               \
-                     uno_two,               \
-                     uno_thr,               \
-                     uno_fou,               \
-                     dos_one,               \
-                     dos_two,               \
-                     dos_thr,               \
-                     dos_fou,               \
-                     tre_one,               \
-                     tre_two,               \
-                     tre_thr,               \
-                     tre_fou,               \
-                     qua_one,               \
-                     qua_two,               \
-                     qua_thr,               \
-                     qua_fou );             \
-        \
-        {                                                         \
-          const T result = to_ ## conversion<T>( double_result ); \
-          in++;                                                   \
-          *out++ = result;                                        \
-        }                                                         \
+        /* \
+         * The subdivision is shared by all the outputs in this cell. \
+         */ \
+        for( i = 0; i < n; i++ ) \
+          { \
+            const double double_result =        \
+              lbbicubic( c[i][0],               \
+                         c[i][1],               \
+                         c[i][2],               \
+                         c[i][3],               \
+                         c[i][4],               \
+                         c[i][5],               \
+                         c[i][6],               \
+                         c[i][7],               \
+                         c[i][8],               \
+                         c[i][9],               \
+                         c[i][10],              \
+                         c[i][11],              \
+                         c[i][12],              \
+                         c[i][13],              \
+                         c[i][14],              \
+                         c[i][15],              \
+                         uno_one,               \
+                         uno_two,               \
+                         uno_thr,               \
+                         uno_fou,               \
+                         dos_one,               \
+                         dos_two,               \
+                         dos_thr,               \
+                         dos_fou,               \
+                         tre_one,               \
+                         tre_two,               \
+                         tre_thr,               \
+                         tre_fou,               \
+                         qua_one,               \
+                         qua_two,               \
+                         qua_thr,               \
+                         qua_fou );             \
+            \
+            out[i * bands] = to_ ## conversion<T>( double_result ); \
+          } \
         \
+        in++; \
+        out++; \
       } while (--band); \
   }
 
@@ -1469,7 +1524,8 @@ NOHALO_CONVERSION( nosign )
                             bands,        \
                             lskip,        \
                             relative_x,   \
-                            relative_y );
+                            relative_y,   \
+                            n );
 
 
 /*
@@ -1481,31 +1537,18 @@ G_DEFINE_TYPE( VipsInterpolateNohalo, vips_interpolate_nohalo,
 }
 
 
-static void
-vips_interpolate_nohalo_interpolate( VipsInterpolate* restrict interpolate,
-                                     void*            restrict out,
-                                     VipsRegion*      restrict in,
-                                     double                    absolute_x,
-                                     double                    absolute_y )
+/*
+ * Interpolate n locations which all have their nearest pixel centre
+ * at p, and which are all in the same quadrant about it.
+ */
+static void inline
+nohalo_run( VipsRegion*    restrict in,
+            void*          restrict out,
+            const VipsPel* restrict p,
+            const double*  restrict relative_x,
+            const double*  restrict relative_y,
+            const int               n )
 {
-  /* absolute_x and absolute_y are always >= 2.0 (see double-check assert
-   * below), so we don't need floor(). 
-   *
-   * It's 2 not 0 since we ask for a window_offset of 2 at the bottom.
-   */
-  const int ix = (int) (absolute_x + 0.5);
-  const int iy = (int) (absolute_y + 0.5);
-
-  /*
-   * Move the pointer to (the first band of) the top/left pixel of the
-   * 2x2 group of pixel centers which contains the sampling location
-   * in its convex hull:
-   */
-  const VipsPel* restrict p = VIPS_REGION_ADDR( in, ix, iy );
-
-  const double relative_x = absolute_x - ix;
-  const double relative_y = absolute_y - iy;
-
   /*
    * VIPS versions of Nicolas's pixel addressing values.
    */
@@ -1521,16 +1564,6 @@ vips_interpolate_nohalo_interpolate( VipsInterpolate* restrict interpolate,
     vips_band_format_iscomplex( in->im->BandFmt ) ? 
       2 * actual_bands : actual_bands;
 
-  g_assert( ix - 2 >= in->valid.left );
-  g_assert( iy - 2 >= in->valid.top );
-  g_assert( ix + 2 <= VIPS_RECT_RIGHT( &in->valid ) );
-  g_assert( iy + 2 <= VIPS_RECT_BOTTOM( &in->valid ) );
-
-  /* Confirm that absolute_x and absolute_y are >= 2, see above. 
-   */
-  g_assert( absolute_x >= 2.0 );
-  g_assert( absolute_y >= 2.0 );
-
   switch( in->im->BandFmt ) {
   case VIPS_FORMAT_UCHAR:
     CALL( unsigned char, nosign );
@@ -1575,6 +1608,104 @@ vips_interpolate_nohalo_interpolate( VipsInterpolate* restrict interpolate,
   }
 }
 
+static void
+vips_interpolate_nohalo_interpolate( VipsInterpolate* restrict interpolate,
+                                     void*            restrict out,
+                                     VipsRegion*      restrict in,
+                                     double                    absolute_x,
+                                     double                    absolute_y )
+{
+  /* absolute_x and absolute_y are always >= 2.0 (see double-check assert
+   * below), so we don't need floor().
+   *
+   * It's 2 not 0 since we ask for a window_offset of 2 at the bottom.
+   */
+  const int ix = (int) (absolute_x + 0.5);
+  const int iy = (int) (absolute_y + 0.5);
+
+  /*
+   * Move the pointer to (the first band of) the top/left pixel of the
+   * 2x2 group of pixel centers which contains the sampling location
+   * in its convex hull:
+   */
+  const VipsPel* restrict p = VIPS_REGION_ADDR( in, ix, iy );
+
+  const double relative_x = absolute_x - ix;
+  const double relative_y = absolute_y - iy;
+
+  g_assert( ix - 2 >= in->valid.left );
+  g_assert( iy - 2 >= in->valid.top );
+  g_assert( ix + 2 <= VIPS_RECT_RIGHT( &in->valid ) );
+  g_assert( iy + 2 <= VIPS_RECT_BOTTOM( &in->valid ) );
+
+  /* Confirm that absolute_x and absolute_y are >= 2, see above.
+   */
+  g_assert( absolute_x >= 2.0 );
+  g_assert( absolute_y >= 2.0 );
+
+  nohalo_run( in, out, p, &relative_x, &relative_y, 1 );
+}
+
+/*
+ * Group the span into runs of locations which share a nearest pixel
+ * centre and a quadrant, and do each run with a single subdivision.
+ * When upsampling by a factor of k, runs are about k / 2 long, so
+ * large zooms save most.
+ */
+static void
+vips_interpolate_nohalo_interpolate_span( VipsInterpolate* restrict interpolate,
+                                          void*            restrict out,
+                                          VipsRegion*      restrict in,
+                                          const double*    restrict x,
+                                          const double*    restrict y,
+                                          int                       n )
+{
+  const int ps = VIPS_IMAGE_SIZEOF_PEL( in->im );
+
+  VipsPel* restrict q = (VipsPel *) out;
+
+  int i;
+
+  i = 0;
+  while( i < n ) {
+    const int ix = (int) (x[i] + 0.5);
+    const int iy = (int) (y[i] + 0.5);
+    const int sx = x[i] - ix >= 0.;
+    const int sy = y[i] - iy >= 0.;
+
+    double relative_x[NOHALO_MAX_RUN];
+    double relative_y[NOHALO_MAX_RUN];
+    int m;
+
+    g_assert( ix - 2 >= in->valid.left );
+    g_assert( iy - 2 >= in->valid.top );
+    g_assert( ix + 2 <= VIPS_RECT_RIGHT( &in->valid ) );
+    g_assert( iy + 2 <= VIPS_RECT_BOTTOM( &in->valid ) );
+    g_assert( x[i] >= 2.0 );
+    g_assert( y[i] >= 2.0 );
+
+    for( m = 0; m < NOHALO_MAX_RUN && i + m < n; m++ ) {
+      const double rx = x[i + m] - ix;
+      const double ry = y[i + m] - iy;
+
+      if( (int) (x[i + m] + 0.5) != ix ||
+          (int) (y[i + m] + 0.5) != iy ||
+          (rx >= 0.) != sx ||
+          (ry >= 0.) != sy )
+        break;
+
+      relative_x[m] = rx;
+      relative_y[m] = ry;
+    }
+
+    nohalo_run( in, q, VIPS_REGION_ADDR( in, ix, iy ),
+                relative_x, relative_y, m );
+
+    q += m * ps;
+    i += m;
+  }
+}
+
 static void
 vips_interpolate_nohalo_class_init( VipsInterpolateNohaloClass *klass )
 {
@@ -1586,6 +1717,8 @@ vips_interpolate_nohalo_class_init( VipsInterpolateNohaloClass *klass )
     _( "edge sharpening resampler with halo reduction" );
 
   interpolate_class->interpolate   = vips_interpolate_nohalo_interpolate;
+  interpolate_class->interpolate_span =
+    vips_interpolate_nohalo_interpolate_span;
   interpolate_class->window_size   = 6;
   interpolate_class->window_offset = 2;
 }
@@ -69,10 +69,22 @@ GType vips_resample_get_type( void );
  */
 #define MAX_POINT (2000)
 
+/* Interpolators and the resamplers which use them work in spans of up to
+ * this many pixels.
+ */
+#define MAX_SPAN (64)
+
 int vips_reduce_get_points( VipsKernel kernel, double shrink );
 void vips_reduce_make_mask( double *c, 
 	VipsKernel kernel, double shrink, double x );
 
+gboolean vips__shrink_reciprocal( int n, guint64 max, guint64 *m, int *s );
+
+gboolean vips__resize_kernel_ok( VipsImage *in );
+int vips__resize_kernel( VipsImage *in, VipsImage **out,
+	int hshrink, int vshrink, double hreduce, double vreduce,
+	VipsKernel kernel );
+
 #ifdef __cplusplus
 }
 #endif /*__cplusplus*/
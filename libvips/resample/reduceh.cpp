@@ -8,6 +8,10 @@
  * 	- rename xshrink as hshrink for consistency
  * 9/9/16
  * 	- add @centre option
+ * 14/10/18
+ * 	- use a native SIMD kernel for 4-band uchar, if there is one
+ * 	- precompute input positions and masks for each output pixel, native
+ * 	  kernels do whole lines of 3- and 4-band uchar, ushort and float
  */
 
 /*
@@ -53,6 +57,7 @@
 #include <vips/vips.h>
 #include <vips/debug.h>
 #include <vips/internal.h>
+#include <vips/simd.h>
 
 #include "presample.h"
 #include "templates.h"
@@ -81,6 +86,25 @@ typedef struct _VipsReduceh {
 	int *matrixi[VIPS_TRANSFORM_SCALE + 1];
 	double *matrixf[VIPS_TRANSFORM_SCALE + 1];
 
+	/* The same masks, one after the other, and a short version for the
+	 * uchar native kernel.
+	 */
+	int *tabi;
+	double *tabf;
+	short *tabs;
+
+	/* For each output pixel, the first input pixel we read and the mask
+	 * we use, computed once at build time.
+	 */
+	int *start;
+	int *phase;
+
+	/* A native kernel for 3- and 4-band uchar, ushort and float, if there
+	 * is one.
+	 */
+	VipsSimdReducehFn simd;
+	const void *simd_coeff;
+
 } VipsReduceh;
 
 typedef VipsResampleClass VipsReducehClass;
@@ -282,8 +306,22 @@ reduceh_notab( VipsReduceh *reduceh,
 }
 
 /* Tried a vector path (see reducev) but it was slower. The vectors for
- * horizontal reduce are just too small to get a useful speedup.
+ * horizontal reduce are just too small to get a useful speedup. The native
+ * kernels work across a whole line instead, see vips_simd_get().
+ */
+
+/* The position in the input of output pixel x.
  */
+static double
+vips_reduceh_position( VipsReduceh *reduceh, int x )
+{
+	double X = x * reduceh->hshrink;
+
+	if( reduceh->centre )
+		X += 0.5;
+
+	return( X );
+}
 
 static int
 vips_reduceh_gen( VipsRegion *out_region, void *seq, 
@@ -319,17 +357,14 @@ vips_reduceh_gen( VipsRegion *out_region, void *seq,
 	VIPS_GATE_START( "vips_reduceh_gen: work" ); 
 
 	for( int y = 0; y < r->height; y ++ ) { 
+		const int *start = reduceh->start + r->left;
+		const int *phase = reduceh->phase + r->left;
+
 		VipsPel *p0;
 		VipsPel *q;
 
-		double X;
-
 		q = VIPS_REGION_ADDR( out_region, r->left, r->top + y );
 
-		X = r->left * reduceh->hshrink;
-		if( reduceh->centre )
-			X += 0.5;
-
 		/* We want p0 to be the start (ie. x == 0) of the input 
 		 * scanline we are reading from. We can then calculate the p we
 		 * need for each pixel with a single mul and avoid calling ADDR
@@ -342,14 +377,17 @@ vips_reduceh_gen( VipsRegion *out_region, void *seq,
 		p0 = VIPS_REGION_ADDR( ir, ir->valid.left, r->top + y ) - 
 			ir->valid.left * ps;
 
+		if( reduceh->simd ) {
+			reduceh->simd( q, p0, r->width, in->Bands,
+				start, phase,
+				reduceh->simd_coeff, reduceh->n_point );
+			continue;
+		}
+
 		for( int x = 0; x < r->width; x++ ) {
-			int ix = (int) X;
-			VipsPel *p = p0 + ix * ps;
-			const int sx = X * VIPS_TRANSFORM_SCALE * 2;
-			const int six = sx & (VIPS_TRANSFORM_SCALE * 2 - 1);
-			const int tx = (six + 1) >> 1;
-			const int *cxi = reduceh->matrixi[tx];
-			const double *cxf = reduceh->matrixf[tx];
+			VipsPel *p = p0 + start[x] * ps;
+			const int *cxi = reduceh->matrixi[phase[x]];
+			const double *cxf = reduceh->matrixf[phase[x]];
 
 			switch( in->BandFmt ) {
 			case VIPS_FORMAT_UCHAR:
@@ -403,7 +441,9 @@ vips_reduceh_gen( VipsRegion *out_region, void *seq,
 			case VIPS_FORMAT_DOUBLE:
 			case VIPS_FORMAT_DPCOMPLEX:
 				reduceh_notab<double>( reduceh,
-					q, p, bands, X - ix );
+					q, p, bands,
+					vips_reduceh_position( reduceh,
+						r->left + x ) - start[x] );
 				break;
 
 			default:
@@ -411,7 +451,6 @@ vips_reduceh_gen( VipsRegion *out_region, void *seq,
 				break;
 			}
 
-			X += reduceh->hshrink;
 			q += ps;
 		}
 	}
@@ -434,6 +473,8 @@ vips_reduceh_build( VipsObject *object )
 
 	VipsImage *in;
 	int width;
+	int n_coeff;
+	gboolean short_ok;
 
 	if( VIPS_OBJECT_CLASS( vips_reduceh_parent_class )->build( object ) )
 		return( -1 );
@@ -454,27 +495,35 @@ vips_reduceh_build( VipsObject *object )
 	reduceh->n_point = 
 		vips_reduce_get_points( reduceh->kernel, reduceh->hshrink ); 
 	g_info( "reduceh: %d point mask", reduceh->n_point );
+	short_ok = TRUE;
 	if( reduceh->n_point > MAX_POINT ) {
 		vips_error( object_class->nickname, 
 			"%s", _( "reduce factor too large" ) );
 		return( -1 );
 	}
+	n_coeff = (VIPS_TRANSFORM_SCALE + 1) * reduceh->n_point;
+	if( !(reduceh->tabf = VIPS_ARRAY( object, n_coeff, double )) ||
+		!(reduceh->tabi = VIPS_ARRAY( object, n_coeff, int )) ||
+		!(reduceh->tabs = VIPS_ARRAY( object, n_coeff, short )) )
+		return( -1 );
 	for( int x = 0; x < VIPS_TRANSFORM_SCALE + 1; x++ ) {
-		reduceh->matrixf[x] = 
-			VIPS_ARRAY( object, reduceh->n_point, double ); 
-		reduceh->matrixi[x] = 
-			VIPS_ARRAY( object, reduceh->n_point, int ); 
-		if( !reduceh->matrixf[x] ||
-			!reduceh->matrixi[x] )
-			return( -1 ); 
+		reduceh->matrixf[x] = reduceh->tabf + x * reduceh->n_point;
+		reduceh->matrixi[x] = reduceh->tabi + x * reduceh->n_point;
 
 		vips_reduce_make_mask( reduceh->matrixf[x], 
 			reduceh->kernel, reduceh->hshrink, 
 			(float) x / VIPS_TRANSFORM_SCALE );
 
-		for( int i = 0; i < reduceh->n_point; i++ )
+		for( int i = 0; i < reduceh->n_point; i++ ) {
 			reduceh->matrixi[x][i] = reduceh->matrixf[x][i] * 
 				VIPS_INTERPOLATE_SCALE;
+			reduceh->tabs[x * reduceh->n_point + i] =
+				VIPS_CLIP( SHRT_MIN,
+					reduceh->matrixi[x][i], SHRT_MAX );
+			if( reduceh->tabs[x * reduceh->n_point + i] !=
+				reduceh->matrixi[x][i] )
+				short_ok = FALSE;
+		}
 
 #ifdef DEBUG
 		printf( "vips_reduceh_build: mask %d\n    ", x ); 
@@ -505,6 +554,33 @@ vips_reduceh_build( VipsObject *object )
 		return( -1 );
 	in = t[1];
 
+	/* The native kernels do 3- and 4-band uchar, ushort and float.
+	 */
+	if( in->Bands == 3 ||
+		in->Bands == 4 ) {
+		switch( in->BandFmt ) {
+		case VIPS_FORMAT_UCHAR:
+			if( short_ok )
+				reduceh->simd_coeff = reduceh->tabs;
+			break;
+
+		case VIPS_FORMAT_USHORT:
+			reduceh->simd_coeff = reduceh->tabi;
+			break;
+
+		case VIPS_FORMAT_FLOAT:
+			reduceh->simd_coeff = reduceh->tabf;
+			break;
+
+		default:
+			break;
+		}
+
+		if( reduceh->simd_coeff )
+			reduceh->simd = (VipsSimdReducehFn)
+				vips_simd_get( VIPS_SIMD_REDUCEH, in->BandFmt );
+	}
+
 	if( vips_image_pipelinev( resample->out, 
 		VIPS_DEMAND_STYLE_THINSTRIP, in, (void *) NULL ) )
 		return( -1 );
@@ -524,6 +600,24 @@ vips_reduceh_build( VipsObject *object )
 		return( -1 );
 	}
 
+	/* Where each output pixel reads from, and which mask it uses. This
+	 * depends only on the output x, so it's the same for every line and
+	 * every region.
+	 */
+	if( !(reduceh->start =
+			VIPS_ARRAY( object, resample->out->Xsize, int )) ||
+		!(reduceh->phase =
+			VIPS_ARRAY( object, resample->out->Xsize, int )) )
+		return( -1 );
+	for( int x = 0; x < resample->out->Xsize; x++ ) {
+		const double X = vips_reduceh_position( reduceh, x );
+		const int sx = X * VIPS_TRANSFORM_SCALE * 2;
+		const int six = sx & (VIPS_TRANSFORM_SCALE * 2 - 1);
+
+		reduceh->start[x] = (int) X;
+		reduceh->phase[x] = (six + 1) >> 1;
+	}
+
 #ifdef DEBUG
 	printf( "vips_reduceh_build: reducing %d x %d image to %d x %d\n", 
 		in->Xsize, in->Ysize, 
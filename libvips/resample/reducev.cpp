@@ -17,6 +17,9 @@
  * 	- add @centre option
  * 7/3/17
  * 	- add a seq line cache
+ * 14/10/18
+ * 	- use a native SIMD kernel for uchar and ushort, if there is one
+ * 	- use an accelerator kernel for large regions, if there is one
  */
 
 /*
@@ -65,6 +68,8 @@
 #include <vips/debug.h>
 #include <vips/internal.h>
 #include <vips/vector.h>
+#include <vips/simd.h>
+#include <vips/accel.h>
 
 #include "presample.h"
 #include "templates.h"
@@ -128,6 +133,14 @@ typedef struct _VipsReducev {
 	int n_pass;	
 	Pass pass[MAX_PASS];
 
+	/* A native kernel for uchar and ushort, if there is one.
+	 */
+	VipsSimdReducevFn simd;
+
+	/* An accelerator kernel, if there is one.
+	 */
+	VipsAccelReducevFn accel;
+
 } VipsReducev;
 
 typedef VipsResampleClass VipsReducevClass;
@@ -507,6 +520,49 @@ reducev_notab( VipsReducev *reducev,
 		out[z] = reduce_sum<T, double>( in + z, l1, cy, n );
 }
 
+/* Send the whole of a region to the accelerator. Non-zero means it was
+ * refused and we should do it on the CPU.
+ */
+static int
+vips_reducev_accel( VipsReducev *reducev,
+	VipsRegion *out_region, VipsRegion *ir, int ne )
+{
+	VipsRect *r = &out_region->valid;
+	const int n = reducev->n_point;
+
+	int *start;
+	int *cy;
+	int result;
+
+	if( !(start = VIPS_ARRAY( NULL, r->height * (n + 1), int )) ) {
+		vips_error_clear();
+		return( -1 );
+	}
+	cy = start + r->height;
+
+	for( int y = 0; y < r->height; y++ ) {
+		const double Y = (r->top + y) * reducev->vshrink +
+			(reducev->centre ? 0.5 : 0.0);
+		const int sy = Y * VIPS_TRANSFORM_SCALE * 2;
+		const int siy = sy & (VIPS_TRANSFORM_SCALE * 2 - 1);
+		const int ty = (siy + 1) >> 1;
+
+		start[y] = (int) Y - ir->valid.top;
+		memcpy( cy + y * n, reducev->matrixi[ty], n * sizeof( int ) );
+	}
+
+	result = reducev->accel(
+		VIPS_REGION_ADDR( out_region, r->left, r->top ),
+		VIPS_REGION_LSKIP( out_region ),
+		VIPS_REGION_ADDR( ir, r->left, ir->valid.top ),
+		VIPS_REGION_LSKIP( ir ), ir->valid.height,
+		ne, r->height, start, cy, n );
+
+	g_free( start );
+
+	return( result );
+}
+
 static int
 vips_reducev_gen( VipsRegion *out_region, void *vseq, 
 	void *a, void *b, gboolean *stop )
@@ -539,6 +595,23 @@ vips_reducev_gen( VipsRegion *out_region, void *vseq,
 	if( vips_region_prepare( ir, &s ) )
 		return( -1 );
 
+	/* Big regions go to the accelerator, if we have one. Anything it
+	 * refuses falls through to the CPU.
+	 */
+	if( reducev->accel &&
+		ne * r->height >= vips_accel_get_min_elements() ) {
+		int result;
+
+		VIPS_GATE_START( "vips_reducev_gen: accel" );
+		result = vips_reducev_accel( reducev, out_region, ir, ne );
+		VIPS_GATE_STOP( "vips_reducev_gen: accel" );
+
+		if( !result ) {
+			VIPS_COUNT_PIXELS( out_region, "vips_reducev_gen" );
+			return( 0 );
+		}
+	}
+
 	VIPS_GATE_START( "vips_reducev_gen: work" ); 
 
 	for( int y = 0; y < r->height; y ++ ) { 
@@ -556,10 +629,14 @@ vips_reducev_gen( VipsRegion *out_region, void *vseq,
 
 		switch( in->BandFmt ) {
 		case VIPS_FORMAT_UCHAR:
-			reducev_unsigned_int_tab
-				<unsigned char, UCHAR_MAX>(
-				reducev,
-				q, p, ne, lskip, cyi );
+			if( reducev->simd )
+				reducev->simd( q, p, ne, lskip, 
+					cyi, reducev->n_point );
+			else
+				reducev_unsigned_int_tab
+					<unsigned char, UCHAR_MAX>(
+					reducev,
+					q, p, ne, lskip, cyi );
 			break;
 
 		case VIPS_FORMAT_CHAR:
@@ -570,10 +647,14 @@ vips_reducev_gen( VipsRegion *out_region, void *vseq,
 			break;
 
 		case VIPS_FORMAT_USHORT:
-			reducev_unsigned_int_tab
-				<unsigned short, USHRT_MAX>(
-				reducev,
-				q, p, ne, lskip, cyi );
+			if( reducev->simd )
+				reducev->simd( q, p, ne, lskip, 
+					cyi, reducev->n_point );
+			else
+				reducev_unsigned_int_tab
+					<unsigned short, USHRT_MAX>(
+					reducev,
+					q, p, ne, lskip, cyi );
 			break;
 
 		case VIPS_FORMAT_SHORT:
@@ -775,10 +856,23 @@ vips_reducev_raw( VipsReducev *reducev, VipsImage *in, VipsImage **out )
 				reducev->n_point, 64 );
 		}
 
-	/* Try to build a vector version, if we can.
+	/* A native kernel, if there's one for this format.
+	 */
+	reducev->simd = (VipsSimdReducevFn) 
+		vips_simd_get( VIPS_SIMD_REDUCEV, in->BandFmt );
+
+	/* And an accelerator kernel. These use the int masks.
+	 */
+	if( VIPS_IMAGE_SIZEOF_ELEMENT( in ) <= 2 )
+		reducev->accel = (VipsAccelReducevFn)
+			vips_accel_get( VIPS_ACCEL_REDUCEV, in->BandFmt );
+
+	/* Try to build a vector version, if we can. The accelerator is
+	 * only called from the C path.
 	 */
 	generate = vips_reducev_gen;
-	if( in->BandFmt == VIPS_FORMAT_UCHAR &&
+	if( !reducev->accel &&
+		in->BandFmt == VIPS_FORMAT_UCHAR &&
 		vips_vector_isenabled() &&
 		!vips_reducev_compile( reducev ) ) {
 		g_info( "reducev: using vector path" ); 
@@ -95,6 +95,17 @@
  * See also: vips_thumbnail().
  */
 
+/**
+ * VipsThumbnailQuality:
+ * @VIPS_THUMBNAIL_QUALITY_HIGH: lanczos3, honour linear
+ * @VIPS_THUMBNAIL_QUALITY_AUTO: fast for small thumbnails of large images
+ * @VIPS_THUMBNAIL_QUALITY_FAST: block shrink and linear, no linear light
+ *
+ * Trade quality for speed in vips_thumbnail().
+ *
+ * See also: vips_thumbnail().
+ */
+
 G_DEFINE_ABSTRACT_TYPE( VipsResample, vips_resample, VIPS_TYPE_OPERATION );
 
 static int
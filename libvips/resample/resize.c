@@ -28,6 +28,8 @@
  * 	- make LINEAR and CUBIC adaptive
  * 25/11/17
  * 	- deprecate --centre ... it's now always on, thanks tback
+ * 14/10/18
+ * 	- do block shrink and reduce in a single pass when we can
  */
 
 /*
@@ -191,6 +193,49 @@ vips_resize_build( VipsObject *object )
 	int_hshrink = vips_resize_int_shrink( resize, hscale );
 	int_vshrink = vips_resize_int_shrink( resize, vscale );
 
+	/* If we're only downsizing, we can do the block shrink and the
+	 * residual reduce in a single pass and skip all the intermediate
+	 * images.
+	 */
+	if( (int_hshrink > 1 ||
+		int_vshrink > 1 ||
+		hscale < 1.0 ||
+		vscale < 1.0) &&
+		hscale * int_hshrink <= 1.0 &&
+		vscale * int_vshrink <= 1.0 &&
+		vips__resize_kernel_ok( in ) ) {
+		hscale *= int_hshrink;
+		vscale *= int_vshrink;
+
+		g_info( "resize kernel %d x %d, then %g x %g",
+			int_hshrink, int_vshrink, hscale, vscale );
+		if( vips__resize_kernel( in, &t[0],
+			int_hshrink, int_vshrink,
+			hscale < 1.0 ? 1.0 / hscale : 1.0,
+			vscale < 1.0 ? 1.0 / vscale : 1.0,
+			resize->kernel ) )
+			return( -1 );
+		in = t[0];
+
+		/* As shrinkv, a sequential input needs a line cache so
+		 * we never fetch out of order.
+		 */
+		if( vips_image_get_typeof( in, VIPS_META_SEQUENTIAL ) ) {
+			g_info( "resize kernel sequential line cache" );
+
+			if( vips_sequential( in, &t[1],
+				"tile_height", 10,
+				NULL ) )
+				return( -1 );
+			in = t[1];
+		}
+
+		if( vips_image_write( in, resample->out ) )
+			return( -1 );
+
+		return( 0 );
+	}
+
 	if( int_vshrink > 1 ) { 
 		g_info( "shrinkv by %d", int_vshrink );
 		if( vips_shrinkv( in, &t[0], int_vshrink, NULL ) )
@@ -0,0 +1,698 @@
+/* block shrink and separable reduce in a single pass
+ *
+ * 14/10/18
+ * 	- from shrinkv.c, shrinkh.c, reducev.cpp and reduceh.cpp
+ */
+
+/*
+
+    This file is part of VIPS.
+
+    VIPS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA
+
+ */
+
+/*
+
+    These files are distributed with VIPS - http://www.vips.ecs.soton.ac.uk
+
+ */
+
+/* vips_resize() is usually vips_shrinkv(), vips_shrinkh(), vips_reducev()
+ * and vips_reduceh() in a chain. Each stage has its own image and region
+ * buffers, so every pixel is written and read back several times on the way
+ * through.
+ *
+ * This does all four stages in one generate function. Lines of the block
+ * shrunk image go into a small ring buffer as we move down the output. The
+ * vertical reduce makes one line from the ring, and the horizontal reduce
+ * makes the output line from that. Each shrunk line is made once per
+ * region, from a single read of the input.
+ *
+ * The arithmetic, masks and edge handling are exactly those of the C paths of
+ * the four operations, so the output is the same.
+ */
+
+/*
+#define DEBUG
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /*HAVE_CONFIG_H*/
+#include <vips/intl.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <vips/vips.h>
+#include <vips/debug.h>
+#include <vips/internal.h>
+#include <vips/vector.h>
+
+#include "presample.h"
+#include "templates.h"
+
+/* Hung off the output image.
+ */
+typedef struct _VipsResizeKernel {
+	int hshrink;		/* Integer block shrink */
+	int vshrink;
+	double hreduce;		/* Residual reduce, 1.0 for none */
+	double vreduce;
+
+	/* Size of the input, and of the image after the block shrink.
+	 */
+	int width;
+	int height;
+	int shrunk_width;
+	int shrunk_height;
+
+	/* Mask sizes. 1 if there's no reduce on that axis.
+	 */
+	int nh;
+	int nv;
+
+	/* For each output column, the first shrunk column we read and the
+	 * mask we use. The same for output rows. Positions are in shrunk
+	 * image coordinates, so they can be off the edges.
+	 */
+	int *hstart;
+	int *hphase;
+	int *vstart;
+	int *vphase;
+
+	/* Masks, as in reduceh and reducev.
+	 */
+	int *hmaski[VIPS_TRANSFORM_SCALE + 1];
+	double *hmaskf[VIPS_TRANSFORM_SCALE + 1];
+	int *vmaski[VIPS_TRANSFORM_SCALE + 1];
+	double *vmaskf[VIPS_TRANSFORM_SCALE + 1];
+} VipsResizeKernel;
+
+typedef struct {
+	VipsRegion *ir;
+
+	/* nv shrunk lines, each covering shrunk columns left to
+	 * left + width. row[] is the shrunk row in each slot, or -1.
+	 */
+	VipsPel **ring;
+	int *row;
+	int left;
+	int width;
+
+	/* Column sums for the vertical block shrink, the shrinkv result, and
+	 * the vreduce result.
+	 */
+	void *sum;
+	VipsPel *vline;
+	VipsPel *rline;
+
+	/* Shrunk columns we've allocated space for.
+	 */
+	int size;
+} VipsResizeKernelSequence;
+
+static void
+vips_resize_kernel_free_buffers( VipsResizeKernel *kernel,
+	VipsResizeKernelSequence *seq )
+{
+	if( seq->ring ) {
+		for( int i = 0; i < kernel->nv; i++ )
+			VIPS_FREE( seq->ring[i] );
+		VIPS_FREE( seq->ring );
+	}
+	VIPS_FREE( seq->sum );
+	VIPS_FREE( seq->vline );
+	VIPS_FREE( seq->rline );
+	seq->size = 0;
+}
+
+static int
+vips_resize_kernel_stop( void *vseq, void *a, void *b )
+{
+	VipsResizeKernelSequence *seq = (VipsResizeKernelSequence *) vseq;
+	VipsResizeKernel *kernel = (VipsResizeKernel *) b;
+
+	VIPS_UNREF( seq->ir );
+	vips_resize_kernel_free_buffers( kernel, seq );
+	VIPS_FREE( seq->row );
+
+	return( 0 );
+}
+
+static void *
+vips_resize_kernel_start( VipsImage *out, void *a, void *b )
+{
+	VipsImage *in = (VipsImage *) a;
+	VipsResizeKernel *kernel = (VipsResizeKernel *) b;
+
+	VipsResizeKernelSequence *seq;
+
+	if( !(seq = VIPS_NEW( out, VipsResizeKernelSequence )) )
+		return( NULL );
+
+	seq->ir = vips_region_new( in );
+	seq->ring = NULL;
+	seq->row = VIPS_ARRAY( NULL, kernel->nv, int );
+	seq->left = 0;
+	seq->width = 0;
+	seq->sum = NULL;
+	seq->vline = NULL;
+	seq->rline = NULL;
+	seq->size = 0;
+
+	if( !seq->ir ||
+		!seq->row ) {
+		vips_resize_kernel_stop( seq, in, kernel );
+		return( NULL );
+	}
+
+	for( int i = 0; i < kernel->nv; i++ )
+		seq->row[i] = -1;
+
+	return( (void *) seq );
+}
+
+/* Make sure we have buffers for width shrunk columns.
+ */
+static int
+vips_resize_kernel_alloc( VipsResizeKernel *kernel,
+	VipsResizeKernelSequence *seq, VipsImage *in, int width )
+{
+	const int ps = VIPS_IMAGE_SIZEOF_PEL( in );
+	const int ne = kernel->hshrink * width * in->Bands;
+
+	if( width <= seq->size )
+		return( 0 );
+
+	vips_resize_kernel_free_buffers( kernel, seq );
+
+	if( !(seq->ring = VIPS_ARRAY( NULL, kernel->nv, VipsPel * )) )
+		return( -1 );
+	for( int i = 0; i < kernel->nv; i++ )
+		seq->ring[i] = NULL;
+	for( int i = 0; i < kernel->nv; i++ )
+		if( !(seq->ring[i] = VIPS_ARRAY( NULL, width * ps, VipsPel )) )
+			return( -1 );
+
+	/* The sum is int for int formats, double for float.
+	 */
+	if( !(seq->sum = VIPS_ARRAY( NULL, ne * sizeof( double ), VipsPel )) ||
+		!(seq->vline = VIPS_ARRAY( NULL,
+			kernel->hshrink * width * ps, VipsPel )) ||
+		!(seq->rline = VIPS_ARRAY( NULL, width * ps, VipsPel )) )
+		return( -1 );
+
+	seq->size = width;
+
+	return( 0 );
+}
+
+/* The block shrink stages round as shrinkv and shrinkh do.
+ */
+static inline int
+resize_kernel_average( int sum, int n )
+{
+	return( (sum + n / 2) / n );
+}
+
+static inline double
+resize_kernel_average( double sum, int n )
+{
+	return( sum / n );
+}
+
+/* And the reduce stages round and clip as reducev and reduceh do.
+ */
+template <typename T, int max_value>
+static inline T
+resize_kernel_finish( int sum )
+{
+	return( VIPS_CLIP( 0, unsigned_fixed_round( sum ), max_value ) );
+}
+
+template <typename T, int max_value>
+static inline T
+resize_kernel_finish( double sum )
+{
+	return( sum );
+}
+
+/* Make shrunk line y for shrunk columns left to left + width into q. ir
+ * holds the input we need.
+ *
+ * T is the pixel type, ST is the sum type (int for int formats, double for
+ * float).
+ */
+template <typename T, typename ST>
+static void
+resize_kernel_shrink_line( VipsResizeKernel *kernel,
+	VipsResizeKernelSequence *seq, VipsRegion *ir, const int bands,
+	VipsPel *pq, int y, int left, int width )
+{
+	const int hshrink = kernel->hshrink;
+	const int vshrink = kernel->vshrink;
+
+	/* The input columns we need, see vips_resize_kernel_gen().
+	 */
+	const int in_left = VIPS_CLIP( 0, left, kernel->shrunk_width - 1 ) *
+		hshrink;
+	const int in_right = VIPS_MIN( kernel->width,
+		(VIPS_CLIP( 0, left + width - 1, kernel->shrunk_width - 1 ) +
+			1) * hshrink );
+	const int ne = (in_right - in_left) * bands;
+
+	ST * restrict sum = (ST *) seq->sum;
+	T * restrict v = (T *) seq->vline;
+	T * restrict q = (T *) pq;
+
+	/* Vertical block shrink, as vips_shrinkv(). Rows past the bottom are
+	 * copies of the last row.
+	 */
+	for( int z = 0; z < ne; z++ )
+		sum[z] = 0;
+	for( int j = 0; j < vshrink; j++ ) {
+		const int row = VIPS_MIN( y * vshrink + j, kernel->height - 1 );
+		const T * restrict p =
+			(T *) VIPS_REGION_ADDR( ir, in_left, row );
+
+		for( int z = 0; z < ne; z++ )
+			sum[z] += p[z];
+	}
+	for( int z = 0; z < ne; z++ )
+		v[z] = resize_kernel_average( sum[z], vshrink );
+
+	/* Horizontal block shrink, as vips_shrinkh(). Columns off either edge
+	 * are copies of the edge.
+	 */
+	for( int x = 0; x < width; x++ ) {
+		const int sx = VIPS_CLIP( 0, left + x,
+			kernel->shrunk_width - 1 );
+
+		for( int b = 0; b < bands; b++ ) {
+			ST s;
+
+			s = 0;
+			for( int i = 0; i < hshrink; i++ ) {
+				const int ix = VIPS_MIN( sx * hshrink + i,
+					kernel->width - 1 ) - in_left;
+
+				s += v[ix * bands + b];
+			}
+
+			q[x * bands + b] = resize_kernel_average( s, hshrink );
+		}
+	}
+}
+
+/* Reduce a line, vertically then horizontally.
+ */
+template <typename T, typename ST, typename CT, int max_value>
+static void
+resize_kernel_reduce_line( VipsResizeKernel *kernel,
+	VipsResizeKernelSequence *seq, const int bands,
+	VipsPel *pq, int y, int left, int width,
+	CT **vmask, CT **hmask )
+{
+	const int nv = kernel->nv;
+	const int nh = kernel->nh;
+	const int ne = seq->width * bands;
+
+	T * restrict r = (T *) seq->rline;
+	T * restrict q = (T *) pq;
+
+	/* vreduce into rline, as reducev_unsigned_int_tab() and
+	 * reducev_float_tab().
+	 */
+	if( nv > 1 ) {
+		const CT * restrict cy = vmask[kernel->vphase[y]];
+		const T *p[MAX_POINT];
+
+		for( int i = 0; i < nv; i++ ) {
+			const int sy = VIPS_CLIP( 0, kernel->vstart[y] + i,
+				kernel->shrunk_height - 1 );
+
+			p[i] = (T *) seq->ring[sy % nv];
+		}
+
+		for( int z = 0; z < ne; z++ ) {
+			ST sum;
+
+			sum = 0;
+			for( int i = 0; i < nv; i++ )
+				sum += cy[i] * p[i][z];
+
+			r[z] = resize_kernel_finish<T, max_value>( sum );
+		}
+	}
+	else {
+		const int sy = VIPS_CLIP( 0, y, kernel->shrunk_height - 1 );
+
+		memcpy( r, seq->ring[sy % nv], ne * sizeof( T ) );
+	}
+
+	/* hreduce to the output, as reduceh_unsigned_int_tab() and
+	 * reduceh_float_tab().
+	 */
+	if( nh > 1 )
+		for( int x = 0; x < width; x++ ) {
+			const CT * restrict cx =
+				hmask[kernel->hphase[left + x]];
+			const T * restrict p =
+				r + (kernel->hstart[left + x] - seq->left) *
+					bands;
+
+			for( int b = 0; b < bands; b++ ) {
+				ST sum;
+
+				sum = reduce_sum<T, ST>( p + b, bands, cx, nh );
+				q[x * bands + b] = resize_kernel_finish
+					<T, max_value>( sum );
+			}
+		}
+	else
+		memcpy( q, r + (left - seq->left) * bands,
+			width * bands * sizeof( T ) );
+}
+
+template <typename T, typename ST, typename CT, int max_value>
+static int
+resize_kernel_gen( VipsResizeKernel *kernel, VipsResizeKernelSequence *seq,
+	VipsImage *in, VipsRegion *out_region, CT **vmask, CT **hmask )
+{
+	const int bands = in->Bands;
+	VipsRect *r = &out_region->valid;
+	VipsRegion *ir = seq->ir;
+
+	int left;
+	int right;
+
+	/* The shrunk columns we need for this output area.
+	 */
+	if( kernel->nh > 1 ) {
+		left = kernel->hstart[r->left];
+		right = kernel->hstart[VIPS_RECT_RIGHT( r ) - 1] + kernel->nh;
+	}
+	else {
+		left = r->left;
+		right = VIPS_RECT_RIGHT( r );
+	}
+
+	if( vips_resize_kernel_alloc( kernel, seq, in, right - left ) )
+		return( -1 );
+
+	/* A new set of columns invalidates our ring.
+	 */
+	if( left != seq->left ||
+		right - left != seq->width ) {
+		seq->left = left;
+		seq->width = right - left;
+		for( int i = 0; i < kernel->nv; i++ )
+			seq->row[i] = -1;
+	}
+
+	for( int y = 0; y < r->height; y++ ) {
+		const int oy = r->top + y;
+		const int top = kernel->nv > 1 ? kernel->vstart[oy] : oy;
+
+		/* Make any shrunk lines we need which are not in the ring.
+		 */
+		for( int i = 0; i < kernel->nv; i++ ) {
+			const int sy = VIPS_CLIP( 0, top + i,
+				kernel->shrunk_height - 1 );
+			const int slot = sy % kernel->nv;
+
+			if( seq->row[slot] != sy ) {
+				const int in_left = VIPS_CLIP( 0, left,
+					kernel->shrunk_width - 1 ) *
+					kernel->hshrink;
+				const int in_right = VIPS_MIN( kernel->width,
+					(VIPS_CLIP( 0, right - 1,
+					kernel->shrunk_width - 1 ) + 1) *
+					kernel->hshrink );
+
+				VipsRect s;
+
+				s.left = in_left;
+				s.top = sy * kernel->vshrink;
+				s.width = in_right - in_left;
+				s.height = VIPS_MIN( kernel->vshrink,
+					kernel->height - s.top );
+				if( vips_region_prepare( ir, &s ) )
+					return( -1 );
+
+				VIPS_GATE_START(
+					"vips_resize_kernel_gen: work" );
+
+				resize_kernel_shrink_line<T, ST>( kernel, seq,
+					ir, bands, seq->ring[slot], sy,
+					left, right - left );
+
+				VIPS_GATE_STOP(
+					"vips_resize_kernel_gen: work" );
+
+				seq->row[slot] = sy;
+			}
+		}
+
+		VIPS_GATE_START( "vips_resize_kernel_gen: work" );
+
+		resize_kernel_reduce_line<T, ST, CT, max_value>( kernel, seq,
+			bands, VIPS_REGION_ADDR( out_region, r->left, oy ),
+			oy, r->left, r->width, vmask, hmask );
+
+		VIPS_GATE_STOP( "vips_resize_kernel_gen: work" );
+	}
+
+	return( 0 );
+}
+
+static int
+vips_resize_kernel_gen( VipsRegion *out_region, void *vseq,
+	void *a, void *b, gboolean *stop )
+{
+	VipsResizeKernelSequence *seq = (VipsResizeKernelSequence *) vseq;
+	VipsImage *in = (VipsImage *) a;
+	VipsResizeKernel *kernel = (VipsResizeKernel *) b;
+
+	int result;
+
+#ifdef DEBUG
+	printf( "vips_resize_kernel_gen: generating %d x %d at %d x %d\n",
+		out_region->valid.width, out_region->valid.height,
+		out_region->valid.left, out_region->valid.top );
+#endif /*DEBUG*/
+
+	switch( in->BandFmt ) {
+	case VIPS_FORMAT_UCHAR:
+		result = resize_kernel_gen<unsigned char, int, int, UCHAR_MAX>(
+			kernel, seq, in, out_region,
+			kernel->vmaski, kernel->hmaski );
+		break;
+
+	case VIPS_FORMAT_USHORT:
+		result = resize_kernel_gen
+			<unsigned short, int, int, USHRT_MAX>(
+			kernel, seq, in, out_region,
+			kernel->vmaski, kernel->hmaski );
+		break;
+
+	case VIPS_FORMAT_FLOAT:
+		result = resize_kernel_gen<float, double, double, 0>(
+			kernel, seq, in, out_region,
+			kernel->vmaskf, kernel->hmaskf );
+		break;
+
+	default:
+		g_assert_not_reached();
+		result = -1;
+		break;
+	}
+
+	VIPS_COUNT_PIXELS( out_region, "vips_resize_kernel_gen" );
+
+	return( result );
+}
+
+/* Positions and masks for one axis, as vips_reduceh() and vips_reducev() make
+ * them with centre sampling.
+ */
+static int
+vips_resize_kernel_axis( VipsImage *out, VipsKernel type,
+	double reduce, int n_point, int n_out, gboolean fixed_sum,
+	int **start, int **phase, int **maski, double **maskf )
+{
+	if( !(*start = VIPS_ARRAY( out, n_out, int )) ||
+		!(*phase = VIPS_ARRAY( out, n_out, int )) )
+		return( -1 );
+
+	for( int x = 0; x < n_out; x++ ) {
+		const double X = x * reduce + 0.5;
+		const int sx = X * VIPS_TRANSFORM_SCALE * 2;
+		const int six = sx & (VIPS_TRANSFORM_SCALE * 2 - 1);
+
+		/* reduceh and reducev embed by n_point / 2 - 1, take that
+		 * off to get back to shrunk image coordinates.
+		 */
+		(*start)[x] = (int) X - (n_point / 2 - 1);
+		(*phase)[x] = (six + 1) >> 1;
+	}
+
+	for( int x = 0; x < VIPS_TRANSFORM_SCALE + 1; x++ ) {
+		if( !(maskf[x] = VIPS_ARRAY( out, n_point, double )) ||
+			!(maski[x] = VIPS_ARRAY( out, n_point, int )) )
+			return( -1 );
+
+		vips_reduce_make_mask( maskf[x], type, reduce,
+			(float) x / VIPS_TRANSFORM_SCALE );
+
+		/* reducev makes int masks which sum to the scale, reduceh
+		 * just truncates.
+		 */
+		if( fixed_sum )
+			vips_vector_to_fixed_point( maskf[x], maski[x],
+				n_point, VIPS_INTERPOLATE_SCALE );
+		else
+			for( int i = 0; i < n_point; i++ )
+				maski[x][i] = maskf[x][i] *
+					VIPS_INTERPOLATE_SCALE;
+	}
+
+	return( 0 );
+}
+
+/* Can vips__resize_kernel() do this image?
+ */
+gboolean
+vips__resize_kernel_ok( VipsImage *in )
+{
+	return( in->Coding == VIPS_CODING_NONE &&
+		(in->BandFmt == VIPS_FORMAT_UCHAR ||
+		 in->BandFmt == VIPS_FORMAT_USHORT ||
+		 in->BandFmt == VIPS_FORMAT_FLOAT) );
+}
+
+/* Block shrink @in by @hshrink x @vshrink, then reduce by @hreduce x
+ * @vreduce with @type, all in one pass. Reduce factors of 1.0 mean no
+ * reduce. The result is the same as vips_shrinkv(), vips_shrinkh(),
+ * vips_reducev() and vips_reduceh() with centre sampling, in that order.
+ */
+int
+vips__resize_kernel( VipsImage *in, VipsImage **out,
+	int hshrink, int vshrink, double hreduce, double vreduce,
+	VipsKernel type )
+{
+	VipsResizeKernel *kernel;
+	int out_width;
+	int out_height;
+
+	g_assert( vips__resize_kernel_ok( in ) );
+	g_assert( hshrink >= 1 && vshrink >= 1 );
+	g_assert( hreduce >= 1.0 && vreduce >= 1.0 );
+
+	*out = vips_image_new();
+	if( !(kernel = VIPS_NEW( *out, VipsResizeKernel )) ) {
+		VIPS_UNREF( *out );
+		return( -1 );
+	}
+
+	kernel->hshrink = hshrink;
+	kernel->vshrink = vshrink;
+	kernel->hreduce = hreduce;
+	kernel->vreduce = vreduce;
+	kernel->width = in->Xsize;
+	kernel->height = in->Ysize;
+
+	/* Sizes as the four operations compute them.
+	 */
+	kernel->shrunk_width = hshrink > 1 ?
+		VIPS_ROUND_UINT( (double) in->Xsize / hshrink ) : in->Xsize;
+	kernel->shrunk_height = vshrink > 1 ?
+		VIPS_ROUND_UINT( (double) in->Ysize / vshrink ) : in->Ysize;
+	out_width = hreduce > 1.0 ?
+		VIPS_ROUND_UINT( kernel->shrunk_width / hreduce ) :
+		kernel->shrunk_width;
+	out_height = vreduce > 1.0 ?
+		VIPS_ROUND_UINT( kernel->shrunk_height / vreduce ) :
+		kernel->shrunk_height;
+	if( kernel->shrunk_width <= 0 ||
+		kernel->shrunk_height <= 0 ||
+		out_width <= 0 ||
+		out_height <= 0 ) {
+		vips_error( "resize",
+			"%s", _( "image has shrunk to nothing" ) );
+		VIPS_UNREF( *out );
+		return( -1 );
+	}
+
+	kernel->nh = hreduce > 1.0 ?
+		vips_reduce_get_points( type, hreduce ) : 1;
+	kernel->nv = vreduce > 1.0 ?
+		vips_reduce_get_points( type, vreduce ) : 1;
+	if( kernel->nh > MAX_POINT ||
+		kernel->nv > MAX_POINT ) {
+		vips_error( "resize", "%s", _( "reduce factor too large" ) );
+		VIPS_UNREF( *out );
+		return( -1 );
+	}
+
+	if( (kernel->nh > 1 &&
+		vips_resize_kernel_axis( *out, type, hreduce,
+			kernel->nh, out_width, FALSE,
+			&kernel->hstart, &kernel->hphase,
+			kernel->hmaski, kernel->hmaskf )) ||
+		(kernel->nv > 1 &&
+		 vips_resize_kernel_axis( *out, type, vreduce,
+			kernel->nv, out_height, TRUE,
+			&kernel->vstart, &kernel->vphase,
+			kernel->vmaski, kernel->vmaskf )) ) {
+		VIPS_UNREF( *out );
+		return( -1 );
+	}
+
+	/* FATSTRIP, as reducev, so the ring buffer is reused across the
+	 * height of each strip.
+	 */
+	if( vips_image_pipelinev( *out,
+		VIPS_DEMAND_STYLE_FATSTRIP, in, NULL ) ) {
+		VIPS_UNREF( *out );
+		return( -1 );
+	}
+	(*out)->Xsize = out_width;
+	(*out)->Ysize = out_height;
+
+#ifdef DEBUG
+	printf( "vips__resize_kernel: %d x %d -> %d x %d -> %d x %d\n",
+		in->Xsize, in->Ysize,
+		kernel->shrunk_width, kernel->shrunk_height,
+		out_width, out_height );
+#endif /*DEBUG*/
+
+	if( vips_image_generate( *out,
+		vips_resize_kernel_start, vips_resize_kernel_gen,
+			vips_resize_kernel_stop,
+		in, kernel ) ) {
+		VIPS_UNREF( *out );
+		return( -1 );
+	}
+
+	vips_reorder_margin_hint( *out, kernel->nv * vshrink );
+
+	return( 0 );
+}
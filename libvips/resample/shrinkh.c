@@ -6,6 +6,11 @@
  * 	- reorganise loops, 30% faster, vectorisable
  * 15/8/16
  * 	- rename xshrink -> hshrink for greater consistency 
+ * 14/10/18
+ * 	- use a native SIMD kernel for 4-band uchar, if there is one
+ * 	- divide by a reciprocal for uchar and ushort
+ * 	- special path for hshrink == 2
+ * 	- SIMD kernel for 4-band ushort too
  */
 
 /*
@@ -46,11 +51,13 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <math.h>
 
 #include <vips/vips.h>
 #include <vips/debug.h>
 #include <vips/internal.h>
+#include <vips/simd.h>
 
 #include "presample.h"
 
@@ -59,6 +66,16 @@ typedef struct _VipsShrinkh {
 
 	int hshrink;		/* Shrink factor */
 
+	/* A native kernel for 4-band uchar and ushort, if there is one.
+	 */
+	VipsSimdShrinkhFn simd;
+
+	/* For uchar and ushort, divide by hshrink with a multiply and shift.
+	 */
+	gboolean reciprocal;
+	guint64 m;
+	int s;
+
 } VipsShrinkh;
 
 typedef VipsResampleClass VipsShrinkhClass;
@@ -90,6 +107,51 @@ G_DEFINE_TYPE( VipsShrinkh, vips_shrinkh, VIPS_TYPE_RESAMPLE );
 	} \
 }
 
+/* Integer shrink with a reciprocal, for uchar and ushort.
+ */
+#define RSHRINK( TYPE, BANDS ) { \
+	TYPE * restrict p = (TYPE *) in; \
+	TYPE * restrict q = (TYPE *) out; \
+	const int round = shrink->hshrink / 2; \
+	const guint64 m = shrink->m; \
+	const int s = shrink->s; \
+	\
+	for( x = 0; x < width; x++ ) { \
+		for( b = 0; b < BANDS; b++ ) { \
+			int sum; \
+			\
+			sum = 0; \
+			x1 = b; \
+			VIPS_UNROLL( shrink->hshrink, INNER( BANDS ) ); \
+			q[b] = ((guint64) (sum + round) * m) >> s; \
+		} \
+		p += ne; \
+		q += BANDS; \
+	} \
+}
+
+#define USHRINK( TYPE, BANDS ) { \
+	if( shrink->reciprocal ) \
+		RSHRINK( TYPE, BANDS ) \
+	else \
+		ISHRINK( TYPE, BANDS ) \
+}
+
+/* hshrink == 2 for uchar and ushort, very common after shrink-on-load.
+ * (sum + 1) / 2 is (a + b + 1) >> 1 for unsigned a and b.
+ */
+#define SHRINK2( TYPE, BANDS ) { \
+	TYPE * restrict p = (TYPE *) in; \
+	TYPE * restrict q = (TYPE *) out; \
+	\
+	for( x = 0; x < width; x++ ) { \
+		for( b = 0; b < BANDS; b++ ) \
+			q[b] = (p[b] + p[b + BANDS] + 1) >> 1; \
+		p += ne; \
+		q += BANDS; \
+	} \
+}
+
 /* Float shrink. 
  */
 #define FSHRINK( TYPE ) { \
@@ -135,22 +197,42 @@ vips_shrinkh_gen2( VipsShrinkh *shrink, VipsRegion *or, VipsRegion *ir,
 		 * Vectorisation doesn't help much for 16, 32-bit or float
 		 * data, don't bother with them.
 		 */
-		switch( bands ) {
-		case 1:
-			ISHRINK( unsigned char, 1 ); break;
-		case 3:
-			ISHRINK( unsigned char, 3 ); break;
-		case 4:
-			ISHRINK( unsigned char, 4 ); break;
-		default:
-			ISHRINK( unsigned char, bands ); break;
-		}
+		if( shrink->simd )
+			shrink->simd( out, in, width, shrink->hshrink );
+		else if( shrink->hshrink == 2 )
+			switch( bands ) {
+			case 1:
+				SHRINK2( unsigned char, 1 ); break;
+			case 3:
+				SHRINK2( unsigned char, 3 ); break;
+			case 4:
+				SHRINK2( unsigned char, 4 ); break;
+			default:
+				SHRINK2( unsigned char, bands ); break;
+			}
+		else
+			switch( bands ) {
+			case 1:
+				USHRINK( unsigned char, 1 ); break;
+			case 3:
+				USHRINK( unsigned char, 3 ); break;
+			case 4:
+				USHRINK( unsigned char, 4 ); break;
+			default:
+				USHRINK( unsigned char, bands ); break;
+			}
 		break;
 
 	case VIPS_FORMAT_CHAR: 	
 		ISHRINK( char, bands ); break; 
 	case VIPS_FORMAT_USHORT: 
-		ISHRINK( unsigned short, bands ); break;
+		if( shrink->simd )
+			shrink->simd( out, in, width, shrink->hshrink );
+		else if( shrink->hshrink == 2 )
+			SHRINK2( unsigned short, bands )
+		else
+			USHRINK( unsigned short, bands );
+		break;
 	case VIPS_FORMAT_SHORT: 	
 		ISHRINK( short, bands ); break; 
 	case VIPS_FORMAT_UINT: 	
@@ -267,6 +349,25 @@ vips_shrinkh_build( VipsObject *object )
 		return( -1 );
 	in = t[1];
 
+	if( (in->BandFmt == VIPS_FORMAT_UCHAR ||
+		 in->BandFmt == VIPS_FORMAT_USHORT) &&
+		in->Bands == 4 )
+		shrink->simd = (VipsSimdShrinkhFn) 
+			vips_simd_get( VIPS_SIMD_SHRINKH, in->BandFmt );
+
+	/* Divides are slow, use a reciprocal if we can.
+	 */
+	if( in->BandFmt == VIPS_FORMAT_UCHAR ||
+		in->BandFmt == VIPS_FORMAT_USHORT ) {
+		guint64 max = (guint64) shrink->hshrink *
+			(in->BandFmt == VIPS_FORMAT_UCHAR ?
+			 	UCHAR_MAX : USHRT_MAX) +
+			shrink->hshrink / 2;
+
+		shrink->reciprocal = vips__shrink_reciprocal( shrink->hshrink,
+			max, &shrink->m, &shrink->s );
+	}
+
 	if( vips_image_pipelinev( resample->out, 
 		VIPS_DEMAND_STYLE_THINSTRIP, in, NULL ) )
 		return( -1 );
@@ -45,6 +45,10 @@
  * 	- rename yshrink -> vshrink for greater consistency 
  * 7/3/17
  * 	- add a seq line cache
+ * 14/10/18
+ * 	- use a native SIMD kernel for the line sum, if there is one
+ * 	- divide by a reciprocal for uchar and ushort
+ * 	- special path for vshrink == 2
  */
 
 /*
@@ -85,12 +89,14 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <math.h>
 
 #include <vips/vips.h>
 #include <vips/debug.h>
 #include <vips/internal.h>
+#include <vips/simd.h>
 
 #include "presample.h"
 
@@ -100,12 +106,44 @@ typedef struct _VipsShrinkv {
 	int vshrink;
 	size_t sizeof_line_buffer;
 
+	/* A native kernel for the line sum, if there is one.
+	 */
+	VipsSimdShrinkvFn simd;
+
+	/* For uchar and ushort, divide by vshrink with a multiply and shift.
+	 */
+	gboolean reciprocal;
+	guint64 m;
+	int s;
+
 } VipsShrinkv;
 
 typedef VipsResampleClass VipsShrinkvClass;
 
 G_DEFINE_TYPE( VipsShrinkv, vips_shrinkv, VIPS_TYPE_RESAMPLE );
 
+/* Find m and s such that (v * m) >> s == v / n for all 0 <= v <= max, see
+ * Granlund and Montgomery, "Division by invariant integers using
+ * multiplication". FALSE if the product could overflow 64 bits.
+ */
+gboolean
+vips__shrink_reciprocal( int n, guint64 max, guint64 *m, int *s )
+{
+	int k, l;
+
+	for( k = 0; k < 32 && ((guint64) 1 << k) <= max; k++ )
+		;
+	for( l = 0; (1 << l) < n; l++ )
+		;
+	if( k > 31 )
+		return( FALSE );
+
+	*s = k + l;
+	*m = ((guint64) 1 << (k + l)) / n + 1;
+
+	return( TRUE );
+}
+
 /* Our per-sequence parameter struct. Somewhere to sum band elements.
  */
 typedef struct {
@@ -170,6 +208,12 @@ vips_shrinkv_add_line( VipsShrinkv *shrink, VipsShrinkvSequence *seq,
 	int x;
 
 	VipsPel *in = VIPS_REGION_ADDR( ir, left, top ); 
+
+	if( shrink->simd ) {
+		shrink->simd( (int *) seq->sum, in, sz );
+		return;
+	}
+
 	switch( resample->in->BandFmt ) {
 	case VIPS_FORMAT_UCHAR: 	
 		ADD( int, unsigned char ); break;
@@ -207,6 +251,19 @@ vips_shrinkv_add_line( VipsShrinkv *shrink, VipsShrinkvSequence *seq,
 		q[x] = (sum[x] + shrink->vshrink / 2) / shrink->vshrink; \
 } 
 
+/* Integer average with a reciprocal, for uchar and ushort sums.
+ */
+#define RAVG( TYPE ) { \
+	int * restrict sum = (int *) seq->sum; \
+	TYPE * restrict q = (TYPE *) out; \
+	const int round = shrink->vshrink / 2; \
+	const guint64 m = shrink->m; \
+	const int s = shrink->s; \
+	\
+	for( x = 0; x < sz; x++ ) \
+		q[x] = ((guint64) (sum[x] + round) * m) >> s; \
+}
+
 /* Float average. 
  */
 #define FAVG( TYPE ) { \
@@ -234,11 +291,19 @@ vips_shrinkv_write_line( VipsShrinkv *shrink, VipsShrinkvSequence *seq,
 	VipsPel *out = VIPS_REGION_ADDR( or, left, top ); 
 	switch( resample->in->BandFmt ) {
 	case VIPS_FORMAT_UCHAR: 	
-		IAVG( unsigned char ); break;
+		if( shrink->reciprocal )
+			RAVG( unsigned char )
+		else
+			IAVG( unsigned char );
+		break;
 	case VIPS_FORMAT_CHAR: 	
 		IAVG( char ); break; 
 	case VIPS_FORMAT_USHORT: 
-		IAVG( unsigned short ); break;
+		if( shrink->reciprocal )
+			RAVG( unsigned short )
+		else
+			IAVG( unsigned short );
+		break;
 	case VIPS_FORMAT_SHORT: 	
 		IAVG( short ); break; 
 	case VIPS_FORMAT_UINT: 	
@@ -259,12 +324,69 @@ vips_shrinkv_write_line( VipsShrinkv *shrink, VipsShrinkvSequence *seq,
 	}
 }
 
+/* Average two lines straight to the output, skipping the accumulator. The
+ * compiler will be able to vectorise these.
+ */
+#define AVG2( TYPE ) { \
+	TYPE * restrict p0 = (TYPE *) p; \
+	TYPE * restrict p1 = (TYPE *) (p + lskip); \
+	TYPE * restrict q = (TYPE *) out; \
+	\
+	for( x = 0; x < sz; x++ ) \
+		q[x] = (p0[x] + p1[x] + 1) >> 1; \
+}
+
+/* The vshrink == 2 case for uchar and ushort, very common after
+ * shrink-on-load. (sum + 1) / 2 is (a + b + 1) >> 1 for unsigned a and b.
+ */
+static int
+vips_shrinkv_gen2( VipsShrinkv *shrink, VipsRegion *or, VipsRegion *ir )
+{
+	VipsResample *resample = VIPS_RESAMPLE( shrink );
+	VipsRect *r = &or->valid;
+	const int sz = r->width * resample->in->Bands;
+
+	int x, y;
+
+	for( y = 0; y < r->height; y++ ) {
+		VipsRect s;
+		VipsPel *p;
+		VipsPel *out;
+		size_t lskip;
+
+		s.left = r->left;
+		s.top = (y + r->top) * 2;
+		s.width = r->width;
+		s.height = 2;
+		if( vips_region_prepare( ir, &s ) )
+			return( -1 );
+
+		VIPS_GATE_START( "vips_shrinkv_gen: work" );
+
+		p = VIPS_REGION_ADDR( ir, s.left, s.top );
+		lskip = VIPS_REGION_LSKIP( ir );
+		out = VIPS_REGION_ADDR( or, r->left, r->top + y );
+
+		if( resample->in->BandFmt == VIPS_FORMAT_UCHAR )
+			AVG2( unsigned char )
+		else
+			AVG2( unsigned short )
+
+		VIPS_GATE_STOP( "vips_shrinkv_gen: work" );
+	}
+
+	VIPS_COUNT_PIXELS( or, "vips_shrinkv_gen" );
+
+	return( 0 );
+}
+
 static int
 vips_shrinkv_gen( VipsRegion *or, void *vseq, 
 	void *a, void *b, gboolean *stop )
 {
 	VipsShrinkvSequence *seq = (VipsShrinkvSequence *) vseq;
 	VipsShrinkv *shrink = (VipsShrinkv *) b;
+	VipsResample *resample = VIPS_RESAMPLE( shrink );
 	VipsRegion *ir = seq->ir;
 	VipsRect *r = &or->valid;
 
@@ -281,6 +403,11 @@ vips_shrinkv_gen( VipsRegion *or, void *vseq,
 		r->width, r->height, r->left, r->top ); 
 #endif /*DEBUG*/
 
+	if( shrink->vshrink == 2 &&
+		(resample->in->BandFmt == VIPS_FORMAT_UCHAR ||
+		 resample->in->BandFmt == VIPS_FORMAT_USHORT) )
+		return( vips_shrinkv_gen2( shrink, or, ir ) );
+
 	for( y = 0; y < r->height; y++ ) { 
 		memset( seq->sum, 0, shrink->sizeof_line_buffer ); 
 
@@ -366,6 +493,22 @@ vips_shrinkv_build( VipsObject *object )
 		in->Xsize * in->Bands * 
 		vips_format_sizeof( VIPS_FORMAT_DPCOMPLEX );
 
+	shrink->simd = (VipsSimdShrinkvFn) 
+		vips_simd_get( VIPS_SIMD_SHRINKV, in->BandFmt );
+
+	/* Divides are slow, use a reciprocal if we can.
+	 */
+	if( in->BandFmt == VIPS_FORMAT_UCHAR ||
+		in->BandFmt == VIPS_FORMAT_USHORT ) {
+		guint64 max = (guint64) shrink->vshrink *
+			(in->BandFmt == VIPS_FORMAT_UCHAR ?
+			 	UCHAR_MAX : USHRT_MAX) +
+			shrink->vshrink / 2;
+
+		shrink->reciprocal = vips__shrink_reciprocal( shrink->vshrink,
+			max, &shrink->m, &shrink->s );
+	}
+
 	/* SMALLTILE or we'll need huge input areas for our output. In seq
 	 * mode, the linecache above will keep us sequential. 
 	 */
@@ -11,6 +11,14 @@
  * 	- don't cache (thanks tomasc)
  * 30/8/17
  * 	- add intent option, thanks kleisauke
+ * 14/10/18
+ * 	- linear mode for sRGB images works in 16-bit
+ * 	- use PNG and GIF shrink-on-load
+ * 	- load from the best level of TIFF and OpenSlide pyramids
+ * 	- add @quality
+ * 	- add vips_thumbnail_multi()
+ * 	- fast mode uses jpeg shrink-on-load of 16 and 32
+ * 	- add @embedded and @embedded_only
  */
 
 /*
@@ -70,6 +78,21 @@
 	(G_TYPE_INSTANCE_GET_CLASS( (obj), \
 		VIPS_TYPE_THUMBNAIL, VipsThumbnailClass ))
 
+/* Max number of pyramid levels we track.
+ */
+#define MAX_LEVELS (256)
+
+/* In auto quality mode, thumbnails smaller than this on both axes and
+ * shrinking by at least FAST_SHRINK use the fast path.
+ */
+#define FAST_SIZE (64)
+#define FAST_SHRINK (8)
+
+/* An embedded thumbnail must have the same aspect ratio as the main image
+ * to within this fraction. Some cameras letterbox a 4:3 preview.
+ */
+#define EMBEDDED_ASPECT (0.02)
+
 typedef struct _VipsThumbnail {
 	VipsOperation parent_instance;
 
@@ -84,6 +107,9 @@ typedef struct _VipsThumbnail {
 	char *export_profile;
 	char *import_profile;
 	VipsIntent intent;
+	VipsThumbnailQuality quality;
+	gboolean embedded;
+	gboolean embedded_only;
 
 	/* Set by subclasses to the input image.
 	 */
@@ -97,6 +123,28 @@ typedef struct _VipsThumbnail {
 	int input_height;
 	VipsAngle angle; 		/* From vips_autorot_get_angle() */
 
+	/* For pyramidal TIFF and OpenSlide, the size of each level.
+	 * level_count is zero if we didn't find a pyramid.
+	 */
+	int level_count;
+	int level_width[MAX_LEVELS];
+	int level_height[MAX_LEVELS];
+
+	/* Set by vips_thumbnail_open() to the pyramid level to load, or 0.
+	 * This is a page number for TIFF.
+	 */
+	int level;
+
+	/* Set by vips_thumbnail_open() if we've picked the fast path.
+	 */
+	gboolean fast;
+
+	/* The EXIF thumbnail, if we might use it, and the orientation of the
+	 * main image, which applies to the thumbnail as well.
+	 */
+	VipsArea *embedded_data;
+	int orientation;
+
 } VipsThumbnail;
 
 typedef struct _VipsThumbnailClass {
@@ -119,12 +167,16 @@ G_DEFINE_ABSTRACT_TYPE( VipsThumbnail, vips_thumbnail, VIPS_TYPE_OPERATION );
 static void
 vips_thumbnail_dispose( GObject *gobject )
 {
+	VipsThumbnail *thumbnail = (VipsThumbnail *) gobject;
+
 #ifdef DEBUG
 	printf( "vips_thumbnail_dispose: " );
 	vips_object_print_name( VIPS_OBJECT( gobject ) );
 	printf( "\n" );
 #endif /*DEBUG*/
 
+	VIPS_FREEF( vips_area_unref, thumbnail->embedded_data );
+
 	G_OBJECT_CLASS( vips_thumbnail_parent_class )->dispose( gobject );
 }
 
@@ -233,6 +285,20 @@ vips_thumbnail_find_jpegshrink( VipsThumbnail *thumbnail, int width, int height
 	if( thumbnail->linear )
 		return( 1 ); 
 
+	/* In fast mode, block shrink as far as we can and leave the rest to a
+	 * cheap linear reduce.
+	 */
+	if( thumbnail->fast ) {
+		if( shrink >= 8 )
+			return( 8 );
+		else if( shrink >= 4 )
+			return( 4 );
+		else if( shrink >= 2 )
+			return( 2 );
+		else
+			return( 1 );
+	}
+
 	/* Shrink-on-load is a simple block shrink and will add quite a bit of
 	 * extra sharpness to the image. We want to block shrink to a
 	 * bit above our target, then vips_shrink() / vips_reduce() to the 
@@ -250,6 +316,243 @@ vips_thumbnail_find_jpegshrink( VipsThumbnail *thumbnail, int width, int height
 		return( 1 );
 }
 
+/* Should we use the fast path? For tiny thumbnails from large images, the
+ * difference between lanczos3 and a block shrink plus linear reduce is
+ * invisible, but the speed difference is large.
+ */
+static gboolean
+vips_thumbnail_pick_fast( VipsThumbnail *thumbnail )
+{
+	double hshrink;
+	double vshrink;
+
+	switch( thumbnail->quality ) {
+	case VIPS_THUMBNAIL_QUALITY_FAST:
+		return( TRUE );
+
+	case VIPS_THUMBNAIL_QUALITY_AUTO:
+		vips_thumbnail_calculate_shrink( thumbnail,
+			thumbnail->input_width, thumbnail->input_height,
+			&hshrink, &vshrink );
+
+		return( hshrink >= FAST_SHRINK &&
+			vshrink >= FAST_SHRINK &&
+			thumbnail->input_width / hshrink < FAST_SIZE &&
+			thumbnail->input_height / vshrink < FAST_SIZE );
+
+	case VIPS_THUMBNAIL_QUALITY_HIGH:
+	default:
+		return( FALSE );
+	}
+}
+
+/* Find the smallest pyramid level which is still larger than the target.
+ */
+static int
+vips_thumbnail_find_pyrlevel( VipsThumbnail *thumbnail )
+{
+	int level;
+
+	g_assert( thumbnail->level_count > 0 );
+
+	for( level = thumbnail->level_count - 1; level > 0; level-- )
+		if( vips_thumbnail_calculate_common_shrink( thumbnail,
+			thumbnail->level_width[level],
+			thumbnail->level_height[level] ) >= 1.0 )
+			break;
+
+	return( level );
+}
+
+/* Look for a pyramid in a TIFF. Pyramid levels are written as a series of
+ * pages, each about half the size of the one before. Open each page
+ * header in turn and stop at the first one which doesn't fit.
+ */
+static void
+vips_thumbnail_get_tiff_pyramid( VipsThumbnail *thumbnail )
+{
+	VipsThumbnailClass *class = VIPS_THUMBNAIL_GET_CLASS( thumbnail );
+
+	int i;
+
+	thumbnail->level_width[0] = thumbnail->input_width;
+	thumbnail->level_height[0] = thumbnail->input_height;
+
+	for( i = 1; i < MAX_LEVELS; i++ ) {
+		VipsImage *page;
+		int expected_width;
+		int expected_height;
+
+		thumbnail->level = i;
+		page = class->open( thumbnail, 1, 1.0 );
+		thumbnail->level = 0;
+
+		if( !page ) {
+			/* Off the end of the file, most likely.
+			 */
+			vips_error_clear();
+			break;
+		}
+
+		/* Allow for rounding in the pyramid builder.
+		 */
+		expected_width = thumbnail->level_width[i - 1] / 2;
+		expected_height = thumbnail->level_height[i - 1] / 2;
+		if( abs( page->Xsize - expected_width ) > 2 ||
+			abs( page->Ysize - expected_height ) > 2 ||
+			page->Xsize < 1 ||
+			page->Ysize < 1 ) {
+			g_object_unref( page );
+			break;
+		}
+
+		thumbnail->level_width[i] = page->Xsize;
+		thumbnail->level_height[i] = page->Ysize;
+		g_object_unref( page );
+	}
+
+	if( i > 1 ) {
+		thumbnail->level_count = i;
+		g_info( "found TIFF pyramid with %d levels", i );
+	}
+}
+
+/* OpenSlide puts the size of each level into the image metadata.
+ */
+static void
+vips_thumbnail_get_openslide_levels( VipsThumbnail *thumbnail,
+	VipsImage *image )
+{
+	const char *str;
+	int level_count;
+	int i;
+
+	if( vips_image_get_typeof( image, "openslide.level-count" ) &&
+		!vips_image_get_string( image, "openslide.level-count", &str ) )
+		level_count = atoi( str );
+	else
+		level_count = 0;
+	level_count = VIPS_CLIP( 0, level_count, MAX_LEVELS );
+
+	for( i = 0; i < level_count; i++ ) {
+		char name[256];
+
+		vips_snprintf( name, 256, "openslide.level[%d].width", i );
+		if( !vips_image_get_typeof( image, name ) ||
+			vips_image_get_string( image, name, &str ) )
+			break;
+		thumbnail->level_width[i] = atoi( str );
+
+		vips_snprintf( name, 256, "openslide.level[%d].height", i );
+		if( !vips_image_get_typeof( image, name ) ||
+			vips_image_get_string( image, name, &str ) )
+			break;
+		thumbnail->level_height[i] = atoi( str );
+	}
+
+	if( i == level_count &&
+		level_count > 1 ) {
+		thumbnail->level_count = level_count;
+		g_info( "found OpenSlide pyramid with %d levels",
+			level_count );
+	}
+}
+
+/* Called by get_info with the header of the main image. Keep the EXIF
+ * thumbnail if we might use it.
+ *
+ * The thumbnail is a plain JPEG with no profile, so unless we've been told
+ * to use it whatever, the main image must be plain sRGB too.
+ */
+static void
+vips_thumbnail_get_embedded( VipsThumbnail *thumbnail, VipsImage *image )
+{
+	GValue value = { 0 };
+
+	if( !(thumbnail->embedded || thumbnail->embedded_only) ||
+		!vips_image_get_typeof( image, "jpeg-thumbnail-data" ) )
+		return;
+
+	if( !thumbnail->embedded_only &&
+		(image->Bands != 3 ||
+		 image->Type != VIPS_INTERPRETATION_sRGB ||
+		 vips_image_get_typeof( image, VIPS_META_ICC_NAME )) ) {
+		g_info( "embedded thumbnail colour does not match" );
+		return;
+	}
+
+	if( vips_image_get( image, "jpeg-thumbnail-data", &value ) ) {
+		vips_error_clear();
+		return;
+	}
+	VIPS_FREEF( vips_area_unref, thumbnail->embedded_data );
+	thumbnail->embedded_data = (VipsArea *) g_value_dup_boxed( &value );
+	g_value_unset( &value );
+
+	if( vips_image_get_typeof( image, VIPS_META_ORIENTATION ) &&
+		vips_image_get_int( image,
+			VIPS_META_ORIENTATION, &thumbnail->orientation ) )
+		vips_error_clear();
+}
+
+/* Decode the EXIF thumbnail, if it's big enough and the right shape.
+ * Return NULL, with no error set, if we can't use it.
+ */
+static VipsImage *
+vips_thumbnail_open_embedded( VipsThumbnail *thumbnail )
+{
+	VipsArea *area = thumbnail->embedded_data;
+
+	VipsImage *header;
+	VipsImage *x;
+	double main_aspect;
+	double aspect;
+
+	if( !area ||
+		!(header = vips_image_new_from_buffer( area->data, area->length,
+			"", NULL )) ) {
+		vips_error_clear();
+		return( NULL );
+	}
+
+	g_info( "embedded thumbnail is %d x %d",
+		header->Xsize, header->Ysize );
+
+	if( !thumbnail->embedded_only ) {
+		main_aspect = (double) thumbnail->input_width /
+			thumbnail->input_height;
+		aspect = (double) header->Xsize / header->Ysize;
+
+		if( header->Bands != 3 ||
+			fabs( aspect - main_aspect ) >
+				EMBEDDED_ASPECT * main_aspect ||
+			vips_thumbnail_calculate_common_shrink( thumbnail,
+				header->Xsize, header->Ysize ) < 1.0 ) {
+			g_info( "embedded thumbnail not suitable" );
+			g_object_unref( header );
+			return( NULL );
+		}
+	}
+
+	/* It's tiny, so decode to memory and we needn't keep the EXIF
+	 * around.
+	 */
+	x = vips_image_copy_memory( header );
+	g_object_unref( header );
+	if( !x ) {
+		vips_error_clear();
+		return( NULL );
+	}
+
+	if( thumbnail->orientation > 1 )
+		vips_image_set_int( x,
+			VIPS_META_ORIENTATION, thumbnail->orientation );
+	else
+		vips_autorot_remove_angle( x );
+
+	return( x );
+}
+
 /* Open the image, returning the best version for thumbnailing. 
  *
  * For example, libjpeg supports fast shrink-on-read, so if we have a JPEG, 
@@ -270,13 +573,57 @@ vips_thumbnail_open( VipsThumbnail *thumbnail )
 	g_info( "input size is %d x %d", 
 		thumbnail->input_width, thumbnail->input_height ); 
 
+	/* The embedded thumbnail means we never decode the main image.
+	 */
+	if( (im = vips_thumbnail_open_embedded( thumbnail )) ) {
+		g_info( "using embedded thumbnail" );
+		return( im );
+	}
+	if( thumbnail->embedded_only ) {
+		vips_error( VIPS_OBJECT_GET_CLASS( thumbnail )->nickname,
+			"%s", _( "no embedded thumbnail" ) );
+		return( NULL );
+	}
+
+	/* The fast path works in sRGB, so we can use shrink-on-load.
+	 */
+	thumbnail->fast = vips_thumbnail_pick_fast( thumbnail );
+	if( thumbnail->fast ) {
+		g_info( "using fast path" );
+		thumbnail->linear = FALSE;
+	}
+
 	shrink = 1.0;
 	scale = 1.0;
 
-	if( vips_isprefix( "VipsForeignLoadJpeg", thumbnail->loader ) ) {
+	if( thumbnail->level_count > 0 ) {
+		/* We found a pyramid: load the smallest level which is still
+		 * larger than our target.
+		 */
+		thumbnail->level = vips_thumbnail_find_pyrlevel( thumbnail );
+
+		g_info( "loading pyramid level %d", thumbnail->level );
+	}
+	else if( vips_isprefix( "VipsForeignLoadJpeg", thumbnail->loader ) ) {
 		shrink = vips_thumbnail_find_jpegshrink( thumbnail, 
 			thumbnail->input_width, thumbnail->input_height );
 
+		/* In fast mode, jpegload can shrink further by boxing the
+		 * raw planes.
+		 */
+		if( thumbnail->fast &&
+			shrink == 8 ) {
+			double common = vips_thumbnail_calculate_common_shrink(
+				thumbnail,
+				thumbnail->input_width,
+				thumbnail->input_height );
+
+			if( common >= 32 )
+				shrink = 32;
+			else if( common >= 16 )
+				shrink = 16;
+		}
+
 		g_info( "loading jpeg with factor %g pre-shrink", shrink ); 
 	}
 	else if( vips_isprefix( "VipsForeignLoadPdf", thumbnail->loader ) ||
@@ -294,6 +641,16 @@ vips_thumbnail_open( VipsThumbnail *thumbnail )
 
 		g_info( "loading webp with factor %g pre-shrink", shrink ); 
 	}
+	else if( vips_isprefix( "VipsForeignLoadPng", thumbnail->loader ) ||
+		vips_isprefix( "VipsForeignLoadGif", thumbnail->loader ) ) {
+		/* PNG and GIF shrink-on-load are block shrinks or subsamples,
+		 * so leave some headroom for vips_resize(), as for JPEG.
+		 */
+		shrink = vips_thumbnail_find_jpegshrink( thumbnail,
+			thumbnail->input_width, thumbnail->input_height );
+
+		g_info( "loading png/gif with factor %g pre-shrink", shrink );
+	}
 
 	if( !(im = class->open( thumbnail, shrink, scale )) )
 		return( NULL );
@@ -305,10 +662,9 @@ static int
 vips_thumbnail_build( VipsObject *object )
 {
 	VipsThumbnail *thumbnail = VIPS_THUMBNAIL( object );
-	VipsImage **t = (VipsImage **) vips_object_local_array( object, 12 );
-	VipsInterpretation interpretation = thumbnail->linear ?
-		VIPS_INTERPRETATION_scRGB : VIPS_INTERPRETATION_sRGB; 
+	VipsImage **t = (VipsImage **) vips_object_local_array( object, 14 );
 
+	VipsInterpretation interpretation;
 	VipsImage *in;
 	double hshrink;
 	double vshrink;
@@ -323,6 +679,12 @@ vips_thumbnail_build( VipsObject *object )
 	gboolean have_premultiplied;
 	VipsBandFormat unpremultiplied_format;
 
+	/* TRUE if we're shrinking 16-bit linear light and need to go back to
+	 * sRGB.
+	 */
+	gboolean have_linear16;
+	VipsInterpretation device;
+
 #ifdef DEBUG
 	printf( "vips_thumbnail_build: " );
 	vips_object_print_name( object );
@@ -339,6 +701,12 @@ vips_thumbnail_build( VipsObject *object )
 		return( -1 );
 	in = t[0];
 
+	/* Open can turn off linear, so we must pick the processing space
+	 * after it.
+	 */
+	interpretation = thumbnail->linear ?
+		VIPS_INTERPRETATION_scRGB : VIPS_INTERPRETATION_sRGB;
+
 	/* RAD needs special unpacking.
 	 */
 	if( in->Coding == VIPS_CODING_RAD ) {
@@ -386,13 +754,39 @@ vips_thumbnail_build( VipsObject *object )
 		have_imported = TRUE;
 	}
 
-	/* To the processing colourspace. This will unpack LABQ as well.
+	/* Linear mode for plain sRGB images can work in 16-bit linear light,
+	 * which is much quicker than float.
 	 */
-	g_info( "converting to processing space %s",
-		vips_enum_nick( VIPS_TYPE_INTERPRETATION, interpretation ) ); 
-	if( vips_colourspace( in, &t[2], interpretation, NULL ) ) 
-		return( -1 ); 
-	in = t[2];
+	have_linear16 = FALSE;
+	device = vips_image_guess_interpretation( in );
+	if( thumbnail->linear &&
+		!have_imported &&
+		in->Coding == VIPS_CODING_NONE &&
+		in->Bands >= 3 &&
+		((device == VIPS_INTERPRETATION_sRGB &&
+		  in->BandFmt == VIPS_FORMAT_UCHAR) ||
+		 (device == VIPS_INTERPRETATION_RGB16 &&
+		  in->BandFmt == VIPS_FORMAT_USHORT)) ) {
+		g_info( "converting to 16-bit linear light" );
+		if( vips_sRGB2scRGB( in, &t[2],
+			"format", VIPS_FORMAT_USHORT,
+			NULL ) )
+			return( -1 );
+		in = t[2];
+
+		have_linear16 = TRUE;
+	}
+	else {
+		/* To the processing colourspace. This will unpack LABQ as
+		 * well.
+		 */
+		g_info( "converting to processing space %s",
+			vips_enum_nick( VIPS_TYPE_INTERPRETATION,
+				interpretation ) );
+		if( vips_colourspace( in, &t[2], interpretation, NULL ) )
+			return( -1 );
+		in = t[2];
+	}
 
 	/* If there's an alpha, we have to premultiply before shrinking. See
 	 * https://github.com/jcupitt/libvips/issues/291
@@ -415,8 +809,27 @@ vips_thumbnail_build( VipsObject *object )
 	vips_thumbnail_calculate_shrink( thumbnail, 
 		in->Xsize, in->Ysize, &hshrink, &vshrink );
 
+	/* The fast path does as much as it can with a block shrink, then
+	 * finishes off with a linear reduce.
+	 */
+	if( thumbnail->fast &&
+		(hshrink >= 2 || vshrink >= 2) ) {
+		int int_hshrink = VIPS_MAX( 1, VIPS_FLOOR( hshrink ) );
+		int int_vshrink = VIPS_MAX( 1, VIPS_FLOOR( vshrink ) );
+
+		g_info( "block shrink by %d x %d", int_hshrink, int_vshrink );
+		if( vips_shrink( in, &t[13], int_hshrink, int_vshrink, NULL ) )
+			return( -1 );
+		in = t[13];
+
+		vips_thumbnail_calculate_shrink( thumbnail,
+			in->Xsize, in->Ysize, &hshrink, &vshrink );
+	}
+
 	if( vips_resize( in, &t[4], 1.0 / hshrink, 
 		"vscale", 1.0 / vshrink, 
+		"kernel", thumbnail->fast ?
+			VIPS_KERNEL_LINEAR : VIPS_KERNEL_LANCZOS3,
 		NULL ) ) 
 		return( -1 );
 	in = t[4];
@@ -429,6 +842,15 @@ vips_thumbnail_build( VipsObject *object )
 		in = t[6];
 	}
 
+	if( have_linear16 ) {
+		g_info( "converting to sRGB" );
+		if( vips_scRGB2sRGB( in, &t[12],
+			"depth", device == VIPS_INTERPRETATION_RGB16 ? 16 : 8,
+			NULL ) )
+			return( -1 );
+		in = t[12];
+	}
+
 	/* Colour management.
 	 *
 	 * If we've already imported, just export. Otherwise, we're in 
@@ -606,6 +1028,27 @@ vips_thumbnail_class_init( VipsThumbnailClass *class )
 		G_STRUCT_OFFSET( VipsThumbnail, intent ),
 		VIPS_TYPE_INTENT, VIPS_INTENT_RELATIVE );
 
+	VIPS_ARG_ENUM( class, "quality", 121,
+		_( "Quality" ),
+		_( "Trade quality for speed" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsThumbnail, quality ),
+		VIPS_TYPE_THUMBNAIL_QUALITY, VIPS_THUMBNAIL_QUALITY_HIGH );
+
+	VIPS_ARG_BOOL( class, "embedded", 122,
+		_( "Embedded" ),
+		_( "Use the EXIF thumbnail if it is large enough" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsThumbnail, embedded ),
+		FALSE );
+
+	VIPS_ARG_BOOL( class, "embedded_only", 123,
+		_( "Embedded only" ),
+		_( "Only use the EXIF thumbnail, never decode the image" ),
+		VIPS_ARGUMENT_OPTIONAL_INPUT,
+		G_STRUCT_OFFSET( VipsThumbnail, embedded_only ),
+		FALSE );
+
 }
 
 static void
@@ -615,6 +1058,7 @@ vips_thumbnail_init( VipsThumbnail *thumbnail )
 	thumbnail->height = 1;
 	thumbnail->auto_rotate = TRUE;
 	thumbnail->intent = VIPS_INTENT_RELATIVE;
+	thumbnail->quality = VIPS_THUMBNAIL_QUALITY_HIGH;
 }
 
 typedef struct _VipsThumbnailFile {
@@ -647,8 +1091,15 @@ vips_thumbnail_file_get_info( VipsThumbnail *thumbnail )
 	thumbnail->input_height = image->Ysize;
 	thumbnail->angle = vips_autorot_get_angle( image );
 
+	if( vips_isprefix( "VipsForeignLoadOpenslide", thumbnail->loader ) )
+		vips_thumbnail_get_openslide_levels( thumbnail, image );
+	vips_thumbnail_get_embedded( thumbnail, image );
+
 	g_object_unref( image );
 
+	if( vips_isprefix( "VipsForeignLoadTiff", thumbnail->loader ) )
+		vips_thumbnail_get_tiff_pyramid( thumbnail );
+
 	return( 0 );
 }
 
@@ -665,7 +1116,20 @@ vips_thumbnail_file_open( VipsThumbnail *thumbnail, int shrink, double scale )
 	 */
 	g_assert( shrink == 1 || scale == 1.0 );
 
-	if( shrink != 1 ) 
+	if( thumbnail->level > 0 ) {
+		if( vips_isprefix( "VipsForeignLoadOpenslide",
+			thumbnail->loader ) )
+			return( vips_image_new_from_file( file->filename,
+				"access", VIPS_ACCESS_SEQUENTIAL,
+				"level", thumbnail->level,
+				NULL ) );
+		else
+			return( vips_image_new_from_file( file->filename,
+				"access", VIPS_ACCESS_SEQUENTIAL,
+				"page", thumbnail->level,
+				NULL ) );
+	}
+	else if( shrink != 1 )
 		return( vips_image_new_from_file( file->filename, 
 			"access", VIPS_ACCESS_SEQUENTIAL,
 			"shrink", shrink,
@@ -728,6 +1192,9 @@ vips_thumbnail_file_init( VipsThumbnailFile *file )
  * * @import_profile: %gchararray, fallback import ICC profile
  * * @export_profile: %gchararray, export ICC profile
  * * @intent: #VipsIntent, rendering intent
+ * * @quality: #VipsThumbnailQuality, trade quality for speed
+ * * @embedded: %gboolean, use the EXIF thumbnail if it is large enough
+ * * @embedded_only: %gboolean, only use the EXIF thumbnail
  *
  * Make a thumbnail from a file. Shrinking is done in three stages: using any
  * shrink-on-load features available in the file import library, using a block
@@ -761,7 +1228,8 @@ vips_thumbnail_file_init( VipsThumbnailFile *file )
  * Shrinking is normally done in sRGB colourspace. Set @linear to shrink in 
  * linear light colourspace instead. This can give better results, but can
  * also be far slower, since tricks like JPEG shrink-on-load cannot be used in
- * linear space.
+ * linear space. sRGB images with no profile are shrunk in 16-bit linear
+ * light, which keeps the extra cost down.
  *
  * If you set @export_profile to the filename of an ICC profile, the image 
  * will be transformed to the target colourspace before writing to the 
@@ -772,6 +1240,23 @@ vips_thumbnail_file_init( VipsThumbnailFile *file )
  * Use @intent to set the rendering intent for any ICC transform. The default
  * is #VIPS_INTENT_RELATIVE.
  *
+ * Set @quality to #VIPS_THUMBNAIL_QUALITY_FAST to trade quality for speed.
+ * Linear light processing is turned off, shrink-on-load is used as far as it
+ * will go, as much as possible is done with a block shrink, and the final
+ * reduce uses #VIPS_KERNEL_LINEAR. #VIPS_THUMBNAIL_QUALITY_AUTO uses the fast
+ * path only for small thumbnails of large images, where the difference is
+ * hard to see. The default is #VIPS_THUMBNAIL_QUALITY_HIGH.
+ *
+ * Set @embedded to use the thumbnail in the EXIF block, if there is one,
+ * instead of decoding the main image. It's only used if it is at least as
+ * large as the target, has the same aspect ratio, and the main image is
+ * sRGB with no ICC profile. The EXIF orientation of the main image is
+ * applied to it. This is very fast for small previews of camera images.
+ *
+ * Set @embedded_only to always use the EXIF thumbnail, whatever its size,
+ * and never touch the main image data. The call fails if there is no EXIF
+ * thumbnail.
+ *
  * See also: vips_thumbnail_buffer().
  *
  * Returns: 0 on success, -1 on error.
@@ -820,9 +1305,13 @@ vips_thumbnail_buffer_get_info( VipsThumbnail *thumbnail )
 	thumbnail->input_width = image->Xsize;
 	thumbnail->input_height = image->Ysize;
 	thumbnail->angle = vips_autorot_get_angle( image );
+	vips_thumbnail_get_embedded( thumbnail, image );
 
 	g_object_unref( image );
 
+	if( vips_isprefix( "VipsForeignLoadTiff", thumbnail->loader ) )
+		vips_thumbnail_get_tiff_pyramid( thumbnail );
+
 	return( 0 );
 }
 
@@ -837,7 +1326,13 @@ vips_thumbnail_buffer_open( VipsThumbnail *thumbnail,
 
 	/* We can't use UNBUFERRED safely on very-many-core systems.
 	 */
-	if( shrink != 1 ) 
+	if( thumbnail->level > 0 )
+		return( vips_image_new_from_buffer(
+			buffer->buf->data, buffer->buf->length, "",
+			"access", VIPS_ACCESS_SEQUENTIAL,
+			"page", thumbnail->level,
+			NULL ) );
+	else if( shrink != 1 )
 		return( vips_image_new_from_buffer( 
 			buffer->buf->data, buffer->buf->length, "", 
 			"access", VIPS_ACCESS_SEQUENTIAL,
@@ -904,6 +1399,9 @@ vips_thumbnail_buffer_init( VipsThumbnailBuffer *buffer )
  * * @import_profile: %gchararray, fallback import ICC profile
  * * @export_profile: %gchararray, export ICC profile
  * * @intent: #VipsIntent, rendering intent
+ * * @quality: #VipsThumbnailQuality, trade quality for speed
+ * * @embedded: %gboolean, use the EXIF thumbnail if it is large enough
+ * * @embedded_only: %gboolean, only use the EXIF thumbnail
  *
  * Exacty as vips_thumbnail(), but read from a memory buffer. 
  *
@@ -956,6 +1454,7 @@ vips_thumbnail_image_get_info( VipsThumbnail *thumbnail )
 	thumbnail->input_width = image->in->Xsize;
 	thumbnail->input_height = image->in->Ysize;
 	thumbnail->angle = vips_autorot_get_angle( image->in );
+	vips_thumbnail_get_embedded( thumbnail, image->in );
 
 	return( 0 );
 }
@@ -1019,6 +1518,9 @@ vips_thumbnail_image_init( VipsThumbnailImage *image )
  * * @import_profile: %gchararray, fallback import ICC profile
  * * @export_profile: %gchararray, export ICC profile
  * * @intent: #VipsIntent, rendering intent
+ * * @quality: #VipsThumbnailQuality, trade quality for speed
+ * * @embedded: %gboolean, use the EXIF thumbnail if it is large enough
+ * * @embedded_only: %gboolean, only use the EXIF thumbnail
  *
  * Exacty as vips_thumbnail(), but read from an existing image.
  *
@@ -1038,3 +1540,163 @@ vips_thumbnail_image( VipsImage *in, VipsImage **out, int width, ... )
 
 	return( result );
 }
+
+/* Make a smaller thumbnail from a larger one. Premultiply, as
+ * vips_thumbnail_build() does, and render to memory, so the next size down
+ * can be made from this one cheaply.
+ */
+static int
+vips_thumbnail_multi_reduce( VipsImage *in, VipsImage **out, double scale )
+{
+	VipsObject *context = VIPS_OBJECT( vips_image_new() );
+	VipsImage **t = (VipsImage **) vips_object_local_array( context, 4 );
+	gboolean have_alpha = vips_image_hasalpha( in );
+
+	VipsImage *x;
+
+	x = in;
+	if( have_alpha ) {
+		if( vips_premultiply( x, &t[0], NULL ) ) {
+			g_object_unref( context );
+			return( -1 );
+		}
+		x = t[0];
+	}
+
+	if( vips_resize( x, &t[1], scale, NULL ) ) {
+		g_object_unref( context );
+		return( -1 );
+	}
+	x = t[1];
+
+	if( have_alpha ) {
+		if( vips_unpremultiply( x, &t[2], NULL ) ||
+			vips_cast( t[2], &t[3], in->BandFmt, NULL ) ) {
+			g_object_unref( context );
+			return( -1 );
+		}
+		x = t[3];
+	}
+
+	if( !(*out = vips_image_copy_memory( x )) ) {
+		g_object_unref( context );
+		return( -1 );
+	}
+
+	g_object_unref( context );
+
+	return( 0 );
+}
+
+/**
+ * vips_thumbnail_multi:
+ * @filename: file to read from
+ * @out: (array length=n) (out): output images
+ * @sizes: (array length=n): target widths in pixels
+ * @n: number of thumbnails to make
+ * @...: %NULL-terminated list of optional named arguments
+ *
+ * Optional arguments:
+ *
+ * * @height: %gint, target height in pixels for the largest size
+ * * @size: #VipsSize, upsize, downsize, both or force
+ * * @auto_rotate: %gboolean, rotate upright using orientation tag
+ * * @crop: #VipsInteresting, shrink and crop to fill target
+ * * @linear: %gboolean, perform shrink in linear light
+ * * @import_profile: %gchararray, fallback import ICC profile
+ * * @export_profile: %gchararray, export ICC profile
+ * * @intent: #VipsIntent, rendering intent
+ * * @quality: #VipsThumbnailQuality, trade quality for speed
+ * * @embedded: %gboolean, use the EXIF thumbnail if it is large enough
+ * * @embedded_only: %gboolean, only use the EXIF thumbnail
+ *
+ * Make @n thumbnails of @filename, one for each width in @sizes, and set
+ * @out[i] to the thumbnail for @sizes[i].
+ *
+ * The file is opened and decoded once, with vips_thumbnail() and the
+ * optional arguments, to make the largest size. Each smaller size is then
+ * made from the next larger one with vips_resize(). This is much quicker
+ * than calling vips_thumbnail() once for each size.
+ *
+ * Each output scales the largest by @sizes[i] over the largest size, so with
+ * @height, @crop or @size all outputs have the same shape as the largest.
+ *
+ * The outputs are memory images. On error, all @out are %NULL.
+ *
+ * See also: vips_thumbnail().
+ *
+ * Returns: 0 on success, -1 on error.
+ */
+int
+vips_thumbnail_multi( const char *filename, VipsImage **out,
+	const int *sizes, int n, ... )
+{
+	va_list ap;
+	int *order;
+	VipsImage *t;
+	int result;
+	int i, j;
+
+	if( n < 1 ) {
+		vips_error( "thumbnail_multi", "%s", _( "no sizes" ) );
+		return( -1 );
+	}
+	for( i = 0; i < n; i++ ) {
+		if( sizes[i] < 1 ) {
+			vips_error( "thumbnail_multi",
+				"%s", _( "bad size" ) );
+			return( -1 );
+		}
+		out[i] = NULL;
+	}
+
+	/* Indexes of sizes, largest first.
+	 */
+	if( !(order = VIPS_ARRAY( NULL, n, int )) )
+		return( -1 );
+	for( i = 0; i < n; i++ ) {
+		for( j = i; j > 0 && sizes[order[j - 1]] < sizes[i]; j-- )
+			order[j] = order[j - 1];
+		order[j] = i;
+	}
+
+	va_start( ap, n );
+	result = vips_call_split( "thumbnail", ap,
+		filename, &t, sizes[order[0]] );
+	va_end( ap );
+	if( result ) {
+		VIPS_FREE( order );
+		return( -1 );
+	}
+
+	/* Render the largest once, everything else comes from this.
+	 */
+	out[order[0]] = vips_image_copy_memory( t );
+	g_object_unref( t );
+	if( !out[order[0]] ) {
+		VIPS_FREE( order );
+		return( -1 );
+	}
+
+	for( i = 1; i < n; i++ ) {
+		int larger = order[i - 1];
+		int smaller = order[i];
+
+		if( sizes[smaller] == sizes[larger] ) {
+			g_object_ref( out[larger] );
+			out[smaller] = out[larger];
+		}
+		else if( vips_thumbnail_multi_reduce( out[larger],
+			&out[smaller],
+			(double) sizes[smaller] / sizes[larger] ) ) {
+			for( j = 0; j < n; j++ )
+				VIPS_UNREF( out[j] );
+			VIPS_FREE( order );
+			return( -1 );
+		}
+	}
+
+	VIPS_FREE( order );
+
+	return( 0 );
+}
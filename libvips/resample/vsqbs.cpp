@@ -3,6 +3,9 @@
  * C. Racette 23-28/05/2010 based on code by N. Robidoux and J. Cupitt
  *
  * N. Robidoux 29-30/05/2010
+ *
+ * 14/10/18
+ * 	- add a span method
  */
 
 /*
@@ -395,6 +398,95 @@ vips_interpolate_vsqbs_interpolate( VipsInterpolate* restrict interpolate,
   }
 }
 
+/*
+ * Interpolate a span: do the format switch once, then loop over the span
+ * with the inlined kernel.
+ */
+#define SPAN_CALL( T, conversion ) {                    \
+  for( i = 0; i < n; i++ ) {                            \
+    const int ix = (int) (x[i] + 0.5);                      \
+    const int iy = (int) (y[i] + 0.5);                      \
+                                                        \
+    g_assert( ix - 1 >= in->valid.left );               \
+    g_assert( iy - 1 >= in->valid.top );                \
+    g_assert( ix + 1 <= VIPS_RECT_RIGHT( &in->valid ) ); \
+    g_assert( iy + 1 <= VIPS_RECT_BOTTOM( &in->valid ) ); \
+                                                        \
+    vsqbs_ ## conversion<T>( q,                          \
+                            VIPS_REGION_ADDR( in, ix, iy ), \
+                            bands,                      \
+                            lskip,                      \
+                            x[i] - ix,                  \
+                            y[i] - iy );                \
+                                                        \
+    q += ps;                                            \
+  }                                                     \
+}
+
+static void
+vips_interpolate_vsqbs_interpolate_span( VipsInterpolate* restrict interpolate,
+                                         void*            restrict out,
+                                         VipsRegion*      restrict in,
+                                         const double*    restrict x,
+                                         const double*    restrict y,
+                                         int                       n )
+{
+  const int ps = VIPS_IMAGE_SIZEOF_PEL( in->im );
+  const int lskip = VIPS_REGION_LSKIP( in ) /
+	  VIPS_IMAGE_SIZEOF_ELEMENT( in->im );
+  const int actual_bands = in->im->Bands;
+  const int bands =
+    vips_band_format_iscomplex( in->im->BandFmt ) ?
+      2 * actual_bands : actual_bands;
+
+  VipsPel* restrict q = (VipsPel *) out;
+
+  int i;
+
+  switch( in->im->BandFmt ) {
+  case VIPS_FORMAT_UCHAR:
+    SPAN_CALL( unsigned char, nosign );
+    break;
+
+  case VIPS_FORMAT_CHAR:
+    SPAN_CALL( signed char, withsign );
+    break;
+
+  case VIPS_FORMAT_USHORT:
+    SPAN_CALL( unsigned short, nosign );
+    break;
+
+  case VIPS_FORMAT_SHORT:
+    SPAN_CALL( signed short, withsign );
+    break;
+
+  case VIPS_FORMAT_UINT:
+    SPAN_CALL( unsigned int, nosign );
+    break;
+
+  case VIPS_FORMAT_INT:
+    SPAN_CALL( signed int, withsign );
+    break;
+
+  /*
+   * Complex images are handled by doubling of bands.
+   */
+  case VIPS_FORMAT_FLOAT:
+  case VIPS_FORMAT_COMPLEX:
+    SPAN_CALL( float, fptypes );
+    break;
+
+  case VIPS_FORMAT_DOUBLE:
+  case VIPS_FORMAT_DPCOMPLEX:
+    SPAN_CALL( double, fptypes );
+    break;
+
+  default:
+    g_assert( 0 );
+    break;
+  }
+}
+
 static void
 vips_interpolate_vsqbs_class_init( VipsInterpolateVsqbsClass *klass )
 {
@@ -405,6 +497,8 @@ vips_interpolate_vsqbs_class_init( VipsInterpolateVsqbsClass *klass )
   object_class->description = _( "B-Splines with antialiasing smoothing" );
 
   interpolate_class->interpolate   = vips_interpolate_vsqbs_interpolate;
+  interpolate_class->interpolate_span =
+    vips_interpolate_vsqbs_interpolate_span;
   interpolate_class->window_size   = 4;
   interpolate_class->window_offset = 1;
 }
@@ -518,6 +518,105 @@ def vips_image_new_from_array(cls, array, scale = 1, offset = 0):
 
 setattr(Vips.Image, 'new_from_array', vips_image_new_from_array)
 
+# map vips formats to and from the typestr codes in the numpy array interface
+# (without the byte order character)
+format_to_typestr = {
+    Vips.BandFormat.UCHAR: 'u1',
+    Vips.BandFormat.CHAR: 'i1',
+    Vips.BandFormat.USHORT: 'u2',
+    Vips.BandFormat.SHORT: 'i2',
+    Vips.BandFormat.UINT: 'u4',
+    Vips.BandFormat.INT: 'i4',
+    Vips.BandFormat.FLOAT: 'f4',
+    Vips.BandFormat.DOUBLE: 'f8',
+    Vips.BandFormat.COMPLEX: 'c8',
+    Vips.BandFormat.DPCOMPLEX: 'c16'
+}
+typestr_to_format = dict((v, k) for k, v in format_to_typestr.items())
+
+native_byteorder = '<' if sys.byteorder == 'little' else '>'
+
+def _numpy_is_packed(interface):
+    """True if an array interface describes pixels we can wrap directly.
+
+    Bands and pixels must be packed and rows must step forwards by at least
+    a whole row. Negative or zero strides (flipped or broadcast views) and
+    stepped slices are not packed.
+    """
+    strides = interface.get('strides')
+    if strides is None:
+        return True
+
+    shape = interface['shape']
+    if len(shape) not in (2, 3):
+        # let new_from_numpy report the error
+        return True
+
+    itemsize = int(interface['typestr'][2:])
+    bands = shape[2] if len(shape) == 3 else 1
+
+    return strides[1] == itemsize * bands and \
+        (len(strides) == 2 or strides[2] == itemsize) and \
+        strides[0] >= itemsize * bands * shape[1]
+
+@classmethod
+def vips_image_new_from_numpy(cls, array):
+    """Create a new Image that shares memory with a numpy array.
+
+    The array must be 2D (height, width) or 3D (height, width, bands) and in
+    native byte order. Anything with an __array_interface__ will work.
+
+    If the pixels are packed, with rows in order top to bottom (padding
+    between rows is fine), they are not copied. The new image holds a
+    reference to array, so it will stay alive for as long as libvips needs
+    it, even if you drop your own reference. Don't write to array while the
+    image is in use.
+
+    Other layouts, such as flipped or transposed views, or slices with a
+    step, are copied with numpy.ascontiguousarray() first.
+    """
+    interface = array.__array_interface__
+    if not _numpy_is_packed(interface):
+        import numpy
+        array = numpy.ascontiguousarray(array)
+        interface = array.__array_interface__
+
+    shape = interface['shape']
+    typestr = interface['typestr']
+    ptr = interface['data'][0]
+
+    if len(shape) == 2:
+        height, width = shape
+        bands = 1
+    elif len(shape) == 3:
+        height, width, bands = shape
+    else:
+        raise Error('Unable to make image from array.',
+                    'Array must be 2D or 3D.')
+
+    if typestr[0] not in '|=' + native_byteorder or \
+            typestr[1:] not in typestr_to_format:
+        raise Error('Unable to make image from array.',
+                    'Unsupported type "%s".' % typestr)
+    format = typestr_to_format[typestr[1:]]
+    itemsize = int(typestr[2:])
+
+    # strides is None for C-contiguous arrays
+    stride = 0
+    strides = interface.get('strides')
+    if strides is not None:
+        stride = strides[0]
+
+    # pygobject holds a ref to array (the closure user data) until libvips
+    # calls the destroy notify, which happens when the image closes
+    def release(data, user_data):
+        return 0
+
+    return cls.new_from_memory_notify(ptr, stride, width, height, bands,
+                                      format, release, array)
+
+setattr(Vips.Image, 'new_from_numpy', vips_image_new_from_numpy)
+
 def generate_docstring(name):
     try:
         op = Vips.Operation.new(name)
@@ -674,6 +773,30 @@ class Image(Vips.Image):
 
     # we can use Vips.Image.write_to_memory() directly
 
+    @property
+    def __array_interface__(self):
+        """Expose the image pixels to numpy with no copy.
+
+        numpy.asarray(image) makes an array that points at the image memory.
+        Images which are not already in memory are rendered with
+        copy_memory() first, and the memory image is kept alive for as long
+        as self. The array has shape (height, width, bands).
+
+        The array is read-only, since libvips images can be shared, for
+        example by the operation cache. Use numpy.array(image) for a copy
+        you can write to.
+        """
+        memory = self.copy_memory()
+        if memory != self:
+            self._numpy_memory = memory
+
+        return {
+            'shape': (memory.height, memory.width, memory.bands),
+            'typestr': native_byteorder + format_to_typestr[memory.format],
+            'data': (memory.get_data(), True),
+            'version': 3
+        }
+
     # support with in the most trivial way
     def __enter__(self):
         return self
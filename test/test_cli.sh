@@ -16,6 +16,12 @@ if ! test -f $top_srcdir/tools/vips-$major.$minor; then
 	exit 1
 fi
 
+# every registered operation must have an entry in the lazy optable
+if ! $vips --check-optable; then
+	echo operation table in libvips/iofuncs/optable.c is out of date
+	exit 1
+fi
+
 # is a difference beyond a threshold? return 0 (meaning all ok) or 1 (meaning
 # error, or outside threshold)
 # 
@@ -42,6 +48,20 @@ test_difference() {
 	fi
 }
 
+# are two numbers within a threshold of each other?
+test_close() {
+	name=$1
+	value=$2
+	correct=$3
+	threshold=$4
+
+	diff=$(echo "d = $value - $correct; if (d < 0) d = -d; d" | bc -l)
+	if break_threshold $diff $threshold; then
+		echo "$name is $value, should be $correct"
+		exit 1
+	fi
+}
+
 test_rotate() {
 	im=$1
 	inter=$2
@@ -97,3 +117,195 @@ test_thumbnail "2000<" 2000 1500
 test_thumbnail "100x100>" 100 75
 test_thumbnail "2000>" 1024 768
 
+# vips_statistics() must give the same results as the separate operations
+test_statistics() {
+	im=$1
+
+	printf "testing statistics $(basename $im) ... "
+
+	set -- $($vips statistics $im --which all \
+		--avg --deviate --min --max --hist $tmp/hist.v)
+	test_close avg $1 $($vips avg $im) 0.000001
+	test_close deviate $2 $($vips deviate $im) 0.000001
+	test_close min $3 $($vips min $im) 0
+	test_close max $4 $($vips max $im) 0
+	$vips hist_find $im $tmp/t1.v
+	test_difference $tmp/t1.v $tmp/hist.v 0
+
+	echo "ok"
+}
+
+$vips extract_band $image $tmp/mono.v 1
+$vips linear $image $tmp/float.v 0.5 10
+test_statistics $image
+test_statistics $tmp/mono.v
+test_statistics $tmp/float.v
+
+# differencing the summed-area table from vips_integral() must give back the
+# original pixels exactly
+test_integral() {
+	im=$1
+
+	printf "testing integral $(basename $im) ... "
+
+	width=$($vipsheader -f width $im)
+	height=$($vipsheader -f height $im)
+	$vips integral $im $tmp/int.v
+	$vips extract_area $tmp/int.v $tmp/t1.v 1 1 $width $height
+	$vips extract_area $tmp/int.v $tmp/t2.v 0 1 $width $height
+	$vips extract_area $tmp/int.v $tmp/t3.v 1 0 $width $height
+	$vips extract_area $tmp/int.v $tmp/t4.v 0 0 $width $height
+	$vips subtract $tmp/t1.v $tmp/t2.v $tmp/t5.v
+	$vips subtract $tmp/t5.v $tmp/t3.v $tmp/t6.v
+	$vips add $tmp/t6.v $tmp/t4.v $tmp/t7.v
+	test_difference $im $tmp/t7.v 0
+
+	echo "ok"
+}
+
+test_integral $image
+test_integral $tmp/mono.v
+
+# getpoints returns one row per point and one column per band ... points are
+# given in reverse so we check they come back in the order asked for, even 
+# though they are read tile by tile
+test_getpoints() {
+	im=$1
+
+	printf "testing getpoints $(basename $im) ... "
+
+	points=""
+	for x in 1000 900 800 700 600 500 400 300 200 100 0; do
+		points="$points $x 300"
+	done
+	$vips getpoints $im $tmp/after.v "$points"
+	$vips extract_area $im $tmp/t1.v 0 300 1001 1
+	$vips subsample $tmp/t1.v $tmp/t2.v 100 1
+	$vips flip $tmp/t2.v $tmp/t3.v horizontal
+	$vips rot $tmp/t3.v $tmp/t4.v d90
+	$vips bandunfold $tmp/t4.v $tmp/before.v
+	test_difference $tmp/before.v $tmp/after.v 0
+
+	# with size 3, each point is the mean of a 3x3 block
+	points=""
+	for x in 1 4 7 10 13 16 19 22 25 28; do
+		points="$points $x 1"
+	done
+	$vips getpoints $im $tmp/after.v "$points" --size 3
+	$vips cast $im $tmp/t1.v float
+	$vips extract_area $tmp/t1.v $tmp/t2.v 0 0 30 3
+	$vips shrink $tmp/t2.v $tmp/t3.v 3 3
+	$vips rot $tmp/t3.v $tmp/t4.v d90
+	$vips bandunfold $tmp/t4.v $tmp/before.v
+	test_difference $tmp/before.v $tmp/after.v 0.001
+
+	echo "ok"
+}
+
+test_getpoints $image
+test_getpoints $tmp/mono.v
+
+# percentiles 0 and 100 are always exact, 8- and 16-bit images are exact
+# throughout, and float images must be within a rank error
+test_percentiles() {
+	im=$1
+
+	printf "testing percentiles $(basename $im) ... "
+
+	set -- $($vips percentiles $im "0 50 100")
+	min=$1
+	median=$2
+	max=$3
+	test_close min $min $($vips min $im) 0
+	test_close max $max $($vips max $im) 0
+
+	$vips cast $im $tmp/t1.v ushort
+	set -- $($vips percentiles $tmp/t1.v "0 50 100")
+	test_close "ushort min" $1 $min 0
+	test_close "ushort median" $2 $median 0
+	test_close "ushort max" $3 $max 0
+
+	$vips cast $im $tmp/t1.v float
+	set -- $($vips percentiles $tmp/t1.v "0 50 100")
+	test_close "float min" $1 $min 0
+	test_close "float median" $2 $median 1
+	test_close "float max" $3 $max 0
+
+	echo "ok"
+}
+
+test_percentiles $image
+test_percentiles $tmp/mono.v
+
+# insert_many must make the same image as a chain of inserts, including
+# overlaps, sub-images off the edges and expand ... with expand, a chained
+# insert at a negative position moves the origin, so only go off the right
+# and bottom edges
+test_insert_many() {
+	im=$1
+	n=$2
+	expand=$3
+
+	printf "testing insert_many $(basename $im) n = $n $expand ... "
+
+	$vips extract_area $im $tmp/sprite1.v 100 100 200 150
+	$vips rot $tmp/sprite1.v $tmp/sprite2.v d90
+	$vips extract_area $im $tmp/sprite3.v 500 400 17 9
+
+	margin=100
+	if [ -n "$expand" ]; then
+		margin=0
+	fi
+
+	$vips copy $im $tmp/before.v
+	subs=""
+	xs=""
+	ys=""
+	i=0
+	while [ $i -lt $n ]; do
+		sub=$tmp/sprite$((i % 3 + 1)).v
+		x=$((i * 137 % 1200 - margin))
+		y=$((i * 71 % 900 - margin))
+		subs="$subs $sub"
+		xs="$xs $x"
+		ys="$ys $y"
+		$vips insert $tmp/before.v $sub $tmp/t1.v $x $y $expand
+		mv $tmp/t1.v $tmp/before.v
+		i=$((i + 1))
+	done
+	$vips insert_many $im "$subs" $tmp/after.v "$xs" "$ys" $expand
+	test_difference $tmp/before.v $tmp/after.v 0
+
+	echo "ok"
+}
+
+test_insert_many $image 3
+test_insert_many $image 50
+test_insert_many $image 10 --expand
+
+# vipsthumbnail --widths makes each size with vips_thumbnail_multi() ... each
+# should be the same size as a plain --size thumbnail and look very similar
+test_thumbnail_widths() {
+	printf "testing thumbnail --widths ... "
+
+	cp $image $tmp/multi.jpg
+	$vipsthumbnail $tmp/multi.jpg --widths "400 100 200" -o tn_%s.v
+	for width in 400 200 100; do
+		$vipsthumbnail $tmp/multi.jpg -s $width -o tn_%s.v
+		for field in width height; do
+			before=$($vipsheader -f $field $tmp/tn_multi.v)
+			after=$($vipsheader -f $field $tmp/tn_multi-$width.v)
+			if [ $before -ne $after ]; then
+				echo "$field of width $width is $after, not $before"
+				exit 1
+			fi
+		done
+		$vips subtract $tmp/tn_multi.v $tmp/tn_multi-$width.v $tmp/t1.v
+		$vips abs $tmp/t1.v $tmp/t2.v
+		test_close "mean difference at $width" $($vips avg $tmp/t2.v) 0 2
+	done
+
+	echo "ok"
+}
+
+test_thumbnail_widths
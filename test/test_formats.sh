@@ -133,6 +133,170 @@ test_raw() {
 	echo "ok"
 }
 
+# load and save via a source and target, check we get the same pixels as
+# the file versions of the same operations
+test_source() {
+	in=$1
+	format=$2
+
+	printf "testing $(basename $in) ${format}load_source ${format}save_target ... "
+
+	$vips ${format}save $in $tmp/t1.$format
+	$vips ${format}save_target $in $tmp/t2.$format
+	$vips ${format}load $tmp/t1.$format $tmp/before.v
+	$vips ${format}load_source $tmp/t2.$format $tmp/after.v
+
+	test_difference $tmp/before.v $tmp/after.v 0
+
+	echo "ok"
+}
+
+# save as a tiled .v file, then check random access to an area crossing tile
+# boundaries matches the same area of the source
+test_tiled_v() {
+	in=$1
+	tile_width=$2
+	tile_height=$3
+
+	printf "testing $(basename $in) tiled v ${tile_width}x${tile_height} ... "
+
+	$vips copy $in $tmp/before.v
+	$vips vipssave $in $tmp/t1.v \
+		--tile --tile-width $tile_width --tile-height $tile_height
+	test_difference $tmp/before.v $tmp/t1.v 0
+
+	$vips extract_area $tmp/before.v $tmp/t2.v 123 45 300 200
+	$vips extract_area $tmp/t1.v $tmp/t3.v 123 45 300 200
+	test_difference $tmp/t2.v $tmp/t3.v 0
+
+	echo "ok"
+}
+
+# force a load via a disc temp, with and without compression, and check
+# random access (rot reads the temp in tiles) gives the same pixels as a
+# load to memory
+test_disc_temp() {
+	in=$1
+
+	printf "testing $(basename $in) disc temp ... "
+
+	$vips rot $in $tmp/before.v d90
+	VIPS_DISC_THRESHOLD=0 $vips rot $in $tmp/t1.v d90
+	VIPS_DISC_THRESHOLD=0 VIPS_DISC_COMPRESS=1 $vips rot $in $tmp/t2.v d90
+	test_difference $tmp/before.v $tmp/t1.v 0
+	test_difference $tmp/before.v $tmp/t2.v 0
+
+	echo "ok"
+}
+
+# restart markers don't change the decoded pixels, so a jpeg saved with
+# restart_interval, perhaps encoded in parallel stripes, must decode to
+# exactly the same image as a plain serial save
+test_jpeg_restart() {
+	in=$1
+	interval=$2
+
+	printf "testing $(basename $in) jpeg restart_interval=$interval ... "
+
+	# big enough to split into several stripes
+	$vips replicate $in $tmp/t1.v 2 2
+	$vips jpegsave $tmp/t1.v $tmp/t2.jpg --optimize-coding
+	$vips jpegsave $tmp/t1.v $tmp/t3.jpg --restart-interval $interval
+	$vips --vips-concurrency=1 jpegsave $tmp/t1.v $tmp/t4.jpg \
+		--restart-interval $interval
+	$vips jpegload $tmp/t2.jpg $tmp/before.v
+	$vips jpegload $tmp/t3.jpg $tmp/after.v
+	test_difference $tmp/before.v $tmp/after.v 0
+	$vips jpegload $tmp/t4.jpg $tmp/after.v
+	test_difference $tmp/before.v $tmp/after.v 0
+
+	echo "ok"
+}
+
+# csv should round-trip float and double exactly, and a parallel load should
+# match a single-threaded one
+test_csv_float() {
+	in=$1
+
+	printf "testing $(basename $in) csv float and double ... "
+
+	$vips linear $in $tmp/t1.v 0.1 0.3
+	$vips cast $tmp/t1.v $tmp/t2.v double
+	$vips linear $tmp/t2.v $tmp/t3.v 1.7 0.01
+
+	$vips csvsave $tmp/t1.v $tmp/t1.csv
+	$vips csvload $tmp/t1.csv $tmp/t4.v
+	$vips cast $tmp/t4.v $tmp/after.v float
+	test_difference $tmp/t1.v $tmp/after.v 0
+
+	$vips csvsave $tmp/t3.v $tmp/t3.csv
+	$vips csvload $tmp/t3.csv $tmp/after.v
+	test_difference $tmp/t3.v $tmp/after.v 0
+
+	$vips --vips-concurrency=1 csvload $tmp/t3.csv $tmp/before.v
+	test_difference $tmp/before.v $tmp/after.v 0
+
+	echo "ok"
+}
+
+# lossless jpeg rotate and crop should match a rotate and crop of the decoded
+# image, to within IDCT rounding
+test_jpegtransform() {
+	in=$1
+	angle=$2
+
+	printf "testing $(basename $in) jpegtransform $angle ... "
+
+	$vips rot $in $tmp/before.v $angle
+	$vips jpegtransform $in $tmp/t1.jpg --angle $angle
+	$vips jpegload $tmp/t1.jpg $tmp/after.v
+	test_difference $tmp/before.v $tmp/after.v 2
+
+	# crop on an MCU boundary
+	$vips extract_area $tmp/before.v $tmp/t2.v 32 16 256 128
+	$vips jpegtransform $in $tmp/t1.jpg --angle $angle \
+		--left 32 --top 16 --width 256 --height 128
+	$vips jpegload $tmp/t1.jpg $tmp/after.v
+	test_difference $tmp/t2.v $tmp/after.v 2
+
+	echo "ok"
+}
+
+# png and gif shrink-on-load ... non-interlaced png does a block average,
+# interlaced png and gif pick every nth pixel
+test_shrink_on_load() {
+	in=$1
+	format=$2
+	shrink=$3
+	reduce=$4
+	threshold=$5
+
+	printf "testing $(basename $in) ${format}load shrink=$shrink ... "
+
+	$vips ${format}load $in $tmp/t1.v
+	$vips $reduce $tmp/t1.v $tmp/before.v $shrink $shrink
+	$vips ${format}load $in $tmp/after.v --shrink $shrink
+	test_difference $tmp/before.v $tmp/after.v $threshold
+
+	echo "ok"
+}
+
+# gifsave of an image with only a few colours should round-trip exactly,
+# since each colour gets its own palette entry
+test_gif_few_colours() {
+	in=$1
+
+	printf "testing $(basename $in) gifsave few colours ... "
+
+	$vips relational_const $in $tmp/before.v more 128
+	$vips gifsave $tmp/before.v $tmp/t1.gif
+	$vips gifload $tmp/t1.gif $tmp/t2.v
+	$vips extract_band $tmp/t2.v $tmp/after.v 0 --n 3
+	test_difference $tmp/before.v $tmp/after.v 0
+
+	echo "ok"
+}
+
 # a format for which we only have a load (eg. matlab)
 # pass in a reference file as well and compare to that
 test_loader() {
@@ -186,6 +350,9 @@ test_supported() {
 }
 
 test_format $image v 0
+test_tiled_v $image 128 128
+test_tiled_v $image 96 40
+test_disc_temp $image
 if test_supported tiffload; then
 	test_format $image tif 0
 	test_format $image tif 90 [compression=jpeg]
@@ -201,6 +368,18 @@ fi
 if test_supported jpegload; then
 	test_format $image jpg 90
 fi
+if test_supported jpegload; then
+	test_jpeg_restart $image 1
+	test_jpeg_restart $image 7
+fi
+if test_supported jpegtransform; then
+	for angle in d0 d90 d180 d270; do
+		test_jpegtransform $image $angle
+	done
+fi
+if test_supported jpegload_source; then
+	test_source $image jpeg
+fi
 if test_supported webpload; then
 	test_format $image webp 90
 fi
@@ -212,6 +391,7 @@ fi
 
 # csv can only do mono
 test_format $mono csv 0
+test_csv_float $mono
 
 # cmyk jpg is a special path
 if test_supported jpegload; then
@@ -240,6 +420,22 @@ fi
 
 if test_supported gifload; then
 	test_loader $giflib_ref $giflib gifload 0
+	test_shrink_on_load $giflib gif 2 subsample 0
+	test_shrink_on_load $giflib gif 4 subsample 0
+fi
+
+if test_supported gifsave; then
+	test_gif_few_colours $image
+fi
+
+if test_supported pngload; then
+	$vips pngsave $image $tmp/shrink.png
+	$vips pngsave $image $tmp/shrink-interlace.png --interlace
+	for shrink in 2 4 8; do
+		test_shrink_on_load $tmp/shrink.png png $shrink shrink 1
+		test_shrink_on_load $tmp/shrink-interlace.png png $shrink \
+			subsample 0
+	done
 fi
 
 if test_supported matload; then
@@ -52,3 +52,23 @@ if ! $vipsheader $tmp/x.png > /dev/null 2>&1 ; then
 	exit 1
 fi
 echo "ok"
+
+printf "testing seq with many threads and a large skip ... "
+width=$($vipsheader -f width $huge)
+height=$($vipsheader -f height $huge)
+top=$((height * 3 / 4))
+rm -f $tmp/x.v $tmp/y.v
+$vips extract_area $huge $tmp/y.v 0 $top $width 500
+if ! VIPS_CONCURRENCY=32 $vips extract_area "$huge[access=sequential]" \
+	$tmp/x.v 0 $top $width 500 ; then
+	echo "sequential extract_area failed"
+	exit 1
+fi
+$vips subtract $tmp/x.v $tmp/y.v $tmp/diff.v
+$vips abs $tmp/diff.v $tmp/abs.v
+max=$($vips max $tmp/abs.v)
+if [ $(echo "$max > 0" | bc) -eq 1 ]; then
+	echo "sequential extract_area differs, max == $max"
+	exit 1
+fi
+echo "ok"
@@ -42,6 +42,9 @@
  * 	- parse options in two passes (thanks Haida)
  * 26/11/17
  * 	- remove throw() decls, they are now deprecated everywhere
+ * 14/10/18
+ * 	- add "pipe" action
+ * 	- register all operations before listing
  */
 
 /*
@@ -166,6 +169,21 @@ parse_main_option_list( const gchar *option_name, const gchar *value,
 	exit( 0 );
 }
 
+/* Check the optable in libvips/iofuncs/optable.c against the set of
+ * operations that actually registered. Run by test/test_cli.sh.
+ */
+static gboolean
+parse_main_option_check_optable( const gchar *option_name, 
+	const gchar *value, gpointer data, GError **error )
+{
+	if( vips__optable_check() ) {
+		fprintf( stderr, "%s", vips_error_buffer() );
+		exit( 1 );
+	}
+
+	exit( 0 );
+}
+
 static GOptionEntry main_option[] = {
 	{ "list", 'l', G_OPTION_FLAG_OPTIONAL_ARG, G_OPTION_ARG_CALLBACK, 
 		(GOptionArgFunc) parse_main_option_list, 
@@ -176,6 +194,11 @@ static GOptionEntry main_option[] = {
 		N_( "PLUGIN" ) },
 	{ "version", 'v', 0, G_OPTION_ARG_NONE, &main_option_version, 
 		N_( "print version" ), NULL },
+	{ "check-optable", 0, 
+		G_OPTION_FLAG_HIDDEN | G_OPTION_FLAG_NO_ARG, 
+		G_OPTION_ARG_CALLBACK, 
+		(GOptionArgFunc) parse_main_option_check_optable, 
+		N_( "check the operation table" ), NULL },
 	{ NULL }
 };
 
@@ -244,6 +267,10 @@ list_function( im_function *func )
 static int
 print_list( int argc, char **argv )
 {
+	/* We look up class names with g_type_from_name() below.
+	 */
+	vips_operation_init_all();
+
 	if( !argv[0] || strcmp( argv[0], "packages" ) == 0 ) 
 		im_map_packages( (VSListMap2Fn) list_package, NULL );
 	else if( strcmp( argv[0], "classes" ) == 0 ) 
@@ -982,6 +1009,338 @@ print_help( int argc, char **argv )
 	return( 0 );
 }
 
+/* "vips pipe" runs a chain of operations in one process. Stages are
+ * separated by "|" and image outputs are passed down the chain, so nothing
+ * is computed until the final save. For example:
+ *
+ * 	vips pipe "k2.jpg | resize _ 0.5 | sharpen _ | x.jpg"
+ *
+ * "_" marks an input image which should come from the previous stage. A
+ * stage which is just a filename is a load (if it's first) or a save (if
+ * it's last). Optional arguments are given as "--name=value". Scripts can
+ * have one stage per line, with "#" comments.
+ */
+
+static char *pipe_script = NULL;
+
+static GOptionEntry pipe_options[] = {
+	{ "script", 's', 0,
+		G_OPTION_ARG_FILENAME, &pipe_script,
+		N_( "read pipeline from FILE" ),
+		N_( "FILE" ) },
+	{ NULL }
+};
+
+typedef struct _PipeStage {
+	const char *nickname;
+	char **token;
+	int n_tokens;
+	int i;
+
+	/* The image from the previous stage, and our result.
+	 */
+	VipsImage *in;
+	VipsImage *out;
+} PipeStage;
+
+static void *
+pipe_stage_input( VipsObject *object,
+	GParamSpec *pspec,
+	VipsArgumentClass *argument_class,
+	VipsArgumentInstance *argument_instance,
+	void *a, void *b )
+{
+	PipeStage *stage = (PipeStage *) a;
+	const char *name = g_param_spec_get_name( pspec );
+	const char *token;
+
+	if( !(argument_class->flags & VIPS_ARGUMENT_REQUIRED) ||
+		!(argument_class->flags & VIPS_ARGUMENT_CONSTRUCT) ||
+		(argument_class->flags & VIPS_ARGUMENT_DEPRECATED) ||
+		!(argument_class->flags & VIPS_ARGUMENT_INPUT) )
+		return( NULL );
+
+	if( stage->i >= stage->n_tokens ) {
+		vips_error( stage->nickname, "%s", _( "too few arguments" ) );
+		return( pspec );
+	}
+	token = stage->token[stage->i++];
+
+	if( strcmp( token, "_" ) == 0 ) {
+		if( !stage->in ||
+			G_PARAM_SPEC_VALUE_TYPE( pspec ) != VIPS_TYPE_IMAGE ) {
+			vips_error( stage->nickname,
+				_( "no image to pipe to \"%s\"" ), name );
+			return( pspec );
+		}
+
+		g_object_set( object, name, stage->in, NULL );
+	}
+	else if( vips_object_set_argument_from_string( object, name, token ) )
+		return( pspec );
+
+	return( NULL );
+}
+
+static void *
+pipe_stage_output( VipsObject *object,
+	GParamSpec *pspec,
+	VipsArgumentClass *argument_class,
+	VipsArgumentInstance *argument_instance,
+	void *a, void *b )
+{
+	PipeStage *stage = (PipeStage *) a;
+	const char *name = g_param_spec_get_name( pspec );
+
+	if( !(argument_class->flags & VIPS_ARGUMENT_REQUIRED) ||
+		!(argument_class->flags & VIPS_ARGUMENT_CONSTRUCT) ||
+		(argument_class->flags & VIPS_ARGUMENT_DEPRECATED) ||
+		!(argument_class->flags & VIPS_ARGUMENT_OUTPUT) )
+		return( NULL );
+
+	/* The first image output goes on down the pipe, other outputs are
+	 * printed.
+	 */
+	if( G_PARAM_SPEC_VALUE_TYPE( pspec ) == VIPS_TYPE_IMAGE ) {
+		if( !stage->out )
+			g_object_get( object, name, &stage->out, NULL );
+	}
+	else if( vips_object_argument_needsstring( object, name ) ) {
+		vips_error( stage->nickname,
+			_( "can't pipe output \"%s\"" ), name );
+		return( pspec );
+	}
+	else if( vips_object_get_argument_to_string( object, name, NULL ) )
+		return( pspec );
+
+	return( NULL );
+}
+
+static int
+pipe_stage_run( PipeStage *stage )
+{
+	VipsOperation *operation;
+	int i;
+
+	if( !(operation = vips_operation_new( stage->nickname )) )
+		return( -1 );
+
+	/* Set any "--name=value" optional args first.
+	 */
+	for( i = 0; i < stage->n_tokens; i++ )
+		if( vips_isprefix( "--", stage->token[i] ) ) {
+			char *name = g_strdup( stage->token[i] + 2 );
+			char *value;
+			int result;
+
+			if( (value = strchr( name, '=' )) )
+				*value++ = '\0';
+			result = vips_object_set_argument_from_string(
+				VIPS_OBJECT( operation ), name,
+				value ? value : "true" );
+			g_free( name );
+
+			if( result ) {
+				g_object_unref( operation );
+				return( -1 );
+			}
+
+			stage->token[i] = NULL;
+		}
+
+	/* Compact the remaining positional args.
+	 */
+	for( stage->i = 0, i = 0; i < stage->n_tokens; i++ )
+		if( stage->token[i] )
+			stage->token[stage->i++] = stage->token[i];
+	stage->n_tokens = stage->i;
+	stage->i = 0;
+
+	if( vips_argument_map( VIPS_OBJECT( operation ),
+		pipe_stage_input, stage, NULL ) ) {
+		g_object_unref( operation );
+		return( -1 );
+	}
+
+	if( stage->i < stage->n_tokens ) {
+		vips_error( stage->nickname, "%s", _( "too many arguments" ) );
+		g_object_unref( operation );
+		return( -1 );
+	}
+
+	if( vips_cache_operation_buildp( &operation ) ) {
+		vips_object_unref_outputs( VIPS_OBJECT( operation ) );
+		g_object_unref( operation );
+		return( -1 );
+	}
+
+	if( vips_argument_map( VIPS_OBJECT( operation ),
+		pipe_stage_output, stage, NULL ) ) {
+		VIPS_UNREF( stage->out );
+		vips_object_unref_outputs( VIPS_OBJECT( operation ) );
+		g_object_unref( operation );
+		return( -1 );
+	}
+
+	vips_object_unref_outputs( VIPS_OBJECT( operation ) );
+	g_object_unref( operation );
+
+	return( 0 );
+}
+
+/* Split a pipeline into stages. Stages are separated by "|" tokens or by
+ * newlines.
+ */
+static GSList *
+pipe_parse( const char *text )
+{
+	char **line;
+	GSList *stages;
+	int i, j;
+
+	line = g_strsplit( text, "\n", -1 );
+	stages = NULL;
+	for( i = 0; line[i]; i++ ) {
+		char **token;
+		int n_tokens;
+		GError *error = NULL;
+
+		g_strstrip( line[i] );
+		if( line[i][0] == '\0' ||
+			line[i][0] == '#' )
+			continue;
+
+		if( !g_shell_parse_argv( line[i],
+			&n_tokens, &token, &error ) ) {
+			vips_g_error( &error );
+			g_strfreev( line );
+			g_slist_free_full( stages,
+				(GDestroyNotify) g_strfreev );
+			return( NULL );
+		}
+
+		/* Break the line at each "|". We build each stage as a
+		 * NULL-terminated token list.
+		 */
+		for( j = 0; j < n_tokens; ) {
+			GPtrArray *stage = g_ptr_array_new();
+
+			for( ; j < n_tokens; j++ ) {
+				if( strcmp( token[j], "|" ) == 0 )
+					break;
+				g_ptr_array_add( stage, g_strdup( token[j] ) );
+			}
+			j += 1;
+
+			if( stage->len > 0 ) {
+				g_ptr_array_add( stage, NULL );
+				stages = g_slist_prepend( stages,
+					g_ptr_array_free( stage, FALSE ) );
+			}
+			else
+				g_ptr_array_free( stage, TRUE );
+		}
+
+		g_strfreev( token );
+	}
+	g_strfreev( line );
+
+	if( !stages )
+		vips_error( "pipe", "%s", _( "empty pipeline" ) );
+
+	return( g_slist_reverse( stages ) );
+}
+
+static int
+pipe_run( GSList *stages )
+{
+	VipsImage *image;
+	GSList *p;
+
+	image = NULL;
+	for( p = stages; p; p = p->next ) {
+		char **token = (char **) p->data;
+		int n_tokens = g_strv_length( token );
+
+		/* A bare filename is a load at the start, a save at the end.
+		 */
+		if( n_tokens == 1 &&
+			!vips_type_find( "VipsOperation", token[0] ) ) {
+			if( p == stages ) {
+				if( !(image = vips_image_new_from_file(
+					token[0], NULL )) )
+					return( -1 );
+				continue;
+			}
+			else if( !p->next &&
+				image ) {
+				int result;
+
+				result = vips_image_write_to_file( image,
+					token[0], NULL );
+				VIPS_UNREF( image );
+
+				return( result );
+			}
+		}
+
+		{
+			PipeStage stage = { 0 };
+
+			stage.nickname = token[0];
+			stage.token = token + 1;
+			stage.n_tokens = n_tokens - 1;
+			stage.in = image;
+
+			if( pipe_stage_run( &stage ) ) {
+				VIPS_UNREF( image );
+				return( -1 );
+			}
+
+			VIPS_UNREF( image );
+			image = stage.out;
+		}
+	}
+
+	if( image ) {
+		vips_error( "pipe", "%s", _( "pipeline result not saved" ) );
+		VIPS_UNREF( image );
+		return( -1 );
+	}
+
+	return( 0 );
+}
+
+static int
+print_pipe( int argc, char **argv )
+{
+	char *text;
+	GSList *stages;
+	int result;
+
+	if( pipe_script ) {
+		GError *error = NULL;
+
+		if( !g_file_get_contents( pipe_script, &text, NULL, &error ) ) {
+			vips_g_error( &error );
+			return( -1 );
+		}
+	}
+	else
+		text = g_strjoinv( " ", argv );
+
+	stages = pipe_parse( text );
+	g_free( text );
+	if( !stages )
+		return( -1 );
+
+	result = pipe_run( stages );
+
+	g_slist_free_full( stages, (GDestroyNotify) g_strfreev );
+
+	return( result );
+}
+
 /* All our built-in actions.
  */
 
@@ -1007,6 +1366,8 @@ static ActionEntry actions[] = {
 		&empty_options[0], print_cppdefs },
 	{ "links", N_( "generate links for vips/bin" ),
 		&empty_options[0], print_links },
+	{ "pipe", N_( "run a pipeline of operations in one process" ),
+		&pipe_options[0], print_pipe },
 	{ "help", N_( "list possible actions" ),
 		&empty_options[0], print_help },
 };
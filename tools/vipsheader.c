@@ -38,6 +38,9 @@
  * 	  functions, so "header" is now obsolete
  * 27/2/13
  * 	- convert to vips8 API
+ * 15/10/18
+ * 	- add --csv and --json batch modes, which probe files in parallel with
+ * 	  vips_foreign_probe()
  */
 
 /*
@@ -82,6 +85,8 @@
 
 static char *main_option_field = NULL;
 static gboolean main_option_all = FALSE;
+static gboolean main_option_csv = FALSE;
+static gboolean main_option_json = FALSE;
 
 static GOptionEntry main_option[] = {
 	{ "all", 'a', 0, G_OPTION_ARG_NONE, &main_option_all, 
@@ -90,6 +95,13 @@ static GOptionEntry main_option[] = {
 		N_( "print value of FIELD (\"getext\" reads extension block, "
 			"\"Hist\" reads image history)" ),
 		"FIELD" },
+	{ "csv", 0, 0, G_OPTION_ARG_NONE, &main_option_csv, 
+		N_( "probe files in parallel and print basic fields as CSV, "
+			"read filenames from stdin if none are given" ), NULL },
+	{ "json", 0, 0, G_OPTION_ARG_NONE, &main_option_json, 
+		N_( "probe files in parallel and print basic fields as JSON "
+			"lines, read filenames from stdin if none are given" ), 
+		NULL },
 	{ NULL }
 };
 
@@ -158,13 +170,202 @@ print_header( VipsImage *im, gboolean many )
 	return( 0 );
 }
 
+static int
+header_main( char **argv )
+{
+	int result;
+	int i;
+
+	result = 0;
+
+	for( i = 1; argv[i]; i++ ) {
+		VipsImage *im;
+
+		if( !(im = vips_image_new_from_file( argv[i], NULL )) ) {
+			print_error();
+			result = 1;
+		}
+
+		if( im && 
+			print_header( im, argv[2] != NULL ) ) {
+			print_error();
+			result = 1;
+		}
+
+		if( im )
+			g_object_unref( im );
+	}
+
+	return( result );
+}
+
+/* Batch mode state. Workers take the next filename with an atomic counter 
+ * and fill in the matching result. Results are printed in order at the end.
+ */
+typedef struct _Batch {
+	char **filenames;
+	int n;
+
+	volatile int next;
+
+	VipsForeignProbe *probe;
+
+	/* NULL on success, or the error message for this file.
+	 */
+	char **error;
+} Batch;
+
+static void *
+batch_worker( void *a )
+{
+	Batch *batch = (Batch *) a;
+
+	int i;
+
+	while( (i = g_atomic_int_add( &batch->next, 1 )) < batch->n ) 
+		if( vips_foreign_probe( batch->filenames[i], 
+			&batch->probe[i] ) ) {
+			batch->error[i] = g_strdup( vips_error_thread_buffer() );
+			vips_error_thread_clear();
+		}
+
+	return( NULL );
+}
+
+/* Quote a field for CSV, if necessary.
+ */
+static void
+print_csv_string( const char *str )
+{
+	const char *p;
+
+	if( !strpbrk( str, ",\"\r\n" ) ) {
+		printf( "%s", str );
+		return;
+	}
+
+	putchar( '"' );
+	for( p = str; *p; p++ ) {
+		if( *p == '"' )
+			putchar( '"' );
+		putchar( *p );
+	}
+	putchar( '"' );
+}
+
+static void
+print_json_string( const char *str )
+{
+	const char *p;
+
+	putchar( '"' );
+	for( p = str; *p; p++ ) 
+		if( *p == '"' || 
+			*p == '\\' ) 
+			printf( "\\%c", *p );
+		else if( (unsigned char) *p < 0x20 ) 
+			printf( "\\u%04x", (unsigned char) *p );
+		else
+			putchar( *p );
+	putchar( '"' );
+}
+
+static void
+print_batch( Batch *batch, int i )
+{
+	VipsForeignProbe *probe = &batch->probe[i];
+	const char *format = 
+		vips_enum_nick( VIPS_TYPE_BAND_FORMAT, probe->format );
+
+	if( main_option_json ) {
+		printf( "{\"filename\":" );
+		print_json_string( batch->filenames[i] );
+		printf( ",\"loader\":\"%s\",\"width\":%d,\"height\":%d,"
+			"\"bands\":%d,\"format\":\"%s\",\"orientation\":%d}\n",
+			probe->loader, probe->width, probe->height, 
+			probe->bands, format, probe->orientation );
+	}
+	else {
+		print_csv_string( batch->filenames[i] );
+		printf( ",%s,%d,%d,%d,%s,%d\n",
+			probe->loader, probe->width, probe->height, 
+			probe->bands, format, probe->orientation );
+	}
+}
+
+/* Probe many files in parallel. Filenames come from the command-line, or 
+ * from stdin, one per line, if there are none.
+ */
+static int
+batch_main( char **argv )
+{
+	GPtrArray *names;
+	Batch batch;
+	GThread **workers;
+	int n_workers;
+	int result;
+	int i;
+
+	names = g_ptr_array_new_with_free_func( g_free );
+	if( argv[1] )
+		for( i = 1; argv[i]; i++ )
+			g_ptr_array_add( names, g_strdup( argv[i] ) );
+	else {
+		char line[VIPS_PATH_MAX];
+
+		while( fgets( line, VIPS_PATH_MAX, stdin ) ) {
+			line[strcspn( line, "\r\n" )] = '\0';
+			if( line[0] )
+				g_ptr_array_add( names, g_strdup( line ) );
+		}
+	}
+
+	batch.filenames = (char **) names->pdata;
+	batch.n = names->len;
+	batch.next = 0;
+	batch.probe = g_new0( VipsForeignProbe, batch.n );
+	batch.error = g_new0( char *, batch.n );
+
+	n_workers = VIPS_CLIP( 1, vips_concurrency_get(), batch.n );
+	workers = g_new( GThread *, n_workers );
+	for( i = 0; i < n_workers; i++ )
+		if( !(workers[i] = vips_g_thread_new( "vipsheader", 
+			(GThreadFunc) batch_worker, &batch )) ) 
+			vips_error_exit( NULL );
+	for( i = 0; i < n_workers; i++ )
+		(void) vips_g_thread_join( workers[i] );
+	g_free( workers );
+
+	if( main_option_csv ) 
+		printf( "filename,loader,width,height,bands,format,"
+			"orientation\n" );
+
+	result = 0;
+	for( i = 0; i < batch.n; i++ ) 
+		if( batch.error[i] ) {
+			fprintf( stderr, "%s: %s", 
+				g_get_prgname(), batch.error[i] );
+			result = 1;
+		}
+		else
+			print_batch( &batch, i );
+
+	for( i = 0; i < batch.n; i++ ) 
+		g_free( batch.error[i] );
+	g_free( batch.error );
+	g_free( batch.probe );
+	g_ptr_array_free( names, TRUE );
+	vips_error_clear();
+
+	return( result );
+}
+
 int
 main( int argc, char *argv[] )
 {
 	GOptionContext *context;
 	GOptionGroup *main_group;
 	GError *error = NULL;
-	int i;
 	int result;
 
 	if( VIPS_INIT( argv[0] ) )
@@ -202,25 +403,11 @@ main( int argc, char *argv[] )
 
 	g_option_context_free( context );
 
-	result = 0;
-
-	for( i = 1; argv[i]; i++ ) {
-		VipsImage *im;
-
-		if( !(im = vips_image_new_from_file( argv[i], NULL )) ) {
-			print_error();
-			result = 1;
-		}
-
-		if( im && 
-			print_header( im, argv[2] != NULL ) ) {
-			print_error();
-			result = 1;
-		}
-
-		if( im )
-			g_object_unref( im );
-	}
+	if( main_option_csv ||
+		main_option_json ) 
+		result = batch_main( argv );
+	else
+		result = header_main( argv );
 
 	/* We don't free this on error exit, sadly.
 	 */
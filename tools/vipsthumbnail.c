@@ -96,6 +96,11 @@
  * 	- add --intent
  * 23/10/17
  * 	- --size Nx didn't work, argh ... thanks jrochkind 
+ * 14/10/18
+ * 	- add --quality
+ * 	- add --jobs, --stdin and --socket batch modes
+ * 15/10/26
+ * 	- add --widths, make several sizes with vips_thumbnail_multi()
  */
 
 #ifdef HAVE_CONFIG_H
@@ -109,6 +114,13 @@
 #include <stdlib.h>
 #include <locale.h>
 #include <ctype.h>
+#include <errno.h>
+
+#ifndef OS_WIN32
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif /*!OS_WIN32*/
 
 #include <vips/vips.h>
 #include <vips/internal.h>
@@ -120,6 +132,9 @@
 static char *thumbnail_size = "128";
 static int thumbnail_width = 128;
 static int thumbnail_height = 128;
+static char *thumbnail_widths = NULL;
+static int *widths = NULL;
+static int n_widths = 0;
 static VipsSize size_restriction = VIPS_SIZE_BOTH;
 static char *output_format = "tn_%s.jpg";
 static char *export_profile = NULL;
@@ -130,6 +145,12 @@ static gboolean crop_image = FALSE;
 static char *smartcrop_image = NULL;
 static gboolean rotate_image = FALSE;
 static char *thumbnail_intent = NULL;
+static char *thumbnail_quality = NULL;
+static int batch_jobs = 1;
+static int batch_threads = 0;
+static gboolean batch_stdin = FALSE;
+static char *batch_socket = NULL;
+static gboolean batch_timings = FALSE;
 
 /* Deprecated and unused.
  */
@@ -144,6 +165,10 @@ static GOptionEntry options[] = {
 		G_OPTION_ARG_STRING, &thumbnail_size, 
 		N_( "shrink to SIZE or to WIDTHxHEIGHT" ), 
 		N_( "SIZE" ) },
+	{ "widths", 'w', 0, 
+		G_OPTION_ARG_STRING, &thumbnail_widths, 
+		N_( "make one thumbnail for each of WIDTHS, eg. \"400 200\"" ), 
+		N_( "WIDTHS" ) },
 	{ "output", 'o', G_OPTION_FLAG_HIDDEN, 
 		G_OPTION_ARG_STRING, &output_format, 
 		N_( "set output to FORMAT" ), 
@@ -171,12 +196,34 @@ static GOptionEntry options[] = {
 		G_OPTION_ARG_STRING, &thumbnail_intent, 
 		N_( "ICC transform with INTENT" ), 
 		N_( "INTENT" ) },
+	{ "quality", 'q', 0,
+		G_OPTION_ARG_STRING, &thumbnail_quality,
+		N_( "trade quality for speed with QUALITY" ),
+		N_( "QUALITY" ) },
 	{ "rotate", 't', 0, 
 		G_OPTION_ARG_NONE, &rotate_image, 
 		N_( "auto-rotate" ), NULL },
 	{ "delete", 'd', 0, 
 		G_OPTION_ARG_NONE, &delete_profile, 
 		N_( "delete profile from exported image" ), NULL },
+	{ "jobs", 'j', 0,
+		G_OPTION_ARG_INT, &batch_jobs,
+		N_( "thumbnail N files at once" ),
+		N_( "N" ) },
+	{ "threads", 'T', 0,
+		G_OPTION_ARG_INT, &batch_threads,
+		N_( "use at most N threads per file" ),
+		N_( "N" ) },
+	{ "stdin", 'I', 0,
+		G_OPTION_ARG_NONE, &batch_stdin,
+		N_( "read filenames from stdin, one per line" ), NULL },
+	{ "socket", 'S', 0,
+		G_OPTION_ARG_FILENAME, &batch_socket,
+		N_( "stay resident and read filenames from socket PATH" ),
+		N_( "PATH" ) },
+	{ "timings", 'z', 0,
+		G_OPTION_ARG_NONE, &batch_timings,
+		N_( "report the time taken for each file" ), NULL },
 
 	{ "crop", 'c', G_OPTION_FLAG_HIDDEN, 
 		G_OPTION_ARG_NONE, &crop_image, 
@@ -200,10 +247,12 @@ static GOptionEntry options[] = {
 };
 
 /* Given (eg.) "/poop/somefile.png", write @im to the thumbnail name,
- * (eg.) "/poop/tn_somefile.jpg".
+ * (eg.) "/poop/tn_somefile.jpg". If @width is set, tag the name with it,
+ * (eg.) "/poop/tn_somefile-400.jpg".
  */
 static int
-thumbnail_write( VipsObject *process, VipsImage *im, const char *filename )
+thumbnail_write( VipsObject *process, VipsImage *im, const char *filename,
+	int width )
 {
 	char *file;
 	char *p;
@@ -217,6 +266,14 @@ thumbnail_write( VipsObject *process, VipsImage *im, const char *filename )
 	if( (p = strrchr( file, '.' )) ) 
 		*p = '\0';
 
+	if( width > 0 ) {
+		char *tagged;
+
+		tagged = g_strdup_printf( "%s-%d", file, width );
+		g_free( file );
+		file = tagged;
+	}
+
 	/* Don't use vips_snprintf(), we only want to optionally substitute a 
 	 * single %s.
 	 */
@@ -255,6 +312,7 @@ thumbnail_process( VipsObject *process, const char *filename )
 	VipsInteresting interesting;
 	VipsImage *image;
 	VipsIntent intent;
+	VipsThumbnailQuality quality;
 
 	interesting = VIPS_INTERESTING_NONE;
 	if( crop_image )
@@ -276,6 +334,44 @@ thumbnail_process( VipsObject *process, const char *filename )
 			return( -1 ); 
 		intent = n;
 	}
+	quality = VIPS_THUMBNAIL_QUALITY_HIGH;
+	if( thumbnail_quality ) {
+		int n;
+
+		if( (n = vips_enum_from_nick( "vipsthumbnail",
+			VIPS_TYPE_THUMBNAIL_QUALITY, thumbnail_quality )) < 0 )
+			return( -1 );
+		quality = n;
+	}
+
+	/* Several sizes from one decode. Each width is a square bounding box,
+	 * as with a plain --size.
+	 */
+	if( n_widths > 0 ) {
+		VipsImage **t = (VipsImage **) 
+			vips_object_local_array( process, n_widths );
+
+		int i;
+
+		if( vips_thumbnail_multi( filename, t, widths, n_widths, 
+			"size", size_restriction, 
+			"auto_rotate", rotate_image, 
+			"crop", interesting, 
+			"linear", linear_processing, 
+			"import_profile", import_profile, 
+			"export_profile", export_profile, 
+			"intent", intent, 
+			"quality", quality,
+			NULL ) )
+			return( -1 );
+
+		for( i = 0; i < n_widths; i++ ) 
+			if( thumbnail_write( process, t[i], filename, 
+				widths[i] ) )
+				return( -1 );
+
+		return( 0 );
+	}
 
 	if( vips_thumbnail( filename, &image, thumbnail_width, 
 		"height", thumbnail_height, 
@@ -286,10 +382,11 @@ thumbnail_process( VipsObject *process, const char *filename )
 		"import_profile", import_profile, 
 		"export_profile", export_profile, 
 		"intent", intent, 
+		"quality", quality,
 		NULL ) )
 		return( -1 );
 
-	if( thumbnail_write( process, image, filename ) ) {
+	if( thumbnail_write( process, image, filename, 0 ) ) {
 		g_object_unref( image ); 
 		return( -1 );
 	}
@@ -299,6 +396,218 @@ thumbnail_process( VipsObject *process, const char *filename )
 	return( 0 );
 }
 
+/* Batch mode: a set of worker threads take files from a queue and
+ * thumbnail them. Each job has a stream to report to.
+ */
+typedef struct _BatchJob {
+	char *filename;
+	FILE *out;
+} BatchJob;
+
+static GAsyncQueue *batch_queue = NULL;
+static GThread **batch_workers = NULL;
+
+/* Protects the counts, and serialises writes to the report streams.
+ */
+static GMutex *batch_lock = NULL;
+static GCond *batch_cond = NULL;
+static int batch_pending = 0;
+static int batch_failed = 0;
+
+/* Push this to stop a worker.
+ */
+static BatchJob batch_quit;
+
+static void
+batch_report( BatchJob *job, gboolean failed, double time )
+{
+	if( failed ) {
+		fprintf( stderr, "%s: unable to thumbnail %s\n",
+			g_get_prgname(), job->filename );
+		fprintf( stderr, "%s", vips_error_buffer() );
+		vips_error_clear();
+	}
+
+	if( job->out ) {
+		fprintf( job->out, "%s %.3f %s\n",
+			failed ? "FAIL" : "OK", time, job->filename );
+		fflush( job->out );
+	}
+}
+
+static void *
+batch_worker( void *data )
+{
+	GTimer *timer = g_timer_new();
+	BatchJob *job;
+
+	while( (job = g_async_queue_pop( batch_queue )) != &batch_quit ) {
+		/* Hang resources for processing this thumbnail off @process.
+		 */
+		VipsObject *process = VIPS_OBJECT( vips_image_new() );
+		gboolean failed;
+
+		g_timer_start( timer );
+		failed = thumbnail_process( process, job->filename ) != 0;
+		g_object_unref( process );
+
+		g_mutex_lock( batch_lock );
+		batch_report( job, failed, g_timer_elapsed( timer, NULL ) );
+		if( failed )
+			batch_failed += 1;
+		batch_pending -= 1;
+		g_cond_broadcast( batch_cond );
+		g_mutex_unlock( batch_lock );
+
+		g_free( job->filename );
+		g_free( job );
+	}
+
+	g_timer_destroy( timer );
+
+	return( NULL );
+}
+
+static void
+batch_start( void )
+{
+	int i;
+
+	batch_queue = g_async_queue_new();
+	batch_lock = vips_g_mutex_new();
+	batch_cond = vips_g_cond_new();
+	batch_workers = g_new0( GThread *, batch_jobs );
+	for( i = 0; i < batch_jobs; i++ )
+		batch_workers[i] = vips_g_thread_new( "vipsthumbnail",
+			batch_worker, NULL );
+}
+
+static void
+batch_add( const char *filename, FILE *out )
+{
+	BatchJob *job;
+
+	job = g_new( BatchJob, 1 );
+	job->filename = g_strdup( filename );
+	job->out = out;
+
+	g_mutex_lock( batch_lock );
+	batch_pending += 1;
+	g_mutex_unlock( batch_lock );
+
+	g_async_queue_push( batch_queue, job );
+}
+
+/* Wait for all queued files to finish.
+ */
+static void
+batch_wait( void )
+{
+	g_mutex_lock( batch_lock );
+	while( batch_pending > 0 )
+		g_cond_wait( batch_cond, batch_lock );
+	g_mutex_unlock( batch_lock );
+}
+
+static int
+batch_stop( void )
+{
+	int i;
+
+	for( i = 0; i < batch_jobs; i++ )
+		g_async_queue_push( batch_queue, &batch_quit );
+	for( i = 0; i < batch_jobs; i++ )
+		if( batch_workers[i] )
+			vips_g_thread_join( batch_workers[i] );
+
+	VIPS_FREE( batch_workers );
+	VIPS_FREEF( g_async_queue_unref, batch_queue );
+	VIPS_FREEF( vips_g_mutex_free, batch_lock );
+	VIPS_FREEF( vips_g_cond_free, batch_cond );
+
+	return( batch_failed ? -1 : 0 );
+}
+
+/* Queue a file for every line in @in, reporting to @out. Blank lines are
+ * skipped.
+ */
+static void
+batch_add_lines( FILE *in, FILE *out )
+{
+	char line[FILENAME_MAX];
+
+	while( fgets( line, FILENAME_MAX, in ) ) {
+		size_t len = strlen( line );
+
+		while( len > 0 &&
+			(line[len - 1] == '\n' ||
+			 line[len - 1] == '\r') )
+			line[--len] = '\0';
+		if( len > 0 )
+			batch_add( line, out );
+	}
+}
+
+#ifndef OS_WIN32
+/* Listen on a unix domain socket. Clients write filenames, one per line,
+ * then close their write side. They get a report line for each file, and
+ * the connection closes when their files are all done. We never return
+ * unless there's an error.
+ */
+static int
+batch_serve( const char *path )
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	memset( &addr, 0, sizeof( addr ) );
+	addr.sun_family = AF_UNIX;
+	if( strlen( path ) >= sizeof( addr.sun_path ) ) {
+		vips_error( "vipsthumbnail",
+			_( "socket path \"%s\" too long" ), path );
+		return( -1 );
+	}
+	vips_strncpy( addr.sun_path, path, sizeof( addr.sun_path ) );
+
+	(void) unlink( path );
+	if( (fd = socket( AF_UNIX, SOCK_STREAM, 0 )) < 0 ||
+		bind( fd, (struct sockaddr *) &addr, sizeof( addr ) ) ||
+		listen( fd, 16 ) ) {
+		vips_error_system( errno, "vipsthumbnail",
+			_( "unable to listen on \"%s\"" ), path );
+		if( fd >= 0 )
+			close( fd );
+		return( -1 );
+	}
+
+	for(;;) {
+		int client;
+		FILE *in;
+		FILE *out;
+
+		if( (client = accept( fd, NULL, NULL )) < 0 )
+			continue;
+
+		if( !(in = fdopen( client, "r" )) ) {
+			close( client );
+			continue;
+		}
+		if( !(out = fdopen( dup( client ), "w" )) ) {
+			fclose( in );
+			continue;
+		}
+
+		batch_add_lines( in, out );
+		batch_wait();
+
+		fclose( out );
+		fclose( in );
+	}
+
+	return( 0 );
+}
+#endif /*!OS_WIN32*/
+
 /* Parse a geometry string and set thumbnail_width and thumbnail_height.
  */
 static int
@@ -404,6 +713,50 @@ thumbnail_parse_geometry( const char *geometry )
 	return( 0 );
 }
 
+/* Parse a list of widths, eg. "400 200, 100", and set widths and n_widths.
+ */
+static int
+thumbnail_parse_widths( const char *str )
+{
+	const char *p;
+	int n;
+
+	/* Count the numbers, then parse them.
+	 */
+	n = 0;
+	for( p = str; *p; ) {
+		while( isspace( *p ) || *p == ',' )
+			p++;
+		if( !*p )
+			break;
+		if( !isdigit( *p ) ) {
+			vips_error( "thumbnail", "%s", _( "bad widths" ) ); 
+			return( -1 );
+		}
+		while( isdigit( *p ) )
+			p++;
+		n += 1;
+	}
+	if( n == 0 ) {
+		vips_error( "thumbnail", "%s", _( "bad widths" ) ); 
+		return( -1 );
+	}
+
+	widths = g_new( int, n );
+	n_widths = 0;
+	for( p = str; *p; ) {
+		while( isspace( *p ) || *p == ',' )
+			p++;
+		if( !*p )
+			break;
+		widths[n_widths++] = atoi( p );
+		while( isdigit( *p ) )
+			p++;
+	}
+
+	return( 0 );
+}
+
 int
 main( int argc, char **argv )
 {
@@ -456,6 +809,9 @@ main( int argc, char **argv )
 	if( thumbnail_size && 
 		thumbnail_parse_geometry( thumbnail_size ) )
 		vips_error_exit( NULL ); 
+	if( thumbnail_widths &&
+		thumbnail_parse_widths( thumbnail_widths ) )
+		vips_error_exit( NULL ); 
 
 #ifndef HAVE_EXIF
 	if( rotate_image ) 
@@ -466,24 +822,72 @@ main( int argc, char **argv )
 
 	result = 0;
 
-	for( i = 1; argv[i]; i++ ) {
-		/* Hang resources for processing this thumbnail off @process.
-		 */
-		VipsObject *process = VIPS_OBJECT( vips_image_new() ); 
-
-		if( thumbnail_process( process, argv[i] ) ) {
-			fprintf( stderr, "%s: unable to thumbnail %s\n", 
-				argv[0], argv[i] );
+	batch_jobs = VIPS_MAX( 1, batch_jobs );
+	if( batch_threads > 0 )
+		vips_concurrency_set( batch_threads );
+	else if( batch_jobs > 1 )
+		vips_concurrency_set(
+			VIPS_MAX( 1, vips_concurrency_get() / batch_jobs ) );
+
+	if( batch_jobs > 1 ||
+		batch_stdin ||
+		batch_socket ) {
+		FILE *out = batch_timings || batch_stdin ? stdout : NULL;
+
+		batch_start();
+
+		for( i = 1; argv[i]; i++ )
+			batch_add( argv[i], out );
+		if( batch_stdin )
+			batch_add_lines( stdin, stdout );
+		batch_wait();
+
+#ifndef OS_WIN32
+		if( batch_socket &&
+			batch_serve( batch_socket ) ) {
 			fprintf( stderr, "%s", vips_error_buffer() );
 			vips_error_clear();
-
-			/* We had a conversion failure: return an error code
-			 * when we finally exit.
-			 */
 			result = -1;
 		}
+#else /*OS_WIN32*/
+		if( batch_socket ) {
+			fprintf( stderr, "%s: %s\n", g_get_prgname(),
+				_( "--socket not supported on this platform" ) );
+			result = -1;
+		}
+#endif /*!OS_WIN32*/
 
-		g_object_unref( process );
+		if( batch_stop() )
+			result = -1;
+	}
+	else {
+		for( i = 1; argv[i]; i++ ) {
+			GTimer *timer = g_timer_new();
+
+			/* Hang resources for processing this thumbnail off
+			 * @process.
+			 */
+			VipsObject *process = VIPS_OBJECT( vips_image_new() );
+
+			if( thumbnail_process( process, argv[i] ) ) {
+				fprintf( stderr,
+					"%s: unable to thumbnail %s\n",
+					argv[0], argv[i] );
+				fprintf( stderr, "%s", vips_error_buffer() );
+				vips_error_clear();
+
+				/* We had a conversion failure: return an error
+				 * code when we finally exit.
+				 */
+				result = -1;
+			}
+			else if( batch_timings )
+				printf( "OK %.3f %s\n",
+					g_timer_elapsed( timer, NULL ), argv[i] );
+
+			g_object_unref( process );
+			g_timer_destroy( timer );
+		}
 	}
 
 	/* We don't free this on error exit, sadly.